@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) <2018> Intel Corporation
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "vmmapi.h"
+#include "atomic.h"
+#include "clock_page.h"
+
+static char vhm_clock_page[4096] __attribute__ ((aligned(4096)));
+
+/*
+ * Hand the clock page to the hypervisor. Without it (e.g. an old hypervisor
+ * or SOS kernel) all the RTC and PIT reads keep exiting to the DM.
+ */
+int
+clock_page_init(struct vmctx *ctx)
+{
+	struct vhm_clock_page *page = (struct vhm_clock_page *)&vhm_clock_page;
+
+	memset(page, 0, sizeof(*page));
+	ctx->clock_page = NULL;
+
+	/* the hypervisor fills in the TSC frequency */
+	if (vm_set_clock_page(ctx, (uint64_t)page) != 0 || page->tsc_khz == 0)
+		return -1;
+
+	ctx->clock_page = page;
+	return 0;
+}
+
+void
+clock_page_write_begin(uint32_t *seq)
+{
+	atomic_store(seq, *seq + 1);
+	atomic_thread_fence();
+}
+
+void
+clock_page_write_end(uint32_t *seq)
+{
+	atomic_thread_fence();
+	atomic_store(seq, *seq + 1);
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/queue.h>
+
+#include "atomic.h"
+#include "cpu_acct.h"
+
+bool cpu_acct_enabled;
+bool perf_thread_names;
+
+static __thread struct cpu_acct *cpu_acct_cur;
+
+/* the registered devices, for cpu_acct_get_by_index() */
+static TAILQ_HEAD(, cpu_acct) cpu_acct_list =
+	TAILQ_HEAD_INITIALIZER(cpu_acct_list);
+static pthread_mutex_t cpu_acct_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+void
+cpu_acct_set_current(struct cpu_acct *acct)
+{
+	cpu_acct_cur = acct;
+}
+
+struct cpu_acct *
+cpu_acct_current(void)
+{
+	return cpu_acct_cur;
+}
+
+void
+cpu_acct_register(struct cpu_acct *acct, const char *name)
+{
+	memset(acct, 0, sizeof(*acct));
+	snprintf(acct->name, sizeof(acct->name), "%s", name);
+
+	pthread_mutex_lock(&cpu_acct_mtx);
+	TAILQ_INSERT_TAIL(&cpu_acct_list, acct, link);
+	pthread_mutex_unlock(&cpu_acct_mtx);
+}
+
+void
+cpu_acct_unregister(struct cpu_acct *acct)
+{
+	pthread_mutex_lock(&cpu_acct_mtx);
+	TAILQ_REMOVE(&cpu_acct_list, acct, link);
+	pthread_mutex_unlock(&cpu_acct_mtx);
+}
+
+void
+dm_thread_setname(pthread_t tid, const char *name)
+{
+	struct cpu_acct *acct = cpu_acct_cur;
+	char tname[16];
+	clockid_t clock;
+	int i;
+
+	/* pthread_setname_np() fails on longer names */
+	snprintf(tname, sizeof(tname), "%s", name);
+	if (perf_thread_names) {
+		for (i = 0; tname[i] != '\0'; i++) {
+			if (tname[i] == ' ')
+				tname[i] = '-';
+			else if (tname[i] == ':')
+				tname[i] = '.';
+		}
+	}
+	pthread_setname_np(tid, tname);
+
+	if (acct == NULL || pthread_getcpuclockid(tid, &clock) != 0)
+		return;
+
+	pthread_mutex_lock(&cpu_acct_mtx);
+	if (acct->nthreads < CPU_ACCT_MAX_THREADS)
+		acct->clocks[acct->nthreads++] = clock;
+	pthread_mutex_unlock(&cpu_acct_mtx);
+}
+
+void
+cpu_acct_trap_end(struct cpu_acct *acct, uint64_t start)
+{
+	if (!cpu_acct_enabled)
+		return;
+	atomic_add_fetch(&acct->trap_ns, cpu_acct_now() - start);
+	atomic_add_fetch(&acct->traps, 1);
+}
+
+void
+cpu_acct_event_end(struct cpu_acct *acct, uint64_t start)
+{
+	if (!cpu_acct_enabled || acct == NULL)
+		return;
+	atomic_add_fetch(&acct->event_ns, cpu_acct_now() - start);
+	atomic_add_fetch(&acct->events, 1);
+}
+
+int
+cpu_acct_get_by_index(int index, char *name, size_t len,
+		      struct cpu_acct_stats *stats)
+{
+	struct cpu_acct *acct;
+	struct timespec ts;
+	int i, n = 0, ret = -1;
+
+	pthread_mutex_lock(&cpu_acct_mtx);
+	TAILQ_FOREACH(acct, &cpu_acct_list, link) {
+		if (n++ != index)
+			continue;
+
+		snprintf(name, len, "%s", acct->name);
+		stats->trap_ns = atomic_load(&acct->trap_ns);
+		stats->traps = atomic_load(&acct->traps);
+		stats->event_ns = atomic_load(&acct->event_ns);
+		stats->events = atomic_load(&acct->events);
+		stats->thread_ns = 0;
+		stats->nthreads = 0;
+		/* the clock of a thread that exited is gone, and with it its time */
+		for (i = 0; i < acct->nthreads; i++) {
+			if (clock_gettime(acct->clocks[i], &ts) != 0)
+				continue;
+			stats->thread_ns += ts.tv_sec * 1000000000UL + ts.tv_nsec;
+			stats->nthreads++;
+		}
+		ret = 0;
+		break;
+	}
+	pthread_mutex_unlock(&cpu_acct_mtx);
+
+	return ret;
+}
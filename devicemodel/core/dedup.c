@@ -0,0 +1,438 @@
+/*
+ * Copyright (C) <2018> Intel Corporation
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <openssl/sha.h>
+
+#include "dm.h"
+#include "vmmapi.h"
+#include "mem.h"
+#include "pci_core.h"
+#include "virtio.h"
+#include "balloon.h"
+#include "cpu_acct.h"
+#include "dm_string.h"
+#include "dedup.h"
+
+/*
+ * The unit of sharing is the hugepage: hugetlbfs gives no smaller page
+ * back to the SOS.
+ */
+#define DEDUP_CHUNK_SIZE	(2 * MB)
+#define DEDUP_INTERVAL		10	/* seconds between two scans */
+
+/* "acrn-dedup-" and the first half of the SHA-256 of the bytes in hex */
+#define DEDUP_NAME_LEN		48
+
+struct dedup_chunk {
+	unsigned char	digest[SHA256_DIGEST_LENGTH];	/* at the last scan */
+	bool		hashed;
+	bool		written;	/* by the DM or a vcpu since the scan */
+	int		fd;		/* of the shared file, -1 while private */
+};
+
+/*
+ * The lock is held while a chunk is shared or made private again, so that
+ * a write waits for the EPT and the mapping of the DM to agree.
+ */
+static struct {
+	struct vmctx		*ctx;
+	vm_paddr_t		gpa;
+	size_t			size;
+	int			interval;
+	int			nr_chunks;
+	struct dedup_chunk	*chunks;
+	int			nr_shared;
+	uint64_t		breaks;
+	pthread_mutex_t		mtx;
+	pthread_cond_t		cond;
+	pthread_t		tid;
+	bool			stop;
+	struct mem_range	mr;
+	bool			mr_registered;
+} dd = {
+	.mtx = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static bool dedup_configured;
+bool dedup_enabled;
+
+int
+dedup_parse(const char *opt)
+{
+	unsigned long gpa, size;
+	int interval = DEDUP_INTERVAL;
+	char *end;
+
+	if (dm_strtoul(opt, &end, 0, &gpa) != 0 || *end != ',')
+		return -1;
+	if (dm_strtoul(end + 1, &end, 0, &size) != 0)
+		return -1;
+	if (*end == ',' && (dm_strtoi(end + 1, &end, 0, &interval) != 0 ||
+			interval <= 0))
+		return -1;
+	if (*end != '\0' || size == 0 || gpa + size < gpa ||
+			((gpa | size) & (DEDUP_CHUNK_SIZE - 1)) != 0)
+		return -1;
+
+	dd.gpa = gpa;
+	dd.size = size;
+	dd.interval = interval;
+	dedup_configured = true;
+	return 0;
+}
+
+static void
+dedup_name(const unsigned char *digest, char *name)
+{
+	int i, n;
+
+	n = snprintf(name, DEDUP_NAME_LEN, "acrn-dedup-");
+	for (i = 0; i < SHA256_DIGEST_LENGTH / 2; i++)
+		n += snprintf(name + n, DEDUP_NAME_LEN - n, "%02x", digest[i]);
+}
+
+static inline vm_paddr_t
+dedup_chunk_gpa(int index)
+{
+	return dd.gpa + (vm_paddr_t)index * DEDUP_CHUNK_SIZE;
+}
+
+/* Map a chunk in the EPT again, from the mapping of the DM */
+static int
+dedup_remap(vm_paddr_t gpa, bool shared)
+{
+	uint64_t hva = (uint64_t)(dd.ctx->baseaddr + gpa);
+
+	/* the accesses in between come to dedup_mem_fault() */
+	if (vm_unmap_memseg_vma(dd.ctx, DEDUP_CHUNK_SIZE, gpa, hva) != 0)
+		return -errno;
+	if (vm_map_memseg_vma(dd.ctx, DEDUP_CHUNK_SIZE, gpa, hva,
+			shared ? (PROT_READ | PROT_EXEC) : PROT_ALL) != 0)
+		return -errno;
+	if (shared && vm_set_cow(dd.ctx, gpa, DEDUP_CHUNK_SIZE, true) != 0)
+		return -errno;
+	return 0;
+}
+
+/*
+ * Back a chunk, unchanged since the last scan, with the hugepage of the
+ * shared file of its bytes. With the lock and a balloon hold.
+ */
+static int
+dedup_share(struct dedup_chunk *c, vm_paddr_t gpa)
+{
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	char name[DEDUP_NAME_LEN];
+	int fd, err;
+
+	/* from here on, the writes of the vcpus wait for the lock */
+	if (vm_set_cow(dd.ctx, gpa, DEDUP_CHUNK_SIZE, true) != 0)
+		return -errno;
+
+	SHA256((unsigned char *)dd.ctx->baseaddr + gpa, DEDUP_CHUNK_SIZE,
+		digest);
+	if (memcmp(digest, c->digest, sizeof(digest)) != 0) {
+		memcpy(c->digest, digest, sizeof(digest));
+		err = -EAGAIN;
+		goto private;
+	}
+
+	dedup_name(digest, name);
+	fd = hugetlb_share_range(gpa, DEDUP_CHUNK_SIZE, name);
+	if (fd < 0) {
+		err = fd;
+		goto private;
+	}
+
+	err = dedup_remap(gpa, true);
+	if (err != 0) {
+		/* the hugepage of the VM is still there to copy back into */
+		hugetlb_unshare_range(gpa, DEDUP_CHUNK_SIZE, fd, name);
+		dedup_remap(gpa, false);
+		return err;
+	}
+
+	/* the VM has no use of its own copy any more */
+	hugetlb_release_range(gpa, DEDUP_CHUNK_SIZE);
+	c->fd = fd;
+	dd.nr_shared++;
+	return 0;
+
+private:
+	vm_set_cow(dd.ctx, gpa, DEDUP_CHUNK_SIZE, false);
+	return err;
+}
+
+/* Give the VM its own copy of a shared chunk again. With the lock. */
+static int
+dedup_unshare(struct dedup_chunk *c, vm_paddr_t gpa)
+{
+	char name[DEDUP_NAME_LEN];
+	int err;
+
+	dedup_name(c->digest, name);
+	err = hugetlb_unshare_range(gpa, DEDUP_CHUNK_SIZE, c->fd, name);
+	if (err != 0) {
+		fprintf(stderr, "dedup: no copy of 0x%lx: %s\n", gpa,
+			strerror(-err));
+		return err;
+	}
+
+	c->fd = -1;
+	dd.nr_shared--;
+	dd.breaks++;
+	return dedup_remap(gpa, false);
+}
+
+int
+dedup_write_range(vm_paddr_t gpa, size_t len)
+{
+	vm_paddr_t end = gpa + len;
+	struct dedup_chunk *c;
+	int i, err = 0;
+
+	if (len == 0 || end <= dd.gpa || gpa >= dd.gpa + dd.size)
+		return 0;
+	if (gpa < dd.gpa)
+		gpa = dd.gpa;
+
+	pthread_mutex_lock(&dd.mtx);
+	for (i = (gpa - dd.gpa) / DEDUP_CHUNK_SIZE;
+			i < dd.nr_chunks && dedup_chunk_gpa(i) < end; i++) {
+		c = &dd.chunks[i];
+		c->written = true;
+		if (c->fd >= 0 && err == 0)
+			err = dedup_unshare(c, dedup_chunk_gpa(i));
+	}
+	pthread_mutex_unlock(&dd.mtx);
+
+	return err;
+}
+
+/*
+ * On failure, the write of the vcpu comes again, like the accesses of the
+ * guest to the hugepages the virtio-balloon could not back again.
+ */
+int
+dedup_fault(vm_paddr_t gpa)
+{
+	if (!dedup_enabled || gpa < dd.gpa || gpa - dd.gpa >= dd.size)
+		return -EINVAL;
+
+	return dedup_write_range(gpa & ~(DEDUP_CHUNK_SIZE - 1), 1);
+}
+
+/*
+ * An access of the guest to a chunk out of its EPT while it is mapped
+ * again: do it through the mapping of the DM once the EPT is back.
+ */
+static int
+dedup_mem_fault(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
+	       int size, uint64_t *val, void *arg1, long arg2)
+{
+	char *hva = ctx->baseaddr + addr;
+
+	if (dir == MEM_F_WRITE) {
+		if (dedup_write_range(addr, size) != 0)
+			return -1;
+		memcpy(hva, val, size);
+	} else {
+		pthread_mutex_lock(&dd.mtx);
+		pthread_mutex_unlock(&dd.mtx);
+		*val = 0;
+		memcpy(val, hva, size);
+	}
+	return 0;
+}
+
+/* The rings of the virtio devices, which the DM writes all the time */
+static void
+dedup_ring(vm_paddr_t gpa, size_t len)
+{
+	dedup_write_range(gpa, len);
+}
+
+static void
+dedup_scan(void)
+{
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	struct dedup_chunk *c;
+	vm_paddr_t gpa;
+	bool scanned;
+	int i;
+
+	virtio_foreach_ring(dedup_ring);
+
+	for (i = 0; i < dd.nr_chunks; i++) {
+		c = &dd.chunks[i];
+		gpa = dedup_chunk_gpa(i);
+
+		/* reading a hugepage the balloon gave back would back it */
+		balloon_hold(true);
+		scanned = !balloon_released(gpa) && c->fd < 0;
+		if (scanned)
+			SHA256((unsigned char *)dd.ctx->baseaddr + gpa,
+				DEDUP_CHUNK_SIZE, digest);
+
+		pthread_mutex_lock(&dd.mtx);
+		if (!scanned || c->fd >= 0 || dd.stop) {
+			c->hashed = false;
+		} else if (c->hashed && !c->written &&
+				memcmp(digest, c->digest, sizeof(digest)) == 0) {
+			dedup_share(c, gpa);
+		} else {
+			memcpy(c->digest, digest, sizeof(digest));
+			c->hashed = true;
+		}
+		c->written = false;
+		pthread_mutex_unlock(&dd.mtx);
+		balloon_hold(false);
+
+		if (dd.stop)
+			break;
+	}
+}
+
+static void *
+dedup_thread(void *arg)
+{
+	struct timespec ts;
+	int nr_shared = 0;
+
+	pthread_mutex_lock(&dd.mtx);
+	while (!dd.stop) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += dd.interval;
+		pthread_cond_timedwait(&dd.cond, &dd.mtx, &ts);
+		if (dd.stop)
+			break;
+
+		pthread_mutex_unlock(&dd.mtx);
+		dedup_scan();
+		pthread_mutex_lock(&dd.mtx);
+
+		if (dd.nr_shared != nr_shared) {
+			nr_shared = dd.nr_shared;
+			printf("dedup: %d of %d hugepages shared, %lu copies\n",
+				nr_shared, dd.nr_chunks, dd.breaks);
+		}
+	}
+	pthread_mutex_unlock(&dd.mtx);
+
+	return NULL;
+}
+
+int
+dedup_init(struct vmctx *ctx)
+{
+	int i, err;
+
+	if (!dedup_configured)
+		return 0;
+
+	for (i = 0; i < dd.size / DEDUP_CHUNK_SIZE; i++) {
+		if (hugetlb_page_size(dedup_chunk_gpa(i)) != DEDUP_CHUNK_SIZE) {
+			fprintf(stderr, "dedup: 0x%lx is no guest memory of "
+				"2M hugepages\n", dedup_chunk_gpa(i));
+			return -EINVAL;
+		}
+	}
+
+	dd.chunks = calloc(dd.size / DEDUP_CHUNK_SIZE, sizeof(*dd.chunks));
+	if (dd.chunks == NULL)
+		return -ENOMEM;
+	dd.nr_chunks = dd.size / DEDUP_CHUNK_SIZE;
+	for (i = 0; i < dd.nr_chunks; i++)
+		dd.chunks[i].fd = -1;
+	dd.ctx = ctx;
+	dd.nr_shared = 0;
+	dd.breaks = 0;
+	dd.stop = false;
+
+	/*
+	 * Registering fails where the virtio-balloon has its own, which
+	 * handles the accesses as well.
+	 */
+	bzero(&dd.mr, sizeof(dd.mr));
+	dd.mr.name = "dedup";
+	dd.mr.flags = MEM_F_RW;
+	dd.mr.base = dd.gpa;
+	dd.mr.size = dd.size;
+	dd.mr.handler = dedup_mem_fault;
+	dd.mr_registered = (register_mem_fallback(&dd.mr) == 0);
+
+	dedup_enabled = true;
+	err = pthread_create(&dd.tid, NULL, dedup_thread, NULL);
+	if (err != 0) {
+		dedup_enabled = false;
+		dedup_deinit(ctx);
+		return -err;
+	}
+	dm_thread_setname(dd.tid, "dedup");
+	return 0;
+}
+
+void
+dedup_deinit(struct vmctx *ctx)
+{
+	char name[DEDUP_NAME_LEN];
+	int i;
+
+	if (dd.chunks == NULL)
+		return;
+
+	if (dedup_enabled) {
+		pthread_mutex_lock(&dd.mtx);
+		dd.stop = true;
+		pthread_cond_signal(&dd.cond);
+		pthread_mutex_unlock(&dd.mtx);
+		pthread_join(dd.tid, NULL);
+		dedup_enabled = false;
+	}
+
+	if (dd.mr_registered)
+		unregister_mem_fallback(&dd.mr);
+	dd.mr_registered = false;
+
+	/* the hugepages go once the guest memory is unmapped */
+	for (i = 0; i < dd.nr_chunks; i++) {
+		if (dd.chunks[i].fd < 0)
+			continue;
+		dedup_name(dd.chunks[i].digest, name);
+		hugetlb_drop_shared(dd.chunks[i].fd, name);
+	}
+	free(dd.chunks);
+	dd.chunks = NULL;
+	dd.nr_chunks = 0;
+}
+
+int
+dedup_reset(void)
+{
+	int i, err = 0;
+
+	if (!dedup_enabled)
+		return 0;
+
+	pthread_mutex_lock(&dd.mtx);
+	for (i = 0; i < dd.nr_chunks; i++) {
+		dd.chunks[i].hashed = false;
+		if (dd.chunks[i].fd >= 0 && err == 0)
+			err = dedup_unshare(&dd.chunks[i], dedup_chunk_gpa(i));
+	}
+	pthread_mutex_unlock(&dd.mtx);
+
+	return err;
+}
@@ -37,6 +37,9 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/file.h>
 
 #include "vmmapi.h"
 
@@ -89,6 +92,22 @@ struct hugetlb_info {
 	char *free_pages_path;
 };
 
+/* from <linux/mempolicy.h>, without depending on libnuma */
+#define MPOL_BIND		2
+#define PREFAULT_THREADS_MAX	16
+#define PREFAULT_AUTO_CHUNK	(256UL * 1024 * 1024)	/* per thread by default */
+
+/* see hugetlb_set_prefault(), 0 threads is one per PREFAULT_AUTO_CHUNK */
+static int prefault_threads = 0;
+static int prefault_node = -1;
+
+struct prefault_chunk {
+	pthread_t	thr;
+	char		*addr;
+	size_t		nr_pages;
+	size_t		pagesz;
+};
+
 static struct hugetlb_info hugetlb_priv[HUGETLB_LV_MAX] = {
 	{
 		.mounted = false,
@@ -124,6 +143,13 @@ static void *ptr;
 static size_t total_size;
 static int hugetlb_lv_max;
 
+/* lowmem, highmem and biosmem, each of them from up to every level */
+#define HUGETLB_REGIONS_MAX	(3 * HUGETLB_LV_MAX)
+
+/* the mappings of the guest memory, see hugetlb_get_regions() */
+static struct hugetlb_region hugetlb_regions[HUGETLB_REGIONS_MAX];
+static int hugetlb_nr_regions;
+
 static int open_hugetlbfs(struct vmctx *ctx, int level)
 {
 	char uuid_str[48];
@@ -213,6 +239,82 @@ static bool should_enable_hugetlb_level(int level)
 	        hugetlb_priv[level].highmem > 0);
 }
 
+int hugetlb_set_prefault(int threads, int node)
+{
+	if (threads < 1 || threads > PREFAULT_THREADS_MAX || node >= 64)
+		return -EINVAL;
+
+	prefault_threads = threads;
+	prefault_node = node;
+	return 0;
+}
+
+static void touch_pages(char *addr, size_t nr_pages, size_t pagesz)
+{
+	size_t i;
+
+	for (i = 0; i < nr_pages; i++) {
+		*(volatile char *)addr = *addr;
+		addr += pagesz;
+	}
+}
+
+static void *prefault_thread(void *arg)
+{
+	struct prefault_chunk *chunk = arg;
+
+	touch_pages(chunk->addr, chunk->nr_pages, chunk->pagesz);
+	return NULL;
+}
+
+/*
+ * Allocate the hugepages of [addr, addr + nr_pages * pagesz) by touching
+ * them, split among the prefault threads. The calling thread takes the
+ * first chunk, and the ones of the threads which fail to start.
+ */
+static void prefault_pages(char *addr, size_t nr_pages, size_t pagesz)
+{
+	struct prefault_chunk chunks[PREFAULT_THREADS_MAX];
+	size_t per_thread, n;
+	int i, nr_threads;
+	long cpus;
+
+	nr_threads = prefault_threads;
+	if (nr_threads == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nr_threads = (int)(nr_pages * pagesz / PREFAULT_AUTO_CHUNK);
+		if (nr_threads > cpus)
+			nr_threads = (int)cpus;
+		if (nr_threads > PREFAULT_THREADS_MAX)
+			nr_threads = PREFAULT_THREADS_MAX;
+		if (nr_threads < 1)
+			nr_threads = 1;
+	}
+	if ((size_t)nr_threads > nr_pages)
+		nr_threads = (nr_pages > 0) ? (int)nr_pages : 1;
+
+	per_thread = nr_pages / nr_threads;
+	for (i = 1; i < nr_threads; i++) {
+		n = (i == nr_threads - 1) ?
+			nr_pages - per_thread * (nr_threads - 1) : per_thread;
+		chunks[i].addr = addr + per_thread * i * pagesz;
+		chunks[i].nr_pages = n;
+		chunks[i].pagesz = pagesz;
+		if (pthread_create(&chunks[i].thr, NULL, prefault_thread,
+					&chunks[i]) != 0) {
+			touch_pages(chunks[i].addr, n, pagesz);
+			chunks[i].nr_pages = 0;
+		}
+	}
+
+	touch_pages(addr, per_thread, pagesz);
+
+	for (i = 1; i < nr_threads; i++) {
+		if (chunks[i].nr_pages > 0)
+			pthread_join(chunks[i].thr, NULL);
+	}
+}
+
 /*
  * level  : hugepage level
  * len	  : region length for mmap
@@ -224,7 +326,8 @@ static int mmap_hugetlbfs_from_level(struct vmctx *ctx, int level, size_t len,
 {
 	char *addr;
 	size_t pagesz = 0;
-	int fd, i;
+	unsigned long nodemask;
+	int fd;
 
 	if (level >= HUGETLB_LV_MAX) {
 		perror("exceed max hugetlb level");
@@ -239,15 +342,34 @@ static int mmap_hugetlbfs_from_level(struct vmctx *ctx, int level, size_t len,
 
 	printf("mmap 0x%lx@%p\n", len, addr);
 
+	if (hugetlb_nr_regions < HUGETLB_REGIONS_MAX) {
+		hugetlb_regions[hugetlb_nr_regions].gpa = offset;
+		hugetlb_regions[hugetlb_nr_regions].len = len;
+		hugetlb_regions[hugetlb_nr_regions].hva = addr;
+		hugetlb_regions[hugetlb_nr_regions].fd = fd;
+		hugetlb_regions[hugetlb_nr_regions].offset = skip;
+		hugetlb_regions[hugetlb_nr_regions].pgsz =
+			hugetlb_priv[level].pg_size;
+		hugetlb_nr_regions++;
+	}
+
+	/* the pages get allocated on the node when touched below */
+	if (prefault_node >= 0) {
+		nodemask = 1UL << prefault_node;
+		if (syscall(SYS_mbind, addr, len, MPOL_BIND, &nodemask,
+				sizeof(nodemask) * 8 + 1, 0) != 0) {
+			perror("mbind hugetlb memory failed");
+			munmap(addr, len);
+			return -ENOMEM;
+		}
+	}
+
 	/* pre-allocate hugepages by touch them */
 	pagesz = hugetlb_priv[level].pg_size;
 
 	printf("touch %ld pages with pagesz 0x%lx\n", len/pagesz, pagesz);
 
-	for (i = 0; i < len/pagesz; i++) {
-		*(volatile char *)addr = *addr;
-		addr += pagesz;
-	}
+	prefault_pages(addr, len/pagesz, pagesz);
 
 	return 0;
 }
@@ -458,69 +580,86 @@ static bool hugetlb_check_memgap(void)
 	return has_gap;
 }
 
-/* try to reserve more huge pages on the level */
+static int write_sys_info(const char *sys_path, int pages)
+{
+	char buf[12];
+	int fd, len, ret = 0;
+
+	fd = open(sys_path, O_WRONLY);
+	if (fd < 0) {
+		printf("can't open: %s, err: %s\n", sys_path, strerror(errno));
+		return -1;
+	}
+
+	len = snprintf(buf, sizeof(buf), "%d", pages);
+	if (write(fd, buf, len) != len) {
+		printf("write %s, error: %s\n", sys_path, strerror(errno));
+		ret = -1;
+	}
+
+	close(fd);
+	return ret;
+}
+
+/* try to reserve the gap pages on the level, with a single write */
 static void reserve_more_pages(int level)
 {
 	int total_pages, orig_pages, cur_pages;
-	char cmd_buf[MAX_PATH_LEN];
-	FILE *fp;
 
 	orig_pages = read_sys_info(hugetlb_priv[level].nr_pages_path);
 	total_pages = orig_pages + hugetlb_priv[level].pages_delta;
-	snprintf(cmd_buf, MAX_PATH_LEN, "echo %d > %s",
-		total_pages, hugetlb_priv[level].nr_pages_path);
 
-	/* system cmd to reserve needed huge pages */
-	fp = popen(cmd_buf, "r");
-	if (fp == NULL) {
-		printf("cmd: %s failed!\n", cmd_buf);
+	printf("to reserve pages (+orig %d): %d > %s\n", orig_pages,
+		total_pages, hugetlb_priv[level].nr_pages_path);
+	if (write_sys_info(hugetlb_priv[level].nr_pages_path, total_pages) < 0)
 		return;
-	}
-	pclose(fp);
 
-	printf("to reserve pages (+orig %d): %s\n", orig_pages, cmd_buf);
 	cur_pages = read_sys_info(hugetlb_priv[level].nr_pages_path);
 	hugetlb_priv[level].pages_delta = total_pages - cur_pages;
 }
 
-/* try to release larger free page */
-static bool release_larger_freepage(int level_limit)
+/*
+ * try to release the free larger pages @level needs memory from to cover
+ * its gap, all the pages of a larger level in one write
+ */
+static bool release_larger_freepages(int level)
 {
-	int level;
+	int lvl, nr_free, nr_release;
 	int total_pages, orig_pages, cur_pages;
-	char cmd_buf[MAX_PATH_LEN];
-	FILE *fp;
+	size_t gap, pg_size;
 
-	for (level = hugetlb_lv_max - 1; level >= level_limit; level--) {
-		if (hugetlb_priv[level].pages_delta >= 0)
-			continue;
+	gap = (size_t)hugetlb_priv[level].pages_delta *
+		hugetlb_priv[level].pg_size;
 
-		/* free one unsed larger page */
-		orig_pages = read_sys_info(hugetlb_priv[level].nr_pages_path);
-		total_pages = orig_pages - 1;
-		snprintf(cmd_buf, MAX_PATH_LEN, "echo %d > %s",
-			total_pages, hugetlb_priv[level].nr_pages_path);
+	for (lvl = hugetlb_lv_max - 1; lvl > level && gap > 0; lvl--) {
+		if (hugetlb_priv[lvl].pages_delta >= 0)
+			continue;
 
-		fp = popen(cmd_buf, "r");
-		if (fp == NULL) {
-			printf("cmd to free mem: %s failed!\n", cmd_buf);
-			return false;
-		}
-		pclose(fp);
+		pg_size = hugetlb_priv[lvl].pg_size;
+		nr_free = -hugetlb_priv[lvl].pages_delta;
+		nr_release = (int)((gap + pg_size - 1) / pg_size);
+		if (nr_release > nr_free)
+			nr_release = nr_free;
+
+		orig_pages = read_sys_info(hugetlb_priv[lvl].nr_pages_path);
+		total_pages = orig_pages - nr_release;
+		printf("to free pages (-orig %d): %d > %s\n", orig_pages,
+			total_pages, hugetlb_priv[lvl].nr_pages_path);
+		if (write_sys_info(hugetlb_priv[lvl].nr_pages_path,
+				total_pages) < 0)
+			continue;
 
-		cur_pages = read_sys_info(hugetlb_priv[level].nr_pages_path);
+		cur_pages = read_sys_info(hugetlb_priv[lvl].nr_pages_path);
+		if (cur_pages >= orig_pages)
+			continue;
 
-		/* release page successfully */
-		if (cur_pages < orig_pages) {
-			hugetlb_priv[level].pages_delta++;
-			break;
-		}
+		hugetlb_priv[lvl].pages_delta += orig_pages - cur_pages;
+		gap = (gap > (orig_pages - cur_pages) * pg_size) ?
+			gap - (orig_pages - cur_pages) * pg_size : 0;
 	}
 
-	if (level < level_limit)
-		return false;
-
-	return true;
+	return gap < (size_t)hugetlb_priv[level].pages_delta *
+		hugetlb_priv[level].pg_size;
 }
 
 /* reserve more free huge pages as different levels.
@@ -535,6 +674,9 @@ static bool release_larger_freepage(int level_limit)
  *.   even enough free memory, it is eaiser to reserve smaller pages than
  * lager ones, for example:2MB easier than 1GB. One flow of current solution:
  *.it could leave SOS very small free memory.
+ * each level gap is reserved with one write, and LV1 is retried once
+ * after the larger free pages it is short of are released, one write
+ * per larger level.
  *.return value: true: success; false: failure
  */
 static bool hugetlb_reserve_pages(void)
@@ -568,13 +710,16 @@ static bool hugetlb_reserve_pages(void)
 		}
 
 		/* now for level == HUGETLB_LV1 it still can't alloc enough
-		 * pages, go back to larger pages, to check if it can
-		 *.release some unused free pages, if release success,
-		 * let it go LV1 again
+		 * pages, release the unused free larger pages it is short of,
+		 * and try LV1 once again
 		 */
-		if (release_larger_freepage(level + 1))
-			level++;
-		else
+		left_gap = hugetlb_priv[level].pages_delta;
+		if (!release_larger_freepages(level))
+			break;
+
+		reserve_more_pages(level);
+		left_gap = hugetlb_priv[level].pages_delta;
+		if (left_gap > 0)
 			break;
 	}
 
@@ -779,6 +924,7 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 	return 0;
 
 err:
+	hugetlb_nr_regions = 0;
 	if (ptr) {
 		munmap(ptr, total_size);
 		ptr = NULL;
@@ -794,6 +940,7 @@ void hugetlb_unsetup_memory(struct vmctx *ctx)
 {
 	int level;
 
+	hugetlb_nr_regions = 0;
 	if (total_size > 0) {
 		munmap(ptr, total_size);
 		total_size = 0;
@@ -805,3 +952,290 @@ void hugetlb_unsetup_memory(struct vmctx *ctx)
 		umount_hugetlbfs(level);
 	}
 }
+
+/*
+ * Copy up to @max of the mappings the guest memory is made of to @regions,
+ * for another process, e.g. a vhost-user backend, to map it too. The fds
+ * stay owned by hugetlb and valid until hugetlb_unsetup_memory().
+ */
+int hugetlb_get_regions(struct hugetlb_region *regions, int max)
+{
+	int n = (hugetlb_nr_regions < max) ? hugetlb_nr_regions : max;
+
+	memcpy(regions, hugetlb_regions, n * sizeof(*regions));
+	return n;
+}
+
+static struct hugetlb_region *hugetlb_find_region(vm_paddr_t gpa, size_t len)
+{
+	struct hugetlb_region *r;
+	int i;
+
+	for (i = 0; i < hugetlb_nr_regions; i++) {
+		r = &hugetlb_regions[i];
+		if (gpa >= r->gpa && gpa - r->gpa < r->len)
+			return (len <= r->len - (gpa - r->gpa)) ? r : NULL;
+	}
+	return NULL;
+}
+
+/* The size of the hugepages backing @gpa, 0 if it is no guest memory */
+size_t hugetlb_page_size(vm_paddr_t gpa)
+{
+	struct hugetlb_region *r = hugetlb_find_region(gpa, 1);
+
+	return (r != NULL) ? r->pgsz : 0;
+}
+
+/*
+ * Give the hugepages backing [gpa, gpa + len) of the guest memory back to
+ * the SOS, the range being whole pages of a mapping. It must be out of the
+ * EPT of the guest first: a later access through the mapping gets a new,
+ * zeroed, page, see hugetlb_populate_range().
+ */
+int hugetlb_release_range(vm_paddr_t gpa, size_t len)
+{
+	struct hugetlb_region *r = hugetlb_find_region(gpa, len);
+
+	if (r == NULL || ((gpa | len) & (r->pgsz - 1)) != 0)
+		return -EINVAL;
+
+	if (fallocate(r->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			r->offset + (gpa - r->gpa), len) != 0)
+		return -errno;
+	return 0;
+}
+
+/*
+ * Back [gpa, gpa + len) of the guest memory again. Unlike touching the
+ * mapping, which would end in a SIGBUS, this fails with -ENOSPC when the
+ * SOS has no free hugepage left.
+ */
+int hugetlb_populate_range(vm_paddr_t gpa, size_t len)
+{
+	struct hugetlb_region *r = hugetlb_find_region(gpa, len);
+
+	if (r == NULL || ((gpa | len) & (r->pgsz - 1)) != 0)
+		return -EINVAL;
+
+	if (fallocate(r->fd, 0, r->offset + (gpa - r->gpa), len) != 0)
+		return -errno;
+	return 0;
+}
+
+static int hugetlb_shared_path(char *path, const char *name)
+{
+	if (snprintf(path, MAX_PATH_LEN, "%s%s",
+			hugetlb_priv[HUGETLB_LV1].mount_path, name) >= MAX_PATH_LEN)
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+/*
+ * Map the level 1 hugetlbfs file @name, creating it if needed, so that
+ * several DMs and SOS processes can share its pages. The mapping is
+ * touched to have every page backed before it is mapped to a guest.
+ */
+void *hugetlb_map_shared(const char *name, size_t len)
+{
+	char path[MAX_PATH_LEN];
+	struct statfs fs;
+	char *addr;
+	size_t off;
+	int fd;
+
+	if (hugetlb_shared_path(path, name) != 0) {
+		fprintf(stderr, "hugetlb: shared path overflow\n");
+		return NULL;
+	}
+
+	fd = open(path, O_CREAT | O_RDWR, 0600);
+	if (fd < 0) {
+		perror("Open shared hugetlbfs file failed");
+		return NULL;
+	}
+
+	if (fstatfs(fd, &fs) != 0 || fs.f_type != HUGETLBFS_MAGIC
+			|| (len % fs.f_bsize) != 0 || ftruncate(fd, len) != 0) {
+		fprintf(stderr, "hugetlb: can not size %s to 0x%lx\n", path, len);
+		close(fd);
+		return NULL;
+	}
+
+	addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		perror("mmap shared hugetlbfs file failed");
+		return NULL;
+	}
+
+	for (off = 0; off < len; off += fs.f_bsize)
+		*(volatile char *)(addr + off) = *(addr + off);
+
+	return addr;
+}
+
+/* Create the shared file @path holding a copy of [hva, hva + len) */
+static int hugetlb_create_shared(const char *path, const char *hva, size_t len)
+{
+	char tmp[MAX_PATH_LEN];
+	char *addr;
+	int fd, err = 0;
+
+	if (snprintf(tmp, MAX_PATH_LEN, "%s.%d", path, getpid()) >= MAX_PATH_LEN)
+		return -ENAMETOOLONG;
+
+	fd = open(tmp, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0)
+		return -errno;
+
+	/* unlike touching the pages, this fails cleanly out of hugepages */
+	if (ftruncate(fd, len) != 0 || fallocate(fd, 0, 0, len) != 0) {
+		err = -errno;
+		goto out;
+	}
+
+	addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		err = -errno;
+		goto out;
+	}
+	memcpy(addr, hva, len);
+	munmap(addr, len);
+
+	/* the file only shows up once full */
+	if (rename(tmp, path) != 0)
+		err = -errno;
+out:
+	if (err != 0)
+		unlink(tmp);
+	close(fd);
+	return err;
+}
+
+/*
+ * Back [gpa, gpa + len) of the guest memory, whole pages of a level 1
+ * mapping, with the pages of the hugetlbfs file @name, shared with the
+ * other DMs backing the same content with it: the first one creates the
+ * file with a copy of the range, the others check that it holds the same
+ * bytes. Neither the guest nor the DM may write the range meanwhile.
+ *
+ * On success, the mapping of the DM is the read-only one of the shared
+ * file, and the fd returned keeps a shared lock on it until
+ * hugetlb_unshare_range(). The hugepages of the guest are still allocated:
+ * hugetlb_release_range() gives them back, once the EPT maps the range
+ * from the mapping of the DM again. -EEXIST if the file holds other bytes.
+ */
+int hugetlb_share_range(vm_paddr_t gpa, size_t len, const char *name)
+{
+	struct hugetlb_region *r = hugetlb_find_region(gpa, len);
+	char path[MAX_PATH_LEN];
+	struct stat st;
+	char *hva, *addr;
+	int fd, err;
+
+	if (r == NULL || r->pgsz != hugetlb_priv[HUGETLB_LV1].pg_size ||
+			((gpa | len) & (r->pgsz - 1)) != 0)
+		return -EINVAL;
+	hva = r->hva + (gpa - r->gpa);
+
+	err = hugetlb_shared_path(path, name);
+	if (err != 0)
+		return err;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 && errno == ENOENT) {
+		err = hugetlb_create_shared(path, hva, len);
+		if (err != 0 && err != -EEXIST)
+			return err;
+		fd = open(path, O_RDONLY);
+	}
+	if (fd < 0)
+		return -errno;
+
+	/*
+	 * The last DM to drop the file removes it, see
+	 * hugetlb_unshare_range(): if it was removed in between, the pages
+	 * are good still, they are just not shared with any DM to come.
+	 */
+	if (flock(fd, LOCK_SH) != 0 || fstat(fd, &st) != 0) {
+		err = -errno;
+		goto fail;
+	}
+	if ((size_t)st.st_size != len) {
+		err = -EEXIST;
+		goto fail;
+	}
+
+	addr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		err = -errno;
+		goto fail;
+	}
+	err = (memcmp(addr, hva, len) == 0) ? 0 : -EEXIST;
+	munmap(addr, len);
+	if (err != 0)
+		goto fail;
+
+	if (mmap(hva, len, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		err = -errno;
+		/* still the mapping of the guest memory, or none */
+		mmap(hva, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+			r->fd, r->offset + (gpa - r->gpa));
+		goto fail;
+	}
+	return fd;
+
+fail:
+	hugetlb_drop_shared(fd, name);
+	return err;
+}
+
+/*
+ * Back [gpa, gpa + len) of the guest memory with hugepages of its own
+ * again, a copy of the shared ones of hugetlb_share_range() @fd, and drop
+ * the file. Like hugetlb_populate_range(), this fails with -ENOSPC when
+ * the SOS has no free hugepage left, the range being still shared then.
+ * The EPT must map the range from the mapping of the DM again.
+ */
+int hugetlb_unshare_range(vm_paddr_t gpa, size_t len, int fd, const char *name)
+{
+	struct hugetlb_region *r = hugetlb_find_region(gpa, len);
+	char *hva, *addr;
+	off_t off;
+
+	if (r == NULL || ((gpa | len) & (r->pgsz - 1)) != 0)
+		return -EINVAL;
+	hva = r->hva + (gpa - r->gpa);
+	off = r->offset + (gpa - r->gpa);
+
+	if (fallocate(r->fd, 0, off, len) != 0)
+		return -errno;
+
+	addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, off);
+	if (addr == MAP_FAILED)
+		return -errno;
+	memcpy(addr, hva, len);
+	munmap(addr, len);
+
+	if (mmap(hva, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+			r->fd, off) == MAP_FAILED)
+		return -errno;
+
+	hugetlb_drop_shared(fd, name);
+	return 0;
+}
+
+/*
+ * Close @fd of the shared file @name, and remove the file if no other
+ * process holds it, giving its hugepages back to the SOS once unmapped.
+ */
+void hugetlb_drop_shared(int fd, const char *name)
+{
+	char path[MAX_PATH_LEN];
+
+	if (flock(fd, LOCK_EX | LOCK_NB) == 0 &&
+			hugetlb_shared_path(path, name) == 0)
+		unlink(path);
+	close(fd);
+}
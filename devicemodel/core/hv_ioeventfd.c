@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) <2018> Intel Corporation
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "vmmapi.h"
+#include "atomic.h"
+#include "hv_ioeventfd.h"
+
+static char hv_ioeventfd_page[4096] __attribute__ ((aligned(4096)));
+
+static struct vhm_ioeventfd_page *ioeventfd_page =
+			(struct vhm_ioeventfd_page *)&hv_ioeventfd_page;
+
+static struct {
+	struct acrn_hv_ioeventfd	args;
+	hv_ioeventfd_handler_t		handler;
+	void				*arg;
+} hv_ioeventfds[VHM_IOEVENTFD_MAX];
+
+/*
+ * Hand the pending bitmap page to the hypervisor. Without it (e.g. an old
+ * hypervisor or SOS kernel) hv_ioeventfd_add() fails and the doorbells keep
+ * going through the regular ioreq path.
+ */
+int
+hv_ioeventfd_init(struct vmctx *ctx)
+{
+	memset(hv_ioeventfds, 0, sizeof(hv_ioeventfds));
+	return vm_set_ioeventfd_page(ctx, (uint64_t)ioeventfd_page);
+}
+
+/*
+ * Ask the hypervisor to complete writes of @len bytes to @addr (a port if
+ * HV_IOEVENTFD_FLAG_PIO is in @flags) by itself, and to run @handler on the
+ * next vm_loop wakeup instead. With HV_IOEVENTFD_FLAG_DATAMATCH, only writes
+ * of @data match.
+ *
+ * Return the index to pass to hv_ioeventfd_del(), or -1 on failure.
+ */
+int
+hv_ioeventfd_add(struct vmctx *ctx, uint64_t addr, uint32_t len,
+		 uint32_t flags, uint64_t data,
+		 hv_ioeventfd_handler_t handler, void *arg)
+{
+	struct acrn_hv_ioeventfd *args;
+	int idx;
+
+	if (!ctx->hv_ioeventfd || handler == NULL)
+		return -1;
+
+	for (idx = 0; idx < VHM_IOEVENTFD_MAX; idx++) {
+		if (hv_ioeventfds[idx].handler == NULL)
+			break;
+	}
+	if (idx == VHM_IOEVENTFD_MAX)
+		return -1;
+
+	args = &hv_ioeventfds[idx].args;
+	bzero(args, sizeof(*args));
+	args->addr = addr;
+	args->data = data;
+	args->len = len;
+	args->flags = flags & ~HV_IOEVENTFD_FLAG_DEASSIGN;
+	args->index = idx;
+
+	if (vm_assign_hv_ioeventfd(ctx, args) != 0)
+		return -1;
+
+	hv_ioeventfds[idx].arg = arg;
+	hv_ioeventfds[idx].handler = handler;
+	return idx;
+}
+
+void
+hv_ioeventfd_del(struct vmctx *ctx, int idx)
+{
+	struct acrn_hv_ioeventfd *args;
+
+	if (idx < 0 || idx >= VHM_IOEVENTFD_MAX ||
+	    hv_ioeventfds[idx].handler == NULL)
+		return;
+
+	args = &hv_ioeventfds[idx].args;
+	args->flags |= HV_IOEVENTFD_FLAG_DEASSIGN;
+	vm_assign_hv_ioeventfd(ctx, args);
+
+	hv_ioeventfds[idx].handler = NULL;
+	hv_ioeventfds[idx].arg = NULL;
+}
+
+/*
+ * Run the handlers of the doorbells rung since the last call. The hypervisor
+ * only kicks us when it finds the bitmap empty, so loop until we read back 0.
+ */
+void
+hv_ioeventfd_dispatch(struct vmctx *ctx)
+{
+	uint64_t pending;
+	int idx;
+
+	if (!ctx->hv_ioeventfd)
+		return;
+
+	while ((pending = atomic_xchg(&ioeventfd_page->pending, 0)) != 0) {
+		while (pending != 0) {
+			idx = __builtin_ctzl(pending);
+			pending &= pending - 1;
+
+			/* a kick may race with hv_ioeventfd_del() */
+			if (hv_ioeventfds[idx].handler != NULL)
+				hv_ioeventfds[idx].handler(hv_ioeventfds[idx].arg);
+		}
+	}
+}
+
+/* Drop all the ioeventfds, their handlers are about to go away */
+void
+hv_ioeventfd_reset(struct vmctx *ctx)
+{
+	int idx;
+
+	for (idx = 0; idx < VHM_IOEVENTFD_MAX; idx++)
+		hv_ioeventfd_del(ctx, idx);
+}
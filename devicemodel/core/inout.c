@@ -26,12 +26,28 @@
  * $FreeBSD$
  */
 
+/*
+ * inout_handlers[] maps each port to the range registered on it, so the
+ * lookup stays a single index. A range is a unit for registration and
+ * for enabling or disabling, which toggles its flag instead of the ones
+ * of each port.
+ *
+ * The updates are serialized by inout_mtx and bracketed by inout_seq,
+ * odd while one is in progress. emulate_inout() takes no lock: it copies
+ * the range of the port and retries if inout_seq moved meanwhile. The
+ * ranges are recycled, never freed, so a stale pointer still reads a
+ * range, which the retry then discards.
+ */
+
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "inout.h"
+#include "atomic.h"
 
 SET_DECLARE(inout_port_set, struct inout_port);
 
@@ -40,13 +56,33 @@ SET_DECLARE(inout_port_set, struct inout_port);
 #define	VERIFY_IOPORT(port, size) \
 	((port) >= 0 && (size) > 0 && ((port) + (size)) <= MAX_IOPORTS)
 
-static struct {
+struct inout_range {
 	const char	*name;
+	int		port;
+	int		size;
 	int		flags;
 	inout_func_t	handler;
 	void		*arg;
 	bool		enabled;
-} inout_handlers[MAX_IOPORTS];
+	struct inout_range *next_free;
+};
+
+static int default_inout(struct vmctx *ctx, int vcpu, int in, int port,
+			 int bytes, uint32_t *eax, void *arg);
+
+static struct inout_range inout_default = {
+	.name = "default",
+	.port = 0,
+	.size = MAX_IOPORTS,
+	.flags = IOPORT_F_INOUT | IOPORT_F_DEFAULT,
+	.handler = default_inout,
+	.enabled = true,
+};
+
+static struct inout_range *inout_handlers[MAX_IOPORTS];
+static struct inout_range *inout_free_ranges;
+static unsigned long inout_seq;
+static pthread_mutex_t inout_mtx = PTHREAD_MUTEX_INITIALIZER;
 
 static int
 default_inout(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
@@ -69,24 +105,105 @@ default_inout(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 	return 0;
 }
 
+/* @pre inout_mtx is held */
+static void
+inout_write_begin(void)
+{
+	atomic_store(&inout_seq, inout_seq + 1);
+}
+
+/* @pre inout_mtx is held */
 static void
-register_default_iohandler(int start, int size)
+inout_write_end(void)
 {
-	struct inout_port iop;
+	atomic_store(&inout_seq, inout_seq + 1);
+}
 
-	if (!VERIFY_IOPORT(start, size)) {
-		printf("invalid input: port:0x%x, size:%d", start, size);
+/* @pre inout_mtx is held */
+static struct inout_range *
+inout_range_alloc(struct inout_port *iop)
+{
+	struct inout_range *r = inout_free_ranges;
+
+	if (r != NULL)
+		inout_free_ranges = r->next_free;
+	else {
+		r = calloc(1, sizeof(*r));
+		if (r == NULL)
+			return NULL;
+	}
+
+	r->name = iop->name;
+	r->port = iop->port;
+	r->size = iop->size;
+	r->flags = iop->flags;
+	r->handler = iop->handler;
+	r->arg = iop->arg;
+	r->enabled = true;
+	r->next_free = NULL;
+	return r;
+}
+
+/* Recycle a range no port maps to any more. @pre inout_mtx is held */
+static void
+inout_range_put(struct inout_range *r)
+{
+	int i;
+
+	if (r == &inout_default)
 		return;
+
+	for (i = r->port; i < r->port + r->size; i++) {
+		if (inout_handlers[i] == r)
+			return;
 	}
 
-	bzero(&iop, sizeof(iop));
-	iop.name = "default";
-	iop.port = start;
-	iop.size = size;
-	iop.flags = IOPORT_F_INOUT | IOPORT_F_DEFAULT;
-	iop.handler = default_inout;
+	r->next_free = inout_free_ranges;
+	inout_free_ranges = r;
+}
+
+/*
+ * Map the ports of [start, start + size) to r, the ranges they leave
+ * are recycled once they lost all their ports.
+ * @pre inout_mtx is held
+ */
+static void
+inout_map(int start, int size, struct inout_range *r)
+{
+	struct inout_range *old, *prev = NULL;
+	int i;
 
-	register_inout(&iop);
+	inout_write_begin();
+	for (i = start; i < start + size; i++) {
+		old = inout_handlers[i];
+		inout_handlers[i] = r;
+		if ((old != NULL) && (old != prev) && (old != r)) {
+			inout_range_put(old);
+			prev = old;
+		}
+	}
+	inout_write_end();
+}
+
+/*
+ * Enable or disable the ranges of [start, start + size)
+ * @pre inout_mtx is held
+ */
+static void
+inout_set_enabled(int start, int size, bool enabled)
+{
+	struct inout_range *r, *prev = NULL;
+	int i;
+
+	inout_write_begin();
+	for (i = start; i < start + size; i++) {
+		r = inout_handlers[i];
+		if ((r != prev) && (r != &inout_default)) {
+			r->enabled = enabled;
+			prev = r;
+		}
+	}
+	inout_write_end();
 }
 
 int
@@ -94,6 +211,9 @@ emulate_inout(struct vmctx *ctx, int *pvcpu, struct pio_request *pio_request)
 {
 	int bytes, flags, in, port;
 	inout_func_t handler;
+	struct inout_range *r;
+	unsigned long seq;
+	bool enabled;
 	void *arg;
 	int retval;
 
@@ -104,9 +224,22 @@ emulate_inout(struct vmctx *ctx, int *pvcpu, struct pio_request *pio_request)
 	assert(port + bytes - 1 < MAX_IOPORTS);
 	assert(bytes == 1 || bytes == 2 || bytes == 4);
 
-	handler = inout_handlers[port].handler;
-	flags = inout_handlers[port].flags;
-	arg = inout_handlers[port].arg;
+	for (;;) {
+		seq = atomic_load(&inout_seq);
+		if ((seq & 1UL) != 0UL) {
+			__builtin_ia32_pause();
+			continue;
+		}
+
+		r = atomic_load(&inout_handlers[port]);
+		handler = r->handler;
+		flags = r->flags;
+		arg = r->arg;
+		enabled = r->enabled;
+		atomic_thread_fence();
+		if (atomic_load(&inout_seq) == seq)
+			break;
+	}
 
 	if (pio_request->direction == REQUEST_READ) {
 		if (!(flags & IOPORT_F_IN))
@@ -116,7 +249,7 @@ emulate_inout(struct vmctx *ctx, int *pvcpu, struct pio_request *pio_request)
 			return -1;
 	}
 
-	if (inout_handlers[port].enabled == false) {
+	if (enabled == false) {
 		return -1;
 	}
 
@@ -129,11 +262,14 @@ void
 init_inout(void)
 {
 	struct inout_port **iopp, *iop;
+	struct inout_range *r;
+
+	pthread_mutex_lock(&inout_mtx);
 
 	/*
 	 * Set up the default handler for all ports
 	 */
-	register_default_iohandler(0, MAX_IOPORTS);
+	inout_map(0, MAX_IOPORTS, &inout_default);
 
 	/*
 	 * Overwrite with specified handlers
@@ -141,27 +277,28 @@ init_inout(void)
 	SET_FOREACH(iopp, inout_port_set) {
 		iop = *iopp;
 		assert(iop->port < MAX_IOPORTS);
-		inout_handlers[iop->port].name = iop->name;
-		inout_handlers[iop->port].flags = iop->flags;
-		inout_handlers[iop->port].handler = iop->handler;
-		inout_handlers[iop->port].arg = NULL;
+		r = inout_range_alloc(iop);
+		assert(r != NULL);
+		r->size = 1;
+		r->arg = NULL;
+		inout_map(iop->port, 1, r);
 	}
+
+	pthread_mutex_unlock(&inout_mtx);
 }
 
 int
 disable_inout(struct inout_port *iop)
 {
-	int i;
-
 	if (!VERIFY_IOPORT(iop->port, iop->size)) {
 		printf("invalid input: port:0x%x, size:%d",
 				iop->port, iop->size);
 		return -1;
 	}
 
-	for (i = iop->port; i < iop->port + iop->size; i++) {
-		inout_handlers[i].enabled = false;
-	}
+	pthread_mutex_lock(&inout_mtx);
+	inout_set_enabled(iop->port, iop->size, false);
+	pthread_mutex_unlock(&inout_mtx);
 
 	return 0;
 }
@@ -169,17 +306,15 @@ disable_inout(struct inout_port *iop)
 int
 enable_inout(struct inout_port *iop)
 {
-	int i;
-
 	if (!VERIFY_IOPORT(iop->port, iop->size)) {
 		printf("invalid input: port:0x%x, size:%d",
 				iop->port, iop->size);
 		return -1;
 	}
 
-	for (i = iop->port; i < iop->port + iop->size; i++) {
-		inout_handlers[i].enabled = true;
-	}
+	pthread_mutex_lock(&inout_mtx);
+	inout_set_enabled(iop->port, iop->size, true);
+	pthread_mutex_unlock(&inout_mtx);
 
 	return 0;
 }
@@ -187,6 +322,7 @@ enable_inout(struct inout_port *iop)
 int
 register_inout(struct inout_port *iop)
 {
+	struct inout_range *r;
 	int i;
 
 	if (!VERIFY_IOPORT(iop->port, iop->size)) {
@@ -195,24 +331,27 @@ register_inout(struct inout_port *iop)
 		return -1;
 	}
 
+	pthread_mutex_lock(&inout_mtx);
+
 	/*
 	 * Verify that the new registration is not overwriting an already
 	 * allocated i/o range.
 	 */
-	if ((iop->flags & IOPORT_F_DEFAULT) == 0) {
-		for (i = iop->port; i < iop->port + iop->size; i++) {
-			if ((inout_handlers[i].flags & IOPORT_F_DEFAULT) == 0)
-				return -1;
+	for (i = iop->port; i < iop->port + iop->size; i++) {
+		if (inout_handlers[i] != &inout_default) {
+			pthread_mutex_unlock(&inout_mtx);
+			return -1;
 		}
 	}
 
-	for (i = iop->port; i < iop->port + iop->size; i++) {
-		inout_handlers[i].name = iop->name;
-		inout_handlers[i].flags = iop->flags;
-		inout_handlers[i].handler = iop->handler;
-		inout_handlers[i].arg = iop->arg;
-		inout_handlers[i].enabled = true;
+	r = inout_range_alloc(iop);
+	if (r == NULL) {
+		pthread_mutex_unlock(&inout_mtx);
+		return -1;
 	}
+	inout_map(iop->port, iop->size, r);
+
+	pthread_mutex_unlock(&inout_mtx);
 
 	return 0;
 }
@@ -227,9 +366,13 @@ unregister_inout(struct inout_port *iop)
 		return -1;
 	}
 
-	assert(inout_handlers[iop->port].name == iop->name);
+	pthread_mutex_lock(&inout_mtx);
+
+	assert(inout_handlers[iop->port]->name == iop->name);
+
+	inout_map(iop->port, iop->size, &inout_default);
 
-	register_default_iohandler(iop->port, iop->size);
+	pthread_mutex_unlock(&inout_mtx);
 
 	return 0;
 }
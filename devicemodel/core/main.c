@@ -38,6 +38,8 @@
 #include <sysexits.h>
 #include <stdbool.h>
 #include <getopt.h>
+#include <sched.h>
+#include <time.h>
 
 #include "vmmapi.h"
 #include "sw_load.h"
@@ -66,6 +68,15 @@
 #include "vmcfg.h"
 #include "tpm.h"
 #include "virtio.h"
+#include "dm_string.h"
+#include "hv_ioeventfd.h"
+#include "clock_page.h"
+#include "snapshot.h"
+#include "migration.h"
+#include "standby.h"
+#include "cpu_acct.h"
+#include "telemetry.h"
+#include "dedup.h"
 
 #define GUEST_NIO_PORT		0x488	/* guest upcalls via i/o port */
 
@@ -85,6 +96,11 @@ char *ovmf_file_name;
 char *kernel_file_name;
 char *elf_file_name;
 uint8_t trusty_enabled;
+bool high_prio_enabled;
+bool guest_cr_bits_enabled;
+bool vpmu_enabled;
+uint32_t ple_gap, ple_window;
+uint32_t guest_tsc_khz;
 char *mac_seed;
 bool stdio_in_use;
 
@@ -99,13 +115,41 @@ static const int BSP;
 
 static cpuset_t cpumask;
 
+/* steering of the upcalls for our ioreqs, see --vhm_upcall */
+static bool upcall_set;
+static bool upcall_affinity;
+static uint32_t upcall_policy;
+static uint64_t upcall_mask;
+
+/* one thread per vcpu handles its ioreqs, see --ioreq_threads */
+static bool ioreq_threads;
+/* reset the PCI devices in place on a system reset, see --warm_reset */
+static bool warm_reset;
+
+/* see --snapshot and --template */
+static char *snapshot_file;
+static char *template_file;
+/* see --incoming */
+static char *incoming_addr;
+
+/* vm_loop polls for ioreqs before sleeping, see --ioreq_poll */
+static unsigned int ioreq_poll_us;
+static int ioreq_poll_cpu = -1;
+
 static void vm_loop(struct vmctx *ctx);
+static int start_ioreq_workers(struct vmctx *ctx);
+static void stop_ioreq_workers(int nr_workers);
 
 static char vhm_request_page[4096] __attribute__ ((aligned(4096)));
 
 static struct vhm_request *vhm_req_buf =
 				(struct vhm_request *)&vhm_request_page;
 
+static char vhm_posted_page[4096] __attribute__ ((aligned(4096)));
+
+static struct vhm_posted_ring *vhm_posted_ring =
+				(struct vhm_posted_ring *)&vhm_posted_page;
+
 struct dmstats {
 	uint64_t	vmexit_bogus;
 	uint64_t	vmexit_reqidle;
@@ -115,6 +159,8 @@ struct dmstats {
 	uint64_t	cpu_switch_rotate;
 	uint64_t	cpu_switch_direct;
 	uint64_t	vmexit_mmio_emul;
+	uint64_t	vmexit_posted_mmio;
+	uint64_t	vmexit_posted_pio;
 } stats;
 
 struct mt_vmm_info {
@@ -123,6 +169,30 @@ struct mt_vmm_info {
 	int		mt_vcpu;
 } mt_vmm_info[VM_MAXCPU];
 
+/*
+ * With --ioreq_threads, vm_loop only dispatches: the ioreq of each vcpu is
+ * claimed by setting busy, by vm_loop which then kicks the worker of the
+ * vcpu, or by the worker itself when it finds the next one already pending
+ * after completing the previous one.
+ */
+struct ioreq_worker {
+	pthread_t	thr;
+	pthread_mutex_t	mtx;
+	pthread_cond_t	cond;
+	bool		kicked;
+	bool		quit;
+	int		busy;
+	int		vcpu;
+	struct vmctx	*ctx;
+} ioreq_workers[VM_MAXCPU];
+
+/* serializes the port I/O and PCI config handlers run by the workers */
+static pthread_mutex_t ioreq_pio_mtx = PTHREAD_MUTEX_INITIALIZER;
+/* serializes the draining of the requests not pausing the vcpus */
+static pthread_mutex_t ioreq_drain_mtx = PTHREAD_MUTEX_INITIALIZER;
+/* serializes the system reset and suspend triggered by the workers */
+static pthread_mutex_t ioreq_suspend_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 static cpuset_t *vcpumap[VM_MAXCPU] = { NULL };
 
 static struct vmctx *_ctx;
@@ -163,6 +233,26 @@ usage(int code)
 		"       --ptdev_no_reset: disable reset check for ptdev\n"
 		"       --debugexit: enable debug exit function\n"
 		"       --intr_monitor: enable interrupt storm monitor\n"
+		"       --high_prio: schedule the vcpus ahead of low priority ones\n"
+		"       --ple: PAUSE-loop exiting, params: <gap>,<window> in TSC cycles\n"
+		"       --tsc_khz: TSC frequency of the guest in kHz\n"
+		"       --guest_cr_bits: let the guest own the CR0/CR4 bits the hypervisor needs no exit on\n"
+		"       --vpmu: give the guest the performance counters of the CPU\n"
+		"       --ioreq_threads: handle the I/O requests of each vcpu in its own thread\n"
+		"       --ioreq_poll: poll for I/O requests before sleeping, params: <budget_us>[,<pcpu>]\n"
+		"       --mem_prefault: allocate the guest memory, params: <threads>[,<numa node>]\n"
+		"       --warm_reset: reset the PCI devices in place on a guest reboot\n"
+		"       --snapshot: save the VM into this file when it is paused\n"
+		"       --template: start the VM from this snapshot file\n"
+		"       --incoming: run the VM migrated to [<addr>:]<port>\n"
+		"       --standby: wait on this mngr socket to run the VM of another acrn-dm\n"
+		"       --cpu_acct: time the BAR accesses and mevent callbacks of each device\n"
+		"       --perf_thread_names: name the device workers without blanks or colons\n"
+		"       --telemetry: let the hypervisor publish the VM statistics in shared memory\n"
+		"       --dedup: share the hugepages of a range other VMs hold the same, params:\n"
+		"............<gpa>,<size>[,<scan interval in seconds>]\n"
+		"       --vhm_upcall: SOS vcpus to signal the ioreqs to, params:\n"
+		"............fixed:<vcpu>|rr:<vcpu mask>|source:<vcpu mask>|affinity\n"
 		"       --vtpm2: Virtual TPM2 args: sock_path=$PATH_OF_SWTPM_SOCKET\n"
 		"............its params: threshold/s,probe-period(s),delay_time(ms),delay_duration(ms)\n",
 		progname, (int)strlen(progname), "", (int)strlen(progname), "",
@@ -171,6 +261,141 @@ usage(int code)
 	exit(code);
 }
 
+/*
+ * fixed:<vcpu>		all upcalls to SOS vcpu <vcpu>
+ * rr:<mask>		rotate among the SOS vcpus in <mask>
+ * source:<mask>	spread by the requesting vcpu over <mask>
+ * affinity		rotate among the cpus the DM may run on
+ */
+static int
+parse_vhm_upcall(const char *opt)
+{
+	const char *arg;
+	char *end;
+	uint64_t val = 0;
+
+	arg = strchr(opt, ':');
+	if (arg != NULL) {
+		errno = 0;
+		val = strtoull(arg + 1, &end, 0);
+		if (errno != 0 || end == arg + 1 || *end != '\0')
+			return -1;
+	}
+
+	if (!strncmp(opt, "fixed:", 6) && val < 64) {
+		upcall_policy = UPCALL_POLICY_FIXED;
+		upcall_mask = 1UL << val;
+	} else if (!strncmp(opt, "rr:", 3) && val != 0) {
+		upcall_policy = UPCALL_POLICY_ROUND_ROBIN;
+		upcall_mask = val;
+	} else if (!strncmp(opt, "source:", 7) && val != 0) {
+		upcall_policy = UPCALL_POLICY_SOURCE;
+		upcall_mask = val;
+	} else if (!strcmp(opt, "affinity")) {
+		upcall_policy = UPCALL_POLICY_ROUND_ROBIN;
+		upcall_affinity = true;
+	} else
+		return -1;
+
+	upcall_set = true;
+	return 0;
+}
+
+/* <gap>,<window> in TSC cycles, either may be 0 for the hypervisor default */
+static int
+parse_ple(const char *opt)
+{
+	char *end;
+	unsigned int gap, window;
+
+	if (dm_strtoui(opt, &end, 0, &gap) || *end != ',' ||
+		dm_strtoui(end + 1, &end, 0, &window) || *end != '\0')
+		return -1;
+
+	ple_gap = gap;
+	ple_window = window;
+	return 0;
+}
+
+/* <budget_us>[,<pcpu>], the pcpu the polling vm_loop thread is pinned to */
+static int
+parse_ioreq_poll(const char *opt)
+{
+	char *end;
+	unsigned int budget, pcpu;
+
+	if (dm_strtoui(opt, &end, 10, &budget) || budget == 0)
+		return -1;
+	if (*end == ',') {
+		if (dm_strtoui(end + 1, &end, 10, &pcpu) || pcpu >= CPU_SETSIZE)
+			return -1;
+		ioreq_poll_cpu = (int)pcpu;
+	}
+	if (*end != '\0')
+		return -1;
+
+	ioreq_poll_us = budget;
+	return 0;
+}
+
+/* <threads>[,<node>], how hugetlb_setup_memory() allocates the guest memory */
+static int
+parse_mem_prefault(const char *opt)
+{
+	char *end;
+	unsigned int threads, node = -1U;
+
+	if (dm_strtoui(opt, &end, 10, &threads))
+		return -1;
+	if (*end == ',') {
+		if (dm_strtoui(end + 1, &end, 10, &node))
+			return -1;
+	}
+	if (*end != '\0')
+		return -1;
+
+	return hugetlb_set_prefault((int)threads, (int)node);
+}
+
+static int
+parse_tsc_khz(const char *opt)
+{
+	char *end;
+	unsigned int khz;
+
+	if (dm_strtoui(opt, &end, 10, &khz) || *end != '\0' || khz == 0)
+		return -1;
+
+	guest_tsc_khz = khz;
+	return 0;
+}
+
+static void
+set_vhm_upcall(struct vmctx *ctx)
+{
+	cpu_set_t set;
+	int i;
+
+	if (!upcall_set)
+		return;
+
+	/* SOS cpu N is SOS vcpu N */
+	if (upcall_affinity) {
+		upcall_mask = 0;
+		CPU_ZERO(&set);
+		if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+			for (i = 0; i < 64; i++) {
+				if (CPU_ISSET(i, &set))
+					upcall_mask |= 1UL << i;
+			}
+		}
+	}
+
+	if (vm_set_upcall_policy(ctx, upcall_policy, upcall_mask) != 0)
+		fprintf(stderr, "failed to set vhm upcall policy %u mask 0x%lx\n",
+			upcall_policy, upcall_mask);
+}
+
 static void
 print_version(void)
 {
@@ -216,21 +441,6 @@ pincpu_parse(const char *opt)
 	return 0;
 }
 
-/**
- * @brief Convert guest physical address to host virtual address
- *
- * @param ctx Pointer to to struct vmctx representing VM context.
- * @param gaddr Guest physical address base.
- * @param len Guest physical address length.
- *
- * @return NULL on convert failed and host virtual address on successful.
- */
-void *
-paddr_guest2host(struct vmctx *ctx, uintptr_t gaddr, size_t len)
-{
-	return vm_map_gpa(ctx, gaddr, len);
-}
-
 int
 virtio_uses_msix(void)
 {
@@ -288,6 +498,12 @@ add_cpu(struct vmctx *ctx, int guest_ncpus)
 
 	vm_set_vcpu_regs(ctx, &ctx->bsp_regs);
 
+	if (ioreq_threads) {
+		error = start_ioreq_workers(ctx);
+		if (error != 0)
+			return error;
+	}
+
 	error = pthread_create(&mt_vmm_info[0].mt_thr, NULL,
 	    start_thread, &mt_vmm_info[0]);
 
@@ -304,6 +520,8 @@ delete_cpu(struct vmctx *ctx, int vcpu)
 
 	vm_destroy_ioreq_client(ctx);
 	pthread_join(mt_vmm_info[0].mt_thr, NULL);
+	if (ioreq_threads)
+		stop_ioreq_workers(guest_ncpus);
 
 	CPU_CLR_ATOMIC(vcpu, &cpumask);
 	return CPU_EMPTY(&cpumask);
@@ -381,6 +599,15 @@ vmexit_pci_emul(struct vmctx *ctx, struct vhm_request *vhm_req, int *pvcpu)
 	}
 }
 
+/* a vcpu wrote to a page --dedup shares, it runs the write again */
+static void
+vmexit_wp(struct vmctx *ctx, struct vhm_request *vhm_req, int *pvcpu)
+{
+	if (dedup_fault(vhm_req->reqs.mmio_request.address) == -EINVAL)
+		fprintf(stderr, "Unhandled write protect fault at 0x%lx\n",
+			vhm_req->reqs.mmio_request.address);
+}
+
 #define	DEBUG_EPT_MISCONFIG
 
 #ifdef DEBUG_EPT_MISCONFIG
@@ -395,12 +622,97 @@ static vmexit_handler_t handler[VM_EXITCODE_MAX] = {
 	[VM_EXITCODE_INOUT]  = vmexit_inout,
 	[VM_EXITCODE_MMIO_EMUL] = vmexit_mmio_emul,
 	[VM_EXITCODE_PCI_CFG] = vmexit_pci_emul,
+	[VM_EXITCODE_WP] = vmexit_wp,
 };
 
+/*
+ * Drain the MMIO and port I/O writes the hypervisor posted without pausing
+ * the vcpus.
+ * They are always older than any pending request in vhm_req_buf, so this
+ * must run before those are handled.
+ */
 static void
-handle_vmexit(struct vmctx *ctx, struct vhm_request *vhm_req, int vcpu)
+handle_posted_requests(struct vmctx *ctx)
+{
+	struct vhm_posted_request *preq;
+	struct mmio_request mmio_req;
+	struct pio_request pio_req;
+	uint32_t head, tail;
+	int vcpu, err;
+
+	if (!ctx->posted_ioreq)
+		return;
+
+	head = atomic_load(&vhm_posted_ring->head);
+	tail = atomic_load(&vhm_posted_ring->tail);
+	while (head != tail) {
+		while (head != tail) {
+			preq = &vhm_posted_ring->entries[head];
+
+			if (preq->flags & POSTED_REQUEST_PIO) {
+				bzero(&pio_req, sizeof(pio_req));
+				pio_req.direction = REQUEST_WRITE;
+				pio_req.address = preq->address;
+				pio_req.size = preq->size;
+				pio_req.value = (uint32_t)preq->value;
+				vcpu = preq->vcpu;
+
+				stats.vmexit_posted_pio++;
+				err = emulate_inout(ctx, &vcpu, &pio_req);
+				if (err)
+					fprintf(stderr, "Unhandled posted out "
+						"0x%04lx, size %ld\n",
+						pio_req.address, pio_req.size);
+
+				head = (head + 1) % VHM_POSTED_REQUEST_MAX;
+				continue;
+			}
+
+			bzero(&mmio_req, sizeof(mmio_req));
+			mmio_req.direction = REQUEST_WRITE;
+			mmio_req.address = preq->address;
+			mmio_req.size = preq->size;
+			mmio_req.value = preq->value;
+
+			stats.vmexit_posted_mmio++;
+			err = emulate_mem(ctx, &mmio_req);
+			if (err)
+				fprintf(stderr, "Failed to emulate posted write "
+					"[mmio address 0x%lx, size %ld]\n",
+					mmio_req.address, mmio_req.size);
+
+			head = (head + 1) % VHM_POSTED_REQUEST_MAX;
+		}
+		atomic_store(&vhm_posted_ring->head, head);
+
+		/* The hypervisor only kicks us when it finds the ring empty
+		 * after producing, so re-check the tail behind a full fence.
+		 */
+		atomic_thread_fence();
+		tail = atomic_load(&vhm_posted_ring->tail);
+	}
+}
+
+/* The posted requests and ioeventfds, kicked without a request of a vcpu */
+static void
+handle_unpaused_requests(struct vmctx *ctx)
+{
+	pthread_mutex_lock(&ioreq_drain_mtx);
+	handle_posted_requests(ctx);
+	hv_ioeventfd_dispatch(ctx);
+	pthread_mutex_unlock(&ioreq_drain_mtx);
+}
+
+/*
+ * Handle the ioreq of vcpu, then notify its completion, or add the vcpu to
+ * *done for the caller to notify it with others.
+ */
+static void
+handle_vmexit(struct vmctx *ctx, struct vhm_request *vhm_req, int vcpu,
+	      uint64_t *done)
 {
 	enum vm_exitcode exitcode;
+	bool serialize;
 
 	exitcode = vhm_req->type;
 	if (exitcode >= VM_EXITCODE_MAX || handler[exitcode] == NULL) {
@@ -409,7 +721,17 @@ handle_vmexit(struct vmctx *ctx, struct vhm_request *vhm_req, int vcpu)
 		exit(1);
 	}
 
+	/*
+	 * The MMIO handlers of the devices shared with their own threads
+	 * already lock their state, the port I/O ones mostly don't.
+	 */
+	serialize = ioreq_threads && (exitcode != VM_EXITCODE_MMIO_EMUL) &&
+		(exitcode != VM_EXITCODE_WP);
+	if (serialize)
+		pthread_mutex_lock(&ioreq_pio_mtx);
 	(*handler[exitcode])(ctx, vhm_req, &vcpu);
+	if (serialize)
+		pthread_mutex_unlock(&ioreq_pio_mtx);
 	atomic_store(&vhm_req->processed, REQ_STATE_COMPLETE);
 
 	/* We cannot notify the VHM/hypervisor on the request completion at this
@@ -423,7 +745,10 @@ handle_vmexit(struct vmctx *ctx, struct vhm_request *vhm_req, int vcpu)
 		(VM_SUSPEND_SUSPEND == vm_get_suspend_mode()))
 		return;
 
-	vm_notify_request_done(ctx, vcpu);
+	if (done != NULL)
+		*done |= 1UL << vcpu;
+	else
+		vm_notify_request_done(ctx, vcpu);
 }
 
 static int
@@ -464,6 +789,10 @@ vm_init_vdevs(struct vmctx *ctx)
 	if (ret < 0)
 		goto pci_fail;
 
+	if (snapshot_file != NULL &&
+	    vm_snapshot_on_pause(ctx, snapshot_file) != 0)
+		fprintf(stderr, "no snapshot on pause\n");
+
 	init_vtpm2(ctx);
 
 	return 0;
@@ -517,6 +846,20 @@ vm_reset_vdevs(struct vmctx *ctx)
 	 * acpi build is necessary because irq for each vdev
 	 * could be assigned with different number after reset.
 	 */
+	bool warm;
+
+	hv_ioeventfd_reset(ctx);
+
+	/*
+	 * With --warm_reset, the PCI devices which support it are reset in
+	 * place, keeping their backends, BARs and IRQs, so that neither they
+	 * nor the ACPI tables need to be rebuilt. If one of them does not,
+	 * all of them are recreated.
+	 */
+	warm = warm_reset && (reset_pci(ctx) == 0);
+	if (warm)
+		pci_irq_reset(ctx);
+
 	atkbdc_deinit(ctx);
 
 	if (debugexit_enabled)
@@ -525,11 +868,13 @@ vm_reset_vdevs(struct vmctx *ctx)
 	vpit_deinit(ctx);
 	vrtc_deinit(ctx);
 
-	deinit_pci(ctx);
-	pci_irq_deinit(ctx);
-	ioapic_deinit();
+	if (!warm) {
+		deinit_pci(ctx);
+		pci_irq_deinit(ctx);
+		ioapic_deinit();
 
-	pci_irq_init(ctx);
+		pci_irq_init(ctx);
+	}
 	atkbdc_init(ctx);
 	vrtc_init(ctx);
 	vpit_init(ctx);
@@ -537,6 +882,9 @@ vm_reset_vdevs(struct vmctx *ctx)
 	if (debugexit_enabled)
 		init_debugexit();
 
+	if (warm)
+		return;
+
 	ioapic_init(ctx);
 	init_pci(ctx);
 
@@ -545,6 +893,30 @@ vm_reset_vdevs(struct vmctx *ctx)
 	}
 }
 
+int
+vm_wait_ioreqs_idle(struct vmctx *ctx, int timeout_ms)
+{
+	int vcpu_id, busy;
+
+	do {
+		busy = 0;
+		for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
+			if (atomic_load(&vhm_req_buf[vcpu_id].processed) !=
+					REQ_STATE_FREE)
+				busy++;
+		}
+		if (ctx->posted_ioreq &&
+		    atomic_load(&vhm_posted_ring->head) !=
+		    atomic_load(&vhm_posted_ring->tail))
+			busy++;
+		if (busy == 0)
+			return 0;
+		usleep(1000);
+	} while (timeout_ms-- > 0);
+
+	return -1;
+}
+
 static void
 vm_system_reset(struct vmctx *ctx)
 {
@@ -562,7 +934,8 @@ vm_system_reset(struct vmctx *ctx)
 	 */
 
 	vm_pause(ctx);
-	for (vcpu_id = 0; vcpu_id < 4; vcpu_id++) {
+	handle_unpaused_requests(ctx);
+	for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
 		struct vhm_request *vhm_req;
 
 		vhm_req = &vhm_req_buf[vcpu_id];
@@ -610,6 +983,10 @@ vm_system_reset(struct vmctx *ctx)
 	vm_reset(ctx);
 	vm_set_suspend_mode(VM_SUSPEND_NONE);
 
+	/* the guest images are loaded again */
+	if (dedup_reset() != 0)
+		fprintf(stderr, "dedup: the VM may not restart\n");
+
 	/* set the BSP init state */
 	acrn_sw_load(ctx);
 	vm_set_vcpu_regs(ctx, &ctx->bsp_regs);
@@ -632,7 +1009,8 @@ vm_suspend_resume(struct vmctx *ctx)
 	 *   6. hypercall restart vm
 	 */
 	vm_pause(ctx);
-	for (vcpu_id = 0; vcpu_id < 4; vcpu_id++) {
+	handle_unpaused_requests(ctx);
+	for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
 		struct vhm_request *vhm_req;
 
 		vhm_req = &vhm_req_buf[vcpu_id];
@@ -656,37 +1034,248 @@ vm_suspend_resume(struct vmctx *ctx)
 	vm_run(ctx);
 }
 
+/* The worker of vcpu claims its pending ioreq */
+static bool
+claim_ioreq(struct vmctx *ctx, int vcpu)
+{
+	struct vhm_request *vhm_req = &vhm_req_buf[vcpu];
+
+	return (atomic_load(&vhm_req->processed) == REQ_STATE_PROCESSING) &&
+		(vhm_req->client == ctx->ioreq_client) &&
+		(atomic_xchg(&ioreq_workers[vcpu].busy, 1) == 0);
+}
+
+static void
+kick_ioreq_worker(struct ioreq_worker *w)
+{
+	pthread_mutex_lock(&w->mtx);
+	w->kicked = true;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mtx);
+}
+
+/*
+ * The system reset and suspend requested by the ioreq a worker handled.
+ * The VM is paused first, then the other workers are waited for, so that
+ * no handler runs while the devices get reset.
+ */
+static void
+ioreq_worker_suspend(struct ioreq_worker *w)
+{
+	int mode, i;
+
+	pthread_mutex_lock(&ioreq_suspend_mtx);
+	mode = vm_get_suspend_mode();
+	if ((mode == VM_SUSPEND_SYSTEM_RESET) || (mode == VM_SUSPEND_SUSPEND)) {
+		vm_pause(w->ctx);
+		for (i = 0; i < guest_ncpus; i++) {
+			while ((i != w->vcpu) && (atomic_load(&ioreq_workers[i].busy) != 0))
+				usleep(1000);
+		}
+
+		if (mode == VM_SUSPEND_SYSTEM_RESET)
+			vm_system_reset(w->ctx);
+		else
+			vm_suspend_resume(w->ctx);
+	}
+	pthread_mutex_unlock(&ioreq_suspend_mtx);
+}
+
+static void *
+ioreq_worker_thread(void *param)
+{
+	char tname[MAXCOMLEN + 1];
+	struct ioreq_worker *w = param;
+	int mode;
+	bool quit;
+
+	snprintf(tname, sizeof(tname), "ioreq %d", w->vcpu);
+	pthread_setname_np(pthread_self(), tname);
+
+	while (1) {
+		pthread_mutex_lock(&w->mtx);
+		while (!w->kicked && !w->quit)
+			pthread_cond_wait(&w->cond, &w->mtx);
+		w->kicked = false;
+		quit = w->quit;
+		pthread_mutex_unlock(&w->mtx);
+		if (quit)
+			break;
+
+		while (1) {
+			handle_vmexit(w->ctx, &vhm_req_buf[w->vcpu], w->vcpu, NULL);
+			atomic_store(&w->busy, 0);
+
+			mode = vm_get_suspend_mode();
+			if ((mode == VM_SUSPEND_SYSTEM_RESET) || (mode == VM_SUSPEND_SUSPEND))
+				ioreq_worker_suspend(w);
+
+			/*
+			 * vm_loop skips the next ioreq if it became pending
+			 * before busy got cleared, take it here then. Older
+			 * posted requests go first, as in vm_loop.
+			 */
+			if (!claim_ioreq(w->ctx, w->vcpu))
+				break;
+			handle_unpaused_requests(w->ctx);
+		}
+	}
+
+	return NULL;
+}
+
+static int
+start_ioreq_workers(struct vmctx *ctx)
+{
+	struct ioreq_worker *w;
+	int i, error;
+
+	for (i = 0; i < guest_ncpus; i++) {
+		w = &ioreq_workers[i];
+		w->ctx = ctx;
+		w->vcpu = i;
+		w->kicked = false;
+		w->quit = false;
+		w->busy = 0;
+		pthread_mutex_init(&w->mtx, NULL);
+		pthread_cond_init(&w->cond, NULL);
+
+		error = pthread_create(&w->thr, NULL, ioreq_worker_thread, w);
+		if (error != 0) {
+			fprintf(stderr, "ERROR: could not create the ioreq thread of VCPU %d\n", i);
+			pthread_mutex_destroy(&w->mtx);
+			pthread_cond_destroy(&w->cond);
+			stop_ioreq_workers(i);
+			return error;
+		}
+	}
+
+	return 0;
+}
+
+static void
+stop_ioreq_workers(int nr_workers)
+{
+	struct ioreq_worker *w;
+	int i;
+
+	for (i = 0; i < nr_workers; i++) {
+		w = &ioreq_workers[i];
+		pthread_mutex_lock(&w->mtx);
+		w->quit = true;
+		pthread_cond_signal(&w->cond);
+		pthread_mutex_unlock(&w->mtx);
+		pthread_join(w->thr, NULL);
+		pthread_mutex_destroy(&w->mtx);
+		pthread_cond_destroy(&w->cond);
+	}
+}
+
+static uint64_t
+monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Spin on the shared ioreq page for up to the --ioreq_poll budget, so
+ * that a request the VHM hands to us is seen without a wakeup of this
+ * thread. The posted requests and ioeventfds are drained meanwhile.
+ * Returns true if a request of ours is waiting, false if vm_loop shall
+ * sleep in the VHM.
+ */
+static bool
+poll_ioreqs(struct vmctx *ctx)
+{
+	struct vhm_request *vhm_req;
+	uint64_t deadline;
+	int vcpu_id, mode;
+
+	deadline = monotonic_ns() + ioreq_poll_us * 1000UL;
+	do {
+		handle_unpaused_requests(ctx);
+
+		for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
+			vhm_req = &vhm_req_buf[vcpu_id];
+			/* requests a worker took are no news */
+			if ((atomic_load(&vhm_req->processed) == REQ_STATE_PROCESSING) &&
+			    (vhm_req->client == ctx->ioreq_client) &&
+			    (!ioreq_threads || (atomic_load(&ioreq_workers[vcpu_id].busy) == 0)))
+				return true;
+		}
+
+		mode = vm_get_suspend_mode();
+		if ((mode == VM_SUSPEND_FULL_RESET) || (mode == VM_SUSPEND_POWEROFF))
+			return true;
+
+		__builtin_ia32_pause();
+	} while (monotonic_ns() < deadline);
+
+	return false;
+}
+
 static void
 vm_loop(struct vmctx *ctx)
 {
 	int error;
+	cpuset_t cpus;
 
 	ctx->ioreq_client = vm_create_ioreq_client(ctx);
 	assert(ctx->ioreq_client > 0);
 
+	if (ioreq_poll_cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(ioreq_poll_cpu, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+			fprintf(stderr, "failed to pin the ioreq polling thread to cpu %d\n",
+				ioreq_poll_cpu);
+	}
+
 	error = vm_run(ctx);
 	assert(error == 0);
 
 	while (1) {
 		int vcpu_id;
 		struct vhm_request *vhm_req;
+		uint64_t done = 0;
 
-		error = vm_attach_ioreq_client(ctx);
-		if (error)
-			break;
+		if ((ioreq_poll_us == 0) || !poll_ioreqs(ctx)) {
+			error = vm_attach_ioreq_client(ctx);
+			if (error)
+				break;
+		}
+
+		handle_unpaused_requests(ctx);
+
+		for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
+			if (ioreq_threads) {
+				if (claim_ioreq(ctx, vcpu_id))
+					kick_ioreq_worker(&ioreq_workers[vcpu_id]);
+				continue;
+			}
 
-		for (vcpu_id = 0; vcpu_id < 4; vcpu_id++) {
 			vhm_req = &vhm_req_buf[vcpu_id];
 			if ((atomic_load(&vhm_req->processed) == REQ_STATE_PROCESSING)
 				&& (vhm_req->client == ctx->ioreq_client))
-				handle_vmexit(ctx, vhm_req, vcpu_id);
+				handle_vmexit(ctx, vhm_req, vcpu_id, &done);
 		}
 
+		/* all the requests of this round in one ioctl */
+		if (done != 0)
+			vm_notify_requests_done(ctx, done);
+
 		if (VM_SUSPEND_FULL_RESET == vm_get_suspend_mode() ||
 		    VM_SUSPEND_POWEROFF == vm_get_suspend_mode()) {
 			break;
 		}
 
+		/* the workers reset and suspend the VM themselves */
+		if (ioreq_threads)
+			continue;
+
 		if (VM_SUSPEND_SYSTEM_RESET == vm_get_suspend_mode()) {
 			vm_system_reset(ctx);
 		}
@@ -728,6 +1317,24 @@ enum {
 	CMD_OPT_DUMP,
 	CMD_OPT_INTR_MONITOR,
 	CMD_OPT_VTPM2,
+	CMD_OPT_VHM_UPCALL,
+	CMD_OPT_HIGH_PRIO,
+	CMD_OPT_PLE,
+	CMD_OPT_TSC_KHZ,
+	CMD_OPT_GUEST_CR_BITS,
+	CMD_OPT_VPMU,
+	CMD_OPT_IOREQ_THREADS,
+	CMD_OPT_IOREQ_POLL,
+	CMD_OPT_MEM_PREFAULT,
+	CMD_OPT_WARM_RESET,
+	CMD_OPT_SNAPSHOT,
+	CMD_OPT_TEMPLATE,
+	CMD_OPT_STANDBY,
+	CMD_OPT_CPU_ACCT,
+	CMD_OPT_PERF_THREAD_NAMES,
+	CMD_OPT_TELEMETRY,
+	CMD_OPT_INCOMING,
+	CMD_OPT_DEDUP,
 };
 
 static struct option long_options[] = {
@@ -766,6 +1373,24 @@ static struct option long_options[] = {
 	{"debugexit",		no_argument,		0, CMD_OPT_DEBUGEXIT},
 	{"intr_monitor",	required_argument,	0, CMD_OPT_INTR_MONITOR},
 	{"vtpm2",		required_argument,	0, CMD_OPT_VTPM2},
+	{"vhm_upcall",		required_argument,	0, CMD_OPT_VHM_UPCALL},
+	{"high_prio",		no_argument,		0, CMD_OPT_HIGH_PRIO},
+	{"ple",			required_argument,	0, CMD_OPT_PLE},
+	{"tsc_khz",		required_argument,	0, CMD_OPT_TSC_KHZ},
+	{"guest_cr_bits",	no_argument,		0, CMD_OPT_GUEST_CR_BITS},
+	{"vpmu",		no_argument,		0, CMD_OPT_VPMU},
+	{"ioreq_threads",	no_argument,		0, CMD_OPT_IOREQ_THREADS},
+	{"ioreq_poll",		required_argument,	0, CMD_OPT_IOREQ_POLL},
+	{"mem_prefault",	required_argument,	0, CMD_OPT_MEM_PREFAULT},
+	{"warm_reset",		no_argument,		0, CMD_OPT_WARM_RESET},
+	{"snapshot",		required_argument,	0, CMD_OPT_SNAPSHOT},
+	{"template",		required_argument,	0, CMD_OPT_TEMPLATE},
+	{"standby",		required_argument,	0, CMD_OPT_STANDBY},
+	{"cpu_acct",		no_argument,		0, CMD_OPT_CPU_ACCT},
+	{"perf_thread_names",	no_argument,		0, CMD_OPT_PERF_THREAD_NAMES},
+	{"telemetry",		no_argument,		0, CMD_OPT_TELEMETRY},
+	{"incoming",		required_argument,	0, CMD_OPT_INCOMING},
+	{"dedup",		required_argument,	0, CMD_OPT_DEDUP},
 	{0,			0,			0,  0  },
 };
 
@@ -915,6 +1540,75 @@ dm_run(int argc, char *argv[])
 				exit(1);
 			}
 			break;
+		case CMD_OPT_VHM_UPCALL:
+			if (parse_vhm_upcall(optarg) != 0) {
+				errx(EX_USAGE, "invalid vhm_upcall param %s", optarg);
+				exit(1);
+			}
+			break;
+		case CMD_OPT_HIGH_PRIO:
+			high_prio_enabled = true;
+			break;
+		case CMD_OPT_PLE:
+			if (parse_ple(optarg) != 0) {
+				errx(EX_USAGE, "invalid ple param %s", optarg);
+				exit(1);
+			}
+			break;
+		case CMD_OPT_TSC_KHZ:
+			if (parse_tsc_khz(optarg) != 0) {
+				errx(EX_USAGE, "invalid tsc_khz %s", optarg);
+				exit(1);
+			}
+			break;
+		case CMD_OPT_GUEST_CR_BITS:
+			guest_cr_bits_enabled = true;
+			break;
+		case CMD_OPT_VPMU:
+			vpmu_enabled = true;
+			break;
+		case CMD_OPT_IOREQ_THREADS:
+			ioreq_threads = true;
+			break;
+		case CMD_OPT_IOREQ_POLL:
+			if (parse_ioreq_poll(optarg) != 0) {
+				errx(EX_USAGE, "invalid ioreq_poll param %s", optarg);
+				exit(1);
+			}
+			break;
+		case CMD_OPT_MEM_PREFAULT:
+			if (parse_mem_prefault(optarg) != 0) {
+				errx(EX_USAGE, "invalid mem_prefault param %s", optarg);
+				exit(1);
+			}
+			break;
+		case CMD_OPT_WARM_RESET:
+			warm_reset = true;
+			break;
+		case CMD_OPT_SNAPSHOT:
+			snapshot_file = optarg;
+			break;
+		case CMD_OPT_TEMPLATE:
+			template_file = optarg;
+			break;
+		case CMD_OPT_CPU_ACCT:
+			cpu_acct_enabled = true;
+			break;
+		case CMD_OPT_PERF_THREAD_NAMES:
+			perf_thread_names = true;
+			break;
+		case CMD_OPT_TELEMETRY:
+			telemetry_enabled = true;
+			break;
+		case CMD_OPT_INCOMING:
+			incoming_addr = optarg;
+			break;
+		case CMD_OPT_DEDUP:
+			if (dedup_parse(optarg) != 0) {
+				errx(EX_USAGE, "invalid dedup param %s", optarg);
+				exit(1);
+			}
+			break;
 		case CMD_OPT_INTR_MONITOR:
 			if (acrn_parse_intr_monitor(optarg) != 0) {
 				errx(EX_USAGE, "invalid intr-monitor params %s", optarg);
@@ -966,6 +1660,26 @@ dm_run(int argc, char *argv[])
 			goto fail;
 		}
 
+		/* Posted MMIO writes are optional, run without them if the
+		 * VHM does not support the ring.
+		 */
+		if (vm_set_posted_ioreq_buffer(ctx,
+				(unsigned long)vhm_posted_ring) != 0)
+			printf("posted ioreq disabled\n");
+
+		/* Likewise for doorbells completed by the hypervisor */
+		if (hv_ioeventfd_init(ctx) != 0)
+			printf("hv ioeventfd disabled\n");
+
+		/* And for the RTC and PIT reads the hypervisor completes */
+		if (clock_page_init(ctx) != 0)
+			printf("hv clock page disabled\n");
+
+		if (telemetry_enabled && telemetry_init(ctx) != 0)
+			printf("hv telemetry page disabled\n");
+
+		set_vhm_upcall(ctx);
+
 		err = mevent_init();
 		if (err) {
 			fprintf(stderr, "Unable to initialize mevent (%d)\n",
@@ -978,6 +1692,26 @@ dm_run(int argc, char *argv[])
 			goto dev_fail;
 		}
 
+		if (template_file != NULL || incoming_addr != NULL) {
+			/* the firmware flash is not in the guest RAM */
+			if (ovmf_file_name != NULL) {
+				error = acrn_sw_load(ctx);
+				if (error)
+					goto vm_fail;
+			}
+
+			if (incoming_addr != NULL) {
+				error = migration_incoming(ctx, incoming_addr);
+				/* the next reset boots the VM */
+				incoming_addr = NULL;
+			} else {
+				error = vm_snapshot_load(ctx, template_file);
+			}
+			if (error)
+				goto vm_fail;
+			goto boot_cpu;
+		}
+
 		/*
 		 * build the guest tables, MP etc.
 		 */
@@ -1010,6 +1744,12 @@ dm_run(int argc, char *argv[])
 		/*
 		 * Add CPU 0
 		 */
+boot_cpu:
+		/* once the guest memory is loaded */
+		error = dedup_init(ctx);
+		if (error)
+			goto vm_fail;
+
 		error = add_cpu(ctx, guest_ncpus);
 		if (error)
 			goto vm_fail;
@@ -1024,6 +1764,7 @@ dm_run(int argc, char *argv[])
 
 		vm_pause(ctx);
 		delete_cpu(ctx, BSP);
+		dedup_deinit(ctx);
 
 		if (vm_get_suspend_mode() != VM_SUSPEND_FULL_RESET)
 			break;
@@ -1038,12 +1779,14 @@ dm_run(int argc, char *argv[])
 	}
 
 vm_fail:
+	dedup_deinit(ctx);
 	vm_deinit_vdevs(ctx);
 dev_fail:
 	mevent_deinit();
 mevent_fail:
 	vm_unsetup_memory(ctx);
 fail:
+	telemetry_deinit(ctx);
 	vm_destroy(ctx);
 	exit(0);
 }
@@ -1066,12 +1809,17 @@ int main(int argc, char *argv[])
 			index = atoi(optarg);
 			vmcfg_dump(index, long_options, optstr);
 			return 0;
+		case CMD_OPT_STANDBY:
+			return dm_standby(optarg);
 		default:
 			dm_options++;
 		}
 	}
 
 	if (!vmcfg) {
+		/* a standby acrn-dm, when there is any, runs the VM for us */
+		if (argc - optind == 1 && dm_launch_standby() == 0)
+			return 0;
 		optind = 0;
 		return dm_run(argc, argv);
 	}
@@ -30,6 +30,12 @@
  * Memory ranges are represented with an RB tree. On insertion, the range
  * is checked for overlaps. On lookup, the key has the same base and limit
  * so it can be searched within the range.
+ *
+ * The trees are only used by the updates, serialized by mmio_mtx. Each
+ * update publishes a new snapshot of them, sorted arrays emulate_mem()
+ * searches without any lock. The snapshot and the ranges it no longer
+ * holds are freed once every thread which may still read them leaves
+ * emulate_mem().
  */
 
 #include <errno.h>
@@ -38,10 +44,12 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <pthread.h>
+#include <sched.h>
 
 #include "vmm.h"
 #include "mem.h"
 #include "tree.h"
+#include "atomic.h"
 
 struct mmio_rb_range {
 	RB_ENTRY(mmio_rb_range)	mr_link;	/* RB tree links */
@@ -56,14 +64,43 @@ RB_PROTOTYPE(mmio_rb_tree, mmio_rb_range, mr_link, mmio_rb_range_compare);
 
 RB_HEAD(mmio_rb_tree, mmio_rb_range) mmio_rb_root, mmio_rb_fallback;
 
+/* The ranges of both trees, sorted by base */
+struct mmio_snapshot {
+	uint64_t		gen;
+	int			nr_ranges;
+	int			nr_fallback;
+	struct mmio_rb_range	**ranges;
+	struct mmio_rb_range	**fallback;
+	struct mmio_rb_range	*entries[];
+};
+
 /*
- * Per-VM cache. Since most accesses from a vCPU will be to
- * consecutive addresses in a range, it makes sense to cache the
- * result of a lookup.
+ * A thread which looked ranges up. seq is odd while it is in
+ * emulate_mem(), the updates wait for it to change then.
  */
-static struct mmio_rb_range	*mmio_hint;
+struct mmio_reader {
+	unsigned long		seq;
+	int			depth;
+	struct mmio_reader	*next;
+};
+
+static struct mmio_snapshot *mmio_snapshot;
+static uint64_t mmio_gen;
 
-static pthread_rwlock_t mmio_rwlock;
+static pthread_mutex_t mmio_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct mmio_reader *mmio_readers;
+static pthread_key_t mmio_reader_key;
+static pthread_once_t mmio_reader_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Per-vCPU cache. Since most accesses from a vCPU will be to
+ * consecutive addresses in a range, it makes sense to cache the
+ * result of a lookup. Each thread handling ioreqs keeps its own, valid
+ * as long as the snapshot it was found in is the current one.
+ */
+static __thread struct mmio_rb_range	*mmio_hint;
+static __thread uint64_t		mmio_hint_gen;
+static __thread struct mmio_reader	*mmio_reader_self;
 
 static int
 mmio_rb_range_compare(struct mmio_rb_range *a, struct mmio_rb_range *b)
@@ -120,17 +157,169 @@ mmio_rb_dump(struct mmio_rb_tree *rbt)
 {
 	struct mmio_rb_range *np;
 
-	pthread_rwlock_rdlock(&mmio_rwlock);
+	pthread_mutex_lock(&mmio_mtx);
 	RB_FOREACH(np, mmio_rb_tree, rbt) {
 		printf(" %lx:%lx, %s\n", np->mr_base, np->mr_end,
 		       np->mr_param.name);
 	}
-	pthread_rwlock_unlock(&mmio_rwlock);
+	pthread_mutex_unlock(&mmio_mtx);
 }
 #endif
 
 RB_GENERATE(mmio_rb_tree, mmio_rb_range, mr_link, mmio_rb_range_compare);
 
+static void
+mmio_reader_exit(void *arg)
+{
+	struct mmio_reader *r = arg, **pp;
+
+	pthread_mutex_lock(&mmio_mtx);
+	for (pp = &mmio_readers; *pp != NULL; pp = &(*pp)->next) {
+		if (*pp == r) {
+			*pp = r->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mmio_mtx);
+	free(r);
+}
+
+static void
+mmio_reader_init(void)
+{
+	pthread_key_create(&mmio_reader_key, mmio_reader_exit);
+}
+
+static struct mmio_reader *
+mmio_reader_get(void)
+{
+	struct mmio_reader *r = mmio_reader_self;
+
+	if (r != NULL)
+		return r;
+
+	pthread_once(&mmio_reader_once, mmio_reader_init);
+	r = calloc(1, sizeof(*r));
+	assert(r != NULL);
+
+	pthread_mutex_lock(&mmio_mtx);
+	r->next = mmio_readers;
+	mmio_readers = r;
+	pthread_mutex_unlock(&mmio_mtx);
+
+	pthread_setspecific(mmio_reader_key, r);
+	mmio_reader_self = r;
+	return r;
+}
+
+static struct mmio_snapshot *
+mmio_read_lock(struct mmio_reader *r)
+{
+	if (r->depth++ == 0)
+		atomic_store(&r->seq, r->seq + 1);
+	return atomic_load(&mmio_snapshot);
+}
+
+static void
+mmio_read_unlock(struct mmio_reader *r)
+{
+	if (--r->depth == 0)
+		atomic_store(&r->seq, r->seq + 1);
+}
+
+/*
+ * Wait for the threads in emulate_mem() to leave it, so that nothing taken
+ * out of the current snapshot is in use anymore. The calling thread may be
+ * emulating the access which triggered the update, it is not waited for.
+ */
+static void
+mmio_synchronize(void)
+{
+	struct mmio_reader *r;
+	unsigned long seq;
+
+	for (r = mmio_readers; r != NULL; r = r->next) {
+		if (r == mmio_reader_self)
+			continue;
+		seq = atomic_load(&r->seq);
+		if ((seq & 1) == 0)
+			continue;
+		while (atomic_load(&r->seq) == seq)
+			sched_yield();
+	}
+}
+
+static int
+mmio_tree_to_array(struct mmio_rb_tree *rbt, struct mmio_rb_range **array)
+{
+	struct mmio_rb_range *np;
+	int n = 0;
+
+	RB_FOREACH(np, mmio_rb_tree, rbt) {
+		if (array != NULL)
+			array[n] = np;
+		n++;
+	}
+
+	return n;
+}
+
+/*
+ * Publish the trees after an update, then free the previous snapshot
+ * together with the range it removed, if any.
+ * @pre mmio_mtx is held
+ */
+static int
+mmio_publish(struct mmio_rb_range *removed)
+{
+	struct mmio_snapshot *snap, *old;
+	int nr_ranges, nr_fallback;
+
+	nr_ranges = mmio_tree_to_array(&mmio_rb_root, NULL);
+	nr_fallback = mmio_tree_to_array(&mmio_rb_fallback, NULL);
+	snap = malloc(sizeof(*snap) +
+		(nr_ranges + nr_fallback) * sizeof(struct mmio_rb_range *));
+	if (snap == NULL)
+		return -1;
+
+	snap->gen = ++mmio_gen;
+	snap->nr_ranges = nr_ranges;
+	snap->nr_fallback = nr_fallback;
+	snap->ranges = snap->entries;
+	snap->fallback = snap->entries + nr_ranges;
+	mmio_tree_to_array(&mmio_rb_root, snap->ranges);
+	mmio_tree_to_array(&mmio_rb_fallback, snap->fallback);
+
+	old = mmio_snapshot;
+	atomic_store(&mmio_snapshot, snap);
+
+	if ((old != NULL) || (removed != NULL)) {
+		mmio_synchronize();
+		free(old);
+		free(removed);
+	}
+
+	return 0;
+}
+
+static struct mmio_rb_range *
+mmio_array_lookup(struct mmio_rb_range **array, int n, uint64_t addr)
+{
+	int lo = 0, hi = n - 1, mid;
+
+	while (lo <= hi) {
+		mid = lo + (hi - lo) / 2;
+		if (addr < array[mid]->mr_base)
+			hi = mid - 1;
+		else if (addr > array[mid]->mr_end)
+			lo = mid + 1;
+		else
+			return array[mid];
+	}
+
+	return NULL;
+}
+
 __attribute__((unused))
 static int
 mem_read(void *ctx, int vcpu, uint64_t gpa, uint64_t *rval, int size, void *arg)
@@ -160,30 +349,43 @@ emulate_mem(struct vmctx *ctx, struct mmio_request *mmio_req)
 {
 	uint64_t paddr = mmio_req->address;
 	int size = mmio_req->size;
+	struct mmio_reader *r = mmio_reader_get();
+	struct mmio_snapshot *snap;
 	struct mmio_rb_range *entry = NULL;
 	int err;
 
-	pthread_rwlock_rdlock(&mmio_rwlock);
+	snap = mmio_read_lock(r);
+	if (snap == NULL) {
+		mmio_read_unlock(r);
+		return -ESRCH;
+	}
+
 	/*
-	 * First check the per-VM cache
+	 * First check the per-vCPU cache
 	 */
-	if (mmio_hint && paddr >= mmio_hint->mr_base &&
+	if (mmio_hint && mmio_hint_gen == snap->gen &&
+			paddr >= mmio_hint->mr_base &&
 			paddr <= mmio_hint->mr_end)
 		entry = mmio_hint;
 
 	if (entry == NULL) {
-		if (mmio_rb_lookup(&mmio_rb_root, paddr, &entry) == 0)
-			/* Update the per-VMU cache */
+		entry = mmio_array_lookup(snap->ranges, snap->nr_ranges, paddr);
+		if (entry != NULL) {
+			/* Update the per-vCPU cache */
 			mmio_hint = entry;
-		else if (mmio_rb_lookup(&mmio_rb_fallback, paddr, &entry)) {
-			pthread_rwlock_unlock(&mmio_rwlock);
-			return -ESRCH;
+			mmio_hint_gen = snap->gen;
+		} else {
+			entry = mmio_array_lookup(snap->fallback,
+					snap->nr_fallback, paddr);
+			if (entry == NULL) {
+				mmio_read_unlock(r);
+				return -ESRCH;
+			}
 		}
 	}
 
-	assert(entry != NULL);
-
-	if (entry->enabled == false) {
+	if (atomic_load(&entry->enabled) == false) {
+		mmio_read_unlock(r);
 		return -1;
 	}
 
@@ -194,7 +396,7 @@ emulate_mem(struct vmctx *ctx, struct mmio_request *mmio_req)
 		err = mem_write(ctx, 0, paddr, mmio_req->value,
 				size, &entry->mr_param);
 
-	pthread_rwlock_unlock(&mmio_rwlock);
+	mmio_read_unlock(r);
 
 	return err;
 }
@@ -214,10 +416,15 @@ register_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 		mrp->mr_base = memp->base;
 		mrp->mr_end = memp->base + memp->size - 1;
 		mrp->enabled = true;
-		pthread_rwlock_wrlock(&mmio_rwlock);
+		pthread_mutex_lock(&mmio_mtx);
 		if (mmio_rb_lookup(rbt, memp->base, &entry) != 0)
 			err = mmio_rb_add(rbt, mrp);
-		pthread_rwlock_unlock(&mmio_rwlock);
+		if (err == 0) {
+			err = mmio_publish(NULL);
+			if (err)
+				RB_REMOVE(mmio_rb_tree, rbt, mrp);
+		}
+		pthread_mutex_unlock(&mmio_mtx);
 		if (err)
 			free(mrp);
 	} else
@@ -226,66 +433,36 @@ register_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 	return err;
 }
 
-int
-disable_mem(struct mem_range *memp)
+static int
+set_mem_enabled(struct mem_range *memp, bool enabled)
 {
 	uint64_t paddr = memp->base;
 	struct mmio_rb_range *entry = NULL;
 
-	pthread_rwlock_rdlock(&mmio_rwlock);
-	/*
-	 * First check the per-VM cache
-	 */
-	if (mmio_hint && paddr >= mmio_hint->mr_base &&
-			paddr <= mmio_hint->mr_end)
-		entry = mmio_hint;
-
-	if (entry == NULL) {
-		if (mmio_rb_lookup(&mmio_rb_root, paddr, &entry) == 0)
-			/* Update the per-VMU cache */
-			mmio_hint = entry;
-		else if (mmio_rb_lookup(&mmio_rb_fallback, paddr, &entry)) {
-			pthread_rwlock_unlock(&mmio_rwlock);
-			return -ESRCH;
-		}
+	pthread_mutex_lock(&mmio_mtx);
+	if ((mmio_rb_lookup(&mmio_rb_root, paddr, &entry) != 0) &&
+		(mmio_rb_lookup(&mmio_rb_fallback, paddr, &entry) != 0)) {
+		pthread_mutex_unlock(&mmio_mtx);
+		return -ESRCH;
 	}
 
 	assert(entry != NULL);
-	entry->enabled = false;
-	pthread_rwlock_unlock(&mmio_rwlock);
+	atomic_store(&entry->enabled, enabled);
+	pthread_mutex_unlock(&mmio_mtx);
 
 	return 0;
 }
 
 int
-enable_mem(struct mem_range *memp)
+disable_mem(struct mem_range *memp)
 {
-	uint64_t paddr = memp->base;
-	struct mmio_rb_range *entry = NULL;
-
-	pthread_rwlock_rdlock(&mmio_rwlock);
-	/*
-	 * First check the per-VM cache
-	 */
-	if (mmio_hint && paddr >= mmio_hint->mr_base &&
-			paddr <= mmio_hint->mr_end)
-		entry = mmio_hint;
-
-	if (entry == NULL) {
-		if (mmio_rb_lookup(&mmio_rb_root, paddr, &entry) == 0)
-			/* Update the per-VMU cache */
-			mmio_hint = entry;
-		else if (mmio_rb_lookup(&mmio_rb_fallback, paddr, &entry)) {
-			pthread_rwlock_unlock(&mmio_rwlock);
-			return -ESRCH;
-		}
-	}
-
-	assert(entry != NULL);
-	entry->enabled = true;
-	pthread_rwlock_unlock(&mmio_rwlock);
+	return set_mem_enabled(memp, false);
+}
 
-	return 0;
+int
+enable_mem(struct mem_range *memp)
+{
+	return set_mem_enabled(memp, true);
 }
 
 int
@@ -300,60 +477,43 @@ register_mem_fallback(struct mem_range *memp)
 	return register_mem_int(&mmio_rb_fallback, memp);
 }
 
-int
-unregister_mem_fallback(struct mem_range *memp)
+static int
+unregister_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 {
 	struct mem_range *mr;
 	struct mmio_rb_range *entry = NULL;
 	int err;
 
-	pthread_rwlock_wrlock(&mmio_rwlock);
-	err = mmio_rb_lookup(&mmio_rb_fallback, memp->base, &entry);
+	pthread_mutex_lock(&mmio_mtx);
+	err = mmio_rb_lookup(rbt, memp->base, &entry);
 	if (err == 0) {
 		mr = &entry->mr_param;
 		assert(mr->name == memp->name);
 		assert(mr->base == memp->base && mr->size == memp->size);
 		assert((mr->flags & MEM_F_IMMUTABLE) == 0);
-		RB_REMOVE(mmio_rb_tree, &mmio_rb_fallback, entry);
+		RB_REMOVE(mmio_rb_tree, rbt, entry);
 
-		/* flush Per-VM cache */
-		if (mmio_hint == entry)
-			mmio_hint = NULL;
+		/* the snapshot still holding it goes with it */
+		if (mmio_publish(entry) != 0) {
+			mmio_rb_add(rbt, entry);
+			err = -1;
+		}
 	}
-	pthread_rwlock_unlock(&mmio_rwlock);
-
-	if (entry)
-		free(entry);
+	pthread_mutex_unlock(&mmio_mtx);
 
 	return err;
 }
 
 int
-unregister_mem(struct mem_range *memp)
+unregister_mem_fallback(struct mem_range *memp)
 {
-	struct mem_range *mr;
-	struct mmio_rb_range *entry = NULL;
-	int err;
-
-	pthread_rwlock_wrlock(&mmio_rwlock);
-	err = mmio_rb_lookup(&mmio_rb_root, memp->base, &entry);
-	if (err == 0) {
-		mr = &entry->mr_param;
-		assert(mr->name == memp->name);
-		assert(mr->base == memp->base && mr->size == memp->size);
-		assert((mr->flags & MEM_F_IMMUTABLE) == 0);
-		RB_REMOVE(mmio_rb_tree, &mmio_rb_root, entry);
-
-		/* flush Per-VM cache */
-		if (mmio_hint == entry)
-			mmio_hint = NULL;
-	}
-	pthread_rwlock_unlock(&mmio_rwlock);
-
-	if (entry)
-		free(entry);
+	return unregister_mem_int(&mmio_rb_fallback, memp);
+}
 
-	return err;
+int
+unregister_mem(struct mem_range *memp)
+{
+	return unregister_mem_int(&mmio_rb_root, memp);
 }
 
 void
@@ -361,5 +521,7 @@ init_mem(void)
 {
 	RB_INIT(&mmio_rb_root);
 	RB_INIT(&mmio_rb_fallback);
-	pthread_rwlock_init(&mmio_rwlock, NULL);
+	pthread_mutex_lock(&mmio_mtx);
+	mmio_publish(NULL);
+	pthread_mutex_unlock(&mmio_mtx);
 }
@@ -27,32 +27,37 @@
  */
 
 /*
- * Micro event library for FreeBSD, designed for a single i/o thread
- * using EPOLL, and having events be persistent by default.
+ * Micro event library for FreeBSD, using EPOLL, and having events be
+ * persistent by default.
+ *
+ * The events are dispatched by the main i/o thread, in mevent_dispatch(),
+ * or by one of the named loops each having its own thread and epoll
+ * instance, so that a busy backend on a loop of its own does not delay the
+ * events of the others.
  */
 #include <assert.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/epoll.h>
 #include <sys/queue.h>
 #include <pthread.h>
 
 #include "mevent.h"
+#include "cpu_acct.h"
 #include "vmmapi.h"
 
 #define	MEVENT_MAX	64
+#define	MEVENT_LOOPS_MAX	16
 
 #define	MEV_ADD		1
 #define	MEV_ENABLE	2
 #define	MEV_DISABLE	3
 #define	MEV_DEL_PENDING	4
 
-static int epoll_fd;
-static pthread_t mevent_tid;
-static int mevent_pipefd[2];
 static pthread_mutex_t mevent_lmutex = PTHREAD_MUTEX_INITIALIZER;
 
 struct mevent {
@@ -65,14 +70,36 @@ struct mevent {
 	enum			ev_type me_type;
 	int			me_cq;
 	int			me_state;
+	int			me_loop;
 
 	int			closefd;
+	struct cpu_acct		*me_acct;	/* of the device that added it */
 	LIST_ENTRY(mevent)	me_list;
+	struct mevent		*me_fd_next;	/* same fd, in mevent_fds */
+};
+
+LIST_HEAD(listhead, mevent);
+
+struct mevent_loop {
+	char			name[16];
+	int			epoll_fd;
+	pthread_t		tid;
+	bool			running;	/* tid is valid */
+	bool			quit;
+	int			pipefd[2];
+	/* List holds the mevent node which is requested to deleted */
+	struct listhead		del_head;
 };
 
-static LIST_HEAD(listhead, mevent) global_head;
-/* List holds the mevent node which is requested to deleted */
-static LIST_HEAD(del_listhead, mevent) del_head;
+/* MEVENT_LOOP_MAIN is run by mevent_dispatch() */
+static struct mevent_loop mevent_loops[MEVENT_LOOPS_MAX];
+static int mevent_nr_loops;
+
+static struct listhead global_head;
+
+/* The events of each fd, indexed by fd */
+static struct mevent **mevent_fds;
+static int mevent_nr_fds;
 
 static void
 mevent_qlock(void)
@@ -87,9 +114,64 @@ mevent_qunlock(void)
 }
 
 static bool
-is_dispatch_thread(void)
+is_dispatch_thread(int loop)
 {
-	return (pthread_self() == mevent_tid);
+	return mevent_loops[loop].running &&
+		(pthread_self() == mevent_loops[loop].tid);
+}
+
+/* the event of fd and type, with mevent_qlock held */
+static struct mevent *
+mevent_fd_find(int fd, enum ev_type type)
+{
+	struct mevent *lp;
+
+	if (fd >= mevent_nr_fds)
+		return NULL;
+
+	for (lp = mevent_fds[fd]; lp != NULL; lp = lp->me_fd_next) {
+		if (lp->me_type == type)
+			return lp;
+	}
+
+	return NULL;
+}
+
+static int
+mevent_fd_insert(struct mevent *mevp)
+{
+	struct mevent **fds;
+	int nr;
+
+	if (mevp->me_fd >= mevent_nr_fds) {
+		nr = (mevent_nr_fds != 0) ? mevent_nr_fds : 64;
+		while (nr <= mevp->me_fd)
+			nr *= 2;
+		fds = realloc(mevent_fds, nr * sizeof(*fds));
+		if (fds == NULL)
+			return -1;
+		memset(fds + mevent_nr_fds, 0,
+			(nr - mevent_nr_fds) * sizeof(*fds));
+		mevent_fds = fds;
+		mevent_nr_fds = nr;
+	}
+
+	mevp->me_fd_next = mevent_fds[mevp->me_fd];
+	mevent_fds[mevp->me_fd] = mevp;
+	return 0;
+}
+
+static void
+mevent_fd_remove(struct mevent *mevp)
+{
+	struct mevent **pp;
+
+	for (pp = &mevent_fds[mevp->me_fd]; *pp != NULL; pp = &(*pp)->me_fd_next) {
+		if (*pp == mevp) {
+			*pp = mevp->me_fd_next;
+			break;
+		}
+	}
 }
 
 static void
@@ -107,22 +189,29 @@ mevent_pipe_read(int fd, enum ev_type type, void *param)
 	} while (status == MEVENT_MAX);
 }
 
-/*On error, -1 is returned, else return zero*/
-int
-mevent_notify(void)
+static int
+mevent_loop_notify(int loop)
 {
-	char c;
+	struct mevent_loop *l = &mevent_loops[loop];
+	char c = 0;
 
 	/*
 	 * If calling from outside the i/o thread, write a byte on the
 	 * pipe to force the i/o thread to exit the blocking epoll call.
 	 */
-	if (mevent_pipefd[1] != 0 && !is_dispatch_thread())
-		if (write(mevent_pipefd[1], &c, 1) <= 0)
+	if (l->pipefd[1] != 0 && !is_dispatch_thread(loop))
+		if (write(l->pipefd[1], &c, 1) <= 0)
 			return -1;
 	return 0;
 }
 
+/*On error, -1 is returned, else return zero*/
+int
+mevent_notify(void)
+{
+	return mevent_loop_notify(MEVENT_LOOP_MAIN);
+}
+
 static int
 mevent_kq_filter(struct mevent *mevp)
 {
@@ -145,46 +234,45 @@ mevent_kq_filter(struct mevent *mevp)
 	return retval;
 }
 
+static void
+mevent_free(struct mevent *mevp)
+{
+	if ((mevp->me_type == EVF_READ ||
+	     mevp->me_type == EVF_READ_ET ||
+	     mevp->me_type == EVF_WRITE ||
+	     mevp->me_type == EVF_WRITE_ET) &&
+	     mevp->me_fd != STDIN_FILENO)
+		close(mevp->me_fd);
+
+	if (mevp->teardown)
+		mevp->teardown(mevp->teardown_param);
+
+	free(mevp);
+}
+
 static void
 mevent_destroy(void)
 {
 	struct mevent *mevp, *tmpp;
+	int i;
 
 	mevent_qlock();
 	list_foreach_safe(mevp, &global_head, me_list, tmpp) {
 		LIST_REMOVE(mevp, me_list);
-		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, mevp->me_fd, NULL);
-
-               if ((mevp->me_type == EVF_READ ||
-                    mevp->me_type == EVF_READ_ET ||
-                    mevp->me_type == EVF_WRITE ||
-                    mevp->me_type == EVF_WRITE_ET) &&
-                    mevp->me_fd != STDIN_FILENO)
-                       close(mevp->me_fd);
-
-		if (mevp->teardown)
-			mevp->teardown(mevp->teardown_param);
-
-		free(mevp);
+		mevent_fd_remove(mevp);
+		epoll_ctl(mevent_loops[mevp->me_loop].epoll_fd,
+			  EPOLL_CTL_DEL, mevp->me_fd, NULL);
+		mevent_free(mevp);
 	}
 
 	/* the mevp in del_head was removed from epoll when add it
 	 * to del_head already.
 	 */
-	list_foreach_safe(mevp, &del_head, me_list, tmpp) {
-		LIST_REMOVE(mevp, me_list);
-
-               if ((mevp->me_type == EVF_READ ||
-                    mevp->me_type == EVF_READ_ET ||
-                    mevp->me_type == EVF_WRITE ||
-                    mevp->me_type == EVF_WRITE_ET) &&
-                    mevp->me_fd != STDIN_FILENO)
-                       close(mevp->me_fd);
-
-		if (mevp->teardown)
-			mevp->teardown(mevp->teardown_param);
-
-		free(mevp);
+	for (i = 0; i < mevent_nr_loops; i++) {
+		list_foreach_safe(mevp, &mevent_loops[i].del_head, me_list, tmpp) {
+			LIST_REMOVE(mevp, me_list);
+			mevent_free(mevp);
+		}
 	}
 	mevent_qunlock();
 }
@@ -194,19 +282,26 @@ mevent_handle(struct epoll_event *kev, int numev)
 {
 	int i;
 	struct mevent *mevp;
+	struct cpu_acct *acct;
+	uint64_t start;
 
 	for (i = 0; i < numev; i++) {
 		mevp = kev[i].data.ptr;
 
-		if (mevp->me_state)
+		if (mevp->me_state) {
+			/* the callback may delete, and so free, mevp */
+			acct = mevp->me_acct;
+			start = cpu_acct_now();
 			(*mevp->run)(mevp->me_fd, mevp->me_type, mevp->run_param);
+			cpu_acct_event_end(acct, start);
+		}
 	}
 }
 
 struct mevent *
-mevent_add(int tfd, enum ev_type type,
-	   void (*run)(int, enum ev_type, void *), void *run_param,
-	   void (*teardown)(void *), void *teardown_param)
+mevent_add_loop(int loop, int tfd, enum ev_type type,
+		void (*run)(int, enum ev_type, void *), void *run_param,
+		void (*teardown)(void *), void *teardown_param)
 {
 	int ret;
 	struct epoll_event ee;
@@ -218,15 +313,15 @@ mevent_add(int tfd, enum ev_type type,
 	if (type == EVF_TIMER)
 		return NULL;
 
+	if (loop < 0 || loop >= mevent_nr_loops)
+		return NULL;
+
 	mevent_qlock();
 	/* Verify that the fd/type tuple is not present in the list */
-	LIST_FOREACH(lp, &global_head, me_list) {
-		if (lp->me_fd == tfd && lp->me_type == type) {
-			mevent_qunlock();
-			return lp;
-		}
-	}
+	lp = mevent_fd_find(tfd, type);
 	mevent_qunlock();
+	if (lp != NULL)
+		return lp;
 
 	/*
 	 * Allocate an entry, populate it, and add it to the list.
@@ -238,25 +333,45 @@ mevent_add(int tfd, enum ev_type type,
 	mevp->me_fd = tfd;
 	mevp->me_type = type;
 	mevp->me_state = 1;
+	mevp->me_loop = loop;
+	mevp->me_acct = cpu_acct_current();
 
 	mevp->run = run;
 	mevp->run_param = run_param;
 	mevp->teardown = teardown;
 	mevp->teardown_param = teardown_param;
 
-	ee.events = mevent_kq_filter(mevp);
-	ee.data.ptr = mevp;
-	ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mevp->me_fd, &ee);
-	if (ret == 0) {
-		mevent_qlock();
+	mevent_qlock();
+	ret = mevent_fd_insert(mevp);
+	if (ret == 0)
 		LIST_INSERT_HEAD(&global_head, mevp, me_list);
-		mevent_qunlock();
-
-		return mevp;
-	} else {
+	mevent_qunlock();
+	if (ret != 0) {
 		free(mevp);
 		return NULL;
 	}
+
+	ee.events = mevent_kq_filter(mevp);
+	ee.data.ptr = mevp;
+	ret = epoll_ctl(mevent_loops[loop].epoll_fd, EPOLL_CTL_ADD, mevp->me_fd, &ee);
+	if (ret == 0)
+		return mevp;
+
+	mevent_qlock();
+	LIST_REMOVE(mevp, me_list);
+	mevent_fd_remove(mevp);
+	mevent_qunlock();
+	free(mevp);
+	return NULL;
+}
+
+struct mevent *
+mevent_add(int tfd, enum ev_type type,
+	   void (*run)(int, enum ev_type, void *), void *run_param,
+	   void (*teardown)(void *), void *teardown_param)
+{
+	return mevent_add_loop(MEVENT_LOOP_MAIN, tfd, type, run, run_param,
+			       teardown, teardown_param);
 }
 
 int
@@ -264,24 +379,20 @@ mevent_enable(struct mevent *evp)
 {
 	int ret;
 	struct epoll_event ee;
-	struct mevent *lp, *mevp = NULL;
+	struct mevent *mevp;
 
 	mevent_qlock();
-	/* Verify that the fd/type tuple is not present in the list */
-	LIST_FOREACH(lp, &global_head, me_list) {
-		if (lp == evp) {
-			mevp = lp;
-			break;
-		}
-	}
+	/* Verify that the event is still registered */
+	mevp = mevent_fd_find(evp->me_fd, evp->me_type);
 	mevent_qunlock();
 
-	if (!mevp)
+	if (mevp != evp)
 		return -1;
 
 	ee.events = mevent_kq_filter(mevp);
 	ee.data.ptr = mevp;
-	ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mevp->me_fd, &ee);
+	ret = epoll_ctl(mevent_loops[mevp->me_loop].epoll_fd, EPOLL_CTL_ADD,
+			mevp->me_fd, &ee);
 	if (ret < 0 && errno == EEXIST)
 		ret = 0;
 
@@ -293,7 +404,8 @@ mevent_disable(struct mevent *evp)
 {
 	int ret;
 
-	ret = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, evp->me_fd, NULL);
+	ret = epoll_ctl(mevent_loops[evp->me_loop].epoll_fd, EPOLL_CTL_DEL,
+			evp->me_fd, NULL);
 	if (ret < 0 && errno == ENOENT)
 		ret = 0;
 
@@ -304,19 +416,19 @@ static void
 mevent_add_to_del_list(struct mevent *evp, int closefd)
 {
 	mevent_qlock();
-	LIST_INSERT_HEAD(&del_head, evp, me_list);
+	LIST_INSERT_HEAD(&mevent_loops[evp->me_loop].del_head, evp, me_list);
 	mevent_qunlock();
 
-	mevent_notify();
+	mevent_loop_notify(evp->me_loop);
 }
 
 static void
-mevent_drain_del_list(void)
+mevent_drain_del_list(int loop)
 {
 	struct mevent *evp, *tmpp;
 
 	mevent_qlock();
-	list_foreach_safe(evp, &del_head, me_list, tmpp) {
+	list_foreach_safe(evp, &mevent_loops[loop].del_head, me_list, tmpp) {
 		LIST_REMOVE(evp, me_list);
 		if (evp->closefd) {
 			close(evp->me_fd);
@@ -334,12 +446,14 @@ mevent_delete_event(struct mevent *evp, int closefd)
 {
 	mevent_qlock();
 	LIST_REMOVE(evp, me_list);
+	mevent_fd_remove(evp);
 	mevent_qunlock();
 	evp->me_state = 0;
 	evp->closefd = closefd;
 
-	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, evp->me_fd, NULL);
-	if (!is_dispatch_thread() && evp->teardown != NULL) {
+	epoll_ctl(mevent_loops[evp->me_loop].epoll_fd, EPOLL_CTL_DEL,
+		  evp->me_fd, NULL);
+	if (!is_dispatch_thread(evp->me_loop) && evp->teardown != NULL) {
 		mevent_add_to_del_list(evp, closefd);
 	} else {
 		if (evp->closefd) {
@@ -365,68 +479,49 @@ mevent_delete_close(struct mevent *evp)
 	return mevent_delete_event(evp, 1);
 }
 
-static void
-mevent_set_name(void)
+/*
+ * Open the pipe that will be used for other threads to force the
+ * blocking epoll call of the loop to exit by writing to it.
+ */
+static int
+mevent_loop_open_pipe(int loop)
 {
-	pthread_setname_np(mevent_tid, "mevent");
-}
+	struct mevent_loop *l = &mevent_loops[loop];
 
-int
-mevent_init(void)
-{
-	epoll_fd = epoll_create1(0);
-	assert(epoll_fd >= 0);
+	if (pipe(l->pipefd) < 0) {
+		perror("pipe");
+		return -1;
+	}
 
-	if (epoll_fd >= 0)
-		return 0;
-	else
+	/*
+	 * Add internal event handler for the pipe write fd
+	 */
+	if (mevent_add_loop(loop, l->pipefd[0], EVF_READ, mevent_pipe_read,
+			    NULL, NULL, NULL) == NULL) {
+		close(l->pipefd[0]);
+		close(l->pipefd[1]);
+		l->pipefd[1] = 0;
 		return -1;
-}
+	}
 
-void
-mevent_deinit(void)
-{
-	mevent_destroy();
-	close(epoll_fd);
-	if (mevent_pipefd[1] != 0)
-		close(mevent_pipefd[1]);
+	return 0;
 }
 
-void
-mevent_dispatch(void)
+/* Wait for and run the events of a loop, until quit or a suspend */
+static void
+mevent_loop_run(int loop)
 {
+	struct mevent_loop *l = &mevent_loops[loop];
 	struct epoll_event eventlist[MEVENT_MAX];
-
-	struct mevent *pipev;
 	int ret;
 
-	mevent_tid = pthread_self();
-	mevent_set_name();
-
-	/*
-	 * Open the pipe that will be used for other threads to force
-	 * the blocking kqueue call to exit by writing to it. Set the
-	 * descriptor to non-blocking.
-	 */
-	ret = pipe(mevent_pipefd);
-	if (ret < 0) {
-		perror("pipe");
-		exit(0);
-	}
-
-	/*
-	 * Add internal event handler for the pipe write fd
-	 */
-	pipev = mevent_add(mevent_pipefd[0], EVF_READ, mevent_pipe_read, NULL, NULL, NULL);
-	assert(pipev != NULL);
-
-	for (;;) {
+	while (!l->quit) {
 		int suspend_mode;
 
 		/*
 		 * Block awaiting events
 		 */
-		ret = epoll_wait(epoll_fd, eventlist, MEVENT_MAX, -1);
+		ret = epoll_wait(l->epoll_fd, eventlist, MEVENT_MAX, -1);
 		if (ret == -1 && errno != EINTR)
 			perror("Error return from epoll_wait");
 
@@ -434,7 +529,10 @@ mevent_dispatch(void)
 		 * Handle reported events
 		 */
 		mevent_handle(eventlist, ret);
-		mevent_drain_del_list();
+		mevent_drain_del_list(loop);
+
+		if (loop != MEVENT_LOOP_MAIN)
+			continue;
 
 		suspend_mode = vm_get_suspend_mode();
 		if ((suspend_mode != VM_SUSPEND_NONE) &&
@@ -443,3 +541,134 @@ mevent_dispatch(void)
 			break;
 	}
 }
+
+static void *
+mevent_loop_thread(void *param)
+{
+	struct mevent_loop *l = param;
+
+	pthread_setname_np(pthread_self(), l->name);
+	mevent_loop_run(l - mevent_loops);
+	return NULL;
+}
+
+static int
+mevent_loop_init(struct mevent_loop *l, const char *name)
+{
+	memset(l, 0, sizeof(*l));
+	strncpy(l->name, name, sizeof(l->name) - 1);
+	LIST_INIT(&l->del_head);
+	l->epoll_fd = epoll_create1(0);
+
+	return (l->epoll_fd >= 0) ? 0 : -1;
+}
+
+int
+mevent_loop_get(const char *name)
+{
+	struct mevent_loop *l;
+	int loop;
+
+	mevent_qlock();
+	for (loop = MEVENT_LOOP_MAIN + 1; loop < mevent_nr_loops; loop++) {
+		if (strncmp(mevent_loops[loop].name, name,
+			    sizeof(mevent_loops[loop].name) - 1) == 0) {
+			mevent_qunlock();
+			/* a loop which failed to start is never used */
+			return mevent_loops[loop].running ? loop : MEVENT_LOOP_MAIN;
+		}
+	}
+
+	if (mevent_nr_loops == MEVENT_LOOPS_MAX) {
+		mevent_qunlock();
+		fprintf(stderr, "mevent: no loop left for %s\n", name);
+		return -1;
+	}
+
+	l = &mevent_loops[mevent_nr_loops];
+	if (mevent_loop_init(l, name) != 0) {
+		mevent_qunlock();
+		return -1;
+	}
+	loop = mevent_nr_loops++;
+	mevent_qunlock();
+
+	if (mevent_loop_open_pipe(loop) != 0)
+		goto fail;
+
+	l->running = true;
+	if (pthread_create(&l->tid, NULL, mevent_loop_thread, l) != 0) {
+		l->running = false;
+		goto fail;
+	}
+
+	return loop;
+
+fail:
+	fprintf(stderr, "mevent: failed to start loop %s\n", name);
+	return MEVENT_LOOP_MAIN;
+}
+
+/* Stop the threads of the named loops, their events go with the others */
+static void
+mevent_loops_stop(void)
+{
+	struct mevent_loop *l;
+	int loop;
+
+	for (loop = MEVENT_LOOP_MAIN + 1; loop < mevent_nr_loops; loop++) {
+		l = &mevent_loops[loop];
+		if (!l->running)
+			continue;
+		l->quit = true;
+		mevent_loop_notify(loop);
+		pthread_join(l->tid, NULL);
+		l->running = false;
+	}
+}
+
+int
+mevent_init(void)
+{
+	int ret;
+
+	LIST_INIT(&global_head);
+	ret = mevent_loop_init(&mevent_loops[MEVENT_LOOP_MAIN], "mevent");
+	assert(ret == 0);
+	mevent_nr_loops = 1;
+
+	return ret;
+}
+
+void
+mevent_deinit(void)
+{
+	struct mevent_loop *l;
+	int loop;
+
+	mevent_loops_stop();
+	mevent_destroy();
+
+	for (loop = 0; loop < mevent_nr_loops; loop++) {
+		l = &mevent_loops[loop];
+		close(l->epoll_fd);
+		if (l->pipefd[1] != 0)
+			close(l->pipefd[1]);
+	}
+	mevent_nr_loops = 0;
+}
+
+void
+mevent_dispatch(void)
+{
+	struct mevent_loop *l = &mevent_loops[MEVENT_LOOP_MAIN];
+
+	l->tid = pthread_self();
+	l->running = true;
+	pthread_setname_np(l->tid, l->name);
+
+	if (l->pipefd[1] == 0 && mevent_loop_open_pipe(MEVENT_LOOP_MAIN) != 0)
+		exit(0);
+
+	mevent_loop_run(MEVENT_LOOP_MAIN);
+}
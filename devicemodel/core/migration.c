@@ -0,0 +1,1071 @@
+/*
+ * Copyright (C) <2018> Intel Corporation
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <zlib.h>
+
+#include "dm.h"
+#include "vmmapi.h"
+#include "pci_core.h"
+#include "virtio.h"
+#include "block_if.h"
+#include "balloon.h"
+#include "mevent.h"
+#include "cpu_acct.h"
+#include "snapshot.h"
+#include "migration.h"
+
+/*
+ * The source sends the header and the target answers whether its VM
+ * matches. Then come records: pages, the state of the vCPUs and of the PCI
+ * devices, and the end, to which the target answers whether it loaded
+ * everything. Both hosts being x86, all is in their byte order.
+ */
+#define MIGRATION_MAGIC		0x5247494d4e524341UL	/* "ACRNMIGR" */
+#define MIGRATION_VERSION	1U
+
+#define MIG_PAGE_SHIFT		12
+#define MIG_PAGE_SIZE		(1UL << MIG_PAGE_SHIFT)
+#define MIG_BATCH		64	/* pages of a record, compressed at once */
+#define MIG_LOG_CHUNK		((size_t)ACRN_DIRTY_LOG_PAGES_MAX << MIG_PAGE_SHIFT)
+
+/* the VM is paused once a round finds so few pages dirty, or at the last */
+#define MIG_DIRTY_LOW		1024
+#define MIG_ROUNDS_MAX		30
+
+#define MIG_IDLE_MS		2000	/* for the I/O in flight to complete */
+#define MIG_TIMEOUT_S		60	/* of a read or write on the socket */
+#define MIG_EXIT_DELAY_S	5	/* for acrnctl to see the end */
+
+#define MIG_REC_PAGES		1U
+#define MIG_REC_STATE		2U
+#define MIG_REC_END		3U
+
+#define MIG_REC_ZLIB		0x1U	/* the pages are compressed */
+#define MIG_GPA_ZERO		0x1UL	/* in the gpas, a page of zeroes */
+
+struct mig_header {
+	uint64_t	magic;
+	uint32_t	version;
+	uint32_t	ncpus;
+	uint32_t	nr_mem_segs;
+	uint32_t	reserved;
+	uint64_t	mem_gpa[VM_MEM_SEGS_MAX];
+	uint64_t	mem_len[VM_MEM_SEGS_MAX];
+};
+
+/*
+ * MIG_REC_PAGES is followed by count gpas, then len bytes: the pages which
+ * are not zeroes, one after the other, raw or compressed. MIG_REC_STATE is
+ * followed by the registers of each vCPU, then the len bytes save_pci()
+ * wrote for count devices.
+ */
+struct mig_record {
+	uint32_t	type;
+	uint32_t	count;
+	uint32_t	len;
+	uint32_t	flags;
+};
+
+struct migration {
+	struct vmctx	*ctx;
+	int		fd;
+	char		dest[64];
+	bool		logging;	/* of the hypervisor is on */
+	uint64_t	*bitmap;	/* the page of ACRN_DIRTY_LOG_GET */
+	uint64_t	*hash[VM_MEM_SEGS_MAX];	/* of each page last sent */
+	uint64_t	zero_hash;
+
+	/* the record being filled */
+	uint64_t	gpas[MIG_BATCH];
+	int		nr;
+	int		nr_raw;		/* pages in raw */
+	char		*raw;
+	char		*zbuf;
+	uLong		zlen;
+
+	uint64_t	start_ms;
+	struct migration_stats stats;	/* under mig_mtx */
+};
+
+bool migration_log_enabled;
+
+static struct migration mig;
+static pthread_mutex_t mig_mtx = PTHREAD_MUTEX_INITIALIZER;
+static bool mig_running;
+
+/*
+ * The pages migration_log_range() marks, allocated once as the vq threads
+ * may still be in it when the migration ends.
+ */
+static struct vmctx *mig_log_ctx;
+static uint64_t *mig_dm_dirty[VM_MEM_SEGS_MAX];
+
+static uint64_t
+mig_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+void
+migration_log_range(vm_paddr_t gpa, size_t len)
+{
+	const struct vm_mem_seg *seg;
+	uint64_t page, last;
+	int i;
+
+	if (len == 0)
+		return;
+
+	for (i = 0; i < mig_log_ctx->nr_mem_segs; i++) {
+		seg = &mig_log_ctx->mem_segs[i];
+		if (gpa < seg->gpa || gpa - seg->gpa >= seg->len)
+			continue;
+		if (len > seg->len - (gpa - seg->gpa))
+			len = seg->len - (gpa - seg->gpa);
+		page = (gpa - seg->gpa) >> MIG_PAGE_SHIFT;
+		last = (gpa - seg->gpa + len - 1) >> MIG_PAGE_SHIFT;
+		for (; page <= last; page++)
+			__atomic_fetch_or(&mig_dm_dirty[i][page / 64],
+				1UL << (page % 64), __ATOMIC_RELAXED);
+		return;
+	}
+}
+
+/* like snapshot_write(), without a SIGPIPE when the peer is gone */
+static int
+mig_send(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static void
+mig_set_state(struct migration *m, int state, int err)
+{
+	pthread_mutex_lock(&mig_mtx);
+	m->stats.state = state;
+	m->stats.err = err;
+	m->stats.total_ms = mig_now_ms() - m->start_ms;
+	pthread_mutex_unlock(&mig_mtx);
+}
+
+/* FNV-1a over the words of a page, which also tells whether it is zeroes */
+static uint64_t
+mig_hash(const uint64_t *p, bool *zero)
+{
+	uint64_t h = 0xcbf29ce484222325UL, any = 0;
+	size_t i;
+
+	for (i = 0; i < MIG_PAGE_SIZE / sizeof(*p); i++) {
+		any |= p[i];
+		h = (h ^ p[i]) * 0x100000001b3UL;
+	}
+
+	*zero = (any == 0);
+	return h;
+}
+
+/* Send the record being filled */
+static int
+mig_flush(struct migration *m)
+{
+	struct mig_record rec;
+	size_t raw_len = m->nr_raw * MIG_PAGE_SIZE;
+	uLongf zlen = m->zlen;
+	const void *data = m->raw;
+
+	if (m->nr == 0)
+		return 0;
+
+	rec.type = MIG_REC_PAGES;
+	rec.count = m->nr;
+	rec.len = raw_len;
+	rec.flags = 0;
+	if (raw_len != 0 &&
+	    compress2((Bytef *)m->zbuf, &zlen, (const Bytef *)m->raw, raw_len,
+			Z_BEST_SPEED) == Z_OK && zlen < raw_len) {
+		rec.len = zlen;
+		rec.flags = MIG_REC_ZLIB;
+		data = m->zbuf;
+	}
+
+	if (mig_send(m->fd, &rec, sizeof(rec)) != 0 ||
+	    mig_send(m->fd, m->gpas, m->nr * sizeof(m->gpas[0])) != 0 ||
+	    (rec.len != 0 && mig_send(m->fd, data, rec.len) != 0)) {
+		fprintf(stderr, "migration: can't send to %s: %s\n", m->dest,
+			strerror(errno));
+		return -1;
+	}
+
+	pthread_mutex_lock(&mig_mtx);
+	m->stats.sent += m->nr;
+	m->stats.zero += m->nr - m->nr_raw;
+	m->stats.bytes += sizeof(rec) + m->nr * sizeof(m->gpas[0]) + rec.len;
+	pthread_mutex_unlock(&mig_mtx);
+
+	m->nr = 0;
+	m->nr_raw = 0;
+	return 0;
+}
+
+/* Add a page to the record, sending it once full */
+static int
+mig_send_page(struct migration *m, int seg, size_t page)
+{
+	const struct vm_mem_seg *s = &m->ctx->mem_segs[seg];
+	vm_paddr_t gpa = s->gpa + (page << MIG_PAGE_SHIFT);
+	char *copy = m->raw + m->nr_raw * MIG_PAGE_SIZE;
+	bool zero = true;
+
+	/* not backed, reading it would end in a SIGBUS */
+	if (balloon_released(gpa)) {
+		m->hash[seg][page] = m->zero_hash;
+	} else {
+		/* the guest may write the page meanwhile, the copy is sent */
+		memcpy(copy, s->hva + (page << MIG_PAGE_SHIFT), MIG_PAGE_SIZE);
+		m->hash[seg][page] = mig_hash((const uint64_t *)copy, &zero);
+	}
+
+	m->gpas[m->nr++] = zero ? (gpa | MIG_GPA_ZERO) : gpa;
+	if (!zero)
+		m->nr_raw++;
+
+	return (m->nr == MIG_BATCH) ? mig_flush(m) : 0;
+}
+
+/* Send the pages of a bitmap, bit 0 for the page first of seg */
+static int
+mig_send_bitmap(struct migration *m, int seg, size_t first,
+		const uint64_t *bitmap, size_t nr_pages)
+{
+	uint64_t w;
+	size_t i;
+	int bit;
+
+	for (i = 0; i < nr_pages; i += 64) {
+		for (w = bitmap[i / 64]; w != 0; w &= w - 1) {
+			bit = __builtin_ctzl(w);
+			if (i + bit >= nr_pages)
+				break;
+			if (mig_send_page(m, seg, first + i + bit) != 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+mig_send_all(struct migration *m)
+{
+	size_t page;
+	int i;
+
+	for (i = 0; i < m->ctx->nr_mem_segs; i++) {
+		for (page = 0; page < m->ctx->mem_segs[i].len >> MIG_PAGE_SHIFT;
+				page++) {
+			if (mig_send_page(m, i, page) != 0)
+				return -1;
+		}
+	}
+
+	return mig_flush(m);
+}
+
+/*
+ * Send the pages the vCPUs wrote since the previous round, returns how
+ * many or -1.
+ */
+static int64_t
+mig_send_dirty(struct migration *m)
+{
+	const struct vm_mem_seg *s;
+	uint64_t nr_dirty;
+	int64_t total = 0;
+	size_t off, len;
+	int i;
+
+	for (i = 0; i < m->ctx->nr_mem_segs; i++) {
+		s = &m->ctx->mem_segs[i];
+		for (off = 0; off < s->len; off += len) {
+			len = s->len - off;
+			if (len > MIG_LOG_CHUNK)
+				len = MIG_LOG_CHUNK;
+			if (vm_dirty_log(m->ctx, ACRN_DIRTY_LOG_GET, s->gpa + off,
+					len, m->bitmap, &nr_dirty) != 0) {
+				fprintf(stderr, "migration: no dirty pages of "
+					"0x%lx: %s\n", s->gpa + off,
+					strerror(errno));
+				return -1;
+			}
+			total += nr_dirty;
+			if (nr_dirty != 0 && mig_send_bitmap(m, i,
+					off >> MIG_PAGE_SHIFT, m->bitmap,
+					len >> MIG_PAGE_SHIFT) != 0)
+				return -1;
+		}
+	}
+
+	return (mig_flush(m) == 0) ? total : -1;
+}
+
+/*
+ * Send again the pages which changed since they were sent, the writes of
+ * the vCPUs when there is no dirty page logging, and those of the SOS
+ * which nothing logs.
+ */
+static int
+mig_send_changed(struct migration *m)
+{
+	const struct vm_mem_seg *s;
+	uint64_t h;
+	size_t page;
+	bool zero;
+	int i;
+
+	for (i = 0; i < m->ctx->nr_mem_segs; i++) {
+		s = &m->ctx->mem_segs[i];
+		for (page = 0; page < s->len >> MIG_PAGE_SHIFT; page++) {
+			if (balloon_released(s->gpa + (page << MIG_PAGE_SHIFT)))
+				h = m->zero_hash;
+			else
+				h = mig_hash((const uint64_t *)(s->hva +
+					(page << MIG_PAGE_SHIFT)), &zero);
+			if (h != m->hash[i][page] &&
+			    mig_send_page(m, i, page) != 0)
+				return -1;
+		}
+	}
+
+	return mig_flush(m);
+}
+
+/* the pages the DM wrote, with the VM paused and its I/O completed */
+static int
+mig_send_dm_dirty(struct migration *m)
+{
+	int i;
+
+	virtio_log_rings();
+	for (i = 0; i < m->ctx->nr_mem_segs; i++) {
+		if (mig_send_bitmap(m, i, 0, mig_dm_dirty[i],
+				m->ctx->mem_segs[i].len >> MIG_PAGE_SHIFT) != 0)
+			return -1;
+	}
+
+	return mig_flush(m);
+}
+
+static int
+mig_send_state(struct migration *m)
+{
+	struct acrn_set_vcpu_regs regs;
+	struct mig_record rec;
+	FILE *f;
+	off_t len;
+	ssize_t n;
+	int fd, nr, i, ret = -1;
+
+	/* save_pci() writes the devices one by one, their count comes last */
+	f = tmpfile();
+	if (f == NULL)
+		return -1;
+	fd = fileno(f);
+
+	nr = save_pci(m->ctx, fd);
+	len = lseek(fd, 0, SEEK_CUR);
+	if (nr < 0 || len < 0 || lseek(fd, 0, SEEK_SET) != 0)
+		goto out;
+
+	rec.type = MIG_REC_STATE;
+	rec.count = nr;
+	rec.len = len;
+	rec.flags = 0;
+	if (mig_send(m->fd, &rec, sizeof(rec)) != 0)
+		goto out;
+
+	for (i = 0; i < guest_ncpus; i++) {
+		if (vm_get_vcpu_regs(m->ctx, (uint16_t)i, &regs) != 0) {
+			fprintf(stderr, "migration: can't get the regs of "
+				"vcpu %d\n", i);
+			goto out;
+		}
+		if (mig_send(m->fd, &regs.vcpu_regs,
+				sizeof(regs.vcpu_regs)) != 0)
+			goto out;
+	}
+
+	while ((n = read(fd, m->raw, MIG_BATCH * MIG_PAGE_SIZE)) > 0) {
+		if (mig_send(m->fd, m->raw, n) != 0)
+			goto out;
+	}
+	ret = (n == 0) ? 0 : -1;
+
+out:
+	fclose(f);
+	return ret;
+}
+
+static int
+mig_set_timeout(int fd)
+{
+	struct timeval tv = { .tv_sec = MIG_TIMEOUT_S };
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0 ||
+	    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0)
+		return -1;
+	return 0;
+}
+
+/* host:port, or [host]:port for IPv6, host being NULL for "port" alone */
+static struct addrinfo *
+mig_resolve(const char *addr, bool passive)
+{
+	struct addrinfo hints, *res;
+	char host[64];
+	const char *port;
+	size_t len;
+
+	port = strrchr(addr, ':');
+	if (port == NULL) {
+		if (!passive)
+			return NULL;
+		len = 0;
+		port = addr;
+	} else {
+		len = port - addr;
+		port++;
+	}
+
+	if (len >= 2 && addr[0] == '[' && addr[len - 1] == ']') {
+		addr++;
+		len -= 2;
+	}
+	if (len >= sizeof(host))
+		return NULL;
+	memcpy(host, addr, len);
+	host[len] = '\0';
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+	if (getaddrinfo(len ? host : NULL, port, &hints, &res) != 0)
+		return NULL;
+
+	return res;
+}
+
+static int
+mig_connect(struct migration *m)
+{
+	struct addrinfo *res, *ai;
+	int fd = -1;
+
+	res = mig_resolve(m->dest, false);
+	if (res == NULL) {
+		fprintf(stderr, "migration: bad destination %s\n", m->dest);
+		return -1;
+	}
+
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (mig_set_timeout(fd) == 0 &&
+		    connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+
+	if (fd < 0)
+		fprintf(stderr, "migration: can't connect to %s: %s\n",
+			m->dest, strerror(errno));
+	return fd;
+}
+
+/* Send the header, 0 if the target takes the VM */
+static int
+mig_handshake(struct migration *m)
+{
+	struct mig_header hdr;
+	int32_t status;
+	int i;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = MIGRATION_MAGIC;
+	hdr.version = MIGRATION_VERSION;
+	hdr.ncpus = guest_ncpus;
+	hdr.nr_mem_segs = m->ctx->nr_mem_segs;
+	for (i = 0; i < m->ctx->nr_mem_segs; i++) {
+		hdr.mem_gpa[i] = m->ctx->mem_segs[i].gpa;
+		hdr.mem_len[i] = m->ctx->mem_segs[i].len;
+	}
+
+	if (mig_send(m->fd, &hdr, sizeof(hdr)) != 0 ||
+	    snapshot_read(m->fd, &status, sizeof(status)) != 0)
+		return -EIO;
+	if (status != 0)
+		fprintf(stderr, "migration: %s refused the VM\n", m->dest);
+	return status;
+}
+
+static void
+mig_stop_logging(struct migration *m)
+{
+	int i;
+
+	__atomic_store_n(&migration_log_enabled, false, __ATOMIC_RELEASE);
+	if (!m->logging)
+		return;
+
+	for (i = 0; i < m->ctx->nr_mem_segs; i++)
+		vm_dirty_log(m->ctx, ACRN_DIRTY_LOG_STOP, m->ctx->mem_segs[i].gpa,
+			m->ctx->mem_segs[i].len, NULL, NULL);
+	m->logging = false;
+}
+
+static void
+mig_start_logging(struct migration *m)
+{
+	int i;
+
+	for (i = 0; i < m->ctx->nr_mem_segs; i++)
+		memset(mig_dm_dirty[i], 0,
+			roundup2(m->ctx->mem_segs[i].len >> MIG_PAGE_SHIFT, 64) / 8);
+	__atomic_store_n(&migration_log_enabled, true, __ATOMIC_RELEASE);
+
+	for (i = 0; i < m->ctx->nr_mem_segs; i++) {
+		if (vm_dirty_log(m->ctx, ACRN_DIRTY_LOG_START,
+				m->ctx->mem_segs[i].gpa,
+				m->ctx->mem_segs[i].len, NULL, NULL) != 0)
+			break;
+	}
+	if (i == m->ctx->nr_mem_segs) {
+		m->logging = true;
+		return;
+	}
+
+	fprintf(stderr, "migration: no dirty page logging, the VM is paused "
+		"for the whole copy\n");
+	while (i-- > 0)
+		vm_dirty_log(m->ctx, ACRN_DIRTY_LOG_STOP, m->ctx->mem_segs[i].gpa,
+			m->ctx->mem_segs[i].len, NULL, NULL);
+}
+
+/* wait, with the VM paused, for the emulation of its I/O to complete */
+static int
+mig_wait_idle(struct migration *m)
+{
+	int ms;
+
+	if (vm_wait_ioreqs_idle(m->ctx, MIG_IDLE_MS) != 0)
+		return -1;
+
+	for (ms = 0; !virtio_vqs_idle(); ms++) {
+		if (ms == MIG_IDLE_MS)
+			return -1;
+		usleep(1000);
+	}
+
+	return 0;
+}
+
+/* Everything but the pre-copy, with the VM paused */
+static int
+mig_stop_and_copy(struct migration *m)
+{
+	struct mig_record rec;
+	int32_t status;
+	int err;
+
+	if (mig_wait_idle(m) != 0) {
+		fprintf(stderr, "migration: I/O of the VM still in flight\n");
+		return -EBUSY;
+	}
+
+	if (m->logging) {
+		if (mig_send_dirty(m) < 0 || mig_send_dm_dirty(m) != 0)
+			return -EIO;
+	} else if (mig_send_changed(m) != 0) {
+		return -EIO;
+	}
+
+	/* the images are opened by the target next */
+	err = blockif_sync_all();
+	if (err != 0) {
+		fprintf(stderr, "migration: can't flush the disks: %s\n",
+			strerror(err));
+		return -err;
+	}
+
+	if (mig_send_state(m) != 0) {
+		fprintf(stderr, "migration: can't send the state of the VM\n");
+		return -EIO;
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = MIG_REC_END;
+	if (mig_send(m->fd, &rec, sizeof(rec)) != 0)
+		return -EIO;
+
+	/*
+	 * Without an answer, the VM may run on the target already: it is
+	 * not resumed here, of two copies running on the same disks.
+	 */
+	if (snapshot_read(m->fd, &status, sizeof(status)) != 0) {
+		fprintf(stderr, "migration: no answer from %s, the VM is "
+			"left paused\n", m->dest);
+		return -ETIMEDOUT;
+	}
+	if (status != 0) {
+		fprintf(stderr, "migration: %s failed to load the VM\n",
+			m->dest);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static void *
+mig_thread(void *arg)
+{
+	struct migration *m = arg;
+	uint64_t pause_ms;
+	int64_t dirty;
+	int err, i;
+
+	m->fd = mig_connect(m);
+	if (m->fd < 0) {
+		err = -ECONNREFUSED;
+		goto fail;
+	}
+
+	err = mig_handshake(m);
+	if (err != 0)
+		goto fail;
+
+	balloon_hold(true);
+	mig_start_logging(m);
+
+	err = -EIO;
+	if (mig_send_all(m) != 0)
+		goto fail;
+
+	while (m->logging && m->stats.round < MIG_ROUNDS_MAX) {
+		dirty = mig_send_dirty(m);
+		if (dirty < 0)
+			goto fail;
+
+		pthread_mutex_lock(&mig_mtx);
+		m->stats.round++;
+		m->stats.dirty = dirty;
+		pthread_mutex_unlock(&mig_mtx);
+		if (dirty < MIG_DIRTY_LOW)
+			break;
+	}
+
+	/* the writes of the SOS up to now, while the VM still runs */
+	if (m->logging && mig_send_changed(m) != 0)
+		goto fail;
+
+	vm_pause(m->ctx);
+	pause_ms = mig_now_ms();
+	mig_set_state(m, MIGRATION_STOPCOPY, 0);
+
+	err = mig_stop_and_copy(m);
+	mig_stop_logging(m);
+	if (err == -ETIMEDOUT) {
+		mig_set_state(m, MIGRATION_FAILED, err);
+		goto out;
+	}
+	if (err != 0) {
+		if (vm_unpause(m->ctx) != 0)
+			fprintf(stderr, "migration: can't resume the VM\n");
+		goto fail;
+	}
+
+	pthread_mutex_lock(&mig_mtx);
+	m->stats.downtime_ms = mig_now_ms() - pause_ms;
+	pthread_mutex_unlock(&mig_mtx);
+	mig_set_state(m, MIGRATION_DONE, 0);
+	printf("migration: VM running on %s, %lu pages sent in %u rounds, "
+		"%lu ms down\n", m->dest, m->stats.sent, m->stats.round,
+		m->stats.downtime_ms);
+
+	sleep(MIG_EXIT_DELAY_S);
+	vm_set_suspend_mode(VM_SUSPEND_POWEROFF);
+	mevent_notify();
+	goto out;
+
+fail:
+	mig_stop_logging(m);
+	mig_set_state(m, MIGRATION_FAILED, err);
+	fprintf(stderr, "migration: to %s failed, the VM runs here\n",
+		m->dest);
+out:
+	balloon_hold(false);
+	if (m->fd >= 0)
+		close(m->fd);
+	for (i = 0; i < VM_MEM_SEGS_MAX; i++) {
+		free(m->hash[i]);
+		m->hash[i] = NULL;
+	}
+	free(m->bitmap);
+	free(m->raw);
+	free(m->zbuf);
+
+	pthread_mutex_lock(&mig_mtx);
+	mig_running = false;
+	pthread_mutex_unlock(&mig_mtx);
+	return NULL;
+}
+
+/* what the migration needs besides the vCPUs, all of it saved */
+static int
+mig_check_vm(struct vmctx *ctx)
+{
+	FILE *f;
+	int nr;
+
+	if (guest_ncpus != 1) {
+		fprintf(stderr, "migration: only single vCPU VMs are "
+			"supported\n");
+		return -EINVAL;
+	}
+
+	/* the DMA of passthrough devices isn't logged */
+	if (pci_has_devtype("passthru")) {
+		fprintf(stderr, "migration: the VM has passthrough devices\n");
+		return -EINVAL;
+	}
+
+	f = tmpfile();
+	if (f == NULL)
+		return -errno;
+	nr = save_pci(ctx, fileno(f));
+	fclose(f);
+
+	return (nr < 0) ? -EINVAL : 0;
+}
+
+static int
+mig_alloc(struct vmctx *ctx)
+{
+	struct migration *m = &mig;
+	size_t nr_pages;
+	bool zero;
+	int i;
+
+	m->zlen = compressBound(MIG_BATCH * MIG_PAGE_SIZE);
+	m->raw = malloc(MIG_BATCH * MIG_PAGE_SIZE);
+	m->zbuf = malloc(m->zlen);
+	if (m->raw == NULL || m->zbuf == NULL ||
+	    posix_memalign((void **)&m->bitmap, MIG_PAGE_SIZE,
+			MIG_PAGE_SIZE) != 0)
+		return -ENOMEM;
+
+	for (i = 0; i < ctx->nr_mem_segs; i++) {
+		nr_pages = ctx->mem_segs[i].len >> MIG_PAGE_SHIFT;
+		m->hash[i] = calloc(nr_pages, sizeof(uint64_t));
+		if (mig_dm_dirty[i] == NULL)
+			mig_dm_dirty[i] = calloc(roundup2(nr_pages, 64) / 64,
+				sizeof(uint64_t));
+		if (m->hash[i] == NULL || mig_dm_dirty[i] == NULL)
+			return -ENOMEM;
+	}
+
+	mig_log_ctx = ctx;
+
+	memset(m->raw, 0, MIG_PAGE_SIZE);
+	m->zero_hash = mig_hash((const uint64_t *)m->raw, &zero);
+	return 0;
+}
+
+int
+migration_start(struct vmctx *ctx, const char *dest)
+{
+	struct migration *m = &mig;
+	pthread_t tid;
+	int err, i;
+
+	pthread_mutex_lock(&mig_mtx);
+	if (mig_running) {
+		pthread_mutex_unlock(&mig_mtx);
+		return -EBUSY;
+	}
+	mig_running = true;
+	pthread_mutex_unlock(&mig_mtx);
+
+	err = mig_check_vm(ctx);
+	if (err != 0)
+		goto fail;
+
+	pthread_mutex_lock(&mig_mtx);
+	memset(m, 0, sizeof(*m));
+	m->ctx = ctx;
+	m->fd = -1;
+	snprintf(m->dest, sizeof(m->dest), "%s", dest);
+	m->start_ms = mig_now_ms();
+	m->stats.state = MIGRATION_PRECOPY;
+	pthread_mutex_unlock(&mig_mtx);
+
+	err = mig_alloc(ctx);
+	if (err != 0)
+		goto free;
+
+	if (pthread_create(&tid, NULL, mig_thread, m) != 0) {
+		err = -errno;
+		goto free;
+	}
+	pthread_detach(tid);
+	dm_thread_setname(tid, "migration");
+	return 0;
+
+free:
+	for (i = 0; i < VM_MEM_SEGS_MAX; i++) {
+		free(m->hash[i]);
+		m->hash[i] = NULL;
+	}
+	free(m->bitmap);
+	free(m->raw);
+	free(m->zbuf);
+fail:
+	pthread_mutex_lock(&mig_mtx);
+	m->stats.state = MIGRATION_FAILED;
+	m->stats.err = err;
+	mig_running = false;
+	pthread_mutex_unlock(&mig_mtx);
+	return err;
+}
+
+void
+migration_get_stats(struct migration_stats *stats)
+{
+	pthread_mutex_lock(&mig_mtx);
+	*stats = mig.stats;
+	if (mig_running)
+		stats->total_ms = mig_now_ms() - mig.start_ms;
+	pthread_mutex_unlock(&mig_mtx);
+}
+
+/* the guest memory of gpa, NULL if the page is not in the VM */
+static char *
+mig_page_hva(struct vmctx *ctx, uint64_t gpa)
+{
+	const struct vm_mem_seg *seg;
+	int i;
+
+	if (gpa & (MIG_PAGE_SIZE - 1))
+		return NULL;
+
+	for (i = 0; i < ctx->nr_mem_segs; i++) {
+		seg = &ctx->mem_segs[i];
+		if (gpa >= seg->gpa && gpa - seg->gpa < seg->len)
+			return seg->hva + (gpa - seg->gpa);
+	}
+
+	return NULL;
+}
+
+static int
+mig_recv_pages(struct vmctx *ctx, int fd, const struct mig_record *rec,
+	       uint64_t *gpas, char *raw, char *zbuf, uLong zlen)
+{
+	uLongf raw_len;
+	size_t expected = 0;
+	char *data, *hva;
+	uint32_t i;
+
+	if (rec->count > MIG_BATCH || rec->len > zlen ||
+	    snapshot_read(fd, gpas, rec->count * sizeof(*gpas)) != 0)
+		return -1;
+
+	for (i = 0; i < rec->count; i++) {
+		if (!(gpas[i] & MIG_GPA_ZERO))
+			expected += MIG_PAGE_SIZE;
+	}
+
+	if (rec->len != 0 && snapshot_read(fd, zbuf, rec->len) != 0)
+		return -1;
+
+	data = zbuf;
+	if (rec->flags & MIG_REC_ZLIB) {
+		raw_len = MIG_BATCH * MIG_PAGE_SIZE;
+		if (uncompress((Bytef *)raw, &raw_len, (const Bytef *)zbuf,
+				rec->len) != Z_OK || raw_len != expected)
+			return -1;
+		data = raw;
+	} else if (rec->len != expected) {
+		return -1;
+	}
+
+	for (i = 0; i < rec->count; i++) {
+		hva = mig_page_hva(ctx, gpas[i] & ~MIG_GPA_ZERO);
+		if (hva == NULL)
+			return -1;
+		if (gpas[i] & MIG_GPA_ZERO) {
+			memset(hva, 0, MIG_PAGE_SIZE);
+		} else {
+			memcpy(hva, data, MIG_PAGE_SIZE);
+			data += MIG_PAGE_SIZE;
+		}
+	}
+
+	return 0;
+}
+
+static int
+mig_recv(struct vmctx *ctx, int fd)
+{
+	uint64_t gpas[MIG_BATCH];
+	struct mig_header hdr;
+	struct mig_record rec;
+	char *raw, *zbuf = NULL;
+	uLong zlen;
+	int32_t status = -EINVAL;
+	int i, ret = -1;
+
+	if (snapshot_read(fd, &hdr, sizeof(hdr)) != 0 ||
+	    hdr.magic != MIGRATION_MAGIC ||
+	    hdr.version != MIGRATION_VERSION) {
+		fprintf(stderr, "migration: not a migration stream\n");
+		return -1;
+	}
+
+	/* as with a snapshot, the hypervisor starts the BSP only */
+	if (hdr.ncpus == 1 && guest_ncpus == 1 &&
+	    hdr.nr_mem_segs == ctx->nr_mem_segs) {
+		status = 0;
+		for (i = 0; i < ctx->nr_mem_segs; i++) {
+			if (hdr.mem_gpa[i] != ctx->mem_segs[i].gpa ||
+			    hdr.mem_len[i] != ctx->mem_segs[i].len)
+				status = -EINVAL;
+		}
+	}
+	if (mig_send(fd, &status, sizeof(status)) != 0 || status != 0) {
+		fprintf(stderr, "migration: the VM sent doesn't match\n");
+		return -1;
+	}
+
+	zlen = compressBound(MIG_BATCH * MIG_PAGE_SIZE);
+	raw = malloc(MIG_BATCH * MIG_PAGE_SIZE);
+	zbuf = malloc(zlen);
+	if (raw == NULL || zbuf == NULL)
+		goto out;
+
+	status = -EIO;
+	for (;;) {
+		if (snapshot_read(fd, &rec, sizeof(rec)) != 0)
+			goto out;
+
+		if (rec.type == MIG_REC_PAGES) {
+			if (mig_recv_pages(ctx, fd, &rec, gpas, raw, zbuf,
+					zlen) != 0) {
+				fprintf(stderr, "migration: bad pages\n");
+				goto out;
+			}
+		} else if (rec.type == MIG_REC_STATE) {
+			ctx->bsp_regs.vcpu_id = 0;
+			if (snapshot_read(fd, &ctx->bsp_regs.vcpu_regs,
+					sizeof(ctx->bsp_regs.vcpu_regs)) != 0 ||
+			    load_pci(ctx, fd, rec.count) != 0) {
+				fprintf(stderr, "migration: bad VM state\n");
+				goto out;
+			}
+			status = 0;
+		} else if (rec.type == MIG_REC_END) {
+			break;
+		} else {
+			fprintf(stderr, "migration: bad record %u\n", rec.type);
+			goto out;
+		}
+	}
+
+	if (mig_send(fd, &status, sizeof(status)) == 0 && status == 0)
+		ret = 0;
+
+out:
+	free(raw);
+	free(zbuf);
+	return ret;
+}
+
+int
+migration_incoming(struct vmctx *ctx, const char *addr)
+{
+	struct addrinfo *res;
+	int lfd, fd, ret, on = 1;
+
+	res = mig_resolve(addr, true);
+	if (res == NULL) {
+		fprintf(stderr, "migration: bad address %s\n", addr);
+		return -1;
+	}
+
+	lfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (lfd < 0 ||
+	    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+	    bind(lfd, res->ai_addr, res->ai_addrlen) != 0 ||
+	    listen(lfd, 1) != 0) {
+		fprintf(stderr, "migration: can't listen on %s: %s\n", addr,
+			strerror(errno));
+		freeaddrinfo(res);
+		if (lfd >= 0)
+			close(lfd);
+		return -1;
+	}
+	freeaddrinfo(res);
+
+	printf("migration: waiting for the VM on %s\n", addr);
+	do {
+		fd = accept(lfd, NULL, NULL);
+	} while (fd < 0 && errno == EINTR);
+	close(lfd);
+	if (fd < 0 || mig_set_timeout(fd) != 0) {
+		fprintf(stderr, "migration: accept failed: %s\n",
+			strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	ret = mig_recv(ctx, fd);
+	close(fd);
+	if (ret != 0)
+		fprintf(stderr, "migration: failed to receive the VM\n");
+	else
+		printf("migration: VM received\n");
+	return ret;
+}
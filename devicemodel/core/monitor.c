@@ -17,12 +17,19 @@
 #include <sys/queue.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <errno.h>
 #include "dm.h"
 #include "dm_string.h"
 #include "monitor.h"
 #include "acrn_mngr.h"
 #include "pm.h"
 #include "vmmapi.h"
+#include "block_if.h"
+#include "pci_core.h"
+#include "virtio.h"
+#include "cpu_acct.h"
+#include "balloon.h"
+#include "migration.h"
 
 #define INTR_STORM_MONITOR_PERIOD	10 /* 10 seconds */
 #define INTR_STORM_THRESHOLD	100000 /* 10K times per second */
@@ -412,6 +419,166 @@ static void handle_query(struct mngr_msg *msg, int client_fd, void *param)
 	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
 }
 
+static void handle_blkstats(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct ack_dm_blkstats *bs = &ack.data.blkstats;
+	struct blockif_stats stats;
+	int i;
+
+	memset(&ack, 0, sizeof(ack));
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	if (blockif_get_stats_by_index(msg->data.blkstats_req.index,
+			bs->ident, sizeof(bs->ident), &stats) < 0) {
+		bs->err = -1;
+		mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+		return;
+	}
+
+	bs->reads = stats.reads;
+	bs->writes = stats.writes;
+	bs->others = stats.others;
+	bs->rbytes = stats.rbytes;
+	bs->wbytes = stats.wbytes;
+	bs->throttled = stats.throttled;
+	for (i = 0; i < BLK_LAT_BUCKETS && i < BLOCKIF_LAT_BUCKETS; i++) {
+		bs->queue_lat[i] = stats.queue_lat[i];
+		bs->service_lat[i] = stats.service_lat[i];
+	}
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+static void handle_vqstats(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct ack_dm_vqstats *vs = &ack.data.vqstats;
+	struct virtio_vq_stats stats;
+	uint16_t qsize;
+
+	memset(&ack, 0, sizeof(ack));
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	if (virtio_get_vq_stats_by_index(msg->data.vqstats_req.index,
+			vs->ident, sizeof(vs->ident), &qsize, &stats) < 0) {
+		vs->err = -1;
+		mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+		return;
+	}
+
+	vs->qsize = qsize;
+	vs->notifies = stats.notifies;
+	vs->polls = stats.polls;
+	vs->chains = stats.chains;
+	vs->descs = stats.descs;
+	vs->used = stats.used;
+	vs->endchains = stats.endchains;
+	vs->interrupts = stats.interrupts;
+	vs->suppressed = stats.suppressed;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+static void handle_cpustats(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct ack_dm_cpustats *cs = &ack.data.cpustats;
+	struct cpu_acct_stats stats;
+
+	memset(&ack, 0, sizeof(ack));
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	if (cpu_acct_get_by_index(msg->data.cpustats_req.index,
+			cs->ident, sizeof(cs->ident), &stats) < 0) {
+		cs->err = -1;
+		mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+		return;
+	}
+
+	cs->trap_ns = stats.trap_ns;
+	cs->traps = stats.traps;
+	cs->event_ns = stats.event_ns;
+	cs->events = stats.events;
+	cs->thread_ns = stats.thread_ns;
+	cs->threads = stats.nthreads;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+/* 4K pages to MB */
+#define PAGES_TO_MB(pages)	((pages) >> 8)
+
+static void handle_balloon(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct ack_dm_balloon *b = &ack.data.balloon;
+	struct balloon_stats stats;
+
+	memset(&ack, 0, sizeof(ack));
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	if (msg->data.balloon_req.set) {
+		if (msg->data.balloon_req.target > PAGES_TO_MB(UINT32_MAX))
+			b->err = -EINVAL;
+		else
+			b->err = balloon_set_target(
+				msg->data.balloon_req.target << 8);
+	}
+
+	if (b->err == 0)
+		b->err = balloon_get_stats(&stats);
+	if (b->err == 0) {
+		b->target = PAGES_TO_MB(stats.target);
+		b->actual = PAGES_TO_MB(stats.actual);
+		b->released = stats.released >> 20;
+		b->reported = stats.reported;
+		b->refaults = stats.refaults;
+	}
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+static void handle_migrate(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct vmctx *ctx = param;
+	struct mngr_msg ack;
+	struct ack_dm_migrate *mg = &ack.data.migrate;
+	struct migration_stats stats;
+
+	memset(&ack, 0, sizeof(ack));
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	if (msg->data.migrate_req.start) {
+		msg->data.migrate_req.dest[MIGRATE_DEST_LEN - 1] = '\0';
+		mg->err = migration_start(ctx, msg->data.migrate_req.dest);
+	}
+
+	migration_get_stats(&stats);
+	if (mg->err == 0)
+		mg->err = stats.err;
+	mg->state = stats.state;
+	mg->round = stats.round;
+	mg->sent = stats.sent;
+	mg->zero = stats.zero;
+	mg->bytes = stats.bytes;
+	mg->dirty = stats.dirty;
+	mg->downtime_ms = stats.downtime_ms;
+	mg->total_ms = stats.total_ms;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
 static struct monitor_vm_ops pmc_ops = {
 	.stop       = NULL,
 	.resume     = vm_monitor_resume,
@@ -453,6 +620,11 @@ int monitor_init(struct vmctx *ctx)
 	ret += mngr_add_handler(monitor_fd, DM_PAUSE, handle_pause, NULL);
 	ret += mngr_add_handler(monitor_fd, DM_CONTINUE, handle_continue, NULL);
 	ret += mngr_add_handler(monitor_fd, DM_QUERY, handle_query, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_BLKSTATS, handle_blkstats, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_VQSTATS, handle_vqstats, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_CPUSTATS, handle_cpustats, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_BALLOON, handle_balloon, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_MIGRATE, handle_migrate, ctx);
 
 	if (ret) {
 		fprintf(stderr, "%s %d\r\n", __FUNCTION__, __LINE__);
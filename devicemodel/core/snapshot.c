@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) <2018> Intel Corporation
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "dm.h"
+#include "vmmapi.h"
+#include "pci_core.h"
+#include "monitor.h"
+#include "mevent.h"
+#include "snapshot.h"
+
+/*
+ * The file is the header, the registers of each vCPU, the records of the
+ * PCI devices (see save_pci) and then, from a page aligned offset, the
+ * guest RAM segments one after the other.
+ */
+#define SNAPSHOT_MAGIC		0x50414e534e524341UL	/* "ACRNSNAP" */
+#define SNAPSHOT_VERSION	1U
+#define SNAPSHOT_MEM_ALIGN	4096UL
+#define SNAPSHOT_CHUNK		(8UL * 1024 * 1024)
+
+struct snapshot_header {
+	uint64_t	magic;
+	uint32_t	version;
+	uint32_t	ncpus;
+	uint32_t	nr_pci;
+	uint32_t	nr_mem_segs;
+	uint64_t	mem_offset;
+	uint64_t	mem_gpa[VM_MEM_SEGS_MAX];
+	uint64_t	mem_len[VM_MEM_SEGS_MAX];
+};
+
+static struct vmctx *snapshot_ctx;
+static const char *snapshot_path;
+
+int
+snapshot_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+int
+snapshot_read(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = read(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int
+snapshot_seek_mem(int fd, uint64_t *offset)
+{
+	off_t off;
+
+	off = lseek(fd, 0, SEEK_CUR);
+	if (off < 0)
+		return -1;
+
+	*offset = roundup2((uint64_t)off, SNAPSHOT_MEM_ALIGN);
+	if (lseek(fd, (off_t)*offset, SEEK_SET) < 0)
+		return -1;
+
+	return 0;
+}
+
+int
+vm_snapshot_save(struct vmctx *ctx, const char *path)
+{
+	struct snapshot_header hdr;
+	struct acrn_set_vcpu_regs regs;
+	int fd, i, nr;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		fprintf(stderr, "snapshot: can't create %s: %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	if (lseek(fd, sizeof(hdr), SEEK_SET) < 0)
+		goto fail;
+
+	for (i = 0; i < guest_ncpus; i++) {
+		if (vm_get_vcpu_regs(ctx, (uint16_t)i, &regs) != 0) {
+			fprintf(stderr, "snapshot: can't get the regs of vcpu %d\n",
+				i);
+			goto fail;
+		}
+		if (snapshot_write(fd, &regs.vcpu_regs,
+				sizeof(regs.vcpu_regs)) != 0)
+			goto fail;
+	}
+
+	nr = save_pci(ctx, fd);
+	if (nr < 0)
+		goto fail;
+
+	if (snapshot_seek_mem(fd, &hdr.mem_offset) != 0)
+		goto fail;
+
+	for (i = 0; i < ctx->nr_mem_segs; i++) {
+		hdr.mem_gpa[i] = ctx->mem_segs[i].gpa;
+		hdr.mem_len[i] = ctx->mem_segs[i].len;
+		if (snapshot_write(fd, ctx->mem_segs[i].hva,
+				ctx->mem_segs[i].len) != 0)
+			goto fail;
+	}
+
+	hdr.magic = SNAPSHOT_MAGIC;
+	hdr.version = SNAPSHOT_VERSION;
+	hdr.ncpus = guest_ncpus;
+	hdr.nr_pci = nr;
+	hdr.nr_mem_segs = ctx->nr_mem_segs;
+	if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		goto fail;
+
+	if (fsync(fd) != 0)
+		goto fail;
+	close(fd);
+	printf("snapshot: saved to %s\n", path);
+	return 0;
+
+fail:
+	fprintf(stderr, "snapshot: failed to save to %s\n", path);
+	close(fd);
+	unlink(path);
+	return -1;
+}
+
+static int
+snapshot_load_mem(int fd, const struct vm_mem_seg *seg, uint64_t offset)
+{
+	size_t done, len;
+	ssize_t n;
+
+	posix_fadvise(fd, offset, seg->len, POSIX_FADV_SEQUENTIAL);
+	posix_fadvise(fd, offset, seg->len, POSIX_FADV_WILLNEED);
+
+	for (done = 0; done < seg->len; done += n) {
+		len = seg->len - done;
+		if (len > SNAPSHOT_CHUNK)
+			len = SNAPSHOT_CHUNK;
+		n = pread(fd, seg->hva + done, len, offset + done);
+		if (n < 0 && errno == EINTR) {
+			n = 0;
+			continue;
+		}
+		if (n <= 0)
+			return -1;
+	}
+
+	/* the template is read once per clone, don't keep it cached */
+	posix_fadvise(fd, offset, seg->len, POSIX_FADV_DONTNEED);
+	return 0;
+}
+
+int
+vm_snapshot_load(struct vmctx *ctx, const char *path)
+{
+	struct snapshot_header hdr;
+	uint64_t offset;
+	int fd, i;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "snapshot: can't open %s: %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+
+	if (snapshot_read(fd, &hdr, sizeof(hdr)) != 0 ||
+	    hdr.magic != SNAPSHOT_MAGIC ||
+	    hdr.version != SNAPSHOT_VERSION) {
+		fprintf(stderr, "snapshot: %s is not a snapshot\n", path);
+		goto fail;
+	}
+
+	/*
+	 * The hypervisor starts the BSP only, the APs of the template are
+	 * not waiting for a SIPI any more.
+	 */
+	if (hdr.ncpus != 1 || guest_ncpus != 1) {
+		fprintf(stderr, "snapshot: only single vCPU templates are supported\n");
+		goto fail;
+	}
+
+	if (hdr.nr_mem_segs != ctx->nr_mem_segs)
+		goto layout;
+	for (i = 0; i < ctx->nr_mem_segs; i++) {
+		if (hdr.mem_gpa[i] != ctx->mem_segs[i].gpa ||
+		    hdr.mem_len[i] != ctx->mem_segs[i].len)
+			goto layout;
+	}
+
+	ctx->bsp_regs.vcpu_id = 0;
+	if (snapshot_read(fd, &ctx->bsp_regs.vcpu_regs,
+			sizeof(ctx->bsp_regs.vcpu_regs)) != 0)
+		goto fail;
+
+	if (load_pci(ctx, fd, hdr.nr_pci) != 0)
+		goto fail;
+
+	offset = hdr.mem_offset;
+	for (i = 0; i < ctx->nr_mem_segs; i++) {
+		if (snapshot_load_mem(fd, &ctx->mem_segs[i], offset) != 0)
+			goto fail;
+		offset += ctx->mem_segs[i].len;
+	}
+
+	close(fd);
+	printf("snapshot: started from %s\n", path);
+	return 0;
+
+layout:
+	fprintf(stderr, "snapshot: the memory of %s doesn't match the VM\n",
+		path);
+fail:
+	fprintf(stderr, "snapshot: failed to load %s\n", path);
+	close(fd);
+	return -1;
+}
+
+static int
+vm_monitor_snapshot(void *arg)
+{
+	int ret;
+
+	vm_pause(snapshot_ctx);
+	ret = vm_snapshot_save(snapshot_ctx, snapshot_path);
+
+	/* the hypervisor doesn't resume a paused VM */
+	vm_set_suspend_mode(VM_SUSPEND_POWEROFF);
+	mevent_notify();
+
+	return ret;
+}
+
+static struct monitor_vm_ops snapshot_ops = {
+	.pause      = vm_monitor_snapshot,
+};
+
+int
+vm_snapshot_on_pause(struct vmctx *ctx, const char *path)
+{
+	bool registered = (snapshot_ctx != NULL);
+
+	/* the ops stay registered over a full reset of the VM */
+	snapshot_ctx = ctx;
+	snapshot_path = path;
+	if (registered)
+		return 0;
+
+	return monitor_register_vm_ops(&snapshot_ops, ctx, "snapshot");
+}
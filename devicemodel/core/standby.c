@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) <2018> Intel Corporation
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "dm.h"
+#include "vmmapi.h"
+#include "pci_core.h"
+#include "acrn_mngr.h"
+#include "standby.h"
+
+#define STANDBY_SOCK_PATH	"/run/acrn/mngr"
+#define STANDBY_CMDLINE_MAX	(64 * 1024)
+#define STANDBY_ACK_TIMEOUT	2
+#define STANDBY_POLL_US		100000
+
+static pthread_mutex_t standby_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t standby_cond = PTHREAD_COND_INITIALIZER;
+static pid_t launch_pid;	/* the acrn-dm which handed its UOS over */
+
+static volatile pid_t standby_pid;	/* the standby running our UOS */
+
+static void
+handle_launch(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	/* take the first launch only */
+	pthread_mutex_lock(&standby_mtx);
+	if (launch_pid || msg->data.launch.pid <= 0) {
+		ack.data.err = -EBUSY;
+	} else {
+		launch_pid = msg->data.launch.pid;
+		ack.data.err = 0;
+		pthread_cond_signal(&standby_cond);
+	}
+	pthread_mutex_unlock(&standby_mtx);
+
+	mngr_send_msg(client_fd, &ack, NULL, STANDBY_ACK_TIMEOUT);
+}
+
+/* take the command line, stdio and cwd of @pid, as if it was us */
+static int
+standby_adopt(pid_t pid, int *pargc, char ***pargv)
+{
+	char path[64];
+	char *buf, **argv;
+	ssize_t n;
+	size_t off, len = 0;
+	int fd, i, argc = 0;
+
+	buf = calloc(1, STANDBY_CMDLINE_MAX + 1);
+	if (!buf)
+		return -1;
+
+	snprintf(path, sizeof(path), "/proc/%d/cmdline", pid);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		goto fail;
+	}
+	while (len < STANDBY_CMDLINE_MAX) {
+		n = read(fd, buf + len, STANDBY_CMDLINE_MAX - len);
+		if (n <= 0)
+			break;
+		len += n;
+	}
+	close(fd);
+
+	if (len == 0 || len == STANDBY_CMDLINE_MAX) {
+		fprintf(stderr, "%s: bad command line\n", path);
+		goto fail;
+	}
+
+	for (off = 0; off < len; off++)
+		if (buf[off] == '\0')
+			argc++;
+
+	argv = calloc(argc + 1, sizeof(*argv));
+	if (!argv)
+		goto fail;
+	for (i = 0; i < argc; i++) {
+		argv[i] = buf;
+		buf += strlen(buf) + 1;
+	}
+
+	for (i = 0; i <= STDERR_FILENO; i++) {
+		snprintf(path, sizeof(path), "/proc/%d/fd/%d", pid, i);
+		fd = open(path, i ? (O_WRONLY | O_APPEND) : O_RDONLY);
+		if (fd < 0)
+			continue;
+		dup2(fd, i);
+		close(fd);
+	}
+
+	snprintf(path, sizeof(path), "/proc/%d/cwd", pid);
+	if (chdir(path))
+		perror(path);
+
+	*pargc = argc;
+	*pargv = argv;
+	return 0;
+
+fail:
+	free(buf);
+	return -1;
+}
+
+int
+dm_standby(const char *name)
+{
+	char **argv;
+	int argc, fd;
+
+	if (strncmp(name, STANDBY_PREFIX, strlen(STANDBY_PREFIX))
+			|| strchr(name, '.')) {
+		fprintf(stderr, "standby name must be %s<n>\n", STANDBY_PREFIX);
+		return 1;
+	}
+
+	/* the system wide setup, done again for nothing by dm_run */
+	if (!check_hugetlb_support())
+		fprintf(stderr, "standby: no hugetlb support\n");
+	if (pciaccess_init() < 0)
+		fprintf(stderr, "standby: no libpciaccess\n");
+
+	fd = mngr_open_un(name, MNGR_SERVER);
+	if (fd < 0) {
+		fprintf(stderr, "standby: cannot open %s\n", name);
+		return 1;
+	}
+
+	if (mngr_add_handler(fd, DM_LAUNCH, handle_launch, NULL)) {
+		mngr_close(fd);
+		return 1;
+	}
+
+	pthread_mutex_lock(&standby_mtx);
+	while (!launch_pid)
+		pthread_cond_wait(&standby_cond, &standby_mtx);
+	pthread_mutex_unlock(&standby_mtx);
+
+	mngr_close(fd);
+
+	if (standby_adopt(launch_pid, &argc, &argv) < 0) {
+		/* our launcher then runs the UOS itself */
+		kill(launch_pid, SIGUSR1);
+		return 1;
+	}
+
+	optind = 0;
+	return dm_run(argc, argv);
+}
+
+static void
+standby_forward_sig(int signo)
+{
+	if (standby_pid > 0)
+		kill(standby_pid, signo);
+}
+
+/* standby-<n>.<pid>.socket, see mngr_open_un */
+static pid_t
+standby_try(const char *sock)
+{
+	struct mngr_msg req, ack;
+	char name[64];
+	const char *p;
+	pid_t pid;
+	int fd, ret;
+
+	p = strchr(sock, '.');
+	if (!p || (size_t)(p - sock) >= sizeof(name))
+		return -1;
+	pid = strtol(p + 1, NULL, 10);
+	if (pid <= 0)
+		return -1;
+
+	memcpy(name, sock, p - sock);
+	name[p - sock] = '\0';
+
+	fd = mngr_open_un(name, MNGR_CLIENT);
+	if (fd < 0)
+		return -1;
+
+	memset(&req, 0, sizeof(req));
+	memset(&ack, 0, sizeof(ack));
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_LAUNCH;
+	req.data.launch.pid = getpid();
+
+	ret = mngr_send_msg(fd, &req, &ack, STANDBY_ACK_TIMEOUT);
+	mngr_close(fd);
+
+	if (ret != sizeof(ack) || ack.data.err)
+		return -1;
+
+	return pid;
+}
+
+static void
+standby_fallback_sig(int signo)
+{
+	standby_pid = -1;
+}
+
+int
+dm_launch_standby(void)
+{
+	struct dirent *entry;
+	DIR *dir;
+	pid_t pid = -1;
+
+	dir = opendir(STANDBY_SOCK_PATH);
+	if (!dir)
+		return -1;
+
+	if (signal(SIGUSR1, standby_fallback_sig) == SIG_ERR) {
+		closedir(dir);
+		return -1;
+	}
+
+	while ((entry = readdir(dir))) {
+		if (strncmp(entry->d_name, STANDBY_PREFIX,
+				strlen(STANDBY_PREFIX)))
+			continue;
+		pid = standby_try(entry->d_name);
+		if (pid > 0)
+			break;
+	}
+	closedir(dir);
+
+	if (pid <= 0) {
+		signal(SIGUSR1, SIG_DFL);
+		return -1;
+	}
+
+	standby_pid = pid;
+	signal(SIGHUP, standby_forward_sig);
+	signal(SIGINT, standby_forward_sig);
+	signal(SIGTERM, standby_forward_sig);
+
+	printf("Handed over to the standby acrn-dm %d\n", pid);
+
+	/* the standby is not our child, and gives up on SIGUSR1 */
+	while (standby_pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH))
+		usleep(STANDBY_POLL_US);
+
+	signal(SIGHUP, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGUSR1, SIG_DFL);
+
+	return standby_pid < 0 ? -1 : 0;
+}
@@ -167,94 +167,34 @@ acrn_parse_ramdisk(char *arg)
 		return -1;
 }
 
+/* Start loading the ramdisk, acrn_sw_load_bzimage() waits for it */
 static int
-acrn_prepare_ramdisk(struct vmctx *ctx)
+acrn_prepare_ramdisk(struct vmctx *ctx, struct image_load *ld)
 {
-	FILE *fp;
-	long len;
-	size_t read;
-
-	fp = fopen(ramdisk_path, "r");
-	if (fp == NULL) {
-		printf("SW_LOAD ERR: could not open ramdisk file %s\n",
-				ramdisk_path);
-		return -1;
-	}
-
-	fseek(fp, 0, SEEK_END);
-	len = ftell(fp);
-
-	if (len != ramdisk_size) {
-		fprintf(stderr,
-			"SW_LOAD ERR: ramdisk file changed\n");
-		fclose(fp);
-		return -1;
-	}
-
-	if (len > (BOOTARGS_LOAD_OFF(ctx) - RAMDISK_LOAD_OFF(ctx))) {
+	if (ramdisk_size > (BOOTARGS_LOAD_OFF(ctx) - RAMDISK_LOAD_OFF(ctx))) {
 		printf("SW_LOAD ERR: the size of ramdisk file is too big"
-				" file len=0x%lx, limit is 0x%lx\n", len,
+				" file len=0x%lx, limit is 0x%lx\n", ramdisk_size,
 				BOOTARGS_LOAD_OFF(ctx) - RAMDISK_LOAD_OFF(ctx));
-		fclose(fp);
-		return -1;
-	}
-
-	fseek(fp, 0, SEEK_SET);
-	read = fread(ctx->baseaddr + RAMDISK_LOAD_OFF(ctx),
-			sizeof(char), len, fp);
-	if (read < len) {
-		printf("SW_LOAD ERR: could not read the whole ramdisk file,"
-				" file len=%ld, read %lu\n", len, read);
-		fclose(fp);
 		return -1;
 	}
-	fclose(fp);
-	printf("SW_LOAD: ramdisk %s size %lu copied to guest 0x%lx\n",
-			ramdisk_path, ramdisk_size, RAMDISK_LOAD_OFF(ctx));
 
+	load_image_start(ld, ramdisk_path, "ramdisk",
+			ctx->baseaddr + RAMDISK_LOAD_OFF(ctx), ramdisk_size);
 	return 0;
 }
 
 static int
 acrn_prepare_kernel(struct vmctx *ctx)
 {
-	FILE *fp;
-	long len;
-	size_t read;
-
-	fp = fopen(kernel_path, "r");
-	if (fp == NULL) {
-		printf("SW_LOAD ERR: could not open kernel file %s\n",
-				kernel_path);
-		return -1;
-	}
-
-	fseek(fp, 0, SEEK_END);
-	len = ftell(fp);
-
-	if (len != kernel_size) {
-		fprintf(stderr,
-			"SW_LOAD ERR: kernel file changed\n");
-		fclose(fp);
-		return -1;
-	}
-
-	if ((len + KERNEL_LOAD_OFF(ctx)) > RAMDISK_LOAD_OFF(ctx)) {
+	if ((kernel_size + KERNEL_LOAD_OFF(ctx)) > RAMDISK_LOAD_OFF(ctx)) {
 		printf("SW_LOAD ERR: need big system memory to fit image\n");
-		fclose(fp);
 		return -1;
 	}
 
-	fseek(fp, 0, SEEK_SET);
-	read = fread(ctx->baseaddr + KERNEL_LOAD_OFF(ctx),
-			sizeof(char), len, fp);
-	if (read < len) {
-		printf("SW_LOAD ERR: could not read the whole kernel file,"
-				" file len=%ld, read %lu\n", len, read);
-		fclose(fp);
+	if (load_image(kernel_path, "kernel",
+			ctx->baseaddr + KERNEL_LOAD_OFF(ctx), kernel_size) != 0)
 		return -1;
-	}
-	fclose(fp);
+
 	printf("SW_LOAD: kernel %s size %lu copied to guest 0x%lx\n",
 			kernel_path, kernel_size, KERNEL_LOAD_OFF(ctx));
 
@@ -312,6 +252,7 @@ static const uint64_t bzimage_init_gdt[] = {
 int
 acrn_sw_load_bzimage(struct vmctx *ctx)
 {
+	struct image_load ramdisk_load;
 	int ret, setup_size;
 
 	memset(&ctx->bsp_regs, 0, sizeof(struct acrn_set_vcpu_regs));
@@ -323,26 +264,30 @@ acrn_sw_load_bzimage(struct vmctx *ctx)
 				BOOTARGS_LOAD_OFF(ctx));
 	}
 
+	/* the ramdisk loads while the kernel does */
 	if (with_ramdisk) {
-		ret = acrn_prepare_ramdisk(ctx);
+		ret = acrn_prepare_ramdisk(ctx, &ramdisk_load);
 		if (ret)
 			return ret;
 	}
 
+	ret = 0;
 	if (with_kernel) {
 		ret = acrn_prepare_kernel(ctx);
 		if (ret)
-			return ret;
+			goto wait_ramdisk;
 		setup_size = acrn_get_bzimage_setup_size(ctx);
-		if (setup_size <= 0)
-			return -1;
+		if (setup_size <= 0) {
+			ret = -1;
+			goto wait_ramdisk;
+		}
 
 		ctx->bsp_regs.vcpu_regs.rip = (uint64_t)
 			(KERNEL_LOAD_OFF(ctx) + setup_size);
 
 		ret = acrn_prepare_zeropage(ctx, setup_size);
 		if (ret)
-			return ret;
+			goto wait_ramdisk;
 
 		printf("SW_LOAD: zeropage prepared @ 0x%lx, "
 				"kernel_entry_addr=0x%lx\n",
@@ -350,6 +295,16 @@ acrn_sw_load_bzimage(struct vmctx *ctx)
 				(KERNEL_LOAD_OFF(ctx) + setup_size));
 	}
 
+wait_ramdisk:
+	if (with_ramdisk) {
+		if (load_image_wait(&ramdisk_load) != 0)
+			return -1;
+		printf("SW_LOAD: ramdisk %s size %lu copied to guest 0x%lx\n",
+				ramdisk_path, ramdisk_size, RAMDISK_LOAD_OFF(ctx));
+	}
+	if (ret)
+		return ret;
+
 	memcpy(ctx->baseaddr + GDT_LOAD_OFF(ctx), &bzimage_init_gdt,
 			sizeof(bzimage_init_gdt));
 	ctx->bsp_regs.vcpu_regs.gdt.limit = sizeof(bzimage_init_gdt) - 1;
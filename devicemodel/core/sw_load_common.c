@@ -29,6 +29,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "vmmapi.h"
 #include "sw_load.h"
@@ -146,6 +150,100 @@ check_image(char *path, size_t size_limit, size_t *size)
 	return 0;
 }
 
+/* read in chunks, each one prefetched while the previous one is copied */
+#define LOAD_CHUNK	(8 * MB)
+
+/*
+ * Read the size bytes of the image at path straight into guest memory at
+ * dst, failing if the file no longer has the size checked at parsing.
+ */
+int
+load_image(const char *path, const char *what, void *dst, size_t size)
+{
+	struct stat st;
+	size_t done = 0, chunk;
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "SW_LOAD ERR: could not open %s file %s\n",
+			what, path);
+		return -1;
+	}
+
+	if (fstat(fd, &st) != 0 || st.st_size != size) {
+		fprintf(stderr, "SW_LOAD ERR: %s file changed\n", what);
+		close(fd);
+		return -1;
+	}
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	posix_fadvise(fd, 0, LOAD_CHUNK, POSIX_FADV_WILLNEED);
+
+	while (done < size) {
+		chunk = size - done;
+		if (chunk > LOAD_CHUNK)
+			chunk = LOAD_CHUNK;
+		if (done + chunk < size)
+			posix_fadvise(fd, done + chunk, LOAD_CHUNK,
+				POSIX_FADV_WILLNEED);
+
+		n = read(fd, (char *)dst + done, chunk);
+		if (n <= 0) {
+			fprintf(stderr,
+				"SW_LOAD ERR: could not read the whole %s file,"
+				" file len=%lu, read %lu\n", what, size, done);
+			close(fd);
+			return -1;
+		}
+		done += n;
+	}
+
+	/* the image is in guest memory now, no need to cache it */
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+	return 0;
+}
+
+static void *
+load_image_thread(void *arg)
+{
+	struct image_load *ld = arg;
+
+	ld->ret = load_image(ld->path, ld->what, ld->dst, ld->size);
+	return NULL;
+}
+
+/*
+ * Start loading an image in a thread, or load it right away if the
+ * thread can not be created. load_image_wait() returns the result.
+ */
+void
+load_image_start(struct image_load *ld, const char *path, const char *what,
+	void *dst, size_t size)
+{
+	ld->path = path;
+	ld->what = what;
+	ld->dst = dst;
+	ld->size = size;
+	ld->ret = 0;
+	ld->started = (pthread_create(&ld->thr, NULL, load_image_thread,
+				ld) == 0);
+	if (!ld->started)
+		ld->ret = load_image(path, what, dst, size);
+}
+
+int
+load_image_wait(struct image_load *ld)
+{
+	if (ld->started) {
+		pthread_join(ld->thr, NULL);
+		ld->started = false;
+	}
+	return ld->ret;
+}
+
 /* Assumption:
  * the range [start, start + size] belongs to one entry of e820 table
  */
@@ -88,38 +88,10 @@ acrn_parse_ovmf(char *arg)
 static int
 acrn_prepare_ovmf(struct vmctx *ctx)
 {
-	FILE *fp;
-	size_t read;
-
-	fp = fopen(ovmf_path, "r");
-	if (fp == NULL) {
-		fprintf(stderr,
-			"SW_LOAD ERR: could not open ovmf file: %s\n",
-			ovmf_path);
+	if (load_image(ovmf_path, "ovmf",
+			ctx->baseaddr + OVMF_TOP(ctx) - ovmf_size, ovmf_size) != 0)
 		return -1;
-	}
 
-	fseek(fp, 0, SEEK_END);
-
-	if (ftell(fp) != ovmf_size) {
-		fprintf(stderr,
-			"SW_LOAD ERR: ovmf file changed\n");
-		fclose(fp);
-		return -1;
-	}
-
-	fseek(fp, 0, SEEK_SET);
-	read = fread(ctx->baseaddr + OVMF_TOP(ctx) - ovmf_size,
-		sizeof(char), ovmf_size, fp);
-
-	if (read < ovmf_size) {
-		fprintf(stderr,
-			"SW_LOAD ERR: could not read whole partition blob\n");
-		fclose(fp);
-		return -1;
-	}
-
-	fclose(fp);
 	printf("SW_LOAD: partition blob %s size %lu copy to guest 0x%lx\n",
 		ovmf_path, ovmf_size, OVMF_TOP(ctx) - ovmf_size);
 
@@ -142,52 +142,19 @@ acrn_parse_guest_part_info(char *arg)
 		return -1;
 }
 
+/* Start loading the partition blob, acrn_sw_load_vsbl() waits for it */
 static int
-acrn_prepare_guest_part_info(struct vmctx *ctx)
+acrn_prepare_guest_part_info(struct vmctx *ctx, struct image_load *ld)
 {
-	FILE *fp;
-	long len;
-	size_t read;
-
-	fp = fopen(guest_part_info_path, "r");
-	if (fp == NULL) {
-		fprintf(stderr,
-			"SW_LOAD ERR: could not open partition blob %s\n",
-			guest_part_info_path);
-		return -1;
-	}
-
-	fseek(fp, 0, SEEK_END);
-	len = ftell(fp);
-
-	if (len != guest_part_info_size) {
-		fprintf(stderr,
-			"SW_LOAD ERR: partition blob changed\n");
-		fclose(fp);
-		return -1;
-	}
-
-	if ((len + GUEST_PART_INFO_OFF(ctx)) > BOOTARGS_OFF(ctx)) {
+	if ((guest_part_info_size + GUEST_PART_INFO_OFF(ctx)) >
+			BOOTARGS_OFF(ctx)) {
 		fprintf(stderr,
 			"SW_LOAD ERR: too large partition blob\n");
-		fclose(fp);
-		return -1;
-	}
-
-	fseek(fp, 0, SEEK_SET);
-	read = fread(ctx->baseaddr + GUEST_PART_INFO_OFF(ctx),
-		sizeof(char), len, fp);
-	if (read < len) {
-		fprintf(stderr,
-			"SW_LOAD ERR: could not read whole partition blob\n");
-		fclose(fp);
 		return -1;
 	}
-	fclose(fp);
-	printf("SW_LOAD: partition blob %s size %lu copy to guest 0x%lx\n",
-		guest_part_info_path, guest_part_info_size,
-		GUEST_PART_INFO_OFF(ctx));
 
+	load_image_start(ld, guest_part_info_path, "partition blob",
+		ctx->baseaddr + GUEST_PART_INFO_OFF(ctx), guest_part_info_size);
 	return 0;
 }
 
@@ -214,36 +181,10 @@ acrn_parse_vsbl(char *arg)
 static int
 acrn_prepare_vsbl(struct vmctx *ctx)
 {
-	FILE *fp;
-	size_t read;
-
-	fp = fopen(vsbl_path, "r");
-	if (fp == NULL) {
-		fprintf(stderr,
-			"SW_LOAD ERR: could not open vsbl file: %s\n",
-			vsbl_path);
+	if (load_image(vsbl_path, "vsbl",
+			ctx->baseaddr + VSBL_TOP(ctx) - vsbl_size, vsbl_size) != 0)
 		return -1;
-	}
-
-	fseek(fp, 0, SEEK_END);
 
-	if (ftell(fp) != vsbl_size) {
-		fprintf(stderr,
-			"SW_LOAD ERR: vsbl file changed\n");
-		fclose(fp);
-		return -1;
-	}
-
-	fseek(fp, 0, SEEK_SET);
-	read = fread(ctx->baseaddr + VSBL_TOP(ctx) - vsbl_size,
-		sizeof(char), vsbl_size, fp);
-	if (read < vsbl_size) {
-		fprintf(stderr,
-			"SW_LOAD ERR: could not read whole partition blob\n");
-		fclose(fp);
-		return -1;
-	}
-	fclose(fp);
 	printf("SW_LOAD: partition blob %s size %lu copy to guest 0x%lx\n",
 		vsbl_path, vsbl_size, VSBL_TOP(ctx) - vsbl_size);
 
@@ -256,6 +197,7 @@ acrn_sw_load_vsbl(struct vmctx *ctx)
 	int ret;
 	struct e820_entry *e820;
 	struct vsbl_para *vsbl_para;
+	struct image_load part_info_load;
 
 	init_cmos_vrpmb(ctx);
 
@@ -280,8 +222,9 @@ acrn_sw_load_vsbl(struct vmctx *ctx)
 		vsbl_para->bootargs_address = 0;
 	}
 
+	/* the partition blob loads while vsbl does */
 	if (with_guest_part_info) {
-		ret = acrn_prepare_guest_part_info(ctx);
+		ret = acrn_prepare_guest_part_info(ctx, &part_info_load);
 		if (ret)
 			return ret;
 		vsbl_para->guest_part_info_address = GUEST_PART_INFO_OFF(ctx);
@@ -292,6 +235,13 @@ acrn_sw_load_vsbl(struct vmctx *ctx)
 	}
 
 	ret = acrn_prepare_vsbl(ctx);
+	if (with_guest_part_info) {
+		if (load_image_wait(&part_info_load) != 0)
+			return -1;
+		printf("SW_LOAD: partition blob %s size %lu copy to guest 0x%lx\n",
+			guest_part_info_path, guest_part_info_size,
+			GUEST_PART_INFO_OFF(ctx));
+	}
 	if (ret)
 		return ret;
 
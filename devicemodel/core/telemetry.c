@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "dm.h"
+#include "vmmapi.h"
+#include "telemetry.h"
+
+bool telemetry_enabled;
+
+static struct acrn_vm_telemetry *telemetry_page;
+static char telemetry_name[64];
+
+static int
+telemetry_map(void)
+{
+	void *page;
+	int fd;
+
+	snprintf(telemetry_name, sizeof(telemetry_name), TELEMETRY_SHM_NAME,
+		 vmname);
+	fd = shm_open(telemetry_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("telemetry: shm_open");
+		return -1;
+	}
+
+	if (ftruncate(fd, sizeof(struct acrn_vm_telemetry)) != 0) {
+		perror("telemetry: ftruncate");
+		goto fail;
+	}
+
+	page = mmap(NULL, sizeof(struct acrn_vm_telemetry),
+		    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (page == MAP_FAILED) {
+		perror("telemetry: mmap");
+		goto fail;
+	}
+	close(fd);
+
+	/* the hypervisor writes to it at any time */
+	if (mlock(page, sizeof(struct acrn_vm_telemetry)) != 0) {
+		perror("telemetry: mlock");
+		munmap(page, sizeof(struct acrn_vm_telemetry));
+		shm_unlink(telemetry_name);
+		return -1;
+	}
+
+	telemetry_page = page;
+	return 0;
+
+fail:
+	close(fd);
+	shm_unlink(telemetry_name);
+	return -1;
+}
+
+int
+telemetry_init(struct vmctx *ctx)
+{
+	if (telemetry_page == NULL && telemetry_map() != 0)
+		return -1;
+
+	memset(telemetry_page, 0, sizeof(*telemetry_page));
+
+	/* the hypervisor fills in the TSC frequency */
+	if (vm_set_telemetry_page(ctx, (uint64_t)telemetry_page) != 0 ||
+			telemetry_page->tsc_khz == 0) {
+		telemetry_deinit(ctx);
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+telemetry_deinit(struct vmctx *ctx)
+{
+	if (telemetry_page == NULL)
+		return;
+
+	vm_set_telemetry_page(ctx, 0);
+	munmap(telemetry_page, sizeof(struct acrn_vm_telemetry));
+	shm_unlink(telemetry_name);
+	telemetry_page = NULL;
+}
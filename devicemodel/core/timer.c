@@ -4,8 +4,11 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/timerfd.h>
 
 #include "vmmapi.h"
@@ -17,86 +20,329 @@
  * Compare with sigevent mechanism, timerfd has a advantage that it could
  * avoid race condition on resource accessing in the async sigev thread.
  *
+ * The timers of an event loop share one timerfd, armed for the earliest
+ * of their deadlines, which are kept in a min-heap. Setting a timer only
+ * takes a syscall when it becomes the earliest one, and none at all from
+ * the callbacks, the timerfd is re-armed once they all ran. The timers
+ * are relative, so they all count on CLOCK_MONOTONIC, a relative
+ * CLOCK_REALTIME timerfd does not follow the changes of the clock either.
+ *
  * Please note timerfd and epoll are all Linux specific. If the code need to be
  * ported to other OS, we can modify the api with POSIX timers and sigevent
  * mechanism.
  */
 
+struct acrn_timer_base {
+	int			loop;
+	int			fd;
+	struct mevent		*mevp;
+	int			users;		/* timers initialized on it */
+	pthread_mutex_t		mtx;
+	struct acrn_timer	**heap;		/* by deadline */
+	int			nr_timers;
+	int			heap_size;
+	uint64_t		armed;		/* deadline of the timerfd, or 0 */
+	bool			expiring;	/* the callbacks are running */
+	struct acrn_timer_base	*next;
+};
+
+static struct acrn_timer_base *timer_bases;
+static pthread_mutex_t timer_bases_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t
+timer_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t
+timespec_to_ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000UL + (uint64_t)ts->tv_nsec;
+}
+
+static inline void
+ns_to_timespec(uint64_t ns, struct timespec *ts)
+{
+	ts->tv_sec = ns / 1000000000UL;
+	ts->tv_nsec = ns % 1000000000UL;
+}
+
+static void
+timer_heap_swap(struct acrn_timer_base *base, int i, int j)
+{
+	struct acrn_timer *t = base->heap[i];
+
+	base->heap[i] = base->heap[j];
+	base->heap[j] = t;
+	base->heap[i]->heap_idx = i;
+	base->heap[j]->heap_idx = j;
+}
+
+static void
+timer_heap_up(struct acrn_timer_base *base, int i)
+{
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (base->heap[parent]->deadline <= base->heap[i]->deadline)
+			break;
+		timer_heap_swap(base, i, parent);
+		i = parent;
+	}
+}
+
+static void
+timer_heap_down(struct acrn_timer_base *base, int i)
+{
+	int child;
+
+	while ((child = 2 * i + 1) < base->nr_timers) {
+		if ((child + 1 < base->nr_timers) &&
+		    (base->heap[child + 1]->deadline < base->heap[child]->deadline))
+			child++;
+		if (base->heap[i]->deadline <= base->heap[child]->deadline)
+			break;
+		timer_heap_swap(base, i, child);
+		i = child;
+	}
+}
+
+/* @pre base->mtx is held, and there is room for one more */
+static void
+timer_heap_add(struct acrn_timer_base *base, struct acrn_timer *timer)
+{
+	timer->heap_idx = base->nr_timers++;
+	base->heap[timer->heap_idx] = timer;
+	timer_heap_up(base, timer->heap_idx);
+}
+
+/* @pre base->mtx is held */
+static void
+timer_heap_remove(struct acrn_timer_base *base, struct acrn_timer *timer)
+{
+	int i = timer->heap_idx;
+
+	if (i < 0)
+		return;
+
+	timer->heap_idx = -1;
+	base->nr_timers--;
+	if (i != base->nr_timers) {
+		base->heap[i] = base->heap[base->nr_timers];
+		base->heap[i]->heap_idx = i;
+		timer_heap_up(base, i);
+		timer_heap_down(base, base->heap[i]->heap_idx);
+	}
+}
+
+/* Arm the timerfd for the earliest deadline, if it changed */
+static void
+timer_base_rearm(struct acrn_timer_base *base)
+{
+	struct itimerspec its;
+	uint64_t deadline;
+
+	if (base->expiring)
+		return;
+
+	deadline = (base->nr_timers > 0) ? base->heap[0]->deadline : 0;
+	if (deadline == base->armed)
+		return;
+
+	memset(&its, 0, sizeof(its));
+	ns_to_timespec(deadline, &its.it_value);
+	if (timerfd_settime(base->fd, TFD_TIMER_ABSTIME, &its, NULL) != 0)
+		perror("acrn_timer timerfd_settime failed");
+	base->armed = deadline;
+}
+
 static void
 timer_handler(int fd __attribute__((unused)),
 		  enum ev_type t __attribute__((unused)),
 		  void *arg)
 {
-	struct acrn_timer *timer = arg;
-	uint64_t buf;
-	int32_t size;
+	struct acrn_timer_base *base = arg;
+	struct acrn_timer *timer;
+	void (*cb)(void *);
+	void *param;
+	uint64_t buf, now, missed;
 
-	if (timer == NULL) {
+	/* Consume I/O event for default EPOLLLT type. */
+	if (read(base->fd, &buf, sizeof(buf)) < 1)
 		return;
+
+	now = timer_now();
+
+	pthread_mutex_lock(&base->mtx);
+	base->armed = 0;
+	base->expiring = true;
+	while ((base->nr_timers > 0) && (base->heap[0]->deadline <= now)) {
+		timer = base->heap[0];
+		timer_heap_remove(base, timer);
+		if (timer->interval != 0) {
+			/* overruns are coalesced, as timerfd does */
+			missed = (now - timer->deadline) / timer->interval;
+			timer->deadline += (missed + 1) * timer->interval;
+			timer_heap_add(base, timer);
+		} else
+			timer->deadline = 0;
+
+		cb = timer->callback;
+		param = timer->callback_param;
+		pthread_mutex_unlock(&base->mtx);
+		if (cb != NULL)
+			(*cb)(param);
+		pthread_mutex_lock(&base->mtx);
 	}
+	base->expiring = false;
+	timer_base_rearm(base);
+	pthread_mutex_unlock(&base->mtx);
+}
 
-	/* Consume I/O event for default EPOLLLT type.
-	 * Here is a temporary solution, the processing could be moved to
-	 * mevent.c once EVF_TIMER is supported.
-	 */
-	size = read(timer->fd, &buf, sizeof(buf));
-	if (size < 1) {
-		fprintf(stderr, "acrn_timer read timerfd error!");
-		return;
+/* The timer base of a loop, created with its first timer */
+static struct acrn_timer_base *
+timer_base_get(int loop)
+{
+	struct acrn_timer_base *base;
+
+	pthread_mutex_lock(&timer_bases_mtx);
+	for (base = timer_bases; base != NULL; base = base->next) {
+		if (base->loop == loop)
+			break;
 	}
 
-	if (timer->callback != NULL) {
-		(*timer->callback)(timer->callback_param);
+	if (base == NULL) {
+		base = calloc(1, sizeof(*base));
+		if (base == NULL)
+			goto out;
+
+		base->loop = loop;
+		base->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (base->fd < 0) {
+			perror("acrn_timer create failed.\n");
+			free(base);
+			base = NULL;
+			goto out;
+		}
+
+		pthread_mutex_init(&base->mtx, NULL);
+		base->mevp = mevent_add_loop(loop, base->fd, EVF_READ,
+					     timer_handler, base, NULL, NULL);
+		if (base->mevp == NULL) {
+			perror("acrn_timer mevent add failed.\n");
+			close(base->fd);
+			pthread_mutex_destroy(&base->mtx);
+			free(base);
+			base = NULL;
+			goto out;
+		}
+
+		base->next = timer_bases;
+		timer_bases = base;
 	}
+	base->users++;
+out:
+	pthread_mutex_unlock(&timer_bases_mtx);
+	return base;
+}
+
+/* Drop a timer from its base, which goes with the last one */
+static void
+timer_base_put(struct acrn_timer_base *base)
+{
+	struct acrn_timer_base **pp;
+
+	pthread_mutex_lock(&timer_bases_mtx);
+	if (--base->users == 0) {
+		for (pp = &timer_bases; *pp != NULL; pp = &(*pp)->next) {
+			if (*pp == base) {
+				*pp = base->next;
+				break;
+			}
+		}
+		mevent_delete_close(base->mevp);
+		pthread_mutex_destroy(&base->mtx);
+		free(base->heap);
+		free(base);
+	}
+	pthread_mutex_unlock(&timer_bases_mtx);
 }
 
 int32_t
-acrn_timer_init(struct acrn_timer *timer, void (*cb)(void *), void *param)
+acrn_timer_init_loop(struct acrn_timer *timer, int loop, void (*cb)(void *),
+		     void *param)
 {
+	struct acrn_timer_base *base;
+	struct acrn_timer **heap;
+
 	if ((timer == NULL) || (cb == NULL)) {
 		return -1;
 	}
 
-	timer->fd = -1;
-	if ((timer->clockid == CLOCK_REALTIME) ||
-			(timer->clockid == CLOCK_MONOTONIC)) {
-		timer->fd = timerfd_create(timer->clockid,
-					TFD_NONBLOCK | TFD_CLOEXEC);
-	} else {
+	if ((timer->clockid != CLOCK_REALTIME) &&
+			(timer->clockid != CLOCK_MONOTONIC)) {
 		perror("acrn_timer clockid is not supported.\n");
+		return -1;
 	}
 
-	if (timer->fd <= 0) {
-		perror("acrn_timer create failed.\n");
+	base = timer_base_get(loop);
+	if (base == NULL) {
 		return -1;
 	}
 
-	timer->mevp = mevent_add(timer->fd, EVF_READ, timer_handler, timer, NULL, NULL);
-	if (timer->mevp == NULL) {
-		close(timer->fd);
-		perror("acrn_timer mevent add failed.\n");
-		return -1;
+	/* room for all the timers of the base in the heap */
+	pthread_mutex_lock(&base->mtx);
+	if (base->heap_size < base->users) {
+		heap = realloc(base->heap, base->users * 2 * sizeof(*heap));
+		if (heap == NULL) {
+			pthread_mutex_unlock(&base->mtx);
+			timer_base_put(base);
+			return -1;
+		}
+		base->heap = heap;
+		base->heap_size = base->users * 2;
 	}
+	pthread_mutex_unlock(&base->mtx);
 
+	timer->base = base;
+	timer->heap_idx = -1;
+	timer->deadline = 0;
+	timer->interval = 0;
 	timer->callback = cb;
 	timer->callback_param = param;
 
 	return 0;
 }
 
+int32_t
+acrn_timer_init(struct acrn_timer *timer, void (*cb)(void *), void *param)
+{
+	return acrn_timer_init_loop(timer, MEVENT_LOOP_MAIN, cb, param);
+}
+
 void
 acrn_timer_deinit(struct acrn_timer *timer)
 {
-	if (timer == NULL) {
+	struct acrn_timer_base *base;
+
+	if ((timer == NULL) || (timer->base == NULL)) {
 		return;
 	}
 
-	if (timer->mevp != NULL) {
-		mevent_delete_close(timer->mevp);
-		timer->mevp = NULL;
-	}
+	base = timer->base;
+	pthread_mutex_lock(&base->mtx);
+	timer_heap_remove(base, timer);
+	timer->deadline = 0;
+	timer_base_rearm(base);
+	pthread_mutex_unlock(&base->mtx);
+	timer_base_put(base);
 
-	timer->fd = -1;
+	timer->base = NULL;
 	timer->callback = NULL;
 	timer->callback_param = NULL;
 }
@@ -104,19 +350,51 @@ acrn_timer_deinit(struct acrn_timer *timer)
 int32_t
 acrn_timer_settime(struct acrn_timer *timer, struct itimerspec *new_value)
 {
-	if (timer == NULL) {
+	struct acrn_timer_base *base;
+	uint64_t value;
+
+	if ((timer == NULL) || (timer->base == NULL) || (new_value == NULL)) {
 		return -1;
 	}
 
-	return timerfd_settime(timer->fd, 0, new_value, NULL);
+	base = timer->base;
+	value = timespec_to_ns(&new_value->it_value);
+
+	pthread_mutex_lock(&base->mtx);
+	timer_heap_remove(base, timer);
+	timer->interval = timespec_to_ns(&new_value->it_interval);
+	if (value != 0) {
+		timer->deadline = timer_now() + value;
+		timer_heap_add(base, timer);
+	} else
+		timer->deadline = 0;
+	timer_base_rearm(base);
+	pthread_mutex_unlock(&base->mtx);
+
+	return 0;
 }
 
 int32_t
 acrn_timer_gettime(struct acrn_timer *timer, struct itimerspec *cur_value)
 {
-	if (timer == NULL) {
+	struct acrn_timer_base *base;
+	uint64_t now, left = 0;
+
+	if ((timer == NULL) || (timer->base == NULL) || (cur_value == NULL)) {
 		return -1;
 	}
 
-	return timerfd_gettime(timer->fd, cur_value);
+	base = timer->base;
+	now = timer_now();
+
+	pthread_mutex_lock(&base->mtx);
+	if (timer->deadline != 0) {
+		/* 1ns left for a timer which expired but did not run yet */
+		left = (timer->deadline > now) ? (timer->deadline - now) : 1;
+	}
+	ns_to_timespec(left, &cur_value->it_value);
+	ns_to_timespec(timer->interval, &cur_value->it_interval);
+	pthread_mutex_unlock(&base->mtx);
+
+	return 0;
 }
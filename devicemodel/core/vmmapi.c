@@ -37,6 +37,7 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 
 
 
@@ -130,6 +131,28 @@ vm_create(const char *name, uint64_t req_buf)
 	else
 		create_vm.vm_flag &= (~SECURE_WORLD_ENABLED);
 
+	/* Set scheduling priority flag */
+	if (high_prio_enabled)
+		create_vm.vm_flag |= HIGH_PRIORITY_VM;
+	else
+		create_vm.vm_flag &= (~HIGH_PRIORITY_VM);
+
+	/* Set CR ownership flag */
+	if (guest_cr_bits_enabled)
+		create_vm.vm_flag |= GUEST_OWNED_CR_BITS;
+	else
+		create_vm.vm_flag &= (~GUEST_OWNED_CR_BITS);
+
+	/* Set virtual PMU flag */
+	if (vpmu_enabled)
+		create_vm.vm_flag |= VPMU_ENABLED;
+	else
+		create_vm.vm_flag &= (~VPMU_ENABLED);
+
+	create_vm.ple_gap = ple_gap;
+	create_vm.ple_window = ple_window;
+	create_vm.tsc_khz = guest_tsc_khz;
+
 	create_vm.req_buf = req_buf;
 	while (retry > 0) {
 		error = ioctl(ctx->fd, IC_CREATE_VM, &create_vm);
@@ -202,6 +225,146 @@ vm_notify_request_done(struct vmctx *ctx, int vcpu)
 	return 0;
 }
 
+/* Set once the VHM turned IC_NOTIFY_REQUEST_FINISH_BATCH down */
+static bool notify_batch_unsupported;
+
+int
+vm_notify_requests_done(struct vmctx *ctx, uint64_t vcpu_mask)
+{
+	struct ioreq_notify_batch notify;
+	int vcpu, error = 0;
+
+	/* a single completion costs the same either way */
+	if (!notify_batch_unsupported && ((vcpu_mask & (vcpu_mask - 1)) != 0)) {
+		bzero(&notify, sizeof(notify));
+		notify.client_id = ctx->ioreq_client;
+		notify.vcpu_mask = vcpu_mask;
+
+		if (ioctl(ctx->fd, IC_NOTIFY_REQUEST_FINISH_BATCH, &notify) == 0)
+			return 0;
+		if (errno != ENOTTY && errno != EINVAL) {
+			fprintf(stderr, "failed: notify requests finish\n");
+			return -1;
+		}
+		notify_batch_unsupported = true;
+	}
+
+	while (vcpu_mask != 0) {
+		vcpu = __builtin_ctzl(vcpu_mask);
+		vcpu_mask &= vcpu_mask - 1;
+		if (vm_notify_request_done(ctx, vcpu) != 0)
+			error = -1;
+	}
+
+	return error;
+}
+
+int
+vm_set_posted_ioreq_buffer(struct vmctx *ctx, uint64_t buf)
+{
+	int error;
+	struct acrn_set_ioreq_buffer iobuf;
+
+	bzero(&iobuf, sizeof(iobuf));
+	iobuf.req_buf = buf;
+
+	error = ioctl(ctx->fd, IC_SET_POSTED_IOREQ_BUFFER, &iobuf);
+	ctx->posted_ioreq = (error == 0);
+
+	return error;
+}
+
+static int
+vm_set_posted_range(struct vmctx *ctx, uint64_t start, uint64_t end,
+		    uint32_t flags, bool assign)
+{
+	struct acrn_posted_mmio_range range;
+
+	if (!ctx->posted_ioreq)
+		return -1;
+
+	bzero(&range, sizeof(range));
+	range.op = assign ? POSTED_MMIO_ASSIGN : POSTED_MMIO_DEASSIGN;
+	range.flags = flags;
+	range.start = start;
+	range.end = end;
+
+	return ioctl(ctx->fd, IC_SET_POSTED_MMIO_RANGE, &range);
+}
+
+int
+vm_set_posted_mmio_range(struct vmctx *ctx, uint64_t start, uint64_t end,
+			 bool assign)
+{
+	return vm_set_posted_range(ctx, start, end, 0, assign);
+}
+
+int
+vm_set_posted_pio_range(struct vmctx *ctx, uint64_t start, uint64_t end,
+			bool assign)
+{
+	return vm_set_posted_range(ctx, start, end, POSTED_RANGE_FLAG_PIO,
+				   assign);
+}
+
+int
+vm_set_upcall_policy(struct vmctx *ctx, uint32_t policy, uint64_t vcpu_mask)
+{
+	struct acrn_upcall_policy upcall;
+
+	bzero(&upcall, sizeof(upcall));
+	upcall.policy = policy;
+	upcall.vcpu_mask = vcpu_mask;
+
+	return ioctl(ctx->fd, IC_SET_UPCALL_POLICY, &upcall);
+}
+
+int
+vm_set_ioeventfd_page(struct vmctx *ctx, uint64_t page)
+{
+	int error;
+	struct acrn_set_ioreq_buffer iobuf;
+
+	bzero(&iobuf, sizeof(iobuf));
+	iobuf.req_buf = page;
+
+	error = ioctl(ctx->fd, IC_SET_IOEVENTFD_PAGE, &iobuf);
+	ctx->hv_ioeventfd = (error == 0);
+
+	return error;
+}
+
+int
+vm_set_clock_page(struct vmctx *ctx, uint64_t page)
+{
+	struct acrn_set_ioreq_buffer iobuf;
+
+	bzero(&iobuf, sizeof(iobuf));
+	iobuf.req_buf = page;
+
+	return ioctl(ctx->fd, IC_SET_CLOCK_PAGE, &iobuf);
+}
+
+int
+vm_set_telemetry_page(struct vmctx *ctx, uint64_t page)
+{
+	struct acrn_set_ioreq_buffer iobuf;
+
+	bzero(&iobuf, sizeof(iobuf));
+	iobuf.req_buf = page;
+
+	return ioctl(ctx->fd, IC_SET_TELEMETRY_PAGE, &iobuf);
+}
+
+int
+vm_assign_hv_ioeventfd(struct vmctx *ctx, struct acrn_hv_ioeventfd *args)
+{
+	if (!ctx->hv_ioeventfd)
+		return -1;
+
+	return ioctl(ctx->fd, IC_ASSIGN_HV_IOEVENTFD, args);
+}
+
 void
 vm_destroy(struct vmctx *ctx)
 {
@@ -277,6 +440,59 @@ vm_map_memseg_vma(struct vmctx *ctx, size_t len, vm_paddr_t gpa,
 	return ioctl(ctx->fd, IC_SET_MEMSEG, &memmap);
 }
 
+/*
+ * Take [gpa, gpa + len) of the guest memory mapped by vm_map_memseg_vma()
+ * out of the EPT of the guest, e.g. before its backing is given back to
+ * the SOS. The guest accesses to it then come to the DM as MMIO.
+ */
+int
+vm_unmap_memseg_vma(struct vmctx *ctx, size_t len, vm_paddr_t gpa,
+	uint64_t vma)
+{
+	struct vm_memmap memmap;
+
+	bzero(&memmap, sizeof(struct vm_memmap));
+	memmap.type = VM_MEMMAP_SYSMEM;
+	memmap.using_vma = 1;
+	memmap.vma_base = vma;
+	memmap.len = len;
+	memmap.gpa = gpa;
+	memmap.prot = PROT_ALL;
+	return ioctl(ctx->fd, IC_UNSET_MEMSEG, &memmap);
+}
+
+int
+vm_dirty_log(struct vmctx *ctx, uint32_t op, vm_paddr_t gpa, size_t len,
+	uint64_t *bitmap, uint64_t *nr_dirty)
+{
+	struct acrn_dirty_log log;
+	int error;
+
+	bzero(&log, sizeof(log));
+	log.op = op;
+	log.gpa = gpa;
+	log.size = len;
+	log.bitmap_gpa = (uint64_t)bitmap;
+
+	error = ioctl(ctx->fd, IC_VM_DIRTY_LOG, &log);
+	if (error == 0 && nr_dirty != NULL)
+		*nr_dirty = log.nr_dirty;
+	return error;
+}
+
+int
+vm_set_cow(struct vmctx *ctx, vm_paddr_t gpa, size_t len, bool set)
+{
+	struct acrn_cow_range cow;
+
+	bzero(&cow, sizeof(cow));
+	cow.set = set ? 1 : 0;
+	cow.gpa = gpa;
+	cow.size = len;
+
+	return ioctl(ctx->fd, IC_VM_SET_COW, &cow);
+}
+
 int
 vm_setup_memory(struct vmctx *ctx, size_t memsize)
 {
@@ -294,7 +510,25 @@ vm_setup_memory(struct vmctx *ctx, size_t memsize)
 
 	ctx->biosmem = high_bios_size();
 
-	return hugetlb_setup_memory(ctx);
+	if (hugetlb_setup_memory(ctx) < 0)
+		return -1;
+
+	/* biosmem is read-only for the guest: devices can not use it */
+	ctx->nr_mem_segs = 0;
+	if (ctx->lowmem > 0) {
+		ctx->mem_segs[ctx->nr_mem_segs].gpa = 0;
+		ctx->mem_segs[ctx->nr_mem_segs].len = ctx->lowmem;
+		ctx->mem_segs[ctx->nr_mem_segs].hva = ctx->baseaddr;
+		ctx->nr_mem_segs++;
+	}
+	if (ctx->highmem > 0) {
+		ctx->mem_segs[ctx->nr_mem_segs].gpa = 4 * GB;
+		ctx->mem_segs[ctx->nr_mem_segs].len = ctx->highmem;
+		ctx->mem_segs[ctx->nr_mem_segs].hva = ctx->baseaddr + 4 * GB;
+		ctx->nr_mem_segs++;
+	}
+
+	return 0;
 }
 
 void
@@ -314,36 +548,78 @@ vm_unsetup_memory(struct vmctx *ctx)
 		bzero((void *)(ctx->baseaddr + 4 * GB), ctx->highmem);
 	}
 
+	ctx->nr_mem_segs = 0;
 	hugetlb_unsetup_memory(ctx);
 }
 
 /*
- * Returns a non-NULL pointer if [gaddr, gaddr+len) is entirely contained in
- * the lowmem or highmem regions.
+ * Append the host mapping of [gaddr, gaddr+len) to the *iovcnt entries of
+ * iov, split at the guest RAM segments. A piece which follows the last
+ * entry in the host address space extends it instead of using another.
  *
- * In particular return NULL if [gaddr, gaddr+len) falls in guest MMIO region.
- * The instruction emulation code depends on this behavior.
+ * Returns 0, -EFAULT if part of the range is not guest RAM, or -ENOSPC if
+ * it needs more than niov entries. iov and *iovcnt are left as they were
+ * on failure.
  */
-void *
-vm_map_gpa(struct vmctx *ctx, vm_paddr_t gaddr, size_t len)
-{
+int
+vm_map_gpa_iov(struct vmctx *ctx, vm_paddr_t gaddr, size_t len,
+	       struct iovec *iov, int *iovcnt, int niov)
+{
+	const struct vm_mem_seg *seg;
+	struct iovec *last;
+	size_t last_len;
+	int i, n = *iovcnt;
+	vm_paddr_t off;
+	size_t chunk;
+	char *hva;
+
+	last_len = (n > 0) ? iov[n - 1].iov_len : 0;
+
+	while (len > 0) {
+		seg = NULL;
+		off = 0;
+		for (i = 0; i < ctx->nr_mem_segs; i++) {
+			off = gaddr - ctx->mem_segs[i].gpa;
+			if (off < ctx->mem_segs[i].len) {
+				seg = &ctx->mem_segs[i];
+				break;
+			}
+		}
+		if (seg == NULL)
+			goto fail_fault;
+
+		chunk = seg->len - off;
+		if (chunk > len)
+			chunk = len;
+		hva = seg->hva + off;
+
+		last = (n > 0) ? &iov[n - 1] : NULL;
+		if ((last != NULL) &&
+		    ((char *)last->iov_base + last->iov_len == hva)) {
+			last->iov_len += chunk;
+		} else {
+			if (n == niov)
+				goto fail_space;
+			iov[n].iov_base = hva;
+			iov[n].iov_len = chunk;
+			n++;
+		}
 
-	if (ctx->lowmem > 0) {
-		if (gaddr < ctx->lowmem && len <= ctx->lowmem &&
-		    gaddr + len <= ctx->lowmem)
-			return (ctx->baseaddr + gaddr);
+		gaddr += chunk;
+		len -= chunk;
 	}
 
-	if (ctx->highmem > 0) {
-		if (gaddr >= 4*GB) {
-			if (gaddr < 4*GB + ctx->highmem &&
-			    len <= ctx->highmem &&
-			    gaddr + len <= 4*GB + ctx->highmem)
-				return (ctx->baseaddr + gaddr);
-		}
-	}
+	*iovcnt = n;
+	return 0;
 
-	return NULL;
+fail_fault:
+	if (*iovcnt > 0)
+		iov[*iovcnt - 1].iov_len = last_len;
+	return -EFAULT;
+fail_space:
+	if (*iovcnt > 0)
+		iov[*iovcnt - 1].iov_len = last_len;
+	return -ENOSPC;
 }
 
 size_t
@@ -380,6 +656,12 @@ vm_pause(struct vmctx *ctx)
 	ioctl(ctx->fd, IC_PAUSE_VM, &ctx->vmid);
 }
 
+int
+vm_unpause(struct vmctx *ctx)
+{
+	return ioctl(ctx->fd, IC_RESUME_VM, &ctx->vmid);
+}
+
 void
 vm_reset(struct vmctx *ctx)
 {
@@ -431,6 +713,33 @@ vm_lapic_msi(struct vmctx *ctx, uint64_t addr, uint64_t msg)
 	return ioctl(ctx->fd, IC_INJECT_MSI, &msi);
 }
 
+int
+vm_lapic_msi_batch(struct vmctx *ctx, const struct vm_lapic_msi *msi,
+		   int count)
+{
+	struct acrn_msi_batch batch;
+	int i, n, error = 0;
+
+	while (count > 0) {
+		n = (count < MSI_BATCH_ENTRIES_MAX) ? count : MSI_BATCH_ENTRIES_MAX;
+
+		bzero(&batch, sizeof(batch));
+		batch.nr_entries = n;
+		for (i = 0; i < n; i++) {
+			batch.entries[i].msi_addr = msi[i].addr;
+			batch.entries[i].msi_data = msi[i].msg;
+		}
+
+		if (ioctl(ctx->fd, IC_INJECT_MSI_BATCH, &batch) != 0)
+			error = -1;
+
+		msi += n;
+		count -= n;
+	}
+
+	return error;
+}
+
 int
 vm_set_gsi_irq(struct vmctx *ctx, int gsi, uint32_t operation)
 {
@@ -454,6 +763,29 @@ vm_assign_ptdev(struct vmctx *ctx, int bus, int slot, int func)
 	return ioctl(ctx->fd, IC_ASSIGN_PTDEV, &bdf);
 }
 
+int
+vm_assign_ptdev_batch(struct vmctx *ctx, const uint16_t *bdfs, int count)
+{
+	struct acrn_ptdev_batch batch;
+	int n, error = 0;
+
+	while (count > 0) {
+		n = (count < PTDEV_BATCH_MAX) ? count : PTDEV_BATCH_MAX;
+
+		bzero(&batch, sizeof(batch));
+		batch.nr_bdfs = n;
+		memcpy(batch.bdfs, bdfs, n * sizeof(uint16_t));
+
+		if (ioctl(ctx->fd, IC_ASSIGN_PTDEV_BATCH, &batch) != 0)
+			error = -1;
+
+		bdfs += n;
+		count -= n;
+	}
+
+	return error;
+}
+
 int
 vm_unassign_ptdev(struct vmctx *ctx, int bus, int slot, int func)
 {
@@ -578,6 +910,37 @@ vm_set_vcpu_regs(struct vmctx *ctx, struct acrn_set_vcpu_regs *vcpu_regs)
 	return ioctl(ctx->fd, IC_SET_VCPU_REGS, vcpu_regs);
 }
 
+/* only once the VM is paused */
+int
+vm_get_vcpu_regs(struct vmctx *ctx, uint16_t vcpu_id,
+		 struct acrn_set_vcpu_regs *vcpu_regs)
+{
+	bzero(vcpu_regs, sizeof(struct acrn_set_vcpu_regs));
+	vcpu_regs->vcpu_id = vcpu_id;
+
+	return ioctl(ctx->fd, IC_GET_VCPU_REGS, vcpu_regs);
+}
+
+int
+vm_get_vmexit_stats(struct vmctx *ctx, uint16_t vcpu_id,
+		    struct acrn_vmexit_stats *stats)
+{
+	bzero(stats, sizeof(struct acrn_vmexit_stats));
+	stats->vcpu_id = vcpu_id;
+
+	return ioctl(ctx->fd, IC_GET_VMEXIT_STATS, stats);
+}
+
+int
+vm_get_exit_timeline(struct vmctx *ctx, uint16_t vcpu_id,
+		     struct acrn_exit_timeline *timeline)
+{
+	bzero(timeline, sizeof(struct acrn_exit_timeline));
+	timeline->vcpu_id = vcpu_id;
+
+	return ioctl(ctx->fd, IC_GET_EXIT_TIMELINE, timeline);
+}
+
 int
 vm_get_device_fd(struct vmctx *ctx)
 {
@@ -30,7 +30,10 @@
 #include <sys/queue.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <linux/fs.h>
+#include <linux/falloc.h>
 #include <errno.h>
 #include <assert.h>
 #include <err.h>
@@ -40,12 +43,20 @@
 #include <string.h>
 #include <pthread.h>
 #include <signal.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "dm.h"
 #include "block_if.h"
 #include "ahci.h"
 #include "dm_string.h"
+#include "atomic.h"
+#include "cpu_acct.h"
+
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#define BLOCKIF_HAVE_URING
+#endif
 
 /*
  * Notes:
@@ -63,6 +74,27 @@
 
 #define BLOCKIF_NUMTHR	8
 #define BLOCKIF_MAXREQ	(64 + BLOCKIF_NUMTHR)
+/* a power of 2 above BLOCKIF_MAXREQ, leaving a slot to stop the reaper */
+#define BLOCKIF_URING_ENTRIES	128
+
+/*
+ * The ranges of the queued requests are hashed by 1MB chunk. A request
+ * is on the chain of each chunk it covers, 2 at most, or on wideq when
+ * it covers more. Two overlapping requests are both on the chain of
+ * their first common chunk.
+ */
+#define BLOCKIF_CHUNK_SHIFT	20
+#define BLOCKIF_HASH_SIZE	64	/* a power of 2 */
+#define BLOCKIF_HASH(c)		((c) & (BLOCKIF_HASH_SIZE - 1))
+
+/* the most a worker thread makes of contiguous requests in one go */
+#define BLOCKIF_MERGE_IOV	256
+#define BLOCKIF_MERGE_MAX	(1024 * 1024)
+static_assert(BLOCKIF_MERGE_IOV >= BLOCKIF_IOV_MAX,
+	      "compile-time assertion failed");
+
+/* what "iops=" and "bps=" let through at once, of an idle disk */
+#define BLOCKIF_THROTTLE_BURST	(100 * 1000 * 1000UL)	/* ns of the rate */
 
 /*
  * Debug printf
@@ -75,7 +107,8 @@ enum blockop {
 	BOP_READ,
 	BOP_WRITE,
 	BOP_FLUSH,
-	BOP_DELETE
+	BOP_DELETE,
+	BOP_ZERO
 };
 
 enum blockstat {
@@ -86,13 +119,114 @@ enum blockstat {
 	BST_DONE
 };
 
+struct blockif_hnode {
+	TAILQ_ENTRY(blockif_hnode) link;
+	struct blockif_elem	*be;
+	off_t			chunk;
+};
+
+TAILQ_HEAD(blockif_hchain, blockif_hnode);
+
 struct blockif_elem {
 	TAILQ_ENTRY(blockif_elem) link;
 	struct blockif_req  *req;
 	enum blockop	     op;
 	enum blockstat	     status;
 	pthread_t            tid;
-	off_t		     block;
+	int		     sync;	/* done by blockif_proc, not the ring */
+
+	/* [start, end) on the hash chains, see BLOCKIF_CHUNK_SHIFT */
+	off_t		     start;
+	off_t		     end;
+	uint64_t	     seq;	/* the order it was queued in */
+	int		     nchunks;	/* -1 on wideq, 0 not hashed */
+	int		     deps;	/* earlier overlapping requests */
+	struct blockif_hnode hnode[2];
+
+	/* the next request done by the same preadv/pwritev */
+	struct blockif_elem  *merged;
+
+	uint64_t	     queued;	/* ns, see blockif_now() */
+	uint64_t	     started;
+};
+
+/*
+ * With "aio=io_uring", the requests are submitted to an io_uring instead
+ * of the worker threads, and one thread reaps their completions. Only
+ * bc->mtx holders touch the submission ring.
+ */
+struct blockif_uring {
+	int			fd;
+	unsigned int		*sq_tail;
+	unsigned int		*sq_mask;
+	unsigned int		*sq_array;
+	unsigned int		*cq_head;
+	unsigned int		*cq_tail;
+	unsigned int		*cq_mask;
+	struct io_uring_sqe	*sqes;
+	struct io_uring_cqe	*cqes;
+	void			*sq_ring;
+	void			*cq_ring;
+	size_t			sq_ring_sz;
+	size_t			cq_ring_sz;
+	size_t			sqes_sz;
+	unsigned int		to_submit;	/* queued, not yet submitted */
+	pthread_t		tid;
+};
+
+/*
+ * An overlay image ("base=") is a header, a bitmap of the clusters it
+ * has, and a sparse data area where cluster n is at data_offset + n *
+ * cluster size. The clusters it doesn't have are read from the base
+ * image, and copied from it on the first write.
+ */
+#define BLOCKIF_COW_MAGIC	0x31574f434e524341UL	/* "ACRNCOW1" */
+#define BLOCKIF_COW_VERSION	1U
+#define BLOCKIF_COW_SHIFT	16		/* 64KB clusters */
+#define BLOCKIF_COW_MAP_PAGE	4096UL		/* of the map, written at once */
+
+struct blockif_cow_header {
+	uint64_t	magic;
+	uint32_t	version;
+	uint32_t	cluster_shift;
+	uint64_t	size;		/* of the disk */
+	uint64_t	map_offset;
+	uint64_t	data_offset;
+	char		base[4056];	/* path of the base image */
+};
+static_assert(sizeof(struct blockif_cow_header) == 4096,
+	      "compile-time assertion failed");
+
+struct blockif_cow {
+	off_t			size;		/* of the disk */
+	int			basefd;
+	off_t			basesize;
+	char			*basemap;	/* with "shared", or NULL */
+	int			shift;		/* of the cluster size */
+	off_t			map_offset;
+	off_t			data_offset;
+	uint8_t			*map;		/* a bit per cluster */
+	size_t			map_size;
+	uint8_t			*dirty;		/* a byte per map page */
+	char			*buf;		/* a cluster, under alloc_mtx */
+	pthread_mutex_t		mtx;		/* setting map and dirty */
+	pthread_mutex_t		alloc_mtx;	/* copying clusters up */
+	int			refs;		/* the contexts sharing it */
+};
+
+/*
+ * The "iops=" and "bps=" limits of a disk, shared by its contexts. Each
+ * is a token bucket of BLOCKIF_THROTTLE_BURST: its tat is when it would
+ * be full again, pushed by each request cost / rate seconds later, and a
+ * request which takes it further than the burst waits for the excess.
+ */
+struct blockif_throttle {
+	uint64_t		iops;		/* per second, 0 for no limit */
+	uint64_t		bps;
+	uint64_t		iops_tat;	/* ns, see blockif_now() */
+	uint64_t		bps_tat;
+	pthread_mutex_t		mtx;
+	int			refs;
 };
 
 struct blockif_ctxt {
@@ -112,17 +246,60 @@ struct blockif_ctxt {
 	pthread_t		btid[BLOCKIF_NUMTHR];
 	pthread_mutex_t		mtx;
 	pthread_cond_t		cond;
+	struct blockif_uring	*uring;		/* NULL with the threads */
+	int			uring_opt;	/* "aio=io_uring" */
+	int			plugged;	/* see blockif_plug() */
+	void			(*batch_done)(void *arg);
+	void			*batch_arg;	/* see blockif_set_batch_done */
 
 	/* Request elements and free/pending/busy queues */
 	TAILQ_HEAD(, blockif_elem) freeq;
 	TAILQ_HEAD(, blockif_elem) pendq;
 	TAILQ_HEAD(, blockif_elem) busyq;
 	struct blockif_elem	reqs[BLOCKIF_MAXREQ];
+	struct blockif_hchain	hash[BLOCKIF_HASH_SIZE];
+	struct blockif_hchain	wideq;
+	uint64_t		seq;
+	struct blockif_stats	stats;
 
 	/* write cache enable */
 	uint8_t			wce;
+
+	/*
+	 * With "direct", fd bypasses the page cache and the requests must
+	 * be aligned to align. bfd is the same file through the page cache.
+	 */
+	int			direct;
+	int			align;
+	int			bfd;
+
+	struct blockif_cow	*cow;		/* NULL with a raw image */
+
+	/*
+	 * With "shared", a read-only image is read from a mapping of its
+	 * first map_len bytes, the pages of the host cache every VM on the
+	 * image maps, rather than copied into each DM.
+	 */
+	char			*map;
+	off_t			map_len;
+
+	struct blockif_throttle	*throttle;	/* NULL without limits */
+
+	/*
+	 * With a "null:<size>" backing, fd is /dev/null and the requests
+	 * complete as they are made, leaving the buffers of the reads as
+	 * they were: what the device model costs, without the storage.
+	 */
+	int			null;
+	char			ident[16];
+	TAILQ_ENTRY(blockif_ctxt) list;		/* on blockif_list */
 };
 
+/* the open contexts, for blockif_get_stats_by_index() */
+static TAILQ_HEAD(, blockif_ctxt) blockif_list =
+	TAILQ_HEAD_INITIALIZER(blockif_list);
+static pthread_mutex_t blockif_list_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 static pthread_once_t blockif_once = PTHREAD_ONCE_INIT;
 
 struct blockif_sig_elem {
@@ -148,11 +325,629 @@ blockif_flush_cache(struct blockif_ctxt *bc)
 	return err;
 }
 
+/* can the iovecs go to bc->fd as they are */
+static int
+blockif_dio_ok(struct blockif_ctxt *bc, const struct iovec *iov, int iovcnt,
+	       off_t offset)
+{
+	uintptr_t mask = bc->align - 1;
+	int i;
+
+	if (!bc->direct)
+		return 1;
+
+	if ((offset + bc->sub_file_start_lba) & mask)
+		return 0;
+	for (i = 0; i < iovcnt; i++) {
+		if (((uintptr_t)iov[i].iov_base & mask) ||
+		    (iov[i].iov_len & mask))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * A write through has the data, and the metadata needed to read it back,
+ * stable on return: RWF_DSYNC (the FUA write of a disk), or the fsync of
+ * the whole file on the kernels without it.
+ */
+static ssize_t
+blockif_pwritev(struct blockif_ctxt *bc, int fd, const struct iovec *iov,
+		int iovcnt, off_t offset)
+{
+	ssize_t len;
+	int err;
+
+#ifdef RWF_DSYNC
+	if (!bc->wce) {
+		len = pwritev2(fd, iov, iovcnt, offset, RWF_DSYNC);
+		if (len >= 0 || (errno != ENOSYS && errno != EOPNOTSUPP))
+			return len;
+	}
+#endif
+
+	len = pwritev(fd, iov, iovcnt, offset);
+	if (len >= 0) {
+		err = blockif_flush_cache(bc);
+		if (err) {
+			errno = err;
+			return -1;
+		}
+	}
+
+	return len;
+}
+
+/*
+ * Map the first len bytes of fd to read them with "shared", or NULL.
+ * Every DM mapping the image shares the same pages of the host cache,
+ * which the kernel may keep in huge pages.
+ */
+static char *
+blockif_map(int fd, off_t len)
+{
+	void *map;
+
+	if (len <= 0)
+		return NULL;
+
+	map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		WPRINTF(("blockif: can't map the image, errno %d\n", errno));
+		return NULL;
+	}
+	(void)madvise(map, len, MADV_HUGEPAGE);
+
+	return map;
+}
+
+/* read iov at offset from map, of the first size bytes of an image */
+static ssize_t
+blockif_map_read(const char *map, off_t size, const struct iovec *iov,
+		 int iovcnt, off_t offset)
+{
+	size_t done, n;
+	int i;
+
+	for (i = 0, done = 0; i < iovcnt && offset + done < size; i++) {
+		n = MIN(iov[i].iov_len, size - offset - done);
+		memcpy(iov[i].iov_base, map + offset + done, n);
+		done += n;
+	}
+
+	return done;
+}
+
+/* the iovecs of the bytes [pos, pos + len) of iov */
+static int
+blockif_iov_slice(const struct iovec *iov, int iovcnt, size_t pos, size_t len,
+		  struct iovec *siov)
+{
+	int i, n;
+
+	for (i = 0, n = 0; i < iovcnt && len > 0; i++) {
+		if (pos >= iov[i].iov_len) {
+			pos -= iov[i].iov_len;
+			continue;
+		}
+		siov[n].iov_base = (char *)iov[i].iov_base + pos;
+		siov[n].iov_len = MIN(iov[i].iov_len - pos, len);
+		len -= siov[n].iov_len;
+		pos = 0;
+		n++;
+	}
+
+	return n;
+}
+
+static inline int
+blockif_cow_test(struct blockif_cow *cow, uint64_t c)
+{
+	return (atomic_load(&cow->map[c >> 3]) >> (c & 7)) & 1;
+}
+
+/* read the base image, which reads as zeroes past its end */
+static ssize_t
+blockif_cow_read_base(struct blockif_cow *cow, struct iovec *siov, int n,
+		      off_t off, size_t len)
+{
+	ssize_t ret = 0;
+	size_t done;
+	int i;
+
+	if (off < cow->basesize && cow->basemap != NULL)
+		ret = blockif_map_read(cow->basemap, cow->basesize, siov, n,
+				       off);
+	else if (off < cow->basesize) {
+		ret = preadv(cow->basefd, siov, n, off);
+		if (ret < 0)
+			return -1;
+	}
+
+	for (i = 0, done = 0; i < n; done += siov[i++].iov_len) {
+		if (done + siov[i].iov_len <= (size_t)ret)
+			continue;
+		if (done >= (size_t)ret)
+			memset(siov[i].iov_base, 0, siov[i].iov_len);
+		else
+			memset((char *)siov[i].iov_base + (ret - done), 0,
+				siov[i].iov_len - (ret - done));
+	}
+
+	return len;
+}
+
+/* write the map page of cluster c, or leave it to the next flush */
+static int
+blockif_cow_mark(struct blockif_ctxt *bc, uint64_t c)
+{
+	struct blockif_cow *cow = bc->cow;
+	size_t page = (c >> 3) / BLOCKIF_COW_MAP_PAGE;
+	struct iovec iov;
+
+	pthread_mutex_lock(&cow->mtx);
+	atomic_or_fetch(&cow->map[c >> 3], 1 << (c & 7));
+	cow->dirty[page] = !!bc->wce;
+	pthread_mutex_unlock(&cow->mtx);
+
+	if (bc->wce)
+		return 0;
+
+	iov.iov_base = cow->map + page * BLOCKIF_COW_MAP_PAGE;
+	iov.iov_len = BLOCKIF_COW_MAP_PAGE;
+	if (blockif_pwritev(bc, bc->fd, &iov, 1, cow->map_offset +
+			page * BLOCKIF_COW_MAP_PAGE) != BLOCKIF_COW_MAP_PAGE) {
+		pthread_mutex_lock(&cow->mtx);
+		cow->dirty[page] = 1;
+		pthread_mutex_unlock(&cow->mtx);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Write [off, off + len), within cluster c which may not be in the
+ * overlay yet: then the rest of the cluster is copied from the base.
+ */
+static int
+blockif_cow_write_cluster(struct blockif_ctxt *bc, struct iovec *siov, int n,
+			  off_t off, size_t len)
+{
+	struct blockif_cow *cow = bc->cow;
+	uint64_t c = off >> cow->shift;
+	off_t start = c << cow->shift;
+	size_t csize, done;
+	struct iovec iov;
+	ssize_t ret;
+	int i, err = 0;
+
+	/* one at a time, the base must not overwrite a concurrent write */
+	pthread_mutex_lock(&cow->alloc_mtx);
+	if (blockif_cow_test(cow, c)) {
+		pthread_mutex_unlock(&cow->alloc_mtx);
+		ret = blockif_pwritev(bc, bc->fd, siov, n,
+				cow->data_offset + off);
+		return (ret == (ssize_t)len) ? 0 : -1;
+	}
+
+	csize = MIN((off_t)1 << cow->shift, bc->size - start);
+	if (off == start && len == csize) {
+		ret = blockif_pwritev(bc, bc->fd, siov, n,
+				cow->data_offset + off);
+	} else {
+		iov.iov_base = cow->buf;
+		iov.iov_len = csize;
+		ret = blockif_cow_read_base(cow, &iov, 1, start, csize);
+		for (i = 0, done = off - start; ret >= 0 && i < n; i++) {
+			memcpy(cow->buf + done, siov[i].iov_base,
+				siov[i].iov_len);
+			done += siov[i].iov_len;
+		}
+		if (ret >= 0)
+			ret = blockif_pwritev(bc, bc->fd, &iov, 1,
+					cow->data_offset + start);
+		len = csize;
+	}
+
+	if (ret != (ssize_t)len || blockif_cow_mark(bc, c) != 0)
+		err = -1;
+	pthread_mutex_unlock(&cow->alloc_mtx);
+
+	return err;
+}
+
+/* blockif_rw() on an overlay */
+static ssize_t
+blockif_cow_rw(struct blockif_ctxt *bc, const struct iovec *biov, int iovcnt,
+	       off_t offset, int write)
+{
+	struct blockif_cow *cow = bc->cow;
+	struct iovec siov[BLOCKIF_MERGE_IOV];
+	size_t len, pos, run, csize = (size_t)1 << cow->shift;
+	ssize_t ret;
+	off_t off;
+	int i, n, alloc;
+
+	assert(iovcnt <= BLOCKIF_MERGE_IOV);
+	for (i = 0, len = 0; i < iovcnt; i++)
+		len += biov[i].iov_len;
+	if (offset >= bc->size)
+		return 0;
+	len = MIN(len, (size_t)(bc->size - offset));
+
+	for (pos = 0; pos < len; pos += run) {
+		/* the run of clusters in or out of the overlay */
+		off = offset + pos;
+		alloc = blockif_cow_test(cow, off >> cow->shift);
+		run = MIN(csize - (off & (csize - 1)), len - pos);
+		while (pos + run < len && (!write || alloc) &&
+		       blockif_cow_test(cow, (off + run) >> cow->shift) == alloc)
+			run += MIN(csize, len - pos - run);
+
+		n = blockif_iov_slice(biov, iovcnt, pos, run, siov);
+		if (write && !alloc)
+			ret = blockif_cow_write_cluster(bc, siov, n, off, run) ?
+				-1 : (ssize_t)run;
+		else if (write)
+			ret = blockif_pwritev(bc, bc->fd, siov, n,
+					cow->data_offset + off);
+		else if (alloc)
+			ret = preadv(bc->fd, siov, n, cow->data_offset + off);
+		else
+			ret = blockif_cow_read_base(cow, siov, n, off, run);
+
+		if (ret < 0)
+			return (pos > 0) ? (ssize_t)pos : -1;
+		if ((size_t)ret < run)
+			return pos + ret;
+	}
+
+	return len;
+}
+
+/* the map of the clusters written since the last flush */
+static int
+blockif_cow_flush(struct blockif_ctxt *bc)
+{
+	struct blockif_cow *cow = bc->cow;
+	size_t p, q, npages = cow->map_size / BLOCKIF_COW_MAP_PAGE;
+	ssize_t len;
+
+	/* the clusters first, then the map which points at them */
+	if (fdatasync(bc->fd))
+		return errno;
+
+	for (p = 0; p < npages; p = q) {
+		/* a flush of another queue takes the next dirty pages */
+		pthread_mutex_lock(&cow->mtx);
+		while (p < npages && !cow->dirty[p])
+			p++;
+		for (q = p; q < npages && cow->dirty[q]; q++)
+			cow->dirty[q] = 0;
+		pthread_mutex_unlock(&cow->mtx);
+
+		if (p == q)
+			break;
+		len = (q - p) * BLOCKIF_COW_MAP_PAGE;
+		if (pwrite(bc->fd, cow->map + p * BLOCKIF_COW_MAP_PAGE, len,
+				cow->map_offset + p * BLOCKIF_COW_MAP_PAGE)
+				!= len) {
+			pthread_mutex_lock(&cow->mtx);
+			memset(cow->dirty + p, 1, q - p);
+			pthread_mutex_unlock(&cow->mtx);
+			return EIO;
+		}
+	}
+
+	if (fdatasync(bc->fd))
+		return errno;
+	return 0;
+}
+
+/* a flush of the file, and of the overlay map */
+static int
+blockif_sync(struct blockif_ctxt *bc)
+{
+	if (bc->null)
+		return 0;
+	if (bc->cow != NULL)
+		return blockif_cow_flush(bc);
+	if (fsync(bc->fd))
+		return errno;
+	return 0;
+}
+
+/*
+ * Read or write biov at offset of the disk. With "direct", a request at
+ * an unaligned offset or of an unaligned length goes through the page
+ * cache, one with unaligned buffers through an aligned bounce buffer.
+ */
+static ssize_t
+blockif_rw(struct blockif_ctxt *bc, const struct iovec *biov, int iovcnt,
+	   off_t offset, int write)
+{
+	struct iovec iov;
+	size_t len, done, n;
+	ssize_t ret;
+	char *bounce;
+	int i, fd, ok;
+
+	if (!write && bc->map != NULL)
+		return blockif_map_read(bc->map, bc->map_len, biov, iovcnt,
+					offset + bc->sub_file_start_lba);
+	if (bc->cow != NULL)
+		return blockif_cow_rw(bc, biov, iovcnt, offset, write);
+
+	ok = blockif_dio_ok(bc, biov, iovcnt, offset);
+	offset += bc->sub_file_start_lba;
+	fd = bc->fd;
+	len = 0;
+	for (i = 0; i < iovcnt; i++)
+		len += biov[i].iov_len;
+
+	if (!ok && ((offset | len) & (bc->align - 1)) != 0)
+		fd = bc->bfd;
+	else if (!ok) {
+		if (posix_memalign((void **)&bounce, bc->align, len) != 0) {
+			errno = ENOMEM;
+			return -1;
+		}
+		iov.iov_base = bounce;
+		iov.iov_len = len;
+
+		if (write) {
+			for (i = 0, done = 0; i < iovcnt; i++) {
+				memcpy(bounce + done, biov[i].iov_base,
+					biov[i].iov_len);
+				done += biov[i].iov_len;
+			}
+			ret = blockif_pwritev(bc, fd, &iov, 1, offset);
+		} else {
+			ret = preadv(fd, &iov, 1, offset);
+			for (i = 0, done = 0; ret > 0 && i < iovcnt &&
+					done < (size_t)ret; i++) {
+				n = MIN(biov[i].iov_len, (size_t)ret - done);
+				memcpy(biov[i].iov_base, bounce + done, n);
+				done += n;
+			}
+		}
+
+		free(bounce);
+		return ret;
+	}
+
+	if (write)
+		return blockif_pwritev(bc, fd, biov, iovcnt, offset);
+	return preadv(fd, biov, iovcnt, offset);
+}
+
+static inline off_t
+blockif_chunk(off_t off)
+{
+	return off >> BLOCKIF_CHUNK_SHIFT;
+}
+
+static inline int
+blockif_overlap(struct blockif_elem *a, struct blockif_elem *b)
+{
+	return (a->start < b->end && b->start < a->end);
+}
+
+static void
+blockif_hash_add(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	struct blockif_hnode *hn;
+	off_t first, last;
+	int i;
+
+	if (be->end <= be->start) {
+		be->nchunks = 0;
+		return;
+	}
+
+	first = blockif_chunk(be->start);
+	last = blockif_chunk(be->end - 1);
+	if (last - first > 1) {
+		be->nchunks = -1;
+		TAILQ_INSERT_TAIL(&bc->wideq, &be->hnode[0], link);
+		return;
+	}
+
+	be->nchunks = last - first + 1;
+	for (i = 0; i < be->nchunks; i++) {
+		hn = &be->hnode[i];
+		hn->chunk = first + i;
+		TAILQ_INSERT_TAIL(&bc->hash[BLOCKIF_HASH(hn->chunk)], hn, link);
+	}
+}
+
+static void
+blockif_hash_del(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	struct blockif_hnode *hn;
+	int i;
+
+	if (be->nchunks < 0)
+		TAILQ_REMOVE(&bc->wideq, &be->hnode[0], link);
+	for (i = 0; i < be->nchunks; i++) {
+		hn = &be->hnode[i];
+		TAILQ_REMOVE(&bc->hash[BLOCKIF_HASH(hn->chunk)], hn, link);
+	}
+	be->nchunks = 0;
+}
+
+/* call fn once for each queued request overlapping be */
+static void
+blockif_hash_foreach(struct blockif_ctxt *bc, struct blockif_elem *be,
+		     void (*fn)(struct blockif_elem *, struct blockif_elem *))
+{
+	struct blockif_elem *tbe;
+	struct blockif_hnode *hn;
+	off_t first, c;
+	int i;
+
+	if (be->nchunks < 0) {
+		/* not worth hashing, wide requests are rare */
+		TAILQ_FOREACH(tbe, &bc->pendq, link) {
+			if (tbe != be && tbe->nchunks != 0 &&
+			    blockif_overlap(be, tbe))
+				(*fn)(be, tbe);
+		}
+		TAILQ_FOREACH(tbe, &bc->busyq, link) {
+			if (tbe != be && tbe->nchunks != 0 &&
+			    blockif_overlap(be, tbe))
+				(*fn)(be, tbe);
+		}
+		return;
+	}
+
+	first = blockif_chunk(be->start);
+	for (i = 0; i < be->nchunks; i++) {
+		c = first + i;
+		TAILQ_FOREACH(hn, &bc->hash[BLOCKIF_HASH(c)], link) {
+			tbe = hn->be;
+			if (tbe == be || hn->chunk != c ||
+			    c != MAX(first, blockif_chunk(tbe->start)))
+				continue;
+			if (blockif_overlap(be, tbe))
+				(*fn)(be, tbe);
+		}
+	}
+	TAILQ_FOREACH(hn, &bc->wideq, link) {
+		tbe = hn->be;
+		if (blockif_overlap(be, tbe))
+			(*fn)(be, tbe);
+	}
+}
+
+static void
+blockif_hash_dep(struct blockif_elem *be, struct blockif_elem *tbe)
+{
+	be->deps++;
+}
+
+static void
+blockif_hash_undep(struct blockif_elem *be, struct blockif_elem *tbe)
+{
+	if (tbe->seq < be->seq)
+		return;
+	assert(tbe->status == BST_BLOCK && tbe->deps > 0);
+	if (--tbe->deps == 0)
+		tbe->status = BST_PEND;
+}
+
+/* ns on CLOCK_MONOTONIC, of the latencies and the limits */
+static uint64_t
+blockif_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void
+blockif_lat_add(uint64_t *hist, uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	int n;
+
+	for (n = 0; us != 0 && n < BLOCKIF_LAT_BUCKETS - 1; n++)
+		us >>= 1;
+	atomic_add_fetch(&hist[n], 1);
+}
+
+/* account for be, outside of bc->mtx, and complete it to the caller */
+static void
+blockif_done(struct blockif_ctxt *bc, struct blockif_elem *be, int err)
+{
+	struct blockif_req *br = be->req;
+	uint64_t len;
+	int i;
+
+	/* what was transferred, the ring fills in no range */
+	len = -br->resid;
+	for (i = 0; i < br->iovcnt; i++)
+		len += br->iov[i].iov_len;
+
+	switch (be->op) {
+	case BOP_READ:
+		atomic_add_fetch(&bc->stats.reads, 1);
+		if (err == 0)
+			atomic_add_fetch(&bc->stats.rbytes, len);
+		break;
+	case BOP_WRITE:
+		atomic_add_fetch(&bc->stats.writes, 1);
+		if (err == 0)
+			atomic_add_fetch(&bc->stats.wbytes, len);
+		break;
+	default:
+		atomic_add_fetch(&bc->stats.others, 1);
+		break;
+	}
+	blockif_lat_add(bc->stats.queue_lat, be->started - be->queued);
+	blockif_lat_add(bc->stats.service_lat, blockif_now() - be->started);
+
+	(*br->callback)(br, err);
+}
+
+/* take cost from the bucket of rate at now, the ns to wait for it */
+static uint64_t
+blockif_bucket_take(uint64_t *tat, uint64_t rate, uint64_t cost,
+		    uint64_t now)
+{
+	if (rate == 0)
+		return 0;
+
+	if (*tat < now)
+		*tat = now;
+	*tat += cost * 1000000000UL / rate;
+
+	if (*tat <= now + BLOCKIF_THROTTLE_BURST)
+		return 0;
+	return *tat - now - BLOCKIF_THROTTLE_BURST;
+}
+
+/* wait until the limits let be and the requests merged with it through */
+static void
+blockif_throttle(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	struct blockif_throttle *thr = bc->throttle;
+	struct blockif_elem *mbe;
+	uint64_t n, bytes, now, wait, bwait;
+	struct timespec ts;
+
+	n = 0;
+	bytes = 0;
+	for (mbe = be; mbe != NULL; mbe = mbe->merged) {
+		n++;
+		if (mbe->op == BOP_READ || mbe->op == BOP_WRITE)
+			bytes += mbe->end - mbe->start;
+	}
+
+	now = blockif_now();
+	pthread_mutex_lock(&thr->mtx);
+	wait = blockif_bucket_take(&thr->iops_tat, thr->iops, n, now);
+	bwait = blockif_bucket_take(&thr->bps_tat, thr->bps, bytes, now);
+	pthread_mutex_unlock(&thr->mtx);
+	wait = MAX(wait, bwait);
+	if (wait == 0)
+		return;
+
+	/* blockif_cancel() cuts it short, as it does a preadv/pwritev */
+	atomic_add_fetch(&bc->stats.throttled, n);
+	ts.tv_sec = wait / 1000000000UL;
+	ts.tv_nsec = wait % 1000000000UL;
+	nanosleep(&ts, NULL);
+}
+
 static int
 blockif_enqueue(struct blockif_ctxt *bc, struct blockif_req *breq,
 		enum blockop op)
 {
-	struct blockif_elem *be, *tbe;
+	struct blockif_elem *be;
 	off_t off;
 	int i;
 
@@ -162,35 +957,77 @@ blockif_enqueue(struct blockif_ctxt *bc, struct blockif_req *breq,
 	TAILQ_REMOVE(&bc->freeq, be, link);
 	be->req = breq;
 	be->op = op;
+	be->queued = blockif_now();
 	switch (op) {
 	case BOP_READ:
 	case BOP_WRITE:
-	case BOP_DELETE:
 		off = breq->offset;
 		for (i = 0; i < breq->iovcnt; i++)
 			off += breq->iov[i].iov_len;
 		break;
+	case BOP_DELETE:
+	case BOP_ZERO:
+		off = breq->offset + breq->resid;
+		break;
 	default:
-		/* off = OFF_MAX; */
-		off = 1 << (sizeof(off_t) - 1);
-	}
-	be->block = off;
-	TAILQ_FOREACH(tbe, &bc->pendq, link) {
-		if (tbe->block == breq->offset)
-			break;
+		/* a flush doesn't wait and isn't waited for */
+		off = breq->offset;
 	}
-	if (tbe == NULL) {
-		TAILQ_FOREACH(tbe, &bc->busyq, link) {
-			if (tbe->block == breq->offset)
+
+	/* wait for the earlier requests which overlap this one */
+	be->start = breq->offset;
+	be->end = off;
+	be->seq = bc->seq++;
+	be->deps = 0;
+	blockif_hash_add(bc, be);
+	if (be->nchunks != 0)
+		blockif_hash_foreach(bc, be, blockif_hash_dep);
+
+	be->status = (be->deps == 0) ? BST_PEND : BST_BLOCK;
+	TAILQ_INSERT_TAIL(&bc->pendq, be, link);
+	return (be->status == BST_PEND);
+}
+
+/*
+ * Take the pending requests which continue be, for the worker thread to
+ * do them all with one preadv/pwritev.
+ */
+static void
+blockif_merge(struct blockif_ctxt *bc, struct blockif_elem *be, pthread_t t)
+{
+	struct blockif_elem *last, *nbe;
+	struct blockif_hnode *hn;
+	int iovcnt;
+	off_t c;
+
+	if ((be->op != BOP_READ && be->op != BOP_WRITE) || be->nchunks <= 0)
+		return;
+
+	iovcnt = be->req->iovcnt;
+	for (last = be; ; last = nbe) {
+		/* one starting at last->end is hashed on that chunk first */
+		c = blockif_chunk(last->end);
+		nbe = NULL;
+		TAILQ_FOREACH(hn, &bc->hash[BLOCKIF_HASH(c)], link) {
+			if (hn->chunk == c && hn->be->start == last->end &&
+			    hn->be->status == BST_PEND && hn->be->op == be->op) {
+				nbe = hn->be;
 				break;
+			}
 		}
+		if (nbe == NULL ||
+		    iovcnt + nbe->req->iovcnt > BLOCKIF_MERGE_IOV ||
+		    nbe->end - be->start > BLOCKIF_MERGE_MAX)
+			break;
+
+		TAILQ_REMOVE(&bc->pendq, nbe, link);
+		nbe->status = BST_BUSY;
+		nbe->tid = t;
+		TAILQ_INSERT_TAIL(&bc->busyq, nbe, link);
+		last->merged = nbe;
+		iovcnt += nbe->req->iovcnt;
+		bc->stats.merged++;
 	}
-	if (tbe == NULL)
-		be->status = BST_PEND;
-	else
-		be->status = BST_BLOCK;
-	TAILQ_INSERT_TAIL(&bc->pendq, be, link);
-	return (be->status == BST_PEND);
 }
 
 static int
@@ -209,6 +1046,7 @@ blockif_dequeue(struct blockif_ctxt *bc, pthread_t t, struct blockif_elem **bep)
 	be->status = BST_BUSY;
 	be->tid = t;
 	TAILQ_INSERT_TAIL(&bc->busyq, be, link);
+	blockif_merge(bc, be, t);
 	*bep = be;
 	return 1;
 }
@@ -216,22 +1054,72 @@ blockif_dequeue(struct blockif_ctxt *bc, pthread_t t, struct blockif_elem **bep)
 static void
 blockif_complete(struct blockif_ctxt *bc, struct blockif_elem *be)
 {
-	struct blockif_elem *tbe;
-
 	if (be->status == BST_DONE || be->status == BST_BUSY)
 		TAILQ_REMOVE(&bc->busyq, be, link);
 	else
 		TAILQ_REMOVE(&bc->pendq, be, link);
-	TAILQ_FOREACH(tbe, &bc->pendq, link) {
-		if (tbe->req->offset == be->block)
-			tbe->status = BST_PEND;
+	if (be->nchunks != 0) {
+		blockif_hash_foreach(bc, be, blockif_hash_undep);
+		blockif_hash_del(bc, be);
 	}
 	be->tid = 0;
 	be->status = BST_FREE;
 	be->req = NULL;
+	be->merged = NULL;
 	TAILQ_INSERT_TAIL(&bc->freeq, be, link);
 }
 
+/*
+ * Zero the range of br: without writing the zeroes if the backing can,
+ * deallocating it as the last resort.
+ */
+static int
+blockif_zero(struct blockif_ctxt *bc, struct blockif_req *br)
+{
+	off_t offset = br->offset + bc->sub_file_start_lba;
+	off_t arg[2];
+	struct iovec iov;
+	size_t len, done;
+	ssize_t n;
+	char *buf;
+	int err;
+
+	/* an overlay has the zeroes written, they hide the base */
+	if (bc->cow == NULL && bc->isblk) {
+		arg[0] = offset;
+		arg[1] = br->resid;
+		if (ioctl(bc->fd, BLKZEROOUT, arg) == 0)
+			return 0;
+	} else if (bc->cow == NULL) {
+		if (fallocate(bc->fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+				offset, br->resid) == 0)
+			return 0;
+		if (bc->candelete && fallocate(bc->fd,
+				FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+				offset, br->resid) == 0)
+			return 0;
+	}
+
+	len = MIN((size_t)br->resid, BLOCKIF_MERGE_MAX);
+	if (posix_memalign((void **)&buf, bc->align, len) != 0)
+		return ENOMEM;
+	memset(buf, 0, len);
+
+	err = 0;
+	for (done = 0; done < (size_t)br->resid; done += n) {
+		iov.iov_base = buf;
+		iov.iov_len = MIN(len, br->resid - done);
+		n = blockif_rw(bc, &iov, 1, br->offset + done, 1);
+		if (n <= 0) {
+			err = (n < 0) ? errno : EIO;
+			break;
+		}
+	}
+
+	free(buf);
+	return err;
+}
+
 static void
 blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 {
@@ -244,8 +1132,7 @@ blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 	err = 0;
 	switch (be->op) {
 	case BOP_READ:
-		len = preadv(bc->fd, br->iov, br->iovcnt,
-				 br->offset + bc->sub_file_start_lba);
+		len = blockif_rw(bc, br->iov, br->iovcnt, br->offset, 0);
 		if (len < 0)
 			err = errno;
 		else
@@ -257,35 +1144,44 @@ blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 			break;
 		}
 
-		len = pwritev(bc->fd, br->iov, br->iovcnt,
-				  br->offset + bc->sub_file_start_lba);
+		len = blockif_rw(bc, br->iov, br->iovcnt, br->offset, 1);
 		if (len < 0)
 			err = errno;
-		else {
+		else
 			br->resid -= len;
-			err = blockif_flush_cache(bc);
-		}
 		break;
 	case BOP_FLUSH:
-		if (fsync(bc->fd))
-			err = errno;
+		err = blockif_sync(bc);
 		break;
 	case BOP_DELETE:
-		/* only used by AHCI */
 		if (!bc->candelete)
 			err = EOPNOTSUPP;
 		else if (bc->rdonly)
 			err = EROFS;
 		else if (bc->isblk) {
-			arg[0] = br->offset;
+			arg[0] = br->offset + bc->sub_file_start_lba;
 			arg[1] = br->resid;
 			if (ioctl(bc->fd, BLKDISCARD, arg))
 				err = errno;
-			else
-				br->resid = 0;
+		} else if (fallocate(bc->fd,
+				FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+				br->offset + bc->sub_file_start_lba,
+				br->resid))
+			err = errno;
+		if (err == 0) {
+			br->resid = 0;
+			err = blockif_flush_cache(bc);
 		}
+		break;
+	case BOP_ZERO:
+		if (bc->rdonly)
+			err = EROFS;
 		else
-			err = EOPNOTSUPP;
+			err = blockif_zero(bc, br);
+		if (err == 0) {
+			br->resid = 0;
+			err = blockif_flush_cache(bc);
+		}
 		break;
 	default:
 		err = EINVAL;
@@ -294,38 +1190,349 @@ blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 
 	be->status = BST_DONE;
 
-	(*br->callback)(br, err);
+	blockif_done(bc, be, err);
+}
+
+/* do be and the requests merged with it */
+static void
+blockif_proc_merged(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	struct iovec iov[BLOCKIF_MERGE_IOV];
+	struct blockif_elem *mbe, *next;
+	struct blockif_req *br;
+	ssize_t len, total;
+	int iovcnt;
+
+	if (be->merged == NULL || (be->op == BOP_WRITE && bc->rdonly)) {
+		for (mbe = be; mbe != NULL; mbe = next) {
+			next = mbe->merged;
+			blockif_proc(bc, mbe);
+		}
+		return;
+	}
+
+	iovcnt = 0;
+	total = 0;
+	for (mbe = be; mbe != NULL; mbe = mbe->merged) {
+		br = mbe->req;
+		memcpy(&iov[iovcnt], br->iov, sizeof(struct iovec) * br->iovcnt);
+		iovcnt += br->iovcnt;
+		total += mbe->end - mbe->start;
+	}
+
+	len = blockif_rw(bc, iov, iovcnt, be->start, be->op == BOP_WRITE);
+	if (len != total) {
+		/* each request gets its own error or short count */
+		for (mbe = be; mbe != NULL; mbe = next) {
+			next = mbe->merged;
+			blockif_proc(bc, mbe);
+		}
+		return;
+	}
+
+	for (mbe = be; mbe != NULL; mbe = next) {
+		next = mbe->merged;
+		br = mbe->req;
+		br->resid -= mbe->end - mbe->start;
+		mbe->status = BST_DONE;
+		blockif_done(bc, mbe, 0);
+	}
+}
+
+static void *
+blockif_thr(void *arg)
+{
+	struct blockif_ctxt *bc;
+	struct blockif_elem *be, *mbe, *next;
+	uint64_t now;
+	pthread_t t;
+
+	bc = arg;
+	t = pthread_self();
+
+	pthread_mutex_lock(&bc->mtx);
+
+	for (;;) {
+		while (blockif_dequeue(bc, t, &be)) {
+			pthread_mutex_unlock(&bc->mtx);
+			if (bc->throttle != NULL)
+				blockif_throttle(bc, be);
+			now = blockif_now();
+			for (mbe = be; mbe != NULL; mbe = mbe->merged)
+				mbe->started = now;
+			blockif_proc_merged(bc, be);
+			if (bc->batch_done != NULL)
+				(*bc->batch_done)(bc->batch_arg);
+			pthread_mutex_lock(&bc->mtx);
+			for (; be != NULL; be = next) {
+				next = be->merged;
+				blockif_complete(bc, be);
+			}
+		}
+		/* Check ctxt status here to see if exit requested */
+		if (bc->closing)
+			break;
+		pthread_cond_wait(&bc->cond, &bc->mtx);
+	}
+
+	pthread_mutex_unlock(&bc->mtx);
+	pthread_exit(NULL);
+	return NULL;
+}
+
+#ifdef BLOCKIF_HAVE_URING
+/* queue be, or a request to stop the reaper if be is NULL */
+static void
+blockif_uring_queue(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	struct blockif_uring *ur = bc->uring;
+	struct io_uring_sqe *sqe;
+	struct blockif_req *br;
+	unsigned int tail, idx;
+
+	tail = *ur->sq_tail;
+	idx = tail & *ur->sq_mask;
+	sqe = &ur->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_NOP;
+	sqe->fd = bc->fd;
+	sqe->user_data = (uintptr_t)be;
+
+	if (be != NULL) {
+		br = be->req;
+		be->sync = 0;
+		switch (be->op) {
+		case BOP_READ:
+			if (!blockif_dio_ok(bc, br->iov, br->iovcnt,
+					br->offset)) {
+				be->sync = 1;
+				break;
+			}
+			sqe->opcode = IORING_OP_READV;
+			break;
+		case BOP_WRITE:
+			if (bc->rdonly || !blockif_dio_ok(bc, br->iov,
+					br->iovcnt, br->offset)) {
+				be->sync = 1;
+				break;
+			}
+			sqe->opcode = IORING_OP_WRITEV;
+			/* the fsync after each write of the threads */
+			if (!bc->wce)
+				sqe->rw_flags = RWF_DSYNC;
+			break;
+		case BOP_FLUSH:
+			sqe->opcode = IORING_OP_FSYNC;
+			break;
+		default:
+			/* the ring completes a NOP, the reaper does the rest */
+			be->sync = 1;
+			break;
+		}
+
+		if (sqe->opcode == IORING_OP_READV ||
+		    sqe->opcode == IORING_OP_WRITEV) {
+			sqe->addr = (uintptr_t)br->iov;
+			sqe->len = br->iovcnt;
+			sqe->off = br->offset + bc->sub_file_start_lba;
+		}
+	}
+
+	ur->sq_array[idx] = idx;
+	atomic_store(ur->sq_tail, tail + 1);
+	ur->to_submit++;
+}
+
+/*
+ * Submit what is queued. What the kernel can't take now (e.g. the
+ * completion ring is full) is submitted again once the reaper made room.
+ */
+static void
+blockif_uring_submit(struct blockif_uring *ur)
+{
+	int ret;
+
+	while (ur->to_submit > 0) {
+		ret = syscall(__NR_io_uring_enter, ur->fd, ur->to_submit,
+				0, 0, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EBUSY)
+				WPRINTF(("blockif: io_uring submit error %d\n",
+					errno));
+			break;
+		}
+		ur->to_submit -= ret;
+	}
+}
+
+static void
+blockif_uring_done(struct blockif_ctxt *bc, struct blockif_elem *be,
+		   int res)
+{
+	struct blockif_req *br = be->req;
+	int err = 0;
+
+	if (be->sync) {
+		blockif_proc(bc, be);
+	} else {
+		if (res < 0)
+			err = -res;
+		else if (be->op != BOP_FLUSH)
+			br->resid -= res;
+		be->status = BST_DONE;
+		blockif_done(bc, be, err);
+	}
+
+	pthread_mutex_lock(&bc->mtx);
+	blockif_complete(bc, be);
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+static void *
+blockif_uring_thr(void *arg)
+{
+	struct blockif_ctxt *bc = arg;
+	struct blockif_uring *ur = bc->uring;
+	struct io_uring_cqe *cqe;
+	struct blockif_elem *be;
+	unsigned int head;
+	int res, ret, stop = 0;
+
+	while (!stop) {
+		ret = syscall(__NR_io_uring_enter, ur->fd, 0, 1,
+				IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0 && errno != EINTR) {
+			WPRINTF(("blockif: io_uring wait error %d\n", errno));
+			usleep(1000);
+		}
+
+		head = *ur->cq_head;
+		while (head != atomic_load(ur->cq_tail)) {
+			cqe = &ur->cqes[head & *ur->cq_mask];
+			be = (struct blockif_elem *)(uintptr_t)cqe->user_data;
+			res = cqe->res;
+			atomic_store(ur->cq_head, ++head);
+
+			if (be == NULL)
+				stop = 1;
+			else
+				blockif_uring_done(bc, be, res);
+		}
+		if (bc->batch_done != NULL)
+			(*bc->batch_done)(bc->batch_arg);
+
+		pthread_mutex_lock(&bc->mtx);
+		blockif_uring_submit(ur);
+		pthread_mutex_unlock(&bc->mtx);
+	}
+
+	return NULL;
+}
+
+static void
+blockif_uring_free(struct blockif_uring *ur)
+{
+	if (ur->sqes != NULL && ur->sqes != MAP_FAILED)
+		munmap(ur->sqes, ur->sqes_sz);
+	if (ur->cq_ring != NULL && ur->cq_ring != MAP_FAILED)
+		munmap(ur->cq_ring, ur->cq_ring_sz);
+	if (ur->sq_ring != NULL && ur->sq_ring != MAP_FAILED)
+		munmap(ur->sq_ring, ur->sq_ring_sz);
+	close(ur->fd);
+	free(ur);
+}
+
+static int
+blockif_uring_init(struct blockif_ctxt *bc)
+{
+	struct io_uring_params p;
+	struct blockif_uring *ur;
+	char *sq, *cq;
+
+	ur = calloc(1, sizeof(struct blockif_uring));
+	if (ur == NULL)
+		return -1;
+
+	memset(&p, 0, sizeof(p));
+	ur->fd = syscall(__NR_io_uring_setup, BLOCKIF_URING_ENTRIES, &p);
+	if (ur->fd < 0) {
+		free(ur);
+		return -1;
+	}
+
+	ur->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ur->cq_ring_sz = p.cq_off.cqes +
+			p.cq_entries * sizeof(struct io_uring_cqe);
+	ur->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ur->sq_ring = mmap(NULL, ur->sq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+	ur->cq_ring = mmap(NULL, ur->cq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_CQ_RING);
+	ur->sqes = mmap(NULL, ur->sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+	if (ur->sq_ring == MAP_FAILED || ur->cq_ring == MAP_FAILED ||
+	    ur->sqes == MAP_FAILED) {
+		blockif_uring_free(ur);
+		return -1;
+	}
+
+	sq = ur->sq_ring;
+	ur->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	ur->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	ur->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	cq = ur->cq_ring;
+	ur->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	ur->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	ur->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	bc->uring = ur;
+	return 0;
+}
+
+static void
+blockif_uring_close(struct blockif_ctxt *bc)
+{
+	pthread_mutex_lock(&bc->mtx);
+	blockif_uring_queue(bc, NULL);
+	blockif_uring_submit(bc->uring);
+	pthread_mutex_unlock(&bc->mtx);
+
+	pthread_join(bc->uring->tid, NULL);
+	blockif_uring_free(bc->uring);
+	bc->uring = NULL;
+}
+#else
+static void
+blockif_uring_queue(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+}
+
+static void
+blockif_uring_submit(struct blockif_uring *ur)
+{
 }
 
 static void *
-blockif_thr(void *arg)
+blockif_uring_thr(void *arg)
 {
-	struct blockif_ctxt *bc;
-	struct blockif_elem *be;
-	pthread_t t;
-
-	bc = arg;
-	t = pthread_self();
-
-	pthread_mutex_lock(&bc->mtx);
+	return NULL;
+}
 
-	for (;;) {
-		while (blockif_dequeue(bc, t, &be)) {
-			pthread_mutex_unlock(&bc->mtx);
-			blockif_proc(bc, be);
-			pthread_mutex_lock(&bc->mtx);
-			blockif_complete(bc, be);
-		}
-		/* Check ctxt status here to see if exit requested */
-		if (bc->closing)
-			break;
-		pthread_cond_wait(&bc->cond, &bc->mtx);
-	}
+static int
+blockif_uring_init(struct blockif_ctxt *bc)
+{
+	return -1;
+}
 
-	pthread_mutex_unlock(&bc->mtx);
-	pthread_exit(NULL);
-	return NULL;
+static void
+blockif_uring_close(struct blockif_ctxt *bc)
+{
 }
+#endif
 
 static void
 blockif_sigcont_handler(int signal)
@@ -408,18 +1615,246 @@ sub_file_unlock(struct blockif_ctxt *bc)
 }
 
 
+/* a new overlay of base in the empty file fd */
+static int
+blockif_cow_create(int fd, const char *base)
+{
+	struct blockif_cow_header hdr;
+	size_t map_size;
+	char *path;
+	off_t size;
+	int basefd;
+
+	path = realpath(base, NULL);
+	if (path == NULL || strlen(path) >= sizeof(hdr.base)) {
+		fprintf(stderr, "blockif: bad base image %s\n", base);
+		free(path);
+		return -1;
+	}
+
+	basefd = open(path, O_RDONLY);
+	size = (basefd < 0) ? -1 : lseek(basefd, 0, SEEK_END);
+	if (basefd >= 0)
+		close(basefd);
+	if (size < 0) {
+		warn("Could not open base image %s", path);
+		free(path);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = BLOCKIF_COW_MAGIC;
+	hdr.version = BLOCKIF_COW_VERSION;
+	hdr.cluster_shift = BLOCKIF_COW_SHIFT;
+	hdr.size = size;
+	map_size = roundup(howmany(size, 1UL << BLOCKIF_COW_SHIFT), 8) / 8;
+	hdr.map_offset = sizeof(hdr);
+	hdr.data_offset = roundup(hdr.map_offset +
+			roundup(map_size, BLOCKIF_COW_MAP_PAGE),
+			1UL << BLOCKIF_COW_SHIFT);
+	strncpy(hdr.base, path, sizeof(hdr.base) - 1);
+	free(path);
+
+	/* the map of an empty overlay is a hole */
+	if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    ftruncate(fd, hdr.data_offset) != 0 || fsync(fd) != 0) {
+		warn("Could not create the overlay");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Set up *cowp if fd is an overlay: always with "base=", which creates
+ * the overlay in an empty file and overrides the base of the header.
+ */
+static int
+blockif_cow_open(int fd, off_t fsize, const char *base, int ro,
+		 struct blockif_cow **cowp)
+{
+	struct blockif_cow_header hdr;
+	struct blockif_cow *cow;
+	uint64_t nclusters;
+
+	*cowp = NULL;
+	if (fsize == 0 && base != NULL) {
+		if (ro || blockif_cow_create(fd, base) != 0)
+			return -1;
+	}
+
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    hdr.magic != BLOCKIF_COW_MAGIC) {
+		if (base == NULL)
+			return 0;
+		fprintf(stderr, "blockif: not an overlay of %s\n", base);
+		return -1;
+	}
+
+	hdr.base[sizeof(hdr.base) - 1] = '\0';
+	nclusters = howmany(hdr.size, 1UL << hdr.cluster_shift);
+	if (hdr.version != BLOCKIF_COW_VERSION || hdr.cluster_shift < 12 ||
+	    hdr.cluster_shift > 24 || hdr.map_offset < sizeof(hdr) ||
+	    hdr.data_offset < hdr.map_offset + howmany(nclusters, 8)) {
+		fprintf(stderr, "blockif: unsupported overlay\n");
+		return -1;
+	}
+
+	cow = calloc(1, sizeof(*cow));
+	if (cow == NULL)
+		return -1;
+	cow->size = hdr.size;
+	cow->shift = hdr.cluster_shift;
+	cow->map_offset = hdr.map_offset;
+	cow->data_offset = hdr.data_offset;
+	cow->map_size = roundup(howmany(nclusters, 8), BLOCKIF_COW_MAP_PAGE);
+	cow->map = calloc(1, cow->map_size);
+	cow->dirty = calloc(1, cow->map_size / BLOCKIF_COW_MAP_PAGE);
+	cow->buf = malloc(1UL << cow->shift);
+	cow->basefd = open(base ? base : hdr.base, O_RDONLY);
+	if (cow->map == NULL || cow->dirty == NULL || cow->buf == NULL ||
+	    cow->basefd < 0) {
+		warn("Could not open base image %s", base ? base : hdr.base);
+		goto err;
+	}
+	cow->basesize = lseek(cow->basefd, 0, SEEK_END);
+
+	/* the end of the map may not be in the file */
+	if (pread(fd, cow->map, howmany(nclusters, 8), cow->map_offset) < 0) {
+		warn("Could not read the overlay map");
+		goto err;
+	}
+
+	pthread_mutex_init(&cow->mtx, NULL);
+	pthread_mutex_init(&cow->alloc_mtx, NULL);
+	cow->refs = 1;
+	*cowp = cow;
+	return 0;
+
+err:
+	if (cow->basefd >= 0)
+		close(cow->basefd);
+	free(cow->buf);
+	free(cow->dirty);
+	free(cow->map);
+	free(cow);
+	return -1;
+}
+
+static void
+blockif_cow_free(struct blockif_cow *cow)
+{
+	pthread_mutex_destroy(&cow->mtx);
+	pthread_mutex_destroy(&cow->alloc_mtx);
+	if (cow->basemap != NULL)
+		munmap(cow->basemap, cow->basesize);
+	close(cow->basefd);
+	free(cow->buf);
+	free(cow->dirty);
+	free(cow->map);
+	free(cow);
+}
+
+/* set up the queues of bc and start its threads or io_uring */
+static void
+blockif_start(struct blockif_ctxt *bc, const char *ident)
+{
+	char tname[MAXCOMLEN + 1];
+	int i;
+
+	snprintf(bc->ident, sizeof(bc->ident), "%s", ident);
+	pthread_mutex_lock(&blockif_list_mtx);
+	TAILQ_INSERT_TAIL(&blockif_list, bc, list);
+	pthread_mutex_unlock(&blockif_list_mtx);
+
+	pthread_mutex_init(&bc->mtx, NULL);
+	pthread_cond_init(&bc->cond, NULL);
+	TAILQ_INIT(&bc->freeq);
+	TAILQ_INIT(&bc->pendq);
+	TAILQ_INIT(&bc->busyq);
+	for (i = 0; i < BLOCKIF_HASH_SIZE; i++)
+		TAILQ_INIT(&bc->hash[i]);
+	TAILQ_INIT(&bc->wideq);
+	for (i = 0; i < BLOCKIF_MAXREQ; i++) {
+		bc->reqs[i].status = BST_FREE;
+		bc->reqs[i].hnode[0].be = &bc->reqs[i];
+		bc->reqs[i].hnode[1].be = &bc->reqs[i];
+		TAILQ_INSERT_HEAD(&bc->freeq, &bc->reqs[i], link);
+	}
+
+	if (bc->uring_opt && blockif_uring_init(bc) != 0)
+		WPRINTF(("blockif: no io_uring for %s, using threads\n", ident));
+
+	if (bc->uring != NULL) {
+		snprintf(tname, sizeof(tname), "blk-%s-cq", ident);
+		pthread_create(&bc->uring->tid, NULL, blockif_uring_thr, bc);
+		dm_thread_setname(bc->uring->tid, tname);
+		return;
+	}
+
+	for (i = 0; i < BLOCKIF_NUMTHR; i++) {
+		if (snprintf(tname, sizeof(tname), "blk-%s-%d",
+					ident, i) >= sizeof(tname)) {
+			perror("blk thread name too long");
+		}
+		pthread_create(&bc->btid[i], NULL, blockif_thr, bc);
+		dm_thread_setname(bc->btid[i], tname);
+	}
+}
+
+/* the size of a "null:" disk: bytes, or with a K, M, G or T suffix */
+static int
+blockif_null_size(const char *s, off_t *size)
+{
+	unsigned long n;
+	char *end;
+	int shift = 0;
+
+	if (dm_strtoul(s, &end, 10, &n))
+		return -1;
+	switch (*end) {
+	case 'T': case 't':
+		shift += 10;
+		/* falls through */
+	case 'G': case 'g':
+		shift += 10;
+		/* falls through */
+	case 'M': case 'm':
+		shift += 10;
+		/* falls through */
+	case 'K': case 'k':
+		shift += 10;
+		end++;
+		break;
+	default:
+		break;
+	}
+	if (*end != '\0' || n == 0 || n > (LONG_MAX >> shift))
+		return -1;
+
+	*size = (off_t)(n << shift);
+	return 0;
+}
+
 struct blockif_ctxt *
 blockif_open(const char *optstr, const char *ident)
 {
-	char tname[MAXCOMLEN + 1];
 	/* char name[MAXPATHLEN]; */
 	char *nopt, *xopts, *cp;
 	struct blockif_ctxt *bc;
 	struct stat sbuf;
 	/* struct diocgattr_arg arg; */
 	off_t size, psectsz, psectoff;
-	int fd, i, sectsz;
-	int writeback, ro, candelete, ssopt, pssopt;
+	off_t range[2];
+	struct blockif_cow *cow = NULL;
+	struct blockif_throttle *thr = NULL;
+	unsigned long iops, bps;
+	const char *base, *path;
+	off_t null_size;
+	int fd, sectsz;
+	int writeback, ro, candelete, ssopt, pssopt, uring, direct, align;
+	int shared;
+	int bfd = -1;
 	long sz;
 	long long b;
 	int err_code = -1;
@@ -435,9 +1870,16 @@ blockif_open(const char *optstr, const char *ident)
 	sub_file_assign = 0;
 	sub_file_start_lba = 0;
 	sub_file_size = 0;
+	null_size = 0;
 
 	/* writethru is on by default */
 	writeback = 0;
+	uring = 0;
+	direct = 0;
+	shared = 0;
+	iops = 0;
+	bps = 0;
+	base = NULL;
 
 	/*
 	 * The first element in the optstring is always a pathname.
@@ -448,6 +1890,7 @@ blockif_open(const char *optstr, const char *ident)
 		WPRINTF(("block_if.c: strdup retruns NULL\n"));
 		return NULL;
 	}
+	path = nopt;
 	while (xopts != NULL) {
 		cp = strsep(&xopts, ",");
 		if (cp == nopt)		/* file or device pathname */
@@ -458,7 +1901,25 @@ blockif_open(const char *optstr, const char *ident)
 			writeback = 0;
 		else if (!strcmp(cp, "ro"))
 			ro = 1;
-		else if (!strncmp(cp, "sectorsize", strlen("sectorsize"))) {
+		else if (!strcmp(cp, "aio=io_uring"))
+			uring = 1;
+		else if (!strcmp(cp, "aio=threads"))
+			uring = 0;
+		else if (!strcmp(cp, "direct"))
+			direct = 1;
+		else if (!strcmp(cp, "shared"))
+			shared = 1;
+		else if (!strncmp(cp, "base=", strlen("base=")))
+			base = cp + strlen("base=");
+		else if (!strncmp(cp, "iops=", strlen("iops="))) {
+			if (dm_strtoul(cp + strlen("iops="), &cp, 10, &iops) ||
+			    *cp != '\0')
+				goto err;
+		} else if (!strncmp(cp, "bps=", strlen("bps="))) {
+			if (dm_strtoul(cp + strlen("bps="), &cp, 10, &bps) ||
+			    *cp != '\0')
+				goto err;
+		} else if (!strncmp(cp, "sectorsize", strlen("sectorsize"))) {
 			/*
 			 *  sectorsize=<sector size>
 			 * or
@@ -487,6 +1948,18 @@ blockif_open(const char *optstr, const char *ident)
 		}
 	}
 
+	if (!strncmp(nopt, "null:", strlen("null:"))) {
+		if (blockif_null_size(nopt + strlen("null:"), &null_size) ||
+		    base != NULL || sub_file_assign || iops != 0 || bps != 0) {
+			fprintf(stderr, "blockif: invalid null disk %s\n", nopt);
+			goto err;
+		}
+		path = "/dev/null";
+		direct = 0;
+		shared = 0;
+		uring = 0;
+	}
+
 	/*
 	 * To support "writeback" and "writethru" mode switch during runtime,
 	 * O_SYNC is not used directly, as O_SYNC flag cannot dynamic change
@@ -494,13 +1967,28 @@ blockif_open(const char *optstr, const char *ident)
 	 * operation to emulate it.
 	 */
 
-	fd = open(nopt, ro ? O_RDONLY : O_RDWR);
+	fd = open(path, (ro ? O_RDONLY : O_RDWR) | (direct ? O_DIRECT : 0) |
+		  ((base && !ro) ? O_CREAT : 0), 0600);
+	if (fd < 0 && direct && errno == EINVAL) {
+		WPRINTF(("blockif: %s can't do O_DIRECT\n", nopt));
+		direct = 0;
+		fd = open(path, (ro ? O_RDONLY : O_RDWR) |
+			  ((base && !ro) ? O_CREAT : 0), 0600);
+	}
 	if (fd < 0 && !ro) {
 		/* Attempt a r/w fail with a r/o open */
-		fd = open(nopt, O_RDONLY);
+		fd = open(path, O_RDONLY | (direct ? O_DIRECT : 0));
 		ro = 1;
 	}
 
+	if (fd >= 0 && direct) {
+		bfd = open(nopt, ro ? O_RDONLY : O_RDWR);
+		if (bfd < 0) {
+			warn("Could not open backing file: %s", nopt);
+			goto err;
+		}
+	}
+
 	if (fd < 0) {
 		warn("Could not open backing file: %s", nopt);
 		goto err;
@@ -511,6 +1999,33 @@ blockif_open(const char *optstr, const char *ident)
 		goto err;
 	}
 
+	/* the overlay is read and written by clusters, through the cache */
+	if (direct)
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+	if (S_ISREG(sbuf.st_mode) &&
+	    blockif_cow_open(fd, sbuf.st_size, base, ro, &cow) != 0)
+		goto err;
+	if (cow == NULL && base != NULL) {
+		fprintf(stderr, "blockif: %s can't be an overlay\n", nopt);
+		goto err;
+	}
+	if (cow == NULL && direct)
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT);
+	if (cow != NULL) {
+		if (sub_file_assign) {
+			fprintf(stderr, "blockif: no range= in an overlay\n");
+			goto err;
+		}
+		if (direct) {
+			close(bfd);
+			bfd = -1;
+			direct = 0;
+		}
+		uring = 0;
+		if (shared)
+			cow->basemap = blockif_map(cow->basefd, cow->basesize);
+	}
+
 	/*
 	 * Deal with raw devices
 	 */
@@ -555,6 +2070,34 @@ blockif_open(const char *optstr, const char *ident)
 	} else
 		psectsz = sbuf.st_blksize;
 
+	/*
+	 * Discarding nothing, or a hole beyond the end of a file, fails
+	 * only if the backing can't discard at all. An overlay never does,
+	 * its holes are where the base shows through.
+	 */
+	if (!ro && cow == NULL) {
+		if (S_ISBLK(sbuf.st_mode)) {
+			range[0] = 0;
+			range[1] = 0;
+			candelete = (ioctl(fd, BLKDISCARD, range) == 0);
+		} else if (S_ISREG(sbuf.st_mode))
+			candelete = (fallocate(fd, FALLOC_FL_PUNCH_HOLE |
+					FALLOC_FL_KEEP_SIZE, sbuf.st_size,
+					DEV_BSIZE) == 0);
+	}
+
+	if (cow != NULL)
+		size = cow->size;
+	if (path != nopt) {
+		size = null_size;
+		candelete = !ro;
+	}
+
+	/* what O_DIRECT needs, the guest may see another sector size */
+	align = psectsz;
+	if (align < DEV_BSIZE || !powerof2(align))
+		align = DEV_BSIZE;
+
 	if (ssopt != 0) {
 		if (!powerof2(ssopt) || !powerof2(pssopt) || ssopt < 512 ||
 		    ssopt > pssopt) {
@@ -584,6 +2127,18 @@ blockif_open(const char *optstr, const char *ident)
 		psectoff = 0;
 	}
 
+	if (iops != 0 || bps != 0) {
+		thr = calloc(1, sizeof(*thr));
+		if (thr == NULL) {
+			perror("calloc");
+			goto err;
+		}
+		thr->iops = iops;
+		thr->bps = bps;
+		pthread_mutex_init(&thr->mtx, NULL);
+		thr->refs = 1;
+	}
+
 	bc = calloc(1, sizeof(struct blockif_ctxt));
 	if (bc == NULL) {
 		perror("calloc");
@@ -619,47 +2174,146 @@ blockif_open(const char *optstr, const char *ident)
 	bc->psectsz = psectsz;
 	bc->psectoff = psectoff;
 	bc->wce = writeback;
-	pthread_mutex_init(&bc->mtx, NULL);
-	pthread_cond_init(&bc->cond, NULL);
-	TAILQ_INIT(&bc->freeq);
-	TAILQ_INIT(&bc->pendq);
-	TAILQ_INIT(&bc->busyq);
-	for (i = 0; i < BLOCKIF_MAXREQ; i++) {
-		bc->reqs[i].status = BST_FREE;
-		TAILQ_INSERT_HEAD(&bc->freeq, &bc->reqs[i], link);
-	}
+	bc->direct = direct;
+	bc->align = align;
+	bc->bfd = bfd;
+	bc->cow = cow;
+	if (shared && ro && cow == NULL) {
+		bc->map_len = bc->sub_file_start_lba + size;
+		bc->map = blockif_map(fd, bc->map_len);
+	} else if (shared && cow == NULL)
+		WPRINTF(("blockif: %s is writable, not shared\n", nopt));
+
+	bc->throttle = thr;
+	bc->null = (path != nopt);
 
-	for (i = 0; i < BLOCKIF_NUMTHR; i++) {
-		if (snprintf(tname, sizeof(tname), "blk-%s-%d",
-					ident, i) >= sizeof(tname)) {
-			perror("blk thread name too long");
-		}
-		pthread_create(&bc->btid[i], NULL, blockif_thr, bc);
-		pthread_setname_np(bc->btid[i], tname);
-	}
+	/*
+	 * A read from the mapping may fault, which the reaper can't wait on,
+	 * and the limits make the worker threads wait.
+	 */
+	bc->uring_opt = uring && (bc->map == NULL) && (thr == NULL);
+	blockif_start(bc, ident);
 
 	return bc;
 err:
+	if (thr != NULL) {
+		pthread_mutex_destroy(&thr->mtx);
+		free(thr);
+	}
+	if (cow != NULL)
+		blockif_cow_free(cow);
+	if (bfd >= 0)
+		close(bfd);
 	if (fd >= 0)
 		close(fd);
 	return NULL;
 }
 
+/*
+ * Another context on the backing of bc, with its own queues and threads.
+ * The descriptors are duplicated, so the lock of a sub file range is
+ * shared and released when bc is closed.
+ */
+struct blockif_ctxt *
+blockif_clone(struct blockif_ctxt *bc, const char *ident)
+{
+	struct blockif_ctxt *nbc;
+
+	assert(bc->magic == BLOCKIF_SIG);
+
+	nbc = calloc(1, sizeof(struct blockif_ctxt));
+	if (nbc == NULL) {
+		perror("calloc");
+		return NULL;
+	}
+
+	nbc->fd = dup(bc->fd);
+	nbc->bfd = (bc->bfd >= 0) ? dup(bc->bfd) : -1;
+	if (nbc->fd < 0 || (bc->bfd >= 0 && nbc->bfd < 0)) {
+		perror("blockif: dup");
+		if (nbc->fd >= 0)
+			close(nbc->fd);
+		free(nbc);
+		return NULL;
+	}
+
+	nbc->magic = BLOCKIF_SIG;
+	nbc->isblk = bc->isblk;
+	nbc->candelete = bc->candelete;
+	nbc->rdonly = bc->rdonly;
+	nbc->size = bc->size;
+	nbc->sub_file_assign = 0;
+	nbc->sub_file_start_lba = bc->sub_file_start_lba;
+	nbc->sectsz = bc->sectsz;
+	nbc->psectsz = bc->psectsz;
+	nbc->psectoff = bc->psectoff;
+	nbc->wce = bc->wce;
+	nbc->direct = bc->direct;
+	nbc->align = bc->align;
+	nbc->uring_opt = bc->uring_opt;
+	nbc->cow = bc->cow;
+	if (nbc->cow != NULL)
+		nbc->cow->refs++;
+	if (bc->map != NULL) {
+		nbc->map_len = bc->map_len;
+		nbc->map = blockif_map(nbc->fd, nbc->map_len);
+	}
+	nbc->throttle = bc->throttle;
+	if (nbc->throttle != NULL)
+		nbc->throttle->refs++;
+	nbc->null = bc->null;
+	blockif_start(nbc, ident);
+
+	return nbc;
+}
+
 static int
 blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 		enum blockop op)
 {
+	struct blockif_elem *be, nbe;
 	int err;
 
 	err = 0;
 
+	if (bc->null) {
+		/* done already, in the caller, which expects it may be */
+		if (op == BOP_READ || op == BOP_WRITE)
+			atomic_add_fetch(&bc->stats.requests, 1);
+		nbe.req = breq;
+		nbe.op = op;
+		nbe.queued = blockif_now();
+		nbe.started = nbe.queued;
+		breq->resid = 0;
+		blockif_done(bc, &nbe, 0);
+		return 0;
+	}
+
 	pthread_mutex_lock(&bc->mtx);
-	if (!TAILQ_EMPTY(&bc->freeq)) {
+	if (!TAILQ_EMPTY(&bc->freeq) && (op == BOP_READ || op == BOP_WRITE))
+		bc->stats.requests++;
+	if (!TAILQ_EMPTY(&bc->freeq) && bc->uring != NULL) {
+		/*
+		 * Straight to the ring, the kernel orders the requests as
+		 * the device does.
+		 */
+		be = TAILQ_FIRST(&bc->freeq);
+		TAILQ_REMOVE(&bc->freeq, be, link);
+		be->req = breq;
+		be->op = op;
+		be->status = BST_BUSY;
+		be->queued = blockif_now();
+		be->started = be->queued;
+		TAILQ_INSERT_TAIL(&bc->busyq, be, link);
+		blockif_uring_queue(bc, be);
+		if (!bc->plugged)
+			blockif_uring_submit(bc->uring);
+	} else if (!TAILQ_EMPTY(&bc->freeq)) {
 		/*
 		 * Enqueue and inform the block i/o thread
 		 * that there is work available
 		 */
-		if (blockif_enqueue(bc, breq, op))
+		if (blockif_enqueue(bc, breq, op) && !bc->plugged)
 			pthread_cond_signal(&bc->cond);
 	} else {
 		/*
@@ -675,6 +2329,50 @@ blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 	return err;
 }
 
+/*
+ * Requests made between blockif_plug() and blockif_unplug() are submitted
+ * together by the last unplug: to the ring, or to the worker threads, woken
+ * once to take and merge them all.
+ */
+void
+blockif_plug(struct blockif_ctxt *bc)
+{
+	assert(bc->magic == BLOCKIF_SIG);
+	pthread_mutex_lock(&bc->mtx);
+	bc->plugged++;
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+void
+blockif_unplug(struct blockif_ctxt *bc)
+{
+	assert(bc->magic == BLOCKIF_SIG);
+	pthread_mutex_lock(&bc->mtx);
+	assert(bc->plugged > 0);
+	if (--bc->plugged == 0 && bc->uring != NULL)
+		blockif_uring_submit(bc->uring);
+	else if (bc->plugged == 0 && !TAILQ_EMPTY(&bc->pendq))
+		pthread_cond_broadcast(&bc->cond);
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+/*
+ * fn is called by the thread completing the requests of bc, outside of
+ * any lock of bc, once it has run the callbacks of a batch of them: those
+ * of the ring entries reaped together, or of a merged request. The
+ * callbacks may leave it the work they have in common.
+ */
+void
+blockif_set_batch_done(struct blockif_ctxt *bc, void (*fn)(void *arg),
+		       void *arg)
+{
+	assert(bc->magic == BLOCKIF_SIG);
+	pthread_mutex_lock(&bc->mtx);
+	bc->batch_done = fn;
+	bc->batch_arg = arg;
+	pthread_mutex_unlock(&bc->mtx);
+}
+
 int
 blockif_read(struct blockif_ctxt *bc, struct blockif_req *breq)
 {
@@ -703,6 +2401,13 @@ blockif_delete(struct blockif_ctxt *bc, struct blockif_req *breq)
 	return blockif_request(bc, breq, BOP_DELETE);
 }
 
+int
+blockif_write_zeroes(struct blockif_ctxt *bc, struct blockif_req *breq)
+{
+	assert(bc->magic == BLOCKIF_SIG);
+	return blockif_request(bc, breq, BOP_ZERO);
+}
+
 int
 blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 {
@@ -743,6 +2448,12 @@ blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 		return -1;
 	}
 
+	/* the ring completes it through the callback as usual */
+	if (bc->uring != NULL) {
+		pthread_mutex_unlock(&bc->mtx);
+		return -EBUSY;
+	}
+
 	/*
 	 * Interrupt the processing thread to force it return
 	 * prematurely via it's normal callback path.
@@ -789,15 +2500,23 @@ blockif_close(struct blockif_ctxt *bc)
 	assert(bc->magic == BLOCKIF_SIG);
 	sub_file_unlock(bc);
 
+	pthread_mutex_lock(&blockif_list_mtx);
+	TAILQ_REMOVE(&blockif_list, bc, list);
+	pthread_mutex_unlock(&blockif_list_mtx);
+
 	/*
 	 * Stop the block i/o thread
 	 */
 	pthread_mutex_lock(&bc->mtx);
 	bc->closing = 1;
 	pthread_mutex_unlock(&bc->mtx);
-	pthread_cond_broadcast(&bc->cond);
-	for (i = 0; i < BLOCKIF_NUMTHR; i++)
-		pthread_join(bc->btid[i], &jval);
+	if (bc->uring != NULL) {
+		blockif_uring_close(bc);
+	} else {
+		pthread_cond_broadcast(&bc->cond);
+		for (i = 0; i < BLOCKIF_NUMTHR; i++)
+			pthread_join(bc->btid[i], &jval);
+	}
 
 	/* XXX Cancel queued i/o's ??? */
 
@@ -805,6 +2524,19 @@ blockif_close(struct blockif_ctxt *bc)
 	 * Release resources
 	 */
 	bc->magic = 0;
+	if (bc->cow != NULL && --bc->cow->refs == 0) {
+		if (blockif_cow_flush(bc) != 0)
+			fprintf(stderr, "blockif: failed to write the overlay map\n");
+		blockif_cow_free(bc->cow);
+	}
+	if (bc->throttle != NULL && --bc->throttle->refs == 0) {
+		pthread_mutex_destroy(&bc->throttle->mtx);
+		free(bc->throttle);
+	}
+	if (bc->map != NULL)
+		munmap(bc->map, bc->map_len);
+	if (bc->bfd >= 0)
+		close(bc->bfd);
 	close(bc->fd);
 	free(bc);
 
@@ -906,6 +2638,36 @@ blockif_candelete(struct blockif_ctxt *bc)
 	return bc->candelete;
 }
 
+void
+blockif_get_stats(struct blockif_ctxt *bc, struct blockif_stats *stats)
+{
+	assert(bc->magic == BLOCKIF_SIG);
+	pthread_mutex_lock(&bc->mtx);
+	*stats = bc->stats;
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+/* the ident and stats of the index-th open context, -1 past the last */
+int
+blockif_get_stats_by_index(int index, char *ident, size_t len,
+			   struct blockif_stats *stats)
+{
+	struct blockif_ctxt *bc;
+
+	pthread_mutex_lock(&blockif_list_mtx);
+	TAILQ_FOREACH(bc, &blockif_list, list) {
+		if (index-- == 0)
+			break;
+	}
+	if (bc != NULL) {
+		snprintf(ident, len, "%s", bc->ident);
+		blockif_get_stats(bc, stats);
+	}
+	pthread_mutex_unlock(&blockif_list_mtx);
+
+	return (bc != NULL) ? 0 : -1;
+}
+
 uint8_t
 blockif_get_wce(struct blockif_ctxt *bc)
 {
@@ -927,7 +2689,23 @@ blockif_flush_all(struct blockif_ctxt *bc)
 
 	err=0;
 	assert(bc->magic == BLOCKIF_SIG);
-	if (fsync(bc->fd))
-		err = errno;
+	err = blockif_sync(bc);
+	return err;
+}
+
+/* Flush every open disk, e.g. before another host opens the images */
+int
+blockif_sync_all(void)
+{
+	struct blockif_ctxt *bc;
+	int err = 0;
+
+	pthread_mutex_lock(&blockif_list_mtx);
+	TAILQ_FOREACH(bc, &blockif_list, list) {
+		if (err == 0)
+			err = blockif_sync(bc);
+	}
+	pthread_mutex_unlock(&blockif_list_mtx);
+
 	return err;
 }
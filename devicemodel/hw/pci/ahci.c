@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <pthread.h>
 #include <inttypes.h>
 #include <openssl/md5.h>
@@ -134,6 +135,14 @@ struct ahci_port {
 	u_int ccs;
 	uint32_t pending;
 
+	/*
+	 * The NCQ commands issued together are completed together, by one
+	 * SDB FIS: batch[slot] are the slots issued with slot, sdb_done the
+	 * completed ones waiting for the last of their batch.
+	 */
+	uint32_t batch[32];
+	uint32_t sdb_done;
+
 	uint32_t clb;
 	uint32_t clbu;
 	uint32_t fb;
@@ -357,6 +366,7 @@ ahci_write_fis_sdb(struct ahci_port *p, int slot, uint8_t *cfis, uint32_t tfd)
 {
 	uint8_t fis[8];
 	uint8_t error;
+	uint32_t done;
 
 	error = (tfd >> 8) & 0xff;
 	tfd &= 0x77;
@@ -365,15 +375,19 @@ ahci_write_fis_sdb(struct ahci_port *p, int slot, uint8_t *cfis, uint32_t tfd)
 	fis[1] = (1 << 6);
 	fis[2] = tfd;
 	fis[3] = error;
+
+	/* the commands which were waiting for slot are done, even if it fails */
+	done = p->sdb_done;
 	if (fis[2] & ATA_S_ERROR) {
 		p->err_cfis[0] = slot;
 		p->err_cfis[2] = tfd;
 		p->err_cfis[3] = error;
 		memcpy(&p->err_cfis[4], cfis + 4, 16);
-	} else {
-		*(uint32_t *)(fis + 4) = (1 << slot);
-		p->sact &= ~(1 << slot);
-	}
+	} else
+		done |= (1 << slot);
+	*(uint32_t *)(fis + 4) = done;
+	p->sact &= ~done;
+	p->sdb_done = 0;
 	p->tfd &= ~0x77;
 	p->tfd |= tfd;
 	ahci_write_fis(p, FIS_TYPE_SETDEVBITS, fis);
@@ -458,6 +472,7 @@ ahci_check_stopped(struct ahci_port *p)
 			p->cmd &= ~(AHCI_P_CMD_CR | AHCI_P_CMD_CCS_MASK);
 			p->ci = 0;
 			p->sact = 0;
+			p->sdb_done = 0;
 			p->waitforclear = 0;
 		}
 	}
@@ -514,6 +529,7 @@ ahci_port_reset(struct ahci_port *pr)
 {
 	pr->serr = 0;
 	pr->sact = 0;
+	pr->sdb_done = 0;
 	pr->xfermode = ATA_UDMA6;
 	pr->mult_sectors = 128;
 
@@ -597,13 +613,13 @@ ahci_build_iov(struct ahci_port *p, struct ahci_ioreq *aior,
 	struct blockif_req *breq = &aior->io_req;
 	int i, j, skip, todo, left, extra;
 	uint32_t dbcsz;
+	bool full = false;
 
 	/* Copy part of PRDT between 'done' and 'len' bytes into the iov. */
 	skip = aior->done;
 	left = aior->len - aior->done;
 	todo = 0;
-	for (i = 0, j = 0; i < prdtl && j < BLOCKIF_IOV_MAX && left > 0;
-	    i++, prdt++) {
+	for (i = 0, j = 0; i < prdtl && !full && left > 0; i++, prdt++) {
 		dbcsz = (prdt->dbc & DBCMASK) + 1;
 		/* Skip already done part of the PRDT */
 		if (dbcsz <= skip) {
@@ -613,17 +629,33 @@ ahci_build_iov(struct ahci_port *p, struct ahci_ioreq *aior,
 		dbcsz -= skip;
 		if (dbcsz > left)
 			dbcsz = left;
-		breq->iov[j].iov_base = paddr_guest2host(ahci_ctx(p->ahci_dev),
-		    prdt->dba + skip, dbcsz);
-		breq->iov[j].iov_len = dbcsz;
+		/* Entries contiguous in the host share an iov. */
+		switch (vm_map_gpa_iov(ahci_ctx(p->ahci_dev), prdt->dba + skip,
+		    dbcsz, breq->iov, &j, BLOCKIF_IOV_MAX)) {
+		case 0:
+			break;
+		case -EFAULT:
+			/* Not guest RAM, blockif fails the request with it. */
+			if (j < BLOCKIF_IOV_MAX) {
+				breq->iov[j].iov_base = NULL;
+				breq->iov[j].iov_len = dbcsz;
+				j++;
+				break;
+			}
+			/* fall through */
+		default:
+			full = true;
+			continue;
+		}
 		todo += dbcsz;
 		left -= dbcsz;
 		skip = 0;
-		j++;
+		if (j == BLOCKIF_IOV_MAX)
+			full = true;
 	}
 
 	/* If we got limited by IOV length, round I/O down to sector size. */
-	if (j == BLOCKIF_IOV_MAX) {
+	if (full) {
 		extra = todo % blockif_sectsz(p->bctx);
 		todo -= extra;
 		assert(todo > 0);
@@ -1839,9 +1871,17 @@ ahci_handle_slot(struct ahci_port *p, int slot)
 static void
 ahci_handle_port(struct ahci_port *p)
 {
+	uint32_t issued;
+	int i;
+
 	if (!(p->cmd & AHCI_P_CMD_ST))
 		return;
 
+	/* the commands issued together are submitted to block_if together */
+	issued = p->pending;
+	if (p->bctx)
+		blockif_plug(p->bctx);
+
 	/*
 	 * Search for any new commands to issue ignoring those that
 	 * are already in-flight.  Stop if device is busy or in error.
@@ -1857,6 +1897,20 @@ ahci_handle_port(struct ahci_port *p)
 			ahci_handle_slot(p, p->ccs);
 		}
 	}
+
+	if (p->bctx)
+		blockif_unplug(p->bctx);
+
+	/* the NCQ ones make a batch, see ata_ioreq_cb() */
+	issued = p->pending & ~issued & p->sact;
+	if (issued == 0)
+		return;
+	for (i = 0; i < 32; i++) {
+		if (issued & (1U << i))
+			p->batch[i] = issued;
+		else
+			p->batch[i] &= ~issued;
+	}
 }
 
 /*
@@ -1916,20 +1970,23 @@ ata_ioreq_cb(struct blockif_req *br, int err)
 		goto out;
 	}
 
+	/*
+	 * This command is now complete. A successful NCQ one is reported
+	 * with the last of its batch, one SDB FIS and interrupt for all.
+	 */
+	p->pending &= ~(1 << slot);
+
 	if (!err)
 		tfd = ATA_S_READY | ATA_S_DSC;
 	else
 		tfd = (ATA_E_ABORT << 8) | ATA_S_READY | ATA_S_ERROR;
-	if (ncq)
+	if (ncq && !err && (p->batch[slot] & p->pending) != 0)
+		p->sdb_done |= (1 << slot);
+	else if (ncq)
 		ahci_write_fis_sdb(p, slot, cfis, tfd);
 	else
 		ahci_write_fis_d2h(p, slot, cfis, tfd);
 
-	/*
-	 * This command is now complete.
-	 */
-	p->pending &= ~(1 << slot);
-
 	ahci_check_stopped(p);
 	ahci_handle_port(p);
 out:
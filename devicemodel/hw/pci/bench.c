@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Benchmark device: trivial registers behind a PIO BAR and an MMIO BAR,
+ * so a guest can time the round trip of an access forwarded to the DM
+ * (tools/acrn-bench does). Nothing in here should cost more than the
+ * ioreq it answers.
+ *
+ * Both BARs have the same layout:
+ *   0x00 SCRATCH  read/write, no side effect
+ *   0x04 COUNT    read: accesses handled so far, low 32 bits
+ *   0x08 MSI      write: send the MSI, if the guest enabled it
+ *   0x10 TSC_LO   read: low half of the TSC when the DM got the access,
+ *                 latching the high half for TSC_HI
+ *   0x14 TSC_HI
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vmmapi.h"
+#include "pci_core.h"
+
+#define PCI_VENDOR_ID_INTEL		0x8086
+#define PCI_DEVICE_ID_ACRN_BENCH	0x86FF
+
+#define BENCH_IO_BAR			0
+#define BENCH_MEM_BAR			1
+#define BENCH_IO_BAR_SIZE		0x20
+#define BENCH_MEM_BAR_SIZE		0x1000
+
+#define BENCH_REG_SCRATCH		0x00
+#define BENCH_REG_COUNT			0x04
+#define BENCH_REG_MSI			0x08
+#define BENCH_REG_TSC_LO		0x10
+#define BENCH_REG_TSC_HI		0x14
+
+struct pci_bench {
+	uint64_t scratch;
+	uint64_t count;
+	uint32_t tsc_hi;
+};
+
+static inline uint64_t
+bench_rdtsc(void)
+{
+	uint32_t lo, hi;
+
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static void
+pci_bench_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
+		int baridx, uint64_t offset, int size, uint64_t value)
+{
+	struct pci_bench *bench = dev->arg;
+
+	bench->count++;
+
+	switch (offset) {
+	case BENCH_REG_SCRATCH:
+		bench->scratch = value;
+		break;
+	case BENCH_REG_MSI:
+		if (pci_msi_enabled(dev))
+			pci_generate_msi(dev, 0);
+		break;
+	default:
+		break;
+	}
+}
+
+static uint64_t
+pci_bench_read(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
+		int baridx, uint64_t offset, int size)
+{
+	struct pci_bench *bench = dev->arg;
+	uint64_t tsc, value = 0;
+
+	bench->count++;
+
+	switch (offset) {
+	case BENCH_REG_SCRATCH:
+		value = bench->scratch;
+		break;
+	case BENCH_REG_COUNT:
+		value = (uint32_t)bench->count;
+		break;
+	case BENCH_REG_TSC_LO:
+		tsc = bench_rdtsc();
+		bench->tsc_hi = tsc >> 32;
+		/* an 8-byte MMIO read gets the whole TSC */
+		value = (size == 8) ? tsc : (uint32_t)tsc;
+		break;
+	case BENCH_REG_TSC_HI:
+		value = bench->tsc_hi;
+		break;
+	default:
+		break;
+	}
+
+	return value;
+}
+
+static int
+pci_bench_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct pci_bench *bench;
+
+	bench = calloc(1, sizeof(struct pci_bench));
+	if (bench == NULL) {
+		perror("bench: alloc");
+		return -1;
+	}
+
+	pci_set_cfgdata16(dev, PCIR_VENDOR, PCI_VENDOR_ID_INTEL);
+	pci_set_cfgdata16(dev, PCIR_DEVICE, PCI_DEVICE_ID_ACRN_BENCH);
+	pci_set_cfgdata8(dev, PCIR_CLASS, PCIC_BASEPERIPH);
+	pci_set_cfgdata8(dev, PCIR_SUBCLASS, PCIS_BASEPERIPH_OTHER);
+
+	if (pci_emul_alloc_bar(dev, BENCH_IO_BAR, PCIBAR_IO,
+			BENCH_IO_BAR_SIZE) != 0 ||
+	    pci_emul_alloc_bar(dev, BENCH_MEM_BAR, PCIBAR_MEM32,
+			BENCH_MEM_BAR_SIZE) != 0 ||
+	    pci_emul_add_msicap(dev, 1) != 0) {
+		free(bench);
+		return -1;
+	}
+
+	dev->arg = bench;
+	return 0;
+}
+
+static void
+pci_bench_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	free(dev->arg);
+	dev->arg = NULL;
+}
+
+struct pci_vdev_ops pci_ops_bench = {
+	.class_name	= "bench",
+	.vdev_init	= pci_bench_init,
+	.vdev_deinit	= pci_bench_deinit,
+	.vdev_barwrite	= pci_bench_write,
+	.vdev_barread	= pci_bench_read
+};
+
+DEFINE_PCI_DEVTYPE(pci_ops_bench);
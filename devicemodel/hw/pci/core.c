@@ -44,6 +44,8 @@
 #include "irq.h"
 #include "lpc.h"
 #include "sw_load.h"
+#include "snapshot.h"
+#include "virtio.h"
 
 #define CONF1_ADDR_PORT    0x0cf8
 #define CONF1_DATA_PORT    0x0cfc
@@ -372,7 +374,7 @@ pci_emul_io_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 {
 	struct pci_vdev *pdi = arg;
 	struct pci_vdev_ops *ops = pdi->dev_ops;
-	uint64_t offset;
+	uint64_t offset, start;
 	int i;
 
 	for (i = 0; i <= PCI_BARMAX; i++) {
@@ -380,6 +382,7 @@ pci_emul_io_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 		    port >= pdi->bar[i].addr &&
 		    port + bytes <= pdi->bar[i].addr + pdi->bar[i].size) {
 			offset = port - pdi->bar[i].addr;
+			start = cpu_acct_now();
 			if (in) {
 				*eax = (*ops->vdev_barread)(ctx, vcpu, pdi, i,
 				                            offset, bytes);
@@ -387,6 +390,7 @@ pci_emul_io_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 			} else
 				(*ops->vdev_barwrite)(ctx, vcpu, pdi, i, offset,
 				                      bytes, bar_value(bytes, *eax));
+			cpu_acct_trap_end(&pdi->cpu_acct, start);
 			return 0;
 		}
 	}
@@ -399,7 +403,7 @@ pci_emul_mem_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 {
 	struct pci_vdev *pdi = arg1;
 	struct pci_vdev_ops *ops = pdi->dev_ops;
-	uint64_t offset;
+	uint64_t offset, start;
 	int bidx = (int) arg2;
 
 	assert(bidx <= PCI_BARMAX);
@@ -409,6 +413,7 @@ pci_emul_mem_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 	       addr + size <= pdi->bar[bidx].addr + pdi->bar[bidx].size);
 
 	offset = addr - pdi->bar[bidx].addr;
+	start = cpu_acct_now();
 
 	if (dir == MEM_F_WRITE) {
 		if (size == 8) {
@@ -438,6 +443,7 @@ pci_emul_mem_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 			*val = bar_value(size, *val);
 		}
 	}
+	cpu_acct_trap_end(&pdi->cpu_acct, start);
 
 	return 0;
 }
@@ -507,6 +513,16 @@ modify_bar_registration(struct pci_vdev *dev, int idx, int registration)
 			error = register_mem(&mr);
 		} else
 			error = unregister_mem(&mr);
+
+		/* Failing to post is not fatal, the writes just stay
+		 * synchronous.
+		 */
+		if (dev->bar[idx].posted_size != 0)
+			(void)vm_set_posted_mmio_range(dev->vmctx,
+				mr.base + dev->bar[idx].posted_off,
+				mr.base + dev->bar[idx].posted_off +
+				dev->bar[idx].posted_size,
+				registration != 0);
 		break;
 	default:
 		error = EINVAL;
@@ -744,6 +760,28 @@ pci_emul_alloc_pbar(struct pci_vdev *pdi, int idx, uint64_t hostbase,
 	return 0;
 }
 
+/*
+ * Let the guest writes to [off, off + size) of memory bar idx complete
+ * without waiting for the device model. Only suitable for registers like
+ * doorbells, which have no side effect the guest would read back before
+ * the next synchronous access to the device. Must be called after the bar
+ * is allocated.
+ */
+void
+pci_emul_set_posted_window(struct pci_vdev *pdi, int idx, uint64_t off,
+			   uint64_t size)
+{
+	assert(idx >= 0 && idx <= PCI_BARMAX);
+	assert(pdi->bar[idx].type == PCIBAR_MEM32 ||
+	       pdi->bar[idx].type == PCIBAR_MEM64);
+	assert(off + size <= pdi->bar[idx].size);
+
+	unregister_bar(pdi, idx);
+	pdi->bar[idx].posted_off = off;
+	pdi->bar[idx].posted_size = size;
+	register_bar(pdi, idx);
+}
+
 void
 pci_emul_free_bars(struct pci_vdev *pdi)
 {
@@ -754,6 +792,7 @@ pci_emul_free_bars(struct pci_vdev *pdi)
 			(pdi->bar[i].type != PCIBAR_MEMHI64)){
 			unregister_bar(pdi, i);
 			pdi->bar[i].type = PCIBAR_NONE;
+			pdi->bar[i].posted_size = 0;
 		}
 	}
 }
@@ -856,6 +895,7 @@ pci_emul_init(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 	      int func, struct funcinfo *fi)
 {
 	struct pci_vdev *pdi;
+	char name[sizeof(pdi->cpu_acct.name)];
 	int err;
 
 	pdi = calloc(1, sizeof(struct pci_vdev));
@@ -875,6 +915,8 @@ pci_emul_init(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 	pdi->lintr.ioapic_irq = 0;
 	pdi->dev_ops = ops;
 	snprintf(pdi->name, PI_NAMESZ, "%s-pci-%d", ops->class_name, slot);
+	snprintf(name, sizeof(name), "%d:%d %s", slot, func, ops->class_name);
+	cpu_acct_register(&pdi->cpu_acct, name);
 
 	/* Disable legacy interrupts */
 	pci_set_cfgdata8(pdi, PCIR_INTLINE, 255);
@@ -887,27 +929,103 @@ pci_emul_init(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 		fi->fi_param = strdup(fi->fi_param_saved);
 	else
 		fi->fi_param = NULL;
+	/* the mevents and workers set up by the device are charged to it */
+	cpu_acct_set_current(&pdi->cpu_acct);
 	err = (*ops->vdev_init)(ctx, pdi, fi->fi_param);
+	cpu_acct_set_current(NULL);
 	if (err == 0)
 		fi->fi_devi = pdi;
-	else
+	else {
+		/* a virtio device failing after its linkup */
+		virtio_unlink(pdi);
+		cpu_acct_unregister(&pdi->cpu_acct);
 		free(pdi);
+	}
 
 	return err;
 }
 
+static void
+pci_emul_save_init_state(struct pci_vdev *dev)
+{
+	int i;
+
+	memcpy(dev->cfgdata_init, dev->cfgdata, sizeof(dev->cfgdata));
+	for (i = 0; i <= PCI_BARMAX; i++)
+		dev->bar_addr_init[i] = dev->bar[i].addr;
+}
+
+/* move the BARs and set the config space they are decoded with */
+static void
+pci_emul_set_cfg(struct pci_vdev *dev, const uint8_t *cfgdata,
+		 const uint64_t *bar_addr)
+{
+	int i;
+
+	for (i = 0; i <= PCI_BARMAX; i++) {
+		switch (dev->bar[i].type) {
+		case PCIBAR_IO:
+		case PCIBAR_MEM32:
+		case PCIBAR_MEM64:
+			unregister_bar(dev, i);
+			dev->bar[i].addr = bar_addr[i];
+			register_bar(dev, i);
+			break;
+		default:
+			break;
+		}
+	}
+
+	memcpy(dev->cfgdata, cfgdata, sizeof(dev->cfgdata));
+}
+
+static void
+pci_emul_reset(struct vmctx *ctx, struct pci_vdev *dev)
+{
+	int i;
+
+	if (dev->lintr.pin > 0)
+		pci_lintr_deassert(dev);
+
+	/* the BARs may have been moved or disabled by the guest */
+	pci_emul_set_cfg(dev, dev->cfgdata_init, dev->bar_addr_init);
+
+	dev->msi.enabled = 0;
+	dev->msi.addr = 0;
+	dev->msi.msg_data = 0;
+
+	dev->msix.enabled = 0;
+	dev->msix.function_mask = 0;
+	if (dev->msix.table != NULL) {
+		for (i = 0; i < dev->msix.table_count; i++) {
+			dev->msix.table[i].addr = 0;
+			dev->msix.table[i].msg_data = 0;
+			dev->msix.table[i].vector_control =
+				PCIM_MSIX_VCTRL_MASK;
+		}
+	}
+
+	(*dev->dev_ops->vdev_reset)(ctx, dev);
+}
+
 static void
 pci_emul_deinit(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 		int func, struct funcinfo *fi)
 {
-	if (ops->vdev_deinit && fi->fi_devi)
+	if (fi->fi_devi)
+		virtio_unlink(fi->fi_devi);
+	if (ops->vdev_deinit && fi->fi_devi) {
+		cpu_acct_set_current(&fi->fi_devi->cpu_acct);
 		(*ops->vdev_deinit)(ctx, fi->fi_devi, fi->fi_param);
+		cpu_acct_set_current(NULL);
+	}
 	if (fi->fi_param)
 		free(fi->fi_param);
 
 	if (fi->fi_devi) {
 		pci_lintr_release(fi->fi_devi);
 		pci_emul_free_bars(fi->fi_devi);
+		cpu_acct_unregister(&fi->fi_devi->cpu_acct);
 		free(fi->fi_devi);
 	}
 }
@@ -1219,6 +1337,79 @@ pci_ecfg_base(void)
 #define	BUSIO_ROUNDUP		32
 #define	BUSMEM_ROUNDUP		(1024 * 1024)
 
+/* Instances whose vdev_prepare gets a thread, the others run inline */
+#define PCI_PREPARE_THREADS	16
+
+struct pci_prepare_arg {
+	pthread_t		tid;
+	bool			started;
+	struct vmctx		*ctx;
+	struct pci_vdev_ops	*ops;
+	const char		*opts;
+};
+
+static void *
+pci_emul_prepare_thread(void *arg)
+{
+	struct pci_prepare_arg *pa = arg;
+
+	pa->ops->vdev_prepare(pa->ctx, pa->opts);
+	return NULL;
+}
+
+/*
+ * Run the vdev_prepare of all the instances concurrently, so that their
+ * slow, independent setup (like the resets of the passthrough devices)
+ * doesn't add up in the sequential vdev_init loop.
+ */
+static void
+pci_emul_prepare(struct vmctx *ctx)
+{
+	struct pci_prepare_arg args[PCI_PREPARE_THREADS];
+	struct pci_prepare_arg *pa;
+	struct pci_vdev_ops *ops;
+	struct businfo *bi;
+	struct funcinfo *fi;
+	int bus, slot, func, i, n = 0;
+
+	for (bus = 0; bus < MAXBUSES; bus++) {
+		bi = pci_businfo[bus];
+		if (bi == NULL)
+			continue;
+
+		for (slot = 0; slot < MAXSLOTS; slot++) {
+			for (func = 0; func < MAXFUNCS; func++) {
+				fi = &bi->slotinfo[slot].si_funcs[func];
+				if (fi->fi_name == NULL)
+					continue;
+				ops = pci_emul_finddev(fi->fi_name);
+				if (ops == NULL || ops->vdev_prepare == NULL)
+					continue;
+
+				if (n == PCI_PREPARE_THREADS) {
+					ops->vdev_prepare(ctx,
+						fi->fi_param_saved);
+					continue;
+				}
+
+				pa = &args[n++];
+				pa->ctx = ctx;
+				pa->ops = ops;
+				pa->opts = fi->fi_param_saved;
+				pa->started = (pthread_create(&pa->tid, NULL,
+					pci_emul_prepare_thread, pa) == 0);
+				if (!pa->started)
+					ops->vdev_prepare(ctx, pa->opts);
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (args[i].started)
+			pthread_join(args[i].tid, NULL);
+	}
+}
+
 int
 init_pci(struct vmctx *ctx)
 {
@@ -1238,6 +1429,8 @@ init_pci(struct vmctx *ctx)
 
 	create_gsi_sharing_groups();
 
+	pci_emul_prepare(ctx);
+
 	for (bus = 0; bus < MAXBUSES; bus++) {
 		bi = pci_businfo[bus];
 		if (bi == NULL)
@@ -1316,6 +1509,21 @@ init_pci(struct vmctx *ctx)
 	}
 	lpc_pirq_routed();
 
+	for (bus = 0; bus < MAXBUSES; bus++) {
+		bi = pci_businfo[bus];
+		if (bi == NULL)
+			continue;
+
+		for (slot = 0; slot < MAXSLOTS; slot++) {
+			si = &bi->slotinfo[slot];
+			for (func = 0; func < MAXFUNCS; func++) {
+				fi = &si->si_funcs[func];
+				if (fi->fi_devi != NULL)
+					pci_emul_save_init_state(fi->fi_devi);
+			}
+		}
+	}
+
 	/*
 	 * The guest physical memory map looks like the following:
 	 * [0,		    lowmem)		guest system memory
@@ -1422,6 +1630,257 @@ deinit_pci(struct vmctx *ctx)
 	}
 }
 
+/*
+ * Put the devices back in the state init_pci() left them in, keeping
+ * their backends, if they all can. Returns -1 without touching any of
+ * them otherwise, deinit_pci() and init_pci() are needed then.
+ */
+int
+reset_pci(struct vmctx *ctx)
+{
+	struct businfo *bi;
+	struct slotinfo *si;
+	struct funcinfo *fi;
+	struct pci_vdev *dev;
+	int bus, slot, func, pass;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (bus = 0; bus < MAXBUSES; bus++) {
+			bi = pci_businfo[bus];
+			if (bi == NULL)
+				continue;
+
+			for (slot = 0; slot < MAXSLOTS; slot++) {
+				si = &bi->slotinfo[slot];
+				for (func = 0; func < MAXFUNCS; func++) {
+					fi = &si->si_funcs[func];
+					dev = fi->fi_devi;
+					if (dev == NULL)
+						continue;
+					if (pass == 1) {
+						pci_emul_reset(ctx, dev);
+						continue;
+					}
+					if (dev->dev_ops->vdev_reset == NULL) {
+						printf("%s has no warm reset\n",
+							dev->name);
+						return -1;
+					}
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * A device in a snapshot, followed by the entries of its MSI-X table and
+ * the len bytes of its vdev_save state.
+ */
+struct pci_vdev_state {
+	uint8_t		bus, slot, func, rsvd;
+	uint32_t	msix_count;
+	uint32_t	len;
+	uint32_t	msi_enabled;
+	uint64_t	msi_addr;
+	uint64_t	msi_msg_data;
+	uint32_t	msix_enabled;
+	uint32_t	msix_function_mask;
+	uint64_t	bar_addr[PCI_BARMAX + 1];
+	uint8_t		cfgdata[PCI_REGMAX + 1];
+};
+
+#define	PCI_VDEV_STATE_MAX	4096
+
+static struct pci_vdev *
+pci_get_vdev(int bus, int slot, int func)
+{
+	struct businfo *bi;
+
+	if (bus >= MAXBUSES || slot >= MAXSLOTS || func >= MAXFUNCS)
+		return NULL;
+
+	bi = pci_businfo[bus];
+	if (bi == NULL)
+		return NULL;
+
+	return bi->slotinfo[slot].si_funcs[func].fi_devi;
+}
+
+/* Whether a device of type @class_name, e.g. "passthru", is set up */
+bool
+pci_has_devtype(const char *class_name)
+{
+	struct pci_vdev *dev;
+	int bus, slot, func;
+
+	for (bus = 0; bus < MAXBUSES; bus++) {
+		if (pci_businfo[bus] == NULL)
+			continue;
+		for (slot = 0; slot < MAXSLOTS; slot++) {
+			for (func = 0; func < MAXFUNCS; func++) {
+				dev = pci_get_vdev(bus, slot, func);
+				if (dev != NULL && strcmp(dev->dev_ops->class_name,
+						class_name) == 0)
+					return true;
+			}
+		}
+	}
+	return false;
+}
+
+static int
+pci_emul_save(struct vmctx *ctx, struct pci_vdev *dev, int fd, void *buf)
+{
+	struct pci_vdev_state st;
+	int i, len = 0;
+
+	if (dev->dev_ops->vdev_save != NULL) {
+		len = (*dev->dev_ops->vdev_save)(ctx, dev, buf,
+				PCI_VDEV_STATE_MAX);
+		if (len < 0)
+			return -1;
+	}
+
+	memset(&st, 0, sizeof(st));
+	st.bus = dev->bus;
+	st.slot = dev->slot;
+	st.func = dev->func;
+	st.msix_count = (dev->msix.table != NULL) ? dev->msix.table_count : 0;
+	st.len = len;
+	st.msi_enabled = dev->msi.enabled;
+	st.msi_addr = dev->msi.addr;
+	st.msi_msg_data = dev->msi.msg_data;
+	st.msix_enabled = dev->msix.enabled;
+	st.msix_function_mask = dev->msix.function_mask;
+	for (i = 0; i <= PCI_BARMAX; i++)
+		st.bar_addr[i] = dev->bar[i].addr;
+	memcpy(st.cfgdata, dev->cfgdata, sizeof(st.cfgdata));
+
+	if (snapshot_write(fd, &st, sizeof(st)) != 0)
+		return -1;
+	if (st.msix_count != 0 && snapshot_write(fd, dev->msix.table,
+			st.msix_count * sizeof(struct msix_table_entry)) != 0)
+		return -1;
+	if (len != 0 && snapshot_write(fd, buf, len) != 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Write the state of every PCI device for a snapshot of a paused VM,
+ * return the number of devices written or -1.
+ */
+int
+save_pci(struct vmctx *ctx, int fd)
+{
+	struct pci_vdev *dev;
+	int bus, slot, func, nr = 0;
+	char *buf;
+
+	buf = malloc(PCI_VDEV_STATE_MAX);
+	if (buf == NULL)
+		return -1;
+
+	for (bus = 0; bus < MAXBUSES; bus++) {
+		for (slot = 0; slot < MAXSLOTS; slot++) {
+			for (func = 0; func < MAXFUNCS; func++) {
+				dev = pci_get_vdev(bus, slot, func);
+				if (dev == NULL)
+					continue;
+				if (dev->dev_ops->vdev_save == NULL &&
+				    dev->dev_ops->vdev_reset == NULL) {
+					fprintf(stderr, "%s can't be saved\n",
+						dev->name);
+					goto fail;
+				}
+				if (pci_emul_save(ctx, dev, fd, buf) != 0)
+					goto fail;
+				nr++;
+			}
+		}
+	}
+
+	free(buf);
+	return nr;
+
+fail:
+	free(buf);
+	return -1;
+}
+
+static int
+pci_emul_load(struct vmctx *ctx, int fd, void *buf)
+{
+	struct pci_vdev_state st;
+	struct pci_vdev *dev;
+	size_t size;
+
+	if (snapshot_read(fd, &st, sizeof(st)) != 0)
+		return -1;
+
+	dev = pci_get_vdev(st.bus, st.slot, st.func);
+	if (dev == NULL || memcmp(dev->cfgdata, st.cfgdata, PCIR_COMMAND) != 0) {
+		fprintf(stderr, "snapshot device %x:%x.%x is not in the VM\n",
+			st.bus, st.slot, st.func);
+		return -1;
+	}
+
+	if (st.len > PCI_VDEV_STATE_MAX ||
+	    (st.len != 0 && dev->dev_ops->vdev_load == NULL) ||
+	    st.msix_count != ((dev->msix.table != NULL) ?
+			dev->msix.table_count : 0)) {
+		fprintf(stderr, "snapshot state of %s doesn't match\n",
+			dev->name);
+		return -1;
+	}
+
+	pci_emul_set_cfg(dev, st.cfgdata, st.bar_addr);
+
+	dev->msi.enabled = st.msi_enabled;
+	dev->msi.addr = st.msi_addr;
+	dev->msi.msg_data = st.msi_msg_data;
+	dev->msix.enabled = st.msix_enabled;
+	dev->msix.function_mask = st.msix_function_mask;
+	if (st.msix_count != 0) {
+		size = st.msix_count * sizeof(struct msix_table_entry);
+		if (snapshot_read(fd, dev->msix.table, size) != 0)
+			return -1;
+	}
+
+	if (st.len != 0) {
+		if (snapshot_read(fd, buf, st.len) != 0)
+			return -1;
+		if ((*dev->dev_ops->vdev_load)(ctx, dev, buf, st.len) != 0) {
+			fprintf(stderr, "failed to load the state of %s\n",
+				dev->name);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Load nr device states written by save_pci into the devices of a new VM */
+int
+load_pci(struct vmctx *ctx, int fd, int nr)
+{
+	char *buf;
+	int i, ret = 0;
+
+	buf = malloc(PCI_VDEV_STATE_MAX);
+	if (buf == NULL)
+		return -1;
+
+	for (i = 0; i < nr && ret == 0; i++)
+		ret = pci_emul_load(ctx, fd, buf);
+
+	free(buf);
+	return ret;
+}
+
 static void
 pci_apic_prt_entry(int bus, int slot, int pin, int pirq_pin, int ioapic_irq,
 		   void *arg)
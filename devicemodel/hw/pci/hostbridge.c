@@ -53,14 +53,22 @@ pci_amd_hostbridge_init(struct vmctx *ctx, struct pci_vdev *pi, char *opts)
 	return 0;
 }
 
+/* all of the state is in the config space */
+static void
+pci_hostbridge_reset(struct vmctx *ctx, struct pci_vdev *pi)
+{
+}
+
 struct pci_vdev_ops pci_ops_amd_hostbridge = {
 	.class_name	= "amd_hostbridge",
 	.vdev_init	= pci_amd_hostbridge_init,
+	.vdev_reset	= pci_hostbridge_reset,
 };
 DEFINE_PCI_DEVTYPE(pci_ops_amd_hostbridge);
 
 struct pci_vdev_ops pci_ops_hostbridge = {
 	.class_name	= "hostbridge",
 	.vdev_init	= pci_hostbridge_init,
+	.vdev_reset	= pci_hostbridge_reset,
 };
 DEFINE_PCI_DEVTYPE(pci_ops_hostbridge);
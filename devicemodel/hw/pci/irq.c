@@ -144,6 +144,20 @@ void pci_irq_deinit(struct vmctx *ctx)
 	pirq_cold = 1;
 }
 
+/*
+ * Disable the PIRQ pins on a warm reset, which keeps the pins and IRQs
+ * given to the PCI devices. The ISA devices may reserve their IRQs again.
+ */
+void
+pci_irq_reset(struct vmctx *ctx)
+{
+	int i;
+
+	for (i = 0; i < nitems(pirqs); i++)
+		pirq_write(ctx, i + 1, PIRQ_DIS);
+	pirq_cold = 1;
+}
+
 void
 pci_irq_assert(struct pci_vdev *dev)
 {
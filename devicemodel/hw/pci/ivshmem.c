@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Inter-VM shared memory device, compatible with the ivshmem-doorbell
+ * PCI device (1af4:1110):
+ *
+ *   BAR0: registers, BAR1: MSI-X table and PBA, BAR2: shared memory
+ *
+ * The shared memory is the hugetlbfs file ivshmem_<name>, mapped in the
+ * guest without trapping: every UOS started with the same <name>, and any
+ * SOS process mapping that file, share the same pages.
+ *
+ * The peer with IVPosition <n> receives doorbells on the unix datagram
+ * socket /run/acrn/ivshmem/<name>.<n>, each datagram being the 32 bit
+ * MSI-X vector to raise. A guest rings peer <n> by writing
+ * (<n> << 16 | vector) to the Doorbell register.
+ *
+ * Usage: -s <slot>,ivshmem,<name>,<size>[,<position>]
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "vmmapi.h"
+#include "mevent.h"
+#include "pci_core.h"
+#include "dm_string.h"
+
+#define IVSHMEM_VENDOR_ID	0x1af4
+#define IVSHMEM_DEVICE_ID	0x1110
+
+#define IVSHMEM_REG_BAR		0
+#define IVSHMEM_MSIX_BAR	1
+#define IVSHMEM_MEM_BAR		2
+#define IVSHMEM_REG_BAR_SIZE	0x100
+
+/* Registers in BAR0 */
+#define IVSHMEM_INTR_MASK	0x0
+#define IVSHMEM_INTR_STATUS	0x4
+#define IVSHMEM_IV_POSITION	0x8
+#define IVSHMEM_DOORBELL	0xc
+
+#define IVSHMEM_MSIX_NUM	8
+#define IVSHMEM_MAX_PEERS	16
+#define IVSHMEM_NAME_LEN	32
+#define IVSHMEM_SOCK_DIR	"/run/acrn/ivshmem/"
+#define IVSHMEM_MIN_SIZE	(2 * 1024 * 1024UL)
+
+struct pci_ivshmem {
+	struct pci_vdev *dev;
+	char name[IVSHMEM_NAME_LEN];
+	uint32_t position;
+	void *mem;
+	size_t size;
+	int sock;
+	struct mevent *mevp;
+	uint32_t intr_mask;
+	uint32_t intr_status;
+};
+
+static void
+ivshmem_sock_path(struct sockaddr_un *addr, const char *name, uint32_t position)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	snprintf(addr->sun_path, sizeof(addr->sun_path), IVSHMEM_SOCK_DIR "%s.%u",
+		name, position);
+}
+
+static void
+ivshmem_doorbell_handler(int fd, enum ev_type t, void *arg)
+{
+	struct pci_ivshmem *ivshmem = arg;
+	uint32_t vector;
+
+	while (recv(fd, &vector, sizeof(vector), 0) == sizeof(vector)) {
+		if (vector < IVSHMEM_MSIX_NUM && pci_msix_enabled(ivshmem->dev))
+			pci_generate_msix(ivshmem->dev, vector);
+	}
+}
+
+static void
+ivshmem_ring(struct pci_ivshmem *ivshmem, uint32_t val)
+{
+	struct sockaddr_un addr;
+	uint32_t peer = val >> 16;
+	uint32_t vector = val & 0xffff;
+
+	if (peer >= IVSHMEM_MAX_PEERS)
+		return;
+
+	/* A peer which is not there just misses the doorbell */
+	ivshmem_sock_path(&addr, ivshmem->name, peer);
+	sendto(ivshmem->sock, &vector, sizeof(vector), MSG_DONTWAIT,
+		(struct sockaddr *)&addr, sizeof(addr));
+}
+
+static int
+ivshmem_sock_open(struct pci_ivshmem *ivshmem)
+{
+	struct sockaddr_un addr;
+
+	if ((mkdir("/run/acrn/", 0755) != 0 && errno != EEXIST) ||
+	    (mkdir(IVSHMEM_SOCK_DIR, 0700) != 0 && errno != EEXIST)) {
+		perror(IVSHMEM_SOCK_DIR);
+		return -1;
+	}
+
+	ivshmem->sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (ivshmem->sock < 0) {
+		perror("ivshmem: socket");
+		return -1;
+	}
+
+	ivshmem_sock_path(&addr, ivshmem->name, ivshmem->position);
+	unlink(addr.sun_path);
+	if (bind(ivshmem->sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		perror("ivshmem: bind");
+		goto err;
+	}
+
+	ivshmem->mevp = mevent_add(ivshmem->sock, EVF_READ,
+			ivshmem_doorbell_handler, ivshmem, NULL, NULL);
+	if (ivshmem->mevp == NULL) {
+		fprintf(stderr, "ivshmem: can not wait for doorbells\n");
+		unlink(addr.sun_path);
+		goto err;
+	}
+
+	return 0;
+
+err:
+	close(ivshmem->sock);
+	ivshmem->sock = -1;
+	return -1;
+}
+
+static void
+ivshmem_sock_close(struct pci_ivshmem *ivshmem)
+{
+	struct sockaddr_un addr;
+
+	if (ivshmem->mevp != NULL) {
+		mevent_delete(ivshmem->mevp);
+		ivshmem->mevp = NULL;
+	}
+	if (ivshmem->sock >= 0) {
+		close(ivshmem->sock);
+		ivshmem->sock = -1;
+		ivshmem_sock_path(&addr, ivshmem->name, ivshmem->position);
+		unlink(addr.sun_path);
+	}
+}
+
+static void
+pci_ivshmem_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
+		  int baridx, uint64_t offset, int size, uint64_t value)
+{
+	struct pci_ivshmem *ivshmem = dev->arg;
+
+	if (baridx == pci_msix_table_bar(dev) ||
+	    baridx == pci_msix_pba_bar(dev)) {
+		pci_emul_msix_twrite(dev, offset, size, value);
+		return;
+	}
+
+	if (baridx != IVSHMEM_REG_BAR || size != 4)
+		return;
+
+	switch (offset) {
+	case IVSHMEM_INTR_MASK:
+		ivshmem->intr_mask = value;
+		break;
+	case IVSHMEM_INTR_STATUS:
+		ivshmem->intr_status = value;
+		break;
+	case IVSHMEM_DOORBELL:
+		ivshmem_ring(ivshmem, value);
+		break;
+	default:
+		/* IVPosition and reserved space are read-only */
+		break;
+	}
+}
+
+static uint64_t
+pci_ivshmem_read(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
+		 int baridx, uint64_t offset, int size)
+{
+	struct pci_ivshmem *ivshmem = dev->arg;
+	uint64_t val = 0;
+
+	if (baridx == pci_msix_table_bar(dev) ||
+	    baridx == pci_msix_pba_bar(dev))
+		return pci_emul_msix_tread(dev, offset, size);
+
+	if (baridx != IVSHMEM_REG_BAR || size != 4)
+		return 0;
+
+	switch (offset) {
+	case IVSHMEM_INTR_MASK:
+		val = ivshmem->intr_mask;
+		break;
+	case IVSHMEM_INTR_STATUS:
+		val = ivshmem->intr_status;
+		ivshmem->intr_status = 0;
+		break;
+	case IVSHMEM_IV_POSITION:
+		val = ivshmem->position;
+		break;
+	default:
+		/* The doorbell and reserved space read as 0 */
+		break;
+	}
+
+	return val;
+}
+
+static int
+ivshmem_parse_opts(struct pci_ivshmem *ivshmem, char *opts)
+{
+	char *dup, *cp, *name, *size, *pos;
+	int ret = -1;
+
+	if (opts == NULL)
+		goto usage;
+
+	dup = cp = strdup(opts);
+	if (dup == NULL)
+		return -1;
+
+	name = strsep(&cp, ",");
+	size = strsep(&cp, ",");
+	pos = strsep(&cp, ",");
+
+	if (name == NULL || *name == '\0' || strchr(name, '/') != NULL ||
+	    strnlen(name, IVSHMEM_NAME_LEN) >= IVSHMEM_NAME_LEN ||
+	    size == NULL || vm_parse_memsize(size, &ivshmem->size) != 0)
+		goto out;
+
+	/* A BAR, made of whole 2M pages */
+	if (ivshmem->size < IVSHMEM_MIN_SIZE ||
+	    (ivshmem->size & (ivshmem->size - 1)) != 0)
+		goto out;
+
+	if (pos != NULL) {
+		if (dm_strtoui(pos, &pos, 10, &ivshmem->position) != 0 ||
+		    ivshmem->position >= IVSHMEM_MAX_PEERS)
+			goto out;
+	}
+
+	strncpy(ivshmem->name, name, IVSHMEM_NAME_LEN - 1);
+	ret = 0;
+out:
+	free(dup);
+	if (ret == 0)
+		return 0;
+usage:
+	fprintf(stderr, "ivshmem: usage <name>,<size: power of 2, >= 2M>[,<position < %d>]\n",
+		IVSHMEM_MAX_PEERS);
+	return -1;
+}
+
+static int
+pci_ivshmem_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct pci_ivshmem *ivshmem;
+	char file[IVSHMEM_NAME_LEN + 8];
+
+	ivshmem = calloc(1, sizeof(struct pci_ivshmem));
+	if (ivshmem == NULL)
+		return -1;
+
+	ivshmem->dev = dev;
+	ivshmem->sock = -1;
+	if (ivshmem_parse_opts(ivshmem, opts) != 0)
+		goto err;
+
+	snprintf(file, sizeof(file), "ivshmem_%s", ivshmem->name);
+	ivshmem->mem = hugetlb_map_shared(file, ivshmem->size);
+	if (ivshmem->mem == NULL)
+		goto err;
+
+	pci_set_cfgdata16(dev, PCIR_VENDOR, IVSHMEM_VENDOR_ID);
+	pci_set_cfgdata16(dev, PCIR_DEVICE, IVSHMEM_DEVICE_ID);
+	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, IVSHMEM_VENDOR_ID);
+	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, IVSHMEM_DEVICE_ID);
+	pci_set_cfgdata8(dev, PCIR_CLASS, PCIC_MEMORY);
+	pci_set_cfgdata8(dev, PCIR_SUBCLASS, PCIS_MEMORY_RAM);
+
+	if (pci_emul_alloc_bar(dev, IVSHMEM_REG_BAR, PCIBAR_MEM32,
+			IVSHMEM_REG_BAR_SIZE) != 0 ||
+	    pci_emul_add_msixcap(dev, IVSHMEM_MSIX_NUM, IVSHMEM_MSIX_BAR) != 0 ||
+	    pci_emul_alloc_bar(dev, IVSHMEM_MEM_BAR, PCIBAR_MEM64,
+			ivshmem->size) != 0)
+		goto err;
+
+	/* Like pass-through BARs, the shared memory is not moved after init */
+	if (vm_map_memseg_vma(ctx, ivshmem->size, dev->bar[IVSHMEM_MEM_BAR].addr,
+			(uint64_t)ivshmem->mem, PROT_READ | PROT_WRITE) < 0) {
+		perror("ivshmem: map shared memory to guest");
+		goto err;
+	}
+
+	if (ivshmem_sock_open(ivshmem) != 0)
+		goto err;
+
+	dev->arg = ivshmem;
+	return 0;
+
+err:
+	if (ivshmem->mem != NULL)
+		munmap(ivshmem->mem, ivshmem->size);
+	free(ivshmem);
+	return -1;
+}
+
+static void
+pci_ivshmem_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct pci_ivshmem *ivshmem = dev->arg;
+
+	if (ivshmem == NULL)
+		return;
+
+	ivshmem_sock_close(ivshmem);
+	munmap(ivshmem->mem, ivshmem->size);
+	free(ivshmem);
+	dev->arg = NULL;
+}
+
+struct pci_vdev_ops pci_ops_ivshmem = {
+	.class_name	= "ivshmem",
+	.vdev_init	= pci_ivshmem_init,
+	.vdev_deinit	= pci_ivshmem_deinit,
+	.vdev_barwrite	= pci_ivshmem_write,
+	.vdev_barread	= pci_ivshmem_read
+};
+
+DEFINE_PCI_DEVTYPE(pci_ops_ivshmem);
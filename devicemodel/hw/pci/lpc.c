@@ -173,6 +173,8 @@ lpc_deinit(struct vmctx *ctx)
 		iop.size = UART_IO_BAR_SIZE;
 		iop.flags = IOPORT_F_INOUT;
 		unregister_inout(&iop);
+		(void)vm_set_posted_pio_range(ctx, lpc_uart->iobase,
+				lpc_uart->iobase + UART_IO_BAR_SIZE, false);
 
 		uart_release_backend(lpc_uart->uart, lpc_uart->opts);
 		uart_deinit(lpc_uart->uart);
@@ -237,6 +239,14 @@ lpc_init(struct vmctx *ctx)
 		error = register_inout(&iop);
 		assert(error == 0);
 		lpc_uart->enabled = 1;
+
+		/*
+		 * Let the guest stream THR writes (REP OUTSB included) without
+		 * waiting for each one; reads stay synchronous and the posted
+		 * ring is drained before them, so ordering is kept.
+		 */
+		(void)vm_set_posted_pio_range(ctx, lpc_uart->iobase,
+				lpc_uart->iobase + UART_IO_BAR_SIZE, true);
 	}
 
 	return 0;
@@ -476,10 +486,20 @@ lpc_pirq_routed(void)
 		pci_set_cfgdata8(lpc_bridge, 0x68 + pin, pirq_read(pin + 5));
 }
 
+/*
+ * The PIRQ routing is reset with the PCI INTx, see pci_irq_reset(). The
+ * COM ports keep their backends, the guest programs them on boot.
+ */
+static void
+pci_lpc_reset(struct vmctx *ctx, struct pci_vdev *pi)
+{
+}
+
 struct pci_vdev_ops pci_ops_lpc = {
 	.class_name		= "lpc",
 	.vdev_init		= pci_lpc_init,
 	.vdev_deinit		= pci_lpc_deinit,
+	.vdev_reset		= pci_lpc_reset,
 	.vdev_write_dsdt	= pci_lpc_write_dsdt,
 	.vdev_cfgwrite		= pci_lpc_cfgwrite,
 	.vdev_barwrite		= pci_lpc_write,
@@ -45,6 +45,7 @@
 #include "pciio.h"
 #include "pci_core.h"
 #include "acpi.h"
+#include "atomic.h"
 
 #ifndef PCI_COMMAND_INTX_DISABLE
 #define PCI_COMMAND_INTX_DISABLE ((uint16_t)0x400)
@@ -108,13 +109,18 @@ struct passthru_dev {
 	struct pci_device *phys_dev;
 	/* Options for passthrough device:
 	 *   need_reset - reset dev before passthrough
+	 *   coalesce_events/coalesce_us - MSI coalescing, see coalesce=
 	 */
 	bool need_reset;
+	uint32_t coalesce_events;
+	uint32_t coalesce_us;
 	/* The memory pages, which not overlap with MSI-X table will be
 	 * passed-through to guest, two potential ranges, before and after MSI-X
 	 * Table if any.
 	 */
 	struct mmio_map	msix_bar_mmio[2];
+	/* Header bytes served from the emulated config space, one bit each */
+	uint64_t ro_cfg;
 };
 
 void ptdev_no_reset(bool enable)
@@ -143,6 +149,26 @@ msi_caplen(int msgctrl)
 	return len;
 }
 
+/*
+ * Config header bytes the hardware never changes: Vendor and Device ID,
+ * Revision ID and Class Code, Header Type, Capabilities Pointer and, in
+ * type 0 headers only, the Subsystem IDs.
+ */
+#define PT_RO_CFG_TYPE1	0x0010000000004f0fUL
+#define PT_RO_CFG_TYPE0	(PT_RO_CFG_TYPE1 | 0x0000f00000000000UL)
+
+static inline bool
+ro_cfg_access(struct passthru_dev *ptdev, int coff, int bytes)
+{
+	uint64_t mask;
+
+	if (coff + bytes > 64)
+		return false;
+
+	mask = ((1UL << bytes) - 1) << coff;
+	return (ptdev->ro_cfg & mask) == mask;
+}
+
 static uint32_t
 read_config(struct pci_device *phys_dev, long reg, int width)
 {
@@ -446,6 +472,8 @@ cfginit_cap(struct vmctx *ctx, struct passthru_dev *ptdev)
 		ptirq.msix.vector_cnt = 1;
 		ptirq.msix.table_paddr = 0;
 		ptirq.msix.table_size = 0;
+		ptirq.coalesce.max_events = ptdev->coalesce_events;
+		ptirq.coalesce.max_us = ptdev->coalesce_us;
 		vm_set_ptdev_msix_info(ctx, &ptirq);
 	}
 
@@ -706,6 +734,8 @@ init_msix_table(struct vmctx *ctx, struct passthru_dev *ptdev, uint64_t base)
 	ptirq.msix.table_paddr = ptdev->bar[idx].addr +
 		dev->msix.table_offset;
 	ptirq.msix.table_size = table_size;
+	ptirq.coalesce.max_events = ptdev->coalesce_events;
+	ptirq.coalesce.max_us = ptdev->coalesce_us;
 	vm_set_ptdev_msix_info(ctx, &ptirq);
 	ptdev->msix.table_size = table_size;
 
@@ -864,6 +894,82 @@ cfginitbar(struct vmctx *ctx, struct passthru_dev *ptdev)
  *     IRQ_INTX(0): phy dev has no MSI support
  *     IRQ_MSI(1):  phy dev has MSI support
  */
+/*
+ * Copy the read-only header registers into the emulated config space: guest
+ * drivers probing them are then served without a sysfs read.
+ */
+static void
+cfginit_ro(struct passthru_dev *ptdev)
+{
+	uint8_t hdrtype;
+	int i;
+
+	hdrtype = read_config(ptdev->phys_dev, PCIR_HDRTYPE, 1);
+	if ((hdrtype & PCIM_HDRTYPE) == PCIM_HDRTYPE_NORMAL)
+		ptdev->ro_cfg = PT_RO_CFG_TYPE0;
+	else
+		ptdev->ro_cfg = PT_RO_CFG_TYPE1;
+
+	for (i = 0; i < 64; i++) {
+		if (ptdev->ro_cfg & (1UL << i))
+			pci_set_cfgdata8(ptdev->dev, i,
+				read_config(ptdev->phys_dev, i, 1));
+	}
+}
+
+/*
+ * The passthrough devices passthru_prepare() already reset, one bit per BDF.
+ * A reset (FLR or secondary bus reset) takes 100ms or more, so they are all
+ * done concurrently before init and cfginit() only consumes the bit.
+ */
+static uint64_t pt_reset_done[0x10000 / 64];
+
+static void
+pt_reset_path(char *path, size_t len, int bus, int slot, int func)
+{
+	snprintf(path, len, "/sys/bus/pci/devices/0000:%02x:%02x.%x/reset",
+		bus, slot, func);
+}
+
+static bool
+pt_reset_consume(uint16_t bdf)
+{
+	uint64_t bit = 1UL << (bdf % 64);
+
+	return (atomic_fetch_and(&pt_reset_done[bdf / 64], ~bit) & bit) != 0;
+}
+
+static void
+passthru_prepare(struct vmctx *ctx, const char *opts)
+{
+	char reset_path[60];
+	const char *opt;
+	int bus, slot, func, fd;
+	uint16_t bdf;
+
+	if (opts == NULL || sscanf(opts, "%x/%x/%x", &bus, &slot, &func) != 3)
+		return;
+
+	/* the same "reset" option passthru_init() parses */
+	for (opt = strchr(opts, ','); opt != NULL; opt = strchr(opt, ',')) {
+		opt++;
+		if (!strncmp(opt, "reset", 5))
+			break;
+	}
+	if (opt == NULL)
+		return;
+
+	pt_reset_path(reset_path, sizeof(reset_path), bus, slot, func);
+	fd = open(reset_path, O_WRONLY);
+	if (fd < 0)
+		return;
+
+	bdf = PCI_BDF(bus, slot, func);
+	if (write(fd, "1", 1) == 1)
+		atomic_fetch_or(&pt_reset_done[bdf / 64], 1UL << (bdf % 64));
+	close(fd);
+}
+
 static int
 cfginit(struct vmctx *ctx, struct passthru_dev *ptdev, int bus,
 	int slot, int func)
@@ -896,13 +1002,12 @@ cfginit(struct vmctx *ctx, struct passthru_dev *ptdev, int bus,
 	 *   UOS reboot
 	 * - refuse to passthrough PCIe dev without any reset capability
 	 */
-	snprintf(reset_path, 40,
-		"/sys/bus/pci/devices/0000:%02x:%02x.%x/reset",
-		bus, slot, func);
+	pt_reset_path(reset_path, sizeof(reset_path), bus, slot, func);
 
 	fd = open(reset_path, O_WRONLY);
 	if (fd >= 0) {
-		if (ptdev->need_reset && write(fd, "1", 1) < 0)
+		if (ptdev->need_reset && !pt_reset_consume(ptdev->phys_bdf) &&
+				write(fd, "1", 1) < 0)
 			warnx("reset dev %x/%x/%x failed!\n",
 			      bus, slot, func);
 		close(fd);
@@ -918,8 +1023,10 @@ cfginit(struct vmctx *ctx, struct passthru_dev *ptdev, int bus,
 		warnx("failed to initialize BARs for PCI %x/%x/%x",
 		    bus, slot, func);
 		return -1;
-	} else
-		return irq_type;
+	}
+
+	cfginit_ro(ptdev);
+	return irq_type;
 }
 
 /*
@@ -993,6 +1100,7 @@ passthru_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	char *opt;
 	bool keep_gsi = false;
 	bool need_reset = false;
+	uint32_t coalesce_events = 0, coalesce_us = 0;
 
 	ptdev = NULL;
 	error = -EINVAL;
@@ -1013,7 +1121,14 @@ passthru_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			keep_gsi = true;
 		else if (!strncmp(opt, "reset", 5))
 			need_reset = true;
-		else
+		/* coalesce=<max_events>:<max_us>, inject MSIs in batches */
+		else if (!strncmp(opt, "coalesce=", 9)) {
+			if (sscanf(opt + 9, "%u:%u", &coalesce_events,
+					&coalesce_us) != 2) {
+				warnx("Invalid passthru coalesce option:%s", opt);
+				return -EINVAL;
+			}
+		} else
 			warnx("Invalid passthru options:%s", opt);
 	}
 
@@ -1031,6 +1146,8 @@ passthru_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	ptdev->phys_bdf = PCI_BDF(bus, slot, func);
 	ptdev->need_reset = need_reset;
+	ptdev->coalesce_events = coalesce_events;
+	ptdev->coalesce_us = coalesce_us;
 	update_pt_info(ptdev->phys_bdf);
 
 	error = pciaccess_init();
@@ -1241,6 +1358,10 @@ passthru_cfgread(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 	if (coff >= PCIR_INTLINE && coff <= PCIR_MAXLAT)
 		return -1;
 
+	/* The read-only header registers are cached */
+	if (ro_cfg_access(ptdev, coff, bytes))
+		return -1;
+
 	/* Everything else just read from the device's config space */
 	*rv = read_config(ptdev->phys_dev, coff, bytes);
 
@@ -2020,6 +2141,7 @@ passthru_write_dsdt(struct pci_vdev *dev)
 
 struct pci_vdev_ops passthru = {
 	.class_name		= "passthru",
+	.vdev_prepare		= passthru_prepare,
 	.vdev_init		= passthru_init,
 	.vdev_deinit		= passthru_deinit,
 	.vdev_cfgwrite		= passthru_cfgwrite,
@@ -15,8 +15,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
 #include <linux/vhost.h>
 
 #include "dm.h"
@@ -24,6 +27,7 @@
 #include "irq.h"
 #include "vmmapi.h"
 #include "vhost.h"
+#include "hv_ioeventfd.h"
 
 static int vhost_debug;
 #define LOG_TAG "vhost: "
@@ -38,6 +42,10 @@ int vhost_kernel_ioctl(struct vhost_dev *vdev,
 {
 	int rc;
 
+	/* a vhost-user backend gets the same requests as messages */
+	if (vdev->user)
+		return vhost_user_ioctl(vdev, request, arg);
+
 	rc = ioctl(vdev->fd, request, arg);
 	if (rc < 0)
 		WPRINTF("ioctl failed, fd = %d, request = 0x%lx,"
@@ -54,6 +62,8 @@ vhost_kernel_init(struct vhost_dev *vdev, struct virtio_base *base,
 	vdev->fd = fd;
 	vdev->vq_idx = vq_idx;
 	vdev->busyloop_timeout = busyloop_timeout;
+	vdev->worker_cpu = -1;
+	vdev->intr_coalesce = 0;
 }
 
 static void
@@ -179,6 +189,107 @@ vhost_eventfd_test_and_clear(int fd)
 	return rc > 0 ? 1 : 0;
 }
 
+/* forward a kick completed by the hypervisor to the vhost kernel thread */
+static void
+vhost_vq_hv_kick(void *arg)
+{
+	struct vhost_vq *vq = arg;
+
+	eventfd_write(vq->kick_fd, 1);
+}
+
+/*
+ * Prefer the in-hypervisor ioeventfd, which does not pause the vcpu, over
+ * the one of the VHM kernel module.
+ */
+static int
+vhost_vq_register_kick(struct vhost_dev *vdev, struct vhost_vq *vq,
+		       struct virtio_vq_info *vqi,
+		       struct acrn_ioeventfd *ioeventfd, bool is_register)
+{
+	struct vmctx *ctx = vdev->base->dev->vmctx;
+	uint32_t flags = 0;
+
+	if (!is_register && vq->hv_ioeventfd >= 0) {
+		hv_ioeventfd_del(ctx, vq->hv_ioeventfd);
+		vq->hv_ioeventfd = -1;
+		return 0;
+	}
+
+	if (is_register) {
+		/* the kick belongs to the vhost kernel thread from now on */
+		virtio_vq_set_hv_kick(vqi, false);
+
+		if (ioeventfd->flags & ACRN_IOEVENTFD_FLAG_PIO)
+			flags |= HV_IOEVENTFD_FLAG_PIO;
+		if (ioeventfd->flags & ACRN_IOEVENTFD_FLAG_DATAMATCH)
+			flags |= HV_IOEVENTFD_FLAG_DATAMATCH;
+		vq->hv_ioeventfd = hv_ioeventfd_add(ctx, ioeventfd->addr,
+					ioeventfd->len, flags, ioeventfd->data,
+					vhost_vq_hv_kick, vq);
+		if (vq->hv_ioeventfd >= 0)
+			return 0;
+	}
+
+	return vm_ioeventfd(ctx, ioeventfd);
+}
+
+/* the end of a coalescing window, its completions get one interrupt */
+static void
+vhost_vq_call_timer(void *arg)
+{
+	struct vhost_vq *vq = arg;
+	struct vhost_dev *vdev = vq->dev;
+
+	vq_interrupt(vdev->base, &vdev->base->queues[vdev->vq_idx + vq->idx]);
+}
+
+static void
+vhost_vq_call(int fd, enum ev_type t, void *arg)
+{
+	struct vhost_vq *vq = arg;
+	struct itimerspec ts;
+
+	vhost_eventfd_test_and_clear(fd);
+
+	/* the first completion opens the window, the others fall in it */
+	if (acrn_timer_gettime(&vq->call_timer, &ts) < 0 ||
+	    ts.it_value.tv_sec != 0 || ts.it_value.tv_nsec != 0)
+		return;
+
+	memset(&ts, 0, sizeof(ts));
+	ts.it_value.tv_sec = vq->dev->intr_coalesce / 1000000;
+	ts.it_value.tv_nsec = (vq->dev->intr_coalesce % 1000000) * 1000;
+	acrn_timer_settime(&vq->call_timer, &ts);
+}
+
+/*
+ * With intr_coalesce, the DM waits on the call eventfd in place of an
+ * irqfd of the hypervisor.
+ */
+static int
+vhost_vq_register_call(struct vhost_vq *vq, bool is_register)
+{
+	if (!is_register) {
+		if (vq->call_mevp != NULL) {
+			mevent_delete(vq->call_mevp);
+			vq->call_mevp = NULL;
+		}
+		acrn_timer_deinit(&vq->call_timer);
+		return 0;
+	}
+
+	if (acrn_timer_init(&vq->call_timer, vhost_vq_call_timer, vq) < 0)
+		return -1;
+	vq->call_mevp = mevent_add(vq->call_fd, EVF_READ, vhost_vq_call, vq,
+				   NULL, NULL);
+	if (vq->call_mevp == NULL) {
+		acrn_timer_deinit(&vq->call_timer);
+		return -1;
+	}
+	return 0;
+}
+
 static int
 vhost_vq_register_eventfd(struct vhost_dev *vdev,
 			  int idx, bool is_register)
@@ -244,7 +355,7 @@ vhost_vq_register_eventfd(struct vhost_dev *vdev,
 	DPRINTF("[ioeventfd: %d][0x%lx@%d][flags: 0x%x][data: 0x%lx]\n",
 		ioeventfd.fd, ioeventfd.addr, ioeventfd.len,
 		ioeventfd.flags, ioeventfd.data);
-	rc = vm_ioeventfd(vdev->base->dev->vmctx, &ioeventfd);
+	rc = vhost_vq_register_kick(vdev, vq, vqi, &ioeventfd, is_register);
 	if (rc < 0) {
 		WPRINTF("vm_ioeventfd failed rc = %d, errno = %d\n",
 			rc, errno);
@@ -252,20 +363,24 @@ vhost_vq_register_eventfd(struct vhost_dev *vdev,
 	}
 
 	/* register irqfd for notify */
-	mte = &vdev->base->dev->msix.table[vqi->msix_idx];
-	msi.msi_addr = mte->addr;
-	msi.msi_data = mte->msg_data;
-	irqfd.fd = vq->call_fd;
-	/* no additional flag bit should be set */
-	irqfd.msi = msi;
-	DPRINTF("[irqfd: %d][MSIX: %d]\n", irqfd.fd, vqi->msix_idx);
-	rc = vm_irqfd(vdev->base->dev->vmctx, &irqfd);
+	if (vdev->intr_coalesce) {
+		rc = vhost_vq_register_call(vq, is_register);
+	} else {
+		mte = &vdev->base->dev->msix.table[vqi->msix_idx];
+		msi.msi_addr = mte->addr;
+		msi.msi_data = mte->msg_data;
+		irqfd.fd = vq->call_fd;
+		/* no additional flag bit should be set */
+		irqfd.msi = msi;
+		DPRINTF("[irqfd: %d][MSIX: %d]\n", irqfd.fd, vqi->msix_idx);
+		rc = vm_irqfd(vdev->base->dev->vmctx, &irqfd);
+	}
 	if (rc < 0) {
 		WPRINTF("vm_irqfd failed rc = %d, errno = %d\n", rc, errno);
 		/* unregister ioeventfd */
 		if (is_register) {
 			ioeventfd.flags |= ACRN_IOEVENTFD_FLAG_DEASSIGN;
-			vm_ioeventfd(vdev->base->dev->vmctx, &ioeventfd);
+			vhost_vq_register_kick(vdev, vq, vqi, &ioeventfd, false);
 		}
 		return -1;
 	}
@@ -299,6 +414,7 @@ vhost_vq_init(struct vhost_dev *vdev, int idx)
 
 	vq->idx = idx;
 	vq->dev = vdev;
+	vq->hv_ioeventfd = -1;
 	return 0;
 
 fail_call:
@@ -652,6 +768,75 @@ vhost_dev_deinit(struct vhost_dev *vdev)
 	return 0;
 }
 
+#define VHOST_WORKERS_MAX	64
+
+/*
+ * The vhost workers of this process, the "vhost-<pid>" tasks: threads of
+ * the process with the recent kernels, kernel threads with the others.
+ */
+static int
+vhost_find_workers(pid_t *tids, int max)
+{
+	static const char * const dirs[] = { "/proc/self/task", "/proc" };
+	char name[32], path[64], comm[32];
+	struct dirent *de;
+	DIR *dir;
+	FILE *f;
+	int i, n = 0;
+	long id;
+
+	snprintf(name, sizeof(name), "vhost-%d\n", getpid());
+	for (i = 0; i < ARRAY_SIZE(dirs) && n < max; i++) {
+		dir = opendir(dirs[i]);
+		if (dir == NULL)
+			continue;
+		while (n < max && (de = readdir(dir)) != NULL) {
+			id = strtol(de->d_name, NULL, 10);
+			if (id <= 0)
+				continue;
+			snprintf(path, sizeof(path), "%s/%ld/comm", dirs[i], id);
+			f = fopen(path, "r");
+			if (f == NULL)
+				continue;
+			if (fgets(comm, sizeof(comm), f) != NULL &&
+			    strcmp(comm, name) == 0)
+				tids[n++] = id;
+			fclose(f);
+		}
+		closedir(dir);
+		/* the threads of the process are its own workers */
+		if (n > 0)
+			break;
+	}
+	return n;
+}
+
+/* pin the workers which are not among the @n ones of before */
+static void
+vhost_pin_worker(struct vhost_dev *vdev, pid_t *before, int n)
+{
+	pid_t workers[VHOST_WORKERS_MAX];
+	cpu_set_t cpus;
+	int i, j, nworkers;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(vdev->worker_cpu, &cpus);
+
+	nworkers = vhost_find_workers(workers, VHOST_WORKERS_MAX);
+	for (i = 0; i < nworkers; i++) {
+		for (j = 0; j < n && before[j] != workers[i]; j++)
+			;
+		if (j < n)
+			continue;
+		if (sched_setaffinity(workers[i], sizeof(cpus), &cpus) < 0)
+			WPRINTF("failed to pin worker %d to cpu %d: %d\n",
+				workers[i], vdev->worker_cpu, errno);
+		else
+			DPRINTF("worker %d pinned to cpu %d\n", workers[i],
+				vdev->worker_cpu);
+	}
+}
+
 /**
  * @brief start vhost data plane.
  *
@@ -665,8 +850,9 @@ int
 vhost_dev_start(struct vhost_dev *vdev)
 {
 	struct vhost_vring_state state;
+	pid_t workers[VHOST_WORKERS_MAX];
 	uint64_t features;
-	int i, rc;
+	int i, rc, nworkers = 0;
 
 	if (vdev->started)
 		return 0;
@@ -688,12 +874,19 @@ vhost_dev_start(struct vhost_dev *vdev)
 		goto fail;
 	}
 
+	if (vdev->worker_cpu >= 0 && !vdev->user)
+		nworkers = vhost_find_workers(workers, VHOST_WORKERS_MAX);
+
 	rc = vhost_kernel_set_owner(vdev);
 	if (rc < 0) {
 		WPRINTF("vhost_set_owner failed\n");
 		goto fail;
 	}
 
+	/* the worker is created by VHOST_SET_OWNER */
+	if (vdev->worker_cpu >= 0 && !vdev->user)
+		vhost_pin_worker(vdev, workers, nworkers);
+
 	/* set vhost internal features */
 	features = (vdev->base->negotiated_caps & vdev->vhost_features) |
 		vdev->vhost_ext_features;
@@ -711,17 +904,17 @@ vhost_dev_start(struct vhost_dev *vdev)
 		goto fail;
 	}
 
-	/* config busyloop timeout */
-	if (vdev->busyloop_timeout) {
-		state.num = vdev->busyloop_timeout;
-		for (i = 0; i < vdev->nvqs; i++) {
-			state.index = i;
-			rc = vhost_kernel_set_vring_busyloop_timeout(vdev,
-				&state);
-			if (rc < 0) {
-				WPRINTF("set_busyloop_timeout failed\n");
-				goto fail;
-			}
+	/* config busyloop timeout, that of a vq has the precedence */
+	for (i = 0; i < vdev->nvqs; i++) {
+		state.index = i;
+		state.num = vdev->vqs[i].busyloop_timeout ?
+			vdev->vqs[i].busyloop_timeout : vdev->busyloop_timeout;
+		if (state.num == 0)
+			continue;
+		rc = vhost_kernel_set_vring_busyloop_timeout(vdev, &state);
+		if (rc < 0) {
+			WPRINTF("set_busyloop_timeout failed\n");
+			goto fail;
 		}
 	}
 
@@ -0,0 +1,495 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * vhost-user transport: the vhost requests of vhost.c are sent as the
+ * messages of the vhost-user protocol over a unix socket, to a backend
+ * process (e.g. a polled SPDK target) which maps the guest memory from
+ * the hugetlbfs fds it gets along with the memory table.
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/vhost.h>
+
+#include "dm.h"
+#include "pci_core.h"
+#include "vmmapi.h"
+#include "vhost.h"
+
+static int vhost_user_debug;
+#define LOG_TAG "vhost-user: "
+#define DPRINTF(fmt, args...) \
+	do { if (vhost_user_debug) printf(LOG_TAG fmt, ##args); } while (0)
+#define WPRINTF(fmt, args...) printf(LOG_TAG fmt, ##args)
+
+#define VHOST_USER_GET_FEATURES			1
+#define VHOST_USER_SET_FEATURES			2
+#define VHOST_USER_SET_OWNER			3
+#define VHOST_USER_SET_MEM_TABLE		5
+#define VHOST_USER_SET_VRING_NUM		8
+#define VHOST_USER_SET_VRING_ADDR		9
+#define VHOST_USER_SET_VRING_BASE		10
+#define VHOST_USER_GET_VRING_BASE		11
+#define VHOST_USER_SET_VRING_KICK		12
+#define VHOST_USER_SET_VRING_CALL		13
+#define VHOST_USER_GET_PROTOCOL_FEATURES	15
+#define VHOST_USER_SET_PROTOCOL_FEATURES	16
+#define VHOST_USER_SET_VRING_ENABLE		18
+#define VHOST_USER_GET_CONFIG			24
+
+#define VHOST_USER_VERSION		0x1U
+#define VHOST_USER_FLAG_REPLY		(1U << 2)
+#define VHOST_USER_FLAG_NEED_REPLY	(1U << 3)
+
+/* in the u64 of SET_VRING_KICK/CALL: no fd comes with the message */
+#define VHOST_USER_VRING_NOFD		(1UL << 8)
+
+/* the protocol features we use */
+#define VHOST_USER_PROTOCOL_F_REPLY_ACK	(1UL << 3)
+#define VHOST_USER_PROTOCOL_F_CONFIG	(1UL << 9)
+#define VHOST_USER_PROTOCOL_FEATURES	\
+	(VHOST_USER_PROTOCOL_F_REPLY_ACK | VHOST_USER_PROTOCOL_F_CONFIG)
+
+#define VHOST_USER_MAX_REGIONS		8
+#define VHOST_USER_MAX_CONFIG		256
+
+struct vhost_user_region {
+	uint64_t gpa;
+	uint64_t size;
+	uint64_t uaddr;
+	uint64_t mmap_offset;
+};
+
+struct vhost_user_mem {
+	uint32_t nregions;
+	uint32_t padding;
+	struct vhost_user_region regions[VHOST_USER_MAX_REGIONS];
+};
+
+struct vhost_user_config {
+	uint32_t offset;
+	uint32_t size;
+	uint32_t flags;
+	uint8_t region[VHOST_USER_MAX_CONFIG];
+};
+
+struct vhost_user_msg {
+	uint32_t request;
+	uint32_t flags;
+	uint32_t size;		/* of the payload */
+	union {
+		uint64_t u64;
+		struct vhost_vring_state state;
+		struct vhost_vring_addr addr;
+		struct vhost_user_mem mem;
+		struct vhost_user_config config;
+	} payload;
+} __attribute__((packed));
+
+#define VHOST_USER_HDR_SIZE	offsetof(struct vhost_user_msg, payload)
+
+static int
+vhost_user_send(struct vhost_dev *vdev, struct vhost_user_msg *msg,
+		int *fds, int nfds)
+{
+	char control[CMSG_SPACE(sizeof(int) * VHOST_USER_MAX_REGIONS)];
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t rc;
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = msg;
+	iov.iov_len = VHOST_USER_HDR_SIZE + msg->size;
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+
+	if (nfds > 0) {
+		memset(control, 0, sizeof(control));
+		mh.msg_control = control;
+		mh.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+		cmsg = CMSG_FIRSTHDR(&mh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+	}
+
+	msg->flags |= VHOST_USER_VERSION;
+	do {
+		rc = sendmsg(vdev->fd, &mh, MSG_NOSIGNAL);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc != iov.iov_len) {
+		WPRINTF("send of request %u failed, errno = %d\n",
+			msg->request, errno);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+vhost_user_recv_all(int fd, void *buf, size_t len)
+{
+	ssize_t rc;
+
+	while (len > 0) {
+		rc = read(fd, buf, len);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			return -1;
+		buf = (char *)buf + rc;
+		len -= rc;
+	}
+	return 0;
+}
+
+static int
+vhost_user_recv(struct vhost_dev *vdev, struct vhost_user_msg *msg,
+		uint32_t request)
+{
+	if (vhost_user_recv_all(vdev->fd, msg, VHOST_USER_HDR_SIZE) < 0 ||
+	    msg->size > sizeof(msg->payload) ||
+	    vhost_user_recv_all(vdev->fd, &msg->payload, msg->size) < 0) {
+		WPRINTF("no reply to request %u\n", request);
+		return -1;
+	}
+
+	if (msg->request != request || !(msg->flags & VHOST_USER_FLAG_REPLY)) {
+		WPRINTF("bad reply %u to request %u\n", msg->request, request);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Send a request which has no reply of its own, waiting for the backend
+ * to ack it when it can.
+ */
+static int
+vhost_user_request(struct vhost_dev *vdev, struct vhost_user_msg *msg,
+		   int *fds, int nfds)
+{
+	uint32_t request = msg->request;
+
+	if (vdev->protocol_features & VHOST_USER_PROTOCOL_F_REPLY_ACK)
+		msg->flags |= VHOST_USER_FLAG_NEED_REPLY;
+
+	if (vhost_user_send(vdev, msg, fds, nfds) < 0)
+		return -1;
+
+	if (!(msg->flags & VHOST_USER_FLAG_NEED_REPLY))
+		return 0;
+
+	if (vhost_user_recv(vdev, msg, request) < 0 ||
+	    msg->size != sizeof(uint64_t))
+		return -1;
+	if (msg->payload.u64 != 0) {
+		WPRINTF("request %u failed: %lu\n", request, msg->payload.u64);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+vhost_user_get_u64(struct vhost_dev *vdev, uint32_t request, uint64_t *val)
+{
+	struct vhost_user_msg msg = { .request = request };
+
+	if (vhost_user_send(vdev, &msg, NULL, 0) < 0 ||
+	    vhost_user_recv(vdev, &msg, request) < 0 ||
+	    msg.size != sizeof(uint64_t))
+		return -1;
+
+	*val = msg.payload.u64;
+	return 0;
+}
+
+static int
+vhost_user_set_u64(struct vhost_dev *vdev, uint32_t request, uint64_t val)
+{
+	struct vhost_user_msg msg = { .request = request };
+
+	msg.size = sizeof(uint64_t);
+	msg.payload.u64 = val;
+	return vhost_user_request(vdev, &msg, NULL, 0);
+}
+
+static int
+vhost_user_set_state(struct vhost_dev *vdev, uint32_t request,
+		     struct vhost_vring_state *state)
+{
+	struct vhost_user_msg msg = { .request = request };
+
+	msg.size = sizeof(*state);
+	msg.payload.state = *state;
+	return vhost_user_request(vdev, &msg, NULL, 0);
+}
+
+/*
+ * Offered along with VHOST_USER_F_PROTOCOL_FEATURES, they are agreed on
+ * before anything else.
+ */
+static int
+vhost_user_set_protocol_features(struct vhost_dev *vdev)
+{
+	uint64_t features;
+
+	if (vhost_user_get_u64(vdev, VHOST_USER_GET_PROTOCOL_FEATURES,
+				&features) < 0)
+		return -1;
+
+	features &= VHOST_USER_PROTOCOL_FEATURES;
+	if (vhost_user_set_u64(vdev, VHOST_USER_SET_PROTOCOL_FEATURES,
+				features) < 0)
+		return -1;
+
+	vdev->protocol_features = features;
+	DPRINTF("protocol features 0x%lx\n", features);
+	return 0;
+}
+
+/*
+ * The regions of @mem are made of one or more hugetlbfs mappings, which
+ * are what the backend maps: it gets their fds along with the table.
+ */
+static int
+vhost_user_set_mem_table(struct vhost_dev *vdev, struct vhost_memory *mem)
+{
+	struct hugetlb_region hr[VHOST_USER_MAX_REGIONS];
+	struct vhost_user_msg msg = { .request = VHOST_USER_SET_MEM_TABLE };
+	struct vhost_user_region r;
+	int fds[VHOST_USER_MAX_REGIONS];
+	int i, n, nr;
+	uint32_t j;
+
+	n = hugetlb_get_regions(hr, VHOST_USER_MAX_REGIONS);
+	for (i = 0, nr = 0; i < n; i++) {
+		for (j = 0; j < mem->nregions; j++) {
+			if (hr[i].gpa >= mem->regions[j].guest_phys_addr &&
+			    hr[i].gpa + hr[i].len <=
+			    mem->regions[j].guest_phys_addr +
+			    mem->regions[j].memory_size)
+				break;
+		}
+		if (j == mem->nregions)
+			continue;
+
+		r.gpa = hr[i].gpa;
+		r.size = hr[i].len;
+		r.uaddr = (uintptr_t)hr[i].hva;
+		r.mmap_offset = hr[i].offset;
+		msg.payload.mem.regions[nr] = r;
+		fds[nr] = hr[i].fd;
+		DPRINTF("[%d][0x%lx -> 0x%lx, 0x%lx] fd %d@0x%lx\n", nr,
+			r.gpa, r.uaddr, r.size, fds[nr], r.mmap_offset);
+		nr++;
+	}
+
+	if (nr == 0) {
+		WPRINTF("guest memory is not shareable, hugetlb is needed\n");
+		return -1;
+	}
+
+	msg.payload.mem.nregions = nr;
+	msg.size = sizeof(msg.payload.mem);
+	return vhost_user_request(vdev, &msg, fds, nr);
+}
+
+static int
+vhost_user_set_vring_file(struct vhost_dev *vdev, uint32_t request,
+			  struct vhost_vring_file *file)
+{
+	struct vhost_user_msg msg = { .request = request };
+	struct vhost_vring_state state;
+
+	/*
+	 * A ring without a kick fd is a polled one in vhost-user, so the fds
+	 * are left to the backend when the ring stops: GET_VRING_BASE stops
+	 * it.
+	 */
+	if (file->fd < 0)
+		return 0;
+
+	msg.size = sizeof(uint64_t);
+	msg.payload.u64 = file->index;
+	if (vhost_user_request(vdev, &msg, &file->fd, 1) < 0)
+		return -1;
+
+	/* with the protocol features, a ring starts disabled */
+	if (request == VHOST_USER_SET_VRING_KICK &&
+	    (vdev->vhost_ext_features & VHOST_USER_F_PROTOCOL_FEATURES)) {
+		state.index = file->index;
+		state.num = 1;
+		return vhost_user_set_state(vdev, VHOST_USER_SET_VRING_ENABLE,
+					    &state);
+	}
+	return 0;
+}
+
+/**
+ * @brief connect to a vhost-user backend.
+ *
+ * @param path Path of the unix socket the backend listens on.
+ *
+ * @return fd of the connection on success and -1 on failure.
+ */
+int
+vhost_user_connect(const char *path)
+{
+	struct sockaddr_un un;
+	int fd;
+
+	if (strnlen(path, sizeof(un.sun_path)) >= sizeof(un.sun_path)) {
+		WPRINTF("socket path %s too long\n", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		WPRINTF("socket failed, errno = %d\n", errno);
+		return -1;
+	}
+
+	memset(&un, 0, sizeof(un));
+	un.sun_family = AF_UNIX;
+	strncpy(un.sun_path, path, sizeof(un.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&un, sizeof(un)) < 0) {
+		WPRINTF("connect to %s failed, errno = %d\n", path, errno);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * @brief send a vhost request to a vhost-user backend.
+ *
+ * @param vdev Pointer to struct vhost_dev, connected to the backend.
+ * @param request The vhost ioctl request, e.g. VHOST_SET_VRING_NUM.
+ * @param arg The argument of the ioctl.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int
+vhost_user_ioctl(struct vhost_dev *vdev, unsigned long int request, void *arg)
+{
+	struct vhost_user_msg msg;
+	uint64_t *features;
+	int rc;
+
+	switch (request) {
+	case VHOST_GET_FEATURES:
+		features = arg;
+		rc = vhost_user_get_u64(vdev, VHOST_USER_GET_FEATURES,
+					features);
+		if (rc == 0 && (*features & VHOST_USER_F_PROTOCOL_FEATURES))
+			rc = vhost_user_set_protocol_features(vdev);
+		break;
+	case VHOST_SET_FEATURES:
+		rc = vhost_user_set_u64(vdev, VHOST_USER_SET_FEATURES,
+					*(uint64_t *)arg);
+		break;
+	case VHOST_SET_OWNER:
+		memset(&msg, 0, sizeof(msg));
+		msg.request = VHOST_USER_SET_OWNER;
+		rc = vhost_user_request(vdev, &msg, NULL, 0);
+		break;
+	case VHOST_RESET_OWNER:
+		/* deprecated in vhost-user, the rings are stopped already */
+		rc = 0;
+		break;
+	case VHOST_SET_MEM_TABLE:
+		rc = vhost_user_set_mem_table(vdev, arg);
+		break;
+	case VHOST_SET_VRING_NUM:
+		rc = vhost_user_set_state(vdev, VHOST_USER_SET_VRING_NUM, arg);
+		break;
+	case VHOST_SET_VRING_BASE:
+		rc = vhost_user_set_state(vdev, VHOST_USER_SET_VRING_BASE, arg);
+		break;
+	case VHOST_GET_VRING_BASE:
+		memset(&msg, 0, sizeof(msg));
+		msg.request = VHOST_USER_GET_VRING_BASE;
+		msg.size = sizeof(struct vhost_vring_state);
+		msg.payload.state = *(struct vhost_vring_state *)arg;
+		rc = vhost_user_send(vdev, &msg, NULL, 0);
+		if (rc == 0)
+			rc = vhost_user_recv(vdev, &msg,
+					     VHOST_USER_GET_VRING_BASE);
+		if (rc == 0)
+			*(struct vhost_vring_state *)arg = msg.payload.state;
+		break;
+	case VHOST_SET_VRING_ADDR:
+		memset(&msg, 0, sizeof(msg));
+		msg.request = VHOST_USER_SET_VRING_ADDR;
+		msg.size = sizeof(struct vhost_vring_addr);
+		msg.payload.addr = *(struct vhost_vring_addr *)arg;
+		rc = vhost_user_request(vdev, &msg, NULL, 0);
+		break;
+	case VHOST_SET_VRING_KICK:
+		rc = vhost_user_set_vring_file(vdev, VHOST_USER_SET_VRING_KICK,
+					       arg);
+		break;
+	case VHOST_SET_VRING_CALL:
+		rc = vhost_user_set_vring_file(vdev, VHOST_USER_SET_VRING_CALL,
+					       arg);
+		break;
+	default:
+		WPRINTF("request 0x%lx not supported\n", request);
+		errno = ENOTSUP;
+		rc = -1;
+		break;
+	}
+
+	return rc;
+}
+
+/**
+ * @brief read the device config space from a vhost-user backend.
+ *
+ * @param vdev Pointer to struct vhost_dev, after vhost_dev_init.
+ * @param config Buffer for the config space.
+ * @param size Bytes of the config space to read.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int
+vhost_user_get_config(struct vhost_dev *vdev, void *config, uint32_t size)
+{
+	struct vhost_user_msg msg = { .request = VHOST_USER_GET_CONFIG };
+	uint32_t len = offsetof(struct vhost_user_config, region) + size;
+
+	if (!(vdev->protocol_features & VHOST_USER_PROTOCOL_F_CONFIG) ||
+	    size > VHOST_USER_MAX_CONFIG) {
+		WPRINTF("backend has no config space\n");
+		return -1;
+	}
+
+	msg.size = len;
+	msg.payload.config.offset = 0;
+	msg.payload.config.size = size;
+	msg.payload.config.flags = 0;
+	if (vhost_user_send(vdev, &msg, NULL, 0) < 0 ||
+	    vhost_user_recv(vdev, &msg, VHOST_USER_GET_CONFIG) < 0 ||
+	    msg.size != len || msg.payload.config.size != size)
+		return -1;
+
+	memcpy(config, msg.payload.config.region, size);
+	return 0;
+}
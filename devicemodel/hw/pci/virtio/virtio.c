@@ -35,6 +35,9 @@
 #include "pci_core.h"
 #include "virtio.h"
 #include "timer.h"
+#include "hv_ioeventfd.h"
+#include "migration.h"
+#include "dedup.h"
 
 /*
  * Functions for dealing with generalized "virtual devices" as
@@ -51,6 +54,17 @@
 static uint8_t virtio_poll_enabled;
 static size_t virtio_poll_interval;
 
+/*
+ * An idle queue is polled half as often each time, up to this many
+ * doublings of virtio_poll_interval, then left to the guest notifications
+ * until the next one.
+ */
+#define VIRTIO_POLL_BACKOFF	6
+
+/* the linked up devices, for virtio_get_vq_stats_by_index() */
+static LIST_HEAD(, virtio_base) virtio_list = LIST_HEAD_INITIALIZER(virtio_list);
+static pthread_mutex_t virtio_list_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 static void
 virtio_start_timer(struct acrn_timer *timer, time_t sec, time_t nsec)
 {
@@ -65,42 +79,168 @@ virtio_start_timer(struct acrn_timer *timer, time_t sec, time_t nsec)
 	assert(acrn_timer_settime(timer, &ts) == 0);
 }
 
+static uint64_t
+virtio_poll_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* the timer of the device for the earliest of its polled queues */
+static void
+virtio_poll_rearm(struct virtio_base *base, uint64_t now)
+{
+	struct virtio_vq_info *vq;
+	uint64_t next = 0, delta;
+	int i;
+
+	for (i = 0; i < base->vops->nvq; i++) {
+		vq = &base->queues[i];
+		if (vq->poll_period != 0 && (next == 0 || vq->poll_due < next))
+			next = vq->poll_due;
+	}
+
+	/* no queue polled, or the timer already goes off in time */
+	if (next == 0 || (base->poll_armed != 0 && base->poll_armed <= next))
+		return;
+
+	base->poll_armed = next;
+	delta = (next > now) ? next - now : 1;
+	virtio_start_timer(&base->polling_timer, delta / 1000000000UL,
+			   delta % 1000000000UL);
+}
+
+static void
+virtio_poll_notify(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	struct virtio_ops *vops = base->vops;
+
+	if (vq->notify)
+		(*vq->notify)(DEV_STRUCT(base), vq);
+	else if (vops->qnotify)
+		(*vops->qnotify)(DEV_STRUCT(base), vq);
+	else
+		fprintf(stderr,
+			"%s: qnotify queue %d: missing vq/vops notify\r\n",
+			vops->name, vq->num);
+}
+
+/*
+ * A queue is polled at virtio_poll_interval, its notifications masked,
+ * as long as the guest keeps it busy: that is, as long as it changes
+ * between two polls, by new chains of the guest or those the device
+ * took. Each idle poll doubles the interval until the queue goes back to
+ * the guest notifications, the first of which has it polled again.
+ */
 static void
 virtio_poll_timer(void *arg)
 {
 	struct virtio_base *base;
-	struct virtio_ops *vops;
 	struct virtio_vq_info *vq;
-	const char *name;
-	int i;
+	uint64_t now;
+	uint32_t mark;
+	int i, busy;
 
 	base = arg;
-	vops = base->vops;
-	name = vops->name;
 
 	if (base->mtx)
 		pthread_mutex_lock(base->mtx);
 
-	base->polling_in_progress = 1;
+	now = virtio_poll_now();
+	base->poll_armed = 0;
+
+	/* the first run, once the guest is up: poll all the queues */
+	if (!base->polling_in_progress) {
+		base->polling_in_progress = 1;
+		for (i = 0; i < base->vops->nvq; i++) {
+			vq = &base->queues[i];
+			if (!vq_ring_ready(vq))
+				continue;
+			vq->poll_period = virtio_poll_interval;
+			vq->poll_due = now;
+			vq->poll_mark = ~0U;
+			vq_set_used_ring_flags(base, vq);
+		}
+	}
 
 	for (i = 0; i < base->vops->nvq; i++) {
 		vq = &base->queues[i];
-		vq->used->flags |= ACRN_VRING_USED_F_NO_NOTIFY;
-		/* TODO: call notify when necessary */
-		if (vq->notify)
-			(*vq->notify)(DEV_STRUCT(base), vq);
-		else if (vops->qnotify)
-			(*vops->qnotify)(DEV_STRUCT(base), vq);
-		else
-			fprintf(stderr,
-				"%s: qnotify queue %d: missing vq/vops notify\r\n",
-				name, i);
+		if (vq->poll_period == 0 || vq->poll_due > now)
+			continue;
+
+		busy = vq_has_descs(vq);
+		mark = vq->last_avail | (busy << 16);
+		if (mark != vq->poll_mark) {
+			vq->poll_mark = mark;
+			vq->poll_period = virtio_poll_interval;
+		} else if (vq->poll_period <
+			   (virtio_poll_interval << VIRTIO_POLL_BACKOFF)) {
+			vq->poll_period <<= 1;
+		} else {
+			vq->poll_period = 0;
+			vq_clear_used_ring_flags(base, vq);
+
+			/* the chains made available before the unmask */
+			mb();
+			busy = vq_has_descs(vq);
+			if (busy) {
+				vq->poll_period = virtio_poll_interval;
+				vq_set_used_ring_flags(base, vq);
+			}
+		}
+
+		if (busy) {
+			vq->stats.polls++;
+			virtio_poll_notify(base, vq);
+		}
+		vq->poll_due = now + vq->poll_period;
 	}
 
+	virtio_poll_rearm(base, now);
+
 	if (base->mtx)
 		pthread_mutex_unlock(base->mtx);
+}
 
-	virtio_start_timer(&base->polling_timer, 0, virtio_poll_interval);
+/*
+ * A guest notification of a queue: counted and, if the queue was left to
+ * them, polled again from the base interval. Called with the lock of the
+ * device held.
+ */
+static void
+virtio_vq_kicked(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	uint64_t now;
+
+	vq->stats.notifies++;
+	if (!base->polling_in_progress || vq->poll_period != 0)
+		return;
+
+	now = virtio_poll_now();
+	vq->poll_period = virtio_poll_interval;
+	vq->poll_due = now + vq->poll_period;
+	vq->poll_mark = ~0U;
+	vq_set_used_ring_flags(base, vq);
+	virtio_poll_rearm(base, now);
+}
+
+/* polling mode, for a VBS-U device whose driver is ready */
+static void
+virtio_poll_start(struct virtio_base *base)
+{
+	if (!virtio_poll_enabled || base->backend_type != BACKEND_VBSU)
+		return;
+
+	base->polling_timer.clockid = CLOCK_MONOTONIC;
+	acrn_timer_init(&base->polling_timer, virtio_poll_timer, base);
+	base->poll_armed = 0;
+	/* wait 5s to start virtio poll mode
+	 * skip vsbl and make sure device initialization completed
+	 * FIXME: Need optimization in the future
+	 */
+	virtio_start_timer(&base->polling_timer, 5, 0);
 }
 
 /**
@@ -134,7 +274,122 @@ virtio_linkup(struct virtio_base *base, struct virtio_ops *vops,
 	for (i = 0; i < vops->nvq; i++) {
 		queues[i].base = base;
 		queues[i].num = i;
+		queues[i].hv_ioeventfd = -1;
+	}
+
+	pthread_mutex_lock(&virtio_list_mtx);
+	LIST_INSERT_HEAD(&virtio_list, base, list);
+	pthread_mutex_unlock(&virtio_list_mtx);
+}
+
+void
+virtio_unlink(struct pci_vdev *dev)
+{
+	struct virtio_base *base;
+
+	pthread_mutex_lock(&virtio_list_mtx);
+	LIST_FOREACH(base, &virtio_list, list) {
+		if (base->dev == dev) {
+			LIST_REMOVE(base, list);
+			break;
+		}
 	}
+	pthread_mutex_unlock(&virtio_list_mtx);
+}
+
+int
+virtio_get_vq_stats_by_index(int index, char *ident, size_t len,
+			     uint16_t *qsize, struct virtio_vq_stats *stats)
+{
+	struct virtio_base *base;
+	struct virtio_vq_info *vq;
+	int ret = -1;
+
+	pthread_mutex_lock(&virtio_list_mtx);
+	LIST_FOREACH(base, &virtio_list, list) {
+		if (index >= base->vops->nvq) {
+			index -= base->vops->nvq;
+			continue;
+		}
+		vq = &base->queues[index];
+		snprintf(ident, len, "%d:%d %s.%d", base->dev->slot,
+			 base->dev->func, base->vops->name, index);
+		*qsize = vq->qsize;
+		*stats = vq->stats;
+		ret = 0;
+		break;
+	}
+	pthread_mutex_unlock(&virtio_list_mtx);
+
+	return ret;
+}
+
+bool
+virtio_vqs_idle(void)
+{
+	struct virtio_base *base;
+	struct virtio_vq_info *vq;
+	bool idle = true;
+	int i;
+
+	pthread_mutex_lock(&virtio_list_mtx);
+	LIST_FOREACH(base, &virtio_list, list) {
+		for (i = 0; i < base->vops->nvq && idle; i++) {
+			vq = &base->queues[i];
+			if (!vq_ring_ready(vq))
+				continue;
+			if (vq->flags & VQ_PACKED)
+				idle = (vq->used_idx == vq->last_avail &&
+					vq->used_wrap == vq->avail_wrap);
+			else
+				idle = (vq->used->idx == vq->last_avail);
+		}
+	}
+	pthread_mutex_unlock(&virtio_list_mtx);
+
+	return idle;
+}
+
+void
+virtio_foreach_ring(void (*fn)(vm_paddr_t gpa, size_t len))
+{
+	struct virtio_base *base;
+	struct virtio_vq_info *vq;
+	char *baseaddr;
+	int i;
+
+	pthread_mutex_lock(&virtio_list_mtx);
+	LIST_FOREACH(base, &virtio_list, list) {
+		baseaddr = base->dev->vmctx->baseaddr;
+		for (i = 0; i < base->vops->nvq; i++) {
+			vq = &base->queues[i];
+			if (!vq_ring_ready(vq))
+				continue;
+			if (vq->flags & VQ_PACKED) {
+				fn((char *)vq->pdesc - baseaddr,
+					vq->qsize * sizeof(*vq->pdesc));
+				fn((char *)vq->device_event - baseaddr,
+					sizeof(*vq->device_event));
+			} else {
+				fn((char *)vq->used - baseaddr,
+					sizeof(uint16_t) * 3 +
+					sizeof(struct virtio_used) * vq->qsize);
+			}
+		}
+	}
+	pthread_mutex_unlock(&virtio_list_mtx);
+}
+
+static void
+virtio_log_ring(vm_paddr_t gpa, size_t len)
+{
+	migration_log_write(gpa, len);
+}
+
+void
+virtio_log_rings(void)
+{
+	virtio_foreach_ring(virtio_log_ring);
 }
 
 /**
@@ -162,9 +417,11 @@ virtio_reset_dev(struct virtio_base *base)
 
 	acrn_timer_deinit(&base->polling_timer);
 	base->polling_in_progress = 0;
+	base->poll_armed = 0;
 
 	nvq = base->vops->nvq;
 	for (vq = base->queues, i = 0; i < nvq; vq++, i++) {
+		virtio_vq_set_hv_kick(vq, false);
 		vq->flags = 0;
 		vq->last_avail = 0;
 		vq->save_used = 0;
@@ -177,6 +434,9 @@ virtio_reset_dev(struct virtio_base *base)
 		vq->gpa_used[0] = 0;
 		vq->gpa_used[1] = 0;
 		vq->enabled = 0;
+		vq->poll_period = 0;
+		free(vq->chain_len);
+		vq->chain_len = NULL;
 	}
 	base->negotiated_caps = 0;
 	base->curq = 0;
@@ -190,6 +450,86 @@ virtio_reset_dev(struct virtio_base *base)
 	base->config_generation = 0;
 }
 
+/*
+ * Called from vm_loop when the hypervisor has seen at least one
+ * queue notification since the last call.
+ */
+static void
+virtio_vq_hv_kick(void *arg)
+{
+	struct virtio_vq_info *vq = arg;
+	struct virtio_base *base = vq->base;
+	struct virtio_ops *vops = base->vops;
+
+	if (base->mtx)
+		pthread_mutex_lock(base->mtx);
+
+	virtio_vq_kicked(base, vq);
+	if (vq->notify)
+		(*vq->notify)(DEV_STRUCT(base), vq);
+	else if (vops->qnotify)
+		(*vops->qnotify)(DEV_STRUCT(base), vq);
+
+	if (base->mtx)
+		pthread_mutex_unlock(base->mtx);
+}
+
+/**
+ * @brief Let the hypervisor complete the queue notifications of a vq.
+ *
+ * The guest kick of the queue is then completed by the hypervisor without
+ * an ioreq round trip, and the vq notify callback runs from vm_loop.
+ * Nothing is done if the hypervisor does not support it.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param enable Whether to register or unregister the kick.
+ *
+ * @return None
+ */
+void
+virtio_vq_set_hv_kick(struct virtio_vq_info *vq, bool enable)
+{
+	struct virtio_base *base = vq->base;
+	struct pcibar *bar;
+	uint64_t addr, data = vq->num;
+	uint32_t flags;
+
+	if (vq->hv_ioeventfd >= 0) {
+		hv_ioeventfd_del(base->dev->vmctx, vq->hv_ioeventfd);
+		vq->hv_ioeventfd = -1;
+	}
+
+	if (!enable)
+		return;
+
+	/* the same doorbells as vhost_vq_register_eventfd() */
+	if (base->device_caps & ACRN_VIRTIO_F_VERSION_1) {
+		if (base->modern_pio_bar_idx) {
+			bar = &base->dev->bar[base->modern_pio_bar_idx];
+			addr = bar->addr;
+			flags = HV_IOEVENTFD_FLAG_DATAMATCH |
+				HV_IOEVENTFD_FLAG_PIO;
+		} else if (base->modern_mmio_bar_idx) {
+			bar = &base->dev->bar[base->modern_mmio_bar_idx];
+			addr = bar->addr + VIRTIO_CAP_NOTIFY_OFFSET +
+				vq->num * VIRTIO_MODERN_NOTIFY_OFF_MULT;
+			flags = 0;
+		} else
+			return;
+	} else {
+		bar = &base->dev->bar[base->legacy_pio_bar_idx];
+		addr = bar->addr + VIRTIO_CR_QNOTIFY;
+		flags = HV_IOEVENTFD_FLAG_DATAMATCH | HV_IOEVENTFD_FLAG_PIO;
+	}
+
+	/* BAR not programmed yet, keep the regular notify path */
+	if (bar->addr == 0)
+		return;
+
+	vq->hv_ioeventfd = hv_ioeventfd_add(base->dev->vmctx, addr, 2,
+					    flags, data, virtio_vq_hv_kick, vq);
+}
+
 /**
  * @brief Set I/O BAR (usually 0) to map PCI config registers.
  *
@@ -307,6 +647,60 @@ virtio_vq_init(struct virtio_base *base, uint32_t pfn)
 	vq->flags = VQ_ALLOC;
 	vq->last_avail = 0;
 	vq->save_used = 0;
+
+	virtio_vq_set_hv_kick(vq, pfn != 0);
+}
+
+/*
+ * The same for a packed ring: the guest gave us the gpa of the ring,
+ * and of the driver and device event suppression structures in place
+ * of the avail and used rings.
+ */
+static void
+virtio_vq_enable_packed(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	uint16_t *chain_len;
+	uint64_t phys;
+	size_t size;
+	char *vb;
+
+	/* the length of each chain, to skip it once it is used */
+	chain_len = realloc(vq->chain_len, vq->qsize * sizeof(uint16_t));
+	if (chain_len == NULL) {
+		fprintf(stderr, "%s: vq %d: no memory for the packed ring\r\n",
+			base->vops->name, vq->num);
+		return;
+	}
+	memset(chain_len, 0, vq->qsize * sizeof(uint16_t));
+	vq->chain_len = chain_len;
+
+	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
+	size = vq->qsize * sizeof(struct virtio_packed_desc);
+	vb = paddr_guest2host(base->dev->vmctx, phys, size);
+	vq->pdesc = (struct virtio_packed_desc *)vb;
+
+	phys = (((uint64_t)vq->gpa_avail[1]) << 32) | vq->gpa_avail[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+			      sizeof(struct virtio_packed_event));
+	vq->driver_event = (struct virtio_packed_event *)vb;
+
+	phys = (((uint64_t)vq->gpa_used[1]) << 32) | vq->gpa_used[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+			      sizeof(struct virtio_packed_event));
+	vq->device_event = (struct virtio_packed_event *)vb;
+
+	/* Mark queue as allocated, and start at 0 when we use it. */
+	vq->flags = VQ_ALLOC | VQ_PACKED;
+	vq->last_avail = 0;
+	vq->avail_wrap = true;
+	vq->used_idx = 0;
+	vq->used_wrap = true;
+	vq->save_used = 1 << 15;
+
+	/* Mark queue as enabled. */
+	vq->enabled = true;
+
+	virtio_vq_set_hv_kick(vq, true);
 }
 
 /*
@@ -327,6 +721,11 @@ virtio_vq_enable(struct virtio_base *base)
 	vq = &base->queues[base->curq];
 	qsz = vq->qsize;
 
+	if (base->negotiated_caps & ACRN_VIRTIO_F_RING_PACKED) {
+		virtio_vq_enable_packed(base, vq);
+		return;
+	}
+
 	/* descriptors */
 	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
 	size = qsz * sizeof(struct virtio_desc);
@@ -352,14 +751,16 @@ virtio_vq_enable(struct virtio_base *base)
 
 	/* Mark queue as enabled. */
 	vq->enabled = true;
+
+	virtio_vq_set_hv_kick(vq, true);
 }
 
 /*
  * Helper inline for vq_getchain(): record the i'th "real"
- * descriptor.
+ * descriptor, from the copy vq_getchain() took of it.
  */
 static inline void
-_vq_record(int i, volatile struct virtio_desc *vd, struct vmctx *ctx,
+_vq_record(int i, const struct virtio_desc *vd, struct vmctx *ctx,
 	   struct iovec *iov, int n_iov, uint16_t *flags) {
 
 	if (i >= n_iov)
@@ -368,9 +769,122 @@ _vq_record(int i, volatile struct virtio_desc *vd, struct vmctx *ctx,
 	iov[i].iov_len = vd->len;
 	if (flags != NULL)
 		flags[i] = vd->flags;
+	if (vd->flags & ACRN_VRING_DESC_F_WRITE) {
+		migration_log_write(vd->addr, vd->len);
+		dedup_prepare_write(vd->addr, vd->len);
+	}
 }
 #define	VQ_MAX_DESCRIPTORS	512	/* see below */
 
+/*
+ * Indirect tables up to this many entries are copied at once out of the
+ * guest memory, in vq_getchain(), and walked from the copy.
+ */
+#define	VQ_INDIR_SNAPSHOT	128
+
+/* the same for a descriptor of a packed ring, or of its indirect table */
+static inline void
+_vq_record_packed(int i, volatile struct virtio_packed_desc *vd,
+		  struct vmctx *ctx, struct iovec *iov, int n_iov,
+		  uint16_t *flags)
+{
+	if (i >= n_iov)
+		return;
+	iov[i].iov_base = paddr_guest2host(ctx, vd->addr, vd->len);
+	iov[i].iov_len = vd->len;
+	if (flags != NULL)
+		flags[i] = vd->flags;
+	if (vd->flags & ACRN_VRING_DESC_F_WRITE) {
+		migration_log_write(vd->addr, vd->len);
+		dedup_prepare_write(vd->addr, vd->len);
+	}
+}
+
+/*
+ * vq_getchain() of a packed ring: the chain is in the descriptors from
+ * last_avail on, an indirect one pointing to a table whose entries are
+ * all used in order, and its buffer id is in its last descriptor.
+ */
+static int
+vq_getchain_packed(struct virtio_vq_info *vq, uint16_t *pidx,
+		   struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	volatile struct virtio_packed_desc *vd, *vindir;
+	struct virtio_base *base = vq->base;
+	const char *name = base->vops->name;
+	struct vmctx *ctx = base->dev->vmctx;
+	u_int i = 0, j, n_indir, ndesc = 0;
+
+	if (!vq_has_descs(vq))
+		return 0;
+
+	/*
+	 * The guest makes the head available last, once the rest of the
+	 * chain is valid; the volatile reads keep them in order.
+	 */
+	do {
+		vd = &vq->pdesc[vq->last_avail];
+		if (++vq->last_avail == vq->qsize) {
+			vq->last_avail = 0;
+			vq->avail_wrap = !vq->avail_wrap;
+		}
+		if (++ndesc > vq->qsize) {
+			fprintf(stderr,
+			    "%s: chain longer than the ring, "
+			    "driver confused?\r\n",
+			    name);
+			return -1;
+		}
+
+		if ((vd->flags & ACRN_VRING_DESC_F_INDIRECT) == 0) {
+			_vq_record_packed(i, vd, ctx, iov, n_iov, flags);
+			i++;
+		} else if ((base->device_caps &
+		    ACRN_VIRTIO_RING_F_INDIRECT_DESC) == 0) {
+			fprintf(stderr,
+			    "%s: descriptor has forbidden INDIRECT flag, "
+			    "driver confused?\r\n",
+			    name);
+			return -1;
+		} else {
+			n_indir = vd->len / 16;
+			if ((vd->len & 0xf) || n_indir == 0 ||
+			    n_indir > VQ_MAX_DESCRIPTORS) {
+				fprintf(stderr,
+				    "%s: invalid indir len 0x%x, "
+				    "driver confused?\r\n",
+				    name, (u_int)vd->len);
+				return -1;
+			}
+			vindir = paddr_guest2host(ctx, vd->addr, vd->len);
+			for (j = 0; j < n_indir; j++) {
+				_vq_record_packed(i, &vindir[j], ctx, iov,
+						  n_iov, flags);
+				i++;
+			}
+		}
+		if (i > VQ_MAX_DESCRIPTORS) {
+			fprintf(stderr,
+			    "%s: descriptor loop? count > %d - "
+			    "driver confused?\r\n",
+			    name, i);
+			return -1;
+		}
+	} while (vd->flags & ACRN_VRING_DESC_F_NEXT);
+
+	*pidx = vd->id;
+	if (vd->id >= vq->qsize) {
+		fprintf(stderr,
+		    "%s: buffer id %u out of range, driver confused?\r\n",
+		    name, (u_int)vd->id);
+		return -1;
+	}
+	vq->chain_len[vd->id] = ndesc;
+	vq->stats.chains++;
+	vq->stats.descs += i;
+	return i;
+}
+
 /*
  * Examine the chain of descriptors starting at the "next one" to
  * make sure that they describe a sensible request.  If so, return
@@ -418,11 +932,15 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 	u_int ndesc, n_indir;
 	u_int idx, next;
 
-	volatile struct virtio_desc *vdir, *vindir, *vp;
+	volatile struct virtio_desc *vindir;
+	struct virtio_desc vdir, vp, indir[VQ_INDIR_SNAPSHOT];
 	struct vmctx *ctx;
 	struct virtio_base *base;
 	const char *name;
 
+	if (vq->flags & VQ_PACKED)
+		return vq_getchain_packed(vq, pidx, iov, n_iov, flags);
+
 	base = vq->base;
 	name = base->vops->name;
 
@@ -458,11 +976,16 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 	 * To prevent loops, we could be more complicated and
 	 * check whether we're re-visiting a previously visited
 	 * index, but we just abort if the count gets excessive.
+	 *
+	 * Each descriptor is read once out of the guest memory, into a
+	 * local copy, rather than field by field through the volatile
+	 * mapping; the checks and the iov are then made on that copy,
+	 * which the guest cannot change underneath them.
 	 */
 	ctx = base->dev->vmctx;
 	*pidx = next = vq->avail->ring[idx & (vq->qsize - 1)];
 	vq->last_avail++;
-	for (i = 0; i < VQ_MAX_DESCRIPTORS; next = vdir->next) {
+	for (i = 0; i < VQ_MAX_DESCRIPTORS; next = vdir.next) {
 		if (next >= vq->qsize) {
 			fprintf(stderr,
 			    "%s: descriptor index %u out of range, "
@@ -470,9 +993,9 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 			    name, next);
 			return -1;
 		}
-		vdir = &vq->desc[next];
-		if ((vdir->flags & ACRN_VRING_DESC_F_INDIRECT) == 0) {
-			_vq_record(i, vdir, ctx, iov, n_iov, flags);
+		vdir = vq->desc[next];
+		if ((vdir.flags & ACRN_VRING_DESC_F_INDIRECT) == 0) {
+			_vq_record(i, &vdir, ctx, iov, n_iov, flags);
 			i++;
 		} else if ((base->device_caps &
 		    ACRN_VIRTIO_RING_F_INDIRECT_DESC) == 0) {
@@ -482,16 +1005,26 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 			    name);
 			return -1;
 		} else {
-			n_indir = vdir->len / 16;
-			if ((vdir->len & 0xf) || n_indir == 0) {
+			n_indir = vdir.len / 16;
+			if ((vdir.len & 0xf) || n_indir == 0) {
 				fprintf(stderr,
 				    "%s: invalid indir len 0x%x, "
 				    "driver confused?\r\n",
-				    name, (u_int)vdir->len);
+				    name, (u_int)vdir.len);
 				return -1;
 			}
 			vindir = paddr_guest2host(ctx,
-			    vdir->addr, vdir->len);
+			    vdir.addr, vdir.len);
+			if (vindir == NULL) {
+				fprintf(stderr,
+				    "%s: invalid indir addr 0x%lx, "
+				    "driver confused?\r\n",
+				    name, (uint64_t)vdir.addr);
+				return -1;
+			}
+			/* a single read of the whole table, if it fits */
+			if (n_indir <= VQ_INDIR_SNAPSHOT)
+				memcpy(indir, (const void *)vindir, vdir.len);
 			/*
 			 * Indirects start at the 0th, then follow
 			 * their own embedded "next"s until those run
@@ -501,20 +1034,23 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 			 */
 			next = 0;
 			for (;;) {
-				vp = &vindir[next];
-				if (vp->flags & ACRN_VRING_DESC_F_INDIRECT) {
+				if (n_indir <= VQ_INDIR_SNAPSHOT)
+					vp = indir[next];
+				else
+					vp = vindir[next];
+				if (vp.flags & ACRN_VRING_DESC_F_INDIRECT) {
 					fprintf(stderr,
 					    "%s: indirect desc has INDIR flag,"
 					    " driver confused?\r\n",
 					    name);
 					return -1;
 				}
-				_vq_record(i, vp, ctx, iov, n_iov, flags);
+				_vq_record(i, &vp, ctx, iov, n_iov, flags);
 				if (++i > VQ_MAX_DESCRIPTORS)
 					goto loopy;
-				if ((vp->flags & ACRN_VRING_DESC_F_NEXT) == 0)
+				if ((vp.flags & ACRN_VRING_DESC_F_NEXT) == 0)
 					break;
-				next = vp->next;
+				next = vp.next;
 				if (next >= n_indir) {
 					fprintf(stderr,
 					    "%s: invalid next %u > %u, "
@@ -524,8 +1060,11 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 				}
 			}
 		}
-		if ((vdir->flags & ACRN_VRING_DESC_F_NEXT) == 0)
+		if ((vdir.flags & ACRN_VRING_DESC_F_NEXT) == 0) {
+			vq->stats.chains++;
+			vq->stats.descs += i;
 			return i;
+		}
 	}
 loopy:
 	fprintf(stderr,
@@ -543,7 +1082,61 @@ loopy:
 void
 vq_retchain(struct virtio_vq_info *vq)
 {
-	vq->last_avail--;
+	uint16_t prev;
+
+	if ((vq->flags & VQ_PACKED) == 0) {
+		vq->last_avail--;
+		return;
+	}
+
+	/*
+	 * Back to the head of the chain: the descriptor before it ends
+	 * the previous chain, or is already used, and has no NEXT.
+	 */
+	do {
+		if (vq->last_avail == 0) {
+			vq->last_avail = vq->qsize;
+			vq->avail_wrap = !vq->avail_wrap;
+		}
+		vq->last_avail--;
+		prev = vq->last_avail ? vq->last_avail - 1 : vq->qsize - 1;
+	} while (vq->pdesc[prev].flags & ACRN_VRING_DESC_F_NEXT);
+}
+
+/*
+ * vq_relchain_batch() of a packed ring: the used descriptors go from
+ * used_idx on, the flags of the first one written last to hand them all
+ * to the guest at once.
+ */
+static void
+vq_relchain_packed(struct virtio_vq_info *vq, const struct virtio_used *used,
+		   int n)
+{
+	volatile struct virtio_packed_desc *vd;
+	uint16_t head, head_flags, flags, ndesc;
+	int i;
+
+	head = vq->used_idx;
+	head_flags = vq->used_wrap ?
+		ACRN_VRING_DESC_F_AVAIL | ACRN_VRING_DESC_F_USED : 0;
+	for (i = 0; i < n; i++) {
+		vd = &vq->pdesc[vq->used_idx];
+		vd->id = used[i].idx;
+		vd->len = used[i].tlen;
+		flags = vq->used_wrap ?
+			ACRN_VRING_DESC_F_AVAIL | ACRN_VRING_DESC_F_USED : 0;
+		if (i > 0)
+			vd->flags = flags;
+
+		ndesc = vq->chain_len[used[i].idx] ?
+			vq->chain_len[used[i].idx] : 1;
+		vq->used_idx += ndesc;
+		if (vq->used_idx >= vq->qsize) {
+			vq->used_idx -= vq->qsize;
+			vq->used_wrap = !vq->used_wrap;
+		}
+	}
+	vq->pdesc[head].flags = head_flags;
 }
 
 /*
@@ -555,10 +1148,25 @@ vq_retchain(struct virtio_vq_info *vq)
  */
 void
 vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
+{
+	struct virtio_used used = { .idx = idx, .tlen = iolen };
+
+	vq_relchain_batch(vq, &used, 1);
+}
+
+/*
+ * Return @n request chains to the guest, the heads and I/O lengths in
+ * @used, with a single update of the used index, so that the guest sees
+ * them all at once.
+ */
+void
+vq_relchain_batch(struct virtio_vq_info *vq, const struct virtio_used *used,
+		  int n)
 {
 	uint16_t uidx, mask;
 	volatile struct virtio_vring_used *vuh;
 	volatile struct virtio_used *vue;
+	int i;
 
 	/*
 	 * Notes:
@@ -570,16 +1178,68 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	 * (I apologize for the two fields named idx; the
 	 * virtio spec calls the one that vue points to, "id"...)
 	 */
+	if (n <= 0)
+		return;
+
+	vq->stats.used += n;
+	if (vq->flags & VQ_PACKED) {
+		vq_relchain_packed(vq, used, n);
+		return;
+	}
+
 	mask = vq->qsize - 1;
 	vuh = vq->used;
 
 	uidx = vuh->idx;
-	vue = &vuh->ring[uidx++ & mask];
-	vue->idx = idx;
-	vue->tlen = iolen;
+	for (i = 0; i < n; i++) {
+		vue = &vuh->ring[uidx++ & mask];
+		vue->idx = used[i].idx;
+		vue->tlen = used[i].tlen;
+	}
 	vuh->idx = uidx;
 }
 
+/*
+ * vq_endchains() of a packed ring, the guest saying in its event
+ * suppression whether it wants the interrupt, or with EVENT_IDX at
+ * which used position.
+ */
+static void
+vq_endchains_packed(struct virtio_vq_info *vq, int used_all_avail)
+{
+	struct virtio_base *base = vq->base;
+	uint16_t old_idx, new_idx, off_wrap, count;
+	int event, intr;
+
+	old_idx = vq->save_used & 0x7fff;
+	new_idx = vq->used_idx;
+	count = new_idx - old_idx;
+	if ((vq->save_used >> 15) != vq->used_wrap)
+		count += vq->qsize;
+	vq->save_used = new_idx | (vq->used_wrap << 15);
+
+	if (used_all_avail &&
+	    (base->negotiated_caps & ACRN_VIRTIO_F_NOTIFY_ON_EMPTY))
+		intr = 1;
+	else if (count == 0 ||
+	    vq->driver_event->flags == ACRN_VRING_EVENT_F_DISABLE)
+		intr = 0;
+	else if (vq->driver_event->flags == ACRN_VRING_EVENT_F_DESC &&
+	    (base->negotiated_caps & ACRN_VIRTIO_RING_F_EVENT_IDX)) {
+		/* the event offset is taken back to the wrap of used_idx */
+		off_wrap = vq->driver_event->off_wrap;
+		event = off_wrap & 0x7fff;
+		if ((off_wrap >> 15) != vq->used_wrap)
+			event -= vq->qsize;
+		intr = (uint16_t)(new_idx - event - 1) < count;
+	} else
+		intr = 1;
+	if (intr)
+		vq_interrupt(base, vq);
+	else if (count != 0)
+		vq->stats.suppressed++;
+}
+
 /*
  * Driver has finished processing "available" chains and calling
  * vq_relchain on each one.  If driver used all the available
@@ -612,6 +1272,12 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 	 * entire avail was processed, we need to interrupt always.
 	 */
 	base = vq->base;
+	vq->stats.endchains++;
+	if (vq->flags & VQ_PACKED) {
+		vq_endchains_packed(vq, used_all_avail);
+		return;
+	}
+
 	old_idx = vq->save_used;
 	vq->save_used = new_idx = vq->used->idx;
 	if (used_all_avail &&
@@ -631,6 +1297,8 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 	}
 	if (intr)
 		vq_interrupt(base, vq);
+	else if (new_idx != old_idx)
+		vq->stats.suppressed++;
 }
 
 /**
@@ -650,11 +1318,31 @@ void vq_clear_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *v
 	int backend_type = base->backend_type;
 	int polling_in_progress = base->polling_in_progress;
 
-	/* we should never unmask notification in polling mode */
-	if (virtio_poll_enabled && backend_type == BACKEND_VBSU && polling_in_progress == 1)
+	/* we should never unmask notification of a polled queue */
+	if (virtio_poll_enabled && backend_type == BACKEND_VBSU &&
+	    polling_in_progress == 1 && vq->poll_period != 0)
 		return;
 
-	vq->used->flags &= ~ACRN_VRING_USED_F_NO_NOTIFY;
+	if (vq->flags & VQ_PACKED)
+		vq->device_event->flags = ACRN_VRING_EVENT_F_ENABLE;
+	else
+		vq->used->flags &= ~ACRN_VRING_USED_F_NO_NOTIFY;
+}
+
+/**
+ * @brief Helper function for setting used ring flags.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return None
+ */
+void vq_set_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	if (vq->flags & VQ_PACKED)
+		vq->device_event->flags = ACRN_VRING_EVENT_F_DISABLE;
+	else
+		vq->used->flags |= ACRN_VRING_USED_F_NO_NOTIFY;
 }
 
 struct config_reg {
@@ -949,6 +1637,7 @@ bad:
 			goto done;
 		}
 		vq = &base->queues[value];
+		virtio_vq_kicked(base, vq);
 		if (vq->notify)
 			(*vq->notify)(DEV_STRUCT(base), vq);
 		else if (vops->qnotify)
@@ -964,17 +1653,8 @@ bad:
 			(*vops->set_status)(DEV_STRUCT(base), value);
 		if (value == 0)
 			(*vops->reset)(DEV_STRUCT(base));
-		if ((value & VIRTIO_CR_STATUS_DRIVER_OK) &&
-		     base->backend_type == BACKEND_VBSU &&
-		     virtio_poll_enabled) {
-			base->polling_timer.clockid = CLOCK_MONOTONIC;
-			acrn_timer_init(&base->polling_timer, virtio_poll_timer, base);
-			/* wait 5s to start virtio poll mode
-			 * skip vsbl and make sure device initialization completed
-			 * FIXME: Need optimization in the future
-			 */
-			virtio_start_timer(&base->polling_timer, 5, 0);
-		}
+		if (value & VIRTIO_CR_STATUS_DRIVER_OK)
+			virtio_poll_start(base);
 		break;
 	case VIRTIO_CR_CFGVEC:
 		base->msix_cfg_idx = value;
@@ -1091,6 +1771,11 @@ virtio_set_modern_mmio_bar(struct virtio_base *base, int barnum)
 				VIRTIO_MODERN_MEM_BAR_SIZE);
 	assert(rc == 0);
 
+	/* queue notifications are pure doorbells, don't block the vcpu */
+	pci_emul_set_posted_window(base->dev, barnum,
+				   VIRTIO_CAP_NOTIFY_OFFSET,
+				   VIRTIO_CAP_NOTIFY_SIZE);
+
 	base->cfg_coff = virtio_find_capability(base, VIRTIO_PCI_CAP_PCI_CFG);
 	if (base->cfg_coff < 0) {
 		fprintf(stderr,
@@ -1157,6 +1842,10 @@ virtio_set_modern_bar(struct virtio_base *base, bool use_notify_pio)
 	if (!vops || (base->device_caps & ACRN_VIRTIO_F_VERSION_1) == 0)
 		return -1;
 
+	/* the rings of the user space devices all go through vq_getchain() */
+	if (base->backend_type == BACKEND_VBSU)
+		base->device_caps |= ACRN_VIRTIO_F_RING_PACKED;
+
 	if (use_notify_pio)
 		rc = virtio_set_modern_pio_bar(base,
 			VIRTIO_MODERN_PIO_BAR_IDX);
@@ -1400,7 +2089,8 @@ virtio_common_cfg_write(struct pci_vdev *dev, uint64_t offset, int size,
 			(*vops->set_status)(DEV_STRUCT(base), value);
 		if (base->status == 0)
 			(*vops->reset)(DEV_STRUCT(base));
-		/* TODO: virtio poll mode for modern devices */
+		if (base->status & VIRTIO_CR_STATUS_DRIVER_OK)
+			virtio_poll_start(base);
 		break;
 	case VIRTIO_COMMON_Q_SELECT:
 		/*
@@ -1574,6 +2264,9 @@ virtio_notify_cfg_write(struct pci_vdev *dev, uint64_t offset, int size,
 	}
 
 	vq = &base->queues[idx];
+	VIRTIO_BASE_LOCK(base);
+	virtio_vq_kicked(base, vq);
+	VIRTIO_BASE_UNLOCK(base);
 	if (vq->notify)
 		(*vq->notify)(DEV_STRUCT(base), vq);
 	else if (vops->qnotify)
@@ -1743,6 +2436,7 @@ virtio_pci_modern_pio_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		pthread_mutex_lock(base->mtx);
 
 	vq = &base->queues[idx];
+	virtio_vq_kicked(base, vq);
 	if (vq->notify)
 		(*vq->notify)(DEV_STRUCT(base), vq);
 	else if (vops->qnotify)
@@ -1817,6 +2511,145 @@ virtio_pci_read(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
  *
  * @return None
  */
+void
+virtio_pci_reset(struct vmctx *ctx, struct pci_vdev *dev)
+{
+	struct virtio_base *base = dev->arg;
+	struct virtio_ops *vops = base->vops;
+
+	VIRTIO_BASE_LOCK(base);
+	base->status = 0;
+	if (vops->set_status)
+		(*vops->set_status)(DEV_STRUCT(base), 0);
+	(*vops->reset)(DEV_STRUCT(base));
+	VIRTIO_BASE_UNLOCK(base);
+}
+
+/* the transport state of a device in a snapshot, then one per queue */
+struct virtio_state {
+	uint64_t	negotiated_caps;
+	uint32_t	nvq;
+	uint32_t	curq;
+	uint32_t	device_feature_select;
+	uint32_t	driver_feature_select;
+	uint16_t	msix_cfg_idx;
+	uint8_t		status;
+	uint8_t		isr;
+	uint8_t		config_generation;
+	uint8_t		rsvd[7];
+};
+
+struct virtio_vq_state {
+	uint32_t	pfn;
+	uint32_t	gpa_desc[2];
+	uint32_t	gpa_avail[2];
+	uint32_t	gpa_used[2];
+	uint16_t	qsize;
+	uint16_t	last_avail;
+	uint16_t	save_used;
+	uint16_t	msix_idx;
+	uint8_t		enabled;
+	uint8_t		wrap;		/* avail, used wrap counters */
+	uint16_t	used_idx;
+};
+
+int
+virtio_pci_save(struct vmctx *ctx, struct pci_vdev *dev, void *buf,
+		size_t len)
+{
+	struct virtio_base *base = dev->arg;
+	struct virtio_state *st = buf;
+	struct virtio_vq_state *vqs = (struct virtio_vq_state *)(st + 1);
+	struct virtio_vq_info *vq;
+	int i, nvq = base->vops->nvq;
+
+	if (sizeof(*st) + nvq * sizeof(*vqs) > len)
+		return -1;
+
+	VIRTIO_BASE_LOCK(base);
+	memset(st, 0, sizeof(*st) + nvq * sizeof(*vqs));
+	st->negotiated_caps = base->negotiated_caps;
+	st->nvq = nvq;
+	st->curq = base->curq;
+	st->device_feature_select = base->device_feature_select;
+	st->driver_feature_select = base->driver_feature_select;
+	st->msix_cfg_idx = base->msix_cfg_idx;
+	st->status = base->status;
+	st->isr = base->isr;
+	st->config_generation = base->config_generation;
+
+	for (vq = base->queues, i = 0; i < nvq; vq++, i++) {
+		vqs[i].pfn = vq->pfn;
+		memcpy(vqs[i].gpa_desc, vq->gpa_desc, sizeof(vq->gpa_desc));
+		memcpy(vqs[i].gpa_avail, vq->gpa_avail, sizeof(vq->gpa_avail));
+		memcpy(vqs[i].gpa_used, vq->gpa_used, sizeof(vq->gpa_used));
+		vqs[i].qsize = vq->qsize;
+		vqs[i].last_avail = vq->last_avail;
+		vqs[i].save_used = vq->save_used;
+		vqs[i].msix_idx = vq->msix_idx;
+		vqs[i].enabled = vq->enabled;
+		vqs[i].wrap = vq->avail_wrap | (vq->used_wrap << 1);
+		vqs[i].used_idx = vq->used_idx;
+	}
+	VIRTIO_BASE_UNLOCK(base);
+
+	return sizeof(*st) + nvq * sizeof(*vqs);
+}
+
+int
+virtio_pci_load(struct vmctx *ctx, struct pci_vdev *dev, const void *buf,
+		size_t len)
+{
+	struct virtio_base *base = dev->arg;
+	struct virtio_ops *vops = base->vops;
+	const struct virtio_state *st = buf;
+	const struct virtio_vq_state *vqs =
+			(const struct virtio_vq_state *)(st + 1);
+	struct virtio_vq_info *vq;
+	int i, nvq = vops->nvq;
+
+	if (len != sizeof(*st) + nvq * sizeof(*vqs) || st->nvq != nvq)
+		return -1;
+
+	VIRTIO_BASE_LOCK(base);
+	base->negotiated_caps = st->negotiated_caps;
+	base->device_feature_select = st->device_feature_select;
+	base->driver_feature_select = st->driver_feature_select;
+	base->msix_cfg_idx = st->msix_cfg_idx;
+	base->isr = st->isr;
+	base->config_generation = st->config_generation;
+
+	/* the rings are mapped as if the guest had just set them up */
+	for (vq = base->queues, i = 0; i < nvq; vq++, i++) {
+		vq->qsize = vqs[i].qsize;
+		vq->msix_idx = vqs[i].msix_idx;
+		memcpy(vq->gpa_desc, vqs[i].gpa_desc, sizeof(vq->gpa_desc));
+		memcpy(vq->gpa_avail, vqs[i].gpa_avail, sizeof(vq->gpa_avail));
+		memcpy(vq->gpa_used, vqs[i].gpa_used, sizeof(vq->gpa_used));
+		base->curq = i;
+		if (vqs[i].pfn != 0)
+			virtio_vq_init(base, vqs[i].pfn);
+		else if (vqs[i].enabled)
+			virtio_vq_enable(base);
+		vq->last_avail = vqs[i].last_avail;
+		vq->save_used = vqs[i].save_used;
+		vq->avail_wrap = vqs[i].wrap & 1;
+		vq->used_wrap = (vqs[i].wrap >> 1) & 1;
+		vq->used_idx = vqs[i].used_idx;
+	}
+	base->curq = st->curq;
+
+	if (vops->apply_features)
+		(*vops->apply_features)(DEV_STRUCT(base),
+			base->negotiated_caps);
+	base->status = st->status;
+	if (vops->set_status)
+		(*vops->set_status)(DEV_STRUCT(base), base->status);
+	VIRTIO_BASE_UNLOCK(base);
+
+	return 0;
+}
+
 void
 virtio_pci_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		 int baridx, uint64_t offset, int size, uint64_t value)
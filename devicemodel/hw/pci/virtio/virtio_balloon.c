@@ -0,0 +1,667 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * virtio memory balloon, with free page reporting.
+ *
+ * The 4K pages the guest puts in the balloon, and the free ranges it
+ * reports, are given back to the SOS a hugepage at a time, once the whole
+ * hugepage of the hugetlbfs mapping backing the guest memory is free:
+ * the hugepage is taken out of the EPT of the guest and its hole punched
+ * in the hugetlbfs file. It is backed and mapped again when the guest
+ * deflates one of its pages or, as reported pages are reused without
+ * telling the device, on the first access of the guest to it, which then
+ * comes here as MMIO.
+ *
+ * Memory is not given back while a passthrough device is set up, as its
+ * DMA to a released page would not fault.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "dm.h"
+#include "pci_core.h"
+#include "virtio.h"
+#include "vmmapi.h"
+#include "mem.h"
+#include "balloon.h"
+#include "dedup.h"
+
+#define VIRTIO_BALLOON_RINGSZ	128
+/* a chain of inflated pfns is one buffer, of reported ranges up to 32 */
+#define VIRTIO_BALLOON_MAXSEGS	64
+
+#define VIRTIO_BALLOON_PFN_SHIFT	12
+
+/* Capability bits */
+#define VIRTIO_BALLOON_F_MUST_TELL_HOST	(1 << 0)	/* Tell before reuse */
+#define VIRTIO_BALLOON_F_DEFLATE_ON_OOM	(1 << 2)	/* Deflate on guest OOM */
+#define VIRTIO_BALLOON_F_REPORTING	(1 << 5)	/* Free page reporting */
+
+#define VIRTIO_BALLOON_S_HOSTCAPS		\
+	(VIRTIO_BALLOON_F_MUST_TELL_HOST |	\
+	VIRTIO_BALLOON_F_DEFLATE_ON_OOM |	\
+	VIRTIO_BALLOON_F_REPORTING)
+
+/*
+ * Queues, the reporting one comes third as the statistics and free page
+ * hint ones are not offered.
+ */
+#define VIRTIO_BALLOON_INFLATEQ	0
+#define VIRTIO_BALLOON_DEFLATEQ	1
+#define VIRTIO_BALLOON_REPORTQ	2
+#define VIRTIO_BALLOON_MAXQ	3
+
+/* the memory is tracked in 2M chunks, the smallest hugepage */
+#define BALLOON_CHUNK_SHIFT	21
+#define BALLOON_CHUNK_PAGES	(1U << (BALLOON_CHUNK_SHIFT - \
+					VIRTIO_BALLOON_PFN_SHIFT))
+
+struct virtio_balloon_config {
+	uint32_t num_pages;	/* target of the balloon, set by the device */
+	uint32_t actual;	/* of the balloon, set by the driver */
+} __attribute__((packed));
+
+struct balloon_chunk {
+	uint16_t	inflated;	/* 4K pages of it in the balloon */
+	bool		released;	/* backing given back to the SOS */
+};
+
+struct virtio_balloon {
+	struct virtio_base base;
+	struct virtio_vq_info queues[VIRTIO_BALLOON_MAXQ];
+	pthread_mutex_t mtx;		/* of the virtio base */
+	struct virtio_balloon_config cfg;
+	struct vmctx *ctx;
+
+	/* the state of the memory, protected by lock */
+	pthread_mutex_t lock;
+	bool reclaim;			/* release the free hugepages */
+	bool checked;			/* whether to release checked */
+	int hold;			/* no release, see balloon_hold() */
+	size_t lowmem;
+	size_t nr_pages;		/* of 4K of the guest memory */
+	uint64_t *inflated;		/* bitmap of the 4K pages */
+	struct balloon_chunk *chunks;
+	struct mem_range mr[2];		/* lowmem and highmem faults */
+	int nr_mr;
+	struct balloon_stats stats;
+};
+
+static int virtio_balloon_debug;
+#define DPRINTF(params) do { if (virtio_balloon_debug) printf params; } while (0)
+#define WPRINTF(params) (printf params)
+
+/* There is one balloon per VM, for the monitor to reach */
+static struct virtio_balloon *balloon_dev;
+
+static void virtio_balloon_reset(void *);
+static void virtio_balloon_notify(void *, struct virtio_vq_info *);
+static int virtio_balloon_cfgread(void *, int, int, uint32_t *);
+static int virtio_balloon_cfgwrite(void *, int, int, uint32_t);
+
+static struct virtio_ops virtio_balloon_ops = {
+	"virtio_balloon",		/* our name */
+	VIRTIO_BALLOON_MAXQ,		/* we support 3 virtqueues */
+	sizeof(struct virtio_balloon_config), /* config reg size */
+	virtio_balloon_reset,		/* reset */
+	virtio_balloon_notify,		/* device-wide qnotify */
+	virtio_balloon_cfgread,		/* read virtio config */
+	virtio_balloon_cfgwrite,	/* write virtio config */
+	NULL,				/* apply negotiated features */
+	NULL,				/* called on guest set status */
+};
+
+/* Index of the 4K page of @gpa in the guest memory, -1 if it is none */
+static ssize_t
+balloon_page_index(struct virtio_balloon *vb, vm_paddr_t gpa)
+{
+	if (gpa < vb->lowmem)
+		return gpa >> VIRTIO_BALLOON_PFN_SHIFT;
+	if (gpa >= 4 * GB && gpa - 4 * GB + vb->lowmem <
+			(vb->nr_pages << VIRTIO_BALLOON_PFN_SHIFT))
+		return (gpa - 4 * GB + vb->lowmem) >> VIRTIO_BALLOON_PFN_SHIFT;
+	return -1;
+}
+
+static struct balloon_chunk *
+balloon_chunk(struct virtio_balloon *vb, vm_paddr_t gpa)
+{
+	ssize_t index = balloon_page_index(vb, gpa);
+
+	return (index < 0) ? NULL : &vb->chunks[index / BALLOON_CHUNK_PAGES];
+}
+
+static void
+balloon_mark_released(struct virtio_balloon *vb, vm_paddr_t gpa, size_t len,
+		bool released)
+{
+	size_t off;
+
+	for (off = 0; off < len; off += 1UL << BALLOON_CHUNK_SHIFT)
+		balloon_chunk(vb, gpa + off)->released = released;
+}
+
+static bool
+balloon_can_reclaim(struct virtio_balloon *vb)
+{
+	if (!vb->checked) {
+		vb->checked = true;
+		if (vb->reclaim && pci_has_devtype("passthru")) {
+			WPRINTF(("virtio_balloon: passthrough device, "
+				"memory not given back\n"));
+			vb->reclaim = false;
+		}
+	}
+	return vb->reclaim;
+}
+
+/* Give a hugepage of the guest memory back to the SOS */
+static int
+balloon_release(struct virtio_balloon *vb, vm_paddr_t gpa, size_t len)
+{
+	uint64_t hva = (uint64_t)(vb->ctx->baseaddr + gpa);
+	int err;
+
+	if (!balloon_can_reclaim(vb) || vb->hold)
+		return 0;
+
+	/* a hugepage --dedup shares is not the guest's to give back */
+	err = dedup_prepare_write(gpa, len);
+	if (err != 0)
+		return err;
+
+	if (vm_unmap_memseg_vma(vb->ctx, len, gpa, hva) != 0) {
+		WPRINTF(("virtio_balloon: unmap 0x%lx@0x%lx failed: %s\n",
+			len, gpa, strerror(errno)));
+		return -errno;
+	}
+
+	err = hugetlb_release_range(gpa, len);
+	if (err != 0) {
+		WPRINTF(("virtio_balloon: release 0x%lx@0x%lx failed: %s\n",
+			len, gpa, strerror(-err)));
+		vm_map_memseg_vma(vb->ctx, len, gpa, hva, PROT_ALL);
+		return err;
+	}
+
+	balloon_mark_released(vb, gpa, len, true);
+	vb->stats.released += len;
+	DPRINTF(("virtio_balloon: released 0x%lx@0x%lx\n", len, gpa));
+	return 0;
+}
+
+/* Back and map again a hugepage balloon_release() gave back */
+static int
+balloon_populate(struct virtio_balloon *vb, vm_paddr_t gpa, size_t len)
+{
+	uint64_t hva = (uint64_t)(vb->ctx->baseaddr + gpa);
+	int err;
+
+	err = hugetlb_populate_range(gpa, len);
+	if (err != 0) {
+		WPRINTF(("virtio_balloon: no memory to back 0x%lx@0x%lx: %s\n",
+			len, gpa, strerror(-err)));
+		return err;
+	}
+
+	if (vm_map_memseg_vma(vb->ctx, len, gpa, hva, PROT_ALL) != 0) {
+		WPRINTF(("virtio_balloon: map 0x%lx@0x%lx failed: %s\n",
+			len, gpa, strerror(errno)));
+		return -errno;
+	}
+
+	balloon_mark_released(vb, gpa, len, false);
+	vb->stats.released -= len;
+	DPRINTF(("virtio_balloon: populated 0x%lx@0x%lx\n", len, gpa));
+	return 0;
+}
+
+/* Release the hugepage of @gpa if all its pages are in the balloon */
+static void
+balloon_try_release(struct virtio_balloon *vb, vm_paddr_t gpa)
+{
+	size_t pgsz = hugetlb_page_size(gpa), off;
+	struct balloon_chunk *chunk;
+
+	if (pgsz == 0)
+		return;
+	gpa &= ~(pgsz - 1);
+
+	for (off = 0; off < pgsz; off += 1UL << BALLOON_CHUNK_SHIFT) {
+		chunk = balloon_chunk(vb, gpa + off);
+		if (chunk == NULL || chunk->released ||
+				chunk->inflated != BALLOON_CHUNK_PAGES)
+			return;
+	}
+	balloon_release(vb, gpa, pgsz);
+}
+
+static void
+balloon_inflate(struct virtio_balloon *vb, uint32_t pfn)
+{
+	vm_paddr_t gpa = (vm_paddr_t)pfn << VIRTIO_BALLOON_PFN_SHIFT;
+	ssize_t index = balloon_page_index(vb, gpa);
+	struct balloon_chunk *chunk;
+
+	if (index < 0 || (vb->inflated[index / 64] & (1UL << (index % 64))))
+		return;
+
+	vb->inflated[index / 64] |= 1UL << (index % 64);
+	chunk = &vb->chunks[index / BALLOON_CHUNK_PAGES];
+	if (++chunk->inflated == BALLOON_CHUNK_PAGES)
+		balloon_try_release(vb, gpa);
+}
+
+static void
+balloon_deflate(struct virtio_balloon *vb, uint32_t pfn)
+{
+	vm_paddr_t gpa = (vm_paddr_t)pfn << VIRTIO_BALLOON_PFN_SHIFT;
+	ssize_t index = balloon_page_index(vb, gpa);
+	struct balloon_chunk *chunk;
+	size_t pgsz;
+
+	if (index < 0 || !(vb->inflated[index / 64] & (1UL << (index % 64))))
+		return;
+
+	vb->inflated[index / 64] &= ~(1UL << (index % 64));
+	chunk = &vb->chunks[index / BALLOON_CHUNK_PAGES];
+	chunk->inflated--;
+
+	/*
+	 * On failure, the access of the guest to the page tries again, see
+	 * balloon_fault().
+	 */
+	if (chunk->released) {
+		pgsz = hugetlb_page_size(gpa);
+		balloon_populate(vb, gpa & ~(pgsz - 1), pgsz);
+	}
+}
+
+/* Release the hugepages within a range the guest reports free */
+static void
+balloon_report(struct virtio_balloon *vb, const struct iovec *iov)
+{
+	vm_paddr_t gpa = (char *)iov->iov_base - vb->ctx->baseaddr;
+	vm_paddr_t end = gpa + iov->iov_len, page;
+	struct balloon_chunk *chunk;
+	size_t pgsz = hugetlb_page_size(gpa);
+
+	if (pgsz == 0)
+		return;
+
+	for (page = (gpa + pgsz - 1) & ~(pgsz - 1); page + pgsz <= end;
+			page += pgsz) {
+		chunk = balloon_chunk(vb, page);
+		if (chunk == NULL || chunk->released)
+			continue;
+		if (balloon_release(vb, page, pgsz) == 0)
+			vb->stats.reported++;
+	}
+}
+
+static void
+virtio_balloon_notify(void *vdev, struct virtio_vq_info *vq)
+{
+	struct virtio_balloon *vb = vdev;
+	struct iovec iov[VIRTIO_BALLOON_MAXSEGS];
+	int q = vq - vb->queues, n, i;
+	uint32_t *pfns;
+	size_t j;
+	uint16_t idx;
+
+	pthread_mutex_lock(&vb->lock);
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(vq, &idx, iov, VIRTIO_BALLOON_MAXSEGS, NULL);
+		if (n <= 0) {
+			WPRINTF(("virtio_balloon: bad chain on queue %d\n", q));
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (q == VIRTIO_BALLOON_REPORTQ) {
+				balloon_report(vb, &iov[i]);
+				continue;
+			}
+			pfns = iov[i].iov_base;
+			for (j = 0; j < iov[i].iov_len / sizeof(*pfns); j++) {
+				if (q == VIRTIO_BALLOON_INFLATEQ)
+					balloon_inflate(vb, pfns[j]);
+				else
+					balloon_deflate(vb, pfns[j]);
+			}
+		}
+		vq_relchain(vq, idx, 0);
+	}
+	pthread_mutex_unlock(&vb->lock);
+
+	vq_endchains(vq, 1);
+}
+
+/*
+ * An access of the guest to a page out of its EPT: back and map again the
+ * hugepage if still released, then do the access through the mapping of
+ * the DM.
+ */
+static int
+balloon_fault(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
+	      int size, uint64_t *val, void *arg1, long arg2)
+{
+	struct virtio_balloon *vb = arg1;
+	struct balloon_chunk *chunk;
+	size_t pgsz;
+	char *hva;
+	int err = 0;
+
+	pthread_mutex_lock(&vb->lock);
+	chunk = balloon_chunk(vb, addr);
+	if (chunk == NULL) {
+		pthread_mutex_unlock(&vb->lock);
+		return -1;
+	}
+	if (chunk->released) {
+		pgsz = hugetlb_page_size(addr);
+		err = balloon_populate(vb, addr & ~(pgsz - 1), pgsz);
+		vb->stats.refaults++;
+	}
+	pthread_mutex_unlock(&vb->lock);
+
+	if (err != 0)
+		return -1;
+
+	hva = ctx->baseaddr + addr;
+	if (dir == MEM_F_READ) {
+		*val = 0;
+		memcpy(val, hva, size);
+	} else {
+		/* with --dedup, this is the fault handler of its range too */
+		if (dedup_prepare_write(addr, size) != 0)
+			return -1;
+		memcpy(hva, val, size);
+	}
+	return 0;
+}
+
+static void
+virtio_balloon_reset(void *vdev)
+{
+	struct virtio_balloon *vb = vdev;
+	size_t index, pgsz;
+	vm_paddr_t gpa;
+
+	DPRINTF(("virtio_balloon: device reset requested !\n"));
+
+	/* the guest starts again with all its memory */
+	pthread_mutex_lock(&vb->lock);
+	for (index = 0; index < vb->nr_pages; index += BALLOON_CHUNK_PAGES) {
+		if (!vb->chunks[index / BALLOON_CHUNK_PAGES].released)
+			continue;
+		gpa = index << VIRTIO_BALLOON_PFN_SHIFT;
+		if (gpa >= vb->lowmem)
+			gpa += 4 * GB - vb->lowmem;
+		pgsz = hugetlb_page_size(gpa);
+		balloon_populate(vb, gpa & ~(pgsz - 1), pgsz);
+	}
+	memset(vb->inflated, 0, (vb->nr_pages + 63) / 64 * sizeof(uint64_t));
+	for (index = 0; index < vb->nr_pages / BALLOON_CHUNK_PAGES; index++)
+		vb->chunks[index].inflated = 0;
+	vb->cfg.actual = 0;
+	pthread_mutex_unlock(&vb->lock);
+
+	virtio_reset_dev(&vb->base);
+}
+
+static int
+virtio_balloon_cfgread(void *vdev, int offset, int size, uint32_t *retval)
+{
+	struct virtio_balloon *vb = vdev;
+	void *ptr;
+
+	/* our caller has already verified offset and size */
+	pthread_mutex_lock(&vb->lock);
+	ptr = (uint8_t *)&vb->cfg + offset;
+	memcpy(retval, ptr, size);
+	pthread_mutex_unlock(&vb->lock);
+	return 0;
+}
+
+static int
+virtio_balloon_cfgwrite(void *vdev, int offset, int size, uint32_t value)
+{
+	struct virtio_balloon *vb = vdev;
+
+	/* only "actual" is written by the driver */
+	if (offset != offsetof(struct virtio_balloon_config, actual) ||
+			size != sizeof(vb->cfg.actual)) {
+		DPRINTF(("virtio_balloon: write to readonly reg %d\n",
+			offset));
+		return -1;
+	}
+
+	pthread_mutex_lock(&vb->lock);
+	vb->cfg.actual = value;
+	pthread_mutex_unlock(&vb->lock);
+	return 0;
+}
+
+int
+balloon_set_target(uint32_t pages)
+{
+	struct virtio_balloon *vb = balloon_dev;
+
+	if (vb == NULL)
+		return -ENODEV;
+
+	pthread_mutex_lock(&vb->lock);
+	vb->cfg.num_pages = pages;
+	pthread_mutex_unlock(&vb->lock);
+
+	virtio_config_changed(&vb->base);
+	return 0;
+}
+
+void
+balloon_hold(bool hold)
+{
+	struct virtio_balloon *vb = balloon_dev;
+
+	if (vb == NULL)
+		return;
+
+	pthread_mutex_lock(&vb->lock);
+	vb->hold += hold ? 1 : -1;
+	pthread_mutex_unlock(&vb->lock);
+}
+
+bool
+balloon_released(vm_paddr_t gpa)
+{
+	struct virtio_balloon *vb = balloon_dev;
+	struct balloon_chunk *chunk;
+	bool released = false;
+
+	if (vb == NULL)
+		return false;
+
+	pthread_mutex_lock(&vb->lock);
+	chunk = balloon_chunk(vb, gpa);
+	if (chunk != NULL)
+		released = chunk->released;
+	pthread_mutex_unlock(&vb->lock);
+
+	return released;
+}
+
+int
+balloon_get_stats(struct balloon_stats *stats)
+{
+	struct virtio_balloon *vb = balloon_dev;
+
+	if (vb == NULL)
+		return -ENODEV;
+
+	pthread_mutex_lock(&vb->lock);
+	*stats = vb->stats;
+	stats->target = vb->cfg.num_pages;
+	stats->actual = vb->cfg.actual;
+	pthread_mutex_unlock(&vb->lock);
+	return 0;
+}
+
+static int
+balloon_register_faults(struct virtio_balloon *vb, vm_paddr_t base,
+			size_t size, const char *name)
+{
+	struct mem_range *mr = &vb->mr[vb->nr_mr];
+
+	if (size == 0)
+		return 0;
+
+	bzero(mr, sizeof(*mr));
+	mr->name = name;
+	mr->flags = MEM_F_RW;
+	mr->base = base;
+	mr->size = size;
+	mr->handler = balloon_fault;
+	mr->arg1 = vb;
+	if (register_mem_fallback(mr) != 0)
+		return -1;
+	vb->nr_mr++;
+	return 0;
+}
+
+static void
+virtio_balloon_free(struct virtio_balloon *vb)
+{
+	int i;
+
+	for (i = 0; i < vb->nr_mr; i++)
+		unregister_mem_fallback(&vb->mr[i]);
+	free(vb->inflated);
+	free(vb->chunks);
+	free(vb);
+}
+
+static int
+virtio_balloon_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_balloon *vb;
+	size_t highmem, target = 0;
+	char *opt, *val, *end;
+
+	if (balloon_dev != NULL) {
+		WPRINTF(("virtio_balloon: only one balloon per VM\n"));
+		return -1;
+	}
+
+	vb = calloc(1, sizeof(struct virtio_balloon));
+	if (!vb) {
+		WPRINTF(("virtio_balloon: calloc returns NULL\n"));
+		return -1;
+	}
+	vb->reclaim = true;
+
+	while ((opt = strsep(&opts, ",")) != NULL) {
+		val = opt;
+		opt = strsep(&val, "=");
+		if (strcmp(opt, "noreclaim") == 0) {
+			vb->reclaim = false;
+		} else if (strcmp(opt, "target") == 0 && val != NULL) {
+			target = strtoul(val, &end, 0);
+			if (*end != '\0' || end == val)
+				goto bad_opt;
+		} else if (*opt != '\0') {
+			goto bad_opt;
+		}
+	}
+
+	vb->ctx = ctx;
+	vb->lowmem = vm_get_lowmem_size(ctx);
+	highmem = vm_get_highmem_size(ctx);
+	vb->nr_pages = (vb->lowmem + highmem) >> VIRTIO_BALLOON_PFN_SHIFT;
+	vb->inflated = calloc((vb->nr_pages + 63) / 64, sizeof(uint64_t));
+	vb->chunks = calloc(vb->nr_pages / BALLOON_CHUNK_PAGES + 1,
+			sizeof(struct balloon_chunk));
+	if (vb->inflated == NULL || vb->chunks == NULL) {
+		WPRINTF(("virtio_balloon: calloc returns NULL\n"));
+		goto fail;
+	}
+
+	if (balloon_register_faults(vb, 0, vb->lowmem, "balloon lowmem") ||
+	    balloon_register_faults(vb, 4 * GB, highmem, "balloon highmem")) {
+		WPRINTF(("virtio_balloon: can not handle the faults\n"));
+		goto fail;
+	}
+
+	pthread_mutex_init(&vb->mtx, NULL);
+	pthread_mutex_init(&vb->lock, NULL);
+
+	virtio_linkup(&vb->base, &virtio_balloon_ops, vb, dev, vb->queues,
+		      BACKEND_VBSU);
+	vb->base.mtx = &vb->mtx;
+	vb->base.device_caps = VIRTIO_BALLOON_S_HOSTCAPS;
+	vb->queues[VIRTIO_BALLOON_INFLATEQ].qsize = VIRTIO_BALLOON_RINGSZ;
+	vb->queues[VIRTIO_BALLOON_DEFLATEQ].qsize = VIRTIO_BALLOON_RINGSZ;
+	vb->queues[VIRTIO_BALLOON_REPORTQ].qsize = VIRTIO_BALLOON_RINGSZ;
+
+	/* in MB, as 4K pages in the config */
+	vb->cfg.num_pages = target << (20 - VIRTIO_BALLOON_PFN_SHIFT);
+
+	/* initialize config space */
+	pci_set_cfgdata16(dev, PCIR_DEVICE, VIRTIO_DEV_BALLOON);
+	pci_set_cfgdata16(dev, PCIR_VENDOR, VIRTIO_VENDOR);
+	pci_set_cfgdata8(dev, PCIR_CLASS, PCIC_OTHER);
+	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, VIRTIO_TYPE_BALLOON);
+	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
+
+	if (virtio_interrupt_init(&vb->base, virtio_uses_msix()))
+		goto fail;
+	virtio_set_io_bar(&vb->base, 0);
+
+	balloon_dev = vb;
+	return 0;
+
+bad_opt:
+	WPRINTF(("virtio_balloon: bad option %s, "
+		"[noreclaim][,target=<MB>] expected\n", opt));
+fail:
+	virtio_balloon_free(vb);
+	return -1;
+}
+
+static void
+virtio_balloon_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_balloon *vb = dev->arg;
+
+	if (vb == NULL) {
+		DPRINTF(("%s: balloon is NULL\n", __func__));
+		return;
+	}
+
+	balloon_dev = NULL;
+	DPRINTF(("%s: free struct virtio_balloon!\n", __func__));
+	virtio_balloon_free(vb);
+}
+
+struct pci_vdev_ops pci_ops_virtio_balloon = {
+	.class_name	= "virtio-balloon",
+	.vdev_init	= virtio_balloon_init,
+	.vdev_deinit	= virtio_balloon_deinit,
+	.vdev_reset	= virtio_pci_reset,
+	.vdev_save	= virtio_pci_save,
+	.vdev_load	= virtio_pci_load,
+	.vdev_barwrite	= virtio_pci_write,
+	.vdev_barread	= virtio_pci_read
+};
+DEFINE_PCI_DEVTYPE(pci_ops_virtio_balloon);
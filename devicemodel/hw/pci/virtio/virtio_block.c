@@ -38,9 +38,23 @@
 #include "dm.h"
 #include "pci_core.h"
 #include "virtio.h"
+#include "vhost.h"
 #include "block_if.h"
+#include "dm_string.h"
 
 #define VIRTIO_BLK_RINGSZ	64
+#define VIRTIO_BLK_MAX_QUEUES	16
+
+/*
+ * Data segments of a request, "seg_max=" to BLOCKIF_IOV_MAX. A chain of
+ * more than the ring holds needs indirect descriptors, the guest sees no
+ * more than VIRTIO_BLK_DIRECT_SEGS until it negotiates them.
+ */
+#define VIRTIO_BLK_DIRECT_SEGS	(VIRTIO_BLK_RINGSZ - 2)
+
+/* in 512-byte sectors, writing the zeroes is the worst case of the latter */
+#define VIRTIO_BLK_MAX_DISCARD_SECTORS	(1U << 22)
+#define VIRTIO_BLK_MAX_WZ_SECTORS	(1U << 16)
 #define VIRTIO_BLK_MAX_OPTS_LEN	256
 
 #define VIRTIO_BLK_S_OK	0
@@ -58,6 +72,13 @@
 /* Device can toggle its cache between writeback and writethrough modes */
 #define	VIRTIO_BLK_F_CONFIG_WCE	(1 << 11)
 
+/* Device supports multiple virtqueues */
+#define	VIRTIO_BLK_F_MQ		(1 << 12)
+
+/* Device can discard and zero ranges, see the discard/write zeroes bits */
+#define	VIRTIO_BLK_F_DISCARD	(1 << 13)
+#define	VIRTIO_BLK_F_WRITE_ZEROES	(1 << 14)
+
 /*
  * Basic device capabilities
  */
@@ -74,6 +95,18 @@
 	(VIRTIO_BLK_F_FLUSH |	\
 	VIRTIO_BLK_F_CONFIG_WCE)
 
+/*
+ * Offered to a vhost-user backend, which masks those it hasn't. The cache
+ * mode is the one of the backend, the guest can not toggle it.
+ */
+#define VIRTIO_BLK_S_VHOSTCAPS		\
+	(VIRTIO_BLK_S_HOSTCAPS |	\
+	VIRTIO_BLK_F_FLUSH |		\
+	VIRTIO_BLK_F_DISCARD |		\
+	VIRTIO_BLK_F_WRITE_ZEROES)
+
+#define VIRTIO_BLK_VHOST_USER	"vhost-user="
+
 /*
  * Config space "registers"
  */
@@ -94,6 +127,15 @@ struct virtio_blk_config {
 		uint32_t opt_io_size;
 	} topology;
 	uint8_t	writeback;
+	uint8_t	unused;
+	uint16_t num_queues;
+	uint32_t max_discard_sectors;
+	uint32_t max_discard_seg;
+	uint32_t discard_sector_alignment;
+	uint32_t max_write_zeroes_sectors;
+	uint32_t max_write_zeroes_seg;
+	uint8_t write_zeroes_may_unmap;
+	uint8_t unused1[3];
 } __attribute__((packed));
 
 /*
@@ -105,12 +147,24 @@ struct virtio_blk_hdr {
 #define	VBH_OP_FLUSH		4
 #define	VBH_OP_FLUSH_OUT	5
 #define	VBH_OP_IDENT		8
+#define	VBH_OP_DISCARD		11
+#define	VBH_OP_WRITE_ZEROES	13
 #define	VBH_FLAG_BARRIER	0x80000000	/* OR'ed into type */
 	uint32_t type;
 	uint32_t ioprio;
 	uint64_t sector;
 } __attribute__((packed));
 
+/*
+ * Segment of a discard or write zeroes request
+ */
+struct virtio_blk_discard_write_zeroes {
+	uint64_t sector;
+	uint32_t num_sectors;
+#define	VBDWZ_FLAG_UNMAP	0x1	/* write zeroes may deallocate */
+	uint32_t flags;
+} __attribute__((packed));
+
 /*
  * Debug printf
  */
@@ -121,56 +175,137 @@ static int virtio_blk_debug;
 struct virtio_blk_ioreq {
 	struct blockif_req req;
 	struct virtio_blk *blk;
+	struct virtio_blk_queue *q;
 	uint8_t *status;
 	uint16_t idx;
 };
 
+/*
+ * Each virtqueue has its own backing context, so the requests of one
+ * queue never wait on the lock or the workers of another queue.
+ */
+struct virtio_blk_queue {
+	pthread_mutex_t mtx;
+	struct virtio_vq_info *vq;
+	struct blockif_ctxt *bc;
+	struct virtio_blk_ioreq ios[VIRTIO_BLK_RINGSZ];
+	struct virtio_used done[VIRTIO_BLK_RINGSZ];
+	int ndone;	/* completed, not yet in the used ring */
+};
+
+/*
+ * The queues are served by a vhost-user backend process, straight from
+ * guest memory, rather than by backing contexts in the DM.
+ */
+struct virtio_blk_vhost {
+	struct vhost_dev vdev;
+	struct vhost_vq vqs[VIRTIO_BLK_MAX_QUEUES];
+};
+
 /*
  * Per-device struct
  */
 struct virtio_blk {
 	struct virtio_base base;
+	struct virtio_ops ops;
 	pthread_mutex_t mtx;
-	struct virtio_vq_info vq;
+	struct virtio_vq_info vqs[VIRTIO_BLK_MAX_QUEUES];
+	struct virtio_blk_queue queues[VIRTIO_BLK_MAX_QUEUES];
+	int nqueues;
 	struct virtio_blk_config cfg;
-	struct blockif_ctxt *bc;
 	char ident[VIRTIO_BLK_BLK_ID_BYTES + 1];
-	struct virtio_blk_ioreq ios[VIRTIO_BLK_RINGSZ];
 	uint8_t original_wce;
+	int seg_max;
+	struct virtio_blk_vhost *vhost;
 };
 
 static void virtio_blk_reset(void *);
 static void virtio_blk_notify(void *, struct virtio_vq_info *);
 static int virtio_blk_cfgread(void *, int, int, uint32_t *);
 static int virtio_blk_cfgwrite(void *, int, int, uint32_t);
+static void virtio_blk_apply_features(void *, uint64_t);
+static void virtio_blk_set_status(void *, uint64_t);
 
-static struct virtio_ops virtio_blk_ops = {
+static const struct virtio_ops virtio_blk_ops = {
 	"virtio_blk",		/* our name */
-	1,			/* we support 1 virtqueue */
+	1,			/* 1 virtqueue, or num_queues */
 	sizeof(struct virtio_blk_config), /* config reg size */
 	virtio_blk_reset,	/* reset */
 	virtio_blk_notify,	/* device-wide qnotify */
 	virtio_blk_cfgread,	/* read PCI config */
 	virtio_blk_cfgwrite,	/* write PCI config */
-	NULL,			/* apply negotiated features */
-	NULL,			/* called on guest set status */
+	virtio_blk_apply_features, /* apply negotiated features */
+	virtio_blk_set_status,	/* called on guest set status */
 };
 
 static void
 virtio_blk_reset(void *vdev)
 {
 	struct virtio_blk *blk = vdev;
+	int i;
 
 	DPRINTF(("virtio_blk: device reset requested !\n"));
+	for (i = 0; i < blk->nqueues; i++) {
+		pthread_mutex_lock(&blk->queues[i].mtx);
+		blk->queues[i].ndone = 0;
+	}
 	virtio_reset_dev(&blk->base);
-	blockif_set_wce(blk->bc, blk->original_wce);
+	for (i = blk->nqueues - 1; i >= 0; i--)
+		pthread_mutex_unlock(&blk->queues[i].mtx);
+
+	for (i = 0; i < blk->nqueues; i++)
+		blockif_set_wce(blk->queues[i].bc, blk->original_wce);
+	virtio_blk_apply_features(blk, 0);
+}
+
+static void
+virtio_blk_apply_features(void *vdev, uint64_t negotiated_features)
+{
+	struct virtio_blk *blk = vdev;
+
+	/* a vhost-user backend's seg_max is its own */
+	if (blk->vhost)
+		return;
+
+	if (negotiated_features & ACRN_VIRTIO_RING_F_INDIRECT_DESC)
+		blk->cfg.seg_max = blk->seg_max;
+	else
+		blk->cfg.seg_max = MIN(blk->seg_max, VIRTIO_BLK_DIRECT_SEGS);
+}
+
+/*
+ * The requests of a queue completed together are returned to the guest
+ * with one update of the used ring, and an interrupt if needed.
+ */
+static void
+virtio_blk_done_batch(void *arg)
+{
+	struct virtio_blk_queue *q = arg;
+	struct virtio_blk *blk = q->ios[0].blk;
+	bool shared;
+
+	/* in the order of virtio_blk_done() */
+	shared = !pci_msix_enabled(blk->base.dev);
+	if (shared)
+		pthread_mutex_lock(&blk->mtx);
+	pthread_mutex_lock(&q->mtx);
+
+	if (q->ndone > 0) {
+		vq_relchain_batch(q->vq, q->done, q->ndone);
+		q->ndone = 0;
+		vq_endchains(q->vq, 0);
+	}
+
+	pthread_mutex_unlock(&q->mtx);
+	if (shared)
+		pthread_mutex_unlock(&blk->mtx);
 }
 
 static void
 virtio_blk_done(struct blockif_req *br, int err)
 {
 	struct virtio_blk_ioreq *io = br->param;
-	struct virtio_blk *blk = io->blk;
+	struct virtio_blk_queue *q = io->q;
 
 	if (err)
 		DPRINTF(("virtio_blk: done with error = %d\n\r", err));
@@ -184,19 +319,22 @@ virtio_blk_done(struct blockif_req *br, int err)
 		*io->status = VIRTIO_BLK_S_OK;
 
 	/*
-	 * Return the descriptor back to the host.
-	 * We wrote 1 byte (our status) to host.
+	 * Return the descriptor back to the host, with the others of the
+	 * batch, by virtio_blk_done_batch(). We wrote 1 byte (our status)
+	 * to host.
 	 */
-	pthread_mutex_lock(&blk->mtx);
-	vq_relchain(&blk->vq, io->idx, 1);
-	vq_endchains(&blk->vq, 0);
-	pthread_mutex_unlock(&blk->mtx);
+	pthread_mutex_lock(&q->mtx);
+	q->done[q->ndone].idx = io->idx;
+	q->done[q->ndone++].tlen = 1;
+	pthread_mutex_unlock(&q->mtx);
 }
 
 static void
-virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
+virtio_blk_proc(struct virtio_blk *blk, struct virtio_blk_queue *q)
 {
+	struct virtio_vq_info *vq = q->vq;
 	struct virtio_blk_hdr *vbh;
+	struct virtio_blk_discard_write_zeroes *seg;
 	struct virtio_blk_ioreq *io;
 	int i, n;
 	int err;
@@ -215,9 +353,17 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 	 * XXX - note - this fails on crash dump, which does a
 	 * VIRTIO_BLK_T_FLUSH with a zero transfer length
 	 */
-	assert(n >= 2 && n <= BLOCKIF_IOV_MAX + 2);
+	assert(n >= 2);
+	if (n > BLOCKIF_IOV_MAX + 2) {
+		/* past seg_max, the status descriptor wasn't recorded */
+		WPRINTF(("virtio_blk: request of %d segments dropped\n",
+			 n - 2));
+		q->done[q->ndone].idx = idx;
+		q->done[q->ndone++].tlen = 0;
+		return;
+	}
 
-	io = &blk->ios[idx];
+	io = &q->ios[idx];
 	assert((flags[0] & ACRN_VRING_DESC_F_WRITE) == 0);
 	assert(iov[0].iov_len == sizeof(struct virtio_blk_hdr));
 	vbh = iov[0].iov_base;
@@ -234,7 +380,8 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 	 * we don't advertise the capability.
 	 */
 	type = vbh->type & ~VBH_FLAG_BARRIER;
-	writeop = (type == VBH_OP_WRITE);
+	writeop = (type == VBH_OP_WRITE || type == VBH_OP_DISCARD ||
+		   type == VBH_OP_WRITE_ZEROES);
 
 	iolen = 0;
 	for (i = 1; i < n; i++) {
@@ -277,11 +424,33 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 		}
 
 		err = ((type == VBH_OP_READ) ? blockif_read : blockif_write)
-				(blk->bc, &io->req);
+				(q->bc, &io->req);
+		break;
+	case VBH_OP_DISCARD:
+	case VBH_OP_WRITE_ZEROES:
+		/* max_discard_seg and max_write_zeroes_seg are 1 */
+		seg = iov[1].iov_base;
+		if (n != 2 || iov[1].iov_len != sizeof(*seg) ||
+		    seg->sector + seg->num_sectors > blk->cfg.capacity) {
+			virtio_blk_done(&io->req, EINVAL);
+			return;
+		}
+		if (seg->flags & ~((type == VBH_OP_WRITE_ZEROES) ?
+				VBDWZ_FLAG_UNMAP : 0)) {
+			virtio_blk_done(&io->req, EOPNOTSUPP);
+			return;
+		}
+
+		io->req.iovcnt = 0;
+		io->req.offset = seg->sector * DEV_BSIZE;
+		io->req.resid = (ssize_t)seg->num_sectors * DEV_BSIZE;
+		err = ((type == VBH_OP_DISCARD) ? blockif_delete :
+			blockif_write_zeroes)(q->bc, &io->req);
 		break;
 	case VBH_OP_FLUSH:
 	case VBH_OP_FLUSH_OUT:
-		err = blockif_flush(blk->bc, &io->req);
+		/* the same file for all the queues, one flush covers them */
+		err = blockif_flush(q->bc, &io->req);
 		break;
 	case VBH_OP_IDENT:
 		/* Assume a single buffer */
@@ -302,9 +471,24 @@ static void
 virtio_blk_notify(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_blk *blk = vdev;
+	struct virtio_blk_queue *q = &blk->queues[vq->num];
+
+	/* the kicks of a vhost-user backend's queues go to its eventfds */
+	if (blk->vhost)
+		return;
+
+	pthread_mutex_lock(&q->mtx);
 
+	/* one submission for all the requests of this notification */
+	blockif_plug(q->bc);
 	while (vq_has_descs(vq))
-		virtio_blk_proc(blk, vq);
+		virtio_blk_proc(blk, q);
+	blockif_unplug(q->bc);
+
+	pthread_mutex_unlock(&q->mtx);
+
+	/* those completed right away, which got no batch of the threads */
+	virtio_blk_done_batch(q);
 }
 
 static uint64_t
@@ -315,19 +499,211 @@ virtio_blk_get_caps(struct virtio_blk *blk, bool wb)
 	caps = VIRTIO_BLK_S_HOSTCAPS;
 	if (wb)
 		caps |= VIRTIO_BLK_F_WB_BITS;
+	if (blk->nqueues > 1)
+		caps |= VIRTIO_BLK_F_MQ;
+	if (!blockif_is_ro(blk->queues[0].bc)) {
+		caps |= VIRTIO_BLK_F_WRITE_ZEROES;
+		if (blockif_candelete(blk->queues[0].bc))
+			caps |= VIRTIO_BLK_F_DISCARD;
+	}
 	return caps;
 }
 
+/*
+ * Take "num_queues=<n>" out of the options, the rest of them are for
+ * the backing contexts.
+ */
+/*
+ * Take the "name=<n>" options of the device, which block_if doesn't
+ * know, out of opts. *val is left alone if there is none.
+ */
+static int
+virtio_blk_parse_int(char *opts, const char *name, int min, int max,
+		     int *val)
+{
+	char *cp, *next, *end;
+	size_t len = strlen(name);
+	int n;
+
+	for (cp = strchr(opts, ','); cp != NULL; cp = next) {
+		next = strchr(cp + 1, ',');
+		if (strncmp(cp + 1, name, len) || cp[1 + len] != '=')
+			continue;
+
+		if (dm_strtoi(cp + 2 + len, &end, 10, &n) ||
+		    (*end != ',' && *end != '\0') ||
+		    n < min || n > max) {
+			WPRINTF(("virtio_blk: %s must be %d to %d\n",
+				name, min, max));
+			return -1;
+		}
+		*val = n;
+
+		memmove(cp, end, strlen(end) + 1);
+		next = cp;
+		if (*next == '\0')
+			break;
+	}
+
+	return 0;
+}
+
+static void
+virtio_blk_set_status(void *vdev, uint64_t status)
+{
+	struct virtio_blk *blk = vdev;
+	struct vhost_dev *vhost;
+
+	if (!blk->vhost)
+		return;
+
+	vhost = &blk->vhost->vdev;
+	if (!vhost->started && (status & VIRTIO_CR_STATUS_DRIVER_OK)) {
+		if (vhost_dev_start(vhost) < 0)
+			WPRINTF(("virtio_blk: vhost_dev_start failed\n"));
+	} else if (vhost->started &&
+		   (status & VIRTIO_CR_STATUS_DRIVER_OK) == 0) {
+		if (vhost_dev_stop(vhost) < 0)
+			WPRINTF(("virtio_blk: vhost_dev_stop failed\n"));
+	}
+}
+
+/*
+ * Hand the queues to the vhost-user backend listening on @path. It has
+ * the disk, so the config space is read from it.
+ */
+static int
+virtio_blk_vhost_init(struct virtio_blk *blk, const char *path, int nqueues)
+{
+	struct virtio_blk_vhost *vhost;
+	uint64_t caps;
+	int fd;
+
+	vhost = calloc(1, sizeof(struct virtio_blk_vhost));
+	if (!vhost) {
+		WPRINTF(("virtio_blk: vhost init out of memory\n"));
+		return -1;
+	}
+
+	fd = vhost_user_connect(path);
+	if (fd < 0) {
+		free(vhost);
+		return -1;
+	}
+
+	caps = VIRTIO_BLK_S_VHOSTCAPS;
+	if (nqueues > 1)
+		caps |= VIRTIO_BLK_F_MQ;
+	blk->base.device_caps = caps;
+
+	/* pre-init before calling vhost_dev_init */
+	vhost->vdev.nvqs = nqueues;
+	vhost->vdev.vqs = vhost->vqs;
+	vhost->vdev.user = true;
+	if (vhost_dev_init(&vhost->vdev, &blk->base, fd, 0, caps,
+			   VHOST_USER_F_PROTOCOL_FEATURES, 0) < 0) {
+		WPRINTF(("virtio_blk: vhost_dev_init failed\n"));
+		free(vhost);
+		return -1;
+	}
+
+	if (vhost_user_get_config(&vhost->vdev, &blk->cfg,
+				  sizeof(blk->cfg)) < 0) {
+		WPRINTF(("virtio_blk: no config from %s\n", path));
+		vhost_dev_deinit(&vhost->vdev);
+		free(vhost);
+		return -1;
+	}
+	blk->cfg.num_queues = nqueues;
+	blk->vhost = vhost;
+	return 0;
+}
+
+static void
+virtio_blk_vhost_deinit(struct virtio_blk *blk)
+{
+	if (!blk->vhost)
+		return;
+
+	if (blk->vhost->vdev.started)
+		vhost_dev_stop(&blk->vhost->vdev);
+	vhost_dev_deinit(&blk->vhost->vdev);
+	free(blk->vhost);
+	blk->vhost = NULL;
+}
+
+static void
+virtio_blk_close_queues(struct virtio_blk *blk)
+{
+	struct blockif_stats stats;
+	int i;
+
+	for (i = 0; i < blk->nqueues; i++) {
+		if (blk->queues[i].bc != NULL) {
+			blockif_get_stats(blk->queues[i].bc, &stats);
+			if (stats.requests != 0)
+				printf("virtio_blk: %s queue %d: %lu requests, "
+					"%lu merged\n", blk->ident, i,
+					stats.requests, stats.merged);
+			if (blockif_flush_all(blk->queues[i].bc))
+				WPRINTF(("vrito_blk:"
+					"Failed to flush before close\n"));
+			blockif_close(blk->queues[i].bc);
+		}
+		pthread_mutex_destroy(&blk->queues[i].mtx);
+	}
+}
+
+/* the config space of the disk of the backing contexts */
+static void
+virtio_blk_setup_config(struct virtio_blk *blk, int nqueues, int seg_max)
+{
+	struct blockif_ctxt *bctxt;
+	off_t size;
+	int sectsz, sts, sto;
+
+	bctxt = blk->queues[0].bc;
+	size = blockif_size(bctxt);
+	sectsz = blockif_sectsz(bctxt);
+	blockif_psectsz(bctxt, &sts, &sto);
+
+	blk->cfg.capacity = size / DEV_BSIZE; /* 512-byte units */
+	blk->cfg.size_max = 0;	/* not negotiated */
+	blk->seg_max = seg_max;
+	virtio_blk_apply_features(blk, 0);
+	blk->cfg.geometry.cylinders = 0;	/* no geometry */
+	blk->cfg.geometry.heads = 0;
+	blk->cfg.geometry.sectors = 0;
+	blk->cfg.blk_size = sectsz;
+	blk->cfg.topology.physical_block_exp =
+	    (sts > sectsz) ? (ffsll(sts / sectsz) - 1) : 0;
+	blk->cfg.topology.alignment_offset =
+	    (sto != 0) ? ((sts - sto) / sectsz) : 0;
+	blk->cfg.topology.min_io_size = 0;
+	blk->cfg.topology.opt_io_size = 0;
+	blk->cfg.writeback = blockif_get_wce(bctxt);
+	blk->cfg.num_queues = nqueues;
+	blk->cfg.max_discard_sectors = VIRTIO_BLK_MAX_DISCARD_SECTORS;
+	blk->cfg.max_discard_seg = 1;
+	blk->cfg.discard_sector_alignment = MAX(sts, sectsz) / DEV_BSIZE;
+	blk->cfg.max_write_zeroes_sectors = VIRTIO_BLK_MAX_WZ_SECTORS;
+	blk->cfg.max_write_zeroes_seg = 1;
+	blk->cfg.write_zeroes_may_unmap = blockif_candelete(bctxt);
+	blk->original_wce = blk->cfg.writeback; /* save for reset */
+	blk->base.device_caps =
+		virtio_blk_get_caps(blk, !!blk->cfg.writeback);
+}
+
 static int
 virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	char bident[16];
-	struct blockif_ctxt *bctxt;
 	MD5_CTX mdctx;
 	u_char digest[16];
 	struct virtio_blk *blk;
-	off_t size;
-	int i, sectsz, sts, sto;
+	struct virtio_blk_queue *q;
+	char *bopts, *vhost_path = NULL;
+	int i, j, nqueues, seg_max;
 	pthread_mutexattr_t attr;
 	int rc;
 
@@ -336,39 +712,35 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		return -1;
 	}
 
-	/*
-	 * The supplied backing file has to exist
-	 */
-	if (snprintf(bident, sizeof(bident), "%d:%d",
-				dev->slot, dev->func) >= sizeof(bident)) {
-		WPRINTF(("bident error, please check slot and func\n"));
+	bopts = strdup(opts);
+	if (!bopts) {
+		WPRINTF(("virtio_blk: strdup returns NULL\n"));
+		return -1;
 	}
-	bctxt = blockif_open(opts, bident);
-	if (bctxt == NULL) {
-		perror("Could not open backing file");
+	nqueues = 1;
+	seg_max = BLOCKIF_IOV_MAX;
+	if (virtio_blk_parse_int(bopts, "num_queues", 1,
+				 VIRTIO_BLK_MAX_QUEUES, &nqueues) ||
+	    virtio_blk_parse_int(bopts, "seg_max", 1, BLOCKIF_IOV_MAX,
+				 &seg_max)) {
+		free(bopts);
 		return -1;
 	}
 
-	size = blockif_size(bctxt);
-	sectsz = blockif_sectsz(bctxt);
-	blockif_psectsz(bctxt, &sts, &sto);
+	/* "vhost-user=<socket path>" rather than a backing file */
+	if (!strncmp(bopts, VIRTIO_BLK_VHOST_USER,
+		     strlen(VIRTIO_BLK_VHOST_USER))) {
+		vhost_path = bopts + strlen(VIRTIO_BLK_VHOST_USER);
+		vhost_path[strcspn(vhost_path, ",")] = '\0';
+	}
 
 	blk = calloc(1, sizeof(struct virtio_blk));
 	if (!blk) {
 		WPRINTF(("virtio_blk: calloc returns NULL\n"));
+		free(bopts);
 		return -1;
 	}
 
-	blk->bc = bctxt;
-	for (i = 0; i < VIRTIO_BLK_RINGSZ; i++) {
-		struct virtio_blk_ioreq *io = &blk->ios[i];
-
-		io->req.callback = virtio_blk_done;
-		io->req.param = io;
-		io->blk = blk;
-		io->idx = i;
-	}
-
 	/* init mutex attribute properly to avoid deadlock */
 	rc = pthread_mutexattr_init(&attr);
 	if (rc)
@@ -383,19 +755,71 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		DPRINTF(("virtio_blk: pthread_mutex_init failed with "
 					"error %d!\n", rc));
 
+	/*
+	 * The supplied backing file has to exist. Every queue has its own
+	 * context on it, with its own workers or io_uring. There are none
+	 * when a vhost-user backend serves the queues.
+	 */
+	for (i = 0; i < nqueues; i++) {
+		q = &blk->queues[i];
+		q->vq = &blk->vqs[i];
+		q->vq->qsize = VIRTIO_BLK_RINGSZ;
+		/* q->vq->vq_notify = we have no per-queue notify */
+		if (vhost_path != NULL)
+			continue;
+
+		rc = pthread_mutex_init(&q->mtx, &attr);
+		if (rc)
+			DPRINTF(("virtio_blk: pthread_mutex_init failed with "
+						"error %d!\n", rc));
+		blk->nqueues = i + 1;
+
+		if (snprintf(bident, sizeof(bident), (nqueues > 1) ?
+				"%d:%d.%d" : "%d:%d", dev->slot, dev->func, i)
+				>= sizeof(bident)) {
+			WPRINTF(("bident error, please check slot and func\n"));
+		}
+		/* the queues share the open file, and its range lock */
+		q->bc = (i == 0) ? blockif_open(bopts, bident) :
+			blockif_clone(blk->queues[0].bc, bident);
+		if (q->bc == NULL) {
+			perror("Could not open backing file");
+			pthread_mutexattr_destroy(&attr);
+			goto fail;
+		}
+
+		for (j = 0; j < VIRTIO_BLK_RINGSZ; j++) {
+			struct virtio_blk_ioreq *io = &q->ios[j];
+
+			io->req.callback = virtio_blk_done;
+			io->req.param = io;
+			io->blk = blk;
+			io->q = q;
+			io->idx = j;
+		}
+		blockif_set_batch_done(q->bc, virtio_blk_done_batch, q);
+	}
+	pthread_mutexattr_destroy(&attr);
+
 	/* init virtio struct and virtqueues */
-	virtio_linkup(&blk->base, &virtio_blk_ops, blk, dev, &blk->vq, BACKEND_VBSU);
+	blk->ops = virtio_blk_ops;
+	blk->ops.nvq = nqueues;
+	virtio_linkup(&blk->base, &blk->ops, blk, dev, blk->vqs,
+		      vhost_path ? BACKEND_VHOST : BACKEND_VBSU);
 	blk->base.mtx = &blk->mtx;
 
-	blk->vq.qsize = VIRTIO_BLK_RINGSZ;
-	/* blk->vq.vq_notify = we have no per-queue notify */
+	/* setup virtio block config space */
+	if (vhost_path == NULL)
+		virtio_blk_setup_config(blk, nqueues, seg_max);
+	else if (virtio_blk_vhost_init(blk, vhost_path, nqueues) < 0)
+		goto fail;
 
 	/*
 	 * Create an identifier for the backing file. Use parts of the
 	 * md5 sum of the filename
 	 */
 	MD5_Init(&mdctx);
-	MD5_Update(&mdctx, opts, strnlen(opts, VIRTIO_BLK_MAX_OPTS_LEN));
+	MD5_Update(&mdctx, bopts, strnlen(bopts, VIRTIO_BLK_MAX_OPTS_LEN));
 	MD5_Final(digest, &mdctx);
 	if (snprintf(blk->ident, sizeof(blk->ident),
 		"ACRN--%02X%02X-%02X%02X-%02X%02X", digest[0],
@@ -403,25 +827,8 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		digest[5]) >= sizeof(blk->ident)) {
 		WPRINTF(("virtio_blk: block ident too long\n"));
 	}
-
-	/* setup virtio block config space */
-	blk->cfg.capacity = size / DEV_BSIZE; /* 512-byte units */
-	blk->cfg.size_max = 0;	/* not negotiated */
-	blk->cfg.seg_max = BLOCKIF_IOV_MAX;
-	blk->cfg.geometry.cylinders = 0;	/* no geometry */
-	blk->cfg.geometry.heads = 0;
-	blk->cfg.geometry.sectors = 0;
-	blk->cfg.blk_size = sectsz;
-	blk->cfg.topology.physical_block_exp =
-	    (sts > sectsz) ? (ffsll(sts / sectsz) - 1) : 0;
-	blk->cfg.topology.alignment_offset =
-	    (sto != 0) ? ((sts - sto) / sectsz) : 0;
-	blk->cfg.topology.min_io_size = 0;
-	blk->cfg.topology.opt_io_size = 0;
-	blk->cfg.writeback = blockif_get_wce(blk->bc);
-	blk->original_wce = blk->cfg.writeback; /* save for reset */
-	blk->base.device_caps =
-		virtio_blk_get_caps(blk, !!blk->cfg.writeback);
+	free(bopts);
+	bopts = NULL;
 
 	/*
 	 * Should we move some of this into virtio.c?  Could
@@ -434,29 +841,33 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, VIRTIO_TYPE_BLOCK);
 	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
 
+	/* a vector for each queue, they complete in parallel */
 	if (virtio_interrupt_init(&blk->base, virtio_uses_msix())) {
-		blockif_close(blk->bc);
-		free(blk);
-		return -1;
+		dev->arg = NULL;
+		goto fail;
 	}
 	virtio_set_io_bar(&blk->base, 0);
 	return 0;
+
+fail:
+	virtio_blk_vhost_deinit(blk);
+	virtio_blk_close_queues(blk);
+	pthread_mutex_destroy(&blk->mtx);
+	free(blk);
+	free(bopts);
+	return -1;
 }
 
 static void
 virtio_blk_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
-	struct blockif_ctxt *bctxt;
 	struct virtio_blk *blk;
 
 	if (dev->arg) {
 		DPRINTF(("virtio_blk: deinit\n"));
 		blk = (struct virtio_blk *) dev->arg;
-		bctxt = blk->bc;
-		if (blockif_flush_all(bctxt))
-			WPRINTF(("vrito_blk:"
-				"Failed to flush before close\n"));
-		blockif_close(bctxt);
+		virtio_blk_vhost_deinit(blk);
+		virtio_blk_close_queues(blk);
 		free(blk);
 	}
 }
@@ -467,13 +878,15 @@ virtio_blk_cfgwrite(void *vdev, int offset, int size, uint32_t value)
 	struct virtio_blk *blk = vdev;
 	struct virtio_blk_config *blkcfg = &(blk->cfg);
 	void *ptr;
+	int i;
 
 	ptr = (uint8_t *)blkcfg + offset;
 
 	if ((offset == offsetof(struct virtio_blk_config, writeback))
 		&& (size == 1)) {
 		memcpy(ptr, &value, size);
-		blockif_set_wce(blk->bc, blkcfg->writeback);
+		for (i = 0; i < blk->nqueues; i++)
+			blockif_set_wce(blk->queues[i].bc, blkcfg->writeback);
 		if (blkcfg->writeback)
 			blk->base.device_caps |= VIRTIO_BLK_F_FLUSH;
 		else
@@ -501,6 +914,9 @@ struct pci_vdev_ops pci_ops_virtio_blk = {
 	.class_name	= "virtio-blk",
 	.vdev_init	= virtio_blk_init,
 	.vdev_deinit	= virtio_blk_deinit,
+	.vdev_reset	= virtio_pci_reset,
+	.vdev_save	= virtio_pci_save,
+	.vdev_load	= virtio_pci_load,
 	.vdev_barwrite	= virtio_pci_write,
 	.vdev_barread	= virtio_pci_read
 };
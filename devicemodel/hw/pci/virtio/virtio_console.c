@@ -30,6 +30,10 @@
 
 #include <sys/uio.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/param.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -86,6 +90,8 @@ enum virtio_console_be_type {
 	VIRTIO_CONSOLE_BE_TTY,
 	VIRTIO_CONSOLE_BE_PTY,
 	VIRTIO_CONSOLE_BE_FILE,
+	VIRTIO_CONSOLE_BE_SOCKET,
+	VIRTIO_CONSOLE_BE_PIPE,
 	VIRTIO_CONSOLE_BE_MAX,
 	VIRTIO_CONSOLE_BE_INVALID = VIRTIO_CONSOLE_BE_MAX
 };
@@ -111,6 +117,15 @@ struct virtio_console_backend {
 	bool				open;
 	enum virtio_console_be_type	be_type;
 	int				pts_fd;	/* only valid for PTY */
+
+	/*
+	 * Guest data is vmsplice()d rather than copied for SOCKET and PIPE.
+	 * A socket is fed through splice_pipe, which still holds what the
+	 * socket could not take yet (splice_len bytes).
+	 */
+	bool				splice;
+	int				splice_pipe[2];	/* only valid for SOCKET */
+	size_t				splice_len;
 };
 
 struct virtio_console {
@@ -172,7 +187,9 @@ static const char *virtio_console_be_table[VIRTIO_CONSOLE_BE_MAX] = {
 	[VIRTIO_CONSOLE_BE_STDIO]	= "stdio",
 	[VIRTIO_CONSOLE_BE_TTY]		= "tty",
 	[VIRTIO_CONSOLE_BE_PTY]		= "pty",
-	[VIRTIO_CONSOLE_BE_FILE]	= "file"
+	[VIRTIO_CONSOLE_BE_FILE]	= "file",
+	[VIRTIO_CONSOLE_BE_SOCKET]	= "socket",
+	[VIRTIO_CONSOLE_BE_PIPE]	= "pipe"
 };
 
 static struct termios virtio_console_saved_tio;
@@ -374,23 +391,43 @@ virtio_console_notify_tx(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_console *console;
 	struct virtio_console_port *port;
-	struct iovec iov[1];
+	struct iovec iov[VIRTIO_CONSOLE_RINGSZ];
+	struct virtio_used used[VIRTIO_CONSOLE_RINGSZ];
 	uint16_t idx;
 	uint16_t flags[8];
+	bool batch;
+	int n = 0;
 
 	console = vdev;
 	port = virtio_console_vq_to_port(console, vq);
 
+	/*
+	 * The data of a port goes to its backend in one write for all the
+	 * chains, a control message being handled on its own.
+	 */
+	batch = (port != &console->control_port);
+
 	while (vq_has_descs(vq)) {
-		vq_getchain(vq, &idx, iov, 1, flags);
-		if (port != NULL)
-			port->cb(port, port->arg, iov, 1);
+		if (vq_getchain(vq, &idx, &iov[n], 1, flags) < 1)
+			break;
+		if (port != NULL && !batch)
+			port->cb(port, port->arg, &iov[n], 1);
 
 		/*
-		 * Release this chain and handle more
+		 * Release this chain with the others and handle more
 		 */
-		vq_relchain(vq, idx, 0);
+		used[n].idx = idx;
+		used[n++].tlen = 0;
+		if (n == ARRAY_SIZE(used)) {
+			if (port != NULL && batch)
+				port->cb(port, port->arg, iov, n);
+			vq_relchain_batch(vq, used, n);
+			n = 0;
+		}
 	}
+	if (port != NULL && batch && n > 0)
+		port->cb(port, port->arg, iov, n);
+	vq_relchain_batch(vq, used, n);
 	vq_endchains(vq, 1);	/* Generate interrupt if appropriate. */
 }
 
@@ -431,9 +468,10 @@ virtio_console_backend_read(int fd __attribute__((unused)),
 	struct virtio_console_port *port;
 	struct virtio_console_backend *be = arg;
 	struct virtio_vq_info *vq;
-	struct iovec iov;
+	struct iovec iov[VIRTIO_CONSOLE_RINGSZ];
 	static char dummybuf[2048];
-	int len, n;
+	struct virtio_used used[VIRTIO_CONSOLE_RINGSZ];
+	int len, left, i, n;
 	uint16_t idx;
 
 	port = be->port;
@@ -454,11 +492,31 @@ virtio_console_backend_read(int fd __attribute__((unused)),
 		return;
 	}
 
+	/*
+	 * Read as much as fits in all the available chains at once, then
+	 * return the filled ones together and the others to the ring.
+	 */
 	do {
-		n = vq_getchain(vq, &idx, &iov, 1, NULL);
-		len = readv(be->fd, &iov, n);
-		if (len <= 0) {
+		for (n = 0; n < ARRAY_SIZE(iov) && vq_has_descs(vq); n++) {
+			if (vq_getchain(vq, &idx, &iov[n], 1, NULL) < 1)
+				break;
+			used[n].idx = idx;
+		}
+		if (n == 0)
+			break;
+
+		len = readv(be->fd, iov, n);
+		for (i = 0, left = (len > 0) ? len : 0; i < n && left > 0; i++) {
+			used[i].tlen = MIN(left, iov[i].iov_len);
+			left -= used[i].tlen;
+		}
+		while (n > i) {
 			vq_retchain(vq);
+			n--;
+		}
+		vq_relchain_batch(vq, used, n);
+
+		if (len <= 0) {
 			vq_endchains(vq, 0);
 
 			/* no data available */
@@ -468,11 +526,13 @@ virtio_console_backend_read(int fd __attribute__((unused)),
 			/* any other errors */
 			goto close;
 		}
-
-		vq_relchain(vq, idx, len);
-	} while (vq_has_descs(vq));
+		/* all full: there may be more to read */
+	} while (i == ARRAY_SIZE(iov) &&
+		 used[i - 1].tlen == iov[i - 1].iov_len &&
+		 vq_has_descs(vq));
 
 	vq_endchains(vq, 1);
+	return;
 
 close:
 	virtio_console_reset_backend(be);
@@ -480,20 +540,114 @@ close:
 		len, errno));
 }
 
+static int
+virtio_console_iov_advance(struct iovec **iov, int *niov, size_t len)
+{
+	while (*niov > 0 && len >= (*iov)->iov_len) {
+		len -= (*iov)->iov_len;
+		(*iov)++;
+		(*niov)--;
+	}
+	if (*niov > 0) {
+		(*iov)->iov_base = (char *)(*iov)->iov_base + len;
+		(*iov)->iov_len -= len;
+	}
+
+	return *niov;
+}
+
+/* move what is parked in the splice pipe on to the socket */
+static int
+virtio_console_splice_flush(struct virtio_console_backend *be)
+{
+	ssize_t ret;
+
+	while (be->splice_len > 0) {
+		ret = splice(be->splice_pipe[0], NULL, be->fd, NULL,
+			be->splice_len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret <= 0)
+			return -1;
+		be->splice_len -= ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Hand the guest pages to the backend by reference. Returns -1 with errno
+ * set when it stops before the whole iov is consumed; iov and niov are
+ * advanced past what was taken.
+ */
+static int
+virtio_console_backend_splice(struct virtio_console_backend *be,
+			      struct iovec **iov, int *niov)
+{
+	ssize_t ret;
+	int fd;
+
+	fd = (be->be_type == VIRTIO_CONSOLE_BE_SOCKET) ?
+		be->splice_pipe[1] : be->fd;
+
+	while (*niov > 0) {
+		if (fd != be->fd && virtio_console_splice_flush(be) < 0)
+			return -1;
+
+		ret = vmsplice(fd, *iov, MIN(*niov, IOV_MAX),
+			SPLICE_F_NONBLOCK);
+		if (ret <= 0)
+			return -1;
+		virtio_console_iov_advance(iov, niov, ret);
+
+		if (fd != be->fd)
+			be->splice_len += ret;
+	}
+
+	if (fd != be->fd && virtio_console_splice_flush(be) < 0)
+		return -1;
+
+	return 0;
+}
+
 static void
 virtio_console_backend_write(struct virtio_console_port *port, void *arg,
 			     struct iovec *iov, int niov)
 {
 	struct virtio_console_backend *be;
-	int ret;
+	int ret = 0;
 
 	be = arg;
 
 	if (be->fd == -1)
 		return;
 
-	ret = writev(be->fd, iov, niov);
-	if (ret <= 0) {
+	if (be->splice) {
+		if (virtio_console_backend_splice(be, &iov, &niov) == 0)
+			return;
+
+		if (errno == EAGAIN && be->splice_len > 0) {
+			/* the parked part goes out with the next write */
+			return;
+		}
+
+		/* no splice support for this fd, fall back on copying */
+		if ((errno == EINVAL || errno == ENOSYS) &&
+				be->splice_len == 0) {
+			WPRINTF(("vtcon: splice unsupported, use writev\n"));
+			be->splice = false;
+		} else
+			ret = -1;
+	}
+
+	while (niov > 0 && ret == 0) {
+		ret = writev(be->fd, iov, niov);
+		if (ret <= 0)
+			break;
+
+		/* the rest of a partial write */
+		virtio_console_iov_advance(&iov, &niov, ret);
+		ret = 0;
+	}
+	if (niov > 0) {
 		/* backend cannot receive more data. For example when pts is
 		 * not connected to any client, its tty buffer will become full.
 		 * In this case we just drop data from guest hvc console.
@@ -520,10 +674,41 @@ virtio_console_backend_can_read(enum virtio_console_be_type be_type)
 	return (be_type == VIRTIO_CONSOLE_BE_FILE) ? false : true;
 }
 
+static int
+virtio_console_open_socket(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strnlen(path, sizeof(addr.sun_path)) >= sizeof(addr.sun_path)) {
+		WPRINTF(("vtcon: socket path too long: %s\n", path));
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		WPRINTF(("vtcon: socket failed, errno = %d\n", errno));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		WPRINTF(("vtcon: connect failed: %s, errno = %d\n",
+			path, errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
 static int
 virtio_console_open_backend(const char *path,
 			    enum virtio_console_be_type be_type)
 {
+	struct stat st;
 	int fd = -1;
 
 	switch (be_type) {
@@ -562,6 +747,20 @@ virtio_console_open_backend(const char *path,
 		if (fd < 0)
 			WPRINTF(("vtcon: open failed: %s\n", path));
 		break;
+	case VIRTIO_CONSOLE_BE_SOCKET:
+		fd = virtio_console_open_socket(path);
+		break;
+	case VIRTIO_CONSOLE_BE_PIPE:
+		/* O_RDWR so that neither end has to be there yet */
+		fd = open(path, O_RDWR | O_NONBLOCK);
+		if (fd < 0)
+			WPRINTF(("vtcon: open failed: %s\n", path));
+		else if (fstat(fd, &st) < 0 || !S_ISFIFO(st.st_mode)) {
+			WPRINTF(("vtcon: not a fifo: %s\n", path));
+			close(fd);
+			fd = -1;
+		}
+		break;
 	default:
 		WPRINTF(("not supported backend %d!\n", be_type));
 	}
@@ -626,6 +825,18 @@ virtio_console_config_backend(struct virtio_console_backend *be)
 			atexit(virtio_console_restore_stdio);
 		}
 		break;
+	case VIRTIO_CONSOLE_BE_SOCKET:
+		if (pipe2(be->splice_pipe, O_NONBLOCK) < 0) {
+			WPRINTF(("vtcon: pipe2 failed, errno = %d\n", errno));
+			return -1;
+		}
+		flags = fcntl(fd, F_GETFL);
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+		be->splice = true;
+		break;
+	case VIRTIO_CONSOLE_BE_PIPE:
+		be->splice = true;
+		break;
 	default:
 		break; /* nothing to do */
 	}
@@ -633,6 +844,20 @@ virtio_console_config_backend(struct virtio_console_backend *be)
 	return 0;
 }
 
+static void
+virtio_console_close_splice(struct virtio_console_backend *be)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (be->splice_pipe[i] >= 0) {
+			close(be->splice_pipe[i]);
+			be->splice_pipe[i] = -1;
+		}
+	}
+	be->splice_len = 0;
+}
+
 static int
 virtio_console_add_backend(struct virtio_console *console,
 			   const char *name, const char *path,
@@ -647,6 +872,8 @@ virtio_console_add_backend(struct virtio_console *console,
 		error = -1;
 		goto out;
 	}
+	be->splice_pipe[0] = -1;
+	be->splice_pipe[1] = -1;
 
 	fd = virtio_console_open_backend(path, be_type);
 	if (fd < 0) {
@@ -672,7 +899,8 @@ virtio_console_add_backend(struct virtio_console *console,
 	}
 
 	if (virtio_console_backend_can_read(be_type)) {
-		if (isatty(fd)) {
+		if (isatty(fd) || be_type == VIRTIO_CONSOLE_BE_SOCKET ||
+				be_type == VIRTIO_CONSOLE_BE_PIPE) {
 			be->evp = mevent_add(fd, EVF_READ,
 					virtio_console_backend_read, be,
 					virtio_console_teardown_backend, be);
@@ -698,6 +926,7 @@ out:
 			if (be->be_type == VIRTIO_CONSOLE_BE_PTY &&
 				be->pts_fd > 0)
 				close(be->pts_fd);
+			virtio_console_close_splice(be);
 			free(be);
 		}
 		if (fd != -1 && fd != STDIN_FILENO)
@@ -723,6 +952,9 @@ virtio_console_close_backend(struct virtio_console_backend *be)
 	case VIRTIO_CONSOLE_BE_STDIO:
 		virtio_console_restore_stdio();
 		break;
+	case VIRTIO_CONSOLE_BE_SOCKET:
+		virtio_console_close_splice(be);
+		break;
 	default:
 		break;
 	}
@@ -907,8 +1139,8 @@ virtio_console_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	console->control_port.cb = virtio_console_control_tx;
 	console->control_port.enabled = true;
 
-	/* virtio-console,[@]stdio|tty|pty|file:portname[=portpath]
-	 * [,[@]stdio|tty|pty|file:portname[=portpath]]
+	/* virtio-console,[@]stdio|tty|pty|file|socket|pipe:portname[=portpath]
+	 * [,[@]stdio|tty|pty|file|socket|pipe:portname[=portpath]]
 	 */
 	while ((opt = strsep(&opts, ",")) != NULL) {
 		backend = strsep(&opt, ":");
@@ -977,6 +1209,9 @@ struct pci_vdev_ops pci_ops_virtio_console = {
 	.class_name	= "virtio-console",
 	.vdev_init	= virtio_console_init,
 	.vdev_deinit	= virtio_console_deinit,
+	.vdev_reset	= virtio_pci_reset,
+	.vdev_save	= virtio_pci_save,
+	.vdev_load	= virtio_pci_load,
 	.vdev_barwrite	= virtio_pci_write,
 	.vdev_barread	= virtio_pci_read
 };
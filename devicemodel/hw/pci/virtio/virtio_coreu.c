@@ -323,7 +323,7 @@ virtio_coreu_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			virtio_coreu_thread, (void *)vcoreu);
 	snprintf(tname, sizeof(tname), "vtcoreu-%d:%d tx",
 			dev->slot, dev->func);
-	pthread_setname_np(vcoreu->rx_tid, tname);
+	dm_thread_setname(vcoreu->rx_tid, tname);
 
 	return 0;
 }
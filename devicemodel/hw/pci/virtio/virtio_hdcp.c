@@ -454,7 +454,7 @@ virtio_hdcp_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			virtio_hdcp_talk_to_daemon, (void *)vhdcp);
 	snprintf(tname, sizeof(tname), "vthdcp-%d:%d tx",
 			dev->slot, dev->func);
-	pthread_setname_np(vhdcp->rx_tid, tname);
+	dm_thread_setname(vhdcp->rx_tid, tname);
 
 	return 0;
 }
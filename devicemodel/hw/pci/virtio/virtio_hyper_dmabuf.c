@@ -8,6 +8,13 @@
 /*
  * virtio hyper dmabuf
  * Allows to share data buffers between VMs using dmabuf like interface
+ *
+ * The device model only sets the device up: both virtqueues, the kick
+ * register and the interrupts are served by VBS-K. Export and flip
+ * messages therefore never pass through here. SOS consumers are told
+ * about imported buffers by the hyper_dmabuf driver itself, through
+ * the events it queues on its character device (poll() on it, there
+ * is no need to busy-poll).
  */
 
 #include <fcntl.h>
@@ -101,8 +101,6 @@ struct virtio_input_config {
 
 struct virtio_input_event_elem {
 	struct virtio_input_event		event;
-	struct iovec				iov;
-	uint16_t				idx;
 };
 
 /*
@@ -280,6 +278,7 @@ virtio_input_send_event(struct virtio_input *vi,
 			struct virtio_input_event *event)
 {
 	struct virtio_vq_info *vq;
+	struct virtio_used used[VIRTIO_INPUT_RINGSZ];
 	struct iovec iov;
 	int n, i;
 	uint16_t idx;
@@ -288,7 +287,7 @@ virtio_input_send_event(struct virtio_input *vi,
 		return;
 
 	if (vi->event_qindex == vi->event_qsize) {
-		vi->event_qsize++;
+		vi->event_qsize *= 2;
 		vi->event_queue = realloc(vi->event_queue,
 			vi->event_qsize *
 			sizeof(struct virtio_input_event_elem));
@@ -300,9 +299,13 @@ virtio_input_send_event(struct virtio_input *vi,
 	if (event->type != EV_SYN || event->code != SYN_REPORT)
 		return;
 
+	/*
+	 * The whole frame goes to the guest at once: the used entries are
+	 * published together and there is one interrupt per SYN_REPORT.
+	 */
 	vq = &vi->queues[VIRTIO_INPUT_EVENT_QUEUE];
 	for (i = 0; i < vi->event_qindex; i++) {
-		if (!vq_has_descs(vq)) {
+		if (i == ARRAY_SIZE(used) || !vq_has_descs(vq)) {
 			while (i-- > 0)
 				vq_retchain(vq);
 			WPRINTF(("%s: not enough avail descs, dropped:%d\n",
@@ -311,17 +314,12 @@ virtio_input_send_event(struct virtio_input *vi,
 		}
 		n = vq_getchain(vq, &idx, &iov, 1, NULL);
 		assert(n == 1);
-		vi->event_queue[i].iov = iov;
-		vi->event_queue[i].idx = idx;
-	}
-
-	for (i = 0; i < vi->event_qindex; i++) {
-		memcpy(vi->event_queue[i].iov.iov_base,
-			&vi->event_queue[i].event,
-			sizeof(struct virtio_input_event));
-		vq_relchain(vq, vi->event_queue[i].idx,
+		memcpy(iov.iov_base, &vi->event_queue[i].event,
 			sizeof(struct virtio_input_event));
+		used[i].idx = idx;
+		used[i].tlen = sizeof(struct virtio_input_event);
 	}
+	vq_relchain_batch(vq, used, i);
 
 out:
 	vi->event_qindex = 0;
@@ -335,12 +333,13 @@ virtio_input_read_event(int fd __attribute__((unused)),
 {
 	struct virtio_input *vi = arg;
 	struct virtio_input_event event;
-	struct input_event host_event;
-	int len;
+	struct input_event host_events[VIRTIO_INPUT_RINGSZ];
+	int len, i, n;
 
-	while (1) {
-		len = read(vi->fd, &host_event, sizeof(host_event));
-		if (len != sizeof(host_event)) {
+	/* evdev hands out as many whole events as fit in one read */
+	do {
+		len = read(vi->fd, host_events, sizeof(host_events));
+		if (len <= 0) {
 			if (len == -1 && errno != EAGAIN)
 				WPRINTF(("vtinput: host read failed! "
 					"len = %d, errno = %d\n",
@@ -348,11 +347,14 @@ virtio_input_read_event(int fd __attribute__((unused)),
 			break;
 		}
 
-		event.type = host_event.type;
-		event.code = host_event.code;
-		event.value = host_event.value;
-		virtio_input_send_event(vi, &event);
-	}
+		n = len / sizeof(host_events[0]);
+		for (i = 0; i < n; i++) {
+			event.type = host_events[i].type;
+			event.code = host_events[i].code;
+			event.value = host_events[i].value;
+			virtio_input_send_event(vi, &event);
+		}
+	} while (len == sizeof(host_events));
 }
 
 static int
@@ -27,12 +27,14 @@
 #include <stdint.h>
 #include <assert.h>
 #include <pthread.h>
+#include <poll.h>
 #include <time.h>
 
 #include <linux/uuid.h>
 #include <linux/mei.h>
 
 #include "types.h"
+#include "atomic.h"
 #include "vmmapi.h"
 #include "mevent.h"
 #include "pci_core.h"
@@ -285,6 +287,11 @@ struct mei_virtio_cfg {
 } __attribute__((packed));
 
 #define VMEI_IOBUFS_MAX 8
+/*
+ * Single producer (the TX virtqueue handler, serialized by the virtio
+ * lock) and single consumer (the TX thread): i_idx is only written by the
+ * former and r_idx by the latter, so neither side takes a lock.
+ */
 struct vmei_circular_iobufs {
 	struct iovec                       bufs[VMEI_IOBUFS_MAX];
 	uint8_t                            complete[VMEI_IOBUFS_MAX];
@@ -352,6 +359,7 @@ struct virtio_mei {
 	pthread_t                       tx_thread;
 	pthread_mutex_t                 tx_mutex;
 	pthread_cond_t                  tx_cond;
+	bool                            tx_pending;
 
 	pthread_t                       rx_thread;
 	pthread_mutex_t                 rx_mutex;
@@ -1412,7 +1420,7 @@ vmei_host_client_native_write(struct vmei_host_client *hclient)
 	struct virtio_mei *vmei = vmei_host_client_to_vmei(hclient);
 	ssize_t len, lencnt = 0;
 	int err;
-	unsigned int iovcnt, i;
+	uint8_t i_idx, r_idx;
 	struct vmei_circular_iobufs *bufs = &hclient->send_bufs;
 
 	if (!vmei)
@@ -1424,48 +1432,89 @@ vmei_host_client_native_write(struct vmei_host_client *hclient)
 		return -EINVAL;
 	}
 
-	if (bufs->i_idx == bufs->r_idx) {
+	r_idx = bufs->r_idx;
+	i_idx = atomic_load(&bufs->i_idx);
+	if (i_idx == r_idx) {
 		/* nothing to send actually */
 		WPRINTF("no buffer to send\n");
 		return 0;
 	}
 
-	while (bufs->i_idx != bufs->r_idx) {
-		/*
-		 * calculate number of entries
-		 * while taking care of wraparound
-		 */
-		iovcnt = (bufs->i_idx > bufs->r_idx) ?
-			 (bufs->i_idx - bufs->r_idx) :
-			 (VMEI_IOBUFS_MAX - bufs->r_idx);
-
-		for (i = 0; i < iovcnt; i++) {
-			len = writev(hclient->client_fd,
-				     &bufs->bufs[bufs->r_idx + i],
-				     1);
-			if (len < 0) {
-				err = -errno;
-				if (err != -EAGAIN)
-					WPRINTF("write failed! error[%d]\n",
-						errno);
-				if (err == -ENODEV)
-					vmei_set_status(vmei,
-							VMEI_STS_PENDING_RESET);
-				return -errno;
-			}
-
-			lencnt += len;
-
-			bufs->bufs[bufs->r_idx + i].iov_len = 0;
-			bufs->complete[bufs->r_idx + i] = 0;
+	while (r_idx != i_idx) {
+		len = writev(hclient->client_fd, &bufs->bufs[r_idx], 1);
+		if (len < 0) {
+			err = -errno;
+			if (err != -EAGAIN)
+				WPRINTF("write failed! error[%d]\n", -err);
+			if (err == -ENODEV)
+				vmei_set_status(vmei, VMEI_STS_PENDING_RESET);
+			return err;
 		}
 
-		bufs->r_idx = (bufs->i_idx > bufs->r_idx) ? bufs->i_idx : 0;
+		lencnt += len;
+
+		bufs->bufs[r_idx].iov_len = 0;
+		bufs->complete[r_idx] = 0;
+		r_idx = (r_idx + 1) % VMEI_IOBUFS_MAX;
+		/* hand the slot back to the producer */
+		atomic_store(&bufs->r_idx, r_idx);
 	}
 
 	return lencnt;
 }
 
+static void
+vmei_tx_kick(struct virtio_mei *vmei)
+{
+	pthread_mutex_lock(&vmei->tx_mutex);
+	vmei->tx_pending = true;
+	pthread_cond_signal(&vmei->tx_cond);
+	pthread_mutex_unlock(&vmei->tx_mutex);
+}
+
+/*
+ * Wait at most timeout_ms for the native device to come back from reset.
+ * sysfs wakes up pollers of dev_state with POLLPRI when it changes.
+ */
+static void
+vmei_wait_dev_enabled(struct virtio_mei *vmei, int timeout_ms)
+{
+	char devpath[256];
+	char buf[MEI_DEV_STATE_LEN] = {0};
+	struct pollfd pfd;
+	struct timespec start, now;
+	int fd, sz, left;
+
+	snprintf(devpath, sizeof(devpath) - 1, "%s/%s/%s",
+		 MEI_SYSFS_ROOT, vmei->name, "dev_state");
+
+	fd = open(devpath, O_RDONLY);
+	if (fd < 0) {
+		usleep(timeout_ms * 1000);
+		return;
+	}
+
+	pfd.fd = fd;
+	pfd.events = POLLPRI | POLLERR;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	left = timeout_ms;
+	for (;;) {
+		lseek(fd, 0, SEEK_SET);
+		sz = read(fd, buf, sizeof(buf));
+		if (sz >= 7 && !memcmp(buf, "ENABLED", 7))
+			break;
+
+		if (left <= 0 || poll(&pfd, 1, left) <= 0)
+			break;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		left = timeout_ms - ((now.tv_sec - start.tv_sec) * 1000 +
+			(now.tv_nsec - start.tv_nsec) / 1000000);
+	}
+
+	close(fd);
+}
+
 static void
 vmei_proc_tx(struct virtio_mei *vmei, struct virtio_vq_info *vq)
 {
@@ -1476,7 +1525,7 @@ vmei_proc_tx(struct virtio_mei *vmei, struct virtio_vq_info *vq)
 
 	struct mei_msg_hdr *hdr;
 	uint8_t *data;
-	uint8_t i_idx;
+	uint8_t i_idx, r_idx;
 	struct vmei_circular_iobufs *bufs;
 
 	struct vmei_host_client *hclient  = NULL;
@@ -1511,9 +1560,9 @@ vmei_proc_tx(struct virtio_mei *vmei, struct virtio_vq_info *vq)
 		goto failed;
 	}
 
-	pthread_mutex_lock(&vmei->tx_mutex);
 	bufs = &hclient->send_bufs;
 	i_idx = bufs->i_idx;
+	r_idx = atomic_load(&bufs->r_idx);
 	HCL_DBG(hclient, "TX: client found complete = %d\n",
 		bufs->complete[i_idx]);
 	/* check for overflow
@@ -1521,13 +1570,12 @@ vmei_proc_tx(struct virtio_mei *vmei, struct virtio_vq_info *vq)
 	 *  (1) no available buffers (all buffers are taken) and
 	 *  (2) no space in the current buffer
 	 */
-	if ((i_idx + 1) % VMEI_IOBUFS_MAX == bufs->r_idx ||
+	if ((i_idx + 1) % VMEI_IOBUFS_MAX == r_idx ||
 	    (bufs->buf_sz - bufs->bufs[i_idx].iov_len < hdr->length)) {
 		HCL_DBG(hclient, "TX: overflow\n");
 		/* close the connection according to spec */
 		/* FIXME need to remove the clinet */
 		vmei_hbm_disconnect_client(hclient);
-		pthread_mutex_unlock(&vmei->tx_mutex);
 		vmei_host_client_put(hclient);
 		goto out;
 	}
@@ -1540,12 +1588,10 @@ vmei_proc_tx(struct virtio_mei *vmei, struct virtio_vq_info *vq)
 		/* send complete msg to HW */
 		HCL_DBG(hclient, "TX: completed, sening msg to FW\n");
 		bufs->complete[i_idx] = 1;
-		bufs->i_idx++;
-		if (bufs->i_idx >= VMEI_IOBUFS_MAX) /* wraparound */
-			bufs->i_idx = 0;
-		pthread_cond_signal(&vmei->tx_cond);
+		/* publish the message to the TX thread */
+		atomic_store(&bufs->i_idx, (i_idx + 1) % VMEI_IOBUFS_MAX);
+		vmei_tx_kick(vmei);
 	}
-	pthread_mutex_unlock(&vmei->tx_mutex);
 	vmei_host_client_put(hclient);
 out:
 	/* chain is processed, release it and set tlen */
@@ -1563,8 +1609,8 @@ out:
 failed:
 	if (vmei->status == VMEI_STS_PENDING_RESET) {
 		vmei_virtual_fw_reset(vmei);
-		/* Let's wait 100ms for HBM enumeration done */
-		usleep(100000);
+		/* Let's wait up to 100ms for HBM enumeration done */
+		vmei_wait_dev_enabled(vmei, 100);
 		virtio_config_changed(&vmei->base);
 	}
 	/* drop the data */
@@ -1583,7 +1629,7 @@ vmei_notify_tx(void *data, struct virtio_vq_info *vq)
 
 	pthread_mutex_lock(&vmei->tx_mutex);
 	DPRINTF("TX: New OUT buffer available!\n");
-	vq->used->flags |= ACRN_VRING_USED_F_NO_NOTIFY;
+	vq_set_used_ring_flags(&vmei->base, vq);
 	pthread_mutex_unlock(&vmei->tx_mutex);
 
 	while (vq_has_descs(vq))
@@ -1602,7 +1648,7 @@ vmei_host_ready_send_buffers(struct vmei_host_client *hclient)
 {
 	struct vmei_circular_iobufs *bufs = &hclient->send_bufs;
 
-	return bufs->complete[bufs->r_idx];
+	return atomic_load(&bufs->r_idx) != atomic_load(&bufs->i_idx);
 }
 
 /**
@@ -1612,21 +1658,38 @@ static void *vmei_tx_thread(void *param)
 {
 	struct virtio_mei *vmei = param;
 	struct timespec max_wait = {0, 0};
+	int pending_cnt = 0;
 	int err;
 
 	pthread_mutex_lock(&vmei->tx_mutex);
-	err = pthread_cond_wait(&vmei->tx_cond, &vmei->tx_mutex);
-	assert(err == 0);
-	if (err)
-		goto out;
-
 	while (vmei->status != VMEI_STST_DEINIT) {
 		struct vmei_me_client *me;
 		struct vmei_host_client *e;
 		ssize_t len;
-		int pending_cnt = 0;
 		int send_ready  = 0;
 
+		if (!vmei->tx_pending) {
+			if (pending_cnt == 0) {
+				err = pthread_cond_wait(&vmei->tx_cond,
+							&vmei->tx_mutex);
+			} else {
+				/* retry writes the driver refused */
+				max_wait.tv_sec = time(NULL) + 2;
+				max_wait.tv_nsec = 0;
+				err = pthread_cond_timedwait(&vmei->tx_cond,
+							     &vmei->tx_mutex,
+							     &max_wait);
+				if (err == ETIMEDOUT)
+					vmei->tx_pending = true;
+			}
+			continue;
+		}
+
+		/* the queues are lock-free, only the wakeup needs tx_mutex */
+		vmei->tx_pending = false;
+		pthread_mutex_unlock(&vmei->tx_mutex);
+
+		pending_cnt = 0;
 		pthread_mutex_lock(&vmei->list_mutex);
 		LIST_FOREACH(me, &vmei->active_clients, list) {
 			pthread_mutex_lock(&me->list_mutex);
@@ -1656,21 +1719,8 @@ static void *vmei_tx_thread(void *param)
 unlock:
 		pthread_mutex_unlock(&vmei->list_mutex);
 
-		if (pending_cnt == 0) {
-			err = pthread_cond_wait(&vmei->tx_cond,
-						&vmei->tx_mutex);
-		} else {
-			max_wait.tv_sec = time(NULL) + 2;
-			max_wait.tv_nsec = 0;
-			err = pthread_cond_timedwait(&vmei->tx_cond,
-						     &vmei->tx_mutex,
-						     &max_wait);
-		}
-
-		if (vmei->status == VMEI_STST_DEINIT)
-			goto out;
+		pthread_mutex_lock(&vmei->tx_mutex);
 	}
-out:
 	pthread_mutex_unlock(&vmei->tx_mutex);
 	pthread_exit(NULL);
 }
@@ -1852,10 +1902,8 @@ found:
 	}
 
 	vmei_proc_vclient_rx(hclient, vq);
-	pthread_mutex_lock(&vmei->tx_mutex);
 	if (vmei_host_ready_send_buffers(hclient))
-		pthread_cond_signal(&vmei->tx_cond);
-	pthread_mutex_unlock(&vmei->tx_mutex);
+		vmei_tx_kick(vmei);
 	vmei_host_client_put(hclient);
 
 	return true;
@@ -1873,25 +1921,21 @@ static void *vmei_rx_thread(void *param)
 
 	vq = &vmei->vqs[VMEI_RXQ];
 
-	/*
-	 * Let us wait till the rx queue pointers get initialised &
-	 * first tx signaled
-	 */
 	pthread_mutex_lock(&vmei->rx_mutex);
-	err = pthread_cond_wait(&vmei->rx_cond, &vmei->rx_mutex);
-	assert(err == 0);
-	if (err)
-		goto out;
-
 	while (vmei->status != VMEI_STST_DEINIT) {
-		/* note - rx mutex is locked here */
-		while (vq_ring_ready(vq)) {
-			vq_clear_used_ring_flags(&vmei->base, vq);
-			mb();
-			if (vq_has_descs(vq) &&
-			    vmei->rx_need_sched &&
-			    vmei->status != VMEI_STS_RESET)
-				break;
+		/*
+		 * note - rx mutex is locked here. Wait till the rx queue
+		 * pointers get initialised and there is something to send.
+		 */
+		for (;;) {
+			if (vq_ring_ready(vq)) {
+				vq_clear_used_ring_flags(&vmei->base, vq);
+				mb();
+				if (vq_has_descs(vq) &&
+				    vmei->rx_need_sched &&
+				    vmei->status != VMEI_STS_RESET)
+					break;
+			}
 
 			err = pthread_cond_wait(&vmei->rx_cond,
 						&vmei->rx_mutex);
@@ -1899,7 +1943,7 @@ static void *vmei_rx_thread(void *param)
 			if (err || vmei->status == VMEI_STST_DEINIT)
 				goto out;
 		}
-		vq->used->flags |= ACRN_VRING_USED_F_NO_NOTIFY;
+		vq_set_used_ring_flags(&vmei->base, vq);
 
 		do {
 			vmei->rx_need_sched = vmei_proc_rx(vmei, vq);
@@ -1926,7 +1970,7 @@ vmei_notify_rx(void *data, struct virtio_vq_info *vq)
 	/* Signal the rx thread for processing */
 	pthread_mutex_lock(&vmei->rx_mutex);
 	DPRINTF("RX: New IN buffer available!\n");
-	vq->used->flags |= ACRN_VRING_USED_F_NO_NOTIFY;
+	vq_set_used_ring_flags(&vmei->base, vq);
 	pthread_cond_signal(&vmei->rx_cond);
 	pthread_mutex_unlock(&vmei->rx_mutex);
 }
@@ -2299,7 +2343,7 @@ init:
 	pthread_create(&vmei->tx_thread, NULL,
 		       vmei_tx_thread, vmei);
 	snprintf(tname, sizeof(tname), "vmei-%d:%d tx", dev->slot, dev->func);
-	pthread_setname_np(vmei->tx_thread, tname);
+	dm_thread_setname(vmei->tx_thread, tname);
 
 	/*
 	 * rx stuff
@@ -2309,7 +2353,7 @@ init:
 	pthread_create(&vmei->rx_thread, NULL,
 		       vmei_rx_thread, (void *)vmei);
 	snprintf(tname, sizeof(tname), "vmei-%d:%d rx", dev->slot, dev->func);
-	pthread_setname_np(vmei->rx_thread, tname);
+	dm_thread_setname(vmei->rx_thread, tname);
 
 	/*
 	 * init clients
@@ -27,6 +27,8 @@
  */
 
 #include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <net/ethernet.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -47,9 +49,26 @@
 #include "virtio.h"
 #include "vhost.h"
 #include "dm_string.h"
+#include "atomic.h"
+
+#define NETMAP_WITH_LIBS
+#include "netmap_user.h"
+
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#define VIRTIO_NET_HAVE_URING
+#endif
+
+#if defined(AF_XDP) && defined(__NR_bpf)
+#include <linux/if_xdp.h>
+#include <linux/bpf.h>
+#define VIRTIO_NET_HAVE_XDP
+#endif
 
 #define VIRTIO_NET_RINGSZ	1024
+#define VIRTIO_NET_CTLQ_RINGSZ	64
 #define VIRTIO_NET_MAXSEGS	256
+#define VIRTIO_NET_BATCH	16	/* chains per tap i/o submission */
 
 /*
  * Host capabilities.  Note that we only offer a few of these.
@@ -73,6 +92,7 @@
 #define	VIRTIO_NET_F_CTRL_VLAN	(1 << 19) /* control channel VLAN filtering */
 #define	VIRTIO_NET_F_GUEST_ANNOUNCE \
 				(1 << 21) /* guest can send gratuitous pkts */
+#define	VIRTIO_NET_F_MQ		(1 << 22) /* several rx/tx queue pairs */
 #define	VHOST_NET_F_VIRTIO_NET_HDR \
 				(1 << 27) /* vhost provides virtio_net_hdr */
 
@@ -80,6 +100,12 @@
 	(VIRTIO_NET_F_MAC | VIRTIO_NET_F_MRG_RXBUF | VIRTIO_NET_F_STATUS | \
 	ACRN_VIRTIO_F_NOTIFY_ON_EMPTY | ACRN_VIRTIO_RING_F_INDIRECT_DESC)
 
+/* with the virtio-net header on the tap, which does these for the guest */
+#define VIRTIO_NET_S_OFFLOADS      \
+	(VIRTIO_NET_F_CSUM | VIRTIO_NET_F_GUEST_CSUM | \
+	VIRTIO_NET_F_HOST_TSO4 | VIRTIO_NET_F_HOST_TSO6 | \
+	VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6)
+
 #define VIRTIO_NET_S_VHOSTCAPS      \
 	(ACRN_VIRTIO_F_NOTIFY_ON_EMPTY | ACRN_VIRTIO_RING_F_INDIRECT_DESC | \
 	ACRN_VIRTIO_RING_F_EVENT_IDX | VIRTIO_NET_F_MRG_RXBUF | \
@@ -94,16 +120,40 @@
 struct virtio_net_config {
 	uint8_t  mac[6];
 	uint16_t status;
+	uint16_t max_virtqueue_pairs;
 } __attribute__((packed));
 
 /*
- * Queue definitions.
+ * Queue definitions: the receive and transmit queues of each pair, then
+ * the control queue when there are several pairs.
  */
 #define VIRTIO_NET_RXQ	0
 #define VIRTIO_NET_TXQ	1
-#define VIRTIO_NET_CTLQ	2	/* NB: not yet supported */
 
-#define VIRTIO_NET_MAXQ	3
+#define VIRTIO_NET_MAX_PAIRS	8
+#define VIRTIO_NET_MAX_COALESCE	100000	/* us */
+
+#define VIRTIO_NET_VHOST_USER	"vhost-user="
+#define VIRTIO_NET_XDP		"xdp="
+#define VIRTIO_NET_MAXQ	(2 * VIRTIO_NET_MAX_PAIRS + 1)
+
+/*
+ * Control queue commands, the header is followed by the data of the
+ * command and the ack written by the device.
+ */
+struct virtio_net_ctrl_hdr {
+	uint8_t		class;
+	uint8_t		cmd;
+} __attribute__((packed));
+
+#define VIRTIO_NET_OK	0
+#define VIRTIO_NET_ERR	1
+
+#define VIRTIO_NET_CTRL_MQ		4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET	0
+
+/* the readable part of a command, all of the ones we know fit */
+#define VIRTIO_NET_CTRL_MAXLEN	64
 
 /*
  * Fixed network header size
@@ -118,6 +168,10 @@ struct virtio_net_rxhdr {
 	uint16_t	vrh_bufs;
 } __attribute__((packed));
 
+/* the largest packet the tap hands over with GSO, and a VLAN tag */
+#define VIRTIO_NET_MAXPKT	\
+	(sizeof(struct virtio_net_rxhdr) + 65536 + ETHER_HDR_LEN + 4)
+
 /*
  * Debug printf
  */
@@ -130,46 +184,159 @@ static int virtio_net_debug;
  */
 struct vhost_net {
 	struct vhost_dev vdev;
-	struct vhost_vq vqs[VIRTIO_NET_MAXQ - 1];
+	struct vhost_vq vqs[2];		/* a single queue pair */
 	int tapfd;
 	bool vhost_started;
 };
 
+struct virtio_net;
+
+/*
+ * The io_uring of one direction of a pair, only its thread touches it.
+ */
+struct virtio_net_uring {
+	int			fd;
+	unsigned int		*sq_tail;
+	unsigned int		*sq_mask;
+	unsigned int		*sq_array;
+	unsigned int		*cq_head;
+	unsigned int		*cq_tail;
+	unsigned int		*cq_mask;
+	struct io_uring_sqe	*sqes;
+	struct io_uring_cqe	*cqes;
+	void			*sq_ring;
+	void			*cq_ring;
+	size_t			sq_ring_sz;
+	size_t			cq_ring_sz;
+	size_t			sqes_sz;
+};
+
 /*
- * Per-device struct
+ * An AF_XDP socket and its umem, the rx frames are only touched by the
+ * mevent loop of the pair and the tx ones by its tx thread.
  */
-struct virtio_net {
-	struct virtio_base base;
-	struct virtio_vq_info queues[VIRTIO_NET_MAXQ - 1];
-	pthread_mutex_t mtx;
+#define VIRTIO_NET_XDP_FRAMES	4096
+#define VIRTIO_NET_XDP_FRAMESZ	2048
+#define VIRTIO_NET_XDP_UMEMSZ	(VIRTIO_NET_XDP_FRAMES * VIRTIO_NET_XDP_FRAMESZ)
+#define VIRTIO_NET_XDP_RINGSZ	2048	/* room for the frames of a ring */
+#define VIRTIO_NET_XDP_TXBATCH	32
+
+struct virtio_net_xdp_ring {
+	uint32_t	*producer;
+	uint32_t	*consumer;
+	void		*descs;
+	uint32_t	mask;
+	void		*map;
+	size_t		map_sz;
+};
+
+struct virtio_net_xdp {
+	int		fd;
+	int		map_fd;		/* XSKMAP of the program */
+	int		prog_fd;
+	int		link_fd;	/* of the program to the interface */
+	uint8_t		*umem;
+	struct virtio_net_xdp_ring fill;
+	struct virtio_net_xdp_ring comp;
+	struct virtio_net_xdp_ring rx;
+	struct virtio_net_xdp_ring tx;
+	uint64_t	tx_free[VIRTIO_NET_XDP_FRAMES / 2];
+	int		tx_nfree;
+	int		tx_queued;	/* not yet kicked */
+};
+
+struct virtio_net_rxslot {
+	struct iovec	iov[VIRTIO_NET_MAXSEGS];
+	struct iovec	*riov;		/* past the rx header */
+	int		n;		/* of riov */
+	void		*vrx;
+	uint16_t	idx;
+};
+
+struct virtio_net_txslot {
+	struct iovec	iov[VIRTIO_NET_MAXSEGS + 1];	/* room for the pad */
+	int		first;		/* iov the tap is given from */
+	int		n;
+	int		tlen;
+	uint16_t	idx;
+};
+
+/*
+ * The chains of a pair which are moved to and from the tap together. A
+ * receive chain which got no packet is held for the next ones, as the
+ * chains after it may have been filled already.
+ */
+struct virtio_net_batch {
+	struct virtio_net_uring	*rx_ring;	/* NULL without io_uring */
+	struct virtio_net_uring	*tx_ring;
+	struct virtio_net_rxslot *rx_slots[VIRTIO_NET_BATCH];
+	int			rx_held;	/* at the head of rx_slots */
+	struct virtio_net_rxslot rx[VIRTIO_NET_BATCH];
+	struct virtio_net_txslot tx[VIRTIO_NET_BATCH];
+};
+
+/*
+ * A receive and a transmit queue, with a queue of the tap device of
+ * their own, served by a mevent loop and a tx thread of their own.
+ */
+struct virtio_net_pair {
+	struct virtio_net *net;
+	struct virtio_vq_info *rxq;
+	struct virtio_vq_info *txq;
 	struct mevent	*mevp;
 
 	int		tapfd;
+	struct virtio_net_batch	*batch;	/* of the tap */
+	struct virtio_net_xdp	*xdp;	/* in place of the tap */
+	struct nm_desc		*nmd;	/* or a netmap port */
 
 	int		rx_ready;
 
+	pthread_mutex_t	rx_mtx;
+	int		rx_in_progress;
+	pthread_t	tx_tid;
+	pthread_mutex_t	tx_mtx;
+	pthread_cond_t	tx_cond;
+	int		tx_in_progress;
+};
+
+/*
+ * Per-device struct
+ */
+struct virtio_net {
+	struct virtio_base base;
+	struct virtio_ops ops;
+	struct virtio_vq_info queues[VIRTIO_NET_MAXQ];
+	pthread_mutex_t mtx;
+
+	struct virtio_net_pair pairs[VIRTIO_NET_MAX_PAIRS];
+	int		npairs;
+	int		curr_pairs;	/* enabled by the guest */
+	int		teardowns;	/* of the pairs, still to come */
+
 	volatile int	resetting;	/* set and checked outside lock */
-	volatile int	closing;	/* stop the tx i/o thread */
+	volatile int	closing;	/* stop the tx i/o threads */
 
 	uint64_t	features;	/* negotiated features */
 
 	struct virtio_net_config config;
 
-	pthread_mutex_t	rx_mtx;
-	int		rx_in_progress;
 	int		rx_vhdrlen;
 	int		rx_merge;	/* merged rx bufs in use */
-	pthread_t	tx_tid;
-	pthread_mutex_t	tx_mtx;
-	pthread_cond_t	tx_cond;
-	int		tx_in_progress;
+	int		rx_bigpkt;	/* a packet may take several of them */
+	int		tap_vnet_hdr;	/* the tap has the virtio-net header */
 
-	void (*virtio_net_rx)(struct virtio_net *net);
-	void (*virtio_net_tx)(struct virtio_net *net, struct iovec *iov,
+	void (*virtio_net_rx)(struct virtio_net_pair *pair);
+	void (*virtio_net_tx)(struct virtio_net_pair *pair, struct iovec *iov,
 			     int iovcnt, int len);
+	/* when the tx thread is done with the chains it got */
+	void (*virtio_net_tx_flush)(struct virtio_net_pair *pair);
 
 	struct vhost_net *vhost_net;
 	bool		use_vhost;
+	uint32_t	busypoll[2];	/* us, of the rx and tx vhost queues */
+	int		vhost_cpu;	/* of the vhost worker, or -1 */
+	uint32_t	intr_coalesce;	/* us, 0 for an irqfd */
 };
 
 static void virtio_net_reset(void *vdev);
@@ -182,14 +349,14 @@ static void virtio_net_neg_features(void *vdev, uint64_t negotiated_features);
 static void virtio_net_set_status(void *vdev, uint64_t status);
 static void virtio_net_teardown(void *param);
 static struct vhost_net *vhost_net_init(struct virtio_base *base, int vhostfd,
-	int tapfd, int vq_idx);
+	int tapfd, int vq_idx, bool user);
 static int vhost_net_deinit(struct vhost_net *vhost_net);
 static int vhost_net_start(struct vhost_net *vhost_net);
 static int vhost_net_stop(struct vhost_net *vhost_net);
 
-static struct virtio_ops virtio_net_ops = {
+static const struct virtio_ops virtio_net_ops = {
 	"vtnet",			/* our name */
-	VIRTIO_NET_MAXQ - 1,		/* we currently support 2 virtqueues */
+	2,				/* 2 virtqueues, or 2 per pair + 1 */
 	sizeof(struct virtio_net_config), /* config reg size */
 	virtio_net_reset,		/* reset */
 	NULL,				/* device-wide qnotify -- not used */
@@ -234,36 +401,62 @@ ether_aton(const char *a, struct ether_addr *e)
  * If the transmit thread is active then stall until it is done.
  */
 static void
-virtio_net_txwait(struct virtio_net *net)
+virtio_net_txwait(struct virtio_net_pair *pair)
 {
-	pthread_mutex_lock(&net->tx_mtx);
-	while (net->tx_in_progress) {
-		pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&pair->tx_mtx);
+	while (pair->tx_in_progress) {
+		pthread_mutex_unlock(&pair->tx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&pair->tx_mtx);
 	}
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_unlock(&pair->tx_mtx);
 }
 
 /*
  * If the receive thread is active then stall until it is done.
  */
 static void
-virtio_net_rxwait(struct virtio_net *net)
+virtio_net_rxwait(struct virtio_net_pair *pair)
 {
-	pthread_mutex_lock(&net->rx_mtx);
-	while (net->rx_in_progress) {
-		pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_lock(&pair->rx_mtx);
+	while (pair->rx_in_progress) {
+		pthread_mutex_unlock(&pair->rx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->rx_mtx);
+		pthread_mutex_lock(&pair->rx_mtx);
+	}
+	pthread_mutex_unlock(&pair->rx_mtx);
+}
+
+/*
+ * Attach the queues of the tap device of the first @n pairs, and detach
+ * the others, so that the tap doesn't hand its packets to a queue the
+ * guest doesn't use.
+ */
+static void
+virtio_net_set_pairs(struct virtio_net *net, int n)
+{
+	struct ifreq ifr;
+	int i;
+
+	for (i = 1; i < net->npairs; i++) {
+		if ((i < n) == (i < net->curr_pairs) ||
+		    net->pairs[i].tapfd < 0)
+			continue;
+
+		memset(&ifr, 0, sizeof(ifr));
+		ifr.ifr_flags = (i < n) ? IFF_ATTACH_QUEUE : IFF_DETACH_QUEUE;
+		if (ioctl(net->pairs[i].tapfd, TUNSETQUEUE, &ifr) < 0)
+			WPRINTF(("vtnet: tap queue %d %s failed: %d\n", i,
+				(i < n) ? "attach" : "detach", errno));
 	}
-	pthread_mutex_unlock(&net->rx_mtx);
+	net->curr_pairs = n;
 }
 
 static void
 virtio_net_reset(void *vdev)
 {
 	struct virtio_net *net = vdev;
+	int i;
 
 	DPRINTF(("vtnet: device reset requested !\n"));
 
@@ -273,46 +466,218 @@ virtio_net_reset(void *vdev)
 	 * Wait for the transmit and receive threads to finish their
 	 * processing.
 	 */
-	virtio_net_txwait(net);
-	virtio_net_rxwait(net);
+	for (i = 0; i < net->npairs; i++) {
+		virtio_net_txwait(&net->pairs[i]);
+		virtio_net_rxwait(&net->pairs[i]);
+		net->pairs[i].rx_ready = 0;
+		/* the held chains are of the rings being reset */
+		if (net->pairs[i].batch)
+			net->pairs[i].batch->rx_held = 0;
+	}
 
-	net->rx_ready = 0;
 	net->rx_merge = 1;
+	net->rx_bigpkt = 0;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
 
 	/* now reset rings, MSI-X vectors, and negotiated capabilities */
 	virtio_reset_dev(&net->base);
 
+	/* the guest has the first pair until it asks for more */
+	virtio_net_set_pairs(net, 1);
+
 	net->resetting = 0;
 	net->closing = 0;
 }
 
 /*
- * Send signal to tx I/O thread and wait till it exits
+ * Send signal to tx I/O threads and wait till they exit
  */
 static void
 virtio_net_tx_stop(struct virtio_net *net)
 {
 	void *jval;
+	int i;
 
 	net->closing = 1;
 
-	pthread_cond_broadcast(&net->tx_cond);
+	for (i = 0; i < net->npairs; i++) {
+		pthread_mutex_lock(&net->pairs[i].tx_mtx);
+		pthread_cond_broadcast(&net->pairs[i].tx_cond);
+		pthread_mutex_unlock(&net->pairs[i].tx_mtx);
+		pthread_join(net->pairs[i].tx_tid, &jval);
+	}
+}
+
+#ifdef VIRTIO_NET_HAVE_URING
+static void
+virtio_net_uring_queue(struct virtio_net_uring *ur, uint8_t opcode, int fd,
+		       struct iovec *iov, int iovcnt, int i)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail, idx;
+
+	tail = *ur->sq_tail;
+	idx = tail & *ur->sq_mask;
+	sqe = &ur->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)iov;
+	sqe->len = iovcnt;
+	sqe->user_data = i;
+	/* a read would wait for a packet otherwise, not fail with EAGAIN */
+	if (opcode == IORING_OP_READV)
+		sqe->rw_flags = RWF_NOWAIT;
+
+	ur->sq_array[idx] = idx;
+	atomic_store(ur->sq_tail, tail + 1);
+}
+
+/*
+ * Submit the n transfers queued and wait for them, res[i] gets the result
+ * of the i-th one. On error the ring is of no more use, and the transfers
+ * which didn't complete are left at -ECANCELED.
+ */
+static int
+virtio_net_uring_run(struct virtio_net_uring *ur, int n, int *res)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head;
+	int i, ret, want = n, submitted = 0, done = 0;
+
+	for (i = 0; i < n; i++)
+		res[i] = -ECANCELED;
+
+	while (done < want) {
+		ret = syscall(__NR_io_uring_enter, ur->fd, want - submitted,
+				want - done, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0 && errno != EINTR) {
+			WPRINTF(("vtnet: io_uring error %d\n", errno));
+			if (want < n || submitted == 0)
+				return -1;
+			/* only wait for what the kernel took */
+			want = submitted;
+		} else if (ret > 0)
+			submitted += ret;
+
+		head = *ur->cq_head;
+		while (head != atomic_load(ur->cq_tail)) {
+			cqe = &ur->cqes[head & *ur->cq_mask];
+			if (cqe->user_data < n)
+				res[cqe->user_data] = cqe->res;
+			head++;
+			done++;
+		}
+		atomic_store(ur->cq_head, head);
+	}
+
+	return (want < n) ? -1 : 0;
+}
+
+static void
+virtio_net_uring_free(struct virtio_net_uring *ur)
+{
+	if (ur == NULL)
+		return;
+	if (ur->sqes != NULL && ur->sqes != MAP_FAILED)
+		munmap(ur->sqes, ur->sqes_sz);
+	if (ur->cq_ring != NULL && ur->cq_ring != MAP_FAILED)
+		munmap(ur->cq_ring, ur->cq_ring_sz);
+	if (ur->sq_ring != NULL && ur->sq_ring != MAP_FAILED)
+		munmap(ur->sq_ring, ur->sq_ring_sz);
+	close(ur->fd);
+	free(ur);
+}
+
+static struct virtio_net_uring *
+virtio_net_uring_init(void)
+{
+	struct io_uring_params p;
+	struct virtio_net_uring *ur;
+	char *sq, *cq;
+
+	ur = calloc(1, sizeof(struct virtio_net_uring));
+	if (ur == NULL)
+		return NULL;
+
+	memset(&p, 0, sizeof(p));
+	ur->fd = syscall(__NR_io_uring_setup, VIRTIO_NET_BATCH, &p);
+	if (ur->fd < 0) {
+		free(ur);
+		return NULL;
+	}
+
+	ur->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ur->cq_ring_sz = p.cq_off.cqes +
+			p.cq_entries * sizeof(struct io_uring_cqe);
+	ur->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ur->sq_ring = mmap(NULL, ur->sq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+	ur->cq_ring = mmap(NULL, ur->cq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_CQ_RING);
+	ur->sqes = mmap(NULL, ur->sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+	if (ur->sq_ring == MAP_FAILED || ur->cq_ring == MAP_FAILED ||
+	    ur->sqes == MAP_FAILED) {
+		virtio_net_uring_free(ur);
+		return NULL;
+	}
+
+	sq = ur->sq_ring;
+	ur->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	ur->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	ur->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	cq = ur->cq_ring;
+	ur->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	ur->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	ur->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return ur;
+}
+
+#define VIRTIO_NET_OP_READV	IORING_OP_READV
+#define VIRTIO_NET_OP_WRITEV	IORING_OP_WRITEV
+#else
+#define VIRTIO_NET_OP_READV	0
+#define VIRTIO_NET_OP_WRITEV	0
+
+static void
+virtio_net_uring_queue(struct virtio_net_uring *ur, uint8_t opcode, int fd,
+		       struct iovec *iov, int iovcnt, int i)
+{
+}
+
+static int
+virtio_net_uring_run(struct virtio_net_uring *ur, int n, int *res)
+{
+	return -1;
+}
+
+static void
+virtio_net_uring_free(struct virtio_net_uring *ur)
+{
+}
 
-	pthread_join(net->tx_tid, &jval);
+static struct virtio_net_uring *
+virtio_net_uring_init(void)
+{
+	return NULL;
 }
+#endif
 
 /*
  * Called to send a buffer chain out to the tap device
  */
 static void
-virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
+virtio_net_tap_tx(struct virtio_net_pair *pair, struct iovec *iov, int iovcnt,
 		  int len)
 {
 	static char pad[60]; /* all zero bytes */
 	ssize_t ret;
 
-	if (net->tapfd == -1)
+	if (pair->tapfd == -1)
 		return;
 
 	/*
@@ -325,7 +690,7 @@ virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
 		iov[iovcnt].iov_len = 60 - len;
 		iovcnt++;
 	}
-	ret = writev(net->tapfd, iov, iovcnt);
+	ret = writev(pair->tapfd, iov, iovcnt);
 	(void)ret; /*avoid compiler warning*/
 }
 
@@ -336,7 +701,7 @@ virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
  *  MP note: the dummybuf is only used for discarding frames, so there
  * is no need for it to be per-vtnet or locked.
  */
-static uint8_t dummybuf[2048];
+static uint8_t dummybuf[VIRTIO_NET_MAXPKT];
 
 static inline struct iovec *
 rx_iov_trim(struct iovec *iov, int *niov, int tlen)
@@ -359,30 +724,219 @@ rx_iov_trim(struct iovec *iov, int *niov, int tlen)
 	return riov;
 }
 
+/*
+ * Add the chains the guest made available to the held ones, up to a
+ * batch.
+ */
+static int
+virtio_net_rx_fill(struct virtio_net_pair *pair, struct virtio_vq_info *vq)
+{
+	struct virtio_net_batch *b = pair->batch;
+	struct virtio_net_rxslot *s;
+	int n, cnt;
+
+	for (n = b->rx_held; n < VIRTIO_NET_BATCH && vq_has_descs(vq); n++) {
+		s = b->rx_slots[n];
+		cnt = vq_getchain(vq, &s->idx, s->iov, VIRTIO_NET_MAXSEGS, NULL);
+		assert(cnt >= 1 && cnt <= VIRTIO_NET_MAXSEGS);
+
+		/*
+		 * Get a pointer to the rx header, and use the
+		 * data immediately following it for the packet buffer,
+		 * unless the tap writes the header itself.
+		 */
+		s->vrx = s->iov[0].iov_base;
+		if (pair->net->tap_vnet_hdr) {
+			assert(s->iov[0].iov_len >= pair->net->rx_vhdrlen);
+			s->riov = s->iov;
+		} else
+			s->riov = rx_iov_trim(s->iov, &cnt,
+					      pair->net->rx_vhdrlen);
+		s->n = cnt;
+	}
+	return n;
+}
+
+/*
+ * Read a packet into each of the n first chains, all of them at once with
+ * io_uring, and release the chains which got one. Returns how many did.
+ */
+static int
+virtio_net_rx_batch(struct virtio_net_pair *pair, struct virtio_vq_info *vq,
+		    int n)
+{
+	struct virtio_net *net = pair->net;
+	struct virtio_net_batch *b = pair->batch;
+	struct virtio_net_rxslot *slots[VIRTIO_NET_BATCH], *s;
+	struct virtio_used used[VIRTIO_NET_BATCH];
+	int res[VIRTIO_NET_BATCH];
+	int i, j, held;
+
+	if (b->rx_ring) {
+		for (i = 0; i < n; i++)
+			virtio_net_uring_queue(b->rx_ring, VIRTIO_NET_OP_READV,
+				pair->tapfd, b->rx_slots[i]->riov,
+				b->rx_slots[i]->n, i);
+		/* the tap of an older kernel may not take RWF_NOWAIT */
+		if (virtio_net_uring_run(b->rx_ring, n, res) < 0 ||
+		    res[0] == -EOPNOTSUPP || res[0] == -EINVAL) {
+			virtio_net_uring_free(b->rx_ring);
+			b->rx_ring = NULL;
+		}
+	} else {
+		for (i = 0; i < n; i++)
+			res[i] = -ECANCELED;
+		for (i = 0; i < n; i++) {
+			s = b->rx_slots[i];
+			res[i] = readv(pair->tapfd, s->riov, s->n);
+			if (res[i] < 0) {
+				res[i] = -errno;
+				break;
+			}
+		}
+	}
+
+	/* the held chains go first, the released ones after them */
+	for (i = 0, held = 0; i < n; i++) {
+		if (res[i] < 0)
+			slots[held++] = b->rx_slots[i];
+	}
+	for (i = 0, j = held; i < n; i++) {
+		s = b->rx_slots[i];
+		if (res[i] < 0)
+			continue;
+
+		/*
+		 * Without the header of the tap, the only valid field in
+		 * the rx packet header is the number of buffers if merged
+		 * rx bufs were negotiated.
+		 */
+		if (!net->tap_vnet_hdr)
+			memset(s->vrx, 0, net->rx_vhdrlen);
+
+		if (net->rx_merge) {
+			struct virtio_net_rxhdr *vrxh;
+
+			vrxh = s->vrx;
+			vrxh->vrh_bufs = 1;
+		}
+
+		used[j - held].idx = s->idx;
+		used[j - held].tlen = res[i] +
+			(net->tap_vnet_hdr ? 0 : net->rx_vhdrlen);
+		slots[j++] = s;
+	}
+	vq_relchain_batch(vq, used, n - held);
+	memcpy(b->rx_slots, slots, n * sizeof(slots[0]));
+	b->rx_held = held;
+
+	return n - held;
+}
+
+/*
+ * With GSO, a packet of up to 64KB may need several of the merged rx
+ * buffers, each a chain. It is read into as many chains as it can take,
+ * those it didn't fill are given back to the ring.
+ */
+static void
+virtio_net_rx_merged(struct virtio_net_pair *pair, struct virtio_vq_info *vq)
+{
+	struct virtio_net *net = pair->net;
+	struct iovec iov[VIRTIO_NET_MAXSEGS + 1];
+	uint16_t idx[VIRTIO_NET_MAXSEGS];
+	size_t caps[VIRTIO_NET_MAXSEGS];
+	struct virtio_used chains[VIRTIO_NET_MAXSEGS];
+	struct virtio_net_rxhdr *vrxh;
+	size_t cap, left;
+	int i, n, niov, nchains, used;
+	ssize_t len;
+
+	do {
+		cap = 0;
+		niov = 0;
+		nchains = 0;
+		while (cap < VIRTIO_NET_MAXPKT && niov < VIRTIO_NET_MAXSEGS &&
+		       vq_has_descs(vq)) {
+			n = vq_getchain(vq, &idx[nchains], &iov[niov],
+					VIRTIO_NET_MAXSEGS - niov, NULL);
+			assert(n >= 1 && n <= VIRTIO_NET_MAXSEGS);
+			if (niov + n > VIRTIO_NET_MAXSEGS) {
+				vq_retchain(vq);
+				break;
+			}
+
+			caps[nchains] = 0;
+			for (i = niov; i < niov + n; i++)
+				caps[nchains] += iov[i].iov_len;
+			cap += caps[nchains];
+			niov += n;
+			nchains++;
+		}
+		assert(iov[0].iov_len >= net->rx_vhdrlen);
+
+		/* what doesn't fit in the buffers goes to the dummy one */
+		iov[niov].iov_base = dummybuf;
+		iov[niov].iov_len = sizeof(dummybuf);
+
+		len = readv(pair->tapfd, iov, niov + 1);
+		if (len < 0 || len > cap) {
+			for (i = 0; i < nchains; i++)
+				vq_retchain(vq);
+
+			/*
+			 * No more packets, but still some avail ring
+			 * entries.  Interrupt if needed/appropriate.
+			 */
+			if (len < 0) {
+				vq_endchains(vq, 0);
+				return;
+			}
+
+			/* dropped, too big for the buffers left */
+			continue;
+		}
+
+		for (used = 1, left = caps[0]; left < len; used++)
+			left += caps[used];
+		vrxh = iov[0].iov_base;
+		vrxh->vrh_bufs = used;
+
+		for (i = 0, left = len; i < used; i++) {
+			chains[i].idx = idx[i];
+			chains[i].tlen = MIN(left, caps[i]);
+			left -= chains[i].tlen;
+		}
+		vq_relchain_batch(vq, chains, used);
+		for (i = used; i < nchains; i++)
+			vq_retchain(vq);
+	} while (vq_has_descs(vq));
+
+	/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
+	vq_endchains(vq, 1);
+}
+
 static void
-virtio_net_tap_rx(struct virtio_net *net)
+virtio_net_tap_rx(struct virtio_net_pair *pair)
 {
-	struct iovec iov[VIRTIO_NET_MAXSEGS], *riov;
+	struct virtio_net *net = pair->net;
 	struct virtio_vq_info *vq;
-	void *vrx;
-	int len, n;
-	uint16_t idx;
+	int n, done;
 	ssize_t ret;
 
 	/*
 	 * Should never be called without a valid tap fd
 	 */
-	assert(net->tapfd != -1);
+	assert(pair->tapfd != -1);
 
 	/*
 	 * But, will be called when the rx ring hasn't yet
 	 * been set up or the guest is resetting the device.
 	 */
-	if (!net->rx_ready || net->resetting) {
+	if (!pair->rx_ready || net->resetting) {
 		/*
 		 * Drop the packet and try later.
 		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
+		ret = read(pair->tapfd, dummybuf, sizeof(dummybuf));
 		(void)ret; /*avoid compiler warning*/
 
 		return;
@@ -391,63 +945,37 @@ virtio_net_tap_rx(struct virtio_net *net)
 	/*
 	 * Check for available rx buffers
 	 */
-	vq = &net->queues[VIRTIO_NET_RXQ];
-	if (!vq_has_descs(vq)) {
+	vq = pair->rxq;
+	if (pair->batch->rx_held == 0 && !vq_has_descs(vq)) {
 		/*
 		 * Drop the packet and try later.  Interrupt on
 		 * empty, if that's negotiated.
 		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
+		ret = read(pair->tapfd, dummybuf, sizeof(dummybuf));
 		(void)ret; /*avoid compiler warning*/
 
 		vq_endchains(vq, 1);
 		return;
 	}
 
-	do {
-		/*
-		 * Get descriptor chain.
-		 */
-		n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
-		assert(n >= 1 && n <= VIRTIO_NET_MAXSEGS);
-
-		/*
-		 * Get a pointer to the rx header, and use the
-		 * data immediately following it for the packet buffer.
-		 */
-		vrx = iov[0].iov_base;
-		riov = rx_iov_trim(iov, &n, net->rx_vhdrlen);
-
-		len = readv(net->tapfd, riov, n);
-
-		if (len < 0 && errno == EWOULDBLOCK) {
-			/*
-			 * No more packets, but still some avail ring
-			 * entries.  Interrupt if needed/appropriate.
-			 */
-			vq_retchain(vq);
-			vq_endchains(vq, 0);
-			return;
-		}
-
-		/*
-		 * The only valid field in the rx packet header is the
-		 * number of buffers if merged rx bufs were negotiated.
-		 */
-		memset(vrx, 0, net->rx_vhdrlen);
-
-		if (net->rx_merge) {
-			struct virtio_net_rxhdr *vrxh;
+	if (net->rx_bigpkt) {
+		virtio_net_rx_merged(pair, vq);
+		return;
+	}
 
-			vrxh = vrx;
-			vrxh->vrh_bufs = 1;
-		}
+	do {
+		n = virtio_net_rx_fill(pair, vq);
+		done = virtio_net_rx_batch(pair, vq, n);
+	} while (done == n && vq_has_descs(vq));
 
+	if (done < n) {
 		/*
-		 * Release this chain and handle more chains.
+		 * No more packets, but still some avail ring
+		 * entries.  Interrupt if needed/appropriate.
 		 */
-		vq_relchain(vq, idx, len + net->rx_vhdrlen);
-	} while (vq_has_descs(vq));
+		vq_endchains(vq, 0);
+		return;
+	}
 
 	/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
 	vq_endchains(vq, 1);
@@ -456,13 +984,13 @@ virtio_net_tap_rx(struct virtio_net *net)
 static void
 virtio_net_rx_callback(int fd, enum ev_type type, void *param)
 {
-	struct virtio_net *net = param;
+	struct virtio_net_pair *pair = param;
 
-	pthread_mutex_lock(&net->rx_mtx);
-	net->rx_in_progress = 1;
-	net->virtio_net_rx(net);
-	net->rx_in_progress = 0;
-	pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_lock(&pair->rx_mtx);
+	pair->rx_in_progress = 1;
+	pair->net->virtio_net_rx(pair);
+	pair->rx_in_progress = 0;
+	pthread_mutex_unlock(&pair->rx_mtx);
 
 }
 
@@ -470,18 +998,19 @@ static void
 virtio_net_ping_rxq(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_net *net = vdev;
+	struct virtio_net_pair *pair = &net->pairs[vq->num / 2];
 
 	/*
 	 * A qnotify means that the rx process can now begin
 	 */
-	if (net->rx_ready == 0) {
-		net->rx_ready = 1;
-		vq->used->flags |= ACRN_VRING_USED_F_NO_NOTIFY;
+	if (pair->rx_ready == 0) {
+		pair->rx_ready = 1;
+		vq_set_used_ring_flags(&net->base, vq);
 	}
 }
 
 static void
-virtio_net_proctx(struct virtio_net *net, struct virtio_vq_info *vq)
+virtio_net_proctx(struct virtio_net_pair *pair, struct virtio_vq_info *vq)
 {
 	struct iovec iov[VIRTIO_NET_MAXSEGS + 1];
 	int i, n;
@@ -503,16 +1032,85 @@ virtio_net_proctx(struct virtio_net *net, struct virtio_vq_info *vq)
 	}
 
 	DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r", plen, n));
-	net->virtio_net_tx(net, &iov[1], n - 1, plen);
+	/* the tap with the virtio-net header takes the one of the guest */
+	if (pair->net->tap_vnet_hdr)
+		pair->net->virtio_net_tx(pair, iov, n, plen);
+	else
+		pair->net->virtio_net_tx(pair, &iov[1], n - 1, plen);
 
 	/* chain is processed, release it and set tlen */
 	vq_relchain(vq, idx, tlen);
 }
 
+/*
+ * Like virtio_net_proctx, for a batch of chains written to the tap with a
+ * single io_uring submission.
+ */
+static void
+virtio_net_proctx_batch(struct virtio_net_pair *pair,
+			struct virtio_vq_info *vq)
+{
+	static char pad[60]; /* all zero bytes */
+	struct virtio_net_batch *b = pair->batch;
+	struct virtio_net_txslot *s;
+	struct virtio_used used[VIRTIO_NET_BATCH];
+	int res[VIRTIO_NET_BATCH];
+	int i, j, n, cnt, plen;
+	ssize_t ret;
+
+	for (n = 0; n < VIRTIO_NET_BATCH && vq_has_descs(vq); n++) {
+		s = &b->tx[n];
+		cnt = vq_getchain(vq, &s->idx, s->iov, VIRTIO_NET_MAXSEGS, NULL);
+		assert(cnt >= 1 && cnt <= VIRTIO_NET_MAXSEGS);
+		plen = 0;
+		s->tlen = s->iov[0].iov_len;
+		for (j = 1; j < cnt; j++) {
+			plen += s->iov[j].iov_len;
+			s->tlen += s->iov[j].iov_len;
+		}
+		s->first = pair->net->tap_vnet_hdr ? 0 : 1;
+		s->n = cnt - s->first;
+
+		/* pad out to 60 bytes, as virtio_net_tap_tx does */
+		if (plen < 60) {
+			s->iov[cnt].iov_base = pad;
+			s->iov[cnt].iov_len = 60 - plen;
+			s->n++;
+		}
+
+		DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r",
+			 plen, cnt));
+		virtio_net_uring_queue(b->tx_ring, VIRTIO_NET_OP_WRITEV,
+				       pair->tapfd, &s->iov[s->first], s->n, n);
+	}
+
+	if (virtio_net_uring_run(b->tx_ring, n, res) < 0) {
+		virtio_net_uring_free(b->tx_ring);
+		b->tx_ring = NULL;
+		/* what the ring didn't send is written the usual way */
+		for (i = 0; i < n; i++) {
+			if (res[i] == -ECANCELED) {
+				s = &b->tx[i];
+				ret = writev(pair->tapfd, &s->iov[s->first],
+					     s->n);
+				(void)ret; /*avoid compiler warning*/
+			}
+		}
+	}
+
+	/* the chains are processed, release them and set tlen */
+	for (i = 0; i < n; i++) {
+		used[i].idx = b->tx[i].idx;
+		used[i].tlen = b->tx[i].tlen;
+	}
+	vq_relchain_batch(vq, used, n);
+}
+
 static void
 virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_net *net = vdev;
+	struct virtio_net_pair *pair = &net->pairs[vq->num / 2];
 
 	/*
 	 * Any ring entries to process?
@@ -521,35 +1119,38 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 		return;
 
 	/* Signal the tx thread for processing */
-	pthread_mutex_lock(&net->tx_mtx);
-	vq->used->flags |= ACRN_VRING_USED_F_NO_NOTIFY;
-	if (net->tx_in_progress == 0)
-		pthread_cond_signal(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&pair->tx_mtx);
+	vq_set_used_ring_flags(&net->base, vq);
+	if (pair->tx_in_progress == 0)
+		pthread_cond_signal(&pair->tx_cond);
+	pthread_mutex_unlock(&pair->tx_mtx);
 }
 
 /*
- * Thread which will handle processing of TX desc
+ * Thread which will handle processing of TX desc of a queue pair
  */
 static void *
 virtio_net_tx_thread(void *param)
 {
-	struct virtio_net *net = param;
+	struct virtio_net_pair *pair = param;
+	struct virtio_net *net = pair->net;
 	struct virtio_vq_info *vq;
 	int error;
 
-	vq = &net->queues[VIRTIO_NET_TXQ];
+	vq = pair->txq;
 
 	/*
 	 * Let us wait till the tx queue pointers get initialised &
 	 * first tx signaled
 	 */
-	pthread_mutex_lock(&net->tx_mtx);
-	error = pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
-	assert(error == 0);
+	pthread_mutex_lock(&pair->tx_mtx);
+	if (!net->closing) {
+		error = pthread_cond_wait(&pair->tx_cond, &pair->tx_mtx);
+		assert(error == 0);
+	}
 	if (net->closing) {
 		WPRINTF(("vtnet tx thread closing...\n"));
-		pthread_mutex_unlock(&net->tx_mtx);
+		pthread_mutex_unlock(&pair->tx_mtx);
 		return NULL;
 	}
 
@@ -562,18 +1163,19 @@ virtio_net_tx_thread(void *param)
 			if (!net->resetting && vq_has_descs(vq))
 				break;
 
-			net->tx_in_progress = 0;
-			error = pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+			pair->tx_in_progress = 0;
+			error = pthread_cond_wait(&pair->tx_cond,
+						  &pair->tx_mtx);
 			assert(error == 0);
 			if (net->closing) {
 				WPRINTF(("vtnet tx thread closing...\n"));
-				pthread_mutex_unlock(&net->tx_mtx);
+				pthread_mutex_unlock(&pair->tx_mtx);
 				return NULL;
 			}
 		}
-		vq->used->flags |= ACRN_VRING_USED_F_NO_NOTIFY;
-		net->tx_in_progress = 1;
-		pthread_mutex_unlock(&net->tx_mtx);
+		vq_set_used_ring_flags(&net->base, vq);
+		pair->tx_in_progress = 1;
+		pthread_mutex_unlock(&pair->tx_mtx);
 
 		do {
 			/*
@@ -581,31 +1183,91 @@ virtio_net_tx_thread(void *param)
 			 * iovecs and sending when an end-of-packet
 			 * is found
 			 */
-			virtio_net_proctx(net, vq);
+			if (pair->batch && pair->batch->tx_ring)
+				virtio_net_proctx_batch(pair, vq);
+			else
+				virtio_net_proctx(pair, vq);
 		} while (vq_has_descs(vq));
 
+		if (net->virtio_net_tx_flush)
+			net->virtio_net_tx_flush(pair);
+
 		/*
 		 * Generate an interrupt if needed.
 		 */
 		vq_endchains(vq, 1);
 
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&pair->tx_mtx);
 	}
 }
 
-#ifdef notyet
-static void
-virtio_net_ping_ctlq(void *vdev, struct virtio_vq_info *vq)
+static uint8_t
+virtio_net_ctrl(struct virtio_net *net, uint8_t *cmd, int len)
 {
-	DPRINTF(("vtnet: control qnotify!\n\r"));
+	struct virtio_net_ctrl_hdr *hdr = (struct virtio_net_ctrl_hdr *)cmd;
+	uint16_t pairs;
+
+	if (len < sizeof(*hdr))
+		return VIRTIO_NET_ERR;
+
+	/* the features of the other classes are not offered */
+	if (hdr->class != VIRTIO_NET_CTRL_MQ ||
+	    hdr->cmd != VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET ||
+	    len < sizeof(*hdr) + sizeof(pairs))
+		return VIRTIO_NET_ERR;
+
+	memcpy(&pairs, cmd + sizeof(*hdr), sizeof(pairs));
+	if (pairs < 1 || pairs > net->npairs)
+		return VIRTIO_NET_ERR;
+
+	DPRINTF(("vtnet: %u queue pairs\n\r", pairs));
+	virtio_net_set_pairs(net, pairs);
+	return VIRTIO_NET_OK;
 }
-#endif
 
-static int
-virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
+static void
+virtio_net_ping_ctlq(void *vdev, struct virtio_vq_info *vq)
 {
-	struct ether_addr ether_addr;
-	struct ether_addr *ea;
+	struct virtio_net *net = vdev;
+	struct iovec iov[VIRTIO_NET_MAXSEGS];
+	uint16_t flags[VIRTIO_NET_MAXSEGS];
+	uint8_t cmd[VIRTIO_NET_CTRL_MAXLEN];
+	uint8_t *ack;
+	uint16_t idx;
+	size_t n;
+	int i, segs, len;
+
+	while (vq_has_descs(vq)) {
+		segs = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, flags);
+		if (segs < 0)
+			return;
+		if (segs < 2 || segs > VIRTIO_NET_MAXSEGS ||
+		    !(flags[segs - 1] & ACRN_VRING_DESC_F_WRITE) ||
+		    iov[segs - 1].iov_len < 1) {
+			WPRINTF(("vtnet: bad control command\n"));
+			vq_relchain(vq, idx, 0);
+			continue;
+		}
+
+		/* the command may be split in any way before the ack */
+		for (i = 0, len = 0; i < segs - 1; i++) {
+			n = MIN(iov[i].iov_len, sizeof(cmd) - len);
+			memcpy(cmd + len, iov[i].iov_base, n);
+			len += n;
+		}
+
+		ack = iov[segs - 1].iov_base;
+		*ack = virtio_net_ctrl(net, cmd, len);
+		vq_relchain(vq, idx, 1);
+	}
+	vq_endchains(vq, 1);
+}
+
+static int
+virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
+{
+	struct ether_addr ether_addr;
+	struct ether_addr *ea;
 	char *tmpstr;
 	char zero_addr[ETHER_ADDR_LEN] = { 0, 0, 0, 0, 0, 0 };
 
@@ -626,8 +1288,43 @@ virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
 	return 0;
 }
 
+/*
+ * The tuning of vhost: busypoll=<us>[:<tx_us>], the busy-poll timeout of
+ * the rx queue and the tx one, vhost_cpu=<pcpu> for the worker, and
+ * intr_coalesce=<us> for at most an interrupt per queue per period.
+ */
+static int
+virtio_net_parse_vhost_opt(struct virtio_net *net, char *opt)
+{
+	unsigned int val, tx;
+	char *cp;
+
+	if (!strncmp(opt, "busypoll=", 9)) {
+		if (dm_strtoui(opt + 9, &cp, 10, &val))
+			return -1;
+		tx = val;
+		if (*cp == ':' && dm_strtoui(cp + 1, &cp, 10, &tx))
+			return -1;
+		if (*cp != '\0')
+			return -1;
+		net->busypoll[VIRTIO_NET_RXQ] = val;
+		net->busypoll[VIRTIO_NET_TXQ] = tx;
+	} else if (!strncmp(opt, "vhost_cpu=", 10)) {
+		if (dm_strtoui(opt + 10, &cp, 10, &val) || *cp != '\0' ||
+		    val >= CPU_SETSIZE)
+			return -1;
+		net->vhost_cpu = val;
+	} else {
+		if (dm_strtoui(opt + 14, &cp, 10, &val) || *cp != '\0' ||
+		    val > VIRTIO_NET_MAX_COALESCE)
+			return -1;
+		net->intr_coalesce = val;
+	}
+	return 0;
+}
+
 static int
-virtio_net_tap_open(char *devname)
+virtio_net_tap_open(char *devname, bool mq, bool vnet_hdr)
 {
 	int tunfd, rc;
 	struct ifreq ifr;
@@ -641,6 +1338,10 @@ virtio_net_tap_open(char *devname)
 
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	if (mq)
+		ifr.ifr_flags |= IFF_MULTI_QUEUE;
+	if (vnet_hdr)
+		ifr.ifr_flags |= IFF_VNET_HDR;
 
 	if (*devname)
 		strncpy(ifr.ifr_name, devname, IFNAMSIZ);
@@ -657,12 +1358,131 @@ virtio_net_tap_open(char *devname)
 	return tunfd;
 }
 
+/*
+ * Size the header of the tap as the guest does, and let the tap hand over
+ * the packets with the offloads the guest takes. The settings are of the
+ * device, not of a queue.
+ */
+static int
+virtio_net_tap_set_offload(struct virtio_net *net)
+{
+	unsigned int offload = 0;
+	int i, sz = net->rx_vhdrlen;
+
+	if (!net->tap_vnet_hdr)
+		return 0;
+
+	if (net->features & VIRTIO_NET_F_GUEST_CSUM) {
+		offload |= TUN_F_CSUM;
+		if (net->features & VIRTIO_NET_F_GUEST_TSO4)
+			offload |= TUN_F_TSO4;
+		if (net->features & VIRTIO_NET_F_GUEST_TSO6)
+			offload |= TUN_F_TSO6;
+	}
+
+	for (i = 0; i < net->npairs; i++) {
+		if (net->pairs[i].tapfd < 0)
+			continue;
+		if (ioctl(net->pairs[i].tapfd, TUNSETVNETHDRSZ, &sz) < 0 ||
+		    ioctl(net->pairs[i].tapfd, TUNSETOFFLOAD, offload) < 0) {
+			WPRINTF(("vtnet: tap offload %#x failed: %d\n",
+				offload, errno));
+			return -1;
+		}
+		return 0;
+	}
+	return -1;
+}
+
+static void
+virtio_net_batch_free(struct virtio_net_batch *b)
+{
+	if (b == NULL)
+		return;
+	virtio_net_uring_free(b->rx_ring);
+	virtio_net_uring_free(b->tx_ring);
+	free(b);
+}
+
+/*
+ * The chains of a batch are read and written with an io_uring per
+ * direction where there is one, one syscall per chain otherwise.
+ */
+static struct virtio_net_batch *
+virtio_net_batch_init(void)
+{
+	struct virtio_net_batch *b;
+	int i;
+
+	b = calloc(1, sizeof(struct virtio_net_batch));
+	if (b == NULL)
+		return NULL;
+
+	for (i = 0; i < VIRTIO_NET_BATCH; i++)
+		b->rx_slots[i] = &b->rx[i];
+	b->rx_ring = virtio_net_uring_init();
+	b->tx_ring = virtio_net_uring_init();
+	if (b->rx_ring == NULL || b->tx_ring == NULL)
+		DPRINTF(("vtnet: no io_uring for the tap\n\r"));
+
+	return b;
+}
+
+/*
+ * Each pair receives in a loop of its own, for the pairs of a device to
+ * receive in parallel.
+ */
+static int
+virtio_net_rx_loop(struct virtio_net_pair *pair, int i)
+{
+	struct virtio_net *net = pair->net;
+	char lname[32];
+	int loop;
+
+	if (net->npairs > 1)
+		snprintf(lname, sizeof(lname), "vtnet-%d:%d rx%d",
+			 net->base.dev->slot, net->base.dev->func, i);
+	else
+		snprintf(lname, sizeof(lname), "vtnet-%d:%d rx",
+			 net->base.dev->slot, net->base.dev->func);
+	loop = mevent_loop_get(lname);
+	if (loop < 0)
+		loop = MEVENT_LOOP_MAIN;
+	return loop;
+}
+
+/* each pair has a queue of the tap */
+static int
+virtio_net_tap_rx_setup(struct virtio_net_pair *pair, int i)
+{
+	int loop = virtio_net_rx_loop(pair, i);
+
+	pair->batch = virtio_net_batch_init();
+	if (pair->batch == NULL) {
+		WPRINTF(("vtnet: no memory for the tap batches\n"));
+		return -1;
+	}
+
+	pair->mevp = mevent_add_loop(loop, pair->tapfd, EVF_READ,
+				     virtio_net_rx_callback, pair,
+				     virtio_net_teardown, pair);
+	if (pair->mevp == NULL) {
+		WPRINTF(("Could not register event\n"));
+		virtio_net_batch_free(pair->batch);
+		pair->batch = NULL;
+		return -1;
+	}
+	return 0;
+}
+
 static void
 virtio_net_tap_setup(struct virtio_net *net, char *devname)
 {
 	char tbuf[80 + 5];	/* room for "acrn_" prefix */
+	struct virtio_net_pair *pair;
+	struct vhost_dev *vdev;
 	int vhost_fd = -1;
-	int rc;
+	int i, rc;
 
 	rc = snprintf(tbuf, strnlen(devname, 79) + 6, "acrn_%s", devname);
 	if (rc < 0 || rc >= 85)	/* give warning if error or truncation happens */
@@ -671,23 +1491,27 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 	net->virtio_net_rx = virtio_net_tap_rx;
 	net->virtio_net_tx = virtio_net_tap_tx;
 
-	net->tapfd = virtio_net_tap_open(tbuf);
-	if (net->tapfd == -1) {
-		WPRINTF(("open of tap device %s failed\n", tbuf));
-		return;
-	}
-	DPRINTF(("open of tap device %s success!\n", tbuf));
+	/* the first open names the device, the others add queues to it */
+	for (i = 0; i < net->npairs; i++) {
+		pair = &net->pairs[i];
+		pair->tapfd = virtio_net_tap_open(tbuf, net->npairs > 1,
+						  !net->use_vhost);
+		if (pair->tapfd == -1) {
+			WPRINTF(("open of tap device %s failed\n", tbuf));
+			goto fail;
+		}
+		DPRINTF(("open of tap device %s success!\n", tbuf));
 
-	/*
-	 * Set non-blocking and register for read
-	 * notifications with the event loop
-	 */
-	int opt = 1;
+		/*
+		 * Set non-blocking and register for read
+		 * notifications with the event loop
+		 */
+		int opt = 1;
 
-	if (ioctl(net->tapfd, FIONBIO, &opt) < 0) {
-		WPRINTF(("tap device O_NONBLOCK failed\n"));
-		close(net->tapfd);
-		net->tapfd = -1;
+		if (ioctl(pair->tapfd, FIONBIO, &opt) < 0) {
+			WPRINTF(("tap device O_NONBLOCK failed\n"));
+			goto fail;
+		}
 	}
 
 	if (net->use_vhost) {
@@ -696,26 +1520,680 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 			WPRINTF(("open of vhost-net failed\n"));
 		else {
 			net->vhost_net = vhost_net_init(&net->base, vhost_fd,
-				net->tapfd, 0);
+				net->pairs[0].tapfd, 0, false);
 			if (!net->vhost_net) {
 				WPRINTF(("vhost_net_init failed, fallback "
 					"to userspace virtio\n"));
 				close(vhost_fd);
 				vhost_fd = -1;
+			} else {
+				vdev = &net->vhost_net->vdev;
+				vdev->vqs[VIRTIO_NET_RXQ].busyloop_timeout =
+					net->busypoll[VIRTIO_NET_RXQ];
+				vdev->vqs[VIRTIO_NET_TXQ].busyloop_timeout =
+					net->busypoll[VIRTIO_NET_TXQ];
+				vdev->worker_cpu = net->vhost_cpu;
+				vdev->intr_coalesce = net->intr_coalesce;
+			}
+		}
+	}
+
+	if (vhost_fd >= 0)
+		return;
+
+	if (net->busypoll[VIRTIO_NET_RXQ] || net->busypoll[VIRTIO_NET_TXQ] ||
+	    net->vhost_cpu >= 0 || net->intr_coalesce)
+		WPRINTF(("vtnet: busypoll, vhost_cpu and intr_coalesce "
+			"are of vhost, ignored\n"));
+
+	/* checksums and segmentation are left to the tap, with the header */
+	if (!net->use_vhost) {
+		net->tap_vnet_hdr = 1;
+		if (virtio_net_tap_set_offload(net) == 0)
+			net->base.device_caps |= VIRTIO_NET_S_OFFLOADS;
+	}
+
+	/*
+	 * The rx of a busy tap should not delay the other backends. A pair
+	 * which can't receive is left without its tap queue.
+	 */
+	for (i = 0; i < net->npairs; i++) {
+		pair = &net->pairs[i];
+		if (virtio_net_tap_rx_setup(pair, i) < 0) {
+			close(pair->tapfd);
+			pair->tapfd = -1;
+		}
+	}
+	return;
+
+fail:
+	for (i = 0; i < net->npairs; i++) {
+		pair = &net->pairs[i];
+		if (pair->tapfd >= 0)
+			close(pair->tapfd);
+		pair->tapfd = -1;
+	}
+}
+
+#ifdef VIRTIO_NET_HAVE_XDP
+static int
+virtio_net_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/*
+ * The program of the interface: the frames of the queue go to the socket
+ * in the XSKMAP, those of the other queues to the kernel stack.
+ */
+static int
+virtio_net_xdp_prog(int map_fd)
+{
+	struct bpf_insn insns[] = {
+		/* r2 = ctx->rx_queue_index */
+		{ .code = BPF_LDX | BPF_MEM | BPF_W, .dst_reg = BPF_REG_2,
+		  .src_reg = BPF_REG_1,
+		  .off = offsetof(struct xdp_md, rx_queue_index) },
+		/* r1 = the XSKMAP */
+		{ .code = BPF_LD | BPF_DW | BPF_IMM, .dst_reg = BPF_REG_1,
+		  .src_reg = BPF_PSEUDO_MAP_FD, .imm = map_fd },
+		{ 0 },
+		/* r3 = the action without a socket for the queue */
+		{ .code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_3,
+		  .imm = XDP_PASS },
+		{ .code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map },
+		{ .code = BPF_JMP | BPF_EXIT },
+	};
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uintptr_t)insns;
+	attr.insn_cnt = ARRAY_SIZE(insns);
+	attr.license = (uintptr_t)"Dual BSD/GPL";
+	return virtio_net_bpf(BPF_PROG_LOAD, &attr);
+}
+
+static int
+virtio_net_xdp_map_ring(struct virtio_net_xdp *x, struct virtio_net_xdp_ring *r,
+			struct xdp_ring_offset *off, size_t descsz, off_t pgoff)
+{
+	char *map;
+
+	r->map_sz = off->desc + VIRTIO_NET_XDP_RINGSZ * descsz;
+	map = mmap(NULL, r->map_sz, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, x->fd, pgoff);
+	if (map == MAP_FAILED)
+		return -1;
+
+	r->map = map;
+	r->producer = (uint32_t *)(map + off->producer);
+	r->consumer = (uint32_t *)(map + off->consumer);
+	r->descs = map + off->desc;
+	r->mask = VIRTIO_NET_XDP_RINGSZ - 1;
+	return 0;
+}
+
+static void
+virtio_net_xdp_unmap_ring(struct virtio_net_xdp_ring *r)
+{
+	if (r->map != NULL)
+		munmap(r->map, r->map_sz);
+}
+
+static void
+virtio_net_xdp_free(struct virtio_net_xdp *x)
+{
+	if (x == NULL)
+		return;
+
+	/* the program goes with its link */
+	if (x->link_fd >= 0)
+		close(x->link_fd);
+	if (x->prog_fd >= 0)
+		close(x->prog_fd);
+	if (x->map_fd >= 0)
+		close(x->map_fd);
+	virtio_net_xdp_unmap_ring(&x->fill);
+	virtio_net_xdp_unmap_ring(&x->comp);
+	virtio_net_xdp_unmap_ring(&x->rx);
+	virtio_net_xdp_unmap_ring(&x->tx);
+	if (x->fd >= 0)
+		close(x->fd);
+	if (x->umem != NULL)
+		munmap(x->umem, VIRTIO_NET_XDP_UMEMSZ);
+	free(x);
+}
+
+/*
+ * A socket bound to one queue of the interface, on a umem of frames
+ * registered once: the first half is for the rx, in the fill ring or the
+ * hands of the kernel, the second half for the tx.
+ */
+static struct virtio_net_xdp *
+virtio_net_xdp_open(const char *ifname, uint32_t queue)
+{
+	struct virtio_net_xdp *x;
+	struct xdp_umem_reg reg;
+	struct xdp_mmap_offsets off;
+	struct sockaddr_xdp sxdp;
+	union bpf_attr attr;
+	socklen_t len = sizeof(off);
+	int i, sz = VIRTIO_NET_XDP_RINGSZ;
+	int ifindex;
+
+	ifindex = if_nametoindex(ifname);
+	if (ifindex == 0) {
+		WPRINTF(("vtnet: no interface %s\n", ifname));
+		return NULL;
+	}
+
+	x = calloc(1, sizeof(struct virtio_net_xdp));
+	if (x == NULL)
+		return NULL;
+	x->map_fd = x->prog_fd = x->link_fd = -1;
+
+	x->umem = mmap(NULL, VIRTIO_NET_XDP_UMEMSZ, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (x->umem == MAP_FAILED) {
+		x->umem = NULL;
+		goto fail;
+	}
+
+	x->fd = socket(AF_XDP, SOCK_RAW, 0);
+	if (x->fd < 0)
+		goto fail;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (uintptr_t)x->umem;
+	reg.len = VIRTIO_NET_XDP_UMEMSZ;
+	reg.chunk_size = VIRTIO_NET_XDP_FRAMESZ;
+	if (setsockopt(x->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0 ||
+	    setsockopt(x->fd, SOL_XDP, XDP_UMEM_FILL_RING, &sz, sizeof(sz)) ||
+	    setsockopt(x->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &sz,
+		       sizeof(sz)) ||
+	    setsockopt(x->fd, SOL_XDP, XDP_RX_RING, &sz, sizeof(sz)) ||
+	    setsockopt(x->fd, SOL_XDP, XDP_TX_RING, &sz, sizeof(sz)) ||
+	    getsockopt(x->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &len))
+		goto fail;
+
+	if (virtio_net_xdp_map_ring(x, &x->fill, &off.fr, sizeof(uint64_t),
+				    XDP_UMEM_PGOFF_FILL_RING) ||
+	    virtio_net_xdp_map_ring(x, &x->comp, &off.cr, sizeof(uint64_t),
+				    XDP_UMEM_PGOFF_COMPLETION_RING) ||
+	    virtio_net_xdp_map_ring(x, &x->rx, &off.rx,
+				    sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) ||
+	    virtio_net_xdp_map_ring(x, &x->tx, &off.tx,
+				    sizeof(struct xdp_desc), XDP_PGOFF_TX_RING))
+		goto fail;
+
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = ifindex;
+	sxdp.sxdp_queue_id = queue;
+	if (bind(x->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0)
+		goto fail;
+
+	for (i = 0; i < VIRTIO_NET_XDP_FRAMES / 2; i++)
+		((uint64_t *)x->fill.descs)[i] =
+			(uint64_t)i * VIRTIO_NET_XDP_FRAMESZ;
+	atomic_store(x->fill.producer, VIRTIO_NET_XDP_FRAMES / 2);
+	for (i = 0; i < VIRTIO_NET_XDP_FRAMES / 2; i++)
+		x->tx_free[i] = (uint64_t)(VIRTIO_NET_XDP_FRAMES / 2 + i) *
+			VIRTIO_NET_XDP_FRAMESZ;
+	x->tx_nfree = VIRTIO_NET_XDP_FRAMES / 2;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(uint32_t);
+	attr.max_entries = queue + 1;
+	x->map_fd = virtio_net_bpf(BPF_MAP_CREATE, &attr);
+	if (x->map_fd < 0)
+		goto fail;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = x->map_fd;
+	attr.key = (uintptr_t)&queue;
+	attr.value = (uintptr_t)&x->fd;
+	if (virtio_net_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0)
+		goto fail;
+
+	x->prog_fd = virtio_net_xdp_prog(x->map_fd);
+	if (x->prog_fd < 0)
+		goto fail;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = x->prog_fd;
+	attr.link_create.target_ifindex = ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	x->link_fd = virtio_net_bpf(BPF_LINK_CREATE, &attr);
+	if (x->link_fd < 0)
+		goto fail;
+
+	return x;
+
+fail:
+	WPRINTF(("vtnet: AF_XDP on %s queue %u failed: %d\n", ifname, queue,
+		errno));
+	virtio_net_xdp_free(x);
+	return NULL;
+}
+
+/* copy a received frame to a chain, as virtio_net_tap_rx reads one */
+static void
+virtio_net_xdp_rx_frame(struct virtio_net_pair *pair,
+			struct virtio_vq_info *vq, uint8_t *frame, uint32_t len)
+{
+	struct virtio_net *net = pair->net;
+	struct iovec iov[VIRTIO_NET_MAXSEGS], *riov;
+	void *vrx;
+	uint32_t copied = 0, l;
+	uint16_t idx;
+	int i, n;
+
+	n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
+	assert(n >= 1 && n <= VIRTIO_NET_MAXSEGS);
+
+	vrx = iov[0].iov_base;
+	riov = rx_iov_trim(iov, &n, net->rx_vhdrlen);
+	for (i = 0; i < n && copied < len; i++) {
+		l = MIN(len - copied, riov[i].iov_len);
+		memcpy(riov[i].iov_base, frame + copied, l);
+		copied += l;
+	}
+
+	memset(vrx, 0, net->rx_vhdrlen);
+	if (net->rx_merge) {
+		struct virtio_net_rxhdr *vrxh;
+
+		vrxh = vrx;
+		vrxh->vrh_bufs = 1;
+	}
+
+	vq_relchain(vq, idx, copied + net->rx_vhdrlen);
+}
+
+static void
+virtio_net_xdp_rx(struct virtio_net_pair *pair)
+{
+	struct virtio_net *net = pair->net;
+	struct virtio_net_xdp *x = pair->xdp;
+	struct virtio_vq_info *vq = pair->rxq;
+	struct xdp_desc *d;
+	uint32_t cons, prod, fill;
+	int ready;
+
+	/*
+	 * The frames are dropped when the rx ring hasn't been set up, the
+	 * guest is resetting the device or has no buffer.
+	 */
+	ready = pair->rx_ready && !net->resetting;
+
+	prod = atomic_load(x->rx.producer);
+	cons = *x->rx.consumer;
+	fill = *x->fill.producer;
+	for (; cons != prod; cons++) {
+		d = &((struct xdp_desc *)x->rx.descs)[cons & x->rx.mask];
+		if (ready && vq_has_descs(vq))
+			virtio_net_xdp_rx_frame(pair, vq, x->umem + d->addr,
+						d->len);
+
+		/* all the rx frames fit in the fill ring */
+		((uint64_t *)x->fill.descs)[fill++ & x->fill.mask] = d->addr;
+	}
+	atomic_store(x->rx.consumer, cons);
+	atomic_store(x->fill.producer, fill);
+
+	/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
+	if (ready)
+		vq_endchains(vq, 1);
+}
+
+/*
+ * Have the kernel send the queued frames, which it does a batch of 32 at
+ * a time in copy mode.
+ */
+static void
+virtio_net_xdp_tx_flush(struct virtio_net_pair *pair)
+{
+	struct virtio_net_xdp *x = pair->xdp;
+
+	if (x == NULL)
+		return;
+	while (x->tx_queued > 0) {
+		if (sendto(x->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+		    errno != EAGAIN && errno != EBUSY && errno != ENOBUFS)
+			break;
+		x->tx_queued -= MIN(x->tx_queued, VIRTIO_NET_XDP_TXBATCH);
+	}
+	x->tx_queued = 0;
+}
+
+/* the frames the kernel has sent are free again */
+static void
+virtio_net_xdp_tx_reclaim(struct virtio_net_xdp *x)
+{
+	uint32_t cons, prod;
+
+	prod = atomic_load(x->comp.producer);
+	for (cons = *x->comp.consumer; cons != prod; cons++)
+		x->tx_free[x->tx_nfree++] =
+			((uint64_t *)x->comp.descs)[cons & x->comp.mask];
+	atomic_store(x->comp.consumer, cons);
+}
+
+static void
+virtio_net_xdp_tx(struct virtio_net_pair *pair, struct iovec *iov, int iovcnt,
+		  int len)
+{
+	struct virtio_net_xdp *x = pair->xdp;
+	struct xdp_desc *d;
+	uint8_t *frame;
+	uint32_t prod;
+	uint64_t addr;
+	int i, copied = 0;
+
+	if (x == NULL || len > VIRTIO_NET_XDP_FRAMESZ)
+		return;
+
+	virtio_net_xdp_tx_reclaim(x);
+	if (x->tx_nfree == 0) {
+		virtio_net_xdp_tx_flush(pair);
+		virtio_net_xdp_tx_reclaim(x);
+		if (x->tx_nfree == 0)
+			return;
+	}
+
+	addr = x->tx_free[--x->tx_nfree];
+	frame = x->umem + addr;
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(frame + copied, iov[i].iov_base, iov[i].iov_len);
+		copied += iov[i].iov_len;
+	}
+	/* pad out to 60 bytes, as virtio_net_tap_tx does */
+	if (len < 60) {
+		memset(frame + len, 0, 60 - len);
+		len = 60;
+	}
+
+	/* all the tx frames fit in the tx ring */
+	prod = *x->tx.producer;
+	d = &((struct xdp_desc *)x->tx.descs)[prod & x->tx.mask];
+	d->addr = addr;
+	d->len = len;
+	d->options = 0;
+	atomic_store(x->tx.producer, prod + 1);
+
+	if (++x->tx_queued >= VIRTIO_NET_XDP_TXBATCH)
+		virtio_net_xdp_tx_flush(pair);
+}
+
+/*
+ * The pair sends and receives through an AF_XDP socket on queue @queue of
+ * the interface @ifname, bypassing the skbs of a tap and a bridge.
+ */
+static void
+virtio_net_xdp_setup(struct virtio_net *net, const char *ifname,
+		     uint32_t queue)
+{
+	struct virtio_net_pair *pair = &net->pairs[0];
+	int loop;
+
+	pair->xdp = virtio_net_xdp_open(ifname, queue);
+	if (pair->xdp == NULL)
+		return;
+
+	net->virtio_net_rx = virtio_net_xdp_rx;
+	net->virtio_net_tx = virtio_net_xdp_tx;
+	net->virtio_net_tx_flush = virtio_net_xdp_tx_flush;
+
+	loop = virtio_net_rx_loop(pair, 0);
+	pair->mevp = mevent_add_loop(loop, pair->xdp->fd, EVF_READ,
+				     virtio_net_rx_callback, pair,
+				     virtio_net_teardown, pair);
+	if (pair->mevp == NULL) {
+		WPRINTF(("Could not register event\n"));
+		virtio_net_xdp_free(pair->xdp);
+		pair->xdp = NULL;
+	}
+}
+#else
+static void
+virtio_net_xdp_free(struct virtio_net_xdp *x)
+{
+}
+
+static void
+virtio_net_xdp_setup(struct virtio_net *net, const char *ifname,
+		     uint32_t queue)
+{
+	WPRINTF(("vtnet: no AF_XDP in this build\n"));
+}
+#endif
+
+/*
+ * The rx rings are synced once per pass of the mevent loop, and the
+ * slots given back with the next sync.
+ */
+static void
+virtio_net_netmap_rx(struct virtio_net_pair *pair)
+{
+	struct virtio_net *net = pair->net;
+	struct nm_desc *nmd = pair->nmd;
+	struct virtio_vq_info *vq = pair->rxq;
+	struct netmap_ring *ring;
+	struct iovec iov[VIRTIO_NET_MAXSEGS], *riov;
+	void *vrx;
+	uint32_t cur, off, l;
+	uint16_t idx;
+	int r, i, n, ready, more;
+	size_t copied;
+
+	ioctl(nmd->fd, NIOCRXSYNC, NULL);
+
+	/*
+	 * The frames are dropped when the rx ring hasn't been set up, the
+	 * guest is resetting the device or has no buffer.
+	 */
+	ready = pair->rx_ready && !net->resetting;
+
+	for (r = nmd->first_rx_ring; r <= nmd->last_rx_ring; r++) {
+		ring = NETMAP_RXRING(nmd->nifp, r);
+		while (!nm_ring_empty(ring)) {
+			if (!ready || !vq_has_descs(vq)) {
+				ring->head = ring->cur = ring->tail;
+				break;
 			}
+
+			n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS,
+					NULL);
+			assert(n >= 1 && n <= VIRTIO_NET_MAXSEGS);
+			vrx = iov[0].iov_base;
+			riov = rx_iov_trim(iov, &n, net->rx_vhdrlen);
+
+			/* a frame over several slots is copied whole */
+			copied = 0;
+			i = 0;
+			off = 0;
+			cur = ring->cur;
+			do {
+				struct netmap_slot *slot = &ring->slot[cur];
+				char *buf = NETMAP_BUF(ring, slot->buf_idx);
+				uint32_t done = 0;
+
+				while (done < slot->len && i < n) {
+					l = MIN(slot->len - done,
+						riov[i].iov_len - off);
+					memcpy((char *)riov[i].iov_base + off,
+					       buf + done, l);
+					done += l;
+					off += l;
+					copied += l;
+					if (off == riov[i].iov_len) {
+						i++;
+						off = 0;
+					}
+				}
+				more = slot->flags & NS_MOREFRAG;
+				cur = nm_ring_next(ring, cur);
+			} while (more && cur != ring->tail);
+			ring->head = ring->cur = cur;
+
+			memset(vrx, 0, net->rx_vhdrlen);
+			if (net->rx_merge) {
+				struct virtio_net_rxhdr *vrxh;
+
+				vrxh = vrx;
+				vrxh->vrh_bufs = 1;
+			}
+			vq_relchain(vq, idx, copied + net->rx_vhdrlen);
 		}
 	}
 
-	if (vhost_fd < 0) {
-		net->mevp = mevent_add(net->tapfd, EVF_READ,
-				       virtio_net_rx_callback, net,
-				       virtio_net_teardown, net);
-		if (net->mevp == NULL) {
-			WPRINTF(("Could not register event\n"));
-			close(net->tapfd);
-			net->tapfd = -1;
+	/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
+	if (ready)
+		vq_endchains(vq, 1);
+}
+
+static void
+virtio_net_netmap_tx_flush(struct virtio_net_pair *pair)
+{
+	if (pair->nmd != NULL)
+		ioctl(pair->nmd->fd, NIOCTXSYNC, NULL);
+}
+
+/*
+ * The frames are queued in the tx rings and sent with a single sync at
+ * the end of the pass of the tx thread, or when the rings are full.
+ */
+static void
+virtio_net_netmap_tx(struct virtio_net_pair *pair, struct iovec *iov,
+		     int iovcnt, int len)
+{
+	struct nm_desc *nmd = pair->nmd;
+	struct netmap_ring *ring;
+	uint32_t cur;
+	char *buf;
+	int r, i, copied, synced = 0;
+
+	if (nmd == NULL)
+		return;
+
+	for (r = nmd->cur_tx_ring; ; ) {
+		ring = NETMAP_TXRING(nmd->nifp, r);
+		if (!nm_ring_empty(ring))
+			break;
+
+		if (++r > nmd->last_tx_ring)
+			r = nmd->first_tx_ring;
+		if (r == nmd->cur_tx_ring) {
+			/* all full, have the kernel free some slots */
+			if (synced++)
+				return;
+			ioctl(nmd->fd, NIOCTXSYNC, NULL);
 		}
 	}
+	nmd->cur_tx_ring = r;
+
+	if (len > ring->nr_buf_size)
+		return;
+
+	cur = ring->cur;
+	buf = NETMAP_BUF(ring, ring->slot[cur].buf_idx);
+	for (i = 0, copied = 0; i < iovcnt; i++) {
+		memcpy(buf + copied, iov[i].iov_base, iov[i].iov_len);
+		copied += iov[i].iov_len;
+	}
+	ring->slot[cur].len = len;
+	ring->slot[cur].flags = 0;
+	ring->head = ring->cur = nm_ring_next(ring, cur);
+}
+
+/*
+ * The pair is a port of a VALE switch, e.g. "vale0:vm1", or an interface
+ * in netmap mode, e.g. "netmap:eth0".
+ */
+static void
+virtio_net_netmap_setup(struct virtio_net *net, const char *ifname)
+{
+	struct virtio_net_pair *pair = &net->pairs[0];
+	int loop;
+
+	pair->nmd = nm_open(ifname, NULL, 0, NULL);
+	if (pair->nmd == NULL) {
+		WPRINTF(("vtnet: unable to nm_open %s: %d\n", ifname, errno));
+		return;
+	}
+
+	net->virtio_net_rx = virtio_net_netmap_rx;
+	net->virtio_net_tx = virtio_net_netmap_tx;
+	net->virtio_net_tx_flush = virtio_net_netmap_tx_flush;
+
+	loop = virtio_net_rx_loop(pair, 0);
+	pair->mevp = mevent_add_loop(loop, pair->nmd->fd, EVF_READ,
+				     virtio_net_rx_callback, pair,
+				     virtio_net_teardown, pair);
+	if (pair->mevp == NULL) {
+		WPRINTF(("Could not register event\n"));
+		nm_close(pair->nmd);
+		pair->nmd = NULL;
+	}
+}
+
+/*
+ * The "null" backend drops what the guest sends and has nothing for it
+ * to receive: the TX path of the device model, with no tap behind it.
+ */
+static void
+virtio_net_null_tx(struct virtio_net_pair *pair, struct iovec *iov,
+		   int iovcnt, int len)
+{
+}
+
+static void
+virtio_net_null_rx(struct virtio_net_pair *pair)
+{
+}
+
+static void
+virtio_net_null_setup(struct virtio_net *net)
+{
+	net->virtio_net_rx = virtio_net_null_rx;
+	net->virtio_net_tx = virtio_net_null_tx;
+}
+
+/*
+ * The queues are served by a vhost-user switch listening on @path, e.g.
+ * OVS-DPDK, straight from the guest memory shared with it.
+ */
+static void
+virtio_net_vhost_user_setup(struct virtio_net *net, const char *path)
+{
+	struct vhost_dev *vdev;
+	int fd;
+
+	fd = vhost_user_connect(path);
+	if (fd < 0)
+		return;
+
+	net->base.device_caps |= VIRTIO_NET_S_OFFLOADS;
+	net->vhost_net = vhost_net_init(&net->base, fd, -1, 0, true);
+	if (!net->vhost_net) {
+		WPRINTF(("vtnet: vhost-user %s failed\n", path));
+		net->base.device_caps &= ~VIRTIO_NET_S_OFFLOADS;
+		return;
+	}
+
+	/* the config space is ours, whatever the switch offers */
+	net->base.device_caps |= VIRTIO_NET_F_MAC | VIRTIO_NET_F_STATUS;
+
+	if (net->busypoll[VIRTIO_NET_RXQ] || net->busypoll[VIRTIO_NET_TXQ] ||
+	    net->vhost_cpu >= 0)
+		WPRINTF(("vtnet: busypoll and vhost_cpu are of vhost-net, "
+			"ignored\n"));
+	vdev = &net->vhost_net->vdev;
+	vdev->intr_coalesce = net->intr_coalesce;
 }
 
 static int
@@ -729,9 +2207,10 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	char *devname = NULL;
 	char *vtopts;
 	char *opt;
+	struct virtio_net_pair *pair;
 	int mac_provided;
 	pthread_mutexattr_t attr;
-	int rc;
+	int i, rc;
 
 	net = calloc(1, sizeof(struct virtio_net));
 	if (!net) {
@@ -758,6 +2237,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	 */
 	mac_provided = 0;
 	net->vhost_net = NULL;
+	net->npairs = 1;
+	net->vhost_cpu = -1;
 	if (opts != NULL) {
 		int err;
 
@@ -772,7 +2253,26 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		while ((opt = strsep(&vtopts, ",")) != NULL) {
 			if (strcmp("vhost", opt) == 0)
 				net->use_vhost = true;
-			else {
+			else if (!strncmp(opt, "queue_pairs=", 12)) {
+				if (dm_strtoi(opt + 12, &opt, 10,
+					      &net->npairs) || *opt != '\0' ||
+				    net->npairs < 1 ||
+				    net->npairs > VIRTIO_NET_MAX_PAIRS) {
+					WPRINTF(("vtnet: queue_pairs must be "
+						"1 to %d\n",
+						VIRTIO_NET_MAX_PAIRS));
+					free(devname);
+					return -1;
+				}
+			} else if (!strncmp(opt, "busypoll=", 9) ||
+				   !strncmp(opt, "vhost_cpu=", 10) ||
+				   !strncmp(opt, "intr_coalesce=", 14)) {
+				if (virtio_net_parse_vhost_opt(net, opt) < 0) {
+					WPRINTF(("vtnet: invalid %s\n", opt));
+					free(devname);
+					return -1;
+				}
+			} else {
 				err = virtio_net_parsemac(opt,
 					net->config.mac);
 				if (err != 0) {
@@ -784,24 +2284,68 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		}
 	}
 
-	virtio_linkup(&net->base, &virtio_net_ops, net, dev, net->queues,
+	/* the vhost-user switch in place of the tap */
+	if (devname != NULL && strncmp(devname, VIRTIO_NET_VHOST_USER,
+				       strlen(VIRTIO_NET_VHOST_USER)) == 0)
+		net->use_vhost = true;
+
+	/* a socket or a netmap port serves one pair, with no vhost */
+	if (devname != NULL &&
+	    (strncmp(devname, VIRTIO_NET_XDP, strlen(VIRTIO_NET_XDP)) == 0 ||
+	     strncmp(devname, "vale", 4) == 0 ||
+	     strncmp(devname, "netmap:", 7) == 0)) {
+		if (net->use_vhost)
+			WPRINTF(("vtnet: vhost is ignored with %s\n",
+				devname));
+		net->use_vhost = false;
+		if (net->npairs > 1) {
+			WPRINTF(("vtnet: %s serves a single queue pair\n",
+				devname));
+			net->npairs = 1;
+		}
+	}
+
+	if (devname != NULL && strcmp(devname, "null") == 0 &&
+	    net->use_vhost) {
+		WPRINTF(("vtnet: vhost is ignored with null\n"));
+		net->use_vhost = false;
+	}
+
+	if (net->use_vhost && net->npairs > 1) {
+		WPRINTF(("vtnet: vhost serves a single queue pair\n"));
+		net->npairs = 1;
+	}
+
+	/* the control queue, to enable the pairs, comes with several */
+	net->ops = virtio_net_ops;
+	net->ops.nvq = 2 * net->npairs + (net->npairs > 1);
+	virtio_linkup(&net->base, &net->ops, net, dev, net->queues,
 		      net->use_vhost ? BACKEND_VHOST : BACKEND_VBSU);
 	net->base.mtx = &net->mtx;
 	net->base.device_caps = VIRTIO_NET_S_HOSTCAPS;
+	if (net->npairs > 1)
+		net->base.device_caps |= VIRTIO_NET_F_MQ | VIRTIO_NET_F_CTRL_VQ;
+
+	for (i = 0; i < net->npairs; i++) {
+		pair = &net->pairs[i];
+		pair->net = net;
+		pair->rxq = &net->queues[2 * i + VIRTIO_NET_RXQ];
+		pair->rxq->qsize = VIRTIO_NET_RINGSZ;
+		pair->rxq->notify = virtio_net_ping_rxq;
+		pair->txq = &net->queues[2 * i + VIRTIO_NET_TXQ];
+		pair->txq->qsize = VIRTIO_NET_RINGSZ;
+		pair->txq->notify = virtio_net_ping_txq;
 
-	net->queues[VIRTIO_NET_RXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_RXQ].notify = virtio_net_ping_rxq;
-	net->queues[VIRTIO_NET_TXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_TXQ].notify = virtio_net_ping_txq;
-#ifdef notyet
-	net->queues[VIRTIO_NET_CTLQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_CTLQ].notify = virtio_net_ping_ctlq;
-#endif
-
-	/*
-	 * Attempt to open the tap device
-	 */
-	net->tapfd = -1;
+		/*
+		 * Attempt to open the tap device
+		 */
+		pair->tapfd = -1;
+	}
+	if (net->npairs > 1) {
+		net->queues[2 * net->npairs].qsize = VIRTIO_NET_CTLQ_RINGSZ;
+		net->queues[2 * net->npairs].notify = virtio_net_ping_ctlq;
+	}
+	net->curr_pairs = net->npairs;
 
 	if (!devname) {
 		WPRINTF(("virtio_net: devname NULL\n"));
@@ -811,6 +2355,31 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	if (strncmp(devname, "tap", 3) == 0 ||
 	    strncmp(devname, "vmnet", 5) == 0)
 		virtio_net_tap_setup(net, devname);
+	else if (strncmp(devname, VIRTIO_NET_VHOST_USER,
+			 strlen(VIRTIO_NET_VHOST_USER)) == 0)
+		virtio_net_vhost_user_setup(net,
+			devname + strlen(VIRTIO_NET_VHOST_USER));
+	else if (strncmp(devname, VIRTIO_NET_XDP,
+			 strlen(VIRTIO_NET_XDP)) == 0) {
+		char *ifname = devname + strlen(VIRTIO_NET_XDP);
+		char *q = strchr(ifname, ':');
+		int queue = 0;
+
+		if (q != NULL) {
+			*q++ = '\0';
+			if (dm_strtoi(q, &q, 10, &queue) || *q != '\0' ||
+			    queue < 0) {
+				WPRINTF(("vtnet: invalid AF_XDP queue\n"));
+				free(devname);
+				return -1;
+			}
+		}
+		virtio_net_xdp_setup(net, ifname, queue);
+	} else if (strncmp(devname, "vale", 4) == 0 ||
+		   strncmp(devname, "netmap:", 7) == 0)
+		virtio_net_netmap_setup(net, devname);
+	else if (strcmp(devname, "null") == 0)
+		virtio_net_null_setup(net);
 
 	free(devname);
 
@@ -841,8 +2410,15 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, VIRTIO_TYPE_NET);
 	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
 
-	/* Link is up if we managed to open tap device */
-	net->config.status = (opts == NULL || net->tapfd >= 0);
+	/* Link is up if we managed to open tap device, or the switch */
+	net->config.status = (opts == NULL || net->pairs[0].tapfd >= 0 ||
+			      net->vhost_net != NULL ||
+			      net->pairs[0].xdp != NULL ||
+			      net->pairs[0].nmd != NULL);
+	net->config.max_virtqueue_pairs = net->npairs;
+
+	/* the guest has the first pair until it asks for more */
+	virtio_net_set_pairs(net, 1);
 
 	/* use BAR 1 to map MSI-X table and PBA, if we're using MSI-X */
 	if (virtio_interrupt_init(&net->base, virtio_uses_msix())) {
@@ -859,22 +2435,29 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
-	net->rx_in_progress = 0;
-	pthread_mutex_init(&net->rx_mtx, NULL);
 
 	/*
-	 * Initialize tx semaphore & spawn TX processing thread.
-	 * As of now, only one thread for TX desc processing is
-	 * spawned.
+	 * Initialize tx semaphores & spawn a TX processing thread for
+	 * each queue pair.
 	 */
-	net->tx_in_progress = 0;
-	pthread_mutex_init(&net->tx_mtx, NULL);
-	pthread_cond_init(&net->tx_cond, NULL);
-	pthread_create(&net->tx_tid, NULL, virtio_net_tx_thread,
-		       (void *)net);
-	snprintf(tname, sizeof(tname), "vtnet-%d:%d tx", dev->slot,
-		 dev->func);
-	pthread_setname_np(net->tx_tid, tname);
+	for (i = 0; i < net->npairs; i++) {
+		pair = &net->pairs[i];
+		pair->rx_in_progress = 0;
+		pthread_mutex_init(&pair->rx_mtx, NULL);
+
+		pair->tx_in_progress = 0;
+		pthread_mutex_init(&pair->tx_mtx, NULL);
+		pthread_cond_init(&pair->tx_cond, NULL);
+		pthread_create(&pair->tx_tid, NULL, virtio_net_tx_thread,
+			       (void *)pair);
+		if (net->npairs > 1)
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx%d",
+				 dev->slot, dev->func, i);
+		else
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx",
+				 dev->slot, dev->func);
+		dm_thread_setname(pair->tx_tid, tname);
+	}
 
 	return 0;
 }
@@ -923,6 +2506,10 @@ virtio_net_neg_features(void *vdev, uint64_t negotiated_features)
 		/* non-merge rx header is 2 bytes shorter */
 		net->rx_vhdrlen -= 2;
 	}
+
+	net->rx_bigpkt = net->rx_merge && (net->features &
+			(VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6));
+	virtio_net_tap_set_offload(net);
 }
 
 static void
@@ -936,8 +2523,8 @@ virtio_net_set_status(void *vdev, uint64_t status)
 
 	if (!net->vhost_net->vhost_started &&
 		(status & VIRTIO_CR_STATUS_DRIVER_OK)) {
-		if (net->mevp)
-			mevent_disable(net->mevp);
+		if (net->pairs[0].mevp)
+			mevent_disable(net->pairs[0].mevp);
 
 		rc = vhost_net_start(net->vhost_net);
 		if (rc < 0) {
@@ -952,28 +2539,49 @@ virtio_net_set_status(void *vdev, uint64_t status)
 	}
 }
 
+/*
+ * The tap queue of a pair is closed once its mevent is gone, the device
+ * is freed with the last of them.
+ */
 static void
 virtio_net_teardown(void *param)
 {
+	struct virtio_net_pair *pair;
 	struct virtio_net *net;
 
-	net = (struct virtio_net *)param;
-	if (!net)
+	pair = (struct virtio_net_pair *)param;
+	if (!pair)
 		return;
 
-	if (net->tapfd >= 0) {
-		close(net->tapfd);
-		net->tapfd = -1;
-	} else
-		fprintf(stderr, "net->tapfd is -1!\n");
+	net = pair->net;
+	if (pair->tapfd >= 0) {
+		close(pair->tapfd);
+		pair->tapfd = -1;
+	} else if (pair->xdp == NULL && pair->nmd == NULL &&
+		   net->virtio_net_tx != virtio_net_null_tx)
+		fprintf(stderr, "pair->tapfd is -1!\n");
+
+	if (pair->nmd != NULL) {
+		nm_close(pair->nmd);
+		pair->nmd = NULL;
+	}
+
+	virtio_net_xdp_free(pair->xdp);
+	pair->xdp = NULL;
 
-	free(net);
+	virtio_net_batch_free(pair->batch);
+	pair->batch = NULL;
+
+	if (atomic_sub_fetch(&net->teardowns, 1) == 0)
+		free(net);
 }
 
 static void
 virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	struct virtio_net *net;
+	struct mevent *mevp;
+	int i, npairs;
 
 	if (dev->arg) {
 		net = (struct virtio_net *) dev->arg;
@@ -987,10 +2595,16 @@ virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			net->vhost_net = NULL;
 		}
 
-		if (net->mevp != NULL)
-			mevent_delete(net->mevp);
-		else
-			virtio_net_teardown(net);
+		/* net may be gone once the last pair is deleted */
+		npairs = net->npairs;
+		net->teardowns = npairs;
+		for (i = 0; i < npairs; i++) {
+			mevp = net->pairs[i].mevp;
+			if (mevp != NULL)
+				mevent_delete(mevp);
+			else
+				virtio_net_teardown(&net->pairs[i]);
+		}
 
 		DPRINTF(("%s: done\n", __func__));
 	} else
@@ -998,7 +2612,8 @@ virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 }
 
 static struct vhost_net *
-vhost_net_init(struct virtio_base *base, int vhostfd, int tapfd, int vq_idx)
+vhost_net_init(struct virtio_base *base, int vhostfd, int tapfd, int vq_idx,
+	       bool user)
 {
 	struct vhost_net *vhost_net = NULL;
 	uint64_t vhost_features = VIRTIO_NET_S_VHOSTCAPS;
@@ -1017,6 +2632,13 @@ vhost_net_init(struct virtio_base *base, int vhostfd, int tapfd, int vq_idx)
 	vhost_net->vdev.vqs = vhost_net->vqs;
 	vhost_net->tapfd = tapfd;
 
+	/* a vhost-user switch has the header, and does the offloads */
+	if (user) {
+		vhost_net->vdev.user = true;
+		vhost_features |= VIRTIO_NET_S_OFFLOADS;
+		vhost_ext_features = VHOST_USER_F_PROTOCOL_FEATURES;
+	}
+
 	rc = vhost_dev_init(&vhost_net->vdev, base, vhostfd, vq_idx,
 		vhost_features, vhost_ext_features, busyloop_timeout);
 	if (rc < 0) {
@@ -1094,10 +2716,31 @@ vhost_net_stop(struct vhost_net *vhost_net)
 	return rc;
 }
 
+/*
+ * With vhost, the rings are run by the kernel or another process, which
+ * keeps their state and writes the guest memory behind our back.
+ */
+static int
+virtio_net_save(struct vmctx *ctx, struct pci_vdev *dev, void *buf,
+		size_t len)
+{
+	struct virtio_net *net = dev->arg;
+
+	if (net->use_vhost) {
+		WPRINTF(("virtio_net: a vhost device can't be saved\n"));
+		return -1;
+	}
+
+	return virtio_pci_save(ctx, dev, buf, len);
+}
+
 struct pci_vdev_ops pci_ops_virtio_net = {
 	.class_name	= "virtio-net",
 	.vdev_init	= virtio_net_init,
 	.vdev_deinit	= virtio_net_deinit,
+	.vdev_reset	= virtio_pci_reset,
+	.vdev_save	= virtio_net_save,
+	.vdev_load	= virtio_pci_load,
 	.vdev_barwrite	= virtio_pci_write,
 	.vdev_barread	= virtio_pci_read
 };
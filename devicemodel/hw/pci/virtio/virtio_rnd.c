@@ -447,7 +447,7 @@ virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		       (void *)rnd);
 	snprintf(tname, sizeof(tname), "vtrnd-%d:%d tx", dev->slot,
 		 dev->func);
-	pthread_setname_np(rnd->rx_tid, tname);
+	dm_thread_setname(rnd->rx_tid, tname);
 
 	return 0;
 
@@ -499,6 +499,9 @@ struct pci_vdev_ops pci_ops_virtio_rnd = {
 	.class_name	= "virtio-rnd",
 	.vdev_init	= virtio_rnd_init,
 	.vdev_deinit	= virtio_rnd_deinit,
+	.vdev_reset	= virtio_pci_reset,
+	.vdev_save	= virtio_pci_save,
+	.vdev_load	= virtio_pci_load,
 	.vdev_barwrite	= virtio_pci_write,
 	.vdev_barread	= virtio_pci_read
 };
@@ -94,6 +94,7 @@
 #include "usb_pmapper.h"
 #include "vmmapi.h"
 #include "dm_string.h"
+#include "timer.h"
 
 #undef LOG_TAG
 #define LOG_TAG			"xHCI: "
@@ -359,6 +360,15 @@ struct pci_xhci_native_port {
 	uint8_t state;
 };
 
+/* A doorbell rung by the guest, for pci_xhci_db_thread */
+struct pci_xhci_db {
+	uint32_t	slot;		/* 0 for the command ring */
+	uint32_t	epid;
+	uint32_t	streamid;
+};
+
+#define	XHCI_DB_QUEUE_SIZE	256
+
 /* This is used to describe the VBus Drop state */
 struct pci_xhci_vbdp_dev_state {
 	struct	usb_devpath path;
@@ -411,6 +421,29 @@ struct pci_xhci_vdev {
 	 */
 	struct pci_xhci_native_port native_ports[XHCI_MAX_VIRT_PORTS];
 	struct timespec mf_prev_time;	/* previous time of accessing MFINDEX */
+
+	/*
+	 * Interrupter moderation: no interrupt before imod_next, the
+	 * ones asserted until then raised together by imod_timer.
+	 */
+	pthread_mutex_t imod_mtx;
+	struct acrn_timer imod_timer;
+	uint64_t	imod_next;	/* ns, CLOCK_MONOTONIC */
+	bool		imod_armed;
+
+	/*
+	 * The doorbells, queued by the MMIO writes and processed by
+	 * db_thread, both under mtx. db_pending has the epid bits of the
+	 * queued doorbells of each slot without a stream, a doorbell
+	 * already queued being dropped.
+	 */
+	pthread_t	db_thread;
+	pthread_cond_t	db_cond;
+	bool		db_exit;
+	struct pci_xhci_db db_queue[XHCI_DB_QUEUE_SIZE];
+	int		db_head;
+	int		db_count;
+	uint32_t	db_pending[XHCI_MAX_SLOTS + 1];
 };
 
 /* portregs and devices arrays are set up to start from idx=1 */
@@ -1176,6 +1209,11 @@ pci_xhci_reset(struct pci_xhci_vdev *xdev)
 	xdev->rtsregs.er_enq_idx = 0;
 	xdev->rtsregs.er_events_cnt = 0;
 	xdev->rtsregs.event_pcs = 1;
+	xdev->imod_next = 0;
+
+	/* the doorbells rung before the reset */
+	xdev->db_count = 0;
+	memset(xdev->db_pending, 0, sizeof(xdev->db_pending));
 
 	for (i = 1; i <= XHCI_MAX_SLOTS; i++)
 		pci_xhci_reset_slot(xdev, i);
@@ -1515,13 +1553,22 @@ pci_xhci_trb_next(struct pci_xhci_vdev *xdev,
 	return next;
 }
 
-static void
-pci_xhci_assert_interrupt(struct pci_xhci_vdev *xdev)
+static uint64_t
+pci_xhci_now(void)
 {
+	struct timespec ts;
 
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* the interrupt of the pending events, with IMOD.IMODI from now on */
+static void
+pci_xhci_fire_interrupt(struct pci_xhci_vdev *xdev, uint64_t now)
+{
+	xdev->imod_next = now +
+		XHCI_IMOD_IVAL_GET(xdev->rtsregs.intrreg.imod) * 250UL;
 	xdev->rtsregs.intrreg.erdp |= XHCI_ERDP_LO_BUSY;
-	xdev->rtsregs.intrreg.iman |= XHCI_IMAN_INTR_PEND;
-	xdev->opregs.usbsts |= XHCI_STS_EINT;
 
 	/* only trigger interrupt if permitted */
 	if ((xdev->opregs.usbcmd & XHCI_CMD_INTE) &&
@@ -1533,6 +1580,51 @@ pci_xhci_assert_interrupt(struct pci_xhci_vdev *xdev)
 	}
 }
 
+static void
+pci_xhci_imod_timer(void *arg)
+{
+	struct pci_xhci_vdev *xdev = arg;
+
+	pthread_mutex_lock(&xdev->imod_mtx);
+	xdev->imod_armed = false;
+	if (xdev->rtsregs.intrreg.iman & XHCI_IMAN_INTR_PEND)
+		pci_xhci_fire_interrupt(xdev, pci_xhci_now());
+	pthread_mutex_unlock(&xdev->imod_mtx);
+}
+
+/*
+ * Interrupt for the events in the ring. Within the moderation interval
+ * of the previous interrupt, it is raised at the end of the interval,
+ * once for all the events inserted until then.
+ */
+static void
+pci_xhci_assert_interrupt(struct pci_xhci_vdev *xdev)
+{
+	struct itimerspec its;
+	uint64_t now, delta;
+
+	xdev->rtsregs.intrreg.iman |= XHCI_IMAN_INTR_PEND;
+	xdev->opregs.usbsts |= XHCI_STS_EINT;
+
+	pthread_mutex_lock(&xdev->imod_mtx);
+	now = pci_xhci_now();
+	if (xdev->imod_armed) {
+		/* raised with the others when the interval ends */
+	} else if (now >= xdev->imod_next) {
+		pci_xhci_fire_interrupt(xdev, now);
+	} else {
+		delta = xdev->imod_next - now;
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_sec = delta / 1000000000UL;
+		its.it_value.tv_nsec = delta % 1000000000UL;
+		if (acrn_timer_settime(&xdev->imod_timer, &its) == 0)
+			xdev->imod_armed = true;
+		else
+			pci_xhci_fire_interrupt(xdev, now);
+	}
+	pthread_mutex_unlock(&xdev->imod_mtx);
+}
+
 static void
 pci_xhci_deassert_interrupt(struct pci_xhci_vdev *xdev)
 {
@@ -3075,11 +3167,60 @@ pci_xhci_device_doorbell(struct pci_xhci_vdev *xdev,
 				 ringaddr, ccs, streamid);
 }
 
+static inline bool
+pci_xhci_db_coalesced(struct pci_xhci_db *db)
+{
+	return db->slot <= XHCI_MAX_SLOTS && db->epid < 32 &&
+	       db->streamid == 0;
+}
+
+/*
+ * The command ring and the transfer rings are processed by this thread,
+ * so that a doorbell write completes at once for the vCPU, whatever the
+ * time the endpoint takes in the usb_pmapper and libusb.
+ */
+static void *
+pci_xhci_db_thread(void *arg)
+{
+	struct pci_xhci_vdev *xdev = arg;
+	struct pci_xhci_db db;
+
+	pthread_mutex_lock(&xdev->mtx);
+	for (;;) {
+		while (xdev->db_count == 0 && !xdev->db_exit)
+			pthread_cond_wait(&xdev->db_cond, &xdev->mtx);
+		if (xdev->db_exit)
+			break;
+
+		db = xdev->db_queue[xdev->db_head];
+		xdev->db_head = (xdev->db_head + 1) % XHCI_DB_QUEUE_SIZE;
+		xdev->db_count--;
+		/* rung again from now on, the ring is walked again */
+		if (pci_xhci_db_coalesced(&db))
+			xdev->db_pending[db.slot] &= ~(1U << db.epid);
+		/* for a vCPU waiting for room in the queue */
+		pthread_cond_broadcast(&xdev->db_cond);
+
+		if (XHCI_HALTED(xdev))
+			continue;
+
+		if (db.slot == 0)
+			pci_xhci_complete_commands(xdev);
+		else if (xdev->portregs != NULL)
+			pci_xhci_device_doorbell(xdev, db.slot, db.epid,
+						 db.streamid);
+	}
+	pthread_mutex_unlock(&xdev->mtx);
+
+	return NULL;
+}
+
 static void
 pci_xhci_dbregs_write(struct pci_xhci_vdev *xdev,
 		      uint64_t offset,
 		      uint64_t value)
 {
+	struct pci_xhci_db db;
 
 	offset = (offset - xdev->dboff) / sizeof(uint32_t);
 
@@ -3091,12 +3232,24 @@ pci_xhci_dbregs_write(struct pci_xhci_vdev *xdev,
 		return;
 	}
 
-	if (offset == 0)
-		pci_xhci_complete_commands(xdev);
-	else if (xdev->portregs != NULL)
-		pci_xhci_device_doorbell(xdev, offset,
-					 XHCI_DB_TARGET_GET(value),
-					 XHCI_DB_SID_GET(value));
+	db.slot = offset;
+	db.epid = (offset == 0) ? 0 : XHCI_DB_TARGET_GET(value);
+	db.streamid = (offset == 0) ? 0 : XHCI_DB_SID_GET(value);
+
+	if (pci_xhci_db_coalesced(&db)) {
+		if (xdev->db_pending[db.slot] & (1U << db.epid))
+			return;
+		xdev->db_pending[db.slot] |= 1U << db.epid;
+	}
+
+	/* the thread makes room, mtx released meanwhile */
+	while (xdev->db_count == XHCI_DB_QUEUE_SIZE && !xdev->db_exit)
+		pthread_cond_wait(&xdev->db_cond, &xdev->mtx);
+
+	xdev->db_queue[(xdev->db_head + xdev->db_count) %
+		       XHCI_DB_QUEUE_SIZE] = db;
+	xdev->db_count++;
+	pthread_cond_broadcast(&xdev->db_cond);
 }
 
 static void
@@ -4150,6 +4303,19 @@ pci_xhci_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	pthread_mutex_init(&xdev->mtx, NULL);
 
+	pthread_mutex_init(&xdev->imod_mtx, NULL);
+	xdev->imod_timer.clockid = CLOCK_MONOTONIC;
+	error = acrn_timer_init(&xdev->imod_timer, pci_xhci_imod_timer, xdev);
+	if (error)
+		goto done;
+
+	pthread_cond_init(&xdev->db_cond, NULL);
+	error = pthread_create(&xdev->db_thread, NULL, pci_xhci_db_thread,
+			xdev);
+	if (error)
+		goto done;
+	dm_thread_setname(xdev->db_thread, "xhci_db");
+
 	/* create vbdp_thread */
 	xdev->vbdp_polling = true;
 	sem_init(&xdev->vbdp_sem, 0, 0);
@@ -4157,6 +4323,7 @@ pci_xhci_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			xdev);
 	if (error)
 		goto done;
+	dm_thread_setname(xdev->vbdp_thread, "xhci_vbdp");
 
 	xhci_in_use = 1;
 done:
@@ -4182,6 +4349,13 @@ pci_xhci_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	assert(xdev);
 	assert(xdev->devices);
 
+	pthread_mutex_lock(&xdev->mtx);
+	xdev->db_exit = true;
+	pthread_cond_broadcast(&xdev->db_cond);
+	pthread_mutex_unlock(&xdev->mtx);
+	pthread_join(xdev->db_thread, NULL);
+	pthread_cond_destroy(&xdev->db_cond);
+
 	for (i = 1; i <= XHCI_MAX_DEVS; ++i) {
 		de = xdev->devices[i];
 		if (de) {
@@ -4202,6 +4376,8 @@ pci_xhci_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pthread_join(xdev->vbdp_thread, NULL);
 	sem_close(&xdev->vbdp_sem);
 
+	acrn_timer_deinit(&xdev->imod_timer);
+	pthread_mutex_destroy(&xdev->imod_mtx);
 	pthread_mutex_destroy(&xdev->mtx);
 	free(xdev);
 	xhci_in_use = 0;
@@ -34,6 +34,10 @@
  * the tables and the compiling them to AML with the Intel iasl compiler.
  * The AML files are then read into guest memory.
  *
+ * The AML of each table is cached, keyed by a hash of its ASL and of the
+ * compiler binary, so a UOS launched with the same configuration again
+ * does not run iasl.
+ *
  *  The tables are placed in the guest's ROM area just below 1MB physical,
  * above the MPTable.
  *
@@ -88,12 +92,15 @@
 #define	ASL_TEMPLATE	"dm.XXXXXXX"
 #define ASL_SUFFIX	".aml"
 #define ASL_COMPILER	"/usr/sbin/iasl"
+#define ASL_CACHE_DIR	"/var/cache/acrn/acpi"
+#define ASL_MAX_SIZE	(1024 * 1024)
 
 uint64_t audio_nhlt_len = 0;
 
 static int basl_keep_temps;
 static int basl_verbose_iasl;
 static int basl_ncpu;
+static const char *basl_cache_dir;	/* NULL, no cache */
 static uint32_t basl_acpi_base = ACPI_BASE;
 
 /*
@@ -941,6 +948,94 @@ basl_load(struct vmctx *ctx, int fd, uint64_t off)
 	return 0;
 }
 
+/* FNV-1a of the ASL of @fd, and of the size and mtime of the compiler */
+static int
+basl_cache_key(int fd, uint64_t *key)
+{
+	struct stat sb;
+	uint64_t hash = 0xcbf29ce484222325UL;
+	char *buf;
+	ssize_t len, i;
+
+	if (stat(ASL_COMPILER, &sb) < 0)
+		return -1;
+
+	buf = malloc(ASL_MAX_SIZE);
+	if (buf == NULL)
+		return -1;
+
+	len = pread(fd, buf, ASL_MAX_SIZE, 0);
+	if (len <= 0 || len == ASL_MAX_SIZE) {
+		free(buf);
+		return -1;
+	}
+
+	for (i = 0; i < len; i++)
+		hash = (hash ^ (uint8_t)buf[i]) * 0x100000001b3UL;
+	hash = (hash ^ (uint64_t)sb.st_size) * 0x100000001b3UL;
+	hash = (hash ^ (uint64_t)sb.st_mtime) * 0x100000001b3UL;
+
+	free(buf);
+	*key = hash;
+	return 0;
+}
+
+static int
+basl_cache_load(struct vmctx *ctx, uint64_t key, uint64_t offset)
+{
+	char path[MAXPATHLEN];
+	int fd, err;
+
+	snprintf(path, sizeof(path), "%s/%016lx%s", basl_cache_dir, key,
+		 ASL_SUFFIX);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	err = basl_load(ctx, fd, offset);
+	close(fd);
+	return err;
+}
+
+/* written aside and renamed, for the UOSs launched at the same time */
+static void
+basl_cache_store(int aml_fd, uint64_t key)
+{
+	char path[MAXPATHLEN], tmp[MAXPATHLEN + 16];
+	struct stat sb;
+	char *buf;
+	int fd;
+
+	if (fstat(aml_fd, &sb) < 0 || sb.st_size <= 0)
+		return;
+
+	buf = malloc(sb.st_size);
+	if (buf == NULL)
+		return;
+
+	if (pread(aml_fd, buf, sb.st_size, 0) != sb.st_size)
+		goto out;
+
+	snprintf(path, sizeof(path), "%s/%016lx%s", basl_cache_dir, key,
+		 ASL_SUFFIX);
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto out;
+
+	if (write(fd, buf, sb.st_size) != sb.st_size) {
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+	close(fd);
+
+	if (rename(tmp, path) < 0)
+		unlink(tmp);
+out:
+	free(buf);
+}
+
 static int
 basl_compile(struct vmctx *ctx,
 		int (*fwrite_section)(FILE *, struct vmctx *),
@@ -948,12 +1043,21 @@ basl_compile(struct vmctx *ctx,
 {
 	struct basl_fio io[2];
 	static char iaslbuf[3*MAXPATHLEN + 10];
+	uint64_t key = 0;
+	bool cached;
 	int err;
 
 	err = basl_start(&io[0], &io[1]);
 	if (!err) {
 		err = (*fwrite_section)(io[0].fp, ctx);
 
+		cached = !err && basl_cache_dir != NULL &&
+			basl_cache_key(io[0].fd, &key) == 0;
+		if (cached && basl_cache_load(ctx, key, offset) == 0) {
+			basl_end(&io[0], &io[1]);
+			return 0;
+		}
+
 		if (!err) {
 			/*
 			 * iasl sends the results of the compilation to
@@ -981,6 +1085,8 @@ basl_compile(struct vmctx *ctx,
 				 * memory at the specified location
 				 */
 				err = basl_load(ctx, io[1].fd, offset);
+				if (!err && cached)
+					basl_cache_store(io[1].fd, key);
 			} else
 				err = -1;
 		}
@@ -1107,6 +1213,18 @@ acpi_build(struct vmctx *ctx, int ncpu)
 	if (getenv("ACPI_KEEPTMPS"))
 		basl_keep_temps = 1;
 
+	/*
+	 * Cache the compiled tables in ACPI_CACHE_DIR, none if it is set
+	 * empty
+	 */
+	basl_cache_dir = getenv("ACPI_CACHE_DIR");
+	if (basl_cache_dir == NULL) {
+		basl_cache_dir = ASL_CACHE_DIR;
+		mkdir("/var/cache/acrn", 0755);
+		mkdir(ASL_CACHE_DIR, 0755);
+	} else if (*basl_cache_dir == '\0')
+		basl_cache_dir = NULL;
+
 	i = 0;
 	err = basl_make_templates();
 
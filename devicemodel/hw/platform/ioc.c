@@ -58,6 +58,7 @@
 #include <fcntl.h>
 #include <pty.h>
 #include <string.h>
+#include <sys/param.h>
 #include <stdbool.h>
 #include <types.h>
 #include <libgen.h>
@@ -1145,12 +1146,12 @@ ioc_update_event(int fd, enum ioc_event_type evt)
 
 /*
  * Build a cbc_request with CBC link frame and add the cbc_request to
- * the rx queue tail.
+ * the rx batch, which ioc_flush_requests hands over to the rx queue.
  */
 void
 ioc_build_request(struct ioc_dev *ioc, int32_t link_len, int32_t srv_len)
 {
-	int i, pos;
+	int first;
 	struct cbc_ring *ring = &ioc->ring;
 	struct cbc_request *req;
 
@@ -1159,14 +1160,37 @@ ioc_build_request(struct ioc_dev *ioc, int32_t link_len, int32_t srv_len)
 		WPRINTF(("ioc queue is full!!, drop the data\n\r"));
 		return;
 	}
-	for (i = 0; i < link_len; i++) {
-		pos = (ring->head + i) & (CBC_RING_BUFFER_SIZE - 1);
 
-		req->buf[i] = ring->buf[pos];
-	}
+	/* the frame may wrap around the end of the ring */
+	first = MIN(link_len, CBC_RING_BUFFER_SIZE - ring->head);
+	memcpy(req->buf, ring->buf + ring->head, first);
+	memcpy(req->buf + first, ring->buf, link_len - first);
+
 	req->srv_len = srv_len;
 	req->link_len = link_len;
-	cbc_request_enqueue(ioc, req, CBC_QUEUE_T_RX, false);
+	SIMPLEQ_INSERT_TAIL(&ioc->rx_batch, req, me_queue);
+}
+
+/*
+ * Move the requests built during one epoll round to the rx queue with a
+ * single lock and wakeup of the rx thread.
+ */
+static void
+ioc_flush_requests(struct ioc_dev *ioc)
+{
+	struct cbc_request *req;
+
+	if (SIMPLEQ_EMPTY(&ioc->rx_batch))
+		return;
+
+	pthread_mutex_lock(&ioc->rx_mtx);
+	while (!SIMPLEQ_EMPTY(&ioc->rx_batch)) {
+		req = SIMPLEQ_FIRST(&ioc->rx_batch);
+		SIMPLEQ_REMOVE_HEAD(&ioc->rx_batch, me_queue);
+		SIMPLEQ_INSERT_TAIL(&ioc->rx_qhead, req, me_queue);
+	}
+	pthread_cond_signal(&ioc->rx_cond);
+	pthread_mutex_unlock(&ioc->rx_mtx);
 }
 
 /*
@@ -1175,17 +1199,38 @@ ioc_build_request(struct ioc_dev *ioc, int32_t link_len, int32_t srv_len)
 static int
 ioc_process_rx(struct ioc_dev *ioc, enum ioc_ch_id id)
 {
-	uint8_t c;
+	struct iovec iov[2];
+	uint8_t drop[CBC_MAX_FRAME_SIZE];
+	int fd, n, count;
+
+	fd = ioc_ch_tbl[id].fd;
+	if (fd < 0)
+		return -1;
 
 	/*
-	 * Read virtual UART data byte one by one
-	 * FIXME: if IOC DM can get several bytes one time
-	 * then need to improve this
+	 * Read whatever the virtual UART has straight into the free space of
+	 * the ring buffer, frames are then parsed in place.
 	 */
-	if (ioc_ch_recv(id, &c, sizeof(c)) < 0)
+	n = cbc_ring_free_iov(&ioc->ring, iov);
+	if (n == 0) {
+		/* no frame start in a full ring, make room */
+		WPRINTF("%s", "ioc cbc ring buffer is full!!\r\n");
+		count = read(fd, drop, sizeof(drop));
+		return count < 0 ? -1 : 0;
+	}
+
+	/*
+	 * Currently epoll work mode is LT, so ignore EAGAIN error.
+	 * If change epoll work mode to ET, need to handle EAGAIN.
+	 */
+	count = readv(fd, iov, n);
+	if (count < 0) {
+		DPRINTF("ioc read bytes error:%s\r\n", strerror(errno));
 		return -1;
-	if (cbc_copy_to_ring(&c, 1, &ioc->ring) == 0)
-		cbc_unpack_link(ioc);
+	}
+
+	cbc_ring_produce(&ioc->ring, count);
+	cbc_unpack_link(ioc);
 	return 0;
 }
 
@@ -1305,6 +1350,7 @@ ioc_core_thread(void *arg)
 		for (i = 0; i < n; i++)
 			ioc_dispatch(ioc, (struct ioc_ch_info *)
 					eventlist[i].data.ptr);
+		ioc_flush_requests(ioc);
 	}
 exit:
 	return NULL;
@@ -1692,6 +1738,7 @@ ioc_init(struct vmctx *ctx)
 	pthread_cond_init(&ioc->rx_cond, NULL);
 	pthread_mutex_init(&ioc->rx_mtx, NULL);
 	SIMPLEQ_INIT(&ioc->rx_qhead);
+	SIMPLEQ_INIT(&ioc->rx_batch);
 	ioc->rx_config.cbc_sig_num = ARRAY_SIZE(cbc_rx_signal_table);
 	ioc->rx_config.cbc_grp_num = ARRAY_SIZE(cbc_rx_group_table);
 	ioc->rx_config.wlist_sig_num = ARRAY_SIZE(wlist_rx_signal_table);
@@ -10,6 +10,8 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+#include <sys/param.h>
 
 #include "ioc.h"
 #include "monitor.h"
@@ -33,23 +35,59 @@ static void cbc_send_pkt(struct cbc_pkt *pkt);
 int
 cbc_copy_to_ring(const uint8_t *buf, size_t size, struct cbc_ring *ring)
 {
-	int i, pos;
+	struct iovec iov[2];
+	size_t room = 0;
+	int i, n;
+
+	n = cbc_ring_free_iov(ring, iov);
+	for (i = 0; i < n; i++)
+		room += iov[i].iov_len;
+	if (room < size) {
+		WPRINTF("ioc cbc ring buffer is full!!\r\n");
+		return -1;
+	}
 
-	/* TODO: memcpy or other implementation instead copy byte one by one */
-	for (i = 0; i < size; i++) {
-		pos = (ring->tail + 1) & (CBC_RING_BUFFER_SIZE - 1);
-		if (pos != ring->head) {
-			ring->buf[ring->tail] =  buf[i];
-
-			ring->tail = pos;
-		} else {
-			WPRINTF("ioc cbc ring buffer is full!!\r\n");
-			return -1;
-		}
+	for (i = 0; i < n && size > 0; i++) {
+		iov[i].iov_len = MIN(iov[i].iov_len, size);
+		memcpy(iov[i].iov_base, buf, iov[i].iov_len);
+		cbc_ring_produce(ring, iov[i].iov_len);
+		buf += iov[i].iov_len;
+		size -= iov[i].iov_len;
 	}
 	return 0;
 }
 
+/*
+ * The free space of the ring buffer is at most two contiguous segments, one
+ * up to the end of the buffer and one from its start. One slot always stays
+ * empty to tell a full ring from an empty one.
+ */
+int
+cbc_ring_free_iov(struct cbc_ring *ring, struct iovec *iov)
+{
+	size_t room, first;
+
+	room = (ring->head - ring->tail - 1) & (CBC_RING_BUFFER_SIZE - 1);
+	if (room == 0)
+		return 0;
+
+	first = MIN(room, CBC_RING_BUFFER_SIZE - ring->tail);
+	iov[0].iov_base = ring->buf + ring->tail;
+	iov[0].iov_len = first;
+	if (first == room)
+		return 1;
+
+	iov[1].iov_base = ring->buf;
+	iov[1].iov_len = room - first;
+	return 2;
+}
+
+void
+cbc_ring_produce(struct cbc_ring *ring, size_t bytes)
+{
+	ring->tail = (ring->tail + bytes) & (CBC_RING_BUFFER_SIZE - 1);
+}
+
 /*
  * Drop the bytes from the ring buffer.
  */
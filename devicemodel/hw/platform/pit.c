@@ -32,12 +32,15 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <time.h>
 
 #include "vmmapi.h"
 #include "inout.h"
 #include "pit.h"
+#include "atomic.h"
+#include "clock_page.h"
 
 #define	TMR2_OUT_STS		0x20
 
@@ -73,6 +76,7 @@ struct channel {
 	int		mode;
 	uint32_t	initial;	/* initial counter value */
 	struct timespec start_ts;	/* uptime when counter was loaded */
+	uint64_t	start_tsc;	/* TSC when counter was loaded */
 	uint8_t		cr[2];
 	uint8_t		ol[2];
 	bool		nullcnt;
@@ -95,6 +99,62 @@ struct vpit {
 pthread_mutex_t vpit_mtx = PTHREAD_MUTEX_INITIALIZER;
 
 
+/*
+ * Publish the counters to the clock page. The hypervisor completes the
+ * free-running reads of the ones loaded and not latched, and the channel 2
+ * OUT reads of NMISC_PORT.
+ */
+static void
+vpit_publish(struct vpit *vpit)
+{
+	struct vhm_clock_page *page = vpit->vm->clock_page;
+	struct channel *c;
+	int i;
+
+	if (page == NULL)
+		return;
+
+	clock_page_write_begin(&page->pit_seq);
+	for (i = 0; i < nitems(vpit->channel); i++) {
+		c = &vpit->channel[i];
+		page->pit[i].start_tsc = c->start_tsc;
+		page->pit[i].initial = c->initial;
+		page->pit[i].mode = c->mode;
+		page->pit[i].valid = c->initial != 0 && !c->nullcnt &&
+			!c->slatched && c->olbyte == 0;
+	}
+	clock_page_write_end(&page->pit_seq);
+}
+
+/*
+ * The byte pointer of the free-running reads lives in the clock page when
+ * there is one, as the hypervisor completes most of those reads.
+ */
+static int
+pit_frbyte_next(struct vpit *vpit, struct channel *c)
+{
+	struct vhm_clock_page *page = vpit->vm->clock_page;
+	int byte;
+
+	if (page != NULL)
+		return atomic_fetch_xor(&page->pit[c - vpit->channel].frbyte,
+					1) & 1;
+
+	byte = c->frbyte;
+	c->frbyte ^= 1;
+	return byte;
+}
+
+static void
+pit_frbyte_reset(struct vpit *vpit, struct channel *c)
+{
+	struct vhm_clock_page *page = vpit->vm->clock_page;
+
+	c->frbyte = 0;
+	if (page != NULL)
+		atomic_store(&page->pit[c - vpit->channel].frbyte, 0);
+}
+
 static inline uint64_t
 ts_to_ticks(const struct timespec *ts)
 {
@@ -215,6 +275,7 @@ pit_load_ce(struct channel *c)
 		c->crbyte = 0;
 		error = clock_gettime(CLOCK_REALTIME, &c->start_ts);
 		assert(error == 0);
+		c->start_tsc = clock_page_tsc();
 		assert(c->initial > 0 && c->initial <= 0x10000);
 	}
 }
@@ -249,6 +310,7 @@ vpit_timer_handler(union sigval s)
 
 	/* CR -> CE if necessary */
 	pit_load_ce(c);
+	vpit_publish(vpit);
 
 done:
 	VPIT_UNLOCK();
@@ -373,6 +435,7 @@ pit_update_counter(struct vpit *vpit, struct channel *c, bool latch,
 		delta_ticks = 0;
 		error = clock_gettime(CLOCK_REALTIME, &c->start_ts);
 		assert(error == 0);
+		c->start_tsc = clock_page_tsc();
 	} else
 		delta_ticks = ticks_elapsed_since(&c->start_ts);
 
@@ -544,6 +607,7 @@ vpit_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 
 		VPIT_LOCK();
 		error = vpit_update_mode(vpit, val);
+		vpit_publish(vpit);
 		VPIT_UNLOCK();
 
 		return error;
@@ -576,11 +640,10 @@ vpit_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 
 				tmp = pit_update_counter(vpit, c, false, &delta_ticks);
 
-				if (c->frbyte)
+				if (pit_frbyte_next(vpit, c))
 					tmp >>= 8;
 				tmp &= 0xff;
 				*eax = tmp;
-				c->frbyte ^= 1;
 			} else {
 				*eax = c->ol[--c->olbyte];
 			}
@@ -602,7 +665,7 @@ vpit_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 				goto done;
 			}
 
-			c->frbyte = 0;
+			pit_frbyte_reset(vpit, c);
 			c->nullcnt = true;
 
 			/* Start an interval timer for channel 0 */
@@ -624,6 +687,7 @@ vpit_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 	}
 
 done:
+	vpit_publish(vpit);
 	VPIT_UNLOCK();
 
 	return error;
@@ -684,6 +748,9 @@ vpit_init(struct vmctx *ctx)
 	}
 
 	ctx->vpit = vpit;
+	for (i = 0; i < nitems(vpit->channel); i++)
+		pit_frbyte_reset(vpit, &vpit->channel[i]);
+	vpit_publish(vpit);
 
 	VPIT_UNLOCK();
 
@@ -713,6 +780,10 @@ vpit_deinit(struct vmctx *ctx)
 
 	pit_timer_stop_cntr0(vpit, NULL);
 
+	/* hand all the reads back to the (gone) vPIT */
+	memset(vpit->channel, 0, sizeof(vpit->channel));
+	vpit_publish(vpit);
+
 	for (i = 0; i < nitems(vpit_timer_arg); i++) {
 		vpit_timer_arg[i].vpit = NULL;
 		assert(!vpit_timer_arg[i].active);
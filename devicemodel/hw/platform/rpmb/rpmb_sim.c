@@ -30,6 +30,7 @@
 #include <string.h>
 #include <inttypes.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <openssl/hmac.h>
 #include <openssl/opensslv.h>
 
@@ -55,73 +56,103 @@ static FILE *rpmb_fd = NULL;
 #define TEEDATA_SIZE		(4*1024*1024) //4M
 #define TEEDATA_BLOCK_COUNT		(TEEDATA_SIZE/256)
 
+/*
+ * Frames one authenticated write may carry: the 8KB of the eMMC 5.1
+ * large RPMB writes. They go to the file in one write and one sync.
+ */
+#define REL_WRITE_MAX_FRAMES	32
+
+#ifndef offsetof
 #define offsetof(s, m)		(size_t) &(((s *) 0)->m)
+#endif
 
 static int virtio_rpmb_debug = 1;
 #define DPRINTF(params) do { if (virtio_rpmb_debug) printf params; } while (0)
 #define WPRINTF(params) (printf params)
 
+/*
+ * Nearly every frame is MACed with one of two keys, the virtual one of
+ * the UOS and the one of the (simulated) physical RPMB. Keep a keyed
+ * HMAC context for each, so the key setup is done once instead of on
+ * every check and every response.
+ */
+#define RPMB_MAC_CTX_NUM	2
+
+struct rpmb_mac_ctx {
+	uint8_t key[KEY_LENGTH];
+	int valid;
+	HMAC_CTX *ctx;
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	HMAC_CTX ctx_storage;
+#endif
+};
+
+static struct rpmb_mac_ctx mac_ctxs[RPMB_MAC_CTX_NUM];
+static int mac_ctx_next;
+static pthread_mutex_t mac_ctx_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 /* Make rpmb_mac compatible for different openssl versions */
+static HMAC_CTX *rpmb_mac_ctx_alloc(struct rpmb_mac_ctx *c)
+{
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
-int rpmb_mac(const uint8_t *key, const struct rpmb_frame *frames,
-			size_t frame_cnt, uint8_t *mac)
+	HMAC_CTX_init(&c->ctx_storage);
+	return &c->ctx_storage;
+#else
+	return HMAC_CTX_new();
+#endif
+}
+
+/* Called with mac_ctx_mtx held */
+static HMAC_CTX *rpmb_mac_get_ctx(const uint8_t *key)
 {
+	struct rpmb_mac_ctx *c;
 	int i;
-	int hmac_ret;
-	unsigned int md_len;
-	HMAC_CTX hmac_ctx;
-
-	HMAC_CTX_init(&hmac_ctx);
-	hmac_ret = HMAC_Init_ex(&hmac_ctx, key, 32, EVP_sha256(), NULL);
-	if (!hmac_ret) {
-		DPRINTF(("HMAC_Init_ex failed\n"));
-		goto err;
-	}
 
-	for (i = 0; i < frame_cnt; i++) {
-		hmac_ret = HMAC_Update(&hmac_ctx, frames[i].data, 284);
-		if (!hmac_ret) {
-			DPRINTF(("HMAC_Update failed\n"));
-			goto err;
+	for (i = 0; i < RPMB_MAC_CTX_NUM; i++) {
+		c = &mac_ctxs[i];
+		if (c->valid && !memcmp(c->key, key, KEY_LENGTH)) {
+			/* no key: start over with the one already set up */
+			if (!HMAC_Init_ex(c->ctx, NULL, 0, NULL, NULL))
+				return NULL;
+			return c->ctx;
 		}
 	}
 
-	hmac_ret = HMAC_Final(&hmac_ctx, mac, &md_len);
-	if (md_len != 32) {
-		DPRINTF(("bad md_len %d != 32.\n", md_len));
-		goto err;
-	}
+	c = &mac_ctxs[mac_ctx_next];
+	mac_ctx_next = (mac_ctx_next + 1) % RPMB_MAC_CTX_NUM;
 
-	if (!hmac_ret) {
-		DPRINTF(("HMAC_Final failed\n"));
-		goto err;
+	if (c->ctx == NULL) {
+		c->ctx = rpmb_mac_ctx_alloc(c);
+		if (c->ctx == NULL) {
+			DPRINTF(("get hmac_ctx failed\n"));
+			return NULL;
+		}
 	}
 
-err:
-	HMAC_CTX_cleanup(&hmac_ctx);
+	c->valid = 0;
+	if (!HMAC_Init_ex(c->ctx, key, 32, EVP_sha256(), NULL)) {
+		DPRINTF(("HMAC_Init_ex failed\n"));
+		return NULL;
+	}
+	memcpy(c->key, key, KEY_LENGTH);
+	c->valid = 1;
 
-	return hmac_ret ? 0 : -1;
+	return c->ctx;
 }
-#else
+
 int rpmb_mac(const uint8_t *key, const struct rpmb_frame *frames,
 			size_t frame_cnt, uint8_t *mac)
 {
 	int i;
-	int hmac_ret;
+	int hmac_ret = 0;
 	unsigned int md_len;
 	HMAC_CTX *hmac_ctx;
 
-	hmac_ctx = HMAC_CTX_new();
-	if (hmac_ctx == NULL) {
-		DPRINTF(("get hmac_ctx failed\n"));
-		return -1;
-	}
+	pthread_mutex_lock(&mac_ctx_mtx);
 
-	hmac_ret = HMAC_Init_ex(hmac_ctx, key, 32, EVP_sha256(), NULL);
-	if (!hmac_ret) {
-		DPRINTF(("HMAC_Init_ex failed\n"));
+	hmac_ctx = rpmb_mac_get_ctx(key);
+	if (hmac_ctx == NULL)
 		goto err;
-	}
 
 	for (i = 0; i < frame_cnt; i++) {
 		hmac_ret = HMAC_Update(hmac_ctx, frames[i].data, 284);
@@ -132,22 +163,21 @@ int rpmb_mac(const uint8_t *key, const struct rpmb_frame *frames,
 	}
 
 	hmac_ret = HMAC_Final(hmac_ctx, mac, &md_len);
-	if (md_len != 32) {
-		DPRINTF(("bad md_len %d != 32.\n", md_len));
-		goto err;
-	}
-
 	if (!hmac_ret) {
 		DPRINTF(("HMAC_Final failed\n"));
 		goto err;
 	}
 
+	if (md_len != 32) {
+		DPRINTF(("bad md_len %d != 32.\n", md_len));
+		hmac_ret = 0;
+	}
+
 err:
-	HMAC_CTX_free(hmac_ctx);
+	pthread_mutex_unlock(&mac_ctx_mtx);
 
 	return hmac_ret ? 0 : -1;
 }
-#endif
 
 static void rpmb_sim_close(void)
 {
@@ -170,13 +200,15 @@ static int file_write(FILE *fp, const void *buf, size_t size, off_t offset)
 	}
 
 	/* The flow of file writing sync should be:
-	   C lib caches--->fflush--->disk caches--->fsync--->disk */
+	   C lib caches--->fflush--->disk caches--->fdatasync--->disk
+	   The file keeps its size once created, so only the data has to
+	   reach the disk, not the timestamps. */
 	if (fflush(fp) < 0) {
 		return -1;
 	}
 
-	if (fsync(fileno(fp)) < 0) {
-		DPRINTF(("%s: fsync failed\n", __func__));
+	if (fdatasync(fileno(fp)) < 0) {
+		DPRINTF(("%s: fdatasync failed\n", __func__));
 		return -1;
 	}
 
@@ -363,7 +395,7 @@ static int rpmb_sim_write(const struct rpmb_frame* in_frame, uint32_t in_cnt,
 	if (in_frame[0].req_resp != swap16(RPMB_REQ_DATA_WRITE))
 		return -EINVAL;
 
-	if (in_cnt > 2) {
+	if (in_cnt > REL_WRITE_MAX_FRAMES) {
 		err = RPMB_RES_GENERAL_FAILURE;
 		goto out;
 	}
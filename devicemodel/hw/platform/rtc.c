@@ -39,6 +39,7 @@
 #include "rtc.h"
 #include "mevent.h"
 #include "timer.h"
+#include "clock_page.h"
 
 /* #define DEBUG_RTC */
 #ifdef DEBUG_RTC
@@ -567,6 +568,49 @@ fail:
 	return VRTC_BROKEN_TIME;
 }
 
+/*
+ * Publish the registers without read side effects to the clock page. The
+ * hypervisor completes the guest reads of them until the date and time
+ * fields roll over to the next second, the first read after that comes
+ * here and publishes them again.
+ */
+static void
+vrtc_publish(struct vrtc *vrtc, bool valid)
+{
+	struct vhm_clock_page *page = vrtc->vm->clock_page;
+	struct timespec ts;
+	time_t basetime, curtime;
+	uint64_t expire_tsc, tsc;
+
+	if (page == NULL)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	tsc = clock_page_tsc();
+
+	expire_tsc = 0;
+	if (valid) {
+		curtime = vrtc_curtime(vrtc, &basetime);
+		secs_to_rtc(curtime, vrtc, 0);
+
+		if (!update_enabled(vrtc))
+			/* the fields only change on guest writes */
+			expire_tsc = UINT64_MAX;
+		else if (basetime == ts.tv_sec)
+			expire_tsc = tsc + clock_page_ns_to_tsc(page,
+					SBT_1S - ts.tv_nsec);
+		/* else time() and the clock disagree near a second boundary */
+	}
+
+	clock_page_write_begin(&page->rtc_seq);
+	page->rtc_addr = vrtc->addr;
+	memcpy(page->rtc_regs, &vrtc->rtcdev, VHM_CLOCK_RTC_REGS);
+	page->rtc_century = vrtc->rtcdev.century;
+	page->rtc_expire_tsc = expire_tsc;
+	page->rtc_valid = valid;
+	clock_page_write_end(&page->rtc_seq);
+}
+
 static void
 vrtc_start_timer(struct acrn_timer *timer, time_t sec, time_t nsec)
 {
@@ -683,6 +727,8 @@ vrtc_update_timer(void *arg)
 		vrtc_time_update(vrtc, curtime, basetime);
 	}
 
+	/* keep the date and time fields of the clock page warm */
+	vrtc_publish(vrtc, true);
 	pthread_mutex_unlock(&vrtc->mtx);
 }
 
@@ -917,6 +963,7 @@ vrtc_addr_handler(struct vmctx *ctx, int vcpu, int in, int port,
 
 	pthread_mutex_lock(&vrtc->mtx);
 	vrtc->addr = *eax & 0x7f;
+	vrtc_publish(vrtc, true);
 	pthread_mutex_unlock(&vrtc->mtx);
 
 	return 0;
@@ -1012,6 +1059,7 @@ vrtc_data_handler(struct vmctx *ctx, int vcpu, int in, int port,
 		}
 	}
 
+	vrtc_publish(vrtc, true);
 	pthread_mutex_unlock(&vrtc->mtx);
 
 	return error;
@@ -1024,6 +1072,7 @@ vrtc_set_time(struct vrtc *vrtc, time_t secs)
 
 	pthread_mutex_lock(&vrtc->mtx);
 	error = vrtc_time_update(vrtc, secs, time(NULL));
+	vrtc_publish(vrtc, true);
 	pthread_mutex_unlock(&vrtc->mtx);
 
 	if (error)
@@ -1056,6 +1105,7 @@ vrtc_reset(struct vrtc *vrtc)
 	rtc = &vrtc->rtcdev;
 	vrtc_set_reg_b(vrtc, rtc->reg_b & ~(RTCSB_ALL_INTRS | RTCSB_SQWE));
 	vrtc_set_reg_c(vrtc, 0);
+	vrtc_publish(vrtc, true);
 
 	pthread_mutex_unlock(&vrtc->mtx);
 }
@@ -1139,6 +1189,7 @@ vrtc_init(struct vmctx *ctx)
 	vrtc->base_rtctime = VRTC_BROKEN_TIME;
 	vrtc_time_update(vrtc, curtime, time(NULL));
 	secs_to_rtc(curtime, vrtc, 0);
+	vrtc_publish(vrtc, true);
 	pthread_mutex_unlock(&vrtc->mtx);
 
 	/* init periodic interrupt timer */
@@ -1163,6 +1214,10 @@ vrtc_deinit(struct vmctx *ctx)
 	acrn_timer_deinit(&vrtc->periodic_timer);
 	acrn_timer_deinit(&vrtc->update_timer);
 
+	pthread_mutex_lock(&vrtc->mtx);
+	vrtc_publish(vrtc, false);
+	pthread_mutex_unlock(&vrtc->mtx);
+
 	memset(&iop, 0, sizeof(struct inout_port));
 	iop.name = "rtc";
 	iop.port = IO_RTC;
@@ -157,6 +157,8 @@ struct tpm_crb_vdev {
 	pthread_t request_thread;
 	pthread_mutex_t request_mutex;
 	pthread_cond_t request_cond;
+	/* set by a START, so a signal sent before the thread waits is kept */
+	bool request_pending;
 };
 
 static uint64_t mmio_read(void *addr, int size)
@@ -265,11 +267,17 @@ static void tpm_crb_request_deliver(void *arg)
 			break;
 		}
 
-		ret = pthread_cond_wait(&tpm_vdev->request_cond, &tpm_vdev->request_mutex);
+		while (!tpm_vdev->request_pending) {
+			ret = pthread_cond_wait(&tpm_vdev->request_cond,
+					&tpm_vdev->request_mutex);
+			if (ret)
+				break;
+		}
 		if (ret) {
 			DPRINTF("ERROR: Failed to wait condition(%d)\n", ret);
 			break;
 		}
+		tpm_vdev->request_pending = false;
 
 		ret = swtpm_handle_request(&tpm_vdev->cmd);
 		tpm_crb_request_completed(tpm_vdev, ret);
@@ -327,6 +335,7 @@ static void crb_reg_write(struct tpm_crb_vdev *tpm_vdev, uint64_t addr, int size
 				break;
 			}
 
+			tpm_vdev->request_pending = true;
 			if (pthread_cond_signal(&tpm_vdev->request_cond)) {
 				DPRINTF("ERROR: Failed to wait condition\n");
 				break;
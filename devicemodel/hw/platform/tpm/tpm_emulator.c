@@ -359,35 +359,42 @@ static int cmd_chan_write(int cmd_chan_fd, const uint8_t *buf, int len)
 	return (len - buffer_length);
 }
 
-static int cmd_chan_read(int cmd_chan_fd, uint8_t *buf, int len)
+/*
+ * Read one response from the cmd channel. swtpm writes it in one go, so
+ * asking for the whole buffer normally gets it with a single read(); the
+ * size in the header tells when it is complete.
+ */
+static int cmd_chan_read_rsp(int cmd_chan_fd, uint8_t *buf, uint32_t len)
 {
-	ssize_t nread = 0;
-	size_t nleft = len;
-
-	if (!buf) {
-		printf("%s error, invalid input\n", __func__);
-		return -1;
-	}
+	ssize_t nread;
+	uint32_t got = 0;
+	uint32_t want = sizeof(tpm_output_header);
 
-	while (nleft > 0) {
-		nread = read(cmd_chan_fd, buf, nleft);
-		if (nread > 0) {
-			nleft -= nread;
-			buf += nread;
-		}
-		else if (nread < 0) {/* error */
+	while (got < want) {
+		nread = read(cmd_chan_fd, buf + got, len - got);
+		if (nread < 0) {
+			if (errno == EINTR)
+				continue;
 			fprintf(stderr, "cmd_chan_read: Error, read() error %d %s\n",
 				   errno, strerror(errno));
 			return -1;
-		}
-		else if (nread == 0) {/* EOF */
-			fprintf(stderr, "cmd_chan_read: Error, read EOF, read %lu bytes\n",
-				   (unsigned long)(len - nleft));
+		} else if (nread == 0) {
+			fprintf(stderr, "cmd_chan_read: Error, read EOF, read %u bytes\n",
+				   got);
 			return -1;
 		}
+
+		got += nread;
+		if (got >= sizeof(tpm_output_header)) {
+			want = tpm_cmd_get_size(buf);
+			if ((want > len) || (want < sizeof(tpm_output_header))) {
+				printf("%s error, bad response size %u\n", __func__, want);
+				return -1;
+			}
+		}
 	}
 
-	return (len - nleft);
+	return got;
 }
 
 /*
@@ -475,23 +482,14 @@ static int swtpm_cmdcmd(int cmd_chan_fd,
 		return -1;
 	}
 
-	ret = cmd_chan_read(cmd_chan_fd, (uint8_t *)out,
-			  sizeof(tpm_output_header));
-	if (ret == -1) {
-		printf("%s failed to read size\n", __func__);
-		return -1;
-	}
-
-	if (tpm_cmd_get_size(out) > out_len) {
-		printf("%s error, get out size is larger than out_len\n", __func__);
+	if (out_len < sizeof(tpm_output_header)) {
+		printf("%s error, out_len is too small\n", __func__);
 		return -1;
 	}
 
-	ret = cmd_chan_read(cmd_chan_fd,
-				(uint8_t *)out + sizeof(tpm_output_header),
-				tpm_cmd_get_size(out) - sizeof(tpm_output_header));
+	ret = cmd_chan_read_rsp(cmd_chan_fd, out, out_len);
 	if (ret == -1) {
-		printf("%s failed to read data\n", __func__);
+		printf("%s failed to read response\n", __func__);
 		return -1;
 	}
 
@@ -11,6 +11,10 @@
 #include <assert.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include "usb.h"
 #include "usbdi.h"
 #include "usb_pmapper.h"
@@ -268,7 +272,8 @@ usb_dev_comp_req(struct libusb_transfer *libusb_xfer)
 				done = len - buf_idx;
 				short_data = 1;
 			}
-			if (req->in)
+			/* already there if the transfer used the block */
+			if (req->in && req->buf_owned)
 				memcpy(block->buf, &req->buffer[buf_idx], done);
 		}
 
@@ -309,22 +314,34 @@ out:
 	if (g_ctx.notify_cb)
 		do_intr = g_ctx.notify_cb(xfer->dev, xfer);
 
-	/* if a interrupt is needed, send it to guest */
-	if (do_intr && g_ctx.intr_cb)
-		g_ctx.intr_cb(xfer->dev, NULL);
+	/*
+	 * If a interrupt is needed, send it to guest: at the end of the
+	 * event pass of usb_dev_sys_thread, for all the transfers which
+	 * complete in it, or now if libusb completes this one elsewhere.
+	 */
+	if (do_intr && g_ctx.intr_cb) {
+		if (pthread_equal(pthread_self(), g_ctx.thread))
+			g_ctx.intr_pending = xfer->dev;
+		else
+			g_ctx.intr_cb(xfer->dev, NULL);
+	}
 
 	/* unlock and release memory */
 	USB_DATA_XFER_UNLOCK(xfer);
 	libusb_free_transfer(libusb_xfer);
-	if (req && req->buffer)
+	if (req && req->buffer && req->buf_owned)
 		free(req->buffer);
 
 	free(req);
 }
 
+/*
+ * buf, when not NULL, is the guest buffer the transfer is done in place
+ * of one of size bytes
+ */
 static struct usb_dev_req *
 usb_dev_alloc_req(struct usb_dev *udev, struct usb_data_xfer *xfer, int in,
-		size_t size, size_t count)
+		size_t size, size_t count, uint8_t *buf)
 {
 	struct usb_dev_req *req;
 	static int seq = 1;
@@ -344,8 +361,12 @@ usb_dev_alloc_req(struct usb_dev *udev, struct usb_data_xfer *xfer, int in,
 	if (!req->libusb_xfer)
 		goto errout;
 
-	if (size)
+	if (buf)
+		req->buffer = buf;
+	else if (size) {
 		req->buffer = malloc(size);
+		req->buf_owned = 1;
+	}
 
 	if (!req->buffer)
 		goto errout;
@@ -353,7 +374,7 @@ usb_dev_alloc_req(struct usb_dev *udev, struct usb_data_xfer *xfer, int in,
 	return req;
 
 errout:
-	if (req && req->buffer)
+	if (req && req->buffer && req->buf_owned)
 		free(req->buffer);
 	if (req && req->libusb_xfer)
 		libusb_free_transfer(req->libusb_xfer);
@@ -747,6 +768,7 @@ usb_dev_data(void *pdata, struct usb_data_xfer *xfer, int dir, int epctx)
 	int blk_start, data_size, blk_count;
 	int retries = 3, i, buf_idx;
 	struct usb_data_xfer_block *b;
+	uint8_t *direct;
 	static const char * const type_str[] = {"CTRL", "ISO", "BULK", "INT"};
 	static const char * const dir_str[] = {"OUT", "IN"};
 
@@ -782,8 +804,16 @@ usb_dev_data(void *pdata, struct usb_data_xfer *xfer, int dir, int epctx)
 	 * Currently, this design works fine for playback and record of USB
 	 * headset, need to do more analysis.
 	 */
+
+	/*
+	 * A TD of a single data block, the usual one of bulk transfers, is
+	 * transferred directly from or into the guest buffer. Those of
+	 * several blocks go through a buffer of the request, the blocks
+	 * being scattered in the guest memory.
+	 */
+	direct = (blk_count == 1) ? xfer->data[blk_start].buf : NULL;
 	req = usb_dev_alloc_req(udev, xfer, dir, data_size, type ==
-			USB_ENDPOINT_ISOC ? 1 : 0);
+			USB_ENDPOINT_ISOC ? 1 : 0, direct);
 	if (!req) {
 		xfer->status = USB_ERR_IOERROR;
 		goto done;
@@ -799,7 +829,7 @@ usb_dev_data(void *pdata, struct usb_data_xfer *xfer, int dir, int epctx)
 			(blk_start + blk_count - 1) % USB_MAX_XFER_BLOCKS,
 			data_size, dir_str[dir], type_str[type]);
 
-	if (!dir) {
+	if (!dir && req->buf_owned) {
 		for (i = 0, buf_idx = 0; i < blk_count; i++) {
 			b = &xfer->data[(blk_start + i) % USB_MAX_XFER_BLOCKS];
 			if (b->buf) {
@@ -1109,19 +1139,119 @@ usb_dev_info(void *pdata, int type, void *value, int size)
 	return sz == size ? 0 : -1;
 }
 
+/* libusb adds and removes its file descriptors as devices are opened */
+static void
+usb_dev_pollfd_added(int fd, short events, void *arg)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = ((events & POLLIN) ? EPOLLIN : 0) |
+		    ((events & POLLOUT) ? EPOLLOUT : 0);
+	ev.data.fd = fd;
+	if (epoll_ctl(g_ctx.epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		UPRINTF(LWRN, "fail to poll libusb fd %d, errno %d\r\n",
+				fd, errno);
+}
+
+static void
+usb_dev_pollfd_removed(int fd, void *arg)
+{
+	epoll_ctl(g_ctx.epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static int
+usb_dev_poll_init(void)
+{
+	const struct libusb_pollfd **fds;
+	struct epoll_event ev;
+	int i;
+
+	g_ctx.epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (g_ctx.epfd < 0)
+		return -1;
+
+	g_ctx.exit_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (g_ctx.exit_fd < 0)
+		goto errout;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = g_ctx.exit_fd;
+	if (epoll_ctl(g_ctx.epfd, EPOLL_CTL_ADD, g_ctx.exit_fd, &ev) < 0)
+		goto errout;
+
+	libusb_set_pollfd_notifiers(g_ctx.libusb_ctx, usb_dev_pollfd_added,
+			usb_dev_pollfd_removed, NULL);
+	fds = libusb_get_pollfds(g_ctx.libusb_ctx);
+	if (!fds)
+		goto errout;
+	for (i = 0; fds[i]; i++)
+		usb_dev_pollfd_added(fds[i]->fd, fds[i]->events, NULL);
+	libusb_free_pollfds(fds);
+
+	return 0;
+
+errout:
+	libusb_set_pollfd_notifiers(g_ctx.libusb_ctx, NULL, NULL, NULL);
+	if (g_ctx.exit_fd >= 0)
+		close(g_ctx.exit_fd);
+	close(g_ctx.epfd);
+	g_ctx.exit_fd = g_ctx.epfd = -1;
+	return -1;
+}
+
+static void
+usb_dev_poll_deinit(void)
+{
+	libusb_set_pollfd_notifiers(g_ctx.libusb_ctx, NULL, NULL, NULL);
+	close(g_ctx.exit_fd);
+	close(g_ctx.epfd);
+	g_ctx.exit_fd = g_ctx.epfd = -1;
+}
+
+/*
+ * Sleep on the libusb file descriptors until an event, a transfer
+ * completion or a hotplug one, or the next libusb timeout, then handle
+ * the events without waiting more.
+ */
 static void *
 usb_dev_sys_thread(void *arg)
 {
-	struct timeval t = {1, 0};
-	int rc = 0;
+	struct epoll_event evs[8];
+	struct timeval t;
+	int rc = 0, timeout;
 
 	while (g_ctx.thread_exit == 0) {
+		timeout = -1;
+		if (libusb_get_next_timeout(g_ctx.libusb_ctx, &t) == 1)
+			timeout = t.tv_sec * 1000 + (t.tv_usec + 999) / 1000;
+
+		rc = epoll_wait(g_ctx.epfd, evs, ARRAY_SIZE(evs), timeout);
+		if (rc < 0 && errno != EINTR) {
+			UPRINTF(LWRN, "epoll_wait fails, errno %d\r\n", errno);
+			sleep(1);
+			continue;
+		}
+		if (g_ctx.thread_exit)
+			break;
+
+		memset(&t, 0, sizeof(t));
 		rc = libusb_handle_events_timeout(g_ctx.libusb_ctx, &t);
+
+		/*
+		 * One interrupt for all the transfers libusb completed in
+		 * this pass, usually several of an endpoint the guest keeps
+		 * many TDs queued on, with their events in the ring already.
+		 */
+		if (g_ctx.intr_pending) {
+			g_ctx.intr_cb(g_ctx.intr_pending, NULL);
+			g_ctx.intr_pending = NULL;
+		}
+
 		if (rc < 0)
-			/* TODO: maybe one second as interval is too long which
-			 * may result of slower USB enumeration process.
-			 */
-			sleep(1);
+			UPRINTF(LWRN, "libusb_handle_events fails, rc %d\r\n",
+					rc);
 	}
 
 	UPRINTF(LINF, "poll thread exit\n\r");
@@ -1170,6 +1300,12 @@ usb_dev_native_sys_disconn_cb(struct libusb_context *ctx, struct libusb_device
 	if (ret == false)
 		return 0;
 
+	/* the pending interrupt may be of the device going away */
+	if (g_ctx.intr_pending) {
+		g_ctx.intr_cb(g_ctx.intr_pending, NULL);
+		g_ctx.intr_pending = NULL;
+	}
+
 	if (g_ctx.disconn_cb)
 		g_ctx.disconn_cb(g_ctx.hci_data, &di);
 
@@ -1243,7 +1379,17 @@ usb_dev_sys_init(usb_dev_sys_cb conn_cb, usb_dev_sys_cb disconn_cb,
 	g_ctx.disconn_handle = native_disconn_handle;
 	g_ctx.thread_exit = 0;
 
+	if (usb_dev_poll_init() < 0) {
+		UPRINTF(LFTL, "fail to poll the libusb events\r\n");
+		libusb_hotplug_deregister_callback(g_ctx.libusb_ctx,
+				native_conn_handle);
+		libusb_hotplug_deregister_callback(g_ctx.libusb_ctx,
+				native_disconn_handle);
+		goto errout;
+	}
+
 	if (pthread_create(&g_ctx.thread, NULL, usb_dev_sys_thread, NULL)) {
+		usb_dev_poll_deinit();
 		libusb_hotplug_deregister_callback(g_ctx.libusb_ctx,
 				native_conn_handle);
 		libusb_hotplug_deregister_callback(g_ctx.libusb_ctx,
@@ -1274,7 +1420,10 @@ usb_dev_sys_deinit(void)
 			g_ctx.disconn_handle);
 
 	g_ctx.thread_exit = 1;
+	if (eventfd_write(g_ctx.exit_fd, 1) < 0)
+		UPRINTF(LWRN, "fail to wake the libusb thread\r\n");
 	pthread_join(g_ctx.thread, NULL);
+	usb_dev_poll_deinit();
 
 	libusb_exit(g_ctx.libusb_ctx);
 	g_ctx.libusb_ctx = NULL;
@@ -36,10 +36,12 @@
 #include <stdbool.h>
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
 #include <sys/errno.h>
 
 #include "types.h"
 #include "mevent.h"
+#include "timer.h"
 #include "uart_core.h"
 #include "ns16550.h"
 #include "dm.h"
@@ -65,6 +67,9 @@
 
 #define	FIFOSZ	256
 
+/* The RX FIFO times out after 4 character times (of 10 bits) without activity */
+#define	RX_TIMEOUT_BITS	40
+
 static struct termios tio_stdio_orig;
 
 static struct {
@@ -110,6 +115,12 @@ struct uart_vdev {
 	struct fifo rxfifo;
 	struct mevent *mev;
 
+	struct acrn_timer rx_timer;	/* RX FIFO character timeout */
+	bool	rx_timer_ok;		/* rx_timer is usable */
+	bool	rx_timer_armed;
+	bool	rx_timeout;		/* RX FIFO timed out below the trigger */
+	uint64_t rx_stamp;		/* last RX FIFO activity, ns */
+
 	struct ttyfd tty;
 	bool	thre_int_pending;	/* THRE interrupt pending */
 
@@ -265,6 +276,82 @@ rxfifo_numchars(struct uart_vdev *uart)
 	return fifo->num;
 }
 
+/*
+ * The number of characters the RX FIFO collects before the data available
+ * interrupt, from FCR bits 7:6. A FIFO below it only interrupts on timeout.
+ */
+static int
+rxfifo_trigger(struct uart_vdev *uart)
+{
+	if ((uart->fcr & FCR_ENABLE) == 0 || !uart->rx_timer_ok)
+		return 1;
+
+	switch (uart->fcr & FCR_RX_MASK) {
+	case FCR_RX_MEDL:
+		return 4;
+	case FCR_RX_MEDH:
+		return 8;
+	case FCR_RX_HIGH:
+		return 14;
+	default:
+		return 1;
+	}
+}
+
+static uint64_t
+uart_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* 4 character times at the programmed baud rate */
+static uint64_t
+uart_rx_timeout_ns(struct uart_vdev *uart)
+{
+	uint64_t divisor;
+
+	divisor = uart->dll | (uart->dlh << 8);
+	if (divisor == 0)
+		divisor = 1;
+
+	return RX_TIMEOUT_BITS * 1000000000UL * 16 * divisor / DEFAULT_RCLK;
+}
+
+static void
+uart_rx_timer_arm(struct uart_vdev *uart, uint64_t ns)
+{
+	struct itimerspec ts;
+
+	bzero(&ts, sizeof(ts));
+	ts.it_value.tv_sec = ns / 1000000000UL;
+	ts.it_value.tv_nsec = ns % 1000000000UL;
+	if (acrn_timer_settime(&uart->rx_timer, &ts) == 0)
+		uart->rx_timer_armed = true;
+}
+
+/*
+ * A character entered or left the RX FIFO: restart the character timeout.
+ * The timer is left running if already armed, rx_timer_expired() re-arms
+ * it for the remainder, so this costs no syscall per character.
+ */
+static void
+uart_rx_activity(struct uart_vdev *uart)
+{
+	int num;
+
+	uart->rx_timeout = false;
+	if (!uart->rx_timer_ok)
+		return;
+
+	uart->rx_stamp = uart_now_ns();
+	num = rxfifo_numchars(uart);
+	if (!uart->rx_timer_armed && num > 0 && num < rxfifo_trigger(uart))
+		uart_rx_timer_arm(uart, uart_rx_timeout_ns(uart));
+}
+
 static void
 uart_opentty(struct uart_vdev *uart)
 {
@@ -323,7 +410,7 @@ modem_status(uint8_t mcr)
 
 /*
  * The IIR returns a prioritized interrupt reason:
- * - receive data available
+ * - receive data available (trigger level reached or character timeout)
  * - transmit holding register empty
  * - modem status change
  *
@@ -332,9 +419,13 @@ modem_status(uint8_t mcr)
 static int
 uart_intr_reason(struct uart_vdev *uart)
 {
+	int num = rxfifo_numchars(uart);
+
 	if ((uart->lsr & LSR_OE) != 0 && (uart->ier & IER_ERLS) != 0)
 		return IIR_RLS;
-	else if (rxfifo_numchars(uart) > 0 && (uart->ier & IER_ERXRDY) != 0)
+	else if (num >= rxfifo_trigger(uart) && (uart->ier & IER_ERXRDY) != 0)
+		return IIR_RXRDY;
+	else if (num > 0 && uart->rx_timeout && (uart->ier & IER_ERXRDY) != 0)
 		return IIR_RXTOUT;
 	else if (uart->thre_int_pending && (uart->ier & IER_ETXRDY) != 0)
 		return IIR_TXRDY;
@@ -375,11 +466,37 @@ uart_toggle_intr(struct uart_vdev *uart)
 		(*uart->intr_assert)(uart->arg);
 }
 
+static void
+uart_rx_timer_expired(void *arg)
+{
+	struct uart_vdev *uart = arg;
+	uint64_t elapsed, timeout;
+	int num;
+
+	pthread_mutex_lock(&uart->mtx);
+
+	uart->rx_timer_armed = false;
+	num = rxfifo_numchars(uart);
+	if (num > 0 && num < rxfifo_trigger(uart)) {
+		elapsed = uart_now_ns() - uart->rx_stamp;
+		timeout = uart_rx_timeout_ns(uart);
+		if (elapsed >= timeout) {
+			uart->rx_timeout = true;
+			uart_toggle_intr(uart);
+		} else
+			uart_rx_timer_arm(uart, timeout - elapsed);
+	}
+
+	pthread_mutex_unlock(&uart->mtx);
+}
+
 static void
 uart_drain(int fd, enum ev_type ev, void *arg)
 {
 	struct uart_vdev *uart;
-	int ch;
+	uint8_t buf[FIFOSZ];
+	ssize_t nread;
+	int i, room;
 
 	uart = arg;
 
@@ -396,9 +513,20 @@ uart_drain(int fd, enum ev_type ev, void *arg)
 	if ((uart->mcr & MCR_LOOPBACK) != 0) {
 		(void) ttyread(&uart->tty);
 	} else {
-		while ((ch = ttyread(&uart->tty)) != -1)
-			rxfifo_putchar(uart, ch);
+		/*
+		 * Fill the free room of the FIFO per read(). What does
+		 * not fit stays in the tty until the guest makes room.
+		 */
+		do {
+			room = uart->rxfifo.size - rxfifo_numchars(uart);
+			if (room == 0)
+				break;
+			nread = read(uart->tty.fd_in, buf, room);
+			for (i = 0; i < nread; i++)
+				rxfifo_putchar(uart, buf[i]);
+		} while (nread == room);
 
+		uart_rx_activity(uart);
 		uart_toggle_intr(uart);
 	}
 
@@ -433,6 +561,7 @@ uart_write(struct uart_vdev *uart, int offset, uint8_t value)
 		if (uart->mcr & MCR_LOOPBACK) {
 			if (rxfifo_putchar(uart, value) != 0)
 				uart->lsr |= LSR_OE;
+			uart_rx_activity(uart);
 		} else if (uart->tty.opened) {
 			ttywrite(&uart->tty, value);
 		} /* else drop on floor */
@@ -546,6 +675,7 @@ uart_read(struct uart_vdev *uart, int offset)
 	switch (offset) {
 	case REG_DATA:
 		reg = rxfifo_getchar(uart);
+		uart_rx_activity(uart);
 		break;
 	case REG_IER:
 		reg = uart->ier;
@@ -643,6 +773,11 @@ uart_init(uart_intr_func_t intr_assert, uart_intr_func_t intr_deassert,
 
 	pthread_mutex_init(&uart->mtx, NULL);
 
+	/* Without the timeout the FIFO interrupts on every character */
+	uart->rx_timer.clockid = CLOCK_MONOTONIC;
+	uart->rx_timer_ok = (acrn_timer_init(&uart->rx_timer,
+				uart_rx_timer_expired, uart) == 0);
+
 	uart_reset(uart);
 
 	return uart;
@@ -656,6 +791,8 @@ uart_deinit(struct uart_vdev *uart)
 			ttyclose();
 			stdio_in_use = false;
 		}
+		if (uart->rx_timer_ok)
+			acrn_timer_deinit(&uart->rx_timer);
 		free(uart);
 	}
 }
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef _BALLOON_H_
+#define _BALLOON_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "types.h"
+
+struct balloon_stats {
+	uint32_t	target;		/* 4K pages the guest is asked for */
+	uint32_t	actual;		/* 4K pages in the balloon */
+	uint64_t	released;	/* bytes given back to the SOS */
+	uint64_t	reported;	/* hugepages released as reported free */
+	uint64_t	refaults;	/* hugepages backed again on access */
+};
+
+/*
+ * Ask the guest to have @pages 4K pages in the virtio-balloon, -ENODEV
+ * if the VM has none.
+ */
+int	balloon_set_target(uint32_t pages);
+int	balloon_get_stats(struct balloon_stats *stats);
+
+/*
+ * While held, the hugepages are not given back to the SOS any more, for
+ * the guest memory to be read through the mapping of the DM. Holds nest:
+ * each balloon_hold(true) ends with a balloon_hold(false). The pages
+ * already released are still: reading them would end in a SIGBUS, hence
+ * balloon_released(), which holds until a deflate or an access of the
+ * guest backs them again.
+ */
+void	balloon_hold(bool hold);
+bool	balloon_released(vm_paddr_t gpa);
+
+#endif /* _BALLOON_H_ */
@@ -39,7 +39,7 @@
 #include <sys/uio.h>
 #include <sys/unistd.h>
 
-#define BLOCKIF_IOV_MAX		33	/* not practical to be IOV_MAX */
+#define BLOCKIF_IOV_MAX		256	/* not practical to be IOV_MAX */
 
 struct blockif_req {
 	struct iovec	iov[BLOCKIF_IOV_MAX];
@@ -50,8 +50,28 @@ struct blockif_req {
 	void		*param;
 };
 
+/*
+ * Latency histograms: bucket 0 counts the requests under 1us, bucket n
+ * those of [2^(n-1), 2^n) us and the last one all the slower ones.
+ */
+#define BLOCKIF_LAT_BUCKETS	20
+
+struct blockif_stats {
+	uint64_t	requests;	/* reads and writes */
+	uint64_t	merged;		/* done with the request before them */
+	uint64_t	reads;		/* completed */
+	uint64_t	writes;
+	uint64_t	others;		/* flushes, discards, write zeroes */
+	uint64_t	rbytes;
+	uint64_t	wbytes;
+	uint64_t	throttled;	/* delayed by "iops=" or "bps=" */
+	uint64_t	queue_lat[BLOCKIF_LAT_BUCKETS];	  /* until processed */
+	uint64_t	service_lat[BLOCKIF_LAT_BUCKETS]; /* until completed */
+};
+
 struct blockif_ctxt;
 struct blockif_ctxt *blockif_open(const char *optstr, const char *ident);
+struct blockif_ctxt *blockif_clone(struct blockif_ctxt *bc, const char *ident);
 off_t	blockif_size(struct blockif_ctxt *bc);
 void	blockif_chs(struct blockif_ctxt *bc, uint16_t *c, uint8_t *h,
 		    uint8_t *s);
@@ -60,14 +80,23 @@ void	blockif_psectsz(struct blockif_ctxt *bc, int *size, int *off);
 int	blockif_queuesz(struct blockif_ctxt *bc);
 int	blockif_is_ro(struct blockif_ctxt *bc);
 int	blockif_candelete(struct blockif_ctxt *bc);
+void	blockif_get_stats(struct blockif_ctxt *bc, struct blockif_stats *stats);
+int	blockif_get_stats_by_index(int index, char *ident, size_t len,
+				   struct blockif_stats *stats);
+void	blockif_plug(struct blockif_ctxt *bc);
+void	blockif_unplug(struct blockif_ctxt *bc);
+void	blockif_set_batch_done(struct blockif_ctxt *bc,
+			       void (*fn)(void *arg), void *arg);
 int	blockif_read(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_write(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_flush(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_delete(struct blockif_ctxt *bc, struct blockif_req *breq);
+int	blockif_write_zeroes(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_close(struct blockif_ctxt *bc);
 uint8_t	blockif_get_wce(struct blockif_ctxt *bc);
 void	blockif_set_wce(struct blockif_ctxt *bc, uint8_t wce);
 int	blockif_flush_all(struct blockif_ctxt *bc);
+int	blockif_sync_all(void);
 
 #endif /* _BLOCK_IF_H_ */
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) <2018> Intel Corporation
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _CLOCK_PAGE_H_
+#define _CLOCK_PAGE_H_
+
+#include "types.h"
+#include "acrn_common.h"
+
+struct vmctx;
+
+/*
+ * The RTC and PIT emulations publish the registers the guest can read
+ * without side effects in a page shared with the hypervisor, which then
+ * completes those reads without an exit to the DM. Each device updates its
+ * part between clock_page_write_begin() and clock_page_write_end() on its
+ * own sequence count, under its own lock. ctx->clock_page is NULL if the
+ * hypervisor does not support the page.
+ */
+int	clock_page_init(struct vmctx *ctx);
+void	clock_page_write_begin(uint32_t *seq);
+void	clock_page_write_end(uint32_t *seq);
+
+/* The TSC of SOS, the time base of the page */
+static inline uint64_t
+clock_page_tsc(void)
+{
+	return __builtin_ia32_rdtsc();
+}
+
+static inline uint64_t
+clock_page_ns_to_tsc(const struct vhm_clock_page *page, uint64_t ns)
+{
+	return ns * page->tsc_khz / 1000000UL;
+}
+
+#endif /* _CLOCK_PAGE_H_ */
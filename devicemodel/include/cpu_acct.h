@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef _CPU_ACCT_H_
+#define _CPU_ACCT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/queue.h>
+#include "types.h"
+
+#define CPU_ACCT_MAX_THREADS	32
+
+/*
+ * CPU time spent on behalf of one emulated device: in its BAR handlers,
+ * which run on the vCPU threads, in the mevent callbacks it added, and in
+ * the worker threads it started with dm_thread_setname(). Handlers and
+ * callbacks are only timed with --cpu_acct, as that costs two
+ * clock_gettime() per call; the CPU time of the workers is read from
+ * their clocks when asked.
+ */
+struct cpu_acct {
+	char		name[32];	/* slot:func devtype */
+	uint64_t	trap_ns;
+	uint64_t	traps;
+	uint64_t	event_ns;
+	uint64_t	events;
+	int		nthreads;
+	clockid_t	clocks[CPU_ACCT_MAX_THREADS];
+	TAILQ_ENTRY(cpu_acct) link;
+};
+
+struct cpu_acct_stats {
+	uint64_t	trap_ns;
+	uint64_t	traps;
+	uint64_t	event_ns;
+	uint64_t	events;
+	uint64_t	thread_ns;
+	int		nthreads;
+};
+
+extern bool cpu_acct_enabled;
+/* Worker names without blanks or colons, see dm_thread_setname() */
+extern bool perf_thread_names;
+
+/*
+ * The device being set up or torn down on this thread, which the mevents
+ * added and the workers named in the meantime belong to. NULL otherwise.
+ */
+void	cpu_acct_set_current(struct cpu_acct *acct);
+struct cpu_acct *cpu_acct_current(void);
+
+void	cpu_acct_register(struct cpu_acct *acct, const char *name);
+void	cpu_acct_unregister(struct cpu_acct *acct);
+
+/*
+ * Names a thread, counting it in the CPU time of the current device.
+ * Names are cut to the 15 characters the kernel keeps. With
+ * --perf_thread_names, blanks become '-' and colons '.', so that the
+ * names of the workers can be given as is to perf report --comms or
+ * taken from perf script output.
+ */
+void	dm_thread_setname(pthread_t tid, const char *name);
+
+static inline uint64_t
+cpu_acct_now(void)
+{
+	struct timespec ts;
+
+	if (!cpu_acct_enabled)
+		return 0;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* Charge the CPU time since start, from cpu_acct_now(), to acct */
+void	cpu_acct_trap_end(struct cpu_acct *acct, uint64_t start);
+void	cpu_acct_event_end(struct cpu_acct *acct, uint64_t start);
+
+/* The index-th device, from 0; -1 past the last */
+int	cpu_acct_get_by_index(int index, char *name, size_t len,
+			      struct cpu_acct_stats *stats);
+
+#endif /* _CPU_ACCT_H_ */
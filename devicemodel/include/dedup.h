@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) <2018> Intel Corporation
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "types.h"
+
+struct vmctx;
+
+/*
+ * With --dedup, a thread hashes the 2M hugepages of a range of the guest
+ * memory, and backs those which hold the same bytes as in another VM with
+ * one hugepage, read-only, in a hugetlbfs file the DMs share: the range is
+ * meant for what the UOSs started from the same image keep unchanged, such
+ * as the text of their kernel. The write of a vcpu to a shared hugepage
+ * gives the VM a copy of its own again (see HC_VM_SET_COW); so does a
+ * write of the DM, which must call dedup_prepare_write() first, as the
+ * virtio devices do for the buffers they write. The other devices and
+ * passthrough devices must not write to the range.
+ */
+extern bool dedup_enabled;
+
+/* <gpa>,<size>[,<interval in seconds>] */
+int	dedup_parse(const char *opt);
+int	dedup_init(struct vmctx *ctx);
+void	dedup_deinit(struct vmctx *ctx);
+
+/* Give the VM its own copy of the whole range, e.g. to load it again */
+int	dedup_reset(void);
+
+/* A write of a vcpu to a shared hugepage, see VM_EXITCODE_WP */
+int	dedup_fault(vm_paddr_t gpa);
+
+int	dedup_write_range(vm_paddr_t gpa, size_t len);
+
+/*
+ * Before the DM writes [gpa, gpa + len) of the guest memory: its shared
+ * hugepages are the VM's own again, and stay so for one more scan. -ENOSPC
+ * when the SOS has no hugepage left for the copy.
+ */
+static inline int
+dedup_prepare_write(vm_paddr_t gpa, size_t len)
+{
+	return dedup_enabled ? dedup_write_range(gpa, len) : 0;
+}
+
+#endif /* _DEDUP_H_ */
@@ -32,11 +32,17 @@
 #include <stdbool.h>
 #include "types.h"
 #include "vmm.h"
+#include "vmmapi.h"
 
 struct vmctx;
 extern int guest_ncpus;
 extern char *guest_uuid_str;
 extern uint8_t trusty_enabled;
+extern bool high_prio_enabled;
+extern bool guest_cr_bits_enabled;
+extern bool vpmu_enabled;
+extern uint32_t ple_gap, ple_window;
+extern uint32_t guest_tsc_khz;
 extern char *vsbl_file_name;
 extern char *ovmf_file_name;
 extern char *kernel_file_name;
@@ -57,10 +63,22 @@ int vmexit_task_switch(struct vmctx *ctx, struct vhm_request *vhm_req,
  *
  * @return NULL on convert failed and host virtual address on successful.
  */
-void *paddr_guest2host(struct vmctx *ctx, uintptr_t gaddr, size_t len);
+static inline void *
+paddr_guest2host(struct vmctx *ctx, uintptr_t gaddr, size_t len)
+{
+	return vm_map_gpa(ctx, gaddr, len);
+}
+
 int  virtio_uses_msix(void);
 size_t high_bios_size(void);
 void ptdev_no_reset(bool enable);
+int dm_run(int argc, char *argv[]);
+/*
+ * Wait up to timeout_ms for the ioreqs of a paused VM to be completed and
+ * its posted writes to be handled by vm_loop, before its state is saved.
+ * Returns 0, or -1 on timeout.
+ */
+int vm_wait_ioreqs_idle(struct vmctx *ctx, int timeout_ms);
 void init_debugexit(void);
 void deinit_debugexit(void);
 #endif
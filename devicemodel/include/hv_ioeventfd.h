@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) <2018> Intel Corporation
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _HV_IOEVENTFD_H_
+#define _HV_IOEVENTFD_H_
+
+#include "types.h"
+#include "acrn_common.h"
+
+struct vmctx;
+
+/*
+ * Doorbell writes matching an in-hypervisor ioeventfd are completed by the
+ * hypervisor without pausing the vcpu. The DM only learns that the doorbell
+ * was rung (possibly several times) and runs the handler from vm_loop.
+ */
+typedef void (*hv_ioeventfd_handler_t)(void *arg);
+
+int	hv_ioeventfd_init(struct vmctx *ctx);
+int	hv_ioeventfd_add(struct vmctx *ctx, uint64_t addr, uint32_t len,
+			 uint32_t flags, uint64_t data,
+			 hv_ioeventfd_handler_t handler, void *arg);
+void	hv_ioeventfd_del(struct vmctx *ctx, int idx);
+void	hv_ioeventfd_dispatch(struct vmctx *ctx);
+void	hv_ioeventfd_reset(struct vmctx *ctx);
+
+#endif /* _HV_IOEVENTFD_H_ */
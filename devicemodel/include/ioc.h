@@ -13,6 +13,7 @@
 
 #include <sys/queue.h>
 #include <sys/epoll.h>
+#include <sys/uio.h>
 
 /*
  * Carrier Board Communication(CBC) frame definition
@@ -93,8 +94,10 @@
 
 /*
  * CBC ring buffer is used to buffer bytes before build one complete CBC frame.
+ * The virtual UART is read straight into it, so it also bounds how much of a
+ * burst one read can take. Must be a power of two.
  */
-#define CBC_RING_BUFFER_SIZE	256
+#define CBC_RING_BUFFER_SIZE	2048
 
 /*
  * Default whitelist node is NULL before whitelist initialization.
@@ -795,6 +798,7 @@ struct ioc_dev {
 
 	char rx_name[16];		/* Rx thread name */
 	struct cbc_qhead rx_qhead;	/* Rx queue head */
+	struct cbc_qhead rx_batch;	/* Rx requests not yet handed over */
 	struct cbc_config rx_config;	/* Rx configuration */
 	pthread_t rx_tid;
 	pthread_cond_t rx_cond;
@@ -842,6 +846,12 @@ void cbc_tx_handler(struct cbc_pkt *pkt);
 /* Copy to buf to the ring buffer */
 int cbc_copy_to_ring(const uint8_t *buf, size_t size, struct cbc_ring *ring);
 
+/* Get the free space of the ring buffer as up to two iovecs */
+int cbc_ring_free_iov(struct cbc_ring *ring, struct iovec *iov);
+
+/* Account bytes written into the free space of the ring buffer */
+void cbc_ring_produce(struct cbc_ring *ring, size_t bytes);
+
 /* Build a cbc_request based on CBC link layer protocol */
 void cbc_unpack_link(struct ioc_dev *ioc);
 
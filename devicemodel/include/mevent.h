@@ -40,9 +40,23 @@ enum ev_type {
 
 struct mevent;
 
+/* The loop of mevent_dispatch() */
+#define MEVENT_LOOP_MAIN	0
+
+/*
+ * The loop of that name, started with a thread of its own on first use.
+ * Returns MEVENT_LOOP_MAIN if it cannot be started, -1 if no loop is
+ * left.
+ */
+int	mevent_loop_get(const char *name);
+
 struct mevent *mevent_add(int fd, enum ev_type type,
 			  void (*run)(int, enum ev_type, void *), void *param,
 			  void (*teardown)(void *), void *teardown_param);
+/* mevent_add() on a loop from mevent_loop_get() */
+struct mevent *mevent_add_loop(int loop, int fd, enum ev_type type,
+			       void (*run)(int, enum ev_type, void *), void *param,
+			       void (*teardown)(void *), void *teardown_param);
 int	mevent_enable(struct mevent *evp);
 int	mevent_disable(struct mevent *evp);
 int	mevent_delete(struct mevent *evp);
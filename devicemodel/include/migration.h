@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) <2018> Intel Corporation
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _MIGRATION_H_
+#define _MIGRATION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "types.h"
+
+struct vmctx;
+
+/*
+ * Live migration of a UOS to the acrn-dm another host started with
+ * --incoming and the same memory size and devices. The guest memory is
+ * copied while the UOS runs, then again the pages it wrote in the meantime,
+ * round after round, with the dirty page logging of the hypervisor. Once
+ * few pages are left, the UOS is paused and the last pages, the vCPU
+ * registers and the state of the PCI devices are sent (see snapshot.h),
+ * then the UOS runs on the target and this acrn-dm exits. The disk images
+ * must be on storage both hosts share.
+ */
+
+/* the state in struct migration_stats */
+#define MIGRATION_NONE		0
+#define MIGRATION_PRECOPY	1	/* copying while the UOS runs */
+#define MIGRATION_STOPCOPY	2	/* the UOS is paused */
+#define MIGRATION_DONE		3	/* the UOS runs on the target */
+#define MIGRATION_FAILED	4	/* the UOS runs here again */
+
+struct migration_stats {
+	int		state;
+	int		err;		/* of a failed migration */
+	uint32_t	round;		/* of the pre-copy */
+	uint64_t	sent;		/* 4K pages, some several times */
+	uint64_t	zero;		/* of them, sent as zero pages */
+	uint64_t	bytes;		/* on the wire */
+	uint64_t	dirty;		/* pages found dirty by the last round */
+	uint64_t	downtime_ms;	/* with the UOS paused */
+	uint64_t	total_ms;
+};
+
+/*
+ * The pages the DM writes, which the dirty page logging of the hypervisor
+ * doesn't see, are logged while a migration goes on: the buffers the
+ * virtio devices write, as vq_getchain() takes them. They are sent again
+ * once the VM is paused.
+ */
+extern bool migration_log_enabled;
+void	migration_log_range(vm_paddr_t gpa, size_t len);
+
+static inline void
+migration_log_write(vm_paddr_t gpa, size_t len)
+{
+	if (migration_log_enabled)
+		migration_log_range(gpa, len);
+}
+
+/**
+ * @brief Start the migration of a running VM to host:port.
+ *
+ * The migration goes on in a thread of its own, see migration_get_stats().
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param dest The host:port the target acrn-dm listens on.
+ *
+ * @return 0 on success, -EBUSY if a migration is going on, -EINVAL if the
+ *         VM can't be migrated.
+ */
+int	migration_start(struct vmctx *ctx, const char *dest);
+
+/* The progress of the last migration started */
+void	migration_get_stats(struct migration_stats *stats);
+
+/**
+ * @brief Receive a VM migrated to [addr:]port, in place of booting it.
+ *
+ * Like vm_snapshot_load(), for a VM which is not started yet. Returns
+ * once the VM is fully received.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param addr The [addr:]port to listen on.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int	migration_incoming(struct vmctx *ctx, const char *addr);
+
+#endif /* _MIGRATION_H_ */
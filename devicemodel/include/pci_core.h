@@ -34,6 +34,7 @@
 #include <assert.h>
 #include "types.h"
 #include "pcireg.h"
+#include "cpu_acct.h"
 
 #define	PCI_BARMAX	PCIR_MAX_BAR_0	/* BAR registers in a Type 0 header */
 #define	PCI_BDF(b, d, f) (((b & 0xFF) << 8) | ((d & 0x1F) << 3) | ((f & 0x7)))
@@ -45,6 +46,14 @@ struct memory_region;
 struct pci_vdev_ops {
 	char	*class_name;		/* Name of device class */
 
+	/*
+	 * optional, slow preparation of an instance that depends on nothing
+	 * but its options (e.g. resetting a physical device). The ones of all
+	 * the instances run concurrently before any vdev_init, so they must
+	 * not touch the PCI core or shared state; vdev_init handles failures.
+	 */
+	void	(*vdev_prepare)(struct vmctx *, const char *opts);
+
 	/* instance creation */
 	int	(*vdev_init)(struct vmctx *, struct pci_vdev *,
 			     char *opts);
@@ -53,6 +62,25 @@ struct pci_vdev_ops {
 	void	(*vdev_deinit)(struct vmctx *, struct pci_vdev *,
 			char *opts);
 
+	/*
+	 * instance reset on a warm reset of the VM, back to its state after
+	 * vdev_init but keeping its backend. The config space, BARs and MSI
+	 * state are restored before. Devices without it are recreated.
+	 */
+	void	(*vdev_reset)(struct vmctx *, struct pci_vdev *);
+
+	/*
+	 * instance state for a snapshot of the VM, beyond the config space,
+	 * BARs and MSI state saved by the PCI core. vdev_save returns the
+	 * length written into buf, or -1 when the state doesn't fit in len.
+	 * A device with vdev_reset but without them is brought back to its
+	 * state after vdev_init, any other device can't be saved.
+	 */
+	int	(*vdev_save)(struct vmctx *, struct pci_vdev *,
+			     void *buf, size_t len);
+	int	(*vdev_load)(struct vmctx *, struct pci_vdev *,
+			     const void *buf, size_t len);
+
 	/* ACPI DSDT enumeration */
 	void	(*vdev_write_dsdt)(struct pci_vdev *);
 
@@ -94,6 +122,8 @@ struct pcibar {
 	enum pcibar_type	type;		/* io or memory */
 	uint64_t		size;
 	uint64_t		addr;
+	uint64_t		posted_off;	/* writes to this window of */
+	uint64_t		posted_size;	/* a mem bar can be posted */
 };
 
 #define PI_NAMESZ	40
@@ -160,6 +190,12 @@ struct pci_vdev {
 
 	uint8_t	cfgdata[PCI_REGMAX + 1];
 	struct pcibar bar[PCI_BARMAX + 1];
+
+	/* as init_pci() left them, for reset_pci() */
+	uint8_t	cfgdata_init[PCI_REGMAX + 1];
+	uint64_t bar_addr_init[PCI_BARMAX + 1];
+
+	struct cpu_acct cpu_acct;
 };
 
 struct gsi_dev {
@@ -235,6 +271,9 @@ typedef void (*pci_lintr_cb)(int b, int s, int pin, int pirq_pin,
 
 int	init_pci(struct vmctx *ctx);
 void	deinit_pci(struct vmctx *ctx);
+int	reset_pci(struct vmctx *ctx);
+int	save_pci(struct vmctx *ctx, int fd);
+int	load_pci(struct vmctx *ctx, int fd, int nr);
 void	msicap_cfgwrite(struct pci_vdev *pi, int capoff, int offset,
 			int bytes, uint32_t val);
 void	msixcap_cfgwrite(struct pci_vdev *pi, int capoff, int offset,
@@ -242,6 +281,8 @@ void	msixcap_cfgwrite(struct pci_vdev *pi, int capoff, int offset,
 void	pci_callback(void);
 int	pci_emul_alloc_bar(struct pci_vdev *pdi, int idx,
 			   enum pcibar_type type, uint64_t size);
+void	pci_emul_set_posted_window(struct pci_vdev *pdi, int idx,
+				   uint64_t off, uint64_t size);
 int	pci_emul_alloc_pbar(struct pci_vdev *pdi, int idx,
 			    uint64_t hostbase, enum pcibar_type type,
 			    uint64_t size);
@@ -309,6 +350,7 @@ void	pci_walk_lintr(int bus, pci_lintr_cb cb, void *arg);
 void	pci_write_dsdt(void);
 uint64_t pci_ecfg_base(void);
 int	pci_bus_configured(int bus);
+bool	pci_has_devtype(const char *class_name);
 int	emulate_pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus,
 			  int slot, int func, int reg, int bytes, int *value);
 int	create_gsi_sharing_groups(void);
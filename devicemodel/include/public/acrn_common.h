@@ -43,7 +43,20 @@
 /*
  * IO request
  */
-#define VHM_REQUEST_MAX 16U
+#define VHM_REQUEST_MAX 16U	/* number of requests in one ioreq page */
+
+/*
+ * Layout of the ioreq buffer, encoded in bits 11:0 of
+ * acrn_set_ioreq_buffer.req_buf (the buffer itself is page aligned).
+ *
+ * V0: one page of VHM_REQUEST_MAX requests.
+ * V1: VHM_REQUEST_PAGES_MAX guest-contiguous pages, request N is the
+ *     (N % VHM_REQUEST_MAX)th one of page (N / VHM_REQUEST_MAX).
+ */
+#define IOREQ_BUF_VERSION_MASK	0xFFFUL
+#define IOREQ_BUF_V0		0UL
+#define IOREQ_BUF_V1		1UL
+#define VHM_REQUEST_PAGES_MAX	4U
 
 #define REQ_STATE_PENDING	0
 #define REQ_STATE_COMPLETE	1
@@ -67,6 +80,9 @@
 
 /* Generic VM flags from guest OS */
 #define SECURE_WORLD_ENABLED    (1UL<<0)  /* Whether secure world is enabled */
+#define HIGH_PRIORITY_VM        (1UL<<1)  /* Whether vCPUs preempt the others on their pCPU */
+#define GUEST_OWNED_CR_BITS     (1UL<<2)  /* Whether the guest owns the CR bits hv needs no exit on */
+#define VPMU_ENABLED            (1UL<<3)  /* Whether the vCPUs get a virtual PMU */
 
 /**
  * @brief Hypercall
@@ -233,6 +249,355 @@ union vhm_request_buffer {
 	int8_t reserved[4096];
 } __aligned(4096);
 
+/**
+ * @brief A MMIO or port I/O write posted to SOS without pausing the
+ * requesting vCPU
+ */
+struct vhm_posted_request {
+	/** @brief Guest physical address, or port, written to. */
+	uint64_t address;
+
+	/** @brief Value written. */
+	uint64_t value;
+
+	/** @brief Width of the write in bytes (1, 2, 4 or 8). */
+	uint32_t size;
+
+	/** @brief ID of the vCPU that issued the write. */
+	uint16_t vcpu;
+
+#define POSTED_REQUEST_PIO	0x1U
+	/** @brief POSTED_REQUEST_PIO for a port I/O write, 0 for MMIO. */
+	uint16_t flags;
+
+	/** @brief Reserved. */
+	uint64_t reserved1;
+} __aligned(32);
+
+#define VHM_POSTED_REQUEST_MAX	127U
+
+/**
+ * @brief Ring of posted writes shared between the hypervisor and SOS
+ *
+ * MMIO and port I/O writes to ranges registered by HC_SET_POSTED_MMIO_RANGE
+ * are appended to this ring instead of the per-vCPU slots of
+ * vhm_request_buffer, and the issuing vCPU resumes immediately. The
+ * hypervisor is the only producer and advances \p tail; SOS is the only
+ * consumer and advances \p head. The ring is empty when head == tail and
+ * full when (tail + 1) % MAX == head, in which case the write falls back to
+ * a regular (blocking) VHM request.
+ *
+ * Ordering: a posted write is always appended before any later request of
+ * the same vCPU is delivered, so SOS shall drain the ring before handling a
+ * request in vhm_request_buffer.
+ *
+ * An upcall is fired only when the ring turns non-empty. After updating
+ * \p head, SOS shall issue a full barrier and re-check \p tail before going
+ * to sleep.
+ */
+struct vhm_posted_ring {
+	/** @brief Index of the next entry to consume, written by SOS. */
+	uint32_t head;
+
+	/** @brief Index of the next entry to produce, written by hypervisor. */
+	uint32_t tail;
+
+	/** @brief Number of writes that found the ring full. */
+	uint32_t overflow;
+
+	/** @brief Reserved. */
+	uint32_t reserved[5];
+
+	/** @brief The posted writes. */
+	struct vhm_posted_request entries[VHM_POSTED_REQUEST_MAX];
+} __aligned(4096);
+
+/** Max number of in-hypervisor ioeventfds of a VM */
+#define VHM_IOEVENTFD_MAX	64U
+
+/**
+ * @brief Pending bitmap of the in-hypervisor ioeventfds of a VM
+ *
+ * When a write of the VM matches the ioeventfd registered at index i by
+ * HC_ASSIGN_IOEVENTFD, the hypervisor completes the write on its own, sets
+ * bit i of \p pending and resumes the vCPU. An upcall is fired only when
+ * \p pending turns non-zero, so SOS shall atomically exchange \p pending
+ * with 0 and handle every bit set in the old value, repeating until it
+ * reads 0. Several matching writes before SOS consumes the bitmap are
+ * coalesced into a single bit, like an eventfd counter.
+ */
+struct vhm_ioeventfd_page {
+	/** @brief Bitmap of the signaled ioeventfds, cleared by SOS. */
+	uint64_t pending;
+
+	/** @brief Reserved. */
+	uint64_t reserved[511];
+} __aligned(4096);
+
+/**
+ * @brief A PIT counter as published in vhm_clock_page
+ */
+struct vhm_clock_pit {
+	/** @brief TSC of SOS when the count was loaded into the counter. */
+	uint64_t start_tsc;
+
+	/** @brief Initial count, 1 to 0x10000. */
+	uint32_t initial;
+
+	/** @brief Counter mode, the mode bits of the control word (0x0-0xe). */
+	uint8_t mode;
+
+	/**
+	 * @brief Non-zero if the hypervisor may complete reads of the counter:
+	 * it is loaded and neither its count nor its status is latched.
+	 */
+	uint8_t valid;
+
+	/** @brief Reserved. */
+	uint16_t reserved0;
+
+	/**
+	 * @brief Byte the next free-running read returns, 0 for the LSB and
+	 * 1 for the MSB. Toggled atomically by whoever completes the read.
+	 */
+	uint32_t frbyte;
+
+	/** @brief Reserved. */
+	uint32_t reserved1;
+};
+
+/** Number of RTC registers (from 0x0) in vhm_clock_page */
+#define VHM_CLOCK_RTC_REGS	14U
+
+/**
+ * @brief RTC and PIT state SOS shares with the hypervisor
+ *
+ * Reads without side effects of the RTC data port (0x71), the PIT counters
+ * (0x40-0x42) and the PIT channel 2 output (0x61) are completed by the
+ * hypervisor from this page; everything else still reaches SOS, which keeps
+ * the page up to date. Times are in the TSC of SOS, which runs with no
+ * offset at \p tsc_khz.
+ *
+ * SOS updates the PIT and the RTC fields under their own sequence count:
+ * it makes the count odd, updates the fields, then makes it even again. The
+ * hypervisor delivers the read to SOS when it finds the count odd or changed
+ * across its read of the fields.
+ */
+struct vhm_clock_page {
+	/** @brief TSC frequency in kHz, written by the hypervisor. */
+	uint32_t tsc_khz;
+
+	/** @brief Sequence count of \p pit. */
+	uint32_t pit_seq;
+
+	/** @brief The three PIT counters. */
+	struct vhm_clock_pit pit[3];
+
+	/** @brief Sequence count of the rtc fields. */
+	uint32_t rtc_seq;
+
+	/** @brief RTC register selected through port 0x70. */
+	uint8_t rtc_addr;
+
+	/** @brief Non-zero if \p rtc_regs and \p rtc_century may be read. */
+	uint8_t rtc_valid;
+
+	/** @brief Reserved. */
+	uint16_t reserved0;
+
+	/** @brief TSC of SOS from which the date and time fields are stale. */
+	uint64_t rtc_expire_tsc;
+
+	/** @brief RTC registers 0x0 to 0xd, register C is always left to SOS. */
+	uint8_t rtc_regs[VHM_CLOCK_RTC_REGS];
+
+	/** @brief RTC century register (0x32). */
+	uint8_t rtc_century;
+
+	/** @brief Reserved. */
+	uint8_t reserved1[3985];
+} __aligned(4096);
+
+/** vCPUs with counters in acrn_vm_telemetry */
+#define ACRN_TELEMETRY_VCPUS		8U
+
+/** Passthrough interrupts with a count in acrn_vm_telemetry */
+#define ACRN_TELEMETRY_PTIRQS		128U
+
+/**
+ * @brief The counters of a vCPU in acrn_vm_telemetry
+ *
+ * They are written from the pCPU of the vCPU on each of its VM exits,
+ * between two increments of \p seq: a reader retries while it finds the
+ * count odd or changed across its read of the counters.
+ */
+struct acrn_vcpu_telemetry {
+	/** @brief Sequence count of the counters. */
+	uint32_t seq;
+
+	/** @brief Reserved. */
+	uint32_t reserved0;
+
+	/** @brief VM exits. */
+	uint64_t exits;
+
+	/** @brief TSC cycles spent in the hypervisor handling them. */
+	uint64_t exit_cycles;
+
+	/** @brief Exits on an external interrupt. */
+	uint64_t ext_intr_exits;
+
+	/** @brief Exits on a port I/O. */
+	uint64_t pio_exits;
+
+	/** @brief Exits on an EPT violation, i.e. MMIO. */
+	uint64_t ept_exits;
+
+	/** @brief Exits on a RDMSR or WRMSR. */
+	uint64_t msr_exits;
+
+	/** @brief Exits on a HLT. */
+	uint64_t hlt_exits;
+
+	/** @brief I/O requests completed by SOS. */
+	uint64_t dm_requests;
+
+	/** @brief TSC cycles waiting for SOS to complete them. */
+	uint64_t dm_wait;
+
+	/** @brief Interrupts sent to the vLAPIC. */
+	uint64_t intr_sent;
+
+	/** @brief Expirations of the vLAPIC timer. */
+	uint64_t timer_fired;
+
+	/** @brief Reserved. */
+	uint64_t reserved1[4];
+} __aligned(8);
+
+/**
+ * @brief The interrupts of a passthrough IRQ in acrn_vm_telemetry
+ *
+ * A slot is taken by an IRQ on its first interrupt, \p pirq is written
+ * before \p count gets non-zero.
+ */
+struct acrn_ptirq_telemetry {
+	/** @brief Physical IRQ. */
+	uint32_t pirq;
+
+	/** @brief Reserved. */
+	uint32_t reserved;
+
+	/** @brief Interrupts, as ptirq_get_intr_data() reports them. */
+	uint64_t count;
+} __aligned(8);
+
+/**
+ * @brief Statistics of a VM the hypervisor keeps up to date in SOS memory
+ *
+ * The page, set with HC_SET_TELEMETRY_PAGE, lets SOS sample the statistics
+ * as often as it wants without a hypercall. The hypervisor only ever
+ * writes to it.
+ */
+struct acrn_vm_telemetry {
+	/** @brief TSC frequency in kHz, written by the hypervisor. */
+	uint32_t tsc_khz;
+
+	/** @brief vCPUs of the VM with counters in \p vcpu. */
+	uint16_t nr_vcpus;
+
+	/** @brief Reserved. */
+	uint16_t reserved0;
+
+	/** @brief Reserved. */
+	uint8_t reserved1[56];
+
+	/** @brief The counters of each vCPU. */
+	struct acrn_vcpu_telemetry vcpu[ACRN_TELEMETRY_VCPUS];
+
+	/** @brief The passthrough IRQs, in the order of their first interrupt. */
+	struct acrn_ptirq_telemetry ptirq[ACRN_TELEMETRY_PTIRQS];
+
+	/** @brief Reserved. */
+	uint8_t reserved2[960];
+} __aligned(4096);
+
+/** Start dirty page logging of a range, see acrn_dirty_log */
+#define ACRN_DIRTY_LOG_START		0U
+/** Stop dirty page logging of a range */
+#define ACRN_DIRTY_LOG_STOP		1U
+/** Fetch and clear the dirty pages of a range */
+#define ACRN_DIRTY_LOG_GET		2U
+
+/** Pages one ACRN_DIRTY_LOG_GET covers at most: its bitmap is one page */
+#define ACRN_DIRTY_LOG_PAGES_MAX	(4096U * 8U)
+
+/**
+ * @brief Dirty page logging of a VM, the parameter for HC_VM_DIRTY_LOG
+ *
+ * ACRN_DIRTY_LOG_START maps [gpa, gpa + size) of the VM with 4K pages and
+ * lets the CPU mark the pages the vCPUs write. ACRN_DIRTY_LOG_GET then
+ * reports the pages written since the previous GET, or since START, and
+ * clears their marks: when it returns, a later write is reported by the
+ * next GET. ACRN_DIRTY_LOG_STOP ends the logging and maps the range with
+ * large pages again. The range of each call is 4K aligned, and that of GET
+ * is at most ACRN_DIRTY_LOG_PAGES_MAX pages.
+ *
+ * Only the writes of the vCPUs are logged: neither DMA by passthrough
+ * devices nor the writes of SOS to the memory of the VM are.
+ */
+struct acrn_dirty_log {
+	/** ACRN_DIRTY_LOG_START, _STOP or _GET */
+	uint32_t op;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/** guest physical address of the range in the VM */
+	uint64_t gpa;
+
+	/** size of the range */
+	uint64_t size;
+
+	/**
+	 * SOS guest physical address of the bitmap GET fills in, in one
+	 * page: bit n, from bit 0 of its first uint64_t, for the page at
+	 * gpa + n * 4K
+	 */
+	uint64_t bitmap_gpa;
+
+	/** pages GET found dirty, written back by the hypervisor */
+	uint64_t nr_dirty;
+} __aligned(8);
+
+/**
+ * @brief Copy on write of a range of a VM, the parameter for HC_VM_SET_COW
+ *
+ * With set, [gpa, gpa + size) of the VM, mapped in its EPT, becomes read
+ * only, and a write of a vCPU to it comes to SOS as a REQ_WP request of
+ * size 0, without emulation: SOS maps a page of the VM's own there, then
+ * completes the request and the vCPU runs the instruction again. This lets
+ * SOS back identical pages of several VMs with one page. Without set, the
+ * range is writable again. The range is 4K aligned; the EPT mappings SOS
+ * adds later are not copy on write.
+ *
+ * Only the writes of the vCPUs are caught: neither DMA by passthrough
+ * devices nor the writes of SOS are.
+ */
+struct acrn_cow_range {
+	/** 1 to make the range copy on write, 0 to make it writable */
+	uint32_t set;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/** guest physical address of the range in the VM */
+	uint64_t gpa;
+
+	/** size of the range */
+	uint64_t size;
+} __aligned(8);
+
 /**
  * @brief Info to create a VM, the parameter for HC_CREATE_VM hypercall
  */
@@ -254,13 +619,25 @@ struct acrn_create_vm {
 
 	/* VM flag bits from Guest OS, now used
 	 *  SECURE_WORLD_ENABLED          (1UL<<0)
+	 *  HIGH_PRIORITY_VM              (1UL<<1)
+	 *  GUEST_OWNED_CR_BITS           (1UL<<2)
+	 *  VPMU_ENABLED                  (1UL<<3)
 	 */
 	uint64_t vm_flag;
 
 	uint64_t req_buf;
 
+	/** PAUSE-loop exiting gap in TSC cycles, 0 for the default */
+	uint32_t ple_gap;
+
+	/** PAUSE-loop exiting window in TSC cycles, 0 for the default */
+	uint32_t ple_window;
+
+	/** TSC frequency of the vCPUs in kHz, 0 for the one of the host */
+	uint32_t tsc_khz;
+
 	/** Reserved for future use*/
-	uint8_t  reserved2[16];
+	uint8_t  reserved2[4];
 } __aligned(8);
 
 /**
@@ -313,7 +690,10 @@ struct acrn_vcpu_regs {
 	uint64_t        cr3;
 	uint64_t        ia32_efer;
 	uint64_t        rflags;
-	uint64_t        reserved_64[4];
+	/** FS and GS base, zero selects the flat default */
+	uint64_t        fs_base;
+	uint64_t        gs_base;
+	uint64_t        reserved_64[2];
 
 	uint32_t        cs_ar;
 	uint32_t        cs_limit;
@@ -354,10 +734,106 @@ struct acrn_set_vcpu_regs {
  * the parameter for HC_SET_IOREQ_BUFFER hypercall
  */
 struct acrn_set_ioreq_buffer {
-	/** guest physical address of VM request_buffer */
+	/** guest physical address of VM request_buffer, ORed with one of
+	 *  IOREQ_BUF_Vx to select its layout */
 	uint64_t req_buf;
 } __aligned(8);
 
+/**
+ * @brief Info to post (or stop posting) MMIO or port I/O writes to a range
+ *
+ * the parameter for HC_SET_POSTED_MMIO_RANGE hypercall
+ */
+struct acrn_posted_mmio_range {
+#define POSTED_MMIO_ASSIGN	0U
+#define POSTED_MMIO_DEASSIGN	1U
+	/** POSTED_MMIO_ASSIGN or POSTED_MMIO_DEASSIGN */
+	uint32_t op;
+
+#define POSTED_RANGE_FLAG_PIO	0x1U
+	/** POSTED_RANGE_FLAG_PIO if start and end are I/O ports */
+	uint32_t flags;
+
+	/** start guest physical address, or port, of the range (inclusive) */
+	uint64_t start;
+
+	/** end guest physical address, or port, of the range (exclusive) */
+	uint64_t end;
+} __aligned(8);
+
+/**
+ * @brief Info to assign (or deassign) an in-hypervisor ioeventfd
+ *
+ * the parameter for HC_ASSIGN_IOEVENTFD hypercall
+ */
+struct acrn_hv_ioeventfd {
+#define HV_IOEVENTFD_FLAG_PIO		0x01U
+#define HV_IOEVENTFD_FLAG_DATAMATCH	0x02U
+#define HV_IOEVENTFD_FLAG_DEASSIGN	0x04U
+	/** guest physical address or port of the doorbell */
+	uint64_t addr;
+
+	/** value to match, if HV_IOEVENTFD_FLAG_DATAMATCH is set */
+	uint64_t data;
+
+	/** width of the write in bytes (1, 2, 4 or 8) */
+	uint32_t len;
+
+	/** HV_IOEVENTFD_FLAG_* */
+	uint32_t flags;
+
+	/** bit of vhm_ioeventfd_page::pending signaled on a match */
+	uint32_t index;
+
+	/** Reserved */
+	uint32_t reserved;
+} __aligned(8);
+
+/**
+ * @brief Info to steer the VHM upcalls of a VM across SOS vCPUs
+ *
+ * the parameter for HC_SET_UPCALL_POLICY hypercall
+ */
+struct acrn_upcall_policy {
+/** all upcalls go to the lowest vCPU of vcpu_mask */
+#define UPCALL_POLICY_FIXED		0U
+/** upcalls rotate among the vCPUs of vcpu_mask */
+#define UPCALL_POLICY_ROUND_ROBIN	1U
+/** upcalls for requests of vCPU N go to the (N % weight)th vCPU of vcpu_mask */
+#define UPCALL_POLICY_SOURCE		2U
+	/** UPCALL_POLICY_xxx */
+	uint32_t policy;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/** bitmap of the SOS vCPUs the upcalls may be injected to, 0 for vCPU 0 only */
+	uint64_t vcpu_mask;
+} __aligned(8);
+
+/**
+ * @brief One hypercall of a HC_MULTICALL batch
+ *
+ * HC_MULTICALL takes the guest physical address of an array of these as
+ * param1 and the number of entries as param2.
+ */
+struct acrn_multicall_entry {
+	/** hypercall ID, HC_MULTICALL itself is not allowed */
+	uint64_t hc_id;
+
+	/** hypercall param1 */
+	uint64_t param1;
+
+	/** hypercall param2 */
+	uint64_t param2;
+
+	/** written back by hypervisor: return value of the hypercall */
+	int64_t result;
+} __aligned(8);
+
+/** Max number of entries of a HC_MULTICALL batch */
+#define MULTICALL_ENTRIES_MAX	256U
+
 /** Operation types for setting IRQ line */
 #define GSI_SET_HIGH		0U
 #define GSI_SET_LOW		1U
@@ -388,6 +864,25 @@ struct acrn_msi_entry {
 	uint64_t msi_data;
 } __aligned(8);
 
+/** Max number of MSIs in one acrn_msi_batch */
+#define MSI_BATCH_ENTRIES_MAX	32U
+
+/**
+ * @brief Info to inject a batch of MSI interrupts to a VM
+ *
+ * the parameter for HC_INJECT_MSI_BATCH hypercall
+ */
+struct acrn_msi_batch {
+	/** number of valid entries */
+	uint32_t nr_entries;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/** MSIs to inject, in order */
+	struct acrn_msi_entry entries[MSI_BATCH_ENTRIES_MAX];
+} __aligned(8);
+
 /**
  * @brief Info to inject a NMI interrupt for a VM
  */
@@ -446,6 +941,141 @@ struct acrn_vm_pci_msix_remap {
 	uint32_t vector_ctl;
 } __aligned(8);
 
+/** Max number of devices in one acrn_ptdev_batch */
+#define PTDEV_BATCH_MAX		64U
+
+/**
+ * @brief Info to assign a batch of pass-through PCI devices to a VM
+ *
+ * the parameter for HC_ASSIGN_PTDEV_BATCH hypercall
+ */
+struct acrn_ptdev_batch {
+	/** number of valid entries */
+	uint32_t nr_bdfs;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/** physical BDF# of the devices, e.g. the VFs of a SR-IOV device */
+	uint16_t bdfs[PTDEV_BATCH_MAX];
+} __aligned(8);
+
+/** VMX basic exit reasons accounted in acrn_vmexit_stats, see SDM Appendix C */
+#define ACRN_VMEXIT_REASONS		65U
+
+/** Buckets of the exit cycle histograms, the last one is open-ended */
+#define ACRN_VMEXIT_HIST_BUCKETS	24U
+
+/** Max number of emulated MMIO regions reported in acrn_vmexit_stats */
+#define ACRN_VMEXIT_MMIO_REGIONS	32U
+
+/**
+ * @brief Accounting of the VM exits of one exit reason
+ *
+ * Times are in TSC cycles, from the VM exit dispatch to the return of
+ * its handler.
+ */
+struct acrn_exit_reason_stats {
+	/** number of exits */
+	uint64_t count;
+
+	/** time spent in their handling */
+	uint64_t total_cycles;
+
+	/** longest handling */
+	uint64_t max_cycles;
+
+	/** exits handled in [2^i, 2^(i+1)) cycles, bucket 0 includes 0 */
+	uint32_t hist[ACRN_VMEXIT_HIST_BUCKETS];
+} __aligned(8);
+
+/**
+ * @brief Accounting of the accesses to one emulated MMIO region
+ */
+struct acrn_mmio_exit_stats {
+	/** start address of the region (inclusive) */
+	uint64_t start;
+
+	/** end address of the region (exclusive) */
+	uint64_t end;
+
+	/** accesses handled by the hypervisor */
+	uint64_t count;
+
+	/** TSC cycles spent in the region handler */
+	uint64_t total_cycles;
+} __aligned(8);
+
+/**
+ * @brief VM exit accounting of a vCPU
+ *
+ * the parameter for HC_GET_VMEXIT_STATS hypercall
+ */
+struct acrn_vmexit_stats {
+	/** IN: virtual CPU ID to read */
+	uint16_t vcpu_id;
+
+	/** OUT: number of valid entries in mmio[] */
+	uint16_t nr_mmio;
+
+	/** Reserved */
+	uint16_t reserved[2];
+
+	/** OUT: indexed by the basic exit reason */
+	struct acrn_exit_reason_stats reason[ACRN_VMEXIT_REASONS];
+
+	/** OUT: EPT violations emulated by the hypervisor, per region */
+	struct acrn_mmio_exit_stats mmio[ACRN_VMEXIT_MMIO_REGIONS];
+} __aligned(8);
+
+/** VM exits kept in the acrn_exit_timeline of a vCPU, a power of 2 */
+#define ACRN_EXIT_TIMELINE_RECORDS	256U
+
+/**
+ * @brief One VM exit of a vCPU
+ */
+struct acrn_exit_record {
+	/** TSC right after the VM exit */
+	uint64_t exit_tsc;
+
+	/** guest RIP the exit happened at */
+	uint64_t guest_rip;
+
+	/** TSC cycles from the VM exit to the next VM entry, saturated */
+	uint32_t cycles;
+
+	/** basic exit reason */
+	uint16_t exit_reason;
+
+	/** Reserved */
+	uint16_t reserved;
+} __aligned(8);
+
+/**
+ * @brief The last VM exits of a vCPU
+ *
+ * the parameter for HC_GET_EXIT_TIMELINE hypercall. The exit of sequence
+ * number i, counted from the creation of the vCPU, is in
+ * records[i % ACRN_EXIT_TIMELINE_RECORDS]; the ones of [first, next) are
+ * valid. The vCPU keeps running while they are copied.
+ */
+struct acrn_exit_timeline {
+	/** IN: virtual CPU ID to read */
+	uint16_t vcpu_id;
+
+	/** Reserved */
+	uint16_t reserved[3];
+
+	/** OUT: sequence number of the oldest valid record */
+	uint64_t first;
+
+	/** OUT: sequence number of the next exit to be recorded */
+	uint64_t next;
+
+	/** OUT: ring of the last exits */
+	struct acrn_exit_record records[ACRN_EXIT_TIMELINE_RECORDS];
+} __aligned(8);
+
 /**
  * @brief The guest config pointer offset.
  *
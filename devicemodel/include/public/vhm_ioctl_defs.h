@@ -74,12 +74,17 @@
 #define IC_CREATE_VCPU                 _IC_ID(IC_ID, IC_ID_VM_BASE + 0x04)
 #define IC_RESET_VM                    _IC_ID(IC_ID, IC_ID_VM_BASE + 0x05)
 #define IC_SET_VCPU_REGS               _IC_ID(IC_ID, IC_ID_VM_BASE + 0x06)
+#define IC_GET_VMEXIT_STATS            _IC_ID(IC_ID, IC_ID_VM_BASE + 0x07)
+#define IC_GET_EXIT_TIMELINE           _IC_ID(IC_ID, IC_ID_VM_BASE + 0x08)
+#define IC_GET_VCPU_REGS               _IC_ID(IC_ID, IC_ID_VM_BASE + 0x09)
+#define IC_RESUME_VM                   _IC_ID(IC_ID, IC_ID_VM_BASE + 0x0A)
 
 /* IRQ and Interrupts */
 #define IC_ID_IRQ_BASE                 0x20UL
 #define IC_INJECT_MSI                  _IC_ID(IC_ID, IC_ID_IRQ_BASE + 0x03)
 #define IC_VM_INTR_MONITOR             _IC_ID(IC_ID, IC_ID_IRQ_BASE + 0x04)
 #define IC_SET_IRQLINE                 _IC_ID(IC_ID, IC_ID_IRQ_BASE + 0x05)
+#define IC_INJECT_MSI_BATCH            _IC_ID(IC_ID, IC_ID_IRQ_BASE + 0x06)
 
 /* DM ioreq management */
 #define IC_ID_IOREQ_BASE                0x30UL
@@ -88,6 +93,14 @@
 #define IC_CREATE_IOREQ_CLIENT          _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x02)
 #define IC_ATTACH_IOREQ_CLIENT          _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x03)
 #define IC_DESTROY_IOREQ_CLIENT         _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x04)
+#define IC_SET_POSTED_IOREQ_BUFFER      _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x05)
+#define IC_SET_POSTED_MMIO_RANGE        _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x06)
+#define IC_SET_UPCALL_POLICY            _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x07)
+#define IC_SET_IOEVENTFD_PAGE           _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x08)
+#define IC_ASSIGN_HV_IOEVENTFD          _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x09)
+#define IC_NOTIFY_REQUEST_FINISH_BATCH  _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x0a)
+#define IC_SET_CLOCK_PAGE               _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x0b)
+#define IC_SET_TELEMETRY_PAGE           _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x0c)
 
 /* Guest memory management */
 #define IC_ID_MEM_BASE                  0x40UL
@@ -95,6 +108,8 @@
 #define IC_ALLOC_MEMSEG                 _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x00)
 #define IC_SET_MEMSEG                   _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x01)
 #define IC_UNSET_MEMSEG                 _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x02)
+#define IC_VM_DIRTY_LOG                 _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x03)
+#define IC_VM_SET_COW                   _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x04)
 
 /* PCI assignment*/
 #define IC_ID_PCI_BASE                  0x50UL
@@ -103,6 +118,7 @@
 #define IC_VM_PCI_MSIX_REMAP           _IC_ID(IC_ID, IC_ID_PCI_BASE + 0x02)
 #define IC_SET_PTDEV_INTR_INFO         _IC_ID(IC_ID, IC_ID_PCI_BASE + 0x03)
 #define IC_RESET_PTDEV_INTR_INFO       _IC_ID(IC_ID, IC_ID_PCI_BASE + 0x04)
+#define IC_ASSIGN_PTDEV_BATCH          _IC_ID(IC_ID, IC_ID_PCI_BASE + 0x05)
 
 /* Power management */
 #define IC_ID_PM_BASE                   0x60UL
@@ -182,6 +198,14 @@ struct ic_ptdev_irq {
 			uint64_t table_paddr;
 		} msix;
 	};
+
+	/** interrupt coalescing, ignored for SOS */
+	struct {
+		/** inject on this many interrupts, 0 for no limit */
+		uint32_t max_events;
+		/** inject at the latest this many us after the first, 0 for off */
+		uint32_t max_us;
+	} coalesce;
 };
 
 /**
@@ -194,6 +218,18 @@ struct ioreq_notify {
 	uint32_t vcpu;
 };
 
+/**
+ * @brief data structure to notify the completion of the ioreqs of several
+ * vcpus at once
+ */
+struct ioreq_notify_batch {
+	/** client id to identify ioreq client */
+	int32_t client_id;
+	uint32_t reserved;
+	/** bitmap of the ioreq submitters */
+	uint64_t vcpu_mask;
+};
+
 /**
  * @brief data structure to track VHM API version
  */
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) <2018> Intel Corporation
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stddef.h>
+
+struct vmctx;
+
+/*
+ * A snapshot of a paused UOS: the vCPU registers, the state of its PCI
+ * devices and the guest RAM, in one file. A new UOS with the same memory
+ * size and devices starts from it as a template, instead of loading and
+ * booting its images again.
+ */
+
+/**
+ * @brief Save a paused VM into a snapshot file.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param path The snapshot file, created or truncated.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int	vm_snapshot_save(struct vmctx *ctx, const char *path);
+
+/**
+ * @brief Load a snapshot file into a VM which is not started yet.
+ *
+ * Done in place of building the guest tables and loading the images.
+ * The VM must have the memory layout, the vCPUs and the PCI devices of
+ * the VM the snapshot was taken from.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param path The snapshot file.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int	vm_snapshot_load(struct vmctx *ctx, const char *path);
+
+/**
+ * @brief Save the VM into path when it is paused through the monitor.
+ *
+ * A VM paused by the monitor does not run again, the DM exits once the
+ * snapshot is written.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param path The snapshot file.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int	vm_snapshot_on_pause(struct vmctx *ctx, const char *path);
+
+/* write or read len bytes at the current offset of a snapshot file */
+int	snapshot_write(int fd, const void *buf, size_t len);
+int	snapshot_read(int fd, void *buf, size_t len);
+
+#endif /* _SNAPSHOT_H_ */
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) <2018> Intel Corporation
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _STANDBY_H_
+#define _STANDBY_H_
+
+/*
+ * A standby acrn-dm is started ahead of time, by acrnd, with the system
+ * wide setup of the device model done: hugetlbfs mounted and libpciaccess
+ * initialized. It waits on the mngr socket "standby-<n>". An acrn-dm
+ * launched for a UOS hands its own command line and stdio over to one
+ * when there is any, and only waits for it to exit.
+ */
+#define STANDBY_PREFIX	"standby-"
+
+/**
+ * @brief Run as a standby acrn-dm until a launch is handed over.
+ *
+ * @param name The mngr socket name, starting with STANDBY_PREFIX.
+ *
+ * @return The exit code of the UOS run, does not return before.
+ */
+int	dm_standby(const char *name);
+
+/**
+ * @brief Hand the UOS of this acrn-dm over to a standby acrn-dm.
+ *
+ * Waits for the standby to exit, forwarding it the termination signals.
+ *
+ * @return Exit code on success, -1 when no standby took it.
+ */
+int	dm_launch_standby(void);
+
+#endif
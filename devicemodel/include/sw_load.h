@@ -28,6 +28,9 @@
 #ifndef	_CORE_SW_LOAD_
 #define _CORE_SW_LOAD_
 
+#include <pthread.h>
+#include <stdbool.h>
+
 #define STR_LEN 1024
 
 /* E820 memory types */
@@ -68,7 +71,25 @@ int acrn_parse_guest_part_info(char *arg);
 char *get_bootargs(void);
 void vsbl_set_bdf(int bnum, int snum, int fnum);
 
+/*
+ * An image read into guest memory by a thread of its own, so that the
+ * images of a VM load concurrently.
+ */
+struct image_load {
+	pthread_t	thr;
+	bool		started;
+	const char	*path;
+	const char	*what;
+	void		*dst;
+	size_t		size;
+	int		ret;
+};
+
 int check_image(char *path, size_t size_limit, size_t *size);
+int load_image(const char *path, const char *what, void *dst, size_t size);
+void load_image_start(struct image_load *ld, const char *path,
+	const char *what, void *dst, size_t size);
+int load_image_wait(struct image_load *ld);
 uint32_t acrn_create_e820_table(struct vmctx *ctx, struct e820_entry *e820);
 int add_e820_entry(struct e820_entry *e820, int len, uint64_t start,
 	uint64_t size, uint32_t type);
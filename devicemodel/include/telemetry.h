@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdbool.h>
+
+struct vmctx;
+
+/* POSIX shared memory object of the telemetry page, %s is the VM name */
+#define TELEMETRY_SHM_NAME	"/acrn-telemetry.%s"
+
+extern bool telemetry_enabled;
+
+/*
+ * With --telemetry, the hypervisor keeps the exit and passthrough interrupt
+ * counters of the VM (struct acrn_vm_telemetry) up to date in a shared
+ * memory object, which monitoring agents map read-only and sample without
+ * any hypercall or VM exit. The object outlives the resets of the VM, its
+ * counters start again from 0.
+ */
+int	telemetry_init(struct vmctx *ctx);
+void	telemetry_deinit(struct vmctx *ctx);
+
+#endif /* _TELEMETRY_H_ */
@@ -6,16 +6,25 @@
 #ifndef _TIMER_H_
 #define _TIMER_H_
 
+struct acrn_timer_base;
+
 struct acrn_timer {
-	int32_t fd;
 	int32_t clockid;
-	struct mevent *mevp;
+	struct acrn_timer_base *base;	/* the timers of its event loop */
+	int heap_idx;			/* in base, -1 if not armed */
+	uint64_t deadline;		/* CLOCK_MONOTONIC ns, 0 if not armed */
+	uint64_t interval;		/* ns, 0 for a one-shot timer */
 	void (*callback)(void *);
 	void *callback_param;
 };
 
+/* A timer run by the main event loop */
 int32_t
 acrn_timer_init(struct acrn_timer *timer, void (*cb)(void *), void *param);
+/* A timer run by an event loop from mevent_loop_get() */
+int32_t
+acrn_timer_init_loop(struct acrn_timer *timer, int loop, void (*cb)(void *),
+		     void *param);
 void
 acrn_timer_deinit(struct acrn_timer *timer);
 int32_t
@@ -69,6 +69,7 @@ struct usb_dev_req {
 	 * data to record it.
 	 */
 	uint8_t	*buffer;
+	int     buf_owned;	/* buffer is ours, not the guest's block */
 	int     buf_length;
 	int     blk_start;
 	int     blk_count;
@@ -88,6 +89,8 @@ struct usb_dev_sys_ctx_info {
 	libusb_context *libusb_ctx;
 	pthread_t thread;
 	int thread_exit;
+	int epfd;		/* the libusb pollfds, for the thread */
+	int exit_fd;		/* eventfd waking the thread to exit */
 
 	/* handles of callback */
 	libusb_hotplug_callback_handle conn_handle;
@@ -102,6 +105,12 @@ struct usb_dev_sys_ctx_info {
 	usb_dev_sys_cb notify_cb;
 	usb_dev_sys_cb intr_cb;
 
+	/*
+	 * The interrupt the completions of a pass of the libusb events
+	 * asked for, raised once at its end, see usb_dev_sys_thread.
+	 */
+	void *intr_pending;
+
 	/*
 	 * private data from HCD layer
 	 */
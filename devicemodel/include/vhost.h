@@ -15,6 +15,14 @@
 #define __VHOST_H__
 
 #include "virtio.h"
+#include "mevent.h"
+#include "timer.h"
+
+/*
+ * vhost-user backend feature bit: the protocol features, which come in
+ * messages of their own, are negotiated.
+ */
+#define VHOST_USER_F_PROTOCOL_FEATURES	(1UL << 30)
 
 /**
  * @brief vhost APIs
@@ -26,8 +34,12 @@
 struct vhost_vq {
 	int kick_fd;		/**< fd of kick eventfd */
 	int call_fd;		/**< fd of call eventfd */
+	int hv_ioeventfd;	/**< in-hypervisor kick, or -1 */
 	int idx;		/**< index of this vq in vhost dev */
 	struct vhost_dev *dev;	/**< pointer to vhost_dev */
+	uint32_t busyloop_timeout; /**< in us, 0 for the one of the dev */
+	struct mevent *call_mevp;  /**< call_fd, with intr_coalesce */
+	struct acrn_timer call_timer; /**< end of the coalescing window */
 };
 
 struct vhost_dev {
@@ -47,10 +59,20 @@ struct vhost_dev {
 	int nvqs;
 
 	/**
-	 * vhost chardev fd
+	 * vhost chardev fd, or the socket of a vhost-user backend
 	 */
 	int fd;
 
+	/**
+	 * fd is a vhost-user socket, set before calling vhost_dev_init
+	 */
+	bool user;
+
+	/**
+	 * vhost-user protocol features agreed on with the backend
+	 */
+	uint64_t protocol_features;
+
 	/**
 	 * first vq's index in virtio_vq_info
 	 */
@@ -72,6 +94,17 @@ struct vhost_dev {
 	 */
 	uint32_t busyloop_timeout;
 
+	/**
+	 * pcpu the vhost worker is pinned to on start, -1 for none
+	 */
+	int worker_cpu;
+
+	/**
+	 * when not 0, the interrupts of a vq are raised by the DM, at most
+	 * once per intr_coalesce us, instead of by an irqfd
+	 */
+	uint32_t intr_coalesce;
+
 	/**
 	 * whether vhost is started
 	 */
@@ -144,6 +177,35 @@ int vhost_dev_stop(struct vhost_dev *vdev);
  */
 int vhost_net_set_backend(struct vhost_dev *vdev, int backend_fd);
 
+/**
+ * @brief connect to a vhost-user backend.
+ * The fd is then passed to vhost_dev_init, with vdev->user set.
+ * @param path Path of the unix socket the backend listens on.
+ * @return fd of the connection on success and -1 on failure.
+ */
+int vhost_user_connect(const char *path);
+
+/**
+ * @brief send a vhost request to a vhost-user backend.
+ * The vhost ioctl is translated to its vhost-user message(s).
+ * @param vdev Pointer to struct vhost_dev, connected to the backend.
+ * @param request The vhost ioctl request, e.g. VHOST_SET_VRING_NUM.
+ * @param arg The argument of the ioctl.
+ * @return 0 on success and -1 on failure.
+ */
+int vhost_user_ioctl(struct vhost_dev *vdev, unsigned long int request,
+		     void *arg);
+
+/**
+ * @brief read the device config space from a vhost-user backend.
+ * @param vdev Pointer to struct vhost_dev, after vhost_dev_init.
+ * @param config Buffer for the config space.
+ * @param size Bytes of the config space to read.
+ * @return 0 on success and -1 on failure.
+ */
+int vhost_user_get_config(struct vhost_dev *vdev, void *config,
+			  uint32_t size);
+
 /**
  * @}
  */
@@ -124,6 +124,19 @@
  * notify, when descriptors are added to the corresponding ring.
  * (These are provided only for interrupt optimization and need
  * not be implemented.)
+ *
+ * With ACRN_VIRTIO_F_RING_PACKED, the three areas the guest gives
+ * for a queue are instead a single ring of <N> 16-byte descriptors,
+ * <N> not necessarily a power of two, and two 4-byte event
+ * suppression structures, the driver's and the device's.  The
+ * guest makes a descriptor available by setting its AVAIL flag to
+ * its wrap counter and its USED flag to the opposite, the chains
+ * lying in consecutive descriptors linked by NEXT; the device writes
+ * the used descriptor of a chain, with the buffer <id> the guest put
+ * in the last descriptor of the chain, at the next used position,
+ * setting both flags to its own wrap counter, then skips as many
+ * descriptors as the chain had.  Both wrap counters start at 1 and
+ * flip each time their position goes past the end of the ring.
  */
 
 #include "types.h"
@@ -154,6 +167,25 @@ struct virtio_used {		/* AKA vring_used_elem */
 	uint32_t	tlen;	/* length written-to */
 } __attribute__((packed));
 
+#define ACRN_VRING_DESC_F_AVAIL		(1 << 7)
+#define ACRN_VRING_DESC_F_USED		(1 << 15)
+
+struct virtio_packed_desc {	/* AKA vring_packed_desc */
+	uint64_t	addr;	/* guest physical address */
+	uint32_t	len;	/* length of buffer, or written-to */
+	uint16_t	id;	/* buffer id, in the last desc of a chain */
+	uint16_t	flags;	/* VRING_F_DESC_* */
+} __attribute__((packed));
+
+#define ACRN_VRING_EVENT_F_ENABLE	0
+#define ACRN_VRING_EVENT_F_DISABLE	1
+#define ACRN_VRING_EVENT_F_DESC		2	/* at off_wrap, EVENT_IDX */
+
+struct virtio_packed_event {	/* AKA vring_packed_desc_event */
+	uint16_t	off_wrap;	/* ring offset, wrap counter in bit 15 */
+	uint16_t	flags;		/* VRING_EVENT_F_* */
+} __attribute__((packed));
+
 #define ACRN_VRING_AVAIL_F_NO_INTERRUPT	1
 
 struct virtio_vring_avail {
@@ -246,6 +278,7 @@ enum {
 #define	VIRTIO_VENDOR		0x1AF4
 #define	VIRTIO_DEV_NET		0x1000
 #define	VIRTIO_DEV_BLOCK	0x1001
+#define	VIRTIO_DEV_BALLOON	0x1002
 #define	VIRTIO_DEV_CONSOLE	0x1003
 #define	VIRTIO_DEV_RANDOM	0x1005
 
@@ -325,6 +358,7 @@ enum {
 
 /* v1.0 compliant. */
 #define ACRN_VIRTIO_F_VERSION_1		(1UL << 32)
+#define ACRN_VIRTIO_F_RING_PACKED	(1UL << 34)
 
 /* From section 2.3, "Virtqueue Configuration", of the virtio specification */
 /**
@@ -532,6 +566,8 @@ struct virtio_base {
 	int backend_type;               /**< VBSU, VBSK or VHOST */
 	struct acrn_timer polling_timer; /**< timer for polling mode */
 	int polling_in_progress;        /**< The polling status */
+	uint64_t poll_armed;		/**< when polling_timer goes off */
+	LIST_ENTRY(virtio_base) list;	/**< in the linked up devices */
 };
 
 #define	VIRTIO_BASE_LOCK(vb)					\
@@ -567,8 +603,27 @@ struct virtio_ops {
 				/**< called to set device status */
 };
 
+/**
+ * @brief Counters of a virtqueue, see virtio_get_vq_stats_by_index().
+ *
+ * Each one is updated by the thread doing the work it counts, without
+ * a lock of its own.
+ */
+struct virtio_vq_stats {
+	uint64_t notifies;	/**< kicks of the guest */
+	uint64_t polls;		/**< polls finding chains, in polling mode */
+	uint64_t chains;	/**< taken by vq_getchain() */
+	uint64_t descs;		/**< descriptors of those chains */
+	uint64_t used;		/**< chains returned by vq_relchain*() */
+	uint64_t endchains;	/**< calls of vq_endchains() */
+	uint64_t interrupts;	/**< raised by vq_interrupt() */
+	uint64_t suppressed;	/**< endchains() without interrupt, after
+				  *  chains were returned */
+};
+
 #define	VQ_ALLOC	0x01	/* set once we have a pfn */
 #define	VQ_BROKED	0x02	/* ??? */
+#define	VQ_PACKED	0x04	/* packed ring, see above */
 /**
  * @brief Virtqueue data structure
  *
@@ -599,7 +654,8 @@ struct virtio_vq_info {
 
 	uint16_t flags;		/**< flags (see above) */
 	uint16_t last_avail;	/**< a recent value of avail->idx */
-	uint16_t save_used;	/**< saved used->idx; see vq_endchains */
+	uint16_t save_used;	/**< saved used->idx, or used_idx and
+				  *  used_wrap in bit 15; see vq_endchains */
 	uint16_t msix_idx;	/**< MSI-X index, or VIRTIO_MSI_NO_VECTOR */
 
 	uint32_t pfn;		/**< PFN of virt queue (not shifted!) */
@@ -611,10 +667,28 @@ struct virtio_vq_info {
 	volatile struct virtio_vring_used *used;
 				/**< the "used" ring */
 
+	volatile struct virtio_packed_desc *pdesc;
+				/**< packed ring, with VQ_PACKED */
+	volatile struct virtio_packed_event *driver_event;
+				/**< interrupt suppression of the guest */
+	volatile struct virtio_packed_event *device_event;
+				/**< notify suppression of the device */
+	bool avail_wrap;	/**< wrap counter of last_avail */
+	bool used_wrap;		/**< wrap counter of used_idx */
+	uint16_t used_idx;	/**< where the next used desc goes */
+	uint16_t *chain_len;	/**< descriptors of each buffer id */
+
 	uint32_t gpa_desc[2];	/**< gpa of descriptors */
 	uint32_t gpa_avail[2];	/**< gpa of avail_ring */
 	uint32_t gpa_used[2];	/**< gpa of used_ring */
 	bool enabled;		/**< whether the virtqueue is enabled */
+	int hv_ioeventfd;	/**< in-hypervisor kick, or -1 */
+
+	uint32_t poll_period;	/**< ns between polls, 0 when notified */
+	uint32_t poll_mark;	/**< the queue at the last poll */
+	uint64_t poll_due;	/**< when the queue is polled next */
+
+	struct virtio_vq_stats stats;	/**< counters of the queue */
 };
 
 /* as noted above, these are sort of backwards, name-wise */
@@ -648,6 +722,14 @@ vq_ring_ready(struct virtio_vq_info *vq)
 static inline int
 vq_has_descs(struct virtio_vq_info *vq)
 {
+	uint16_t flags;
+
+	if (vq_ring_ready(vq) && (vq->flags & VQ_PACKED)) {
+		flags = vq->pdesc[vq->last_avail].flags;
+		return (!!(flags & ACRN_VRING_DESC_F_AVAIL) == vq->avail_wrap &&
+		    !!(flags & ACRN_VRING_DESC_F_USED) != vq->avail_wrap);
+	}
+
 	return (vq_ring_ready(vq) && vq->last_avail !=
 	    vq->avail->idx);
 }
@@ -665,6 +747,7 @@ vq_has_descs(struct virtio_vq_info *vq)
 static inline void
 vq_interrupt(struct virtio_base *vb, struct virtio_vq_info *vq)
 {
+	vq->stats.interrupts++;
 	if (pci_msix_enabled(vb->dev))
 		pci_generate_msix(vb->dev, vq->msix_idx);
 	else {
@@ -724,6 +807,67 @@ void virtio_linkup(struct virtio_base *base, struct virtio_ops *vops,
 		   struct virtio_vq_info *queues,
 		   int backend_type);
 
+/**
+ * @brief Forget a virtio device, before it is freed.
+ *
+ * Takes the device off the list virtio_linkup() put it on, if it is a
+ * virtio one.
+ *
+ * @param dev Pointer to struct pci_vdev which emulates a PCI device.
+ *
+ * @return None
+ */
+void virtio_unlink(struct pci_vdev *dev);
+
+/**
+ * @brief Get the counters of the index'th virtqueue.
+ *
+ * The virtqueues are numbered from 0 across the linked up devices, in
+ * the order of the devices and then of their queues.
+ *
+ * @param index Which virtqueue.
+ * @param ident Buffer for "slot:func name.queue" of the virtqueue.
+ * @param len Size of ident.
+ * @param qsize Where to return the size of the virtqueue.
+ * @param stats Where to copy the counters.
+ *
+ * @return 0 on success, -1 past the last virtqueue.
+ */
+int virtio_get_vq_stats_by_index(int index, char *ident, size_t len,
+				 uint16_t *qsize,
+				 struct virtio_vq_stats *stats);
+
+/**
+ * @brief Have the devices returned all the chains they took?
+ *
+ * Once the VM is paused, tells when the requests in the backends are done
+ * and nothing is written to the guest memory any more.
+ *
+ * @return true when no virtqueue has a chain in use.
+ */
+bool virtio_vqs_idle(void);
+
+/**
+ * @brief Log the ring parts the devices write, for a migration.
+ *
+ * The buffers the devices write are logged as their chains are taken, see
+ * migration_log_write(); the used rings are written as chains are
+ * returned, they are logged at once when the VM is paused.
+ *
+ * @return None
+ */
+void virtio_log_rings(void);
+
+/**
+ * @brief Call fn on the ring parts the devices write.
+ *
+ * The used rings, or the packed rings and their device event areas, of
+ * the virtqueues set up, by guest physical address.
+ *
+ * @return None
+ */
+void virtio_foreach_ring(void (*fn)(vm_paddr_t gpa, size_t len));
+
 /**
  * @brief Get the virtio poll parameters
  *
@@ -778,6 +922,20 @@ int virtio_intr_init(struct virtio_base *base, int barnum, int use_msix);
  */
 void virtio_reset_dev(struct virtio_base *base);
 
+/**
+ * @brief Let the hypervisor complete the queue notifications of a vq.
+ *
+ * The guest kick of the queue is then completed by the hypervisor without
+ * an ioreq round trip, and the vq notify callback runs from vm_loop.
+ * Nothing is done if the hypervisor does not support it.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param enable Whether to register or unregister the kick.
+ *
+ * @return None
+ */
+void virtio_vq_set_hv_kick(struct virtio_vq_info *vq, bool enable);
+
 /**
  * @brief Set I/O BAR (usually 0) to map PCI config registers.
  *
@@ -826,6 +984,22 @@ void vq_retchain(struct virtio_vq_info *vq);
  */
 void vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen);
 
+/**
+ * @brief Return several request chains to the guest at once.
+ *
+ * The same as calling vq_relchain() on each of them, but the used index
+ * is updated once, and the guest sees all the chains together.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param used The chains, idx as returned by vq_getchain() and tlen the
+ *             number of data bytes to be returned to frontend.
+ * @param n Number of chains in used.
+ *
+ * @return None
+ */
+void vq_relchain_batch(struct virtio_vq_info *vq,
+		       const struct virtio_used *used, int n);
+
 /**
  * @brief Driver has finished processing "available" chains and calling
  * vq_relchain on each one.
@@ -853,6 +1027,21 @@ void vq_endchains(struct virtio_vq_info *vq, int used_all_avail);
  */
 void vq_clear_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq);
 
+/**
+ * @brief Helper function for setting used ring flags.
+ *
+ * Masks the notifications of the guest for the queue, through the used
+ * ring flags of a split ring or the device event suppression of a packed
+ * one. Driver should always use this helper function rather than write
+ * the used ring flags.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return None
+ */
+void vq_set_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq);
+
 /**
  * @brief Handle PCI configuration space reads.
  *
@@ -890,6 +1079,50 @@ uint64_t virtio_pci_read(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 void virtio_pci_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		      int baridx, uint64_t offset, int size, uint64_t value);
 
+/**
+ * @brief Reset a virtio device on a warm reset of the VM.
+ *
+ * Does what a guest write of 0 to the device status does, the backend of
+ * the device is kept. Fit for the vdev_reset of the devices whose virtio
+ * reset callback brings them back to their state after init.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param dev Pointer to struct pci_vdev which emulates a PCI device.
+ *
+ * @return None
+ */
+void virtio_pci_reset(struct vmctx *ctx, struct pci_vdev *dev);
+
+/**
+ * @brief Save the transport state of a virtio device for a snapshot.
+ *
+ * The negotiated features, the device status and the virtqueues set up
+ * by the guest. Fit for the vdev_save of the devices keeping no other
+ * state the guest depends on.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param dev Pointer to struct pci_vdev which emulates a PCI device.
+ * @param buf Buffer to save the state into.
+ * @param len Size of buf.
+ *
+ * @return length of the state, -1 if buf is too small.
+ */
+int virtio_pci_save(struct vmctx *ctx, struct pci_vdev *dev, void *buf,
+		    size_t len);
+
+/**
+ * @brief Load the state saved by virtio_pci_save into a new device.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param dev Pointer to struct pci_vdev which emulates a PCI device.
+ * @param buf The saved state.
+ * @param len Length of the saved state.
+ *
+ * @return 0 on success, -1 if the state is not of this device.
+ */
+int virtio_pci_load(struct vmctx *ctx, struct pci_vdev *dev, const void *buf,
+		    size_t len);
+
 /**
  * @brief Indicate the device has experienced an error.
  *
@@ -237,6 +237,7 @@ enum vm_exitcode {
 	VM_EXITCODE_INOUT = 0,
 	VM_EXITCODE_MMIO_EMUL,
 	VM_EXITCODE_PCI_CFG,
+	VM_EXITCODE_WP,
 	VM_EXITCODE_MAX
 };
 
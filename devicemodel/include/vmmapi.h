@@ -30,6 +30,7 @@
 #define	_VMMAPI_H_
 
 #include <sys/param.h>
+#include <sys/uio.h>
 #include <uuid/uuid.h>
 #include "types.h"
 #include "vmm.h"
@@ -47,15 +48,43 @@
 
 #define CMOS_BUF_SIZE		256
 
+/*
+ * A range of guest RAM, mapped in the DM. vm_map_gpa() looks it up for
+ * each buffer the devices access, so the bounds are computed once when
+ * the memory is set up.
+ */
+#define VM_MEM_SEGS_MAX	2
+
+struct vm_mem_seg {
+	vm_paddr_t	gpa;
+	size_t		len;
+	char		*hva;
+};
+
+/* A hugetlbfs mapping of guest memory, see hugetlb_get_regions() */
+struct hugetlb_region {
+	vm_paddr_t	gpa;
+	size_t		len;
+	char		*hva;
+	int		fd;	/* hugetlbfs file of the mapping */
+	off_t		offset;	/* of the mapping in the file */
+	size_t		pgsz;	/* of the hugepages of the file */
+};
+
 struct vmctx {
 	int     fd;
 	int     vmid;
 	int     ioreq_client;
+	bool    posted_ioreq;	/* posted MMIO write ring is set up */
+	bool    hv_ioeventfd;	/* in-hypervisor ioeventfd page is set up */
+	struct vhm_clock_page *clock_page;	/* RTC/PIT state shared with hv */
 	uint32_t lowmem_limit;
 	size_t  lowmem;
 	size_t  biosmem;
 	size_t  highmem;
 	char    *baseaddr;
+	int	nr_mem_segs;
+	struct vm_mem_seg mem_segs[VM_MEM_SEGS_MAX];	/* lowmem, highmem */
 	char    *name;
 	uuid_t  vm_uuid;
 
@@ -73,6 +102,31 @@ struct vmctx {
 #define	PROT_RW		(PROT_READ | PROT_WRITE)
 #define	PROT_ALL	(PROT_READ | PROT_WRITE | PROT_EXEC)
 
+/*
+ * Returns a non-NULL pointer if [gaddr, gaddr+len) is entirely contained in
+ * the lowmem or highmem regions.
+ *
+ * In particular return NULL if [gaddr, gaddr+len) falls in guest MMIO region.
+ * The instruction emulation code depends on this behavior.
+ */
+static inline void *
+vm_map_gpa(struct vmctx *ctx, vm_paddr_t gaddr, size_t len)
+{
+	const struct vm_mem_seg *seg;
+	vm_paddr_t off;
+	int i;
+
+	for (i = 0; i < ctx->nr_mem_segs; i++) {
+		seg = &ctx->mem_segs[i];
+		/* wraps around below seg->gpa */
+		off = gaddr - seg->gpa;
+		if (off < seg->len && len <= seg->len - off)
+			return seg->hva + off;
+	}
+
+	return NULL;
+}
+
 struct vm_lapic_msi {
 	uint64_t	msg;
 	uint64_t	addr;
@@ -93,23 +147,65 @@ void	*vm_create_devmem(struct vmctx *ctx, int segid, const char *name,
 int	vm_get_device_fd(struct vmctx *ctx);
 struct	vmctx *vm_create(const char *name, uint64_t req_buf);
 void	vm_pause(struct vmctx *ctx);
+/* Run again a VM vm_pause() stopped, once its ioreqs are all completed */
+int	vm_unpause(struct vmctx *ctx);
 void	vm_reset(struct vmctx *ctx);
 int	vm_create_ioreq_client(struct vmctx *ctx);
 int	vm_destroy_ioreq_client(struct vmctx *ctx);
 int	vm_attach_ioreq_client(struct vmctx *ctx);
 int	vm_notify_request_done(struct vmctx *ctx, int vcpu);
+int	vm_notify_requests_done(struct vmctx *ctx, uint64_t vcpu_mask);
+int	vm_set_posted_ioreq_buffer(struct vmctx *ctx, uint64_t buf);
+int	vm_set_posted_mmio_range(struct vmctx *ctx, uint64_t start,
+				 uint64_t end, bool assign);
+int	vm_set_posted_pio_range(struct vmctx *ctx, uint64_t start,
+				uint64_t end, bool assign);
+int	vm_set_clock_page(struct vmctx *ctx, uint64_t page);
+int	vm_set_telemetry_page(struct vmctx *ctx, uint64_t page);
+int	vm_set_upcall_policy(struct vmctx *ctx, uint32_t policy,
+			     uint64_t vcpu_mask);
+int	vm_set_ioeventfd_page(struct vmctx *ctx, uint64_t page);
+int	vm_assign_hv_ioeventfd(struct vmctx *ctx,
+			       struct acrn_hv_ioeventfd *args);
 void	vm_set_suspend_mode(enum vm_suspend_how how);
 int	vm_get_suspend_mode(void);
 void	vm_destroy(struct vmctx *ctx);
 int	vm_parse_memsize(const char *optarg, size_t *memsize);
 int	vm_map_memseg_vma(struct vmctx *ctx, size_t len, vm_paddr_t gpa,
 	uint64_t vma, int prot);
+int	vm_unmap_memseg_vma(struct vmctx *ctx, size_t len, vm_paddr_t gpa,
+	uint64_t vma);
+/*
+ * ACRN_DIRTY_LOG_START, _STOP or _GET on [gpa, gpa + len) of the guest;
+ * for GET, bitmap is a page aligned page, len at most
+ * ACRN_DIRTY_LOG_PAGES_MAX pages, and nr_dirty, if not NULL, gets the
+ * number of bits set.
+ */
+int	vm_dirty_log(struct vmctx *ctx, uint32_t op, vm_paddr_t gpa, size_t len,
+	uint64_t *bitmap, uint64_t *nr_dirty);
+/*
+ * Write protect [gpa, gpa + len) of the guest, mapped, and have the writes
+ * of its vcpus come as VM_EXITCODE_WP, to be run again once completed; or
+ * make it writable again. See struct acrn_cow_range.
+ */
+int	vm_set_cow(struct vmctx *ctx, vm_paddr_t gpa, size_t len, bool set);
 int	vm_setup_memory(struct vmctx *ctx, size_t len);
 void	vm_unsetup_memory(struct vmctx *ctx);
 bool	check_hugetlb_support(void);
 int	hugetlb_setup_memory(struct vmctx *ctx);
 void	hugetlb_unsetup_memory(struct vmctx *ctx);
-void	*vm_map_gpa(struct vmctx *ctx, vm_paddr_t gaddr, size_t len);
+void	*hugetlb_map_shared(const char *name, size_t len);
+int	hugetlb_get_regions(struct hugetlb_region *regions, int max);
+int	hugetlb_set_prefault(int threads, int node);
+size_t	hugetlb_page_size(vm_paddr_t gpa);
+int	hugetlb_release_range(vm_paddr_t gpa, size_t len);
+int	hugetlb_populate_range(vm_paddr_t gpa, size_t len);
+int	hugetlb_share_range(vm_paddr_t gpa, size_t len, const char *name);
+int	hugetlb_unshare_range(vm_paddr_t gpa, size_t len, int fd,
+	const char *name);
+void	hugetlb_drop_shared(int fd, const char *name);
+int	vm_map_gpa_iov(struct vmctx *ctx, vm_paddr_t gaddr, size_t len,
+		       struct iovec *iov, int *iovcnt, int niov);
 uint32_t vm_get_lowmem_limit(struct vmctx *ctx);
 void	vm_set_lowmem_limit(struct vmctx *ctx, uint32_t limit);
 size_t	vm_get_lowmem_size(struct vmctx *ctx);
@@ -118,8 +214,12 @@ int	vm_run(struct vmctx *ctx);
 int	vm_suspend(struct vmctx *ctx, enum vm_suspend_how how);
 int	vm_apicid2vcpu(struct vmctx *ctx, int apicid);
 int	vm_lapic_msi(struct vmctx *ctx, uint64_t addr, uint64_t msg);
+int	vm_lapic_msi_batch(struct vmctx *ctx, const struct vm_lapic_msi *msi,
+			   int count);
 int	vm_set_gsi_irq(struct vmctx *ctx, int gsi, uint32_t operation);
 int	vm_assign_ptdev(struct vmctx *ctx, int bus, int slot, int func);
+int	vm_assign_ptdev_batch(struct vmctx *ctx, const uint16_t *bdfs,
+			      int count);
 int	vm_unassign_ptdev(struct vmctx *ctx, int bus, int slot, int func);
 int	vm_map_ptdev_mmio(struct vmctx *ctx, int bus, int slot, int func,
 			  vm_paddr_t gpa, size_t len, vm_paddr_t hpa);
@@ -136,6 +236,12 @@ int	vm_reset_ptdev_intx_info(struct vmctx *ctx, int virt_pin, bool pic_pin);
 
 int	vm_create_vcpu(struct vmctx *ctx, uint16_t vcpu_id);
 int	vm_set_vcpu_regs(struct vmctx *ctx, struct acrn_set_vcpu_regs *cpu_regs);
+int	vm_get_vcpu_regs(struct vmctx *ctx, uint16_t vcpu_id,
+			 struct acrn_set_vcpu_regs *cpu_regs);
+int	vm_get_vmexit_stats(struct vmctx *ctx, uint16_t vcpu_id,
+			    struct acrn_vmexit_stats *stats);
+int	vm_get_exit_timeline(struct vmctx *ctx, uint16_t vcpu_id,
+			     struct acrn_exit_timeline *timeline);
 
 int	vm_get_cpu_state(struct vmctx *ctx, void *state_buf);
 int	vm_intr_monitor(struct vmctx *ctx, void *intr_buf);
@@ -0,0 +1,26 @@
+#!/bin/bash
+#
+# Run in the SOS while a load runs in the UOS: dump the per-disk and the
+# per-virtqueue counters of the device model every interval, with the
+# time they were taken, for the differences between two samples.
+#
+# usage: collect_stats.sh <vm name> [interval] [samples] [log]
+
+vm_name=$1
+interval=${2:-5}
+samples=${3:-12}
+log=${4:-/tmp/${vm_name}_stats.log}
+
+if [ -z "$vm_name" ]; then
+  echo "usage: $0 <vm name> [interval] [samples] [log]"
+  exit 1
+fi
+
+: > $log
+for i in $(seq 1 $samples); do
+  echo "--- $(date +%s.%N)" >> $log
+  acrnctl blkstat $vm_name >> $log || exit 1
+  acrnctl vqstat $vm_name >> $log || exit 1
+  sleep $interval
+done
+echo "$samples samples of $vm_name in $log"
@@ -0,0 +1,39 @@
+#!/bin/bash
+#
+# Launch a UOS with a null virtio-blk disk and a null virtio-net NIC,
+# which complete every request in the device model: run null_load.sh in
+# the UOS and collect_stats.sh in the SOS to measure the virtio path.
+#
+# usage: launch_null_uos.sh <vm index> <uos image> [disk queues] [nic pairs]
+
+vm_name=vm$1
+image=$2
+blk_queues=${3:-1}
+net_pairs=${4:-1}
+
+if [ -z "$image" ]; then
+  echo "usage: $0 <vm index> <uos image> [disk queues] [nic pairs]"
+  exit 1
+fi
+
+if pgrep -a -f acrn-dm | grep -q "${vm_name}\$"; then
+  echo "$vm_name is running, can't create twice!"
+  exit 1
+fi
+
+mac=$(cat /sys/class/net/e*/address | head -1)
+mac_seed=${mac:9:8}-${vm_name}
+
+# one vCPU per queue, so each has its own to submit from
+ncpus=$(( blk_queues > net_pairs ? blk_queues : net_pairs ))
+
+acrn-dm -A -m 2048M -c $ncpus -s 0:0,hostbridge -s 1:0,lpc -l com1,stdio \
+  -s 3,virtio-blk,$image \
+  -s 4,virtio-net,tap0 \
+  -s 5,virtio-blk,null:16G,writeback,num_queues=$blk_queues \
+  -s 6,virtio-net,null,queue_pairs=$net_pairs \
+  --mac_seed $mac_seed \
+  -k /usr/lib/kernel/default-iot-lts2018 \
+  -B "root=/dev/vda3 rw rootwait maxcpus=$ncpus nohpet console=hvc0 \
+  console=ttyS0 no_timer_check ignore_loglevel log_buf_len=16M \
+  consoleblank=0 tsc=reliable" $vm_name
@@ -0,0 +1,66 @@
+#!/bin/bash
+#
+# Run in the UOS started by launch_null_uos.sh: fio on the null disk, then
+# a transmit load with pktgen on the null NIC. Each run prints its rate;
+# the SOS side counters are those of collect_stats.sh.
+#
+# usage: null_load.sh [disk] [nic] [seconds]
+
+disk=${1:-/dev/vdb}
+nic=${2:-enp0s6}
+runtime=${3:-30}
+jobs=$(nproc)
+
+run_fio()
+{
+  echo "=== fio $1 bs=$2 iodepth=$3 jobs=$jobs"
+  fio --name=null --filename=$disk --direct=1 --ioengine=libaio \
+    --rw=$1 --bs=$2 --iodepth=$3 --numjobs=$jobs --group_reporting \
+    --time_based --runtime=$runtime --output-format=terse --terse-version=3 |
+  awk -F';' '{ printf "read %s IOPS %s KB/s, write %s IOPS %s KB/s\n",
+    $8, $7, $49, $48 }'
+}
+
+pg()
+{
+  echo "$2" > /proc/net/pktgen/$1
+}
+
+run_pktgen()
+{
+  local size=$1 cpu dev txqs
+
+  txqs=$(ls -d /sys/class/net/$nic/queues/tx-* | wc -l)
+
+  echo "=== pktgen size=$size threads=$jobs"
+  modprobe pktgen || return
+  ip link set $nic up
+  for cpu in $(seq 0 $((jobs - 1))); do
+    pg kpktgend_$cpu "rem_device_all"
+    dev=$nic@$cpu
+    pg kpktgend_$cpu "add_device $dev"
+    pg $dev "count 0"
+    pg $dev "pkt_size $size"
+    pg $dev "queue_map_min $((cpu % txqs))"
+    pg $dev "queue_map_max $((cpu % txqs))"
+    pg $dev "dst 10.0.0.2"
+    pg $dev "dst_mac 02:00:00:00:00:02"
+  done
+  pg pgctrl "start" &
+  sleep $runtime
+  pg pgctrl "stop"
+  wait
+  for cpu in $(seq 0 $((jobs - 1))); do
+    grep -h "pps" /proc/net/pktgen/$nic@$cpu
+  done
+}
+
+for bs in 4k 64k; do
+  run_fio randread $bs 32
+  run_fio randwrite $bs 32
+done
+run_fio randread 4k 1
+
+for size in 64 1500; do
+  run_pktgen $size
+done
@@ -6,39 +6,6 @@
 
 #include <hypervisor.h>
 
-/*
- * lookup a ptdev entry by sid
- * Before adding a ptdev remapping, should lookup by physical sid to check
- * whether the resource has been token by others.
- * When updating a ptdev remapping, should lookup by virtual sid to check
- * whether this resource is valid.
- * @pre: vm must be NULL when lookup by physical sid, otherwise,
- * vm must not be NULL when lookup by virtual sid.
- */
-static inline struct ptirq_remapping_info *
-ptirq_lookup_entry_by_sid(uint32_t intr_type,
-		const union source_id *sid,const struct acrn_vm *vm)
-{
-	uint16_t idx;
-	struct ptirq_remapping_info *entry;
-
-	for (idx = 0U; idx < CONFIG_MAX_PT_IRQ_ENTRIES; idx++) {
-		entry = &ptirq_entries[idx];
-		if (!is_entry_active(entry)) {
-			continue;
-		}
-		if ((intr_type == entry->intr_type) &&
-			((vm == NULL) ?
-			(sid->value == entry->phys_sid.value) :
-			((vm == entry->vm) &&
-			(sid->value == entry->virt_sid.value)))) {
-			return entry;
-		}
-	}
-
-	return NULL;
-}
-
 static inline struct ptirq_remapping_info *
 ptirq_lookup_entry_by_vpin(struct acrn_vm *vm, uint8_t virt_pin, bool pic_pin)
 {
@@ -83,9 +50,52 @@ static uint64_t calculate_logical_dest_mask(uint64_t pdmask)
 	return dest_mask;
 }
 
-static void ptirq_build_physical_msi(struct acrn_vm *vm, struct ptirq_msi_info *info,
+/*
+ * Have the IOMMU post the MSI into the PIR of its target vCPU, which takes
+ * it without a VM exit if running. Only done for an edge triggered MSI with
+ * a single target, a lowest priority one goes to the first vCPU of its
+ * destination, and not coalesced. Return false to fall back to the host
+ * vector.
+ */
+static bool ptirq_build_posted_msi(struct acrn_vm *vm, struct ptirq_remapping_info *entry,
+		uint64_t vdmask)
+{
+	struct ptirq_msi_info *info = &entry->msi;
+	uint16_t phys_bdf = entry->phys_sid.msi_id.bdf;
+	uint32_t delmode = info->vmsi_data & APIC_DELMODE_MASK;
+	struct acrn_vcpu *vcpu;
+	uint16_t vcpu_id;
+	bool ret = false;
+
+	if (is_apicv_posted_intr_supported() && (vm->intr_inject_delay_delta == 0UL) &&
+		(entry->coalesce_cycles == 0UL) &&
+		((info->vmsi_data & APIC_TRIGMOD_MASK) == APIC_TRIGMOD_EDGE) &&
+		iommu_posted_intr_supported((uint8_t)(phys_bdf >> 8U), (uint8_t)(phys_bdf & 0xffU))) {
+		vcpu_id = ffs64(vdmask);
+		if ((vcpu_id != INVALID_BIT_INDEX) &&
+			((delmode == APIC_DELMODE_LOWPRIO) ||
+			((delmode == APIC_DELMODE_FIXED) && (vdmask == (1UL << vcpu_id))))) {
+			vcpu = vcpu_from_vid(vm, vcpu_id);
+			if (iommu_set_posted_irte((uint8_t)(phys_bdf >> 8U), (uint8_t)(phys_bdf & 0xffU),
+					&entry->irte_idx, info->vmsi_data & 0xFFU,
+					apicv_get_pir_desc_paddr(vcpu)) == 0) {
+				/* remappable format, SHV clear: data is not used */
+				info->pmsi_data = 0U;
+				info->pmsi_addr = MSI_ADDR_BASE | MSI_ADDR_IF_REMAP |
+					(((uint64_t)entry->irte_idx & 0x7FFFUL) << 5U) |
+					((((uint64_t)entry->irte_idx >> 15U) & 0x1UL) << 2U);
+				ret = true;
+			}
+		}
+	}
+
+	return ret;
+}
+
+static void ptirq_build_physical_msi(struct acrn_vm *vm, struct ptirq_remapping_info *entry,
 		uint32_t vector)
 {
+	struct ptirq_msi_info *info = &entry->msi;
 	uint64_t vdmask, pdmask, dest_mask;
 	uint32_t dest, delmode;
 	bool phys;
@@ -95,24 +105,26 @@ static void ptirq_build_physical_msi(struct acrn_vm *vm, struct ptirq_msi_info *
 	phys = ((info->vmsi_addr & MSI_ADDR_LOG) != MSI_ADDR_LOG);
 
 	calcvdest(vm, &vdmask, dest, phys);
-	pdmask = vcpumask2pcpumask(vm, vdmask);
+	if (!ptirq_build_posted_msi(vm, entry, vdmask)) {
+		pdmask = vcpumask2pcpumask(vm, vdmask);
 
-	/* get physical delivery mode */
-	delmode = info->vmsi_data & APIC_DELMODE_MASK;
-	if ((delmode != APIC_DELMODE_FIXED) && (delmode != APIC_DELMODE_LOWPRIO)) {
-		delmode = APIC_DELMODE_LOWPRIO;
-	}
+		/* get physical delivery mode */
+		delmode = info->vmsi_data & APIC_DELMODE_MASK;
+		if ((delmode != APIC_DELMODE_FIXED) && (delmode != APIC_DELMODE_LOWPRIO)) {
+			delmode = APIC_DELMODE_LOWPRIO;
+		}
 
-	/* update physical delivery mode & vector */
-	info->pmsi_data = info->vmsi_data;
-	info->pmsi_data &= ~0x7FFU;
-	info->pmsi_data |= delmode | vector;
+		/* update physical delivery mode & vector */
+		info->pmsi_data = info->vmsi_data;
+		info->pmsi_data &= ~0x7FFU;
+		info->pmsi_data |= delmode | vector;
 
-	dest_mask = calculate_logical_dest_mask(pdmask);
-	/* update physical dest mode & dest field */
-	info->pmsi_addr = info->vmsi_addr;
-	info->pmsi_addr &= ~0xFF00CU;
-	info->pmsi_addr |= (dest_mask << PAGE_SHIFT) | MSI_ADDR_RH | MSI_ADDR_LOG;
+		dest_mask = calculate_logical_dest_mask(pdmask);
+		/* update physical dest mode & dest field */
+		info->pmsi_addr = info->vmsi_addr;
+		info->pmsi_addr &= ~0xFF00CU;
+		info->pmsi_addr |= (dest_mask << PAGE_SHIFT) | MSI_ADDR_RH | MSI_ADDR_LOG;
+	}
 
 	dev_dbg(ACRN_DBG_IRQ, "MSI addr:data = 0x%llx:%x(V) -> 0x%llx:%x(P)",
 		info->vmsi_addr, info->vmsi_data,
@@ -138,14 +150,14 @@ ptirq_build_physical_rte(struct acrn_vm *vm, struct ptirq_remapping_info *entry)
 		/* init polarity & pin state */
 		if ((rte.full & IOAPIC_RTE_INTPOL) != 0UL) {
 			if (entry->polarity == 0U) {
-				vioapic_set_irq_nolock(vm,
+				vioapic_set_irq(vm,
 					(uint32_t)virt_sid->intx_id.pin,
 					GSI_SET_HIGH);
 			}
 			entry->polarity = 1U;
 		} else {
 			if (entry->polarity == 1U) {
-				vioapic_set_irq_nolock(vm,
+				vioapic_set_irq(vm,
 					(uint32_t)virt_sid->intx_id.pin,
 					GSI_SET_LOW);
 			}
@@ -231,8 +243,7 @@ static struct ptirq_remapping_info *add_msix_remapping(struct acrn_vm *vm,
 		}
 	} else if (entry->vm != vm) {
 		if (is_vm0(entry->vm)) {
-			entry->vm = vm;
-			entry->virt_sid.msi_id.bdf = virt_bdf;
+			ptirq_change_virt_sid(entry, vm, &virt_sid);
 		} else {
 			pr_err("MSIX pbdf%x idx=%d already in vm%d with vbdf%x, not able to add into vm%d with vbdf%x",
 				entry->phys_sid.msi_id.bdf, entry->phys_sid.msi_id.entry_nr, entry->vm->vm_id,
@@ -323,8 +334,7 @@ static struct ptirq_remapping_info *add_intx_remapping(struct acrn_vm *vm, uint8
 		}
 	} else if (entry->vm != vm) {
 		if (is_vm0(entry->vm)) {
-			entry->vm = vm;
-			entry->virt_sid.value = virt_sid.value;
+			ptirq_change_virt_sid(entry, vm, &virt_sid);
 		} else {
 			pr_err("INTX pin%d already in vm%d with vpin%d, not able to add into vm%d with vpin%d",
 				phys_pin, entry->vm->vm_id, entry->virt_sid.intx_id.pin, vm->vm_id, virt_pin);
@@ -452,17 +462,17 @@ static void ptirq_handle_intx(struct acrn_vm *vm,
 
 void ptirq_softirq(uint16_t pcpu_id)
 {
-	struct acrn_vcpu *vcpu = (struct acrn_vcpu *)per_cpu(vcpu, pcpu_id);
-	struct acrn_vm *vm = vcpu->vm;
-
 	while (1) {
-		struct ptirq_remapping_info *entry = ptirq_dequeue_softirq(vm);
+		struct ptirq_remapping_info *entry = ptirq_dequeue_softirq(pcpu_id);
 		struct ptirq_msi_info *msi;
+		struct acrn_vm *vm;
 
 		if (entry == NULL) {
 			break;
 		}
 
+		/* the queue is per pCPU, it holds entries of any VM */
+		vm = entry->vm;
 		msi = &entry->msi;
 
 		/* skip any inactive entry */
@@ -471,6 +481,11 @@ void ptirq_softirq(uint16_t pcpu_id)
 			continue;
 		}
 
+		/* the virtual pin of an INTx entry, the vector of an MSI one */
+		TRACE_4I(TRACE_PTIRQ_SOFTIRQ, entry->allocated_pirq, (uint32_t)vm->vm_id,
+			(entry->intr_type == PTDEV_INTR_INTX) ? (uint32_t)entry->virt_sid.intx_id.pin :
+				(msi->vmsi_data & 0xFFU), entry->intr_type);
+
 		/* handle real request */
 		if (entry->intr_type == PTDEV_INTR_INTX) {
 			ptirq_handle_intx(vm, entry);
@@ -492,12 +507,62 @@ void ptirq_softirq(uint16_t pcpu_id)
 	}
 }
 
+/*
+ * Whether a device behind the line of a level INTx entry still asserts its
+ * interrupt, going by the Interrupt Status bit of its PCI status register.
+ * Unknown sources make it false, which keeps the plain unmask-and-see path.
+ */
+static bool ptirq_intx_src_pending(const struct ptirq_remapping_info *entry)
+{
+	union pci_bdf bdf;
+	uint32_t i, num = entry->intx_src_num, cmd_status;
+	bool pending = false;
+
+	if (num <= PTIRQ_INTX_SRC_MAX) {
+		for (i = 0U; i < num; i++) {
+			bdf.value = entry->intx_src_bdf[i];
+			/* command and status in one access */
+			cmd_status = pci_pdev_read_cfg(bdf, PCIR_COMMAND, 4U);
+			if (((cmd_status & PCIM_CMD_INTxDIS) == 0U) &&
+				(((cmd_status >> 16U) & PCIM_STATUS_INTxSTATE) != 0U)) {
+				pending = true;
+				break;
+			}
+		}
+	}
+
+	return pending;
+}
+
+static void ptirq_intx_add_src(struct ptirq_remapping_info *entry, uint16_t phys_bdf)
+{
+	uint32_t i, num = entry->intx_src_num;
+	bool found = false;
+
+	if (num <= PTIRQ_INTX_SRC_MAX) {
+		for (i = 0U; i < num; i++) {
+			if (entry->intx_src_bdf[i] == phys_bdf) {
+				found = true;
+				break;
+			}
+		}
+
+		if (!found) {
+			if (num < PTIRQ_INTX_SRC_MAX) {
+				entry->intx_src_bdf[num] = phys_bdf;
+			}
+			entry->intx_src_num = num + 1U;
+		}
+	}
+}
+
 void ptirq_intx_ack(struct acrn_vm *vm, uint8_t virt_pin,
 		enum ptirq_vpin_source vpin_src)
 {
 	uint32_t phys_irq;
 	struct ptirq_remapping_info *entry;
 	bool pic_pin = (vpin_src == PTDEV_VPIN_PIC);
+	bool still_asserted = false;
 
 	entry = ptirq_lookup_entry_by_vpin(vm, virt_pin, pic_pin);
 	if (entry != NULL) {
@@ -508,7 +573,15 @@ void ptirq_intx_ack(struct acrn_vm *vm, uint8_t virt_pin,
 		 */
 		switch (vpin_src) {
 		case PTDEV_VPIN_IOAPIC:
-			if (entry->polarity != 0U) {
+			/*
+			 * If another device on a shared line is still asserted,
+			 * leave the virtual line up and the physical pin masked:
+			 * the vIOAPIC delivers it again at this EOI, instead of the
+			 * unmask raising a physical interrupt right away to do so.
+			 */
+			if (ptirq_intx_src_pending(entry)) {
+				still_asserted = true;
+			} else if (entry->polarity != 0U) {
 				vioapic_set_irq(vm, virt_pin, GSI_SET_HIGH);
 			} else {
 				vioapic_set_irq(vm, virt_pin, GSI_SET_LOW);
@@ -527,7 +600,9 @@ void ptirq_intx_ack(struct acrn_vm *vm, uint8_t virt_pin,
 
 		dev_dbg(ACRN_DBG_PTIRQ, "dev-assign: irq=0x%x acked vr: 0x%x",
 				phys_irq, irq_to_vector(phys_irq));
-		gsi_unmask_irq(phys_irq);
+		if (!still_asserted) {
+			gsi_unmask_irq(phys_irq);
+		}
 	}
 }
 
@@ -582,8 +657,9 @@ int32_t ptirq_msix_remap(struct acrn_vm *vm, uint16_t virt_bdf,
 	}
 
 	/* build physical config MSI, update to info->pmsi_xxx */
-	ptirq_build_physical_msi(vm, info, irq_to_vector(entry->allocated_pirq));
 	entry->msi = *info;
+	ptirq_build_physical_msi(vm, entry, irq_to_vector(entry->allocated_pirq));
+	*info = entry->msi;
 
 	dev_dbg(ACRN_DBG_IRQ, "PCI %x:%x.%x MSI VR[%d] 0x%x->0x%x assigned to vm%d",
 		pci_bus(virt_bdf), pci_slot(virt_bdf), pci_func(virt_bdf), entry_nr,
@@ -715,7 +791,7 @@ int32_t ptirq_intx_pin_remap(struct acrn_vm *vm, uint8_t virt_pin,
 				(vpin_src == 0) ? "vPIC" : "vIOAPIC",
 				(vpin_src == 0) ? "vIOPIC" : "vPIC",
 				virt_pin, entry->vm->vm_id);
-			entry->virt_sid.value = virt_sid.value;
+			ptirq_change_virt_sid(entry, vm, &virt_sid);
 		}
 		spinlock_release(&ptdev_lock);
 		activate_physical_ioapic(vm, entry);
@@ -731,14 +807,18 @@ int32_t ptirq_intx_pin_remap(struct acrn_vm *vm, uint8_t virt_pin,
  *   one entry vs. one phys_pin
  * - currently, one phys_pin can only be held by one pin source (vPIC or
  *   vIOAPIC)
+ * - the devices sharing the phys_pin each add it, with their phys_bdf
  */
 int32_t ptirq_add_intx_remapping(struct acrn_vm *vm, uint8_t virt_pin, uint8_t phys_pin,
-				bool pic_pin)
+				uint16_t phys_bdf, bool pic_pin)
 {
 	struct ptirq_remapping_info *entry;
 
 	spinlock_obtain(&ptdev_lock);
 	entry = add_intx_remapping(vm, virt_pin, phys_pin, pic_pin);
+	if (entry != NULL) {
+		ptirq_intx_add_src(entry, phys_bdf);
+	}
 	spinlock_release(&ptdev_lock);
 
 	return (entry != NULL) ? 0 : -ENODEV;
@@ -791,3 +871,50 @@ void ptirq_remove_msix_remapping(const struct acrn_vm *vm, uint16_t virt_bdf,
 		spinlock_release(&ptdev_lock);
 	}
 }
+
+/*
+ * @pre vm != NULL
+ */
+int32_t ptirq_set_msix_coalescing(const struct acrn_vm *vm, uint16_t virt_bdf,
+		uint32_t vector_count, uint32_t max_events, uint32_t max_us)
+{
+	struct ptirq_remapping_info *entry;
+	uint32_t i;
+	int32_t ret = 0;
+
+	for (i = 0U; i < vector_count; i++) {
+		DEFINE_MSI_SID(virt_sid, virt_bdf, i);
+
+		spinlock_obtain(&ptdev_lock);
+		entry = ptirq_lookup_entry_by_sid(PTDEV_INTR_MSI, &virt_sid, vm);
+		if (entry != NULL) {
+			ptirq_set_coalescing(entry, max_events, max_us);
+		} else {
+			ret = -ENODEV;
+		}
+		spinlock_release(&ptdev_lock);
+	}
+
+	return ret;
+}
+
+/*
+ * @pre vm != NULL
+ */
+int32_t ptirq_set_intx_coalescing(struct acrn_vm *vm, uint8_t virt_pin, bool pic_pin,
+		uint32_t max_events, uint32_t max_us)
+{
+	struct ptirq_remapping_info *entry;
+	int32_t ret = 0;
+
+	spinlock_obtain(&ptdev_lock);
+	entry = ptirq_lookup_entry_by_vpin(vm, virt_pin, pic_pin);
+	if (entry != NULL) {
+		ptirq_set_coalescing(entry, max_events, max_us);
+	} else {
+		ret = -ENODEV;
+	}
+	spinlock_release(&ptdev_lock);
+
+	return ret;
+}
@@ -29,6 +29,10 @@ static bool skip_l1dfl_vmentry;
 static uint64_t x86_arch_capabilities;
 
 /* TODO: add more capability per requirement */
+/* MWAIT features */
+#define MWAIT_FEATURE_IRQ_BREAK			(1U << 0U)
+#define MWAIT_FEATURE_ARAT			(1U << 1U)
+
 /* APICv features */
 #define VAPIC_FEATURE_VIRT_ACCESS		(1U << 0U)
 #define VAPIC_FEATURE_VIRT_REG			(1U << 1U)
@@ -40,6 +44,11 @@ static uint64_t x86_arch_capabilities;
 struct cpu_capability {
 	uint8_t apicv_features;
 	uint8_t ept_features;
+	uint8_t ple_features;
+	uint8_t tsc_scaling_features;
+	uint8_t mwait_features;
+	uint8_t ptmr_features;
+	uint8_t ptmr_rate;
 };
 static struct cpu_capability cpu_caps;
 
@@ -503,27 +512,34 @@ static uint16_t get_cpu_id_from_lapic_id(uint32_t lapic_id)
 }
 
 /*
- * Start all secondary CPUs.
+ * Send the startup IPIs to all secondary CPUs, which then initialize in
+ * parallel with the caller until they wait in wait_cpus_up().
  */
-void start_cpus(void)
+void kick_cpus(void)
 {
-	uint32_t timeout;
-	uint16_t expected_up;
-
 	/* secondary cpu start up will wait for pcpu_sync -> 0UL */
 	atomic_store64(&pcpu_sync, 1UL);
 
-	/* Set flag showing number of CPUs expected to be up to all
-	 * cpus
-	 */
-	expected_up = phys_cpu_num;
-
 	/* Broadcast IPIs to all other CPUs,
 	 * In this case, INTR_CPU_STARTUP_ALL_EX_SELF decides broadcasting
 	 * IPIs, INVALID_CPU_ID is parameter value to destination pcpu_id.
 	 */
 	send_startup_ipi(INTR_CPU_STARTUP_ALL_EX_SELF,
 			INVALID_CPU_ID, startup_paddr);
+}
+
+/*
+ * Wait for the secondary CPUs kicked by kick_cpus() and let them continue.
+ */
+void wait_cpus_up(void)
+{
+	uint32_t timeout;
+	uint16_t expected_up;
+
+	/* Set flag showing number of CPUs expected to be up to all
+	 * cpus
+	 */
+	expected_up = phys_cpu_num;
 
 	/* Wait until global count is equal to expected CPU up count or
 	 * configured time-out has expired
@@ -551,6 +567,15 @@ void start_cpus(void)
 	atomic_store64(&pcpu_sync, 0UL);
 }
 
+/*
+ * Start all secondary CPUs.
+ */
+void start_cpus(void)
+{
+	kick_cpus();
+	wait_cpus_up();
+}
+
 void stop_cpus(void)
 {
 	uint16_t pcpu_id, expected_up;
@@ -750,10 +775,81 @@ static void apicv_cap_detect(void)
 	cpu_caps.apicv_features = features;
 }
 
+static void ple_cap_detect(void)
+{
+	uint64_t msr_val;
+
+	cpu_caps.ple_features = 0U;
+
+	msr_val = msr_read(MSR_IA32_VMX_PROCBASED_CTLS);
+	if (is_ctrl_setting_allowed(msr_val, VMX_PROCBASED_CTLS_SECONDARY)) {
+		msr_val = msr_read(MSR_IA32_VMX_PROCBASED_CTLS2);
+		if (is_ctrl_setting_allowed(msr_val, VMX_PROCBASED_CTLS2_PAUSE_LOOP)) {
+			cpu_caps.ple_features = 1U;
+		}
+	}
+}
+
+static void tsc_scaling_cap_detect(void)
+{
+	uint64_t msr_val;
+
+	cpu_caps.tsc_scaling_features = 0U;
+
+	msr_val = msr_read(MSR_IA32_VMX_PROCBASED_CTLS);
+	if (is_ctrl_setting_allowed(msr_val, VMX_PROCBASED_CTLS_SECONDARY)) {
+		msr_val = msr_read(MSR_IA32_VMX_PROCBASED_CTLS2);
+		if (is_ctrl_setting_allowed(msr_val, VMX_PROCBASED_CTLS2_TSC_SCALING)) {
+			cpu_caps.tsc_scaling_features = 1U;
+		}
+	}
+}
+
+static void ptmr_cap_detect(void)
+{
+	uint64_t msr_val;
+
+	cpu_caps.ptmr_features = 0U;
+
+	msr_val = msr_read(MSR_IA32_VMX_PINBASED_CTLS);
+	if (is_ctrl_setting_allowed(msr_val, VMX_PINBASED_CTLS_ENABLE_PTMR)) {
+		/* IA32_VMX_MISC[4:0]: the TSC bit whose change ticks the timer */
+		cpu_caps.ptmr_rate = (uint8_t)(msr_read(MSR_IA32_VMX_MISC) & 0x1FUL);
+		cpu_caps.ptmr_features = 1U;
+	}
+}
+
+static void mwait_cap_detect(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	cpu_caps.mwait_features = 0U;
+
+	/*
+	 * The idle loop waits with interrupts masked, so that no event is
+	 * missed between its last check and MWAIT.
+	 */
+	if (cpu_has_cap(X86_FEATURE_MONITOR) && (boot_cpu_data.cpuid_level >= CPUID_THERMAL_POWER)) {
+		cpuid(CPUID_MONITOR_MWAIT, &eax, &ebx, &ecx, &edx);
+		if (((ecx & CPUID_ECX_MWAIT_EMX) != 0U) && ((ecx & CPUID_ECX_MWAIT_IBE) != 0U)) {
+			cpu_caps.mwait_features |= MWAIT_FEATURE_IRQ_BREAK;
+		}
+
+		cpuid(CPUID_THERMAL_POWER, &eax, &ebx, &ecx, &edx);
+		if ((eax & CPUID_EAX_ARAT) != 0U) {
+			cpu_caps.mwait_features |= MWAIT_FEATURE_ARAT;
+		}
+	}
+}
+
 static void cpu_cap_detect(void)
 {
 	apicv_cap_detect();
 	ept_cap_detect();
+	ple_cap_detect();
+	tsc_scaling_cap_detect();
+	ptmr_cap_detect();
+	mwait_cap_detect();
 }
 
 bool is_ept_supported(void)
@@ -761,6 +857,46 @@ bool is_ept_supported(void)
 	return (cpu_caps.ept_features != 0U);
 }
 
+bool is_ple_supported(void)
+{
+	return (cpu_caps.ple_features != 0U);
+}
+
+bool is_tsc_scaling_supported(void)
+{
+	return (cpu_caps.tsc_scaling_features != 0U);
+}
+
+bool is_vmx_ptmr_supported(void)
+{
+	return (cpu_caps.ptmr_features != 0U);
+}
+
+uint8_t get_vmx_ptmr_rate(void)
+{
+	return cpu_caps.ptmr_rate;
+}
+
+bool is_mwait_supported(void)
+{
+	return ((cpu_caps.mwait_features & MWAIT_FEATURE_IRQ_BREAK) != 0U);
+}
+
+/*
+ * C-states deeper than C1 stop the LAPIC timer unless it is always
+ * running, the hypervisor timers would then never fire.
+ */
+uint32_t get_mwait_hint(uint32_t hint)
+{
+	uint32_t ret = hint;
+
+	if (((cpu_caps.mwait_features & MWAIT_FEATURE_ARAT) == 0U) && (hint >= MWAIT_HINT_C2)) {
+		ret = MWAIT_HINT_C1;
+	}
+
+	return ret;
+}
+
 bool is_apicv_reg_virtualization_supported(void)
 {
 	return ((cpu_caps.apicv_features & VAPIC_FEATURE_VIRT_REG) != 0U);
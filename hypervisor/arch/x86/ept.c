@@ -10,6 +10,16 @@
 
 #define ACRN_DBG_EPT	6U
 
+#define EPT_SPLIT_PAGES_MAX	4UL
+
+/* EPTP bit enabling the accessed and dirty flags of the EPT */
+#define EPTP_AD_ENABLE		(1UL << 6U)
+/* Most a dirty log operation waits for the vCPUs to flush their EPT TLB */
+#define EPT_FLUSH_WAIT_US	10000U
+
+/* Time a VM exit may spend on the iterations of a string instruction */
+#define MMIO_STRING_BUDGET_US	20U
+
 void destroy_ept(struct acrn_vm *vm)
 {
 	/* Destroy secure world */
@@ -22,28 +32,78 @@ void destroy_ept(struct acrn_vm *vm)
 	}
 }
 
+/*
+ * The cache is per vCPU and only touched from the pCPU the vCPU runs on.
+ * An entry is good while the VM's EPT generation is the one it was filled
+ * at: every EPT change bumps the generation, so it never outlives a remap.
+ */
+static bool gpa_cache_lookup(const struct acrn_vcpu *vcpu, int32_t world, uint64_t gen,
+		uint64_t gpa, uint64_t *hpa, uint64_t *pg_size)
+{
+	const struct gpa_cache_entry *entry;
+	uint32_t i;
+	bool hit = false;
+
+	for (i = 0U; i < GPA_CACHE_ENTRIES; i++) {
+		entry = &vcpu->arch.gpa_cache.entries[i];
+		if ((entry->pg_size != 0UL) && (entry->gen == gen) && (entry->world == world)
+				&& ((gpa & (~(entry->pg_size - 1UL))) == entry->gpa_base)) {
+			*hpa = entry->hpa_base | (gpa & (entry->pg_size - 1UL));
+			*pg_size = entry->pg_size;
+			hit = true;
+			break;
+		}
+	}
+
+	return hit;
+}
+
+static void gpa_cache_fill(struct acrn_vcpu *vcpu, int32_t world, uint64_t gen,
+		uint64_t gpa, uint64_t hpa, uint64_t pg_size)
+{
+	struct gpa_cache *cache = &vcpu->arch.gpa_cache;
+	struct gpa_cache_entry *entry = &cache->entries[cache->next];
+
+	entry->gpa_base = gpa & (~(pg_size - 1UL));
+	entry->hpa_base = hpa & (~(pg_size - 1UL));
+	entry->pg_size = pg_size;
+	entry->gen = gen;
+	entry->world = world;
+	cache->next = (cache->next + 1U) % GPA_CACHE_ENTRIES;
+}
+
 /* using return value INVALID_HPA as error code */
 uint64_t local_gpa2hpa(struct acrn_vm *vm, uint64_t gpa, uint32_t *size)
 {
 	uint64_t hpa = INVALID_HPA;
 	uint64_t *pgentry, pg_size = 0UL;
+	uint64_t gen;
+	int32_t world = NORMAL_WORLD;
 	void *eptp;
 	struct acrn_vcpu *vcpu = vcpu_from_pid(vm, get_cpu_id());
 
 	if ((vcpu != NULL) && (vcpu->arch.cur_context == SECURE_WORLD)) {
+		world = SECURE_WORLD;
 		eptp = vm->arch_vm.sworld_eptp;
 	} else {
 		eptp = vm->arch_vm.nworld_eptp;
 	}
 
-	pgentry = lookup_address((uint64_t *)eptp, gpa, &pg_size, &vm->arch_vm.ept_mem_ops);
-	if (pgentry != NULL) {
-		hpa = ((*pgentry & (~(pg_size - 1UL)))
-				| (gpa & (pg_size - 1UL)));
-		pr_dbg("GPA2HPA: 0x%llx->0x%llx", gpa, hpa);
-	} else {
-		pr_err("VM %d GPA2HPA: failed for gpa 0x%llx",
-				vm->vm_id, gpa);
+	/* read before the walk, so a change racing with it drops the entry */
+	gen = atomic_load64(&vm->arch_vm.ept_gen);
+	if ((vcpu == NULL) || !gpa_cache_lookup(vcpu, world, gen, gpa, &hpa, &pg_size)) {
+		pgentry = lookup_address((uint64_t *)eptp, gpa, &pg_size, &vm->arch_vm.ept_mem_ops);
+		if (pgentry != NULL) {
+			hpa = ((*pgentry & PDE_PFN_MASK & (~(pg_size - 1UL)))
+					| (gpa & (pg_size - 1UL)));
+			pr_dbg("GPA2HPA: 0x%llx->0x%llx", gpa, hpa);
+			if (vcpu != NULL) {
+				gpa_cache_fill(vcpu, world, gen, gpa, hpa, pg_size);
+			}
+		} else {
+			pr_err("VM %d GPA2HPA: failed for gpa 0x%llx",
+					vm->vm_id, gpa);
+		}
 	}
 	/**
 	 * If specified parameter size is not NULL and
@@ -71,10 +131,58 @@ uint64_t vm0_hpa2gpa(uint64_t hpa)
 	return hpa;
 }
 
+/*
+ * Emulate one MMIO access of the decoded instruction.
+ *
+ * For MMIO write, ask DM to run MMIO emulation after instruction emulation.
+ * For MMIO read, ask DM to run MMIO emulation at first.
+ *
+ * @retval 0 The access is completed.
+ * @retval IOREQ_PENDING The access is delivered to VHM.
+ * @retval -EFAULT The instruction emulation failed.
+ * @retval <0 on other errors of emulate_io().
+ */
+static int32_t emulate_mmio_access(struct acrn_vcpu *vcpu, struct io_request *io_req)
+{
+	int32_t status = 0;
+
+	/* Determine value being written. */
+	if (io_req->reqs.mmio.direction == REQUEST_WRITE) {
+		if (emulate_instruction(vcpu) != 0) {
+			status = -EFAULT;
+		}
+	}
+
+	if (status == 0) {
+		status = emulate_io(vcpu, io_req);
+		if (status == 0) {
+			emulate_mmio_post(vcpu, io_req);
+		}
+	}
+
+	return status;
+}
+
+/* A write to a page SOS shares with other VMs, see HC_VM_SET_COW */
+static bool is_cow_write(const struct acrn_vcpu *vcpu, uint64_t gpa)
+{
+	const uint64_t *pgentry;
+	uint64_t pg_size;
+	bool cow = false;
+
+	if (vcpu->arch.cur_context == NORMAL_WORLD) {
+		pgentry = lookup_address((uint64_t *)vcpu->vm->arch_vm.nworld_eptp, gpa,
+				&pg_size, &vcpu->vm->arch_vm.ept_mem_ops);
+		cow = (pgentry != NULL) && ((*pgentry & EPT_COW) != 0UL);
+	}
+
+	return cow;
+}
+
 int32_t ept_violation_vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	int32_t status = -EINVAL, ret;
-	uint64_t exit_qual;
+	uint64_t exit_qual, deadline;
 	uint64_t gpa;
 	struct io_request *io_req = &vcpu->req;
 	struct mmio_request *mmio_req = &io_req->reqs.mmio;
@@ -104,7 +212,7 @@ int32_t ept_violation_vmexit_handler(struct acrn_vcpu *vcpu)
 	}
 
 	/* Get the guest physical address */
-	gpa = exec_vmread64(VMX_GUEST_PHYSICAL_ADDR_FULL);
+	gpa = vcpu_vmcs_read(vcpu, VMCS_GUEST_PHYSICAL_ADDR);
 
 	TRACE_2L(TRACE_VMEXIT_EPT_VIOLATION, exit_qual, gpa);
 
@@ -112,48 +220,56 @@ int32_t ept_violation_vmexit_handler(struct acrn_vcpu *vcpu)
 	 */
 	mmio_req->address = gpa;
 
-	ret = decode_instruction(vcpu);
-	if (ret > 0) {
-		mmio_req->size = (uint64_t)ret;
-		/*
-		 * For MMIO write, ask DM to run MMIO emulation after
-		 * instruction emulation. For MMIO read, ask DM to run MMIO
-		 * emulation at first.
-		 */
-
-		/* Determine value being written. */
-		if (mmio_req->direction == REQUEST_WRITE) {
-			status = emulate_instruction(vcpu);
-			if (status != 0) {
-				ret = -EFAULT;;
-			}
-		}
-
+	/*
+	 * Don't emulate a write to a shared page: SOS gives the VM a page of
+	 * its own, mapped writable, then the instruction runs again.
+	 */
+	if ((io_req->type == REQ_WP) && is_cow_write(vcpu, gpa)) {
+		mmio_req->size = 0UL;
+		vcpu_retain_rip(vcpu);
+		status = acrn_insert_request_wait(vcpu, io_req);
+		ret = 1;
+	} else {
+		ret = decode_instruction(vcpu);
 		if (ret > 0) {
-			status = emulate_io(vcpu, io_req);
-			if (status == 0) {
-				emulate_mmio_post(vcpu, io_req);
+			mmio_req->size = (uint64_t)ret;
+
+			/*
+			 * Run the iterations of a REP MOVS/STOS completed
+			 * without SOS here rather than one per VM exit. Stop at
+			 * a pending request of the vCPU, so that interrupts are
+			 * taken between iterations as on hardware, and at the
+			 * time budget.
+			 */
+			deadline = rdtsc() + us_to_ticks(MMIO_STRING_BUDGET_US);
+			do {
+				status = emulate_mmio_access(vcpu, io_req);
+			} while ((status == 0) && (vcpu->arch.pending_req == 0UL) &&
+					(rdtsc() < deadline) && emulate_string_next(vcpu));
+
+			if (status == IOREQ_PENDING) {
+				status = 0;
+			} else if (status == -EFAULT) {
+				ret = -EFAULT;
 			} else {
-				if (status == IOREQ_PENDING) {
-					status = 0;
-				}
+				/* completed, or emulate_io() failed */
+			}
+		} else {
+			if (ret == -EFAULT) {
+				pr_info("page fault happen during decode_instruction");
+				status = 0;
 			}
-		}
-	} else {
-		if (ret == -EFAULT) {
-			pr_info("page fault happen during decode_instruction");
-			status = 0;
 		}
 	}
 
 	if (ret <= 0) {
-		pr_acrnlog("Guest Linear Address: 0x%016llx", exec_vmread(VMX_GUEST_LINEAR_ADDR));
+		pr_acrnlog("Guest Linear Address: 0x%016llx", vcpu_vmcs_read(vcpu, VMCS_GUEST_LINEAR_ADDR));
 		pr_acrnlog("Guest Physical Address address: 0x%016llx", gpa);
 	}
 	return status;
 }
 
-int32_t ept_misconfig_vmexit_handler(__unused struct acrn_vcpu *vcpu)
+int32_t ept_misconfig_vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	int32_t status;
 
@@ -161,10 +277,10 @@ int32_t ept_misconfig_vmexit_handler(__unused struct acrn_vcpu *vcpu)
 
 	/* TODO - EPT Violation handler */
 	pr_fatal("%s, Guest linear address: 0x%016llx ",
-			__func__, exec_vmread(VMX_GUEST_LINEAR_ADDR));
+			__func__, vcpu_vmcs_read(vcpu, VMCS_GUEST_LINEAR_ADDR));
 
 	pr_fatal("%s, Guest physical address: 0x%016llx ",
-			__func__, exec_vmread64(VMX_GUEST_PHYSICAL_ADDR_FULL));
+			__func__, vcpu_vmcs_read(vcpu, VMCS_GUEST_PHYSICAL_ADDR));
 
 	ASSERT(status == 0, "EPT Misconfiguration is not handled.\n");
 
@@ -173,12 +289,127 @@ int32_t ept_misconfig_vmexit_handler(__unused struct acrn_vcpu *vcpu)
 	return status;
 }
 
-void ept_mr_add(struct acrn_vm *vm, uint64_t *pml4_page,
-	uint64_t hpa, uint64_t gpa, uint64_t size, uint64_t prot_orig)
+static void ept_request_flush(struct acrn_vm *vm)
 {
 	uint16_t i;
 	struct acrn_vcpu *vcpu;
+
+	foreach_vcpu(i, vm, vcpu) {
+		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+	}
+}
+
+/*
+ * A change flushes right away outside of a batch. Inside, the dirty flag is
+ * set before the depth is checked, and the commit drops the depth before it
+ * takes the flag, so one of them always sees the other and does the flush.
+ */
+static void ept_changed(struct acrn_vm *vm)
+{
+	atomic_inc64(&vm->arch_vm.ept_gen);
+	(void)atomic_swap32(&vm->arch_vm.ept_batch_dirty, 1U);
+	/* the swap above orders this load after the store of the flag */
+	if (vm->arch_vm.ept_batch_depth == 0) {
+		if (atomic_swap32(&vm->arch_vm.ept_batch_dirty, 0U) != 0U) {
+			ept_request_flush(vm);
+		}
+	}
+}
+
+/*
+ * The IOMMU walks the normal world EPT of the VM as well. A change can
+ * also free a page-table page by a merge, hence adds flush too.
+ */
+static void ept_flush_iommu(const struct acrn_vm *vm, const uint64_t *pml4_page, uint64_t gpa, uint64_t size)
+{
+	if ((vm->iommu != NULL) && (pml4_page == vm->arch_vm.nworld_eptp)) {
+		iommu_flush_domain_range(vm->iommu, gpa, size);
+	}
+}
+
+void ept_update_begin(struct acrn_vm *vm)
+{
+	(void)atomic_inc_return(&vm->arch_vm.ept_batch_depth);
+}
+
+void ept_update_commit(struct acrn_vm *vm)
+{
+	if (atomic_dec_return(&vm->arch_vm.ept_batch_depth) == 0) {
+		if (atomic_swap32(&vm->arch_vm.ept_batch_dirty, 0U) != 0U) {
+			ept_request_flush(vm);
+		}
+	}
+}
+
+uint64_t ept_nworld_eptp(struct acrn_vcpu *vcpu)
+{
+	uint64_t eptp = hva2hpa(vcpu->vm->arch_vm.nworld_eptp) | (3UL << 3U) | 6UL;
+
+	vcpu->arch.ept_ad = (vcpu->vm->arch_vm.ept_mem_ops.info->ept.dirty_log != 0U);
+	if (vcpu->arch.ept_ad) {
+		eptp |= EPTP_AD_ENABLE;
+	}
+
+	return eptp;
+}
+
+void ept_flush_vcpu(struct acrn_vcpu *vcpu)
+{
+	uint64_t gen = atomic_load64(&vcpu->vm->arch_vm.ept_gen);
+	bool ad = (vcpu->vm->arch_vm.ept_mem_ops.info->ept.dirty_log != 0U);
+
+	/* the secure world EPTP never enables the flags, see switch_world() */
+	if ((vcpu->arch.ept_ad != ad) && (vcpu->arch.cur_context == NORMAL_WORLD)) {
+		exec_vmwrite64(VMX_EPT_POINTER_FULL, ept_nworld_eptp(vcpu));
+	}
+
+	/*
+	 * The generation is read before the flush: a change made meanwhile
+	 * makes a new request, which the next VM entry sees as not covered.
+	 */
+	if (vcpu->arch.ept_flushed_gen != gen) {
+		invept(vcpu);
+		vcpu->arch.ept_flushed_gen = gen;
+	}
+}
+
+/*
+ * Most page-table pages a mapping of [gpa, gpa + size) takes: one per 512G,
+ * 1G and 2M region it touches. The secure world range has pages of its own.
+ */
+static uint64_t ept_add_pages_needed(uint64_t gpa, uint64_t size)
+{
+	uint64_t end = gpa + size;
+	uint64_t nr_pages = 0UL;
+
+	if (end > TRUSTY_EPT_REBASE_GPA) {
+		end = TRUSTY_EPT_REBASE_GPA;
+	}
+	if (gpa < end) {
+		nr_pages = ((end - 1UL) >> PML4E_SHIFT) - (gpa >> PML4E_SHIFT) + 1UL;
+		nr_pages += ((end - 1UL) >> PDPTE_SHIFT) - (gpa >> PDPTE_SHIFT) + 1UL;
+		nr_pages += ((end - 1UL) >> PDE_SHIFT) - (gpa >> PDE_SHIFT) + 1UL;
+	}
+
+	return nr_pages;
+}
+
+/*
+ * A modification or deletion only splits the large pages it partially
+ * covers, at either end of the range: a 1G and a 2M one on each side.
+ */
+static uint64_t ept_split_pages_needed(uint64_t gpa, uint64_t size)
+{
+	uint64_t nr_pages = ept_add_pages_needed(gpa, size);
+
+	return (nr_pages > EPT_SPLIT_PAGES_MAX) ? EPT_SPLIT_PAGES_MAX : nr_pages;
+}
+
+int32_t ept_mr_add(struct acrn_vm *vm, uint64_t *pml4_page,
+	uint64_t hpa, uint64_t gpa, uint64_t size, uint64_t prot_orig)
+{
 	uint64_t prot = prot_orig;
+	int32_t ret;
 
 	dev_dbg(ACRN_DBG_EPT, "%s, vm[%d] hpa: 0x%016llx gpa: 0x%016llx size: 0x%016llx prot: 0x%016x\n",
 			__func__, vm->vm_id, hpa, gpa, size, prot);
@@ -191,19 +422,22 @@ void ept_mr_add(struct acrn_vm *vm, uint64_t *pml4_page,
 		prot |= EPT_SNOOP_CTRL;
 	}
 
-	mmu_add(pml4_page, hpa, gpa, size, prot, &vm->arch_vm.ept_mem_ops);
-
-	foreach_vcpu(i, vm, vcpu) {
-		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+	ret = ept_pool_reserve(vm, ept_add_pages_needed(gpa, size));
+	if (ret == 0) {
+		mmu_add(pml4_page, hpa, gpa, size, prot, &vm->arch_vm.ept_mem_ops);
+		ept_pool_unreserve(vm);
+		ept_changed(vm);
+		ept_flush_iommu(vm, pml4_page, gpa, size);
 	}
+
+	return ret;
 }
 
-void ept_mr_modify(struct acrn_vm *vm, uint64_t *pml4_page,
+int32_t ept_mr_modify(struct acrn_vm *vm, uint64_t *pml4_page,
 		uint64_t gpa, uint64_t size,
 		uint64_t prot_set, uint64_t prot_clr)
 {
-	struct acrn_vcpu *vcpu;
-	uint16_t i;
+	int32_t ret;
 
 	dev_dbg(ACRN_DBG_EPT, "%s,vm[%d] gpa 0x%llx size 0x%llx\n", __func__, vm->vm_id, gpa, size);
 
@@ -211,25 +445,166 @@ void ept_mr_modify(struct acrn_vm *vm, uint64_t *pml4_page,
 		prot_set |= EPT_SNOOP_CTRL;
 	}
 
-	mmu_modify_or_del(pml4_page, gpa, size, prot_set, prot_clr, &vm->arch_vm.ept_mem_ops, MR_MODIFY);
-
-	foreach_vcpu(i, vm, vcpu) {
-		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+	ret = ept_pool_reserve(vm, ept_split_pages_needed(gpa, size));
+	if (ret == 0) {
+		mmu_modify_or_del(pml4_page, gpa, size, prot_set, prot_clr, &vm->arch_vm.ept_mem_ops, MR_MODIFY);
+		ept_pool_unreserve(vm);
+		ept_changed(vm);
+		ept_flush_iommu(vm, pml4_page, gpa, size);
 	}
+
+	return ret;
 }
 /**
  * @pre [gpa,gpa+size) has been mapped into host physical memory region
  */
-void ept_mr_del(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa, uint64_t size)
+int32_t ept_mr_del(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa, uint64_t size)
 {
-	struct acrn_vcpu *vcpu;
-	uint16_t i;
+	int32_t ret;
 
 	dev_dbg(ACRN_DBG_EPT, "%s,vm[%d] gpa 0x%llx size 0x%llx\n", __func__, vm->vm_id, gpa, size);
 
-	mmu_modify_or_del(pml4_page, gpa, size, 0UL, 0UL, &vm->arch_vm.ept_mem_ops, MR_DEL);
+	ret = ept_pool_reserve(vm, ept_split_pages_needed(gpa, size));
+	if (ret == 0) {
+		mmu_modify_or_del(pml4_page, gpa, size, 0UL, 0UL, &vm->arch_vm.ept_mem_ops, MR_DEL);
+		ept_pool_unreserve(vm);
+		ept_changed(vm);
+		ept_flush_iommu(vm, pml4_page, gpa, size);
+	}
+
+	return ret;
+}
 
+/*
+ * Whether a vCPU dropped the EPT translations of before the generation gen:
+ * it flushed them, or it is out of the guest and flushes before its next VM
+ * entry, as the flush request was made before.
+ */
+static bool ept_vcpu_flushed(const struct acrn_vcpu *vcpu, uint64_t gen)
+{
+	return (vcpu->arch.ept_flushed_gen >= gen) || (vcpu->state != VCPU_RUNNING) ||
+		(per_cpu(sched_ctx, vcpu->pcpu_id).curr_vcpu != vcpu);
+}
+
+/*
+ * The dirty flags the log cleared must be out of the TLB of every vCPU before
+ * they are reported: a write through a stale translation would not set them
+ * again. A vCPU which does not come out of the guest in time makes the log
+ * unreliable, until it is stopped.
+ */
+static void ept_dirty_log_flush(struct acrn_vm *vm)
+{
+	uint64_t gen, deadline;
+	uint16_t i;
+	struct acrn_vcpu *vcpu;
+
+	ept_changed(vm);
+	gen = atomic_load64(&vm->arch_vm.ept_gen);
+	deadline = rdtsc() + us_to_ticks(EPT_FLUSH_WAIT_US);
 	foreach_vcpu(i, vm, vcpu) {
-		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+		while (!ept_vcpu_flushed(vcpu, gen)) {
+			if (rdtsc() > deadline) {
+				pr_err("%s: vm%hu vcpu%hu did not flush its EPT TLB", __func__, vm->vm_id, vcpu->vcpu_id);
+				vm->arch_vm.ept_mem_ops.info->ept.dirty_lost = true;
+				return;
+			}
+			pause_cpu();
+		}
+	}
+}
+
+int32_t ept_dirty_log_start(struct acrn_vm *vm, uint64_t gpa, uint64_t size)
+{
+	union pgtable_pages_info *info = vm->arch_vm.ept_mem_ops.info;
+	struct pgtable_walk walk = {
+		.type = WALK_SPLIT,
+		.flags = EPT_ACCESSED | EPT_DIRTY,
+		.start = gpa,
+		.end = gpa + size,
+		.mem_ops = &vm->arch_vm.ept_mem_ops,
+	};
+	int32_t ret;
+
+	dev_dbg(ACRN_DBG_EPT, "%s,vm[%d] gpa 0x%llx size 0x%llx\n", __func__, vm->vm_id, gpa, size);
+
+	if (!cpu_has_ept_ad()) {
+		ret = -ENODEV;
+	} else {
+		ret = ept_pool_reserve(vm, ept_add_pages_needed(gpa, size));
 	}
+	if (ret == 0) {
+		/* no merge from now on, and the EPTP of the vCPUs enables the flags */
+		info->ept.dirty_log++;
+		mmu_walk((uint64_t *)vm->arch_vm.nworld_eptp, &walk);
+		ept_pool_unreserve(vm);
+		ept_dirty_log_flush(vm);
+	}
+
+	return ret;
+}
+
+int32_t ept_dirty_log_stop(struct acrn_vm *vm, uint64_t gpa, uint64_t size)
+{
+	union pgtable_pages_info *info = vm->arch_vm.ept_mem_ops.info;
+	struct pgtable_walk walk = {
+		.type = WALK_MERGE,
+		.flags = EPT_ACCESSED | EPT_DIRTY,
+		.start = gpa,
+		.end = gpa + size,
+		.mem_ops = &vm->arch_vm.ept_mem_ops,
+	};
+	int32_t ret = 0;
+
+	dev_dbg(ACRN_DBG_EPT, "%s,vm[%d] gpa 0x%llx size 0x%llx\n", __func__, vm->vm_id, gpa, size);
+
+	if (info->ept.dirty_log == 0U) {
+		ret = -EINVAL;
+	} else {
+		info->ept.dirty_log--;
+		if (info->ept.dirty_log == 0U) {
+			info->ept.dirty_lost = false;
+		}
+		/* merges are back once no range is logged any more */
+		mmu_walk((uint64_t *)vm->arch_vm.nworld_eptp, &walk);
+		ept_changed(vm);
+		ept_flush_iommu(vm, vm->arch_vm.nworld_eptp, gpa, size);
+	}
+
+	return ret;
+}
+
+int32_t ept_dirty_log_get(struct acrn_vm *vm, uint64_t gpa, uint64_t size, uint64_t *bitmap, uint64_t *nr_dirty)
+{
+	const union pgtable_pages_info *info = vm->arch_vm.ept_mem_ops.info;
+	struct pgtable_walk walk = {
+		.type = WALK_TEST_AND_CLEAR,
+		.bit = EPT_DIRTY_BIT,
+		.start = gpa,
+		.end = gpa + size,
+		.bitmap = bitmap,
+		.mem_ops = &vm->arch_vm.ept_mem_ops,
+	};
+	int32_t ret = 0;
+
+	if (info->ept.dirty_log == 0U) {
+		ret = -EINVAL;
+	} else if (info->ept.dirty_lost) {
+		ret = -EIO;
+	} else {
+		/* the bitmap is SOS memory */
+		stac();
+		(void)memset((void *)bitmap, 0U, ((size >> PAGE_SHIFT) + 7UL) >> 3U);
+		mmu_walk((uint64_t *)vm->arch_vm.nworld_eptp, &walk);
+		clac();
+
+		if (walk.count != 0UL) {
+			ept_dirty_log_flush(vm);
+			if (info->ept.dirty_lost) {
+				ret = -EIO;
+			}
+		}
+		*nr_dirty = walk.count;
+	}
+
+	return ret;
 }
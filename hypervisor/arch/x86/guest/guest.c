@@ -69,7 +69,7 @@ enum vm_paging_mode get_vcpu_paging_mode(struct acrn_vcpu *vcpu)
 /* TODO: Add code to check for Revserved bits, SMAP and PKE when do translation
  * during page walk */
 static int32_t local_gva2gpa_common(struct acrn_vcpu *vcpu, const struct page_walk_info *pw_info,
-	uint64_t gva, uint64_t *gpa, uint32_t *err_code)
+	uint64_t gva, uint64_t *gpa, uint32_t *err_code, struct gva_cache_entry *walk)
 {
 	uint32_t i;
 	uint64_t index;
@@ -107,10 +107,14 @@ static int32_t local_gva2gpa_common(struct acrn_vcpu *vcpu, const struct page_wa
 			uint32_t *base32 = (uint32_t *)base;
 			/* 32bit entry */
 			entry = (uint64_t)(*(base32 + index));
+			walk->pte[walk->nr_levels] = base32 + index;
 		} else {
 			uint64_t *base64 = (uint64_t *)base;
 			entry = *(base64 + index);
+			walk->pte[walk->nr_levels] = base64 + index;
 		}
+		walk->pte_val[walk->nr_levels] = entry;
+		walk->nr_levels++;
 
 		/* check if the entry present */
 		if ((entry & PAGE_PRESENT) == 0U) {
@@ -207,6 +211,7 @@ static int32_t local_gva2gpa_common(struct acrn_vcpu *vcpu, const struct page_wa
 	entry <<= (shift + 12U);
 	entry >>= 12U;
 	*gpa = entry | (gva & (page_size - 1UL));
+	walk->page_size = page_size;
 out:
 
 	clac();
@@ -218,7 +223,7 @@ out:
 }
 
 static int32_t local_gva2gpa_pae(struct acrn_vcpu *vcpu, struct page_walk_info *pw_info,
-	uint64_t gva, uint64_t *gpa, uint32_t *err_code)
+	uint64_t gva, uint64_t *gpa, uint32_t *err_code, struct gva_cache_entry *walk)
 {
 	int32_t index;
 	uint64_t *base;
@@ -235,6 +240,9 @@ static int32_t local_gva2gpa_pae(struct acrn_vcpu *vcpu, struct page_walk_info *
 
 	index = (gva >> 30U) & 0x3UL;
 	entry = base[index];
+	walk->pte[0] = &base[index];
+	walk->pte_val[0] = entry;
+	walk->nr_levels = 1U;
 
 	if ((entry & PAGE_PRESENT) == 0U) {
 		ret = -EFAULT;
@@ -243,12 +251,89 @@ static int32_t local_gva2gpa_pae(struct acrn_vcpu *vcpu, struct page_walk_info *
 
 	pw_info->level = 2U;
 	pw_info->top_entry = entry;
-	ret = local_gva2gpa_common(vcpu, pw_info, gva, gpa, err_code);
+	ret = local_gva2gpa_common(vcpu, pw_info, gva, gpa, err_code, walk);
 
 out:
 	return ret;
 }
 
+/*
+ * Guest CR3 loads and INVLPG do not exit, so a cached walk can't be dropped
+ * when the guest edits its page tables. Instead, each hit re-reads the
+ * entries the walk went through, straight from the host pointers it kept,
+ * and only counts if they are unchanged; A/D bits don't affect the result
+ * and are left out. That skips the EPT lookup per level and the checks.
+ * The pointers hold while the EPT generation does, and the access bits
+ * cover every input the permission checks look at.
+ */
+static uint32_t gva_walk_access(struct acrn_vcpu *vcpu, const struct page_walk_info *pw_info)
+{
+	uint32_t access = pw_info->level;
+
+	access |= pw_info->is_user_mode_access ? (1U << 4U) : 0U;
+	access |= pw_info->is_write_access ? (1U << 5U) : 0U;
+	access |= pw_info->is_inst_fetch ? (1U << 6U) : 0U;
+	access |= pw_info->pse ? (1U << 7U) : 0U;
+	access |= pw_info->wp ? (1U << 8U) : 0U;
+	access |= pw_info->nxe ? (1U << 9U) : 0U;
+	access |= pw_info->is_smep_on ? (1U << 10U) : 0U;
+	if (pw_info->is_smap_on) {
+		access |= 1U << 11U;
+		access |= ((vcpu_get_rflags(vcpu) & RFLAGS_AC) != 0UL) ? (1U << 12U) : 0U;
+	}
+
+	return access;
+}
+
+static bool gva_walk_unchanged(const struct gva_cache_entry *entry)
+{
+	uint32_t i;
+	uint64_t val;
+	bool same = true;
+
+	stac();
+	for (i = 0U; i < entry->nr_levels; i++) {
+		if (entry->pte32) {
+			val = (uint64_t)(*(const uint32_t *)entry->pte[i]);
+		} else {
+			val = *(const uint64_t *)entry->pte[i];
+		}
+		if (((val ^ entry->pte_val[i]) & ~(PAGE_ACCESSED | PAGE_DIRTY)) != 0UL) {
+			same = false;
+			break;
+		}
+	}
+	clac();
+
+	return same;
+}
+
+static bool gva_cache_lookup(struct acrn_vcpu *vcpu, uint64_t cr3, uint32_t access,
+	uint64_t gva, uint64_t *gpa)
+{
+	struct gva_cache_entry *entry;
+	uint64_t gen = atomic_load64(&vcpu->vm->arch_vm.ept_gen);
+	uint32_t i;
+	bool hit = false;
+
+	for (i = 0U; i < GVA_CACHE_ENTRIES; i++) {
+		entry = &vcpu->arch.gva_cache.entries[i];
+		if ((entry->page_size != 0UL) && (entry->cr3 == cr3) && (entry->access == access)
+				&& (entry->world == vcpu->arch.cur_context) && (entry->ept_gen == gen)
+				&& ((gva & (~(entry->page_size - 1UL))) == entry->gva_base)) {
+			if (gva_walk_unchanged(entry)) {
+				*gpa = entry->gpa_base | (gva & (entry->page_size - 1UL));
+				hit = true;
+			} else {
+				entry->page_size = 0UL;
+			}
+			break;
+		}
+	}
+
+	return hit;
+}
+
 /* Refer to SDM Vol.3A 6-39 section 6.15 for the format of paging fault error
  * code.
  *
@@ -272,6 +357,10 @@ int32_t gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
 {
 	enum vm_paging_mode pm = get_vcpu_paging_mode(vcpu);
 	struct page_walk_info pw_info;
+	struct gva_cache *cache = &vcpu->arch.gva_cache;
+	struct gva_cache_entry *walk;
+	uint32_t access;
+	uint64_t cr3, gen;
 	int32_t ret = 0;
 
 	if ((gpa == NULL) || (err_code == NULL)) {
@@ -279,7 +368,8 @@ int32_t gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
 	}
 	*gpa = 0UL;
 
-	pw_info.top_entry = exec_vmread(VMX_GUEST_CR3);
+	cr3 = exec_vmread(VMX_GUEST_CR3);
+	pw_info.top_entry = cr3;
 	pw_info.level = (uint32_t)pm;
 	pw_info.is_write_access = ((*err_code & PAGE_FAULT_WR_FLAG) != 0U);
 	pw_info.is_inst_fetch = ((*err_code & PAGE_FAULT_ID_FLAG) != 0U);
@@ -301,19 +391,47 @@ int32_t gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
 
 	*err_code &=  ~PAGE_FAULT_P_FLAG;
 
-	if (pm == PAGING_MODE_4_LEVEL) {
-		pw_info.width = 9U;
-		ret = local_gva2gpa_common(vcpu, &pw_info, gva, gpa, err_code);
-	} else if (pm == PAGING_MODE_3_LEVEL) {
-		pw_info.width = 9U;
-		ret = local_gva2gpa_pae(vcpu, &pw_info, gva, gpa, err_code);
-	} else if (pm == PAGING_MODE_2_LEVEL) {
+	if (pm == PAGING_MODE_0_LEVEL) {
+		*gpa = gva;
+		return 0;
+	}
+
+	if (pm == PAGING_MODE_2_LEVEL) {
 		pw_info.width = 10U;
 		pw_info.pse = ((vcpu_get_cr4(vcpu) & CR4_PSE) != 0UL);
 		pw_info.nxe = false;
-		ret = local_gva2gpa_common(vcpu, &pw_info, gva, gpa, err_code);
 	} else {
-		*gpa = gva;
+		pw_info.width = 9U;
+	}
+
+	access = gva_walk_access(vcpu, &pw_info);
+	if (gva_cache_lookup(vcpu, cr3, access, gva, gpa)) {
+		return 0;
+	}
+
+	/* read before the walk, so a change racing with it drops the entry */
+	gen = atomic_load64(&vcpu->vm->arch_vm.ept_gen);
+	walk = &cache->entries[cache->next];
+	walk->page_size = 0UL;
+	walk->nr_levels = 0U;
+	walk->pte32 = (pw_info.width == 10U);
+
+	if (pm == PAGING_MODE_3_LEVEL) {
+		ret = local_gva2gpa_pae(vcpu, &pw_info, gva, gpa, err_code, walk);
+	} else {
+		ret = local_gva2gpa_common(vcpu, &pw_info, gva, gpa, err_code, walk);
+	}
+
+	if (ret == 0) {
+		walk->cr3 = cr3;
+		walk->access = access;
+		walk->world = vcpu->arch.cur_context;
+		walk->ept_gen = gen;
+		walk->gva_base = gva & (~(walk->page_size - 1UL));
+		walk->gpa_base = *gpa & (~(walk->page_size - 1UL));
+		cache->next = (cache->next + 1U) % GVA_CACHE_ENTRIES;
+	} else {
+		walk->page_size = 0UL;
 	}
 
 	if (ret == -EFAULT) {
@@ -467,7 +585,7 @@ int32_t prepare_vm0_memmap(struct acrn_vm *vm)
 {
 	uint32_t i;
 	uint64_t attr_uc = (EPT_RWX | EPT_UNCACHED);
-	uint64_t hv_hpa;
+	uint64_t hv_hpa, map_bottom, map_top, run_start, run_end;
 	uint64_t *pml4_page = (uint64_t *)vm->arch_vm.nworld_eptp;
 
 	const struct e820_entry *entry;
@@ -482,17 +600,42 @@ int32_t prepare_vm0_memmap(struct acrn_vm *vm)
 		panic("Please configure VM0_ADDRESS_SPACE correctly!\n");
 	}
 
-	/* create real ept map for all ranges with UC */
-	ept_mr_add(vm, pml4_page, p_e820_mem_info->mem_bottom, p_e820_mem_info->mem_bottom,
-			(p_e820_mem_info->mem_top - p_e820_mem_info->mem_bottom), attr_uc);
+	/*
+	 * create real ept map for all ranges with UC, widened to 1G boundaries
+	 * where the address space allows, so the ends take 1G pages as well
+	 */
+	map_bottom = p_e820_mem_info->mem_bottom & PDPTE_MASK;
+	map_top = (p_e820_mem_info->mem_top + PDPTE_SIZE - 1UL) & PDPTE_MASK;
+	if (map_top > EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZE)) {
+		map_top = p_e820_mem_info->mem_top;
+	}
+	(void)ept_mr_add(vm, pml4_page, map_bottom, map_bottom, (map_top - map_bottom), attr_uc);
 
-	/* update ram entries to WB attr */
+	/*
+	 * update ram entries to WB attr; contiguous ram entries are merged into
+	 * one run first, so a large page is only split where a real hole or
+	 * non-ram entry starts, and the EPT/IOMMU flush is done once per run
+	 */
+	run_start = 0UL;
+	run_end = 0UL;
 	for (i = 0U; i < entries_count; i++) {
 		entry = p_e820 + i;
-		if (entry->type == E820_TYPE_RAM) {
-			ept_mr_modify(vm, pml4_page, entry->baseaddr, entry->length, EPT_WB, EPT_MT_MASK);
+		if (entry->type != E820_TYPE_RAM) {
+			continue;
+		}
+		if ((run_end != run_start) && (entry->baseaddr == run_end)) {
+			run_end += entry->length;
+		} else {
+			if (run_end != run_start) {
+				(void)ept_mr_modify(vm, pml4_page, run_start, (run_end - run_start), EPT_WB, EPT_MT_MASK);
+			}
+			run_start = entry->baseaddr;
+			run_end = entry->baseaddr + entry->length;
 		}
 	}
+	if (run_end != run_start) {
+		(void)ept_mr_modify(vm, pml4_page, run_start, (run_end - run_start), EPT_WB, EPT_MT_MASK);
+	}
 
 	dev_dbg(ACRN_DBG_GUEST, "VM0 e820 layout:\n");
 	for (i = 0U; i < entries_count; i++) {
@@ -506,6 +649,6 @@ int32_t prepare_vm0_memmap(struct acrn_vm *vm)
 	 * will cause EPT violation if sos accesses hv memory
 	 */
 	hv_hpa = get_hv_image_base();
-	ept_mr_del(vm, pml4_page, hv_hpa, CONFIG_HV_RAM_SIZE);
+	(void)ept_mr_del(vm, pml4_page, hv_hpa, CONFIG_HV_RAM_SIZE);
 	return 0;
 }
@@ -1780,8 +1780,12 @@ static int32_t decode_opcode(struct instr_emul_vie *vie)
 	 * If w bit of opcode is 1, the operand size is decided
 	 * by prefix and default operand size attribute (handled
 	 * in decode_prefixes).
+	 * The w bit of MOVZX/MOVSX tells the size of the source, opsize
+	 * stays the one of the destination register, see vie_mem_size().
 	 */
-	if ((ret == 0) && ((vie->opcode & 0x1U) == 0U)) {
+	if ((ret == 0) && ((vie->opcode & 0x1U) == 0U) &&
+			(vie->op.op_type != VIE_OP_TYPE_MOVZX) &&
+			(vie->op.op_type != VIE_OP_TYPE_MOVSX)) {
 		vie->opsize = 1U;
 	}
 
@@ -2134,6 +2138,154 @@ static int32_t local_decode_instruction(enum vm_cpu_mode cpu_mode,
 	return 0;
 }
 
+/* Size of the memory access of a decoded instruction */
+static uint8_t vie_mem_size(const struct instr_emul_vie *vie)
+{
+	uint8_t size = vie->opsize;
+
+	if ((vie->op.op_type == VIE_OP_TYPE_MOVZX) || (vie->op.op_type == VIE_OP_TYPE_MOVSX)) {
+		size = ((vie->opcode & 0x1U) != 0U) ? 2U : 1U;
+	}
+
+	return size;
+}
+
+/*
+ * MOV between a register and memory and MOVZX make most of the MMIO
+ * accesses. They are recognized from their prefixes, opcode and ModRM:reg
+ * alone: the instruction length comes with the VM exit, and the memory
+ * operand went through the guest paging checks of the MMU before the EPT
+ * violation, so its addressing bytes need no decoding. Anything else,
+ * including prefixes other than the operand size and REX ones, is left
+ * to the full decoder. vie is left untouched then.
+ */
+static bool fast_decode_mov(enum vm_cpu_mode cpu_mode, bool cs_d, struct instr_emul_vie *vie)
+{
+	const struct instr_emul_vie_op *op = &one_byte_opcodes[0];
+	const uint8_t *inst = vie->inst;
+	uint8_t i = 0U;
+	uint8_t opcode, modrm, rex = 0U;
+	bool opsize_override = false;
+	bool two_byte = false;
+	bool ret = false;
+
+	if (inst[i] == 0x66U) {
+		opsize_override = true;
+		i++;
+	}
+
+	if ((cpu_mode == CPU_MODE_64BIT) && ((inst[i] & 0xF0U) == 0x40U)) {
+		rex = inst[i];
+		i++;
+	}
+
+	if (inst[i] == 0x0FU) {
+		two_byte = true;
+		i++;
+	}
+
+	/* the opcode and the ModRM byte */
+	if ((cpu_mode != CPU_MODE_REAL) && ((i + 2U) <= vie->num_valid)) {
+		opcode = inst[i];
+		modrm = inst[i + 1U];
+
+		if (two_byte) {
+			if ((opcode == 0xB6U) || (opcode == 0xB7U)) {
+				op = &two_byte_opcodes[opcode];
+			}
+		} else if ((opcode >= 0x88U) && (opcode <= 0x8BU)) {
+			op = &one_byte_opcodes[opcode];
+		} else {
+			/* not a MOV to or from a register */
+		}
+
+		if ((op->op_type != VIE_OP_TYPE_NONE) && ((modrm >> 6U) != VIE_MOD_DIRECT)) {
+			vie->op = *op;
+			vie->opcode = opcode;
+			vie->opsize_override = opsize_override ? 1U : 0U;
+			vie->rex_present = (rex != 0U) ? 1U : 0U;
+			vie->rex_w = ((rex & 0x8U) != 0U) ? 1U : 0U;
+			vie->rex_r = ((rex & 0x4U) != 0U) ? 1U : 0U;
+
+			if (cpu_mode == CPU_MODE_64BIT) {
+				vie->addrsize = 8U;
+				vie->opsize = (vie->rex_w != 0U) ? 8U : (opsize_override ? 2U : 4U);
+			} else if (cs_d) {
+				vie->addrsize = 4U;
+				vie->opsize = opsize_override ? 2U : 4U;
+			} else {
+				vie->addrsize = 2U;
+				vie->opsize = opsize_override ? 4U : 2U;
+			}
+
+			if (!two_byte && ((opcode & 0x1U) == 0U)) {
+				vie->opsize = 1U;
+			}
+
+			vie->mod = (modrm >> 6U) & 0x3U;
+			vie->reg = ((modrm >> 3U) & 0x7U) | (vie->rex_r << 3U);
+			vie->num_processed = vie->num_valid;
+			vie->decoded = 1U;
+			ret = true;
+		}
+	}
+
+	return ret;
+}
+
+static struct decode_cache_entry *decode_cache_slot(struct acrn_vcpu *vcpu,
+		const struct instr_emul_vie *vie, enum vm_cpu_mode cpu_mode, bool cs_d)
+{
+	uint32_t hash = 2166136261U;	/* FNV-1a */
+	uint8_t i;
+
+	for (i = 0U; i < vie->num_valid; i++) {
+		hash = (hash ^ vie->inst[i]) * 16777619U;
+	}
+	hash = (hash ^ (uint32_t)cpu_mode) * 16777619U;
+	hash = (hash ^ (cs_d ? 1U : 0U)) * 16777619U;
+
+	return &per_cpu(decode_cache, vcpu->pcpu_id).entries[hash & (DECODE_CACHE_ENTRIES - 1U)];
+}
+
+static bool decode_cache_match(const struct decode_cache_entry *entry,
+		const struct instr_emul_vie *vie, enum vm_cpu_mode cpu_mode, bool cs_d)
+{
+	uint8_t i;
+	bool match = (entry->vie.num_valid == vie->num_valid) &&
+			(entry->cpu_mode == cpu_mode) && (entry->cs_d == cs_d);
+
+	for (i = 0U; match && (i < vie->num_valid); i++) {
+		match = (entry->vie.inst[i] == vie->inst[i]);
+	}
+
+	return match;
+}
+
+/*
+ * The bytes are always fetched again, as guest code can change under the
+ * same RIP; only the decode of bytes seen before is skipped.
+ */
+static int32_t cached_decode_instruction(struct acrn_vcpu *vcpu, enum vm_cpu_mode cpu_mode,
+				bool cs_d, struct instr_emul_vie *vie)
+{
+	struct decode_cache_entry *entry = decode_cache_slot(vcpu, vie, cpu_mode, cs_d);
+	int32_t ret = 0;
+
+	if (decode_cache_match(entry, vie, cpu_mode, cs_d)) {
+		*vie = entry->vie;
+	} else {
+		ret = local_decode_instruction(cpu_mode, cs_d, vie);
+		if (ret == 0) {
+			entry->vie = *vie;
+			entry->cpu_mode = cpu_mode;
+			entry->cs_d = cs_d;
+		}
+	}
+
+	return ret;
+}
+
 /* for instruction MOVS/STO, check the gva gotten from DI/SI. */
 static int32_t instr_check_di(struct acrn_vcpu *vcpu, struct instr_emul_ctxt *emul_ctxt)
 {
@@ -2265,7 +2417,12 @@ int32_t decode_instruction(struct acrn_vcpu *vcpu)
 	get_guest_paging_info(vcpu, emul_ctxt, csar);
 	cpu_mode = get_vcpu_mode(vcpu);
 
-	retval = local_decode_instruction(cpu_mode, seg_desc_def32(csar),
+	if (fast_decode_mov(cpu_mode, seg_desc_def32(csar), &emul_ctxt->vie)) {
+		/* the MMU checked the memory operand already */
+		return (int32_t)vie_mem_size(&emul_ctxt->vie);
+	}
+
+	retval = cached_decode_instruction(vcpu, cpu_mode, seg_desc_def32(csar),
 		&emul_ctxt->vie);
 
 	if (retval != 0) {
@@ -2298,7 +2455,87 @@ int32_t decode_instruction(struct acrn_vcpu *vcpu)
 		}
 	}
 
-	return (int32_t)(emul_ctxt->vie.opsize);
+	return (int32_t)vie_mem_size(&emul_ctxt->vie);
+}
+
+/*
+ * Tell if the element a string instruction points to with seg:reg follows
+ * the one just accessed, in the same page of the guest linear space.
+ */
+static bool is_next_string_elem(const struct acrn_vcpu *vcpu, const struct instr_emul_vie *vie,
+		enum cpu_reg_name seg, enum cpu_reg_name reg, bool down)
+{
+	struct seg_desc desc;
+	enum vm_cpu_mode cpu_mode = get_vcpu_mode(vcpu);
+	uint64_t off, prev_off, gla, prev_gla, lo, hi;
+	uint64_t size = (uint64_t)vie->opsize;
+	bool ret = false;
+
+	vm_get_seg_desc(seg, &desc);
+	off = vm_get_register(vcpu, reg);
+	prev_off = down ? (off + size) : (off - size);
+
+	if ((vie_calculate_gla(cpu_mode, seg, &desc, off, vie->addrsize, &gla) == 0) &&
+			(vie_calculate_gla(cpu_mode, seg, &desc, prev_off, vie->addrsize, &prev_gla) == 0)) {
+		lo = down ? gla : prev_gla;
+		hi = (down ? prev_gla : gla) + size - 1UL;
+		/* no wrap of the offset or of the linear address */
+		ret = ((hi - lo) == ((2UL * size) - 1UL)) && ((lo >> PAGE_SHIFT) == (hi >> PAGE_SHIFT));
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Set up the next iteration of a REP MOVS/STOS on MMIO
+ *
+ * The iterations of a repeated string instruction are done in the
+ * hypervisor, one after another, as long as the MMIO element and the memory
+ * one follow the previous ones in the same page: the guest mappings checked
+ * for the first of them then hold for the next. Otherwise the instruction is
+ * re-executed by the guest and exits again.
+ *
+ * @param vcpu The virtual CPU whose MMIO access was just completed
+ *
+ * @pre vcpu != NULL && vcpu->req.type is REQ_MMIO or REQ_WP
+ *
+ * @return true if vcpu->req is updated for the next iteration, false if the
+ * instruction is not a repeated string one, is completed or leaves the page.
+ */
+bool emulate_string_next(struct acrn_vcpu *vcpu)
+{
+	struct instr_emul_vie *vie = &per_cpu(g_inst_ctxt, vcpu->pcpu_id).vie;
+	struct mmio_request *mmio_req = &vcpu->req.reqs.mmio;
+	enum cpu_reg_name src_seg;
+	uint64_t size = (uint64_t)vie->opsize;
+	bool down, is_mmio_write, ret = false;
+
+	/* rip is retained as long as the count register is not zero */
+	if (((vie->op.op_type == VIE_OP_TYPE_MOVS) || (vie->op.op_type == VIE_OP_TYPE_STOS)) &&
+			((vie->repz_present | vie->repnz_present) != 0U) && (vcpu->arch.inst_len == 0U)) {
+		down = ((vm_get_register(vcpu, CPU_REG_RFLAGS) & PSL_D) != 0UL);
+		is_mmio_write = (mmio_req->direction == REQUEST_WRITE);
+		src_seg = (vie->seg_override != 0U) ? (vie->segment_register) : CPU_REG_DS;
+
+		if (vie->op.op_type == VIE_OP_TYPE_STOS) {
+			ret = is_next_string_elem(vcpu, vie, CPU_REG_ES, CPU_REG_RDI, down);
+		} else {
+			ret = is_next_string_elem(vcpu, vie, CPU_REG_ES, CPU_REG_RDI, down) &&
+				is_next_string_elem(vcpu, vie, src_seg, CPU_REG_RSI, down);
+		}
+
+		if (ret) {
+			mmio_req->address = down ? (mmio_req->address - size) : (mmio_req->address + size);
+			if (is_mmio_write) {
+				mmio_req->value = 0UL;
+			} else {
+				/* MOVS from MMIO, the destination is memory */
+				vie->dst_gpa = down ? (vie->dst_gpa - size) : (vie->dst_gpa + size);
+			}
+		}
+	}
+
+	return ret;
 }
 
 int32_t emulate_instruction(const struct acrn_vcpu *vcpu)
@@ -194,7 +194,25 @@ struct instr_emul_ctxt {
 	struct acrn_vcpu *vcpu;
 };
 
+#define DECODE_CACHE_ENTRIES	16U	/* power of 2 */
+
+/*
+ * Instructions decoded on this pCPU, indexed by a hash of the bytes.
+ * The decode only depends on the bytes, the CPU mode and CS.D, so an
+ * entry matching all three is what the decoder would give again.
+ */
+struct decode_cache_entry {
+	struct instr_emul_vie vie;	/* 0 num_valid for an unused entry */
+	enum vm_cpu_mode cpu_mode;
+	bool cs_d;
+};
+
+struct decode_cache {
+	struct decode_cache_entry entries[DECODE_CACHE_ENTRIES];
+};
+
 int32_t emulate_instruction(const struct acrn_vcpu *vcpu);
 int32_t decode_instruction(struct acrn_vcpu *vcpu);
+bool emulate_string_next(struct acrn_vcpu *vcpu);
 
 #endif
@@ -146,6 +146,69 @@ inline void vcpu_set_cr4(struct acrn_vcpu *vcpu, uint64_t val)
 	vmx_write_cr4(vcpu, val);
 }
 
+/* VMCS encodings of enum vmcs_cached_field */
+static const uint32_t vmcs_cached_encoding[VMCS_CACHED_FIELDS] = {
+	[VMCS_EXIT_QUALIFICATION] = VMX_EXIT_QUALIFICATION,
+	[VMCS_GUEST_PHYSICAL_ADDR] = VMX_GUEST_PHYSICAL_ADDR_FULL,
+	[VMCS_GUEST_LINEAR_ADDR] = VMX_GUEST_LINEAR_ADDR,
+	[VMCS_EXIT_INT_INFO] = VMX_EXIT_INT_INFO,
+	[VMCS_EXIT_INT_ERROR_CODE] = VMX_EXIT_INT_ERROR_CODE,
+	[VMCS_IDT_VEC_INFO] = VMX_IDT_VEC_INFO_FIELD,
+	[VMCS_IDT_VEC_ERROR_CODE] = VMX_IDT_VEC_ERROR_CODE,
+	[VMCS_GUEST_INTERRUPTIBILITY] = VMX_GUEST_INTERRUPTIBILITY_INFO,
+	[VMCS_ENTRY_INT_INFO] = VMX_ENTRY_INT_INFO_FIELD,
+	[VMCS_ENTRY_EXCEPTION_ERROR_CODE] = VMX_ENTRY_EXCEPTION_ERROR_CODE,
+	[VMCS_PROC_VM_EXEC_CONTROLS] = VMX_PROC_VM_EXEC_CONTROLS,
+};
+
+/*
+ * The cache is only touched on the pCPU of the vCPU, so the bitmaps need no
+ * locked operations. A 64-bit VMREAD/VMWRITE covers all field widths in
+ * IA-32e mode.
+ */
+uint64_t vcpu_vmcs_read(struct acrn_vcpu *vcpu, enum vmcs_cached_field field)
+{
+	struct vmcs_cache *cache = &vcpu->arch.vmcs_cache;
+	uint32_t bit = 1U << (uint32_t)field;
+
+	if ((cache->cached & bit) == 0U) {
+		cache->val[field] = exec_vmread64(vmcs_cached_encoding[field]);
+		cache->cached |= bit;
+	}
+
+	return cache->val[field];
+}
+
+void vcpu_vmcs_write(struct acrn_vcpu *vcpu, enum vmcs_cached_field field, uint64_t val)
+{
+	struct vmcs_cache *cache = &vcpu->arch.vmcs_cache;
+	uint32_t bit = 1U << (uint32_t)field;
+
+	cache->val[field] = val;
+	cache->cached |= bit;
+	cache->dirty |= bit;
+}
+
+void vcpu_vmcs_cache_reset(struct acrn_vcpu *vcpu)
+{
+	vcpu->arch.vmcs_cache.cached = 0U;
+	vcpu->arch.vmcs_cache.dirty = 0U;
+}
+
+static void vcpu_vmcs_cache_flush(struct acrn_vcpu *vcpu)
+{
+	struct vmcs_cache *cache = &vcpu->arch.vmcs_cache;
+	uint32_t dirty = cache->dirty;
+	uint16_t field;
+
+	while (dirty != 0U) {
+		field = ffs64((uint64_t)dirty);
+		exec_vmwrite64(vmcs_cached_encoding[field], cache->val[field]);
+		dirty &= ~(1U << field);
+	}
+	cache->dirty = 0U;
+}
+
 uint64_t vcpu_get_guest_msr(const struct acrn_vcpu *vcpu, uint32_t msr)
 {
 	uint32_t index = vmsr_get_guest_msr_index(msr);
@@ -226,6 +289,9 @@ void set_vcpu_regs(struct acrn_vcpu *vcpu, struct acrn_vcpu_regs *vcpu_regs)
 	ectx->cs.base = vcpu_regs->cs_base;
 	ectx->cs.limit = vcpu_regs->cs_limit;
 
+	ectx->fs.base = vcpu_regs->fs_base;
+	ectx->gs.base = vcpu_regs->gs_base;
+
 	ectx->gdtr.base = vcpu_regs->gdt.base;
 	ectx->gdtr.limit = vcpu_regs->gdt.limit;
 
@@ -272,6 +338,48 @@ void set_vcpu_regs(struct acrn_vcpu *vcpu, struct acrn_vcpu_regs *vcpu_regs)
 			vcpu_regs->cr0);
 }
 
+/**
+ * @pre vcpu != NULL && vcpu_regs != NULL
+ * @pre get_cpu_id() == vcpu->pcpu_id
+ */
+void get_vcpu_regs(struct acrn_vcpu *vcpu, struct acrn_vcpu_regs *vcpu_regs)
+{
+	struct run_context *ctx = &(vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx);
+
+	(void)memset(vcpu_regs, 0U, sizeof(struct acrn_vcpu_regs));
+
+	(void)memcpy_s(&(vcpu_regs->gprs), sizeof(struct acrn_gp_regs),
+			&(ctx->guest_cpu_regs), sizeof(struct acrn_gp_regs));
+	vcpu_regs->gprs.rsp = vcpu_get_rsp(vcpu);
+
+	vcpu_regs->gdt.base = exec_vmread(VMX_GUEST_GDTR_BASE);
+	vcpu_regs->gdt.limit = (uint16_t)exec_vmread32(VMX_GUEST_GDTR_LIMIT);
+	vcpu_regs->idt.base = exec_vmread(VMX_GUEST_IDTR_BASE);
+	vcpu_regs->idt.limit = (uint16_t)exec_vmread32(VMX_GUEST_IDTR_LIMIT);
+
+	vcpu_regs->rip = vcpu_get_rip(vcpu);
+	vcpu_regs->cr0 = vcpu_get_cr0(vcpu);
+	vcpu_regs->cr3 = exec_vmread(VMX_GUEST_CR3);
+	vcpu_regs->cr4 = vcpu_get_cr4(vcpu);
+	vcpu_regs->ia32_efer = vcpu_get_efer(vcpu);
+	vcpu_regs->rflags = vcpu_get_rflags(vcpu);
+
+	vcpu_regs->cs_base = exec_vmread(VMX_GUEST_CS_BASE);
+	vcpu_regs->cs_ar = exec_vmread32(VMX_GUEST_CS_ATTR);
+	vcpu_regs->cs_limit = exec_vmread32(VMX_GUEST_CS_LIMIT);
+	vcpu_regs->fs_base = exec_vmread(VMX_GUEST_FS_BASE);
+	vcpu_regs->gs_base = exec_vmread(VMX_GUEST_GS_BASE);
+
+	vcpu_regs->cs_sel = exec_vmread16(VMX_GUEST_CS_SEL);
+	vcpu_regs->ss_sel = exec_vmread16(VMX_GUEST_SS_SEL);
+	vcpu_regs->ds_sel = exec_vmread16(VMX_GUEST_DS_SEL);
+	vcpu_regs->es_sel = exec_vmread16(VMX_GUEST_ES_SEL);
+	vcpu_regs->fs_sel = exec_vmread16(VMX_GUEST_FS_SEL);
+	vcpu_regs->gs_sel = exec_vmread16(VMX_GUEST_GS_SEL);
+	vcpu_regs->ldt_sel = exec_vmread16(VMX_GUEST_LDTR_SEL);
+	vcpu_regs->tr_sel = exec_vmread16(VMX_GUEST_TR_SEL);
+}
+
 static struct acrn_vcpu_regs realmode_init_regs = {
 	.gdt = {
 		.limit = 0xFFFFU,
@@ -366,6 +474,7 @@ int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn
 			is_vcpu_bsp(vcpu) ? "PRIMARY" : "SECONDARY");
 
 	vcpu->arch.vpid = allocate_vpid();
+	vcpu->sched.prio = vm->sched_prio;
 
 	/* Initialize exception field in VCPU context */
 	vcpu->arch.exception_info.exception = VECTOR_INVALID;
@@ -406,6 +515,7 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 	struct run_context *ctx =
 		&vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
 	int64_t status = 0;
+	uint64_t entry_tsc;
 
 	if (bitmap_test_and_clear_lock(CPU_REG_RIP, &vcpu->reg_updated))
 		exec_vmwrite(VMX_GUEST_RIP, ctx->rip);
@@ -415,6 +525,7 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 		exec_vmwrite64(VMX_GUEST_IA32_EFER_FULL, ctx->ia32_efer);
 	if (bitmap_test_and_clear_lock(CPU_REG_RFLAGS, &vcpu->reg_updated))
 		exec_vmwrite(VMX_GUEST_RFLAGS, ctx->rflags);
+	vcpu_vmcs_cache_flush(vcpu);
 
 	/* If this VCPU is not already launched, launch it */
 	if (!vcpu->launched) {
@@ -446,7 +557,9 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 #endif
 
 		/* Launch the VM */
+		entry_tsc = rdtsc();
 		status = vmx_vmrun(ctx, VM_LAUNCH, ibrs_type);
+		vcpu->sched.guest_time += rdtsc() - entry_tsc;
 
 		/* See if VM launched successfully */
 		if (status == 0) {
@@ -459,19 +572,25 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 		/* This VCPU was already launched, check if the last guest
 		 * instruction needs to be repeated and resume VCPU accordingly
 		 */
+		/* RIP only moves past the instruction, if any, just emulated */
 		instlen = vcpu->arch.inst_len;
-		rip = vcpu_get_rip(vcpu);
-		exec_vmwrite(VMX_GUEST_RIP, ((rip+(uint64_t)instlen) &
-				0xFFFFFFFFFFFFFFFFUL));
+		if (instlen != 0U) {
+			rip = vcpu_get_rip(vcpu);
+			exec_vmwrite(VMX_GUEST_RIP, ((rip+(uint64_t)instlen) &
+					0xFFFFFFFFFFFFFFFFUL));
+		}
 #ifdef CONFIG_L1D_FLUSH_VMENTRY_ENABLED
 		cpu_l1d_flush();
 #endif
 
 		/* Resume the VM */
+		entry_tsc = rdtsc();
 		status = vmx_vmrun(ctx, VM_RESUME, ibrs_type);
+		vcpu->sched.guest_time += rdtsc() - entry_tsc;
 	}
 
 	vcpu->reg_cached = 0UL;
+	vcpu->arch.vmcs_cache.cached = 0U;
 
 	cs_attr = exec_vmread32(VMX_GUEST_CS_ATTR);
 	ia32_efer = vcpu_get_efer(vcpu);
@@ -511,8 +630,19 @@ int32_t shutdown_vcpu(__unused struct acrn_vcpu *vcpu)
  */
 void offline_vcpu(struct acrn_vcpu *vcpu)
 {
+	struct sched_context *ctx = &per_cpu(sched_ctx, vcpu->pcpu_id);
+
 	vlapic_free(vcpu);
-	per_cpu(ever_run_vcpu, vcpu->pcpu_id) = NULL;
+	if (per_cpu(ever_run_vcpu, vcpu->pcpu_id) == vcpu) {
+		per_cpu(ever_run_vcpu, vcpu->pcpu_id) = NULL;
+	}
+	if (ctx->vmcs_vcpu == vcpu) {
+		ctx->vmcs_vcpu = NULL;
+	}
+	if (ctx->fpu_vcpu == vcpu) {
+		ctx->fpu_vcpu = NULL;
+	}
+	vpmu_put(vcpu);
 	free_pcpu(vcpu->pcpu_id);
 	vcpu->state = VCPU_OFFLINE;
 }
@@ -545,6 +675,10 @@ void reset_vcpu(struct acrn_vcpu *vcpu)
 	vcpu->arch.irq_window_enabled = 0;
 	vcpu->arch.inject_event_pending = false;
 	(void)memset(vcpu->arch.vmcs, 0U, PAGE_SIZE);
+	vcpu->sched.xsave_valid = false;
+	vcpu->sched.halted = 0U;
+	vcpu->sched.steal_msr = 0UL;
+	vcpu->sched.steal_page = NULL;
 
 	for (i = 0; i < NR_WORLD; i++) {
 		(void)memset(&vcpu->arch.contexts[i], 0U,
@@ -590,6 +724,7 @@ void resume_vcpu(struct acrn_vcpu *vcpu)
 
 	get_schedule_lock(vcpu->pcpu_id);
 	vcpu->state = vcpu->prev_state;
+	vcpu->sched.halted = 0U;
 
 	if (vcpu->state == VCPU_RUNNING) {
 		add_vcpu_to_runqueue(vcpu);
@@ -609,6 +744,46 @@ void schedule_vcpu(struct acrn_vcpu *vcpu)
 	release_schedule_lock(vcpu->pcpu_id);
 }
 
+static bool vcpu_has_pending_event(struct acrn_vcpu *vcpu)
+{
+	return ((vcpu->arch.pending_req != 0UL) ||
+		(vlapic_pending_intr(vcpu_vlapic(vcpu), NULL) != 0));
+}
+
+void halt_vcpu(struct acrn_vcpu *vcpu)
+{
+	get_schedule_lock(vcpu->pcpu_id);
+	/*
+	 * Publish the halted flag before looking for events: a waker sets
+	 * its event before it tests the flag, so one of us sees the other.
+	 */
+	(void)atomic_swap32(&vcpu->sched.halted, 1U);
+	if (vcpu_has_pending_event(vcpu)) {
+		vcpu->sched.halted = 0U;
+	} else {
+		remove_vcpu_from_runqueue(vcpu);
+		make_reschedule_request(vcpu);
+	}
+	release_schedule_lock(vcpu->pcpu_id);
+}
+
+void wake_vcpu(struct acrn_vcpu *vcpu)
+{
+	if (atomic_load32(&vcpu->sched.halted) == 0U) {
+		return;
+	}
+
+	get_schedule_lock(vcpu->pcpu_id);
+	if (vcpu->sched.halted != 0U) {
+		vcpu->sched.halted = 0U;
+		if (vcpu->state == VCPU_RUNNING) {
+			add_vcpu_to_runqueue(vcpu);
+			make_reschedule_request(vcpu);
+		}
+	}
+	release_schedule_lock(vcpu->pcpu_id);
+}
+
 /* help function for vcpu create */
 int32_t prepare_vcpu(struct acrn_vm *vm, uint16_t pcpu_id)
 {
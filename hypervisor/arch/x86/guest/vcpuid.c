@@ -6,35 +6,47 @@
 
 #include <hypervisor.h>
 
+/*
+ * Index of the first entry not below leaf/subleaf. set_vcpuid_entries()
+ * adds the entries by increasing leaf, then subleaf, the table is sorted.
+ */
+static uint32_t vcpuid_lower_bound(const struct acrn_vm *vm, uint32_t leaf, uint32_t subleaf)
+{
+	uint32_t lo = 0U, hi = vm->vcpuid_entry_nr, mid;
+	const struct vcpuid_entry *tmp;
+
+	while (lo < hi) {
+		mid = (lo + hi) >> 1U;
+		tmp = &vm->vcpuid_entries[mid];
+		if ((tmp->leaf < leaf) || ((tmp->leaf == leaf) && (tmp->subleaf < subleaf))) {
+			lo = mid + 1U;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
 static inline struct vcpuid_entry *find_vcpuid_entry(const struct acrn_vcpu *vcpu,
 					uint32_t leaf_arg, uint32_t subleaf)
 {
-	uint32_t i = 0U, nr, half;
+	uint32_t i;
 	struct vcpuid_entry *entry = NULL;
 	struct acrn_vm *vm = vcpu->vm;
 	uint32_t leaf = leaf_arg;
 
-	nr = vm->vcpuid_entry_nr;
-	half = nr >> 1U;
-	if (vm->vcpuid_entries[half].leaf < leaf) {
-		i = half;
-	}
-
-	for (; i < nr; i++) {
-		struct vcpuid_entry *tmp = &vm->vcpuid_entries[i];
-
-		if (tmp->leaf < leaf) {
-			continue;
-		} else if (tmp->leaf == leaf) {
-			if (((tmp->flags & CPUID_CHECK_SUBLEAF) != 0U) &&
-				(tmp->subleaf != subleaf)) {
-				continue;
+	/* the first entry of the leaf, the only one without CPUID_CHECK_SUBLEAF */
+	i = vcpuid_lower_bound(vm, leaf, 0U);
+	if ((i < vm->vcpuid_entry_nr) && (vm->vcpuid_entries[i].leaf == leaf)) {
+		if ((vm->vcpuid_entries[i].flags & CPUID_CHECK_SUBLEAF) != 0U) {
+			i = vcpuid_lower_bound(vm, leaf, subleaf);
+			if ((i < vm->vcpuid_entry_nr) && (vm->vcpuid_entries[i].leaf == leaf) &&
+					(vm->vcpuid_entries[i].subleaf == subleaf)) {
+				entry = &vm->vcpuid_entries[i];
 			}
-			entry = tmp;
-			break;
 		} else {
-			/* tmp->leaf > leaf */
-			break;
+			entry = &vm->vcpuid_entries[i];
 		}
 	}
 
@@ -63,6 +75,35 @@ static inline struct vcpuid_entry *find_vcpuid_entry(const struct acrn_vcpu *vcp
 	return entry;
 }
 
+/*
+ * The leaves telling the TSC frequency, when the TSC of the VM is scaled:
+ * the crystal ratio of leaf 0x15 only fits the native TSC, it is hidden.
+ */
+static void set_vcpuid_tsc_freq(const struct acrn_vm *vm, struct vcpuid_entry *entry)
+{
+	uint32_t guest_khz = vm->arch_vm.tsc_khz;
+
+	if (vm->arch_vm.tsc_multiplier != 0UL) {
+		switch (entry->leaf) {
+		case 0x15U:
+			entry->eax = 0U;
+			entry->ebx = 0U;
+			entry->ecx = 0U;
+			break;
+		case 0x16U:
+			entry->eax = guest_khz / 1000U;
+			entry->ebx = entry->eax;
+			break;
+		case 0x40000010U:
+			entry->eax = guest_khz;
+			break;
+		default:
+			/* not about the TSC */
+			break;
+		}
+	}
+}
+
 static inline int32_t set_vcpuid_entry(struct acrn_vm *vm,
 				const struct vcpuid_entry *entry)
 {
@@ -78,6 +119,7 @@ static inline int32_t set_vcpuid_entry(struct acrn_vm *vm,
 		tmp = &vm->vcpuid_entries[vm->vcpuid_entry_nr];
 		vm->vcpuid_entry_nr++;
 		(void)memcpy_s(tmp, entry_size, entry, entry_size);
+		set_vcpuid_tsc_freq(vm, tmp);
 		ret = 0;
 	}
 	return ret;
@@ -92,8 +134,35 @@ static void init_vcpuid_entry(uint32_t leaf, uint32_t subleaf,
 	entry->leaf = leaf;
 	entry->subleaf = subleaf;
 	entry->flags = flags;
+	entry->hits = 0UL;
 
 	switch (leaf) {
+	/*
+	 * Leaf 0x01, the VM wide part. guest_cpuid() patches the initial
+	 * APIC ID and OSXSAVE per vCPU.
+	 */
+	case 0x01U:
+		cpuid(leaf, &entry->eax, &entry->ebx, &entry->ecx, &entry->edx);
+
+#ifndef CONFIG_MTRR_ENABLED
+		/* mask mtrr */
+		entry->edx &= ~CPUID_EDX_MTRR;
+#endif
+
+		/* mask pcid */
+		entry->ecx &= ~CPUID_ECX_PCID;
+
+		/*mask vmx to guest os */
+		entry->ecx &= ~CPUID_ECX_VMX;
+
+		/*no xsave support for guest if it is not enabled on host*/
+		if ((entry->ecx & CPUID_ECX_OSXSAVE) == 0U) {
+			entry->ecx &= ~CPUID_ECX_XSAVE;
+		}
+
+		entry->ecx &= ~CPUID_ECX_OSXSAVE;
+		break;
+
 	case 0x07U:
 		if (subleaf == 0U) {
 			cpuid(leaf,
@@ -152,6 +221,19 @@ static void init_vcpuid_entry(uint32_t leaf, uint32_t subleaf,
 		break;
 	}
 
+	/*
+	 * Leaf 0x40000001 - ACRN paravirtual features.
+	 *
+	 * EAX: ACRN_FEATURE_* bits.
+	 * EBX, ECX, EDX: RESERVED (reserved fields are set to zero).
+	 */
+	case ACRN_CPUID_FEATURES:
+		entry->eax = ACRN_FEATURE_STEAL_TIME;
+		entry->ebx = 0U;
+		entry->ecx = 0U;
+		entry->edx = 0U;
+		break;
+
 	/*
 	 * Leaf 0x40000010 - Timing Information.
 	 * This leaf returns the current TSC frequency and
@@ -197,8 +279,8 @@ int32_t set_vcpuid_entries(struct acrn_vm *vm)
 	vm->vcpuid_level = limit;
 
 	for (i = 1U; i <= limit; i++) {
-		/* cpuid 1/0xb is percpu related */
-		if ((i == 1U) || (i == 0xbU)) {
+		/* cpuid 0xb is percpu related */
+		if (i == 0xbU) {
 			continue;
 		}
 
@@ -247,9 +329,16 @@ int32_t set_vcpuid_entries(struct acrn_vm *vm)
 			}
 			break;
 
-		/* These features are disabled */
-		/* PMU is not supported */
 		case 0x0aU:
+			init_vcpuid_entry(i, 0U, 0U, &entry);
+			vpmu_init_cpuid(vm, &entry);
+			result = set_vcpuid_entry(vm, &entry);
+			if (result != 0) {
+				return result;
+			}
+			break;
+
+		/* These features are disabled */
 		/* Intel RDT */
 		case 0x0fU:
 		case 0x10U:
@@ -274,6 +363,12 @@ int32_t set_vcpuid_entries(struct acrn_vm *vm)
 		return result;
 	}
 
+	init_vcpuid_entry(ACRN_CPUID_FEATURES, 0U, 0U, &entry);
+	result = set_vcpuid_entry(vm, &entry);
+	if (result != 0) {
+		return result;
+	}
+
 	init_vcpuid_entry(0x40000010U, 0U, 0U, &entry);
 	result = set_vcpuid_entry(vm, &entry);
 	if (result != 0) {
@@ -306,16 +401,32 @@ void guest_cpuid(struct acrn_vcpu *vcpu,
 	uint32_t leaf = *eax;
 	uint32_t subleaf = *ecx;
 
-	/* vm related */
-	if ((leaf != 0x1U) && (leaf != 0xbU) && (leaf != 0xdU)) {
+	/* vm related, leaf 0x1 has per vcpu fields on top */
+	if ((leaf != 0xbU) && (leaf != 0xdU)) {
 		struct vcpuid_entry *entry =
 			find_vcpuid_entry(vcpu, leaf, subleaf);
 
 		if (entry != NULL) {
+			entry->hits++;
 			*eax = entry->eax;
 			*ebx = entry->ebx;
 			*ecx = entry->ecx;
 			*edx = entry->edx;
+
+			if (entry->leaf == 0x01U) {
+				uint32_t apicid = vlapic_get_apicid(vcpu_vlapic(vcpu));
+
+				/* Patching initial APIC ID */
+				*ebx &= ~APIC_ID_MASK;
+				*ebx |= (apicid <<  APIC_ID_SHIFT);
+
+				if ((*ecx & CPUID_ECX_XSAVE) != 0U) {
+					/*read guest CR4*/
+					if ((exec_vmread(VMX_GUEST_CR4) & CR4_OSXSAVE) != 0UL) {
+						*ecx |= CPUID_ECX_OSXSAVE;
+					}
+				}
+			}
 		} else {
 			*eax = 0U;
 			*ebx = 0U;
@@ -325,42 +436,6 @@ void guest_cpuid(struct acrn_vcpu *vcpu,
 	} else {
 		/* percpu related */
 		switch (leaf) {
-		case 0x01U:
-		{
-			cpuid(leaf, eax, ebx, ecx, edx);
-			uint32_t apicid = vlapic_get_apicid(vcpu_vlapic(vcpu));
-			/* Patching initial APIC ID */
-			*ebx &= ~APIC_ID_MASK;
-			*ebx |= (apicid <<  APIC_ID_SHIFT);
-
-#ifndef CONFIG_MTRR_ENABLED
-			/* mask mtrr */
-			*edx &= ~CPUID_EDX_MTRR;
-#endif
-
-			/* mask pcid */
-			*ecx &= ~CPUID_ECX_PCID;
-
-			/*mask vmx to guest os */
-			*ecx &= ~CPUID_ECX_VMX;
-
-			/*no xsave support for guest if it is not enabled on host*/
-			if ((*ecx & CPUID_ECX_OSXSAVE) == 0U) {
-				*ecx &= ~CPUID_ECX_XSAVE;
-			}
-
-			*ecx &= ~CPUID_ECX_OSXSAVE;
-			if ((*ecx & CPUID_ECX_XSAVE) != 0U) {
-				uint64_t cr4;
-				/*read guest CR4*/
-				cr4 = exec_vmread(VMX_GUEST_CR4);
-				if ((cr4 & CR4_OSXSAVE) != 0UL) {
-					*ecx |= CPUID_ECX_OSXSAVE;
-				}
-			}
-			break;
-		}
-
 		case 0x0bU:
 			/* Patching X2APIC */
 #ifdef CONFIG_PARTITION_MODE
@@ -405,12 +480,24 @@ void guest_cpuid(struct acrn_vcpu *vcpu,
 				*edx = 0U;
 			} else {
 				cpuid_subleaf(leaf, subleaf, eax, ebx, ecx, edx);
+				if (subleaf == 1U) {
+					/* no IA32_XSS component, see MSR_IA32_XSS */
+					*ecx = 0U;
+					*edx = 0U;
+				} else if ((subleaf > 1U) && ((*ecx & CPUID_ECX_XSTATE_SUPERVISOR) != 0U)) {
+					*eax = 0U;
+					*ebx = 0U;
+					*ecx = 0U;
+					*edx = 0U;
+				} else {
+					/* user state component */
+				}
 			}
 			break;
 
 		default:
 			/*
-			 * In this switch statement, leaf shall either be 0x01U or 0x0bU
+			 * In this switch statement, leaf shall either be 0x0bU
 			 * or 0x0dU. All the other cases have been handled properly
 			 * before this switch statement.
 			 * Gracefully return if prior case clauses have not been met.
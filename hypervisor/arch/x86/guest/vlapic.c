@@ -113,19 +113,21 @@ vm_lapic_from_vcpu_id(struct acrn_vm *vm, uint16_t vcpu_id)
 
 static uint16_t vm_apicid2vcpu_id(struct acrn_vm *vm, uint8_t lapicid)
 {
-	uint16_t i;
-	struct acrn_vcpu *vcpu;
+	struct vlapic_dest_map *map = &vm->arch_vm.lapic_dest;
+	uint32_t seq;
+	uint16_t vcpu_id;
 
-	foreach_vcpu(i, vm, vcpu) {
-		struct acrn_vlapic *vlapic = vcpu_vlapic(vcpu);
-		if (vlapic_get_apicid(vlapic) == lapicid) {
-			return vcpu->vcpu_id;
-		}
-	}
+	do {
+		seq = atomic_load32(&map->seq);
+		vcpu_id = map->apicid_to_vcpu[lapicid];
+	} while (((seq & 1U) != 0U) || (seq != atomic_load32(&map->seq)));
 
-	pr_err("%s: bad lapicid %hhu", __func__, lapicid);
+	if (vcpu_id == INVALID_CPU_ID) {
+		pr_err("%s: bad lapicid %hhu", __func__, lapicid);
+		vcpu_id = phys_cpu_num;
+	}
 
-	return phys_cpu_num;
+	return vcpu_id;
 }
 
 static uint64_t
@@ -200,6 +202,137 @@ static inline void vlapic_build_x2apic_id(struct acrn_vlapic *vlapic)
 	lapic->ldr.v = (cluster_id << 16U) | (1U << logical_id);
 }
 
+void vlapic_init_dest_map(struct acrn_vm *vm)
+{
+	struct vlapic_dest_map *map = &vm->arch_vm.lapic_dest;
+	uint32_t i;
+
+	(void)memset((void *)map, 0U, sizeof(*map));
+	spinlock_init(&map->lock);
+	for (i = 0U; i < VLAPIC_XAPIC_MDA_NUM; i++) {
+		map->apicid_to_vcpu[i] = INVALID_CPU_ID;
+	}
+}
+
+/*
+ * Whether an xAPIC with this DFR and LDR is a destination of the 8-bit
+ * logical MDA, in the "Flat Model" a bitmask, in the "Cluster Model" a
+ * cluster and a bitmask of APICs in it.
+ */
+static bool vlapic_xapic_logical_match(uint32_t dfr, uint32_t ldr, uint32_t mda)
+{
+	bool ret;
+
+	if ((dfr & APIC_DFR_MODEL_MASK) == APIC_DFR_MODEL_FLAT) {
+		ret = ((mda & (ldr >> 24U)) != 0U);
+	} else if ((dfr & APIC_DFR_MODEL_MASK) == APIC_DFR_MODEL_CLUSTER) {
+		ret = (((mda >> 4U) & 0xfU) == (ldr >> 28U)) &&
+			((mda & 0xfU & (ldr >> 24U)) != 0U);
+	} else {
+		/* Guest has configured a bad logical model for this vcpu */
+		ret = false;
+	}
+
+	return ret;
+}
+
+/*
+ * Bring the destination map up to date with the APIC ID, LDR, DFR and
+ * mode of the vLAPIC, on any change of them.
+ */
+static void vlapic_update_dest_map(struct acrn_vlapic *vlapic)
+{
+	struct vlapic_dest_map *map = &vlapic->vm->arch_vm.lapic_dest;
+	uint16_t vcpu_id = vlapic->vcpu->vcpu_id;
+	uint64_t bit = 1UL << vcpu_id;
+	uint32_t dfr = vlapic->apic_page.dfr.v;
+	uint32_t ldr = vlapic->apic_page.ldr.v;
+	bool x2apic = is_x2apic_enabled(vlapic);
+	uint32_t i, j, apicid;
+
+	spinlock_obtain(&map->lock);
+	map->seq++;
+	cpu_write_memory_barrier();
+
+	for (i = 0U; i < VLAPIC_XAPIC_MDA_NUM; i++) {
+		if (map->apicid_to_vcpu[i] == vcpu_id) {
+			map->apicid_to_vcpu[i] = INVALID_CPU_ID;
+		}
+	}
+	apicid = vlapic_get_apicid(vlapic);
+	if (apicid < VLAPIC_XAPIC_MDA_NUM) {
+		map->apicid_to_vcpu[apicid] = vcpu_id;
+	}
+
+	for (i = 0U; i < VLAPIC_XAPIC_MDA_NUM; i++) {
+		if (!x2apic && vlapic_xapic_logical_match(dfr, ldr, i)) {
+			map->xapic_logical[i] |= bit;
+		} else {
+			map->xapic_logical[i] &= ~bit;
+		}
+	}
+
+	for (i = 0U; i < map->nr_x2apic_clusters; i++) {
+		for (j = 0U; j < VLAPIC_X2APIC_LDEST_NUM; j++) {
+			map->x2apic_clusters[i].vcpus[j] &= ~bit;
+		}
+	}
+	if (x2apic) {
+		/* the x2APIC LDR follows from the APIC ID, a vCPU never moves */
+		for (i = 0U; i < map->nr_x2apic_clusters; i++) {
+			if (map->x2apic_clusters[i].cluster_id == (ldr >> 16U)) {
+				break;
+			}
+		}
+		if ((i == map->nr_x2apic_clusters) && (i < CONFIG_MAX_VCPUS_PER_VM)) {
+			map->x2apic_clusters[i].cluster_id = ldr >> 16U;
+			map->nr_x2apic_clusters++;
+		}
+		if (i < map->nr_x2apic_clusters) {
+			for (j = 0U; j < VLAPIC_X2APIC_LDEST_NUM; j++) {
+				if ((ldr & (1U << j)) != 0U) {
+					map->x2apic_clusters[i].vcpus[j] |= bit;
+				}
+			}
+		}
+	}
+
+	cpu_write_memory_barrier();
+	map->seq++;
+	spinlock_release(&map->lock);
+}
+
+/* The vCPUs matching a logical destination, in either mode. */
+static uint64_t vlapic_logical_dest(struct acrn_vm *vm, uint32_t dest)
+{
+	const struct vlapic_dest_map *map = &vm->arch_vm.lapic_dest;
+	uint32_t seq, i, ldest;
+	uint16_t bit;
+	uint64_t dmask;
+
+	do {
+		seq = atomic_load32(&map->seq);
+
+		/* xAPIC vLAPICs only look at the low 8 bits of the MDA */
+		dmask = map->xapic_logical[dest & 0xffU];
+
+		for (i = 0U; i < map->nr_x2apic_clusters; i++) {
+			if (map->x2apic_clusters[i].cluster_id == ((dest >> 16U) & 0xFFFFU)) {
+				ldest = dest & 0xFFFFU;
+				bit = ffs64((uint64_t)ldest);
+				while (bit != INVALID_BIT_INDEX) {
+					dmask |= map->x2apic_clusters[i].vcpus[bit];
+					ldest &= ldest - 1U;
+					bit = ffs64((uint64_t)ldest);
+				}
+				break;
+			}
+		}
+	} while (((seq & 1U) != 0U) || (seq != atomic_load32(&map->seq)));
+
+	return dmask;
+}
+
 static void
 vlapic_dfr_write_handler(struct acrn_vlapic *vlapic)
 {
@@ -217,6 +350,8 @@ vlapic_dfr_write_handler(struct acrn_vlapic *vlapic)
 	} else {
 		dev_dbg(ACRN_DBG_LAPIC, "DFR in Unknown Model %#x", lapic->dfr);
 	}
+
+	vlapic_update_dest_map(vlapic);
 }
 
 static void
@@ -227,6 +362,8 @@ vlapic_ldr_write_handler(struct acrn_vlapic *vlapic)
 	lapic = &(vlapic->apic_page);
 	lapic->ldr.v &= ~APIC_LDR_RESERVED;
 	dev_dbg(ACRN_DBG_LAPIC, "vlapic LDR set to %#x", lapic->ldr);
+
+	vlapic_update_dest_map(vlapic);
 }
 
 static inline uint32_t
@@ -278,6 +415,39 @@ static void vlapic_init_timer(struct acrn_vlapic *vlapic)
 	initialize_timer(&vtimer->timer,
 			vlapic_timer_expired, vlapic->vcpu,
 			0UL, 0, 0UL);
+
+	/* latency sensitive VMs keep exact timer deadlines */
+	if (vlapic->vm->sched_prio != SCHED_PRIO_HIGH) {
+		set_timer_slack(&vtimer->timer, us_to_ticks(CONFIG_VLAPIC_TIMER_SLACK_US));
+	}
+}
+
+/**
+ * @pre vlapic != NULL
+ *
+ * The VMX preemption timer only counts while the vCPU runs, so it only
+ * backs the TSC deadlines of vCPUs which have their pCPU to themselves.
+ */
+static bool vlapic_ptmr_usable(__unused const struct acrn_vlapic *vlapic)
+{
+	bool ret = false;
+
+#ifdef CONFIG_VLAPIC_PREEMPTION_TIMER
+	ret = is_vmx_ptmr_supported() &&
+		(per_cpu(sched_ctx, vlapic->vcpu->pcpu_id).nr_vcpus == 1U);
+#endif
+
+	return ret;
+}
+
+/**
+ * @pre vlapic != NULL
+ */
+static void vlapic_stop_timer(struct acrn_vlapic *vlapic)
+{
+	del_timer(&vlapic->vtimer.timer);
+	vlapic->vtimer.ptmr_armed = false;
+	vlapic->vtimer.ptmr_parked = false;
 }
 
 /**
@@ -288,7 +458,7 @@ static void vlapic_reset_timer(struct acrn_vlapic *vlapic)
 	struct hv_timer *timer;
 
 	timer = &vlapic->vtimer.timer;
-	del_timer(timer);
+	vlapic_stop_timer(vlapic);
 	timer->mode = TICK_MODE_ONESHOT;
 	timer->fire_tsc = 0UL;
 	timer->period_in_cycle = 0UL;
@@ -336,7 +506,7 @@ static void vlapic_update_lvtt(struct acrn_vlapic *vlapic,
 		 * A write to the LVT Timer Register that changes
 		 * the timer mode disarms the local APIC timer.
 		 */
-		del_timer(timer);
+		vlapic_stop_timer(vlapic);
 		timer->mode = (timer_mode == APIC_LVTT_TM_PERIODIC) ?
 				TICK_MODE_PERIODIC: TICK_MODE_ONESHOT;
 		timer->fire_tsc = 0UL;
@@ -425,17 +595,22 @@ static void vlapic_set_tsc_deadline_msr(struct acrn_vlapic *vlapic,
 		vcpu_set_guest_msr(vlapic->vcpu, MSR_IA32_TSC_DEADLINE, val);
 
 		timer = &vlapic->vtimer.timer;
-		del_timer(timer);
+		vlapic_stop_timer(vlapic);
 
 		if (val != 0UL) {
 			/* transfer guest tsc to host tsc */
 			val -= exec_vmread64(VMX_TSC_OFFSET_FULL);
-			timer->fire_tsc = val;
-			/* vlapic_init_timer has been called,
-			 * and timer->fire_tsc is not 0,here
-			 * add_timer should not return error
-			 */
-			(void)add_timer(timer);
+			timer->fire_tsc = vm_unscale_tsc(vlapic->vm, val);
+			if (vlapic_ptmr_usable(vlapic)) {
+				/* counted from the next VM entry on */
+				vlapic->vtimer.ptmr_armed = true;
+			} else {
+				/* vlapic_init_timer has been called,
+				 * and timer->fire_tsc is not 0,here
+				 * add_timer should not return error
+				 */
+				(void)add_timer(timer);
+			}
 		} else {
 			timer->fire_tsc = 0UL;
 		}
@@ -454,10 +629,13 @@ vlapic_esr_write_handler(struct acrn_vlapic *vlapic)
 
 /*
  * Returns 1 if the vcpu needs to be notified of the interrupt and 0 otherwise.
+ * A posted interrupt notification is sent here, or if pi_pcpus is not NULL,
+ * left to the caller by setting the pCPU to notify in it.
  * @pre vector >= 16
  */
 static int32_t
-vlapic_set_intr_ready(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
+vlapic_record_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level,
+		uint64_t *pi_pcpus)
 {
 	struct lapic_regs *lapic;
 	struct lapic_reg *irrptr, *tmrptr;
@@ -476,6 +654,12 @@ vlapic_set_intr_ready(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
 		return 0;
 	}
 
+	atomic_inc64(&vlapic->vcpu->exit_stats.intr_sent);
+
+	/* the last word: whether the vCPU holds its pCPU, see below */
+	TRACE_4I(TRACE_VLAPIC_INTR, (uint32_t)vlapic->vcpu->vcpu_id, vector,
+		(uint32_t)vlapic->vm->vm_id, atomic_load32(&vlapic->vcpu->running));
+
 	if (is_apicv_intr_delivery_supported()) {
 		pending_intr = apicv_set_intr_ready(vlapic, vector);
 		if ((pending_intr != 0)
@@ -483,17 +667,31 @@ vlapic_set_intr_ready(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
 			&& (get_cpu_id() != vlapic->vcpu->pcpu_id)) {
 			/*
 			 * Send interrupt to vCPU via posted interrupt way:
-			 * 1. If target vCPU is in non-root mode(running),
-			 *    send PI notification to vCPU and hardware will
-			 *    sync PIR to vIRR automatically.
-			 * 2. If target vCPU is in root mode(isn't running),
-			 *    record this request as ACRN_REQUEST_EVENT,then
-			 *    will pick up the interrupt from PIR and inject
-			 *    it to vCPU in next vmentry.
+			 * 1. Record this request as ACRN_REQUEST_EVENT, the
+			 *    interrupt is picked up from PIR and injected to
+			 *    vCPU in next vmentry.
+			 * 2. If target vCPU holds its pCPU, send PI notification
+			 *    to vCPU and hardware will sync PIR to vIRR
+			 *    automatically in non-root mode, without VM exit.
+			 * 3. Otherwise, no notification is needed: the vCPU
+			 *    handles its pending requests before it enters the
+			 *    guest again. A halted vCPU is woken up either way.
+			 *
+			 * The locked set of the request orders it before the
+			 * load of running, which vCPU switch in publishes with
+			 * a full barrier too: either this side notifies, or the
+			 * vCPU sees the request.
 			 */
 			bitmap_set_lock(ACRN_REQUEST_EVENT,
 				&vlapic->vcpu->arch.pending_req);
-			vlapic_post_intr(vlapic->vcpu->pcpu_id);
+			wake_vcpu(vlapic->vcpu);
+			if (atomic_load32(&vlapic->vcpu->running) == 1U) {
+				if (pi_pcpus != NULL) {
+					bitmap_set_nolock(vlapic->vcpu->pcpu_id, pi_pcpus);
+				} else {
+					vlapic_post_intr(vlapic->vcpu->pcpu_id);
+				}
+			}
 			return 0;
 		}
 		return pending_intr;
@@ -508,6 +706,8 @@ vlapic_set_intr_ready(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
 							&irrptr[idx].v)) {
 		return 0;
 	}
+	/* after the IRR bit, see vlapic_intr_accepted() */
+	bitmap32_set_lock((uint16_t)idx, &vlapic->irr_summary);
 
 	/*
 	 * Verify that the trigger-mode of the interrupt matches with
@@ -524,6 +724,31 @@ vlapic_set_intr_ready(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
 	return 1;
 }
 
+static inline int32_t
+vlapic_set_intr_ready(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
+{
+	return vlapic_record_intr(vlapic, vector, level, NULL);
+}
+
+/*
+ * vlapic_set_intr() of an edge triggered vector for one of the vCPUs an
+ * IPI goes to. The pCPUs to notify are collected in pi_pcpus (posted
+ * interrupt) and kick_pcpus, for the caller to notify all at once.
+ * @pre vector >= 16
+ */
+static void vlapic_set_intr_multicast(struct acrn_vcpu *vcpu, uint32_t vector,
+		uint64_t *pi_pcpus, uint64_t *kick_pcpus)
+{
+	if (vlapic_record_intr(vcpu_vlapic(vcpu), vector, false, pi_pcpus) != 0) {
+		/* vcpu_make_request(), without its IPI */
+		bitmap_set_lock(ACRN_REQUEST_EVENT, &vcpu->arch.pending_req);
+		wake_vcpu(vcpu);
+		if (get_cpu_id() != vcpu->pcpu_id) {
+			bitmap_set_nolock(vcpu->pcpu_id, kick_pcpus);
+		}
+	}
+}
+
 /**
  * @brief Send notification vector to target pCPU.
  *
@@ -561,6 +786,29 @@ uint64_t apicv_get_pir_desc_paddr(struct acrn_vcpu *vcpu)
 	return hva2hpa(&(vlapic->pir_desc));
 }
 
+/**
+ * @pre vcpu != NULL
+ */
+bool apicv_set_pir_notification(struct acrn_vcpu *vcpu, uint32_t vector, bool suppress)
+{
+	struct vlapic_pir_desc *pir_desc = &(vcpu->arch.vlapic.pir_desc);
+	uint64_t old, new;
+
+	/* the IOMMU sets ON concurrently, so update the rest atomically */
+	do {
+		old = atomic_load64(&pir_desc->pending);
+		new = old & ~(PID_NV_MASK | PID_NDST_MASK | (1UL << PID_SN_BIT));
+		new |= ((uint64_t)vector << PID_NV_POS) & PID_NV_MASK;
+		/* xAPIC mode: the APIC ID is in bits 15:8 of NDST */
+		new |= ((uint64_t)per_cpu(lapic_id, vcpu->pcpu_id) << (PID_NDST_POS + 8U)) & PID_NDST_MASK;
+		if (suppress) {
+			new |= (1UL << PID_SN_BIT);
+		}
+	} while (atomic_cmpxchg64(&pir_desc->pending, old, new) != old);
+
+	return ((new & (1UL << PID_ON_BIT)) != 0UL);
+}
+
 /**
  * @pre offset value shall be one of the folllowing values:
  *	APIC_OFFSET_CMCI_LVT
@@ -819,7 +1067,7 @@ vlapic_update_ppr(struct acrn_vlapic *vlapic)
 		int32_t lastprio, curprio;
 		struct lapic_reg *isrptr;
 		uint32_t i, idx, vector;
-		uint32_t isrvec;
+		uint32_t isrvec, summary, bits;
 
 		if ((vlapic->isrvec_stk_top == 0U) && (top_isrvec != 0U)) {
 			panic("isrvec_stk is corrupted: %u", top_isrvec);
@@ -846,10 +1094,15 @@ vlapic_update_ppr(struct acrn_vlapic *vlapic)
 		 */
 		i = 1U;
 		isrptr = &(vlapic->apic_page.isr[0]);
-		for (vector = 0U; vector < 256U; vector++) {
-			idx = vector >> 5U;
-			if ((isrptr[idx].v & (1U << (vector & 0x1fU)))
-									!= 0U) {
+		summary = vlapic->isr_summary;
+		while (summary != 0U) {
+			/* only the ISR words with a bit set, lowest first */
+			idx = (uint32_t)ffs64((uint64_t)summary);
+			summary &= ~(1U << idx);
+			bits = isrptr[idx].v;
+			while (bits != 0U) {
+				vector = (idx * 32U) + (uint32_t)ffs64((uint64_t)bits);
+				bits &= bits - 1U;
 				isrvec = (uint32_t)vlapic->isrvec_stk[i];
 				if ((i > vlapic->isrvec_stk_top) ||
 					((i < ISRVEC_STK_SIZE) &&
@@ -882,9 +1135,9 @@ vlapic_process_eoi(struct acrn_vlapic *vlapic)
 	isrptr = &lapic->isr[0];
 	tmrptr = &lapic->tmr[0];
 
-	/* i ranges effectively from 7 to 0 */
-	for (i = 8U; i > 0U; ) {
-		i--;
+	/* the highest ISR word with a bit set */
+	i = (uint32_t)fls32(vlapic->isr_summary);
+	if (i != INVALID_BIT_INDEX) {
 		bitpos = (uint32_t)fls32(isrptr[i].v);
 		if (bitpos != INVALID_BIT_INDEX) {
 			if (vlapic->isrvec_stk_top == 0U) {
@@ -892,6 +1145,9 @@ vlapic_process_eoi(struct acrn_vlapic *vlapic)
 					vlapic->isrvec_stk_top);
 			}
 			isrptr[i].v &= ~(1U << bitpos);
+			if (isrptr[i].v == 0U) {
+				vlapic->isr_summary &= ~(1U << i);
+			}
 			vector = (i * 32U) + bitpos;
 			dev_dbg(ACRN_DBG_LAPIC, "EOI vector %u", vector);
 			vlapic_dump_isr(vlapic, "vlapic_process_eoi");
@@ -1001,8 +1257,6 @@ vlapic_calcdest(struct acrn_vm *vm, uint64_t *dmask, uint32_t dest,
 {
 	struct acrn_vlapic *vlapic;
 	struct acrn_vlapic *target = NULL;
-	uint32_t dfr, ldr, ldest, cluster;
-	uint32_t mda_flat_ldest, mda_cluster_ldest, mda_ldest, mda_cluster_id;
 	uint64_t amask;
 	uint16_t vcpu_id;
 
@@ -1028,78 +1282,20 @@ vlapic_calcdest(struct acrn_vm *vm, uint64_t *dmask, uint32_t dest,
 		 * Logical mode: match each APIC that has a bit set
 		 * in its LDR that matches a bit in the ldest.
 		 */
-		*dmask = 0UL;
-		amask = vm_active_cpus(vm);
-		for (vcpu_id = 0U; vcpu_id < vm->hw.created_vcpus; vcpu_id++) {
-			if ((amask & (1UL << vcpu_id)) != 0UL) {
+		amask = vlapic_logical_dest(vm, dest) & vm_active_cpus(vm);
+		if (!lowprio) {
+			*dmask = amask;
+		} else {
+			*dmask = 0UL;
+			vcpu_id = ffs64(amask);
+			while (vcpu_id != INVALID_BIT_INDEX) {
+				bitmap_clear_nolock(vcpu_id, &amask);
 				vlapic = vm_lapic_from_vcpu_id(vm, vcpu_id);
-
-				if (is_x2apic_enabled(vlapic)){
-					ldr = vlapic->apic_page.ldr.v;
-					ldest = ldr & 0xFFFFU;
-
-					mda_cluster_id = (dest >> 16U) & 0xFFFFU;
-					mda_ldest = dest & 0xFFFFU;
-					if (mda_cluster_id != ((ldr >> 16U) & 0xFFFFU)) {
-						continue;
-					}
-				} else {
-					/*
-					 * In the "Flat Model" the MDA is interpreted as an 8-bit wide
-					 * bitmask. This model is only available in the xAPIC mode.
-					 */
-					mda_flat_ldest = dest & 0xffU;
-
-					/*
-					 * In the "Cluster Model" the MDA is used to identify a
-					 * specific cluster and a set of APICs in that cluster.
-					 */
-					mda_cluster_id = (dest >> 4U) & 0xfU;
-					mda_cluster_ldest = dest & 0xfU;
-
-					dfr = vlapic->apic_page.dfr.v;
-					ldr = vlapic->apic_page.ldr.v;
-
-					if ((dfr & APIC_DFR_MODEL_MASK) ==
-							APIC_DFR_MODEL_FLAT) {
-						ldest = ldr >> 24U;
-						mda_ldest = mda_flat_ldest;
-					} else if ((dfr & APIC_DFR_MODEL_MASK) ==
-							APIC_DFR_MODEL_CLUSTER) {
-
-						cluster = ldr >> 28U;
-						ldest = (ldr >> 24U) & 0xfU;
-
-						if (cluster != mda_cluster_id) {
-							continue;
-						}
-						mda_ldest = mda_cluster_ldest;
-					} else {
-						/*
-						 * Guest has configured a bad logical
-						 * model for this vcpu - skip it.
-						 */
-						dev_dbg(ACRN_DBG_LAPIC,
-								"CANNOT deliver interrupt");
-						dev_dbg(ACRN_DBG_LAPIC,
-								"vlapic has bad logical model %x", dfr);
-						continue;
-					}
-				}
-				if ((mda_ldest & ldest) != 0U) {
-					if (lowprio) {
-						if (target == NULL) {
-							target = vlapic;
-						} else if (target->apic_page.ppr.v >
-								vlapic->apic_page.ppr.v) {
-							target = vlapic;
-						} else {
-							/* target is the dest */
-						}
-					} else {
-						bitmap_set_lock(vcpu_id, dmask);
-					}
+				if ((target == NULL) ||
+					(target->apic_page.ppr.v > vlapic->apic_page.ppr.v)) {
+					target = vlapic;
 				}
+				vcpu_id = ffs64(amask);
 			}
 		}
 
@@ -1212,6 +1408,7 @@ vlapic_icrlo_write_handler(struct acrn_vlapic *vlapic)
 	uint16_t vcpu_id;
 	bool phys;
 	uint64_t dmask = 0UL;
+	uint64_t pi_pcpus = 0UL, kick_pcpus = 0UL;
 	uint32_t icr_low, icr_high, dest;
 	uint32_t vec, mode, shorthand;
 	struct lapic_regs *lapic;
@@ -1276,7 +1473,7 @@ vlapic_icrlo_write_handler(struct acrn_vlapic *vlapic)
 			target_vcpu = vcpu_from_vid(vlapic->vm, vcpu_id);
 
 			if (mode == APIC_DELMODE_FIXED) {
-				vlapic_set_intr(target_vcpu, vec, LAPIC_TRIG_EDGE);
+				vlapic_set_intr_multicast(target_vcpu, vec, &pi_pcpus, &kick_pcpus);
 				dev_dbg(ACRN_DBG_LAPIC,
 					"vlapic sending ipi %u to vcpu_id %hu",
 					vec, vcpu_id);
@@ -1296,6 +1493,14 @@ vlapic_icrlo_write_handler(struct acrn_vlapic *vlapic)
 		}
 	}
 
+	/* one notification per pCPU, however many of its vCPUs are targets */
+	if (pi_pcpus != 0UL) {
+		send_dest_ipi_mask((uint32_t)pi_pcpus, VECTOR_POSTED_INTR);
+	}
+	if (kick_pcpus != 0UL) {
+		send_dest_ipi_mask((uint32_t)kick_pcpus, VECTOR_NOTIFY_VCPU);
+	}
+
 	return 0;	/* handled completely in the kernel */
 }
 
@@ -1316,7 +1521,7 @@ int32_t
 vlapic_pending_intr(const struct acrn_vlapic *vlapic, uint32_t *vecptr)
 {
 	const struct lapic_regs *lapic = &(vlapic->apic_page);
-	uint32_t i, vector, val, bitpos;
+	uint32_t i, vector, val, bitpos, summary;
 	const struct lapic_reg *irrptr;
 
 	if (is_apicv_intr_delivery_supported()) {
@@ -1325,9 +1530,14 @@ vlapic_pending_intr(const struct acrn_vlapic *vlapic, uint32_t *vecptr)
 
 	irrptr = &lapic->irr[0];
 
-	/* i ranges effectively from 7 to 0 */
-	for (i = 8U; i > 0U; ) {
-		i--;
+	/*
+	 * Only the IRR words flagged in the summary may have a bit set; a
+	 * flagged word may just have been emptied by vlapic_intr_accepted().
+	 */
+	summary = atomic_load32(&vlapic->irr_summary);
+	while (summary != 0U) {
+		i = (uint32_t)fls32(summary);
+		summary &= ~(1U << i);
 		val = atomic_load32(&irrptr[i].v);
 		bitpos = (uint32_t)fls32(val);
 		if (bitpos != INVALID_BIT_INDEX) {
@@ -1374,10 +1584,21 @@ vlapic_intr_accepted(struct acrn_vlapic *vlapic, uint32_t vector)
 
 	irrptr = &lapic->irr[0];
 	atomic_clear32(&irrptr[idx].v, 1U << (vector & 0x1fU));
+	if (atomic_load32(&irrptr[idx].v) == 0U) {
+		/*
+		 * Recheck after clearing the summary bit: a vector set in
+		 * between may have had its summary bit set before the clear.
+		 */
+		bitmap32_clear_lock((uint16_t)idx, &vlapic->irr_summary);
+		if (atomic_load32(&irrptr[idx].v) != 0U) {
+			bitmap32_set_lock((uint16_t)idx, &vlapic->irr_summary);
+		}
+	}
 	vlapic_dump_irr(vlapic, "vlapic_intr_accepted");
 
 	isrptr = &lapic->isr[0];
 	isrptr[idx].v |= 1U << (vector & 0x1fU);
+	vlapic->isr_summary |= 1U << idx;
 	vlapic_dump_isr(vlapic, "vlapic_intr_accepted");
 
 	/*
@@ -1414,7 +1635,7 @@ vlapic_svr_write_handler(struct acrn_vlapic *vlapic)
 			 * and mask all the LVT entries.
 			 */
 			dev_dbg(ACRN_DBG_LAPIC, "vlapic is software-disabled");
-			del_timer(&vlapic->vtimer.timer);
+			vlapic_stop_timer(vlapic);
 
 			vlapic_mask_lvts(vlapic);
 			/* the only one enabled LINT0-ExtINT vlapic disabled */
@@ -1685,6 +1906,7 @@ vlapic_reset(struct acrn_vlapic *vlapic)
 	lapic = &(vlapic->apic_page);
 	(void)memset((void *)lapic, 0U, sizeof(struct lapic_regs));
 	(void)memset((void *)&(vlapic->pir_desc), 0U, sizeof(vlapic->pir_desc));
+	(void)apicv_set_pir_notification(vlapic->vcpu, VECTOR_POSTED_INTR_WAKEUP, false);
 
 	lapic->id.v = vlapic_build_id(vlapic);
 	lapic->version.v = VLAPIC_VERSION;
@@ -1709,6 +1931,10 @@ vlapic_reset(struct acrn_vlapic *vlapic)
 	}
 
 	vlapic->isrvec_stk_top = 0U;
+	vlapic->irr_summary = 0U;
+	vlapic->isr_summary = 0U;
+
+	vlapic_update_dest_map(vlapic);
 }
 
 /**
@@ -1737,6 +1963,7 @@ void vlapic_restore(struct acrn_vlapic *vlapic, const struct lapic_regs *regs)
 	lapic->ppr = regs->ppr;
 	lapic->ldr = regs->ldr;
 	lapic->dfr = regs->dfr;
+	vlapic_update_dest_map(vlapic);
 	for (i = 0; i < 8; i++) {
 		lapic->tmr[i].v = regs->tmr[i].v;
 	}
@@ -1769,6 +1996,7 @@ vlapic_set_apicbase(struct acrn_vlapic *vlapic, uint64_t new)
 		if ((new & APICBASE_X2APIC) == APICBASE_X2APIC) {
 			vlapic->msr_apicbase = new;
 			vlapic_build_x2apic_id(vlapic);
+			vlapic_update_dest_map(vlapic);
 			switch_apicv_mode_x2apic(vlapic->vcpu);
 			return 0;
 		}
@@ -1981,6 +2209,29 @@ vlapic_set_local_intr(struct acrn_vm *vm, uint16_t vcpu_id_arg, uint32_t vector)
 	return error;
 }
 
+#ifdef CONFIG_PARTITION_MODE
+/*
+ * If the LAPIC is pass-thru to the guest, a virtual MSI can not be pended
+ * in the vLAPIC: send it on the wire, the guest uses physical APIC ids.
+ * Only Fixed delivery to a Physical destination is supported.
+ */
+static int32_t
+vlapic_x2apic_pt_msi(uint32_t dest, bool phys, uint32_t delmode, uint32_t vec)
+{
+	int32_t ret = -1;
+
+	if (phys && (delmode == APIC_DELMODE_FIXED)) {
+		msr_write(MSR_IA32_EXT_APIC_ICR, ((uint64_t)dest << 32U) | APIC_DESTMODE_PHY
+			| APIC_DEST_DESTFLD | APIC_DELMODE_FIXED | vec);
+		ret = 0;
+	} else {
+		pr_err("%s: only fixed physical MSI to pass-thru LAPIC", __func__);
+	}
+
+	return ret;
+}
+#endif
+
 /**
  * @brief Inject MSI to target VM.
  *
@@ -1989,7 +2240,8 @@ vlapic_set_local_intr(struct acrn_vm *vm, uint16_t vcpu_id_arg, uint32_t vector)
  * @param[in] msg  MSI data.
  *
  * @retval 0 on success.
- * @retval -1 on error that addr is invalid.
+ * @retval -1 on error that addr is invalid, or the MSI can not be sent to a
+ * VM with pass-thru LAPIC.
  *
  * @pre vm != NULL
  */
@@ -2025,8 +2277,17 @@ vlapic_intr_msi(struct acrn_vm *vm, uint64_t addr, uint64_t msg)
 		dev_dbg(ACRN_DBG_LAPIC, "lapic MSI %s dest %#x, vec %u",
 			phys ? "physical" : "logical", dest, vec);
 
+#ifdef CONFIG_PARTITION_MODE
+		if (vm->vm_desc->lapic_pt) {
+			ret = vlapic_x2apic_pt_msi(dest, phys, delmode, vec);
+		} else {
+			vlapic_deliver_intr(vm, LAPIC_TRIG_EDGE, dest, phys, delmode, vec, rh);
+			ret = 0;
+		}
+#else
 		vlapic_deliver_intr(vm, LAPIC_TRIG_EDGE, dest, phys, delmode, vec, rh);
 		ret = 0;
+#endif
 	} else {
 		dev_dbg(ACRN_DBG_LAPIC, "lapic MSI invalid addr %#lx", addr);
 	        ret = -1;
@@ -2044,6 +2305,7 @@ static void vlapic_timer_expired(void *data)
 
 	vlapic = vcpu_vlapic(vcpu);
 	lapic = &(vlapic->apic_page);
+	vcpu->exit_stats.timer_fired++;
 
 	/* inject vcpu timer interrupt if not masked */
 	if (!vlapic_lvtt_masked(vlapic)) {
@@ -2159,6 +2421,28 @@ static int32_t vlapic_x2apic_access(struct acrn_vcpu *vcpu, uint32_t msr, bool w
 	return error;
 }
 
+/**
+ * @pre vcpu != NULL
+ */
+int32_t vlapic_x2apic_write_icr(struct acrn_vcpu *vcpu, uint64_t val)
+{
+	struct acrn_vlapic *vlapic = vcpu_vlapic(vcpu);
+	int32_t error = -1;
+
+	if (is_x2apic_enabled(vlapic)) {
+#ifdef CONFIG_PARTITION_MODE
+		if (vcpu->vm->vm_desc->lapic_pt) {
+			return vlapic_x2apic_pt_icr_access(vcpu->vm, val);
+		}
+#endif
+		vlapic->apic_page.icr_hi.v = (uint32_t)(val >> 32U);
+		vlapic->apic_page.icr_lo.v = (uint32_t)val;
+		error = vlapic_icrlo_write_handler(vlapic);
+	}
+
+	return error;
+}
+
 int32_t
 vlapic_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *rval)
 {
@@ -2226,6 +2510,8 @@ vlapic_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t wval)
 
 int32_t vlapic_create(struct acrn_vcpu *vcpu)
 {
+	int32_t ret = 0;
+
 	vcpu->arch.vlapic.vm = vcpu->vm;
 	vcpu->arch.vlapic.vcpu = vcpu;
 
@@ -2234,18 +2520,22 @@ int32_t vlapic_create(struct acrn_vcpu *vcpu)
 			(uint64_t *)vcpu->vm->arch_vm.nworld_eptp;
 		/* only need unmap it from SOS as UOS never mapped it */
 		if (is_vm0(vcpu->vm)) {
-			ept_mr_del(vcpu->vm, pml4_page,
+			(void)ept_mr_del(vcpu->vm, pml4_page,
 				DEFAULT_APIC_BASE, PAGE_SIZE);
 		}
 
-		ept_mr_add(vcpu->vm, pml4_page,
+		ret = ept_mr_add(vcpu->vm, pml4_page,
 			vlapic_apicv_get_apic_access_addr(),
 			DEFAULT_APIC_BASE, PAGE_SIZE,
 			EPT_WR | EPT_RD | EPT_UNCACHED);
 	}
 
+	if (ret != 0) {
+		pr_err("vm%hu: APIC access page not mapped", vcpu->vm->vm_id);
+	}
+
 	vlapic_init(vcpu_vlapic(vcpu));
-	return 0;
+	return ret;
 }
 
 /*
@@ -2257,7 +2547,7 @@ void vlapic_free(struct acrn_vcpu *vcpu)
 
 	vlapic = vcpu_vlapic(vcpu);
 
-	del_timer(&vlapic->vtimer.timer);
+	vlapic_stop_timer(vlapic);
 
 }
 
@@ -2278,7 +2568,7 @@ apicv_set_intr_ready(struct acrn_vlapic *vlapic, uint32_t vector)
 	mask = 1UL << (vector & 0x3fU);
 
 	atomic_set64(&pir_desc->pir[idx], mask);
-	notify = (atomic_cmpxchg64(&pir_desc->pending, 0UL, 1UL) == 0UL) ? 1 : 0;
+	notify = bitmap_test_and_set_lock(PID_ON_BIT, &pir_desc->pending) ? 0 : 1;
 	return notify;
 }
 
@@ -2293,7 +2583,7 @@ apicv_pending_intr(const struct acrn_vlapic *vlapic)
 	pir_desc = &(vlapic->pir_desc);
 
 	pending = atomic_load64(&pir_desc->pending);
-	if (pending == 0U) {
+	if ((pending & (1UL << PID_ON_BIT)) == 0UL) {
 		return 0;
 	}
 
@@ -2376,7 +2666,7 @@ vlapic_apicv_inject_pir(struct acrn_vlapic *vlapic)
 	struct lapic_reg *irr = NULL;
 
 	pir_desc = &(vlapic->pir_desc);
-	if (atomic_cmpxchg64(&pir_desc->pending, 1UL, 0UL) == 1UL) {
+	if (bitmap_test_and_clear_lock(PID_ON_BIT, &pir_desc->pending)) {
 		pirval = 0UL;
 		lapic = &(vlapic->apic_page);
 		irr = &lapic->irr[0];
@@ -2415,6 +2705,8 @@ vlapic_apicv_inject_pir(struct acrn_vlapic *vlapic)
 		 */
 		if (pirval != 0UL) {
 			rvi = pirbase + fls64(pirval);
+			TRACE_4I(TRACE_VLAPIC_INJECT, (uint32_t)vlapic->vcpu->vcpu_id, (uint32_t)rvi,
+				(uint32_t)vlapic->vm->vm_id, 1U);
 
 			intr_status_old = 0xFFFFU &
 					exec_vmread16(VMX_GUEST_INTR_STATUS);
@@ -2589,3 +2881,95 @@ int32_t tpr_below_threshold_vmexit_handler(__unused struct acrn_vcpu *vcpu)
 	pr_err("Unhandled %s.", __func__);
 	return 0;
 }
+
+int32_t ptmr_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	/*
+	 * The deadline is fired by vlapic_ptmr_check() before the next VM
+	 * entry. The control is set, whatever the vLAPIC was told, so that
+	 * vlapic_ptmr_load() clears it if the timer is not armed any more.
+	 */
+	vcpu_vlapic(vcpu)->vtimer.ptmr_enabled = true;
+	return 0;
+}
+
+/**
+ * @pre vcpu != NULL
+ * @pre vcpu->pcpu_id == get_cpu_id()
+ */
+void vlapic_ptmr_check(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vlapic *vlapic = vcpu_vlapic(vcpu);
+	struct vlapic_timer *vtimer = &vlapic->vtimer;
+	struct hv_timer *timer = &vtimer->timer;
+
+	if (vtimer->ptmr_parked) {
+		vtimer->ptmr_parked = false;
+		/*
+		 * The hv_timer runs on this pCPU and its softirq can't come
+		 * in between, so a deadline which is still set has not fired.
+		 */
+		if ((timer->fire_tsc != 0UL) && vlapic_ptmr_usable(vlapic)) {
+			del_timer(timer);
+			vtimer->ptmr_armed = true;
+		}
+	}
+
+	if (vtimer->ptmr_armed && (rdtsc() >= timer->fire_tsc)) {
+		vtimer->ptmr_armed = false;
+		vlapic_timer_expired(vcpu);
+	}
+}
+
+/**
+ * @pre vcpu != NULL
+ * @pre vcpu->pcpu_id == get_cpu_id()
+ */
+void vlapic_ptmr_load(struct acrn_vcpu *vcpu)
+{
+	struct vlapic_timer *vtimer = &vcpu_vlapic(vcpu)->vtimer;
+	uint64_t now, ticks;
+	uint32_t value32;
+
+	if (vtimer->ptmr_armed) {
+		now = rdtsc();
+		ticks = (vtimer->timer.fire_tsc > now) ? (vtimer->timer.fire_tsc - now) : 0UL;
+		/*
+		 * The timer counts down once every 2^rate TSC cycles, from an
+		 * arbitrary phase: round up so that it doesn't exit before the
+		 * deadline. A deadline out of the 32-bit range exits early and
+		 * gets programmed again.
+		 */
+		ticks = (ticks >> get_vmx_ptmr_rate()) + 1UL;
+		if (ticks > 0xFFFFFFFFUL) {
+			ticks = 0xFFFFFFFFUL;
+		}
+		exec_vmwrite32(VMX_GUEST_TIMER, (uint32_t)ticks);
+	}
+
+	if (vtimer->ptmr_armed != vtimer->ptmr_enabled) {
+		value32 = exec_vmread32(VMX_PIN_VM_EXEC_CONTROLS);
+		if (vtimer->ptmr_armed) {
+			value32 |= VMX_PINBASED_CTLS_ENABLE_PTMR;
+		} else {
+			value32 &= ~VMX_PINBASED_CTLS_ENABLE_PTMR;
+		}
+		exec_vmwrite32(VMX_PIN_VM_EXEC_CONTROLS, value32);
+		vtimer->ptmr_enabled = vtimer->ptmr_armed;
+	}
+}
+
+/**
+ * @pre vcpu != NULL
+ * @pre vcpu->pcpu_id == get_cpu_id()
+ */
+void vlapic_ptmr_put(struct acrn_vcpu *vcpu)
+{
+	struct vlapic_timer *vtimer = &vcpu_vlapic(vcpu)->vtimer;
+
+	if (vtimer->ptmr_armed) {
+		vtimer->ptmr_armed = false;
+		vtimer->ptmr_parked = true;
+		(void)add_timer(&vtimer->timer);
+	}
+}
@@ -36,9 +36,11 @@ static inline void free_vm_id(const struct acrn_vm *vm)
 	bitmap_clear_lock(vm->vm_id, &vmid_bitmap);
 }
 
+/* a VM being torn down keeps its ID reserved but is no longer visible */
 static inline bool is_vm_valid(uint16_t vm_id)
 {
-	return bitmap_test(vm_id, &vmid_bitmap);
+	return (bitmap_test(vm_id, &vmid_bitmap) &&
+		(vm_array[vm_id].state != VM_POWERING_OFF));
 }
 
 /* return a pointer to the virtual machine structure associated with
@@ -57,6 +59,90 @@ struct acrn_vm *get_vm_from_vmid(uint16_t vm_id)
 	return ret;
 }
 
+/*
+ * guest_khz / host_khz with VMX_TSC_MULTIPLIER_SHIFT fractional bits, the
+ * fraction is computed 16 bits at a time to stay within 64-bit integers.
+ */
+static uint64_t get_tsc_multiplier(uint32_t guest_khz, uint32_t host_khz)
+{
+	uint64_t mult = (uint64_t)guest_khz / host_khz;
+	uint64_t rem = (uint64_t)guest_khz % host_khz;
+	uint32_t i;
+
+	for (i = 0U; i < (VMX_TSC_MULTIPLIER_SHIFT / 16U); i++) {
+		rem <<= 16U;
+		mult = (mult << 16U) | (rem / host_khz);
+		rem %= host_khz;
+	}
+
+	return mult;
+}
+
+/*
+ * A TSC frequency other than the host one needs TSC scaling, and the
+ * integer part of the multiplier is limited to 16 bits.
+ */
+static int32_t init_vm_tsc(struct acrn_vm *vm, uint32_t guest_khz)
+{
+	int32_t ret = 0;
+
+	vm->arch_vm.tsc_khz = tsc_khz;
+	vm->arch_vm.tsc_multiplier = 0UL;
+	if ((guest_khz != 0U) && (guest_khz != tsc_khz)) {
+		if (!is_tsc_scaling_supported()) {
+			pr_err("%s: no TSC scaling for a %u kHz TSC", __func__, guest_khz);
+			ret = -ENODEV;
+		} else if ((guest_khz / tsc_khz) >= (1U << (64U - VMX_TSC_MULTIPLIER_SHIFT))) {
+			ret = -EINVAL;
+		} else {
+			vm->arch_vm.tsc_khz = guest_khz;
+			vm->arch_vm.tsc_multiplier = get_tsc_multiplier(guest_khz, tsc_khz);
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Host TSC cycles as counted by the guest TSC, the hardware computes
+ * (host * multiplier) >> VMX_TSC_MULTIPLIER_SHIFT in the same way.
+ */
+uint64_t vm_scale_tsc(const struct acrn_vm *vm, uint64_t host_cycles)
+{
+	uint64_t lo, hi, ret = host_cycles;
+
+	if (vm->arch_vm.tsc_multiplier != 0UL) {
+		asm volatile ("mulq %3"
+				: "=a"(lo), "=d"(hi)
+				: "a"(host_cycles), "rm"(vm->arch_vm.tsc_multiplier));
+		ret = (hi << (64U - VMX_TSC_MULTIPLIER_SHIFT)) | (lo >> VMX_TSC_MULTIPLIER_SHIFT);
+	}
+
+	return ret;
+}
+
+/* The reverse of vm_scale_tsc(), saturated at ~0UL */
+uint64_t vm_unscale_tsc(const struct acrn_vm *vm, uint64_t guest_cycles)
+{
+	uint64_t mult = vm->arch_vm.tsc_multiplier;
+	uint64_t hi = guest_cycles >> (64U - VMX_TSC_MULTIPLIER_SHIFT);
+	uint64_t q, r, ret = guest_cycles;
+
+	if (mult != 0UL) {
+		if (hi >= mult) {
+			/* the quotient would not fit */
+			ret = ~0UL;
+		} else {
+			asm volatile ("divq %4"
+					: "=a"(q), "=d"(r)
+					: "a"(guest_cycles << VMX_TSC_MULTIPLIER_SHIFT), "d"(hi), "rm"(mult));
+			ret = q;
+		}
+	}
+
+	return ret;
+}
+
 /**
  * @pre vm_desc != NULL && rtn_vm != NULL
  */
@@ -87,6 +173,8 @@ int32_t create_vm(struct vm_description *vm_desc, struct acrn_vm **rtn_vm)
 #endif
 	vm->hw.created_vcpus = 0U;
 	vm->emul_mmio_regions = 0U;
+	vm->ple_gap = (vm_desc->ple_gap != 0U) ? vm_desc->ple_gap : VMX_PLE_GAP_CYCLES;
+	vm->ple_window = (vm_desc->ple_window != 0U) ? vm_desc->ple_window : VMX_PLE_WINDOW_CYCLES;
 
 	/* gpa_lowtop are used for system start up */
 	vm->hw.gpa_lowtop = 0UL;
@@ -95,6 +183,11 @@ int32_t create_vm(struct vm_description *vm_desc, struct acrn_vm **rtn_vm)
 	vm->arch_vm.nworld_eptp = vm->arch_vm.ept_mem_ops.get_pml4_page(vm->arch_vm.ept_mem_ops.info);
 	sanitize_pte((uint64_t *)vm->arch_vm.nworld_eptp);
 
+	status = init_vm_tsc(vm, vm_desc->tsc_khz);
+	if (status != 0) {
+		goto err;
+	}
+
 	/* Only for SOS: Configure VM software information */
 	/* For UOS: This VM software information is configure in DM */
 	if (is_vm0(vm)) {
@@ -113,9 +206,13 @@ int32_t create_vm(struct vm_description *vm_desc, struct acrn_vm **rtn_vm)
 	} else {
 		/* populate UOS vm fields according to vm_desc */
 		vm->sworld_control.flag.supported = vm_desc->sworld_supported;
+		vm->sched_prio = vm_desc->high_prio ? SCHED_PRIO_HIGH : SCHED_PRIO_LOW;
+		vm->guest_cr_bits = vm_desc->guest_cr_bits;
+		vm->vpmu = vm_desc->vpmu;
 		if (vm->sworld_control.flag.supported != 0UL) {
 			struct memory_ops *ept_mem_ops = &vm->arch_vm.ept_mem_ops;
-			ept_mr_add(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
+			/* the secure world range has page-table pages of its own */
+			(void)ept_mr_add(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
 				hva2hpa(ept_mem_ops->get_sworld_memory_base(ept_mem_ops->info)),
 				TRUSTY_EPT_REBASE_GPA, TRUSTY_RAM_SIZE, EPT_WB | EPT_RWX);
 		}
@@ -123,17 +220,21 @@ int32_t create_vm(struct vm_description *vm_desc, struct acrn_vm **rtn_vm)
 		(void)memcpy_s(&vm->GUID[0], sizeof(vm->GUID),
 					&vm_desc->GUID[0], sizeof(vm_desc->GUID));
 #ifdef CONFIG_PARTITION_MODE
-		ept_mr_add(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
+		status = ept_mr_add(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
 				vm_desc->start_hpa, 0UL, vm_desc->mem_size,
 				EPT_RWX|EPT_WB);
+		if (status != 0) {
+			goto err;
+		}
 		init_vm_boot_info(vm);
 #endif
 	}
 
 	enable_iommu();
 
-	INIT_LIST_HEAD(&vm->softirq_dev_entry_list);
-	spinlock_init(&vm->softirq_dev_lock);
+	vlapic_init_dest_map(vm);
+	spinlock_init(&vm->posted_ioreq_lock);
+	spinlock_init(&vm->ioeventfd_lock);
 	vm->intr_inject_delay_delta = 0UL;
 
 	/* Set up IO bit-mask such that VM exit occurs on
@@ -173,10 +274,20 @@ int32_t create_vm(struct vm_description *vm_desc, struct acrn_vm **rtn_vm)
 	/* Populate return VM handle */
 	*rtn_vm = vm;
 	vm->sw.io_shared_page = NULL;
+	vm->sw.io_req_slots = 0U;
+	vm->sw.posted_ioreq_page = NULL;
+	vm->sw.ioeventfd_page = NULL;
+	vm->sw.clock_page = NULL;
+	vm->sw.telemetry_page = NULL;
+	vm->sw.telemetry_ptirqs = 0;
 #ifdef CONFIG_IOREQ_POLLING
 	/* Now, enable IO completion polling mode for all VMs with CONFIG_IOREQ_POLLING. */
 	vm->sw.is_completion_polling = true;
 #endif
+#ifdef CONFIG_IOREQ_ADAPTIVE
+	/* Poll for the completions when DM has been fast lately. */
+	vm->sw.is_completion_adaptive = true;
+#endif
 
 	status = set_vcpuid_entries(vm);
 	if (status != 0) {
@@ -192,10 +303,33 @@ err:
 	if (vm->arch_vm.nworld_eptp != NULL) {
 		(void)memset(vm->arch_vm.nworld_eptp, 0U, PAGE_SIZE);
 	}
+	free_ept_mem(vm);
 
 	return status;
 }
 
+static void vm_teardown_work(struct work_item *work)
+{
+	struct acrn_vm *vm = (struct acrn_vm *)work->data;
+
+	ptdev_release_all_entries(vm);
+
+	/* Free iommu */
+	if (vm->iommu != NULL) {
+		destroy_iommu_domain(vm->iommu);
+	}
+
+	/* unused by the vCPUs and the IOMMU by now */
+	free_ept_mem(vm);
+
+	vpci_cleanup(vm);
+
+	scrub_secure_world(vm);
+
+	/* Free vm id, last as it makes the VM structure reusable */
+	free_vm_id(vm);
+}
+
 /*
  * @pre vm != NULL
  */
@@ -214,20 +348,17 @@ int32_t shutdown_vm(struct acrn_vm *vm)
 			offline_vcpu(vcpu);
 		}
 
-		ptdev_release_all_entries(vm);
-
-		/* Free EPT allocated resources assigned to VM */
+		/*
+		 * Free EPT allocated resources assigned to VM. Secure world
+		 * memory the SOS gets back is scrubbed right here, the one
+		 * reserved by the hypervisor by the teardown work.
+		 */
 		destroy_ept(vm);
 
-		/* Free iommu */
-		if (vm->iommu != NULL) {
-			destroy_iommu_domain(vm->iommu);
-		}
-
-		/* Free vm id */
-		free_vm_id(vm);
-
-		vpci_cleanup(vm);
+		/* release the rest from the idle loop of the VM's BSP pCPU */
+		vm->state = VM_POWERING_OFF;
+		init_work(&vm->teardown_work, vm_teardown_work, vm);
+		(void)queue_work_on(vcpu_from_vid(vm, 0U)->pcpu_id, &vm->teardown_work);
 		ret = 0;
 	} else {
 	        ret = -EINVAL;
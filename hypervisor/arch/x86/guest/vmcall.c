@@ -11,35 +11,16 @@ static spinlock_t vmm_hypercall_lock = {
 	.head = 0U,
 	.tail = 0U,
 };
-/*
- * Pass return value to SOS by register rax.
- * This function should always return 0 since we shouldn't
- * deal with hypercall error in hypervisor.
+/**
+ * @pre vcpu != NULL
+ * @pre the caller has checked that vcpu is allowed to issue hypcall_id
  */
-int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
+int32_t dispatch_hypercall(struct acrn_vcpu *vcpu, uint64_t hypcall_id,
+		uint64_t param1, uint64_t param2)
 {
-	int32_t ret = -EACCES;
+	int32_t ret;
 	struct acrn_vm *vm = vcpu->vm;
-	/* hypercall ID from guest*/
-	uint64_t hypcall_id = vcpu_get_gpreg(vcpu, CPU_REG_R8);
-	/* hypercall param1 from guest*/
-	uint64_t param1 = vcpu_get_gpreg(vcpu, CPU_REG_RDI);
-	/* hypercall param2 from guest*/
-	uint64_t param2 = vcpu_get_gpreg(vcpu, CPU_REG_RSI);
-
-	if (!is_hypercall_from_ring0()) {
-		pr_err("hypercall is only allowed from RING-0!\n");
-		goto out;
-	}
 
-	if (!is_vm0(vm) && (hypcall_id != HC_WORLD_SWITCH) &&
-		(hypcall_id != HC_INITIALIZE_TRUSTY) &&
-		(hypcall_id != HC_SAVE_RESTORE_SWORLD_CTX)) {
-		pr_err("hypercall %d is only allowed from VM0!\n", hypcall_id);
-		goto out;
-	}
-
-	/* Dispatch the hypercall handler */
 	switch (hypcall_id) {
 	case HC_SOS_OFFLINE_CPU:
 		spinlock_obtain(&vmm_hypercall_lock);
@@ -55,6 +36,10 @@ int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 
 		break;
 
+	case HC_MULTICALL:
+		ret = hcall_multicall(vcpu, param1, param2);
+		break;
+
 	case HC_CREATE_VM:
 		spinlock_obtain(&vmm_hypercall_lock);
 		ret = hcall_create_vm(vm, param1);
@@ -89,6 +74,13 @@ int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 		spinlock_release(&vmm_hypercall_lock);
 		break;
 
+	case HC_RESUME_VM:
+		/* param1: vmid */
+		spinlock_obtain(&vmm_hypercall_lock);
+		ret = hcall_resume_vm((uint16_t)param1);
+		spinlock_release(&vmm_hypercall_lock);
+		break;
+
 	case HC_CREATE_VCPU:
 		/* param1: vmid */
 		spinlock_obtain(&vmm_hypercall_lock);
@@ -103,6 +95,27 @@ int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 		spinlock_release(&vmm_hypercall_lock);
 		break;
 
+	case HC_GET_VMEXIT_STATS:
+		/* param1: vmid */
+		spinlock_obtain(&vmm_hypercall_lock);
+		ret = hcall_get_vmexit_stats(vm, (uint16_t)param1, param2);
+		spinlock_release(&vmm_hypercall_lock);
+		break;
+
+	case HC_GET_EXIT_TIMELINE:
+		/* param1: vmid */
+		spinlock_obtain(&vmm_hypercall_lock);
+		ret = hcall_get_exit_timeline(vm, (uint16_t)param1, param2);
+		spinlock_release(&vmm_hypercall_lock);
+		break;
+
+	case HC_GET_VCPU_REGS:
+		/* param1: vmid */
+		spinlock_obtain(&vmm_hypercall_lock);
+		ret = hcall_get_vcpu_regs(vm, (uint16_t)param1, param2);
+		spinlock_release(&vmm_hypercall_lock);
+		break;
+
 	case HC_SET_IRQLINE:
 		/* param1: vmid */
 		ret = hcall_set_irqline(vm, (uint16_t)param1,
@@ -114,6 +127,11 @@ int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 		ret = hcall_inject_msi(vm, (uint16_t)param1, param2);
 		break;
 
+	case HC_INJECT_MSI_BATCH:
+		/* param1: vmid */
+		ret = hcall_inject_msi_batch(vm, (uint16_t)param1, param2);
+		break;
+
 	case HC_SET_IOREQ_BUFFER:
 		/* param1: vmid */
 		spinlock_obtain(&vmm_hypercall_lock);
@@ -121,6 +139,55 @@ int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 		spinlock_release(&vmm_hypercall_lock);
 		break;
 
+	case HC_SET_POSTED_IOREQ_BUFFER:
+		/* param1: vmid */
+		spinlock_obtain(&vmm_hypercall_lock);
+		ret = hcall_set_posted_ioreq_buffer(vm, (uint16_t)param1, param2);
+		spinlock_release(&vmm_hypercall_lock);
+		break;
+
+	case HC_SET_POSTED_MMIO_RANGE:
+		/* param1: vmid */
+		spinlock_obtain(&vmm_hypercall_lock);
+		ret = hcall_set_posted_mmio_range(vm, (uint16_t)param1, param2);
+		spinlock_release(&vmm_hypercall_lock);
+		break;
+
+	case HC_SET_UPCALL_POLICY:
+		/* param1: vmid */
+		spinlock_obtain(&vmm_hypercall_lock);
+		ret = hcall_set_upcall_policy(vm, (uint16_t)param1, param2);
+		spinlock_release(&vmm_hypercall_lock);
+		break;
+
+	case HC_SET_IOEVENTFD_PAGE:
+		/* param1: vmid */
+		spinlock_obtain(&vmm_hypercall_lock);
+		ret = hcall_set_ioeventfd_page(vm, (uint16_t)param1, param2);
+		spinlock_release(&vmm_hypercall_lock);
+		break;
+
+	case HC_ASSIGN_IOEVENTFD:
+		/* param1: vmid */
+		spinlock_obtain(&vmm_hypercall_lock);
+		ret = hcall_assign_ioeventfd(vm, (uint16_t)param1, param2);
+		spinlock_release(&vmm_hypercall_lock);
+		break;
+
+	case HC_SET_CLOCK_PAGE:
+		/* param1: vmid */
+		spinlock_obtain(&vmm_hypercall_lock);
+		ret = hcall_set_clock_page(vm, (uint16_t)param1, param2);
+		spinlock_release(&vmm_hypercall_lock);
+		break;
+
+	case HC_SET_TELEMETRY_PAGE:
+		/* param1: vmid */
+		spinlock_obtain(&vmm_hypercall_lock);
+		ret = hcall_set_telemetry_page(vm, (uint16_t)param1, param2);
+		spinlock_release(&vmm_hypercall_lock);
+		break;
+
 	case HC_NOTIFY_REQUEST_FINISH:
 		/* param1: vmid
 		 * param2: vcpu_id */
@@ -128,6 +195,12 @@ int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 			(uint16_t)param2);
 		break;
 
+	case HC_NOTIFY_REQUEST_FINISH_BATCH:
+		/* param1: vmid
+		 * param2: bitmap of the vcpu_ids */
+		ret = hcall_notify_ioreq_finish_batch((uint16_t)param1, param2);
+		break;
+
 	case HC_VM_SET_MEMORY_REGIONS:
 		ret = hcall_set_vm_memory_regions(vm, param1);
 		break;
@@ -136,6 +209,18 @@ int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 		ret = hcall_write_protect_page(vm, (uint16_t)param1, param2);
 		break;
 
+	case HC_VM_DIRTY_LOG:
+		/* param1: vmid
+		 * param2: struct acrn_dirty_log */
+		ret = hcall_vm_dirty_log(vm, (uint16_t)param1, param2);
+		break;
+
+	case HC_VM_SET_COW:
+		/* param1: vmid
+		 * param2: struct acrn_cow_range */
+		ret = hcall_vm_set_cow(vm, (uint16_t)param1, param2);
+		break;
+
 	/*
 	 * Don't do MSI remapping and make the pmsi_data equal to vmsi_data
 	 * This is a temporary solution before this hypercall is removed from SOS
@@ -154,6 +239,11 @@ int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 		ret = hcall_assign_ptdev(vm, (uint16_t)param1, param2);
 		break;
 
+	case HC_ASSIGN_PTDEV_BATCH:
+		/* param1: vmid */
+		ret = hcall_assign_ptdev_batch(vm, (uint16_t)param1, param2);
+		break;
+
 	case HC_DEASSIGN_PTDEV:
 		/* param1: vmid */
 		ret = hcall_deassign_ptdev(vm, (uint16_t)param1, param2);
@@ -194,6 +284,43 @@ int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 		break;
 	}
 
+	return ret;
+}
+
+/*
+ * Pass return value to SOS by register rax.
+ * This function should always return 0 since we shouldn't
+ * deal with hypercall error in hypervisor.
+ */
+int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	int32_t ret = -EACCES;
+	struct acrn_vm *vm = vcpu->vm;
+	/* hypercall ID from guest*/
+	uint64_t hypcall_id = vcpu_get_gpreg(vcpu, CPU_REG_R8);
+	/* hypercall param1 from guest*/
+	uint64_t param1 = vcpu_get_gpreg(vcpu, CPU_REG_RDI);
+	/* hypercall param2 from guest*/
+	uint64_t param2 = vcpu_get_gpreg(vcpu, CPU_REG_RSI);
+	uint64_t start;
+
+	if (!is_hypercall_from_ring0()) {
+		pr_err("hypercall is only allowed from RING-0!\n");
+		goto out;
+	}
+
+	if (!is_vm0(vm) && (hypcall_id != HC_WORLD_SWITCH) &&
+		(hypcall_id != HC_INITIALIZE_TRUSTY) &&
+		(hypcall_id != HC_SAVE_RESTORE_SWORLD_CTX)) {
+		pr_err("hypercall %d is only allowed from VM0!\n", hypcall_id);
+		goto out;
+	}
+
+	/* Dispatch the hypercall handler */
+	start = rdtsc();
+	ret = dispatch_hypercall(vcpu, hypcall_id, param1, param2);
+	hcall_stats_record(hypcall_id, rdtsc() - start);
+
 out:
 	vcpu_set_gpreg(vcpu, CPU_REG_RAX, (uint64_t)ret);
 
@@ -32,7 +32,8 @@ static const uint32_t emulated_guest_msrs[NUM_GUEST_MSRS] = {
 	MSR_IA32_BIOS_SIGN_ID,
 	MSR_IA32_TIME_STAMP_COUNTER,
 	MSR_IA32_APIC_BASE,
-	MSR_IA32_PERF_CTL
+	MSR_IA32_PERF_CTL,
+	MSR_IA32_XSS
 };
 
 #define NUM_MTRR_MSRS	13U
@@ -200,6 +201,68 @@ static const uint32_t x2apic_msrs[NUM_X2APIC_MSRS] = {
 	MSR_IA32_EXT_APIC_SELF_IPI,
 };
 
+/*
+ * Never intercepted: the guest enters system calls through these, and the
+ * hypervisor does not use them. VM entries and exits leave them alone, so
+ * they only have to follow the vCPU when another one takes its pCPU. The
+ * FS and GS bases are exitless as well, the VMCS switches them.
+ */
+static const uint32_t passthru_msrs[NUM_PASSTHRU_MSRS] = {
+	MSR_IA32_STAR,
+	MSR_IA32_LSTAR,
+	MSR_IA32_CSTAR,
+	MSR_IA32_FMASK,
+	MSR_IA32_KERNEL_GS_BASE
+};
+
+void save_passthru_msrs(struct acrn_vcpu *vcpu)
+{
+	uint32_t i;
+
+	for (i = 0U; i < NUM_PASSTHRU_MSRS; i++) {
+		vcpu->arch.passthru_msrs[i] = msr_read(passthru_msrs[i]);
+	}
+}
+
+void load_passthru_msrs(const struct acrn_vcpu *vcpu)
+{
+	uint32_t i;
+
+	for (i = 0U; i < NUM_PASSTHRU_MSRS; i++) {
+		msr_write(passthru_msrs[i], vcpu->arch.passthru_msrs[i]);
+	}
+}
+
+/*
+ * Count the intercepted accesses per MSR, to tell which ones are worth
+ * passing through. Only the pCPU of the vCPU writes the counters.
+ */
+static void account_msr_exit(struct acrn_vcpu *vcpu, uint32_t msr, bool write)
+{
+	struct msr_exit_stats *stats = NULL;
+	struct msr_exit_stats *slot;
+	uint32_t i;
+
+	for (i = 0U; i < VMEXIT_MSR_SLOTS; i++) {
+		slot = &vcpu->exit_stats.msr[i];
+		if (((slot->reads | slot->writes) == 0UL) || (slot->msr == msr)) {
+			stats = slot;
+			break;
+		}
+	}
+
+	if (stats == NULL) {
+		vcpu->exit_stats.msr_other++;
+	} else {
+		stats->msr = msr;
+		if (write) {
+			stats->writes++;
+		} else {
+			stats->reads++;
+		}
+	}
+}
+
 /* emulated_guest_msrs[] shares same indexes with array vcpu->arch->guest_msrs[] */
 uint32_t vmsr_get_guest_msr_index(uint32_t msr)
 {
@@ -277,6 +340,8 @@ static void init_msr_area(struct acrn_vcpu *vcpu)
 	vcpu->arch.msr_area.guest[MSR_AREA_TSC_AUX].value = vcpu->vcpu_id;
 	vcpu->arch.msr_area.host[MSR_AREA_TSC_AUX].msr_num = MSR_IA32_TSC_AUX;
 	vcpu->arch.msr_area.host[MSR_AREA_TSC_AUX].value = vcpu->pcpu_id;
+
+	vpmu_init(vcpu);
 }
 
 void init_msr_emulation(struct acrn_vcpu *vcpu)
@@ -328,6 +393,7 @@ int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 
 	/* Read the msr value */
 	msr = (uint32_t)vcpu_get_gpreg(vcpu, CPU_REG_RCX);
+	account_msr_exit(vcpu, msr, false);
 
 	/* Do the required processing for each msr case */
 	switch (msr) {
@@ -383,10 +449,22 @@ int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 		err = vlapic_rdmsr(vcpu, msr, &v);
 		break;
 	}
+	case MSR_ACRN_STEAL_TIME:
+	{
+		v = vcpu->sched.steal_msr;
+		break;
+	}
+	case MSR_IA32_XSS:
+	{
+		v = vcpu_get_guest_msr(vcpu, MSR_IA32_XSS);
+		break;
+	}
 	default:
 	{
 		if (is_x2apic_msr(msr)) {
 			err = vlapic_rdmsr(vcpu, msr, &v);
+		} else if (is_vpmu_msr(msr) && (vpmu_rdmsr(vcpu, msr, &v) == 0)) {
+			/* handled by the vPMU */
 		} else {
 			pr_warn("%s(): vm%d vcpu%d reading MSR %lx not supported",
 				__func__, vcpu->vm->vm_id, vcpu->vcpu_id, msr);
@@ -416,7 +494,8 @@ static void set_guest_tsc(struct acrn_vcpu *vcpu, uint64_t guest_tsc)
 {
 	uint64_t tsc_delta, tsc_offset_delta, tsc_adjust;
 
-	tsc_delta = guest_tsc - rdtsc();
+	/* the offset applies to the scaled host TSC */
+	tsc_delta = guest_tsc - vm_scale_tsc(vcpu->vm, rdtsc());
 
 	/* the delta between new and existing TSC_OFFSET */
 	tsc_offset_delta = tsc_delta - exec_vmread64(VMX_TSC_OFFSET_FULL);
@@ -457,6 +536,7 @@ int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 
 	/* Read the MSR ID */
 	msr = (uint32_t)vcpu_get_gpreg(vcpu, CPU_REG_RCX);
+	account_msr_exit(vcpu, msr, true);
 
 	/* Get the MSR contents */
 	v = (vcpu_get_gpreg(vcpu, CPU_REG_RDX) << 32U) |
@@ -529,10 +609,37 @@ int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 		err = vlapic_wrmsr(vcpu, msr, v);
 		break;
 	}
+	case MSR_IA32_EXT_APIC_ICR:
+	{
+		/* guest IPIs, straight to the ICR handler */
+		err = vlapic_x2apic_write_icr(vcpu, v);
+		break;
+	}
+	case MSR_ACRN_STEAL_TIME:
+	{
+		err = set_steal_time_msr(vcpu, v);
+		break;
+	}
+	case MSR_IA32_XSS:
+	{
+		/*
+		 * No supervisor state component is exposed, the guest gets
+		 * XSAVES for the compacted format of its user components.
+		 * IA32_XSS of the pCPU stays 0.
+		 */
+		if (v != 0UL) {
+			err = -EACCES;
+		} else {
+			vcpu_set_guest_msr(vcpu, MSR_IA32_XSS, v);
+		}
+		break;
+	}
 	default:
 	{
 		if (is_x2apic_msr(msr)) {
 			err = vlapic_wrmsr(vcpu, msr, v);
+		} else if (is_vpmu_msr(msr) && (vpmu_wrmsr(vcpu, msr, v) == 0)) {
+			/* handled by the vPMU */
 		} else {
 			pr_warn("%s(): vm%d vcpu%d writing MSR %lx not supported",
 				__func__, vcpu->vm->vm_id, vcpu->vcpu_id, msr);
@@ -0,0 +1,405 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <hypervisor.h>
+
+/* Version 2 of the architectural PMU is exposed, with no AnyThread bits */
+#define VPMU_VERSION			2U
+#define VPMU_EVTSEL_ANY			(1UL << 21U)
+#define VPMU_EVTSEL_VALID		(0xFFFFFFFFUL & ~VPMU_EVTSEL_ANY)
+#define VPMU_FIXED_CTL_VALID		0xBUL	/* OS, USR and PMI of a counter */
+#define PERF_CAP_FW_WRITE		(1UL << 13U)
+
+/* The physical PMU, as far as the guests get it */
+static struct vpmu_caps {
+	uint32_t version;		/* of the physical PMU */
+	uint32_t nr_gp;
+	uint32_t nr_fixed;
+	uint32_t cpuid_eax;		/* CPUID.0AH of the guests */
+	uint32_t cpuid_ebx;
+	uint32_t cpuid_edx;
+	uint64_t gp_mask;		/* bits of a general purpose counter */
+	uint64_t fixed_mask;		/* bits of a fixed counter */
+	uint64_t global_mask;		/* counter bits of the global MSRs */
+	bool full_width;		/* IA32_A_PMCx are writable */
+} vpmu_caps;
+
+#ifndef PROFILING_ON
+static void vpmu_pmi_handler(__unused uint32_t irq, __unused void *data)
+{
+	(void)vpmu_handle_pmi();
+}
+#endif
+
+/*
+ * The hypervisor profiling, when built in, gets the PMI and passes it on
+ * while it does not sample.
+ */
+void init_vpmu(void)
+{
+	uint32_t eax, ebx, ecx, edx, width;
+
+	if (boot_cpu_data.cpuid_level < 0x0aU) {
+		return;
+	}
+
+	cpuid(0x0aU, &eax, &ebx, &ecx, &edx);
+	vpmu_caps.version = eax & 0xFFU;
+	if (vpmu_caps.version < VPMU_VERSION) {
+		pr_info("%s: no vPMU on a PMU of version %u", __func__, vpmu_caps.version);
+		return;
+	}
+
+	vpmu_caps.nr_gp = min((eax >> 8U) & 0xFFU, VPMU_MAX_GP_COUNTERS);
+	vpmu_caps.nr_fixed = min(edx & 0x1FU, VPMU_MAX_FIXED_COUNTERS);
+	width = (eax >> 16U) & 0xFFU;
+	vpmu_caps.gp_mask = (width >= 64U) ? ~0UL : ((1UL << width) - 1UL);
+	width = (edx >> 5U) & 0xFFU;
+	vpmu_caps.fixed_mask = (width >= 64U) ? ~0UL : ((1UL << width) - 1UL);
+	vpmu_caps.global_mask = ((1UL << vpmu_caps.nr_gp) - 1UL) |
+		(((1UL << vpmu_caps.nr_fixed) - 1UL) << 32U);
+	if (cpu_has_cap(X86_FEATURE_PDCM)) {
+		vpmu_caps.full_width = ((msr_read(MSR_IA32_PERF_CAPABILITIES) & PERF_CAP_FW_WRITE) != 0UL);
+	}
+
+	vpmu_caps.cpuid_eax = VPMU_VERSION | (vpmu_caps.nr_gp << 8U) | (eax & 0xFFFF0000U);
+	vpmu_caps.cpuid_ebx = ebx;
+	vpmu_caps.cpuid_edx = vpmu_caps.nr_fixed | (edx & 0x1FE0U);
+
+#ifndef PROFILING_ON
+	if (request_irq(PMI_IRQ, vpmu_pmi_handler, NULL, IRQF_NONE) < 0) {
+		pr_err("%s: failed to add the PMI isr", __func__);
+		vpmu_caps.version = 0U;
+	}
+#endif
+}
+
+bool is_vpmu_enabled(const struct acrn_vm *vm)
+{
+	return vm->vpmu && (vpmu_caps.version >= VPMU_VERSION);
+}
+
+void vpmu_init_cpuid(const struct acrn_vm *vm, struct vcpuid_entry *entry)
+{
+	if (is_vpmu_enabled(vm)) {
+		entry->eax = vpmu_caps.cpuid_eax;
+		entry->ebx = vpmu_caps.cpuid_ebx;
+		entry->edx = vpmu_caps.cpuid_edx;
+	} else {
+		entry->eax = 0U;
+		entry->ebx = 0U;
+		entry->edx = 0U;
+	}
+	entry->ecx = 0U;
+}
+
+static void vpmu_set_msr_cnt(struct acrn_vcpu *vcpu, uint32_t cnt)
+{
+	if (vcpu->arch.vpmu.msr_cnt != cnt) {
+		exec_vmwrite32(VMX_ENTRY_MSR_LOAD_COUNT, cnt);
+		exec_vmwrite32(VMX_EXIT_MSR_STORE_COUNT, cnt);
+		exec_vmwrite32(VMX_EXIT_MSR_LOAD_COUNT, cnt);
+		vcpu->arch.vpmu.msr_cnt = cnt;
+	}
+}
+
+void vpmu_init(struct acrn_vcpu *vcpu)
+{
+	/* the physical PMU does not hold its state any more */
+	vpmu_put(vcpu);
+	(void)memset((void *)&vcpu->arch.vpmu, 0U, sizeof(vcpu->arch.vpmu));
+
+	/* counted in the lists once the vCPU owns the PMU */
+	vcpu->arch.msr_area.guest[MSR_AREA_PERF_GLOBAL_CTRL].msr_num = MSR_IA32_PERF_GLOBAL_CTRL;
+	vcpu->arch.msr_area.guest[MSR_AREA_PERF_GLOBAL_CTRL].value = 0UL;
+	vcpu->arch.msr_area.host[MSR_AREA_PERF_GLOBAL_CTRL].msr_num = MSR_IA32_PERF_GLOBAL_CTRL;
+	vcpu->arch.msr_area.host[MSR_AREA_PERF_GLOBAL_CTRL].value = 0UL;
+	vcpu->arch.vpmu.msr_cnt = MSR_AREA_PERF_GLOBAL_CTRL;
+}
+
+bool is_vpmu_msr(uint32_t msr)
+{
+	return ((msr >= MSR_IA32_PMC0) && (msr <= MSR_IA32_PMC7)) ||
+		((msr >= MSR_IA32_PERFEVTSEL0) && (msr <= MSR_IA32_PERFEVTSEL3)) ||
+		((msr >= MSR_IA32_A_PMC0) && (msr <= MSR_IA32_A_PMC7)) ||
+		((msr >= MSR_IA32_FIXED_CTR0) && (msr <= MSR_IA32_FIXED_CTR2)) ||
+		((msr >= MSR_IA32_FIXED_CTR_CTL) && (msr <= MSR_IA32_PERF_GLOBAL_INUSE));
+}
+
+static inline bool is_vpmu_loaded(const struct acrn_vcpu *vcpu)
+{
+	return per_cpu(sched_ctx, vcpu->pcpu_id).vpmu_vcpu == vcpu;
+}
+
+/*
+ * Without full-width writes, the counter takes bit 31 of the value
+ * written to IA32_PMCx over to its upper bits.
+ */
+static void vpmu_write_pmc(uint32_t idx, uint64_t val)
+{
+	if (vpmu_caps.full_width) {
+		msr_write(MSR_IA32_A_PMC0 + idx, val);
+	} else {
+		msr_write(MSR_IA32_PMC0 + idx, val);
+	}
+}
+
+static void vpmu_save(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vpmu *vpmu = &vcpu->arch.vpmu;
+	uint32_t i;
+
+	for (i = 0U; i < vpmu_caps.nr_gp; i++) {
+		vpmu->evtsel[i] = msr_read(MSR_IA32_PERFEVTSEL0 + i);
+		vpmu->pmc[i] = msr_read(MSR_IA32_PMC0 + i);
+		msr_write(MSR_IA32_PERFEVTSEL0 + i, 0UL);
+	}
+	for (i = 0U; i < vpmu_caps.nr_fixed; i++) {
+		vpmu->fixed_ctr[i] = msr_read(MSR_IA32_FIXED_CTR0 + i);
+	}
+	vpmu->fixed_ctr_ctl = msr_read(MSR_IA32_FIXED_CTR_CTL);
+	msr_write(MSR_IA32_FIXED_CTR_CTL, 0UL);
+
+	vpmu->global_status = msr_read(MSR_IA32_PERF_GLOBAL_STATUS) & vpmu_caps.global_mask;
+	msr_write(MSR_IA32_PERF_GLOBAL_OVF_CTRL, vpmu->global_status);
+}
+
+/*
+ * A PMU of version 4 takes the pending overflows back, the older ones
+ * lose them when the vCPU moves to another pCPU owner.
+ */
+static void vpmu_restore(const struct acrn_vcpu *vcpu)
+{
+	const struct acrn_vpmu *vpmu = &vcpu->arch.vpmu;
+	uint32_t i;
+
+	for (i = 0U; i < vpmu_caps.nr_gp; i++) {
+		vpmu_write_pmc(i, vpmu->pmc[i]);
+		msr_write(MSR_IA32_PERFEVTSEL0 + i, vpmu->evtsel[i]);
+	}
+	for (i = 0U; i < vpmu_caps.nr_fixed; i++) {
+		msr_write(MSR_IA32_FIXED_CTR0 + i, vpmu->fixed_ctr[i]);
+	}
+	msr_write(MSR_IA32_FIXED_CTR_CTL, vpmu->fixed_ctr_ctl);
+
+	if ((vpmu_caps.version >= 4U) && (vpmu->global_status != 0UL)) {
+		msr_write(MSR_IA32_PERF_GLOBAL_STATUS_SET, vpmu->global_status);
+	}
+}
+
+void vpmu_load(struct acrn_vcpu *vcpu)
+{
+	struct sched_context *ctx = &per_cpu(sched_ctx, vcpu->pcpu_id);
+	struct acrn_vcpu *prev = ctx->vpmu_vcpu;
+
+	if (!is_vpmu_enabled(vcpu->vm)) {
+		return;
+	}
+
+	if (profiling_pmu_running()) {
+		if (prev != NULL) {
+			vpmu_save(prev);
+			ctx->vpmu_vcpu = NULL;
+		}
+		vpmu_set_msr_cnt(vcpu, MSR_AREA_PERF_GLOBAL_CTRL);
+	} else {
+		if (prev != vcpu) {
+			if (prev != NULL) {
+				vpmu_save(prev);
+			} else {
+				/* delivering a PMI masks it, the profiling may have too */
+				msr_write(MSR_IA32_EXT_APIC_LVT_PMI, VECTOR_PMI);
+			}
+			vpmu_restore(vcpu);
+			ctx->vpmu_vcpu = vcpu;
+		}
+		vpmu_set_msr_cnt(vcpu, MSR_AREA_COUNT);
+	}
+}
+
+/*
+ * The counters stay programmed but stopped, until the next owner or the
+ * profiling overwrites them.
+ */
+void vpmu_put(struct acrn_vcpu *vcpu)
+{
+	struct sched_context *ctx = &per_cpu(sched_ctx, vcpu->pcpu_id);
+
+	if (ctx->vpmu_vcpu == vcpu) {
+		ctx->vpmu_vcpu = NULL;
+	}
+}
+
+bool vpmu_handle_pmi(void)
+{
+	struct acrn_vcpu *vcpu = get_cpu_var(sched_ctx).vpmu_vcpu;
+	bool handled = false;
+
+	if ((vcpu != NULL) && ((msr_read(MSR_IA32_PERF_GLOBAL_STATUS) & vpmu_caps.global_mask) != 0UL)) {
+		/* the guest acknowledges the overflows itself */
+		(void)vlapic_set_local_intr(vcpu->vm, vcpu->vcpu_id, APIC_LVT_PMC);
+		handled = true;
+	}
+	msr_write(MSR_IA32_EXT_APIC_LVT_PMI, VECTOR_PMI);
+
+	return handled;
+}
+
+static int32_t vpmu_gp_index(uint32_t msr, uint32_t base, uint32_t *idx)
+{
+	int32_t ret = -EACCES;
+
+	if ((msr - base) < vpmu_caps.nr_gp) {
+		*idx = msr - base;
+		ret = 0;
+	}
+
+	return ret;
+}
+
+int32_t vpmu_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *val)
+{
+	const struct acrn_vpmu *vpmu = &vcpu->arch.vpmu;
+	bool loaded = is_vpmu_loaded(vcpu);
+	uint32_t idx = 0U;
+	int32_t ret = 0;
+
+	if (!is_vpmu_enabled(vcpu->vm)) {
+		return -EACCES;
+	}
+
+	if ((msr >= MSR_IA32_PMC0) && (msr <= MSR_IA32_PMC7)) {
+		ret = vpmu_gp_index(msr, MSR_IA32_PMC0, &idx);
+		if (ret == 0) {
+			*val = loaded ? msr_read(msr) : vpmu->pmc[idx];
+		}
+	} else if ((msr >= MSR_IA32_A_PMC0) && (msr <= MSR_IA32_A_PMC7)) {
+		ret = vpmu_caps.full_width ? vpmu_gp_index(msr, MSR_IA32_A_PMC0, &idx) : -EACCES;
+		if (ret == 0) {
+			*val = loaded ? msr_read(MSR_IA32_PMC0 + idx) : vpmu->pmc[idx];
+		}
+	} else if ((msr >= MSR_IA32_PERFEVTSEL0) && (msr <= MSR_IA32_PERFEVTSEL3)) {
+		ret = vpmu_gp_index(msr, MSR_IA32_PERFEVTSEL0, &idx);
+		if (ret == 0) {
+			*val = loaded ? msr_read(msr) : vpmu->evtsel[idx];
+		}
+	} else if ((msr >= MSR_IA32_FIXED_CTR0) && (msr <= MSR_IA32_FIXED_CTR2)) {
+		idx = msr - MSR_IA32_FIXED_CTR0;
+		if (idx < vpmu_caps.nr_fixed) {
+			*val = loaded ? msr_read(msr) : vpmu->fixed_ctr[idx];
+		} else {
+			ret = -EACCES;
+		}
+	} else {
+		switch (msr) {
+		case MSR_IA32_FIXED_CTR_CTL:
+			*val = loaded ? msr_read(msr) : vpmu->fixed_ctr_ctl;
+			break;
+		case MSR_IA32_PERF_GLOBAL_STATUS:
+			*val = loaded ? (msr_read(msr) & vpmu_caps.global_mask) : vpmu->global_status;
+			break;
+		case MSR_IA32_PERF_GLOBAL_CTRL:
+			*val = vcpu->arch.msr_area.guest[MSR_AREA_PERF_GLOBAL_CTRL].value;
+			break;
+		case MSR_IA32_PERF_GLOBAL_OVF_CTRL:
+			*val = 0UL;
+			break;
+		default:
+			/* IA32_PERF_GLOBAL_STATUS_SET and INUSE are version 4 */
+			ret = -EACCES;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+int32_t vpmu_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t val)
+{
+	struct acrn_vpmu *vpmu = &vcpu->arch.vpmu;
+	bool loaded = is_vpmu_loaded(vcpu);
+	uint64_t fixed_ctl_mask = 0UL;
+	uint32_t idx = 0U;
+	int32_t ret = 0;
+
+	if (!is_vpmu_enabled(vcpu->vm)) {
+		return -EACCES;
+	}
+
+	if ((msr >= MSR_IA32_PMC0) && (msr <= MSR_IA32_PMC7)) {
+		ret = vpmu_gp_index(msr, MSR_IA32_PMC0, &idx);
+		if (ret == 0) {
+			if (loaded) {
+				msr_write(msr, val);
+			} else {
+				/* sign extended from bit 31, like the hardware does */
+				vpmu->pmc[idx] = (uint64_t)(int64_t)(int32_t)(uint32_t)val & vpmu_caps.gp_mask;
+			}
+		}
+	} else if ((msr >= MSR_IA32_A_PMC0) && (msr <= MSR_IA32_A_PMC7)) {
+		ret = vpmu_caps.full_width ? vpmu_gp_index(msr, MSR_IA32_A_PMC0, &idx) : -EACCES;
+		if (ret == 0) {
+			if (loaded) {
+				msr_write(msr, val & vpmu_caps.gp_mask);
+			} else {
+				vpmu->pmc[idx] = val & vpmu_caps.gp_mask;
+			}
+		}
+	} else if ((msr >= MSR_IA32_PERFEVTSEL0) && (msr <= MSR_IA32_PERFEVTSEL3)) {
+		ret = vpmu_gp_index(msr, MSR_IA32_PERFEVTSEL0, &idx);
+		if (ret == 0) {
+			/* no counting of the events of the sibling threads */
+			if (loaded) {
+				msr_write(msr, val & VPMU_EVTSEL_VALID);
+			} else {
+				vpmu->evtsel[idx] = val & VPMU_EVTSEL_VALID;
+			}
+		}
+	} else if ((msr >= MSR_IA32_FIXED_CTR0) && (msr <= MSR_IA32_FIXED_CTR2)) {
+		idx = msr - MSR_IA32_FIXED_CTR0;
+		if (idx >= vpmu_caps.nr_fixed) {
+			ret = -EACCES;
+		} else if (loaded) {
+			msr_write(msr, val & vpmu_caps.fixed_mask);
+		} else {
+			vpmu->fixed_ctr[idx] = val & vpmu_caps.fixed_mask;
+		}
+	} else {
+		switch (msr) {
+		case MSR_IA32_FIXED_CTR_CTL:
+			for (idx = 0U; idx < vpmu_caps.nr_fixed; idx++) {
+				fixed_ctl_mask |= VPMU_FIXED_CTL_VALID << (idx * 4U);
+			}
+			if (loaded) {
+				msr_write(msr, val & fixed_ctl_mask);
+			} else {
+				vpmu->fixed_ctr_ctl = val & fixed_ctl_mask;
+			}
+			break;
+		case MSR_IA32_PERF_GLOBAL_CTRL:
+			if ((val & ~vpmu_caps.global_mask) != 0UL) {
+				ret = -EACCES;
+			} else {
+				/* loaded on VM entry */
+				vcpu->arch.msr_area.guest[MSR_AREA_PERF_GLOBAL_CTRL].value = val;
+			}
+			break;
+		case MSR_IA32_PERF_GLOBAL_OVF_CTRL:
+			if (loaded) {
+				msr_write(msr, val & vpmu_caps.global_mask);
+			} else {
+				vpmu->global_status &= ~val;
+			}
+			break;
+		default:
+			/* IA32_PERF_GLOBAL_STATUS is read-only */
+			ret = -EACCES;
+			break;
+		}
+	}
+
+	return ret;
+}
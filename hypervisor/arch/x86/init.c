@@ -54,6 +54,7 @@ static void init_passthru(void)
 static void init_guest(void)
 {
 	init_scheduler();
+	init_work_queues();
 }
 
 /*TODO: move into guest-vcpu module */
@@ -88,6 +89,8 @@ static void bsp_boot_post(void)
 
 	init_debug_post(BOOT_CPU_ID);
 
+	init_vpmu();
+
 	init_passthru();
 
 	enter_guest_mode(BOOT_CPU_ID);
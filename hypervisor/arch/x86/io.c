@@ -10,13 +10,10 @@
 
 static void complete_ioreq(struct acrn_vcpu *vcpu, struct io_request *io_req)
 {
-	union vhm_request_buffer *req_buf = NULL;
 	struct vhm_request *vhm_req;
 
-	req_buf = (union vhm_request_buffer *)(vcpu->vm->sw.io_shared_page);
-
 	stac();
-	vhm_req = &req_buf->req_queue[vcpu->vcpu_id];
+	vhm_req = get_vhm_req(vcpu->vm, vcpu->vcpu_id);
 	if (io_req != NULL) {
 		switch (vcpu->req.type) {
 		case REQ_PORTIO:
@@ -136,17 +133,48 @@ static void io_instr_dest_handler(struct io_request *io_req)
  */
 void emulate_io_post(struct acrn_vcpu *vcpu)
 {
+	struct vhm_request *vhm_req;
+	uint32_t state;
+
 	if (get_vhm_req_state(vcpu->vm, vcpu->vcpu_id)
 		!= REQ_STATE_COMPLETE) {
 		return;
 	}
 
+	/*
+	 * In adaptive mode SOS may notify a completion the hypervisor has
+	 * just found by polling, claim it so that only one of them posts it.
+	 * The request is not reused before the post work reads it, as the
+	 * vcpu stays paused till then.
+	 */
+	stac();
+	vhm_req = get_vhm_req(vcpu->vm, vcpu->vcpu_id);
+	state = atomic_cmpxchg32(&vhm_req->processed, REQ_STATE_COMPLETE, REQ_STATE_FREE);
+	clac();
+	if (state != REQ_STATE_COMPLETE) {
+		return;
+	}
+
+	vcpu->sched.dm_wait += rdtsc() - vcpu->sched.dm_wait_start;
+	vcpu->sched.dm_requests++;
+	if (vcpu->vm->sw.is_completion_adaptive) {
+		record_ioreq_latency(vcpu);
+	}
+
 	/*
 	 * If vcpu is in Zombie state and will be destroyed soon. Just
-	 * mark ioreq done and don't resume vcpu.
+	 * mark ioreq done and don't resume vcpu. A VM paused for its state
+	 * to be saved may be resumed instead, let the vcpu then execute the
+	 * access again, as its result is dropped here.
 	 */
 	if (vcpu->state == VCPU_ZOMBIE) {
 		complete_ioreq(vcpu, NULL);
+		get_schedule_lock(vcpu->pcpu_id);
+		if (vcpu->prev_state == VCPU_PAUSED) {
+			vcpu_retain_rip(vcpu);
+			vcpu->prev_state = VCPU_RUNNING;
+		}
+		release_schedule_lock(vcpu->pcpu_id);
 		return;
 	}
 
@@ -176,6 +204,52 @@ void emulate_io_post(struct acrn_vcpu *vcpu)
 	resume_vcpu(vcpu);
 }
 
+/**
+ * @brief Get the emulated port io index which \p port belongs to
+ *
+ * @return The emulated port io index, or EMUL_PIO_IDX_MAX if \p port is not
+ * emulated by the hypervisor.
+ */
+static inline uint32_t get_pio_idx(const struct vm_io_lookup *lookup, uint16_t port)
+{
+	uint32_t page = lookup->l1[port >> EMUL_PIO_L1_SHIFT];
+	uint32_t idx = EMUL_PIO_IDX_MAX;
+
+	if (page != 0U) {
+		idx = lookup->l2[page - 1U][port & EMUL_PIO_L2_MASK];
+		idx = (idx != 0U) ? (idx - 1U) : EMUL_PIO_IDX_MAX;
+	}
+
+	return idx;
+}
+
+/**
+ * @brief Point the ports in [\p port_start, \p port_end) to \p pio_idx
+ *
+ * @param entry \p pio_idx plus one, or 0 to remove the ports from the table
+ */
+static void set_pio_idx(struct vm_io_lookup *lookup, uint16_t port_start,
+		uint16_t port_end, uint8_t entry)
+{
+	uint32_t port, page;
+
+	for (port = port_start; port < port_end; port++) {
+		page = port >> EMUL_PIO_L1_SHIFT;
+		if (lookup->l1[page] == 0U) {
+			if (entry == 0U) {
+				continue;
+			}
+			if (lookup->l2_used >= EMUL_PIO_L2_PAGES) {
+				pr_err("no free page in pio lookup table for port 0x%x", port);
+				break;
+			}
+			lookup->l2_used++;
+			lookup->l1[page] = lookup->l2_used;
+		}
+		lookup->l2[lookup->l1[page] - 1U][port & EMUL_PIO_L2_MASK] = entry;
+	}
+}
+
 /**
  * Try handling the given request by any port I/O handler registered in the
  * hypervisor.
@@ -201,12 +275,10 @@ hv_emulate_pio(const struct acrn_vcpu *vcpu, struct io_request *io_req)
 	size = (uint16_t)pio_req->size;
 	mask = 0xFFFFFFFFU >> (32U - 8U * size);
 
-	for (idx = 0U; idx < EMUL_PIO_IDX_MAX; idx++) {
+	idx = get_pio_idx(&vm->arch_vm.pio_lookup, port);
+	if (idx < EMUL_PIO_IDX_MAX) {
 		handler = &(vm->arch_vm.emul_pio[idx]);
-
-		if ((port < handler->port_start) || (port >= handler->port_end)) {
-			continue;
-		}
+		atomic_inc64(&handler->access_cnt);
 
 		if (pio_req->direction == REQUEST_WRITE) {
 			if (handler->io_write != NULL) {
@@ -220,16 +292,47 @@ hv_emulate_pio(const struct acrn_vcpu *vcpu, struct io_request *io_req)
 			pr_dbg("IO read on port %04x, data %08x", port, pio_req->value);
 		}
 		status = 0;
-		break;
 	}
 
 	return status;
 }
 
+/**
+ * Find the emulated MMIO region that may contain \p address.
+ *
+ * The regions in vm->emul_mmio[] are kept sorted by range_start and do not
+ * overlap, so a binary search for the last region starting at or below
+ * \p address is sufficient.
+ *
+ * @return The index of the last region whose range_start <= \p address, or
+ * vm->emul_mmio_regions if there is no such region.
+ */
+static uint16_t find_mmio_node_idx(const struct acrn_vm *vm, uint64_t address)
+{
+	uint16_t low = 0U;
+	uint16_t high = vm->emul_mmio_regions;
+	uint16_t mid;
+
+	while (low < high) {
+		mid = low + ((high - low) >> 1U);
+		if (vm->emul_mmio[mid].range_start <= address) {
+			low = mid + 1U;
+		} else {
+			high = mid;
+		}
+	}
+
+	return (low > 0U) ? (low - 1U) : vm->emul_mmio_regions;
+}
+
 /**
  * Use registered MMIO handlers on the given request if it falls in the range of
  * any of them.
  *
+ * The region hit by the previous MMIO access of \p vcpu is checked first, as
+ * guests tend to access the same device repeatedly. Otherwise the sorted
+ * region array is binary-searched.
+ *
  * @pre io_req->type == REQ_MMIO
  *
  * @retval 0 Successfully emulated by registered handlers.
@@ -240,32 +343,41 @@ static int32_t
 hv_emulate_mmio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 {
 	int32_t status = -ENODEV;
-	uint16_t idx;
+	uint16_t idx, next;
 	uint64_t address, size;
+	struct acrn_vm *vm = vcpu->vm;
 	struct mmio_request *mmio_req = &io_req->reqs.mmio;
 	struct mem_io_node *mmio_handler = NULL;
+	uint64_t start;
 
 	address = mmio_req->address;
 	size = mmio_req->size;
 
-	for (idx = 0U; idx < vcpu->vm->emul_mmio_regions; idx++) {
-		uint64_t base, end;
-
-		mmio_handler = &(vcpu->vm->emul_mmio[idx]);
-		base = mmio_handler->range_start;
-		end = mmio_handler->range_end;
+	idx = vcpu->mmio_hint;
+	if ((idx >= vm->emul_mmio_regions) || (address < vm->emul_mmio[idx].range_start) ||
+			(address >= vm->emul_mmio[idx].range_end)) {
+		idx = find_mmio_node_idx(vm, address);
+	}
 
-		if (((address + size) <= base) || (address >= end)) {
-			continue;
-		} else if (!((address >= base) && ((address + size) <= end))) {
+	if ((idx < vm->emul_mmio_regions) && (address < vm->emul_mmio[idx].range_end)) {
+		mmio_handler = &(vm->emul_mmio[idx]);
+		if ((address + size) > mmio_handler->range_end) {
 			pr_fatal("Err MMIO, address:0x%llx, size:%x", address, size);
-			return -EIO;
+			status = -EIO;
 		} else {
 			/* Handle this MMIO operation */
-			if (mmio_handler->read_write != NULL) {
-				status = mmio_handler->read_write(io_req, mmio_handler->handler_private_data);
-				break;
-			}
+			vcpu->mmio_hint = idx;
+			start = rdtsc();
+			status = mmio_handler->read_write(io_req, mmio_handler->handler_private_data);
+			vcpu->exit_stats.mmio_count[idx]++;
+			vcpu->exit_stats.mmio_cycles[idx] += rdtsc() - start;
+		}
+	} else {
+		/* The access may still run into the next region */
+		next = (idx < vm->emul_mmio_regions) ? (idx + 1U) : 0U;
+		if ((next < vm->emul_mmio_regions) && ((address + size) > vm->emul_mmio[next].range_start)) {
+			pr_fatal("Err MMIO, address:0x%llx, size:%x", address, size);
+			status = -EIO;
 		}
 	}
 
@@ -319,11 +431,23 @@ emulate_io(struct acrn_vcpu *vcpu, struct io_request *io_req)
 		/*
 		 * No handler from HV side, search from VHM in Dom0
 		 *
-		 * ACRN insert request to VHM and inject upcall.
+		 * ACRN insert request to VHM and inject upcall. Writes to
+		 * ioeventfds and posted ranges do not need to wait for the
+		 * completion, and clock reads SOS shares the state of are
+		 * completed here.
 		 */
-		status = acrn_insert_request_wait(vcpu, io_req);
+		if ((acrn_complete_clock_read(vcpu, io_req) == 0) ||
+				(acrn_signal_ioeventfd(vcpu, io_req) == 0) ||
+				(acrn_insert_posted_request(vcpu, io_req) == 0)) {
+			status = 0;
+		} else {
+			status = acrn_insert_request_wait(vcpu, io_req);
+			if (status == 0) {
+				status = IOREQ_PENDING;
+			}
+		}
 
-		if (status != 0) {
+		if (status < 0) {
 			/* here for both IO & MMIO, the direction, address,
 			 * size definition is same
 			 */
@@ -332,8 +456,6 @@ emulate_io(struct acrn_vcpu *vcpu, struct io_request *io_req)
 				"addr = 0x%llx, size=%lu", __func__,
 				pio_req->direction, io_req->type,
 				pio_req->address, pio_req->size);
-		} else {
-			status = IOREQ_PENDING;
 		}
 #endif
 	}
@@ -346,6 +468,106 @@ emulate_io(struct acrn_vcpu *vcpu, struct io_request *io_req)
  *
  * @param vcpu The virtual CPU which triggers the VM exit on I/O instruction
  */
+/* Most bytes of an OUTS string emulated within one VM exit */
+#define PIO_STRING_BATCH	64U
+
+/* Add \p delta to \p reg, within the address size of the instruction */
+static void pio_string_adjust_reg(struct acrn_vcpu *vcpu, enum cpu_reg_name reg,
+	uint64_t addr_mask, uint64_t delta)
+{
+	uint64_t val = vcpu_get_gpreg(vcpu, reg);
+
+	if (addr_mask == 0xFFFFUL) {
+		val = (val & ~addr_mask) | ((val + delta) & addr_mask);
+	} else {
+		/* A 32 bit result zero-extends in 64 bit mode */
+		val = (val + delta) & addr_mask;
+	}
+	vcpu_set_gpreg(vcpu, reg, val);
+}
+
+/**
+ * @brief Emulate (REP) OUTS
+ *
+ * Elements are fetched from the guest linear address VMX provides. As long
+ * as the writes complete without waiting (hypervisor handler, ioeventfd or
+ * posted range), up to PIO_STRING_BATCH bytes are written within this exit;
+ * one waiting for the device model ends the batch. RSI and RCX are updated
+ * as the processor would, and
+ * RIP is retained while the count is not exhausted so that the guest
+ * resumes the string by itself.
+ *
+ * @pre io_req->reqs.pio is filled in for a write
+ *
+ * @return The status of the last emulate_io(), or 0 on a page fault.
+ */
+static int32_t emulate_pio_outs(struct acrn_vcpu *vcpu, struct io_request *io_req, uint64_t exit_qual)
+{
+	struct pio_request *pio_req = &io_req->reqs.pio;
+	uint8_t buf[PIO_STRING_BATCH];
+	uint64_t size = pio_req->size;
+	uint64_t addr_mask, count, nr, done, fault_addr, step;
+	uint64_t gla = exec_vmread(VMX_GUEST_LINEAR_ADDR);
+	uint32_t addr_size = (exec_vmread32(VMX_INSTR_INFO) >> 7U) & 0x7U;
+	uint32_t err_code = 0U;
+	bool down = ((vcpu_get_rflags(vcpu) & PSL_D) != 0UL);
+	int32_t status = 0;
+
+	if (addr_size == 0U) {
+		addr_mask = 0xFFFFUL;
+	} else if (addr_size == 1U) {
+		addr_mask = 0xFFFFFFFFUL;
+	} else {
+		addr_mask = ~0UL;
+	}
+
+	if (vm_exit_io_instruction_is_rep_prefixed(exit_qual) != 0UL) {
+		count = vcpu_get_gpreg(vcpu, CPU_REG_RCX) & addr_mask;
+	} else {
+		count = 1UL;
+	}
+
+	/* Backward strings, rare in practice, go one element per exit */
+	nr = down ? 1UL : (PIO_STRING_BATCH / size);
+	if (nr > count) {
+		nr = count;
+	}
+
+	done = 0UL;
+	if ((nr != 0UL) && (copy_from_gva(vcpu, buf, gla, (uint32_t)(nr * size), &err_code, &fault_addr) < 0)) {
+		vcpu_inject_pf(vcpu, fault_addr, err_code);
+		vcpu_retain_rip(vcpu);
+		nr = 0UL;
+		count = 0UL;
+	}
+
+	while (done < nr) {
+		pio_req->value = 0U;
+		(void)memcpy_s(&pio_req->value, sizeof(pio_req->value), &buf[done * size], size);
+
+		status = emulate_io(vcpu, io_req);
+		done++;
+
+		if (status != 0) {
+			/* Waits for the device model, which completes it */
+			break;
+		}
+	}
+
+	if (done != 0UL) {
+		step = done * size;
+		pio_string_adjust_reg(vcpu, CPU_REG_RSI, addr_mask, down ? (0UL - step) : step);
+		if (vm_exit_io_instruction_is_rep_prefixed(exit_qual) != 0UL) {
+			pio_string_adjust_reg(vcpu, CPU_REG_RCX, addr_mask, 0UL - done);
+			if (done < count) {
+				vcpu_retain_rip(vcpu);
+			}
+		}
+	}
+
+	return status;
+}
+
 int32_t pio_instr_vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	int32_t status;
@@ -372,7 +594,11 @@ int32_t pio_instr_vmexit_handler(struct acrn_vcpu *vcpu)
 		(uint32_t)pio_req->size,
 		(uint32_t)cur_context_idx);
 
-	status = emulate_io(vcpu, io_req);
+	if ((pio_req->direction == REQUEST_WRITE) && (vm_exit_io_instruction_is_string(exit_qual) != 0UL)) {
+		status = emulate_pio_outs(vcpu, io_req, exit_qual);
+	} else {
+		status = emulate_io(vcpu, io_req);
+	}
 
 	if (status == 0) {
 		emulate_pio_post(vcpu, io_req);
@@ -446,17 +672,29 @@ void setup_io_bitmap(struct acrn_vm *vm)
  * @param io_read_fn_ptr The handler for emulating reads from the given range
  * @param io_write_fn_ptr The handler for emulating writes to the given range
  * @pre pio_idx < EMUL_PIO_IDX_MAX
+ *
+ * @remark The ports are added to the lookup table of \p vm so that
+ * hv_emulate_pio() finds the handler by direct indexing.
  */
 void register_io_emulation_handler(struct acrn_vm *vm, uint32_t pio_idx,
 		const struct vm_io_range *range, io_read_fn_t io_read_fn_ptr, io_write_fn_t io_write_fn_ptr)
 {
+	struct vm_io_handler_desc *handler = &vm->arch_vm.emul_pio[pio_idx];
+
 	if (is_vm0(vm)) {
 		deny_guest_pio_access(vm, range->base, range->len);
 	}
-	vm->arch_vm.emul_pio[pio_idx].port_start = range->base;
-	vm->arch_vm.emul_pio[pio_idx].port_end = range->base + range->len;
-	vm->arch_vm.emul_pio[pio_idx].io_read = io_read_fn_ptr;
-	vm->arch_vm.emul_pio[pio_idx].io_write = io_write_fn_ptr;
+
+	/* Drop the ports of a previous registration on the same index */
+	set_pio_idx(&vm->arch_vm.pio_lookup, handler->port_start, handler->port_end, 0U);
+
+	handler->port_start = range->base;
+	handler->port_end = range->base + range->len;
+	handler->io_read = io_read_fn_ptr;
+	handler->io_write = io_write_fn_ptr;
+	handler->access_cnt = 0UL;
+
+	set_pio_idx(&vm->arch_vm.pio_lookup, handler->port_start, handler->port_end, (uint8_t)(pio_idx + 1U));
 }
 
 /**
@@ -471,7 +709,11 @@ void register_io_emulation_handler(struct acrn_vm *vm, uint32_t pio_idx,
  * @param handler_private_data Handler-specific data which will be passed to \p read_write when called
  *
  * @retval 0 Registration succeeds
- * @retval -EINVAL \p read_write is NULL, \p end is not larger than \p start or \p vm has been launched
+ * @retval -EINVAL \p read_write is NULL, \p end is not larger than \p start,
+ * the range overlaps a registered one or \p vm has been launched
+ *
+ * @remark vm->emul_mmio[] is kept sorted by the start address so that
+ * hv_emulate_mmio() can binary-search it.
  */
 int32_t register_mmio_emulation_handler(struct acrn_vm *vm,
 	hv_mem_io_handler_t read_write, uint64_t start,
@@ -479,6 +721,7 @@ int32_t register_mmio_emulation_handler(struct acrn_vm *vm,
 {
 	int32_t status = -EINVAL;
 	struct mem_io_node *mmio_node;
+	uint16_t idx, pos;
 
 	if ((vm->hw.created_vcpus > 0U) && vm->hw.vcpu_array[0].launched) {
 		ASSERT(false, "register mmio handler after vm launched");
@@ -492,7 +735,21 @@ int32_t register_mmio_emulation_handler(struct acrn_vm *vm,
 			pr_err("the emulated mmio region is out of range");
 			return status;
 		}
-		mmio_node = &(vm->emul_mmio[vm->emul_mmio_regions]);
+
+		/* Find the insert position and reject overlapping ranges */
+		idx = find_mmio_node_idx(vm, start);
+		pos = (idx < vm->emul_mmio_regions) ? (idx + 1U) : 0U;
+		if (((pos > 0U) && (vm->emul_mmio[pos - 1U].range_end > start)) ||
+				((pos < vm->emul_mmio_regions) && (vm->emul_mmio[pos].range_start < end))) {
+			pr_err("the emulated mmio region [0x%llx, 0x%llx) overlaps", start, end);
+			return status;
+		}
+
+		for (idx = vm->emul_mmio_regions; idx > pos; idx--) {
+			vm->emul_mmio[idx] = vm->emul_mmio[idx - 1U];
+		}
+
+		mmio_node = &(vm->emul_mmio[pos]);
 		/* Fill in information for this node */
 		mmio_node->read_write = read_write;
 		mmio_node->handler_private_data = handler_private_data;
@@ -507,7 +764,7 @@ int32_t register_mmio_emulation_handler(struct acrn_vm *vm,
 		 * need to unmap it.
 		 */
 		if (is_vm0(vm)) {
-			ept_mr_del(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
+			(void)ept_mr_del(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
 				start, end - start);
 		}
 
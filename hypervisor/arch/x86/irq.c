@@ -26,6 +26,7 @@ static struct static_mapping_table irq_static_mappings[NR_STATIC_MAPPINGS] = {
 	{NOTIFY_IRQ, VECTOR_NOTIFY_VCPU},
 	{POSTED_INTR_NOTIFY_IRQ, VECTOR_POSTED_INTR},
 	{PMI_IRQ, VECTOR_PMI},
+	{POSTED_INTR_WAKEUP_IRQ, VECTOR_POSTED_INTR_WAKEUP},
 };
 
 /*
@@ -354,6 +355,7 @@ void dispatch_interrupt(const struct intr_excp_ctx *ctx)
 	desc->ctx_rip = ctx->rip;
 	desc->ctx_rflags = ctx->rflags;
 	desc->ctx_cs = ctx->cs;
+	desc->ctx_rbp = ctx->gp_regs.rbp;
 #endif
 	handle_irq(desc);
 	return;
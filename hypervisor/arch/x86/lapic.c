@@ -247,17 +247,32 @@ send_startup_ipi(enum intr_cpu_startup_shorthand cpu_startup_shorthand,
 void send_dest_ipi_mask(uint32_t dest_mask, uint32_t vector)
 {
 	union apic_icr icr;
-	uint16_t pcpu_id;
+	uint16_t pcpu_id, i;
 	uint32_t mask = dest_mask;
+	uint32_t cluster;
 
-	icr.value_32.lo_32 = vector | (INTR_LAPIC_ICR_PHYSICAL << 11U);
+	/*
+	 * In x2APIC logical mode one IPI reaches any of the up to 16 CPUs
+	 * of a cluster, so send one per cluster rather than per pCPU.
+	 */
+	icr.value_32.lo_32 = vector | (INTR_LAPIC_ICR_LOGICAL << 11U);
 
 	pcpu_id = ffs64(mask);
 
 	while (pcpu_id != INVALID_BIT_INDEX) {
 		bitmap32_clear_nolock(pcpu_id, &mask);
 		if (bitmap_test(pcpu_id, &pcpu_active_bitmap)) {
-			icr.value_32.hi_32 = per_cpu(lapic_id, pcpu_id);
+			cluster = per_cpu(lapic_ldr, pcpu_id) & X2APIC_LDR_CLUSTER_MASK;
+			icr.value_32.hi_32 = per_cpu(lapic_ldr, pcpu_id);
+
+			for (i = pcpu_id + 1U; i < phys_cpu_num; i++) {
+				if (bitmap32_test(i, &mask) && bitmap_test(i, &pcpu_active_bitmap) &&
+					((per_cpu(lapic_ldr, i) & X2APIC_LDR_CLUSTER_MASK) == cluster)) {
+					bitmap32_clear_nolock(i, &mask);
+					icr.value_32.hi_32 |= per_cpu(lapic_ldr, i);
+				}
+			}
+
 			msr_write(MSR_IA32_EXT_APIC_ICR, icr.value);
 		} else {
 			pr_err("pcpu_id %d not in active!", pcpu_id);
@@ -136,6 +136,11 @@ int32_t check_vmx_mmu_cap(void)
 	return 0;
 }
 
+bool cpu_has_ept_ad(void)
+{
+	return cpu_has_vmx_ept_cap(VMX_EPT_AD);
+}
+
 uint16_t allocate_vpid(void)
 {
 	uint16_t vpid = atomic_xadd16(&vmx_vpid_nr, 1U);
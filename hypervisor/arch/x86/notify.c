@@ -5,11 +5,10 @@
  */
 
 #include <hypervisor.h>
+#include <softirq.h>
 
 static uint32_t notification_irq = IRQ_INVALID;
 
-static uint64_t smp_call_mask = 0UL;
-
 /* run in interrupt context */
 static void kick_notification(__unused uint32_t irq, __unused void *data)
 {
@@ -17,42 +16,98 @@ static void kick_notification(__unused uint32_t irq, __unused void *data)
 	 * And it also serves for smp call.
 	 */
 	uint16_t pcpu_id = get_cpu_id();
+	struct smp_call_node *node, *next, *list = NULL;
+	struct smp_call_request *req;
+
+	/* take all queued requests at once, producers only ever push */
+	node = (struct smp_call_node *)atomic_swap64(&per_cpu(smp_call_queue, pcpu_id), 0UL);
+
+	/* the queue is LIFO, run the requests in the order they came */
+	while (node != NULL) {
+		next = node->next;
+		node->next = list;
+		list = node;
+		node = next;
+	}
 
-	if (bitmap_test(pcpu_id, &smp_call_mask)) {
-		struct smp_call_info_data *smp_call =
-			&per_cpu(smp_call_info, pcpu_id);
-
-		if (smp_call->func != NULL) {
-			smp_call->func(smp_call->data);
+	while (list != NULL) {
+		/* the requester may release the request once its bit clears */
+		next = list->next;
+		req = list->req;
+		if (req->func != NULL) {
+			req->func(req->data);
 		}
-		bitmap_clear_lock(pcpu_id, &smp_call_mask);
+		bitmap_clear_lock(pcpu_id, &req->pending);
+		list = next;
 	}
 }
 
-void smp_call_function(uint64_t mask, smp_call_func_t func, void *data)
+static void smp_call_enqueue(uint16_t pcpu_id, struct smp_call_node *node)
+{
+	uint64_t *queue = &per_cpu(smp_call_queue, pcpu_id);
+	uint64_t head;
+
+	do {
+		head = atomic_load64(queue);
+		node->next = (struct smp_call_node *)head;
+	} while (atomic_cmpxchg64(queue, head, (uint64_t)node) != head);
+}
+
+void smp_call_function_async(uint64_t mask, struct smp_call_request *req,
+		smp_call_func_t func, void *data)
 {
 	uint16_t pcpu_id;
-	struct smp_call_info_data *smp_call;
+	uint64_t targets = 0UL;
+	uint64_t remaining = mask;
 
-	/* wait for previous smp call complete, which may run on other cpus */
-	while (atomic_cmpxchg64(&smp_call_mask, 0UL, mask & INVALID_BIT_INDEX) != 0UL);
-	pcpu_id = ffs64(mask);
+	req->func = func;
+	req->data = data;
+
+	pcpu_id = ffs64(remaining);
 	while (pcpu_id != INVALID_BIT_INDEX) {
-		bitmap_clear_nolock(pcpu_id, &mask);
+		bitmap_clear_nolock(pcpu_id, &remaining);
 		if (bitmap_test(pcpu_id, &pcpu_active_bitmap)) {
-			smp_call = &per_cpu(smp_call_info, pcpu_id);
-			smp_call->func = func;
-			smp_call->data = data;
+			bitmap_set_nolock(pcpu_id, &targets);
 		} else {
 			/* pcpu is not in active, print error */
 			pr_err("pcpu_id %d not in active!", pcpu_id);
-			bitmap_clear_nolock(pcpu_id, &smp_call_mask);
 		}
-		pcpu_id = ffs64(mask);
+		pcpu_id = ffs64(remaining);
+	}
+
+	/* publish the pending mask before any target can run the request */
+	atomic_store64(&req->pending, targets);
+
+	remaining = targets;
+	pcpu_id = ffs64(remaining);
+	while (pcpu_id != INVALID_BIT_INDEX) {
+		bitmap_clear_nolock(pcpu_id, &remaining);
+		req->node[pcpu_id].req = req;
+		smp_call_enqueue(pcpu_id, &req->node[pcpu_id]);
+		pcpu_id = ffs64(remaining);
+	}
+
+	if (targets != 0UL) {
+		send_dest_ipi_mask((uint32_t)targets, VECTOR_NOTIFY_VCPU);
 	}
-	send_dest_ipi_mask((uint32_t)smp_call_mask, VECTOR_NOTIFY_VCPU);
-	/* wait for current smp call complete */
-	wait_sync_change(&smp_call_mask, 0UL);
+}
+
+bool smp_call_done(const struct smp_call_request *req)
+{
+	return (atomic_load64(&req->pending) == 0UL);
+}
+
+void smp_call_wait(struct smp_call_request *req)
+{
+	wait_sync_change(&req->pending, 0UL);
+}
+
+void smp_call_function(uint64_t mask, smp_call_func_t func, void *data)
+{
+	struct smp_call_request req;
+
+	smp_call_function_async(mask, &req, func, data);
+	smp_call_wait(&req);
 }
 
 static int32_t request_notification_irq(irq_action_t func, void *data)
@@ -95,20 +150,56 @@ void setup_notification(void)
 		notification_irq, irq_to_vector(notification_irq));
 }
 
+/*
+ * The IOMMU posts interrupts of passthrough devices into the PIR of a vCPU
+ * which may not be in non-root mode: make every such vCPU of this pCPU pick
+ * them up in its next VM entry, waking it up if it is halted.
+ */
+static void posted_intr_softirq(uint16_t pcpu_id)
+{
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	uint16_t vm_id, i;
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		if (vm == NULL) {
+			continue;
+		}
+
+		foreach_vcpu(i, vm, vcpu) {
+			if ((vcpu->pcpu_id == pcpu_id) &&
+				bitmap_test(PID_ON_BIT, &(vcpu_vlapic(vcpu)->pir_desc.pending))) {
+				vcpu_make_request(vcpu, ACRN_REQUEST_EVENT);
+			}
+		}
+	}
+}
+
 static void posted_intr_notification(__unused uint32_t irq, __unused void *data)
 {
-	/* Dummy IRQ handler for case that Posted-Interrupt Notification
-	 * is sent to vCPU in root mode(isn't running),interrupt will be
-	 * picked up in next vmentry,do nothine here.
+	/* Posted-Interrupt Notification is sent to vCPU in root mode(isn't
+	 * running), or is the wakeup of a halted vCPU: the interrupt is
+	 * picked up from the PIR in next vmentry, scheduled in softirq as
+	 * the vCPU may have to be woken up.
 	 */
+	fire_softirq(SOFTIRQ_POSTED_INTR);
 }
 
 /*pre-conditon: be called only by BSP initialization proccess*/
 void setup_posted_intr_notification(void)
 {
+	register_softirq(SOFTIRQ_POSTED_INTR, posted_intr_softirq);
+
 	if (request_irq(POSTED_INTR_NOTIFY_IRQ,
 			posted_intr_notification,
 			NULL, IRQF_NONE) < 0) {
 		pr_err("Failed to setup posted-intr notification");
 	}
+
+	if (request_irq(POSTED_INTR_WAKEUP_IRQ,
+			posted_intr_notification,
+			NULL, IRQF_NONE) < 0) {
+		pr_err("Failed to setup posted-intr wakeup");
+	}
 }
@@ -10,6 +10,7 @@ static struct page ppt_pdpt_pages[PDPT_PAGE_NUM(CONFIG_PLATFORM_RAM_SIZE + PLATF
 static struct page ppt_pd_pages[PD_PAGE_NUM(CONFIG_PLATFORM_RAM_SIZE + PLATFORM_LO_MMIO_SIZE)];
 
 /* ppt: pripary page table */
+static struct pgtable_stats ppt_stats;
 static union pgtable_pages_info ppt_pages_info = {
 	.ppt = {
 		.pml4_base = ppt_pml4_pages,
@@ -51,6 +52,7 @@ static inline struct page *ppt_get_pd_page(const union pgtable_pages_info *info,
 
 const struct memory_ops ppt_mem_ops = {
 	.info = &ppt_pages_info,
+	.stats = &ppt_stats,
 	.get_default_access_right = ppt_get_default_access_right,
 	.pgentry_present = ppt_pgentry_present,
 	.get_pml4_page = ppt_get_pml4_page,
@@ -65,9 +67,26 @@ static struct page vm0_pt_pages[PT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZ
 
 /* uos_nworld_pml4_pages[i] is ...... of UOS i (whose vm_id = i +1) */
 static struct page uos_nworld_pml4_pages[CONFIG_MAX_VM_NUM - 1U][PML4_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-static struct page uos_nworld_pdpt_pages[CONFIG_MAX_VM_NUM - 1U][PDPT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-static struct page uos_nworld_pd_pages[CONFIG_MAX_VM_NUM - 1U][PD_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-static struct page uos_nworld_pt_pages[CONFIG_MAX_VM_NUM - 1U][PT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
+
+/*
+ * The other normal world paging structures of the UOSs come from one pool:
+ * a UOS takes what its mappings need, up to the worst case of its address
+ * space.
+ */
+#define EPT_POOL_PAGE_NUM	(CONFIG_UOS_EPT_POOL_SIZE >> PAGE_SHIFT)
+#define EPT_POOL_BITMAP_SIZE	INT_DIV_ROUNDUP(EPT_POOL_PAGE_NUM, 64UL)
+#define UOS_EPT_POOL_QUOTA	(PDPT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE)) + \
+				PD_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE)) + \
+				PT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE)))
+
+static struct page ept_pool_pages[EPT_POOL_PAGE_NUM];
+static uint64_t ept_pool_bitmap[EPT_POOL_BITMAP_SIZE];
+/* vm_id + 1 of the VM a page is taken by, 0 if free */
+static uint16_t ept_pool_owner[EPT_POOL_PAGE_NUM];
+/* pages neither taken nor reserved */
+static uint64_t ept_pool_free_pages = EPT_POOL_PAGE_NUM;
+static struct ept_pool_quota ept_pool_quotas[CONFIG_MAX_VM_NUM];
+static spinlock_t ept_pool_lock = { .head = 0U, .tail = 0U, };
 
 static struct page uos_sworld_pgtable_pages[CONFIG_MAX_VM_NUM - 1U][TRUSTY_PGTABLE_PAGE_NUM(TRUSTY_RAM_SIZE)];
 /* pre-assumption: TRUSTY_RAM_SIZE is 2M aligned */
@@ -91,6 +110,14 @@ void *get_reserve_sworld_memory_base(void)
 	return uos_sworld_memory;
 }
 
+bool is_reserve_sworld_memory(uint64_t hpa, uint64_t size)
+{
+	uint64_t base = hva2hpa(uos_sworld_memory);
+
+	return (hpa >= base) && (size <= sizeof(uos_sworld_memory)) &&
+		((hpa - base) <= (sizeof(uos_sworld_memory) - size));
+}
+
 static inline uint64_t ept_get_default_access_right(void)
 {
 	return EPT_RWX;
@@ -101,44 +128,181 @@ static inline uint64_t ept_pgentry_present(uint64_t pte)
 	return pte & EPT_RWX;
 }
 
+static struct page *ept_pool_alloc_page(struct ept_pool_quota *quota)
+{
+	struct page *page;
+	uint64_t idx, bit = EPT_POOL_PAGE_NUM;
+
+	spinlock_obtain(&ept_pool_lock);
+	if (quota->recycled != NULL) {
+		/* still taken by this VM, it only ever was in its own EPT */
+		page = quota->recycled;
+		quota->recycled = *(struct page **)(void *)page;
+	} else {
+		if (quota->reserved != 0UL) {
+			quota->reserved--;
+		} else if ((ept_pool_free_pages != 0UL) && (quota->used < quota->limit)) {
+			/* a mapping change which did not reserve, still within bounds */
+			ept_pool_free_pages--;
+		} else {
+			panic("EPT page pool exhausted by vm%hu", quota->vm_id);
+		}
+		quota->used++;
+
+		/* a free page exists, the counters above account for every taken one */
+		for (idx = 0UL; idx < EPT_POOL_BITMAP_SIZE; idx++) {
+			if (ept_pool_bitmap[idx] != ~0UL) {
+				bit = (idx << 6U) + ffz64(ept_pool_bitmap[idx]);
+				break;
+			}
+		}
+		if (bit >= EPT_POOL_PAGE_NUM) {
+			panic("EPT page pool bitmap out of sync");
+		}
+
+		ept_pool_bitmap[idx] |= (1UL << (bit & 0x3FUL));
+		ept_pool_owner[bit] = quota->vm_id + 1U;
+		page = &ept_pool_pages[bit];
+	}
+	spinlock_release(&ept_pool_lock);
+
+	return page;
+}
+
+/*
+ * A PT or PD page merged back into a large page is kept for the next split in
+ * the same VM rather than freed: the vCPUs and the IOMMU of the VM may walk
+ * it until the EPT flush is done, so it must not show up in another EPT.
+ */
+static void ept_free_table_page(const union pgtable_pages_info *info, struct page *page)
+{
+	struct ept_pool_quota *quota = info->ept.pool;
+
+	if ((quota != NULL) && (page >= &ept_pool_pages[0]) && (page < &ept_pool_pages[EPT_POOL_PAGE_NUM])) {
+		spinlock_obtain(&ept_pool_lock);
+		*(struct page **)(void *)page = quota->recycled;
+		quota->recycled = page;
+		spinlock_release(&ept_pool_lock);
+	}
+}
+
+/* The dirty page log is kept per 4K page */
+static bool ept_may_merge_pt(const union pgtable_pages_info *info)
+{
+	return (info->ept.dirty_log == 0U);
+}
+
+/* The secure world EPT keeps pointing at the PDs it copied, so they must stay */
+static bool ept_may_merge_pd(const union pgtable_pages_info *info)
+{
+	return !info->ept.pd_shared && (info->ept.dirty_log == 0U);
+}
+
+int32_t ept_pool_reserve(const struct acrn_vm *vm, uint64_t nr_pages)
+{
+	struct ept_pool_quota *quota = vm->arch_vm.ept_mem_ops.info->ept.pool;
+	int32_t ret = 0;
+
+	if (quota != NULL) {
+		spinlock_obtain(&ept_pool_lock);
+		if ((nr_pages > ept_pool_free_pages) ||
+				((quota->used + quota->reserved + nr_pages) > quota->limit)) {
+			pr_err("vm%hu: no %llu EPT pages, %llu used, %llu left in the pool",
+				vm->vm_id, nr_pages, quota->used, ept_pool_free_pages);
+			ret = -ENOMEM;
+		} else {
+			ept_pool_free_pages -= nr_pages;
+			quota->reserved += nr_pages;
+		}
+		spinlock_release(&ept_pool_lock);
+	}
+
+	return ret;
+}
+
+void ept_pool_unreserve(const struct acrn_vm *vm)
+{
+	struct ept_pool_quota *quota = vm->arch_vm.ept_mem_ops.info->ept.pool;
+
+	if (quota != NULL) {
+		spinlock_obtain(&ept_pool_lock);
+		ept_pool_free_pages += quota->reserved;
+		quota->reserved = 0UL;
+		spinlock_release(&ept_pool_lock);
+	}
+}
+
+void free_ept_mem(const struct acrn_vm *vm)
+{
+	struct ept_pool_quota *quota = vm->arch_vm.ept_mem_ops.info->ept.pool;
+	uint64_t i;
+
+	if (quota != NULL) {
+		spinlock_obtain(&ept_pool_lock);
+		for (i = 0UL; (i < EPT_POOL_PAGE_NUM) && (quota->used != 0UL); i++) {
+			if (ept_pool_owner[i] == (vm->vm_id + 1U)) {
+				ept_pool_owner[i] = 0U;
+				ept_pool_bitmap[i >> 6U] &= ~(1UL << (i & 0x3FUL));
+				quota->used--;
+				ept_pool_free_pages++;
+			}
+		}
+		ept_pool_free_pages += quota->reserved;
+		quota->reserved = 0UL;
+		quota->recycled = NULL;
+		spinlock_release(&ept_pool_lock);
+	}
+}
+
+/*
+ * The EPT pages are handed out as they are: every table page gets all of its
+ * entries written right away, by construct_pgentry() or split_large_page()
+ * below the top level and by the sanitize_pte() of the caller at the top, so
+ * zeroing them first would only write each page twice.
+ */
 static inline struct page *ept_get_pml4_page(const union pgtable_pages_info *info)
 {
-	struct page *pml4_page = info->ept.nworld_pml4_base;
-	(void)memset(pml4_page, 0U, PAGE_SIZE);
-	return pml4_page;
+	return info->ept.nworld_pml4_base;
 }
 
 static inline struct page *ept_get_pdpt_page(const union pgtable_pages_info *info, uint64_t gpa)
 {
-	struct page *pdpt_page = info->ept.nworld_pdpt_base + (gpa >> PML4E_SHIFT);
-	(void)memset(pdpt_page, 0U, PAGE_SIZE);
+	struct page *pdpt_page;
+
+	if (info->ept.pool != NULL) {
+		pdpt_page = ept_pool_alloc_page(info->ept.pool);
+	} else {
+		pdpt_page = info->ept.nworld_pdpt_base + (gpa >> PML4E_SHIFT);
+	}
 	return pdpt_page;
 }
 
 static inline struct page *ept_get_pd_page(const union pgtable_pages_info *info, uint64_t gpa)
 {
 	struct page *pd_page;
-	if (gpa < TRUSTY_EPT_REBASE_GPA) {
-		pd_page = info->ept.nworld_pd_base + (gpa >> PDPTE_SHIFT);
-	} else {
+	if (gpa >= TRUSTY_EPT_REBASE_GPA) {
 		pd_page = info->ept.sworld_pgtable_base + TRUSTY_PML4_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) +
 			TRUSTY_PDPT_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) + ((gpa - TRUSTY_EPT_REBASE_GPA) >> PDPTE_SHIFT);
+	} else if (info->ept.pool != NULL) {
+		pd_page = ept_pool_alloc_page(info->ept.pool);
+	} else {
+		pd_page = info->ept.nworld_pd_base + (gpa >> PDPTE_SHIFT);
 	}
-	(void)memset(pd_page, 0U, PAGE_SIZE);
 	return pd_page;
 }
 
 static inline struct page *ept_get_pt_page(const union pgtable_pages_info *info, uint64_t gpa)
 {
 	struct page *pt_page;
-	if (gpa < TRUSTY_EPT_REBASE_GPA) {
-		pt_page = info->ept.nworld_pt_base + (gpa >> PDE_SHIFT);
-	} else {
+	if (gpa >= TRUSTY_EPT_REBASE_GPA) {
 		pt_page = info->ept.sworld_pgtable_base + TRUSTY_PML4_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) +
 			TRUSTY_PDPT_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) + TRUSTY_PD_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) +
 			((gpa - TRUSTY_EPT_REBASE_GPA) >> PDE_SHIFT);
+	} else if (info->ept.pool != NULL) {
+		pt_page = ept_pool_alloc_page(info->ept.pool);
+	} else {
+		pt_page = info->ept.nworld_pt_base + (gpa >> PDE_SHIFT);
 	}
-	(void)memset(pt_page, 0U, PAGE_SIZE);
 	return pt_page;
 }
 
@@ -153,15 +317,22 @@ void init_ept_mem_ops(struct acrn_vm *vm)
 	if (vm_id != 0U) {
 		ept_pages_info[vm_id].ept.top_address_space = EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE);
 		ept_pages_info[vm_id].ept.nworld_pml4_base = uos_nworld_pml4_pages[vm_id - 1U];
-		ept_pages_info[vm_id].ept.nworld_pdpt_base = uos_nworld_pdpt_pages[vm_id - 1U];
-		ept_pages_info[vm_id].ept.nworld_pd_base = uos_nworld_pd_pages[vm_id - 1U];
-		ept_pages_info[vm_id].ept.nworld_pt_base = uos_nworld_pt_pages[vm_id - 1U];
+		ept_pool_quotas[vm_id].limit = UOS_EPT_POOL_QUOTA;
+		ept_pool_quotas[vm_id].used = 0UL;
+		ept_pool_quotas[vm_id].reserved = 0UL;
+		ept_pool_quotas[vm_id].recycled = NULL;
+		ept_pool_quotas[vm_id].vm_id = vm_id;
+		ept_pages_info[vm_id].ept.pool = &ept_pool_quotas[vm_id];
+		ept_pages_info[vm_id].ept.pd_shared = false;
+		ept_pages_info[vm_id].ept.dirty_log = 0U;
+		ept_pages_info[vm_id].ept.dirty_lost = false;
 		ept_pages_info[vm_id].ept.sworld_pgtable_base = uos_sworld_pgtable_pages[vm_id - 1U];
 		ept_pages_info[vm_id].ept.sworld_memory_base = uos_sworld_memory[vm_id - 1U];
 
 		vm->arch_vm.ept_mem_ops.get_sworld_memory_base = ept_get_sworld_memory_base;
 	}
 	vm->arch_vm.ept_mem_ops.info = &ept_pages_info[vm_id];
+	vm->arch_vm.ept_mem_ops.stats = &vm->arch_vm.ept_stats;
 
 	vm->arch_vm.ept_mem_ops.get_default_access_right = ept_get_default_access_right;
 	vm->arch_vm.ept_mem_ops.pgentry_present = ept_pgentry_present;
@@ -169,5 +340,8 @@ void init_ept_mem_ops(struct acrn_vm *vm)
 	vm->arch_vm.ept_mem_ops.get_pdpt_page = ept_get_pdpt_page;
 	vm->arch_vm.ept_mem_ops.get_pd_page = ept_get_pd_page;
 	vm->arch_vm.ept_mem_ops.get_pt_page = ept_get_pt_page;
+	vm->arch_vm.ept_mem_ops.free_table_page = ept_free_table_page;
+	vm->arch_vm.ept_mem_ops.may_merge_pt = ept_may_merge_pt;
+	vm->arch_vm.ept_mem_ops.may_merge_pd = ept_may_merge_pd;
 
 }
@@ -45,10 +45,89 @@ static void split_large_page(uint64_t *pte, enum _page_table_level level,
 
 	ref_prot = mem_ops->get_default_access_right();
 	set_pgentry(pte, hva2hpa((void *)pbase) | ref_prot);
+	mem_ops->stats->nr_split++;
 
 	/* TODO: flush the TLB */
 }
 
+/*
+ * Undo split_large_page() at PD level: map the 2M range of a PDE with a
+ * large page again once all the 4K pages of its PT are contiguous, 2M
+ * aligned and have the same attributes, or drop the PT if it maps nothing.
+ * Not done where mem_ops forbids it.
+ */
+static void try_to_merge_pt(uint64_t *pde, const struct memory_ops *mem_ops)
+{
+	uint64_t *pt_page = pde_page_vaddr(*pde);
+	uint64_t paddr = pt_page[0] & PDE_PFN_MASK;
+	uint64_t prot = pt_page[0] & ~PDE_PFN_MASK;
+	uint64_t i;
+	bool uniform, empty;
+
+	if ((mem_ops->may_merge_pt != NULL) && !mem_ops->may_merge_pt(mem_ops->info)) {
+		return;
+	}
+
+	uniform = (mem_ops->pgentry_present(pt_page[0]) != 0UL) && mem_aligned_check(paddr, PDE_SIZE);
+	empty = (mem_ops->pgentry_present(pt_page[0]) == 0UL);
+	for (i = 1UL; (i < PTRS_PER_PTE) && (uniform || empty); i++) {
+		uniform = uniform && (pt_page[i] == ((paddr + (i * PTE_SIZE)) | prot));
+		empty = empty && (mem_ops->pgentry_present(pt_page[i]) == 0UL);
+	}
+
+	if (uniform || empty) {
+		if (uniform) {
+			set_pgentry(pde, paddr | (prot | PAGE_PSE));
+			mem_ops->stats->nr_merged++;
+		} else {
+			sanitize_pte_entry(pde);
+		}
+
+		if (mem_ops->free_table_page != NULL) {
+			mem_ops->free_table_page(mem_ops->info, (struct page *)pt_page);
+		}
+	}
+}
+
+/*
+ * The same at PDPT level: a PD of 2M pages which are contiguous, 1G aligned
+ * and have the same attributes becomes a 1G page, an empty PD goes away.
+ * Only done where mem_ops allows it.
+ */
+static void try_to_merge_pd(uint64_t *pdpte, const struct memory_ops *mem_ops)
+{
+	uint64_t *pd_page = pdpte_page_vaddr(*pdpte);
+	uint64_t paddr = pd_page[0] & PDE_PFN_MASK;
+	uint64_t prot = pd_page[0] & ~PDE_PFN_MASK;
+	uint64_t i;
+	bool uniform, empty;
+
+	if ((mem_ops->may_merge_pd == NULL) || !mem_ops->may_merge_pd(mem_ops->info)) {
+		return;
+	}
+
+	uniform = (mem_ops->pgentry_present(pd_page[0]) != 0UL) && (pde_large(pd_page[0]) != 0UL) &&
+			mem_aligned_check(paddr, PDPTE_SIZE);
+	empty = (mem_ops->pgentry_present(pd_page[0]) == 0UL);
+	for (i = 1UL; (i < PTRS_PER_PDE) && (uniform || empty); i++) {
+		uniform = uniform && (pd_page[i] == ((paddr + (i * PDE_SIZE)) | prot));
+		empty = empty && (mem_ops->pgentry_present(pd_page[i]) == 0UL);
+	}
+
+	if (uniform || empty) {
+		if (uniform) {
+			set_pgentry(pdpte, paddr | prot);
+			mem_ops->stats->nr_merged_1g++;
+		} else {
+			sanitize_pte_entry(pdpte);
+		}
+
+		if (mem_ops->free_table_page != NULL) {
+			mem_ops->free_table_page(mem_ops->info, (struct page *)pd_page);
+		}
+	}
+}
+
 static inline void local_modify_or_del_pte(uint64_t *pte,
 		uint64_t prot_set, uint64_t prot_clr, uint32_t type)
 {
@@ -137,6 +216,7 @@ static void modify_or_del_pde(const uint64_t *pdpte, uint64_t vaddr_start, uint6
 			}
 		}
 		modify_or_del_pte(pde, vaddr, vaddr_end, prot_set, prot_clr, mem_ops, type);
+		try_to_merge_pt(pde, mem_ops);
 		if (vaddr_next >= vaddr_end) {
 			break;	/* done */
 		}
@@ -180,6 +260,7 @@ static void modify_or_del_pdpte(const uint64_t *pml4e, uint64_t vaddr_start, uin
 			}
 		}
 		modify_or_del_pde(pdpte, vaddr, vaddr_end, prot_set, prot_clr, mem_ops, type);
+		try_to_merge_pd(pdpte, mem_ops);
 		if (vaddr_next >= vaddr_end) {
 			break;	/* done */
 		}
@@ -288,6 +369,9 @@ static void add_pde(const uint64_t *pdpte, uint64_t paddr_start, uint64_t vaddr_
 			}
 		}
 		add_pte(pde, paddr, vaddr, vaddr_end, prot, mem_ops);
+		if (pde_large(*pde) == 0UL) {
+			try_to_merge_pt(pde, mem_ops);
+		}
 		if (vaddr_next >= vaddr_end) {
 			break;	/* done */
 		}
@@ -330,6 +414,9 @@ static void add_pdpte(const uint64_t *pml4e, uint64_t paddr_start, uint64_t vadd
 			}
 		}
 		add_pde(pdpte, paddr, vaddr, vaddr_end, prot, mem_ops);
+		if (pdpte_large(*pdpte) == 0UL) {
+			try_to_merge_pd(pdpte, mem_ops);
+		}
 		if (vaddr_next >= vaddr_end) {
 			break;	/* done */
 		}
@@ -371,6 +458,148 @@ void mmu_add(uint64_t *pml4_page, uint64_t paddr_base, uint64_t vaddr_base, uint
 	}
 }
 
+/*
+ * The leaf entry pte maps [vaddr, vaddr + pg_size). Clear walk->flags in it
+ * or, for WALK_TEST_AND_CLEAR, report the pages of the range it maps if it
+ * has the bit walk->bit. The bit is only cleared if the whole page is in
+ * the range: what is out of it can still be reported for another range.
+ */
+static void walk_leaf(uint64_t *pte, uint64_t vaddr, uint64_t pg_size, struct pgtable_walk *walk)
+{
+	uint64_t start = (vaddr > walk->start) ? vaddr : walk->start;
+	uint64_t end = ((vaddr + pg_size) < walk->end) ? (vaddr + pg_size) : walk->end;
+	uint64_t i, first, last;
+	bool set;
+
+	if (walk->type == WALK_TEST_AND_CLEAR) {
+		if ((start == vaddr) && (end == (vaddr + pg_size))) {
+			set = bitmap_test_and_clear_lock(walk->bit, pte);
+		} else {
+			set = bitmap_test(walk->bit, pte);
+		}
+		if (set) {
+			first = (start - walk->start) >> PAGE_SHIFT;
+			last = (end - walk->start) >> PAGE_SHIFT;
+			for (i = first; i < last; i++) {
+				walk->bitmap[i >> 6U] |= 1UL << (i & 0x3fUL);
+			}
+			walk->count += last - first;
+		}
+	} else if ((*pte & walk->flags) != 0UL) {
+		set_pgentry(pte, *pte & ~walk->flags);
+	} else {
+		/* nothing to clear */
+	}
+}
+
+static void walk_pte(const uint64_t *pde, uint64_t vaddr_start, struct pgtable_walk *walk)
+{
+	uint64_t *pt_page = pde_page_vaddr(*pde);
+	uint64_t vaddr = vaddr_start;
+	uint64_t index = pte_index(vaddr);
+
+	for (; index < PTRS_PER_PTE; index++) {
+		uint64_t *pte = pt_page + index;
+
+		if (walk->mem_ops->pgentry_present(*pte) != 0UL) {
+			walk_leaf(pte, vaddr, PTE_SIZE, walk);
+		}
+		vaddr += PTE_SIZE;
+		if (vaddr >= walk->end) {
+			break;
+		}
+	}
+}
+
+static void walk_pde(const uint64_t *pdpte, uint64_t vaddr_start, struct pgtable_walk *walk)
+{
+	uint64_t *pd_page = pdpte_page_vaddr(*pdpte);
+	uint64_t vaddr = vaddr_start;
+	uint64_t index = pde_index(vaddr);
+
+	for (; index < PTRS_PER_PDE; index++) {
+		uint64_t *pde = pd_page + index;
+		uint64_t vaddr_next = (vaddr & PDE_MASK) + PDE_SIZE;
+
+		if (walk->mem_ops->pgentry_present(*pde) != 0UL) {
+			if ((pde_large(*pde) != 0UL) && (walk->type == WALK_SPLIT)) {
+				split_large_page(pde, IA32E_PD, vaddr, walk->mem_ops);
+			}
+			if (pde_large(*pde) != 0UL) {
+				walk_leaf(pde, vaddr & PDE_MASK, PDE_SIZE, walk);
+			} else {
+				walk_pte(pde, vaddr, walk);
+				if (walk->type == WALK_MERGE) {
+					try_to_merge_pt(pde, walk->mem_ops);
+				}
+			}
+		}
+		if (vaddr_next >= walk->end) {
+			break;	/* done */
+		}
+		vaddr = vaddr_next;
+	}
+}
+
+static void walk_pdpte(const uint64_t *pml4e, uint64_t vaddr_start, struct pgtable_walk *walk)
+{
+	uint64_t *pdpt_page = pml4e_page_vaddr(*pml4e);
+	uint64_t vaddr = vaddr_start;
+	uint64_t index = pdpte_index(vaddr);
+
+	for (; index < PTRS_PER_PDPTE; index++) {
+		uint64_t *pdpte = pdpt_page + index;
+		uint64_t vaddr_next = (vaddr & PDPTE_MASK) + PDPTE_SIZE;
+
+		if (walk->mem_ops->pgentry_present(*pdpte) != 0UL) {
+			if ((pdpte_large(*pdpte) != 0UL) && (walk->type == WALK_SPLIT)) {
+				split_large_page(pdpte, IA32E_PDPT, vaddr, walk->mem_ops);
+			}
+			if (pdpte_large(*pdpte) != 0UL) {
+				walk_leaf(pdpte, vaddr & PDPTE_MASK, PDPTE_SIZE, walk);
+			} else {
+				walk_pde(pdpte, vaddr, walk);
+				if (walk->type == WALK_MERGE) {
+					try_to_merge_pd(pdpte, walk->mem_ops);
+				}
+			}
+		}
+		if (vaddr_next >= walk->end) {
+			break;	/* done */
+		}
+		vaddr = vaddr_next;
+	}
+}
+
+/*
+ * Walk the leaf entries mapping [walk->start, walk->end), skipping what is
+ * not mapped.
+ * type: WALK_SPLIT
+ * map the range with 4K pages only, and clear walk->flags in them.
+ * type: WALK_TEST_AND_CLEAR
+ * set the bit of walk->bitmap of each page mapped by an entry with the bit
+ * walk->bit, counted in walk->count, and clear the bit.
+ * type: WALK_MERGE
+ * clear walk->flags, then map the range with large pages where it can.
+ */
+void mmu_walk(uint64_t *pml4_page, struct pgtable_walk *walk)
+{
+	uint64_t vaddr = walk->start;
+	uint64_t vaddr_next;
+	uint64_t *pml4e;
+
+	dev_dbg(ACRN_DBG_MMU, "%s, vaddr: [0x%llx - 0x%llx] type %u\n", __func__, walk->start, walk->end, walk->type);
+
+	while (vaddr < walk->end) {
+		vaddr_next = (vaddr & PML4E_MASK) + PML4E_SIZE;
+		pml4e = pml4e_offset(pml4_page, vaddr);
+		if (walk->mem_ops->pgentry_present(*pml4e) != 0UL) {
+			walk_pdpte(pml4e, vaddr, walk);
+		}
+		vaddr = vaddr_next;
+	}
+}
+
 /**
  * @pre (pml4_page != NULL) && (pg_size != NULL)
  */
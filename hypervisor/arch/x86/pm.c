@@ -172,20 +172,26 @@ void enter_s3(struct acrn_vm *vm, uint32_t pm1a_cnt_val, uint32_t pm1b_cnt_val)
 		spinlock_release(&trampoline_spinlock);
 
 		resume_lapic();
-		resume_iommu();
-		resume_ioapic();
 		resume_console();
 
-		exec_vmxon_instr(pcpu_id);
-		CPU_IRQ_ENABLE();
-
 		/* restore the default main entry */
 		stac();
 		write_trampoline_sym(main_entry, pmain_entry_saved);
 		clac();
 
-		/* online all APs again */
-		start_cpus();
+		/* online all APs again, they come up while the BSP restores
+		 * the IOMMU, the IOAPIC and VMX, which they don't use before
+		 * wait_cpus_up()
+		 */
+		kick_cpus();
+
+		resume_iommu();
+		resume_ioapic();
+
+		exec_vmxon_instr(pcpu_id);
+		CPU_IRQ_ENABLE();
+
+		wait_cpus_up();
 
 		/* jump back to vm */
 		resume_vm_from_s3(vm, guest_wakeup_vec32);
@@ -59,3 +59,4 @@ CTASSERT(CPU_CONTEXT_OFFSET_LDTR - CPU_CONTEXT_OFFSET_EXTCTX_START
 CTASSERT((sizeof(struct trusty_startup_param)
 		+ sizeof(struct trusty_key_info)) < 0x1000U);
 CTASSERT(NR_WORLD == 2);
+CTASSERT(sizeof(struct acrn_vm_telemetry) == PAGE_SIZE);
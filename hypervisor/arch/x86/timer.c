@@ -9,10 +9,15 @@
 
 #define MAX_TIMER_ACTIONS	32U
 #define CAL_MS			10U
+#define CAL_CHECK_MS		1U	/* PIT check of the MSR_PLATFORM_INFO rate */
+#define CAL_CHECK_TOLERANCE	100U	/* 1 / 100 of the PIT measure */
+#define BUS_CLOCK_HZ		100000000UL
 #define MIN_TIMER_PERIOD_US	500U
 
 uint32_t tsc_khz = 0U;
 
+#define node_to_timer(n)	list_entry((n), struct hv_timer, node)
+
 static void run_timer(const struct hv_timer *timer)
 {
 	/* deadline = 0 means stop timer, we should skip */
@@ -29,44 +34,163 @@ static void tsc_deadline_handler(__unused uint32_t irq, __unused void *data)
 	fire_softirq(SOFTIRQ_TIMER);
 }
 
-static inline void update_physical_timer(struct per_cpu_timers *cpu_timer)
+/*
+ * The active timers of a pCPU are kept in two pairing heaps, one ordered
+ * on the deadline and one on the deadline plus slack: add is O(1),
+ * removing the first or any other timer is O(log n) amortized.
+ */
+
+/*
+ * Link two detached heaps, the one firing later becomes the first
+ * child of the other. Return the new root.
+ */
+static struct timer_node *heap_meld(struct timer_node *a, struct timer_node *b)
 {
-	struct hv_timer *timer = NULL;
+	struct timer_node *root, *sub;
 
-	/* find the next event timer */
-	if (!list_empty(&cpu_timer->timer_list)) {
-		timer = list_entry((&cpu_timer->timer_list)->next,
-			struct hv_timer, node);
+	if (a == NULL) {
+		root = b;
+	} else if (b == NULL) {
+		root = a;
+	} else {
+		if (b->key < a->key) {
+			root = b;
+			sub = a;
+		} else {
+			root = a;
+			sub = b;
+		}
 
-		/* it is okay to program a expired time */
-		msr_write(MSR_IA32_TSC_DEADLINE, timer->fire_tsc);
+		sub->sibling = root->child;
+		if (root->child != NULL) {
+			root->child->prev = sub;
+		}
+		sub->prev = root;
+		root->child = sub;
+		root->sibling = NULL;
+		root->prev = NULL;
 	}
+
+	return root;
 }
 
 /*
- * return true if we add the timer on the timer_list head
+ * Two-pass merge of a sibling list into a single heap: meld pairs left
+ * to right, then meld the pairs right to left.
  */
-static bool local_add_timer(struct per_cpu_timers *cpu_timer,
-			struct hv_timer *timer)
+static struct timer_node *heap_merge_pairs(struct timer_node *first)
 {
-	struct list_head *pos, *prev;
-	struct hv_timer *tmp;
-	uint64_t tsc = timer->fire_tsc;
-
-	prev = &cpu_timer->timer_list;
-	list_for_each(pos, &cpu_timer->timer_list) {
-		tmp = list_entry(pos, struct hv_timer, node);
-		if (tmp->fire_tsc < tsc) {
-			prev = &tmp->node;
-		}
-		else {
-			break;
+	struct timer_node *a = first, *b, *next;
+	struct timer_node *pairs = NULL, *root = NULL;
+
+	while (a != NULL) {
+		b = a->sibling;
+		next = NULL;
+		a->sibling = NULL;
+		a->prev = NULL;
+		if (b != NULL) {
+			next = b->sibling;
+			b->sibling = NULL;
+			b->prev = NULL;
 		}
+
+		a = heap_meld(a, b);
+		/* stack the melded pairs through their sibling link */
+		a->sibling = pairs;
+		pairs = a;
+		a = next;
+	}
+
+	while (pairs != NULL) {
+		next = pairs->sibling;
+		pairs->sibling = NULL;
+		root = heap_meld(root, pairs);
+		pairs = next;
+	}
+
+	return root;
+}
+
+static void heap_set_root(struct timer_node *head, struct timer_node *root)
+{
+	head->child = root;
+	if (root != NULL) {
+		root->prev = head;
+	}
+}
+
+static void heap_insert(struct timer_node *head, struct timer_node *node, uint64_t key)
+{
+	node->child = NULL;
+	node->sibling = NULL;
+	node->prev = NULL;
+	node->key = key;
+	heap_set_root(head, heap_meld(head->child, node));
+}
+
+static void heap_remove(struct timer_node *head, struct timer_node *node)
+{
+	struct timer_node *sub;
+
+	/* cut the subtree of node out of the heap */
+	if (node->prev->child == node) {
+		node->prev->child = node->sibling;
+	} else {
+		node->prev->sibling = node->sibling;
+	}
+	if (node->sibling != NULL) {
+		node->sibling->prev = node->prev;
+	}
+
+	sub = heap_merge_pairs(node->child);
+	node->child = NULL;
+	node->sibling = NULL;
+	node->prev = NULL;
+
+	heap_set_root(head, heap_meld(head->child, sub));
+}
+
+static void queue_timer(struct per_cpu_timers *cpu_timer, struct hv_timer *timer)
+{
+	heap_insert(&cpu_timer->head, &timer->node, timer->fire_tsc);
+	heap_insert(&cpu_timer->late_head, &timer->late_node,
+			timer->fire_tsc + timer->slack_in_cycle);
+}
+
+static void dequeue_timer(struct per_cpu_timers *cpu_timer, struct hv_timer *timer)
+{
+	heap_remove(&cpu_timer->head, &timer->node);
+	heap_remove(&cpu_timer->late_head, &timer->late_node);
+}
+
+static inline struct hv_timer *first_timer(const struct per_cpu_timers *cpu_timer)
+{
+	struct hv_timer *timer = NULL;
+
+	if (cpu_timer->head.child != NULL) {
+		timer = node_to_timer(cpu_timer->head.child);
 	}
 
-	list_add(&timer->node, prev);
+	return timer;
+}
 
-	return (prev == &cpu_timer->timer_list);
+/*
+ * Program the TSC deadline to the end of the first slack: all timers due
+ * by then expire in the same softirq. An armed deadline which is earlier
+ * (its timer was deleted) only costs a spurious softirq, so it is kept.
+ */
+static void update_physical_timer(struct per_cpu_timers *cpu_timer)
+{
+	uint64_t deadline;
+
+	if (cpu_timer->late_head.child != NULL) {
+		deadline = cpu_timer->late_head.child->key;
+		if ((cpu_timer->armed_tsc == 0UL) || (deadline < cpu_timer->armed_tsc)) {
+			/* it is okay to program a expired time */
+			msr_write(MSR_IA32_TSC_DEADLINE, deadline);
+			cpu_timer->armed_tsc = deadline;
+		}
+	}
 }
 
 int32_t add_timer(struct hv_timer *timer)
@@ -78,7 +202,7 @@ int32_t add_timer(struct hv_timer *timer)
 	if ((timer == NULL) || (timer->func == NULL) || (timer->fire_tsc == 0UL)) {
 		ret = -EINVAL;
 	} else {
-		ASSERT(list_empty(&timer->node), "add timer again!\n");
+		ASSERT(timer->node.prev == NULL, "add timer again!\n");
 
 		/* limit minimal periodic timer cycle period */
 		if (timer->mode == TICK_MODE_PERIODIC) {
@@ -88,10 +212,11 @@ int32_t add_timer(struct hv_timer *timer)
 		pcpu_id  = get_cpu_id();
 		cpu_timer = &per_cpu(cpu_timers, pcpu_id);
 
-		/* update the physical timer if we're on the timer_list head */
-		if (local_add_timer(cpu_timer, timer)) {
-			update_physical_timer(cpu_timer);
-		}
+		spinlock_obtain(&cpu_timer->lock);
+		timer->pcpu_id = pcpu_id;
+		queue_timer(cpu_timer, timer);
+		update_physical_timer(cpu_timer);
+		spinlock_release(&cpu_timer->lock);
 
 		TRACE_2L(TRACE_TIMER_ACTION_ADDED, timer->fire_tsc, 0UL);
 	}
@@ -102,8 +227,17 @@ int32_t add_timer(struct hv_timer *timer)
 
 void del_timer(struct hv_timer *timer)
 {
-	if ((timer != NULL) && !list_empty(&timer->node)) {
-		list_del_init(&timer->node);
+	struct per_cpu_timers *cpu_timer;
+
+	if ((timer != NULL) && (timer->node.prev != NULL)) {
+		cpu_timer = &per_cpu(cpu_timers, timer->pcpu_id);
+
+		spinlock_obtain(&cpu_timer->lock);
+		/* it may have expired while we were waiting for the lock */
+		if (timer->node.prev != NULL) {
+			dequeue_timer(cpu_timer, timer);
+		}
+		spinlock_release(&cpu_timer->lock);
 	}
 }
 
@@ -112,7 +246,14 @@ static void init_percpu_timer(uint16_t pcpu_id)
 	struct per_cpu_timers *cpu_timer;
 
 	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
-	INIT_LIST_HEAD(&cpu_timer->timer_list);
+	spinlock_init(&cpu_timer->lock);
+	cpu_timer->head.child = NULL;
+	cpu_timer->head.sibling = NULL;
+	cpu_timer->head.prev = NULL;
+	cpu_timer->late_head.child = NULL;
+	cpu_timer->late_head.sibling = NULL;
+	cpu_timer->late_head.prev = NULL;
+	cpu_timer->armed_tsc = 0UL;
 }
 
 static void init_tsc_deadline_timer(void)
@@ -132,40 +273,45 @@ static void timer_softirq(uint16_t pcpu_id)
 {
 	struct per_cpu_timers *cpu_timer;
 	struct hv_timer *timer;
-	struct list_head *pos, *n;
-	int32_t tries = MAX_TIMER_ACTIONS;
-	uint64_t current_tsc = rdtsc();
+	uint32_t tries = MAX_TIMER_ACTIONS;
 
 	/* handle passed timer */
 	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
 
-	/* This is to make sure we are not blocked due to delay inside func()
-	 * force to exit irq handler after we serviced >31 timers
-	 * caller used to local_add_timer() for periodic timer, if there is a delay
-	 * inside func(), it will infinitely loop here, because new added timer
-	 * already passed due to previously func()'s delay.
+	spinlock_obtain(&cpu_timer->lock);
+	/* the deadline fired, the TSC deadline MSR disarmed itself */
+	cpu_timer->armed_tsc = 0UL;
+
+	/*
+	 * Expire the passed timers in one batch, re-reading the TSC so that
+	 * timers passing meanwhile don't need another interrupt. Stop after
+	 * MAX_TIMER_ACTIONS timers: a periodic timer whose func() takes longer
+	 * than its period would loop here forever otherwise; the rest is
+	 * picked up by the immediately expiring deadline programmed below.
 	 */
-	list_for_each_safe(pos, n, &cpu_timer->timer_list) {
-		timer = list_entry(pos, struct hv_timer, node);
-		/* timer expried */
+	while (tries > 0U) {
+		timer = first_timer(cpu_timer);
+		if ((timer == NULL) || (timer->fire_tsc > rdtsc())) {
+			break;
+		}
 		tries--;
-		if ((timer->fire_tsc <= current_tsc) && (tries > 0)) {
-			del_timer(timer);
-
-			run_timer(timer);
 
-			if (timer->mode == TICK_MODE_PERIODIC) {
-				/* update periodic timer fire tsc */
-				timer->fire_tsc += timer->period_in_cycle;
-				(void)local_add_timer(cpu_timer, timer);
-			}
-		} else {
-			break;
+		dequeue_timer(cpu_timer, timer);
+		if (timer->mode == TICK_MODE_PERIODIC) {
+			/* update periodic timer fire tsc */
+			timer->fire_tsc += timer->period_in_cycle;
+			queue_timer(cpu_timer, timer);
 		}
+
+		/* func() may wake vCPUs or take other locks */
+		spinlock_release(&cpu_timer->lock);
+		run_timer(timer);
+		spinlock_obtain(&cpu_timer->lock);
 	}
 
 	/* update nearest timer */
 	update_physical_timer(cpu_timer);
+	spinlock_release(&cpu_timer->lock);
 }
 
 void timer_init(void)
@@ -276,10 +422,39 @@ static uint64_t native_calibrate_tsc(void)
 	return tsc_hz;
 }
 
+/*
+ * Determine TSC frequency via the maximum non-turbo ratio of
+ * MSR_PLATFORM_INFO, the TSC rate of the CPUs with a 100MHz bus clock.
+ * As older ones run at 133MHz, the result is only trusted if a short PIT
+ * measure agrees with it, which still saves most of the PIT calibration.
+ */
+static uint64_t msr_calibrate_tsc(void)
+{
+	uint64_t tsc_hz = 0UL, pit_hz, delta;
+	uint64_t ratio;
+
+	if ((boot_cpu_data.family == 6U) && (boot_cpu_data.model >= 0x2AU)) {
+		ratio = (msr_read(MSR_PLATFORM_INFO) >> 8U) & 0xFFUL;
+		if (ratio != 0UL) {
+			tsc_hz = ratio * BUS_CLOCK_HZ;
+			pit_hz = pit_calibrate_tsc(CAL_CHECK_MS);
+			delta = (tsc_hz > pit_hz) ? (tsc_hz - pit_hz) : (pit_hz - tsc_hz);
+			if (delta > (pit_hz / CAL_CHECK_TOLERANCE)) {
+				tsc_hz = 0UL;
+			}
+		}
+	}
+
+	return tsc_hz;
+}
+
 void calibrate_tsc(void)
 {
 	uint64_t tsc_hz;
 	tsc_hz = native_calibrate_tsc();
+	if (tsc_hz == 0U) {
+		tsc_hz = msr_calibrate_tsc();
+	}
 	if (tsc_hz == 0U) {
 		tsc_hz = pit_calibrate_tsc(CAL_MS);
 	}
@@ -71,7 +71,10 @@ static void create_secure_world_ept(struct acrn_vm *vm, uint64_t gpa_orig,
 	hpa = gpa2hpa(vm, gpa_orig);
 
 	/* Unmap gpa_orig~gpa_orig+size from guest normal world ept mapping */
-	ept_mr_del(vm, (uint64_t *)vm->arch_vm.nworld_eptp, gpa_orig, size);
+	if (ept_mr_del(vm, (uint64_t *)vm->arch_vm.nworld_eptp, gpa_orig, size) != 0) {
+		pr_err("Sworld memory can't be unmapped from the normal world");
+		return;
+	}
 
 	/* Copy PDPT entries from Normal world to Secure world
 	 * Secure world can access Normal World's memory,
@@ -81,7 +84,6 @@ static void create_secure_world_ept(struct acrn_vm *vm, uint64_t gpa_orig,
 	 * and Normal World's EPT
 	 */
 	pml4_base = vm->arch_vm.ept_mem_ops.info->ept.sworld_pgtable_base;
-	(void)memset(pml4_base, 0U, PAGE_SIZE);
 	vm->arch_vm.sworld_eptp = pml4_base;
 	sanitize_pte((uint64_t *)vm->arch_vm.sworld_eptp);
 
@@ -111,9 +113,10 @@ static void create_secure_world_ept(struct acrn_vm *vm, uint64_t gpa_orig,
 		src_pdpte_p++;
 		dest_pdpte_p++;
 	}
+	vm->arch_vm.ept_mem_ops.info->ept.pd_shared = true;
 
 	/* Map [gpa_rebased, gpa_rebased + size) to secure ept mapping */
-	ept_mr_add(vm, (uint64_t *)vm->arch_vm.sworld_eptp, hpa, gpa_rebased, size, EPT_RWX | EPT_WB);
+	(void)ept_mr_add(vm, (uint64_t *)vm->arch_vm.sworld_eptp, hpa, gpa_rebased, size, EPT_RWX | EPT_WB);
 
 	/* Backup secure world info, will be used when destroy secure world and suspend UOS */
 	vm->sworld_control.sworld_memory.base_gpa_in_uos = gpa_orig;
@@ -129,24 +132,47 @@ void destroy_secure_world(struct acrn_vm *vm, bool need_clr_mem)
 
 	if (vm->arch_vm.sworld_eptp != NULL) {
 		if (need_clr_mem) {
-			/* clear trusty memory space */
-			stac();
-			(void)memset(hpa2hva(hpa), 0U, (size_t)size);
-			clac();
+			if (is_reserve_sworld_memory(hpa, size)) {
+				/*
+				 * Nobody but this VM can reach it, so it is
+				 * enough to clear it before the VM slot is
+				 * reused, see scrub_secure_world().
+				 */
+				vm->sworld_control.flag.scrub_pending = 1UL;
+			} else {
+				/* clear trusty memory space */
+				stac();
+				(void)memset(hpa2hva(hpa), 0U, (size_t)size);
+				clac();
+			}
 		}
 
-		ept_mr_del(vm, vm->arch_vm.sworld_eptp, gpa_uos, size);
+		(void)ept_mr_del(vm, vm->arch_vm.sworld_eptp, gpa_uos, size);
 		/* sanitize trusty ept page-structures */
 		sanitize_pte((uint64_t *)vm->arch_vm.sworld_eptp);
 		vm->arch_vm.sworld_eptp = NULL;
+		vm->arch_vm.ept_mem_ops.info->ept.pd_shared = false;
 
 		/* Restore memory to guest normal world */
-		ept_mr_add(vm, vm->arch_vm.nworld_eptp, hpa, gpa_uos, size, EPT_RWX | EPT_WB);
+		if (ept_mr_add(vm, vm->arch_vm.nworld_eptp, hpa, gpa_uos, size, EPT_RWX | EPT_WB) != 0) {
+			pr_err("Sworld memory can't be given back to the normal world");
+		}
 	} else {
 		pr_err("sworld eptp is NULL, it's not created");
 	}
 }
 
+void scrub_secure_world(struct acrn_vm *vm)
+{
+	if (vm->sworld_control.flag.scrub_pending != 0UL) {
+		stac();
+		(void)memset(hpa2hva(vm->sworld_control.sworld_memory.base_hpa), 0U,
+			(size_t)vm->sworld_control.sworld_memory.length);
+		clac();
+		vm->sworld_control.flag.scrub_pending = 0UL;
+	}
+}
+
 static inline void save_fxstore_guest_area(struct ext_context *ext_ctx)
 {
 	asm volatile("fxsave (%0)"
@@ -219,7 +245,36 @@ static void save_world_ctx(struct acrn_vcpu *vcpu, struct ext_context *ext_ctx)
 	}
 }
 
-static void load_world_ctx(struct acrn_vcpu *vcpu, const struct ext_context *ext_ctx)
+/*
+ * The world being left was saved just before the next one is loaded, so
+ * its ext_context mirrors the live VMCS and MSRs: writing a field that
+ * both worlds hold with the same value is wasted work, and the MSR writes
+ * are the most expensive part of a world switch.
+ */
+static inline void vmwrite_changed(uint32_t field, uint64_t prev, uint64_t next)
+{
+	if (prev != next) {
+		exec_vmwrite64(field, next);
+	}
+}
+
+static inline void msr_write_changed(uint32_t msr, uint64_t prev, uint64_t next)
+{
+	if (prev != next) {
+		msr_write(msr, next);
+	}
+}
+
+#define load_segment_changed(prev, next, SEG_NAME)				\
+{										\
+	vmwrite_changed(SEG_NAME##_SEL, (prev).selector, (next).selector);	\
+	vmwrite_changed(SEG_NAME##_BASE, (prev).base, (next).base);		\
+	vmwrite_changed(SEG_NAME##_LIMIT, (prev).limit, (next).limit);		\
+	vmwrite_changed(SEG_NAME##_ATTR, (prev).attr, (next).attr);		\
+}
+
+static void load_world_ctx(struct acrn_vcpu *vcpu, const struct ext_context *prev_ctx,
+		const struct ext_context *ext_ctx)
 {
 	uint32_t i;
 
@@ -230,39 +285,39 @@ static void load_world_ctx(struct acrn_vcpu *vcpu, const struct ext_context *ext
 	bitmap_set_lock(CPU_REG_RIP, &vcpu->reg_updated);
 
 	/* VMCS Execution field */
-	exec_vmwrite64(VMX_TSC_OFFSET_FULL, ext_ctx->tsc_offset);
+	vmwrite_changed(VMX_TSC_OFFSET_FULL, prev_ctx->tsc_offset, ext_ctx->tsc_offset);
 
 	/* VMCS GUEST field */
-	exec_vmwrite(VMX_GUEST_CR0, ext_ctx->vmx_cr0);
-	exec_vmwrite(VMX_GUEST_CR4, ext_ctx->vmx_cr4);
-	exec_vmwrite(VMX_CR0_READ_SHADOW, ext_ctx->vmx_cr0_read_shadow);
-	exec_vmwrite(VMX_CR4_READ_SHADOW, ext_ctx->vmx_cr4_read_shadow);
-	exec_vmwrite(VMX_GUEST_CR3, ext_ctx->cr3);
-	exec_vmwrite(VMX_GUEST_DR7, ext_ctx->dr7);
-	exec_vmwrite64(VMX_GUEST_IA32_DEBUGCTL_FULL, ext_ctx->ia32_debugctl);
-	exec_vmwrite64(VMX_GUEST_IA32_PAT_FULL, ext_ctx->ia32_pat);
-	exec_vmwrite32(VMX_GUEST_IA32_SYSENTER_CS, ext_ctx->ia32_sysenter_cs);
-	exec_vmwrite(VMX_GUEST_IA32_SYSENTER_ESP, ext_ctx->ia32_sysenter_esp);
-	exec_vmwrite(VMX_GUEST_IA32_SYSENTER_EIP, ext_ctx->ia32_sysenter_eip);
-	load_segment(ext_ctx->cs, VMX_GUEST_CS);
-	load_segment(ext_ctx->ss, VMX_GUEST_SS);
-	load_segment(ext_ctx->ds, VMX_GUEST_DS);
-	load_segment(ext_ctx->es, VMX_GUEST_ES);
-	load_segment(ext_ctx->fs, VMX_GUEST_FS);
-	load_segment(ext_ctx->gs, VMX_GUEST_GS);
-	load_segment(ext_ctx->tr, VMX_GUEST_TR);
-	load_segment(ext_ctx->ldtr, VMX_GUEST_LDTR);
+	vmwrite_changed(VMX_GUEST_CR0, prev_ctx->vmx_cr0, ext_ctx->vmx_cr0);
+	vmwrite_changed(VMX_GUEST_CR4, prev_ctx->vmx_cr4, ext_ctx->vmx_cr4);
+	vmwrite_changed(VMX_CR0_READ_SHADOW, prev_ctx->vmx_cr0_read_shadow, ext_ctx->vmx_cr0_read_shadow);
+	vmwrite_changed(VMX_CR4_READ_SHADOW, prev_ctx->vmx_cr4_read_shadow, ext_ctx->vmx_cr4_read_shadow);
+	vmwrite_changed(VMX_GUEST_CR3, prev_ctx->cr3, ext_ctx->cr3);
+	vmwrite_changed(VMX_GUEST_DR7, prev_ctx->dr7, ext_ctx->dr7);
+	vmwrite_changed(VMX_GUEST_IA32_DEBUGCTL_FULL, prev_ctx->ia32_debugctl, ext_ctx->ia32_debugctl);
+	vmwrite_changed(VMX_GUEST_IA32_PAT_FULL, prev_ctx->ia32_pat, ext_ctx->ia32_pat);
+	vmwrite_changed(VMX_GUEST_IA32_SYSENTER_CS, prev_ctx->ia32_sysenter_cs, ext_ctx->ia32_sysenter_cs);
+	vmwrite_changed(VMX_GUEST_IA32_SYSENTER_ESP, prev_ctx->ia32_sysenter_esp, ext_ctx->ia32_sysenter_esp);
+	vmwrite_changed(VMX_GUEST_IA32_SYSENTER_EIP, prev_ctx->ia32_sysenter_eip, ext_ctx->ia32_sysenter_eip);
+	load_segment_changed(prev_ctx->cs, ext_ctx->cs, VMX_GUEST_CS);
+	load_segment_changed(prev_ctx->ss, ext_ctx->ss, VMX_GUEST_SS);
+	load_segment_changed(prev_ctx->ds, ext_ctx->ds, VMX_GUEST_DS);
+	load_segment_changed(prev_ctx->es, ext_ctx->es, VMX_GUEST_ES);
+	load_segment_changed(prev_ctx->fs, ext_ctx->fs, VMX_GUEST_FS);
+	load_segment_changed(prev_ctx->gs, ext_ctx->gs, VMX_GUEST_GS);
+	load_segment_changed(prev_ctx->tr, ext_ctx->tr, VMX_GUEST_TR);
+	load_segment_changed(prev_ctx->ldtr, ext_ctx->ldtr, VMX_GUEST_LDTR);
 	/* Only base and limit for IDTR and GDTR */
-	exec_vmwrite(VMX_GUEST_IDTR_BASE, ext_ctx->idtr.base);
-	exec_vmwrite(VMX_GUEST_GDTR_BASE, ext_ctx->gdtr.base);
-	exec_vmwrite32(VMX_GUEST_IDTR_LIMIT, ext_ctx->idtr.limit);
-	exec_vmwrite32(VMX_GUEST_GDTR_LIMIT, ext_ctx->gdtr.limit);
+	vmwrite_changed(VMX_GUEST_IDTR_BASE, prev_ctx->idtr.base, ext_ctx->idtr.base);
+	vmwrite_changed(VMX_GUEST_GDTR_BASE, prev_ctx->gdtr.base, ext_ctx->gdtr.base);
+	vmwrite_changed(VMX_GUEST_IDTR_LIMIT, prev_ctx->idtr.limit, ext_ctx->idtr.limit);
+	vmwrite_changed(VMX_GUEST_GDTR_LIMIT, prev_ctx->gdtr.limit, ext_ctx->gdtr.limit);
 
 	/* MSRs which not in the VMCS */
-	msr_write(MSR_IA32_STAR, ext_ctx->ia32_star);
-	msr_write(MSR_IA32_LSTAR, ext_ctx->ia32_lstar);
-	msr_write(MSR_IA32_FMASK, ext_ctx->ia32_fmask);
-	msr_write(MSR_IA32_KERNEL_GS_BASE, ext_ctx->ia32_kernel_gs_base);
+	msr_write_changed(MSR_IA32_STAR, prev_ctx->ia32_star, ext_ctx->ia32_star);
+	msr_write_changed(MSR_IA32_LSTAR, prev_ctx->ia32_lstar, ext_ctx->ia32_lstar);
+	msr_write_changed(MSR_IA32_FMASK, prev_ctx->ia32_fmask, ext_ctx->ia32_fmask);
+	msr_write_changed(MSR_IA32_KERNEL_GS_BASE, prev_ctx->ia32_kernel_gs_base, ext_ctx->ia32_kernel_gs_base);
 
 	/* FX area */
 	rstor_fxstore_guest_area(ext_ctx);
@@ -285,12 +340,13 @@ static void copy_smc_param(const struct run_context *prev_ctx,
 void switch_world(struct acrn_vcpu *vcpu, int32_t next_world)
 {
 	struct acrn_vcpu_arch *arch = &vcpu->arch;
+	uint64_t start = rdtsc();
 
 	/* save previous world context */
 	save_world_ctx(vcpu, &arch->contexts[!next_world].ext_ctx);
 
 	/* load next world context */
-	load_world_ctx(vcpu, &arch->contexts[next_world].ext_ctx);
+	load_world_ctx(vcpu, &arch->contexts[!next_world].ext_ctx, &arch->contexts[next_world].ext_ctx);
 
 	/* Copy SMC parameters: RDI, RSI, RDX, RBX */
 	copy_smc_param(&arch->contexts[!next_world].run_ctx,
@@ -298,9 +354,7 @@ void switch_world(struct acrn_vcpu *vcpu, int32_t next_world)
 
 	if (next_world == NORMAL_WORLD) {
 		/* load EPTP for next world */
-		exec_vmwrite64(VMX_EPT_POINTER_FULL,
-			hva2hpa(vcpu->vm->arch_vm.nworld_eptp) |
-			(3UL << 3U) | 0x6UL);
+		exec_vmwrite64(VMX_EPT_POINTER_FULL, ept_nworld_eptp(vcpu));
 
 #ifndef CONFIG_L1D_FLUSH_VMENTRY_ENABLED
 		cpu_l1d_flush();
@@ -313,6 +367,8 @@ void switch_world(struct acrn_vcpu *vcpu, int32_t next_world)
 
 	/* Update world index */
 	arch->cur_context = next_world;
+
+	exit_stats_record(&vcpu->vm->sworld_control.switch_stats[next_world], rdtsc() - start);
 }
 
 static inline uint32_t get_max_svn_index(void)
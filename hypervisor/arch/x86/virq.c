@@ -60,7 +60,7 @@ static bool is_guest_irq_enabled(struct acrn_vcpu *vcpu)
 	if ((guest_rflags & HV_ARCH_VCPU_RFLAGS_IF) != 0UL) {
 		/* Interrupts are allowed */
 		/* Check for temporarily disabled interrupts */
-		guest_state = exec_vmread32(VMX_GUEST_INTERRUPTIBILITY_INFO);
+		guest_state = (uint32_t)vcpu_vmcs_read(vcpu, VMCS_GUEST_INTERRUPTIBILITY);
 
 		if ((guest_state & (HV_ARCH_VCPU_BLOCKED_BY_STI |
 				    HV_ARCH_VCPU_BLOCKED_BY_MOVSS)) == 0UL) {
@@ -94,14 +94,14 @@ static bool vcpu_pending_request(struct acrn_vcpu *vcpu)
 void vcpu_make_request(struct acrn_vcpu *vcpu, uint16_t eventid)
 {
 	bitmap_set_lock(eventid, &vcpu->arch.pending_req);
+	/* a vCPU halted off the run queue must be put back first */
+	wake_vcpu(vcpu);
 	/*
 	 * if current hostcpu is not the target vcpu's hostcpu, we need
 	 * to invoke IPI to wake up target vcpu
 	 *
-	 * TODO: Here we just compare with cpuid, since cpuid currently is
-	 *  global under pCPU / vCPU 1:1 mapping. If later we enabled vcpu
-	 *  scheduling, we need change here to determine it target vcpu is
-	 *  VMX non-root or root mode
+	 * TODO: a vCPU sharing its pCPU may be in root mode while another
+	 *  vCPU runs, the IPI then only costs a spurious VM exit.
 	 */
 	if (get_cpu_id() != vcpu->pcpu_id) {
 		send_single_ipi(vcpu->pcpu_id, VECTOR_NOTIFY_VCPU);
@@ -141,14 +141,15 @@ static int32_t vcpu_inject_vlapic_int(struct acrn_vcpu *vcpu)
 		return -1;
 	}
 
-	exec_vmwrite32(VMX_ENTRY_INT_INFO_FIELD, VMX_INT_INFO_VALID |
+	vcpu_vmcs_write(vcpu, VMCS_ENTRY_INT_INFO, VMX_INT_INFO_VALID |
 		(vector & 0xFFU));
+	TRACE_4I(TRACE_VLAPIC_INJECT, (uint32_t)vcpu->vcpu_id, vector, (uint32_t)vcpu->vm->vm_id, 0U);
 
 	vlapic_intr_accepted(vlapic, vector);
 	return 0;
 }
 
-static int32_t vcpu_do_pending_extint(const struct acrn_vcpu *vcpu)
+static int32_t vcpu_do_pending_extint(struct acrn_vcpu *vcpu)
 {
 	struct acrn_vm *vm;
 	struct acrn_vcpu *primary;
@@ -165,7 +166,7 @@ static int32_t vcpu_do_pending_extint(const struct acrn_vcpu *vcpu)
 		if (vector <= NR_MAX_VECTOR) {
 			dev_dbg(ACRN_DBG_INTR, "VPIC: to inject PIC vector %d\n",
 					vector & 0xFFU);
-			exec_vmwrite32(VMX_ENTRY_INT_INFO_FIELD,
+			vcpu_vmcs_write(vcpu, VMCS_ENTRY_INT_INFO,
 					VMX_INT_INFO_VALID |
 					(vector & 0xFFU));
 			vpic_intr_accepted(vcpu->vm, vector);
@@ -236,11 +237,11 @@ int32_t vcpu_queue_exception(struct acrn_vcpu *vcpu, uint32_t vector, uint32_t e
 static void vcpu_inject_exception(struct acrn_vcpu *vcpu, uint32_t vector)
 {
 	if ((exception_type[vector] & EXCEPTION_ERROR_CODE_VALID) != 0U) {
-		exec_vmwrite32(VMX_ENTRY_EXCEPTION_ERROR_CODE,
+		vcpu_vmcs_write(vcpu, VMCS_ENTRY_EXCEPTION_ERROR_CODE,
 				vcpu->arch.exception_info.error);
 	}
 
-	exec_vmwrite32(VMX_ENTRY_INT_INFO_FIELD, VMX_INT_INFO_VALID |
+	vcpu_vmcs_write(vcpu, VMCS_ENTRY_INT_INFO, VMX_INT_INFO_VALID |
 			(exception_type[vector] << 8U) | (vector & 0xFFU));
 
 	vcpu->arch.exception_info.exception = VECTOR_INVALID;
@@ -338,9 +339,9 @@ int32_t interrupt_window_vmexit_handler(struct acrn_vcpu *vcpu)
 	 * acrn_handle_pending_request will continue handle for this vcpu
 	 */
 	vcpu->arch.irq_window_enabled = 0U;
-	value32 = exec_vmread32(VMX_PROC_VM_EXEC_CONTROLS);
+	value32 = (uint32_t)vcpu_vmcs_read(vcpu, VMCS_PROC_VM_EXEC_CONTROLS);
 	value32 &= ~(VMX_PROCBASED_CTLS_IRQ_WIN);
-	exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS, value32);
+	vcpu_vmcs_write(vcpu, VMCS_PROC_VM_EXEC_CONTROLS, value32);
 
 	vcpu_retain_rip(vcpu);
 	return 0;
@@ -352,7 +353,7 @@ int32_t external_interrupt_vmexit_handler(struct acrn_vcpu *vcpu)
 	struct intr_excp_ctx ctx;
 	int32_t ret;
 
-	intr_info = exec_vmread32(VMX_EXIT_INT_INFO);
+	intr_info = (uint32_t)vcpu_vmcs_read(vcpu, VMCS_EXIT_INT_INFO);
 	if (((intr_info & VMX_INT_INFO_VALID) == 0U) ||
 		(((intr_info & VMX_INT_TYPE_MASK) >> 8U)
 		!= VMX_INT_TYPE_EXT_INT)) {
@@ -398,7 +399,7 @@ int32_t acrn_handle_pending_request(struct acrn_vcpu *vcpu)
 
 	if (bitmap_test_and_clear_lock(ACRN_REQUEST_EPT_FLUSH,
 						pending_req_bits)) {
-		invept(vcpu);
+		ept_flush_vcpu(vcpu);
 	}
 
 	if (bitmap_test_and_clear_lock(ACRN_REQUEST_VPID_FLUSH,
@@ -416,12 +417,12 @@ int32_t acrn_handle_pending_request(struct acrn_vcpu *vcpu)
 		if ((arch->inject_info.intr_info &
 		     (EXCEPTION_ERROR_CODE_VALID << 8U)) != 0U) {
 			error_code = arch->inject_info.error_code;
-			exec_vmwrite32(VMX_ENTRY_EXCEPTION_ERROR_CODE,
+			vcpu_vmcs_write(vcpu, VMCS_ENTRY_EXCEPTION_ERROR_CODE,
 			        error_code);
 		}
 
 		intr_info = arch->inject_info.intr_info;
-		exec_vmwrite32(VMX_ENTRY_INT_INFO_FIELD, intr_info);
+		vcpu_vmcs_write(vcpu, VMCS_ENTRY_INT_INFO, intr_info);
 
 		arch->inject_event_pending = false;
 		goto INTR_WIN;
@@ -455,7 +456,7 @@ int32_t acrn_handle_pending_request(struct acrn_vcpu *vcpu)
 	/* inject NMI before maskable hardware interrupt */
 	if (bitmap_test_and_clear_lock(ACRN_REQUEST_NMI, pending_req_bits)) {
 		/* Inject NMI vector = 2 */
-		exec_vmwrite32(VMX_ENTRY_INT_INFO_FIELD,
+		vcpu_vmcs_write(vcpu, VMCS_ENTRY_INT_INFO,
 			VMX_INT_INFO_VALID | (VMX_INT_TYPE_NMI << 8U) | IDT_NMI);
 
 		goto INTR_WIN;
@@ -469,7 +470,7 @@ int32_t acrn_handle_pending_request(struct acrn_vcpu *vcpu)
 	 *   at next vm exit?
 	 */
 	if ((arch->idt_vectoring_info & VMX_INT_INFO_VALID) != 0U) {
-		exec_vmwrite32(VMX_ENTRY_INT_INFO_FIELD,
+		vcpu_vmcs_write(vcpu, VMCS_ENTRY_INT_INFO,
 				arch->idt_vectoring_info);
 		goto INTR_WIN;
 	}
@@ -527,9 +528,9 @@ INTR_WIN:
 		return ret;
 	}
 
-	tmp = exec_vmread32(VMX_PROC_VM_EXEC_CONTROLS);
+	tmp = (uint32_t)vcpu_vmcs_read(vcpu, VMCS_PROC_VM_EXEC_CONTROLS);
 	tmp |= VMX_PROCBASED_CTLS_IRQ_WIN;
-	exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS, tmp);
+	vcpu_vmcs_write(vcpu, VMCS_PROC_VM_EXEC_CONTROLS, tmp);
 	arch->irq_window_enabled = 1U;
 
 	return ret;
@@ -539,7 +540,7 @@ void cancel_event_injection(struct acrn_vcpu *vcpu)
 {
 	uint32_t intinfo;
 
-	intinfo = exec_vmread32(VMX_ENTRY_INT_INFO_FIELD);
+	intinfo = (uint32_t)vcpu_vmcs_read(vcpu, VMCS_ENTRY_INT_INFO);
 
 	/*
 	 * If event is injected, we clear VMX_ENTRY_INT_INFO_FIELD,
@@ -552,11 +553,11 @@ void cancel_event_injection(struct acrn_vcpu *vcpu)
 
 		if ((intinfo & (EXCEPTION_ERROR_CODE_VALID << 8U)) != 0U) {
 			vcpu->arch.inject_info.error_code =
-				exec_vmread32(VMX_ENTRY_EXCEPTION_ERROR_CODE);
+				(uint32_t)vcpu_vmcs_read(vcpu, VMCS_ENTRY_EXCEPTION_ERROR_CODE);
 		}
 
 		vcpu->arch.inject_info.intr_info = intinfo;
-		exec_vmwrite32(VMX_ENTRY_INT_INFO_FIELD, 0U);
+		vcpu_vmcs_write(vcpu, VMCS_ENTRY_INT_INFO, 0U);
 	}
 }
 
@@ -573,7 +574,7 @@ int32_t exception_vmexit_handler(struct acrn_vcpu *vcpu)
 	pr_dbg(" Handling guest exception");
 
 	/* Obtain VM-Exit information field pg 2912 */
-	intinfo = exec_vmread32(VMX_EXIT_INT_INFO);
+	intinfo = (uint32_t)vcpu_vmcs_read(vcpu, VMCS_EXIT_INT_INFO);
 	if ((intinfo & VMX_INT_INFO_VALID) != 0U) {
 		exception_vector = intinfo & 0xFFU;
 		/* Check if exception caused by the guest is a HW exception.
@@ -581,7 +582,7 @@ int32_t exception_vmexit_handler(struct acrn_vcpu *vcpu)
 		 * error code to be conveyed to get via the stack
 		 */
 		if ((intinfo & VMX_INT_INFO_ERR_CODE_VALID) != 0U) {
-			int_err_code = exec_vmread32(VMX_EXIT_INT_ERROR_CODE);
+			int_err_code = (uint32_t)vcpu_vmcs_read(vcpu, VMCS_EXIT_INT_ERROR_CODE);
 
 			/* get current privilege level and fault address */
 			cpl = exec_vmread32(VMX_GUEST_CS_ATTR);
@@ -10,11 +10,13 @@
  * According to "SDM APPENDIX C VMX BASIC EXIT REASONS",
  * there are 65 Basic Exit Reasons.
  */
-#define NR_VMX_EXIT_REASONS	65U
+#define NR_VMX_EXIT_REASONS	ACRN_VMEXIT_REASONS
 
 static int32_t unhandled_vmexit_handler(struct acrn_vcpu *vcpu);
 static int32_t xsetbv_vmexit_handler(struct acrn_vcpu *vcpu);
 static int32_t wbinvd_vmexit_handler(struct acrn_vcpu *vcpu);
+static int32_t hlt_vmexit_handler(struct acrn_vcpu *vcpu);
+static int32_t pause_vmexit_handler(struct acrn_vcpu *vcpu);
 
 /* VM Dispatch table for Exit condition handling */
 static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
@@ -43,7 +45,7 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 	[VMX_EXIT_REASON_GETSEC] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_HLT] = {
-		.handler = unhandled_vmexit_handler},
+		.handler = hlt_vmexit_handler},
 	[VMX_EXIT_REASON_INVD] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_INVLPG] = {
@@ -98,7 +100,7 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 	[VMX_EXIT_REASON_MONITOR] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_PAUSE] = {
-		.handler = unhandled_vmexit_handler},
+		.handler = pause_vmexit_handler},
 	[VMX_EXIT_REASON_ENTRY_FAILURE_MACHINE_CHECK] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_TPR_BELOW_THRESHOLD] = {
@@ -124,7 +126,7 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 	[VMX_EXIT_REASON_RDTSCP] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_VMX_PREEMPTION_TIMER_EXPIRED] = {
-		.handler = unhandled_vmexit_handler},
+		.handler = ptmr_vmexit_handler},
 	[VMX_EXIT_REASON_INVVPID] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_WBINVD] = {
@@ -152,10 +154,95 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 		.handler = unhandled_vmexit_handler}
 };
 
+static inline uint32_t exit_hist_bucket(uint64_t cycles)
+{
+	uint32_t bucket = 0U;
+
+	if (cycles != 0UL) {
+		bucket = (uint32_t)fls64(cycles);
+		if (bucket >= ACRN_VMEXIT_HIST_BUCKETS) {
+			bucket = ACRN_VMEXIT_HIST_BUCKETS - 1U;
+		}
+	}
+
+	return bucket;
+}
+
+void exit_stats_record(struct acrn_exit_reason_stats *stats, uint64_t cycles)
+{
+	stats->count++;
+	stats->total_cycles += cycles;
+	if (cycles > stats->max_cycles) {
+		stats->max_cycles = cycles;
+	}
+	stats->hist[exit_hist_bucket(cycles)]++;
+}
+
+void exit_timeline_exit(struct acrn_vcpu *vcpu)
+{
+	struct exit_timeline *tl = &vcpu->exit_timeline;
+	struct acrn_exit_record *rec = &tl->records[tl->nr_exits & (ACRN_EXIT_TIMELINE_RECORDS - 1U)];
+
+	rec->exit_tsc = rdtsc();
+	rec->guest_rip = vcpu_get_rip(vcpu);
+	rec->exit_reason = (uint16_t)(vcpu->arch.exit_reason & 0xFFFFU);
+	tl->pending = true;
+}
+
+void exit_timeline_entry(struct acrn_vcpu *vcpu)
+{
+	struct exit_timeline *tl = &vcpu->exit_timeline;
+	struct acrn_exit_record *rec = &tl->records[tl->nr_exits & (ACRN_EXIT_TIMELINE_RECORDS - 1U)];
+	uint64_t cycles;
+
+	if (tl->pending) {
+		cycles = rdtsc() - rec->exit_tsc;
+		rec->cycles = (cycles > 0xFFFFFFFFUL) ? 0xFFFFFFFFU : (uint32_t)cycles;
+		/* the record is complete before it gets counted */
+		cpu_write_memory_barrier();
+		tl->nr_exits++;
+		tl->pending = false;
+	}
+}
+
+/* publish the exit counters of vcpu in the telemetry page of its VM */
+static void telemetry_record_exit(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vm_telemetry *page = (struct acrn_vm_telemetry *)vcpu->vm->sw.telemetry_page;
+	const struct vmexit_stats *stats = &vcpu->exit_stats;
+	struct acrn_vcpu_telemetry *t;
+
+	if ((page != NULL) && (vcpu->vcpu_id < ACRN_TELEMETRY_VCPUS)) {
+		t = &page->vcpu[vcpu->vcpu_id];
+		/* the count is kept here, SOS may write to the page */
+		vcpu->telemetry_seq++;
+		stac();
+		t->seq = vcpu->telemetry_seq;
+		cpu_write_memory_barrier();
+		t->exits = stats->exits;
+		t->exit_cycles = stats->exit_cycles;
+		t->ext_intr_exits = stats->reason[VMX_EXIT_REASON_EXTERNAL_INTERRUPT].count;
+		t->pio_exits = stats->reason[VMX_EXIT_REASON_IO_INSTRUCTION].count;
+		t->ept_exits = stats->reason[VMX_EXIT_REASON_EPT_VIOLATION].count;
+		t->msr_exits = stats->reason[VMX_EXIT_REASON_RDMSR].count +
+			stats->reason[VMX_EXIT_REASON_WRMSR].count;
+		t->hlt_exits = stats->reason[VMX_EXIT_REASON_HLT].count;
+		t->dm_requests = vcpu->sched.dm_requests;
+		t->dm_wait = vcpu->sched.dm_wait;
+		t->intr_sent = stats->intr_sent;
+		t->timer_fired = stats->timer_fired;
+		cpu_write_memory_barrier();
+		vcpu->telemetry_seq++;
+		t->seq = vcpu->telemetry_seq;
+		clac();
+	}
+}
+
 int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	struct vm_exit_dispatch *dispatch = NULL;
 	uint16_t basic_exit_reason;
+	uint64_t start, cycles;
 	int32_t ret;
 
 	if (get_cpu_id() != vcpu->pcpu_id) {
@@ -165,7 +252,7 @@ int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 
 	/* Obtain interrupt info */
 	vcpu->arch.idt_vectoring_info =
-	    exec_vmread32(VMX_IDT_VEC_INFO_FIELD);
+	    (uint32_t)vcpu_vmcs_read(vcpu, VMCS_IDT_VEC_INFO);
 	/* Filter out HW exception & NMI */
 	if ((vcpu->arch.idt_vectoring_info & VMX_INT_INFO_VALID) != 0U) {
 		uint32_t vector_info = vcpu->arch.idt_vectoring_info;
@@ -175,7 +262,7 @@ int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 
 		if (type == VMX_INT_TYPE_HW_EXP) {
 			if ((vector_info & VMX_INT_INFO_ERR_CODE_VALID) != 0U) {
-				err_code = exec_vmread32(VMX_IDT_VEC_ERROR_CODE);
+				err_code = (uint32_t)vcpu_vmcs_read(vcpu, VMCS_IDT_VEC_ERROR_CODE);
 			}
 			(void)vcpu_queue_exception(vcpu, vector, err_code);
 			vcpu->arch.idt_vectoring_info = 0U;
@@ -210,10 +297,11 @@ int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 	if (dispatch->need_exit_qualification != 0U) {
 		/* Get exit qualification */
 		vcpu->arch.exit_qualification =
-		    exec_vmread(VMX_EXIT_QUALIFICATION);
+		    vcpu_vmcs_read(vcpu, VMCS_EXIT_QUALIFICATION);
 	}
 
 	/* exit dispatch handling */
+	start = rdtsc();
 	if (basic_exit_reason == VMX_EXIT_REASON_EXTERNAL_INTERRUPT) {
 		/* Handling external_interrupt
 		 * should disable intr
@@ -224,6 +312,11 @@ int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 	} else {
 		ret = dispatch->handler(vcpu);
 	}
+	cycles = rdtsc() - start;
+	exit_stats_record(&vcpu->exit_stats.reason[basic_exit_reason], cycles);
+	vcpu->exit_stats.exits++;
+	vcpu->exit_stats.exit_cycles += cycles;
+	telemetry_record_exit(vcpu);
 
 	return ret;
 }
@@ -231,12 +324,12 @@ int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 static int32_t unhandled_vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	pr_fatal("Error: Unhandled VM exit condition from guest at 0x%016llx ",
-			exec_vmread(VMX_GUEST_RIP));
+			vcpu_get_rip(vcpu));
 
 	pr_fatal("Exit Reason: 0x%016llx ", vcpu->arch.exit_reason);
 
 	pr_err("Exit qualification: 0x%016llx ",
-			exec_vmread(VMX_EXIT_QUALIFICATION));
+			vcpu_vmcs_read(vcpu, VMCS_EXIT_QUALIFICATION));
 
 	TRACE_2L(TRACE_VMEXIT_UNHANDLED, vcpu->arch.exit_reason, 0UL);
 
@@ -263,6 +356,18 @@ int32_t cpuid_vmexit_handler(struct acrn_vcpu *vcpu)
 	return 0;
 }
 
+static void account_cr_write(uint64_t *bit_writes, uint64_t changed_bits)
+{
+	uint64_t bits = changed_bits & 0xFFFFFFFFUL;
+	uint16_t bit;
+
+	while (bits != 0UL) {
+		bit = ffs64(bits);
+		bitmap_clear_nolock(bit, &bits);
+		bit_writes[bit]++;
+	}
+}
+
 int32_t cr_access_vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	uint64_t reg;
@@ -279,10 +384,12 @@ int32_t cr_access_vmexit_handler(struct acrn_vcpu *vcpu)
 			vm_exit_cr_access_cr_num(exit_qual)) {
 	case 0x00UL:
 		/* mov to cr0 */
+		account_cr_write(vcpu->exit_stats.cr0_bit_writes, vcpu_get_cr0(vcpu) ^ reg);
 		vcpu_set_cr0(vcpu, reg);
 		break;
 	case 0x04UL:
 		/* mov to cr4 */
+		account_cr_write(vcpu->exit_stats.cr4_bit_writes, vcpu_get_cr4(vcpu) ^ reg);
 		vcpu_set_cr4(vcpu, reg);
 		break;
 	case 0x08UL:
@@ -370,3 +477,20 @@ static int32_t wbinvd_vmexit_handler(struct acrn_vcpu *vcpu)
 
 	return 0;
 }
+
+/*
+ * HLT and PAUSE-loop exits are only enabled when vCPUs may share a pCPU:
+ * a halted vCPU leaves the run queue until an interrupt is made pending
+ * for it, a spinning vCPU gives its slice to the next runnable one.
+ */
+static int32_t hlt_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	halt_vcpu(vcpu);
+	return 0;
+}
+
+static int32_t pause_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	yield_vcpu(vcpu);
+	return 0;
+}
@@ -21,9 +21,11 @@ extern struct efi_context* efi_ctx;
 #define TR_AR				(0x008bU) /* TSS (busy), refer to SDM Vol3 26.3.1.2 */
 
 static uint64_t cr0_host_mask;
+static uint64_t cr0_min_host_mask;
 static uint64_t cr0_always_on_mask;
 static uint64_t cr0_always_off_mask;
 static uint64_t cr4_host_mask;
+static uint64_t cr4_min_host_mask;
 static uint64_t cr4_always_on_mask;
 static uint64_t cr4_always_off_mask;
 
@@ -203,16 +205,18 @@ void exec_vmwrite16(uint32_t field, uint16_t value)
 	exec_vmwrite64(field, (uint64_t)value);
 }
 
-static void init_cr0_cr4_host_mask(void)
+static void init_cr0_cr4_host_mask(const struct acrn_vcpu *vcpu)
 {
 	static bool inited = false;
-	uint64_t fixed0, fixed1;
+	uint64_t fixed0, fixed1, cr0_mask, cr4_mask;
 	if (!inited) {
 		/* Read the CR0 fixed0 / fixed1 MSR registers */
 		fixed0 = msr_read(MSR_IA32_VMX_CR0_FIXED0);
 		fixed1 = msr_read(MSR_IA32_VMX_CR0_FIXED1);
 
 		cr0_host_mask = ~(fixed0 ^ fixed1);
+		/* The fixed bits stay trapped for a VM owning the optional ones */
+		cr0_min_host_mask = cr0_host_mask | (CR0_TRAP_MASK & ~CR0_OPTIONAL_TRAP_MASK);
 		/* Add the bit hv wants to trap */
 		cr0_host_mask |= CR0_TRAP_MASK;
 		/* CR0 clear PE/PG from always on bits due to "unrestructed
@@ -230,6 +234,7 @@ static void init_cr0_cr4_host_mask(void)
 		fixed1 = msr_read(MSR_IA32_VMX_CR4_FIXED1);
 
 		cr4_host_mask = ~(fixed0 ^ fixed1);
+		cr4_min_host_mask = cr4_host_mask | (CR4_TRAP_MASK & ~CR4_OPTIONAL_TRAP_MASK);
 		/* Add the bit hv wants to trap */
 		cr4_host_mask |= CR4_TRAP_MASK;
 		cr4_always_on_mask = fixed0;
@@ -244,14 +249,15 @@ static void init_cr0_cr4_host_mask(void)
 		inited = true;
 	}
 
-	exec_vmwrite(VMX_CR0_MASK, cr0_host_mask);
+	cr0_mask = vcpu->vm->guest_cr_bits ? cr0_min_host_mask : cr0_host_mask;
+	exec_vmwrite(VMX_CR0_MASK, cr0_mask);
 	/* Output CR0 mask value */
-	pr_dbg("CR0 mask value: 0x%016llx", cr0_host_mask);
+	pr_dbg("CR0 mask value: 0x%016llx", cr0_mask);
 
-
-	exec_vmwrite(VMX_CR4_MASK, cr4_host_mask);
+	cr4_mask = vcpu->vm->guest_cr_bits ? cr4_min_host_mask : cr4_host_mask;
+	exec_vmwrite(VMX_CR4_MASK, cr4_mask);
 	/* Output CR4 mask value */
-	pr_dbg("CR4 mask value: 0x%016llx", cr4_host_mask);
+	pr_dbg("CR4 mask value: 0x%016llx", cr4_mask);
 }
 
 uint64_t vmx_rdmsr_pat(const struct acrn_vcpu *vcpu)
@@ -354,7 +360,7 @@ static bool is_cr0_write_valid(struct acrn_vcpu *vcpu, uint64_t cr0)
  *   - ET (4)  Flexible to guest
  *   - NE (5)  must always be 1
  *   - WP (16) Trapped to get if it inhibits supervisor level procedures to
- *             write into ro-pages.
+ *             write into ro-pages. Flexible to a VM with guest_cr_bits.
  *   - AM (18) Flexible to guest
  *   - NW (29) Trapped to emulate cache disable situation
  *   - CD (30) Trapped to emulate cache disable situation
@@ -499,6 +505,7 @@ static bool is_cr4_write_valid(struct acrn_vcpu *vcpu, uint64_t cr4)
  *   - DE  (3) Flexible to guest
  *   - PSE (4) Trapped to track paging mode.
  *             Set the value according to the value from guest.
+ *             Flexible to a VM with guest_cr_bits.
  *   - PAE (5) Trapped to track paging mode.
  *             Set the value according to the value from guest.
  *   - MCE (6) Flexible to guest
@@ -736,6 +743,15 @@ static void init_host_state(void)
 	exec_vmwrite(VMX_HOST_IA32_SYSENTER_EIP, 0UL);
 }
 
+static inline bool is_hlt_exiting_enabled(void)
+{
+#ifdef CONFIG_HLT_EXITING
+	return true;
+#else
+	return false;
+#endif
+}
+
 static uint32_t check_vmx_ctrl(uint32_t msr, uint32_t ctrl_req)
 {
 	uint64_t vmx_msr;
@@ -817,6 +833,15 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	 */
 	value32 &= ~VMX_PROCBASED_CTLS_INVLPG;
 
+	/*
+	 * Exit on HLT so a halted vCPU blocks until it has an interrupt
+	 * and hands the pCPU to the other vCPUs or the idle loop. This is
+	 * a must when vCPUs may share a pCPU.
+	 */
+	if (is_vcpu_overcommit_supported() || is_hlt_exiting_enabled()) {
+		value32 |= VMX_PROCBASED_CTLS_HLT;
+	}
+
 	exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS, value32);
 	pr_dbg("VMX_PROC_VM_EXEC_CONTROLS: 0x%x ", value32);
 
@@ -858,6 +883,25 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 
 	value32 |= VMX_PROCBASED_CTLS2_WBINVD;
 
+	/*
+	 * RDTSC and RDTSCP never exit: a TSC frequency other than the host
+	 * one is obtained by scaling, on top of the TSC offset.
+	 */
+	if (vcpu->vm->arch_vm.tsc_multiplier != 0UL) {
+		value32 |= VMX_PROCBASED_CTLS2_TSC_SCALING;
+		exec_vmwrite64(VMX_TSC_MULTIPLIER_FULL, vcpu->vm->arch_vm.tsc_multiplier);
+	}
+
+	/*
+	 * Likewise, a vCPU spinning on a lock yields its time slice, to the
+	 * preempted lock holder if possible. The gap and window are per VM.
+	 */
+	if (is_vcpu_overcommit_supported() && is_ple_supported()) {
+		value32 |= VMX_PROCBASED_CTLS2_PAUSE_LOOP;
+		exec_vmwrite32(VMX_PLE_GAP, vcpu->vm->ple_gap);
+		exec_vmwrite32(VMX_PLE_WINDOW, vcpu->vm->ple_window);
+	}
+
 	exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS2, value32);
 	pr_dbg("VMX_PROC_VM_EXEC_CONTROLS2: 0x%x ", value32);
 
@@ -891,7 +935,7 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	 * TODO: introduce API to make this data driven based
 	 * on VMX_EPT_VPID_CAP
 	 */
-	value64 = hva2hpa(vm->arch_vm.nworld_eptp) | (3UL << 3U) | 6UL;
+	value64 = ept_nworld_eptp(vcpu);
 	exec_vmwrite64(VMX_EPT_POINTER_FULL, value64);
 	pr_dbg("VMX_EPT_POINTER: 0x%016llx ", value64);
 
@@ -943,7 +987,7 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	/* Natural-width */
 	pr_dbg("Natural-width*********");
 
-	init_cr0_cr4_host_mask();
+	init_cr0_cr4_host_mask(vcpu);
 
 	/* The CR3 target registers work in concert with VMX_CR3_TARGET_COUNT
 	 * field. Using these registers guest CR3 access can be managed. i.e.,
@@ -985,7 +1029,7 @@ static void init_entry_ctrl(const struct acrn_vcpu *vcpu)
 	 * MSRs on load from memory on VM entry from mem address provided by
 	 * VM-entry MSR load address field
 	 */
-	exec_vmwrite32(VMX_ENTRY_MSR_LOAD_COUNT, MSR_AREA_COUNT);
+	exec_vmwrite32(VMX_ENTRY_MSR_LOAD_COUNT, vcpu->arch.vpmu.msr_cnt);
 	exec_vmwrite64(VMX_ENTRY_MSR_LOAD_ADDR_FULL, (uint64_t)vcpu->arch.msr_area.guest);
 
 	/* Set up VM entry interrupt information field pg 2909 24.8.3 */
@@ -1030,8 +1074,8 @@ static void init_exit_ctrl(struct acrn_vcpu *vcpu)
 	 * The 64 bit VM-exit MSR store and load address fields provide the
 	 * corresponding addresses
 	 */
-	exec_vmwrite32(VMX_EXIT_MSR_STORE_COUNT, MSR_AREA_COUNT);
-	exec_vmwrite32(VMX_EXIT_MSR_LOAD_COUNT, MSR_AREA_COUNT);
+	exec_vmwrite32(VMX_EXIT_MSR_STORE_COUNT, vcpu->arch.vpmu.msr_cnt);
+	exec_vmwrite32(VMX_EXIT_MSR_LOAD_COUNT, vcpu->arch.vpmu.msr_cnt);
 	exec_vmwrite64(VMX_EXIT_MSR_STORE_ADDR_FULL, (uint64_t)vcpu->arch.msr_area.guest);
 	exec_vmwrite64(VMX_EXIT_MSR_LOAD_ADDR_FULL, (uint64_t)vcpu->arch.msr_area.host);
 }
@@ -1047,6 +1091,9 @@ void init_vmcs(struct acrn_vcpu *vcpu)
 	/* Log message */
 	pr_dbg("Initializing VMCS");
 
+	/* nothing read from or pending for the previous VMCS contents stays */
+	vcpu_vmcs_cache_reset(vcpu);
+
 	/* Obtain the VM Rev ID from HW and populate VMCS page with it */
 	vmx_rev_id = msr_read(MSR_IA32_VMX_BASIC);
 	(void)memcpy_s(vcpu->arch.vmcs, 4U, (void *)&vmx_rev_id, 4U);
@@ -1103,9 +1150,14 @@ void switch_apicv_mode_x2apic(struct acrn_vcpu *vcpu)
 		value32 &= ~VMX_EXIT_CTLS_ACK_IRQ;
 		exec_vmwrite32(VMX_EXIT_CONTROLS, value32);
 
-		value32 = exec_vmread32(VMX_PROC_VM_EXEC_CONTROLS);
+		value32 = (uint32_t)vcpu_vmcs_read(vcpu, VMCS_PROC_VM_EXEC_CONTROLS);
 		value32 &= ~VMX_PROCBASED_CTLS_TPR_SHADOW;
-		exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS, value32);
+		/*
+		 * Interrupts are delivered by the physical LAPIC straight
+		 * to the guest, which hence has to halt in non-root mode.
+		 */
+		value32 &= ~VMX_PROCBASED_CTLS_HLT;
+		vcpu_vmcs_write(vcpu, VMCS_PROC_VM_EXEC_CONTROLS, value32);
 
 		exec_vmwrite32(VMX_TPR_THRESHOLD, 0U);
 
@@ -41,6 +41,43 @@
 #define CTX_ENTRY_LOWER_SLPTPTR_POS     (12U)
 #define CTX_ENTRY_LOWER_SLPTPTR_MASK    (0xFFFFFFFFFFFFFUL <<  CTX_ENTRY_LOWER_SLPTPTR_POS)
 
+/* interrupt remapping table entry, posted format */
+#define IRTE_LOWER_P			(1UL << 0U)
+#define IRTE_LOWER_PST			(1UL << 15U)
+#define IRTE_LOWER_VECTOR_POS		(16U)
+#define IRTE_LOWER_PDA_MASK		(0xFFFFFFC0UL)
+#define IRTE_LOWER_PDA_POS		(32U)
+#define IRTE_UPPER_SVT_SID		(1UL << 18U)
+#define IRTE_UPPER_PDA_MASK		(0xFFFFFFFF00000000UL)
+
+/* one page of IRTEs, IRTA_REG encodes the size as 2^(S + 1) entries */
+#define DMAR_IRTE_NUM			256U
+#define DMAR_IRTA_SIZE			7UL
+
+/* 128-bit invalidation descriptors, one page of them per queue */
+#define DMAR_QI_DESC_NUM		256U
+/* address width of a 4-level EPT used as second-level page table */
+#define DMAR_EPT_ADDR_WIDTH		48U
+
+/* most page-selective IOTLB invalidations queued for one range */
+#define DMAR_QI_PSI_BATCH		32U
+#define DMAR_INV_CONTEXT_DESC		0x01UL
+#define DMAR_INV_IOTLB_DESC		0x02UL
+#define DMAR_INV_IEC_DESC		0x04UL
+#define DMAR_INV_WAIT_DESC		0x05UL
+#define DMAR_INV_GRANULARITY_POS	(4U)
+#define DMAR_INV_DID_POS		(16U)
+#define DMAR_INV_SID_POS		(32U)
+#define DMAR_INV_FM_POS			(48U)
+#define DMAR_INV_IOTLB_DW		(1UL << 6U)
+#define DMAR_INV_IOTLB_DR		(1UL << 7U)
+#define DMAR_INV_IEC_INDEX		(1UL << 4U)
+#define DMAR_INV_IEC_IIDX_POS		(32U)
+#define DMAR_INV_STATUS_WRITE		(1UL << 5U)
+#define DMAR_INV_STATUS_DATA_POS	(32U)
+#define DMAR_INV_STATUS_INCOMPLETED	0U
+#define DMAR_INV_STATUS_COMPLETED	1U
+
 static inline uint64_t dmar_get_bitslice(uint64_t var, uint64_t mask, uint32_t pos)
 {
 	return ((var & mask) >> pos);
@@ -104,6 +141,10 @@ struct dmar_drhd_rt {
 	uint16_t cap_fault_reg_offset;
 	uint16_t ecap_iotlb_offset;
 	uint32_t fault_state[IOMMU_FAULT_REGISTER_STATE_NUM]; /* 32bit registers */
+
+	uint32_t qi_tail;	/* next free invalidation descriptor */
+	volatile uint32_t qi_status;	/* written by invalidation wait descriptors */
+	uint64_t irte_bitmap[DMAR_IRTE_NUM >> 6U];	/* allocated IRTEs */
 };
 
 struct dmar_root_entry {
@@ -116,6 +157,16 @@ struct dmar_context_entry {
 	uint64_t upper;
 };
 
+struct dmar_qi_desc {
+	uint64_t lower;
+	uint64_t upper;
+};
+
+struct dmar_irte {
+	uint64_t lower;
+	uint64_t upper;
+};
+
 struct iommu_domain {
 	bool is_host;
 	bool is_tt_ept;     /* if reuse EPT of the domain */
@@ -131,6 +182,8 @@ struct context_table {
 
 static struct page root_tables[CONFIG_MAX_IOMMU_NUM] __aligned(PAGE_SIZE);
 static struct context_table ctx_tables[CONFIG_MAX_IOMMU_NUM] __aligned(PAGE_SIZE);
+static struct page qi_queues[CONFIG_MAX_IOMMU_NUM] __aligned(PAGE_SIZE);
+static struct page ir_tables[CONFIG_MAX_IOMMU_NUM] __aligned(PAGE_SIZE);
 
 static inline uint8_t* get_root_table(uint32_t dmar_index)
 {
@@ -142,6 +195,16 @@ static inline uint8_t* get_ctx_table(uint32_t dmar_index, uint8_t bus_no)
 	return ctx_tables[dmar_index].buses[bus_no].contents;
 }
 
+static inline struct dmar_qi_desc *get_qi_queue(uint32_t dmar_index)
+{
+	return (struct dmar_qi_desc *)qi_queues[dmar_index].contents;
+}
+
+static inline struct dmar_irte *get_ir_table(uint32_t dmar_index)
+{
+	return (struct dmar_irte *)ir_tables[dmar_index].contents;
+}
+
 bool iommu_snoop_supported(struct acrn_vm *vm)
 {
 	bool ret;
@@ -435,8 +498,9 @@ static int32_t dmar_register_hrhd(struct dmar_drhd_rt *dmar_unit)
 	/* when the hardware support snoop control,
 	 * to make sure snoop control is always enabled,
 	 * the SNP filed in the leaf PTE should be set.
-	 * How to guarantee it when EPT is used as second-level
-	 * translation paging structures?
+	 * ept_mr_add()/ept_mr_modify() set it in the EPT leaves
+	 * of all cacheable mappings, as the EPT is used as
+	 * second-level translation paging structures.
 	 */
 	if (iommu_ecap_sc(dmar_unit->ecap) == 0U) {
 		dev_dbg(ACRN_DBG_IOMMU, "dmar uint doesn't support snoop control!");
@@ -490,6 +554,56 @@ static void dmar_write_buffer_flush(struct dmar_drhd_rt *dmar_unit)
 	}
 }
 
+static inline bool is_dmar_qi_enabled(const struct dmar_drhd_rt *dmar_unit)
+{
+	return ((dmar_unit->gcmd & DMA_GCMD_QIE) != 0U);
+}
+
+/*
+ * Queue nr invalidation descriptors followed by a single invalidation wait
+ * descriptor and spin until hardware writes back the wait status.
+ * The queue is drained on return, so nr can be up to DMAR_QI_DESC_NUM - 2.
+ */
+static void dmar_issue_qi_requests(struct dmar_drhd_rt *dmar_unit, const struct dmar_qi_desc *descs,
+		uint32_t nr)
+{
+	struct dmar_qi_desc *queue = get_qi_queue(dmar_unit->index);
+	struct dmar_qi_desc *wait_desc;
+	uint32_t i;
+	/* variable start isn't used when built as release version */
+	__unused uint64_t start;
+
+	spinlock_obtain(&(dmar_unit->lock));
+	for (i = 0U; i < nr; i++) {
+		queue[dmar_unit->qi_tail] = descs[i];
+		iommu_flush_cache(dmar_unit, &queue[dmar_unit->qi_tail], sizeof(struct dmar_qi_desc));
+		dmar_unit->qi_tail = (dmar_unit->qi_tail + 1U) % DMAR_QI_DESC_NUM;
+	}
+
+	dmar_unit->qi_status = DMAR_INV_STATUS_INCOMPLETED;
+	wait_desc = &queue[dmar_unit->qi_tail];
+	wait_desc->lower = DMAR_INV_WAIT_DESC | DMAR_INV_STATUS_WRITE |
+		((uint64_t)DMAR_INV_STATUS_COMPLETED << DMAR_INV_STATUS_DATA_POS);
+	wait_desc->upper = hva2hpa((void *)&(dmar_unit->qi_status));
+	iommu_flush_cache(dmar_unit, wait_desc, sizeof(struct dmar_qi_desc));
+	dmar_unit->qi_tail = (dmar_unit->qi_tail + 1U) % DMAR_QI_DESC_NUM;
+
+	iommu_write64(dmar_unit, DMAR_IQT_REG, (uint64_t)dmar_unit->qi_tail << DMAR_IQ_SHIFT);
+
+	start = rdtsc();
+	while (dmar_unit->qi_status != DMAR_INV_STATUS_COMPLETED) {
+		ASSERT(((rdtsc() - start) < CYCLES_PER_MS),
+			"DMAR QI Timeout!");
+		pause_cpu();
+	}
+	spinlock_release(&(dmar_unit->lock));
+}
+
+static inline void dmar_issue_qi_request(struct dmar_drhd_rt *dmar_unit, const struct dmar_qi_desc *desc)
+{
+	dmar_issue_qi_requests(dmar_unit, desc, 1U);
+}
+
 /*
  * did: domain id
  * sid: source id
@@ -501,6 +615,7 @@ static void dmar_invalid_context_cache(struct dmar_drhd_rt *dmar_unit,
 {
 	uint64_t cmd = DMA_CCMD_ICC;
 	uint32_t status;
+	struct dmar_qi_desc desc;
 
 	switch (cirg) {
 	case DMAR_CIRG_GLOBAL:
@@ -517,14 +632,23 @@ static void dmar_invalid_context_cache(struct dmar_drhd_rt *dmar_unit,
 		return;
 	}
 
-	spinlock_obtain(&(dmar_unit->lock));
-	iommu_write64(dmar_unit, DMAR_CCMD_REG, cmd);
-	/* read upper 32bits to check */
-	dmar_wait_completion(dmar_unit, DMAR_CCMD_REG + 4U, DMA_CCMD_ICC_32, true, &status);
+	/* register based invalidation is not allowed once QI is enabled */
+	if (is_dmar_qi_enabled(dmar_unit)) {
+		desc.lower = DMAR_INV_CONTEXT_DESC | ((uint64_t)cirg << DMAR_INV_GRANULARITY_POS) |
+			((uint64_t)did << DMAR_INV_DID_POS) | ((uint64_t)sid << DMAR_INV_SID_POS) |
+			(((uint64_t)fm & 0x3UL) << DMAR_INV_FM_POS);
+		desc.upper = 0UL;
+		dmar_issue_qi_request(dmar_unit, &desc);
+	} else {
+		spinlock_obtain(&(dmar_unit->lock));
+		iommu_write64(dmar_unit, DMAR_CCMD_REG, cmd);
+		/* read upper 32bits to check */
+		dmar_wait_completion(dmar_unit, DMAR_CCMD_REG + 4U, DMA_CCMD_ICC_32, true, &status);
 
-	spinlock_release(&(dmar_unit->lock));
+		spinlock_release(&(dmar_unit->lock));
 
-	dev_dbg(ACRN_DBG_IOMMU, "cc invalidation granularity %d", dma_ccmd_get_caig_32(status));
+		dev_dbg(ACRN_DBG_IOMMU, "cc invalidation granularity %d", dma_ccmd_get_caig_32(status));
+	}
 }
 
 static void dmar_invalid_context_cache_global(struct dmar_drhd_rt *dmar_unit)
@@ -541,6 +665,7 @@ static void dmar_invalid_iotlb(struct dmar_drhd_rt *dmar_unit, uint16_t did, uin
 	uint64_t cmd = DMA_IOTLB_IVT | DMA_IOTLB_DR | DMA_IOTLB_DW;
 	uint64_t addr = 0UL;
 	uint32_t status;
+	struct dmar_qi_desc desc;
 
 	switch (iirg) {
 	case DMAR_IIRG_GLOBAL:
@@ -560,19 +685,43 @@ static void dmar_invalid_iotlb(struct dmar_drhd_rt *dmar_unit, uint16_t did, uin
 		pr_err("unknown IIRG type");
 		return;
 	}
-	spinlock_obtain(&(dmar_unit->lock));
-	if (addr != 0U) {
-		iommu_write64(dmar_unit, dmar_unit->ecap_iotlb_offset, addr);
+
+	if (is_dmar_qi_enabled(dmar_unit)) {
+		desc.lower = DMAR_INV_IOTLB_DESC | ((uint64_t)iirg << DMAR_INV_GRANULARITY_POS) |
+			DMAR_INV_IOTLB_DR | DMAR_INV_IOTLB_DW | ((uint64_t)did << DMAR_INV_DID_POS);
+		desc.upper = addr;
+		dmar_issue_qi_request(dmar_unit, &desc);
+	} else {
+		spinlock_obtain(&(dmar_unit->lock));
+		if (addr != 0U) {
+			iommu_write64(dmar_unit, dmar_unit->ecap_iotlb_offset, addr);
+		}
+
+		iommu_write64(dmar_unit, dmar_unit->ecap_iotlb_offset + 8U, cmd);
+		/* read upper 32bits to check */
+		dmar_wait_completion(dmar_unit, dmar_unit->ecap_iotlb_offset + 12U, DMA_IOTLB_IVT_32, true, &status);
+		spinlock_release(&(dmar_unit->lock));
+
+		if (dma_iotlb_get_iaig_32(status) == 0U) {
+			pr_err("fail to invalidate IOTLB!, 0x%x, 0x%x", status, iommu_read32(dmar_unit, DMAR_FSTS_REG));
+		}
 	}
+}
 
-	iommu_write64(dmar_unit, dmar_unit->ecap_iotlb_offset + 8U, cmd);
-	/* read upper 32bits to check */
-	dmar_wait_completion(dmar_unit, dmar_unit->ecap_iotlb_offset + 12U, DMA_IOTLB_IVT_32, true, &status);
-	spinlock_release(&(dmar_unit->lock));
+/*
+ * Invalidate the interrupt entry cache, for one IRTE or all of them
+ * when index is INVALID_IRTE_ID.
+ */
+static void dmar_invalid_iec(struct dmar_drhd_rt *dmar_unit, uint16_t index)
+{
+	struct dmar_qi_desc desc;
 
-	if (dma_iotlb_get_iaig_32(status) == 0U) {
-		pr_err("fail to invalidate IOTLB!, 0x%x, 0x%x", status, iommu_read32(dmar_unit, DMAR_FSTS_REG));
+	desc.lower = DMAR_INV_IEC_DESC;
+	if (index != INVALID_IRTE_ID) {
+		desc.lower |= DMAR_INV_IEC_INDEX | ((uint64_t)index << DMAR_INV_IEC_IIDX_POS);
 	}
+	desc.upper = 0UL;
+	dmar_issue_qi_request(dmar_unit, &desc);
 }
 
 /* Invalidate IOTLB globally,
@@ -585,6 +734,52 @@ static void dmar_invalid_iotlb_global(struct dmar_drhd_rt *dmar_unit)
 	dmar_invalid_iotlb(dmar_unit, 0U, 0UL, 0U, false, DMAR_IIRG_GLOBAL);
 }
 
+/*
+ * Invalidate the IOTLB entries of domain did for [gpa, gpa + size): cover
+ * the range with naturally aligned power-of-2 blocks, one page-selective
+ * descriptor each, behind a single wait descriptor. Falls back to a
+ * domain-selective invalidation without QI or page-selective support, or
+ * if the range takes more than DMAR_QI_PSI_BATCH blocks.
+ */
+static void dmar_invalid_iotlb_range(struct dmar_drhd_rt *dmar_unit, uint16_t did, uint64_t gpa, uint64_t size)
+{
+	struct dmar_qi_desc descs[DMAR_QI_PSI_BATCH];
+	uint64_t addr = gpa & PAGE_MASK;
+	uint64_t end = (gpa + size + PAGE_SIZE - 1UL) & PAGE_MASK;
+	uint64_t nr_pages;
+	uint32_t nr = 0U;
+	uint16_t am, mamv = iommu_cap_max_amask_val(dmar_unit->cap);
+	bool psi = is_dmar_qi_enabled(dmar_unit) && (iommu_cap_pgsel_inv(dmar_unit->cap) != 0U);
+
+	while (psi && (addr < end)) {
+		if (nr == DMAR_QI_PSI_BATCH) {
+			psi = false;
+			break;
+		}
+		nr_pages = (end - addr) >> PAGE_SHIFT;
+		am = fls64(nr_pages);
+		if ((addr >> PAGE_SHIFT) != 0UL) {
+			am = min(am, ffs64(addr >> PAGE_SHIFT));
+		}
+		if (am > mamv) {
+			am = mamv;
+		}
+		descs[nr].lower = DMAR_INV_IOTLB_DESC | ((uint64_t)DMAR_IIRG_PAGE << DMAR_INV_GRANULARITY_POS) |
+			DMAR_INV_IOTLB_DR | DMAR_INV_IOTLB_DW | ((uint64_t)did << DMAR_INV_DID_POS);
+		descs[nr].upper = addr | dma_iotlb_invl_addr_am((uint8_t)am);
+		nr++;
+		addr += (PAGE_SIZE_4K << am);
+	}
+
+	if (psi) {
+		if (nr != 0U) {
+			dmar_issue_qi_requests(dmar_unit, descs, nr);
+		}
+	} else {
+		dmar_invalid_iotlb(dmar_unit, did, 0UL, 0U, false, DMAR_IIRG_DOMAIN);
+	}
+}
+
 static void dmar_set_root_table(struct dmar_drhd_rt *dmar_unit)
 {
 	uint64_t address;
@@ -615,6 +810,103 @@ static void dmar_set_root_table(struct dmar_drhd_rt *dmar_unit)
 	spinlock_release(&(dmar_unit->lock));
 }
 
+/*
+ * Posted interrupts need interrupt remapping, which in turn can only be
+ * invalidated through the invalidation queue.
+ */
+static bool dmar_unit_support_posted_intr(const struct dmar_drhd_rt *dmar_unit)
+{
+	bool ret = false;
+
+#ifdef CONFIG_VTD_POSTED_INTR_ENABLED
+	ret = ((iommu_ecap_qi(dmar_unit->ecap) != 0U) && (iommu_ecap_ir(dmar_unit->ecap) != 0U) &&
+		(iommu_cap_pi(dmar_unit->cap) != 0U));
+#else
+	(void)dmar_unit;
+#endif
+
+	return ret;
+}
+
+static void dmar_enable_qi(struct dmar_drhd_rt *dmar_unit)
+{
+	uint32_t status = 0U;
+
+	spinlock_obtain(&(dmar_unit->lock));
+	if ((dmar_unit->gcmd & DMA_GCMD_QIE) == 0U) {
+		dmar_unit->qi_tail = 0U;
+		iommu_write64(dmar_unit, DMAR_IQT_REG, 0UL);
+		/* queue size field 0: one page, 256 descriptors */
+		iommu_write64(dmar_unit, DMAR_IQA_REG, hva2hpa(get_qi_queue(dmar_unit->index)));
+
+		dmar_unit->gcmd |= DMA_GCMD_QIE;
+		iommu_write32(dmar_unit, DMAR_GCMD_REG, dmar_unit->gcmd);
+		dmar_wait_completion(dmar_unit, DMAR_GSTS_REG, DMA_GSTS_QIES, false, &status);
+	}
+	spinlock_release(&(dmar_unit->lock));
+}
+
+static void dmar_disable_qi(struct dmar_drhd_rt *dmar_unit)
+{
+	uint32_t status = 0U;
+
+	spinlock_obtain(&(dmar_unit->lock));
+	if ((dmar_unit->gcmd & DMA_GCMD_QIE) != 0U) {
+		dmar_unit->gcmd &= ~DMA_GCMD_QIE;
+		iommu_write32(dmar_unit, DMAR_GCMD_REG, dmar_unit->gcmd);
+		dmar_wait_completion(dmar_unit, DMAR_GSTS_REG, DMA_GSTS_QIES, true, &status);
+	}
+	spinlock_release(&(dmar_unit->lock));
+}
+
+/*
+ * Compatibility format interrupts stay allowed, so the IOAPIC and the
+ * MSIs of the hypervisor and VM0 devices are delivered as before; only
+ * the MSIs programmed in remappable format go through the IRTEs.
+ */
+static void dmar_enable_intr_remapping(struct dmar_drhd_rt *dmar_unit)
+{
+	uint32_t status = 0U;
+
+	spinlock_obtain(&(dmar_unit->lock));
+	iommu_write64(dmar_unit, DMAR_IRTA_REG, hva2hpa(get_ir_table(dmar_unit->index)) | DMAR_IRTA_SIZE);
+	iommu_write32(dmar_unit, DMAR_GCMD_REG, dmar_unit->gcmd | DMA_GCMD_SIRTP);
+	dmar_wait_completion(dmar_unit, DMAR_GSTS_REG, DMA_GSTS_IRTPS, false, &status);
+	spinlock_release(&(dmar_unit->lock));
+
+	/* the table may have been in use before a suspend */
+	dmar_invalid_iec(dmar_unit, INVALID_IRTE_ID);
+
+	spinlock_obtain(&(dmar_unit->lock));
+	dmar_unit->gcmd |= DMA_GCMD_CFI;
+	iommu_write32(dmar_unit, DMAR_GCMD_REG, dmar_unit->gcmd);
+	dmar_wait_completion(dmar_unit, DMAR_GSTS_REG, DMA_GSTS_CFIS, false, &status);
+
+	dmar_unit->gcmd |= DMA_GCMD_IRE;
+	iommu_write32(dmar_unit, DMAR_GCMD_REG, dmar_unit->gcmd);
+	dmar_wait_completion(dmar_unit, DMAR_GSTS_REG, DMA_GSTS_IRES, false, &status);
+	spinlock_release(&(dmar_unit->lock));
+
+	dev_dbg(ACRN_DBG_IOMMU, "%s: gsr:0x%x", __func__, status);
+}
+
+static void dmar_disable_intr_remapping(struct dmar_drhd_rt *dmar_unit)
+{
+	uint32_t status = 0U;
+
+	spinlock_obtain(&(dmar_unit->lock));
+	if ((dmar_unit->gcmd & DMA_GCMD_IRE) != 0U) {
+		dmar_unit->gcmd &= ~DMA_GCMD_IRE;
+		iommu_write32(dmar_unit, DMAR_GCMD_REG, dmar_unit->gcmd);
+		dmar_wait_completion(dmar_unit, DMAR_GSTS_REG, DMA_GSTS_IRES, true, &status);
+
+		dmar_unit->gcmd &= ~DMA_GCMD_CFI;
+		iommu_write32(dmar_unit, DMAR_GCMD_REG, dmar_unit->gcmd);
+		dmar_wait_completion(dmar_unit, DMAR_GSTS_REG, DMA_GSTS_CFIS, true, &status);
+	}
+	spinlock_release(&(dmar_unit->lock));
+}
+
 static void dmar_fault_event_mask(struct dmar_drhd_rt *dmar_unit)
 {
 	spinlock_obtain(&(dmar_unit->lock));
@@ -778,20 +1070,46 @@ static void dmar_prepare(struct dmar_drhd_rt *dmar_unit)
 	dev_dbg(ACRN_DBG_IOMMU, "enable dmar uint [0x%x]", dmar_unit->drhd->reg_base_addr);
 	dmar_setup_interrupt(dmar_unit);
 	dmar_set_root_table(dmar_unit);
+	if (dmar_unit_support_posted_intr(dmar_unit)) {
+		dmar_enable_qi(dmar_unit);
+		dmar_enable_intr_remapping(dmar_unit);
+	}
+}
+
+/*
+ * Invalidate the context cache and then the IOTLB globally, behind a single
+ * wait descriptor when QI is enabled.
+ */
+static void dmar_invalid_all_global(struct dmar_drhd_rt *dmar_unit)
+{
+	struct dmar_qi_desc descs[2];
+
+	if (is_dmar_qi_enabled(dmar_unit)) {
+		descs[0].lower = DMAR_INV_CONTEXT_DESC | ((uint64_t)DMAR_CIRG_GLOBAL << DMAR_INV_GRANULARITY_POS);
+		descs[0].upper = 0UL;
+		descs[1].lower = DMAR_INV_IOTLB_DESC | ((uint64_t)DMAR_IIRG_GLOBAL << DMAR_INV_GRANULARITY_POS) |
+			DMAR_INV_IOTLB_DR | DMAR_INV_IOTLB_DW;
+		descs[1].upper = 0UL;
+		dmar_issue_qi_requests(dmar_unit, descs, 2U);
+	} else {
+		dmar_invalid_context_cache_global(dmar_unit);
+		dmar_invalid_iotlb_global(dmar_unit);
+	}
 }
 
 static void dmar_enable(struct dmar_drhd_rt *dmar_unit)
 {
 	dev_dbg(ACRN_DBG_IOMMU, "enable dmar uint [0x%x]", dmar_unit->drhd->reg_base_addr);
 	dmar_write_buffer_flush(dmar_unit);
-	dmar_invalid_context_cache_global(dmar_unit);
-	dmar_invalid_iotlb_global(dmar_unit);
+	dmar_invalid_all_global(dmar_unit);
 	dmar_enable_translation(dmar_unit);
 }
 
 static void dmar_disable(struct dmar_drhd_rt *dmar_unit)
 {
 	dmar_disable_translation(dmar_unit);
+	dmar_disable_intr_remapping(dmar_unit);
+	dmar_disable_qi(dmar_unit);
 	dmar_fault_event_mask(dmar_unit);
 }
 
@@ -801,8 +1119,7 @@ static void dmar_suspend(struct dmar_drhd_rt *dmar_unit)
 
 	/* flush */
 	dmar_write_buffer_flush(dmar_unit);
-	dmar_invalid_context_cache_global(dmar_unit);
-	dmar_invalid_iotlb_global(dmar_unit);
+	dmar_invalid_all_global(dmar_unit);
 
 	dmar_disable(dmar_unit);
 
@@ -937,7 +1254,12 @@ static int32_t add_iommu_device(struct iommu_domain *domain, uint16_t segment, u
 	return 0;
 }
 
-static int32_t remove_iommu_device(const struct iommu_domain *domain, uint16_t segment, uint8_t bus, uint8_t devfun)
+/*
+ * Clear the context entry of a device, the caller invalidates the caches of
+ * the DMAR unit returned in *unit.
+ */
+static int32_t clear_iommu_device(const struct iommu_domain *domain, uint16_t segment, uint8_t bus, uint8_t devfun,
+	struct dmar_drhd_rt **unit)
 {
 	struct dmar_drhd_rt *dmar_unit;
 	struct dmar_root_entry *root_table;
@@ -973,14 +1295,78 @@ static int32_t remove_iommu_device(const struct iommu_domain *domain, uint16_t s
 	context_entry->upper = 0UL;
 	iommu_flush_cache(dmar_unit, context_entry, sizeof(struct dmar_context_entry));
 
-	/* if caching mode is present, need to invalidate translation cache */
-	/* if(cap_caching_mode(dmar_unit->cap)) { */
-	dmar_invalid_context_cache_global(dmar_unit);
-	dmar_invalid_iotlb_global(dmar_unit);
-	/* } */
+	*unit = dmar_unit;
 	return 0;
 }
 
+static int32_t remove_iommu_device(const struct iommu_domain *domain, uint16_t segment, uint8_t bus, uint8_t devfun)
+{
+	struct dmar_drhd_rt *dmar_unit = NULL;
+	uint16_t dom_id = vmid_to_domainid(domain->vm_id);
+	int32_t ret;
+
+	ret = clear_iommu_device(domain, segment, bus, devfun, &dmar_unit);
+	if (ret != 0) {
+		return ret;
+	}
+
+	/*
+	 * Only the entry of this device and the translations of its domain
+	 * may be cached from it (VT-d spec 6.5.3.3), no need to flush the
+	 * devices of other domains.
+	 */
+	dmar_invalid_context_cache(dmar_unit, dom_id, (uint16_t)(((uint16_t)bus << 8U) | devfun), 0U,
+		DMAR_CIRG_DEVICE);
+	dmar_invalid_iotlb(dmar_unit, dom_id, 0UL, 0U, false, DMAR_IIRG_DOMAIN);
+	return 0;
+}
+
+int32_t assign_iommu_devices(struct iommu_domain *domain, const uint16_t *bdfs, uint32_t count)
+{
+	struct dmar_info *info = get_dmar_info();
+	struct dmar_drhd_rt *dmar_unit = NULL;
+	uint64_t flush_units = 0UL;
+	uint16_t dom_id;
+	uint32_t i, n;
+	int32_t status = 0;
+
+	/* detach the whole batch from VM0 before a single invalidation */
+	for (n = 0U; (n < count) && (vm0_domain != NULL); n++) {
+		status = clear_iommu_device(vm0_domain, 0U, (uint8_t)(bdfs[n] >> 8U), (uint8_t)(bdfs[n] & 0xffU),
+				&dmar_unit);
+		if (status != 0) {
+			break;
+		}
+		bitmap_set_nolock((uint16_t)dmar_unit->index, &flush_units);
+	}
+
+	if (vm0_domain != NULL) {
+		/* a domain-selective invalidation covers all the devices of the batch, VT-d spec 6.5.3.3 */
+		dom_id = vmid_to_domainid(vm0_domain->vm_id);
+		for (i = 0U; i < info->drhd_count; i++) {
+			if (bitmap_test((uint16_t)i, &flush_units)) {
+				dmar_unit = &dmar_drhd_units[i];
+				dmar_invalid_context_cache(dmar_unit, dom_id, 0U, 0U, DMAR_CIRG_DOMAIN);
+				dmar_invalid_iotlb(dmar_unit, dom_id, 0UL, 0U, false, DMAR_IIRG_DOMAIN);
+			}
+		}
+	} else {
+		n = count;
+	}
+
+	/* the devices detached from VM0 are assigned even if a later one failed */
+	for (i = 0U; i < n; i++) {
+		if (add_iommu_device(domain, 0U, (uint8_t)(bdfs[i] >> 8U), (uint8_t)(bdfs[i] & 0xffU)) != 0) {
+			pr_err("%s: failed to assign %x", __func__, bdfs[i]);
+			if (status == 0) {
+				status = -EINVAL;
+			}
+		}
+	}
+
+	return status;
+}
+
 /*
  * @pre action != NULL
  * As an internal API, VT-d code can guarantee action is not NULL.
@@ -1023,6 +1409,8 @@ struct iommu_domain *create_iommu_domain(uint16_t vm_id, uint64_t translation_ta
 		domain->trans_table_ptr = translation_table;
 		domain->addr_width = addr_width;
 		domain->is_tt_ept = true;
+		/* cleared by the first DMAR unit without snoop control */
+		domain->iommu_snoop = true;
 
 		dev_dbg(ACRN_DBG_IOMMU, "create domain [%d]: vm_id = %hu, ept@0x%x",
 			vmid_to_domainid(domain->vm_id), domain->vm_id, domain->trans_table_ptr);
@@ -1031,6 +1419,26 @@ struct iommu_domain *create_iommu_domain(uint16_t vm_id, uint64_t translation_ta
 	return domain;
 }
 
+/*
+ * The EPT is a valid second-level page table as it is: the R/W bits, the
+ * 2M/1G page bit and the SNP bit, set in the leaves of cacheable mappings,
+ * are at the same place. register_hrhd_units() only takes DMAR units which
+ * support both superpage sizes, so the large pages of the EPT are kept
+ * rather than broken up for DMA.
+ */
+struct iommu_domain *create_ept_iommu_domain(struct acrn_vm *vm)
+{
+	struct iommu_domain *domain = NULL;
+
+	if (vm->arch_vm.nworld_eptp == NULL) {
+		pr_err("%s, EPT of vm%hu not set", __func__, vm->vm_id);
+	} else {
+		domain = create_iommu_domain(vm->vm_id, hva2hpa(vm->arch_vm.nworld_eptp), DMAR_EPT_ADDR_WIDTH);
+	}
+
+	return domain;
+}
+
 /**
  * @pre domain != NULL
  */
@@ -1045,6 +1453,23 @@ void destroy_iommu_domain(struct iommu_domain *domain)
 	(void)memset(domain, 0U, sizeof(*domain));
 }
 
+void iommu_flush_domain_range(const struct iommu_domain *domain, uint64_t gpa, uint64_t size)
+{
+	struct dmar_info *info = get_dmar_info();
+	struct dmar_drhd_rt *dmar_unit;
+	uint32_t i;
+
+	/* pass-through domains don't translate, nothing is cached */
+	if (!domain->is_host) {
+		for (i = 0U; i < info->drhd_count; i++) {
+			dmar_unit = &dmar_drhd_units[i];
+			if (!dmar_unit->drhd->ignore) {
+				dmar_invalid_iotlb_range(dmar_unit, vmid_to_domainid(domain->vm_id), gpa, size);
+			}
+		}
+	}
+}
+
 int32_t assign_iommu_device(struct iommu_domain *domain, uint8_t bus, uint8_t devfun)
 {
 	int32_t status = 0;
@@ -1121,7 +1546,7 @@ void init_iommu_vm0_domain(struct acrn_vm *vm0)
 	uint16_t bus;
 	uint16_t devfun;
 
-	vm0->iommu = create_iommu_domain(vm0->vm_id, hva2hpa(vm0->arch_vm.nworld_eptp), 48U);
+	vm0->iommu = create_ept_iommu_domain(vm0);
 
 	vm0_domain = (struct iommu_domain *) vm0->iommu;
 
@@ -1134,3 +1559,93 @@ void init_iommu_vm0_domain(struct acrn_vm *vm0)
 		}
 	}
 }
+
+static uint16_t alloc_irte(struct dmar_drhd_rt *dmar_unit)
+{
+	uint16_t index = (uint16_t)ffz64_ex(dmar_unit->irte_bitmap, DMAR_IRTE_NUM);
+
+	while (index < DMAR_IRTE_NUM) {
+		if (!bitmap_test_and_set_lock(index & 0x3FU, &dmar_unit->irte_bitmap[index >> 6U])) {
+			break;
+		}
+		index = (uint16_t)ffz64_ex(dmar_unit->irte_bitmap, DMAR_IRTE_NUM);
+	}
+
+	return (index < DMAR_IRTE_NUM) ? index : INVALID_IRTE_ID;
+}
+
+static struct dmar_drhd_rt *device_to_ir_dmaru(uint8_t bus, uint8_t devfun)
+{
+	struct dmar_drhd_rt *dmar_unit = device_to_dmaru(0U, bus, devfun);
+
+	if ((dmar_unit != NULL) && ((dmar_unit->gcmd & DMA_GCMD_IRE) == 0U)) {
+		dmar_unit = NULL;
+	}
+
+	return dmar_unit;
+}
+
+bool iommu_posted_intr_supported(uint8_t bus, uint8_t devfun)
+{
+	return (device_to_ir_dmaru(bus, devfun) != NULL);
+}
+
+int32_t iommu_set_posted_irte(uint8_t bus, uint8_t devfun, uint16_t *index, uint32_t vector, uint64_t pid_paddr)
+{
+	struct dmar_drhd_rt *dmar_unit = device_to_ir_dmaru(bus, devfun);
+	struct dmar_irte *irte;
+	struct dmar_irte new_irte;
+	int32_t ret = 0;
+
+	if (dmar_unit == NULL) {
+		ret = -ENODEV;
+	} else {
+		if (*index == INVALID_IRTE_ID) {
+			*index = alloc_irte(dmar_unit);
+		}
+
+		if (*index == INVALID_IRTE_ID) {
+			pr_err("dmar[%d] runs out of IRTEs", dmar_unit->index);
+			ret = -EBUSY;
+		} else {
+			new_irte.lower = IRTE_LOWER_P | IRTE_LOWER_PST | ((uint64_t)vector << IRTE_LOWER_VECTOR_POS) |
+				((pid_paddr & IRTE_LOWER_PDA_MASK) << IRTE_LOWER_PDA_POS);
+			/* only requests with the device's own source id may use the entry */
+			new_irte.upper = (((uint64_t)bus << 8U) | devfun) | IRTE_UPPER_SVT_SID |
+				(pid_paddr & IRTE_UPPER_PDA_MASK);
+
+			/*
+			 * Hardware reads an IRTE in one go but the CPU writes it in two
+			 * halves. Keep the entry not present while both halves change;
+			 * retargeting among vCPUs of one VM only changes the lower half.
+			 */
+			irte = &get_ir_table(dmar_unit->index)[*index];
+			if (irte->upper != new_irte.upper) {
+				irte->lower = 0UL;
+				cpu_write_memory_barrier();
+				irte->upper = new_irte.upper;
+				cpu_write_memory_barrier();
+			}
+			irte->lower = new_irte.lower;
+			iommu_flush_cache(dmar_unit, irte, sizeof(struct dmar_irte));
+			dmar_invalid_iec(dmar_unit, *index);
+		}
+	}
+
+	return ret;
+}
+
+void iommu_free_irte(uint8_t bus, uint8_t devfun, uint16_t index)
+{
+	struct dmar_drhd_rt *dmar_unit = device_to_ir_dmaru(bus, devfun);
+	struct dmar_irte *irte;
+
+	if ((dmar_unit != NULL) && (index < DMAR_IRTE_NUM)) {
+		irte = &get_ir_table(dmar_unit->index)[index];
+		irte->lower = 0UL;
+		irte->upper = 0UL;
+		iommu_flush_cache(dmar_unit, irte, sizeof(struct dmar_irte));
+		dmar_invalid_iec(dmar_unit, index);
+		bitmap_clear_lock(index & 0x3FU, &dmar_unit->irte_bitmap[index >> 6U]);
+	}
+}
@@ -37,6 +37,7 @@ void vcpu_thread(struct acrn_vcpu *vcpu)
 		do_softirq();
 
 		/* Check and process pending requests(including interrupt) */
+		vlapic_ptmr_check(vcpu);
 		ret = acrn_handle_pending_request(vcpu);
 		if (ret < 0) {
 			pr_fatal("vcpu handling pending request fail");
@@ -52,6 +53,7 @@ void vcpu_thread(struct acrn_vcpu *vcpu)
 			 * to do pre work and continue vcpu loop after
 			 * schedule() is return.
 			 */
+			vlapic_ptmr_put(vcpu);
 			schedule();
 			run_vcpu_pre_work(vcpu);
 			continue;
@@ -61,12 +63,16 @@ void vcpu_thread(struct acrn_vcpu *vcpu)
 
 		profiling_vmenter_handler(vcpu);
 
+		vpmu_load(vcpu);
+		vlapic_ptmr_load(vcpu);
+		exit_timeline_entry(vcpu);
 		ret = run_vcpu(vcpu);
 		if (ret != 0) {
 			pr_fatal("vcpu resume failed");
 			pause_vcpu(vcpu, VCPU_ZOMBIE);
 			continue;
 		}
+		exit_timeline_exit(vcpu);
 
 		vcpu->arch.nrexits++;
 
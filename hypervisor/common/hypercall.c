@@ -120,6 +120,12 @@ int32_t hcall_create_vm(struct acrn_vm *vm, uint64_t param)
 
 	(void)memset(&vm_desc, 0U, sizeof(vm_desc));
 	vm_desc.sworld_supported = ((cv.vm_flag & (SECURE_WORLD_ENABLED)) != 0U);
+	vm_desc.high_prio = ((cv.vm_flag & (HIGH_PRIORITY_VM)) != 0U);
+	vm_desc.guest_cr_bits = ((cv.vm_flag & (GUEST_OWNED_CR_BITS)) != 0U);
+	vm_desc.vpmu = ((cv.vm_flag & (VPMU_ENABLED)) != 0U);
+	vm_desc.ple_gap = cv.ple_gap;
+	vm_desc.ple_window = cv.ple_window;
+	vm_desc.tsc_khz = cv.tsc_khz;
 	(void)memcpy_s(&vm_desc.GUID[0], 16U, &cv.GUID[0], 16U);
 	ret = create_vm(&vm_desc, &target_vm);
 
@@ -217,6 +223,43 @@ int32_t hcall_pause_vm(uint16_t vmid)
 	return ret;
 }
 
+/**
+ * @brief resume virtual machine
+ *
+ * Resume a virtual machine paused by hcall_pause_vm, e.g. after its state
+ * has been saved for a migration that failed. The vcpus which were
+ * waiting for an I/O request when paused execute the access again.
+ *
+ * @param vmid ID of the VM
+ *
+ * @return 0 on success, -1 if the VM does not exist or is not paused,
+ *         -EBUSY if an I/O request of the VM is not completed yet.
+ */
+int32_t hcall_resume_vm(uint16_t vmid)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_vcpu *vcpu;
+	uint16_t i;
+	int32_t ret = 0;
+
+	if ((target_vm == NULL) || is_vm0(target_vm) || (target_vm->state != VM_PAUSED)) {
+		ret = -1;
+	} else {
+		foreach_vcpu(i, target_vm, vcpu) {
+			if (get_vhm_req_state(target_vm, vcpu->vcpu_id) != REQ_STATE_FREE) {
+				ret = -EBUSY;
+				break;
+			}
+		}
+
+		if (ret == 0) {
+			resume_vm(target_vm);
+		}
+	}
+
+	return ret;
+}
+
 /**
  * @brief create vcpu
  *
@@ -249,6 +292,11 @@ int32_t hcall_create_vcpu(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 	}
 
 	pcpu_id = allocate_pcpu();
+	if ((pcpu_id == INVALID_CPU_ID) && can_share_pcpu(cv.pcpu_id)) {
+		/* the scheduler time slices a used pCPU */
+		pcpu_id = cv.pcpu_id;
+	}
+
 	if (pcpu_id == INVALID_CPU_ID) {
 		pr_err("%s: No physical available\n", __func__);
 		return -1;
@@ -318,143 +366,839 @@ int32_t hcall_set_vcpu_regs(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 		return -1;
 	}
 
-	if (vcpu_regs.vcpu_id >= CONFIG_MAX_VCPUS_PER_VM) {
-		pr_err("%s: invalid vcpu_id for set_vcpu_regs\n", __func__);
-		return -1;
+	if (vcpu_regs.vcpu_id >= CONFIG_MAX_VCPUS_PER_VM) {
+		pr_err("%s: invalid vcpu_id for set_vcpu_regs\n", __func__);
+		return -1;
+	}
+
+	vcpu = vcpu_from_vid(target_vm, vcpu_regs.vcpu_id);
+	set_vcpu_regs(vcpu, &(vcpu_regs.vcpu_regs));
+
+	return 0;
+}
+
+struct vcpu_regs_read {
+	struct acrn_vcpu *vcpu;
+	struct acrn_vcpu_regs *vcpu_regs;
+};
+
+/* the VMCS of a vcpu is only loaded on its own pcpu */
+static void read_vcpu_regs(void *data)
+{
+	struct vcpu_regs_read *req = (struct vcpu_regs_read *)data;
+
+	get_vcpu_regs(req->vcpu, req->vcpu_regs);
+}
+
+/**
+ * @brief get the vcpu regs of a paused VM
+ *
+ * The counterpart of hcall_set_vcpu_regs, a VM paused by the DM does not
+ * run any more, so its state can be saved and later set into another VM.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_set_vcpu_regs
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_vcpu_regs(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_set_vcpu_regs vcpu_regs;
+	struct vcpu_regs_read req;
+	uint64_t mask = 0UL;
+
+	if ((target_vm == NULL) || (param == 0UL) || is_vm0(target_vm)) {
+		return -EINVAL;
+	}
+
+	if (target_vm->state != VM_PAUSED) {
+		return -EBUSY;
+	}
+
+	if (copy_from_gpa(vm, &vcpu_regs, param, sizeof(vcpu_regs)) != 0) {
+		pr_err("%s: Unable copy param from vm\n", __func__);
+		return -EINVAL;
+	}
+
+	if (vcpu_regs.vcpu_id >= target_vm->hw.created_vcpus) {
+		pr_err("%s: invalid vcpu_id %hu\n", __func__, vcpu_regs.vcpu_id);
+		return -EINVAL;
+	}
+
+	req.vcpu = vcpu_from_vid(target_vm, vcpu_regs.vcpu_id);
+	req.vcpu_regs = &(vcpu_regs.vcpu_regs);
+	if (req.vcpu->pcpu_id == get_cpu_id()) {
+		read_vcpu_regs(&req);
+	} else {
+		bitmap_set_nolock(req.vcpu->pcpu_id, &mask);
+		smp_call_function(mask, read_vcpu_regs, &req);
+	}
+
+	if (copy_to_gpa(vm, &vcpu_regs, param, sizeof(vcpu_regs)) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief get the VM exit accounting of a vcpu
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_vmexit_stats
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_vmexit_stats(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_mmio_exit_stats mmio;
+	struct acrn_vcpu *vcpu;
+	uint16_t vcpu_id, nr_mmio, i;
+
+	if ((target_vm == NULL) || (param == 0UL)) {
+		return -EINVAL;
+	}
+
+	if (copy_from_gpa(vm, &vcpu_id, param + offsetof(struct acrn_vmexit_stats, vcpu_id),
+			sizeof(vcpu_id)) != 0) {
+		pr_err("%s: Unable copy param from vm\n", __func__);
+		return -EINVAL;
+	}
+
+	if (vcpu_id >= target_vm->hw.created_vcpus) {
+		pr_err("%s: invalid vcpu_id %hu\n", __func__, vcpu_id);
+		return -EINVAL;
+	}
+	vcpu = vcpu_from_vid(target_vm, vcpu_id);
+
+	/* The struct does not fit on the stack, so it is filled in piece by piece */
+	if (copy_to_gpa(vm, (void *)vcpu->exit_stats.reason, param + offsetof(struct acrn_vmexit_stats, reason),
+			(uint32_t)sizeof(vcpu->exit_stats.reason)) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+		return -EINVAL;
+	}
+
+	nr_mmio = target_vm->emul_mmio_regions;
+	if (nr_mmio > ACRN_VMEXIT_MMIO_REGIONS) {
+		nr_mmio = ACRN_VMEXIT_MMIO_REGIONS;
+	}
+	for (i = 0U; i < nr_mmio; i++) {
+		mmio.start = target_vm->emul_mmio[i].range_start;
+		mmio.end = target_vm->emul_mmio[i].range_end;
+		mmio.count = vcpu->exit_stats.mmio_count[i];
+		mmio.total_cycles = vcpu->exit_stats.mmio_cycles[i];
+		if (copy_to_gpa(vm, &mmio, param + offsetof(struct acrn_vmexit_stats, mmio) +
+				((uint64_t)i * sizeof(mmio)), (uint32_t)sizeof(mmio)) != 0) {
+			pr_err("%s: Unable copy param to vm\n", __func__);
+			return -EINVAL;
+		}
+	}
+
+	if (copy_to_gpa(vm, &nr_mmio, param + offsetof(struct acrn_vmexit_stats, nr_mmio),
+			sizeof(nr_mmio)) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief get the last VM exits of a vcpu
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_exit_timeline
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_exit_timeline(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	const volatile uint64_t *nr_exits;
+	struct acrn_vcpu *vcpu;
+	uint64_t range[2], next, last;
+	uint16_t vcpu_id;
+
+	if ((target_vm == NULL) || (param == 0UL)) {
+		return -EINVAL;
+	}
+
+	if (copy_from_gpa(vm, &vcpu_id, param + offsetof(struct acrn_exit_timeline, vcpu_id),
+			sizeof(vcpu_id)) != 0) {
+		pr_err("%s: Unable copy param from vm\n", __func__);
+		return -EINVAL;
+	}
+
+	if (vcpu_id >= target_vm->hw.created_vcpus) {
+		pr_err("%s: invalid vcpu_id %hu\n", __func__, vcpu_id);
+		return -EINVAL;
+	}
+	vcpu = vcpu_from_vid(target_vm, vcpu_id);
+	nr_exits = &vcpu->exit_timeline.nr_exits;
+
+	/*
+	 * The vcpu keeps recording on its pcpu: the records published before
+	 * the copy are valid, unless written over while copied. The writer
+	 * may already fill the slot of exit 'last'.
+	 */
+	next = *nr_exits;
+	cpu_memory_barrier();
+	if (copy_to_gpa(vm, (void *)vcpu->exit_timeline.records, param + offsetof(struct acrn_exit_timeline, records),
+			(uint32_t)sizeof(vcpu->exit_timeline.records)) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+		return -EINVAL;
+	}
+	cpu_memory_barrier();
+	last = *nr_exits;
+
+	range[0] = ((last + 1UL) > ACRN_EXIT_TIMELINE_RECORDS) ? (last + 1UL - ACRN_EXIT_TIMELINE_RECORDS) : 0UL;
+	if (range[0] > next) {
+		range[0] = next;
+	}
+	range[1] = next;
+	if (copy_to_gpa(vm, range, param + offsetof(struct acrn_exit_timeline, first), sizeof(range)) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief set or clear IRQ line
+ *
+ * Set or clear a virtual IRQ line for a VM, which could be from ISA
+ * or IOAPIC, normally it triggers an edge IRQ.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param ops request command for IRQ set or clear
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_irqline(const struct acrn_vm *vm, uint16_t vmid,
+				const struct acrn_irqline_ops *ops)
+{
+	uint32_t irq_pic;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+
+	if (target_vm == NULL) {
+		return -EINVAL;
+	}
+
+	if (ops->gsi >= vioapic_pincount(vm)) {
+		return -EINVAL;
+	}
+
+	if (ops->gsi < vpic_pincount()) {
+		/*
+		 * IRQ line for 8254 timer is connected to
+		 * I/O APIC pin #2 but PIC pin #0,route GSI
+		 * number #2 to PIC IRQ #0.
+		 */
+		irq_pic = (ops->gsi == 2U) ? 0U : ops->gsi;
+		vpic_set_irq(target_vm, irq_pic, ops->op);
+	}
+
+	/* handle IOAPIC irqline */
+	vioapic_set_irq(target_vm, ops->gsi, ops->op);
+
+	return 0;
+}
+
+/**
+ * @brief inject MSI interrupt
+ *
+ * Inject a MSI interrupt for a VM.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to struct acrn_msi_entry
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_inject_msi(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	int32_t ret;
+	struct acrn_msi_entry msi;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+
+	if (target_vm == NULL) {
+		return -1;
+	}
+
+	(void)memset((void *)&msi, 0U, sizeof(msi));
+	if (copy_from_gpa(vm, &msi, param, sizeof(msi)) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+		return -1;
+	}
+	ret = vlapic_intr_msi(target_vm, msi.msi_addr, msi.msi_data);
+
+	return ret;
+}
+
+/**
+ * @brief inject a batch of MSI interrupts
+ *
+ * Inject the MSIs of a struct acrn_msi_batch for a VM, in order. An MSI
+ * identical to an earlier one of the batch targets the same vector of the
+ * same vCPUs, which is still pending from that one, and is skipped.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to struct acrn_msi_batch
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero if any MSI of the batch fails.
+ */
+int32_t hcall_inject_msi_batch(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	int32_t ret = 0;
+	struct acrn_msi_batch batch;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	uint32_t i, j, size;
+
+	if (target_vm == NULL) {
+		return -1;
+	}
+
+	(void)memset((void *)&batch, 0U, sizeof(batch));
+	if (copy_from_gpa(vm, &batch, param, sizeof(batch.nr_entries)) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+		return -1;
+	}
+
+	if ((batch.nr_entries == 0U) || (batch.nr_entries > MSI_BATCH_ENTRIES_MAX)) {
+		pr_err("%s: invalid number of MSIs %u", __func__, batch.nr_entries);
+		return -EINVAL;
+	}
+
+	/* only copy the valid entries */
+	size = (uint32_t)offsetof(struct acrn_msi_batch, entries) +
+		(batch.nr_entries * (uint32_t)sizeof(struct acrn_msi_entry));
+	if (copy_from_gpa(vm, &batch, param, size) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+		return -1;
+	}
+
+	for (i = 0U; i < batch.nr_entries; i++) {
+		for (j = 0U; j < i; j++) {
+			if ((batch.entries[j].msi_addr == batch.entries[i].msi_addr) &&
+				(batch.entries[j].msi_data == batch.entries[i].msi_data)) {
+				break;
+			}
+		}
+
+		/* coalesce duplicates */
+		if (j == i) {
+			if (vlapic_intr_msi(target_vm, batch.entries[i].msi_addr,
+					batch.entries[i].msi_data) != 0) {
+				ret = -1;
+			}
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief set ioreq shared buffer
+ *
+ * Set the ioreq share buffer for a VM.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_set_ioreq_buffer
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_ioreq_buffer(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	uint64_t hpa, gpa;
+	struct acrn_set_ioreq_buffer iobuf;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	uint16_t i, pages;
+
+	if (target_vm == NULL) {
+		return -1;
+	}
+
+	(void)memset((void *)&iobuf, 0U, sizeof(iobuf));
+
+	if (copy_from_gpa(vm, &iobuf, param, sizeof(iobuf)) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+		return -1;
+	}
+
+	dev_dbg(ACRN_DBG_HYCALL, "[%d] SET BUFFER=0x%p",
+			vmid, iobuf.req_buf);
+
+	target_vm->sw.io_shared_page = NULL;
+	target_vm->sw.io_req_slots = 0U;
+
+	switch (iobuf.req_buf & IOREQ_BUF_VERSION_MASK) {
+	case IOREQ_BUF_V0:
+		pages = 1U;
+		break;
+	case IOREQ_BUF_V1:
+		pages = VHM_REQUEST_PAGES_MAX;
+		break;
+	default:
+		pr_err("%s: unknown ioreq buffer layout 0x%llx", __func__, iobuf.req_buf);
+		return -EINVAL;
+	}
+
+	/* every vcpu needs its own request */
+	if ((pages * VHM_REQUEST_MAX) < CONFIG_MAX_VCPUS_PER_VM) {
+		pr_err("%s: ioreq buffer too small for %u vcpus", __func__, CONFIG_MAX_VCPUS_PER_VM);
+		return -EINVAL;
+	}
+
+	/* the pages are contiguous in guest only, translate them one by one */
+	gpa = iobuf.req_buf & ~IOREQ_BUF_VERSION_MASK;
+	for (i = 0U; i < pages; i++) {
+		hpa = gpa2hpa(vm, gpa + ((uint64_t)i * PAGE_SIZE));
+		if (hpa == INVALID_HPA) {
+			pr_err("%s,vm[%hu] gpa 0x%llx,GPA is unmapping.",
+				__func__, vm->vm_id, gpa + ((uint64_t)i * PAGE_SIZE));
+			return -EINVAL;
+		}
+		target_vm->sw.io_req_pages[i] = hpa2hva(hpa);
+	}
+
+	target_vm->sw.io_req_slots = (uint16_t)(pages * VHM_REQUEST_MAX);
+	target_vm->sw.io_shared_page = target_vm->sw.io_req_pages[0];
+	for (i = 0U; i < target_vm->sw.io_req_slots; i++) {
+		set_vhm_req_state(target_vm, i, REQ_STATE_FREE);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief set the ring buffer of posted MMIO writes
+ *
+ * Set the ring page (struct vhm_posted_ring) that MMIO writes to posted
+ * ranges of a VM are appended to.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_set_ioreq_buffer
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_posted_ioreq_buffer(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	uint64_t hpa;
+	struct acrn_set_ioreq_buffer iobuf;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct vhm_posted_ring *ring;
+	int32_t ret = 0;
+
+	if (target_vm == NULL) {
+		return -1;
+	}
+
+	(void)memset((void *)&iobuf, 0U, sizeof(iobuf));
+
+	if (copy_from_gpa(vm, &iobuf, param, sizeof(iobuf)) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+		return -1;
+	}
+
+	dev_dbg(ACRN_DBG_HYCALL, "[%d] SET POSTED BUFFER=0x%p",
+			vmid, iobuf.req_buf);
+
+	hpa = gpa2hpa(vm, iobuf.req_buf);
+
+	spinlock_obtain(&target_vm->posted_ioreq_lock);
+	if ((hpa == INVALID_HPA) || ((hpa & PAGE_MASK) != hpa)) {
+		pr_err("%s,vm[%hu] gpa 0x%llx,GPA is unmapping or unaligned.",
+			__func__, vm->vm_id, iobuf.req_buf);
+		target_vm->sw.posted_ioreq_page = NULL;
+		ret = -EINVAL;
+	} else {
+		ring = (struct vhm_posted_ring *)hpa2hva(hpa);
+		stac();
+		ring->head = 0U;
+		ring->tail = 0U;
+		ring->overflow = 0U;
+		clac();
+		target_vm->sw.posted_ioreq_page = (void *)ring;
+	}
+	spinlock_release(&target_vm->posted_ioreq_lock);
+
+	return ret;
+}
+
+/**
+ * @brief post (or stop posting) MMIO or port I/O writes to a range
+ *
+ * Writes of a VM to a posted range are appended to the ring set by
+ * hcall_set_posted_ioreq_buffer and the vCPU is not paused for them.
+ * POSTED_RANGE_FLAG_PIO makes the range one of I/O ports.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_posted_mmio_range
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_posted_mmio_range(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_posted_mmio_range range;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	uint16_t i, n;
+	int32_t ret = -EINVAL;
+
+	if (target_vm == NULL) {
+		return -1;
+	}
+
+	(void)memset((void *)&range, 0U, sizeof(range));
+
+	if (copy_from_gpa(vm, &range, param, sizeof(range)) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+		return -1;
+	}
+
+	if ((range.start >= range.end) || ((range.flags & ~POSTED_RANGE_FLAG_PIO) != 0U)) {
+		return -EINVAL;
+	}
+
+	spinlock_obtain(&target_vm->posted_ioreq_lock);
+	n = target_vm->posted_mmio_regions;
+	for (i = 0U; i < n; i++) {
+		/* ports and addresses are distinct spaces */
+		if ((target_vm->posted_mmio[i].flags == range.flags) &&
+				(range.start < target_vm->posted_mmio[i].end) &&
+				(target_vm->posted_mmio[i].start < range.end)) {
+			break;
+		}
+	}
+
+	if (range.op == POSTED_MMIO_ASSIGN) {
+		if ((i == n) && (n < MAX_POSTED_MMIO_REGIONS)) {
+			target_vm->posted_mmio[n].start = range.start;
+			target_vm->posted_mmio[n].end = range.end;
+			target_vm->posted_mmio[n].flags = range.flags;
+			target_vm->posted_mmio_regions = n + 1U;
+			ret = 0;
+		}
+	} else if (range.op == POSTED_MMIO_DEASSIGN) {
+		if ((i < n) && (target_vm->posted_mmio[i].start == range.start) &&
+				(target_vm->posted_mmio[i].end == range.end)) {
+			target_vm->posted_mmio[i] = target_vm->posted_mmio[n - 1U];
+			target_vm->posted_mmio_regions = n - 1U;
+			ret = 0;
+		}
+	} else {
+		/* unknown op */
+	}
+	spinlock_release(&target_vm->posted_ioreq_lock);
+
+	dev_dbg(ACRN_DBG_HYCALL, "[%d] posted %s op %u [0x%llx, 0x%llx): %d",
+			vmid, ((range.flags & POSTED_RANGE_FLAG_PIO) != 0U) ? "pio" : "mmio",
+			range.op, range.start, range.end, ret);
+
+	return ret;
+}
+
+/**
+ * @brief steer the VHM upcalls of a VM
+ *
+ * Set which SOS vCPUs are signaled of the I/O requests of a VM.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_upcall_policy
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_upcall_policy(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_upcall_policy policy;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct vhm_upcall_info *upcall;
+	uint16_t i, nr = 0U;
+
+	if (target_vm == NULL) {
+		return -1;
+	}
+
+	(void)memset((void *)&policy, 0U, sizeof(policy));
+
+	if (copy_from_gpa(vm, &policy, param, sizeof(policy)) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+		return -1;
+	}
+
+	if ((policy.policy > UPCALL_POLICY_SOURCE) ||
+			((policy.vcpu_mask >> vm->hw.created_vcpus) != 0UL)) {
+		pr_err("%s: invalid policy %u, vcpu mask 0x%llx", __func__,
+			policy.policy, policy.vcpu_mask);
+		return -EINVAL;
+	}
+
+	upcall = &target_vm->upcall;
+
+	/* stop steering while the targets are updated */
+	upcall->nr_targets = 0U;
+	cpu_memory_barrier();
+
+	for (i = 0U; i < vm->hw.created_vcpus; i++) {
+		if ((policy.vcpu_mask & (1UL << i)) != 0UL) {
+			upcall->targets[nr] = i;
+			nr++;
+		}
+	}
+	upcall->policy = policy.policy;
+	upcall->rr_next = 0U;
+	cpu_memory_barrier();
+	upcall->nr_targets = nr;
+
+	dev_dbg(ACRN_DBG_HYCALL, "[%d] upcall policy %u, vcpu mask 0x%llx",
+			vmid, policy.policy, policy.vcpu_mask);
+
+	return 0;
+}
+
+/**
+ * @brief set the pending bitmap page of the ioeventfds
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the page, or 0 to stop
+ *              signaling ioeventfds
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_ioeventfd_page(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	uint64_t hpa = 0UL;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct vhm_ioeventfd_page *page;
+	int32_t ret = 0;
+
+	if (target_vm == NULL) {
+		return -1;
+	}
+
+	dev_dbg(ACRN_DBG_HYCALL, "[%d] SET IOEVENTFD PAGE=0x%llx", vmid, param);
+
+	if (param != 0UL) {
+		hpa = gpa2hpa(vm, param);
+	}
+
+	spinlock_obtain(&target_vm->ioeventfd_lock);
+	if (param == 0UL) {
+		target_vm->sw.ioeventfd_page = NULL;
+	} else if ((hpa == INVALID_HPA) || ((hpa & PAGE_MASK) != hpa)) {
+		pr_err("%s,vm[%hu] gpa 0x%llx,GPA is unmapping or unaligned.",
+			__func__, vm->vm_id, param);
+		target_vm->sw.ioeventfd_page = NULL;
+		ret = -EINVAL;
+	} else {
+		page = (struct vhm_ioeventfd_page *)hpa2hva(hpa);
+		stac();
+		page->pending = 0UL;
+		clac();
+		target_vm->sw.ioeventfd_page = (void *)page;
 	}
+	spinlock_release(&target_vm->ioeventfd_lock);
 
-	vcpu = vcpu_from_vid(target_vm, vcpu_regs.vcpu_id);
-	set_vcpu_regs(vcpu, &(vcpu_regs.vcpu_regs));
-
-	return 0;
+	return ret;
 }
 
 /**
- * @brief set or clear IRQ line
- *
- * Set or clear a virtual IRQ line for a VM, which could be from ISA
- * or IOAPIC, normally it triggers an edge IRQ.
- * The function will return -1 if the target VM does not exist.
+ * @brief set the page of the RTC and PIT state shared by SOS
  *
  * @param vm Pointer to VM data structure
  * @param vmid ID of the VM
- * @param ops request command for IRQ set or clear
+ * @param param guest physical address of the page, or 0 to deliver all
+ *              RTC and PIT reads to SOS again
  *
  * @pre Pointer vm shall point to VM0
  * @return 0 on success, non-zero on error.
  */
-int32_t hcall_set_irqline(const struct acrn_vm *vm, uint16_t vmid,
-				const struct acrn_irqline_ops *ops)
+int32_t hcall_set_clock_page(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 {
-	uint32_t irq_pic;
+	uint64_t hpa = 0UL;
 	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct vhm_clock_page *page;
+	int32_t ret = 0;
 
 	if (target_vm == NULL) {
-		return -EINVAL;
+		return -1;
 	}
 
-	if (ops->gsi >= vioapic_pincount(vm)) {
-		return -EINVAL;
-	}
+	dev_dbg(ACRN_DBG_HYCALL, "[%d] SET CLOCK PAGE=0x%llx", vmid, param);
 
-	if (ops->gsi < vpic_pincount()) {
-		/*
-		 * IRQ line for 8254 timer is connected to
-		 * I/O APIC pin #2 but PIC pin #0,route GSI
-		 * number #2 to PIC IRQ #0.
-		 */
-		irq_pic = (ops->gsi == 2U) ? 0U : ops->gsi;
-		vpic_set_irq(target_vm, irq_pic, ops->op);
+	if (param != 0UL) {
+		hpa = gpa2hpa(vm, param);
 	}
 
-	/* handle IOAPIC irqline */
-	vioapic_set_irq(target_vm, ops->gsi, ops->op);
+	if (param == 0UL) {
+		target_vm->sw.clock_page = NULL;
+	} else if ((hpa == INVALID_HPA) || ((hpa & PAGE_MASK) != hpa)) {
+		pr_err("%s,vm[%hu] gpa 0x%llx,GPA is unmapping or unaligned.",
+			__func__, vm->vm_id, param);
+		target_vm->sw.clock_page = NULL;
+		ret = -EINVAL;
+	} else {
+		page = (struct vhm_clock_page *)hpa2hva(hpa);
+		stac();
+		page->tsc_khz = tsc_khz;
+		clac();
+		target_vm->sw.clock_page = (void *)page;
+	}
 
-	return 0;
+	return ret;
 }
 
 /**
- * @brief inject MSI interrupt
- *
- * Inject a MSI interrupt for a VM.
- * The function will return -1 if the target VM does not exist.
+ * @brief set the statistics page of a VM
  *
  * @param vm Pointer to VM data structure
  * @param vmid ID of the VM
- * @param param guest physical address. This gpa points to struct acrn_msi_entry
+ * @param param guest physical address of the page, or 0 to stop updating it
  *
  * @pre Pointer vm shall point to VM0
  * @return 0 on success, non-zero on error.
  */
-int32_t hcall_inject_msi(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+int32_t hcall_set_telemetry_page(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 {
-	int32_t ret;
-	struct acrn_msi_entry msi;
+	uint64_t hpa = 0UL;
 	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_vm_telemetry *page;
+	int32_t ret = 0;
 
 	if (target_vm == NULL) {
 		return -1;
 	}
 
-	(void)memset((void *)&msi, 0U, sizeof(msi));
-	if (copy_from_gpa(vm, &msi, param, sizeof(msi)) != 0) {
-		pr_err("%s: Unable copy param to vm\n", __func__);
-		return -1;
+	dev_dbg(ACRN_DBG_HYCALL, "[%d] SET TELEMETRY PAGE=0x%llx", vmid, param);
+
+	if (param != 0UL) {
+		hpa = gpa2hpa(vm, param);
+	}
+
+	/* the slots of the passthrough IRQs are taken again in the new page */
+	target_vm->sw.telemetry_page = NULL;
+	cpu_memory_barrier();
+	ptirq_reset_telemetry(target_vm);
+	target_vm->sw.telemetry_ptirqs = 0;
+
+	if (param == 0UL) {
+		/* nothing more */
+	} else if ((hpa == INVALID_HPA) || ((hpa & PAGE_MASK) != hpa)) {
+		pr_err("%s,vm[%hu] gpa 0x%llx,GPA is unmapping or unaligned.",
+			__func__, vm->vm_id, param);
+		ret = -EINVAL;
+	} else {
+		page = (struct acrn_vm_telemetry *)hpa2hva(hpa);
+		stac();
+		page->tsc_khz = tsc_khz;
+		page->nr_vcpus = (target_vm->hw.created_vcpus < ACRN_TELEMETRY_VCPUS) ?
+			target_vm->hw.created_vcpus : (uint16_t)ACRN_TELEMETRY_VCPUS;
+		clac();
+		cpu_memory_barrier();
+		target_vm->sw.telemetry_page = (void *)page;
 	}
-	ret = vlapic_intr_msi(target_vm, msi.msi_addr, msi.msi_data);
 
 	return ret;
 }
 
 /**
- * @brief set ioreq shared buffer
- *
- * Set the ioreq share buffer for a VM.
- * The function will return -1 if the target VM does not exist.
+ * @brief assign (or deassign) an in-hypervisor ioeventfd
  *
  * @param vm Pointer to VM data structure
  * @param vmid ID of the VM
  * @param param guest physical address. This gpa points to
- *              struct acrn_set_ioreq_buffer
+ *              struct acrn_hv_ioeventfd
  *
  * @pre Pointer vm shall point to VM0
  * @return 0 on success, non-zero on error.
  */
-int32_t hcall_set_ioreq_buffer(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+int32_t hcall_assign_ioeventfd(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 {
-	uint64_t hpa;
-	struct acrn_set_ioreq_buffer iobuf;
+	struct acrn_hv_ioeventfd args;
 	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
-	uint16_t i;
+	struct hv_ioeventfd *fd;
+	uint16_t idx;
+	int32_t ret = -EINVAL;
 
 	if (target_vm == NULL) {
 		return -1;
 	}
 
-	(void)memset((void *)&iobuf, 0U, sizeof(iobuf));
+	(void)memset((void *)&args, 0U, sizeof(args));
 
-	if (copy_from_gpa(vm, &iobuf, param, sizeof(iobuf)) != 0) {
+	if (copy_from_gpa(vm, &args, param, sizeof(args)) != 0) {
 		pr_err("%s: Unable copy param to vm\n", __func__);
 		return -1;
 	}
 
-	dev_dbg(ACRN_DBG_HYCALL, "[%d] SET BUFFER=0x%p",
-			vmid, iobuf.req_buf);
-
-	hpa = gpa2hpa(vm, iobuf.req_buf);
-	if (hpa == INVALID_HPA) {
-		pr_err("%s,vm[%hu] gpa 0x%llx,GPA is unmapping.",
-			__func__, vm->vm_id, iobuf.req_buf);
-		target_vm->sw.io_shared_page = NULL;
+	if (args.index >= VHM_IOEVENTFD_MAX) {
 		return -EINVAL;
 	}
+	idx = (uint16_t)args.index;
 
-	target_vm->sw.io_shared_page = hpa2hva(hpa);
-	for (i = 0U; i < VHM_REQUEST_MAX; i++) {
-		set_vhm_req_state(target_vm, i, REQ_STATE_FREE);
+	spinlock_obtain(&target_vm->ioeventfd_lock);
+	if ((args.flags & HV_IOEVENTFD_FLAG_DEASSIGN) != 0U) {
+		if (bitmap_test(idx, &target_vm->ioeventfd_active)) {
+			bitmap_clear_nolock(idx, &target_vm->ioeventfd_active);
+			ret = 0;
+		}
+	} else if (!bitmap_test(idx, &target_vm->ioeventfd_active) &&
+			((args.len == 1U) || (args.len == 2U) ||
+			 (args.len == 4U) || (args.len == 8U))) {
+		fd = &target_vm->ioeventfd[idx];
+		fd->addr = args.addr;
+		fd->data = args.data;
+		fd->len = args.len;
+		fd->flags = args.flags;
+		bitmap_set_nolock(idx, &target_vm->ioeventfd_active);
+		ret = 0;
+	} else {
+		/* busy index or bad width */
 	}
+	spinlock_release(&target_vm->ioeventfd_lock);
 
-	return 0;
+	dev_dbg(ACRN_DBG_HYCALL, "[%d] ioeventfd %u flags 0x%x 0x%llx/%u: %d",
+			vmid, args.index, args.flags, args.addr, args.len, ret);
+
+	return ret;
 }
 
 /**
@@ -494,6 +1238,35 @@ int32_t hcall_notify_ioreq_finish(uint16_t vmid, uint16_t vcpu_id)
 	return 0;
 }
 
+int32_t hcall_notify_ioreq_finish_batch(uint16_t vmid, uint64_t vcpu_mask)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	uint64_t mask = vcpu_mask;
+	uint16_t vcpu_id;
+
+	if ((target_vm == NULL) || (target_vm->sw.io_shared_page == NULL)) {
+		pr_err("%s, invalid parameter\n", __func__);
+		return -EINVAL;
+	}
+
+	if ((mask == 0UL) || ((mask >> target_vm->hw.created_vcpus) != 0UL)) {
+		pr_err("%s, invalid vcpu bitmap 0x%llx for VM %d\n",
+			__func__, mask, target_vm->vm_id);
+		return -EINVAL;
+	}
+
+	dev_dbg(ACRN_DBG_HYCALL, "[%d] NOTIFY_FINISH for vcpus 0x%llx",
+			vmid, mask);
+
+	while (mask != 0UL) {
+		vcpu_id = ffs64(mask);
+		bitmap_clear_nolock(vcpu_id, &mask);
+		emulate_io_post(vcpu_from_vid(target_vm, vcpu_id));
+	}
+
+	return 0;
+}
+
 /**
  *@pre Pointer vm shall point to VM0
  */
@@ -503,6 +1276,7 @@ static int32_t set_vm_memory_region(struct acrn_vm *vm,
 	uint64_t hpa, base_paddr, gpa_end;
 	uint64_t prot;
 	uint64_t *pml4_page;
+	int32_t ret;
 
 	if ((region->size & (PAGE_SIZE - 1UL)) != 0UL) {
 		pr_err("%s: [vm%d] map size 0x%x is not page aligned",
@@ -563,14 +1337,14 @@ static int32_t set_vm_memory_region(struct acrn_vm *vm,
 			prot |= EPT_UNCACHED;
 		}
 		/* create gpa to hpa EPT mapping */
-		ept_mr_add(target_vm, pml4_page, hpa,
+		ret = ept_mr_add(target_vm, pml4_page, hpa,
 				region->gpa, region->size, prot);
 	} else {
-		ept_mr_del(target_vm, pml4_page,
+		ret = ept_mr_del(target_vm, pml4_page,
 				region->gpa, region->size);
 	}
 
-	return 0;
+	return ret;
 }
 
 /**
@@ -589,6 +1363,7 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vm *vm, uint64_t param)
 	struct vm_memory_region mr;
 	struct acrn_vm *target_vm;
 	uint32_t idx;
+	int32_t ret = 0;
 
 
 	(void)memset((void *)&regions, 0U, sizeof(regions));
@@ -608,22 +1383,21 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vm *vm, uint64_t param)
 		return -EFAULT;
 	}
 
+	/* one EPT flush for all the regions */
+	ept_update_begin(target_vm);
 	idx = 0U;
-	while (idx < regions.mr_num) {
-		int32_t ret;
-
+	while ((ret == 0) && (idx < regions.mr_num)) {
 		if (copy_from_gpa(vm, &mr, regions.regions_gpa + idx * sizeof(mr), sizeof(mr)) != 0) {
 			pr_err("%s: Copy mr entry fail from vm\n", __func__);
-			return -EFAULT;
-		}
-
-		ret = set_vm_memory_region(vm, target_vm, &mr);
-		if (ret < 0) {
-			return ret;
+			ret = -EFAULT;
+		} else {
+			ret = set_vm_memory_region(vm, target_vm, &mr);
+			idx++;
 		}
-		idx++;
 	}
-	return 0;
+	ept_update_commit(target_vm);
+
+	return ret;
 }
 
 /**
@@ -655,10 +1429,8 @@ static int32_t write_protect_page(struct acrn_vm *vm,const struct wp_data *wp)
 	prot_set = (wp->set != 0U) ? 0UL : EPT_WR;
 	prot_clr = (wp->set != 0U) ? EPT_WR : 0UL;
 
-	ept_mr_modify(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
+	return ept_mr_modify(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
 		wp->gpa, PAGE_SIZE, prot_set, prot_clr);
-
-	return 0;
 }
 
 /**
@@ -696,6 +1468,120 @@ int32_t hcall_write_protect_page(struct acrn_vm *vm, uint16_t vmid, uint64_t wp_
 	return write_protect_page(target_vm, &wp);
 }
 
+/**
+ * @brief log the dirty pages of a VM
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_dirty_log
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_dirty_log(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_dirty_log log;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	uint64_t hpa;
+	int32_t ret;
+
+	if ((target_vm == NULL) || is_vm0(target_vm)) {
+		return -EINVAL;
+	}
+
+	(void)memset((void *)&log, 0U, sizeof(log));
+	if (copy_from_gpa(vm, &log, param, sizeof(log)) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+		return -EFAULT;
+	}
+
+	dev_dbg(ACRN_DBG_HYCALL, "[%d] DIRTY LOG op %u gpa 0x%llx size 0x%llx",
+		vmid, log.op, log.gpa, log.size);
+
+	if (((log.gpa & PAGE_MASK) != log.gpa) || ((log.size & PAGE_MASK) != log.size) ||
+			(log.size == 0UL) || ((log.gpa + log.size) < log.gpa)) {
+		return -EINVAL;
+	}
+
+	switch (log.op) {
+	case ACRN_DIRTY_LOG_START:
+		ret = ept_dirty_log_start(target_vm, log.gpa, log.size);
+		break;
+	case ACRN_DIRTY_LOG_STOP:
+		ret = ept_dirty_log_stop(target_vm, log.gpa, log.size);
+		break;
+	case ACRN_DIRTY_LOG_GET:
+		hpa = gpa2hpa(vm, log.bitmap_gpa);
+		if ((log.size > ((uint64_t)ACRN_DIRTY_LOG_PAGES_MAX << PAGE_SHIFT)) ||
+				(hpa == INVALID_HPA) || ((hpa & PAGE_MASK) != hpa)) {
+			pr_err("%s: bad range or bitmap 0x%llx", __func__, log.bitmap_gpa);
+			ret = -EINVAL;
+		} else {
+			ret = ept_dirty_log_get(target_vm, log.gpa, log.size,
+				(uint64_t *)hpa2hva(hpa), &log.nr_dirty);
+			if ((ret == 0) && (copy_to_gpa(vm, &log, param, sizeof(log)) != 0)) {
+				ret = -EFAULT;
+			}
+		}
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	return ret;
+}
+
+/**
+ * @brief make a range of a VM copy on write
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_cow_range
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_set_cow(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_cow_range cow;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	uint64_t prot_set, prot_clr;
+	int32_t ret;
+
+	if ((target_vm == NULL) || is_vm0(target_vm)) {
+		return -EINVAL;
+	}
+
+	(void)memset((void *)&cow, 0U, sizeof(cow));
+	if (copy_from_gpa(vm, &cow, param, sizeof(cow)) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+		return -EFAULT;
+	}
+
+	dev_dbg(ACRN_DBG_HYCALL, "[%d] COW set %u gpa 0x%llx size 0x%llx",
+		vmid, cow.set, cow.gpa, cow.size);
+
+	if (((cow.gpa & PAGE_MASK) != cow.gpa) || ((cow.size & PAGE_MASK) != cow.size) ||
+			(cow.size == 0UL) || ((cow.gpa + cow.size) < cow.gpa)) {
+		return -EINVAL;
+	}
+
+	if (gpa2hpa(target_vm, cow.gpa) == INVALID_HPA) {
+		pr_err("%s: [vm%d] gpa 0x%llx is not mapped", __func__, vmid, cow.gpa);
+		return -EINVAL;
+	}
+
+	prot_set = (cow.set != 0U) ? EPT_COW : EPT_WR;
+	prot_clr = (cow.set != 0U) ? EPT_WR : EPT_COW;
+	ret = ept_mr_modify(target_vm, (uint64_t *)target_vm->arch_vm.nworld_eptp,
+			cow.gpa, cow.size, prot_set, prot_clr);
+
+	return ret;
+}
+
 /**
  * @brief translate guest physical address to host physical address
  *
@@ -779,9 +1665,7 @@ int32_t hcall_assign_ptdev(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 				__func__, target_vm->vm_id);
 			return -EPERM;
 		}
-		/* TODO: how to get vm's address width? */
-		target_vm->iommu = create_iommu_domain(vmid,
-				hva2hpa(target_vm->arch_vm.nworld_eptp), 48U);
+		target_vm->iommu = create_ept_iommu_domain(target_vm);
 		if (target_vm->iommu == NULL) {
 			return -ENODEV;
 		}
@@ -793,6 +1677,64 @@ int32_t hcall_assign_ptdev(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 	return ret;
 }
 
+/**
+ * @brief Assign a batch of passthrough devs to VM.
+ *
+ * The devices are detached from VM0 first and the VT-d caches of VM0 are
+ * invalidated once for the whole batch, which matters when provisioning
+ * the many VFs of SR-IOV devices.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to struct acrn_ptdev_batch
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_assign_ptdev_batch(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_ptdev_batch batch;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	uint32_t size;
+
+	if (target_vm == NULL) {
+		pr_err("%s, vm is null\n", __func__);
+		return -EINVAL;
+	}
+
+	(void)memset((void *)&batch, 0U, sizeof(batch));
+	if (copy_from_gpa(vm, &batch, param, sizeof(batch.nr_bdfs)) != 0) {
+		pr_err("%s: Unable copy param from vm %d\n", __func__, vm->vm_id);
+		return -EIO;
+	}
+
+	if ((batch.nr_bdfs == 0U) || (batch.nr_bdfs > PTDEV_BATCH_MAX)) {
+		pr_err("%s: invalid number of devices %u", __func__, batch.nr_bdfs);
+		return -EINVAL;
+	}
+
+	/* only copy the valid entries */
+	size = (uint32_t)offsetof(struct acrn_ptdev_batch, bdfs) + (batch.nr_bdfs * (uint32_t)sizeof(uint16_t));
+	if (copy_from_gpa(vm, &batch, param, size) != 0) {
+		pr_err("%s: Unable copy param from vm %d\n", __func__, vm->vm_id);
+		return -EIO;
+	}
+
+	/* create a iommu domain for target VM if not created */
+	if (target_vm->iommu == NULL) {
+		if (target_vm->arch_vm.nworld_eptp == NULL) {
+			pr_err("%s, EPT of VM not set!\n", __func__);
+			return -EPERM;
+		}
+		target_vm->iommu = create_ept_iommu_domain(target_vm);
+		if (target_vm->iommu == NULL) {
+			return -ENODEV;
+		}
+	}
+
+	return assign_iommu_devices(target_vm->iommu, batch.bdfs, batch.nr_bdfs);
+}
+
 /**
  * @brief Deassign one passthrough dev from VM.
  *
@@ -832,6 +1774,9 @@ int32_t hcall_deassign_ptdev(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 /**
  * @brief Set interrupt mapping info of ptdev.
  *
+ * Also sets how interrupts of the ptdev are coalesced, unless the target
+ * is VM0.
+ *
  * @param vm Pointer to VM data structure
  * @param vmid ID of the VM
  * @param param guest physical address. This gpa points to data structure of
@@ -857,6 +1802,11 @@ int32_t hcall_set_ptdev_intr_info(struct acrn_vm *vm, uint16_t vmid, uint64_t pa
 		return -1;
 	}
 
+	if (irq.coalesce.max_us > PTDEV_COALESCE_MAX_US) {
+		pr_err("%s: coalescing beyond %u us\n", __func__, PTDEV_COALESCE_MAX_US);
+		return -EINVAL;
+	}
+
 	/* Inform vPCI about the interupt info changes */
 #ifndef CONFIG_PARTITION_MODE
 	vpci_set_ptdev_intr_info(target_vm, irq.virt_bdf, irq.phys_bdf);
@@ -864,11 +1814,19 @@ int32_t hcall_set_ptdev_intr_info(struct acrn_vm *vm, uint16_t vmid, uint64_t pa
 
 	if (irq.type == IRQ_INTX) {
 		ret = ptirq_add_intx_remapping(target_vm, irq.is.intx.virt_pin,
-				irq.is.intx.phys_pin, irq.is.intx.pic_pin);
+				irq.is.intx.phys_pin, irq.phys_bdf, irq.is.intx.pic_pin);
+		if ((ret == 0) && !is_vm0(target_vm)) {
+			ret = ptirq_set_intx_coalescing(target_vm, irq.is.intx.virt_pin,
+				irq.is.intx.pic_pin, irq.coalesce.max_events, irq.coalesce.max_us);
+		}
 	} else if ((irq.type == IRQ_MSI) || (irq.type == IRQ_MSIX)) {
 		ret = ptirq_add_msix_remapping(target_vm,
 				irq.virt_bdf, irq.phys_bdf,
 				irq.is.msix.vector_cnt);
+		if ((ret == 0) && !is_vm0(target_vm)) {
+			ret = ptirq_set_msix_coalescing(target_vm, irq.virt_bdf,
+				irq.is.msix.vector_cnt, irq.coalesce.max_events, irq.coalesce.max_us);
+		}
 	} else {
 		pr_err("%s: Invalid irq type: %u\n", __func__, irq.type);
 		ret = -1;
@@ -1118,3 +2076,74 @@ int32_t hcall_set_callback_vector(const struct acrn_vm *vm, uint64_t param)
 
 	return 0;
 }
+
+/* entries copied in at a time, to bound the stack usage */
+#define MULTICALL_CHUNK_ENTRIES	16U
+
+/* nested batches and hypercalls switching the vcpu context can't be batched */
+static bool is_multicall_allowed(uint64_t hypcall_id)
+{
+	return ((hypcall_id != HC_MULTICALL) && (hypcall_id != HC_WORLD_SWITCH) &&
+		(hypcall_id != HC_INITIALIZE_TRUSTY) &&
+		(hypcall_id != HC_SAVE_RESTORE_SWORLD_CTX));
+}
+
+/**
+ * @brief issue a batch of hypercalls
+ *
+ * Run the hypercalls of an array of struct acrn_multicall_entry in order,
+ * writing the return value of each back to its entry. A failing entry does
+ * not stop the batch.
+ *
+ * @param vcpu Pointer to the vCPU issuing the hypercall
+ * @param param1 guest physical address. This gpa points to an array of
+ *              struct acrn_multicall_entry
+ * @param param2 number of entries, at most MULTICALL_ENTRIES_MAX
+ *
+ * @pre Pointer vcpu->vm shall point to VM0
+ * @return 0 if all entries are run (see each result), non-zero on error.
+ */
+int32_t hcall_multicall(struct acrn_vcpu *vcpu, uint64_t param1, uint64_t param2)
+{
+	struct acrn_multicall_entry entries[MULTICALL_CHUNK_ENTRIES];
+	struct acrn_vm *vm = vcpu->vm;
+	uint64_t gpa = param1, done = 0UL;
+	uint32_t i, n;
+
+	if ((param2 == 0UL) || (param2 > MULTICALL_ENTRIES_MAX)) {
+		pr_err("%s: invalid number of entries %llu", __func__, param2);
+		return -EINVAL;
+	}
+
+	while (done < param2) {
+		if ((param2 - done) < MULTICALL_CHUNK_ENTRIES) {
+			n = (uint32_t)(param2 - done);
+		} else {
+			n = MULTICALL_CHUNK_ENTRIES;
+		}
+
+		if (copy_from_gpa(vm, entries, gpa, n * (uint32_t)sizeof(entries[0])) != 0) {
+			pr_err("%s: Unable copy param from vm\n", __func__);
+			return -EINVAL;
+		}
+
+		for (i = 0U; i < n; i++) {
+			if (!is_multicall_allowed(entries[i].hc_id)) {
+				entries[i].result = -EINVAL;
+			} else {
+				entries[i].result = dispatch_hypercall(vcpu, entries[i].hc_id,
+						entries[i].param1, entries[i].param2);
+			}
+		}
+
+		if (copy_to_gpa(vm, entries, gpa, n * (uint32_t)sizeof(entries[0])) != 0) {
+			pr_err("%s: Unable copy param to vm\n", __func__);
+			return -EINVAL;
+		}
+
+		gpa += (uint64_t)n * sizeof(entries[0]);
+		done += n;
+	}
+
+	return 0;
+}
@@ -9,20 +9,52 @@
 
 uint32_t acrn_vhm_vector = VECTOR_VIRT_IRQ_VHM;
 
-static void fire_vhm_interrupt(void)
+/*
+ * Pick the SOS vcpu to signal a request of vcpu to, per the upcall policy
+ * of its VM.
+ */
+static uint16_t get_vhm_upcall_target(const struct acrn_vcpu *vcpu)
+{
+	struct vhm_upcall_info *upcall = &vcpu->vm->upcall;
+	uint16_t nr = upcall->nr_targets;
+	uint16_t target = BOOT_CPU_ID;
+	uint32_t idx;
+
+	if (nr != 0U) {
+		switch (upcall->policy) {
+		case UPCALL_POLICY_ROUND_ROBIN:
+			idx = (uint32_t)atomic_inc_return((int32_t *)&upcall->rr_next);
+			break;
+		case UPCALL_POLICY_SOURCE:
+			idx = vcpu->vcpu_id;
+			break;
+		default:
+			idx = 0U;
+			break;
+		}
+		target = upcall->targets[idx % nr];
+	}
+
+	return target;
+}
+
+static void fire_vhm_interrupt(const struct acrn_vcpu *vcpu)
 {
 	/*
-	 * use vLAPIC to inject vector to SOS vcpu 0 if vlapic is enabled
-	 * otherwise, send IPI hardcoded to BOOT_CPU_ID
+	 * use vLAPIC to inject vector to the SOS vcpu chosen by the upcall
+	 * policy of the VM, or vcpu 0 if it is offline.
 	 */
 	struct acrn_vm *vm0;
-	struct acrn_vcpu *vcpu;
+	struct acrn_vcpu *target;
 
 	vm0 = get_vm_from_vmid(0U);
 
-	vcpu = vcpu_from_vid(vm0, 0U);
+	target = vcpu_from_vid(vm0, get_vhm_upcall_target(vcpu));
+	if ((target->state == VCPU_ZOMBIE) || (target->state == VCPU_OFFLINE)) {
+		target = vcpu_from_vid(vm0, BOOT_CPU_ID);
+	}
 
-	vlapic_intr_edge(vcpu, acrn_vhm_vector);
+	vlapic_intr_edge(target, acrn_vhm_vector);
 }
 
 #if defined(HV_DEBUG)
@@ -68,7 +100,7 @@ void reset_vm_ioreqs(struct acrn_vm *vm)
 {
 	uint16_t i;
 
-	for (i = 0U; i < VHM_REQUEST_MAX; i++) {
+	for (i = 0U; i < vm->sw.io_req_slots; i++) {
 		set_vhm_req_state(vm, i, REQ_STATE_FREE);
 	}
 }
@@ -78,6 +110,97 @@ static inline bool has_complete_ioreq(struct acrn_vcpu *vcpu)
 	return (get_vhm_req_state(vcpu->vm, vcpu->vcpu_id) == REQ_STATE_COMPLETE);
 }
 
+static void update_spin_window(struct ioreq_latency *lat)
+{
+	uint32_t i, total = 0U, sum = 0U;
+
+	for (i = 0U; i < IOREQ_LAT_BUCKETS; i++) {
+		total += lat->hist[i];
+	}
+
+	for (i = 0U; i < (IOREQ_LAT_BUCKETS - 1U); i++) {
+		sum += lat->hist[i];
+		if ((sum * 100U) >= (total * IOREQ_SPIN_PERCENT)) {
+			break;
+		}
+	}
+
+	/* bucket i ends at 2^i us */
+	if ((1U << i) <= IOREQ_SPIN_MAX_US) {
+		lat->spin_window = us_to_ticks(1U << i);
+	} else {
+		lat->spin_window = 0UL;
+	}
+
+	/* age the history so that the window follows the DM */
+	if (total >= IOREQ_LAT_HISTORY) {
+		for (i = 0U; i < IOREQ_LAT_BUCKETS; i++) {
+			lat->hist[i] >>= 1U;
+		}
+	}
+}
+
+/**
+ * @brief Account the completion of the pending VHM request of \p vcpu
+ *
+ * @param vcpu The virtual CPU whose request is completed
+ *
+ * @pre vcpu != NULL && vcpu->vm->sw.is_completion_adaptive
+ *
+ * @return None
+ */
+void record_ioreq_latency(struct acrn_vcpu *vcpu)
+{
+	struct ioreq_latency *lat = &vcpu->ioreq_lat;
+	uint64_t us = ticks_to_us(rdtsc() - lat->start_tsc);
+	uint32_t bucket;
+
+	if (us == 0UL) {
+		bucket = 0U;
+	} else {
+		bucket = (uint32_t)fls64(us) + 1U;
+		if (bucket >= IOREQ_LAT_BUCKETS) {
+			bucket = IOREQ_LAT_BUCKETS - 1U;
+		}
+	}
+	lat->hist[bucket]++;
+
+	if (lat->polling) {
+		lat->spin_hit++;
+		lat->polling = false;
+	}
+
+	lat->samples++;
+	if (lat->samples >= IOREQ_LAT_UPDATE) {
+		lat->samples = 0U;
+		update_spin_window(lat);
+	}
+}
+
+/*
+ * Stop polling the pending request of vcpu and let SOS notify its
+ * completion instead.
+ */
+static void stop_ioreq_polling(struct acrn_vcpu *vcpu)
+{
+	struct vhm_request *vhm_req;
+
+	vcpu->ioreq_lat.polling = false;
+	vcpu->ioreq_lat.spin_miss++;
+
+	stac();
+	vhm_req = get_vhm_req(vcpu->vm, vcpu->vcpu_id);
+	atomic_store32(&vhm_req->completion_polling, 0U);
+	clac();
+
+	/*
+	 * SOS marks the request COMPLETE and then checks completion_polling.
+	 * Order the clearing above before our re-check of the state, so that
+	 * either SOS notifies or the caller finds the completion.
+	 */
+	cpu_memory_barrier();
+}
+
 /**
  * @brief Handle completed ioreq if any one pending
  *
@@ -97,8 +220,399 @@ void handle_complete_ioreq(uint16_t pcpu_id)
 				/* we have completed ioreq pending */
 				emulate_io_post(vcpu);
 			}
+		} else if (vm->sw.is_completion_adaptive && vcpu->ioreq_lat.polling) {
+			if (!has_complete_ioreq(vcpu) && (rdtsc() > vcpu->ioreq_lat.deadline)) {
+				/* DM is slower than expected, wait for notification */
+				stop_ioreq_polling(vcpu);
+			}
+
+			if (has_complete_ioreq(vcpu)) {
+				emulate_io_post(vcpu);
+			}
+		} else {
+			/* notification mode, nothing to poll */
+		}
+	}
+}
+
+/**
+ * @brief Tell if the idle loop of a pCPU polls for an I/O completion
+ *
+ * @param pcpu_id The physical cpu id whose idle loop is checked
+ *
+ * @return true if a request completion is only seen by polling
+ */
+bool is_ioreq_polled(uint16_t pcpu_id)
+{
+	struct acrn_vcpu *vcpu = get_ever_run_vcpu(pcpu_id);
+	bool ret = false;
+
+	if (vcpu != NULL) {
+		if (vcpu->vm->sw.is_completion_polling) {
+			/* FREE, or no buffer at all, leaves nothing to poll */
+			ret = (get_vhm_req_state(vcpu->vm, vcpu->vcpu_id) <= REQ_STATE_PROCESSING);
+		} else if (vcpu->vm->sw.is_completion_adaptive) {
+			ret = vcpu->ioreq_lat.polling;
+		} else {
+			/* notification mode, SOS wakes the vCPU up */
+		}
+	}
+
+	return ret;
+}
+
+static bool is_posted_range(const struct acrn_vm *vm, uint32_t flags, uint64_t address, uint64_t size)
+{
+	uint16_t idx;
+	bool ret = false;
+
+	for (idx = 0U; idx < vm->posted_mmio_regions; idx++) {
+		if ((vm->posted_mmio[idx].flags == flags) && (address >= vm->posted_mmio[idx].start) &&
+				((address + size) <= vm->posted_mmio[idx].end)) {
+			ret = true;
+			break;
 		}
 	}
+
+	return ret;
+}
+
+/**
+ * @brief Post a MMIO or port I/O write of \p vcpu to SOS without pausing \p vcpu
+ *
+ * @param vcpu The virtual CPU that triggers the access
+ * @param io_req The I/O request holding the details of the access
+ *
+ * @pre vcpu != NULL && io_req != NULL
+ *
+ * @retval 0 The write is posted and needs no more handling.
+ * @retval -ENODEV The request is not eligible for posting, or the ring is
+ * full, and shall be delivered by acrn_insert_request_wait().
+ */
+int32_t acrn_insert_posted_request(struct acrn_vcpu *vcpu, const struct io_request *io_req)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	/* pio_request and mmio_request share the layout up to value */
+	const struct mmio_request *mmio_req = &io_req->reqs.mmio;
+	struct vhm_posted_ring *ring;
+	struct vhm_posted_request *entry;
+	uint32_t head = 0U, tail = 0U, next;
+	uint32_t flags;
+	int32_t ret = -ENODEV;
+
+	if (((io_req->type != REQ_MMIO) && (io_req->type != REQ_PORTIO)) ||
+			(mmio_req->direction != REQUEST_WRITE) ||
+			(vm->sw.posted_ioreq_page == NULL) || (vm->posted_mmio_regions == 0U)) {
+		return ret;
+	}
+
+	ring = (struct vhm_posted_ring *)vm->sw.posted_ioreq_page;
+	flags = (io_req->type == REQ_PORTIO) ? POSTED_RANGE_FLAG_PIO : 0U;
+
+	spinlock_obtain(&vm->posted_ioreq_lock);
+	if (is_posted_range(vm, flags, mmio_req->address, mmio_req->size)) {
+		stac();
+		tail = ring->tail % VHM_POSTED_REQUEST_MAX;
+		next = (tail + 1U) % VHM_POSTED_REQUEST_MAX;
+		if (next == atomic_load32(&ring->head)) {
+			/* Ring full, deliver it as a blocking request */
+			ring->overflow++;
+		} else {
+			entry = &ring->entries[tail];
+			entry->address = mmio_req->address;
+			entry->value = (flags != 0U) ? (uint64_t)io_req->reqs.pio.value : mmio_req->value;
+			entry->size = (uint32_t)mmio_req->size;
+			entry->vcpu = vcpu->vcpu_id;
+			entry->flags = (flags != 0U) ? (uint16_t)POSTED_REQUEST_PIO : 0U;
+			atomic_store32(&ring->tail, next);
+
+			/*
+			 * Make the new tail visible before checking whether SOS
+			 * has already drained up to the previous one, see
+			 * vhm_posted_ring for the protocol.
+			 */
+			cpu_memory_barrier();
+			head = atomic_load32(&ring->head);
+			ret = 0;
+		}
+		clac();
+	}
+	spinlock_release(&vm->posted_ioreq_lock);
+
+	/* signal VHM only if the ring was empty before */
+	if ((ret == 0) && (head == tail)) {
+		fire_vhm_interrupt(vcpu);
+	}
+
+	return ret;
+}
+
+static bool is_ioeventfd_match(const struct hv_ioeventfd *fd, const struct io_request *io_req)
+{
+	/* pio_request and mmio_request share the layout of these fields */
+	const struct pio_request *pio_req = &io_req->reqs.pio;
+	bool is_pio = ((fd->flags & HV_IOEVENTFD_FLAG_PIO) != 0U);
+
+	return ((is_pio == (io_req->type == REQ_PORTIO)) &&
+		(pio_req->address == fd->addr) &&
+		(pio_req->size == (uint64_t)fd->len) &&
+		(((fd->flags & HV_IOEVENTFD_FLAG_DATAMATCH) == 0U) ||
+		 ((uint64_t)pio_req->value == fd->data)));
+}
+
+/**
+ * @brief Complete a doorbell write of \p vcpu in the hypervisor
+ *
+ * @param vcpu The virtual CPU that triggers the I/O access
+ * @param io_req The I/O request holding the details of the I/O access
+ *
+ * @pre vcpu != NULL && io_req != NULL
+ *
+ * @retval 0 The write is signaled and needs no more handling.
+ * @retval -ENODEV The request matches no ioeventfd.
+ */
+int32_t acrn_signal_ioeventfd(struct acrn_vcpu *vcpu, const struct io_request *io_req)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct vhm_ioeventfd_page *page;
+	uint64_t active, old = 0UL, bit = 0UL;
+	uint16_t idx;
+	int32_t ret = -ENODEV;
+
+	if (((io_req->type != REQ_PORTIO) && (io_req->type != REQ_MMIO)) ||
+			(io_req->reqs.pio.direction != REQUEST_WRITE) ||
+			(vm->sw.ioeventfd_page == NULL) || (vm->ioeventfd_active == 0UL)) {
+		return ret;
+	}
+
+	page = (struct vhm_ioeventfd_page *)vm->sw.ioeventfd_page;
+
+	spinlock_obtain(&vm->ioeventfd_lock);
+	active = vm->ioeventfd_active;
+	while (active != 0UL) {
+		idx = (uint16_t)ffs64(active);
+		bitmap_clear_nolock(idx, &active);
+		if (is_ioeventfd_match(&vm->ioeventfd[idx], io_req)) {
+			bit = 1UL << idx;
+			stac();
+			do {
+				old = atomic_load64(&page->pending);
+			} while (atomic_cmpxchg64(&page->pending, old, old | bit) != old);
+			clac();
+			ret = 0;
+			break;
+		}
+	}
+	spinlock_release(&vm->ioeventfd_lock);
+
+	/* signal VHM only if no ioeventfd was pending before */
+	if ((ret == 0) && (old == 0UL)) {
+		fire_vhm_interrupt(vcpu);
+	}
+
+	return ret;
+}
+
+#define PIT_CNTR0_PORT		0x40U
+#define PIT_CNTR2_PORT		0x42U
+#define NMISC_PORT		0x61U
+#define NMISC_TMR2_OUT		0x20U
+#define RTC_DATA_PORT		0x71U
+
+#define RTC_REG_A		0x0AU
+#define RTC_REG_C		0x0CU
+#define RTC_CENTURY		0x32U
+
+#define PIT_FREQ		1193182UL
+#define PIT_MODE_INTTC		0x0U
+#define PIT_MODE_RATEGEN	0x4U
+#define PIT_MODE_SQWAVE		0x6U
+#define PIT_MODE_SWSTROBE	0x8U
+
+/* PIT ticks elapsed since start_tsc, computed without overflowing */
+static uint64_t clock_pit_ticks(uint64_t start_tsc)
+{
+	uint64_t now = rdtsc();
+	uint64_t tsc_hz = (uint64_t)tsc_khz * 1000UL;
+	uint64_t delta = (now > start_tsc) ? (now - start_tsc) : 0UL;
+
+	return ((delta / tsc_hz) * PIT_FREQ) + (((delta % tsc_hz) * PIT_FREQ) / tsc_hz);
+}
+
+/* The count of a counter \p ticks after its load, as the vPIT of the DM gives it */
+static uint16_t clock_pit_count(uint32_t mode, uint32_t initial, uint64_t ticks)
+{
+	uint32_t t, count;
+
+	switch (mode) {
+	case PIT_MODE_RATEGEN:
+		count = initial - (uint32_t)(ticks % initial);
+		break;
+	case PIT_MODE_SQWAVE:
+		t = (uint32_t)(ticks % initial);
+		if (t >= ((initial + 1U) / 2U)) {
+			t -= (initial + 1U) / 2U;
+		}
+		count = (initial & ~1U) - (t * 2U);
+		break;
+	default:
+		/* PIT_MODE_INTTC and PIT_MODE_SWSTROBE count down and wrap */
+		count = initial - (uint32_t)ticks;
+		break;
+	}
+
+	return (uint16_t)count;
+}
+
+/* The OUT pin of a counter \p ticks after its load */
+static bool clock_pit_out(uint32_t mode, uint32_t initial, uint64_t ticks)
+{
+	bool out;
+
+	switch (mode) {
+	case PIT_MODE_INTTC:
+		out = (ticks >= initial);
+		break;
+	case PIT_MODE_RATEGEN:
+		out = ((ticks % initial) != (initial - 1U));
+		break;
+	case PIT_MODE_SQWAVE:
+		out = ((ticks % initial) < ((initial + 1U) / 2U));
+		break;
+	default:
+		out = (ticks != initial);
+		break;
+	}
+
+	return out;
+}
+
+/*
+ * Snapshot the PIT counter \p channel of \p page.
+ *
+ * Return false if SOS is updating it or did not mark it valid.
+ */
+static bool clock_pit_snapshot(const struct vhm_clock_page *page, uint32_t channel,
+		uint32_t *mode, uint32_t *initial, uint64_t *start_tsc)
+{
+	const struct vhm_clock_pit *pit = &page->pit[channel];
+	uint32_t seq;
+	bool valid;
+
+	seq = atomic_load32(&page->pit_seq);
+	valid = (pit->valid != 0U);
+	*mode = pit->mode;
+	*initial = pit->initial;
+	*start_tsc = pit->start_tsc;
+
+	return ((seq & 1U) == 0U) && valid && (*initial != 0U) && (atomic_load32(&page->pit_seq) == seq);
+}
+
+static int32_t clock_read_pit(struct vhm_clock_page *page, uint32_t channel, uint32_t *value)
+{
+	struct vhm_clock_pit *pit = &page->pit[channel];
+	uint32_t mode, initial, frbyte;
+	uint64_t start_tsc;
+	uint16_t count;
+	int32_t ret = -ENODEV;
+
+	if (clock_pit_snapshot(page, channel, &mode, &initial, &start_tsc)) {
+		count = clock_pit_count(mode, initial, clock_pit_ticks(start_tsc));
+
+		/* free-running reads return the LSB and MSB in turn */
+		do {
+			frbyte = atomic_load32(&pit->frbyte);
+		} while (atomic_cmpxchg32(&pit->frbyte, frbyte, frbyte ^ 1U) != frbyte);
+
+		*value = ((frbyte & 1U) != 0U) ? ((uint32_t)count >> 8U) : ((uint32_t)count & 0xFFU);
+		ret = 0;
+	}
+
+	return ret;
+}
+
+static int32_t clock_read_nmisc(const struct vhm_clock_page *page, uint32_t *value)
+{
+	uint32_t mode, initial;
+	uint64_t start_tsc;
+	int32_t ret = -ENODEV;
+
+	if (clock_pit_snapshot(page, 2U, &mode, &initial, &start_tsc)) {
+		*value = clock_pit_out(mode, initial, clock_pit_ticks(start_tsc)) ? NMISC_TMR2_OUT : 0U;
+		ret = 0;
+	}
+
+	return ret;
+}
+
+static int32_t clock_read_rtc(const struct vhm_clock_page *page, uint32_t *value)
+{
+	uint32_t seq, addr;
+	uint64_t expire_tsc;
+	uint8_t reg = 0U;
+	bool valid;
+	int32_t ret = -ENODEV;
+
+	seq = atomic_load32(&page->rtc_seq);
+	addr = page->rtc_addr;
+	valid = (page->rtc_valid != 0U);
+	expire_tsc = page->rtc_expire_tsc;
+	if ((addr < VHM_CLOCK_RTC_REGS) && (addr != RTC_REG_C)) {
+		reg = page->rtc_regs[addr];
+	} else if (addr == RTC_CENTURY) {
+		reg = page->rtc_century;
+	} else {
+		/* reading register C clears it, nvram is left to SOS */
+		valid = false;
+	}
+
+	/* the date and time fields (the ones below register A) go stale */
+	if (valid && ((addr < RTC_REG_A) || (addr == RTC_CENTURY)) && (rdtsc() >= expire_tsc)) {
+		valid = false;
+	}
+
+	if (((seq & 1U) == 0U) && valid && (atomic_load32(&page->rtc_seq) == seq)) {
+		*value = reg;
+		ret = 0;
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Complete a read of the RTC or PIT of \p vcpu in the hypervisor
+ *
+ * @param vcpu The virtual CPU that triggers the I/O access
+ * @param io_req The I/O request holding the details of the I/O access
+ *
+ * @pre vcpu != NULL && io_req != NULL
+ *
+ * @retval 0 The read is completed in \p io_req.
+ * @retval -ENODEV The read shall be delivered to SOS.
+ */
+int32_t acrn_complete_clock_read(struct acrn_vcpu *vcpu, struct io_request *io_req)
+{
+	struct pio_request *pio_req = &io_req->reqs.pio;
+	struct vhm_clock_page *page = (struct vhm_clock_page *)vcpu->vm->sw.clock_page;
+	int32_t ret = -ENODEV;
+
+	if ((io_req->type == REQ_PORTIO) && (pio_req->direction == REQUEST_READ) &&
+			(pio_req->size == 1UL) && (page != NULL)) {
+		stac();
+		if ((pio_req->address >= PIT_CNTR0_PORT) && (pio_req->address <= PIT_CNTR2_PORT)) {
+			ret = clock_read_pit(page, (uint32_t)(pio_req->address - PIT_CNTR0_PORT),
+					&pio_req->value);
+		} else if (pio_req->address == NMISC_PORT) {
+			ret = clock_read_nmisc(page, &pio_req->value);
+		} else if (pio_req->address == RTC_DATA_PORT) {
+			ret = clock_read_rtc(page, &pio_req->value);
+		} else {
+			/* not a clock port */
+		}
+		clac();
+	}
+
+	return ret;
 }
 
 /**
@@ -111,28 +625,33 @@ void handle_complete_ioreq(uint16_t pcpu_id)
  */
 int32_t acrn_insert_request_wait(struct acrn_vcpu *vcpu, const struct io_request *io_req)
 {
-	union vhm_request_buffer *req_buf = NULL;
 	struct vhm_request *vhm_req;
-	uint16_t cur;
 
-	if (vcpu->vm->sw.io_shared_page == NULL) {
+	if ((vcpu->vm->sw.io_shared_page == NULL) ||
+			(vcpu->vcpu_id >= vcpu->vm->sw.io_req_slots)) {
 		return -EINVAL;
 	}
 
 	ASSERT(get_vhm_req_state(vcpu->vm, vcpu->vcpu_id) == REQ_STATE_FREE,
 		"VHM request buffer is busy");
 
-	req_buf = (union vhm_request_buffer *)(vcpu->vm->sw.io_shared_page);
-	cur = vcpu->vcpu_id;
-
 	stac();
-	vhm_req = &req_buf->req_queue[cur];
+	vhm_req = get_vhm_req(vcpu->vm, vcpu->vcpu_id);
 	/* ACRN insert request to VHM and inject upcall */
 	vhm_req->type = io_req->type;
 	(void)memcpy_s(&vhm_req->reqs, sizeof(union vhm_io_request),
 		&io_req->reqs, sizeof(union vhm_io_request));
 	if (vcpu->vm->sw.is_completion_polling) {
 		vhm_req->completion_polling = 1U;
+	} else if (vcpu->vm->sw.is_completion_adaptive) {
+		struct ioreq_latency *lat = &vcpu->ioreq_lat;
+
+		lat->start_tsc = rdtsc();
+		lat->deadline = lat->start_tsc + lat->spin_window;
+		lat->polling = (lat->spin_window != 0UL);
+		vhm_req->completion_polling = lat->polling ? 1U : 0U;
+	} else {
+		/* notification mode */
 	}
 	clac();
 
@@ -147,6 +666,7 @@ int32_t acrn_insert_request_wait(struct acrn_vcpu *vcpu, const struct io_request
 	 * before we perform upcall.
 	 * because VHM can work in pulling mode without wait for upcall
 	 */
+	vcpu->sched.dm_wait_start = rdtsc();
 	set_vhm_req_state(vcpu->vm, vcpu->vcpu_id, REQ_STATE_PENDING);
 
 #if defined(HV_DEBUG)
@@ -156,24 +676,31 @@ int32_t acrn_insert_request_wait(struct acrn_vcpu *vcpu, const struct io_request
 #endif
 
 	/* signal VHM */
-	fire_vhm_interrupt();
+	fire_vhm_interrupt(vcpu);
 
 	return 0;
 }
 
+struct vhm_request *get_vhm_req(const struct acrn_vm *vm, uint16_t vhm_req_id)
+{
+	union vhm_request_buffer *req_buf;
+
+	req_buf = (union vhm_request_buffer *)vm->sw.io_req_pages[vhm_req_id / VHM_REQUEST_MAX];
+
+	return &req_buf->req_queue[vhm_req_id % VHM_REQUEST_MAX];
+}
+
 uint32_t get_vhm_req_state(struct acrn_vm *vm, uint16_t vhm_req_id)
 {
 	uint32_t state;
-	union vhm_request_buffer *req_buf = NULL;
 	struct vhm_request *vhm_req;
 
-	req_buf = (union vhm_request_buffer *)vm->sw.io_shared_page;
-	if (req_buf == NULL) {
+	if ((vm->sw.io_shared_page == NULL) || (vhm_req_id >= vm->sw.io_req_slots)) {
 		return (uint32_t)-1;
 	}
 
 	stac();
-	vhm_req = &req_buf->req_queue[vhm_req_id];
+	vhm_req = get_vhm_req(vm, vhm_req_id);
 	state = atomic_load32(&vhm_req->processed);
 	clac();
 
@@ -182,16 +709,14 @@ uint32_t get_vhm_req_state(struct acrn_vm *vm, uint16_t vhm_req_id)
 
 void set_vhm_req_state(struct acrn_vm *vm, uint16_t vhm_req_id, uint32_t state)
 {
-	union vhm_request_buffer *req_buf = NULL;
 	struct vhm_request *vhm_req;
 
-	req_buf = (union vhm_request_buffer *)vm->sw.io_shared_page;
-	if (req_buf == NULL) {
+	if ((vm->sw.io_shared_page == NULL) || (vhm_req_id >= vm->sw.io_req_slots)) {
 		return;
 	}
 
 	stac();
-	vhm_req = &req_buf->req_queue[vhm_req_id];
+	vhm_req = get_vhm_req(vm, vhm_req_id);
 	atomic_store32(&vhm_req->processed, state);
 	clac();
 }
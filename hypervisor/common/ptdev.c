@@ -13,11 +13,99 @@ struct ptirq_remapping_info ptirq_entries[CONFIG_MAX_PT_IRQ_ENTRIES];
 static uint64_t ptirq_entry_bitmaps[PTIRQ_BITMAP_ARRAY_SIZE];
 spinlock_t ptdev_lock;
 
+/* active entries hashed by physical sid, and by vm + virtual sid */
+#define PTIRQ_HASH_BITS		7U
+#define PTIRQ_HASH_SIZE		(1U << PTIRQ_HASH_BITS)
+static struct list_head ptirq_phys_htable[PTIRQ_HASH_SIZE];
+static struct list_head ptirq_virt_htable[PTIRQ_HASH_SIZE];
+
+static inline uint32_t ptirq_hash(uint32_t intr_type, const union source_id *sid,
+		const struct acrn_vm *vm)
+{
+	uint64_t key = ((uint64_t)intr_type << 48U) | (uint64_t)sid->value;
+
+	if (vm != NULL) {
+		key |= (uint64_t)vm->vm_id << 32U;
+	}
+
+	/* multiplicative hashing, the top bits are the best mixed */
+	return (uint32_t)((key * 0x9E3779B97F4A7C15UL) >> (64U - PTIRQ_HASH_BITS));
+}
+
+static void ptirq_hash_entry(struct ptirq_remapping_info *entry)
+{
+	list_add(&entry->phys_link,
+		&ptirq_phys_htable[ptirq_hash(entry->intr_type, &entry->phys_sid, NULL)]);
+	list_add(&entry->virt_link,
+		&ptirq_virt_htable[ptirq_hash(entry->intr_type, &entry->virt_sid, entry->vm)]);
+}
+
+static void ptirq_unhash_entry(struct ptirq_remapping_info *entry)
+{
+	list_del_init(&entry->phys_link);
+	list_del_init(&entry->virt_link);
+}
+
 bool is_entry_active(const struct ptirq_remapping_info *entry)
 {
 	return atomic_load32(&entry->active) == ACTIVE_FLAG;
 }
 
+/*
+ * lookup a ptdev entry by sid
+ * Before adding a ptdev remapping, should lookup by physical sid to check
+ * whether the resource has been token by others.
+ * When updating a ptdev remapping, should lookup by virtual sid to check
+ * whether this resource is valid.
+ * @pre: vm must be NULL when lookup by physical sid, otherwise,
+ * vm must not be NULL when lookup by virtual sid.
+ * @pre: ptdev_lock is held
+ */
+struct ptirq_remapping_info *ptirq_lookup_entry_by_sid(uint32_t intr_type,
+		const union source_id *sid, const struct acrn_vm *vm)
+{
+	struct list_head *pos;
+	struct ptirq_remapping_info *entry;
+	uint32_t idx = ptirq_hash(intr_type, sid, vm);
+
+	if (vm == NULL) {
+		list_for_each(pos, &ptirq_phys_htable[idx]) {
+			entry = list_entry(pos, struct ptirq_remapping_info, phys_link);
+			if (is_entry_active(entry) && (entry->intr_type == intr_type) &&
+					(entry->phys_sid.value == sid->value)) {
+				return entry;
+			}
+		}
+	} else {
+		list_for_each(pos, &ptirq_virt_htable[idx]) {
+			entry = list_entry(pos, struct ptirq_remapping_info, virt_link);
+			if (is_entry_active(entry) && (entry->intr_type == intr_type) &&
+					(entry->vm == vm) && (entry->virt_sid.value == sid->value)) {
+				return entry;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Move the entry to vm, with virt_sid as its virtual sid there.
+ * @pre: ptdev_lock is held
+ */
+void ptirq_change_virt_sid(struct ptirq_remapping_info *entry, struct acrn_vm *vm,
+		const union source_id *virt_sid)
+{
+	entry->vm = vm;
+	entry->virt_sid.value = virt_sid->value;
+
+	if (!list_empty(&entry->virt_link)) {
+		list_del(&entry->virt_link);
+		list_add(&entry->virt_link,
+			&ptirq_virt_htable[ptirq_hash(entry->intr_type, virt_sid, vm)]);
+	}
+}
+
 static inline uint16_t ptirq_alloc_entry_id(void)
 {
 	uint16_t id = (uint16_t)ffz64_ex(ptirq_entry_bitmaps, CONFIG_MAX_PT_IRQ_ENTRIES);
@@ -32,20 +120,53 @@ static inline uint16_t ptirq_alloc_entry_id(void)
 	return INVALID_PTDEV_ENTRY_ID;
 }
 
+static void ptirq_free_entry_id(uint16_t id)
+{
+	bitmap_clear_lock((id & 0x3FU), &ptirq_entry_bitmaps[id >> 6U]);
+}
+
+/*
+ * Interrupts are deferred to SOFTIRQ_PTDEV on the pCPU that took them, and
+ * only that pCPU's softirq takes entries off its queue, so producers just
+ * push lock-free and an entry is queued once until the softirq takes it.
+ */
 static void ptirq_enqueue_softirq(struct ptirq_remapping_info *entry)
 {
-	uint64_t rflags;
+	uint16_t pcpu_id = get_cpu_id();
+	uint64_t *queue = &per_cpu(ptdev_softirq_queue, pcpu_id);
+	uint64_t head;
+
+	/* neither queued already nor released */
+	if (atomic_cmpxchg32(&entry->softirq_state, 0U, PTIRQ_SOFTIRQ_QUEUED) == 0U) {
+		do {
+			head = atomic_load64(queue);
+			entry->softirq_next = (struct ptirq_remapping_info *)head;
+		} while (atomic_cmpxchg64(queue, head, (uint64_t)entry) != head);
+
+		fire_softirq(SOFTIRQ_PTDEV);
+	}
+}
+
+/*
+ * Take the entry off the queue, the caller now owns it.
+ * Return true if it was released while queued, it is freed here then.
+ */
+static bool ptirq_unqueue_softirq(struct ptirq_remapping_info *entry)
+{
+	uint32_t state;
+	bool released;
+
+	do {
+		state = atomic_load32(&entry->softirq_state);
+	} while (atomic_cmpxchg32(&entry->softirq_state, state,
+			state & ~PTIRQ_SOFTIRQ_QUEUED) != state);
 
-	/* enqueue request in order, SOFTIRQ_PTDEV will pickup */
-	spinlock_irqsave_obtain(&entry->vm->softirq_dev_lock, &rflags);
+	released = ((state & PTIRQ_SOFTIRQ_RELEASED) != 0U);
+	if (released) {
+		ptirq_free_entry_id(entry->ptdev_entry_id);
+	}
 
-	/* avoid adding recursively */
-	list_del(&entry->softirq_node);
-	/* TODO: assert if entry already in list */
-	list_add_tail(&entry->softirq_node,
-			&entry->vm->softirq_dev_entry_list);
-	spinlock_irqrestore_release(&entry->vm->softirq_dev_lock, rflags);
-	fire_softirq(SOFTIRQ_PTDEV);
+	return released;
 }
 
 static void ptirq_intr_delay_callback(void *data)
@@ -56,23 +177,70 @@ static void ptirq_intr_delay_callback(void *data)
 	ptirq_enqueue_softirq(entry);
 }
 
-struct ptirq_remapping_info *ptirq_dequeue_softirq(struct acrn_vm *vm)
+static inline bool is_coalescing_full(const struct ptirq_remapping_info *entry)
 {
-	uint64_t rflags;
-	struct ptirq_remapping_info *entry = NULL;
+	return ((entry->coalesce_cycles != 0UL) && (entry->coalesce_events != 0U) &&
+		((uint32_t)entry->coalesced >= entry->coalesce_events));
+}
+
+/*
+ * A batch of coalesced interrupts is injected once, on whichever of its
+ * deadline and its event limit comes first. Return false if the batch
+ * this request was for has been injected already.
+ */
+static bool ptirq_take_coalesced(struct ptirq_remapping_info *entry)
+{
+	bool ret = true;
 
-	spinlock_irqsave_obtain(&vm->softirq_dev_lock, &rflags);
+	if (entry->coalesce_cycles != 0UL) {
+		/* disarm before the reset, the next interrupt arms it again */
+		del_timer(&entry->intr_delay_timer);
+		ret = (atomic_readandclear32((uint32_t *)&entry->coalesced) != 0U);
+	}
 
-	while (!list_empty(&vm->softirq_dev_entry_list)) {
-		entry = get_first_item(&vm->softirq_dev_entry_list,
-			struct ptirq_remapping_info, softirq_node);
+	return ret;
+}
 
-		list_del_init(&entry->softirq_node);
+/* softirq context of pcpu_id */
+struct ptirq_remapping_info *ptirq_dequeue_softirq(uint16_t pcpu_id)
+{
+	struct ptirq_remapping_info *entry = NULL;
+	struct ptirq_remapping_info *list, *node, *next;
+
+	list = (struct ptirq_remapping_info *)per_cpu(ptdev_softirq_list, pcpu_id);
+
+	while (true) {
+		if (list == NULL) {
+			/* take all queued entries at once, producers only ever push */
+			node = (struct ptirq_remapping_info *)
+				atomic_swap64(&per_cpu(ptdev_softirq_queue, pcpu_id), 0UL);
+
+			/* the queue is LIFO, handle the entries in the order they came */
+			while (node != NULL) {
+				next = node->softirq_next;
+				node->softirq_next = list;
+				list = node;
+				node = next;
+			}
 
+			if (list == NULL) {
+				break;
+			}
+		}
+
+		entry = list;
+		list = entry->softirq_next;
+
+		if (ptirq_unqueue_softirq(entry) || !is_entry_active(entry)) {
+			entry = NULL;
 		/* if vm0, just dequeue, if uos, check delay timer */
-		if (is_vm0(entry->vm) ||
-			timer_expired(&entry->intr_delay_timer)) {
-			break;
+		} else if (is_vm0(entry->vm) ||
+			timer_expired(&entry->intr_delay_timer) ||
+			is_coalescing_full(entry)) {
+			if (ptirq_take_coalesced(entry)) {
+				break;
+			}
+			entry = NULL;
 		} else {
 			/* add it into timer list; dequeue next one */
 			(void)add_timer(&entry->intr_delay_timer);
@@ -80,7 +248,7 @@ struct ptirq_remapping_info *ptirq_dequeue_softirq(struct acrn_vm *vm)
 		}
 	}
 
-	spinlock_irqrestore_release(&vm->softirq_dev_lock, rflags);
+	per_cpu(ptdev_softirq_list, pcpu_id) = (void *)list;
 	return entry;
 }
 
@@ -100,8 +268,9 @@ struct ptirq_remapping_info *ptirq_alloc_entry(struct acrn_vm *vm, uint32_t intr
 	entry->intr_type = intr_type;
 	entry->vm = vm;
 	entry->intr_count = 0UL;
-
-	INIT_LIST_HEAD(&entry->softirq_node);
+	entry->irte_idx = INVALID_IRTE_ID;
+	INIT_LIST_HEAD(&entry->phys_link);
+	INIT_LIST_HEAD(&entry->virt_link);
 
 	initialize_timer(&entry->intr_delay_timer, ptirq_intr_delay_callback,
 		entry, 0UL, 0, 0UL);
@@ -113,25 +282,63 @@ struct ptirq_remapping_info *ptirq_alloc_entry(struct acrn_vm *vm, uint32_t intr
 
 void ptirq_release_entry(struct ptirq_remapping_info *entry)
 {
-	uint64_t rflags;
+	uint32_t state;
 
-	/*
-	 * remove entry from softirq list
-	 * is required before calling ptirq_release_entry.
-	 */
-	spinlock_irqsave_obtain(&entry->vm->softirq_dev_lock, &rflags);
-	list_del_init(&entry->softirq_node);
-	spinlock_irqrestore_release(&entry->vm->softirq_dev_lock, rflags);
 	atomic_clear32(&entry->active, ACTIVE_FLAG);
-	bitmap_clear_nolock((entry->ptdev_entry_id) & 0x3FU,
-		&ptirq_entry_bitmaps[((entry->ptdev_entry_id) & 0x3FU) >> 6U]);
+	ptirq_unhash_entry(entry);
+
+	/* an entry still queued is freed by the softirq taking it off */
+	do {
+		state = atomic_load32(&entry->softirq_state);
+	} while (atomic_cmpxchg32(&entry->softirq_state, state,
+			state | PTIRQ_SOFTIRQ_RELEASED) != state);
+
+	if ((state & PTIRQ_SOFTIRQ_QUEUED) == 0U) {
+		ptirq_free_entry_id(entry->ptdev_entry_id);
+	}
+}
+
+/* slot taken when ptirq[] of the telemetry page is full */
+#define PTIRQ_TELEMETRY_NO_SLOT	0xFFFFU
+
+/* publish intr_count of entry in the telemetry page of its VM */
+static void ptirq_update_telemetry(struct ptirq_remapping_info *entry)
+{
+	struct acrn_vm_telemetry *page = (struct acrn_vm_telemetry *)entry->vm->sw.telemetry_page;
+	struct acrn_ptirq_telemetry *t;
+	int32_t slot;
+
+	if (page != NULL) {
+		if (entry->telemetry_slot == 0U) {
+			slot = atomic_inc_return(&entry->vm->sw.telemetry_ptirqs);
+			if (slot <= (int32_t)ACRN_TELEMETRY_PTIRQS) {
+				entry->telemetry_slot = (uint16_t)slot;
+				stac();
+				page->ptirq[slot - 1].pirq = entry->allocated_pirq;
+				clac();
+				/* the IRQ is known before its count gets non-zero */
+				cpu_write_memory_barrier();
+			} else {
+				entry->telemetry_slot = PTIRQ_TELEMETRY_NO_SLOT;
+			}
+		}
+
+		if (entry->telemetry_slot != PTIRQ_TELEMETRY_NO_SLOT) {
+			t = &page->ptirq[entry->telemetry_slot - 1U];
+			stac();
+			t->count = entry->intr_count;
+			clac();
+		}
+	}
 }
 
 /* interrupt context */
-static void ptirq_interrupt_handler(__unused uint32_t irq, void *data)
+static void ptirq_interrupt_handler(uint32_t irq, void *data)
 {
 	struct ptirq_remapping_info *entry =
 		(struct ptirq_remapping_info *) data;
+	bool enqueue = true;
+	int32_t count;
 
 	/*
 	 * "interrupt storm" detection & delay intr injection just for UOS
@@ -139,9 +346,22 @@ static void ptirq_interrupt_handler(__unused uint32_t irq, void *data)
 	 */
 	if (!is_vm0(entry->vm)) {
 		entry->intr_count++;
-
-		/* if delta > 0, set the delay TSC, dequeue to handle */
-		if (entry->vm->intr_inject_delay_delta > 0UL) {
+		ptirq_update_telemetry(entry);
+
+		if (entry->coalesce_cycles != 0UL) {
+			count = atomic_inc_return(&entry->coalesced);
+			if (count == 1) {
+				/* first of a batch: its deadline, the timer is disarmed */
+				entry->intr_delay_timer.fire_tsc = rdtsc() + entry->coalesce_cycles;
+			} else if ((entry->coalesce_events == 0U) ||
+					((uint32_t)count < entry->coalesce_events)) {
+				/* the batch is pending already */
+				enqueue = false;
+			} else {
+				/* full: injected without waiting for the deadline */
+			}
+		} else if (entry->vm->intr_inject_delay_delta > 0UL) {
+			/* if delta > 0, set the delay TSC, dequeue to handle */
 			entry->intr_delay_timer.fire_tsc = rdtsc() +
 				entry->vm->intr_inject_delay_delta;
 		} else {
@@ -149,7 +369,12 @@ static void ptirq_interrupt_handler(__unused uint32_t irq, void *data)
 		}
 	}
 
-	ptirq_enqueue_softirq(entry);
+	TRACE_4I(TRACE_PTIRQ_IRQ, irq, (uint32_t)entry->vm->vm_id,
+		(uint32_t)entry->ptdev_entry_id, enqueue ? 1U : 0U);
+
+	if (enqueue) {
+		ptirq_enqueue_softirq(entry);
+	}
 }
 
 /* active intr with irq registering */
@@ -164,6 +389,7 @@ int32_t ptirq_activate_entry(struct ptirq_remapping_info *entry, uint32_t phys_i
 		pr_err("request irq failed, please check!, phys-irq=%d", phys_irq);
 	} else {
 		entry->allocated_pirq = (uint32_t)retval;
+		ptirq_hash_entry(entry);
 		atomic_set32(&entry->active, ACTIVE_FLAG);
 	}
 
@@ -172,27 +398,46 @@ int32_t ptirq_activate_entry(struct ptirq_remapping_info *entry, uint32_t phys_i
 
 void ptirq_deactivate_entry(struct ptirq_remapping_info *entry)
 {
-	uint64_t rflags;
-
 	atomic_clear32(&entry->active, ACTIVE_FLAG);
+	ptirq_unhash_entry(entry);
 
 	free_irq(entry->allocated_pirq);
 	entry->allocated_pirq = IRQ_INVALID;
 
-	/* remove from softirq list if added */
-	spinlock_irqsave_obtain(&entry->vm->softirq_dev_lock, &rflags);
-	list_del_init(&entry->softirq_node);
+	if (entry->irte_idx != INVALID_IRTE_ID) {
+		iommu_free_irte((uint8_t)(entry->phys_sid.msi_id.bdf >> 8U),
+			(uint8_t)(entry->phys_sid.msi_id.bdf & 0xffU), entry->irte_idx);
+		entry->irte_idx = INVALID_IRTE_ID;
+	}
+
+	/* a queued entry is dropped by the softirq as it is inactive now */
 	del_timer(&entry->intr_delay_timer);
-	spinlock_irqrestore_release(&entry->vm->softirq_dev_lock, rflags);
+}
+
+/*
+ * Coalesce interrupts of the entry: inject them at the latest max_us
+ * after the first, or as soon as max_events have arrived if not 0.
+ * max_us 0 turns coalescing off.
+ */
+void ptirq_set_coalescing(struct ptirq_remapping_info *entry, uint32_t max_events, uint32_t max_us)
+{
+	entry->coalesce_events = max_events;
+	entry->coalesce_cycles = us_to_ticks(max_us);
 }
 
 void ptdev_init(void)
 {
+	uint32_t i;
+
 	if (get_cpu_id() != BOOT_CPU_ID) {
 		return;
 	}
 
 	spinlock_init(&ptdev_lock);
+	for (i = 0U; i < PTIRQ_HASH_SIZE; i++) {
+		INIT_LIST_HEAD(&ptirq_phys_htable[i]);
+		INIT_LIST_HEAD(&ptirq_virt_htable[i]);
+	}
 	register_softirq(SOFTIRQ_PTDEV, ptirq_softirq);
 }
 
@@ -237,3 +482,14 @@ uint32_t ptirq_get_intr_data(const struct acrn_vm *target_vm, uint64_t *buffer,
 
 	return index;
 }
+
+void ptirq_reset_telemetry(const struct acrn_vm *target_vm)
+{
+	uint16_t i;
+
+	for (i = 0U; i < CONFIG_MAX_PT_IRQ_ENTRIES; i++) {
+		if (ptirq_entries[i].vm == target_vm) {
+			ptirq_entries[i].telemetry_slot = 0U;
+		}
+	}
+}
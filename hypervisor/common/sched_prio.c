@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <hypervisor.h>
+#include <schedule.h>
+
+/*
+ * Fixed priority policy: the runqueue is kept sorted by decreasing
+ * priority, a higher priority vCPU preempts as soon as it is runnable,
+ * and vCPUs of the same priority round-robin every CONFIG_SCHED_SLICE_MS.
+ */
+
+static void prio_insert(struct sched_context *ctx, struct acrn_vcpu *vcpu)
+{
+	struct list_head *pos;
+	struct acrn_vcpu *tmp;
+
+	/* behind all the vCPUs of the same or a higher priority */
+	list_for_each(pos, &ctx->runqueue) {
+		tmp = list_entry(pos, struct acrn_vcpu, run_list);
+		if (tmp->sched.prio < vcpu->sched.prio) {
+			break;
+		}
+	}
+
+	list_add_tail(&vcpu->run_list, pos);
+}
+
+static struct acrn_vcpu *prio_pick_next(struct sched_context *ctx)
+{
+	struct acrn_vcpu *vcpu = NULL;
+
+	if (!list_empty(&ctx->runqueue)) {
+		vcpu = get_first_item(&ctx->runqueue, struct acrn_vcpu, run_list);
+	}
+
+	return vcpu;
+}
+
+static bool prio_slice_expired(struct sched_context *ctx)
+{
+	struct acrn_vcpu *curr = ctx->curr_vcpu;
+	struct acrn_vcpu *next;
+	bool ret = false;
+
+	if ((curr != NULL) && !list_empty(&curr->run_list) &&
+			(curr->run_list.next != &ctx->runqueue)) {
+		next = list_entry(curr->run_list.next, struct acrn_vcpu, run_list);
+		if (next->sched.prio == curr->sched.prio) {
+			/* requeue behind its peers, a lower priority never preempts */
+			list_del_init(&curr->run_list);
+			prio_insert(ctx, curr);
+			ret = true;
+		}
+	}
+
+	return ret;
+}
+
+static void prio_boost(struct sched_context *ctx, struct acrn_vcpu *vcpu)
+{
+	struct acrn_vcpu *curr = ctx->curr_vcpu;
+	struct list_head *pos;
+	struct acrn_vcpu *tmp;
+
+	list_del_init(&vcpu->run_list);
+	if ((curr != NULL) && !list_empty(&curr->run_list) &&
+			(curr->sched.prio == vcpu->sched.prio)) {
+		/* the running vCPU heads its priority, take its slice next */
+		list_add(&vcpu->run_list, &curr->run_list);
+	} else {
+		/* ahead of all the vCPUs of the same or a lower priority */
+		list_for_each(pos, &ctx->runqueue) {
+			tmp = list_entry(pos, struct acrn_vcpu, run_list);
+			if (tmp->sched.prio <= vcpu->sched.prio) {
+				break;
+			}
+		}
+		list_add_tail(&vcpu->run_list, pos);
+	}
+}
+
+const struct acrn_scheduler sched_prio = {
+	.name = "prio",
+	.insert = prio_insert,
+	.pick_next = prio_pick_next,
+	.slice_expired = prio_slice_expired,
+	.boost = prio_boost,
+};
@@ -6,13 +6,81 @@
 
 #include <hypervisor.h>
 #include <schedule.h>
+#include <softirq.h>
 
 static uint64_t pcpu_used_bitmap;
 
+#ifdef CONFIG_SCHED_PRIO
+static const struct acrn_scheduler *scheduler = &sched_prio;
+#else
+static const struct acrn_scheduler *scheduler = &sched_fifo;
+#endif
+
+#if defined(CONFIG_IDLE_MWAIT)
+#define IDLE_POLICY_DEFAULT	IDLE_POLICY_MWAIT
+#elif defined(CONFIG_IDLE_ADAPTIVE)
+#define IDLE_POLICY_DEFAULT	IDLE_POLICY_ADAPTIVE
+#else
+#define IDLE_POLICY_DEFAULT	IDLE_POLICY_POLL
+#endif
+
+/*
+ * Adaptive idle spins for twice the average idle period, and not at all
+ * once that is longer than IDLE_POLL_MAX_US: waking up from MWAIT costs
+ * less than that then.
+ */
+#define IDLE_POLL_MAX_US	100U
+/* the average idle period follows the last 8 ones */
+#define IDLE_AVG_SHIFT		3U
+
+static const char *idle_policy_names[NR_IDLE_POLICIES] = {
+	[IDLE_POLICY_POLL] = "poll",
+	[IDLE_POLICY_MWAIT] = "mwait",
+	[IDLE_POLICY_ADAPTIVE] = "adaptive",
+};
+
+/* XCR0 components restored on a vCPU switch, 0 if XSAVE is unavailable */
+static uint64_t xsave_mask;
+static bool xsaveopt_supported;
+/* the save areas are in the compacted format of XSAVES */
+static bool xsaves_supported;
+
+/* XCR0 bits of the components SSE instructions use whatever XCR0 is */
+#define XCR0_LEGACY_MASK	0x3UL
+
+/* legacy region and XSAVE header, then the extended components */
+#define XSAVE_EXT_OFFSET	576U
+/* the format bit in the last byte of XCOMP_BV, in the XSAVE header */
+#define XSAVE_XCOMP_BV_HI	527U
+
+/*
+ * Size of a compacted XSAVE area with the components of mask. Only the
+ * ones in use take room there, one after another.
+ */
+static uint32_t xsave_compacted_size(uint64_t mask)
+{
+	uint32_t eax, ebx, ecx, edx, i;
+	uint32_t size = XSAVE_EXT_OFFSET;
+
+	for (i = 2U; i < 63U; i++) {
+		if ((mask & (1UL << i)) != 0UL) {
+			cpuid_subleaf(CPUID_XSAVE_FEATURES, i, &eax, &ebx, &ecx, &edx);
+			if ((ecx & CPUID_ECX_XSTATE_ALIGN64) != 0U) {
+				size = (size + 63U) & ~63U;
+			}
+			size += eax;
+		}
+	}
+
+	return size;
+}
+
 void init_scheduler(void)
 {
 	struct sched_context *ctx;
 	uint32_t i;
+	uint32_t eax, ebx, ecx, edx, std_size;
+	uint64_t mask;
 
 	for (i = 0U; i < phys_cpu_num; i++) {
 		ctx = &per_cpu(sched_ctx, i);
@@ -22,7 +90,42 @@ void init_scheduler(void)
 		INIT_LIST_HEAD(&ctx->runqueue);
 		ctx->flags = 0UL;
 		ctx->curr_vcpu = NULL;
+		ctx->scheduler = scheduler;
+		ctx->nr_vcpus = 0U;
+		ctx->vmcs_vcpu = NULL;
+		ctx->fpu_vcpu = NULL;
+		ctx->vpmu_vcpu = NULL;
+		ctx->slice_timer_armed = false;
+		ctx->idle_avg = 0UL;
+		if (set_idle_policy(i, IDLE_POLICY_DEFAULT, CONFIG_IDLE_MWAIT_HINT) != 0) {
+			(void)set_idle_policy(i, IDLE_POLICY_POLL, 0U);
+		}
+	}
+
+	if ((IDLE_POLICY_DEFAULT != IDLE_POLICY_POLL) && !is_mwait_supported()) {
+		pr_err("No usable MWAIT, idle pCPUs poll");
+	}
+
+	if (cpu_has_cap(X86_FEATURE_XSAVE)) {
+		cpuid_subleaf(CPUID_XSAVE_FEATURES, 0U, &eax, &ebx, &ecx, &edx);
+		mask = ((uint64_t)edx << 32U) | (uint64_t)eax;
+		std_size = ecx;
+		cpuid_subleaf(CPUID_XSAVE_FEATURES, 1U, &eax, &ebx, &ecx, &edx);
+
+		/* IA32_XSS stays 0, XSAVES only handles the user components */
+		if (((eax & CPUID_EAX_XSAVES) != 0U) &&
+				(xsave_compacted_size(mask) <= SCHED_XSAVE_AREA_SIZE)) {
+			xsave_mask = mask;
+			xsaves_supported = true;
+		} else if (std_size <= SCHED_XSAVE_AREA_SIZE) {
+			xsave_mask = mask;
+			xsaveopt_supported = ((eax & CPUID_EAX_XSAVEOPT) != 0U);
+		} else {
+			pr_err("XSAVE area of %u bytes, vCPU switches only keep SSE state", std_size);
+		}
 	}
+
+	pr_info("vCPU scheduler: %s", scheduler->name);
 }
 
 void get_schedule_lock(uint16_t pcpu_id)
@@ -52,12 +155,101 @@ uint16_t allocate_pcpu(void)
 
 void set_pcpu_used(uint16_t pcpu_id)
 {
+	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+
+	spinlock_obtain(&ctx->runqueue_lock);
+	ctx->nr_vcpus++;
+	spinlock_release(&ctx->runqueue_lock);
 	bitmap_set_lock(pcpu_id, &pcpu_used_bitmap);
 }
 
 void free_pcpu(uint16_t pcpu_id)
 {
-	bitmap_clear_lock(pcpu_id, &pcpu_used_bitmap);
+	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+	bool last;
+
+	spinlock_obtain(&ctx->runqueue_lock);
+	if (ctx->nr_vcpus > 0U) {
+		ctx->nr_vcpus--;
+	}
+	last = (ctx->nr_vcpus == 0U);
+	spinlock_release(&ctx->runqueue_lock);
+
+	if (last) {
+		bitmap_clear_lock(pcpu_id, &pcpu_used_bitmap);
+	}
+}
+
+/*
+ * Several vCPUs may share a pCPU only if the scheduler time slices
+ * between them.
+ */
+bool is_vcpu_overcommit_supported(void)
+{
+	return (scheduler->slice_expired != NULL);
+}
+
+bool can_share_pcpu(uint16_t pcpu_id)
+{
+	return (is_vcpu_overcommit_supported() && (pcpu_id < phys_cpu_num) &&
+		bitmap_test(pcpu_id, &pcpu_used_bitmap));
+}
+
+/* Account the time since the vCPU became runnable without its pCPU */
+static void account_steal_time(struct sched_vcpu *sched)
+{
+	if (sched->ready_tsc != 0UL) {
+		sched->steal_time += rdtsc() - sched->ready_tsc;
+		sched->ready_tsc = 0UL;
+	}
+}
+
+/* the guest counts in cycles of its own TSC */
+static void update_steal_page(struct acrn_vcpu *vcpu)
+{
+	struct sched_vcpu *sched = &vcpu->sched;
+	struct acrn_steal_time *st = sched->steal_page;
+
+	if (st != NULL) {
+		stac();
+		st->version++;
+		cpu_write_memory_barrier();
+		st->steal = vm_scale_tsc(vcpu->vm, sched->steal_time);
+		st->dm_wait = vm_scale_tsc(vcpu->vm, sched->dm_wait);
+		cpu_write_memory_barrier();
+		st->version++;
+		clac();
+	}
+}
+
+/**
+ * @pre vcpu != NULL
+ */
+int32_t set_steal_time_msr(struct acrn_vcpu *vcpu, uint64_t val)
+{
+	struct sched_vcpu *sched = &vcpu->sched;
+	uint64_t gpa = val & ~(sizeof(struct acrn_steal_time) - 1UL);
+	uint64_t hpa;
+	int32_t ret = 0;
+
+	if ((val & ACRN_STEAL_TIME_RSVD_MASK) != 0UL) {
+		ret = -EINVAL;
+	} else if ((val & ACRN_STEAL_TIME_ENABLE) == 0UL) {
+		sched->steal_page = NULL;
+		sched->steal_msr = val;
+	} else {
+		/* aligned on its size, the page never crosses a guest page */
+		hpa = gpa2hpa(vcpu->vm, gpa);
+		if (hpa == INVALID_HPA) {
+			ret = -EINVAL;
+		} else {
+			sched->steal_page = (struct acrn_steal_time *)hpa2hva(hpa);
+			sched->steal_msr = val;
+			update_steal_page(vcpu);
+		}
+	}
+
+	return ret;
 }
 
 void add_vcpu_to_runqueue(struct acrn_vcpu *vcpu)
@@ -67,7 +259,10 @@ void add_vcpu_to_runqueue(struct acrn_vcpu *vcpu)
 
 	spinlock_obtain(&ctx->runqueue_lock);
 	if (list_empty(&vcpu->run_list)) {
-		list_add_tail(&vcpu->run_list, &ctx->runqueue);
+		ctx->scheduler->insert(ctx, vcpu);
+		if (ctx->curr_vcpu != vcpu) {
+			vcpu->sched.ready_tsc = rdtsc();
+		}
 	}
 	spinlock_release(&ctx->runqueue_lock);
 }
@@ -79,23 +274,144 @@ void remove_vcpu_from_runqueue(struct acrn_vcpu *vcpu)
 
 	spinlock_obtain(&ctx->runqueue_lock);
 	list_del_init(&vcpu->run_list);
+	account_steal_time(&vcpu->sched);
 	spinlock_release(&ctx->runqueue_lock);
 }
 
 static struct acrn_vcpu *select_next_vcpu(uint16_t pcpu_id)
 {
 	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
-	struct acrn_vcpu *vcpu = NULL;
+	struct acrn_vcpu *vcpu;
+
+	spinlock_obtain(&ctx->runqueue_lock);
+	vcpu = ctx->scheduler->pick_next(ctx);
+	spinlock_release(&ctx->runqueue_lock);
+
+	return vcpu;
+}
+
+static void expire_slice(struct sched_context *ctx)
+{
+	bool expired;
+
+	spinlock_obtain(&ctx->runqueue_lock);
+	expired = ctx->scheduler->slice_expired(ctx);
+	spinlock_release(&ctx->runqueue_lock);
+
+	if (expired) {
+		bitmap_set_lock(NEED_RESCHEDULE, &ctx->flags);
+	}
+}
+
+static void slice_timer_fn(void *data)
+{
+	expire_slice((struct sched_context *)data);
+}
+
+/*
+ * The vCPU of the same VM that waits for its pCPU the longest, likely a
+ * lock holder preempted while the others spin on the lock. NULL if none.
+ * This is only a hint, boost_vcpu() checks it again under the lock.
+ */
+static struct acrn_vcpu *find_yield_target(const struct acrn_vcpu *vcpu)
+{
+	struct acrn_vcpu *tmp, *target = NULL;
+	uint64_t ready_tsc, oldest = ~0UL;
+	uint16_t i;
+
+	foreach_vcpu(i, vcpu->vm, tmp) {
+		ready_tsc = tmp->sched.ready_tsc;
+		if ((tmp != vcpu) && (ready_tsc != 0UL) && (ready_tsc < oldest)) {
+			oldest = ready_tsc;
+			target = tmp;
+		}
+	}
+
+	return target;
+}
+
+/* Switch the pCPU of a preempted vCPU to it, unless a higher priority runs */
+static void boost_vcpu(struct acrn_vcpu *vcpu)
+{
+	struct sched_context *ctx = &per_cpu(sched_ctx, vcpu->pcpu_id);
+	bool expired = false;
 
 	spinlock_obtain(&ctx->runqueue_lock);
+	/* it may have been switched in or have halted meanwhile */
+	if ((ctx->curr_vcpu != vcpu) && !list_empty(&vcpu->run_list)) {
+		ctx->scheduler->boost(ctx, vcpu);
+		expired = ctx->scheduler->slice_expired(ctx);
+	}
+	spinlock_release(&ctx->runqueue_lock);
+
+	if (expired) {
+		make_reschedule_request(vcpu);
+	}
+}
+
+/*
+ * Give up the rest of the time slice on a PAUSE-loop exit. A preempted
+ * sibling vCPU gets its pCPU first, as it may hold the lock this one
+ * spins on; otherwise any other runnable vCPU of the same priority
+ * waiting on the pCPU takes it.
+ */
+void yield_vcpu(struct acrn_vcpu *vcpu)
+{
+	struct sched_context *ctx = &per_cpu(sched_ctx, vcpu->pcpu_id);
+	struct acrn_vcpu *target;
+
+	if ((ctx->scheduler->slice_expired != NULL) && (ctx->curr_vcpu == vcpu)) {
+		target = find_yield_target(vcpu);
+		if (target != NULL) {
+			boost_vcpu(target);
+		}
+
+		/* boosting a vCPU of this pCPU already ended the slice */
+		if ((target == NULL) || (target->pcpu_id != vcpu->pcpu_id)) {
+			expire_slice(ctx);
+		}
+	}
+}
+
+/* the timer list is per pCPU, so arm it from the pCPU itself */
+static void arm_slice_timer(struct sched_context *ctx)
+{
+	uint64_t period = us_to_ticks(CONFIG_SCHED_SLICE_MS * 1000U);
+
+	if ((ctx->scheduler->slice_expired != NULL) && !ctx->slice_timer_armed) {
+		initialize_timer(&ctx->slice_timer, slice_timer_fn, ctx,
+				rdtsc() + period, TICK_MODE_PERIODIC, period);
+		if (add_timer(&ctx->slice_timer) == 0) {
+			ctx->slice_timer_armed = true;
+		}
+	}
+}
+
+/* The FIFO policy: the first runnable vCPU owns the pCPU */
+static void fifo_insert(struct sched_context *ctx, struct acrn_vcpu *vcpu)
+{
+	list_add_tail(&vcpu->run_list, &ctx->runqueue);
+}
+
+static struct acrn_vcpu *fifo_pick_next(struct sched_context *ctx)
+{
+	struct acrn_vcpu *vcpu = NULL;
+
 	if (!list_empty(&ctx->runqueue)) {
 		vcpu = get_first_item(&ctx->runqueue, struct acrn_vcpu, run_list);
 	}
-	spinlock_release(&ctx->runqueue_lock);
 
 	return vcpu;
 }
 
+const struct acrn_scheduler sched_fifo = {
+	.name = "fifo",
+	.insert = fifo_insert,
+	.pick_next = fifo_pick_next,
+	.slice_expired = NULL,
+	.boost = NULL,
+};
+
 void make_reschedule_request(const struct acrn_vcpu *vcpu)
 {
 	struct sched_context *ctx = &per_cpu(sched_ctx, vcpu->pcpu_id);
@@ -113,41 +429,210 @@ int32_t need_reschedule(uint16_t pcpu_id)
 	return bitmap_test_and_clear_lock(NEED_RESCHEDULE, &ctx->flags);
 }
 
+static inline void xsave_vcpu(struct sched_vcpu *sched)
+{
+	uint64_t xcr0 = read_xcr(0);
+
+	/*
+	 * Only the components enabled by the guest can differ from what was
+	 * restored, plus the SSE registers which are usable whatever the
+	 * XCR0 of the guest is. XSAVEOPT and XSAVES further skip the ones
+	 * still in their init state or not modified since the XRSTOR of the
+	 * switch in, so a vCPU that never touches AVX does not pay for it.
+	 * The compacted format of XSAVES also packs what is saved, instead
+	 * of spreading it at the fixed offsets of every supported component.
+	 */
+	sched->xcr0 = xcr0;
+	if ((xcr0 & XCR0_LEGACY_MASK) != XCR0_LEGACY_MASK) {
+		write_xcr(0, xcr0 | XCR0_LEGACY_MASK);
+	}
+
+	if (xsaves_supported) {
+		asm volatile("xsaves64 (%0)"
+				: : "r" (sched->xsave_area), "a" (0xFFFFFFFFU), "d" (0xFFFFFFFFU)
+				: "memory");
+	} else if (xsaveopt_supported) {
+		asm volatile("xsaveopt64 (%0)"
+				: : "r" (sched->xsave_area), "a" (0xFFFFFFFFU), "d" (0xFFFFFFFFU)
+				: "memory");
+	} else {
+		asm volatile("xsave64 (%0)"
+				: : "r" (sched->xsave_area), "a" (0xFFFFFFFFU), "d" (0xFFFFFFFFU)
+				: "memory");
+	}
+}
+
+static inline void xrstor_vcpu(const struct sched_vcpu *sched)
+{
+	/*
+	 * Restore with every component enabled so that the ones the vCPU
+	 * never used are put in their init state rather than leaked from
+	 * the previous owner of the pCPU. The init ones are cheap, XRSTOR
+	 * does not read their save area.
+	 */
+	if (read_xcr(0) != xsave_mask) {
+		write_xcr(0, xsave_mask);
+	}
+	if (xsaves_supported) {
+		asm volatile("xrstors64 (%0)"
+				: : "r" (sched->xsave_area), "a" (0xFFFFFFFFU), "d" (0xFFFFFFFFU)
+				: "memory");
+	} else {
+		asm volatile("xrstor64 (%0)"
+				: : "r" (sched->xsave_area), "a" (0xFFFFFFFFU), "d" (0xFFFFFFFFU)
+				: "memory");
+	}
+	if (sched->xcr0 != xsave_mask) {
+		write_xcr(0, sched->xcr0);
+	}
+}
+
+static void init_vcpu_fpu_state(struct sched_vcpu *sched)
+{
+	/* legacy region with the reset MXCSR, XSTATE_BV = 0: all in init state */
+	(void)memset((void *)sched->xsave_area, 0U, sizeof(sched->xsave_area));
+	sched->xsave_area[24] = 0x80U;
+	sched->xsave_area[25] = 0x1FU;
+	if (xsaves_supported) {
+		/* XRSTORS wants the compacted format, with no component saved */
+		sched->xsave_area[XSAVE_XCOMP_BV_HI] = 0x80U;
+	}
+	sched->xcr0 = 1UL;
+	sched->xsave_valid = true;
+}
+
+/*
+ * Guests own the FPU/SSE/AVX registers, XCR0 and the pass-through MSRs
+ * while they run, so the state has to follow the vCPU when a pCPU is
+ * shared. Idle does not touch it, hence the switch is deferred until
+ * another vCPU is switched in.
+ */
+static void switch_lazy_state(struct sched_context *ctx, struct acrn_vcpu *next)
+{
+	struct acrn_vcpu *prev = ctx->fpu_vcpu;
+
+	if (prev != next) {
+		if (prev != NULL) {
+			if (xsave_mask != 0UL) {
+				xsave_vcpu(&prev->sched);
+			} else {
+				asm volatile("fxsave64 (%0)" : : "r" (prev->sched.xsave_area) : "memory");
+			}
+			save_passthru_msrs(prev);
+			prev->sched.xsave_valid = true;
+		}
+
+		if (!next->sched.xsave_valid) {
+			init_vcpu_fpu_state(&next->sched);
+			(void)memset((void *)next->arch.passthru_msrs, 0U, sizeof(next->arch.passthru_msrs));
+		}
+
+		if (xsave_mask != 0UL) {
+			xrstor_vcpu(&next->sched);
+		} else {
+			asm volatile("fxrstor64 (%0)" : : "r" (next->sched.xsave_area));
+		}
+		load_passthru_msrs(next);
+		ctx->fpu_vcpu = next;
+	}
+}
+
+/*
+ * Keep the average of the periods the pCPU spends idle, the adaptive
+ * idle policy tells apart short and long ones with it.
+ */
+static void account_idle_period(struct sched_context *ctx)
+{
+	uint64_t period = rdtsc() - ctx->idle_start;
+
+	ctx->idle_avg = ctx->idle_avg - (ctx->idle_avg >> IDLE_AVG_SHIFT) + (period >> IDLE_AVG_SHIFT);
+}
+
 static void context_switch_out(struct acrn_vcpu *vcpu)
 {
-	/* if it's idle thread, no action for switch out */
+	/* if it's idle thread, only its accounting for switch out */
 	if (vcpu == NULL) {
+		account_idle_period(&get_cpu_var(sched_ctx));
 		return;
 	}
 
 	/* cancel event(int, gp, nmi and exception) injection */
 	cancel_event_injection(vcpu);
 
+	vcpu->sched.runtime += rdtsc() - vcpu->sched.start_tsc;
+	/* preempted, it waits for the pCPU from now on */
+	if (!list_empty(&vcpu->run_list)) {
+		vcpu->sched.ready_tsc = rdtsc();
+		/* device interrupts posted meanwhile are seen at switch in */
+		if (is_apicv_posted_intr_supported()) {
+			(void)apicv_set_pir_notification(vcpu, VECTOR_POSTED_INTR, true);
+		}
+	} else if (is_apicv_posted_intr_supported()) {
+		/*
+		 * Halted or paused: device interrupts have to wake it up, with
+		 * a vector the vCPU running on this pCPU in non-root mode does
+		 * not take as its own notification. One that was posted before
+		 * is handled in softirq, this runs under the schedule lock.
+		 */
+		if (apicv_set_pir_notification(vcpu, VECTOR_POSTED_INTR_WAKEUP, false)) {
+			fire_softirq(SOFTIRQ_POSTED_INTR);
+		}
+	} else {
+		/* no posted interrupts */
+	}
+
 	atomic_store32(&vcpu->running, 0U);
-	/* do prev vcpu context switch out */
-	/* For now, we don't need to invalid ept.
-	 * But if we have more than one vcpu on one pcpu,
-	 * we need add ept invalid operation here.
+	/* TLB entries are tagged with VPID and EPTP, so vCPUs sharing
+	 * a pCPU need no flush here.
 	 */
 }
 
 static void context_switch_in(struct acrn_vcpu *vcpu)
 {
+	struct sched_context *ctx = &get_cpu_var(sched_ctx);
+	uint64_t vmcs_pa;
+
 	/* update current_vcpu */
-	get_cpu_var(sched_ctx).curr_vcpu = vcpu;
+	ctx->curr_vcpu = vcpu;
 
-	/* if it's idle thread, no action for switch out */
+	/* if it's idle thread, no action for switch in but accounting */
 	if (vcpu == NULL) {
+		ctx->idle_start = rdtsc();
 		return;
 	}
 
-	atomic_store32(&vcpu->running, 1U);
-	/* FIXME:
-	 * Now, we don't need to load new vcpu VMCS because
-	 * we only do switch between vcpu loop and idle loop.
-	 * If we have more than one vcpu on on pcpu, need to
-	 * add VMCS load operation here.
-	 */
+	if (ctx->vmcs_vcpu != vcpu) {
+		/* a not launched vCPU loads its VMCS in init_vmcs() */
+		if (vcpu->launched) {
+			vmcs_pa = hva2hpa(vcpu->arch.vmcs);
+			exec_vmptrld((void *)&vmcs_pa);
+
+			/* avoid VMCS recycling RSB usage, as on VM launch */
+			if (ibrs_type == IBRS_RAW) {
+				msr_write(MSR_IA32_PRED_CMD, PRED_SET_IBPB);
+			}
+		}
+		ctx->vmcs_vcpu = vcpu;
+		get_cpu_var(vcpu) = vcpu;
+		get_cpu_var(ever_run_vcpu) = vcpu;
+	}
+
+	switch_lazy_state(ctx, vcpu);
+
+	account_steal_time(&vcpu->sched);
+	update_steal_page(vcpu);
+
+	vcpu->sched.start_tsc = rdtsc();
+	vcpu->sched.nr_switches++;
+
+	/* let the IOMMU notify it directly, and take what was posted meanwhile */
+	if (is_apicv_posted_intr_supported() &&
+		apicv_set_pir_notification(vcpu, VECTOR_POSTED_INTR, false)) {
+		bitmap_set_lock(ACRN_REQUEST_EVENT, &vcpu->arch.pending_req);
+	}
+
+	/* full barrier, see the posted interrupt path of vlapic */
+	(void)atomic_swap32(&vcpu->running, 1U);
 }
 
 void make_pcpu_offline(uint16_t pcpu_id)
@@ -167,19 +652,93 @@ int32_t need_offline(uint16_t pcpu_id)
 	return bitmap_test_and_clear_lock(NEED_OFFLINE, &ctx->flags);
 }
 
+/**
+ * @pre pcpu_id < phys_cpu_num
+ */
+int32_t set_idle_policy(uint16_t pcpu_id, uint32_t policy, uint32_t mwait_hint)
+{
+	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+	int32_t ret = 0;
+
+	if (policy >= NR_IDLE_POLICIES) {
+		ret = -EINVAL;
+	} else if ((policy != IDLE_POLICY_POLL) && !is_mwait_supported()) {
+		ret = -ENODEV;
+	} else {
+		/* taken by the idle loop on its next round */
+		ctx->mwait_hint = get_mwait_hint(mwait_hint);
+		ctx->idle_policy = policy;
+	}
+
+	return ret;
+}
+
+const char *get_idle_policy_name(uint32_t policy)
+{
+	return (policy < NR_IDLE_POLICIES) ? idle_policy_names[policy] : "unknown";
+}
+
+/*
+ * Called with interrupts enabled. The last check for work is made with
+ * them masked and the reschedule flags monitored, so that a request or
+ * an interrupt arriving before MWAIT ends the wait right away.
+ */
+static void mwait_idle(struct sched_context *ctx, uint16_t pcpu_id)
+{
+	CPU_IRQ_DISABLE();
+	cpu_monitor(&ctx->flags);
+	if ((ctx->flags == 0UL) && (per_cpu(softirq_pending, pcpu_id) == 0UL) &&
+			!is_ioreq_polled(pcpu_id)) {
+		cpu_mwait(ctx->mwait_hint);
+	}
+	CPU_IRQ_ENABLE();
+}
+
+static void idle_wait(struct sched_context *ctx, uint16_t pcpu_id)
+{
+	uint64_t max_poll, poll_window;
+	bool sleep;
+
+	switch (ctx->idle_policy) {
+	case IDLE_POLICY_MWAIT:
+		sleep = true;
+		break;
+	case IDLE_POLICY_ADAPTIVE:
+		max_poll = us_to_ticks(IDLE_POLL_MAX_US);
+		poll_window = (ctx->idle_avg < max_poll) ? (ctx->idle_avg << 1U) : 0UL;
+		sleep = ((rdtsc() - ctx->idle_start) >= poll_window);
+		break;
+	default:
+		sleep = false;
+		break;
+	}
+
+	if (sleep) {
+		mwait_idle(ctx, pcpu_id);
+	} else {
+		cpu_do_idle();
+	}
+}
+
 void default_idle(void)
 {
 	uint16_t pcpu_id = get_cpu_id();
+	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
 
 	while (1) {
 		if (need_reschedule(pcpu_id) != 0) {
+			/* don't leave work behind when a vCPU takes the pCPU */
+			run_deferred_work(pcpu_id);
 			schedule();
 		} else if (need_offline(pcpu_id) != 0) {
 			cpu_dead(pcpu_id);
 		} else {
 			CPU_IRQ_ENABLE();
+			/* timers may wake a halted vCPU of this pCPU */
+			do_softirq();
 			handle_complete_ioreq(pcpu_id);
-			cpu_do_idle();
+			run_deferred_work(pcpu_id);
+			idle_wait(ctx, pcpu_id);
 			CPU_IRQ_DISABLE();
 		}
 	}
@@ -229,6 +788,7 @@ void schedule(void)
 	struct acrn_vcpu *prev = per_cpu(sched_ctx, pcpu_id).curr_vcpu;
 
 	get_schedule_lock(pcpu_id);
+	arm_slice_timer(&per_cpu(sched_ctx, pcpu_id));
 	next = select_next_vcpu(pcpu_id);
 
 	if (prev == next) {
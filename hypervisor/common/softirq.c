@@ -36,10 +36,15 @@ void do_softirq(void)
 	volatile uint64_t *softirq_pending_bitmap =
 			&per_cpu(softirq_pending, cpu_id);
 	uint16_t nr = ffs64(*softirq_pending_bitmap);
+	uint64_t start, cycles;
 
 	while (nr < NR_SOFTIRQS) {
 		bitmap_clear_lock(nr, softirq_pending_bitmap);
+		start = rdtsc();
 		(*softirq_handlers[nr])(cpu_id);
+		cycles = rdtsc() - start;
+		softirq_stats_record(cpu_id, nr, cycles);
+		TRACE_2L(TRACE_SOFTIRQ, (uint64_t)nr, cycles);
 		nr = ffs64(*softirq_pending_bitmap);
 	}
 }
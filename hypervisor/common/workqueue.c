@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <hypervisor.h>
+
+void init_work_queues(void)
+{
+	struct work_queue *wq;
+	uint16_t i;
+
+	for (i = 0U; i < phys_cpu_num; i++) {
+		wq = &per_cpu(work_queue, i);
+		spinlock_init(&wq->lock);
+		INIT_LIST_HEAD(&wq->list);
+	}
+}
+
+int32_t queue_work_on(uint16_t pcpu_id, struct work_item *work)
+{
+	struct work_queue *wq = &per_cpu(work_queue, pcpu_id);
+	int32_t ret = 0;
+
+	spinlock_obtain(&wq->lock);
+	if (list_empty(&work->node)) {
+		work->pcpu_id = pcpu_id;
+		list_add_tail(&work->node, &wq->list);
+	} else {
+		ret = -EBUSY;
+	}
+	spinlock_release(&wq->lock);
+
+	/* an idle pCPU may be waiting in MWAIT */
+	if ((ret == 0) && (pcpu_id != get_cpu_id())) {
+		send_single_ipi(pcpu_id, VECTOR_NOTIFY_VCPU);
+	}
+
+	return ret;
+}
+
+bool work_pending(const struct work_item *work)
+{
+	return !list_empty(&work->node);
+}
+
+void run_deferred_work(uint16_t pcpu_id)
+{
+	struct work_queue *wq = &per_cpu(work_queue, pcpu_id);
+	struct work_item *work;
+
+	spinlock_obtain(&wq->lock);
+	while (!list_empty(&wq->list)) {
+		work = list_entry(wq->list.next, struct work_item, node);
+		/* keep it pending while func() runs, so it can't be queued twice */
+		list_del(&work->node);
+		spinlock_release(&wq->lock);
+
+		work->func(work);
+
+		spinlock_obtain(&wq->lock);
+		INIT_LIST_HEAD(&work->node);
+	}
+	spinlock_release(&wq->lock);
+}
@@ -11,6 +11,115 @@ struct hv_timer console_timer;
 
 #define CONSOLE_KICK_TIMER_TIMEOUT  40UL /* timeout is 40ms*/
 
+/* Per pCPU staging of the log output, a power of 2 */
+#define CONSOLE_RING_SIZE	2048U
+/* Bytes written per console tick, about what 115200 baud sends in 40ms */
+#define CONSOLE_DRAIN_MAX	512U
+
+/*
+ * Log messages of one pCPU waiting for the console pCPU to write them.
+ * head and tail run freely; only the owner pCPU moves tail and only the
+ * console timer moves head, so no lock is needed.
+ */
+struct console_ring {
+	char buf[CONSOLE_RING_SIZE];
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	/* Messages dropped because the ring was full, since last reported */
+	uint32_t dropped;
+};
+
+static struct console_ring console_rings[CONFIG_MAX_PCPU_NUM];
+/* Set while the console timer drains the rings */
+static bool console_staging;
+static uint16_t console_next_pcpu;
+
+static void console_ring_copy(struct console_ring *ring, uint32_t pos, const char *s, uint32_t len)
+{
+	uint32_t off = pos & (CONSOLE_RING_SIZE - 1U);
+	uint32_t first = CONSOLE_RING_SIZE - off;
+
+	if (len <= first) {
+		(void)memcpy_s(&ring->buf[off], first, s, len);
+	} else {
+		(void)memcpy_s(&ring->buf[off], first, s, first);
+		(void)memcpy_s(&ring->buf[0], off, s + first, len - first);
+	}
+}
+
+bool console_stage_msg(const char *msg, size_t len)
+{
+	struct console_ring *ring;
+	uint64_t rflags;
+	uint32_t tail;
+	bool staged = console_staging;
+
+	if (staged && (len != 0U)) {
+		/* Messages logged from interrupt handlers go on the same ring */
+		CPU_INT_ALL_DISABLE(&rflags);
+		ring = &console_rings[get_cpu_id()];
+		tail = ring->tail;
+		if ((len + 2U) > (CONSOLE_RING_SIZE - (tail - ring->head))) {
+			atomic_inc32(&ring->dropped);
+		} else {
+			console_ring_copy(ring, tail, msg, (uint32_t)len);
+			console_ring_copy(ring, tail + (uint32_t)len, "\n\r", 2U);
+			/* The bytes before the new tail */
+			cpu_write_memory_barrier();
+			ring->tail = tail + (uint32_t)len + 2U;
+		}
+		CPU_INT_ALL_RESTORE(rflags);
+	}
+
+	return staged;
+}
+
+/* Write up to budget bytes of the staged messages, pCPUs in turn */
+static void console_drain(uint32_t budget_arg)
+{
+	struct console_ring *ring;
+	uint32_t budget = budget_arg;
+	uint32_t head, tail, off, chunk, dropped;
+	uint16_t i, pcpu_id;
+	char notice[48];
+
+	for (i = 0U; (i < phys_cpu_num) && (budget != 0U); i++) {
+		pcpu_id = (console_next_pcpu + i) % phys_cpu_num;
+		ring = &console_rings[pcpu_id];
+
+		dropped = atomic_readandclear32(&ring->dropped);
+		if (dropped != 0U) {
+			snprintf(notice, sizeof(notice), "[cpu=%hu] %u log messages dropped\n\r",
+				pcpu_id, dropped);
+			(void)console_write(notice, strnlen_s(notice, sizeof(notice)));
+		}
+
+		head = ring->head;
+		tail = ring->tail;
+		while ((head != tail) && (budget != 0U)) {
+			off = head & (CONSOLE_RING_SIZE - 1U);
+			chunk = tail - head;
+			if (chunk > (CONSOLE_RING_SIZE - off)) {
+				chunk = CONSOLE_RING_SIZE - off;
+			}
+			if (chunk > budget) {
+				chunk = budget;
+			}
+			(void)console_write(&ring->buf[off], chunk);
+			head += chunk;
+			budget -= chunk;
+		}
+		/* The bytes are written out before the owner may reuse them */
+		cpu_write_memory_barrier();
+		ring->head = head;
+	}
+
+	/* Another pCPU goes first on the next tick */
+	if (phys_cpu_num != 0U) {
+		console_next_pcpu = (console_next_pcpu + 1U) % phys_cpu_num;
+	}
+}
+
 void console_init(void)
 {
 	uart16550_init();
@@ -36,6 +145,8 @@ static void console_timer_callback(__unused void *data)
 {
 	struct acrn_vuart *vu;
 
+	console_drain(CONSOLE_DRAIN_MAX);
+
 	/* Kick HV-Shell and Uart-Console tasks */
 	vu = vuart_console_active();
 	if (vu != NULL) {
@@ -52,6 +163,8 @@ void console_setup_timer(void)
 {
 	uint64_t period_in_cycle, fire_tsc;
 
+	console_staging = true;
+
 	period_in_cycle = CYCLES_PER_MS * CONSOLE_KICK_TIMER_TIMEOUT;
 	fire_tsc = rdtsc() + period_in_cycle;
 	initialize_timer(&console_timer,
@@ -67,6 +180,10 @@ void console_setup_timer(void)
 void suspend_console(void)
 {
 	del_timer(&console_timer);
+
+	/* Back to synchronous output, once everything staged is out */
+	console_staging = false;
+	console_drain(CONFIG_MAX_PCPU_NUM * CONSOLE_RING_SIZE);
 }
 
 void resume_console(void)
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <hypervisor.h>
+
+static struct hcall_latency hcall_lat[HCALL_LAT_IDS];
+
+static inline bool hcall_lat_index(uint64_t hypcall_id, uint32_t *idx)
+{
+	bool ret = false;
+
+	if (((hypcall_id >> 24U) == HC_ID) &&
+		((hypcall_id & 0xFFFFFFUL) < HCALL_LAT_IDS)) {
+		*idx = (uint32_t)(hypcall_id & 0xFFFFFFUL);
+		ret = true;
+	}
+
+	return ret;
+}
+
+static inline uint32_t hcall_lat_bucket(uint64_t cycles)
+{
+	uint32_t bucket = 0U;
+
+	if (cycles != 0UL) {
+		bucket = (uint32_t)fls64(cycles);
+		if (bucket >= HCALL_LAT_BUCKETS) {
+			bucket = HCALL_LAT_BUCKETS - 1U;
+		}
+	}
+
+	return bucket;
+}
+
+void hcall_stats_record(uint64_t hypcall_id, uint64_t cycles)
+{
+	struct hcall_latency *lat;
+	uint64_t max;
+	uint32_t idx;
+
+	if (hcall_lat_index(hypcall_id, &idx)) {
+		lat = &hcall_lat[idx];
+
+		atomic_inc64(&lat->count);
+		(void)atomic_xadd64((int64_t *)&lat->total_cycles, (int64_t)cycles);
+		atomic_inc32(&lat->hist[hcall_lat_bucket(cycles)]);
+
+		max = atomic_load64(&lat->max_cycles);
+		while (cycles > max) {
+			if (atomic_cmpxchg64(&lat->max_cycles, max, cycles) == max) {
+				break;
+			}
+			max = atomic_load64(&lat->max_cycles);
+		}
+	}
+}
+
+int32_t hcall_stats_get(uint64_t hypcall_id, struct hcall_latency *lat)
+{
+	uint32_t idx, i;
+	int32_t ret = -EINVAL;
+
+	if (hcall_lat_index(hypcall_id, &idx)) {
+		lat->count = atomic_load64(&hcall_lat[idx].count);
+		lat->total_cycles = atomic_load64(&hcall_lat[idx].total_cycles);
+		lat->max_cycles = atomic_load64(&hcall_lat[idx].max_cycles);
+		for (i = 0U; i < HCALL_LAT_BUCKETS; i++) {
+			lat->hist[i] = atomic_load32(&hcall_lat[idx].hist[i]);
+		}
+		ret = 0;
+	}
+
+	return ret;
+}
+
+void hcall_stats_clear(void)
+{
+	(void)memset((void *)hcall_lat, 0U, sizeof(hcall_lat));
+}
+
+/*
+ * Upper bound in cycles of the bucket holding the given percentile,
+ * which is as precise as a log2 histogram gets.
+ */
+static uint64_t hcall_lat_percentile(const struct hcall_latency *lat, uint64_t percent)
+{
+	uint64_t target = ((lat->count * percent) + 99UL) / 100UL;
+	uint64_t seen = 0UL;
+	uint32_t i;
+
+	for (i = 0U; i < (HCALL_LAT_BUCKETS - 1U); i++) {
+		seen += lat->hist[i];
+		if (seen >= target) {
+			break;
+		}
+	}
+
+	return (i == (HCALL_LAT_BUCKETS - 1U)) ? lat->max_cycles : (1UL << (i + 1U));
+}
+
+void get_hcall_latency_info(char *str_arg, size_t str_max)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct hcall_latency lat;
+	uint32_t idx;
+
+	len = snprintf(str, size, "\r\nHCALL ID\tCOUNT\t\tAVG\tMAX\t\tP50\tP99\t(cycles)");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (idx = 0U; idx < HCALL_LAT_IDS; idx++) {
+		(void)hcall_stats_get(BASE_HC_ID(HC_ID, (uint64_t)idx), &lat);
+		if (lat.count == 0UL) {
+			continue;
+		}
+
+		len = snprintf(str, size, "\r\n0x%08llx\t%-12lld\t%lld\t%-12lld\t%lld\t%lld",
+				BASE_HC_ID(HC_ID, (uint64_t)idx), lat.count,
+				lat.total_cycles / lat.count, lat.max_cycles,
+				hcall_lat_percentile(&lat, 50UL),
+				hcall_lat_percentile(&lat, 99UL));
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
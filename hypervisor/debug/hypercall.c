@@ -51,6 +51,9 @@ static int32_t hcall_profiling_ops(struct acrn_vm *vm, uint64_t cmd, uint64_t pa
 	case PROFILING_GET_PCPUID:
 		ret = profiling_get_pcpu_id(vm, param);
 		break;
+	case PROFILING_GET_HCALL_LATENCY:
+		ret = profiling_get_hcall_latency(vm, param);
+		break;
 	default:
 		pr_err("%s: invalid profiling command %llu\n", __func__, cmd);
 		ret = -1;
@@ -122,6 +125,78 @@ static int32_t hcall_setup_hv_npk_log(struct acrn_vm *vm, uint64_t param)
 	return 0;
 }
 
+/**
+  * @brief Select the events recorded by acrntrace.
+  *
+  * @param vm Pointer to VM data structure
+  * @param param guest physical address. This gpa points to
+  *              struct trace_mask_param
+  *
+  * @pre Pointer vm shall point to VM0
+  * @return 0 on success, non-zero on error.
+  */
+static int32_t hcall_set_trace_mask(struct acrn_vm *vm, uint64_t param)
+{
+	struct trace_mask_param mask_param;
+
+	if (copy_from_gpa(vm, &mask_param, param, sizeof(mask_param)) != 0) {
+		pr_err("%s: Unable copy param from vm\n", __func__);
+		return -1;
+	}
+
+	trace_set_mask(&mask_param);
+
+	return 0;
+}
+
+/**
+  * @brief Control the aggregation of the trace events.
+  *
+  * @param vm Pointer to VM data structure
+  * @param cmd enum trace_aggr_cmd_type
+  * @param param guest physical address of a struct trace_aggr for
+  *              TRACE_AGGR_SNAPSHOT, ignored otherwise
+  *
+  * @pre Pointer vm shall point to VM0
+  * @return 0 on success, non-zero on error.
+  */
+static int32_t hcall_trace_aggregate(struct acrn_vm *vm, uint64_t cmd, uint64_t param)
+{
+	/* Too big for the stack */
+	static struct trace_aggr aggr;
+	static spinlock_t aggr_lock = { .head = 0U, .tail = 0U };
+	int32_t ret = 0;
+
+	switch (cmd) {
+	case TRACE_AGGR_STOP:
+		trace_aggregate(false);
+		break;
+	case TRACE_AGGR_START:
+		trace_aggregate(true);
+		break;
+	case TRACE_AGGR_SNAPSHOT:
+		spinlock_obtain(&aggr_lock);
+		if (copy_from_gpa(vm, &aggr.pcpu_id, param, sizeof(aggr.pcpu_id)) != 0) {
+			pr_err("%s: Unable copy param from vm\n", __func__);
+			ret = -1;
+		} else {
+			ret = trace_aggr_snapshot(&aggr);
+		}
+		if ((ret == 0) && (copy_to_gpa(vm, &aggr, param, sizeof(aggr)) != 0)) {
+			pr_err("%s: Unable copy param to vm\n", __func__);
+			ret = -1;
+		}
+		spinlock_release(&aggr_lock);
+		break;
+	default:
+		pr_err("%s: invalid cmd %llu\n", __func__, cmd);
+		ret = -EINVAL;
+		break;
+	}
+
+	return ret;
+}
+
 /**
   * @brief Setup hypervisor debug infrastructure, such as share buffer, NPK log and profiling.
   *
@@ -151,6 +226,14 @@ int32_t hcall_debug(struct acrn_vm *vm, uint64_t param1, uint64_t param2, uint64
 		ret = hcall_profiling_ops(vm, param1, param2);
 		break;
 
+	case HC_SET_TRACE_MASK:
+		ret = hcall_set_trace_mask(vm, param1);
+		break;
+
+	case HC_TRACE_AGGREGATE:
+		ret = hcall_trace_aggregate(vm, param1, param2);
+		break;
+
 	default:
 		pr_err("op %d: Invalid hypercall\n", hypcall_id);
 		ret = -EPERM;
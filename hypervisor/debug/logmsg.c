@@ -6,6 +6,7 @@
 
 #include <hypervisor.h>
 #include <per_cpu.h>
+#include <reloc.h>
 /* buf size should be identical to the size in hvlog option, which is
  * transfered to SOS:
  * bsp/uefi/clearlinux/acrn.conf: hvlog=2M@0x1FE00000
@@ -25,10 +26,125 @@ void init_logmsg(uint32_t flags)
 	logmsg_ctl.seq = 0;
 }
 
+/*
+ * Find the next conversion of fmt which takes an argument, parsed as the
+ * hypervisor vsnprintf() does: flags, width, precision and length, then
+ * one of d, i, u, x, X, s or c. 'l' and "ll" both mean 64 bit.
+ *
+ * Return the position after the conversion, or NULL at the end of fmt.
+ */
+static const char *log_bin_next_arg(const char *fmt, char *conv, bool *is_64bit)
+{
+	const char *s = fmt;
+	const char *next = NULL;
+
+	while ((next == NULL) && (*s != '\0')) {
+		if (*s != '%') {
+			s++;
+			continue;
+		}
+		s++;
+		while ((*s == '#') || (*s == '0') || (*s == '-') || (*s == '+') || (*s == ' ')) {
+			s++;
+		}
+		while (((*s >= '0') && (*s <= '9')) || (*s == '.')) {
+			s++;
+		}
+		*is_64bit = (*s == 'l');
+		while ((*s == 'h') || (*s == 'l')) {
+			s++;
+		}
+
+		if ((*s == 'd') || (*s == 'i') || (*s == 'u') || (*s == 'x') || (*s == 'X')
+				|| (*s == 's') || (*s == 'c')) {
+			*conv = *s;
+			next = s + 1;
+		} else if (*s != '\0') {
+			/* "%%" or an unknown conversion, printed as is */
+			s++;
+		} else {
+			/* Dangling '%' */
+		}
+	}
+
+	return next;
+}
+
+/*
+ * Record the format string address and the raw arguments instead of the
+ * formatted message: no formatting in the hypervisor, acrnlog does it
+ * with the format strings of the hypervisor image.
+ */
+static void log_put_binary(struct shared_buf *sbuf, uint32_t severity, uint16_t pcpu_id,
+	uint32_t seq, uint64_t timestamp, const char *fmt, va_list args)
+{
+	uint64_t rec[LOG_MESSAGE_MAX_SIZE / sizeof(uint64_t)];
+	struct log_bin_header *hdr = (struct log_bin_header *)rec;
+	uint64_t *arg = &rec[sizeof(struct log_bin_header) / sizeof(uint64_t)];
+	uint8_t *bytes = (uint8_t *)rec;
+	const char *s = fmt;
+	const char *str;
+	uint32_t nr_args = 0U;
+	uint32_t i, pos, len, entries;
+	bool is_64bit = false;
+	char conv = '\0';
+
+	/* Count the arguments first, the strings go after them */
+	while ((nr_args < LOG_BIN_MAX_ARGS) && (s != NULL)) {
+		s = log_bin_next_arg(s, &conv, &is_64bit);
+		if (s != NULL) {
+			nr_args++;
+		}
+	}
+
+	pos = (uint32_t)(sizeof(struct log_bin_header) + (nr_args * sizeof(uint64_t)));
+	s = fmt;
+	for (i = 0U; i < nr_args; i++) {
+		s = log_bin_next_arg(s, &conv, &is_64bit);
+		if (conv == 's') {
+			str = __builtin_va_arg(args, const char *);
+			if (str == NULL) {
+				str = "(null)";
+			}
+			arg[i] = 0UL;
+			if (pos < LOG_MESSAGE_MAX_SIZE) {
+				len = (uint32_t)strnlen_s(str, (LOG_MESSAGE_MAX_SIZE - pos) - 1U);
+				if (len != 0U) {
+					(void)memcpy_s(&bytes[pos], LOG_MESSAGE_MAX_SIZE - pos, str, len);
+				}
+				bytes[pos + len] = 0U;
+				arg[i] = pos;
+				pos += len + 1U;
+			}
+		} else if (is_64bit) {
+			arg[i] = __builtin_va_arg(args, uint64_t);
+		} else {
+			arg[i] = __builtin_va_arg(args, uint32_t);
+		}
+	}
+
+	entries = ((pos - 1U) / LOG_ENTRY_SIZE) + 1U;
+	(void)memset(&bytes[pos], 0U, (entries * LOG_ENTRY_SIZE) - pos);
+
+	hdr->marker = LOG_BIN_MARKER;
+	hdr->severity = (uint8_t)severity;
+	hdr->nr_args = (uint8_t)nr_args;
+	hdr->nr_entries = (uint8_t)entries;
+	hdr->pcpu_id = pcpu_id;
+	hdr->size = (uint16_t)pos;
+	hdr->seq = seq;
+	hdr->reserved = 0U;
+	hdr->timestamp = timestamp;
+	hdr->fmt = (uint64_t)fmt - get_hv_image_delta();
+
+	(void)sbuf_put_many(sbuf, bytes, entries);
+}
+
 void do_logmsg(uint32_t severity, const char *fmt, ...)
 {
 	va_list args;
 	uint64_t timestamp, rflags;
+	uint32_t seq;
 	uint16_t pcpu_id;
 	bool do_console_log;
 	bool do_mem_log;
@@ -51,12 +167,31 @@ void do_logmsg(uint32_t severity, const char *fmt, ...)
 
 	/* Get CPU ID */
 	pcpu_id = get_cpu_id();
+	seq = (uint32_t)atomic_inc_return(&logmsg_ctl.seq);
+
+	if (do_mem_log && ((logmsg_ctl.flags & LOG_FLAG_BINARY) != 0U)) {
+		struct shared_buf *sbuf = (struct shared_buf *)per_cpu(sbuf, pcpu_id)[ACRN_HVLOG];
+
+		/* If sbuf is not ready, we just drop the massage */
+		if (sbuf != NULL) {
+			va_start(args, fmt);
+			log_put_binary(sbuf, severity, pcpu_id, seq, timestamp, fmt, args);
+			va_end(args);
+		}
+
+		/* Nothing left to format for memory only messages */
+		do_mem_log = false;
+		if (!do_console_log && !do_npk_log) {
+			return;
+		}
+	}
+
 	buffer = per_cpu(logbuf, pcpu_id);
 
 	(void)memset(buffer, 0U, LOG_MESSAGE_MAX_SIZE);
 	/* Put time-stamp, CPU ID and severity into buffer */
 	snprintf(buffer, LOG_MESSAGE_MAX_SIZE, "[%lluus][cpu=%hu][sev=%u][seq=%u]:",
-			timestamp, pcpu_id, severity, atomic_inc_return(&logmsg_ctl.seq));
+			timestamp, pcpu_id, severity, seq);
 
 	/* Put message into remaining portion of local buffer */
 	va_start(args, fmt);
@@ -70,8 +205,12 @@ void do_logmsg(uint32_t severity, const char *fmt, ...)
 		npk_log_write(buffer, strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE));
 	}
 
-	/* Check if flags specify to output to stdout */
-	if (do_console_log) {
+	/*
+	 * Check if flags specify to output to stdout. Fatal messages are
+	 * written right away, the pCPU may not get much further.
+	 */
+	if (do_console_log && ((severity == LOG_FATAL) ||
+			!console_stage_msg(buffer, strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE)))) {
 		spinlock_irqsave_obtain(&(logmsg_ctl.lock), &rflags);
 
 		/* Send buffer to stdout */
@@ -82,18 +221,16 @@ void do_logmsg(uint32_t severity, const char *fmt, ...)
 
 	/* Check if flags specify to output to memory */
 	if (do_mem_log) {
-		uint32_t i, msg_len;
+		uint32_t msg_len;
 		struct shared_buf *sbuf = (struct shared_buf *)per_cpu(sbuf, pcpu_id)[ACRN_HVLOG];
 
 		/* If sbuf is not ready, we just drop the massage */
 		if (sbuf != NULL) {
 			msg_len = strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE);
 
-			for (i = 0U; i < (((msg_len - 1U) / LOG_ENTRY_SIZE) + 1U);
-					i++) {
-				(void)sbuf_put(sbuf, (uint8_t *)buffer +
-							(i * LOG_ENTRY_SIZE));
-			}
+			/* The whole message or nothing, in one go */
+			(void)sbuf_put_many(sbuf, (uint8_t *)buffer,
+					((msg_len - 1U) / LOG_ENTRY_SIZE) + 1U);
 		}
 	}
 }
@@ -7,6 +7,7 @@
 
 static int32_t npk_log_setup_ref;
 static bool npk_log_enabled;
+static bool npk_trace_enabled;
 static uint64_t base;
 
 #define HV_NPK_LOG_REF_SHIFT  2U
@@ -15,12 +16,20 @@ static uint64_t base;
 #define HV_NPK_LOG_MAX 1024U
 #define HV_NPK_LOG_HDR 0x01000242U
 
+/*
+ * The trace events of a pCPU go on a channel of their own, after the
+ * HV_NPK_LOG_REF_MASK + 1 log channels of each pCPU.
+ */
+#define HV_NPK_TRACE_CHAN_BASE	(CONFIG_MAX_PCPU_NUM << HV_NPK_LOG_REF_SHIFT)
+
 enum {
 	HV_NPK_LOG_CMD_INVALID = 0U,
 	HV_NPK_LOG_CMD_CONF,
 	HV_NPK_LOG_CMD_ENABLE,
 	HV_NPK_LOG_CMD_DISABLE,
 	HV_NPK_LOG_CMD_QUERY,
+	HV_NPK_LOG_CMD_TRACE_ENABLE,
+	HV_NPK_LOG_CMD_TRACE_DISABLE,
 };
 
 #define	HV_NPK_LOG_RES_INVALID	0x0U
@@ -108,6 +117,20 @@ void npk_log_setup(struct hv_npk_log_param *param)
 		param->loglevel = npk_loglevel;
 		param->mmio_addr = base;
 		break;
+	case HV_NPK_LOG_CMD_TRACE_ENABLE:
+		/* the channels of the log, shared with it if configured already */
+		if (param->mmio_addr != 0UL) {
+			base = param->mmio_addr;
+		}
+		if (base != 0UL) {
+			npk_trace_enabled = true;
+			param->res = HV_NPK_LOG_RES_OK;
+		}
+		break;
+	case HV_NPK_LOG_CMD_TRACE_DISABLE:
+		npk_trace_enabled = false;
+		param->res = HV_NPK_LOG_RES_OK;
+		break;
 	default:
 		pr_err("HV_NPK_LOG: unknown cmd (%d)\n", param->cmd);
 		break;
@@ -146,3 +169,35 @@ void npk_log_write(const char *buf, size_t buf_len)
 
 	atomic_dec32(&per_cpu(npk_log_ref, cpu_id));
 }
+
+bool npk_trace_on(void)
+{
+	return npk_trace_enabled;
+}
+
+/*
+ * A trace record goes out as 64-bit packets on the channel of the pCPU:
+ * the first one marked and time stamped by the Trace Hub, the others
+ * plain, closed by a flag. Interrupts are held off so that the various
+ * records of a pCPU don't interleave on its channel.
+ */
+void npk_trace_write(const uint64_t *words, uint32_t nr_words)
+{
+	uint16_t cpu_id = get_cpu_id();
+	struct npk_chan *channel = (struct npk_chan *)base;
+	uint64_t rflags;
+	uint32_t i;
+
+	if (!npk_trace_enabled || (channel == NULL) || (nr_words == 0U)) {
+		return;
+	}
+
+	channel += HV_NPK_TRACE_CHAN_BASE + cpu_id;
+	CPU_INT_ALL_DISABLE(&rflags);
+	mmio_write64(words[0], &(channel->DnMTS));
+	for (i = 1U; i < nr_words; i++) {
+		mmio_write64(words[i], &(channel->Dn));
+	}
+	mmio_write8(0U, &(channel->FLAG));
+	CPU_INT_ALL_RESTORE(rflags);
+}
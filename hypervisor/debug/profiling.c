@@ -11,7 +11,7 @@
 #define ACRN_ERR_PROFILING		3U
 
 #define MAJOR_VERSION			1
-#define MINOR_VERSION			0
+#define MINOR_VERSION			1
 
 #define LBR_NUM_REGISTERS			32U
 #define PERF_OVF_BIT_MASK			0xC0000070000000FULL
@@ -213,81 +213,31 @@ static void profiling_disable_pmu(void)
 }
 
 /*
- * Writes specified size of data into sbuf
+ * Writes a header and its payload into sbuf as one record, each part
+ * starting on a multiple of align bytes. All or nothing: the reader never
+ * sees a header without its payload.
  */
-static int32_t profiling_sbuf_put_variable(struct shared_buf *sbuf,
-					uint8_t *data, uint32_t size)
+static int32_t profiling_sbuf_put_record(struct shared_buf *sbuf,
+	const struct data_header *header, uint32_t header_size,
+	const void *payload, uint32_t payload_size, uint32_t align)
 {
-	uint32_t remaining_space, offset, next_tail;
-	void *to;
-
-	/*
-	 * 1. check for null pointers and non-zero size
-	 * 2. check if enough room available in the buffer
-	 *     2a. if not, drop the sample, increment count of dropped samples,
-	 *         return
-	 *     2b. unless overwrite flag is enabled
-	 * 3. Continue if buffer has space for the sample
-	 * 4. Copy sample to buffer
-	 *     4a. Split variable sample to be copied if the sample is going to
-	 *         wrap around the buffer
-	 *     4b. Otherwise do a simple copy
-	 * 5. return number of bytes of data put in buffer
-	 */
-
-	if ((sbuf == NULL) || (data == NULL)) {
-		dev_dbg(ACRN_DBG_PROFILING, "buffer or data not initialized!");
-		return -EINVAL;
-	}
-
-	if (size == 0U) {
-		dev_dbg(ACRN_DBG_PROFILING,
-			"0 bytes reqeusted to be put in buffer!");
-		return 0;
-	}
+	uint32_t header_span = ((header_size + align - 1U) / align) * align;
+	uint32_t payload_span = ((payload_size + align - 1U) / align) * align;
+	uint32_t pos;
 
-	if (sbuf->tail >= sbuf->head) {
-		remaining_space = sbuf->size - (sbuf->tail - sbuf->head);
-	} else {
-		remaining_space = sbuf->head - sbuf->tail;
+	pos = sbuf_reserve(sbuf, header_span + payload_span);
+	if (pos == SBUF_NO_ROOM) {
+		return -ENOSPC;
 	}
 
-	if (size >= remaining_space) {
-		/* Only (remaining_space - 1) can be written to sbuf.
-		 * Since if the next_tail equals head, then it is assumed
-		 * that buffer is empty, not full
-		 */
-		dev_dbg(ACRN_DBG_PROFILING,
-		"Not enough space to write data! Returning without writing");
-		return 0;
+	(void)sbuf_copy_at(sbuf, pos, header, header_size);
+	if (payload_size != 0U) {
+		(void)sbuf_copy_at(sbuf, sbuf_next_ptr(pos, header_span, sbuf->size),
+			payload, payload_size);
 	}
+	sbuf_commit(sbuf, pos, header_span + payload_span);
 
-	next_tail = sbuf_next_ptr(sbuf->tail, size, sbuf->size);
-	dev_dbg(ACRN_DBG_PROFILING, "sbuf->tail: %llu, next_tail: %llu",
-		sbuf->tail, next_tail);
-
-	to = (void *)sbuf + SBUF_HEAD_SIZE + sbuf->tail;
-
-	if (next_tail < sbuf->tail) { /* wrap-around */
-		dev_dbg(ACRN_DBG_PROFILING, "wrap-around condition!");
-		offset = sbuf->size - sbuf->tail;
-		(void)memcpy_s(to, offset, data, offset);
-
-		/* 2nd part */
-		to = (void *)sbuf + SBUF_HEAD_SIZE;
-
-		if ((size - offset) > 0U) {
-			(void)memcpy_s(to, size - offset,
-				data + offset, size - offset);
-		}
-	} else {
-		dev_dbg(ACRN_DBG_PROFILING, "non-wrap-around!");
-		(void)memcpy_s(to, size, data, size);
-	}
-
-	sbuf->tail = next_tail;
-
-	return (int32_t)size;
+	return (int32_t)(header_size + payload_size);
 }
 
 /*
@@ -296,8 +246,6 @@ static int32_t profiling_sbuf_put_variable(struct shared_buf *sbuf,
  */
 static int32_t profiling_generate_data(int32_t collector, uint32_t type)
 {
-	uint64_t i;
-	uint32_t remaining_space = 0U;
 	int32_t 	ret = 0;
 	struct data_header pkt_header;
 	uint64_t payload_size = 0UL;
@@ -322,13 +270,6 @@ static int32_t profiling_generate_data(int32_t collector, uint32_t type)
 		}
 
 		if (ss->pmu_state == PMU_RUNNING) {
-			if (sbuf->tail >= sbuf->head) {
-				remaining_space = sbuf->size
-						- (sbuf->tail - sbuf->head);
-			} else {
-				remaining_space = sbuf->head - sbuf->tail;
-			}
-
 			/* populate the data header */
 			pkt_header.tsc = rdtsc();
 			pkt_header.collector_id = collector;
@@ -346,6 +287,11 @@ static int32_t profiling_generate_data(int32_t collector, uint32_t type)
 					+ LBR_PMU_SAMPLE_SIZE;
 				payload = &get_cpu_var(profiling_info.pmu_sample);
 				break;
+			case CALLSTACK_PMU_SAMPLING:
+				payload_size = CORE_PMU_SAMPLE_SIZE
+					+ CALLSTACK_PMU_SAMPLE_SIZE;
+				payload = &get_cpu_var(profiling_info.pmu_sample);
+				break;
 			case VM_SWITCH_TRACING:
 				payload_size = VM_SWITCH_TRACE_SIZE;
 				payload = &get_cpu_var(profiling_info.vm_switch_trace);
@@ -361,25 +307,16 @@ static int32_t profiling_generate_data(int32_t collector, uint32_t type)
 			}
 			pkt_header.payload_size = payload_size;
 
-			if ((uint64_t)remaining_space < (DATA_HEADER_SIZE + payload_size)) {
+			/* The SEP reader consumes SEP_BUF_ENTRY_SIZE entries */
+			if (profiling_sbuf_put_record(sbuf, &pkt_header, (uint32_t)DATA_HEADER_SIZE,
+					payload, (uint32_t)payload_size, SEP_BUF_ENTRY_SIZE) < 0) {
 				ss->samples_dropped++;
 				dev_dbg(ACRN_DBG_PROFILING,
-				"%s: not enough space left in sbuf[%d: %d] exiting cpu%d",
-				__func__, remaining_space,
-				DATA_HEADER_SIZE + payload_size, get_cpu_id());
+				"%s: not enough space left in sbuf for %d bytes exiting cpu%d",
+				__func__, DATA_HEADER_SIZE + payload_size, get_cpu_id());
 				return 0;
 			}
 
-			for (i = 0U; i < (((DATA_HEADER_SIZE - 1U) / SEP_BUF_ENTRY_SIZE) + 1U); i++) {
-				(void)sbuf_put((struct shared_buf *)sbuf,
-					(uint8_t *)&pkt_header + i * SEP_BUF_ENTRY_SIZE);
-			}
-
-			for (i = 0U; i < (((payload_size - 1U) / SEP_BUF_ENTRY_SIZE) + 1U); i++) {
-				(void)sbuf_put((struct shared_buf *)sbuf,
-					(uint8_t *)payload + i * SEP_BUF_ENTRY_SIZE);
-			}
-
 			ss->samples_logged++;
 		}
 	} else if (collector == COLLECT_POWER_DATA) {
@@ -393,13 +330,6 @@ static int32_t profiling_generate_data(int32_t collector, uint32_t type)
 			return 0;
 		}
 
-		if (sbuf->tail >= sbuf->head) {
-			remaining_space
-				= sbuf->size - (sbuf->tail - sbuf->head);
-		} else {
-			remaining_space = sbuf->head - sbuf->tail;
-		}
-
 		/* populate the data header */
 		pkt_header.tsc = rdtsc();
 		pkt_header.collector_id = collector;
@@ -435,18 +365,13 @@ static int32_t profiling_generate_data(int32_t collector, uint32_t type)
 		}
 		pkt_header.payload_size = payload_size;
 
-		if ((DATA_HEADER_SIZE + payload_size) >= (uint64_t)remaining_space) {
+		/* Variable length records, packed back to back */
+		if (profiling_sbuf_put_record(sbuf, &pkt_header, (uint32_t)DATA_HEADER_SIZE,
+				payload, (uint32_t)payload_size, 1U) < 0) {
 			pr_err("%s: not enough space in socwatch buffer on cpu %d",
 				__func__, get_cpu_id());
 			return 0;
 		}
-		/* copy header */
-		(void)profiling_sbuf_put_variable((struct shared_buf *)sbuf,
-			(uint8_t *)&pkt_header, (uint32_t)DATA_HEADER_SIZE);
-
-		/* copy payload */
-		(void)profiling_sbuf_put_variable((struct shared_buf *)sbuf,
-			(uint8_t *)payload, (uint32_t)payload_size);
 
 	} else {
 		dev_dbg(ACRN_ERR_PROFILING,
@@ -557,6 +482,38 @@ static void profiling_handle_msrops(void)
 		__func__, get_cpu_id());
 }
 
+/*
+ * Follow the frame pointers of the interrupted hypervisor code, which is
+ * built with -fno-omit-frame-pointer when profiling. The walk stops at the
+ * first frame outside the stack of this pCPU, so that a garbage rbp never
+ * faults.
+ */
+static void profiling_capture_callstack(uint64_t rbp, struct callstack_pmu_sample *ssample)
+{
+	uint64_t stack_lo = (uint64_t)&get_cpu_var(stack)[0];
+	uint64_t stack_hi = stack_lo + CONFIG_STACK_SIZE;
+	uint64_t fp = rbp;
+	const uint64_t *frame;
+
+	ssample->nr = 0U;
+	while ((ssample->nr < NUM_CALLSTACK_ENTRY) && (fp >= stack_lo)
+			&& (fp <= (stack_hi - 16UL)) && ((fp & 0x7UL) == 0UL)) {
+		frame = (const uint64_t *)fp;
+		/* frame[0] is the caller's rbp, frame[1] the return address */
+		if (frame[1] == 0UL) {
+			break;
+		}
+		ssample->ip[ssample->nr] = frame[1];
+		ssample->nr++;
+
+		/* Callers' frames are higher up the stack */
+		if (frame[0] <= fp) {
+			break;
+		}
+		fp = frame[0];
+	}
+}
+
 /*
  * Interrupt handler for performance monitoring interrupts
  */
@@ -569,12 +526,17 @@ static void profiling_pmi_handler(uint32_t irq, __unused void *data)
 	struct profiling_msr_op *msrop = NULL;
 	struct pmu_sample *psample = &(get_cpu_var(profiling_info.pmu_sample));
 	struct sep_state *ss = &(get_cpu_var(profiling_info.sep_state));
+	bool in_hv = false;
 
 	if ((ss == NULL) || (psample == NULL)) {
 		dev_dbg(ACRN_ERR_PROFILING, "%s: exiting cpu%d",
 			__func__, get_cpu_id());
 		return;
 	}
+	/* Not sampling: the overflow is the one of a vPMU */
+	if ((ss->pmu_state != PMU_RUNNING) && vpmu_handle_pmi()) {
+		return;
+	}
 	/* Stop all the counters first */
 	msr_write(MSR_IA32_PERF_GLOBAL_CTRL, 0x0U);
 
@@ -636,15 +598,21 @@ static void profiling_pmi_handler(uint32_t irq, __unused void *data)
 		psample->csample.rflags
 			= (uint32_t)irq_desc_array[irq].ctx_rflags;
 		psample->csample.cs = (uint32_t)irq_desc_array[irq].ctx_cs;
+		in_hv = true;
 	}
 
-	if ((sep_collection_switch &
+	if (in_hv && ((sep_collection_switch &
+				(1UL << (uint64_t)CALLSTACK_PMU_SAMPLING)) > 0UL)) {
+		/* The call stack takes the place of the LBR records */
+		profiling_capture_callstack(irq_desc_array[irq].ctx_rbp, &psample->ext.ssample);
+		(void)profiling_generate_data(COLLECT_PROFILE_DATA, CALLSTACK_PMU_SAMPLING);
+	} else if ((sep_collection_switch &
 				(1UL << (uint64_t)LBR_PMU_SAMPLING)) > 0UL) {
-		psample->lsample.lbr_tos = msr_read(MSR_CORE_LASTBRANCH_TOS);
+		psample->ext.lsample.lbr_tos = msr_read(MSR_CORE_LASTBRANCH_TOS);
 		for (i = 0U; i < LBR_NUM_REGISTERS; i++) {
-			psample->lsample.lbr_from_ip[i]
+			psample->ext.lsample.lbr_from_ip[i]
 				= msr_read(MSR_CORE_LASTBRANCH_0_FROM_IP + i);
-			psample->lsample.lbr_to_ip[i]
+			psample->ext.lsample.lbr_to_ip[i]
 				= msr_read(MSR_CORE_LASTBRANCH_0_TO_IP + i);
 		}
 		/* Generate core pmu sample and lbr data */
@@ -922,7 +890,8 @@ int32_t profiling_get_version_info(struct acrn_vm *vm, uint64_t addr)
 					((1U << (uint64_t)CORE_PMU_SAMPLING) |
 					(1U << (uint64_t)CORE_PMU_COUNTING) |
 					(1U << (uint64_t)LBR_PMU_SAMPLING) |
-					(1U << (uint64_t)VM_SWITCH_TRACING));
+					(1U << (uint64_t)VM_SWITCH_TRACING) |
+					(1U << (uint64_t)CALLSTACK_PMU_SAMPLING));
 
 	if (copy_to_gpa(vm, &ver_info, addr, sizeof(ver_info)) != 0) {
 		pr_err("%s: Unable to copy addr to vm\n", __func__);
@@ -1017,6 +986,8 @@ int32_t profiling_set_control(struct acrn_vm *vm, uint64_t addr)
 					break;
 				case VM_SWITCH_TRACING:
 					break;
+				case CALLSTACK_PMU_SAMPLING:
+					break;
 				default:
 					dev_dbg(ACRN_DBG_PROFILING,
 					"%s: feature not supported %u",
@@ -1257,6 +1228,44 @@ int32_t profiling_get_pcpu_id(struct acrn_vm *vm, uint64_t addr)
 	return 0;
 }
 
+/*
+ * Read the latency histogram of one hypercall
+ */
+int32_t profiling_get_hcall_latency(struct acrn_vm *vm, uint64_t addr)
+{
+	struct profiling_hcall_latency info;
+	struct hcall_latency lat;
+
+	(void)memset((void *)&info, 0U, sizeof(info));
+
+	dev_dbg(ACRN_DBG_PROFILING, "%s: entering", __func__);
+
+	if (copy_from_gpa(vm, &info, addr, sizeof(info)) != 0) {
+		pr_err("%s: Unable to copy addr from vm\n", __func__);
+		return -EINVAL;
+	}
+
+	if (hcall_stats_get(info.hc_id, &lat) != 0) {
+		pr_err("%s: hypercall 0x%llx is not tracked\n", __func__, info.hc_id);
+		return -EINVAL;
+	}
+
+	info.count = lat.count;
+	info.total_cycles = lat.total_cycles;
+	info.max_cycles = lat.max_cycles;
+	(void)memcpy_s((void *)info.hist, sizeof(info.hist),
+			(void *)lat.hist, sizeof(lat.hist));
+
+	if (copy_to_gpa(vm, &info, addr, sizeof(info)) != 0) {
+		pr_err("%s: Unable to copy param to vm\n", __func__);
+		return -EINVAL;
+	}
+
+	dev_dbg(ACRN_DBG_PROFILING, "%s: exiting", __func__);
+
+	return 0;
+}
+
 /*
  * IPI interrupt handler function
  */
@@ -1286,6 +1295,15 @@ void profiling_ipi_handler(__unused void *data)
 	get_cpu_var(profiling_info.ipi_cmd) = IPI_UNKNOWN;
 }
 
+/*
+ * Whether the PMU of the current pCPU samples for the profiling, the vPMU
+ * gets it otherwise
+ */
+bool profiling_pmu_running(void)
+{
+	return get_cpu_var(profiling_info.sep_state).pmu_state == PMU_RUNNING;
+}
+
 /*
  * Save the VCPU info on vmenter
  */
@@ -1319,7 +1337,7 @@ void profiling_pre_vmexit_handler(struct acrn_vcpu *vcpu)
 			= exit_reason;
 		if (exit_reason == VMX_EXIT_REASON_EXTERNAL_INTERRUPT) {
 			get_cpu_var(profiling_info.vm_info).external_vector
-				= (int32_t)(exec_vmread(VMX_EXIT_INT_INFO) & 0xFFUL);
+				= (int32_t)(vcpu_vmcs_read(vcpu, VMCS_EXIT_INT_INFO) & 0xFFUL);
 		} else {
 			get_cpu_var(profiling_info.vm_info).external_vector = -1;
 		}
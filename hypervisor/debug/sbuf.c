@@ -67,41 +67,115 @@ uint32_t sbuf_get(struct shared_buf *sbuf, uint8_t *data)
  * negative:	failed.
  */
 
-uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data)
+/* Bytes which can be added before the buffer looks empty again */
+static inline uint32_t sbuf_room(const struct shared_buf *sbuf)
 {
-	void *to;
-	uint32_t next_tail;
-	uint32_t ele_size;
-	bool trigger_overwrite = false;
+	uint32_t used;
 
-	stac();
-	next_tail = sbuf_next_ptr(sbuf->tail, sbuf->ele_size, sbuf->size);
-	/* if this write would trigger overrun */
-	if (next_tail == sbuf->head) {
-		/* accumulate overrun count if necessary */
-		sbuf->overrun_cnt += sbuf->flags & OVERRUN_CNT_EN;
-		if ((sbuf->flags & OVERWRITE_EN) == 0U) {
-			/* if not enable over write, return here. */
-			clac();
-			return 0;
-		}
-		trigger_overwrite = true;
+	if (sbuf->tail >= sbuf->head) {
+		used = sbuf->tail - sbuf->head;
+	} else {
+		used = sbuf->size - (sbuf->head - sbuf->tail);
 	}
 
-	to = (void *)sbuf + SBUF_HEAD_SIZE + sbuf->tail;
+	return sbuf->size - used;
+}
 
-	(void)memcpy_s(to, sbuf->ele_size, data, sbuf->ele_size);
+/* @pre stac() */
+static uint32_t do_sbuf_reserve(struct shared_buf *sbuf, uint32_t len)
+{
+	uint32_t room, pos = SBUF_NO_ROOM;
+
+	if ((len != 0U) && (len < sbuf->size)) {
+		room = sbuf_room(sbuf);
+		if (len < room) {
+			pos = sbuf->tail;
+		} else {
+			/* accumulate overrun count if necessary */
+			sbuf->overrun_cnt += sbuf->flags & OVERRUN_CNT_EN;
+
+			/* Overwriting drops whole elements, so the reader stays in step */
+			if (((sbuf->flags & OVERWRITE_EN) != 0U) && (sbuf->ele_size != 0U)
+					&& ((len % sbuf->ele_size) == 0U)) {
+				while (len >= room) {
+					sbuf->head = sbuf_next_ptr(sbuf->head, sbuf->ele_size, sbuf->size);
+					room += sbuf->ele_size;
+				}
+				pos = sbuf->tail;
+			}
+		}
+	}
+
+	return pos;
+}
 
-	if (trigger_overwrite) {
-		sbuf->head = sbuf_next_ptr(sbuf->head,
-				sbuf->ele_size, sbuf->size);
+/* @pre stac(), pos and len within a reservation */
+static uint32_t do_sbuf_copy_at(struct shared_buf *sbuf, uint32_t pos, const void *data, uint32_t len)
+{
+	uint8_t *base = (uint8_t *)sbuf + SBUF_HEAD_SIZE;
+	const uint8_t *from = (const uint8_t *)data;
+	uint32_t first = sbuf->size - pos;
+
+	if (len <= first) {
+		(void)memcpy_s(base + pos, first, from, len);
+	} else {
+		/* The record wraps around the end of the buffer */
+		(void)memcpy_s(base + pos, first, from, first);
+		(void)memcpy_s(base, pos, from + first, len - first);
 	}
-	sbuf->tail = next_tail;
 
-	ele_size = sbuf->ele_size;
+	return sbuf_next_ptr(pos, len, sbuf->size);
+}
+
+uint32_t sbuf_reserve(struct shared_buf *sbuf, uint32_t len)
+{
+	uint32_t pos;
+
+	stac();
+	pos = do_sbuf_reserve(sbuf, len);
 	clac();
 
-	return ele_size;
+	return pos;
+}
+
+uint32_t sbuf_copy_at(struct shared_buf *sbuf, uint32_t pos, const void *data, uint32_t len)
+{
+	uint32_t next;
+
+	stac();
+	next = do_sbuf_copy_at(sbuf, pos, data, len);
+	clac();
+
+	return next;
+}
+
+void sbuf_commit(struct shared_buf *sbuf, uint32_t pos, uint32_t len)
+{
+	stac();
+	sbuf->tail = sbuf_next_ptr(pos, len, sbuf->size);
+	clac();
+}
+
+uint32_t sbuf_put_many(struct shared_buf *sbuf, const uint8_t *data, uint32_t nr)
+{
+	uint32_t pos, len;
+
+	stac();
+	len = nr * sbuf->ele_size;
+	pos = do_sbuf_reserve(sbuf, len);
+	if (pos == SBUF_NO_ROOM) {
+		len = 0U;
+	} else {
+		sbuf->tail = do_sbuf_copy_at(sbuf, pos, data, len);
+	}
+	clac();
+
+	return len;
+}
+
+uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data)
+{
+	return sbuf_put_many(sbuf, data, 1U);
 }
 
 int32_t sbuf_share_setup(uint16_t pcpu_id, uint32_t sbuf_id, uint64_t *hva)
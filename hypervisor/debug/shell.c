@@ -29,9 +29,19 @@ static int32_t shell_show_cpu_int(__unused int32_t argc, __unused char **argv);
 static int32_t shell_show_ptdev_info(__unused int32_t argc, __unused char **argv);
 static int32_t shell_show_vioapic_info(int32_t argc, char **argv);
 static int32_t shell_show_ioapic_info(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_vm_pio_info(int32_t argc, char **argv);
 static int32_t shell_loglevel(int32_t argc, char **argv);
 static int32_t shell_cpuid(int32_t argc, char **argv);
 static int32_t shell_trigger_crash(int32_t argc, char **argv);
+static int32_t shell_show_hcall_lat(int32_t argc, char **argv);
+static int32_t shell_show_sched(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_softirq(int32_t argc, char **argv);
+static int32_t shell_idle(int32_t argc, char **argv);
+static int32_t shell_show_ept(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_vmexit(int32_t argc, char **argv);
+static int32_t shell_perf_top(int32_t argc, char **argv);
+static int32_t shell_show_vcpuid(int32_t argc, char **argv);
+static int32_t shell_show_sworld(int32_t argc, char **argv);
 
 static struct shell_cmd shell_cmds[] = {
 	{
@@ -94,6 +104,12 @@ static struct shell_cmd shell_cmds[] = {
 		.help_str	= SHELL_CMD_IOAPIC_HELP,
 		.fcn		= shell_show_ioapic_info,
 	},
+	{
+		.str		= SHELL_CMD_VM_PIO,
+		.cmd_param	= SHELL_CMD_VM_PIO_PARAM,
+		.help_str	= SHELL_CMD_VM_PIO_HELP,
+		.fcn		= shell_show_vm_pio_info,
+	},
 	{
 		.str		= SHELL_CMD_LOG_LVL,
 		.cmd_param	= SHELL_CMD_LOG_LVL_PARAM,
@@ -112,6 +128,60 @@ static struct shell_cmd shell_cmds[] = {
 		.help_str	= SHELL_CMD_REBOOT_HELP,
 		.fcn		= shell_trigger_crash,
 	},
+	{
+		.str		= SHELL_CMD_HCALL_LAT,
+		.cmd_param	= SHELL_CMD_HCALL_LAT_PARAM,
+		.help_str	= SHELL_CMD_HCALL_LAT_HELP,
+		.fcn		= shell_show_hcall_lat,
+	},
+	{
+		.str		= SHELL_CMD_SCHED,
+		.cmd_param	= SHELL_CMD_SCHED_PARAM,
+		.help_str	= SHELL_CMD_SCHED_HELP,
+		.fcn		= shell_show_sched,
+	},
+	{
+		.str		= SHELL_CMD_SOFTIRQ,
+		.cmd_param	= SHELL_CMD_SOFTIRQ_PARAM,
+		.help_str	= SHELL_CMD_SOFTIRQ_HELP,
+		.fcn		= shell_show_softirq,
+	},
+	{
+		.str		= SHELL_CMD_IDLE,
+		.cmd_param	= SHELL_CMD_IDLE_PARAM,
+		.help_str	= SHELL_CMD_IDLE_HELP,
+		.fcn		= shell_idle,
+	},
+	{
+		.str		= SHELL_CMD_EPT,
+		.cmd_param	= SHELL_CMD_EPT_PARAM,
+		.help_str	= SHELL_CMD_EPT_HELP,
+		.fcn		= shell_show_ept,
+	},
+	{
+		.str		= SHELL_CMD_VMEXIT,
+		.cmd_param	= SHELL_CMD_VMEXIT_PARAM,
+		.help_str	= SHELL_CMD_VMEXIT_HELP,
+		.fcn		= shell_show_vmexit,
+	},
+	{
+		.str		= SHELL_CMD_PERF_TOP,
+		.cmd_param	= SHELL_CMD_PERF_TOP_PARAM,
+		.help_str	= SHELL_CMD_PERF_TOP_HELP,
+		.fcn		= shell_perf_top,
+	},
+	{
+		.str		= SHELL_CMD_VCPUID,
+		.cmd_param	= SHELL_CMD_VCPUID_PARAM,
+		.help_str	= SHELL_CMD_VCPUID_HELP,
+		.fcn		= shell_show_vcpuid,
+	},
+	{
+		.str		= SHELL_CMD_SWORLD,
+		.cmd_param	= SHELL_CMD_SWORLD_PARAM,
+		.help_str	= SHELL_CMD_SWORLD_HELP,
+		.fcn		= shell_show_sworld,
+	},
 };
 
 /* The initial log level*/
@@ -1094,6 +1164,604 @@ static int32_t shell_show_vioapic_info(int32_t argc, char **argv)
 	return -EINVAL;
 }
 
+static void get_vm_pio_info(char *str_arg, size_t str_max, uint16_t vmid)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	struct acrn_vm *vm = get_vm_from_vmid(vmid);
+	struct vm_io_handler_desc *handler;
+	uint32_t idx;
+
+	if (vm == NULL) {
+		len = snprintf(str, size, "\r\nvm is not exist for vmid %hu", vmid);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+		goto END;
+	}
+
+	len = snprintf(str, size, "\r\nIDX\tSTART\tEND\tCOUNT");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (idx = 0U; idx < EMUL_PIO_IDX_MAX; idx++) {
+		handler = &vm->arch_vm.emul_pio[idx];
+		if (handler->port_end <= handler->port_start) {
+			continue;
+		}
+
+		len = snprintf(str, size, "\r\n%u\t0x%04x\t0x%04x\t%llu", idx,
+				handler->port_start, handler->port_end, handler->access_cnt);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+END:
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int32_t shell_show_vm_pio_info(int32_t argc, char **argv)
+{
+	uint16_t vmid;
+	int32_t ret;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+	ret = atoi(argv[1]);
+	if (ret >= 0) {
+		vmid = (uint16_t) ret;
+		get_vm_pio_info(shell_log_buf, SHELL_LOG_BUF_SIZE, vmid);
+		shell_puts(shell_log_buf);
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static int32_t shell_show_hcall_lat(int32_t argc, char **argv)
+{
+	if (argc == 1) {
+		get_hcall_latency_info(shell_log_buf, SHELL_LOG_BUF_SIZE);
+		shell_puts(shell_log_buf);
+		return 0;
+	}
+
+	if ((argc == 2) && (strcmp(argv[1], "clear") == 0)) {
+		hcall_stats_clear();
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static int32_t shell_show_softirq(int32_t argc, char **argv)
+{
+	if (argc == 1) {
+		get_softirq_stats_info(shell_log_buf, SHELL_LOG_BUF_SIZE);
+		shell_puts(shell_log_buf);
+		return 0;
+	}
+
+	if ((argc == 2) && (strcmp(argv[1], "clear") == 0)) {
+		softirq_stats_clear();
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static int32_t shell_show_sched(__unused int32_t argc, __unused char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	uint16_t i;
+	uint16_t idx;
+
+	snprintf(temp_str, MAX_STR_SIZE, "\r\nscheduler: %s\r\n",
+			per_cpu(sched_ctx, BOOT_CPU_ID).scheduler->name);
+	shell_puts(temp_str);
+	shell_puts("\r\nVM ID    PCPU ID    VCPU ID    PRIO    RUNTIME(us)     GUEST(us)       STEAL(us)       DM WAIT(us)     SWITCHES"
+		"\r\n=====    =======    =======    ====    ===========     =========       =========       ===========     ========\r\n");
+
+	for (idx = 0U; idx < CONFIG_MAX_VM_NUM; idx++) {
+		vm = get_vm_from_vmid(idx);
+		if (vm == NULL) {
+			continue;
+		}
+		foreach_vcpu(i, vm, vcpu) {
+			snprintf(temp_str, MAX_STR_SIZE,
+					"  %-9d %-10d %-10hu %-7s %-15llu %-15llu %-15llu %-15llu %llu\r\n",
+					vm->vm_id,
+					vcpu->pcpu_id,
+					vcpu->vcpu_id,
+					(vcpu->sched.prio == SCHED_PRIO_HIGH) ?
+					"HIGH" : "LOW",
+					ticks_to_us(vcpu->sched.runtime),
+					ticks_to_us(vcpu->sched.guest_time),
+					ticks_to_us(vcpu->sched.steal_time),
+					ticks_to_us(vcpu->sched.dm_wait),
+					vcpu->sched.nr_switches);
+			shell_puts(temp_str);
+		}
+	}
+
+	return 0;
+}
+
+/* Count the 1G, 2M and 4K leaves of the normal world EPT of a VM */
+static void ept_count_leaves(const struct acrn_vm *vm, uint64_t nr_leaves[3])
+{
+	const struct memory_ops *mem_ops = &vm->arch_vm.ept_mem_ops;
+	const uint64_t *pml4_page = (const uint64_t *)vm->arch_vm.nworld_eptp;
+	const uint64_t *pdpt_page, *pd_page, *pt_page;
+	uint64_t i, j, k, l;
+
+	nr_leaves[0] = 0UL;
+	nr_leaves[1] = 0UL;
+	nr_leaves[2] = 0UL;
+	for (i = 0UL; i < PTRS_PER_PML4E; i++) {
+		if (mem_ops->pgentry_present(pml4_page[i]) == 0UL) {
+			continue;
+		}
+		pdpt_page = pml4e_page_vaddr(pml4_page[i]);
+		for (j = 0UL; j < PTRS_PER_PDPTE; j++) {
+			if (mem_ops->pgentry_present(pdpt_page[j]) == 0UL) {
+				continue;
+			}
+			if (pdpte_large(pdpt_page[j]) != 0UL) {
+				nr_leaves[0]++;
+				continue;
+			}
+			pd_page = pdpte_page_vaddr(pdpt_page[j]);
+			for (k = 0UL; k < PTRS_PER_PDE; k++) {
+				if (mem_ops->pgentry_present(pd_page[k]) == 0UL) {
+					continue;
+				}
+				if (pde_large(pd_page[k]) != 0UL) {
+					nr_leaves[1]++;
+					continue;
+				}
+				pt_page = pde_page_vaddr(pd_page[k]);
+				for (l = 0UL; l < PTRS_PER_PTE; l++) {
+					if (mem_ops->pgentry_present(pt_page[l]) != 0UL) {
+						nr_leaves[2]++;
+					}
+				}
+			}
+		}
+	}
+}
+
+static int32_t shell_show_ept(__unused int32_t argc, __unused char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	char pool_str[32];
+	char merge_str[32];
+	struct acrn_vm *vm;
+	const struct ept_pool_quota *quota;
+	uint64_t nr_leaves[3];
+	uint16_t idx;
+
+	shell_puts("\r\nVM ID    POOL PAGES         SPLITS     MERGES 2M/1G    1G PAGES   2M PAGES   4K PAGES"
+		"\r\n=====    ==========         ======     ============    ========   ========   ========\r\n");
+
+	for (idx = 0U; idx < CONFIG_MAX_VM_NUM; idx++) {
+		vm = get_vm_from_vmid(idx);
+		if (vm == NULL) {
+			continue;
+		}
+		quota = vm->arch_vm.ept_mem_ops.info->ept.pool;
+		if (quota != NULL) {
+			snprintf(pool_str, 32U, "%llu/%llu", quota->used, quota->limit);
+		} else {
+			/* vm0 has static page tables */
+			(void)strncpy_s(pool_str, 32U, "-", 32U);
+		}
+		snprintf(merge_str, 32U, "%llu/%llu", vm->arch_vm.ept_stats.nr_merged,
+				vm->arch_vm.ept_stats.nr_merged_1g);
+		ept_count_leaves(vm, nr_leaves);
+		snprintf(temp_str, MAX_STR_SIZE, "  %-6hu %-18s %-10llu %-15s %-10llu %-10llu %llu\r\n",
+				vm->vm_id, pool_str, vm->arch_vm.ept_stats.nr_split, merge_str,
+				nr_leaves[0], nr_leaves[1], nr_leaves[2]);
+		shell_puts(temp_str);
+	}
+
+	return 0;
+}
+
+/* Upper bound in cycles of the histogram bucket holding the percentile */
+static uint64_t vmexit_percentile(const struct acrn_exit_reason_stats *stats, uint64_t percent)
+{
+	uint64_t target = ((stats->count * percent) + 99UL) / 100UL;
+	uint64_t seen = 0UL;
+	uint32_t i;
+
+	for (i = 0U; i < (ACRN_VMEXIT_HIST_BUCKETS - 1U); i++) {
+		seen += stats->hist[i];
+		if (seen >= target) {
+			break;
+		}
+	}
+
+	return (i == (ACRN_VMEXIT_HIST_BUCKETS - 1U)) ? stats->max_cycles : (1UL << (i + 1U));
+}
+
+static void shell_show_vcpu_vmexit(const struct acrn_vcpu *vcpu)
+{
+	char temp_str[MAX_STR_SIZE];
+	const struct acrn_exit_reason_stats *stats;
+	const struct msr_exit_stats *msr;
+	const struct acrn_vm *vm = vcpu->vm;
+	uint64_t count;
+	uint16_t i;
+
+	snprintf(temp_str, MAX_STR_SIZE, "\r\nVM %hu VCPU %hu\r\n"
+			"REASON    COUNT           AVG        MAX            P50        P99        (cycles)\r\n",
+			vm->vm_id, vcpu->vcpu_id);
+	shell_puts(temp_str);
+
+	for (i = 0U; i < ACRN_VMEXIT_REASONS; i++) {
+		stats = &vcpu->exit_stats.reason[i];
+		if (stats->count == 0UL) {
+			continue;
+		}
+		snprintf(temp_str, MAX_STR_SIZE, "%-9hu %-15llu %-10llu %-14llu %-10llu %llu\r\n",
+				i, stats->count, stats->total_cycles / stats->count, stats->max_cycles,
+				vmexit_percentile(stats, 50UL), vmexit_percentile(stats, 99UL));
+		shell_puts(temp_str);
+	}
+
+	for (i = 0U; i < vm->emul_mmio_regions; i++) {
+		count = vcpu->exit_stats.mmio_count[i];
+		if (count == 0UL) {
+			continue;
+		}
+		snprintf(temp_str, MAX_STR_SIZE, "MMIO [0x%llx, 0x%llx)    %-15llu %llu\r\n",
+				vm->emul_mmio[i].range_start, vm->emul_mmio[i].range_end,
+				count, vcpu->exit_stats.mmio_cycles[i] / count);
+		shell_puts(temp_str);
+	}
+
+	for (i = 0U; i < VMEXIT_MSR_SLOTS; i++) {
+		msr = &vcpu->exit_stats.msr[i];
+		if ((msr->reads | msr->writes) == 0UL) {
+			break;
+		}
+		snprintf(temp_str, MAX_STR_SIZE, "MSR 0x%08x    RD %-15llu WR %llu\r\n",
+				msr->msr, msr->reads, msr->writes);
+		shell_puts(temp_str);
+	}
+
+	if (vcpu->exit_stats.msr_other != 0UL) {
+		snprintf(temp_str, MAX_STR_SIZE, "MSR other         %llu\r\n",
+				vcpu->exit_stats.msr_other);
+		shell_puts(temp_str);
+	}
+
+	for (i = 0U; i < 32U; i++) {
+		if ((vcpu->exit_stats.cr0_bit_writes[i] | vcpu->exit_stats.cr4_bit_writes[i]) == 0UL) {
+			continue;
+		}
+		snprintf(temp_str, MAX_STR_SIZE, "CR bit %-2hu    CR0 %-15llu CR4 %llu\r\n",
+				i, vcpu->exit_stats.cr0_bit_writes[i], vcpu->exit_stats.cr4_bit_writes[i]);
+		shell_puts(temp_str);
+	}
+}
+
+static int32_t shell_show_vmexit(int32_t argc, char **argv)
+{
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	int32_t vm_id;
+	uint16_t i;
+
+	if ((argc != 2) && ((argc != 3) || (strcmp(argv[2], "clear") != 0))) {
+		return -EINVAL;
+	}
+
+	vm_id = atoi(argv[1]);
+	vm = (vm_id >= 0) ? get_vm_from_vmid((uint16_t)vm_id) : NULL;
+	if (vm == NULL) {
+		shell_puts("No vm found in the input <vm_id>\r\n");
+		return -EINVAL;
+	}
+
+	foreach_vcpu(i, vm, vcpu) {
+		if (argc == 3) {
+			/* racing with the vCPU at worst loses the counts of an exit */
+			(void)memset((void *)&vcpu->exit_stats, 0U, sizeof(vcpu->exit_stats));
+		} else {
+			shell_show_vcpu_vmexit(vcpu);
+		}
+	}
+
+	return 0;
+}
+
+#define PERF_TOP_DEFAULT_MS	1000U
+#define PERF_TOP_MIN_MS		100U
+#define PERF_TOP_REASONS	3U	/* exit reasons shown per vCPU */
+
+/* counters of a vCPU at the previous perf_top period */
+struct perf_top_snapshot {
+	uint64_t exits[ACRN_VMEXIT_REASONS];
+	uint64_t dm_requests;
+	uint64_t dm_wait;
+	uint64_t intr_sent;
+	uint64_t timer_fired;
+};
+
+static struct hv_timer perf_top_timer;
+static uint64_t perf_top_tsc;
+static struct perf_top_snapshot perf_top_last[CONFIG_MAX_VM_NUM][CONFIG_MAX_VCPUS_PER_VM];
+
+/* a counter cleared or a VM created again meanwhile restarts from 0 */
+static inline uint64_t perf_top_delta(uint64_t now, uint64_t *last)
+{
+	uint64_t delta = (now >= *last) ? (now - *last) : now;
+
+	*last = now;
+	return delta;
+}
+
+static void perf_top_vcpu(const struct acrn_vcpu *vcpu, struct perf_top_snapshot *last,
+		uint64_t period_us, bool print)
+{
+	char temp_str[MAX_STR_SIZE];
+	uint64_t exits[ACRN_VMEXIT_REASONS];
+	uint64_t nr_exits = 0UL, dm_requests, dm_wait, intr, timer;
+	uint64_t top_rate[PERF_TOP_REASONS];
+	uint16_t top[PERF_TOP_REASONS];
+	uint16_t i, j;
+	size_t len;
+
+	for (i = 0U; i < ACRN_VMEXIT_REASONS; i++) {
+		exits[i] = perf_top_delta(vcpu->exit_stats.reason[i].count, &last->exits[i]);
+		nr_exits += exits[i];
+	}
+	dm_requests = perf_top_delta(vcpu->sched.dm_requests, &last->dm_requests);
+	dm_wait = perf_top_delta(vcpu->sched.dm_wait, &last->dm_wait);
+	intr = perf_top_delta(vcpu->exit_stats.intr_sent, &last->intr_sent);
+	timer = perf_top_delta(vcpu->exit_stats.timer_fired, &last->timer_fired);
+
+	if (!print) {
+		return;
+	}
+
+	/* the busiest exit reasons, in decreasing order */
+	for (j = 0U; j < PERF_TOP_REASONS; j++) {
+		top[j] = ACRN_VMEXIT_REASONS;
+		for (i = 0U; i < ACRN_VMEXIT_REASONS; i++) {
+			if ((exits[i] != 0UL) && ((top[j] == ACRN_VMEXIT_REASONS) || (exits[i] > exits[top[j]]))) {
+				top[j] = i;
+			}
+		}
+		if (top[j] != ACRN_VMEXIT_REASONS) {
+			top_rate[j] = (exits[top[j]] * 1000000UL) / period_us;
+			/* out of the next rounds */
+			exits[top[j]] = 0UL;
+		}
+	}
+
+	len = (size_t)snprintf(temp_str, MAX_STR_SIZE, "%-4hu %-5hu %-5hu %-10llu %-9llu %-11llu %-9llu %-9llu",
+			vcpu->vm->vm_id, vcpu->vcpu_id, vcpu->pcpu_id,
+			(nr_exits * 1000000UL) / period_us,
+			(dm_requests * 1000000UL) / period_us,
+			(dm_requests != 0UL) ? ticks_to_us(dm_wait / dm_requests) : 0UL,
+			(intr * 1000000UL) / period_us,
+			(timer * 1000000UL) / period_us);
+	for (j = 0U; (j < PERF_TOP_REASONS) && (top[j] != ACRN_VMEXIT_REASONS) && (len < MAX_STR_SIZE); j++) {
+		len += (size_t)snprintf(temp_str + len, MAX_STR_SIZE - len, " %hu:%llu",
+				top[j], top_rate[j]);
+	}
+	shell_puts(temp_str);
+	shell_puts("\r\n");
+}
+
+/* Snapshot the counters of all vCPUs, printing their rates since the last one */
+static void perf_top_sample(bool print)
+{
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	uint64_t now = rdtsc();
+	uint64_t period_us = ticks_to_us(now - perf_top_tsc);
+	uint16_t idx, i;
+
+	perf_top_tsc = now;
+	if (period_us == 0UL) {
+		period_us = 1UL;
+	}
+
+	if (print) {
+		shell_puts("\r\nVM   VCPU  PCPU  EXITS/s    IOREQ/s   DM RTT(us)  INTR/s    TIMER/s   TOP EXITS (reason:/s)\r\n");
+	}
+
+	for (idx = 0U; idx < CONFIG_MAX_VM_NUM; idx++) {
+		vm = get_vm_from_vmid(idx);
+		if (vm == NULL) {
+			continue;
+		}
+		foreach_vcpu(i, vm, vcpu) {
+			perf_top_vcpu(vcpu, &perf_top_last[idx][i], period_us, print);
+		}
+	}
+}
+
+static void perf_top_timer_callback(__unused void *data)
+{
+	perf_top_sample(true);
+}
+
+static int32_t shell_perf_top(int32_t argc, char **argv)
+{
+	uint64_t period_in_cycle;
+	int32_t period_ms = (int32_t)PERF_TOP_DEFAULT_MS;
+
+	if (argc > 2) {
+		return -EINVAL;
+	}
+
+	del_timer(&perf_top_timer);
+	if (argc == 2) {
+		if (strcmp(argv[1], "off") == 0) {
+			return 0;
+		}
+		period_ms = atoi(argv[1]);
+		if (period_ms < (int32_t)PERF_TOP_MIN_MS) {
+			shell_puts("The period is at least 100 ms\r\n");
+			return -EINVAL;
+		}
+	}
+
+	/* the first period starts from here */
+	perf_top_sample(false);
+
+	period_in_cycle = CYCLES_PER_MS * (uint64_t)period_ms;
+	initialize_timer(&perf_top_timer, perf_top_timer_callback, NULL,
+			rdtsc() + period_in_cycle, TICK_MODE_PERIODIC, period_in_cycle);
+	if (add_timer(&perf_top_timer) != 0) {
+		return -EINVAL;
+	}
+	shell_puts("Type \"perf_top off\" to stop\r\n");
+
+	return 0;
+}
+
+static int32_t shell_show_vcpuid(int32_t argc, char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	struct vcpuid_entry *entry;
+	int32_t vm_id;
+	uint32_t i;
+
+	if ((argc != 2) && ((argc != 3) || (strcmp(argv[2], "clear") != 0))) {
+		return -EINVAL;
+	}
+
+	vm_id = atoi(argv[1]);
+	vm = (vm_id >= 0) ? get_vm_from_vmid((uint16_t)vm_id) : NULL;
+	if (vm == NULL) {
+		shell_puts("No vm found in the input <vm_id>\r\n");
+		return -EINVAL;
+	}
+
+	if (argc == 2) {
+		shell_puts("\r\nLEAF        SUBLEAF  EAX        EBX        ECX        EDX        HITS\r\n");
+	}
+
+	for (i = 0U; i < vm->vcpuid_entry_nr; i++) {
+		entry = &vm->vcpuid_entries[i];
+		if (argc == 3) {
+			entry->hits = 0UL;
+		} else {
+			snprintf(temp_str, MAX_STR_SIZE, "0x%08x  0x%-5x  0x%08x 0x%08x 0x%08x 0x%08x %lld\r\n",
+				entry->leaf, entry->subleaf, entry->eax, entry->ebx, entry->ecx, entry->edx,
+				entry->hits);
+			shell_puts(temp_str);
+		}
+	}
+
+	return 0;
+}
+
+static int32_t shell_show_sworld(int32_t argc, char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	const char *world_name[NR_WORLD] = { "normal", "secure" };
+	struct acrn_vm *vm;
+	const struct acrn_exit_reason_stats *stats;
+	int32_t vm_id;
+	uint16_t i;
+
+	if ((argc != 2) && ((argc != 3) || (strcmp(argv[2], "clear") != 0))) {
+		return -EINVAL;
+	}
+
+	vm_id = atoi(argv[1]);
+	vm = (vm_id >= 0) ? get_vm_from_vmid((uint16_t)vm_id) : NULL;
+	if (vm == NULL) {
+		shell_puts("No vm found in the input <vm_id>\r\n");
+		return -EINVAL;
+	}
+
+	if (argc == 3) {
+		/* racing with a world switch at worst loses its count */
+		(void)memset((void *)vm->sworld_control.switch_stats, 0U, sizeof(vm->sworld_control.switch_stats));
+		return 0;
+	}
+
+	shell_puts("\r\nTO WORLD  COUNT           AVG        MAX            P50        P99        (cycles)\r\n");
+	for (i = 0U; i < NR_WORLD; i++) {
+		stats = &vm->sworld_control.switch_stats[i];
+		if (stats->count == 0UL) {
+			continue;
+		}
+		snprintf(temp_str, MAX_STR_SIZE, "%-9s %-15llu %-10llu %-14llu %-10llu %llu\r\n",
+				world_name[i], stats->count, stats->total_cycles / stats->count,
+				stats->max_cycles, vmexit_percentile(stats, 50UL), vmexit_percentile(stats, 99UL));
+		shell_puts(temp_str);
+	}
+
+	return 0;
+}
+
+static int32_t shell_idle(int32_t argc, char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct sched_context *ctx;
+	uint32_t policy, hint = CONFIG_IDLE_MWAIT_HINT;
+	uint16_t pcpu_id;
+
+	if (argc == 1) {
+		shell_puts("\r\nPCPU ID    POLICY      HINT    AVG IDLE(us)"
+			"\r\n=======    ======      ====    ============\r\n");
+		for (pcpu_id = 0U; pcpu_id < phys_cpu_num; pcpu_id++) {
+			ctx = &per_cpu(sched_ctx, pcpu_id);
+			snprintf(temp_str, MAX_STR_SIZE, "  %-8hu %-11s 0x%02x    %llu\r\n",
+					pcpu_id, get_idle_policy_name(ctx->idle_policy),
+					ctx->mwait_hint, ticks_to_us(ctx->idle_avg));
+			shell_puts(temp_str);
+		}
+		return 0;
+	}
+
+	if ((argc != 3) && (argc != 4)) {
+		return -EINVAL;
+	}
+
+	pcpu_id = (uint16_t)atoi(argv[1]);
+	if (pcpu_id >= phys_cpu_num) {
+		return -EINVAL;
+	}
+
+	for (policy = 0U; policy < NR_IDLE_POLICIES; policy++) {
+		if (strcmp(argv[2], get_idle_policy_name(policy)) == 0) {
+			break;
+		}
+	}
+
+	if (argc == 4) {
+		hint = (uint32_t)strtoul_hex(argv[3]);
+	}
+
+	return set_idle_policy(pcpu_id, policy, hint);
+}
+
 static void get_rte_info(union ioapic_rte rte, bool *mask, bool *irr,
 	bool *phys, uint32_t *delmode, bool *level, uint32_t *vector, uint32_t *dest)
 {
@@ -78,6 +78,10 @@ struct shell {
 #define SHELL_CMD_VIOAPIC_PARAM		"<vm id>"
 #define SHELL_CMD_VIOAPIC_HELP		"show vioapic info"
 
+#define SHELL_CMD_VM_PIO		"vm_pio"
+#define SHELL_CMD_VM_PIO_PARAM		"<vm id>"
+#define SHELL_CMD_VM_PIO_HELP		"show emulated port I/O ranges and access counts"
+
 #define SHELL_CMD_LOG_LVL		"loglevel"
 #define SHELL_CMD_LOG_LVL_PARAM		"[<console_loglevel> [<mem_loglevel> " \
 					"[npk_loglevel]]]"
@@ -86,4 +90,40 @@ struct shell {
 #define SHELL_CMD_CPUID			"cpuid"
 #define SHELL_CMD_CPUID_PARAM		"<leaf> [subleaf]"
 #define SHELL_CMD_CPUID_HELP		"cpuid leaf [subleaf], in hexadecimal"
+
+#define SHELL_CMD_HCALL_LAT		"hcall_lat"
+#define SHELL_CMD_HCALL_LAT_PARAM	"[clear]"
+#define SHELL_CMD_HCALL_LAT_HELP	"show per-hypercall latency, or clear the histograms"
+
+#define SHELL_CMD_SOFTIRQ		"softirq"
+#define SHELL_CMD_SOFTIRQ_PARAM		"[clear]"
+#define SHELL_CMD_SOFTIRQ_HELP		"show per-pCPU softirq run count and cycles, or clear them"
+
+#define SHELL_CMD_SCHED			"sched"
+#define SHELL_CMD_SCHED_PARAM		NULL
+#define SHELL_CMD_SCHED_HELP		"show vCPU scheduler, priority and runtime accounting"
+
+#define SHELL_CMD_IDLE			"idle"
+#define SHELL_CMD_IDLE_PARAM		"[<pcpu_id> <poll|mwait|adaptive> [mwait_hint]]"
+#define SHELL_CMD_IDLE_HELP		"show or set the idle policy of pCPUs"
+
+#define SHELL_CMD_EPT			"ept"
+#define SHELL_CMD_EPT_PARAM		NULL
+#define SHELL_CMD_EPT_HELP		"show EPT page pool usage, large page split/merge counts and page sizes"
+
+#define SHELL_CMD_VMEXIT		"vmexit"
+#define SHELL_CMD_VMEXIT_PARAM		"<vm_id> [clear]"
+#define SHELL_CMD_VMEXIT_HELP		"show per-vCPU VM exit counts and cycles by exit reason and MMIO region"
+
+#define SHELL_CMD_PERF_TOP		"perf_top"
+#define SHELL_CMD_PERF_TOP_PARAM	"[<period_ms>|off]"
+#define SHELL_CMD_PERF_TOP_HELP		"print per-vCPU exit, I/O request, interrupt and timer rates periodically"
+
+#define SHELL_CMD_VCPUID		"vcpuid"
+#define SHELL_CMD_VCPUID_PARAM		"<vm_id> [clear]"
+#define SHELL_CMD_VCPUID_HELP		"show the CPUID table of a VM with the exits served by each entry"
+
+#define SHELL_CMD_SWORLD		"sworld"
+#define SHELL_CMD_SWORLD_PARAM		"<vm_id> [clear]"
+#define SHELL_CMD_SWORLD_HELP		"show trusty world switch counts and cycles of a VM"
 #endif /* SHELL_PRIV_H */
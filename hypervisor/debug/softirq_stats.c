@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <hypervisor.h>
+#include <softirq.h>
+
+static struct softirq_stat softirq_stats[CONFIG_MAX_PCPU_NUM][NR_SOFTIRQS];
+
+static const char *const softirq_names[NR_SOFTIRQS] = {
+	[SOFTIRQ_TIMER] = "TIMER",
+	[SOFTIRQ_PTDEV] = "PTDEV",
+	[SOFTIRQ_POSTED_INTR] = "POSTED_INTR",
+};
+
+void softirq_stats_record(uint16_t pcpu_id, uint16_t nr, uint64_t cycles)
+{
+	struct softirq_stat *stat = &softirq_stats[pcpu_id][nr];
+
+	stat->count++;
+	stat->total_cycles += cycles;
+	if (cycles > stat->max_cycles) {
+		stat->max_cycles = cycles;
+	}
+}
+
+void softirq_stats_clear(void)
+{
+	(void)memset((void *)softirq_stats, 0U, sizeof(softirq_stats));
+}
+
+void get_softirq_stats_info(char *str_arg, size_t str_max)
+{
+	char *str = str_arg;
+	size_t len, size = str_max;
+	const struct softirq_stat *stat;
+	uint16_t pcpu_id, nr;
+
+	len = snprintf(str, size, "\r\nPCPU\tSOFTIRQ\tCOUNT\t\tAVG\tMAX\t(cycles)");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (pcpu_id = 0U; pcpu_id < phys_cpu_num; pcpu_id++) {
+		for (nr = 0U; nr < NR_SOFTIRQS; nr++) {
+			stat = &softirq_stats[pcpu_id][nr];
+			if (stat->count == 0UL) {
+				continue;
+			}
+
+			len = snprintf(str, size, "\r\n%hu\t%s\t%-12lld\t%lld\t%lld",
+					pcpu_id, softirq_names[nr], stat->count,
+					stat->total_cycles / stat->count, stat->max_cycles);
+			if (len >= size) {
+				goto overflow;
+			}
+			size -= len;
+			str += len;
+		}
+	}
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
@@ -36,13 +36,121 @@ struct trace_entry {
 	} payload;
 } __attribute__((aligned(8)));
 
-static inline bool trace_check(uint16_t cpu_id)
+/* Events enabled by the SOS, see struct trace_mask_param */
+static uint64_t trace_mask[TRACE_MASK_WORDS] = {
+	~0UL, ~0UL, ~0UL, ~0UL, ~0UL, ~0UL
+};
+
+static inline uint32_t trace_mask_bit(uint32_t evid)
+{
+	uint32_t bit;
+
+	if (evid < TRACE_MASK_VMEXIT) {
+		bit = evid;
+	} else if ((evid >= TRACE_VMEXIT_ENTRY) && (evid < (TRACE_VMEXIT_ENTRY + 64U))) {
+		bit = TRACE_MASK_VMEXIT + (evid - TRACE_VMEXIT_ENTRY);
+	} else {
+		bit = TRACE_MASK_OTHER;
+	}
+
+	return bit;
+}
+
+/* Aggregation state of one pCPU, only touched by that pCPU but for snapshots */
+struct trace_aggr_state {
+	struct trace_aggr stats;
+	uint64_t exit_tsc;
+	/* Reason of the VM exit being handled, TRACE_AGGR_EXIT_REASONS if none */
+	uint32_t exit_reason;
+};
+
+static bool trace_aggr_on;
+static struct trace_aggr_state trace_aggr_states[CONFIG_MAX_PCPU_NUM];
+
+static inline bool trace_check(uint16_t cpu_id, uint32_t evid)
 {
-	if (per_cpu(sbuf, cpu_id)[ACRN_TRACE] == NULL) {
+	uint32_t bit = trace_mask_bit(evid);
+
+	if (!trace_aggr_on && !npk_trace_on() && (per_cpu(sbuf, cpu_id)[ACRN_TRACE] == NULL)) {
 		return false;
 	}
 
-	return true;
+	return ((trace_mask[bit >> 6U] & (1UL << (bit & 0x3FU))) != 0UL);
+}
+
+void trace_set_mask(const struct trace_mask_param *param)
+{
+	uint32_t i;
+
+	/* Each word is updated atomically, racing events go either way */
+	for (i = 0U; i < TRACE_MASK_WORDS; i++) {
+		trace_mask[i] = param->mask[i];
+	}
+}
+
+void trace_aggregate(bool enable)
+{
+	uint16_t pcpu_id;
+	uint64_t now = rdtsc();
+
+	if (enable) {
+		/* Stop first so that no pCPU accounts into a half cleared state */
+		trace_aggr_on = false;
+		cpu_write_memory_barrier();
+		for (pcpu_id = 0U; pcpu_id < phys_cpu_num; pcpu_id++) {
+			(void)memset((void *)&trace_aggr_states[pcpu_id], 0U, sizeof(struct trace_aggr_state));
+			trace_aggr_states[pcpu_id].stats.start_tsc = now;
+			trace_aggr_states[pcpu_id].exit_reason = TRACE_AGGR_EXIT_REASONS;
+		}
+		cpu_write_memory_barrier();
+	}
+
+	trace_aggr_on = enable;
+}
+
+int32_t trace_aggr_snapshot(struct trace_aggr *aggr)
+{
+	uint16_t pcpu_id = aggr->pcpu_id;
+
+	if (pcpu_id >= phys_cpu_num) {
+		return -EINVAL;
+	}
+
+	(void)memcpy_s((void *)aggr, sizeof(struct trace_aggr),
+		(const void *)&trace_aggr_states[pcpu_id].stats, sizeof(struct trace_aggr));
+	aggr->pcpu_id = pcpu_id;
+	aggr->tsc = rdtsc();
+
+	return 0;
+}
+
+static inline uint32_t trace_aggr_bucket(uint64_t cycles)
+{
+	uint32_t bucket = (cycles == 0UL) ? 0U : (uint32_t)fls64(cycles);
+
+	return (bucket < TRACE_AGGR_HIST_BUCKETS) ? bucket : (TRACE_AGGR_HIST_BUCKETS - 1U);
+}
+
+static void trace_aggr_put(uint16_t cpu_id, uint32_t evid, const struct trace_entry *entry)
+{
+	struct trace_aggr_state *state = &trace_aggr_states[cpu_id];
+	uint32_t reason = state->exit_reason;
+	uint64_t cycles;
+
+	state->stats.count[trace_mask_bit(evid)]++;
+
+	if (evid == TRACE_VM_EXIT) {
+		/* The basic exit reason is the first data word */
+		state->exit_tsc = entry->tsc;
+		state->exit_reason = (uint32_t)(entry->payload.fields_64.e & 0xFFFFUL);
+	} else if ((evid == TRACE_VM_ENTER) && (reason < TRACE_AGGR_EXIT_REASONS)) {
+		cycles = entry->tsc - state->exit_tsc;
+		state->stats.exit_cycles[reason] += cycles;
+		state->stats.exit_hist[reason][trace_aggr_bucket(cycles)]++;
+		state->exit_reason = TRACE_AGGR_EXIT_REASONS;
+	} else {
+		/* Only counted */
+	}
 }
 
 static inline void trace_put(uint16_t cpu_id, uint32_t evid, uint32_t n_data, struct trace_entry *entry)
@@ -51,10 +159,20 @@ static inline void trace_put(uint16_t cpu_id, uint32_t evid, uint32_t n_data, st
 				per_cpu(sbuf, cpu_id)[ACRN_TRACE];
 
 	entry->tsc = rdtsc();
+	if (trace_aggr_on) {
+		trace_aggr_put(cpu_id, evid, entry);
+		return;
+	}
+
 	entry->id = evid;
 	entry->n_data = (uint8_t)n_data;
 	entry->cpu = (uint8_t)cpu_id;
-	(void)sbuf_put(sbuf, (uint8_t *)entry);
+	if (npk_trace_on()) {
+		/* the records keep the sbuf layout, acrntrace tools decode both */
+		npk_trace_write((const uint64_t *)entry, (uint32_t)(sizeof(struct trace_entry) / sizeof(uint64_t)));
+	} else {
+		(void)sbuf_put(sbuf, (uint8_t *)entry);
+	}
 }
 
 void TRACE_2L(uint32_t evid, uint64_t e, uint64_t f)
@@ -62,7 +180,7 @@ void TRACE_2L(uint32_t evid, uint64_t e, uint64_t f)
 	struct trace_entry entry;
 	uint16_t cpu_id = get_cpu_id();
 
-	if (!trace_check(cpu_id)) {
+	if (!trace_check(cpu_id, evid)) {
 		return;
 	}
 
@@ -76,7 +194,7 @@ void TRACE_4I(uint32_t evid, uint32_t a, uint32_t b, uint32_t c, uint32_t d)
 	struct trace_entry entry;
 	uint16_t cpu_id = get_cpu_id();
 
-	if (!trace_check(cpu_id)) {
+	if (!trace_check(cpu_id, evid)) {
 		return;
 	}
 
@@ -92,7 +210,7 @@ void TRACE_6C(uint32_t evid, uint8_t a1, uint8_t a2, uint8_t a3, uint8_t a4, uin
 	struct trace_entry entry;
 	uint16_t cpu_id = get_cpu_id();
 
-	if (!trace_check(cpu_id)) {
+	if (!trace_check(cpu_id, evid)) {
 		return;
 	}
 
@@ -115,7 +233,7 @@ static inline void TRACE_16STR(uint32_t evid, const char name[])
 	uint16_t cpu_id = get_cpu_id();
 	size_t len, i;
 
-	if (!trace_check(cpu_id)) {
+	if (!trace_check(cpu_id, evid)) {
 		return;
 	}
 
@@ -46,6 +46,9 @@ static char vuart_tx_buf[TX_BUF_SIZE];
 int8_t vuart_vmid = - 1;
 #endif
 
+/* No GSI operation applied to the COM IRQ yet */
+#define VUART_IRQ_OP_NONE	0xFFFFFFFFU
+
 static inline void fifo_reset(struct fifo *fifo)
 {
 	fifo->rindex = 0U;
@@ -124,7 +127,7 @@ static uint8_t vuart_intr_reason(const struct acrn_vuart *vu)
  * Toggle the COM port's intr pin depending on whether or not we have an
  * interrupt condition to report to the processor.
  */
-static void vuart_toggle_intr(const struct acrn_vuart *vu)
+static void vuart_toggle_intr(struct acrn_vuart *vu)
 {
 	uint8_t intr_reason;
 	union ioapic_rte rte;
@@ -149,8 +152,15 @@ static void vuart_toggle_intr(const struct acrn_vuart *vu)
 				GSI_SET_HIGH : GSI_SET_LOW;
 	}
 
-	vpic_set_irq(vu->vm, CONFIG_COM_IRQ, operation);
-	vioapic_set_irq(vu->vm, CONFIG_COM_IRQ, operation);
+	/*
+	 * Every register access lands here: a guest streaming bytes to THR
+	 * keeps the line where it is, so skip the vPIC/vIOAPIC updates then.
+	 */
+	if (operation != vu->irq_op) {
+		vu->irq_op = operation;
+		vpic_set_irq(vu->vm, CONFIG_COM_IRQ, operation);
+		vioapic_set_irq(vu->vm, CONFIG_COM_IRQ, operation);
+	}
 }
 
 static void vuart_write(struct acrn_vm *vm, uint16_t offset_arg,
@@ -401,6 +411,7 @@ void vuart_init(struct acrn_vm *vm)
 	vm->vuart.dlh = (uint8_t)(divisor >> 8U);
 
 	vm->vuart.active = false;
+	vm->vuart.irq_op = VUART_IRQ_OP_NONE;
 	vm->vuart.base = CONFIG_COM_BASE;
 	vm->vuart.vm = vm;
 	vuart_fifo_init(vu);
@@ -41,40 +41,58 @@
 #define IOAPIC_ID_MASK		0x0f000000U
 #define MASK_ALL_INTERRUPTS   0x0001000000010000UL
 
+/*
+ * Decode the delivery of the pin from its RTE, and index the pin by the
+ * vector.
+ * @pre the RTE of the pin is being written, with both locks held
+ */
+static void
+vioapic_update_pin(struct acrn_vioapic *vioapic, uint32_t pin,
+		union ioapic_rte last, union ioapic_rte rte)
+{
+	struct vioapic_pin *vpin = &vioapic->pins[pin];
+	uint32_t last_vector = last.u.lo_32 & IOAPIC_RTE_LOW_INTVEC;
+
+	vpin->vector = rte.u.lo_32 & IOAPIC_RTE_LOW_INTVEC;
+	vpin->dest = (uint32_t)(rte.full >> IOAPIC_RTE_DEST_SHIFT);
+	vpin->delmode = (uint32_t)(rte.full & IOAPIC_RTE_DELMOD);
+	vpin->phys = ((rte.full & IOAPIC_RTE_DESTMOD) == IOAPIC_RTE_DESTPHY);
+	vpin->level = ((rte.full & IOAPIC_RTE_TRGRLVL) != 0UL);
+
+	if (vpin->vector != last_vector) {
+		bitmap_clear_lock((uint16_t)(pin & 0x3FU),
+			&vioapic->vector_pins[last_vector][pin >> 6U]);
+	}
+	bitmap_set_lock((uint16_t)(pin & 0x3FU),
+		&vioapic->vector_pins[vpin->vector][pin >> 6U]);
+}
+
 /**
  * @pre pin < vioapic_pincount(vm)
+ * @pre the lock of the pin is held
  */
 static void
 vioapic_send_intr(struct acrn_vioapic *vioapic, uint32_t pin)
 {
-	uint32_t vector, dest, delmode;
-	union ioapic_rte rte;
-	bool level, phys;
+	const struct vioapic_pin *vpin = &vioapic->pins[pin];
 
-	rte = vioapic->rtbl[pin];
-
-	if ((rte.full & IOAPIC_RTE_INTMASK) == IOAPIC_RTE_INTMSET) {
+	if ((vioapic->rtbl[pin].full & IOAPIC_RTE_INTMASK) == IOAPIC_RTE_INTMSET) {
 		dev_dbg(ACRN_DBG_IOAPIC, "ioapic pin%hhu: masked", pin);
 		return;
 	}
 
-	phys = ((rte.full & IOAPIC_RTE_DESTMOD) == IOAPIC_RTE_DESTPHY);
-	delmode = (uint32_t)(rte.full & IOAPIC_RTE_DELMOD);
-	level = ((rte.full & IOAPIC_RTE_TRGRLVL) != 0UL);
 	/* For level trigger irq, avoid send intr if
 	 * previous one hasn't received EOI
 	 */
-	if (level) {
+	if (vpin->level) {
 		if ((vioapic->rtbl[pin].full & IOAPIC_RTE_REM_IRR) != 0UL) {
 			return;
 		}
 		vioapic->rtbl[pin].full |= IOAPIC_RTE_REM_IRR;
 	}
 
-	vector = rte.u.lo_32 & IOAPIC_RTE_LOW_INTVEC;
-	dest = (uint32_t)(rte.full >> IOAPIC_RTE_DEST_SHIFT);
-	vlapic_deliver_intr(vioapic->vm, level, dest, phys,
-							delmode, vector, false);
+	vlapic_deliver_intr(vioapic->vm, vpin->level, vpin->dest, vpin->phys,
+			vpin->delmode, vpin->vector, false);
 }
 
 /**
@@ -91,7 +109,7 @@ vioapic_set_pinstate(struct acrn_vioapic *vioapic, uint16_t pin, uint32_t level)
 		old_lvl = (uint32_t)bitmap_test(pin & 0x3FU, &vioapic->pin_state[pin >> 6U]);
 		if (level == 0U) {
 			/* clear pin_state and deliver interrupt according to polarity */
-			bitmap_clear_nolock(pin & 0x3FU,
+			bitmap_clear_lock(pin & 0x3FU,
 					&vioapic->pin_state[pin >> 6U]);
 			if (((rte.full & IOAPIC_RTE_INTPOL) != 0UL)
 				&& old_lvl != level) {
@@ -99,7 +117,8 @@ vioapic_set_pinstate(struct acrn_vioapic *vioapic, uint16_t pin, uint32_t level)
 			}
 		} else {
 			/* set pin_state and deliver intrrupt according to polarity */
-			bitmap_set_nolock(pin & 0x3FU, &vioapic->pin_state[pin >> 6U]);
+			/* the word is shared with pins under other locks */
+			bitmap_set_lock(pin & 0x3FU, &vioapic->pin_state[pin >> 6U]);
 			if (((rte.full & IOAPIC_RTE_INTPOL) == 0UL)
 				&& old_lvl != level) {
 				vioapic_send_intr(vioapic, pin);
@@ -111,8 +130,8 @@ vioapic_set_pinstate(struct acrn_vioapic *vioapic, uint16_t pin, uint32_t level)
 /**
  * @brief Set vIOAPIC IRQ line status.
  *
- * Similar with vioapic_set_irq(),but would not make sure
- * operation be done with ioapic lock.
+ * Similar with vioapic_set_irq(), but with the lock of the pin held
+ * by the caller already.
  *
  * @param[in] vm        Pointer to target VM
  * @param[in] irq       Target IRQ number
@@ -170,9 +189,12 @@ vioapic_set_irq(struct acrn_vm *vm, uint32_t irq, uint32_t operation)
 {
 	struct acrn_vioapic *vioapic = vm_ioapic(vm);
 
-	spinlock_obtain(&(vioapic->mtx));
-	vioapic_set_irq_nolock(vm, irq, operation);
-	spinlock_release(&(vioapic->mtx));
+	/* only the pin: interrupts on different pins never contend */
+	if (irq < REDIR_ENTRIES_HW) {
+		spinlock_obtain(&(vioapic->pins[irq].lock));
+		vioapic_set_irq_nolock(vm, irq, operation);
+		spinlock_release(&(vioapic->pins[irq].lock));
+	}
 }
 
 /*
@@ -274,7 +296,8 @@ static inline bool vioapic_need_intr(const struct acrn_vioapic *vioapic, uint16_
 
 /*
  * Due to the race between vcpus, ensure to do spinlock_obtain(&(vioapic->mtx))
- * & spinlock_release(&(vioapic->mtx)) by caller.
+ * & spinlock_release(&(vioapic->mtx)) by caller. The lock of the pin is
+ * taken here while its RTE changes.
  */
 static void
 vioapic_indirect_write(struct acrn_vioapic *vioapic, uint32_t addr,
@@ -311,6 +334,7 @@ vioapic_indirect_write(struct acrn_vioapic *vioapic, uint32_t addr,
 		uint32_t rte_offset = addr_offset >> 1U;
 		pin = rte_offset;
 
+		spinlock_obtain(&(vioapic->pins[pin].lock));
 		last = vioapic->rtbl[pin];
 		new = last;
 		if ((addr_offset & 1U) != 0U) {
@@ -345,6 +369,7 @@ vioapic_indirect_write(struct acrn_vioapic *vioapic, uint32_t addr,
 						"vpic wire mode -> IOAPIC");
 				} else {
 					pr_err("WARNING: invalid vpic wire mode change");
+					spinlock_release(&(vioapic->pins[pin].lock));
 					return;
 				}
 			/* unmask -> mask */
@@ -359,6 +384,7 @@ vioapic_indirect_write(struct acrn_vioapic *vioapic, uint32_t addr,
 			}
 		}
 		vioapic->rtbl[pin] = new;
+		vioapic_update_pin(vioapic, pin, last, new);
 		dev_dbg(ACRN_DBG_IOAPIC, "ioapic pin%hhu: redir table entry %#lx",
 		    pin, vioapic->rtbl[pin].full);
 		/*
@@ -394,6 +420,7 @@ vioapic_indirect_write(struct acrn_vioapic *vioapic, uint32_t addr,
 				"ioapic pin%hhu: asserted at rtbl write", pin);
 			vioapic_send_intr(vioapic, pin);
 		}
+		spinlock_release(&(vioapic->pins[pin].lock));
 
 		/* remap for ptdev */
 		if (((new.full & IOAPIC_RTE_INTMASK) == 0UL) ||
@@ -450,7 +477,8 @@ void
 vioapic_process_eoi(struct acrn_vm *vm, uint32_t vector)
 {
 	struct acrn_vioapic *vioapic;
-	uint32_t pin, pincount = vioapic_pincount(vm);
+	uint32_t i, pin, pincount = vioapic_pincount(vm);
+	uint64_t pins;
 	union ioapic_rte rte;
 
 	if ((vector < VECTOR_DYNAMIC_START) || (vector > NR_MAX_VECTOR)) {
@@ -461,47 +489,55 @@ vioapic_process_eoi(struct acrn_vm *vm, uint32_t vector)
 	dev_dbg(ACRN_DBG_IOAPIC, "ioapic processing eoi for vector %u", vector);
 
 	/* notify device to ack if assigned pin */
-	for (pin = 0U; pin < pincount; pin++) {
-		rte = vioapic->rtbl[pin];
-		if (((rte.u.lo_32 & IOAPIC_RTE_LOW_INTVEC) != vector) ||
-			((rte.full & IOAPIC_RTE_REM_IRR) == 0UL)) {
-			continue;
-		}
-
-		ptirq_intx_ack(vm, (uint8_t)pin, PTDEV_VPIN_IOAPIC);
-	}
-
-	/*
-	 * XXX keep track of the pins associated with this vector instead
-	 * of iterating on every single pin each time.
-	 */
-	spinlock_obtain(&(vioapic->mtx));
-	for (pin = 0U; pin < pincount; pin++) {
-		rte = vioapic->rtbl[pin];
-		if (((rte.u.lo_32 & IOAPIC_RTE_LOW_INTVEC) != vector) ||
-			((rte.full & IOAPIC_RTE_REM_IRR) == 0UL)) {
-			continue;
-		}
+	for (i = 0U; i < STATE_BITMAP_SIZE; i++) {
+		pins = vioapic->vector_pins[vector & NR_MAX_VECTOR][i];
+		pin = (uint32_t)ffs64(pins);
+		while (pin != INVALID_BIT_INDEX) {
+			pins &= pins - 1UL;
+			pin += i * 64U;
+			if (pin >= pincount) {
+				break;
+			}
 
-		vioapic->rtbl[pin].full &= (~IOAPIC_RTE_REM_IRR);
-		if (vioapic_need_intr(vioapic, (uint16_t)pin)) {
-			dev_dbg(ACRN_DBG_IOAPIC,
-				"ioapic pin%hhu: asserted at eoi", pin);
-			vioapic_send_intr(vioapic, pin);
+			rte = vioapic->rtbl[pin];
+			if (((rte.u.lo_32 & IOAPIC_RTE_LOW_INTVEC) == vector) &&
+				((rte.full & IOAPIC_RTE_REM_IRR) != 0UL)) {
+				ptirq_intx_ack(vm, (uint8_t)pin, PTDEV_VPIN_IOAPIC);
+
+				spinlock_obtain(&(vioapic->pins[pin].lock));
+				/* recheck, the RTE may have changed meanwhile */
+				rte = vioapic->rtbl[pin];
+				if (((rte.u.lo_32 & IOAPIC_RTE_LOW_INTVEC) == vector) &&
+					((rte.full & IOAPIC_RTE_REM_IRR) != 0UL)) {
+					vioapic->rtbl[pin].full &= (~IOAPIC_RTE_REM_IRR);
+					if (vioapic_need_intr(vioapic, (uint16_t)pin)) {
+						dev_dbg(ACRN_DBG_IOAPIC,
+							"ioapic pin%hhu: asserted at eoi", pin);
+						vioapic_send_intr(vioapic, pin);
+					}
+				}
+				spinlock_release(&(vioapic->pins[pin].lock));
+			}
+			pin = (uint32_t)ffs64(pins);
 		}
 	}
-	spinlock_release(&(vioapic->mtx));
 }
 
 void
 vioapic_reset(struct acrn_vioapic *vioapic)
 {
 	uint32_t pin, pincount;
+	union ioapic_rte last;
 
 	/* Initialize all redirection entries to mask all interrupts */
 	pincount = vioapic_pincount(vioapic->vm);
+	(void)memset((void *)vioapic->vector_pins, 0U, sizeof(vioapic->vector_pins));
 	for (pin = 0U; pin < pincount; pin++) {
+		spinlock_obtain(&(vioapic->pins[pin].lock));
+		last = vioapic->rtbl[pin];
 		vioapic->rtbl[pin].full = MASK_ALL_INTERRUPTS;
+		vioapic_update_pin(vioapic, pin, last, vioapic->rtbl[pin]);
+		spinlock_release(&(vioapic->pins[pin].lock));
 	}
 	vioapic->id = 0U;
 	vioapic->ioregsel = 0U;
@@ -510,8 +546,13 @@ vioapic_reset(struct acrn_vioapic *vioapic)
 void
 vioapic_init(struct acrn_vm *vm)
 {
+	uint32_t pin;
+
 	vm->arch_vm.vioapic.vm = vm;
 	spinlock_init(&(vm->arch_vm.vioapic.mtx));
+	for (pin = 0U; pin < REDIR_ENTRIES_HW; pin++) {
+		spinlock_init(&(vm->arch_vm.vioapic.pins[pin].lock));
+	}
 
 	vioapic_reset(vm_ioapic(vm));
 
@@ -49,6 +49,49 @@ uint32_t pci_vdev_read_cfg(struct pci_vdev *vdev, uint32_t offset, uint32_t byte
 	return val;
 }
 
+/*
+ * Bytes of the config header the hardware never changes: Vendor and Device
+ * ID, Revision ID and Class Code, Header Type, Capabilities Pointer,
+ * Interrupt Pin and, in type 0 headers only, the Subsystem IDs.
+ */
+#define PCI_CFG_RO_BYTES_TYPE1	0x2010000000004F0FUL
+#define PCI_CFG_RO_BYTES_TYPE0	(PCI_CFG_RO_BYTES_TYPE1 | 0x0000F00000000000UL)
+
+/*
+ * Cache the read-only header registers of the physical device in cfgdata,
+ * guest drivers probing them then no longer reach the hardware.
+ *
+ * @pre the cached bytes are not emulated by any other vdev handler
+ */
+void pci_vdev_cache_ro_cfg(struct pci_vdev *vdev)
+{
+	uint8_t hdrtype = (uint8_t)pci_pdev_read_cfg(vdev->pdev.bdf, PCIR_HDRTYPE, 1U);
+	uint64_t mask;
+	uint32_t offset;
+
+	mask = ((hdrtype & PCIM_HDRTYPE) == PCIM_HDRTYPE_NORMAL) ? PCI_CFG_RO_BYTES_TYPE0 : PCI_CFG_RO_BYTES_TYPE1;
+	for (offset = 0U; offset < 64U; offset++) {
+		if ((mask & (1UL << offset)) != 0UL) {
+			pci_vdev_write_cfg_u8(vdev, offset, (uint8_t)pci_pdev_read_cfg(vdev->pdev.bdf, offset, 1U));
+		}
+	}
+
+	vdev->ro_cfg_mask = mask;
+}
+
+bool pci_vdev_ro_cfg_access(const struct pci_vdev *vdev, uint32_t offset, uint32_t bytes)
+{
+	uint64_t mask;
+	bool ret = false;
+
+	if ((offset + bytes) <= 64U) {
+		mask = ((1UL << bytes) - 1UL) << offset;
+		ret = ((vdev->ro_cfg_mask & mask) == mask);
+	}
+
+	return ret;
+}
+
 void pci_vdev_write_cfg(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes, uint32_t val)
 {
 	switch (bytes) {
@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Inter-VM shared memory device emulated in the hypervisor for partition
+ * mode VMs. See ivshmem.h.
+ */
+
+#include <hypervisor.h>
+#include <ivshmem.h>
+#include "pci_priv.h"
+
+#define IVSHMEM_VENDOR		0x1AF4U
+#define IVSHMEM_DEVICE		0x1110U
+#define PCIC_MEMORY		0x05U
+#define PCIS_MEMORY_RAM		0x00U
+
+/* Registers in BAR0 */
+#define IVSHMEM_INTR_MASK	0x0U
+#define IVSHMEM_INTR_STATUS	0x4U
+#define IVSHMEM_IV_POSITION	0x8U
+#define IVSHMEM_DOORBELL	0xCU
+
+#define IVSHMEM_REG_BAR		0U
+#define IVSHMEM_MSIX_BAR	1U
+#define IVSHMEM_MEM_BAR		2U
+#define IVSHMEM_MSIX_CAPOFF	0x40U
+
+/* Serializes the doorbells and the MSI-X state of all devices */
+static spinlock_t ivshmem_lock = { .head = 0U, .tail = 0U };
+
+/* Doorbell: peer id in the high word, MSI-X vector in the low word */
+static void ivshmem_ring(const struct ivshmem_dev *dev, uint32_t val)
+{
+	uint32_t peer_id = val >> 16U;
+	struct ivshmem_dev *peer;
+
+	if (peer_id < IVSHMEM_MAX_PEERS) {
+		peer = dev->region->peers[peer_id];
+		if ((peer != NULL) && (peer->vdev != NULL)) {
+			vmsix_emul_raise(peer->vdev, &peer->msix, (uint16_t)(val & 0xFFFFU));
+		}
+	}
+}
+
+static int32_t ivshmem_reg_access_handler(struct io_request *io_req, void *handler_private_data)
+{
+	struct mmio_request *mmio = &io_req->reqs.mmio;
+	struct pci_vdev *vdev = (struct pci_vdev *)handler_private_data;
+	struct ivshmem_dev *dev = (struct ivshmem_dev *)vdev->priv;
+	uint64_t offset = mmio->address - vdev->bar[IVSHMEM_REG_BAR].base;
+	uint32_t val = (uint32_t)mmio->value;
+
+	/* The registers are DWORDs */
+	if ((mmio->size != 4UL) || ((offset & 0x3UL) != 0UL)) {
+		return -EINVAL;
+	}
+
+	spinlock_obtain(&ivshmem_lock);
+	if (mmio->direction == REQUEST_READ) {
+		switch (offset) {
+		case IVSHMEM_INTR_MASK:
+			mmio->value = dev->intr_mask;
+			break;
+		case IVSHMEM_INTR_STATUS:
+			mmio->value = dev->intr_status;
+			dev->intr_status = 0U;
+			break;
+		case IVSHMEM_IV_POSITION:
+			mmio->value = dev->position;
+			break;
+		default:
+			/* The doorbell and reserved space read as 0 */
+			mmio->value = 0UL;
+			break;
+		}
+	} else {
+		switch (offset) {
+		case IVSHMEM_INTR_MASK:
+			dev->intr_mask = val;
+			break;
+		case IVSHMEM_INTR_STATUS:
+			dev->intr_status = val;
+			break;
+		case IVSHMEM_DOORBELL:
+			ivshmem_ring(dev, val);
+			break;
+		default:
+			/* IVPosition and reserved space are read-only */
+			break;
+		}
+	}
+	spinlock_release(&ivshmem_lock);
+
+	return 0;
+}
+
+static int32_t ivshmem_msix_access_handler(struct io_request *io_req, void *handler_private_data)
+{
+	struct mmio_request *mmio = &io_req->reqs.mmio;
+	struct pci_vdev *vdev = (struct pci_vdev *)handler_private_data;
+	struct ivshmem_dev *dev = (struct ivshmem_dev *)vdev->priv;
+	int32_t ret;
+
+	spinlock_obtain(&ivshmem_lock);
+	ret = vmsix_emul_mmio_rw(vdev, &dev->msix, mmio, mmio->address - vdev->bar[IVSHMEM_MSIX_BAR].base);
+	spinlock_release(&ivshmem_lock);
+
+	return ret;
+}
+
+/* Naturally aligned, and alone in its pages so that it can be trapped */
+static bool ivshmem_bar_valid(const struct pci_bar *bar, uint64_t size)
+{
+	uint64_t align = (size > PAGE_SIZE) ? size : PAGE_SIZE;
+
+	return (bar->type == PCIBAR_MEM32) && (bar->size == size) && (bar->base != 0UL)
+		&& ((bar->base & (align - 1UL)) == 0UL);
+}
+
+static int32_t vdev_ivshmem_init(struct pci_vdev *vdev)
+{
+	struct ivshmem_dev *dev = (struct ivshmem_dev *)vdev->priv;
+	struct acrn_vm *vm = vdev->vpci->vm;
+	const struct pci_bar *reg, *msix, *mem;
+	struct ivshmem_region *region;
+	uint32_t i;
+	int32_t ret;
+
+	if ((dev == NULL) || (dev->region == NULL) || (dev->position >= IVSHMEM_MAX_PEERS)) {
+		pr_err("%s: no ivshmem region for vdev %x", __func__, vdev->vbdf.value);
+		return -EINVAL;
+	}
+
+	region = dev->region;
+	reg = &vdev->bar[IVSHMEM_REG_BAR];
+	msix = &vdev->bar[IVSHMEM_MSIX_BAR];
+	mem = &vdev->bar[IVSHMEM_MEM_BAR];
+	if ((region->size < PAGE_SIZE) || ((region->size & (region->size - 1UL)) != 0UL)
+			|| (((uint64_t)region->mem & (PAGE_SIZE - 1UL)) != 0UL)
+			|| !ivshmem_bar_valid(reg, IVSHMEM_REG_SIZE) || !ivshmem_bar_valid(msix, IVSHMEM_MSIX_SIZE)
+			|| !ivshmem_bar_valid(mem, region->size)) {
+		pr_err("%s: invalid ivshmem vdev %x", __func__, vdev->vbdf.value);
+		return -EINVAL;
+	}
+
+	pci_vdev_write_cfg_u16(vdev, PCIR_VENDOR, (uint16_t)IVSHMEM_VENDOR);
+	pci_vdev_write_cfg_u16(vdev, PCIR_DEVICE, (uint16_t)IVSHMEM_DEVICE);
+	pci_vdev_write_cfg_u8(vdev, PCIR_CLASS, (uint8_t)PCIC_MEMORY);
+	pci_vdev_write_cfg_u8(vdev, PCIR_SUBCLASS, (uint8_t)PCIS_MEMORY_RAM);
+	pci_vdev_write_cfg_u8(vdev, PCIR_HDRTYPE, (uint8_t)PCIM_HDRTYPE_NORMAL);
+	pci_vdev_write_cfg_u16(vdev, PCIR_SUBVEND_0, (uint16_t)IVSHMEM_VENDOR);
+	pci_vdev_write_cfg_u16(vdev, PCIR_SUBDEV_0, (uint16_t)IVSHMEM_DEVICE);
+	for (i = 0U; i <= IVSHMEM_MEM_BAR; i++) {
+		pci_vdev_write_cfg_u32(vdev, pci_bar_offset(i), (uint32_t)vdev->bar[i].base);
+	}
+
+	spinlock_obtain(&ivshmem_lock);
+	if (region->peers[dev->position] != NULL) {
+		ret = -EBUSY;
+	} else {
+		vmsix_emul_init(vdev, &dev->msix, IVSHMEM_MSIX_CAPOFF, VMSIX_EMUL_MAX_ENTRIES, IVSHMEM_MSIX_BAR);
+		dev->vdev = vdev;
+		dev->intr_mask = 0U;
+		dev->intr_status = 0U;
+		region->peers[dev->position] = dev;
+		ret = 0;
+	}
+	spinlock_release(&ivshmem_lock);
+
+	if (ret != 0) {
+		pr_err("%s: IVPosition %hu taken twice", __func__, dev->position);
+		return ret;
+	}
+
+	/* The shared memory is mapped once for all, not trapped */
+	ret = ept_mr_add(vm, (uint64_t *)vm->arch_vm.nworld_eptp, hva2hpa(region->mem),
+		mem->base, region->size, EPT_RD | EPT_WR | EPT_WB);
+	if (ret == 0) {
+		ret = register_mmio_emulation_handler(vm, ivshmem_reg_access_handler,
+			reg->base, reg->base + reg->size, vdev);
+	}
+	if (ret == 0) {
+		ret = register_mmio_emulation_handler(vm, ivshmem_msix_access_handler,
+			msix->base, msix->base + msix->size, vdev);
+	}
+
+	return ret;
+}
+
+static int32_t vdev_ivshmem_deinit(struct pci_vdev *vdev)
+{
+	struct ivshmem_dev *dev = (struct ivshmem_dev *)vdev->priv;
+
+	spinlock_obtain(&ivshmem_lock);
+	if ((dev != NULL) && (dev->vdev == vdev)) {
+		dev->region->peers[dev->position] = NULL;
+		dev->vdev = NULL;
+	}
+	spinlock_release(&ivshmem_lock);
+
+	return 0;
+}
+
+static int32_t vdev_ivshmem_cfgread(struct pci_vdev *vdev, uint32_t offset,
+	uint32_t bytes, uint32_t *val)
+{
+	/* Assumption: access needed to be aligned on 1/2/4 bytes */
+	if ((offset & (bytes - 1U)) != 0U) {
+		*val = 0xFFFFFFFFU;
+		return -EINVAL;
+	}
+
+	*val = pci_vdev_read_cfg(vdev, offset, bytes);
+
+	return 0;
+}
+
+/* BARs are placed by the VM description: answer sizing, keep the base */
+static void vdev_ivshmem_cfgwrite_bar(struct pci_vdev *vdev, uint32_t offset,
+	uint32_t bytes, uint32_t val)
+{
+	uint32_t idx = (offset - pci_bar_offset(0U)) >> 2U;
+	const struct pci_bar *bar = &vdev->bar[idx];
+	uint32_t bar_val = 0U;
+
+	if ((bytes != 4U) || ((offset & 0x3U) != 0U)) {
+		return;
+	}
+
+	if (bar->type == PCIBAR_MEM32) {
+		if (val == ~0U) {
+			bar_val = ~((uint32_t)bar->size - 1U) & PCIM_BAR_MEM_BASE;
+		} else {
+			bar_val = (uint32_t)bar->base;
+		}
+	}
+
+	pci_vdev_write_cfg_u32(vdev, offset, bar_val);
+}
+
+static int32_t vdev_ivshmem_cfgwrite(struct pci_vdev *vdev, uint32_t offset,
+	uint32_t bytes, uint32_t val)
+{
+	struct ivshmem_dev *dev = (struct ivshmem_dev *)vdev->priv;
+	bool msix_access;
+
+	/* Assumption: access needed to be aligned on 1/2/4 bytes */
+	if ((offset & (bytes - 1U)) != 0U) {
+		return -EINVAL;
+	}
+
+	/* Stays read-only if init failed */
+	if ((dev == NULL) || (dev->vdev != vdev)) {
+		return -ENODEV;
+	}
+
+	spinlock_obtain(&ivshmem_lock);
+	msix_access = vmsix_emul_cfgwrite(vdev, &dev->msix, offset, bytes, val);
+	spinlock_release(&ivshmem_lock);
+
+	if (msix_access) {
+		/* Handled by vmsix_emul_cfgwrite() */
+	} else if (pci_bar_access(offset)) {
+		vdev_ivshmem_cfgwrite_bar(vdev, offset, bytes, val);
+	} else if (in_range(offset, PCIR_COMMAND, 2U) || (offset == PCIR_INTLINE)) {
+		pci_vdev_write_cfg(vdev, offset, bytes, val);
+	} else {
+		/* The rest of the header and capability space is read-only */
+	}
+
+	return 0;
+}
+
+struct pci_vdev_ops pci_ops_vdev_ivshmem = {
+	.init = vdev_ivshmem_init,
+	.deinit = vdev_ivshmem_deinit,
+	.cfgwrite = vdev_ivshmem_cfgwrite,
+	.cfgread = vdev_ivshmem_cfgread,
+};
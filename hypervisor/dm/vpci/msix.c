@@ -48,6 +48,11 @@ static inline bool msixtable_access(struct pci_vdev *vdev, uint32_t offset)
 	return in_range(offset, vdev->msix.table_offset, vdev->msix.table_count * MSIX_TABLE_ENTRY_SIZE);
 }
 
+static inline bool vmsix_entry_remapped(const struct pci_vdev *vdev, uint32_t index)
+{
+	return bitmap_test((uint16_t)(index & 0x3fU), &vdev->msix.remapped[index >> 6U]);
+}
+
 static int32_t vmsix_remap_entry(struct pci_vdev *vdev, uint32_t index, bool enable)
 {
 	struct msix_table_entry *pentry;
@@ -55,6 +60,8 @@ static int32_t vmsix_remap_entry(struct pci_vdev *vdev, uint32_t index, bool ena
 	uint64_t hva;
 	int32_t ret;
 
+	bitmap_clear_nolock((uint16_t)(index & 0x3fU), &vdev->msix.remapped[index >> 6U]);
+
 	info.is_msix = 1;
 	info.vmsi_addr = vdev->msix.tables[index].addr;
 	info.vmsi_data = (enable) ? vdev->msix.tables[index].data : 0U;
@@ -77,11 +84,31 @@ static int32_t vmsix_remap_entry(struct pci_vdev *vdev, uint32_t index, bool ena
 		mmio_write32(info.pmsi_data, (void *)&(pentry->data));
 		mmio_write32(vdev->msix.tables[index].vector_control, (void *)&(pentry->vector_control));
 		clac();
+
+		if (enable) {
+			bitmap_set_nolock((uint16_t)(index & 0x3fU), &vdev->msix.remapped[index >> 6U]);
+		}
 	}
 
 	return ret;
 }
 
+/*
+ * The physical entry already holds the remapped message: a mask or unmask
+ * only needs its Vector Control written, without disabling MSI-X around a
+ * remap.
+ */
+static void vmsix_update_entry_mask(const struct pci_vdev *vdev, uint32_t index)
+{
+	struct msix_table_entry *pentry;
+
+	pentry = (struct msix_table_entry *)(vdev->msix.mmio_hva + vdev->msix.table_offset) + index;
+
+	stac();
+	mmio_write32(vdev->msix.tables[index].vector_control, (void *)&(pentry->vector_control));
+	clac();
+}
+
 static inline void enable_disable_msix(struct pci_vdev *vdev, bool enable)
 {
 	uint32_t msgctrl;
@@ -95,7 +122,14 @@ static inline void enable_disable_msix(struct pci_vdev *vdev, bool enable)
 	pci_pdev_write_cfg(vdev->pdev.bdf, vdev->msix.capoff + PCIR_MSIX_CTRL, 2U, msgctrl);
 }
 
-/* Do MSI-X remap for all MSI-X table entries in the target device */
+/*
+ * Do MSI-X remap for the MSI-X table entries in use in the target device.
+ *
+ * Devices expose many more vectors than drivers use, so masked entries are
+ * only masked in the physical table on enable and remapped on their first
+ * unmask by vmsix_table_rw(), and only remapped entries are torn down on
+ * disable.
+ */
 static int32_t vmsix_remap(struct pci_vdev *vdev, bool enable)
 {
 	uint32_t index;
@@ -105,9 +139,15 @@ static int32_t vmsix_remap(struct pci_vdev *vdev, bool enable)
 	enable_disable_msix(vdev, false);
 
 	for (index = 0U; index < vdev->msix.table_count; index++) {
-		ret = vmsix_remap_entry(vdev, index, enable);
-		if (ret != 0) {
-			return ret;
+		if (enable && ((vdev->msix.tables[index].vector_control & PCIM_MSIX_VCTRL_MASK) != 0U)) {
+			vmsix_update_entry_mask(vdev, index);
+		} else if (enable || vmsix_entry_remapped(vdev, index)) {
+			ret = vmsix_remap_entry(vdev, index, enable);
+			if (ret != 0) {
+				return ret;
+			}
+		} else {
+			/* never remapped since MSI-X was enabled */
 		}
 	}
 
@@ -251,9 +291,18 @@ static void vmsix_table_rw(struct pci_vdev *vdev, struct mmio_request *mmio, uin
 		if ((pci_vdev_read_cfg(vdev, vdev->msix.capoff + PCIR_MSIX_CTRL, 2U) & PCIM_MSIXCTRL_MSIX_ENABLE)
 			== PCIM_MSIXCTRL_MSIX_ENABLE) {
 
-			if ((((entry->vector_control ^ vector_control) & PCIM_MSIX_VCTRL_MASK) != 0U) || message_changed) {
+			if (message_changed) {
 				unmasked = ((entry->vector_control & PCIM_MSIX_VCTRL_MASK) == 0U);
 				(void)vmsix_remap_one_entry(vdev, index, unmasked);
+			} else if (((entry->vector_control ^ vector_control) & PCIM_MSIX_VCTRL_MASK) != 0U) {
+				unmasked = ((entry->vector_control & PCIM_MSIX_VCTRL_MASK) == 0U);
+				if (vmsix_entry_remapped(vdev, index)) {
+					vmsix_update_entry_mask(vdev, index);
+				} else {
+					(void)vmsix_remap_one_entry(vdev, index, unmasked);
+				}
+			} else {
+				/* Neither the message nor the mask changed */
 			}
 		}
 	}
@@ -414,6 +463,7 @@ static int32_t vmsix_init(struct pci_vdev *vdev)
 static int32_t vmsix_deinit(struct pci_vdev *vdev)
 {
 	vdev->msix.intercepted_size = 0U;
+	(void)memset((void *)vdev->msix.remapped, 0U, sizeof(vdev->msix.remapped));
 
 	if (vdev->msix.table_count != 0U) {
 		ptirq_remove_msix_remapping(vdev->vpci->vm, vdev->vbdf.value, vdev->msix.table_count);
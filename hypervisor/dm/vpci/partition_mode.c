@@ -38,6 +38,10 @@ static struct pci_vdev *partition_mode_find_vdev(struct vpci *vpci, union pci_bd
 	struct pci_vdev *vdev;
 	int32_t i;
 
+	if (vbdf.bits.b == 0U) {
+		return vpci->bus0_vdevs[vbdf.value];
+	}
+
 	vdev_array = vpci->vm->vm_desc->vpci_vdev_array;
 	for (i = 0; i < vdev_array->num_pci_vdev; i++) {
 		vdev = &vdev_array->vpci_vdev_list[i];
@@ -61,6 +65,9 @@ static int32_t partition_mode_vpci_init(struct acrn_vm *vm)
 	for (i = 0; i < vdev_array->num_pci_vdev; i++) {
 		vdev = &vdev_array->vpci_vdev_list[i];
 		vdev->vpci = vpci;
+		if ((vdev->vbdf.bits.b == 0U) && (vpci->bus0_vdevs[vdev->vbdf.value] == NULL)) {
+			vpci->bus0_vdevs[vdev->vbdf.value] = vdev;
+		}
 
 		if ((vdev->ops != NULL) && (vdev->ops->init != NULL)) {
 			if (vdev->ops->init(vdev) != 0) {
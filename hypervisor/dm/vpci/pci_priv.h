@@ -74,9 +74,21 @@ extern struct pci_vdev_ops pci_ops_vdev_msix;
 
 uint32_t pci_vdev_read_cfg(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes);
 void pci_vdev_write_cfg(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes, uint32_t val);
+void pci_vdev_cache_ro_cfg(struct pci_vdev *vdev);
+bool pci_vdev_ro_cfg_access(const struct pci_vdev *vdev, uint32_t offset, uint32_t bytes);
 
 void populate_msi_struct(struct pci_vdev *vdev);
 
+#ifdef CONFIG_PARTITION_MODE
+void vmsix_emul_init(struct pci_vdev *vdev, struct vmsix_emul *msix, uint32_t capoff,
+	uint32_t table_count, uint32_t bar);
+void vmsix_emul_raise(struct pci_vdev *vdev, struct vmsix_emul *msix, uint16_t vector);
+bool vmsix_emul_cfgwrite(struct pci_vdev *vdev, struct vmsix_emul *msix, uint32_t offset,
+	uint32_t bytes, uint32_t val);
+int32_t vmsix_emul_mmio_rw(struct pci_vdev *vdev, struct vmsix_emul *msix, struct mmio_request *mmio,
+	uint64_t offset);
+#endif
+
 struct pci_vdev *sharing_mode_find_vdev(union pci_bdf pbdf);
 void add_vdev_handler(struct pci_vdev *vdev, struct pci_vdev_ops *ops);
 
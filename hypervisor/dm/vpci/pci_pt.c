@@ -71,17 +71,20 @@ static int32_t vdev_pt_init(struct pci_vdev *vdev)
 			vm->arch_vm.nworld_eptp = vm->arch_vm.ept_mem_ops.get_pml4_page(vm->arch_vm.ept_mem_ops.info);
 			sanitize_pte((uint64_t *)vm->arch_vm.nworld_eptp);
 		}
-		vm->iommu = create_iommu_domain(vm->vm_id,
-			hva2hpa(vm->arch_vm.nworld_eptp), 48U);
+		vm->iommu = create_ept_iommu_domain(vm);
 	}
 
 	ret = assign_iommu_device(vm->iommu, (uint8_t)vdev->pdev.bdf.bits.b,
 		(uint8_t)(vdev->pdev.bdf.value & 0xFFU));
 
+	pci_vdev_cache_ro_cfg(vdev);
+
 	pci_command = (uint16_t)pci_pdev_read_cfg(vdev->pdev.bdf, PCIR_COMMAND, 2U);
 	/* Disable INTX */
 	pci_command |= 0x400U;
 	pci_pdev_write_cfg(vdev->pdev.bdf, PCIR_COMMAND, 2U, pci_command);
+	/* Shadowed to know whether the BARs decode, see vdev_pt_mem_decode() */
+	pci_vdev_write_cfg_u16(vdev, PCIR_COMMAND, pci_command);
 
 	return ret;
 }
@@ -106,8 +109,8 @@ static int32_t vdev_pt_cfgread(struct pci_vdev *vdev, uint32_t offset,
 		return -EINVAL;
 	}
 
-	/* PCI BARs is emulated */
-	if (pci_bar_access(offset)) {
+	/* PCI BARs is emulated, the read-only header registers cached */
+	if (pci_bar_access(offset) || pci_vdev_ro_cfg_access(vdev, offset, bytes)) {
 		*val = pci_vdev_read_cfg(vdev, offset, bytes);
 	} else {
 		*val = pci_pdev_read_cfg(vdev->pdev.bdf, offset, bytes);
@@ -116,24 +119,90 @@ static int32_t vdev_pt_cfgread(struct pci_vdev *vdev, uint32_t offset,
 	return 0;
 }
 
-static void vdev_pt_remap_bar(struct pci_vdev *vdev, uint32_t idx,
-	uint32_t new_base)
+/*
+ * The guest BARs are mapped only while memory decode is enabled in the
+ * command register shadowed in cfgdata. Guests turn decode off while they
+ * size and move BARs, so those writes cost no EPT update at all.
+ */
+static bool vdev_pt_mem_decode(struct pci_vdev *vdev)
+{
+	return ((pci_vdev_read_cfg_u16(vdev, PCIR_COMMAND) & PCIM_CMD_MEMEN) != 0U);
+}
+
+/* @pre Called between ept_update_begin() and ept_update_commit() */
+static void vdev_pt_unmap_bar(struct pci_vdev *vdev, uint32_t idx)
 {
 	struct acrn_vm *vm = vdev->vpci->vm;
 
 	if (vdev->bar[idx].base != 0UL) {
-		ept_mr_del(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
-			vdev->bar[idx].base,
-			vdev->bar[idx].size);
+		if (ept_mr_del(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
+				vdev->bar[idx].base,
+				vdev->bar[idx].size) != 0) {
+			pr_err("%s: BAR%u at 0x%llx stays mapped", __func__, idx, vdev->bar[idx].base);
+		}
 	}
+}
 
-	if (new_base != 0U) {
+/* @pre Called between ept_update_begin() and ept_update_commit() */
+static void vdev_pt_map_bar(struct pci_vdev *vdev, uint32_t idx)
+{
+	struct acrn_vm *vm = vdev->vpci->vm;
+
+	if (vdev->bar[idx].base != 0UL) {
 		/* Map the physical BAR in the guest MMIO space */
-		ept_mr_add(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
-			vdev->pdev.bar[idx].base, /* HPA */
-			new_base, /*GPA*/
-			vdev->bar[idx].size,
-			EPT_WR | EPT_RD | EPT_UNCACHED);
+		if (ept_mr_add(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
+				vdev->pdev.bar[idx].base, /* HPA */
+				vdev->bar[idx].base, /*GPA*/
+				vdev->bar[idx].size,
+				EPT_WR | EPT_RD | EPT_UNCACHED) != 0) {
+			pr_err("%s: BAR%u not mapped at 0x%llx", __func__, idx, vdev->bar[idx].base);
+		}
+	}
+}
+
+/* Move a BAR: the old and the new mapping change under one EPT flush */
+static void vdev_pt_remap_bar(struct pci_vdev *vdev, uint32_t idx,
+	uint32_t new_base)
+{
+	struct acrn_vm *vm = vdev->vpci->vm;
+
+	if (vdev->bar[idx].base == (uint64_t)new_base) {
+		/* Rewritten with the same base, nothing moves */
+	} else if (!vdev_pt_mem_decode(vdev)) {
+		vdev->bar[idx].base = new_base;
+	} else {
+		ept_update_begin(vm);
+		vdev_pt_unmap_bar(vdev, idx);
+		vdev->bar[idx].base = new_base;
+		vdev_pt_map_bar(vdev, idx);
+		ept_update_commit(vm);
+	}
+}
+
+/* Map or unmap all the BARs, under one EPT flush, as memory decode toggles */
+static void vdev_pt_cfgwrite_command(struct pci_vdev *vdev, uint32_t offset,
+	uint32_t bytes, uint32_t val)
+{
+	struct acrn_vm *vm = vdev->vpci->vm;
+	bool decode = vdev_pt_mem_decode(vdev);
+	uint32_t idx;
+
+	pci_pdev_write_cfg(vdev->pdev.bdf, offset, bytes, val);
+	pci_vdev_write_cfg(vdev, offset, bytes, val);
+
+	if (decode != vdev_pt_mem_decode(vdev)) {
+		ept_update_begin(vm);
+		for (idx = 0U; idx < PCI_BAR_COUNT; idx++) {
+			if (vdev->bar[idx].type != PCIBAR_MEM32) {
+				continue;
+			}
+			if (decode) {
+				vdev_pt_unmap_bar(vdev, idx);
+			} else {
+				vdev_pt_map_bar(vdev, idx);
+			}
+		}
+		ept_update_commit(vm);
 	}
 }
 
@@ -163,8 +232,6 @@ static void vdev_pt_cfgwrite_bar(struct pci_vdev *vdev, uint32_t offset,
 		if (bar_update_normal) {
 			vdev_pt_remap_bar(vdev, idx,
 				pci_bar_base(new_bar));
-
-			vdev->bar[idx].base = pci_bar_base(new_bar);
 		}
 		break;
 
@@ -187,6 +254,8 @@ static int32_t vdev_pt_cfgwrite(struct pci_vdev *vdev, uint32_t offset,
 	/* PCI BARs are emulated */
 	if (pci_bar_access(offset)) {
 		vdev_pt_cfgwrite_bar(vdev, offset, bytes, val);
+	} else if (offset == PCIR_COMMAND) {
+		vdev_pt_cfgwrite_command(vdev, offset, bytes, val);
 	} else {
 		/* Write directly to physical device's config space */
 		pci_pdev_write_cfg(vdev->pdev.bdf, offset, bytes, val);
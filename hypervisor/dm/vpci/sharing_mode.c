@@ -70,7 +70,11 @@ static void sharing_mode_cfgread(__unused struct vpci *vpci, union pci_bdf bdf,
 
 		/* Not handled by any handlers. Passthru to physical device */
 		if (!handled) {
-			*val = pci_pdev_read_cfg(vdev->pdev.bdf, offset, bytes);
+			if (pci_vdev_ro_cfg_access(vdev, offset, bytes)) {
+				*val = pci_vdev_read_cfg(vdev, offset, bytes);
+			} else {
+				*val = pci_pdev_read_cfg(vdev->pdev.bdf, offset, bytes);
+			}
 		}
 	}
 }
@@ -127,6 +131,7 @@ static void enumerate_pci_dev(uint16_t pbdf, void *cb_data)
 
 	vdev = alloc_pci_vdev(vm, (union pci_bdf)pbdf);
 	if (vdev != NULL) {
+		pci_vdev_cache_ro_cfg(vdev);
 		populate_msi_struct(vdev);
 	}
 }
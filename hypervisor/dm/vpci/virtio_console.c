@@ -0,0 +1,558 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Legacy virtio-pci console emulated in the hypervisor, linking two
+ * partition mode VMs. See virtio_console.h.
+ */
+
+#include <hypervisor.h>
+#include <virtio_console.h>
+#include "pci_priv.h"
+
+#define VIRTIO_VENDOR			0x1AF4U
+#define VIRTIO_DEV_CONSOLE		0x1003U
+#define VIRTIO_TYPE_CONSOLE		3U
+
+/* Legacy virtio-pci registers in BAR0 */
+#define VIRTIO_PCI_HOST_FEATURES	0U
+#define VIRTIO_PCI_GUEST_FEATURES	4U
+#define VIRTIO_PCI_QUEUE_PFN		8U
+#define VIRTIO_PCI_QUEUE_NUM		12U
+#define VIRTIO_PCI_QUEUE_SEL		14U
+#define VIRTIO_PCI_QUEUE_NOTIFY		16U
+#define VIRTIO_PCI_STATUS		18U
+#define VIRTIO_PCI_ISR			19U
+#define VIRTIO_MSI_CONFIG_VECTOR	20U
+#define VIRTIO_MSI_QUEUE_VECTOR		22U
+
+#define VIRTIO_PCI_QUEUE_ADDR_SHIFT	12U
+#define VIRTIO_PCI_VRING_ALIGN		4096UL
+#define VIRTIO_MSI_NO_VECTOR		0xFFFFU
+#define VIRTIO_CONFIG_S_DRIVER_OK	4U
+#define VIRTIO_PCI_ISR_INTR		1U
+
+/* No feature is offered: no size, no multiport, no emergency write */
+#define VCON_HOST_FEATURES		0U
+
+#define VRING_DESC_F_NEXT		1U
+#define VRING_DESC_F_WRITE		2U
+#define VRING_AVAIL_F_NO_INTERRUPT	1U
+
+/* MSI-X capability, table and PBA in BAR1 */
+#define VCON_MSIX_CAPOFF		0x40U
+#define VCON_MSIX_BAR			1U
+
+struct vring_desc {
+	uint64_t addr;
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+};
+
+struct vring_used_elem {
+	uint32_t id;
+	uint32_t len;
+};
+
+/* Serializes both ends of every link, and the bounce buffer */
+static spinlock_t vcon_lock = { .head = 0U, .tail = 0U };
+static struct vcon_port *vcon_ports[CONFIG_MAX_VM_NUM];
+static uint8_t vcon_bounce[PAGE_SIZE];
+
+static inline struct acrn_vm *vcon_vm(const struct vcon_port *port)
+{
+	return port->vdev->vpci->vm;
+}
+
+static inline uint64_t vq_desc_gpa(const struct vcon_queue *vq)
+{
+	return (uint64_t)vq->pfn << VIRTIO_PCI_QUEUE_ADDR_SHIFT;
+}
+
+static inline uint64_t vq_avail_gpa(const struct vcon_queue *vq)
+{
+	return vq_desc_gpa(vq) + ((uint64_t)sizeof(struct vring_desc) * VCON_QUEUE_SIZE);
+}
+
+static inline uint64_t vq_used_gpa(const struct vcon_queue *vq)
+{
+	/* flags, idx, ring[] and used_event of the avail ring */
+	uint64_t avail_end = vq_avail_gpa(vq) + 6UL + (2UL * VCON_QUEUE_SIZE);
+
+	return (avail_end + VIRTIO_PCI_VRING_ALIGN - 1UL) & ~(VIRTIO_PCI_VRING_ALIGN - 1UL);
+}
+
+/**
+ * @pre vcon_lock is held
+ */
+static bool vq_ready(const struct vcon_port *port, uint32_t qidx)
+{
+	return (port->vdev != NULL) && ((port->status & VIRTIO_CONFIG_S_DRIVER_OK) != 0U)
+		&& (port->queues[qidx].pfn != 0U);
+}
+
+/* Peek the head of the next available chain without consuming it */
+static bool vq_avail_head(struct vcon_port *port, uint32_t qidx, uint16_t *head)
+{
+	struct vcon_queue *vq = &port->queues[qidx];
+	struct acrn_vm *vm = vcon_vm(port);
+	uint64_t avail = vq_avail_gpa(vq);
+	uint16_t avail_idx;
+	uint16_t slot = vq->last_avail % VCON_QUEUE_SIZE;
+	bool ret = false;
+
+	if (copy_from_gpa(vm, &avail_idx, avail + 2UL, (uint32_t)sizeof(avail_idx)) == 0) {
+		if ((avail_idx != vq->last_avail) &&
+			(copy_from_gpa(vm, head, avail + 4UL + (2UL * slot), (uint32_t)sizeof(*head)) == 0)) {
+			ret = (*head < VCON_QUEUE_SIZE);
+		}
+	}
+
+	return ret;
+}
+
+/* A descriptor which can not be read is taken as an empty last one */
+static void vq_read_desc(struct vcon_port *port, uint32_t qidx, uint16_t idx, struct vring_desc *desc)
+{
+	const struct vcon_queue *vq = &port->queues[qidx];
+
+	if ((idx >= VCON_QUEUE_SIZE) || (copy_from_gpa(vcon_vm(port), desc,
+			vq_desc_gpa(vq) + ((uint64_t)sizeof(struct vring_desc) * idx),
+			(uint32_t)sizeof(*desc)) != 0)) {
+		(void)memset(desc, 0U, sizeof(*desc));
+	}
+}
+
+static void vq_push_used(struct vcon_port *port, uint32_t qidx, uint16_t head, uint32_t len)
+{
+	struct vcon_queue *vq = &port->queues[qidx];
+	struct acrn_vm *vm = vcon_vm(port);
+	uint64_t used = vq_used_gpa(vq);
+	struct vring_used_elem elem = { .id = head, .len = len };
+	uint16_t slot = vq->used_idx % VCON_QUEUE_SIZE;
+
+	(void)copy_to_gpa(vm, &elem, used + 4UL + ((uint64_t)sizeof(elem) * slot), (uint32_t)sizeof(elem));
+	vq->used_idx++;
+	/* The element is visible before the index: x86 keeps stores in order */
+	(void)copy_to_gpa(vm, &vq->used_idx, used + 2UL, (uint32_t)sizeof(vq->used_idx));
+}
+
+static void vq_interrupt(struct vcon_port *port, uint32_t qidx)
+{
+	const struct vcon_queue *vq = &port->queues[qidx];
+	uint16_t flags;
+
+	if ((copy_from_gpa(vcon_vm(port), &flags, vq_avail_gpa(vq), (uint32_t)sizeof(flags)) != 0)
+			|| ((flags & VRING_AVAIL_F_NO_INTERRUPT) == 0U)) {
+		port->isr |= VIRTIO_PCI_ISR_INTR;
+		vmsix_emul_raise(port->vdev, &port->msix, vq->msix_vector);
+	}
+}
+
+/* Pick the next transmit chain if none is being copied */
+static bool vcon_tx_next(struct vcon_port *port)
+{
+	struct vcon_tx_cursor *tx = &port->tx;
+	uint16_t head;
+
+	if (!tx->active && vq_avail_head(port, VCON_TXQ, &head)) {
+		port->queues[VCON_TXQ].last_avail++;
+		tx->active = true;
+		tx->head = head;
+		tx->desc = head;
+		tx->hops = 0U;
+		tx->offset = 0U;
+	}
+
+	return tx->active;
+}
+
+static void vcon_tx_complete(struct vcon_port *port)
+{
+	vq_push_used(port, VCON_TXQ, port->tx.head, 0U);
+	port->tx.active = false;
+}
+
+/*
+ * Copy the byte stream transmitted by src into the receive buffers its peer
+ * posted. A transmit chain may span several receive chains, so where it
+ * stopped is kept in src->tx until the peer provides more buffers.
+ *
+ * @pre vcon_lock is held
+ */
+static void vcon_transfer(struct vcon_port *src)
+{
+	struct vcon_port *dst = src->peer;
+	struct vcon_tx_cursor *tx = &src->tx;
+	struct vring_desc txd, rxd;
+	uint16_t rxhead, rxhops;
+	uint32_t rxoff, written, len;
+	bool tx_done = false, rx_done = false, stop = false;
+
+	if ((dst == NULL) || !vq_ready(src, VCON_TXQ) || !vq_ready(dst, VCON_RXQ)) {
+		return;
+	}
+
+	while (!stop && vcon_tx_next(src) && vq_avail_head(dst, VCON_RXQ, &rxhead)) {
+		vq_read_desc(dst, VCON_RXQ, rxhead, &rxd);
+		rxhops = 0U;
+		rxoff = 0U;
+		written = 0U;
+
+		while (true) {
+			vq_read_desc(src, VCON_TXQ, tx->desc, &txd);
+			if (tx->offset >= txd.len) {
+				tx->hops++;
+				if (((txd.flags & VRING_DESC_F_NEXT) != 0U) && (tx->hops < VCON_QUEUE_SIZE)) {
+					tx->desc = txd.next;
+					tx->offset = 0U;
+					continue;
+				}
+				vcon_tx_complete(src);
+				tx_done = true;
+				if (!vcon_tx_next(src)) {
+					break;
+				}
+				continue;
+			}
+
+			if ((rxoff >= rxd.len) || ((rxd.flags & VRING_DESC_F_WRITE) == 0U)) {
+				rxhops++;
+				if (((rxd.flags & VRING_DESC_F_NEXT) != 0U) && (rxhops < VCON_QUEUE_SIZE)) {
+					vq_read_desc(dst, VCON_RXQ, rxd.next, &rxd);
+					rxoff = 0U;
+					continue;
+				}
+				break;
+			}
+
+			len = min(txd.len - tx->offset, rxd.len - rxoff);
+			len = min(len, (uint32_t)sizeof(vcon_bounce));
+			if ((copy_from_gpa(vcon_vm(src), vcon_bounce, txd.addr + tx->offset, len) != 0)
+				|| (copy_to_gpa(vcon_vm(dst), vcon_bounce, rxd.addr + rxoff, len) != 0)) {
+				/* Drop a chain pointing out of guest memory */
+				vcon_tx_complete(src);
+				tx_done = true;
+				stop = true;
+				break;
+			}
+			tx->offset += len;
+			rxoff += len;
+			written += len;
+		}
+
+		if (written == 0U) {
+			break;
+		}
+		dst->queues[VCON_RXQ].last_avail++;
+		vq_push_used(dst, VCON_RXQ, rxhead, written);
+		rx_done = true;
+	}
+
+	if (tx_done) {
+		vq_interrupt(src, VCON_TXQ);
+	}
+	if (rx_done) {
+		vq_interrupt(dst, VCON_RXQ);
+	}
+}
+
+static void vcon_reset(struct vcon_port *port)
+{
+	uint32_t i;
+
+	port->guest_features = 0U;
+	port->queue_sel = 0U;
+	port->status = 0U;
+	port->isr = 0U;
+	port->msix_config_vector = VIRTIO_MSI_NO_VECTOR;
+	(void)memset(port->queues, 0U, sizeof(port->queues));
+	for (i = 0U; i < VCON_QUEUE_NUM; i++) {
+		port->queues[i].msix_vector = VIRTIO_MSI_NO_VECTOR;
+	}
+	(void)memset(&port->tx, 0U, sizeof(port->tx));
+	port->msix.pba = 0UL;
+}
+
+static inline uint16_t vcon_msix_vector(uint32_t val)
+{
+	return (val < VCON_MSIX_NUM) ? (uint16_t)val : VIRTIO_MSI_NO_VECTOR;
+}
+
+static struct vcon_port *vcon_find_port(const struct acrn_vm *vm)
+{
+	return (vm->vm_id < CONFIG_MAX_VM_NUM) ? vcon_ports[vm->vm_id] : NULL;
+}
+
+static uint32_t vcon_pio_read(struct acrn_vm *vm, uint16_t addr, __unused size_t width)
+{
+	struct vcon_port *port;
+	uint16_t sel;
+	uint32_t val = 0U;
+
+	spinlock_obtain(&vcon_lock);
+	port = vcon_find_port(vm);
+	if (port != NULL) {
+		sel = port->queue_sel;
+		switch (addr - port->pio_base) {
+		case VIRTIO_PCI_HOST_FEATURES:
+			val = VCON_HOST_FEATURES;
+			break;
+		case VIRTIO_PCI_GUEST_FEATURES:
+			val = port->guest_features;
+			break;
+		case VIRTIO_PCI_QUEUE_PFN:
+			val = (sel < VCON_QUEUE_NUM) ? port->queues[sel].pfn : 0U;
+			break;
+		case VIRTIO_PCI_QUEUE_NUM:
+			val = (sel < VCON_QUEUE_NUM) ? VCON_QUEUE_SIZE : 0U;
+			break;
+		case VIRTIO_PCI_QUEUE_SEL:
+			val = sel;
+			break;
+		case VIRTIO_PCI_STATUS:
+			val = port->status;
+			break;
+		case VIRTIO_PCI_ISR:
+			/* Reading the ISR acknowledges it */
+			val = port->isr;
+			port->isr = 0U;
+			break;
+		case VIRTIO_MSI_CONFIG_VECTOR:
+			val = port->msix_config_vector;
+			break;
+		case VIRTIO_MSI_QUEUE_VECTOR:
+			val = (sel < VCON_QUEUE_NUM) ? port->queues[sel].msix_vector : VIRTIO_MSI_NO_VECTOR;
+			break;
+		default:
+			/* No device specific configuration without features */
+			break;
+		}
+	}
+	spinlock_release(&vcon_lock);
+
+	return val;
+}
+
+static void vcon_pio_write(struct acrn_vm *vm, uint16_t addr, __unused size_t width, uint32_t val)
+{
+	struct vcon_port *port;
+	struct vcon_queue *vq;
+	uint16_t sel;
+
+	spinlock_obtain(&vcon_lock);
+	port = vcon_find_port(vm);
+	if (port != NULL) {
+		sel = port->queue_sel;
+		vq = (sel < VCON_QUEUE_NUM) ? &port->queues[sel] : NULL;
+		switch (addr - port->pio_base) {
+		case VIRTIO_PCI_GUEST_FEATURES:
+			port->guest_features = val & VCON_HOST_FEATURES;
+			break;
+		case VIRTIO_PCI_QUEUE_PFN:
+			if (vq != NULL) {
+				vq->pfn = val;
+				vq->last_avail = 0U;
+				vq->used_idx = 0U;
+			}
+			break;
+		case VIRTIO_PCI_QUEUE_SEL:
+			port->queue_sel = (uint16_t)val;
+			break;
+		case VIRTIO_PCI_QUEUE_NOTIFY:
+			if (val == VCON_TXQ) {
+				vcon_transfer(port);
+			} else if (val == VCON_RXQ) {
+				/* New receive buffers: resume what the peer sends */
+				if (port->peer != NULL) {
+					vcon_transfer(port->peer);
+				}
+			} else {
+				/* No such queue */
+			}
+			break;
+		case VIRTIO_PCI_STATUS:
+			port->status = (uint8_t)val;
+			if (port->status == 0U) {
+				vcon_reset(port);
+			} else if ((port->status & VIRTIO_CONFIG_S_DRIVER_OK) != 0U) {
+				vcon_transfer(port);
+				if (port->peer != NULL) {
+					vcon_transfer(port->peer);
+				}
+			} else {
+				/* Driver still negotiating */
+			}
+			break;
+		case VIRTIO_MSI_CONFIG_VECTOR:
+			port->msix_config_vector = vcon_msix_vector(val);
+			break;
+		case VIRTIO_MSI_QUEUE_VECTOR:
+			if (vq != NULL) {
+				vq->msix_vector = vcon_msix_vector(val);
+			}
+			break;
+		default:
+			/* Read-only or device specific configuration */
+			break;
+		}
+	}
+	spinlock_release(&vcon_lock);
+}
+
+static int32_t vcon_msix_access_handler(struct io_request *io_req, void *handler_private_data)
+{
+	struct mmio_request *mmio = &io_req->reqs.mmio;
+	struct pci_vdev *vdev = (struct pci_vdev *)handler_private_data;
+	struct vcon_port *port = (struct vcon_port *)vdev->priv;
+	int32_t ret;
+
+	spinlock_obtain(&vcon_lock);
+	ret = vmsix_emul_mmio_rw(vdev, &port->msix, mmio, mmio->address - vdev->bar[VCON_MSIX_BAR].base);
+	spinlock_release(&vcon_lock);
+
+	return ret;
+}
+
+static int32_t vdev_virtio_console_init(struct pci_vdev *vdev)
+{
+	struct vcon_port *port = (struct vcon_port *)vdev->priv;
+	struct acrn_vm *vm = vdev->vpci->vm;
+	const struct pci_bar *pio = &vdev->bar[0];
+	const struct pci_bar *mmio = &vdev->bar[VCON_MSIX_BAR];
+	struct vm_io_range range;
+
+	if ((port == NULL) || (vm->vm_id >= CONFIG_MAX_VM_NUM)
+			|| (pio->type != PCIBAR_IO) || (pio->size != VCON_PIO_SIZE)
+			|| (pio->base == 0UL) || ((pio->base & (VCON_PIO_SIZE - 1UL)) != 0UL)
+			|| (mmio->type != PCIBAR_MEM32) || (mmio->size != VCON_MMIO_SIZE)
+			|| (mmio->base == 0UL) || ((mmio->base & (VCON_MMIO_SIZE - 1UL)) != 0UL)) {
+		pr_err("%s: invalid virtio console vdev %x", __func__, vdev->vbdf.value);
+		return -EINVAL;
+	}
+
+	pci_vdev_write_cfg_u16(vdev, PCIR_VENDOR, (uint16_t)VIRTIO_VENDOR);
+	pci_vdev_write_cfg_u16(vdev, PCIR_DEVICE, (uint16_t)VIRTIO_DEV_CONSOLE);
+	pci_vdev_write_cfg_u8(vdev, PCIR_CLASS, (uint8_t)PCIC_SIMPLECOMM);
+	pci_vdev_write_cfg_u8(vdev, PCIR_SUBCLASS, (uint8_t)PCIS_SIMPLECOMM_OTHER);
+	pci_vdev_write_cfg_u8(vdev, PCIR_HDRTYPE, (uint8_t)PCIM_HDRTYPE_NORMAL);
+	pci_vdev_write_cfg_u32(vdev, pci_bar_offset(0U), (uint32_t)pio->base | PCIM_BAR_IO_SPACE);
+	pci_vdev_write_cfg_u32(vdev, pci_bar_offset(VCON_MSIX_BAR), (uint32_t)mmio->base);
+	pci_vdev_write_cfg_u16(vdev, PCIR_SUBVEND_0, (uint16_t)VIRTIO_VENDOR);
+	pci_vdev_write_cfg_u16(vdev, PCIR_SUBDEV_0, (uint16_t)VIRTIO_TYPE_CONSOLE);
+
+	spinlock_obtain(&vcon_lock);
+	vmsix_emul_init(vdev, &port->msix, VCON_MSIX_CAPOFF, VCON_MSIX_NUM, VCON_MSIX_BAR);
+	port->vdev = vdev;
+	port->pio_base = (uint16_t)pio->base;
+	vcon_reset(port);
+	vcon_ports[vm->vm_id] = port;
+	spinlock_release(&vcon_lock);
+
+	range.flags = IO_ATTR_RW;
+	range.base = port->pio_base;
+	range.len = (uint16_t)VCON_PIO_SIZE;
+	register_io_emulation_handler(vm, VIRTIO_CONSOLE_PIO_IDX, &range, vcon_pio_read, vcon_pio_write);
+
+	return register_mmio_emulation_handler(vm, vcon_msix_access_handler,
+		mmio->base, mmio->base + mmio->size, vdev);
+}
+
+static int32_t vdev_virtio_console_deinit(struct pci_vdev *vdev)
+{
+	struct vcon_port *port = (struct vcon_port *)vdev->priv;
+	struct acrn_vm *vm = vdev->vpci->vm;
+
+	spinlock_obtain(&vcon_lock);
+	if ((port != NULL) && (port->vdev == vdev)) {
+		vcon_reset(port);
+		port->vdev = NULL;
+		vcon_ports[vm->vm_id] = NULL;
+	}
+	spinlock_release(&vcon_lock);
+
+	return 0;
+}
+
+static int32_t vdev_virtio_console_cfgread(struct pci_vdev *vdev, uint32_t offset,
+	uint32_t bytes, uint32_t *val)
+{
+	/* Assumption: access needed to be aligned on 1/2/4 bytes */
+	if ((offset & (bytes - 1U)) != 0U) {
+		*val = 0xFFFFFFFFU;
+		return -EINVAL;
+	}
+
+	*val = pci_vdev_read_cfg(vdev, offset, bytes);
+
+	return 0;
+}
+
+/* BARs are placed by the VM description: answer sizing, keep the base */
+static void vdev_virtio_console_cfgwrite_bar(struct pci_vdev *vdev, uint32_t offset,
+	uint32_t bytes, uint32_t val)
+{
+	uint32_t idx = (offset - pci_bar_offset(0U)) >> 2U;
+	const struct pci_bar *bar = &vdev->bar[idx];
+	uint32_t space, bar_val = 0U;
+
+	if ((bytes != 4U) || ((offset & 0x3U) != 0U)) {
+		return;
+	}
+
+	if ((bar->type == PCIBAR_IO) || (bar->type == PCIBAR_MEM32)) {
+		space = (bar->type == PCIBAR_IO) ? PCIM_BAR_IO_SPACE : PCIM_BAR_MEM_32;
+		if (val == ~0U) {
+			bar_val = ~((uint32_t)bar->size - 1U);
+		} else {
+			bar_val = (uint32_t)bar->base;
+		}
+		bar_val = (bar_val & ((bar->type == PCIBAR_IO) ? PCIM_BAR_IO_BASE : PCIM_BAR_MEM_BASE)) | space;
+	}
+
+	pci_vdev_write_cfg_u32(vdev, offset, bar_val);
+}
+
+static int32_t vdev_virtio_console_cfgwrite(struct pci_vdev *vdev, uint32_t offset,
+	uint32_t bytes, uint32_t val)
+{
+	struct vcon_port *port = (struct vcon_port *)vdev->priv;
+	bool msix_access;
+
+	/* Assumption: access needed to be aligned on 1/2/4 bytes */
+	if ((offset & (bytes - 1U)) != 0U) {
+		return -EINVAL;
+	}
+
+	/* Stays read-only if init failed */
+	if ((port == NULL) || (port->vdev != vdev)) {
+		return -ENODEV;
+	}
+
+	spinlock_obtain(&vcon_lock);
+	msix_access = vmsix_emul_cfgwrite(vdev, &port->msix, offset, bytes, val);
+	spinlock_release(&vcon_lock);
+
+	if (msix_access) {
+		/* Handled by vmsix_emul_cfgwrite() */
+	} else if (pci_bar_access(offset)) {
+		vdev_virtio_console_cfgwrite_bar(vdev, offset, bytes, val);
+	} else if (in_range(offset, PCIR_COMMAND, 2U) || (offset == PCIR_INTLINE)) {
+		pci_vdev_write_cfg(vdev, offset, bytes, val);
+	} else {
+		/* The rest of the header and capability space is read-only */
+	}
+
+	return 0;
+}
+
+struct pci_vdev_ops pci_ops_vdev_virtio_console = {
+	.init = vdev_virtio_console_init,
+	.deinit = vdev_virtio_console_deinit,
+	.cfgwrite = vdev_virtio_console_cfgwrite,
+	.cfgread = vdev_virtio_console_cfgread,
+};
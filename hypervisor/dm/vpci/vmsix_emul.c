@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * MSI-X capability, table and PBA of PCI devices emulated by the hypervisor
+ * in partition mode. The device keeps the table and the PBA in the low and
+ * high half of a 4K MMIO BAR; callers serialize the accesses.
+ */
+
+#include <hypervisor.h>
+#include "pci_priv.h"
+
+#define VMSIX_EMUL_ENTRY_SIZE	16U
+
+static inline uint16_t vmsix_emul_ctrl(const struct pci_vdev *vdev, const struct vmsix_emul *msix)
+{
+	return vdev->cfgdata.data_16[(msix->capoff + PCIR_MSIX_CTRL) >> 1U];
+}
+
+void vmsix_emul_init(struct pci_vdev *vdev, struct vmsix_emul *msix, uint32_t capoff,
+	uint32_t table_count, uint32_t bar)
+{
+	uint32_t i;
+
+	msix->capoff = capoff;
+	msix->table_count = min(table_count, VMSIX_EMUL_MAX_ENTRIES);
+	msix->bar = bar;
+	msix->pba = 0UL;
+	for (i = 0U; i < VMSIX_EMUL_MAX_ENTRIES; i++) {
+		msix->table[i].addr = 0UL;
+		msix->table[i].data = 0U;
+		msix->table[i].vector_control = PCIM_MSIX_VCTRL_MASK;
+	}
+
+	pci_vdev_write_cfg_u16(vdev, PCIR_STATUS,
+		pci_vdev_read_cfg_u16(vdev, PCIR_STATUS) | (uint16_t)PCIM_STATUS_CAPPRESENT);
+	pci_vdev_write_cfg_u8(vdev, PCIR_CAP_PTR, (uint8_t)capoff);
+	pci_vdev_write_cfg_u8(vdev, capoff + PCICAP_ID, (uint8_t)PCIY_MSIX);
+	pci_vdev_write_cfg_u8(vdev, capoff + PCICAP_NEXTPTR, 0U);
+	pci_vdev_write_cfg_u16(vdev, capoff + PCIR_MSIX_CTRL, (uint16_t)(msix->table_count - 1U));
+	pci_vdev_write_cfg_u32(vdev, capoff + PCIR_MSIX_TABLE, bar);
+	pci_vdev_write_cfg_u32(vdev, capoff + PCIR_MSIX_PBA, VMSIX_EMUL_PBA_OFFSET | bar);
+}
+
+void vmsix_emul_raise(struct pci_vdev *vdev, struct vmsix_emul *msix, uint16_t vector)
+{
+	const struct msix_table_entry *entry;
+	uint16_t ctrl = vmsix_emul_ctrl(vdev, msix);
+
+	if ((vector < msix->table_count) && ((ctrl & PCIM_MSIXCTRL_MSIX_ENABLE) != 0U)) {
+		entry = &msix->table[vector];
+		if (((ctrl & PCIM_MSIXCTRL_FUNCTION_MASK) != 0U)
+				|| ((entry->vector_control & PCIM_MSIX_VCTRL_MASK) != 0U)) {
+			msix->pba |= (1UL << vector);
+		} else {
+			(void)vlapic_intr_msi(vdev->vpci->vm, entry->addr, entry->data);
+		}
+	}
+}
+
+/* Send the messages left pending while their vector was masked */
+static void vmsix_emul_flush(struct pci_vdev *vdev, struct vmsix_emul *msix)
+{
+	uint16_t vector;
+	uint64_t pending = msix->pba;
+
+	msix->pba = 0UL;
+	for (vector = 0U; vector < msix->table_count; vector++) {
+		if ((pending & (1UL << vector)) != 0U) {
+			vmsix_emul_raise(vdev, msix, vector);
+		}
+	}
+}
+
+bool vmsix_emul_cfgwrite(struct pci_vdev *vdev, struct vmsix_emul *msix, uint32_t offset,
+	uint32_t bytes, uint32_t val)
+{
+	uint32_t old, new, mask;
+	bool ret = false;
+
+	if (in_range(offset, msix->capoff, 4U)) {
+		/* Only Enable and Function Mask of the capability are writable */
+		mask = ((uint32_t)PCIM_MSIXCTRL_MSIX_ENABLE | PCIM_MSIXCTRL_FUNCTION_MASK) << 16U;
+		old = pci_vdev_read_cfg_u32(vdev, msix->capoff);
+		pci_vdev_write_cfg(vdev, offset, bytes, val);
+		new = pci_vdev_read_cfg_u32(vdev, msix->capoff);
+		pci_vdev_write_cfg_u32(vdev, msix->capoff, (old & ~mask) | (new & mask));
+		vmsix_emul_flush(vdev, msix);
+		ret = true;
+	} else if (in_range(offset, msix->capoff, 12U)) {
+		/* Table and PBA locations are read-only */
+		ret = true;
+	} else {
+		/* Not in the capability */
+	}
+
+	return ret;
+}
+
+int32_t vmsix_emul_mmio_rw(struct pci_vdev *vdev, struct vmsix_emul *msix, struct mmio_request *mmio,
+	uint64_t offset)
+{
+	uint8_t *table = (uint8_t *)msix->table;
+
+	/* Only naturally aligned DWORD and QWORD are permitted */
+	if (((mmio->size != 4UL) && (mmio->size != 8UL)) || ((offset & (mmio->size - 1UL)) != 0UL)) {
+		return -EINVAL;
+	}
+
+	if (offset < ((uint64_t)msix->table_count * VMSIX_EMUL_ENTRY_SIZE)) {
+		if (mmio->direction == REQUEST_READ) {
+			mmio->value = 0UL;
+			(void)memcpy_s(&mmio->value, (size_t)mmio->size, table + offset, (size_t)mmio->size);
+		} else {
+			(void)memcpy_s(table + offset, (size_t)mmio->size, &mmio->value, (size_t)mmio->size);
+			vmsix_emul_flush(vdev, msix);
+		}
+	} else if (mmio->direction == REQUEST_READ) {
+		if (offset == VMSIX_EMUL_PBA_OFFSET) {
+			mmio->value = msix->pba;
+		} else if (offset == (VMSIX_EMUL_PBA_OFFSET + 4UL)) {
+			mmio->value = msix->pba >> 32U;
+		} else {
+			mmio->value = 0UL;
+		}
+	} else {
+		/* PBA and reserved space are read-only */
+	}
+
+	return 0;
+}
@@ -98,6 +98,46 @@ static void pci_cfgdata_io_write(struct acrn_vm *vm, uint16_t addr, size_t bytes
 	}
 }
 
+#ifdef CONFIG_PARTITION_MODE
+/*
+ * ECAM: the BDF and register are both in the address, so an access takes a
+ * single exit and needs no state shared between the vCPUs.
+ */
+static int32_t vpci_mmcfg_access_handler(struct io_request *io_req, void *handler_private_data)
+{
+	struct acrn_vm *vm = (struct acrn_vm *)handler_private_data;
+	struct vpci *vpci = &vm->vpci;
+	struct mmio_request *mmio = &io_req->reqs.mmio;
+	uint64_t offset = mmio->address - PCI_MMCFG_BASE;
+	uint32_t bytes = (uint32_t)mmio->size;
+	uint32_t reg = (uint32_t)offset & 0xFFFU;
+	union pci_bdf bdf;
+	uint32_t val = ~0U;
+
+	bdf.value = (uint16_t)(offset >> 12U);
+
+	/* Only the 256 bytes of the legacy config space are emulated */
+	if (((bytes == 1U) || (bytes == 2U) || (bytes == 4U)) &&
+			((reg & (bytes - 1U)) == 0U) && (reg <= PCI_REGMAX)) {
+		if (mmio->direction == REQUEST_READ) {
+			if ((vpci->ops != NULL) && (vpci->ops->cfgread != NULL)) {
+				vpci->ops->cfgread(vpci, bdf, reg, bytes, &val);
+			}
+		} else {
+			if ((vpci->ops != NULL) && (vpci->ops->cfgwrite != NULL)) {
+				vpci->ops->cfgwrite(vpci, bdf, reg, bytes, (uint32_t)mmio->value);
+			}
+		}
+	}
+
+	if (mmio->direction == REQUEST_READ) {
+		mmio->value = (uint64_t)val;
+	}
+
+	return 0;
+}
+#endif
+
 void vpci_init(struct acrn_vm *vm)
 {
 	struct vpci *vpci = &vm->vpci;
@@ -134,6 +174,12 @@ void vpci_init(struct acrn_vm *vm)
 		/* Intercept and handle I/O ports CFC -- CFF */
 		register_io_emulation_handler(vm, PCI_CFGDATA_PIO_IDX, &pci_cfgdata_range,
 			pci_cfgdata_io_read, pci_cfgdata_io_write);
+
+#ifdef CONFIG_PARTITION_MODE
+		/* SOS in sharing mode keeps reaching the physical ECAM window directly */
+		(void)register_mmio_emulation_handler(vm, vpci_mmcfg_access_handler,
+			PCI_MMCFG_BASE, PCI_MMCFG_BASE + PCI_MMCFG_SIZE, vm);
+#endif
 	}
 }
 
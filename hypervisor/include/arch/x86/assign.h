@@ -89,10 +89,13 @@ int32_t ptirq_intx_pin_remap(struct acrn_vm *vm, uint8_t virt_pin, enum ptirq_vp
  * Except vm0, Device Model should call this function to pre-hold ptdev intx
  * The entry is identified by phys_pin, one entry vs. one phys_pin.
  * Currently, one phys_pin can only be held by one pin source (vPIC or vIOAPIC).
+ * Each device sharing the phys_pin adds it again with its own phys_bdf, which
+ * lets the acknowledgement of a shared level line check all of them.
  *
  * @param[in] vm pointer to acrn_vm
  * @param[in] virt_pin virtual pin number associated with the passthrough device
  * @param[in] phys_pin physical pin number associated with the passthrough device
+ * @param[in] phys_bdf physical BDF of the passthrough device
  * @param[in] pic_pin true for pic, false for ioapic
  *
  * @return
@@ -103,7 +106,8 @@ int32_t ptirq_intx_pin_remap(struct acrn_vm *vm, uint8_t virt_pin, enum ptirq_vp
  * @pre vm != NULL
  *
  */
-int32_t ptirq_add_intx_remapping(struct acrn_vm *vm, uint8_t virt_pin, uint8_t phys_pin, bool pic_pin);
+int32_t ptirq_add_intx_remapping(struct acrn_vm *vm, uint8_t virt_pin, uint8_t phys_pin,
+		uint16_t phys_bdf, bool pic_pin);
 
 /**
  * @brief Remove an interrupt remapping entry for INTx.
@@ -158,6 +162,47 @@ int32_t ptirq_add_msix_remapping(struct acrn_vm *vm, uint16_t virt_bdf, uint16_t
  */
 void ptirq_remove_msix_remapping(const struct acrn_vm *vm, uint16_t virt_bdf, uint32_t vector_count);
 
+/**
+ * @brief Set interrupt coalescing of MSI/MSI-x entries.
+ *
+ * Interrupts of each vector are injected at the latest \p max_us after the
+ * first of a batch, or as soon as \p max_events of them have arrived.
+ *
+ * @param[in] vm pointer to acrn_vm
+ * @param[in] virt_bdf virtual bdf associated with the passthrough device
+ * @param[in] vector_count number of vectors
+ * @param[in] max_events number of interrupts to inject at once, 0 for no limit
+ * @param[in] max_us longest delay of an interrupt, 0 turns coalescing off
+ *
+ * @return
+ *    - 0: on success
+ *    - \p -ENODEV: no remapping entry for some of the vectors
+ *
+ * @pre vm != NULL
+ *
+ */
+int32_t ptirq_set_msix_coalescing(const struct acrn_vm *vm, uint16_t virt_bdf,
+		uint32_t vector_count, uint32_t max_events, uint32_t max_us);
+
+/**
+ * @brief Set interrupt coalescing of an INTx entry.
+ *
+ * @param[in] vm pointer to acrn_vm
+ * @param[in] virt_pin virtual pin number associated with the passthrough device
+ * @param[in] pic_pin true for pic, false for ioapic
+ * @param[in] max_events number of interrupts to inject at once, 0 for no limit
+ * @param[in] max_us longest delay of an interrupt, 0 turns coalescing off
+ *
+ * @return
+ *    - 0: on success
+ *    - \p -ENODEV: no remapping entry for the pin
+ *
+ * @pre vm != NULL
+ *
+ */
+int32_t ptirq_set_intx_coalescing(struct acrn_vm *vm, uint8_t virt_pin, bool pic_pin,
+		uint32_t max_events, uint32_t max_us);
+
 /**
   * @}
   */
@@ -304,6 +304,10 @@ extern struct cpuinfo_x86 boot_cpu_data;
  */
 #define MAX_CX_ENTRY	(MAX_CSTATE - 1U)
 
+/* MWAIT hints, bits 7:4 are the target C-state minus one */
+#define MWAIT_HINT_C1	0x00U
+#define MWAIT_HINT_C2	0x10U
+
 /* Function prototypes */
 void cpu_do_idle(void);
 void cpu_dead(uint16_t pcpu_id);
@@ -312,11 +316,19 @@ bool is_apicv_reg_virtualization_supported(void);
 bool is_apicv_intr_delivery_supported(void);
 bool is_apicv_posted_intr_supported(void);
 bool is_ept_supported(void);
+bool is_ple_supported(void);
+bool is_tsc_scaling_supported(void);
+bool is_vmx_ptmr_supported(void);
+uint8_t get_vmx_ptmr_rate(void);
+bool is_mwait_supported(void);
+uint32_t get_mwait_hint(uint32_t hint);
 bool cpu_has_cap(uint32_t bit);
 void load_cpu_state_data(void);
 void init_cpu_pre(uint16_t pcpu_id);
 void init_cpu_post(uint16_t pcpu_id);
 void start_cpus(void);
+void kick_cpus(void);
+void wait_cpus_up(void);
 void stop_cpus(void);
 void wait_sync_change(uint64_t *sync, uint64_t wake_sync);
 void cpu_l1d_flush(void);
@@ -418,6 +430,27 @@ static inline void cpu_memory_barrier(void)
 	asm volatile ("mfence\n" : : : "memory");
 }
 
+/* Orders writes to WB memory, the CPU itself never reorders them */
+static inline void cpu_write_memory_barrier(void)
+{
+	asm volatile ("" : : : "memory");
+}
+
+/* Arms address monitoring of the cache line of addr for cpu_mwait() */
+static inline void cpu_monitor(const volatile void *addr)
+{
+	asm volatile ("monitor\n" : : "a"(addr), "c"(0U), "d"(0U) : "memory");
+}
+
+/*
+ * Waits in the C-state of hint for a write to the monitored line or an
+ * interrupt, the latter breaks the wait even if interrupts are masked.
+ */
+static inline void cpu_mwait(uint32_t hint)
+{
+	asm volatile ("mwait\n" : : "a"(hint), "c"(1U) : "memory");
+}
+
 /* Write the task register */
 #define CPU_LTR_EXECUTE(ltr_ptr)                            \
 {                                                           \
@@ -532,6 +565,15 @@ write_xcr(int32_t reg, uint64_t val)
 	asm volatile("xsetbv" : : "c" (reg), "a" (low), "d" (high));
 }
 
+static inline uint64_t
+read_xcr(int32_t reg)
+{
+	uint32_t low, high;
+
+	asm volatile("xgetbv" : "=a" (low), "=d" (high) : "c" (reg));
+	return (((uint64_t)high << 32U) | (uint64_t)low);
+}
+
 static inline void stac(void)
 {
 	asm volatile ("stac" : : : "memory");
@@ -90,13 +90,29 @@
 #define CPUID_EBX_PQE           (1U<<15U)
 /* CPUID.01H:ECX.PCID*/
 #define CPUID_ECX_PCID          (1U<<17U)
+/* CPUID.05H:ECX.EMX, MWAIT extensions */
+#define CPUID_ECX_MWAIT_EMX     (1U<<0U)
+/* CPUID.05H:ECX.IBE, interrupts break MWAIT even when masked */
+#define CPUID_ECX_MWAIT_IBE     (1U<<1U)
+/* CPUID.06H:EAX.ARAT, APIC timer always running */
+#define CPUID_EAX_ARAT          (1U<<2U)
+/* CPUID.(EAX=0DH,ECX=01H):EAX.XSAVEOPT */
+#define CPUID_EAX_XSAVEOPT      (1U<<0U)
+/* CPUID.(EAX=0DH,ECX=01H):EAX.XSAVES, with XRSTORS and IA32_XSS */
+#define CPUID_EAX_XSAVES        (1U<<3U)
+/* CPUID.(EAX=0DH,ECX=i):ECX, i > 1 */
+#define CPUID_ECX_XSTATE_SUPERVISOR  (1U<<0U)	/* component of IA32_XSS */
+#define CPUID_ECX_XSTATE_ALIGN64     (1U<<1U)	/* 64-byte aligned when compacted */
 
 /* CPUID source operands */
 #define CPUID_VENDORSTRING      0U
 #define CPUID_FEATURES          1U
 #define CPUID_TLB               2U
 #define CPUID_SERIALNUM         3U
+#define CPUID_MONITOR_MWAIT     5U
+#define CPUID_THERMAL_POWER     6U
 #define CPUID_EXTEND_FEATURE    7U
+#define CPUID_XSAVE_FEATURES    0xDU
 #define CPUID_MAX_EXTENDED_FUNCTION  0x80000000U
 #define CPUID_EXTEND_FUNCTION_1      0x80000001U
 #define CPUID_EXTEND_FUNCTION_2      0x80000002U
@@ -103,6 +103,8 @@ int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu);
 void init_msr_emulation(struct acrn_vcpu *vcpu);
 
 uint32_t vmsr_get_guest_msr_index(uint32_t msr);
+void save_passthru_msrs(struct acrn_vcpu *vcpu);
+void load_passthru_msrs(const struct acrn_vcpu *vcpu);
 
 void update_msr_bitmap_x2apic_apicv(struct acrn_vcpu *vcpu);
 void update_msr_bitmap_x2apic_passthru(struct acrn_vcpu *vcpu);
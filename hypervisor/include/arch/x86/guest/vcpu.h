@@ -53,6 +53,7 @@
 #ifndef ASSEMBLER
 
 #include <guest.h>
+#include <schedule.h>
 
 /**
  * @brief vcpu
@@ -166,9 +167,12 @@ struct ext_context {
 #define SECURE_WORLD	1
 
 #define NUM_WORLD_MSRS		2U
-#define NUM_COMMON_MSRS		6U
+#define NUM_COMMON_MSRS		7U
 #define NUM_GUEST_MSRS		(NUM_WORLD_MSRS + NUM_COMMON_MSRS)
 
+/* MSRs accessed without VM exits that the VMCS does not switch */
+#define NUM_PASSTHRU_MSRS	5U
+
 struct event_injection_info {
 	uint32_t intr_info;
 	uint32_t error_code;
@@ -179,7 +183,7 @@ struct cpu_context {
 	struct ext_context ext_ctx;
 
 	/* per world MSRs, need isolation between secure and normal world */
-	uint32_t world_msrs[NUM_WORLD_MSRS];
+	uint64_t world_msrs[NUM_WORLD_MSRS];
 };
 
 /* Intel SDM 24.8.2, the address must be 16-byte aligned */
@@ -191,6 +195,7 @@ struct msr_store_entry {
 
 enum {
 	MSR_AREA_TSC_AUX = 0,
+	MSR_AREA_PERF_GLOBAL_CTRL,	/* in the lists while the vPMU is loaded */
 	MSR_AREA_COUNT,
 };
 
@@ -199,6 +204,72 @@ struct msr_store_area {
 	struct msr_store_entry host[MSR_AREA_COUNT];
 };
 
+#define GPA_CACHE_ENTRIES	4U
+
+struct gpa_cache_entry {
+	uint64_t gpa_base;
+	uint64_t hpa_base;
+	uint64_t pg_size;	/* 0 for an unused entry */
+	uint64_t gen;		/* EPT generation the entry was filled at */
+	int32_t world;
+};
+
+struct gpa_cache {
+	struct gpa_cache_entry entries[GPA_CACHE_ENTRIES];
+	uint32_t next;
+};
+
+#define GVA_CACHE_ENTRIES	4U
+#define GVA_WALK_LEVELS_MAX	4U
+
+struct gva_cache_entry {
+	uint64_t cr3;		/* with the PCID, if any, in its low bits */
+	uint64_t gva_base;
+	uint64_t gpa_base;
+	uint64_t page_size;	/* 0 for an unused entry */
+	uint64_t ept_gen;
+	uint32_t access;	/* walk inputs the permission checks depend on */
+	int32_t world;
+	uint32_t nr_levels;
+	bool pte32;
+	/* host pointers to, and values of, the entries the walk read */
+	const void *pte[GVA_WALK_LEVELS_MAX];
+	uint64_t pte_val[GVA_WALK_LEVELS_MAX];
+};
+
+struct gva_cache {
+	struct gva_cache_entry entries[GVA_CACHE_ENTRIES];
+	uint32_t next;
+};
+
+/*
+ * VMCS fields accessed through the per-exit cache. A field is read from the
+ * VMCS at most once per VM exit, and writes are collected and done once
+ * before the next VM entry. Every access to these fields while the vCPU is
+ * not in VMX non-root operation must go through vcpu_vmcs_read() and
+ * vcpu_vmcs_write(), except for the VMCS initialization.
+ */
+enum vmcs_cached_field {
+	VMCS_EXIT_QUALIFICATION = 0,
+	VMCS_GUEST_PHYSICAL_ADDR,
+	VMCS_GUEST_LINEAR_ADDR,
+	VMCS_EXIT_INT_INFO,
+	VMCS_EXIT_INT_ERROR_CODE,
+	VMCS_IDT_VEC_INFO,
+	VMCS_IDT_VEC_ERROR_CODE,
+	VMCS_GUEST_INTERRUPTIBILITY,
+	VMCS_ENTRY_INT_INFO,
+	VMCS_ENTRY_EXCEPTION_ERROR_CODE,
+	VMCS_PROC_VM_EXEC_CONTROLS,
+	VMCS_CACHED_FIELDS,
+};
+
+struct vmcs_cache {
+	uint64_t val[VMCS_CACHED_FIELDS];
+	uint32_t cached;	/* bitmap of the valid val[] */
+	uint32_t dirty;		/* bitmap of the val[] to write back */
+};
+
 struct acrn_vcpu_arch {
 	/* vmcs region for this vcpu, MUST be 4KB-aligned */
 	uint8_t vmcs[PAGE_SIZE];
@@ -214,8 +285,20 @@ struct acrn_vcpu_arch {
 
 	/* common MSRs, world_msrs[] is a subset of it */
 	uint64_t guest_msrs[NUM_GUEST_MSRS];
+	/* values of the pass-through MSRs while another vCPU has the pCPU */
+	uint64_t passthru_msrs[NUM_PASSTHRU_MSRS];
 
 	uint16_t vpid;
+	/* EPT generation of the VM the last invept() on this vCPU covered */
+	uint64_t ept_flushed_gen;
+	/* whether its normal world EPTP enables the accessed and dirty flags */
+	bool ept_ad;
+	/* recent GPA to HPA translations done on this vCPU's pCPU */
+	struct gpa_cache gpa_cache;
+	/* recent guest page walks, see gva2gpa() */
+	struct gva_cache gva_cache;
+	/* VMCS fields read or written since the last VM exit */
+	struct vmcs_cache vmcs_cache;
 
 	/* Holds the information needed for IRQ/exception handling. */
 	struct {
@@ -247,8 +330,52 @@ struct acrn_vcpu_arch {
 
 	/* List of MSRS to be stored and loaded on VM exits or VM entries */
 	struct msr_store_area msr_area;
+
+	struct acrn_vpmu vpmu;
 } __aligned(PAGE_SIZE);
 
+/*
+ * Always-on VM exit accounting, only written from the pCPU of the vCPU.
+ * The MMIO counters are indexed like vm->emul_mmio[], which no longer
+ * changes once the vCPUs run.
+ */
+#define VMEXIT_MSR_SLOTS	16U
+
+struct msr_exit_stats {
+	uint32_t msr;
+	uint64_t reads;
+	uint64_t writes;
+};
+
+struct vmexit_stats {
+	struct acrn_exit_reason_stats reason[ACRN_VMEXIT_REASONS];
+	uint64_t mmio_count[CONFIG_MAX_EMULATED_MMIO_REGIONS];
+	uint64_t mmio_cycles[CONFIG_MAX_EMULATED_MMIO_REGIONS];
+	/* intercepted MSRs in the order of their first access */
+	struct msr_exit_stats msr[VMEXIT_MSR_SLOTS];
+	uint64_t msr_other;	/* accesses to MSRs beyond msr[] */
+	/* MOV to CR0/CR4 exits changing each bit */
+	uint64_t cr0_bit_writes[32];
+	uint64_t cr4_bit_writes[32];
+	/* interrupts sent to the vLAPIC, counted from any pCPU */
+	uint64_t intr_sent;
+	uint64_t timer_fired;	/* expirations of the vLAPIC timer */
+	/* all the exits, for the telemetry page */
+	uint64_t exits;
+	uint64_t exit_cycles;
+};
+
+/*
+ * Always-on ring of the last VM exits, written from the pCPU of the vCPU.
+ * The record of exit nr_exits is filled on the exit and published on the
+ * next VM entry.
+ */
+struct exit_timeline {
+	uint64_t nr_exits;
+	bool pending;		/* records[nr_exits] waits for its VM entry */
+	struct acrn_exit_record records[ACRN_EXIT_TIMELINE_RECORDS];
+};
+
 struct acrn_vm;
 struct acrn_vcpu {
 	/* Architecture specific definitions for this VCPU */
@@ -271,6 +398,12 @@ struct acrn_vcpu {
 	uint32_t running; /* vcpu is picked up and run? */
 
 	struct io_request req; /* used by io/ept emulation */
+	uint16_t mmio_hint; /* index of the emul_mmio[] region hit last time */
+	struct ioreq_latency ioreq_lat; /* used by adaptive I/O completion */
+	struct sched_vcpu sched; /* scheduling state and runtime accounting */
+	struct vmexit_stats exit_stats; /* VM exit counts and cycles */
+	struct exit_timeline exit_timeline; /* the last VM exits */
+	uint32_t telemetry_seq;	/* of vcpu[vcpu_id] in the telemetry page */
 
 	uint64_t reg_cached;
 	uint64_t reg_updated;
@@ -471,6 +604,40 @@ uint64_t vcpu_get_cr4(struct acrn_vcpu *vcpu);
  */
 void vcpu_set_cr4(struct acrn_vcpu *vcpu, uint64_t val);
 
+/**
+ * @brief read a cached VMCS field
+ *
+ * Read the field from the VMCS on the first access after a VM exit and
+ * from the cache afterwards.
+ *
+ * @param[in] vcpu pointer to vcpu data structure
+ * @param[in] field the VMCS field
+ *
+ * @return the value of the field, zero extended.
+ */
+uint64_t vcpu_vmcs_read(struct acrn_vcpu *vcpu, enum vmcs_cached_field field);
+
+/**
+ * @brief write a cached VMCS field
+ *
+ * Update the field in the cache, it goes to the VMCS on the next VM entry.
+ *
+ * @param[inout] vcpu pointer to vcpu data structure
+ * @param[in] field the VMCS field
+ * @param[in] val the value to write
+ */
+void vcpu_vmcs_write(struct acrn_vcpu *vcpu, enum vmcs_cached_field field, uint64_t val);
+
+/**
+ * @brief drop the VMCS field cache
+ *
+ * To be called once the VMCS was set up from scratch, pending writes are
+ * discarded.
+ *
+ * @param[inout] vcpu pointer to vcpu data structure
+ */
+void vcpu_vmcs_cache_reset(struct acrn_vcpu *vcpu);
+
 /**
  * @brief get guest emulated MSR
  *
@@ -505,6 +672,18 @@ void vcpu_set_guest_msr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t val);
  */
 void set_vcpu_regs(struct acrn_vcpu *vcpu, struct acrn_vcpu_regs *vcpu_regs);
 
+/**
+ * @brief get the vcpu registers
+ *
+ * Read back the registers set_vcpu_regs takes from the VMCS of a vCPU
+ * that does not run, so that a paused vCPU can be restarted elsewhere
+ * from the same state. It has to run on the pCPU of the vCPU.
+ *
+ * @param[in] vcpu pointer to vcpu data structure
+ * @param[out] vcpu_regs all the registers' value
+ */
+void get_vcpu_regs(struct acrn_vcpu *vcpu, struct acrn_vcpu_regs *vcpu_regs);
+
 /**
  * @brief reset all the vcpu registers
  *
@@ -617,6 +796,27 @@ void resume_vcpu(struct acrn_vcpu *vcpu);
  */
 void schedule_vcpu(struct acrn_vcpu *vcpu);
 
+/**
+ * @brief block the vcpu until an event is pending for it
+ *
+ * Called on a HLT exit. Unless an event is already pending, take the vCPU off
+ * the run queue so the other vCPUs of its pCPU can run, and make a reschedule
+ * request for it.
+ *
+ * @param[inout] vcpu pointer to vcpu data structure
+ */
+void halt_vcpu(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief wake up a halted vcpu
+ *
+ * Put a vCPU blocked by halt_vcpu() back to the run queue and make a
+ * reschedule request for it. Called after an event was made pending for it.
+ *
+ * @param[inout] vcpu pointer to vcpu data structure
+ */
+void wake_vcpu(struct acrn_vcpu *vcpu);
+
 /**
  * @brief create a vcpu for the vm and mapped to the pcpu.
  *
@@ -45,17 +45,36 @@
 
 #define REDIR_ENTRIES_HW	120U /* SOS align with native ioapic */
 #define STATE_BITMAP_SIZE	INT_DIV_ROUNDUP(REDIR_ENTRIES_HW, 64U)
+#define VIOAPIC_VECTOR_NUM	256U
 
 #define IOAPIC_RTE_LOW_INTVEC	((uint32_t)IOAPIC_RTE_INTVEC)
 
+/* A pin, its delivery decoded from the RTE when the RTE is written */
+struct vioapic_pin {
+	spinlock_t	lock;	/* level, Remote IRR and delivery of the pin */
+	uint32_t	vector;
+	uint32_t	dest;
+	uint32_t	delmode;
+	bool		phys;
+	bool		level;
+};
+
+/*
+ * 'mtx' serializes programming the vIOAPIC, the state of a single pin is
+ * protected by its own lock, taken after 'mtx' if both are needed. An RTE
+ * only changes with both held.
+ */
 struct acrn_vioapic {
 	struct acrn_vm	*vm;
 	spinlock_t	mtx;
 	uint32_t	id;
 	uint32_t	ioregsel;
 	union ioapic_rte rtbl[REDIR_ENTRIES_HW];
+	struct vioapic_pin pins[REDIR_ENTRIES_HW];
 	/* pin_state status bitmap: 1 - high, 0 - low */
 	uint64_t pin_state[STATE_BITMAP_SIZE];
+	/* pins by the vector of their RTE, for EOI */
+	uint64_t vector_pins[VIOAPIC_VECTOR_NUM][STATE_BITMAP_SIZE];
 	struct ptirq_remapping_info *vpin_to_pt_entry[VIOAPIC_MAX_PIN];
 };
 
@@ -87,8 +106,8 @@ void	vioapic_set_irq(struct acrn_vm *vm, uint32_t irq, uint32_t operation);
 /**
  * @brief Set vIOAPIC IRQ line status.
  *
- * Similar with vioapic_set_irq(),but would not make sure
- * operation be done with ioapic lock.
+ * Similar with vioapic_set_irq(), but with the lock of the pin held
+ * by the caller already.
  *
  * @param[in] vm        Pointer to target VM
  * @param[in] irq       Target IRQ number
@@ -47,6 +47,17 @@
 
 #define VLAPIC_MAXLVT_INDEX	APIC_LVT_CMCI
 
+/*
+ * Layout of 'pending' follows the VT-d posted interrupt descriptor, so the
+ * IOMMU can post interrupts of passthrough devices into the same PIR.
+ */
+#define PID_ON_BIT		0U	/* outstanding notification */
+#define PID_SN_BIT		1U	/* suppress notification */
+#define PID_NV_POS		16U	/* notification vector */
+#define PID_NV_MASK		(0xFFUL << PID_NV_POS)
+#define PID_NDST_POS		32U	/* notification destination */
+#define PID_NDST_MASK		(0xFFFFFFFFUL << PID_NDST_POS)
+
 struct vlapic_pir_desc {
 	uint64_t pir[4];
 	uint64_t pending;
@@ -58,6 +69,35 @@ struct vlapic_timer {
 	uint32_t mode;
 	uint32_t tmicr;
 	uint32_t divisor_shift;
+	/*
+	 * The TSC deadline in timer.fire_tsc is counted by the VMX preemption
+	 * timer instead of the hv_timer, see vlapic_ptmr_load().
+	 */
+	bool ptmr_armed;
+	/* The deadline went to the hv_timer while the vCPU was scheduled out */
+	bool ptmr_parked;
+	/* The preemption timer control is set in the VMCS of the vCPU */
+	bool ptmr_enabled;
+};
+
+#define VLAPIC_XAPIC_MDA_NUM	256U	/* 8-bit xAPIC IDs and logical MDAs */
+#define VLAPIC_X2APIC_LDEST_NUM	16U	/* logical ID bits of an x2APIC cluster */
+
+/*
+ * Where the interrupts of a VM are routed to: which vCPU has an xAPIC ID,
+ * and the vCPUs each logical destination matches. Updated only when a
+ * vLAPIC's LDR, DFR or mode changes, read lock-free by vlapic_calcdest().
+ */
+struct vlapic_dest_map {
+	spinlock_t lock;		/* serializes updates */
+	uint32_t seq;			/* odd while being updated */
+	uint16_t apicid_to_vcpu[VLAPIC_XAPIC_MDA_NUM];	/* INVALID_CPU_ID if none */
+	uint64_t xapic_logical[VLAPIC_XAPIC_MDA_NUM];	/* vCPUs in xAPIC mode */
+	uint16_t nr_x2apic_clusters;
+	struct {
+		uint32_t cluster_id;
+		uint64_t vcpus[VLAPIC_X2APIC_LDEST_NUM];	/* by logical ID bit */
+	} x2apic_clusters[CONFIG_MAX_VCPUS_PER_VM];
 };
 
 struct acrn_vlapic {
@@ -96,6 +136,14 @@ struct acrn_vlapic {
 	uint8_t		isrvec_stk[ISRVEC_STK_SIZE];
 	uint32_t	isrvec_stk_top;
 
+	/*
+	 * Bit n is set if the IRR (ISR) register n may be non-zero, so the
+	 * highest pending (in service) vector is found with two bit scans.
+	 * Only maintained when the vLAPIC, not APICv, delivers interrupts.
+	 */
+	uint32_t	irr_summary;
+	uint32_t	isr_summary;
+
 	uint64_t	msr_apicbase;
 
 	/*
@@ -181,9 +229,44 @@ void vlapic_post_intr(uint16_t dest_pcpu_id);
  */
 uint64_t apicv_get_pir_desc_paddr(struct acrn_vcpu *vcpu);
 
+/**
+ * @brief Set how the IOMMU notifies a vCPU of posted interrupts.
+ *
+ * Point the notification of the PIR descriptor at the pCPU of the vCPU with
+ * \p vector, or suppress it while the vCPU waits for its pCPU anyway.
+ *
+ * @param[in] vcpu Target vCPU
+ * @param[in] vector Notification vector
+ * @param[in] suppress Whether to suppress notifications
+ *
+ * @return true if interrupts are outstanding in the PIR
+ *
+ * @pre vcpu != NULL
+ */
+bool apicv_set_pir_notification(struct acrn_vcpu *vcpu, uint32_t vector, bool suppress);
+
+/**
+ * @brief Initialize the interrupt destination map of a VM.
+ *
+ * @param[in] vm VM, before any of its vLAPICs is initialized
+ */
+void vlapic_init_dest_map(struct acrn_vm *vm);
+
 int32_t vlapic_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *rval);
 int32_t vlapic_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t wval);
 
+/**
+ * @brief Write the x2APIC ICR MSR, i.e. send an IPI from the vCPU.
+ *
+ * Same as vlapic_wrmsr() of MSR_IA32_EXT_APIC_ICR, without its dispatch.
+ *
+ * @param[in] vcpu Sending vCPU
+ * @param[in] val  ICR value, destination in the upper 32 bits
+ *
+ * @return 0 on success, -1 if the vLAPIC is not in x2APIC mode
+ */
+int32_t vlapic_x2apic_write_icr(struct acrn_vcpu *vcpu, uint64_t val);
+
 /*
  * Signals to the LAPIC that an interrupt at 'vector' needs to be generated
  * to the 'cpu', the state is recorded in IRR.
@@ -243,7 +326,8 @@ int32_t vlapic_set_local_intr(struct acrn_vm *vm, uint16_t vcpu_id_arg, uint32_t
  * @param[in] msg  MSI data.
  *
  * @retval 0 on success.
- * @retval -1 on error that addr is invalid.
+ * @retval -1 on error that addr is invalid, or the MSI can not be sent to a
+ * VM with pass-thru LAPIC.
  *
  * @pre vm != NULL
  */
@@ -281,6 +365,34 @@ int32_t apic_access_vmexit_handler(struct acrn_vcpu *vcpu);
 int32_t apic_write_vmexit_handler(struct acrn_vcpu *vcpu);
 int32_t veoi_vmexit_handler(struct acrn_vcpu *vcpu);
 int32_t tpr_below_threshold_vmexit_handler(__unused struct acrn_vcpu *vcpu);
+int32_t ptmr_vmexit_handler(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief Fire a TSC deadline counted by the VMX preemption timer which has
+ * passed, and take a deadline left to the hv_timer by vlapic_ptmr_put()
+ * back.
+ *
+ * Called with interrupts disabled before the pending requests of the vCPU
+ * are processed, so an expired deadline gets injected on this VM entry.
+ *
+ * @param[in] vcpu Current vCPU
+ */
+void vlapic_ptmr_check(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief Program the VMX preemption timer for the next VM entry.
+ *
+ * @param[in] vcpu Current vCPU
+ */
+void vlapic_ptmr_load(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief Move the TSC deadline counted by the VMX preemption timer to the
+ * hv_timer before the vCPU gets scheduled out, e.g. when halted.
+ *
+ * @param[in] vcpu Current vCPU
+ */
+void vlapic_ptmr_put(struct acrn_vcpu *vcpu);
 void calcvdest(struct acrn_vm *vm, uint64_t *dmask, uint32_t dest, bool phys);
 
 /**
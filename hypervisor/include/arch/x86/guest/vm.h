@@ -9,6 +9,7 @@
 #include <bsp_extern.h>
 #include <vpci.h>
 #include <page.h>
+#include <workqueue.h>
 
 #ifdef CONFIG_PARTITION_MODE
 #include <mptable.h>
@@ -55,8 +56,24 @@ struct vm_sw_info {
 	struct sw_linux linux_info;
 	/* HVA to IO shared page */
 	void *io_shared_page;
+	/* HVAs to all the pages of the ioreq buffer, [0] is io_shared_page */
+	void *io_req_pages[VHM_REQUEST_PAGES_MAX];
+	/* Number of requests in the ioreq buffer */
+	uint16_t io_req_slots;
+	/* HVA to the ring page of posted MMIO writes */
+	void *posted_ioreq_page;
+	/* HVA to the pending bitmap page of the ioeventfds */
+	void *ioeventfd_page;
+	/* HVA to the RTC and PIT state shared by SOS */
+	void *clock_page;
+	/* HVA to the statistics page of the VM (struct acrn_vm_telemetry) */
+	void *telemetry_page;
+	/* slots of ptirq[] taken in the telemetry page */
+	int32_t telemetry_ptirqs;
 	/* If enable IO completion polling mode */
 	bool is_completion_polling;
+	/* If enable IO completion adaptive (polling then notification) mode */
+	bool is_completion_adaptive;
 };
 
 struct vm_pm_info {
@@ -83,6 +100,7 @@ enum vm_state {
 	VM_CREATED = 0,	/* VM created / awaiting start (boot) */
 	VM_STARTED,	/* VM started (booted) */
 	VM_PAUSED,	/* VM paused */
+	VM_POWERING_OFF,	/* VM shut down, its resources being released */
 	VM_STATE_UNKNOWN
 };
 
@@ -101,11 +119,24 @@ struct vm_arch {
 	 */
 	void *sworld_eptp;
 	struct memory_ops ept_mem_ops;
+	struct pgtable_stats ept_stats;
+	/* bumped by each EPT change, see ept_update_begin() */
+	uint64_t ept_gen;
+	int32_t ept_batch_depth;
+	uint32_t ept_batch_dirty;
 
 	void *tmp_pg_array;	/* Page array for tmp guest paging struct */
 	struct acrn_vioapic vioapic;	/* Virtual IOAPIC base address */
 	struct acrn_vpic vpic;      /* Virtual PIC */
+	struct vlapic_dest_map lapic_dest;	/* routing of vLAPIC destinations */
 	struct vm_io_handler_desc emul_pio[EMUL_PIO_IDX_MAX];
+	struct vm_io_lookup pio_lookup;
+
+	/* TSC frequency the vCPUs see, and the VMCS TSC multiplier giving it,
+	 * 0 if it is the one of the host
+	 */
+	uint32_t tsc_khz;
+	uint64_t tsc_multiplier;
 
 	/* reference to virtual platform to come here (as needed) */
 } __aligned(PAGE_SIZE);
@@ -122,6 +153,7 @@ struct vcpuid_entry {
 	uint32_t subleaf;
 	uint32_t flags;
 	uint32_t padding;
+	uint64_t hits;		/* CPUID exits served by this entry */
 };
 
 struct acrn_vm {
@@ -131,6 +163,7 @@ struct acrn_vm {
 	struct vm_pm_info pm;	/* Reference to this VM's arch information */
 	uint16_t vm_id;		    /* Virtual machine identifier */
 	enum vm_state state;	/* VM state */
+	struct work_item teardown_work;	/* releases the resources left at shutdown */
 	struct acrn_vuart vuart;		/* Virtual UART */
 	enum vpic_wire_mode wire_mode;
 	struct iommu_domain *iommu;	/* iommu domain of this VM */
@@ -139,6 +172,21 @@ struct acrn_vm {
 	uint16_t emul_mmio_regions; /* Number of emulated mmio regions */
 	struct mem_io_node emul_mmio[CONFIG_MAX_EMULATED_MMIO_REGIONS];
 
+	spinlock_t posted_ioreq_lock;	/* serializes producers of the posted ring */
+	uint16_t posted_mmio_regions;	/* Number of posted mmio regions */
+	struct posted_mmio_range posted_mmio[MAX_POSTED_MMIO_REGIONS];
+
+	spinlock_t ioeventfd_lock;	/* protects the ioeventfd table */
+	uint64_t ioeventfd_active;	/* bitmap of the assigned ioeventfds */
+	struct hv_ioeventfd ioeventfd[VHM_IOEVENTFD_MAX];
+
+	struct vhm_upcall_info upcall;	/* steering of the VHM upcalls */
+	uint32_t sched_prio;		/* SCHED_PRIO_* of the vCPUs */
+	uint32_t ple_gap;		/* PAUSE-loop exiting gap, TSC cycles */
+	uint32_t ple_window;		/* PAUSE-loop exiting window, TSC cycles */
+	bool guest_cr_bits;		/* owns the CR*_OPTIONAL_TRAP_MASK bits */
+	bool vpmu;			/* created with VPMU_ENABLED */
+
 	uint8_t GUID[16];
 	struct secure_world_control sworld_control;
 
@@ -157,8 +205,6 @@ struct acrn_vm {
 	uint8_t vrtc_offset;
 #endif
 
-	spinlock_t softirq_dev_lock;
-	struct list_head softirq_dev_entry_list;
 	uint64_t intr_inject_delay_delta; /* delay of intr injection */
 } __aligned(PAGE_SIZE);
 
@@ -178,6 +224,17 @@ struct vm_description {
 	uint16_t               vm_hw_num_cores;   /* Number of virtual cores */
 	/* Whether secure world is supported for current VM. */
 	bool                   sworld_supported;
+	/* Whether the vCPUs run at SCHED_PRIO_HIGH */
+	bool                   high_prio;
+	/* Whether the guest owns the CR0/CR4 bits hv only flushes the EPT on */
+	bool                   guest_cr_bits;
+	/* Whether the vCPUs get a virtual PMU */
+	bool                   vpmu;
+	/* PAUSE-loop exiting gap and window in TSC cycles, 0 for the defaults */
+	uint32_t               ple_gap;
+	uint32_t               ple_window;
+	/* TSC frequency of the vCPUs in kHz, 0 for the one of the host */
+	uint32_t               tsc_khz;
 #ifdef CONFIG_PARTITION_MODE
 	uint8_t			vm_id;
 	struct mptable_info	*mptable;
@@ -265,6 +322,8 @@ int32_t start_vm(struct acrn_vm *vm);
 int32_t reset_vm(struct acrn_vm *vm);
 int32_t create_vm(struct vm_description *vm_desc, struct acrn_vm **rtn_vm);
 int32_t prepare_vm(uint16_t pcpu_id);
+uint64_t vm_scale_tsc(const struct acrn_vm *vm, uint64_t host_cycles);
+uint64_t vm_unscale_tsc(const struct acrn_vm *vm, uint64_t guest_cycles);
 
 #ifdef CONFIG_PARTITION_MODE
 const struct vm_description_array *get_vm_desc_base(void);
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef VPMU_H
+#define VPMU_H
+
+/**
+ * @file vpmu.h
+ *
+ * @brief Virtual architectural PMU of the VMs created with VPMU_ENABLED
+ *
+ * The guest gets the general purpose and fixed counters of the physical
+ * PMU, up to the numbers below. Their state follows the vCPU when the pCPU
+ * is shared, and IA32_PERF_GLOBAL_CTRL is switched on VM entry and exit
+ * through the MSR load/store lists, so the counters only count in the
+ * guest. The hypervisor profiling takes precedence: the vPMU of the vCPUs
+ * of a pCPU is suspended while it samples there.
+ */
+
+#define VPMU_MAX_GP_COUNTERS	4U
+#define VPMU_MAX_FIXED_COUNTERS	3U
+
+struct acrn_vcpu;
+struct acrn_vm;
+struct vcpuid_entry;
+
+/**
+ * @brief PMU state of a vCPU while another one owns the physical PMU
+ *
+ * IA32_PERF_GLOBAL_CTRL of the guest is kept in its MSR_AREA_PERF_GLOBAL_CTRL
+ * entry the VM entry loads.
+ */
+struct acrn_vpmu {
+	uint64_t evtsel[VPMU_MAX_GP_COUNTERS];
+	uint64_t pmc[VPMU_MAX_GP_COUNTERS];
+	uint64_t fixed_ctr[VPMU_MAX_FIXED_COUNTERS];
+	uint64_t fixed_ctr_ctl;
+	uint64_t global_status;		/* overflows not acknowledged yet */
+	uint32_t msr_cnt;		/* length of the MSR lists in the VMCS */
+};
+
+/**
+ * @brief Probe the physical PMU, and route its interrupt to the vPMU
+ *
+ * Called on the BSP, before any VM gets created.
+ */
+void init_vpmu(void);
+
+/**
+ * @brief Whether the vCPUs of a VM have a vPMU
+ *
+ * @param[in] vm Pointer to VM data structure
+ */
+bool is_vpmu_enabled(const struct acrn_vm *vm);
+
+/**
+ * @brief Fill CPUID leaf 0AH of a VM
+ *
+ * @param[in] vm Pointer to VM data structure
+ * @param[inout] entry The leaf, returning all zeros without vPMU
+ */
+void vpmu_init_cpuid(const struct acrn_vm *vm, struct vcpuid_entry *entry);
+
+/**
+ * @brief Reset the vPMU of a vCPU and its MSR_AREA_PERF_GLOBAL_CTRL entries
+ *
+ * Called when the VMCS gets initialized, on the pCPU of the vCPU.
+ *
+ * @param[in] vcpu Pointer to vCPU data structure
+ */
+void vpmu_init(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief Whether an MSR belongs to the architectural PMU
+ *
+ * All of them stay intercepted, so that the ones of a vCPU which does not
+ * own the physical PMU access its saved state. RDPMC does not exit: the
+ * guest reads the physical counters with it.
+ *
+ * @param[in] msr The MSR index
+ */
+bool is_vpmu_msr(uint32_t msr);
+
+/**
+ * @brief Emulate RDMSR of a PMU MSR
+ *
+ * @retval 0 on success.
+ * @retval -EACCES if the VM has no vPMU or the counter does not exist.
+ */
+int32_t vpmu_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *val);
+
+/**
+ * @brief Emulate WRMSR of a PMU MSR
+ *
+ * @retval 0 on success.
+ * @retval -EACCES if the VM has no vPMU, the counter does not exist, or
+ * reserved bits are set.
+ */
+int32_t vpmu_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t val);
+
+/**
+ * @brief Give the physical PMU to the current vCPU before VM entry
+ *
+ * Saves the state of the previous owner on the pCPU, loads the one of the
+ * vCPU, and adds IA32_PERF_GLOBAL_CTRL to the MSR lists. Drops the vPMU
+ * while the hypervisor profiling owns the PMU. Called with interrupts
+ * disabled.
+ *
+ * @param[in] vcpu Current vCPU
+ */
+void vpmu_load(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief Take the physical PMU back from a vCPU going offline, from any pCPU
+ *
+ * Its state is lost.
+ *
+ * @param[in] vcpu Pointer to vCPU data structure
+ */
+void vpmu_put(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief Forward a performance monitoring interrupt to the vCPU which owns
+ * the physical PMU, through the PMC LVT of its vLAPIC
+ *
+ * @retval true if the overflows were the ones of a vCPU.
+ */
+bool vpmu_handle_pmi(void);
+
+#endif /* VPMU_H */
@@ -19,6 +19,7 @@
 #include <vmtrr.h>
 #include <timer.h>
 #include <vlapic.h>
+#include <vpmu.h>
 #include <vcpu.h>
 #include <trusty.h>
 #include <guest_pm.h>
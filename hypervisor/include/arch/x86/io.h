@@ -21,7 +21,19 @@
 #define PM1B_EVT_PIO_IDX	(PM1A_CNT_PIO_IDX + 1U)
 #define PM1B_CNT_PIO_IDX	(PM1B_EVT_PIO_IDX + 1U)
 #define RTC_PIO_IDX		(PM1B_CNT_PIO_IDX + 1U)
-#define EMUL_PIO_IDX_MAX	(RTC_PIO_IDX + 1U)
+#define VIRTIO_CONSOLE_PIO_IDX	(RTC_PIO_IDX + 1U)
+#define EMUL_PIO_IDX_MAX	(VIRTIO_CONSOLE_PIO_IDX + 1U)
+
+/*
+ * Two-level lookup table from port to emulated port io index: the high byte
+ * of the port selects a second level page which is indexed by the low byte.
+ * An emulated range may straddle one page boundary at most.
+ */
+#define EMUL_PIO_L1_SHIFT	8U
+#define EMUL_PIO_L1_ENTRIES	(1U << (16U - EMUL_PIO_L1_SHIFT))
+#define EMUL_PIO_L2_ENTRIES	(1U << EMUL_PIO_L1_SHIFT)
+#define EMUL_PIO_L2_MASK	(EMUL_PIO_L2_ENTRIES - 1U)
+#define EMUL_PIO_L2_PAGES	(EMUL_PIO_IDX_MAX * 2U)
 
 /* Write 1 byte to specified I/O port */
 static inline void pio_write8(uint8_t value, uint16_t port)
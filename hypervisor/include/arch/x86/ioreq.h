@@ -38,6 +38,37 @@ struct io_request {
 	union vhm_io_request reqs;
 };
 
+/* Number of log2(us) buckets of the completion latency histogram */
+#define IOREQ_LAT_BUCKETS	16U
+/* Never spin longer than this waiting for a completion, in us */
+#define IOREQ_SPIN_MAX_US	64U
+/* Spin long enough to catch this percentage of the recent completions */
+#define IOREQ_SPIN_PERCENT	90U
+/* Re-tune the spin window every that many completions */
+#define IOREQ_LAT_UPDATE	32U
+/* Halve the histogram once it holds that many completions */
+#define IOREQ_LAT_HISTORY	1024U
+
+/**
+ * @brief Per-vCPU state of the adaptive I/O completion mode
+ *
+ * A request is polled for completion for at most \p spin_window, then
+ * falls back to notification by SOS. The window is the latency that covers
+ * IOREQ_SPIN_PERCENT of the recent completions, or 0 (notification only)
+ * if that is longer than IOREQ_SPIN_MAX_US.
+ */
+struct ioreq_latency {
+	/** @brief hist[0]: < 1us; hist[i]: [2^(i-1), 2^i) us */
+	uint32_t hist[IOREQ_LAT_BUCKETS];
+	uint32_t samples;	/**< completions since last re-tune */
+	bool polling;		/**< the pending request is being polled */
+	uint64_t spin_window;	/**< in TSC ticks */
+	uint64_t start_tsc;	/**< when the pending request was sent */
+	uint64_t deadline;	/**< when to give up polling it */
+	uint64_t spin_hit;	/**< completions found by polling */
+	uint64_t spin_miss;	/**< polls given up for notification */
+};
+
 /**
  * @brief Definition of a IO port range
  */
@@ -106,6 +137,26 @@ struct vm_io_handler_desc {
 	 * If the pointer is null, the write access is ignored.
 	 */
 	io_write_fn_t io_write;
+
+	/**
+	 * @brief Number of accesses emulated by this description.
+	 */
+	uint64_t access_cnt;
+};
+
+/**
+ * @brief Port to emulated port io index lookup table of a VM.
+ *
+ * Entries in both levels are stored plus one so that a zero-filled table
+ * means no port is emulated.
+ */
+struct vm_io_lookup {
+	/** @brief Page number (plus one) of each 256-port block. */
+	uint8_t l1[EMUL_PIO_L1_ENTRIES];
+	/** @brief Number of second level pages in use. */
+	uint8_t l2_used;
+	/** @brief Emulated port io index (plus one) of each port. */
+	uint8_t l2[EMUL_PIO_L2_PAGES][EMUL_PIO_L2_ENTRIES];
 };
 
 
@@ -167,6 +218,44 @@ struct mem_io_node {
 	uint64_t range_end;
 };
 
+/* Max number of MMIO or port I/O ranges whose writes can be posted to SOS */
+#define MAX_POSTED_MMIO_REGIONS	16U
+
+/**
+ * @brief A MMIO or port I/O range whose writes are posted to SOS without
+ * pausing the vCPU
+ */
+struct posted_mmio_range {
+	uint64_t start;	/**< start address or port (inclusive) */
+	uint64_t end;	/**< end address or port (exclusive) */
+	uint32_t flags;	/**< POSTED_RANGE_FLAG_PIO for a port I/O range */
+};
+
+/**
+ * @brief A doorbell write completed by the hypervisor itself
+ *
+ * Set by HC_ASSIGN_IOEVENTFD, a matching write only sets a bit in the
+ * ioeventfd page of the VM (see vhm_ioeventfd_page).
+ */
+struct hv_ioeventfd {
+	uint64_t addr;	/**< guest physical address or port */
+	uint64_t data;	/**< value to match with HV_IOEVENTFD_FLAG_DATAMATCH */
+	uint32_t len;	/**< width of the write in bytes */
+	uint32_t flags;	/**< HV_IOEVENTFD_FLAG_* */
+};
+
+/**
+ * @brief Which SOS vCPUs the VHM upcalls of a VM are injected to
+ *
+ * Set by HC_SET_UPCALL_POLICY. With no target, upcalls go to SOS vCPU 0.
+ */
+struct vhm_upcall_info {
+	uint32_t policy;	/**< UPCALL_POLICY_xxx */
+	uint32_t rr_next;	/**< round-robin cursor */
+	uint16_t nr_targets;	/**< number of valid entries in targets */
+	uint16_t targets[CONFIG_MAX_VCPUS_PER_VM];	/**< SOS vCPU IDs */
+};
+
 /* External Interfaces */
 
 /**
@@ -221,7 +310,8 @@ void   register_io_emulation_handler(struct acrn_vm *vm, uint32_t pio_idx,
  * @param handler_private_data Handler-specific data which will be passed to \p read_write when called
  *
  * @retval 0 Registration succeeds
- * @retval -EINVAL \p read_write is NULL, \p end is not larger than \p start or \p vm has been launched
+ * @retval -EINVAL \p read_write is NULL, \p end is not larger than \p start,
+ * the range overlaps a registered one or \p vm has been launched
  */
 int32_t register_mmio_emulation_handler(struct acrn_vm *vm,
 	hv_mem_io_handler_t read_write, uint64_t start,
@@ -287,6 +377,57 @@ void emulate_io_post(struct acrn_vcpu *vcpu);
  */
 int32_t acrn_insert_request_wait(struct acrn_vcpu *vcpu, const struct io_request *io_req);
 
+/**
+ * @brief Post a MMIO or port I/O write of \p vcpu to SOS without pausing \p vcpu
+ *
+ * The write is appended to the posted ring of the VM (see vhm_posted_ring) if
+ * it falls in a range of its kind registered via HC_SET_POSTED_MMIO_RANGE.
+ *
+ * @param vcpu The virtual CPU that triggers the access
+ * @param io_req The I/O request holding the details of the access
+ *
+ * @pre vcpu != NULL && io_req != NULL
+ *
+ * @retval 0 The write is posted and needs no more handling.
+ * @retval -ENODEV The request is not eligible for posting, or the ring is
+ * full, and shall be delivered by acrn_insert_request_wait().
+ */
+int32_t acrn_insert_posted_request(struct acrn_vcpu *vcpu, const struct io_request *io_req);
+
+/**
+ * @brief Complete a doorbell write of \p vcpu in the hypervisor
+ *
+ * If the write matches an ioeventfd registered via HC_ASSIGN_IOEVENTFD, the
+ * bit of the ioeventfd is set in the ioeventfd page of the VM and SOS is
+ * signaled if no other bit was pending.
+ *
+ * @param vcpu The virtual CPU that triggers the I/O access
+ * @param io_req The I/O request holding the details of the I/O access
+ *
+ * @pre vcpu != NULL && io_req != NULL
+ *
+ * @retval 0 The write is signaled and needs no more handling.
+ * @retval -ENODEV The request matches no ioeventfd.
+ */
+int32_t acrn_signal_ioeventfd(struct acrn_vcpu *vcpu, const struct io_request *io_req);
+
+/**
+ * @brief Complete a read of the RTC or PIT of \p vcpu in the hypervisor
+ *
+ * Reads without side effects of the RTC data port, the PIT counters and the
+ * PIT channel 2 output are completed from the clock page of the VM (see
+ * vhm_clock_page) if SOS marked the state they need valid.
+ *
+ * @param vcpu The virtual CPU that triggers the I/O access
+ * @param io_req The I/O request holding the details of the I/O access
+ *
+ * @pre vcpu != NULL && io_req != NULL
+ *
+ * @retval 0 The read is completed in \p io_req.
+ * @retval -ENODEV The read shall be delivered to SOS.
+ */
+int32_t acrn_complete_clock_read(struct acrn_vcpu *vcpu, struct io_request *io_req);
+
 /**
  * @brief Reset all IO requests status of the VM
  *
@@ -305,6 +446,43 @@ void reset_vm_ioreqs(struct acrn_vm *vm);
  */
 void handle_complete_ioreq(uint16_t pcpu_id);
 
+/**
+ * @brief Tell if the idle loop of a pCPU polls for an I/O completion
+ *
+ * The idle loop must not wait for an event then, SOS gives none.
+ *
+ * @param pcpu_id The physical cpu id whose idle loop is checked
+ *
+ * @return true if a request completion is only seen by polling
+ */
+bool is_ioreq_polled(uint16_t pcpu_id);
+
+/**
+ * @brief Account the completion of the pending VHM request of \p vcpu
+ *
+ * Feeds the adaptive completion mode with the latency of the request.
+ *
+ * @param vcpu The virtual CPU whose request is completed
+ *
+ * @pre vcpu != NULL && vcpu->vm->sw.is_completion_adaptive
+ *
+ * @return None
+ */
+void record_ioreq_latency(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief Get the VHM request of the given ID in the ioreq buffer
+ *
+ * @param vm Target VM context
+ * @param vhm_req_id VHM Request ID
+ *
+ * @pre vm->sw.io_shared_page != NULL
+ * @pre vhm_req_id < vm->sw.io_req_slots
+ *
+ * @return HVA of the VHM request, to be accessed within stac()/clac().
+ */
+struct vhm_request *get_vhm_req(const struct acrn_vm *vm, uint16_t vhm_req_id);
+
 /**
  * @brief Get the state of VHM request
  *
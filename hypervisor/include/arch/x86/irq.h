@@ -31,6 +31,7 @@
 #define VECTOR_SPURIOUS		0xFFU
 #define VECTOR_HYPERVISOR_CALLBACK_VHM	0xF3U
 #define VECTOR_PMI			0xF4U
+#define VECTOR_POSTED_INTR_WAKEUP	0xF5U
 
 /* the maximum number of msi entry is 2048 according to PCI
  * local bus specification
@@ -42,11 +43,12 @@
 #define NR_IRQS		256U
 #define IRQ_INVALID		0xffffffffU
 
-#define NR_STATIC_MAPPINGS     (4U)
+#define NR_STATIC_MAPPINGS     (5U)
 #define TIMER_IRQ		(NR_IRQS - 1U)
 #define NOTIFY_IRQ		(NR_IRQS - 2U)
 #define POSTED_INTR_NOTIFY_IRQ	(NR_IRQS - 3U)
 #define PMI_IRQ			(NR_IRQS - 4U)
+#define POSTED_INTR_WAKEUP_IRQ	(NR_IRQS - 5U)
 
 #define DEFAULT_DEST_MODE	IOAPIC_RTE_DESTLOG
 #define DEFAULT_DELIVERY_MODE	IOAPIC_RTE_DELLOPRI
@@ -68,11 +70,67 @@ struct intr_excp_ctx {
 };
 
 typedef void (*smp_call_func_t)(void *data);
-struct smp_call_info_data {
+
+struct smp_call_request;
+
+/* link of a request in the call queue of one target pCPU */
+struct smp_call_node {
+	struct smp_call_node *next;
+	struct smp_call_request *req;
+};
+
+/**
+ * @brief A cross-CPU function call
+ *
+ * Owned by the caller until smp_call_done() returns true; the caller must not
+ * reuse or free it before.
+ */
+struct smp_call_request {
 	smp_call_func_t func;
 	void *data;
+	uint64_t pending;	/* target pCPUs yet to run func */
+	struct smp_call_node node[CONFIG_MAX_PCPU_NUM];
 };
 
+/**
+ * @brief Run func(data) on the pCPUs of mask without waiting for it
+ *
+ * The request is queued on each active target pCPU, which runs it in its
+ * notification IRQ handler. Requests from several pCPUs don't serialize.
+ *
+ * @param[in] mask target pCPUs
+ * @param[out] req request to track completion with
+ * @param[in] func function to run
+ * @param[in] data argument of func
+ *
+ * @return None
+ */
+void smp_call_function_async(uint64_t mask, struct smp_call_request *req,
+		smp_call_func_t func, void *data);
+
+/**
+ * @brief Check whether all target pCPUs of a request ran it
+ *
+ * @param[in] req request queued by smp_call_function_async()
+ *
+ * @return true if the request completed, false otherwise
+ */
+bool smp_call_done(const struct smp_call_request *req);
+
+/**
+ * @brief Wait until all target pCPUs of a request ran it
+ *
+ * @param[in] req request queued by smp_call_function_async()
+ *
+ * @return None
+ */
+void smp_call_wait(struct smp_call_request *req);
+
+/**
+ * @brief Run func(data) on the pCPUs of mask and wait for completion
+ *
+ * @return None
+ */
 void smp_call_function(uint64_t mask, smp_call_func_t func, void *data);
 
 void init_default_irqs(uint16_t cpu_id);
@@ -107,6 +165,7 @@ uint32_t irq_to_vector(uint32_t irq);
 #define	MSI_ADDR_BASE	0xfee00000UL
 #define	MSI_ADDR_RH	0x00000008UL	/* Redirection Hint */
 #define	MSI_ADDR_LOG	0x00000004UL	/* Destination Mode */
+#define	MSI_ADDR_IF_REMAP	0x00000010UL	/* Interrupt Format: remappable */
 
 /* RFLAGS */
 #define HV_ARCH_VCPU_RFLAGS_IF              (1UL<<9U)
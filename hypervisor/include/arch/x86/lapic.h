@@ -19,6 +19,9 @@
 #define INTR_LAPIC_ICR_PHYSICAL 0x0U
 #define INTR_LAPIC_ICR_LOGICAL  0x1U
 
+/* x2APIC logical ID: cluster in bits 31:16, one bit per CPU in 15:0 */
+#define X2APIC_LDR_CLUSTER_MASK	0xffff0000U
+
 /* intr_lapic_icr_level */
 #define INTR_LAPIC_ICR_DEASSERT  0x0U
 #define INTR_LAPIC_ICR_ASSERT       0x1U
@@ -88,6 +91,8 @@ void send_startup_ipi(enum intr_cpu_startup_shorthand cpu_startup_shorthand,
 /**
  * @brief Send an IPI to multiple pCPUs
  *
+ * One IPI is sent per x2APIC cluster of the destination pCPUs.
+ *
  * @param[in]	dest_mask The mask of destination physical cpus
  * @param[in]	vector The vector of interrupt
  */
@@ -124,6 +124,23 @@ void mmu_add(uint64_t *pml4_page, uint64_t paddr_base, uint64_t vaddr_base,
 		uint64_t size, uint64_t prot, const struct memory_ops *mem_ops);
 void mmu_modify_or_del(uint64_t *pml4_page, uint64_t vaddr_base, uint64_t size,
 		uint64_t prot_set, uint64_t prot_clr, const struct memory_ops *mem_ops, uint32_t type);
+
+/* the types of mmu_walk() */
+#define WALK_SPLIT		0U
+#define WALK_TEST_AND_CLEAR	1U
+#define WALK_MERGE		2U
+
+struct pgtable_walk {
+	uint32_t type;		/* WALK_* */
+	uint16_t bit;		/* WALK_TEST_AND_CLEAR: the bit tested */
+	uint64_t flags;		/* WALK_SPLIT and WALK_MERGE: the bits cleared */
+	uint64_t start;		/* of the range, page aligned */
+	uint64_t end;
+	uint64_t *bitmap;	/* WALK_TEST_AND_CLEAR: bit 0 for start */
+	uint64_t count;		/* WALK_TEST_AND_CLEAR: bits set in bitmap */
+	const struct memory_ops *mem_ops;
+};
+void mmu_walk(uint64_t *pml4_page, struct pgtable_walk *walk);
 void hv_access_memory_region_update(uint64_t base, uint64_t size);
 
 /**
@@ -133,6 +150,12 @@ void hv_access_memory_region_update(uint64_t base, uint64_t size);
  * @retval -ENODEV Don't support EPT or VPID capability
  */
 int32_t check_vmx_mmu_cap(void);
+/**
+ * @brief Whether the EPT has accessed and dirty flags
+ *
+ * @retval true if the EPTP can enable them
+ */
+bool cpu_has_ept_ad(void);
 /**
  * @brief VPID allocation
  *
@@ -216,6 +239,47 @@ static inline void clflush(volatile void *p)
  * @return None
  */
 void destroy_ept(struct acrn_vm *vm);
+/**
+ * @brief Start a batch of EPT changes
+ *
+ * The ept_mr_add/modify/del() calls up to the matching ept_update_commit()
+ * leave the EPT flush of the vCPUs to it, so a series of small changes
+ * takes one flush. Batches may nest.
+ *
+ * @param[inout] vm the pointer that points to VM data structure
+ *
+ * @return None
+ */
+void ept_update_begin(struct acrn_vm *vm);
+/**
+ * @brief End a batch of EPT changes and flush the EPT of the vCPUs
+ *        if any change was made in it
+ *
+ * @param[inout] vm the pointer that points to VM data structure
+ *
+ * @return None
+ */
+void ept_update_commit(struct acrn_vm *vm);
+/**
+ * @brief Flush the EPT on the current vCPU, unless no EPT change was made
+ *        since its last flush
+ *
+ * @param[inout] vcpu the pointer that points to the current vCPU
+ *
+ * @return None
+ */
+void ept_flush_vcpu(struct acrn_vcpu *vcpu);
+/**
+ * @brief The EPTP of the normal world of the current vCPU
+ *
+ * It enables the accessed and dirty flags while dirty pages of the VM are
+ * logged, and the vCPU records whether it does.
+ *
+ * @param[inout] vcpu the pointer that points to the current vCPU
+ *
+ * @return the value for VMX_EPT_POINTER_FULL
+ */
+uint64_t ept_nworld_eptp(struct acrn_vcpu *vcpu);
 /**
  * @brief Translating from guest-physical address to host-physcial address
  *
@@ -259,9 +323,10 @@ uint64_t vm0_hpa2gpa(uint64_t hpa);
  *                 to be mapped
  * @param[in] prot_orig The specified memory access right and memory type
  *
- * @return None
+ * @retval 0 on success
+ * @retval -ENOMEM if the EPT page pool can't cover the mapping
  */
-void ept_mr_add(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t hpa,
+int32_t ept_mr_add(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t hpa,
 		uint64_t gpa, uint64_t size, uint64_t prot_orig);
 /**
  * @brief Guest-physical memory page access right or memory type updating
@@ -276,9 +341,10 @@ void ept_mr_add(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t hpa,
  * @param[in] prot_clr The specified memory access right and memory type
  *                     that will be cleared
  *
- * @return None
+ * @retval 0 on success
+ * @retval -ENOMEM if the EPT page pool can't cover the large pages to split
  */
-void ept_mr_modify(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
+int32_t ept_mr_modify(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
 		uint64_t size, uint64_t prot_set, uint64_t prot_clr);
 /**
  * @brief Guest-physical memory region unmapping
@@ -289,12 +355,60 @@ void ept_mr_modify(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
  *                physical memory region whoes mapping needs to be deleted
  * @param[in] size The size of guest physical memory region
  *
- * @return None
+ * @retval 0 on success
+ * @retval -ENOMEM if the EPT page pool can't cover the large pages to split
  *
  * @pre [gpa,gpa+size) has been mapped into host physical memory region
  */
-void ept_mr_del(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
+int32_t ept_mr_del(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
 		uint64_t size);
+/**
+ * @brief Start logging the dirty pages of a guest-physical memory region
+ *
+ * Map the region with 4K pages and have the vCPUs set the dirty flags of
+ * the EPT. A VM may log several regions; page merges are off until the
+ * last one stops.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] gpa The start guest physical address of the region, 4K aligned
+ * @param[in] size The size of the region, 4K aligned
+ *
+ * @retval 0 on success
+ * @retval -ENODEV if the EPT has no dirty flags
+ * @retval -ENOMEM if the EPT page pool can't cover the 4K pages
+ */
+int32_t ept_dirty_log_start(struct acrn_vm *vm, uint64_t gpa, uint64_t size);
+/**
+ * @brief Stop logging the dirty pages of a guest-physical memory region
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] gpa The start guest physical address of the region, 4K aligned
+ * @param[in] size The size of the region, 4K aligned
+ *
+ * @retval 0 on success
+ * @retval -EINVAL if no region is logged
+ */
+int32_t ept_dirty_log_stop(struct acrn_vm *vm, uint64_t gpa, uint64_t size);
+/**
+ * @brief Fetch and clear the dirty pages of a guest-physical memory region
+ *
+ * Set the bit of each page written since the last call, or since the start
+ * of the log, and clear the dirty flags. A write made once it returns is
+ * reported by the next call.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] gpa The start guest physical address of the region, 4K aligned
+ * @param[in] size The size of the region, 4K aligned
+ * @param[out] bitmap SOS memory, bit n for the page at gpa + n * 4K
+ * @param[out] nr_dirty the number of bits set
+ *
+ * @retval 0 on success
+ * @retval -EINVAL if no region is logged
+ * @retval -EIO if a vCPU did not flush the dirty flags in time: writes may
+ *              have been missed, the log has to be stopped
+ */
+int32_t ept_dirty_log_get(struct acrn_vm *vm, uint64_t gpa, uint64_t size, uint64_t *bitmap,
+		uint64_t *nr_dirty);
 /**
  * @brief EPT violation handling
  *
@@ -312,7 +426,7 @@ int32_t ept_violation_vmexit_handler(struct acrn_vcpu *vcpu);
  * @retval -EINVAL fail to handle the EPT misconfig
  * @retval 0 Success to handle the EPT misconfig
  */
-int32_t ept_misconfig_vmexit_handler(__unused struct acrn_vcpu *vcpu);
+int32_t ept_misconfig_vmexit_handler(struct acrn_vcpu *vcpu);
 
 /**
  * @}
@@ -31,6 +31,15 @@
 
 struct acrn_vm;
 
+/* The share of a VM in the EPT page pool, see ept_pool_reserve() */
+struct ept_pool_quota {
+	uint64_t limit;		/* most pages the VM may take */
+	uint64_t used;		/* pages in the EPT of the VM */
+	uint64_t reserved;	/* pages set aside for the mapping change in progress */
+	struct page *recycled;	/* taken pages out of the EPT, linked through their first bytes */
+	uint16_t vm_id;
+};
+
 struct page {
 	uint8_t contents[PAGE_SIZE];
 } __aligned(PAGE_SIZE);
@@ -50,11 +59,27 @@ union pgtable_pages_info {
 		struct page *nworld_pt_base;
 		struct page *sworld_pgtable_base;
 		struct page *sworld_memory_base;
+		/* normal world PDPT/PD/PT pages come from the pool if set */
+		struct ept_pool_quota *pool;
+		/* the secure world EPT points at the normal world PD pages */
+		bool pd_shared;
+		/* ranges whose dirty pages are logged, the 4K pages must stay */
+		uint16_t dirty_log;
+		/* a vCPU kept stale dirty flags, see ept_dirty_log_get() */
+		bool dirty_lost;
 	} ept;
 };
 
+/* Large page split and merge events of a page table */
+struct pgtable_stats {
+	uint64_t nr_split;
+	uint64_t nr_merged;	/* PTs back to 2M pages */
+	uint64_t nr_merged_1g;	/* PDs back to 1G pages */
+};
+
 struct memory_ops {
 	union pgtable_pages_info *info;
+	struct pgtable_stats *stats;
 	uint64_t (*get_default_access_right)(void);
 	uint64_t (*pgentry_present)(uint64_t pte);
 	struct page *(*get_pml4_page)(const union pgtable_pages_info *info);
@@ -62,10 +87,47 @@ struct memory_ops {
 	struct page *(*get_pd_page)(const union pgtable_pages_info *info, uint64_t gpa);
 	struct page *(*get_pt_page)(const union pgtable_pages_info *info, uint64_t gpa);
 	void *(*get_sworld_memory_base)(const union pgtable_pages_info *info);
+	/* optional: a PT or PD page went out of the page table, see try_to_merge_pt() */
+	void (*free_table_page)(const union pgtable_pages_info *info, struct page *page);
+	/* optional: whether PTs may be merged into 2M pages, see try_to_merge_pt() */
+	bool (*may_merge_pt)(const union pgtable_pages_info *info);
+	/* optional: whether PDs may be merged into 1G pages, see try_to_merge_pd() */
+	bool (*may_merge_pd)(const union pgtable_pages_info *info);
 };
 
 extern const struct memory_ops ppt_mem_ops;
 void init_ept_mem_ops(struct acrn_vm *vm);
+
+/**
+ * @brief Set page-table pages of the EPT page pool aside for a VM.
+ *
+ * The pages the EPT of the VM takes next come out of the reservation, so a
+ * mapping change does not run out of pages half way. vm0 has its own pages
+ * and always succeeds.
+ *
+ * @param[in] vm VM which is about to change its EPT
+ * @param[in] nr_pages Most pages the change takes
+ *
+ * @retval 0 on success
+ * @retval -ENOMEM if the pool or the quota of the VM can't cover nr_pages
+ */
+int32_t ept_pool_reserve(const struct acrn_vm *vm, uint64_t nr_pages);
+
+/**
+ * @brief Give the pages set aside by ept_pool_reserve() and not taken back.
+ *
+ * @param[in] vm VM whose EPT change is done
+ */
+void ept_pool_unreserve(const struct acrn_vm *vm);
+
+/**
+ * @brief Give the EPT page-table pages of a VM back to the pool.
+ *
+ * @param[in] vm VM being destroyed, no longer in use by any vCPU or IOMMU
+ */
+void free_ept_mem(const struct acrn_vm *vm);
 void *get_reserve_sworld_memory_base(void);
+/* whether [hpa, hpa + size) lies in the memory reserved for the secure worlds */
+bool is_reserve_sworld_memory(uint64_t hpa, uint64_t size);
 
 #endif /* PAGE_H */
@@ -10,6 +10,7 @@
 #include <hypervisor.h>
 #include <bsp_extern.h>
 #include <schedule.h>
+#include <workqueue.h>
 #include <common/irq.h>
 #include <arch/x86/irq.h>
 #include <sbuf.h>
@@ -37,7 +38,10 @@ struct per_cpu_region {
 #endif
 	struct per_cpu_timers cpu_timers;
 	struct sched_context sched_ctx;
+	struct work_queue work_queue;
 	struct instr_emul_ctxt g_inst_ctxt;
+	struct decode_cache decode_cache;
+	struct malloc_cache malloc_cache;
 	struct host_gdt gdt;
 	struct tss_64 tss;
 	enum pcpu_boot_state boot_state;
@@ -47,7 +51,9 @@ struct per_cpu_region {
 	uint8_t stack[CONFIG_STACK_SIZE] __aligned(16);
 	uint32_t lapic_id;
 	uint32_t lapic_ldr;
-	struct smp_call_info_data smp_call_info;
+	uint64_t smp_call_queue;	/* struct smp_call_node *, pushed lock-free */
+	uint64_t ptdev_softirq_queue;	/* struct ptirq_remapping_info *, pushed lock-free */
+	void *ptdev_softirq_list;	/* taken off the queue, not handled yet */
 #ifdef PROFILING_ON
 	struct profiling_info_wrapper profiling_info;
 #endif
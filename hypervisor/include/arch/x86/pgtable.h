@@ -39,8 +39,14 @@
 #define EPT_WP			(5UL << EPT_MT_SHIFT)
 #define EPT_WB			(6UL << EPT_MT_SHIFT)
 #define EPT_MT_MASK		(7UL << EPT_MT_SHIFT)
+/* set by the CPU if the accessed and dirty flags are enabled in the EPTP */
+#define EPT_ACCESSED		(1UL << 8U)
+#define EPT_DIRTY_BIT		9U
+#define EPT_DIRTY		(1UL << EPT_DIRTY_BIT)
 /* VTD: Second-Level Paging Entries: Snoop Control */
 #define EPT_SNOOP_CTRL		(1UL << 11U)
+/* software, ignored by EPT and VT-d: writes go to SOS, see HC_VM_SET_COW */
+#define EPT_COW			(1UL << 52U)
 #define EPT_VE			(1UL << 63U)
 
 #define EPT_RWX			(EPT_RD | EPT_WR | EPT_EXE)
@@ -24,21 +24,37 @@ enum tick_mode {
 	TICK_MODE_PERIODIC,	/**< periodic mode */
 };
 
+/**
+ * @brief Link of a timer in the per-cpu pairing heap
+ */
+struct timer_node {
+	struct timer_node *child;	/**< first child, fires no earlier */
+	struct timer_node *sibling;	/**< next sibling */
+	struct timer_node *prev;	/**< parent if first child, else previous sibling; NULL if not queued */
+	uint64_t key;			/**< TSC the heap is ordered on */
+};
+
 /**
  * @brief Definition of timers for per-cpu
  */
 struct per_cpu_timers {
-	struct list_head timer_list;	/**< it's for runtime active timer list */
+	spinlock_t lock;		/**< protects the heap, timers may be deleted from another pCPU */
+	struct timer_node head;		/**< head.child is the active timer due first */
+	struct timer_node late_head;	/**< head.child is the active timer whose slack ends first */
+	uint64_t armed_tsc;		/**< deadline programmed in MSR_IA32_TSC_DEADLINE, 0 if none */
 };
 
 /**
  * @brief Definition of timer
  */
 struct hv_timer {
-	struct list_head node;		/**< link all timers */
+	struct timer_node node;		/**< link in the heap ordered on fire_tsc */
+	struct timer_node late_node;	/**< link in the heap ordered on fire_tsc + slack_in_cycle */
+	uint16_t pcpu_id;		/**< pCPU whose heap the timer is queued on */
 	enum tick_mode mode;		/**< timer mode: one-shot or periodic */
 	uint64_t fire_tsc;		/**< tsc deadline to interrupt */
 	uint64_t period_in_cycle;	/**< period of the periodic timer in unit of TSC cycles */
+	uint64_t slack_in_cycle;	/**< how late the timer may fire, in unit of TSC cycles */
 	timer_handle_t func;		/**< callback if time reached */
 	void *priv_data;		/**< func private data */
 };
@@ -70,10 +86,35 @@ static inline void initialize_timer(struct hv_timer *timer,
 		timer->fire_tsc = fire_tsc;
 		timer->mode = mode;
 		timer->period_in_cycle = period_in_cycle;
-		INIT_LIST_HEAD(&timer->node);
+		timer->slack_in_cycle = 0UL;
+		timer->node.child = NULL;
+		timer->node.sibling = NULL;
+		timer->node.prev = NULL;
+		timer->late_node.child = NULL;
+		timer->late_node.sibling = NULL;
+		timer->late_node.prev = NULL;
 	}
 }
 
+/**
+ * @brief Set the slack of a timer.
+ *
+ * The timer may fire up to slack_in_cycle TSC cycles after its deadline, so
+ * that it expires together with other timers of the pCPU and saves physical
+ * timer interrupts. Timers are initialized with no slack.
+ *
+ * @param[in] timer Pointer to timer.
+ * @param[in] slack_in_cycle slack in unit of TSC cycles.
+ *
+ * @remark Only change the slack of a timer which is not added.
+ *
+ * @return None
+ */
+static inline void set_timer_slack(struct hv_timer *timer, uint64_t slack_in_cycle)
+{
+	timer->slack_in_cycle = slack_in_cycle;
+}
+
 /**
  * @brief Check a timer whether expired.
  *
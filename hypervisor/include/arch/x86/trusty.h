@@ -111,10 +111,14 @@ struct secure_world_control {
 		uint64_t active    :  1;
 		/* sworld context saving status: 0(unsaved), 1(saved) */
 		uint64_t ctx_saved :  1;
-		uint64_t reserved  : 61;
+		/* sworld memory scrubbing: 0(done), 1(left to the VM teardown) */
+		uint64_t scrub_pending :  1;
+		uint64_t reserved  : 60;
 	} flag;
 	/* Secure world memory structure */
 	struct secure_world_memory sworld_memory;
+	/* World switches into each world, indexed by the world entered */
+	struct acrn_exit_reason_stats switch_stats[NR_WORLD];
 };
 
 struct trusty_startup_param {
@@ -129,6 +133,7 @@ struct trusty_startup_param {
 void switch_world(struct acrn_vcpu *vcpu, int32_t next_world);
 bool initialize_trusty(struct acrn_vcpu *vcpu, uint64_t param);
 void destroy_secure_world(struct acrn_vm *vm, bool need_clr_mem);
+void scrub_secure_world(struct acrn_vm *vm);
 void save_sworld_context(struct acrn_vcpu *vcpu);
 void restore_sworld_context(struct acrn_vcpu *vcpu);
 void trusty_set_dseed(const void *dseed, uint8_t dseed_num);
@@ -17,6 +17,14 @@ int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu);
 int32_t cpuid_vmexit_handler(struct acrn_vcpu *vcpu);
 int32_t cr_access_vmexit_handler(struct acrn_vcpu *vcpu);
 extern void vm_exit(void);
+
+/* account one handling of 'cycles' TSC cycles, for VM exits and world switches */
+void exit_stats_record(struct acrn_exit_reason_stats *stats, uint64_t cycles);
+
+/* record a VM exit in the exit timeline, right after it */
+void exit_timeline_exit(struct acrn_vcpu *vcpu);
+/* complete the last exit of the timeline, right before the VM entry */
+void exit_timeline_entry(struct acrn_vcpu *vcpu);
 static inline uint64_t
 vm_exit_qualification_bit_mask(uint64_t exit_qual, uint32_t msb, uint32_t lsb)
 {
@@ -64,6 +64,8 @@
 
 #define VMX_XSS_EXITING_BITMAP_FULL		0x0000202CU
 #define VMX_XSS_EXITING_BITMAP_HIGH		0x0000202DU
+#define VMX_TSC_MULTIPLIER_FULL		0x00002032U
+#define VMX_TSC_MULTIPLIER_HIGH		0x00002033U
 /* 64-bit read-only data fields */
 #define VMX_GUEST_PHYSICAL_ADDR_FULL 0x00002400U
 #define VMX_GUEST_PHYSICAL_ADDR_HIGH 0x00002401U
@@ -311,6 +313,17 @@
 #define VMX_PROCBASED_CTLS2_RDSEED     (1U<<16U)
 #define VMX_PROCBASED_CTLS2_EPT_VE     (1U<<18U)
 #define VMX_PROCBASED_CTLS2_XSVE_XRSTR (1U<<20U)
+#define VMX_PROCBASED_CTLS2_TSC_SCALING (1U<<25U)
+
+/* TSC multiplier: fixed point with 48 fractional bits */
+#define VMX_TSC_MULTIPLIER_SHIFT	48U
+
+/* PAUSE-loop exiting: max cycles between two PAUSEs of one loop, and the
+ * cycles a loop may spin before the VM exit. Defaults of the VMs which
+ * don't set their own.
+ */
+#define VMX_PLE_GAP_CYCLES		128U
+#define VMX_PLE_WINDOW_CYCLES		4096U
 
 /* MSR_IA32_VMX_EPT_VPID_CAP: EPT and VPID capability bits */
 #define VMX_EPT_EXECUTE_ONLY		(1U << 0U)
@@ -420,6 +433,14 @@ static inline uint64_t apic_access_offset(uint64_t qual)
 
 /* CR4 bits hv want to trap to track status change */
 #define CR4_TRAP_MASK (CR4_PSE | CR4_PAE | CR4_VMXE | CR4_PCIDE)
+
+/*
+ * Bits of the trap masks hv only traps to flush the EPT on a change. The
+ * hardware does the TLB invalidation for a guest MOV to CR itself, a VM
+ * created with GUEST_OWNED_CR_BITS owns them.
+ */
+#define CR0_OPTIONAL_TRAP_MASK	(CR0_WP)
+#define CR4_OPTIONAL_TRAP_MASK	(CR4_PSE)
 #define	CR4_RESERVED_MASK ~(CR4_VME | CR4_PVI | CR4_TSD | CR4_DE | CR4_PSE | \
 				CR4_PAE | CR4_MCE | CR4_PGE | CR4_PCE |	     \
 				CR4_OSFXSR | CR4_PCIDE | CR4_OSXSAVE |       \
@@ -504,6 +504,26 @@ struct iommu_domain;
  */
 int32_t assign_iommu_device(struct iommu_domain *domain, uint8_t bus, uint8_t devfun);
 
+/**
+ * @brief Assign a batch of devices to a iommu domain.
+ *
+ * Same as assign_iommu_device() for each device, but the context cache and
+ * IOTLB of the VM0 domain are invalidated once per DMAR unit for the whole
+ * batch rather than once per device.
+ *
+ * @param[in]    domain iommu domain the devices are assigned to
+ * @param[in]    bdfs the 16-bit BDFs of the devices
+ * @param[in]    count number of devices in \p bdfs
+ *
+ * @retval 0 on success.
+ * @retval <0 the error of the first device failing, the devices before it are assigned
+ *
+ * @pre domain != NULL
+ * @pre bdfs != NULL
+ *
+ */
+int32_t assign_iommu_devices(struct iommu_domain *domain, const uint16_t *bdfs, uint32_t count);
+
 /**
  * @brief Unassign a device specified by bus & devfun from a iommu domain .
  *
@@ -541,6 +561,26 @@ int32_t unassign_iommu_device(const struct iommu_domain *domain, uint8_t bus, ui
  */
 struct iommu_domain *create_iommu_domain(uint16_t vm_id, uint64_t translation_table, uint32_t addr_width);
 
+/**
+ * @brief Create a iommu domain whose second-level page table is the EPT of a VM.
+ *
+ * DMA of the devices in the domain is translated through the normal world
+ * EPT of the VM, 2M and 1G pages included, so no separate table has to be
+ * kept in sync with it. The domain stays snoop controlled until a device
+ * behind a DMAR unit without snoop control is added, see
+ * iommu_snoop_supported().
+ *
+ * @param[in] vm the VM the domain is created for
+ *
+ * @return Pointer to the created iommu_domain
+ *
+ * @retval NULL when the EPT of \p vm is not set up
+ *
+ * @pre vm != NULL
+ *
+ */
+struct iommu_domain *create_ept_iommu_domain(struct acrn_vm *vm);
+
 /**
  * @brief Destroy the specific iommu domain.
  *
@@ -553,6 +593,23 @@ struct iommu_domain *create_iommu_domain(uint16_t vm_id, uint64_t translation_ta
  */
 void destroy_iommu_domain(struct iommu_domain *domain);
 
+/**
+ * @brief Flush the IOTLB entries of a domain for a range of its address space.
+ *
+ * Needed once a mapping of the translation table of the domain was changed
+ * or removed. The IOTLB of each DMAR unit is invalidated page-selectively,
+ * in one batch of queued invalidations, or domain-selectively if that is
+ * not supported or the range is too fragmented.
+ *
+ * @param[in] domain iommu domain whose translation table changed
+ * @param[in] gpa start of the changed range
+ * @param[in] size size of the changed range
+ *
+ * @pre domain != NULL
+ *
+ */
+void iommu_flush_domain_range(const struct iommu_domain *domain, uint64_t gpa, uint64_t size);
+
 /**
  * @brief Enable translation of IOMMUs.
  *
@@ -624,6 +681,52 @@ void init_iommu_vm0_domain(struct acrn_vm *vm0);
  */
 bool iommu_snoop_supported(struct acrn_vm *vm);
 
+#define INVALID_IRTE_ID		0xffffU
+
+/**
+ * @brief Check if interrupts of a device can be posted.
+ *
+ * @param[in]    bus the 8-bit bus number of the device
+ * @param[in]    devfun the 8-bit device(5-bit):function(3-bit) of the device
+ *
+ * @retval true the IOMMU of the device has posted interrupt remapping enabled
+ * @retval false otherwise
+ *
+ */
+bool iommu_posted_intr_supported(uint8_t bus, uint8_t devfun);
+
+/**
+ * @brief Program a posted format interrupt remapping entry.
+ *
+ * Point an IRTE of the IOMMU of the device at a posted interrupt descriptor,
+ * so interrupts of the device are recorded there with \p vector. An IRTE is
+ * allocated if \p index is INVALID_IRTE_ID, otherwise the entry is updated.
+ *
+ * @param[in]    bus the 8-bit bus number of the device
+ * @param[in]    devfun the 8-bit device(5-bit):function(3-bit) of the device
+ * @param[inout] index the IRTE index, to be used as the remappable MSI handle
+ * @param[in]    vector the vector to post
+ * @param[in]    pid_paddr the 64-byte aligned physical address of the posted interrupt descriptor
+ *
+ * @retval 0 on success
+ * @retval -ENODEV posted interrupts are not supported for the device
+ * @retval -EBUSY no IRTE left
+ *
+ * @pre index != NULL
+ *
+ */
+int32_t iommu_set_posted_irte(uint8_t bus, uint8_t devfun, uint16_t *index, uint32_t vector, uint64_t pid_paddr);
+
+/**
+ * @brief Free an interrupt remapping entry.
+ *
+ * @param[in]    bus the 8-bit bus number of the device
+ * @param[in]    devfun the 8-bit device(5-bit):function(3-bit) of the device
+ * @param[in]    index the IRTE index from iommu_set_posted_irte
+ *
+ */
+void iommu_free_irte(uint8_t bus, uint8_t devfun, uint16_t index);
+
 /**
   * @}
   */
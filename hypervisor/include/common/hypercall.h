@@ -119,6 +119,20 @@ int32_t hcall_start_vm(uint16_t vmid);
  */
 int32_t hcall_pause_vm(uint16_t vmid);
 
+/**
+ * @brief resume virtual machine
+ *
+ * Resume a virtual machine paused by hcall_pause_vm, e.g. after its state
+ * has been saved for a migration that failed. The vcpus which were
+ * waiting for an I/O request when paused execute the access again.
+ *
+ * @param vmid ID of the VM
+ *
+ * @return 0 on success, -1 if the VM does not exist or is not paused,
+ *         -EBUSY if an I/O request of the VM is not completed yet.
+ */
+int32_t hcall_resume_vm(uint16_t vmid);
+
 /**
  * @brief create vcpu
  *
@@ -152,6 +166,55 @@ int32_t hcall_create_vcpu(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
  */
 int32_t hcall_set_vcpu_regs(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
 
+/**
+ * @brief get vcpu regs
+ *
+ * Get the registers of a vcpu of a paused VM, in the form taken by
+ * hcall_set_vcpu_regs. The vcpu_id of the struct selects the vcpu.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_set_vcpu_regs
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, -EBUSY if the VM is not paused, -EINVAL on
+ *         other errors.
+ */
+int32_t hcall_get_vcpu_regs(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief get the VM exit accounting of a vcpu
+ *
+ * Read the per exit reason counts, cycles and histograms of a vcpu and
+ * its accesses to the MMIO regions emulated by the hypervisor.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_vmexit_stats
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_vmexit_stats(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief get the last VM exits of a vcpu
+ *
+ * Read the exit reason, guest RIP, exit TSC and the cycles to the next
+ * VM entry of the last ACRN_EXIT_TIMELINE_RECORDS VM exits of a vcpu.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_exit_timeline
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_exit_timeline(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
 /**
  * @brief set or clear IRQ line
  *
@@ -183,6 +246,23 @@ int32_t hcall_set_irqline(const struct acrn_vm *vm, uint16_t vmid,
  */
 int32_t hcall_inject_msi(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
 
+/**
+ * @brief inject a batch of MSI interrupts
+ *
+ * Inject the MSIs of a struct acrn_msi_batch for a VM, in order. An MSI
+ * identical to an earlier one of the batch targets the same vector of the
+ * same vCPUs, which is still pending from that one, and is skipped.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to struct acrn_msi_batch
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero if any MSI of the batch fails.
+ */
+int32_t hcall_inject_msi_batch(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
 /**
  * @brief set ioreq shared buffer
  *
@@ -199,6 +279,124 @@ int32_t hcall_inject_msi(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
  */
 int32_t hcall_set_ioreq_buffer(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
 
+/**
+ * @brief set the ring buffer of posted MMIO writes
+ *
+ * Set the ring page (struct vhm_posted_ring) that MMIO writes to posted
+ * ranges of a VM are appended to.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_set_ioreq_buffer
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_posted_ioreq_buffer(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief post (or stop posting) MMIO writes to a range
+ *
+ * Writes of a VM to a posted range are appended to the ring set by
+ * hcall_set_posted_ioreq_buffer and the vCPU is not paused for them.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_posted_mmio_range
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_posted_mmio_range(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief steer the VHM upcalls of a VM
+ *
+ * Set which SOS vCPUs are signaled of the I/O requests of a VM.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_upcall_policy
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_upcall_policy(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief set the pending bitmap page of the ioeventfds
+ *
+ * Set the page (struct vhm_ioeventfd_page) the hypervisor signals the
+ * ioeventfds of a VM in.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the page, or 0 to stop
+ *              signaling ioeventfds
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_ioeventfd_page(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief set the page of the RTC and PIT state shared by SOS
+ *
+ * Set the page (struct vhm_clock_page) the hypervisor completes the reads
+ * of the RTC and PIT of a VM from, without delivering them to SOS.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the page, or 0 to deliver all
+ *              RTC and PIT reads to SOS again
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_clock_page(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief set the statistics page of a VM
+ *
+ * Set the page (struct acrn_vm_telemetry) in which the hypervisor keeps
+ * the VM exit and passthrough interrupt counters of a VM up to date, for
+ * SOS to sample them without a hypercall.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the page, or 0 to stop updating it
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_telemetry_page(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief assign (or deassign) an in-hypervisor ioeventfd
+ *
+ * Writes of a VM matching an ioeventfd are completed by the hypervisor and
+ * only signaled in the page set by hcall_set_ioeventfd_page.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_hv_ioeventfd
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_assign_ioeventfd(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
 /**
  * @brief notify request done
  *
@@ -212,6 +410,20 @@ int32_t hcall_set_ioreq_buffer(struct acrn_vm *vm, uint16_t vmid, uint64_t param
  */
 int32_t hcall_notify_ioreq_finish(uint16_t vmid, uint16_t vcpu_id);
 
+/**
+ * @brief notify the completion of the requests of several vCPUs
+ *
+ * Same as hcall_notify_ioreq_finish() for each vCPU of the bitmap, in one
+ * hypercall. Nothing is notified if the bitmap has a vCPU the VM does not
+ * have.
+ *
+ * @param vmid ID of the VM
+ * @param vcpu_mask bitmap of the vcpu IDs of the requestors
+ *
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_notify_ioreq_finish_batch(uint16_t vmid, uint64_t vcpu_mask);
+
 /**
  * @brief setup ept memory mapping for multi regions
  *
@@ -237,6 +449,40 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vm *vm, uint64_t param);
  */
 int32_t hcall_write_protect_page(struct acrn_vm *vm, uint16_t vmid, uint64_t wp_gpa);
 
+/**
+ * @brief log the dirty pages of a VM
+ *
+ * Start or stop logging the pages the vCPUs of a VM write in a range of
+ * its memory, or fetch and clear the pages written, see
+ * struct acrn_dirty_log.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_dirty_log
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_dirty_log(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief make a range of a VM copy on write
+ *
+ * Write protect a range of the memory of a VM, or make it writable again,
+ * and have the writes of its vCPUs to it come to SOS without emulation,
+ * see struct acrn_cow_range.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_cow_range
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_set_cow(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
 /**
  * @brief translate guest physical address to host physical address
  *
@@ -266,6 +512,22 @@ int32_t hcall_gpa_to_hpa(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
  */
 int32_t hcall_assign_ptdev(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
 
+/**
+ * @brief Assign a batch of passthrough devs to VM.
+ *
+ * The devices are detached from VM0 first and the VT-d caches of VM0 are
+ * invalidated once for the whole batch, which matters when provisioning
+ * the many VFs of SR-IOV devices.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to struct acrn_ptdev_batch
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_assign_ptdev_batch(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
 /**
  * @brief Deassign one passthrough dev from VM.
  *
@@ -283,6 +545,9 @@ int32_t hcall_deassign_ptdev(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
 /**
  * @brief Set interrupt mapping info of ptdev.
  *
+ * Also sets how interrupts of the ptdev are coalesced, unless the target
+ * is VM0.
+ *
  * @param vm Pointer to VM data structure
  * @param vmid ID of the VM
  * @param param guest physical address. This gpa points to data structure of
@@ -417,6 +682,38 @@ int32_t hcall_save_restore_sworld_ctx(struct acrn_vcpu *vcpu);
  */
 int32_t hcall_set_callback_vector(const struct acrn_vm *vm, uint64_t param);
 
+/**
+ * @brief issue a batch of hypercalls
+ *
+ * Run the hypercalls of an array of struct acrn_multicall_entry in order,
+ * writing the return value of each back to its entry. A failing entry does
+ * not stop the batch.
+ *
+ * @param vcpu Pointer to the vCPU issuing the hypercall
+ * @param param1 guest physical address. This gpa points to an array of
+ *              struct acrn_multicall_entry
+ * @param param2 number of entries, at most MULTICALL_ENTRIES_MAX
+ *
+ * @pre Pointer vcpu->vm shall point to VM0
+ * @return 0 if all entries are run (see each result), non-zero on error.
+ */
+int32_t hcall_multicall(struct acrn_vcpu *vcpu, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief run a hypercall
+ *
+ * @param vcpu Pointer to the vCPU issuing the hypercall
+ * @param hypcall_id ID of the hypercall
+ * @param param1 hypercall param1
+ * @param param2 hypercall param2
+ *
+ * @pre vcpu != NULL
+ * @pre the caller has checked that vcpu is allowed to issue hypcall_id
+ * @return return value of the hypercall
+ */
+int32_t dispatch_hypercall(struct acrn_vcpu *vcpu, uint64_t hypcall_id,
+		uint64_t param1, uint64_t param2);
+
 /**
  * @}
  */
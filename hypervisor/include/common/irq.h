@@ -32,6 +32,7 @@ struct irq_desc {
 	uint64_t ctx_rip;
 	uint64_t ctx_rflags;
 	uint64_t ctx_cs;
+	uint64_t ctx_rbp;
 #endif
 };
 
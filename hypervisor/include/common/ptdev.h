@@ -14,6 +14,13 @@
 
 #define INVALID_PTDEV_ENTRY_ID 0xffffU
 
+/* physical devices of a shared INTx line tracked per entry, as in the DM */
+#define PTIRQ_INTX_SRC_MAX	4U
+
+/* softirq_state of an entry */
+#define PTIRQ_SOFTIRQ_QUEUED	0x1U	/* on the SOFTIRQ_PTDEV queue of a pCPU */
+#define PTIRQ_SOFTIRQ_RELEASED	0x2U	/* released, free it once taken off */
+
 enum ptirq_vpin_source {
 	PTDEV_VPIN_IOAPIC,
 	PTDEV_VPIN_PIC,
@@ -61,11 +68,25 @@ struct ptirq_remapping_info {
 	uint32_t active;	/* 1=active, 0=inactive and to free*/
 	uint32_t allocated_pirq;
 	uint32_t polarity; /* 0=active high, 1=active low*/
-	struct list_head softirq_node;
+	struct list_head phys_link;	/* hashed by phys_sid while active */
+	struct list_head virt_link;	/* hashed by vm and virt_sid while active */
+	struct ptirq_remapping_info *softirq_next;	/* on the queue of a pCPU */
+	uint32_t softirq_state;
 	struct ptirq_msi_info msi;
+	uint16_t irte_idx;	/* IRTE of a posted MSI, INVALID_IRTE_ID if none */
 
 	uint64_t intr_count;
+	uint16_t telemetry_slot;	/* ptirq[] of the telemetry page + 1, 0: none yet */
 	struct hv_timer intr_delay_timer; /* used for delay intr injection */
+
+	/* interrupt coalescing, not for vm0 */
+	uint32_t coalesce_events;	/* inject on this many interrupts */
+	uint64_t coalesce_cycles;	/* or this long after the first, 0: off */
+	int32_t coalesced;		/* interrupts not injected yet */
+
+	/* INTx: physical BDFs behind the pin, none known for vm0 */
+	uint16_t intx_src_bdf[PTIRQ_INTX_SRC_MAX];
+	uint32_t intx_src_num;	/* > PTIRQ_INTX_SRC_MAX: not all known */
 };
 
 extern struct ptirq_remapping_info ptirq_entries[];
@@ -76,12 +97,19 @@ void ptirq_softirq(uint16_t pcpu_id);
 void ptdev_init(void);
 void ptdev_release_all_entries(const struct acrn_vm *vm);
 
-struct ptirq_remapping_info *ptirq_dequeue_softirq(struct acrn_vm *vm);
+struct ptirq_remapping_info *ptirq_lookup_entry_by_sid(uint32_t intr_type,
+		const union source_id *sid, const struct acrn_vm *vm);
+void ptirq_change_virt_sid(struct ptirq_remapping_info *entry, struct acrn_vm *vm,
+		const union source_id *virt_sid);
+struct ptirq_remapping_info *ptirq_dequeue_softirq(uint16_t pcpu_id);
 struct ptirq_remapping_info *ptirq_alloc_entry(struct acrn_vm *vm, uint32_t intr_type);
 void ptirq_release_entry(struct ptirq_remapping_info *entry);
 int32_t ptirq_activate_entry(struct ptirq_remapping_info *entry, uint32_t phys_irq);
 void ptirq_deactivate_entry(struct ptirq_remapping_info *entry);
+void ptirq_set_coalescing(struct ptirq_remapping_info *entry, uint32_t max_events, uint32_t max_us);
 
 uint32_t ptirq_get_intr_data(const struct acrn_vm *target_vm, uint64_t *buffer, uint32_t buffer_cnt);
+/* forget the slots of the telemetry page taken by the entries of target_vm */
+void ptirq_reset_telemetry(const struct acrn_vm *target_vm);
 
 #endif /* PTDEV_H */
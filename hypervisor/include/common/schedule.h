@@ -7,15 +7,99 @@
 #ifndef SCHEDULE_H
 #define SCHEDULE_H
 
+#include <timer.h>
+
 #define	NEED_RESCHEDULE		(1U)
 #define	NEED_OFFLINE		(2U)
 
+/* vCPU priorities, only the priority scheduler tells them apart */
+#define	SCHED_PRIO_LOW		0U	/* best effort */
+#define	SCHED_PRIO_HIGH		1U	/* latency critical */
+
+/* How an idle pCPU waits for work */
+#define	IDLE_POLICY_POLL	0U	/* spin, lowest wakeup latency */
+#define	IDLE_POLICY_MWAIT	1U	/* MWAIT in the configured C-state */
+#define	IDLE_POLICY_ADAPTIVE	2U	/* spin through short idle periods only */
+#define	NR_IDLE_POLICIES	3U
+
+/*
+ * XSAVE area large enough for all the user state components we expose,
+ * in the standard format, or in the compacted one when XSAVES is there.
+ */
+#define	SCHED_XSAVE_AREA_SIZE	4096U
+
+struct sched_context;
+struct acrn_steal_time;
+
+/**
+ * @brief Scheduling policy of the runqueues
+ *
+ * The runqueue of a pCPU holds all of its runnable vCPUs, including the
+ * running one. All hooks are called with the runqueue_lock held.
+ */
+struct acrn_scheduler {
+	const char *name;
+	/** queue a runnable vCPU */
+	void (*insert)(struct sched_context *ctx, struct acrn_vcpu *vcpu);
+	/** the vCPU to run next, NULL for idle */
+	struct acrn_vcpu *(*pick_next)(struct sched_context *ctx);
+	/**
+	 * called every time slice, return true if the running vCPU shall
+	 * give the pCPU up. NULL if the policy does not use time slices.
+	 */
+	bool (*slice_expired)(struct sched_context *ctx);
+	/**
+	 * make a queued vCPU, not the running one, the next to run among
+	 * those of its priority. NULL if the policy does not use time slices.
+	 */
+	void (*boost)(struct sched_context *ctx, struct acrn_vcpu *vcpu);
+};
+
+/**
+ * @brief Per-vCPU scheduling state and accounting
+ */
+struct sched_vcpu {
+	uint32_t prio;		/* SCHED_PRIO_* */
+	uint64_t start_tsc;	/* TSC when last switched in */
+	uint64_t runtime;	/* TSC cycles spent on the pCPU */
+	uint64_t nr_switches;	/* times it was switched in */
+	uint32_t halted;	/* off the runqueue in HLT until an event arrives */
+
+	/* run time accounting, in TSC cycles */
+	uint64_t guest_time;	/* spent in VMX non-root operation */
+	uint64_t ready_tsc;	/* when it became runnable off the pCPU, or 0 */
+	uint64_t steal_time;	/* runnable while another vCPU had the pCPU */
+	uint64_t dm_wait_start;	/* when its I/O request was sent to the DM */
+	uint64_t dm_wait;	/* paused on I/O requests to the DM */
+	uint64_t dm_requests;	/* I/O requests completed by the DM */
+	uint64_t steal_msr;	/* MSR_ACRN_STEAL_TIME */
+	struct acrn_steal_time *steal_page;	/* guest copy, NULL if disabled */
+
+	/* guest FPU/SSE/AVX state while another vCPU owns the pCPU */
+	bool xsave_valid;
+	uint64_t xcr0;
+	uint8_t xsave_area[SCHED_XSAVE_AREA_SIZE] __aligned(64);
+};
+
 struct sched_context {
 	spinlock_t runqueue_lock;
 	struct list_head runqueue;
 	uint64_t flags;
 	struct acrn_vcpu *curr_vcpu;
 	spinlock_t scheduler_lock;
+
+	const struct acrn_scheduler *scheduler;
+	uint16_t nr_vcpus;		/* vCPUs assigned to this pCPU */
+	struct acrn_vcpu *vmcs_vcpu;	/* whose VMCS is current */
+	struct acrn_vcpu *fpu_vcpu;	/* whose FPU state and pass-through MSRs are loaded */
+	struct acrn_vcpu *vpmu_vcpu;	/* whose counters are in the physical PMU */
+	bool slice_timer_armed;
+	struct hv_timer slice_timer;
+
+	uint32_t idle_policy;		/* IDLE_POLICY_* */
+	uint32_t mwait_hint;		/* EAX of MWAIT */
+	uint64_t idle_start;		/* TSC when idle got the pCPU */
+	uint64_t idle_avg;		/* average idle period, TSC cycles */
 };
 
 void init_scheduler(void);
@@ -25,10 +109,16 @@ void release_schedule_lock(uint16_t pcpu_id);
 void set_pcpu_used(uint16_t pcpu_id);
 uint16_t allocate_pcpu(void);
 void free_pcpu(uint16_t pcpu_id);
+bool is_vcpu_overcommit_supported(void);
+bool can_share_pcpu(uint16_t pcpu_id);
 
 void add_vcpu_to_runqueue(struct acrn_vcpu *vcpu);
 void remove_vcpu_from_runqueue(struct acrn_vcpu *vcpu);
+void yield_vcpu(struct acrn_vcpu *vcpu);
+int32_t set_steal_time_msr(struct acrn_vcpu *vcpu, uint64_t val);
 
+int32_t set_idle_policy(uint16_t pcpu_id, uint32_t policy, uint32_t mwait_hint);
+const char *get_idle_policy_name(uint32_t policy);
 void default_idle(void);
 
 void make_reschedule_request(const struct acrn_vcpu *vcpu);
@@ -39,5 +129,7 @@ int32_t need_offline(uint16_t pcpu_id);
 void schedule(void);
 
 void vcpu_thread(struct acrn_vcpu *vcpu);
-#endif /* SCHEDULE_H */
 
+extern const struct acrn_scheduler sched_fifo;
+extern const struct acrn_scheduler sched_prio;
+#endif /* SCHEDULE_H */
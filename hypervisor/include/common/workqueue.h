@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+/*
+ * Deferred work runs on a chosen pCPU when it has nothing else to do: in
+ * the idle loop, or when it leaves the idle loop to switch to a vCPU. It
+ * suits expensive bookkeeping which must not add to the latency of the
+ * hypercall or VM exit queuing it.
+ */
+
+struct work_item;
+typedef void (*work_func_t)(struct work_item *work);
+
+struct work_item {
+	struct list_head node;
+	work_func_t func;
+	void *data;
+	uint16_t pcpu_id;	/* pCPU it is queued on */
+};
+
+struct work_queue {
+	spinlock_t lock;
+	struct list_head list;
+};
+
+void init_work_queues(void);
+
+/**
+ * @brief Initialize a work item
+ *
+ * @param work Pointer to the work item
+ * @param func function to run, with the work item as argument
+ * @param data private data of func
+ */
+static inline void init_work(struct work_item *work, work_func_t func, void *data)
+{
+	INIT_LIST_HEAD(&work->node);
+	work->func = func;
+	work->data = data;
+}
+
+/**
+ * @brief Queue a work item on a pCPU
+ *
+ * @param pcpu_id pCPU to run the work on
+ * @param work Pointer to the work item
+ *
+ * @return 0 on success, -EBUSY if the work item is already queued
+ */
+int32_t queue_work_on(uint16_t pcpu_id, struct work_item *work);
+
+/**
+ * @brief Check whether a work item is queued and not run yet
+ */
+bool work_pending(const struct work_item *work);
+
+/**
+ * @brief Run the work queued on a pCPU
+ *
+ * Called from the idle loop of that pCPU.
+ */
+void run_deferred_work(uint16_t pcpu_id);
+
+#endif /* WORKQUEUE_H */
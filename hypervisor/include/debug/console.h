@@ -35,6 +35,20 @@ size_t console_write(const char *s, size_t len);
 void console_putc(const char *ch);
 char console_getc(void);
 
+/**
+ * @brief Queue a log message for the console, followed by "\n\r"
+ *
+ * Once the console timer runs, log messages are not written to the UART
+ * by the pCPU logging them: they are staged on a ring of that pCPU, and
+ * the console timer drains the rings of all pCPUs. Nothing is blocked on
+ * the UART nor on other pCPUs; a message which does not fit in the ring
+ * is dropped and counted, the count showing up in the console output.
+ *
+ * @return false if messages are not staged (yet), the caller then writes
+ *         the message itself.
+ */
+bool console_stage_msg(const char *msg, size_t len);
+
 void console_setup_timer(void);
 void uart16550_set_property(bool enabled, bool port_mapped, uint64_t base_addr);
 bool is_pci_dbg_uart(union pci_bdf bdf_value);
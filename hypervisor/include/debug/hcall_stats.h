@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef HCALL_STATS_H
+#define HCALL_STATS_H
+
+/*
+ * Bucket i of a hypercall latency histogram counts the calls which took
+ * [2^i, 2^(i + 1)) TSC cycles; bucket 0 also takes the zero-cycle calls
+ * and the last bucket takes everything above its lower bound.
+ */
+#define HCALL_LAT_BUCKETS	32U
+
+/* hypercalls are tracked by the low byte of their ID (see BASE_HC_ID) */
+#define HCALL_LAT_IDS		(HC_ID_PM_BASE + 0x10UL)
+
+struct hcall_latency {
+	uint64_t count;
+	uint64_t total_cycles;
+	uint64_t max_cycles;
+	uint32_t hist[HCALL_LAT_BUCKETS];
+};
+
+/**
+ * @brief Account one hypercall into its latency histogram
+ *
+ * @param hypcall_id ID of the hypercall as issued by the guest
+ * @param cycles TSC cycles spent in the hypercall handler
+ */
+void hcall_stats_record(uint64_t hypcall_id, uint64_t cycles);
+
+/**
+ * @brief Take a snapshot of the latency histogram of one hypercall
+ *
+ * @param hypcall_id ID of the hypercall
+ * @param lat Pointer to the snapshot to fill
+ *
+ * @return 0 on success, -EINVAL if hypcall_id is not tracked
+ */
+int32_t hcall_stats_get(uint64_t hypcall_id, struct hcall_latency *lat);
+
+/**
+ * @brief Reset all hypercall latency histograms
+ */
+void hcall_stats_clear(void);
+
+/**
+ * @brief Format a summary of all non-empty histograms
+ *
+ * @param str_arg Pointer to the output buffer
+ * @param str_max Size of the output buffer
+ */
+void get_hcall_latency_info(char *str_arg, size_t str_max);
+
+#endif /* HCALL_STATS_H */
@@ -20,12 +20,40 @@
 #define LOG_FLAG_STDOUT		0x00000001U
 #define LOG_FLAG_MEMORY		0x00000002U
 #define LOG_FLAG_NPK		0x00000004U
+/* Memory log in binary form, formatted by acrnlog in the SOS */
+#define LOG_FLAG_BINARY		0x00000008U
 #define LOG_ENTRY_SIZE	80U
 /* Size of buffer used to store a message being logged,
  * should align to LOG_ENTRY_SIZE.
  */
 #define LOG_MESSAGE_MAX_SIZE	(4U * LOG_ENTRY_SIZE)
 
+/* First byte of a binary record, never the first one of a text message */
+#define LOG_BIN_MARKER		0x01U
+
+/**
+ * @brief Header of a binary memory log record
+ *
+ * The header is followed by nr_args 64 bit arguments, then by the bytes of
+ * the string arguments, whose argument slots hold their offset in the
+ * record (0 for a string which did not fit). The record spans nr_entries
+ * LOG_ENTRY_SIZE entries of the sbuf.
+ */
+struct log_bin_header {
+	uint8_t marker;		/* LOG_BIN_MARKER */
+	uint8_t severity;
+	uint8_t nr_args;
+	uint8_t nr_entries;
+	uint16_t pcpu_id;
+	uint16_t size;		/* Bytes used in the record */
+	uint32_t seq;
+	uint32_t reserved;
+	uint64_t timestamp;	/* In us */
+	uint64_t fmt;		/* Link time address of the format string */
+};
+
+#define LOG_BIN_MAX_ARGS	((LOG_MESSAGE_MAX_SIZE - sizeof(struct log_bin_header)) / sizeof(uint64_t))
+
 #if defined(HV_DEBUG)
 
 extern uint16_t console_loglevel;
@@ -11,4 +11,9 @@ struct hv_npk_log_param;
 void npk_log_setup(struct hv_npk_log_param *param);
 void npk_log_write(const char *buf, size_t len);
 
+/* Whether the trace events go to the Trace Hub instead of the trace sbufs */
+bool npk_trace_on(void);
+/* Send a trace record of nr_words 64-bit words on the channel of the pCPU */
+void npk_trace_write(const uint64_t *words, uint32_t nr_words);
+
 #endif /* NPK_LOG_H */
@@ -15,5 +15,6 @@ void profiling_vmenter_handler(struct acrn_vcpu *vcpu);
 void profiling_pre_vmexit_handler(struct acrn_vcpu *vcpu);
 void profiling_post_vmexit_handler(struct acrn_vcpu *vcpu);
 void profiling_setup(void);
+bool profiling_pmu_running(void);
 
 #endif /* PROFILING_H */
@@ -9,6 +9,8 @@
 
 #ifdef PROFILING_ON
 
+#include <hcall_stats.h>
+
 #define MAX_NR_VCPUS			8
 #define MAX_NR_VMS				6
 
@@ -63,6 +65,7 @@ typedef enum PROFILING_SEP_FEATURE {
 	LBR_PMU_SAMPLING,
 	UNCORE_PMU_SAMPLING,
 	VM_SWITCH_TRACING,
+	CALLSTACK_PMU_SAMPLING,
 	MAX_SEP_FEATURE_ID
 } profiling_sep_feature;
 
@@ -264,11 +267,28 @@ struct lbr_pmu_sample {
 } __aligned(SEP_BUF_ENTRY_SIZE);
 
 #define LBR_PMU_SAMPLE_SIZE ((uint64_t)sizeof(struct lbr_pmu_sample))
+#define NUM_CALLSTACK_ENTRY	30
+
+/*
+ * Return addresses of the hypervisor frames active when the PMI hit,
+ * innermost first, found by following the frame pointers.
+ */
+struct callstack_pmu_sample {
+	/* number of valid entries in ip */
+	uint32_t	nr;
+	uint32_t	reserved;
+	uint64_t	ip[NUM_CALLSTACK_ENTRY];
+} __aligned(SEP_BUF_ENTRY_SIZE);
+
+#define CALLSTACK_PMU_SAMPLE_SIZE ((uint64_t)sizeof(struct callstack_pmu_sample))
 struct pmu_sample {
 	/* core pmu sample */
 	struct core_pmu_sample	csample;
-	/* lbr pmu sample */
-	struct lbr_pmu_sample	lsample;
+	/* sent right after the core sample: lbr pmu sample or call stack */
+	union {
+		struct lbr_pmu_sample		lsample;
+		struct callstack_pmu_sample	ssample;
+	} ext;
 } __aligned(SEP_BUF_ENTRY_SIZE);
 
 struct vm_switch_trace {
@@ -279,6 +299,17 @@ struct vm_switch_trace {
 }__aligned(SEP_BUF_ENTRY_SIZE);
 
 #define VM_SWITCH_TRACE_SIZE ((uint64_t)sizeof(struct vm_switch_trace))
+
+/*
+ * Latency histogram of one hypercall, hc_id is filled in by the caller
+ */
+struct profiling_hcall_latency {
+	uint64_t hc_id;
+	uint64_t count;
+	uint64_t total_cycles;
+	uint64_t max_cycles;
+	uint32_t hist[HCALL_LAT_BUCKETS];
+} __aligned(8);
 /*
  * Wrapper containing  SEP sampling/profiling related data structures
  */
@@ -295,6 +326,7 @@ struct profiling_info_wrapper {
 
 int32_t profiling_get_version_info(struct acrn_vm *vm, uint64_t addr);
 int32_t profiling_get_pcpu_id(struct acrn_vm *vm, uint64_t addr);
+int32_t profiling_get_hcall_latency(struct acrn_vm *vm, uint64_t addr);
 int32_t profiling_msr_ops_all_cpus(struct acrn_vm *vm, uint64_t addr);
 int32_t profiling_vm_list_info(struct acrn_vm *vm, uint64_t addr);
 int32_t profiling_get_control(struct acrn_vm *vm, uint64_t addr);
@@ -59,11 +59,57 @@ struct shared_buf {
 };
 
 
+/* Returned by sbuf_reserve() when the record does not fit */
+#define SBUF_NO_ROOM	0xFFFFFFFFU
+
 /**
  *@pre sbuf != NULL
  *@pre data != NULL
  */
 uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data);
+
+/**
+ * @brief Add \p nr elements of ele_size bytes each, all or none
+ *
+ * With OVERWRITE_EN, the oldest elements are dropped to make room.
+ *
+ * @return The number of bytes written, 0 if there is no room
+ *
+ * @pre sbuf != NULL
+ * @pre data != NULL
+ */
+uint32_t sbuf_put_many(struct shared_buf *sbuf, const uint8_t *data, uint32_t nr);
+
+/**
+ * @brief Reserve \p len bytes at the tail, for records of any length
+ *
+ * The reservation is filled with sbuf_copy_at(), possibly in several
+ * pieces, and published to the reader at once with sbuf_commit(). Only the
+ * owner of the buffer (its pCPU) may produce, and one reservation may be
+ * pending at a time. Elements are dropped on overwrite only if \p len is a
+ * multiple of ele_size.
+ *
+ * @return The position of the reservation, or SBUF_NO_ROOM
+ *
+ * @pre sbuf != NULL
+ */
+uint32_t sbuf_reserve(struct shared_buf *sbuf, uint32_t len);
+
+/**
+ * @brief Copy \p len bytes at \p pos of a reservation, wrapping around
+ *
+ * @return The position following the copied bytes
+ *
+ * @pre \p pos and \p len lie within a reservation of sbuf_reserve()
+ */
+uint32_t sbuf_copy_at(struct shared_buf *sbuf, uint32_t pos, const void *data, uint32_t len);
+
+/**
+ * @brief Publish the \p len bytes reserved at \p pos
+ *
+ * @pre \p pos and \p len are the ones passed to and returned by sbuf_reserve()
+ */
+void sbuf_commit(struct shared_buf *sbuf, uint32_t pos, uint32_t len);
 int32_t sbuf_share_setup(uint16_t pcpu_id, uint32_t sbuf_id, uint64_t *hva);
 uint32_t sbuf_next_ptr(uint32_t pos, uint32_t span, uint32_t scope);
 
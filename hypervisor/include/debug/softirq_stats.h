@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef SOFTIRQ_STATS_H
+#define SOFTIRQ_STATS_H
+
+struct softirq_stat {
+	uint64_t count;
+	uint64_t total_cycles;
+	uint64_t max_cycles;
+};
+
+/**
+ * @brief Account one run of a softirq handler
+ *
+ * Only called on the pCPU the handler ran on, so needs no locking.
+ *
+ * @param pcpu_id pCPU the handler ran on
+ * @param nr softirq number
+ * @param cycles TSC cycles spent in the handler
+ */
+void softirq_stats_record(uint16_t pcpu_id, uint16_t nr, uint64_t cycles);
+
+/**
+ * @brief Reset the softirq statistics of all pCPUs
+ */
+void softirq_stats_clear(void);
+
+/**
+ * @brief Format the softirq statistics of each pCPU
+ *
+ * @param str_arg Pointer to the output buffer
+ * @param str_max Size of the output buffer
+ */
+void get_softirq_stats_info(char *str_arg, size_t str_max);
+
+#endif /* SOFTIRQ_STATS_H */
@@ -17,6 +17,17 @@
 #define TRACE_TIMER_ACTION_PCKUP	0x2U
 #define TRACE_TIMER_ACTION_UPDAT	0x3U
 #define TRACE_TIMER_IRQ			0x4U
+#define TRACE_SOFTIRQ			0x5U
+
+/*
+ * Path of a passthrough interrupt to the guest, see irq_analyze.py:
+ * physical IRQ handled, taken by the ptdev softirq, recorded in the
+ * vLAPIC, then injected (or posted) before the next VM entry.
+ */
+#define TRACE_PTIRQ_IRQ			0x20U
+#define TRACE_PTIRQ_SOFTIRQ		0x21U
+#define TRACE_VLAPIC_INTR		0x22U
+#define TRACE_VLAPIC_INJECT		0x23U
 
 #define TRACE_VM_EXIT			0x10U
 #define TRACE_VM_ENTER			0X11U
@@ -45,4 +56,32 @@ void TRACE_2L(uint32_t evid, uint64_t e, uint64_t f);
 void TRACE_4I(uint32_t evid, uint32_t a, uint32_t b, uint32_t c, uint32_t d);
 void TRACE_6C(uint32_t evid, uint8_t a1, uint8_t a2, uint8_t a3, uint8_t a4, uint8_t b1, uint8_t b2);
 
+/**
+ * @brief Select the events recorded by TRACE_xxx()
+ *
+ * Takes effect on all the pCPUs at once.
+ *
+ * @param param The new event mask, see struct trace_mask_param
+ */
+void trace_set_mask(const struct trace_mask_param *param);
+
+/**
+ * @brief Switch between raw event recording and in-place aggregation
+ *
+ * While aggregating, TRACE_xxx() only update the per-pCPU struct trace_aggr
+ * statistics and put nothing in the trace sbufs, which need not be set up.
+ *
+ * @param enable true to clear the statistics and start aggregating
+ */
+void trace_aggregate(bool enable);
+
+/**
+ * @brief Snapshot the aggregated statistics of one pCPU
+ *
+ * @param aggr Receives the statistics of pCPU aggr->pcpu_id
+ *
+ * @return 0 on success, -EINVAL if the pCPU does not exist
+ */
+int32_t trace_aggr_snapshot(struct trace_aggr *aggr);
+
 #endif /* TRACE_H */
@@ -61,6 +61,7 @@ struct acrn_vuart {
 	char vuart_tx_buf[TX_BUF_SIZE];
 #endif
 	bool thre_int_pending;	/* THRE interrupt pending */
+	uint32_t irq_op;	/* Last GSI operation on the COM IRQ */
 	bool active;
 	struct acrn_vm *vm;
 	spinlock_t lock;	/* protects all softc elements */
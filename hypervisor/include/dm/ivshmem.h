@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef IVSHMEM_H_
+#define IVSHMEM_H_
+
+#include <vpci.h>
+
+/**
+ * @file ivshmem.h
+ *
+ * @brief Inter-VM shared memory device for partition mode
+ *
+ * An ivshmem-doorbell compatible PCI device (1af4:1110) whose BAR2 maps
+ * a region of hypervisor memory into every VM attached to it. Guests move
+ * data through the region at memory bandwidth and ring each other's MSI-X
+ * vectors through the Doorbell register in BAR0; only the doorbell exits.
+ *
+ * BAR0 holds the registers, BAR1 the MSI-X table and PBA, and BAR2 the
+ * shared memory. All three are placed by the VM description and can not
+ * be relocated by the guest. INTx is not supported.
+ */
+
+/** Size of the register BAR */
+#define IVSHMEM_REG_SIZE	0x100UL
+/** Size of the MSI-X BAR */
+#define IVSHMEM_MSIX_SIZE	0x1000UL
+/** VMs which can share one region */
+#define IVSHMEM_MAX_PEERS	4U
+
+struct ivshmem_dev;
+
+/**
+ * @brief Memory shared by the ivshmem devices of several VMs
+ *
+ * Defined statically in the VM description, with a power of 2 size of
+ * at least one page.
+ */
+struct ivshmem_region {
+	/** Page aligned hypervisor memory holding the region */
+	void *mem;
+	uint64_t size;
+	/** Attached devices, by IVPosition: filled in at vdev init */
+	struct ivshmem_dev *peers[IVSHMEM_MAX_PEERS];
+};
+
+/**
+ * @brief The ivshmem device of one VM, attached through pci_vdev::priv
+ */
+struct ivshmem_dev {
+	struct ivshmem_region *region;
+	/** IVPosition of this VM, the peer id the others ring */
+	uint16_t position;
+
+	struct pci_vdev *vdev;
+	uint32_t intr_mask;
+	uint32_t intr_status;
+	struct vmsix_emul msix;
+};
+
+extern struct pci_vdev_ops pci_ops_vdev_ivshmem;
+
+#endif /* IVSHMEM_H_ */
@@ -55,12 +55,18 @@
 
 #define PCI_CFG_ENABLE        0x80000000U
 
+/* ECAM window of the guests, as set in the PCIEXBAR of the virtual host bridge */
+#define PCI_MMCFG_BASE        0xE0000000UL
+#define PCI_MMCFG_SIZE        0x10000000UL
+
 /* PCI config header registers for all devices */
 #define PCIR_VENDOR           0x00U
 #define PCIR_DEVICE           0x02U
 #define PCIR_COMMAND          0x04U
+#define PCIM_CMD_MEMEN        0x02U
 #define PCIM_CMD_INTxDIS      0x400U
 #define PCIR_STATUS           0x06U
+#define PCIM_STATUS_INTxSTATE     0x0008U
 #define PCIM_STATUS_CAPPRESENT    0x0010U
 #define PCIR_REVID            0x08U
 #define PCIR_SUBCLASS         0x0AU
@@ -78,7 +84,12 @@
 #define PCIM_BAR_MEM_1MB      0x02U
 #define PCIM_BAR_MEM_64       0x04U
 #define PCIM_BAR_MEM_BASE     0xFFFFFFF0U
+#define PCIM_BAR_IO_BASE      0xFFFFFFFCU
+#define PCIR_SUBVEND_0        0x2CU
+#define PCIR_SUBDEV_0         0x2EU
 #define PCIR_CAP_PTR          0x34U
+#define PCIR_INTLINE          0x3CU
+#define PCIR_INTPIN           0x3DU
 
 /* config registers for header type 1 (PCI-to-PCI bridge) devices */
 #define PCIR_PRIBUS_1         0x18U
@@ -108,6 +119,8 @@
 /* PCI device class */
 #define PCIC_BRIDGE           0x06U
 #define PCIS_BRIDGE_HOST      0x00U
+#define PCIC_SIMPLECOMM       0x07U
+#define PCIS_SIMPLECOMM_OTHER 0x80U
 
 /* MSI-X definitions */
 #define PCIR_MSIX_CTRL        0x2U
@@ -136,6 +149,7 @@ enum pci_bar_type {
 	PCIBAR_NONE = 0,
 	PCIBAR_MEM32,
 	PCIBAR_MEM64,
+	PCIBAR_IO,
 };
 
 typedef void (*pci_enumeration_cb)(uint16_t pbdf, void *data);
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef VIRTIO_CONSOLE_H_
+#define VIRTIO_CONSOLE_H_
+
+#include <vpci.h>
+
+/**
+ * @file virtio_console.h
+ *
+ * @brief Hypervisor-resident virtio console for partition mode
+ *
+ * Partition mode VMs have no device model to back a virtio device. This
+ * legacy virtio-pci console is served by the hypervisor instead: two ports
+ * are paired with each other, and the bytes one VM transmits are copied
+ * straight into the receive buffers the peer VM posted, within the exit
+ * of the queue notification.
+ *
+ * BAR0 holds the legacy virtio I/O registers and BAR1 the MSI-X table and
+ * PBA. Both are placed by the VM description and can not be relocated by
+ * the guest. INTx is not supported.
+ */
+
+/** Size of the legacy virtio register block in BAR0 */
+#define VCON_PIO_SIZE		0x20UL
+/** Size of the MSI-X BAR */
+#define VCON_MMIO_SIZE		0x1000UL
+
+/** Virtqueues of a console without multiport: receiveq and transmitq */
+#define VCON_RXQ		0U
+#define VCON_TXQ		1U
+#define VCON_QUEUE_NUM		2U
+/** Number of descriptors of each virtqueue */
+#define VCON_QUEUE_SIZE		64U
+
+/** MSI-X vectors: config change plus one per virtqueue */
+#define VCON_MSIX_NUM		(VCON_QUEUE_NUM + 1U)
+
+struct vcon_queue {
+	/* Guest page frame number of the ring, 0 if not set up */
+	uint32_t pfn;
+	uint16_t msix_vector;
+	/* Next entry of the avail ring to consume */
+	uint16_t last_avail;
+	/* Next entry of the used ring to produce */
+	uint16_t used_idx;
+};
+
+/* Position in the transmit chain being copied to the peer */
+struct vcon_tx_cursor {
+	bool active;
+	uint16_t head;
+	uint16_t desc;
+	uint16_t hops;
+	uint32_t offset;
+};
+
+/**
+ * @brief One end of an inter-VM virtio console link
+ *
+ * Ports are defined statically in the VM description, each pointing at
+ * its peer, and attached to a vdev through pci_vdev::priv.
+ */
+struct vcon_port {
+	/** The other end of the link */
+	struct vcon_port *peer;
+
+	/** Filled in when the vdev is initialized */
+	struct pci_vdev *vdev;
+	uint16_t pio_base;
+
+	uint32_t guest_features;
+	uint16_t queue_sel;
+	uint8_t status;
+	uint8_t isr;
+	uint16_t msix_config_vector;
+	struct vcon_queue queues[VCON_QUEUE_NUM];
+	struct vcon_tx_cursor tx;
+
+	struct vmsix_emul msix;
+};
+
+extern struct pci_vdev_ops pci_ops_vdev_virtio_console;
+
+#endif /* VIRTIO_CONSOLE_H_ */
@@ -84,8 +84,24 @@ struct msix {
 	uint32_t  table_bar;
 	uint32_t  table_offset;
 	uint32_t  table_count;
+	/* entries whose physical copy holds the remapped current message */
+	uint64_t  remapped[INT_DIV_ROUNDUP(CONFIG_MAX_MSIX_TABLE_NUM, 64U)];
 };
 
+#ifdef CONFIG_PARTITION_MODE
+#define VMSIX_EMUL_MAX_ENTRIES	4U
+#define VMSIX_EMUL_PBA_OFFSET	0x800U
+
+/* MSI-X of a device emulated in the hypervisor, see vmsix_emul_init() */
+struct vmsix_emul {
+	struct msix_table_entry table[VMSIX_EMUL_MAX_ENTRIES];
+	uint64_t  pba;
+	uint32_t  capoff;
+	uint32_t  table_count;
+	uint32_t  bar;
+};
+#endif
+
 union cfgdata {
 	uint8_t data_8[PCI_REGMAX + 1U];
 	uint16_t data_16[(PCI_REGMAX + 1U) >> 2U];
@@ -109,12 +125,18 @@ struct pci_vdev {
 
 	union cfgdata cfgdata;
 
+	/* Header bytes of a physical device served from cfgdata, one bit each */
+	uint64_t ro_cfg_mask;
+
 	/* The bar info of the virtual PCI device. */
 	struct pci_bar bar[PCI_BAR_COUNT];
 
 #ifndef CONFIG_PARTITION_MODE
 	struct msi msi;
 	struct msix msix;
+#else
+	/* State of a device emulated in the hypervisor, see virtio_console.h */
+	void *priv;
 #endif
 };
 
@@ -134,10 +156,16 @@ struct vpci_ops {
 };
 
 
+#define PCI_DEVFN_NUM	((PCI_SLOTMAX + 1U) * (PCI_FUNCMAX + 1U))
+
 struct vpci {
 	struct acrn_vm *vm;
 	struct pci_addr_info addr_info;
 	struct vpci_ops *ops;
+#ifdef CONFIG_PARTITION_MODE
+	/* vdevs on bus 0, where partition mode puts them all, by devfn */
+	struct pci_vdev *bus0_vdevs[PCI_DEVFN_NUM];
+#endif
 };
 
 extern struct pci_vdev_ops pci_ops_vdev_hostbridge;
@@ -13,6 +13,8 @@
 #include <trace.h>
 #include <sbuf.h>
 #include <npk_log.h>
+#include <hcall_stats.h>
+#include <softirq_stats.h>
 #include <profiling.h>
 
 #endif /* HV_DEBUG_H */
@@ -23,5 +23,7 @@
 #define ENODEV		19
 /** Indicates that argument is not valid. */
 #define EINVAL		22
+/** Indicates that there is no space left. */
+#define ENOSPC		28
 
 #endif /* ERRNO_H */
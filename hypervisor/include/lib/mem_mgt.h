@@ -21,6 +21,17 @@ struct mem_pool {
 	uint32_t *contiguity_bitmap;	/* Pointer to contiguity bitmap */
 };
 
+/* Size classes of small allocations: CONFIG_MALLOC_ALIGN << 0 .. << 7 */
+#define MALLOC_SIZE_CLASSES	8U
+/* Most freed buffers of one size class a pCPU keeps for reuse */
+#define MALLOC_CACHE_DEPTH	32U
+
+/* Per pCPU free lists of buffers, linked through their first bytes */
+struct malloc_cache {
+	void *free_list[MALLOC_SIZE_CLASSES];
+	uint32_t nr_free[MALLOC_SIZE_CLASSES];
+};
+
 /* APIs exposing memory allocation/deallocation abstractions */
 void *malloc(uint32_t num_bytes);
 void *calloc(uint32_t num_elements, uint32_t element_size);
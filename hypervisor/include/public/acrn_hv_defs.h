@@ -28,6 +28,7 @@
 #define HC_GET_API_VERSION          BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x00UL)
 #define HC_SOS_OFFLINE_CPU          BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x01UL)
 #define HC_SET_CALLBACK_VECTOR      BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x02UL)
+#define HC_MULTICALL                BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x03UL)
 
 /* VM management */
 #define HC_ID_VM_BASE               0x10UL
@@ -38,23 +39,38 @@
 #define HC_CREATE_VCPU              BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x04UL)
 #define HC_RESET_VM                 BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x05UL)
 #define HC_SET_VCPU_REGS            BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x06UL)
+#define HC_GET_VMEXIT_STATS         BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x07UL)
+#define HC_GET_EXIT_TIMELINE        BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x08UL)
+#define HC_GET_VCPU_REGS            BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x09UL)
+#define HC_RESUME_VM                BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x0AUL)
 
 /* IRQ and Interrupts */
 #define HC_ID_IRQ_BASE              0x20UL
 #define HC_INJECT_MSI               BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x03UL)
 #define HC_VM_INTR_MONITOR          BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x04UL)
 #define HC_SET_IRQLINE              BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x05UL)
+#define HC_INJECT_MSI_BATCH         BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x06UL)
 
 /* DM ioreq management */
 #define HC_ID_IOREQ_BASE            0x30UL
 #define HC_SET_IOREQ_BUFFER         BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x00UL)
 #define HC_NOTIFY_REQUEST_FINISH    BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x01UL)
+#define HC_SET_POSTED_IOREQ_BUFFER  BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x02UL)
+#define HC_SET_POSTED_MMIO_RANGE    BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x03UL)
+#define HC_SET_UPCALL_POLICY        BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x04UL)
+#define HC_SET_IOEVENTFD_PAGE       BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x05UL)
+#define HC_ASSIGN_IOEVENTFD         BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x06UL)
+#define HC_NOTIFY_REQUEST_FINISH_BATCH BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x07UL)
+#define HC_SET_CLOCK_PAGE           BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x08UL)
+#define HC_SET_TELEMETRY_PAGE       BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x09UL)
 
 /* Guest memory management */
 #define HC_ID_MEM_BASE              0x40UL
 #define HC_VM_GPA2HPA               BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x01UL)
 #define HC_VM_SET_MEMORY_REGIONS    BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x02UL)
 #define HC_VM_WRITE_PROTECT_PAGE    BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x03UL)
+#define HC_VM_DIRTY_LOG             BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x04UL)
+#define HC_VM_SET_COW               BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x05UL)
 
 /* PCI assignment*/
 #define HC_ID_PCI_BASE              0x50UL
@@ -63,12 +79,15 @@
 #define HC_VM_PCI_MSIX_REMAP        BASE_HC_ID(HC_ID, HC_ID_PCI_BASE + 0x02UL)
 #define HC_SET_PTDEV_INTR_INFO      BASE_HC_ID(HC_ID, HC_ID_PCI_BASE + 0x03UL)
 #define HC_RESET_PTDEV_INTR_INFO    BASE_HC_ID(HC_ID, HC_ID_PCI_BASE + 0x04UL)
+#define HC_ASSIGN_PTDEV_BATCH       BASE_HC_ID(HC_ID, HC_ID_PCI_BASE + 0x05UL)
 
 /* DEBUG */
 #define HC_ID_DBG_BASE              0x60UL
 #define HC_SETUP_SBUF               BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x00UL)
 #define HC_SETUP_HV_NPK_LOG         BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x01UL)
 #define HC_PROFILING_OPS            BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x02UL)
+#define HC_SET_TRACE_MASK           BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x03UL)
+#define HC_TRACE_AGGREGATE          BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x04UL)
 
 /* Trusty */
 #define HC_ID_TRUSTY_BASE           0x70UL
@@ -209,6 +228,76 @@ struct hv_npk_log_param {
 	uint64_t mmio_addr;
 } __aligned(8);
 
+/** Number of 64-bit words in the acrntrace event mask */
+#define TRACE_MASK_WORDS	6U
+/** Mask bit of the VM exit event with exit reason 0 */
+#define TRACE_MASK_VMEXIT	256U
+/** Mask bit shared by all the event ids without a bit of their own */
+#define TRACE_MASK_OTHER	320U
+
+/**
+ * @brief Event filter of acrntrace
+ *
+ * the parameter for HC_SET_TRACE_MASK hypercall. Bit n enables the events
+ * of id n for n < 256, bit TRACE_MASK_VMEXIT + r the VM exit event of exit
+ * reason r (r < 64), and bit TRACE_MASK_OTHER every other event id. The
+ * remaining bits are reserved. All events are enabled by default.
+ */
+struct trace_mask_param {
+	uint64_t mask[TRACE_MASK_WORDS];
+} __aligned(8);
+
+/**
+ * @brief Commands of the HC_TRACE_AGGREGATE hypercall
+ */
+enum trace_aggr_cmd_type {
+	/** Go back to recording raw events */
+	TRACE_AGGR_STOP = 0U,
+	/** Clear the statistics and aggregate the events instead of recording them */
+	TRACE_AGGR_START,
+	/** Copy the statistics of one pCPU to the struct trace_aggr at param */
+	TRACE_AGGR_SNAPSHOT,
+};
+
+/** Number of event counters: one per bit of the trace mask in use */
+#define TRACE_AGGR_COUNTERS	(TRACE_MASK_OTHER + 1U)
+/** Number of VM exit reasons with statistics of their own */
+#define TRACE_AGGR_EXIT_REASONS	64U
+/** Bucket n of the latency histograms counts [2^n, 2^(n+1)) cycles */
+#define TRACE_AGGR_HIST_BUCKETS	32U
+
+/**
+ * @brief Aggregated trace statistics of one pCPU
+ *
+ * Filled in by TRACE_AGGR_SNAPSHOT for the pcpu_id given by the SOS. The
+ * counters index like the trace mask bits; the VM exit latency is the time
+ * from the VM_EXIT event to the next VM_ENTER event. Only events enabled
+ * in the trace mask are accounted, and a snapshot taken while the pCPU is
+ * tracing may be off by the events in flight.
+ */
+struct trace_aggr {
+	/** pCPU to snapshot, from the SOS */
+	uint16_t pcpu_id;
+
+	/** Reserved */
+	uint16_t reserved[3];
+
+	/** TSC when the statistics were cleared */
+	uint64_t start_tsc;
+
+	/** TSC of the snapshot */
+	uint64_t tsc;
+
+	/** Number of events, by trace mask bit */
+	uint64_t count[TRACE_AGGR_COUNTERS];
+
+	/** Cycles spent handling each VM exit reason */
+	uint64_t exit_cycles[TRACE_AGGR_EXIT_REASONS];
+
+	/** log2 histogram of the time spent per VM exit, by exit reason */
+	uint64_t exit_hist[TRACE_AGGR_EXIT_REASONS][TRACE_AGGR_HIST_BUCKETS];
+} __aligned(8);
+
 /**
  * Gpa to hpa translation parameter, used for HC_VM_GPA2HPA hypercall
  */
@@ -265,6 +354,16 @@ struct hc_ptdev_irq {
 			uint32_t vector_cnt;
 		} msix;
 	} is;	/* irq source */
+
+#define PTDEV_COALESCE_MAX_US 10000U
+	/** interrupt coalescing, ignored for VM0 */
+	struct {
+		/** inject on this many interrupts, 0 for no limit */
+		uint32_t max_events;
+
+		/** inject at the latest this many us after the first, 0 for off */
+		uint32_t max_us;
+	} coalesce;
 } __aligned(8);
 
 /**
@@ -310,6 +409,40 @@ struct trusty_boot_param {
 	uint8_t rpmb_key[64];
 } __aligned(8);
 
+/* CPUID.40000001H:EAX, paravirtual features of ACRN */
+#define ACRN_CPUID_FEATURES		0x40000001U
+#define ACRN_FEATURE_STEAL_TIME		(1U << 0U)
+
+/*
+ * Guest physical address of the struct acrn_steal_time of the vCPU,
+ * 64 bytes aligned, bit 0 enables the updates.
+ */
+#define MSR_ACRN_STEAL_TIME		0x400000E0U
+#define ACRN_STEAL_TIME_ENABLE		(1UL << 0U)
+#define ACRN_STEAL_TIME_RSVD_MASK	0x3EUL
+
+/**
+ * @brief Run time accounting of a vCPU shared with the guest
+ *
+ * Updated by the hypervisor each time the vCPU is switched in. Times are
+ * in guest TSC cycles, see CPUID leaf 0x40000010 for the TSC frequency.
+ */
+struct acrn_steal_time {
+	/** time the vCPU was runnable but another one had its pCPU */
+	uint64_t steal;
+
+	/** time the vCPU was paused on I/O requests emulated by the DM */
+	uint64_t dm_wait;
+
+	/** odd while the hypervisor updates the fields */
+	uint32_t version;
+
+	/** reserved */
+	uint32_t flags;
+
+	uint8_t reserved[40];
+} __aligned(64);
+
 /**
  * @}
  */
@@ -322,7 +455,8 @@ enum profiling_cmd_type {
 	PROFILING_SET_CONTROL_SWITCH,
 	PROFILING_CONFIG_PMI,
 	PROFILING_CONFIG_VMSWITCH,
-	PROFILING_GET_PCPUID
+	PROFILING_GET_PCPUID,
+	PROFILING_GET_HCALL_LATENCY
 };
 
 #endif /* ACRN_HV_DEFS_H */
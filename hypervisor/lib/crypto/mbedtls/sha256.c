@@ -25,9 +25,19 @@
  *  http://csrc.nist.gov/publications/fips/fips180-2/fips180-2.pdf
  */
 
+#include <hypervisor.h>
 #include "md.h"
 #include "sha256.h"
 
+/*
+ * The SHA extensions take a whole 64-byte block per few instructions,
+ * pshufb/palignr come from SSSE3.
+ */
+static bool sha256_use_ni(void)
+{
+    return( cpu_has_cap( X86_FEATURE_SHA ) && cpu_has_cap( X86_FEATURE_SSSE3 ) );
+}
+
 /*
  * 32-bit integer manipulation macros (big endian)
  */
@@ -160,6 +170,12 @@ int32_t mbedtls_internal_sha256_process( mbedtls_sha256_context *ctx,
     uint32_t A[8];
     uint32_t i;
 
+    if( sha256_use_ni() )
+    {
+        sha256_ni_transform( ctx->state, data, 1 );
+        return( 0 );
+    }
+
     for( i = 0; i < 8; i++ )
         A[i] = ctx->state[i];
 
@@ -231,6 +247,13 @@ int32_t mbedtls_sha256_update_ret( mbedtls_sha256_context *ctx,
         left = 0;
     }
 
+    if( ( ilen >= 64 ) && sha256_use_ni() )
+    {
+        sha256_ni_transform( ctx->state, input, ilen / 64 );
+        input += ilen & ~(size_t)0x3F;
+        ilen  &= 0x3F;
+    }
+
     while( ilen >= 64 )
     {
         if( ( ret = mbedtls_internal_sha256_process( ctx, input ) ) != 0 )
@@ -143,4 +143,17 @@ int32_t mbedtls_sha256_ret( const uint8_t *input,
                         uint8_t output[32],
                         int32_t is224 );
 
+/**
+ * \brief          SHA-256 block transform using the SHA extensions.
+ *
+ *                 Only to be called when the CPU reports SHA and SSSE3.
+ *                 The XMM registers it uses are saved and restored.
+ *
+ * \param state    The intermediate digest state to update.
+ * \param data     The data blocks to process.
+ * \param blocks   The number of 64-byte blocks in data.
+ */
+void sha256_ni_transform( uint32_t state[8], const uint8_t *data,
+                          uint64_t blocks );
+
 #endif /* mbedtls_sha256.h */
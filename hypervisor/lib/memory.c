@@ -209,6 +209,77 @@ static void deallocate_mem(struct mem_pool *pool, const void *ptr)
 	}
 }
 
+/*
+ * Number of buffers of the allocation at ptr: all but the last one have
+ * their contiguity bit set.
+ */
+static uint32_t pool_buffs_of(const struct mem_pool *pool, const void *ptr)
+{
+	uint32_t buff_idx = (uint32_t)(((const char *)ptr - (const char *)pool->start_addr) / pool->buff_size);
+	uint32_t nr_buffs = 1U;
+
+	while ((buff_idx < pool->total_buffs) && ((pool->contiguity_bitmap[buff_idx / BITMAP_WORD_SIZE] &
+			(1U << (buff_idx % BITMAP_WORD_SIZE))) != 0U)) {
+		nr_buffs++;
+		buff_idx++;
+	}
+
+	return nr_buffs;
+}
+
+/*
+ * Small allocations are rounded up to a power-of-2 number of buffers and
+ * freed ones are kept on a free list of the pCPU for the next allocation
+ * of the class, so the common case takes neither the pool lock nor a
+ * bitmap search. Only interrupts are held off while a list is changed.
+ * The buffers on the lists stay allocated in the pool.
+ */
+static uint32_t malloc_size_class(uint32_t num_bytes)
+{
+	uint32_t class_idx = 0U;
+
+	while ((class_idx < MALLOC_SIZE_CLASSES) && ((MALLOC_HEAP_BUFF_SIZE << class_idx) < num_bytes)) {
+		class_idx++;
+	}
+
+	return class_idx;
+}
+
+static void *malloc_cache_pop(uint32_t class_idx)
+{
+	struct malloc_cache *cache = &per_cpu(malloc_cache, get_cpu_id());
+	uint64_t rflags;
+	void *memory;
+
+	CPU_INT_ALL_DISABLE(&rflags);
+	memory = cache->free_list[class_idx];
+	if (memory != NULL) {
+		cache->free_list[class_idx] = *(void **)memory;
+		cache->nr_free[class_idx]--;
+	}
+	CPU_INT_ALL_RESTORE(rflags);
+
+	return memory;
+}
+
+static bool malloc_cache_push(uint32_t class_idx, const void *ptr)
+{
+	struct malloc_cache *cache = &per_cpu(malloc_cache, get_cpu_id());
+	uint64_t rflags;
+	bool cached = false;
+
+	CPU_INT_ALL_DISABLE(&rflags);
+	if (cache->nr_free[class_idx] < MALLOC_CACHE_DEPTH) {
+		*(void **)ptr = cache->free_list[class_idx];
+		cache->free_list[class_idx] = (void *)ptr;
+		cache->nr_free[class_idx]++;
+		cached = true;
+	}
+	CPU_INT_ALL_RESTORE(rflags);
+
+	return cached;
+}
+
 /*
  * The return address will be PAGE_SIZE aligned if 'num_bytes' is greater
  * than PAGE_SIZE.
@@ -216,13 +287,20 @@ static void deallocate_mem(struct mem_pool *pool, const void *ptr)
 void *malloc(uint32_t num_bytes)
 {
 	void *memory = NULL;
+	uint32_t class_idx = malloc_size_class(num_bytes);
 
-	/* Check if bytes requested extend page-size */
-	if (num_bytes < PAGE_SIZE) {
+	if (class_idx < MALLOC_SIZE_CLASSES) {
+		memory = malloc_cache_pop(class_idx);
+		if (memory == NULL) {
+			memory = allocate_mem(&Memory_Pool, MALLOC_HEAP_BUFF_SIZE << class_idx);
+		}
+	} else if (num_bytes < PAGE_SIZE) {
 		/*
 		 * Request memory allocation from smaller segmented memory pool
 		 */
 		memory = allocate_mem(&Memory_Pool, num_bytes);
+	} else {
+		/* bytes requested extend page-size */
 	}
 
 	/* Check if memory allocation is successful */
@@ -254,8 +332,15 @@ void free(const void *ptr)
 	if ((Memory_Pool.start_addr < ptr) &&
 		(ptr < (Memory_Pool.start_addr +
 			(Memory_Pool.total_buffs * Memory_Pool.buff_size)))) {
-		/* Free buffer in 16-Bytes aligned Memory Pool */
-		deallocate_mem(&Memory_Pool, ptr);
+		uint32_t nr_buffs = pool_buffs_of(&Memory_Pool, ptr);
+		uint32_t class_idx = malloc_size_class(nr_buffs * MALLOC_HEAP_BUFF_SIZE);
+
+		/* only allocations of a size class have a power-of-2 size, up to the largest class */
+		if ((class_idx >= MALLOC_SIZE_CLASSES) || ((nr_buffs & (nr_buffs - 1U)) != 0U) ||
+				!malloc_cache_push(class_idx, ptr)) {
+			/* Free buffer in 16-Bytes aligned Memory Pool */
+			deallocate_mem(&Memory_Pool, ptr);
+		}
 	}
 }
 
@@ -298,6 +383,19 @@ void *memchr(const void *void_s, int32_t c, size_t n)
  *                          or else return null.
  *
  ***********************************************************************/
+/*
+ * With ERMS, REP MOVSB/STOSB copy in cache lines once past a start-up cost,
+ * which FSRM makes small enough for short strings too. Neither feature is
+ * known before the CPU capabilities are detected: the early callers take
+ * the quadword path.
+ */
+#define MEM_REP_STRING_MIN	256U
+
+static inline bool use_rep_string(size_t n)
+{
+	return ((n >= MEM_REP_STRING_MIN) && cpu_has_cap(X86_FEATURE_ERMS)) || cpu_has_cap(X86_FEATURE_FSRM);
+}
+
 void *memcpy_s(void *d, size_t dmax, const void *s, size_t slen_arg)
 {
 	uint8_t *dest8;
@@ -321,6 +419,15 @@ void *memcpy_s(void *d, size_t dmax, const void *s, size_t slen_arg)
 	dest8 = (uint8_t *)d;
 	src8 = (uint8_t *)s;
 
+	if (use_rep_string(slen)) {
+		asm volatile ("cld; rep; movsb"
+				: "+c"(slen), "+D"(dest8), "+S"(src8)
+				:
+				: "memory");
+
+		return d;
+	}
+
 	/* small data block */
 	if (slen < 8U) {
 		while (slen != 0U) {
@@ -378,6 +485,13 @@ void *memset(void *base, uint8_t v, size_t n)
 
 	if ((dest_p == NULL) || (n == 0U)) {
 		ret = NULL;
+	} else if (use_rep_string(n)) {
+		count = n;
+		asm volatile("cld ; rep ; stosb"
+					: "+c"(count), "+D"(dest_p)
+					: "a" (v)
+					: "memory");
+		ret = (void *)dest_p;
 	} else {
 		/* do the few bytes to get uint64_t alignment */
 		count = n;
@@ -6,6 +6,8 @@
 
 #include <hypervisor.h>
 #include <e820.h>
+#include <virtio_console.h>
+#include <ivshmem.h>
 
 #define NUM_USER_VMS    2U
 
@@ -21,8 +23,36 @@ uint16_t VM1_CPUS[VM1_NUM_CPUS] = {0U, 2U, 4U, 6U};
 /* Logical CPU IDs assigned with this VM */
 uint16_t VM2_CPUS[VM2_NUM_CPUS] = {7U, 5U, 3U, 1U};
 
+/* Virtio console BARs, in the PCI hole of both VMs */
+#define VCON_PIO_BASE	0x6000UL
+#define VCON_MMIO_BASE	0xDFFFF000UL
+
+/* The two ends of the virtio console between VM1 and VM2 */
+static struct vcon_port vcon_link[2] = {
+	{ .peer = &vcon_link[1] },
+	{ .peer = &vcon_link[0] },
+};
+
+/* Inter-VM shared memory of VM1 and VM2 */
+#define IVSHMEM_MEM_SIZE	0x100000UL
+#define IVSHMEM_REG_BASE	0xDFFFE000UL
+#define IVSHMEM_MSIX_BASE	0xDFFFD000UL
+#define IVSHMEM_MEM_BASE	0xDFE00000UL
+
+static uint8_t ivshmem_mem[IVSHMEM_MEM_SIZE] __aligned(PAGE_SIZE);
+
+static struct ivshmem_region ivshmem_region = {
+	.mem = ivshmem_mem,
+	.size = IVSHMEM_MEM_SIZE,
+};
+
+static struct ivshmem_dev ivshmem_devs[2] = {
+	{ .region = &ivshmem_region, .position = 0U },
+	{ .region = &ivshmem_region, .position = 1U },
+};
+
 static struct vpci_vdev_array vpci_vdev_array1 = {
-	.num_pci_vdev = 3,
+	.num_pci_vdev = 5,
 	.vpci_vdev_list = {
 		{/*vdev 0: hostbridge */
 			.vbdf.bits = {.b = 0x00U, .d = 0x00U, .f = 0x0U},
@@ -86,11 +116,52 @@ static struct vpci_vdev_array vpci_vdev_array1 = {
 				}
 			}
 		},
+
+		{/*vdev 3: virtio console linked to the other VM*/
+			.vbdf.bits = {.b = 0x00U, .d = 0x03U, .f = 0x0U},
+			.ops = &pci_ops_vdev_virtio_console,
+			.bar = {
+				[0] = {
+					.base = VCON_PIO_BASE,
+					.size = VCON_PIO_SIZE,
+					.type = PCIBAR_IO,
+				},
+				[1] = {
+					.base = VCON_MMIO_BASE,
+					.size = VCON_MMIO_SIZE,
+					.type = PCIBAR_MEM32,
+				}
+			},
+			.priv = &vcon_link[0],
+		},
+
+		{/*vdev 4: shared memory with the other VM*/
+			.vbdf.bits = {.b = 0x00U, .d = 0x04U, .f = 0x0U},
+			.ops = &pci_ops_vdev_ivshmem,
+			.bar = {
+				[0] = {
+					.base = IVSHMEM_REG_BASE,
+					.size = IVSHMEM_REG_SIZE,
+					.type = PCIBAR_MEM32,
+				},
+				[1] = {
+					.base = IVSHMEM_MSIX_BASE,
+					.size = IVSHMEM_MSIX_SIZE,
+					.type = PCIBAR_MEM32,
+				},
+				[2] = {
+					.base = IVSHMEM_MEM_BASE,
+					.size = IVSHMEM_MEM_SIZE,
+					.type = PCIBAR_MEM32,
+				}
+			},
+			.priv = &ivshmem_devs[0],
+		},
 	}
 };
 
 static struct vpci_vdev_array vpci_vdev_array2 = {
-	.num_pci_vdev = 3,
+	.num_pci_vdev = 5,
 
 	.vpci_vdev_list = {
 		{/*vdev 0: hostbridge*/
@@ -178,6 +249,46 @@ static struct vpci_vdev_array vpci_vdev_array2 = {
 
 		},
 
+		{/*vdev 3: virtio console linked to the other VM*/
+			.vbdf.bits = {.b = 0x00U, .d = 0x03U, .f = 0x0U},
+			.ops = &pci_ops_vdev_virtio_console,
+			.bar = {
+				[0] = {
+					.base = VCON_PIO_BASE,
+					.size = VCON_PIO_SIZE,
+					.type = PCIBAR_IO,
+				},
+				[1] = {
+					.base = VCON_MMIO_BASE,
+					.size = VCON_MMIO_SIZE,
+					.type = PCIBAR_MEM32,
+				}
+			},
+			.priv = &vcon_link[1],
+		},
+
+		{/*vdev 4: shared memory with the other VM*/
+			.vbdf.bits = {.b = 0x00U, .d = 0x04U, .f = 0x0U},
+			.ops = &pci_ops_vdev_ivshmem,
+			.bar = {
+				[0] = {
+					.base = IVSHMEM_REG_BASE,
+					.size = IVSHMEM_REG_SIZE,
+					.type = PCIBAR_MEM32,
+				},
+				[1] = {
+					.base = IVSHMEM_MSIX_BASE,
+					.size = IVSHMEM_MSIX_SIZE,
+					.type = PCIBAR_MEM32,
+				},
+				[2] = {
+					.base = IVSHMEM_MEM_BASE,
+					.size = IVSHMEM_MEM_SIZE,
+					.type = PCIBAR_MEM32,
+				}
+			},
+			.priv = &ivshmem_devs[1],
+		},
 	}
 };
 
@@ -0,0 +1,9 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <hypervisor.h>
+
+void hcall_stats_record(__unused uint64_t hypcall_id, __unused uint64_t cycles) {}
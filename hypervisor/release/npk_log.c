@@ -8,3 +8,5 @@
 
 void npk_log_setup(__unused struct hv_npk_log_param *param) {}
 void npk_log_write(__unused const char *buf, __unused size_t len) {}
+bool npk_trace_on(void) { return false; }
+void npk_trace_write(__unused const uint64_t *words, __unused uint32_t nr_words) {}
@@ -0,0 +1,9 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <hypervisor.h>
+
+void softirq_stats_record(__unused uint16_t pcpu_id, __unused uint16_t nr, __unused uint64_t cycles) {}
@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Guest side of the exit path microbenchmarks: times accesses that trap,
+ * either handled in the hypervisor or forwarded to the DM "bench" device,
+ * and prints a cycle histogram per path.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <getopt.h>
+#include <sys/io.h>
+#include <sys/mman.h>
+
+/* must match devicemodel/hw/pci/bench.c */
+#define BENCH_VENDOR_ID		0x8086
+#define BENCH_DEVICE_ID		0x86FF
+#define BENCH_MEM_BAR_SIZE	0x1000
+#define BENCH_REG_SCRATCH	0x00
+#define BENCH_REG_TSC_LO	0x10
+
+#define PCI_SYSFS		"/sys/bus/pci/devices"
+
+/* IMR of the master PIC, emulated in the hypervisor */
+#define PIC_MASTER_IMR		0x21
+
+#define DEFAULT_LOOPS		10000
+/* log2 buckets: the last one takes everything above 2^(NR_BUCKETS-1) */
+#define NR_BUCKETS		24
+
+struct bench_dev {
+	uint16_t io_base;
+	volatile uint8_t *mmio;
+};
+
+struct bench_path {
+	const char *name;
+	const char *desc;
+	int need_dev;
+	uint64_t (*run_one)(struct bench_dev *dev);
+};
+
+static inline uint64_t rdtsc_ordered(void)
+{
+	uint32_t lo, hi;
+
+	asm volatile("lfence; rdtsc; lfence" : "=a" (lo), "=d" (hi) :: "memory");
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static uint64_t run_cpuid(struct bench_dev *dev)
+{
+	uint32_t eax = 0, ebx, ecx = 0, edx;
+	uint64_t start = rdtsc_ordered();
+
+	asm volatile("cpuid" : "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx));
+	return rdtsc_ordered() - start;
+}
+
+static uint64_t run_pio_hv(struct bench_dev *dev)
+{
+	uint64_t start = rdtsc_ordered();
+
+	(void)inb(PIC_MASTER_IMR);
+	return rdtsc_ordered() - start;
+}
+
+static uint64_t run_pio_dm(struct bench_dev *dev)
+{
+	uint64_t start = rdtsc_ordered();
+
+	(void)inl(dev->io_base + BENCH_REG_SCRATCH);
+	return rdtsc_ordered() - start;
+}
+
+static uint64_t run_mmio_dm(struct bench_dev *dev)
+{
+	uint64_t start = rdtsc_ordered();
+
+	(void)*(volatile uint32_t *)(dev->mmio + BENCH_REG_SCRATCH);
+	return rdtsc_ordered() - start;
+}
+
+/*
+ * Half of the MMIO round trip: from the access to the DM handling it, as
+ * stamped by the device. Only meaningful while the guest TSC runs with no
+ * offset from the host one.
+ */
+static uint64_t run_mmio_dm_entry(struct bench_dev *dev)
+{
+	uint64_t start = rdtsc_ordered();
+	uint64_t dm_tsc = *(volatile uint64_t *)(dev->mmio + BENCH_REG_TSC_LO);
+
+	return dm_tsc - start;
+}
+
+static const struct bench_path paths[] = {
+	{ "cpuid", "CPUID, handled in the hypervisor", 0, run_cpuid },
+	{ "pio-hv", "PIO emulated in the hypervisor (vPIC IMR)", 0, run_pio_hv },
+	{ "pio-dm", "PIO forwarded to the DM bench device", 1, run_pio_dm },
+	{ "mmio-dm", "MMIO decoded by the hypervisor, handled in the DM", 1, run_mmio_dm },
+	{ "mmio-dm-entry", "MMIO access until the DM handles it", 1, run_mmio_dm_entry },
+};
+
+#define NR_PATHS	(sizeof(paths) / sizeof(paths[0]))
+
+static int read_sysfs_hex(const char *dev, const char *attr, unsigned long *val)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+	int ret;
+
+	snprintf(path, sizeof(path), PCI_SYSFS "/%s/%s", dev, attr);
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+	ret = (fscanf(fp, "%lx", val) == 1) ? 0 : -1;
+	fclose(fp);
+	return ret;
+}
+
+static int find_bench_dev(struct bench_dev *dev)
+{
+	DIR *dir;
+	struct dirent *d;
+	unsigned long vendor, device, start, end, flags;
+	char path[PATH_MAX];
+	FILE *fp;
+	int fd, found = 0;
+
+	dir = opendir(PCI_SYSFS);
+	if (dir == NULL) {
+		perror("opendir " PCI_SYSFS);
+		return -1;
+	}
+
+	while ((d = readdir(dir)) != NULL) {
+		if (d->d_name[0] == '.')
+			continue;
+		if (read_sysfs_hex(d->d_name, "vendor", &vendor) == 0 &&
+				read_sysfs_hex(d->d_name, "device", &device) == 0 &&
+				vendor == BENCH_VENDOR_ID && device == BENCH_DEVICE_ID) {
+			found = 1;
+			break;
+		}
+	}
+
+	if (!found) {
+		closedir(dir);
+		fprintf(stderr, "no bench device, start the DM with -s <slot>,bench\n");
+		return -1;
+	}
+
+	/* line 0 of "resource" is the PIO BAR */
+	snprintf(path, sizeof(path), PCI_SYSFS "/%s/resource", d->d_name);
+	fp = fopen(path, "r");
+	if (fp == NULL || fscanf(fp, "%lx %lx %lx", &start, &end, &flags) != 3) {
+		fprintf(stderr, "cannot read %s\n", path);
+		if (fp != NULL)
+			fclose(fp);
+		closedir(dir);
+		return -1;
+	}
+	fclose(fp);
+	dev->io_base = (uint16_t)start;
+
+	snprintf(path, sizeof(path), PCI_SYSFS "/%s/resource1", d->d_name);
+	closedir(dir);
+
+	fd = open(path, O_RDWR | O_SYNC);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	dev->mmio = mmap(NULL, BENCH_MEM_BAR_SIZE, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	close(fd);
+	if (dev->mmio == MAP_FAILED) {
+		perror("mmap bench BAR");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report(const struct bench_path *p, uint64_t *samples, int loops)
+{
+	uint64_t buckets[NR_BUCKETS] = { 0 };
+	uint64_t sum = 0, peak = 0;
+	int i, b, first = -1, last = 0;
+
+	qsort(samples, loops, sizeof(samples[0]), cmp_u64);
+
+	for (i = 0; i < loops; i++) {
+		sum += samples[i];
+		b = 63 - __builtin_clzll(samples[i] | 1);
+		if (b >= NR_BUCKETS)
+			b = NR_BUCKETS - 1;
+		buckets[b]++;
+	}
+
+	printf("%s: %s\n", p->name, p->desc);
+	printf("  cycles min %lu p50 %lu avg %lu p99 %lu max %lu\n",
+		samples[0], samples[loops / 2], sum / loops,
+		samples[(uint64_t)loops * 99 / 100], samples[loops - 1]);
+
+	for (b = 0; b < NR_BUCKETS; b++) {
+		if (buckets[b] == 0)
+			continue;
+		if (first < 0)
+			first = b;
+		last = b;
+		if (buckets[b] > peak)
+			peak = buckets[b];
+	}
+
+	for (b = first; b <= last; b++) {
+		printf("  [%8lu, %8lu) %8lu |", 1UL << b, 1UL << (b + 1), buckets[b]);
+		for (i = 0; i < (int)(buckets[b] * 50 / peak); i++)
+			putchar('#');
+		putchar('\n');
+	}
+}
+
+static void usage(const char *prog)
+{
+	unsigned int i;
+
+	printf("Usage: %s [-n loops] [-w warmup] [path...]\n", prog);
+	printf("  -n loops   timed accesses per path, %d by default\n", DEFAULT_LOOPS);
+	printf("  -w warmup  untimed accesses before, loops / 10 by default\n");
+	printf("paths (all by default):\n");
+	for (i = 0; i < NR_PATHS; i++)
+		printf("  %-14s %s\n", paths[i].name, paths[i].desc);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_dev dev = { 0 };
+	int selected[NR_PATHS] = { 0 };
+	int loops = DEFAULT_LOOPS, warmup = -1;
+	int opt, i, any = 0, need_dev = 0, need_io = 0;
+	unsigned int j;
+	uint64_t *samples;
+
+	while ((opt = getopt(argc, argv, "n:w:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			loops = atoi(optarg);
+			break;
+		case 'w':
+			warmup = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return (opt == 'h') ? 0 : 1;
+		}
+	}
+
+	if (loops <= 0) {
+		fprintf(stderr, "loops must be positive\n");
+		return 1;
+	}
+	if (warmup < 0)
+		warmup = loops / 10;
+
+	for (i = optind; i < argc; i++) {
+		for (j = 0; j < NR_PATHS; j++) {
+			if (strcmp(argv[i], paths[j].name) == 0)
+				break;
+		}
+		if (j == NR_PATHS) {
+			fprintf(stderr, "unknown path %s\n", argv[i]);
+			usage(argv[0]);
+			return 1;
+		}
+		selected[j] = 1;
+		any = 1;
+	}
+
+	for (j = 0; j < NR_PATHS; j++) {
+		if (!any)
+			selected[j] = 1;
+		if (selected[j]) {
+			need_dev |= paths[j].need_dev;
+			need_io |= (paths[j].run_one == run_pio_hv) ||
+				(paths[j].run_one == run_pio_dm);
+		}
+	}
+
+	if (need_io && iopl(3) < 0) {
+		perror("iopl");
+		return 1;
+	}
+	if (need_dev && find_bench_dev(&dev) < 0)
+		return 1;
+
+	samples = calloc(loops, sizeof(samples[0]));
+	if (samples == NULL) {
+		perror("calloc");
+		return 1;
+	}
+
+	for (j = 0; j < NR_PATHS; j++) {
+		if (!selected[j])
+			continue;
+		for (i = 0; i < warmup; i++)
+			(void)paths[j].run_one(&dev);
+		for (i = 0; i < loops; i++)
+			samples[i] = paths[j].run_one(&dev);
+		report(&paths[j], samples, loops);
+	}
+
+	free(samples);
+	return 0;
+}
@@ -28,7 +28,7 @@
  * is supoorted at this moment. To support multiple Android Guest OS, this
  * path should be moved to structure vm_t and configurable.
  */
-static const char *android_img = "/data/android/android.img";
+const char *android_img = "/data/android/android.img";
 static const char *android_histpath = "logs/history_event";
 char *loop_dev;
 
@@ -112,6 +112,15 @@ static char *next_vm_event(const char *cursor, const char *data,
 #define VMRECORD_TAG_NOT_FOUND		"NOT_FOUND"
 #define VMRECORD_TAG_MISS_LOG		"MISS_LOGS"
 #define VMRECORD_TAG_SUCCESS		"         "
+/* log_vmrecordid is rotated past this size, once no record is waiting */
+#define VMRECORD_ROTATE_SIZE		(256 * KB)
+
+/*
+ * Offset in log_vmrecordid of the oldest record still waiting to sync, per
+ * sender. The records before it are all done, so stage2 starts from there
+ * rather than scanning the whole file each refresh.
+ */
+static size_t vmrecord_waiting[SENDER_MAX];
 static int generate_log_vmrecord(const char *path)
 {
 	const char * const head =
@@ -350,6 +359,7 @@ static void sync_lines_stage2(const struct sender_t *sender,
 {
 	struct mm_file_t *recos;
 	char *record;
+	char *first_waiting;
 	size_t recolen;
 	int sid;
 
@@ -363,13 +373,19 @@ static void sync_lines_stage2(const struct sender_t *sender,
 						       strerror(errno));
 		return;
 	}
-	if (!recos->size ||
-	    mm_count_lines(recos) < VMRECORD_HEAD_LINES) {
+	/* a file smaller than the offset was generated again */
+	if (vmrecord_waiting[sid] > (size_t)recos->size)
+		vmrecord_waiting[sid] = 0;
+	if (!recos->size || (!vmrecord_waiting[sid] &&
+	    mm_count_lines(recos) < VMRECORD_HEAD_LINES)) {
 		LOGE("(%s) invalid\n", sender->log_vmrecordid);
 		goto out;
 	}
 
-	for (record = next_record(recos, recos->begin, &recolen); record;
+	first_waiting = NULL;
+	for (record = next_record(recos, recos->begin + vmrecord_waiting[sid],
+				  &recolen);
+	     record;
 	     record = next_record(recos, record + recolen, &recolen)) {
 		const char * const record_fmt =
 			VM_NAME_FMT ANDROID_KEY_FMT IGN_RESTS;
@@ -386,12 +402,17 @@ static void sync_lines_stage2(const struct sender_t *sender,
 				  vm_name, sizeof(vm_name),
 				  vmkey, sizeof(vmkey)) != 2) {
 			LOGE("failed to parse vm record\n");
+			if (!first_waiting)
+				first_waiting = record;
 			continue;
 		}
 
 		vm = get_vm_by_name((const char *)vm_name);
-		if (!vm || !vm->history_data)
+		if (!vm || !vm->history_data) {
+			if (!first_waiting)
+				first_waiting = record;
 			continue;
+		}
 
 		hist_line = get_line(vmkey, strnlen(vmkey, sizeof(vmkey)),
 				     vm->history_data, vm->history_size[sid],
@@ -407,12 +428,73 @@ static void sync_lines_stage2(const struct sender_t *sender,
 			refresh_key_synced_stage2(record, recolen, SUCCESS);
 		else if (res == VMEVT_MISSLOG)
 			refresh_key_synced_stage2(record, recolen, MISS_LOG);
+		else if (!first_waiting)
+			first_waiting = record;
 	}
 
+	vmrecord_waiting[sid] = first_waiting ?
+				(size_t)(first_waiting - recos->begin) :
+				(size_t)recos->size;
 out:
 	unmap_file(recos);
 }
 
+/*
+ * Once all its records are synced, start log_vmrecordid over from the last
+ * record of each VM, which is all get_last_line_synced() needs after a
+ * restart. The new file is renamed over the old one, so that a crash in
+ * the middle leaves either of them.
+ */
+static void rotate_vmrecord(const struct sender_t *sender)
+{
+	char record[64];
+	char *tmp;
+	struct vm_t *vm;
+	int sid;
+	int id;
+	int len;
+
+	sid = sender_id(sender);
+	if (sid == -1 || vmrecord_waiting[sid] < VMRECORD_ROTATE_SIZE)
+		return;
+	if (get_file_size(sender->log_vmrecordid) !=
+	    (ssize_t)vmrecord_waiting[sid])
+		return;
+
+	if (asprintf(&tmp, "%s.tmp", sender->log_vmrecordid) == -1) {
+		LOGE("out of memory\n");
+		return;
+	}
+	if (generate_log_vmrecord(tmp) < 0)
+		goto fail;
+
+	for_each_vm(id, vm, conf) {
+		if (!vm || !vm->last_synced_line_key[sid][0])
+			continue;
+
+		len = snprintf(record, sizeof(record), "%s %s %s\n",
+			       vm->name, vm->last_synced_line_key[sid],
+			       VMRECORD_TAG_SUCCESS);
+		if (s_not_expect(len, sizeof(record)) ||
+		    append_file(tmp, record, len) < 0)
+			goto fail;
+	}
+
+	if (rename(tmp, sender->log_vmrecordid) == -1) {
+		LOGE("failed to rotate (%s), error (%s)\n",
+		     sender->log_vmrecordid, strerror(errno));
+		goto fail;
+	}
+	LOGI("rotated (%s)\n", sender->log_vmrecordid);
+	vmrecord_waiting[sid] = 0;
+	free(tmp);
+	return;
+
+fail:
+	remove(tmp);
+	free(tmp);
+}
+
 /* This function only for initialization */
 static void get_last_line_synced(const struct sender_t *sender)
 {
@@ -549,6 +631,7 @@ void refresh_vm_history(const struct sender_t *sender,
 	get_vms_history(sender);
 
 	sync_lines_stage2(sender, fn);
+	rotate_vmrecord(sender);
 	sync_lines_stage1(sender);
 	for_each_vm(id, vm, conf) {
 		if (!vm)
@@ -22,13 +22,18 @@
 #include "channels.h"
 #include "startupreason.h"
 #include "probeutils.h"
+#include "android_events.h"
 #include "log_sys.h"
 
 #define POLLING_TIMER_SIG 0xCEAC
+/* seconds from a write of the UOS image to the sync, to batch its writes */
+#define VM_SYNC_DELAY 2
 
 static void channel_oneshot(struct channel_t *cnl);
 static void channel_polling(struct channel_t *cnl);
 static void channel_inotify(struct channel_t *cnl);
+static int receive_vm_img_events(struct channel_t *channel);
+static int receive_inotify_events(struct channel_t *channel);
 
 /**
  * @brief structure containing implementation of each channel.
@@ -37,9 +42,9 @@ static void channel_inotify(struct channel_t *cnl);
  * called by main thread in order.
  */
 static struct channel_t channels[] = {
-	{"oneshot", -1, channel_oneshot},
-	{"polling", -1, channel_polling},
-	{"inotify", -1, channel_inotify},
+	{"oneshot", -1, channel_oneshot, NULL},
+	{"polling", -1, channel_polling, receive_vm_img_events},
+	{"inotify", -1, channel_inotify, receive_inotify_events},
 };
 
 #define for_each_channel(i, channel) \
@@ -165,14 +170,31 @@ static void channel_oneshot(struct channel_t *cnl)
 	}
 }
 
+/*
+ * The VM events are synced from the history in the UOS image. Instead of
+ * reading it every interval, the image is watched: its first write arms a
+ * one-shot sync VM_SYNC_DELAY later, or at the end of the interval from the
+ * last sync, and the watch is dropped until that sync. An idle UOS then
+ * costs no wakeup, and a busy one a single wakeup per interval. Without
+ * the image to watch, the job falls back to a periodic timer.
+ */
 /* TODO: implement multiple polling jobs */
 static struct polling_job_t {
 	timer_t timerid;
 	uint32_t timer_val;
 
+	int ifd;		/* inotify fd of the channel, -1 if periodic */
+	int wd;			/* watch of the image, -1 while the sync is armed */
+	struct timespec last;	/* CLOCK_MONOTONIC of the last sync */
+	pthread_mutex_t mtx;
+
 	enum event_type_t type;
 	void (*fn)(union sigval v);
-} vm_job;
+} vm_job = {
+	.ifd = -1,
+	.wd = -1,
+	.mtx = PTHREAD_MUTEX_INITIALIZER,
+};
 
 /**
  * Callback thread of a polling job.
@@ -182,13 +204,25 @@ static void polling_vm(union sigval v __attribute__((unused)))
 
 	struct event_t *e = create_event(VM, "polling", NULL, 0, NULL, 0);
 
+	pthread_mutex_lock(&vm_job.mtx);
+	clock_gettime(CLOCK_MONOTONIC, &vm_job.last);
+	if (vm_job.ifd >= 0) {
+		/* watch again, for the writes after this sync */
+		vm_job.wd = inotify_add_watch(vm_job.ifd, android_img,
+					      VM_IMG_MASK);
+		if (vm_job.wd < 0)
+			LOGE("failed to watch (%s) again, error (%s)\n",
+			     android_img, strerror(errno));
+	}
+	pthread_mutex_unlock(&vm_job.mtx);
+
 	if (e)
 		event_enqueue(e);
 }
 
 /**
  * Setup a timer with specific loop time. The callback fn will be performed
- * after timer expire.
+ * after timer expire. The timer is periodic, unless the image is watched.
  *
  * @param pjob Polling_job filled by caller.
  *
@@ -211,7 +245,8 @@ static int create_polling_job(struct polling_job_t *pjob)
 
 	memset(&timer_val, 0, sizeof(struct itimerspec));
 	timer_val.it_value.tv_sec = pjob->timer_val;
-	timer_val.it_interval.tv_sec = pjob->timer_val;
+	if (pjob->ifd < 0)
+		timer_val.it_interval.tv_sec = pjob->timer_val;
 
 	if (timer_settime(pjob->timerid, 0, &timer_val, NULL) == -1) {
 		LOGE("timer_settime failed.\n");
@@ -222,6 +257,104 @@ static int create_polling_job(struct polling_job_t *pjob)
 	return 0;
 }
 
+/**
+ * The watched image is gone (deleted or replaced), sync the VM events
+ * periodically from now on.
+ *
+ * @param pjob Polling_job, locked by the caller.
+ */
+static void polling_job_periodic(struct polling_job_t *pjob)
+{
+	struct itimerspec timer_val;
+
+	LOGW("(%s) isn't watched anymore, polling it every %us\n",
+	     android_img, pjob->timer_val);
+	close(pjob->ifd);
+	pjob->ifd = -1;
+	pjob->wd = -1;
+
+	memset(&timer_val, 0, sizeof(struct itimerspec));
+	timer_val.it_value.tv_sec = pjob->timer_val;
+	timer_val.it_interval.tv_sec = pjob->timer_val;
+	if (timer_settime(pjob->timerid, 0, &timer_val, NULL) == -1)
+		LOGE("timer_settime failed.\n");
+}
+
+/**
+ * Arm the one-shot sync of a watched image that was written.
+ *
+ * @param pjob Polling_job, locked by the caller.
+ */
+static void polling_job_arm(struct polling_job_t *pjob)
+{
+	struct itimerspec timer_val;
+	struct timespec now;
+	long delay = VM_SYNC_DELAY;
+	long since;
+
+	/* stop watching, the next sync covers any write from now on */
+	inotify_rm_watch(pjob->ifd, pjob->wd);
+	pjob->wd = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	since = now.tv_sec - pjob->last.tv_sec;
+	if (since + delay < (long)pjob->timer_val)
+		delay = (long)pjob->timer_val - since;
+
+	memset(&timer_val, 0, sizeof(struct itimerspec));
+	timer_val.it_value.tv_sec = delay;
+	if (timer_settime(pjob->timerid, 0, &timer_val, NULL) == -1) {
+		LOGE("timer_settime failed.\n");
+		polling_job_periodic(pjob);
+	}
+}
+
+/**
+ * Handle the inotify events of the watched UOS image.
+ *
+ * @param channel Channel structure of polling.
+ *
+ * @return 0 if successful, or -1 if not.
+ */
+static int receive_vm_img_events(struct channel_t *channel)
+{
+	char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ievent;
+	char *p;
+	int len;
+
+	pthread_mutex_lock(&vm_job.mtx);
+	while (vm_job.ifd >= 0) {
+		len = read(channel->fd, buf, sizeof(buf));
+		if (len <= 0) {
+			if (len < 0 && errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (p = buf; p < buf + len;
+		     p += sizeof(struct inotify_event) + ievent->len) {
+			ievent = (const struct inotify_event *)p;
+			/* events of a watch removed by polling_job_arm() */
+			if (ievent->wd != vm_job.wd)
+				continue;
+
+			if (ievent->mask & (IN_DELETE_SELF | IN_MOVE_SELF |
+					    IN_IGNORED)) {
+				polling_job_periodic(&vm_job);
+				break;
+			}
+			polling_job_arm(&vm_job);
+		}
+	}
+	if (vm_job.ifd < 0)
+		channel->fd = -1;
+	pthread_mutex_unlock(&vm_job.mtx);
+
+	return 0;
+}
+
 /**
  * Setup polling jobs. These jobs running with fixed time interval.
  *
@@ -263,6 +396,17 @@ static void channel_polling(struct channel_t *cnl)
 	LOGD("start polling job with %ds\n", vm_job.timer_val);
 	vm_job.fn = polling_vm;
 	vm_job.type = VM;
+
+	/* the first sync is at the end of the interval, armed */
+	clock_gettime(CLOCK_MONOTONIC, &vm_job.last);
+	if (vm_job.timer_val && file_exists(android_img)) {
+		vm_job.ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (vm_job.ifd < 0)
+			LOGW("inotify init fail, %s\n", strerror(errno));
+	}
+	if (vm_job.ifd >= 0)
+		cnl->fd = vm_job.ifd;
+
 	if (create_polling_job(&vm_job) == -1) {
 		LOGE("failed to create polling job\n, error (%s)\n",
 		     strerror(errno));
@@ -479,10 +623,8 @@ static void *wait_events(void *unused __attribute__((unused)))
 						     channel->name);
 						continue;
 					}
-					/* Until now, we only have
-					 * inotify channel to wait
-					 */
-					receive_inotify_events(channel);
+					if (channel->event_fn)
+						channel->event_fn(channel);
 				}
 		}
 	}
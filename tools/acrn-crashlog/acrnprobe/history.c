@@ -27,6 +27,7 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "fsutils.h"
 #include "load_conf.h"
 #include "history.h"
@@ -50,6 +51,8 @@ struct history_entry {
 
 char *history_file;
 static int current_lines;
+/* the logs of an event are collected by several threads, see sender.c */
+static pthread_mutex_t history_mtx = PTHREAD_MUTEX_INITIALIZER;
 
 static int entry_to_history_line(struct history_entry *entry,
 				char *newline, size_t size)
@@ -142,6 +145,7 @@ void hist_raise_event(const char *event, const char *type, const char *log,
 		     &maxlines) == -1)
 		return;
 
+	pthread_mutex_lock(&history_mtx);
 	if (++current_lines >= maxlines) {
 		LOGW("lines of (%s) meet quota %d, backup... Pls clean!\n",
 		     history_file, maxlines);
@@ -149,17 +153,18 @@ void hist_raise_event(const char *event, const char *type, const char *log,
 	}
 
 	if (get_current_time_long(eventtime) <= 0)
-		return;
+		goto unlock;
 
 	entry.eventtime = eventtime;
 	if (entry_to_history_line(&entry, line, sizeof(line)) == -1) {
 		LOGE("failed to generate new line\n");
-		return;
+		goto unlock;
 	}
-	if (append_file(history_file, line, strnlen(line, MAXLINESIZE)) <= 0) {
+	if (append_file(history_file, line, strnlen(line, MAXLINESIZE)) <= 0)
 		LOGE("failed to append (%s) to (%s)\n", line, history_file);
-		return;
-	}
+
+unlock:
+	pthread_mutex_unlock(&history_mtx);
 }
 
 void hist_raise_uptime(char *lastuptime)
@@ -8,6 +8,7 @@
 #include "load_conf.h"
 
 extern char *loop_dev;
+extern const char *android_img;
 
 #define VMEVT_HANDLED 0
 #define VMEVT_DEFER -1
@@ -8,6 +8,7 @@
 
 #define BASE_DIR_MASK		(IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
 #define UPTIME_MASK		IN_CLOSE_WRITE
+#define VM_IMG_MASK		(IN_MODIFY | IN_DELETE_SELF | IN_MOVE_SELF)
 #define MAXEVENTS 15
 #define HEART_RATE (6 * 1000) /* ms */
 
@@ -15,6 +16,8 @@ struct channel_t {
 	char *name;
 	int fd;
 	void (*channel_fn)(struct channel_t *);
+	/* handle the events of fd, for the channels which set it */
+	int (*event_fn)(struct channel_t *);
 };
 extern int create_detached_thread(pthread_t *pid,
 				void *(*fn)(void *), void *arg);
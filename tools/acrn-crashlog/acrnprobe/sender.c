@@ -12,6 +12,7 @@
 #include <sys/wait.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <pthread.h>
 #include "fsutils.h"
 #include "strutils.h"
 #include "cmdutils.h"
@@ -25,6 +26,11 @@
 #include "log_sys.h"
 #include "loop.h"
 
+/* threads collecting the logs of one crashlog event */
+#define LOG_COLLECT_WORKERS	4
+/* bandwidth the copies of the logs may take, all threads together */
+#define LOG_COPY_RATE		(32 * MB)
+
 #ifdef HAVE_TELEMETRICS_CLIENT
 #include "telemetry.h"
 
@@ -340,6 +346,74 @@ static void crashlog_get_log(struct log_t *log, void *data)
 		LOGW("get (%s) spend %ds\n", log->name, spent);
 }
 
+struct log_collect_t {
+	struct log_t **log;	/* log[] of the crash or info */
+	void *data;
+	int next;		/* log[] index the next worker takes */
+	pthread_mutex_t mtx;
+};
+
+static void *log_collect_worker(void *arg)
+{
+	struct log_collect_t *lc = (struct log_collect_t *)arg;
+	struct log_t *log;
+	int id;
+
+	while (1) {
+		pthread_mutex_lock(&lc->mtx);
+		id = lc->next;
+		if (id < LOG_MAX && lc->log[id])
+			lc->next++;
+		pthread_mutex_unlock(&lc->mtx);
+
+		if (id >= LOG_MAX || !(log = lc->log[id]))
+			break;
+		log->get(log, lc->data);
+	}
+
+	return NULL;
+}
+
+/**
+ * Collect the logs of a crash or an info into the same dir, the logs being
+ * independent files they are gathered in parallel by a few workers.
+ *
+ * @param log log[] of the crash or info.
+ * @param data The dir passed to log->get.
+ */
+static void crashlog_collect_logs(struct log_t **log, void *data)
+{
+	struct log_collect_t lc = {
+		.log = log,
+		.data = data,
+		.next = 0,
+		.mtx = PTHREAD_MUTEX_INITIALIZER
+	};
+	pthread_t tid[LOG_COLLECT_WORKERS - 1];
+	int count = 0;
+	int started;
+	int i;
+
+	while (count < LOG_MAX && log[count])
+		count++;
+
+	/* the caller is one of the workers */
+	for (started = 0; started < MIN(count, LOG_COLLECT_WORKERS) - 1;
+	     started++) {
+		if (pthread_create(&tid[started], NULL, log_collect_worker,
+				   &lc)) {
+			LOGW("failed to create log worker (%s)\n",
+			     strerror(errno));
+			break;
+		}
+	}
+
+	log_collect_worker(&lc);
+
+	for (i = 0; i < started; i++)
+		pthread_join(tid[i], NULL);
+}
+
 #ifdef HAVE_TELEMETRICS_CLIENT
 static void telemd_send_crash(struct event_t *e)
 {
@@ -786,9 +860,6 @@ static void crashlog_send_crash(struct event_t *e)
 	}
 
 	if (to_collect_logs(crash) || !strcmp(e->channel, "inotify")) {
-		struct log_t *log;
-		int id;
-
 		e->dir = generate_log_dir(MODE_CRASH, key);
 		if (e->dir == NULL) {
 			LOGE("failed to generate crashlog dir\n");
@@ -798,12 +869,7 @@ static void crashlog_send_crash(struct event_t *e)
 		generate_crashfile(e->dir, "CRASH", 5, key, SHORT_KEY_LENGTH,
 				   crash->name, crash->name_len,
 				   data0, d0len, data1, d1len, data2, d2len);
-		for_each_log_collect(id, log, crash) {
-			if (!log)
-				continue;
-
-			log->get(log, (void *)e->dir);
-		}
+		crashlog_collect_logs(crash->log, (void *)e->dir);
 
 	}
 
@@ -846,9 +912,7 @@ free_data:
 
 static void crashlog_send_info(struct event_t *e)
 {
-	int id;
 	struct info_t *info = (struct info_t *)e->private;
-	struct log_t *log;
 	char *key = generate_event_id("INFO", 4, (const char *)info->name,
 				      info->name_len, KEY_SHORT);
 
@@ -865,11 +929,7 @@ static void crashlog_send_info(struct event_t *e)
 			goto free_key;
 		}
 
-		for_each_log_collect(id, log, info) {
-			if (!log)
-				continue;
-			log->get(log, (void *)e->dir);
-		}
+		crashlog_collect_logs(info->log, (void *)e->dir);
 	}
 
 	hist_raise_event("INFO", info->name, e->dir, "", key);
@@ -1112,6 +1172,7 @@ int init_sender(void)
 			ret = prepare_history();
 			if (ret)
 				return -1;
+			set_copy_rate_limit(LOG_COPY_RATE);
 #ifdef HAVE_TELEMETRICS_CLIENT
 		} else if (!strcmp(sender->name, "telemd")) {
 			sender->send = telemd_send;
@@ -31,8 +31,12 @@
 #include <sys/sendfile.h>
 #include <sys/vfs.h>
 #include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 #include <stdlib.h>
 #include <ftw.h>
+#include <time.h>
+#include <pthread.h>
 #include "fsutils.h"
 #include "cmdutils.h"
 #include "strutils.h"
@@ -221,9 +225,99 @@ void unmap_file(struct mm_file_t *mfile)
 	free(mfile);
 }
 
+/* Bytes per second do_copy_tail() may copy, in all threads. 0: no limit */
+static size_t copy_rate_limit;
+static pthread_mutex_t copy_rate_mtx = PTHREAD_MUTEX_INITIALIZER;
+/* When the data copied so far is paid for, in ns of CLOCK_MONOTONIC */
+static unsigned long long copy_rate_next;
+
+/**
+ * Limit the rate of the copies of do_copy_tail(), so that collecting large
+ * logs doesn't starve the other I/O of the system. Copies sharing the
+ * storage with reflinks are not accounted for.
+ *
+ * @param bytes_per_sec Rate of all the copies together, 0 means no limit.
+ */
+void set_copy_rate_limit(size_t bytes_per_sec)
+{
+	pthread_mutex_lock(&copy_rate_mtx);
+	copy_rate_limit = bytes_per_sec;
+	copy_rate_next = 0;
+	pthread_mutex_unlock(&copy_rate_mtx);
+}
+
+/* Account for len bytes the caller is about to copy, and wait their turn */
+static void copy_throttle(size_t len)
+{
+	struct timespec ts;
+	unsigned long long now, wait = 0;
+
+	pthread_mutex_lock(&copy_rate_mtx);
+	if (copy_rate_limit) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		if (copy_rate_next < now)
+			copy_rate_next = now;
+		wait = copy_rate_next - now;
+		copy_rate_next += len * 1000000000ULL / copy_rate_limit;
+	}
+	pthread_mutex_unlock(&copy_rate_mtx);
+
+	if (wait) {
+		ts.tv_sec = wait / 1000000000ULL;
+		ts.tv_nsec = wait % 1000000000ULL;
+		while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+			;
+	}
+}
+
+/*
+ * Copy len bytes from offset of fsrc to fdest, in chunks paced by
+ * copy_throttle(). copy_file_range(2) keeps the data in the kernel and lets
+ * the filesystem share or offload it, sendfile(2) is the fallback when it
+ * can't be used between these files.
+ */
+static ssize_t copy_range(int fdest, int fsrc, off_t offset, size_t len)
+{
+	size_t done = 0, chunk;
+	ssize_t ret;
+	int use_cfr = 1;
+
+	while (done < len) {
+		chunk = MIN(len - done, (size_t)CPCHUNKSIZE);
+		copy_throttle(chunk);
+
+		if (use_cfr) {
+			ret = copy_file_range(fsrc, &offset, fdest, NULL,
+					      chunk, 0);
+			if (ret == -1 && (errno == EXDEV || errno == ENOSYS ||
+			    errno == EINVAL || errno == EOPNOTSUPP) && !done) {
+				use_cfr = 0;
+				ret = sendfile(fdest, fsrc, &offset, chunk);
+			}
+		} else {
+			ret = sendfile(fdest, fsrc, &offset, chunk);
+		}
+
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (ret == 0)
+			break;
+		done += ret;
+	}
+
+	return done;
+}
+
 /**
  * Copy the tail data from a file which supports mmap(2)-like operations
  * to new file.
+ * The entire file is first tried as a reflink, which shares the data of the
+ * files when the filesystem supports it; the copies are rate limited by
+ * set_copy_rate_limit().
  *
  * @param src File path to copy, this file supports mmap(2)-like operations
  *            (i.e., it cannot be a socket).
@@ -263,12 +357,17 @@ int do_copy_tail(const char *src, const char *dest, int limit)
 	if (info.st_size > limit)
 		offset = info.st_size - limit;
 
-	rc = sendfile(fdest, fsrc, &offset, limit);
+	if (!offset && ioctl(fdest, FICLONE, fsrc) == 0)
+		rc = limit;
+	else
+		rc = copy_range(fdest, fsrc, offset, limit);
+	if (rc == -1)
+		rc = -errno;
 
 	close(fsrc);
 	close(fdest);
 
-	return rc == -1 ? -errno : rc;
+	return rc;
 }
 
 /**
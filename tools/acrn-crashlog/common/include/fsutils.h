@@ -34,6 +34,7 @@
 #define MB                      (KB * KB)
 #define MAXLINESIZE             (PATH_MAX + 128)
 #define CPBUFFERSIZE            (4 * KB)
+#define CPCHUNKSIZE             (1 * MB)
 #define PAGE_SIZE               (4 * KB)
 
 struct mm_file_t {
@@ -81,6 +82,7 @@ int remove_r(const char *dir);
 int mm_count_lines(struct mm_file_t *mfile);
 struct mm_file_t *mmap_file(const char *path);
 void unmap_file(struct mm_file_t *mfile);
+void set_copy_rate_limit(size_t bytes_per_sec);
 int do_copy_tail(const char *src, const char *dest, int limit);
 int do_mv(char *src, char *dest);
 ssize_t append_file(const char *filename, const char *text, size_t tlen);
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Guest side of the interrupt latency measurements. Wakes up either on
+ * its own timer, as cyclictest does, or on the interrupts of a UIO
+ * device, such as a passthrough device bound to uio_pci_generic. The
+ * summary and the histogram are printed in the format of cyclictest,
+ * and the TSC of each wakeup can be logged for irq_analyze.py to join
+ * with the hypervisor trace.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#define DEFAULT_INTERVAL	1000	/* us */
+#define NSEC_PER_SEC		1000000000L
+#define NSEC_PER_USEC		1000L
+
+static volatile sig_atomic_t stop;
+
+struct probe_stats {
+	long min, max, act;
+	uint64_t sum;
+	uint64_t cycles;
+	uint64_t overflows;
+	uint64_t *hist;		/* us, hist_max buckets */
+	int hist_max;
+};
+
+static inline uint64_t rdtsc_ordered(void)
+{
+	uint32_t lo, hi;
+
+	asm volatile("lfence; rdtsc" : "=a" (lo), "=d" (hi) :: "memory");
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static void sighand(int sig)
+{
+	stop = 1;
+}
+
+static inline int64_t ts_diff_ns(const struct timespec *a,
+		const struct timespec *b)
+{
+	return (int64_t)(a->tv_sec - b->tv_sec) * NSEC_PER_SEC +
+		(a->tv_nsec - b->tv_nsec);
+}
+
+static inline void ts_add_ns(struct timespec *ts, long ns)
+{
+	ts->tv_nsec += ns;
+	while (ts->tv_nsec >= NSEC_PER_SEC) {
+		ts->tv_nsec -= NSEC_PER_SEC;
+		ts->tv_sec++;
+	}
+}
+
+static void account(struct probe_stats *st, long us)
+{
+	st->act = us;
+	if (st->cycles == 0 || us < st->min)
+		st->min = us;
+	if (us > st->max)
+		st->max = us;
+	st->sum += us;
+	st->cycles++;
+
+	if (st->hist == NULL)
+		return;
+	if (us >= st->hist_max)
+		st->overflows++;
+	else
+		st->hist[us]++;
+}
+
+/* one wakeup on our own timer: the latency is how late it came */
+static int wait_timer(struct timespec *next, long interval_ns, long *us)
+{
+	struct timespec now;
+	int ret;
+
+	ts_add_ns(next, interval_ns);
+	ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL);
+	if (ret != 0)
+		return -ret;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	*us = ts_diff_ns(&now, next) / NSEC_PER_USEC;
+	return 0;
+}
+
+/*
+ * One interrupt of the UIO device: the guest can't tell when it was
+ * raised, so the latency is what irq_analyze.py makes of the TSC log,
+ * and the time between two interrupts is what is accounted here.
+ */
+static int wait_uio(int fd, struct timespec *last, long *us)
+{
+	struct timespec now;
+	uint32_t count, enable = 1;
+
+	if (write(fd, &enable, sizeof(enable)) != sizeof(enable) && errno != EIO)
+		return -errno;
+	if (read(fd, &count, sizeof(count)) != sizeof(count))
+		return -errno;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	*us = ts_diff_ns(&now, last) / NSEC_PER_USEC;
+	*last = now;
+	return 0;
+}
+
+static void print_cyclictest(const struct probe_stats *st, int prio,
+		long interval)
+{
+	int i;
+
+	if (st->hist != NULL) {
+		printf("# Histogram\n");
+		for (i = 0; i < st->hist_max; i++)
+			printf("%06d %06lu\n", i, st->hist[i]);
+		printf("# Total: %09lu\n", st->cycles);
+		printf("# Min Latencies: %05ld\n", st->min);
+		printf("# Avg Latencies: %05lu\n",
+			st->cycles ? st->sum / st->cycles : 0);
+		printf("# Max Latencies: %05ld\n", st->max);
+		printf("# Histogram Overflows: %05lu\n", st->overflows);
+	}
+	printf("T: 0 (%5d) P:%2d I:%ld C:%7lu Min:%7ld Act:%5ld Avg:%5lu Max:%8ld\n",
+		getpid(), prio, interval, st->cycles, st->min, st->act,
+		st->cycles ? st->sum / st->cycles : 0, st->max);
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [-i interval] [-l loops] [-p prio] [-h us] [-u uio] "
+		"[-t file]\n", prog);
+	printf("  -i interval  us between two wakeups, %d by default\n",
+		DEFAULT_INTERVAL);
+	printf("  -l loops     stop after that many wakeups, 0 (the default) "
+		"until ^C\n");
+	printf("  -p prio      SCHED_FIFO priority, 0 for SCHED_OTHER\n");
+	printf("  -h us        histogram of latencies up to us, in the "
+		"format of cyclictest -h\n");
+	printf("  -u uio       wait on the interrupts of /dev/uioN instead of "
+		"a timer\n");
+	printf("  -t file      log the guest TSC of each wakeup, for "
+		"acrnalyze.py --guest\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct probe_stats st = { 0 };
+	struct sched_param sp = { 0 };
+	struct timespec ts;
+	long interval = DEFAULT_INTERVAL, loops = 0, us;
+	const char *uio = NULL, *tsc_file = NULL;
+	FILE *tsc_log = NULL;
+	uint64_t tsc;
+	int opt, prio = 0, fd = -1, ret = 0;
+
+	while ((opt = getopt(argc, argv, "i:l:p:h:u:t:")) != -1) {
+		switch (opt) {
+		case 'i':
+			interval = atol(optarg);
+			break;
+		case 'l':
+			loops = atol(optarg);
+			break;
+		case 'p':
+			prio = atoi(optarg);
+			break;
+		case 'h':
+			st.hist_max = atoi(optarg);
+			break;
+		case 'u':
+			uio = optarg;
+			break;
+		case 't':
+			tsc_file = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (interval <= 0 || loops < 0 || st.hist_max < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (st.hist_max > 0) {
+		st.hist = calloc(st.hist_max, sizeof(st.hist[0]));
+		if (st.hist == NULL) {
+			perror("calloc");
+			return 1;
+		}
+	}
+
+	if (uio != NULL) {
+		fd = open(uio, O_RDWR);
+		if (fd < 0) {
+			perror(uio);
+			return 1;
+		}
+	}
+
+	if (tsc_file != NULL) {
+		tsc_log = fopen(tsc_file, "w");
+		if (tsc_log == NULL) {
+			perror(tsc_file);
+			return 1;
+		}
+		fprintf(tsc_log, "# guest TSC of each wakeup of %s\n",
+			uio ? uio : "the timer");
+	}
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+		perror("mlockall");
+	if (prio > 0) {
+		sp.sched_priority = prio;
+		if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0)
+			perror("sched_setscheduler");
+	}
+
+	signal(SIGINT, sighand);
+	signal(SIGTERM, sighand);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	/* the intervals of a UIO device are counted from its first interrupt */
+	if (fd >= 0) {
+		ret = wait_uio(fd, &ts, &us);
+		tsc = rdtsc_ordered();
+		if (ret == 0 && tsc_log != NULL)
+			fprintf(tsc_log, "%lu\n", tsc);
+	}
+	while (ret == 0 && !stop && (loops == 0 || (long)st.cycles < loops)) {
+		if (fd >= 0)
+			ret = wait_uio(fd, &ts, &us);
+		else
+			ret = wait_timer(&ts, interval * NSEC_PER_USEC, &us);
+		tsc = rdtsc_ordered();
+		if (ret < 0)
+			break;
+		account(&st, us);
+		if (tsc_log != NULL)
+			fprintf(tsc_log, "%lu\n", tsc);
+	}
+
+	if (ret < 0 && ret != -EINTR)
+		fprintf(stderr, "wait: %s\n", strerror(-ret));
+	print_cyclictest(&st, prio, interval);
+
+	if (tsc_log != NULL)
+		fclose(tsc_log);
+	if (fd >= 0)
+		close(fd);
+	free(st.hist);
+	return (ret < 0 && ret != -EINTR) ? 1 : 0;
+}
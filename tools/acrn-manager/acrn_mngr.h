@@ -16,6 +16,11 @@
 
 #define MNGR_MSG_MAGIC   0x67736d206d6d76	/* that is char[8] "mngr msg", on X86 */
 #define VMNAME_LEN	16
+#define BLK_IDENT_LEN	16
+#define BLK_LAT_BUCKETS	20	/* 2^n us, see DM_BLKSTATS */
+#define VQ_IDENT_LEN	32
+#define CPU_IDENT_LEN	32
+#define MIGRATE_DEST_LEN	64
 
 struct mngr_msg {
 	unsigned long long magic;	/* Make sure you get a mngr_msg */
@@ -23,7 +28,7 @@ struct mngr_msg {
 	unsigned long timestamp;
 	union {
 		/* ack of DM_STOP, DM_SUSPEND, DM_RESUME, DM_PAUSE, DM_CONTINUE,
-		   ACRND_TIMER, ACRND_STOP, ACRND_RESUME, RTC_TIMER */
+		   DM_LAUNCH, ACRND_TIMER, ACRND_STOP, ACRND_RESUME, RTC_TIMER */
 		int err;
 
 		/* ack of WAKEUP_REASON */
@@ -32,6 +37,117 @@ struct mngr_msg {
 		/* ack of DM_QUERY */
 		int state;
 
+		/* req of DM_BLKSTATS */
+		struct req_dm_blkstats {
+			unsigned index;		/* of the disk, from 0 */
+		} blkstats_req;
+
+		/*
+		 * ack of DM_BLKSTATS, err is -1 past the last disk. Bucket 0
+		 * of a latency histogram counts the requests under 1us,
+		 * bucket n those of [2^(n-1), 2^n) us.
+		 */
+		struct ack_dm_blkstats {
+			int err;
+			char ident[BLK_IDENT_LEN];	/* slot:func[.queue] */
+			unsigned long long reads;
+			unsigned long long writes;
+			unsigned long long others;
+			unsigned long long rbytes;
+			unsigned long long wbytes;
+			unsigned long long throttled;
+			unsigned long long queue_lat[BLK_LAT_BUCKETS];
+			unsigned long long service_lat[BLK_LAT_BUCKETS];
+		} blkstats;
+
+		/* req of DM_LAUNCH */
+		struct req_dm_launch {
+			int pid;	/* acrn-dm of which to take the args */
+		} launch;
+
+		/* req of DM_VQSTATS */
+		struct req_dm_vqstats {
+			unsigned index;		/* of the virtqueue, from 0 */
+		} vqstats_req;
+
+		/* ack of DM_VQSTATS, err is -1 past the last virtqueue */
+		struct ack_dm_vqstats {
+			int err;
+			char ident[VQ_IDENT_LEN];	/* slot:func name.queue */
+			unsigned qsize;
+			unsigned long long notifies;
+			unsigned long long polls;
+			unsigned long long chains;
+			unsigned long long descs;
+			unsigned long long used;
+			unsigned long long endchains;
+			unsigned long long interrupts;
+			unsigned long long suppressed;
+		} vqstats;
+
+		/* req of DM_CPUSTATS */
+		struct req_dm_cpustats {
+			unsigned index;		/* of the PCI device, from 0 */
+		} cpustats_req;
+
+		/*
+		 * ack of DM_CPUSTATS, err is -1 past the last device. The
+		 * BAR and mevent times are 0 unless acrn-dm runs with
+		 * --cpu_acct.
+		 */
+		struct ack_dm_cpustats {
+			int err;
+			char ident[CPU_IDENT_LEN];	/* slot:func devtype */
+			unsigned long long trap_ns;	/* in BAR handlers */
+			unsigned long long traps;
+			unsigned long long event_ns;	/* in mevent callbacks */
+			unsigned long long events;
+			unsigned long long thread_ns;	/* of the workers */
+			unsigned threads;
+		} cpustats;
+
+		/* req of DM_BALLOON */
+		struct req_dm_balloon {
+			int set;		/* set the target, or only ask */
+			unsigned target;	/* in MB */
+		} balloon_req;
+
+		/*
+		 * ack of DM_BALLOON, err is -ENODEV if the UOS has no
+		 * virtio-balloon. The sizes are in MB.
+		 */
+		struct ack_dm_balloon {
+			int err;
+			unsigned target;
+			unsigned actual;
+			unsigned long long released;	/* given back to SOS */
+			unsigned long long reported;	/* hugepages free */
+			unsigned long long refaults;	/* hugepages reused */
+		} balloon;
+
+		/* req of DM_MIGRATE */
+		struct req_dm_migrate {
+			int start;		/* to dest, or only ask */
+			char dest[MIGRATE_DEST_LEN];	/* host:port */
+		} migrate_req;
+
+		/*
+		 * ack of DM_MIGRATE, on the last migration started or the
+		 * one just started, err being that of starting it or of a
+		 * failed migration
+		 */
+		struct ack_dm_migrate {
+			int err;
+			int state;	/* MIGRATE_* */
+			unsigned round;
+			unsigned long long sent;	/* 4K pages */
+			unsigned long long zero;	/* of them */
+			unsigned long long bytes;	/* on the wire */
+			unsigned long long dirty;	/* by the last round */
+			unsigned long long downtime_ms;
+			unsigned long long total_ms;
+		} migrate;
+
 		/* req of ACRND_TIMER */
 		struct req_acrnd_timer {
 			char name[VMNAME_LEN];
@@ -62,6 +178,13 @@ struct mngr_msg {
 			time_t t;
 		} rtc_timer;
 
+		/* req of VM_STATE */
+		struct req_vm_state {
+			char vmname[VMNAME_LEN];
+			int state;	/* enum vm_state of acrnctl.h */
+			int err;	/* 0, or the op failed or timed out */
+		} vm_state;
+
 	} data;
 };
 
@@ -80,9 +203,22 @@ enum dm_msgid {
 	DM_PAUSE,		/* Freeze this virtual machine */
 	DM_CONTINUE,		/* Unfreeze this virtual machine */
 	DM_QUERY,		/* Ask power state of this UOS */
+	DM_BLKSTATS,		/* Ask I/O statistics of a disk of this UOS */
+	DM_VQSTATS,		/* Ask statistics of a virtqueue of this UOS */
+	DM_LAUNCH,		/* Standby DM to run the UOS of an acrn-dm */
+	DM_CPUSTATS,		/* Ask CPU time of a PCI device of this UOS */
+	DM_BALLOON,		/* Ask or set the memory balloon of this UOS */
+	DM_MIGRATE,		/* Migrate this UOS, or ask how it goes */
 	DM_MAX,
 };
 
+/* state of ack_dm_migrate, as in devicemodel/include/migration.h */
+#define MIGRATE_NONE		0
+#define MIGRATE_PRECOPY		1	/* copying while the UOS runs */
+#define MIGRATE_STOPCOPY	2	/* the UOS is paused */
+#define MIGRATE_DONE		3	/* the UOS runs on the target */
+#define MIGRATE_FAILED		4
+
 /* DM handled message req/ack pairs */
 
 /* Acrnd handled message event types */
@@ -109,6 +245,7 @@ enum sos_lcs_msgid {
 	SUSPEND,
 	SHUTDOWN,
 	REBOOT,
+	VM_STATE,		/* Acrnd notify the state a UOS reached */
 };
 
 /* helper functions */
@@ -12,6 +12,7 @@
 #include <limits.h>
 #include <pthread.h>
 #include <dirent.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include "acrnctl.h"
 #include "acrn_mngr.h"
@@ -433,6 +434,219 @@ int continue_vm(const char *vmname)
 	return ack.data.err;
 }
 
+/* print the counters of the latency histograms which aren't 0 */
+static void print_blk_lat(const char *name, const unsigned long long *lat)
+{
+	int i;
+
+	printf("  %s latency:", name);
+	for (i = 0; i < BLK_LAT_BUCKETS; i++) {
+		if (!lat[i])
+			continue;
+		if (i == 0)
+			printf(" <1us:%llu", lat[i]);
+		else if (i == BLK_LAT_BUCKETS - 1)
+			printf(" >=%luus:%llu", 1UL << (i - 1), lat[i]);
+		else
+			printf(" <%luus:%llu", 1UL << i, lat[i]);
+	}
+	printf("\n");
+}
+
+int blkstat_vm(const char *vmname)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+	struct ack_dm_blkstats *bs = &ack.data.blkstats;
+	unsigned i;
+	int ret;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_BLKSTATS;
+
+	for (i = 0; ; i++) {
+		req.timestamp = time(NULL);
+		req.data.blkstats_req.index = i;
+		ret = send_msg(vmname, &req, &ack);
+		if (ret)
+			return ret;
+		if (bs->err)
+			break;
+
+		bs->ident[BLK_IDENT_LEN - 1] = '\0';
+		printf("%s disk %s\n", vmname, bs->ident);
+		printf("  reads:%llu (%llu bytes) writes:%llu (%llu bytes) "
+			"others:%llu throttled:%llu\n", bs->reads, bs->rbytes,
+			bs->writes, bs->wbytes, bs->others, bs->throttled);
+		print_blk_lat("queue", bs->queue_lat);
+		print_blk_lat("service", bs->service_lat);
+	}
+
+	if (i == 0)
+		printf("%s has no disk\n", vmname);
+
+	return 0;
+}
+
+int vqstat_vm(const char *vmname)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+	struct ack_dm_vqstats *vs = &ack.data.vqstats;
+	unsigned i;
+	int ret;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_VQSTATS;
+
+	for (i = 0; ; i++) {
+		req.timestamp = time(NULL);
+		req.data.vqstats_req.index = i;
+		ret = send_msg(vmname, &req, &ack);
+		if (ret)
+			return ret;
+		if (vs->err)
+			break;
+
+		vs->ident[VQ_IDENT_LEN - 1] = '\0';
+		printf("%s virtqueue %s size:%u\n", vmname, vs->ident,
+			vs->qsize);
+		printf("  notifies:%llu polls:%llu chains:%llu (%llu.%02llu "
+			"descs each) used:%llu\n", vs->notifies, vs->polls,
+			vs->chains, vs->chains ? vs->descs / vs->chains : 0,
+			vs->chains ? vs->descs * 100 / vs->chains % 100 : 0,
+			vs->used);
+		printf("  endchains:%llu interrupts:%llu suppressed:%llu\n",
+			vs->endchains, vs->interrupts, vs->suppressed);
+	}
+
+	if (i == 0)
+		printf("%s has no virtqueue\n", vmname);
+
+	return 0;
+}
+
+int cpustat_vm(const char *vmname)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+	struct ack_dm_cpustats *cs = &ack.data.cpustats;
+	unsigned i;
+	int ret;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_CPUSTATS;
+
+	for (i = 0; ; i++) {
+		req.timestamp = time(NULL);
+		req.data.cpustats_req.index = i;
+		ret = send_msg(vmname, &req, &ack);
+		if (ret)
+			return ret;
+		if (cs->err)
+			break;
+
+		cs->ident[CPU_IDENT_LEN - 1] = '\0';
+		printf("%s device %s\n", vmname, cs->ident);
+		printf("  bar:%llu.%03llums (%llu accesses) mevent:%llu.%03llums "
+			"(%llu callbacks) threads:%llu.%03llums (%u)\n",
+			cs->trap_ns / 1000000, cs->trap_ns / 1000 % 1000,
+			cs->traps,
+			cs->event_ns / 1000000, cs->event_ns / 1000 % 1000,
+			cs->events,
+			cs->thread_ns / 1000000, cs->thread_ns / 1000 % 1000,
+			cs->threads);
+	}
+
+	if (i == 0)
+		printf("%s has no PCI device\n", vmname);
+
+	return 0;
+}
+
+int balloon_vm(const char *vmname, int set, unsigned target)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+	struct ack_dm_balloon *b = &ack.data.balloon;
+	int ret;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_BALLOON;
+	req.timestamp = time(NULL);
+	req.data.balloon_req.set = set;
+	req.data.balloon_req.target = target;
+
+	ret = send_msg(vmname, &req, &ack);
+	if (ret)
+		return ret;
+
+	if (b->err) {
+		printf("%s: %s\n", vmname, (b->err == -ENODEV) ?
+			"no virtio-balloon" : strerror(-b->err));
+		return b->err;
+	}
+
+	printf("%s balloon target:%uMB actual:%uMB released:%lluMB "
+		"(%llu reported, %llu refaults)\n", vmname, b->target,
+		b->actual, b->released, b->reported, b->refaults);
+	return 0;
+}
+
+static const char *migrate_state[] = {
+	[MIGRATE_NONE] = "none",
+	[MIGRATE_PRECOPY] = "pre-copy",
+	[MIGRATE_STOPCOPY] = "stop-and-copy",
+	[MIGRATE_DONE] = "done",
+	[MIGRATE_FAILED] = "failed",
+};
+
+/* Start the migration, then show how it goes every second till its end */
+int migrate_vm(const char *vmname, const char *dest)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+	struct ack_dm_migrate *mg = &ack.data.migrate;
+	int ret, state;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_MIGRATE;
+	req.timestamp = time(NULL);
+	req.data.migrate_req.start = 1;
+	snprintf(req.data.migrate_req.dest, MIGRATE_DEST_LEN, "%s", dest);
+
+	for (;;) {
+		ret = send_msg(vmname, &req, &ack);
+		if (ret) {
+			printf("%s: acrn-dm gone, see its log\n", vmname);
+			return ret;
+		}
+
+		state = mg->state;
+		if (state < MIGRATE_NONE || state > MIGRATE_FAILED)
+			state = MIGRATE_FAILED;
+		if (state == MIGRATE_FAILED || (mg->err && state == MIGRATE_NONE)) {
+			printf("%s: migration to %s failed: %s\n", vmname, dest,
+				strerror(-mg->err));
+			return mg->err ? mg->err : -1;
+		}
+
+		printf("%s %s round:%u sent:%lluMB (%llu zero pages) wire:%lluMB "
+			"dirty:%llu pages %llums\n", vmname,
+			migrate_state[state], mg->round, mg->sent >> 8, mg->zero,
+			mg->bytes >> 20, mg->dirty, mg->total_ms);
+		if (state == MIGRATE_DONE) {
+			printf("%s runs on %s, %llums down\n", vmname, dest,
+				mg->downtime_ms);
+			return 0;
+		}
+
+		sleep(1);
+		req.timestamp = time(NULL);
+		req.data.migrate_req.start = 0;
+	}
+}
+
 int suspend_vm(const char *vmname)
 {
 	struct mngr_msg req;
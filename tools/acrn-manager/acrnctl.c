@@ -19,6 +19,8 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <pthread.h>
 #include "acrn_mngr.h"
 #include "acrnctl.h"
 #include "ioc.h"
@@ -37,6 +39,11 @@
 #define SUSPEND_DESC   "Switch virtual machine to suspend state"
 #define RESUME_DESC    "Resume virtual machine from suspend state"
 #define RESET_DESC     "Stop and then start virtual machine VM_NAME"
+#define BLKSTAT_DESC   "Show the disk I/O statistics of virtual machine VM_NAME"
+#define VQSTAT_DESC    "Show the virtqueue statistics of virtual machine VM_NAME"
+#define CPUSTAT_DESC   "Show the CPU time of the devices of virtual machine VM_NAME"
+#define BALLOON_DESC   "Show or set, in MB, the memory balloon of virtual machine VM_NAME"
+#define MIGRATE_DESC   "Migrate virtual machine VM_NAME to the acrn-dm --incoming on HOST:PORT"
 
 #define STOP_TIMEOUT	30U
 
@@ -396,11 +403,23 @@ static int acrnctl_do_add(int argc, char *argv[])
 	return ret;
 }
 
+static void *stop_vm_thread(void *arg)
+{
+	stop_vm(arg);
+	return NULL;
+}
+
+/* each stop waits for its ack, send them to all the VMs at once */
 static int acrnctl_do_stop(int argc, char *argv[])
 {
 	struct vmmngr_struct *s;
+	pthread_t *tid;
+	int *threaded;
 	int i;
 
+	tid = calloc(argc, sizeof(*tid));
+	threaded = calloc(argc, sizeof(*threaded));
+
 	for (i = 1; i < argc; i++) {
 		s = vmmngr_find(argv[i]);
 		if (!s) {
@@ -412,9 +431,19 @@ static int acrnctl_do_stop(int argc, char *argv[])
 			       state_str[s->state]);
 			continue;
 		}
-		stop_vm(argv[i]);
+		if (tid && threaded)
+			threaded[i] = !pthread_create(&tid[i], NULL,
+						      stop_vm_thread, argv[i]);
+		if (!threaded || !threaded[i])
+			stop_vm(argv[i]);
 	}
 
+	for (i = 1; i < argc && threaded; i++)
+		if (threaded[i])
+			pthread_join(tid[i], NULL);
+
+	free(tid);
+	free(threaded);
 	return 0;
 }
 
@@ -528,6 +557,140 @@ static int acrnctl_do_continue(int argc, char *argv[])
 	return 0;
 }
 
+static int acrnctl_do_blkstat(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		s = vmmngr_find(argv[i]);
+		if (!s) {
+			printf("Can't find vm %s\n", argv[i]);
+			continue;
+		}
+
+		switch (s->state) {
+			case VM_STARTED:
+			case VM_PAUSED:
+				blkstat_vm(argv[i]);
+				break;
+			default:
+				printf("%s current state %s, no disk statistics\n",
+					argv[i], state_str[s->state]);
+		}
+	}
+
+	return 0;
+}
+
+static int acrnctl_do_vqstat(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		s = vmmngr_find(argv[i]);
+		if (!s) {
+			printf("Can't find vm %s\n", argv[i]);
+			continue;
+		}
+
+		switch (s->state) {
+			case VM_STARTED:
+			case VM_PAUSED:
+				vqstat_vm(argv[i]);
+				break;
+			default:
+				printf("%s current state %s, no virtqueue statistics\n",
+					argv[i], state_str[s->state]);
+		}
+	}
+
+	return 0;
+}
+
+static int acrnctl_do_cpustat(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		s = vmmngr_find(argv[i]);
+		if (!s) {
+			printf("Can't find vm %s\n", argv[i]);
+			continue;
+		}
+
+		switch (s->state) {
+			case VM_STARTED:
+			case VM_PAUSED:
+				cpustat_vm(argv[i]);
+				break;
+			default:
+				printf("%s current state %s, no device CPU time\n",
+					argv[i], state_str[s->state]);
+		}
+	}
+
+	return 0;
+}
+
+static int acrnctl_do_balloon(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+	unsigned long target = 0;
+	char *end;
+
+	if (argc == 3) {
+		target = strtoul(argv[2], &end, 0);
+		if (*end != '\0' || end == argv[2] || target > UINT_MAX) {
+			printf("Invalid balloon size %s\n", argv[2]);
+			return -1;
+		}
+	}
+
+	s = vmmngr_find(argv[1]);
+	if (!s) {
+		printf("Can't find vm %s\n", argv[1]);
+		return -1;
+	}
+
+	switch (s->state) {
+		case VM_STARTED:
+		case VM_PAUSED:
+			return balloon_vm(argv[1], argc == 3, target);
+		default:
+			printf("%s current state %s, no memory balloon\n",
+				argv[1], state_str[s->state]);
+	}
+
+	return -1;
+}
+
+static int acrnctl_do_migrate(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+
+	if (strlen(argv[2]) >= MIGRATE_DEST_LEN) {
+		printf("Invalid destination %s\n", argv[2]);
+		return -1;
+	}
+
+	s = vmmngr_find(argv[1]);
+	if (!s) {
+		printf("Can't find vm %s\n", argv[1]);
+		return -1;
+	}
+
+	if (s->state != VM_STARTED) {
+		printf("%s current state %s, can't migrate\n",
+			argv[1], state_str[s->state]);
+		return -1;
+	}
+
+	return migrate_vm(argv[1], argv[2]);
+}
+
 static int acrnctl_do_suspend(int argc, char *argv[])
 {
 	struct vmmngr_struct *s;
@@ -678,6 +841,30 @@ static int valid_start_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 	return 0;
 }
 
+static int valid_balloon_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[32] = "VM_NAME [SIZE_MB]";
+
+	if (argc < 2 || argc > 3 || !strcmp(argv[1], "help")) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int valid_migrate_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[32] = "VM_NAME HOST:PORT";
+
+	if (argc != 3 || !strcmp(argv[1], "help")) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int valid_list_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 {
 	if (argc != 1) {
@@ -699,6 +886,11 @@ struct acrnctl_cmd acmds[] = {
 	ACMD("suspend", acrnctl_do_suspend, SUSPEND_DESC, df_valid_args),
 	ACMD("resume", acrnctl_do_resume, RESUME_DESC, df_valid_args),
 	ACMD("reset", acrnctl_do_reset, RESET_DESC, df_valid_args),
+	ACMD("blkstat", acrnctl_do_blkstat, BLKSTAT_DESC, df_valid_args),
+	ACMD("vqstat", acrnctl_do_vqstat, VQSTAT_DESC, df_valid_args),
+	ACMD("cpustat", acrnctl_do_cpustat, CPUSTAT_DESC, df_valid_args),
+	ACMD("balloon", acrnctl_do_balloon, BALLOON_DESC, valid_balloon_args),
+	ACMD("migrate", acrnctl_do_migrate, MIGRATE_DESC, valid_migrate_args),
 };
 
 #define NCMD	(sizeof(acmds)/sizeof(struct acrnctl_cmd))
@@ -64,5 +64,10 @@ int pause_vm(const char *vmname);
 int continue_vm(const char *vmname);
 int suspend_vm(const char *vmname);
 int resume_vm(const char *vmname, unsigned reason);
+int blkstat_vm(const char *vmname);
+int vqstat_vm(const char *vmname);
+int cpustat_vm(const char *vmname);
+int balloon_vm(const char *vmname, int set, unsigned target);
+int migrate_vm(const char *vmname, const char *dest);
 
 #endif				/* _ACRNCTL_H_ */
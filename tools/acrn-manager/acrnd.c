@@ -8,6 +8,7 @@
 #include <signal.h>
 #include <sys/queue.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -234,67 +235,358 @@ static void acrnd_run_vm(char *name)
 	exit(0);
 }
 
-static int active_all_vms(void)
+#define SOS_LCS_SOCK		"sos-lcs"
+
+/*
+ * VM launch/stop ordering. A VM lists the VMs it depends on, separated by
+ * blanks, in ACRN_CONF_PATH_ADD/[vmname].deps. VMs without dependency are
+ * level 0, the others one level above their highest dependency. All the VMs
+ * of a level are launched, resumed or stopped at once, and the next level
+ * waits for them to reach their state. Stop goes from the highest level down.
+ * Each VM reaching its state, or failing to, is notified to SOS-LCS.
+ */
+#define VM_DEPS_MAX		8
+#define VMS_LAUNCH_TIMEOUT	30 /* Wait VMS_LAUNCH_TIMEOUT sec for a level to boot */
+
+enum vm_op {
+	VM_OP_NONE = 0,
+	VM_OP_LAUNCH,
+	VM_OP_RESUME,
+	VM_OP_STOP,
+};
+
+struct vm_order {
+	char name[MAX_NAME_LEN];
+	unsigned long state;	/* when the order is built */
+	unsigned level;
+	int deps[VM_DEPS_MAX];	/* index of the VMs it depends on */
+	int ndeps;
+	enum vm_op op;		/* in flight on this VM */
+	unsigned reason;	/* wakeup reason of VM_OP_RESUME */
+	int err;
+	int threaded;
+	pthread_t tid;
+};
+
+static void load_vm_deps(struct vm_order *order, int num, int idx)
 {
-	struct vmmngr_struct *vm;
-	int ret = 0;
-	pid_t pid;
-	unsigned reason;
+	char path[128];
+	char l[256];
+	char *dep, *save;
+	FILE *fp;
+	int i;
 
-	vmmngr_update();
+	if (snprintf(path, sizeof(path), "%s/%s.deps", ACRN_CONF_PATH_ADD,
+			order[idx].name) >= sizeof(path))
+		return;
 
-	LIST_FOREACH(vm, &vmmngr_head, list) {
-		switch (vm->state) {
-		case VM_CREATED:
-			pid = fork();
-			if (!pid)
-				acrnd_run_vm(vm->name);
-			break;
-		case VM_SUSPENDED:
-			reason = get_sos_wakeup_reason();
-			ret += resume_vm(vm->name, reason);
-			break;
-		default:
-			pdebug();
+	fp = fopen(path, "r");
+	if (!fp)
+		return;
+
+	while (fgets(l, sizeof(l), fp)) {
+		for (dep = strtok_r(l, " \t\n", &save); dep;
+				dep = strtok_r(NULL, " \t\n", &save)) {
+			for (i = 0; i < num; i++)
+				if (!strcmp(order[i].name, dep))
+					break;
+
+			if (i == num || i == idx) {
+				fprintf(stderr, "%s: ignore dependency %s\n",
+					order[idx].name, dep);
+				continue;
+			}
+
+			if (order[idx].ndeps == VM_DEPS_MAX) {
+				fprintf(stderr, "%s: more than %d dependencies\n",
+					order[idx].name, VM_DEPS_MAX);
+				goto out;
+			}
+			order[idx].deps[order[idx].ndeps++] = i;
 		}
 	}
 
-	return ret ? -1 : 0;
+ out:
+	fclose(fp);
 }
 
-static void stop_all_vms(void)
+/* snapshot the VMs and their levels, caller frees *@porder */
+static int build_vm_order(struct vm_order **porder)
 {
 	struct vmmngr_struct *vm;
-	int err;
+	struct vm_order *order;
+	int num = 0, pass, changed, i, j, d;
 
+	*porder = NULL;
 	vmmngr_update();
 
+	LIST_FOREACH(vm, &vmmngr_head, list)
+		num++;
+	if (!num)
+		return 0;
+
+	order = calloc(num, sizeof(*order));
+	if (!order) {
+		perror("Alloc vm order fail:");
+		return -1;
+	}
+
+	i = 0;
 	LIST_FOREACH(vm, &vmmngr_head, list) {
-		err = stop_vm(vm->name);
-		if (err != 0) {
-			fprintf(stderr, "Fail to send stop cmd to vm %s\n", vm->name);
-		} else {
-			printf("Send stop cmd to vm %s successfully\n", vm->name);
+		memcpy(order[i].name, vm->name, sizeof(order[i].name));
+		order[i].state = vm->state;
+		i++;
+	}
+
+	for (i = 0; i < num; i++)
+		load_vm_deps(order, num, i);
+
+	/* num passes settle the longest chain, a loop keeps on changing */
+	changed = 1;
+	for (pass = 0; changed && pass <= num; pass++) {
+		changed = 0;
+		for (i = 0; i < num; i++) {
+			for (d = 0; d < order[i].ndeps; d++) {
+				j = order[i].deps[d];
+				if (order[i].level <= order[j].level
+						&& order[j].level < num) {
+					order[i].level = order[j].level + 1;
+					changed = 1;
+				}
+			}
 		}
 	}
+	if (changed)
+		fprintf(stderr, "Dependency loop in %s/*.deps\n", ACRN_CONF_PATH_ADD);
+
+	*porder = order;
+	return num;
 }
 
-static int wakeup_suspended_vms(unsigned wakeup_reason)
+static void notify_vm_state(int lcs_fd, const char *name, int state, int err)
+{
+	struct mngr_msg req;
+
+	printf("vm %s %s%s\n", name, state_str[state], err ? " failed" : "");
+
+	if (lcs_fd < 0)
+		return;
+
+	memset(&req, 0, sizeof(req));
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = VM_STATE;
+	req.timestamp = time(NULL);
+	strncpy(req.data.vm_state.vmname, name,
+		sizeof(req.data.vm_state.vmname) - 1);
+	req.data.vm_state.state = state;
+	req.data.vm_state.err = err;
+
+	mngr_send_msg(lcs_fd, &req, NULL, 0);
+}
+
+static void *vm_op_thread(void *arg)
+{
+	struct vm_order *o = arg;
+
+	if (o->op == VM_OP_STOP)
+		o->err = stop_vm(o->name);
+	else
+		o->err = resume_vm(o->name, o->reason);
+
+	return NULL;
+}
+
+/* start @op on the VMs of @level, return how many failed to start */
+static int run_vm_level(struct vm_order *order, int num, unsigned level,
+			enum vm_op op, unsigned reason, int lcs_fd)
+{
+	struct vm_order *o;
+	pid_t pid;
+	int i, failed = 0;
+
+	for (i = 0; i < num; i++) {
+		o = &order[i];
+		if (o->level != level)
+			continue;
+
+		if (op == VM_OP_STOP)
+			o->op = (o->state != VM_CREATED) ? VM_OP_STOP : VM_OP_NONE;
+		else if (o->state == VM_SUSPENDED)
+			o->op = VM_OP_RESUME;
+		else if (o->state == VM_CREATED && op == VM_OP_LAUNCH)
+			o->op = VM_OP_LAUNCH;
+		else
+			o->op = VM_OP_NONE;
+
+		if (o->op == VM_OP_NONE)
+			continue;
+
+		if (o->op == VM_OP_LAUNCH) {
+			pid = fork();
+			if (!pid)
+				acrnd_run_vm(o->name);
+			if (pid < 0) {
+				perror("Fork vm fail:");
+				o->err = -1;
+			}
+			continue;
+		}
+
+		o->reason = reason;
+		o->threaded = !pthread_create(&o->tid, NULL, vm_op_thread, o);
+		if (!o->threaded)
+			vm_op_thread(o);
+	}
+
+	for (i = 0; i < num; i++) {
+		o = &order[i];
+		if (o->level != level || o->op == VM_OP_NONE)
+			continue;
+
+		if (o->threaded) {
+			pthread_join(o->tid, NULL);
+			o->threaded = 0;
+		}
+
+		if (o->err) {
+			notify_vm_state(lcs_fd, o->name, o->state, o->err);
+			o->op = VM_OP_NONE;
+			failed++;
+		}
+	}
+
+	return failed;
+}
+
+/* wait for the VMs of @level with an op in flight to reach their state */
+static void wait_vm_level(struct vm_order *order, int num, unsigned level,
+			  time_t deadline, int lcs_fd)
 {
 	struct vmmngr_struct *vm;
-	int ret = 0;
+	struct vm_order *o;
+	unsigned long target, state;
+	int i, pending;
+
+	while (1) {
+		vmmngr_update();
+		pending = 0;
+
+		for (i = 0; i < num; i++) {
+			o = &order[i];
+			if (o->level != level || o->op == VM_OP_NONE)
+				continue;
+
+			target = (o->op == VM_OP_STOP) ? VM_CREATED : VM_STARTED;
+			vm = vmmngr_find(o->name);
+			state = vm ? vm->state : VM_CREATED;
+
+			if (state == target) {
+				notify_vm_state(lcs_fd, o->name, state, 0);
+				o->op = VM_OP_NONE;
+			} else if (time(NULL) >= deadline) {
+				fprintf(stderr, "Timeout to wait vm %s %s\n",
+					o->name, state_str[target]);
+				notify_vm_state(lcs_fd, o->name, state, -ETIMEDOUT);
+				o->op = VM_OP_NONE;
+			} else {
+				pending++;
+			}
+		}
 
-	vmmngr_update();
+		if (!pending)
+			break;
+		sleep(1);
+	}
+}
 
-	LIST_FOREACH(vm, &vmmngr_head, list) {
-		if (vm->state == VM_SUSPENDED)
-			ret += resume_vm(vm->name, wakeup_reason);
+/*
+ * Run @op level by level, waiting at most @timeout sec for each level (for
+ * the whole run of VM_OP_STOP). Don't wait after the last level unless
+ * @wait_last: its VMs are then not notified.
+ */
+static int run_vms_ordered(enum vm_op op, unsigned reason, unsigned timeout,
+			   int wait_last)
+{
+	struct vm_order *order;
+	unsigned level, max_level = 0;
+	time_t deadline;
+	int num, i, n, lcs_fd, failed = 0;
+
+	num = build_vm_order(&order);
+	if (num <= 0)
+		return num;
+
+	for (i = 0; i < num; i++)
+		if (order[i].level > max_level)
+			max_level = order[i].level;
+
+	/* notifications are best effort, SOS-LCS may not be there */
+	lcs_fd = mngr_open_un(SOS_LCS_SOCK, MNGR_CLIENT);
+
+	deadline = time(NULL) + timeout;
+	for (n = 0; n <= max_level; n++) {
+		level = (op == VM_OP_STOP) ? max_level - n : n;
+		failed += run_vm_level(order, num, level, op, reason, lcs_fd);
+
+		if (n == max_level && !wait_last)
+			break;
+		if (op != VM_OP_STOP)
+			deadline = time(NULL) + timeout;
+		wait_vm_level(order, num, level, deadline, lcs_fd);
 	}
 
-	return ret ? -1 : 0;
+	if (lcs_fd >= 0)
+		mngr_close(lcs_fd);
+	free(order);
+
+	return failed ? -1 : 0;
+}
+
+static void *active_vms_thread(void *arg)
+{
+	run_vms_ordered(VM_OP_LAUNCH, get_sos_wakeup_reason(),
+			VMS_LAUNCH_TIMEOUT, 1);
+	return NULL;
+}
+
+/*
+ * Bring up the VMs in a detached thread, the levels may take a while to boot
+ * and acrnd has to serve its socket meanwhile.
+ */
+static int active_all_vms(void)
+{
+	pthread_t tid;
+	pthread_attr_t attr;
+	int rc;
+
+	rc = pthread_attr_init(&attr);
+	if (rc)
+		goto inline_run;
+	rc = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (!rc)
+		rc = pthread_create(&tid, &attr, active_vms_thread, NULL);
+	pthread_attr_destroy(&attr);
+	if (!rc)
+		return 0;
+
+ inline_run:
+	return run_vms_ordered(VM_OP_LAUNCH, get_sos_wakeup_reason(),
+			       VMS_LAUNCH_TIMEOUT, 0);
+}
+
+static void stop_all_vms(unsigned timeout)
+{
+	if (run_vms_ordered(VM_OP_STOP, 0, timeout, 1))
+		fprintf(stderr, "Fail to send stop cmd to some vms\n");
+}
+
+static int wakeup_suspended_vms(unsigned wakeup_reason)
+{
+	/* replied to SOS-LCS once the last level is asked to resume */
+	return run_vms_ordered(VM_OP_RESUME, wakeup_reason,
+			       VMS_LAUNCH_TIMEOUT, 0);
 }
 
-#define SOS_LCS_SOCK		"sos-lcs"
 #define DEFAULT_TIMEOUT	2U
 #define ACRND_NAME		"acrnd"
 static int acrnd_fd = -1;
@@ -648,7 +940,93 @@ static void sigterm_handler(int signo)
 	sigterm = 1;
 }
 
-static const char optString[] = "t";
+/* keep standby_num standby acrn-dm waiting, see acrn-dm --standby */
+#define STANDBY_PREFIX		"standby-"
+#define STANDBY_MAX		8
+#define STANDBY_SPAWN_WAIT	10 /* Wait STANDBY_SPAWN_WAIT sec for its socket */
+
+static int standby_num;
+static time_t standby_spawned[STANDBY_MAX];
+
+static void spawn_standby_dm(int slot)
+{
+	char name[32];
+	pid_t pid;
+
+	snprintf(name, sizeof(name), STANDBY_PREFIX "%d", slot);
+
+	pid = fork();
+	if (pid < 0) {
+		perror("Fork standby acrn-dm fail:");
+		return;
+	}
+
+	if (!pid) {
+		/* orphan it, once it runs a UOS acrnd does not wait for it */
+		if (fork())
+			_exit(0);
+
+		if (logfile) {
+			stdin = freopen("/dev/null", "r+", stdin);
+			stdout = freopen("/dev/null", "r+", stdout);
+			stderr = freopen("/dev/null", "r+", stderr);
+		}
+		execlp("acrn-dm", "acrn-dm", "--standby", name, NULL);
+		_exit(1);
+	}
+
+	waitpid(pid, NULL, 0);
+	standby_spawned[slot] = time(NULL);
+}
+
+/* respawn the standbys which took a UOS or died */
+static void refill_standby_dms(void)
+{
+	int ready[STANDBY_MAX] = { };
+	char path[128];
+	struct dirent *entry;
+	time_t current;
+	DIR *dir;
+	char *p;
+	long slot;
+	long pid;
+
+	if (!standby_num)
+		return;
+
+	dir = opendir(ACRN_DM_SOCK_PATH);
+	if (dir) {
+		/* [name].[pid].socket */
+		while ((entry = readdir(dir))) {
+			if (strncmp(entry->d_name, STANDBY_PREFIX,
+					strlen(STANDBY_PREFIX)))
+				continue;
+
+			slot = strtol(entry->d_name + strlen(STANDBY_PREFIX), &p, 10);
+			if (*p != '.' || slot < 0 || slot >= standby_num)
+				continue;
+
+			pid = strtol(p + 1, NULL, 10);
+			if (pid > 0 && kill(pid, 0) == 0) {
+				ready[slot] = 1;
+				continue;
+			}
+
+			snprintf(path, sizeof(path), "%s/%s", ACRN_DM_SOCK_PATH,
+				 entry->d_name);
+			unlink(path);
+		}
+		closedir(dir);
+	}
+
+	current = time(NULL);
+	for (slot = 0; slot < standby_num; slot++)
+		if (!ready[slot] &&
+		    current - standby_spawned[slot] >= STANDBY_SPAWN_WAIT)
+			spawn_standby_dm(slot);
+}
+
+static const char optString[] = "tp:";
 
 int main(int argc, char *argv[])
 {
@@ -659,6 +1037,14 @@ int main(int argc, char *argv[])
 		case 't':
 			 logfile = 0;
 			 break;
+		case 'p':
+			 standby_num = atoi(optarg);
+			 if (standby_num < 0 || standby_num > STANDBY_MAX) {
+				 printf("Standby acrn-dm number must be 0~%d\n",
+					STANDBY_MAX);
+				 return -1;
+			 }
+			 break;
 		default:
 			 printf("Ingrone unknown opt: %c\n", opt);
 		}
@@ -671,6 +1057,9 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
+	/* UOSs launched from now on may already find a standby */
+	refill_standby_dms();
+
 	if (init_vm()) {
 		pdebug();
 		return -1;
@@ -691,6 +1080,7 @@ int main(int argc, char *argv[])
 	/* Last thing, run our timer works */
 	while (!sigterm) {
 		try_do_works();
+		refill_standby_dms();
 		sleep(1);
 	}
 
@@ -699,8 +1089,7 @@ int main(int argc, char *argv[])
 	 * gracefully. acrnd will exit after waiting maximal VMS_STOP_TIMEOUT sec.
 	 * System will kill all other vms which can not be stopped within VMS_STOP_TIMEOUT sec.
 	 */
-	stop_all_vms();
-	wait_for_stop(VMS_STOP_TIMEOUT);
+	stop_all_vms(VMS_STOP_TIMEOUT);
 
 	return 0;
 }
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Samples the telemetry page acrn-dm --telemetry shares with the
+ * hypervisor, and prints the rates of the VM exits of each vCPU and of the
+ * passthrough interrupts. Reading the page costs no hypercall, so the
+ * interval can be as short as wanted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "acrn_common.h"
+
+/* must match devicemodel/include/telemetry.h */
+#define TELEMETRY_SHM_NAME	"/acrn-telemetry.%s"
+
+#define DEFAULT_INTERVAL_MS	1000
+
+struct sample {
+	uint64_t ns;
+	struct acrn_vcpu_telemetry vcpu[ACRN_TELEMETRY_VCPUS];
+	uint64_t ptirq[ACRN_TELEMETRY_PTIRQS];
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* a consistent copy of the counters of a vCPU, see acrn_vcpu_telemetry */
+static void read_vcpu(const volatile struct acrn_vcpu_telemetry *src,
+		struct acrn_vcpu_telemetry *dst)
+{
+	uint32_t seq;
+
+	do {
+		seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+		memcpy(dst, (const void *)src, sizeof(*dst));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1U) != 0U || seq != __atomic_load_n(&src->seq, __ATOMIC_RELAXED));
+}
+
+static void take_sample(const struct acrn_vm_telemetry *page, struct sample *s)
+{
+	int i;
+
+	s->ns = now_ns();
+	for (i = 0; i < page->nr_vcpus; i++)
+		read_vcpu(&page->vcpu[i], &s->vcpu[i]);
+	for (i = 0; i < ACRN_TELEMETRY_PTIRQS; i++)
+		s->ptirq[i] = __atomic_load_n(&page->ptirq[i].count, __ATOMIC_RELAXED);
+}
+
+/* per second, over the interval between s0 and s1 */
+static uint64_t rate(uint64_t v0, uint64_t v1, uint64_t ns)
+{
+	return (v1 - v0) * 1000000000UL / ns;
+}
+
+static void report(const struct acrn_vm_telemetry *page,
+		const struct sample *s0, const struct sample *s1)
+{
+	const struct acrn_vcpu_telemetry *a, *b;
+	uint64_t ns = s1->ns - s0->ns, exits, reqs, khz = page->tsc_khz;
+	int i;
+
+	if (ns == 0)
+		return;
+
+	printf("%-5s %9s %8s %8s %8s %8s %8s %8s %8s %9s %8s %8s\n",
+		"vcpu", "exits/s", "cyc/exit", "intr/s", "pio/s", "ept/s",
+		"msr/s", "hlt/s", "dmreq/s", "us/dmreq", "virq/s", "timer/s");
+	for (i = 0; i < page->nr_vcpus; i++) {
+		a = &s0->vcpu[i];
+		b = &s1->vcpu[i];
+		exits = b->exits - a->exits;
+		reqs = b->dm_requests - a->dm_requests;
+		printf("%-5d %9lu %8lu %8lu %8lu %8lu %8lu %8lu %8lu %9lu %8lu %8lu\n",
+			i, rate(a->exits, b->exits, ns),
+			exits ? (b->exit_cycles - a->exit_cycles) / exits : 0,
+			rate(a->ext_intr_exits, b->ext_intr_exits, ns),
+			rate(a->pio_exits, b->pio_exits, ns),
+			rate(a->ept_exits, b->ept_exits, ns),
+			rate(a->msr_exits, b->msr_exits, ns),
+			rate(a->hlt_exits, b->hlt_exits, ns),
+			rate(a->dm_requests, b->dm_requests, ns),
+			(reqs && khz) ? (b->dm_wait - a->dm_wait) * 1000 / khz / reqs : 0,
+			rate(a->intr_sent, b->intr_sent, ns),
+			rate(a->timer_fired, b->timer_fired, ns));
+	}
+
+	for (i = 0; i < ACRN_TELEMETRY_PTIRQS; i++) {
+		if (s1->ptirq[i] == 0)
+			continue;
+		printf("ptirq %u: %lu/s (%lu)\n", page->ptirq[i].pirq,
+			rate(s0->ptirq[i], s1->ptirq[i], ns), s1->ptirq[i]);
+	}
+	printf("\n");
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [-i interval_ms] [-n count] vm_name\n", prog);
+	printf("  -i interval_ms  between two reports, %d by default\n",
+		DEFAULT_INTERVAL_MS);
+	printf("  -n count        stop after that many reports, 0 (the default) until ^C\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct acrn_vm_telemetry *page;
+	struct sample samples[2];
+	char name[64];
+	int interval_ms = DEFAULT_INTERVAL_MS, count = 0;
+	int opt, fd, n, cur = 0;
+
+	while ((opt = getopt(argc, argv, "i:n:h")) != -1) {
+		switch (opt) {
+		case 'i':
+			interval_ms = atoi(optarg);
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return (opt == 'h') ? 0 : 1;
+		}
+	}
+
+	if (optind != argc - 1 || interval_ms <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	snprintf(name, sizeof(name), TELEMETRY_SHM_NAME, argv[optind]);
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		perror(name);
+		fprintf(stderr, "is acrn-dm running %s with --telemetry?\n",
+			argv[optind]);
+		return 1;
+	}
+	page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	if (page->nr_vcpus > ACRN_TELEMETRY_VCPUS) {
+		fprintf(stderr, "bad telemetry page, %u vcpus\n", page->nr_vcpus);
+		return 1;
+	}
+
+	take_sample(page, &samples[cur]);
+	for (n = 0; count == 0 || n < count; n++) {
+		usleep(interval_ms * 1000);
+		take_sample(page, &samples[cur ^ 1]);
+		report(page, &samples[cur], &samples[cur ^ 1]);
+		cur ^= 1;
+	}
+
+	munmap(page, sizeof(*page));
+	return 0;
+}
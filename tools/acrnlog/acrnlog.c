@@ -16,6 +16,10 @@
 #include <dirent.h>
 #include <errno.h>
 #include <pthread.h>
+#include <elf.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <zlib.h>
 
 #define LOG_ELEMENT_SIZE        80
 #define LOG_MSG_SIZE		480
@@ -23,6 +27,33 @@
 #define LOG_INCOMPLETE_WARNING	"WARNING: logs missing here! "\
 				"Try reducing polling interval"
 
+/*
+ * Binary records, written by the hypervisor when bit 3 of its log
+ * destination is set: the format string address and the raw arguments,
+ * formatted here with the strings of the hypervisor ELF image.
+ * Keep in sync with struct log_bin_header in hypervisor/include/debug/logmsg.h
+ */
+#define LOG_BIN_MARKER		0x01
+#define LOG_BIN_MAX_SIZE	(4 * LOG_ELEMENT_SIZE)
+
+struct log_bin_header {
+	__u8 marker;
+	__u8 severity;
+	__u8 nr_args;
+	__u8 nr_entries;
+	__u16 pcpu_id;
+	__u16 size;
+	__u32 seq;
+	__u32 reserved;
+	__u64 timestamp;
+	__u64 fmt;
+};
+
+/* The hypervisor image given with -e, to look the format strings up */
+static const char *hv_elf_path;
+static const Elf64_Ehdr *hv_elf;
+static size_t hv_elf_size;
+
 /* Count of /dev/acrn_hvlog_cur_xxx */
 static unsigned int dev_cnt;
 static unsigned long interval = DEFAULT_POLL_INTERVAL;
@@ -30,6 +61,7 @@ static unsigned long interval = DEFAULT_POLL_INTERVAL;
 /* this is for log file */
 #define LOG_FILE_SIZE	(1024*1024)
 #define LOG_FILE_NUM 	4
+#define LOG_WRITE_BUF_SIZE	(32*1024)
 static size_t hvlog_log_size = LOG_FILE_SIZE;
 static unsigned short hvlog_log_num = LOG_FILE_NUM;
 
@@ -40,8 +72,19 @@ struct hvlog_file {
 	size_t left_space;
 	unsigned short index;
 	unsigned short num;
+
+	/* messages not written yet, see flush_log_file() */
+	size_t buf_len;
+	char buf[LOG_WRITE_BUF_SIZE];
+
+	/* -z: gzip stream of the current file, one flush point per buf */
+	int compress;
+	z_stream zs;
 };
 
+/* File name suffix of the log files, ".gz" when they are compressed */
+static const char *log_suffix = "";
+
 static struct hvlog_file cur_log = {
 	.path = "/tmp/acrnlog/acrnlog_cur",
 	.fd = -1,
@@ -82,6 +125,222 @@ struct hvlog_dev {
 };
 
 size_t write_log_file(struct hvlog_file * log, const char *buf, size_t len);
+void flush_log_file(struct hvlog_file *log);
+
+static int hv_elf_load(const char *path)
+{
+	struct stat st;
+	void *addr;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		perror(path);
+		return -1;
+	}
+
+	hv_elf = addr;
+	hv_elf_size = st.st_size;
+	if (hv_elf_size < sizeof(Elf64_Ehdr) ||
+	    memcmp(hv_elf->e_ident, ELFMAG, SELFMAG) != 0 ||
+	    hv_elf->e_ident[EI_CLASS] != ELFCLASS64 ||
+	    hv_elf->e_shoff + (__u64)hv_elf->e_shnum * sizeof(Elf64_Shdr) > hv_elf_size) {
+		printf("%s is not a 64 bit ELF image\n", path);
+		munmap(addr, hv_elf_size);
+		hv_elf = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* The string at link address addr of the hypervisor, NULL if unknown */
+static const char *hv_elf_string(__u64 addr)
+{
+	const Elf64_Shdr *sh;
+	const char *s;
+	int i;
+
+	if (!hv_elf)
+		return NULL;
+
+	sh = (const Elf64_Shdr *)((const char *)hv_elf + hv_elf->e_shoff);
+	for (i = 0; i < hv_elf->e_shnum; i++, sh++) {
+		/* Format strings are data, and .trampoline is linked at 0 */
+		if (sh->sh_type != SHT_PROGBITS || !(sh->sh_flags & SHF_ALLOC) ||
+		    (sh->sh_flags & SHF_EXECINSTR))
+			continue;
+		if (addr < sh->sh_addr || addr >= sh->sh_addr + sh->sh_size)
+			continue;
+		if (sh->sh_offset + sh->sh_size > hv_elf_size)
+			return NULL;
+
+		s = (const char *)hv_elf + sh->sh_offset + (addr - sh->sh_addr);
+		if (!memchr(s, 0, sh->sh_addr + sh->sh_size - addr))
+			return NULL;
+		return s;
+	}
+
+	return NULL;
+}
+
+/*
+ * Format a binary record the way the hypervisor vsnprintf() would have:
+ * d, i, u, x, X, s and c take an argument, 'l' and "ll" mean 64 bit.
+ */
+static size_t hvlog_format_bin(char *out, size_t size, const char *rec)
+{
+	const struct log_bin_header *hdr = (const struct log_bin_header *)rec;
+	const __u64 *args = (const __u64 *)(rec + sizeof(*hdr));
+	const char *fmt, *start, *str;
+	char spec[32];
+	size_t len, n = 0;
+	int i = 0, ret, is_64bit;
+	__u64 arg;
+
+#define OUT_LEFT	((n < size) ? (size - n) : 0)
+	ret = snprintf(out, size, "[%lluus][cpu=%u][sev=%u][seq=%u]:",
+		       (unsigned long long)hdr->timestamp, hdr->pcpu_id,
+		       hdr->severity, hdr->seq);
+	n = ret > 0 ? ret : 0;
+
+	fmt = hv_elf_string(hdr->fmt);
+	if (!fmt) {
+		/* No image to format with, dump the record */
+		ret = snprintf(out + n, OUT_LEFT, "fmt@0x%llx",
+			       (unsigned long long)hdr->fmt);
+		n += ret > 0 ? ret : 0;
+		for (i = 0; i < hdr->nr_args; i++) {
+			ret = snprintf(out + n, OUT_LEFT, " 0x%llx",
+				       (unsigned long long)args[i]);
+			n += ret > 0 ? ret : 0;
+		}
+		return n < size ? n : size - 1;
+	}
+
+	while (*fmt && n < size - 1) {
+		if (*fmt != '%') {
+			out[n++] = *fmt++;
+			continue;
+		}
+
+		start = fmt++;
+		fmt += strspn(fmt, "#0-+ ");
+		fmt += strspn(fmt, "0123456789.");
+		is_64bit = (*fmt == 'l');
+		fmt += strspn(fmt, "hl");
+
+		if (!*fmt || !strchr("diuxXsc", *fmt)) {
+			/* "%%" or an unknown conversion, printed as is */
+			if (*fmt == '%') {
+				out[n++] = '%';
+			} else {
+				len = fmt - start + (*fmt ? 1 : 0);
+				ret = snprintf(out + n, OUT_LEFT, "%.*s", (int)len, start);
+				n += ret > 0 ? ret : 0;
+			}
+			if (*fmt)
+				fmt++;
+			continue;
+		}
+
+		if (i >= hdr->nr_args) {
+			ret = snprintf(out + n, OUT_LEFT, "<?>");
+			n += ret > 0 ? ret : 0;
+			fmt++;
+			continue;
+		}
+		arg = args[i++];
+
+		/* The spec up to the length, with "ll" for 64 bit arguments */
+		len = fmt - start;
+		if (len >= sizeof(spec) - 4)
+			len = sizeof(spec) - 4;
+		memcpy(spec, start, len);
+		if (is_64bit) {
+			while (len > 1 && spec[len - 1] == 'l')
+				len--;
+			spec[len++] = 'l';
+			spec[len++] = 'l';
+		}
+		spec[len++] = *fmt;
+		spec[len] = 0;
+
+		switch (*fmt) {
+		case 's':
+			str = "(null)";
+			if (arg != 0 && arg < hdr->size && hdr->size <= LOG_BIN_MAX_SIZE &&
+			    memchr(rec + arg, 0, hdr->size - arg))
+				str = rec + arg;
+			ret = snprintf(out + n, OUT_LEFT, spec, str);
+			break;
+		case 'd':
+		case 'i':
+			if (is_64bit)
+				ret = snprintf(out + n, OUT_LEFT, spec, (long long)arg);
+			else
+				ret = snprintf(out + n, OUT_LEFT, spec, (int)arg);
+			break;
+		case 'c':
+			ret = snprintf(out + n, OUT_LEFT, spec, (int)arg);
+			break;
+		default:
+			if (is_64bit)
+				ret = snprintf(out + n, OUT_LEFT, spec, (unsigned long long)arg);
+			else
+				ret = snprintf(out + n, OUT_LEFT, spec, (unsigned int)arg);
+			break;
+		}
+		n += ret > 0 ? ret : 0;
+		fmt++;
+	}
+#undef OUT_LEFT
+
+	n = n < size ? n : size - 1;
+	out[n] = 0;
+	return n;
+}
+
+/*
+ * Read the rest of the binary record whose first entry is first, and
+ * format it into msg.
+ */
+static struct hvlog_msg *hvlog_read_bin(struct hvlog_dev *dev, const char *first,
+					struct hvlog_msg *msg)
+{
+	char rec[LOG_BIN_MAX_SIZE] = {0};
+	const struct log_bin_header *hdr = (const struct log_bin_header *)rec;
+	int i;
+
+	memcpy(rec, first, LOG_ELEMENT_SIZE);
+	if (hdr->nr_entries == 0 || hdr->nr_entries * LOG_ELEMENT_SIZE > LOG_BIN_MAX_SIZE)
+		return NULL;
+
+	for (i = 1; i < hdr->nr_entries; i++) {
+		if (read(dev->fd, rec + i * LOG_ELEMENT_SIZE, LOG_ELEMENT_SIZE) != LOG_ELEMENT_SIZE)
+			return NULL;
+	}
+
+	memset(msg, 0, sizeof(struct hvlog_msg) + LOG_MSG_SIZE);
+	msg->usec = hdr->timestamp;
+	msg->cpu = hdr->pcpu_id;
+	msg->sev = hdr->severity;
+	msg->seq = hdr->seq;
+	msg->len = hvlog_format_bin(msg->raw, LOG_MSG_SIZE - 1, rec);
+	msg->raw[msg->len++] = '\n';
+	msg->raw[msg->len] = 0;
+
+	return msg;
+}
 
 static int get_dev_cnt(void)
 {
@@ -130,7 +389,10 @@ struct hvlog_msg *hvlog_read_dev(struct hvlog_dev *dev)
 	msg_num = 0;
 
 	do {
-		if (dev->latched) {
+		if (dev->latched && dev->entry_latch[0] == LOG_BIN_MARKER) {
+			dev->latched = 0;
+			return hvlog_read_bin(dev, dev->entry_latch, msg[0]);
+		} else if (dev->latched) {
 			/* handle the latched msg first */
 			dev->latched = 0;
 			memcpy(&msg[0]->raw[msg[0]->len], dev->entry_latch,
@@ -143,6 +405,16 @@ struct hvlog_msg *hvlog_read_dev(struct hvlog_dev *dev)
 				 LOG_ELEMENT_SIZE);
 			if (!ret)
 				break;
+			if (msg[0]->raw[msg[0]->len] == LOG_BIN_MARKER) {
+				if (msg_num == 0)
+					return hvlog_read_bin(dev, &msg[0]->raw[msg[0]->len], msg[0]);
+				/* The text message lost its end, keep the record for next time */
+				dev->latched = 1;
+				memcpy(dev->entry_latch, &msg[0]->raw[msg[0]->len],
+				       LOG_ELEMENT_SIZE);
+				msg[0]->raw[msg[0]->len] = 0;
+				break;
+			}
 			/* do we read a new meaasge?
 			 * msg[0]->raw[msg[0]->len format: [%lluus][cpu=%d][sev=%d][seq=%llu]: */
 			p = strstr(&msg[0]->raw[msg[0]->len], "][seq=");
@@ -246,72 +518,180 @@ static struct hvlog_data {
 } *cur, *last;
 
 /*
- * read the earliest msg from each dev, to hvlog_data[].msg
- * hvlog_data[] will be used for reordering
+ * Min-heap on the seq of the msg of the hvlog_data[] it indexes: the devs
+ * holding a msg, the earliest one on top.
  */
-static int hvlog_dev_read_msg(struct hvlog_data *data, int num_dev)
+struct hvlog_heap {
+	struct hvlog_data *data;
+	int *idx;
+	int num;
+};
+
+static __u64 hvlog_heap_seq(const struct hvlog_heap *heap, int pos)
+{
+	return heap->data[heap->idx[pos]].msg->seq;
+}
+
+static void hvlog_heap_swap(struct hvlog_heap *heap, int a, int b)
 {
-	int i, new_read;
+	int tmp = heap->idx[a];
+
+	heap->idx[a] = heap->idx[b];
+	heap->idx[b] = tmp;
+}
+
+static void hvlog_heap_push(struct hvlog_heap *heap, int i)
+{
+	int pos = heap->num++;
+
+	heap->idx[pos] = i;
+	while (pos > 0 && hvlog_heap_seq(heap, (pos - 1) / 2) >
+			  hvlog_heap_seq(heap, pos)) {
+		hvlog_heap_swap(heap, pos, (pos - 1) / 2);
+		pos = (pos - 1) / 2;
+	}
+}
+
+/* Take the earliest msg off the heap, return the index of its dev */
+static int hvlog_heap_pop(struct hvlog_heap *heap)
+{
+	int top = heap->idx[0];
+	int pos = 0, child;
+
+	heap->idx[0] = heap->idx[--heap->num];
+	while ((child = 2 * pos + 1) < heap->num) {
+		if (child + 1 < heap->num &&
+		    hvlog_heap_seq(heap, child + 1) < hvlog_heap_seq(heap, child))
+			child++;
+		if (hvlog_heap_seq(heap, pos) <= hvlog_heap_seq(heap, child))
+			break;
+		hvlog_heap_swap(heap, pos, child);
+		pos = child;
+	}
+
+	return top;
+}
+
+/* read a msg from each dev not holding one, and put them on the heap */
+static int hvlog_heap_fill(struct hvlog_heap *heap, int num_dev)
+{
+	struct hvlog_data *data = heap->data;
+	int i, new_read = 0;
 
-	new_read = 0;
 	for (i = 0; i < num_dev; i++) {
-		if (data[i].msg)
-			continue;
-		if (!data[i].dev)
+		if (data[i].msg || !data[i].dev)
 			continue;
 
 		data[i].msg = hvlog_read_dev(data[i].dev);
-		if (data[i].msg)
+		if (data[i].msg) {
+			hvlog_heap_push(heap, i);
 			new_read++;
+		}
 	}
 
 	return new_read;
 }
 
-static struct hvlog_msg *get_min_seq_msg(struct hvlog_data *data, int num_dev)
+static struct hvlog_msg *get_min_seq_msg(struct hvlog_heap *heap)
 {
-	int i, index_min = -1;
-	__u64 min_seq = 0;
 	struct hvlog_msg *msg;
+	int i;
 
-	for (i = 0; i < num_dev; i++) {
-		if (!data[i].msg)
-			continue;
+	if (!heap->num)
+		return NULL;
 
-		if (index_min == -1) {
-			index_min = i;
-			min_seq = data[i].msg->seq;
-			continue;
-		}
+	i = hvlog_heap_pop(heap);
+	msg = heap->data[i].msg;
+	heap->data[i].msg = NULL;
 
-		if (data[i].msg->seq > min_seq)
-			continue;
-		index_min = i;
-		min_seq = data[i].msg->seq;
+	return msg;
+}
+
+static size_t write_fd(struct hvlog_file *log, const char *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (log->fd >= 0 && done < len) {
+		ret = write(log->fd, buf + done, len - done);
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			break;
+		}
+		done += ret;
 	}
 
-	if (index_min == -1)
-		return NULL;
+	return done;
+}
 
-	msg = data[index_min].msg;
-	data[index_min].msg = NULL;
+/*
+ * Compress log->buf to the file. Z_FULL_FLUSH ends each buf on a byte
+ * boundary with a reset dictionary, so a file cut short (e.g. the current
+ * one, or on a crash) still decompresses up to its last flush.
+ */
+static void deflate_log_file(struct hvlog_file *log, int flush)
+{
+	char out[LOG_WRITE_BUF_SIZE];
+	size_t len;
 
-	return msg;
+	log->zs.next_in = (Bytef *)log->buf;
+	log->zs.avail_in = log->buf_len;
+	do {
+		log->zs.next_out = (Bytef *)out;
+		log->zs.avail_out = sizeof(out);
+		if (deflate(&log->zs, flush) == Z_STREAM_ERROR)
+			break;
+
+		len = write_fd(log, out, sizeof(out) - log->zs.avail_out);
+		log->left_space -= (len < log->left_space) ? len : log->left_space;
+	} while (log->zs.avail_out == 0);
+}
+
+/* The file space that write_log_file() of len bytes may take at most */
+static size_t log_space_needed(struct hvlog_file *log, size_t len)
+{
+	if (!log->compress)
+		return len;
+
+	return deflateBound(&log->zs, log->buf_len + len);
+}
+
+static int init_log_compress(struct hvlog_file *log)
+{
+	/* 15 + 16: the largest window, with a gzip header and trailer */
+	if (deflateInit2(&log->zs, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK)
+		return -1;
+
+	log->compress = 1;
+	return 0;
+}
+
+/* write what is left of the current file, and its gzip trailer */
+static void finish_log_file(struct hvlog_file *log)
+{
+	if (log->compress && log->fd >= 0)
+		deflate_log_file(log, Z_FINISH);
+	else
+		write_fd(log, log->buf, log->buf_len);
+	log->buf_len = 0;
 }
 
 static int new_log_file(struct hvlog_file *log)
 {
-	char file_name[32] = { };
+	char file_name[40] = { };
 
 	if (log->fd >= 0) {
 		if (!hvlog_log_size)
 			return 0;
+		finish_log_file(log);
 		close(log->fd);
 		log->fd = -1;
 	}
 
-	if (snprintf(file_name, sizeof(file_name), "%s.%hu", log->path,
-		 log->index + 1) >= sizeof(file_name)) {
+	if (snprintf(file_name, sizeof(file_name), "%s.%hu%s", log->path,
+		 log->index + 1, log_suffix) >= sizeof(file_name)) {
 		printf("WARN: log path is truncated\n");
 	} else
 		remove(file_name);
@@ -322,10 +702,13 @@ static int new_log_file(struct hvlog_file *log)
 		return -1;
 	}
 
+	if (log->compress)
+		deflateReset(&log->zs);
+
 	log->left_space = hvlog_log_size;
 	log->index++;
-	if (snprintf(file_name, sizeof(file_name), "%s.%hu", log->path,
-			log->index - hvlog_log_num) >= sizeof(file_name)) {
+	if (snprintf(file_name, sizeof(file_name), "%s.%hu%s", log->path,
+			log->index - hvlog_log_num, log_suffix) >= sizeof(file_name)) {
 		printf("WARN: log path is truncated\n");
 	} else
 		remove(file_name);
@@ -333,50 +716,137 @@ static int new_log_file(struct hvlog_file *log)
 	return 0;
 }
 
+void flush_log_file(struct hvlog_file *log)
+{
+	if (log->compress)
+		deflate_log_file(log, Z_FULL_FLUSH);
+	else
+		write_fd(log, log->buf, log->buf_len);
+
+	log->buf_len = 0;
+}
+
+/*
+ * Messages are gathered in log->buf, and written out once it is full, the
+ * file is rotated or flush_log_file() is called when the logs go idle.
+ * A compressed file accounts for its space as the compressed data is
+ * written: when the bound of the next flush may not fit, the buffer is
+ * flushed early to see what is really left, and only then rotated.
+ */
 size_t write_log_file(struct hvlog_file * log, const char *buf, size_t len)
 {
-	int ret;
+	if (log->compress && log->buf_len &&
+	    log_space_needed(log, len) >= log->left_space)
+		flush_log_file(log);
 
-	if (len >= log->left_space)
+	if (log_space_needed(log, len) >= log->left_space)
 		if (new_log_file(log))
 			return 0;
 
-	ret = write(log->fd, buf, len);
-	log->left_space -= ret;
+	if (log->buf_len + len > sizeof(log->buf))
+		flush_log_file(log);
+
+	memcpy(log->buf + log->buf_len, buf, len);
+	log->buf_len += len;
+	if (!log->compress)
+		log->left_space -= len;
+
+	return len;
+}
+
+/* consecutive wakeups poll() can report with nothing to read */
+#define POLL_EMPTY_WAKEUPS	3
+
+/*
+ * Wait for the cur devs to have logs. They are polled with the interval
+ * as timeout; if poll() keeps reporting them readable while they are
+ * empty, they don't support it and the interval is slept instead.
+ */
+static void hvlog_wait(struct pollfd *pfd, int num, unsigned int *empty_wakeups)
+{
+	int ret;
+
+	if (*empty_wakeups >= POLL_EMPTY_WAKEUPS) {
+		usleep(interval);
+		return;
+	}
 
-	return ret;
+	ret = poll(pfd, num, interval / 1000);
+	if (ret > 0)
+		(*empty_wakeups)++;
+	else if (ret < 0 && errno != EINTR)
+		*empty_wakeups = POLL_EMPTY_WAKEUPS;
 }
 
 static void *cur_read_func(void *arg)
 {
+	struct hvlog_heap heap = { .data = cur, .num = 0 };
+	struct pollfd *pfd;
 	struct hvlog_msg *msg;
 	__u64 last_seq = 0;
 	char warn_msg[LOG_MSG_SIZE] = {0};
+	unsigned int empty_wakeups = 0;
+	int i, num_pfd = 0;
+
+	heap.idx = calloc(dev_cnt, sizeof(int));
+	pfd = calloc(dev_cnt, sizeof(struct pollfd));
+	if (!heap.idx || !pfd) {
+		printf("Failed to allocate buf for cur log merge\n");
+		free(heap.idx);
+		free(pfd);
+		return NULL;
+	}
+
+	for (i = 0; i < dev_cnt; i++) {
+		if (!cur[i].dev)
+			continue;
+		pfd[num_pfd].fd = cur[i].dev->fd;
+		pfd[num_pfd].events = POLLIN;
+		num_pfd++;
+	}
 
 	while (1) {
-		hvlog_dev_read_msg(cur, dev_cnt);
-		msg = get_min_seq_msg(cur, dev_cnt);
-		if (!msg) {
-			usleep(interval);
+		if (hvlog_heap_fill(&heap, dev_cnt))
+			empty_wakeups = 0;
+		if (!heap.num) {
+			flush_log_file(&cur_log);
+			hvlog_wait(pfd, num_pfd, &empty_wakeups);
 			continue;
 		}
 
-		/* if msg->seq is not contineous, warn for logs missing */
-		if (last_seq + 1 < msg->seq) {
-			if (snprintf(warn_msg, LOG_MSG_SIZE,
-				 "\n\n\t%s[%lu ms]\n\n\n",
-				 LOG_INCOMPLETE_WARNING, interval) >= LOG_MSG_SIZE) {
-				printf("WARN: warning message is truncated\n");
+		/*
+		 * Go on with the dev of each msg written as long as the seqs
+		 * are contiguous; on a gap, the missing msg may be available
+		 * on one of the other devs, so read them again first.
+		 */
+		do {
+			i = heap.idx[0];
+			msg = get_min_seq_msg(&heap);
+
+			/* if msg->seq is not contineous, warn for logs missing */
+			if (last_seq + 1 < msg->seq) {
+				if (snprintf(warn_msg, LOG_MSG_SIZE,
+					 "\n\n\t%s[%lu ms]\n\n\n",
+					 LOG_INCOMPLETE_WARNING, interval) >= LOG_MSG_SIZE) {
+					printf("WARN: warning message is truncated\n");
+				}
+
+				write_log_file(&cur_log, warn_msg, strnlen(warn_msg, LOG_MSG_SIZE));
 			}
 
-			write_log_file(&cur_log, warn_msg, strnlen(warn_msg, LOG_MSG_SIZE));
-		}
+			last_seq = msg->seq;
 
-		last_seq = msg->seq;
+			write_log_file(&cur_log, msg->raw, msg->len);
 
-		write_log_file(&cur_log, msg->raw, msg->len);
+			/* msg is the buffer of the dev, read the next one now */
+			cur[i].msg = hvlog_read_dev(cur[i].dev);
+			if (cur[i].msg)
+				hvlog_heap_push(&heap, i);
+		} while (heap.num && hvlog_heap_seq(&heap, 0) == last_seq + 1);
 	}
 
+	free(heap.idx);
+	free(pfd);
 	return NULL;
 }
 
@@ -412,8 +882,12 @@ static int mk_dir(const char *path)
 			if (snprintf(acrnlog_file, sizeof(acrnlog_file), "%s/%s%d",
 					path, prefix, index++) >= sizeof(acrnlog_file)) {
 				printf("WARN: acrnlog file path is truncated\n");
-			} else
+			} else {
+				remove(acrnlog_file);
+				/* and the compressed one, -z may have changed */
+				strcat(acrnlog_file, ".gz");
 				remove(acrnlog_file);
+			}
 		}
 	}
 
@@ -421,18 +895,23 @@ static int mk_dir(const char *path)
 }
 
 /* for user optinal args */
-static const char optString[] = "s:n:t:h";
+static const char optString[] = "s:n:t:e:zh";
+static int log_compress;
 
 static void display_usage(void)
 {
 	printf("acrnlog - tool to collect ACRN hypervisor log\n"
-	       "[Usage] acrnlog [-s size] [-n number] [-t interval] [-h]\n\n"
+	       "[Usage] acrnlog [-s size] [-n number] [-t interval] [-e image] [-z] [-h]\n\n"
 	       "[Options]\n"
 	       "\t-h: print this message\n"
 	       "\t-t: polling interval to collect logs, in ms\n"
+	       "\t    (the longest wait when the logs are idle)\n"
 	       "\t-s: size limitation for each log file, in MB.\n"
 	       "\t    0 means no limitation.\n"
 	       "\t-n: how many files you would like to keep on disk\n"
+	       "\t-e: hypervisor ELF image (acrn.out), to format binary logs\n"
+	       "\t-z: gzip compress the log files, the size limit applies\n"
+	       "\t    to the compressed files\n"
 	       "[Output] capatured log files under /tmp/acrnlog/\n");
 }
 
@@ -471,6 +950,12 @@ static int parse_opt(int argc, char *argv[])
 			interval = ret * 1000;
 			printf("Polling interval is %u ms\n", ret);
 			break;
+		case 'e':
+			hv_elf_path = optarg;
+			break;
+		case 'z':
+			log_compress = 1;
+			break;
 		case 'h':
 			display_usage();
 			return -EINVAL;
@@ -495,6 +980,17 @@ int main(int argc, char *argv[])
 	if (parse_opt(argc, argv))
 		return -1;
 
+	if (hv_elf_path && hv_elf_load(hv_elf_path))
+		printf("Binary logs will not be formatted\n");
+
+	if (log_compress) {
+		if (init_log_compress(&cur_log) || init_log_compress(&last_log)) {
+			printf("Failed to init log compression\n");
+			return -1;
+		}
+		log_suffix = ".gz";
+	}
+
 	ret = mk_dir("/tmp/acrnlog");
 	if (ret) {
 		printf("Cannot create /tmp/acrnlog. Error: %s\n",
@@ -561,13 +1057,18 @@ int main(int argc, char *argv[])
 	}
 
 	if (num_last) {
-		while (1) {
-			hvlog_dev_read_msg(last, dev_cnt);
-			msg = get_min_seq_msg(last, dev_cnt);
+		struct hvlog_heap heap = { .data = last, .num = 0 };
+
+		heap.idx = calloc(dev_cnt, sizeof(int));
+		while (heap.idx) {
+			hvlog_heap_fill(&heap, dev_cnt);
+			msg = get_min_seq_msg(&heap);
 			if (!msg)
 				break;
 			write_log_file(&last_log, msg->raw, msg->len);
 		}
+		finish_log_file(&last_log);
+		free(heap.idx);
 	}
 
 	if (cur_thread)
@@ -0,0 +1,773 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * acrnalyze - streaming analyzer of acrntrace data
+ *
+ * Computes the vm_exit and irq reports of acrnalyze.py in one pass over
+ * either a raw per-CPU trace file or a packed container (see trace_pack.h),
+ * and packs the per-CPU files of an acrntrace run into such a container.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "acrntrace.h"
+#include "trace_pack.h"
+
+#undef pr_fmt
+#define pr_fmt(fmt)		"acrnalyze: " fmt
+
+#define DEFAULT_TSC_FREQ	1881.6	/* MHz, as in scripts/config.py */
+#define MAX_CPUS		64
+#define PATH_LEN		256
+
+#define EVENT_ID_MASK		0xffffffffffffUL
+#define EVENT_CPU_SHIFT		56
+
+#define TRACE_VM_EXIT		0x10
+#define TRACE_VM_ENTER		0x11
+#define TRACE_VMEXIT_UNHANDLED	0x20000
+#define NR_IRQ_VECTORS		256
+
+/* Event dictionary of the packer: open addressing on the event id */
+#define DICT_SLOTS		8192
+#define DICT_MAX_EVENTS		(DICT_SLOTS / 2)
+
+#define FLAG_VM_EXIT		(1U << 0)
+#define FLAG_IRQ		(1U << 1)
+#define FLAG_LIST_EVENTS	(1U << 2)
+
+static const struct {
+	uint64_t id;
+	const char *name;
+} event_names[] = {
+	{ 0x00000001, "TIMER_ACTION_ADDED" },
+	{ 0x00000002, "TIMER_ACTION_PCKUP" },
+	{ 0x00000003, "TIMER_ACTION_UPDAT" },
+	{ 0x00000004, "TIMER_IRQ" },
+	{ 0x00000005, "SOFTIRQ" },
+	{ 0x00000010, "VM_EXIT" },
+	{ 0x00000011, "VM_ENTER" },
+	{ 0x000000fc, "CUSTOM" },
+	{ 0x000000fd, "FUNC_ENTER" },
+	{ 0x000000fe, "FUNC_EXIT" },
+	{ 0x000000ff, "STR" },
+	{ TRACE_VMEXIT_ENTRY + 0x00, "VMEXIT_EXCEPTION_OR_NMI" },
+	{ TRACE_VMEXIT_ENTRY + 0x01, "VMEXIT_EXTERNAL_INTERRUPT" },
+	{ TRACE_VMEXIT_ENTRY + 0x02, "VMEXIT_INTERRUPT_WINDOW" },
+	{ TRACE_VMEXIT_ENTRY + 0x04, "VMEXIT_CPUID" },
+	{ TRACE_VMEXIT_ENTRY + 0x10, "VMEXIT_RDTSC" },
+	{ TRACE_VMEXIT_ENTRY + 0x12, "VMEXIT_VMCALL" },
+	{ TRACE_VMEXIT_ENTRY + 0x1c, "VMEXIT_CR_ACCESS" },
+	{ TRACE_VMEXIT_ENTRY + 0x1e, "VMEXIT_IO_INSTRUCTION" },
+	{ TRACE_VMEXIT_ENTRY + 0x1f, "VMEXIT_RDMSR" },
+	{ TRACE_VMEXIT_ENTRY + 0x20, "VMEXIT_WRMSR" },
+	{ TRACE_VMEXIT_ENTRY + 0x30, "VMEXIT_EPT_VIOLATION" },
+	{ TRACE_VMEXIT_ENTRY + 0x31, "VMEXIT_EPT_MISCONFIGURATION" },
+	{ TRACE_VMEXIT_ENTRY + 0x33, "VMEXIT_RDTSCP" },
+	{ TRACE_VMEXIT_ENTRY + 0x38, "VMEXIT_APICV_WRITE" },
+	{ TRACE_VMEXIT_ENTRY + 0x39, "VMEXIT_APICV_ACCESS" },
+	{ TRACE_VMEXIT_ENTRY + 0x3a, "VMEXIT_APICV_VIRT_EOI" },
+	{ TRACE_VMEXIT_UNHANDLED, "VMEXIT_UNHANDLED" },
+};
+
+#define NR_EVENT_NAMES	(sizeof(event_names) / sizeof(event_names[0]))
+
+/* Statistics of one pCPU, updated record by record */
+struct cpu_stats {
+	uint64_t nr_records;
+
+	/* vm_exit: accounted from the first VM_ENTER on */
+	int running;
+	int last_reason;
+	uint64_t tsc_begin, tsc_end, tsc_exit;
+	uint64_t total_exits;
+	uint64_t nr_exits[TRACE_VMEXIT_REASONS];
+	uint64_t time_in_exit[TRACE_VMEXIT_REASONS];
+	uint64_t nr_unhandled;
+
+	/* irq */
+	uint64_t irq_begin, irq_end;
+	uint64_t irq_exits[NR_IRQ_VECTORS];
+};
+
+static struct cpu_stats *stats;
+static uint64_t window_begin, window_end = UINT64_MAX;
+static double tsc_freq = DEFAULT_TSC_FREQ;
+static uint32_t flags;
+
+static void display_usage(void)
+{
+	printf("acrnalyze - streaming analyzer of ACRN trace data\n"
+	       "[Usage] acrnalyze -i ifile [-o ofile] [-f freq] [-w begin:end]"
+	       " [--vm_exit] [--irq] [-l]\n"
+	       "        acrnalyze -p -i trace_dir -o container\n\n"
+	       "[Options]\n"
+	       "\t-h: print this message\n"
+	       "\t-i: input: raw trace data file or packed container,\n"
+	       "\t    acrntrace output directory with -p\n"
+	       "\t-o: output: report, written to ofile.csv; container with -p\n"
+	       "\t-f: TSC frequency in MHz\n"
+	       "\t-w: only analyze the records in this TSC window\n"
+	       "\t-l: list the event dictionary of a container\n"
+	       "\t-p: pack the per-CPU files of trace_dir into a container\n"
+	       "\t--vm_exit: generate vm_exit report\n"
+	       "\t--irq: generate irq related report\n");
+}
+
+static const char *event_name(uint64_t id)
+{
+	size_t i;
+
+	for (i = 0; i < NR_EVENT_NAMES; i++) {
+		if (event_names[i].id == id)
+			return event_names[i].name;
+	}
+
+	return NULL;
+}
+
+static int read_full(int fd, void *buf, size_t len, off_t off)
+{
+	ssize_t ret;
+	size_t done = 0;
+
+	while (done < len) {
+		ret = pread(fd, (char *)buf + done, len - done, off + done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		done += ret;
+	}
+
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len, off_t off)
+{
+	ssize_t ret;
+	size_t done = 0;
+
+	while (done < len) {
+		ret = pwrite(fd, (const char *)buf + done, len - done, off + done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		done += ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Analysis
+ */
+
+static void account_vm_exit(struct cpu_stats *cs, uint64_t id, const trace_ev_t *ev)
+{
+	if (id == TRACE_VM_ENTER) {
+		if (!cs->running) {
+			cs->running = 1;
+			cs->tsc_begin = ev->tsc;
+			cs->tsc_exit = ev->tsc;
+		} else if (cs->last_reason >= 0) {
+			cs->time_in_exit[cs->last_reason] += ev->tsc - cs->tsc_exit;
+		}
+		cs->last_reason = -1;
+		cs->tsc_end = ev->tsc;
+	} else if (!cs->running) {
+		/* wait for the first VM entry */
+	} else if (id == TRACE_VM_EXIT) {
+		/* The basic exit reason is in the first data word */
+		cs->last_reason = (ev->e & 0xffff) < TRACE_VMEXIT_REASONS ?
+			(int)(ev->e & 0xffff) : -1;
+		if (cs->last_reason >= 0)
+			cs->nr_exits[cs->last_reason]++;
+		cs->tsc_exit = ev->tsc;
+		cs->tsc_end = ev->tsc;
+		cs->total_exits++;
+	} else if (id == TRACE_VMEXIT_UNHANDLED) {
+		cs->nr_unhandled++;
+	}
+}
+
+static void account_irq(struct cpu_stats *cs, uint64_t id, const trace_ev_t *ev)
+{
+	if (cs->irq_begin == 0)
+		cs->irq_begin = ev->tsc;
+	cs->irq_end = ev->tsc;
+
+	if (id == TRACE_VMEXIT_ENTRY + 0x01 && ev->e < NR_IRQ_VECTORS)
+		cs->irq_exits[ev->e]++;
+}
+
+static void account_records(const trace_ev_t *ev, size_t nr)
+{
+	struct cpu_stats *cs;
+	uint64_t id;
+	size_t i;
+
+	for (i = 0; i < nr; i++, ev++) {
+		if (ev->tsc < window_begin || ev->tsc > window_end)
+			continue;
+
+		cs = &stats[(ev->id >> EVENT_CPU_SHIFT) % MAX_CPUS];
+		id = ev->id & EVENT_ID_MASK;
+		cs->nr_records++;
+
+		if (flags & FLAG_VM_EXIT)
+			account_vm_exit(cs, id, ev);
+		if (flags & FLAG_IRQ)
+			account_irq(cs, id, ev);
+	}
+}
+
+/* Raw acrntrace output: stream it through in container sized blocks */
+static int analyze_raw(int fd, trace_ev_t *buf)
+{
+	const size_t len = TRACE_PACK_BLOCK_RECORDS * sizeof(trace_ev_t);
+	size_t have = 0;
+	ssize_t ret;
+
+	while (1) {
+		ret = read(fd, (char *)buf + have, len - have);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			pr_err("Failed to read trace data, errno %d\n", errno);
+			return -1;
+		}
+
+		have += ret;
+		if (ret == 0 || have == len) {
+			account_records(buf, have / sizeof(trace_ev_t));
+			if (ret == 0)
+				break;
+			have = 0;
+		}
+	}
+
+	return 0;
+}
+
+static int compare_blocks(const void *a, const void *b)
+{
+	const struct trace_pack_block *x = a, *y = b;
+
+	if (x->first_tsc != y->first_tsc)
+		return (x->first_tsc < y->first_tsc) ? -1 : 1;
+	return (x->offset < y->offset) ? -1 : (x->offset > y->offset);
+}
+
+static int load_table(int fd, void **table, size_t nr, size_t size, uint64_t off)
+{
+	*table = calloc(nr ? nr : 1, size);
+	if (!*table) {
+		pr_err("Failed to allocate memory\n");
+		return -1;
+	}
+
+	if (read_full(fd, *table, nr * size, off)) {
+		pr_err("Failed to read container, errno %d\n", errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void list_events(const struct trace_pack_event *events, uint32_t nr)
+{
+	uint32_t i;
+
+	printf("%-18s\t%-28s\t%s\n", "Event", "Name", "Count");
+	for (i = 0; i < nr; i++)
+		printf("0x%016lx\t%-28.*s\t%lu\n", events[i].id,
+		       TRACE_PACK_NAME_LEN, events[i].name, events[i].count);
+}
+
+static int analyze_container(int fd, const struct trace_pack_header *hdr,
+		trace_ev_t *buf)
+{
+	struct trace_pack_block *blocks = NULL;
+	struct trace_pack_event *events = NULL;
+	uint32_t i, skipped = 0;
+	int err = -1;
+
+	if (hdr->version != TRACE_PACK_VERSION ||
+			hdr->record_size != TRACE_PACK_RECORD_SIZE) {
+		pr_err("Unsupported container version %u\n", hdr->version);
+		return -1;
+	}
+
+	if (load_table(fd, (void **)&blocks, hdr->nr_blocks,
+			sizeof(*blocks), hdr->index_offset) ||
+	    load_table(fd, (void **)&events, hdr->nr_events,
+			sizeof(*events), hdr->dict_offset))
+		goto out;
+
+	if (flags & FLAG_LIST_EVENTS)
+		list_events(events, hdr->nr_events);
+
+	/* The index is sorted by TSC: skip the blocks out of the window */
+	for (i = 0; i < hdr->nr_blocks; i++) {
+		if (blocks[i].first_tsc > window_end)
+			break;
+		if (blocks[i].last_tsc < window_begin ||
+				blocks[i].nr_records > TRACE_PACK_BLOCK_RECORDS) {
+			skipped++;
+			continue;
+		}
+
+		if (read_full(fd, buf, blocks[i].nr_records * sizeof(trace_ev_t),
+				blocks[i].offset)) {
+			pr_err("Failed to read block %u, errno %d\n", i, errno);
+			goto out;
+		}
+		account_records(buf, blocks[i].nr_records);
+	}
+
+	pr_dbg("%u of %u blocks read\n", i - skipped, hdr->nr_blocks);
+	err = 0;
+out:
+	free(blocks);
+	free(events);
+	return err;
+}
+
+/*
+ * Reports, in the format of acrnalyze.py
+ */
+
+static void report_vm_exit(FILE *csv, uint32_t cpu, const struct cpu_stats *cs)
+{
+	uint64_t rt_cycle = cs->tsc_end - cs->tsc_begin;
+	uint64_t total_exit_time = 0, nr, time;
+	double rt_sec, ev_freq, pct;
+	char name[TRACE_PACK_NAME_LEN];
+	const char *known;
+	int r;
+
+	if (!cs->running || rt_cycle == 0) {
+		printf("CPU%u: no VM entry in the trace, no vm_exit report\n", cpu);
+		return;
+	}
+
+	rt_sec = (double)rt_cycle / (tsc_freq * 1000 * 1000);
+	for (r = 0; r < TRACE_VMEXIT_REASONS; r++)
+		total_exit_time += cs->time_in_exit[r];
+
+	printf("CPU%u\n", cpu);
+	printf("Total run time: %lu cycles\n", rt_cycle);
+	printf("TSC Freq: %f MHz\n", tsc_freq);
+	printf("Total run time: %d sec\n", (int)rt_sec);
+
+	if (csv) {
+		fprintf(csv, "CPU%u\n", cpu);
+		fprintf(csv, "Run time(cycles),Run time(Sec),Freq(MHz)\n");
+		fprintf(csv, "%lu,%.3f,%d\n", rt_cycle, rt_sec, (int)tsc_freq);
+		fprintf(csv, "Exit_Reason,NR_Exit,NR_Exit/Sec,"
+			"Time Consumed(cycles),Time Percentage\n");
+	}
+
+	printf("%-28s\t%-12s\t%-12s\t%-24s\t%-16s\n", "Event", "NR_Exit",
+	       "NR_Exit/Sec", "Time Consumed(cycles)", "Time percentage");
+
+	/* The named exits always, the others as far as they happened */
+	for (r = 0; r <= TRACE_VMEXIT_REASONS; r++) {
+		if (r == TRACE_VMEXIT_REASONS) {
+			known = event_name(TRACE_VMEXIT_UNHANDLED);
+			nr = cs->nr_unhandled;
+			time = 0;
+		} else {
+			known = event_name(TRACE_VMEXIT_ENTRY + r);
+			nr = cs->nr_exits[r];
+			time = cs->time_in_exit[r];
+		}
+
+		if (known)
+			snprintf(name, sizeof(name), "%s", known);
+		else if (nr)
+			snprintf(name, sizeof(name), "VMEXIT_0x%02x", r);
+		else
+			continue;
+
+		ev_freq = (double)nr / rt_sec;
+		pct = (double)time * 100 / (double)rt_cycle;
+		printf("%-28s\t%-12lu\t%-12.2f\t%-24lu\t%-16.2f\n",
+		       name, nr, ev_freq, time, pct);
+		if (csv)
+			fprintf(csv, "%s,%lu,%.2f,%lu,%2.2f\n",
+				name, nr, ev_freq, time, pct);
+	}
+
+	ev_freq = (double)cs->total_exits / rt_sec;
+	pct = (double)total_exit_time * 100 / (double)rt_cycle;
+	printf("%-28s\t%-12lu\t%-12.2f\t%-24lu\t%-16.2f\n",
+	       "Total", cs->total_exits, ev_freq, total_exit_time, pct);
+	if (csv)
+		fprintf(csv, "Total,%lu,%.2f,%lu,%2.2f\n",
+			cs->total_exits, ev_freq, total_exit_time, pct);
+}
+
+static void report_irq(FILE *csv, uint32_t cpu, const struct cpu_stats *cs)
+{
+	uint64_t rt_cycle = cs->irq_end - cs->irq_begin;
+	double rt_sec, pct;
+	int v;
+
+	if (rt_cycle == 0) {
+		printf("CPU%u: trace too short, no irq report\n", cpu);
+		return;
+	}
+
+	rt_sec = (double)rt_cycle / (tsc_freq * 1000 * 1000);
+
+	printf("CPU%u\n", cpu);
+	printf("%-8s\t%-8s\t%-8s\n", "Vector", "Count", "NR_Exit/Sec");
+	if (csv) {
+		fprintf(csv, "CPU%u\n", cpu);
+		fprintf(csv, "Vector,NR_Exit,NR_Exit/Sec\n");
+	}
+
+	for (v = 0; v < NR_IRQ_VECTORS; v++) {
+		if (!cs->irq_exits[v])
+			continue;
+		pct = (double)cs->irq_exits[v] / rt_sec;
+		printf("0x%08x\t%-8lu\t%-8.2f\n", v, cs->irq_exits[v], pct);
+		if (csv)
+			fprintf(csv, "0x%08x,%lu,%.2f\n", v, cs->irq_exits[v], pct);
+	}
+}
+
+static int analyze(const char *ifile, const char *ofile)
+{
+	struct trace_pack_header hdr;
+	char csv_name[PATH_LEN];
+	trace_ev_t *buf = NULL;
+	FILE *csv = NULL;
+	uint32_t cpu;
+	int fd, err = -1;
+
+	fd = open(ifile, O_RDONLY);
+	if (fd < 0) {
+		pr_err("Failed to open %s, errno %d\n", ifile, errno);
+		return -1;
+	}
+
+	stats = calloc(MAX_CPUS, sizeof(*stats));
+	buf = malloc(TRACE_PACK_BLOCK_RECORDS * sizeof(trace_ev_t));
+	if (!stats || !buf) {
+		pr_err("Failed to allocate memory\n");
+		goto out;
+	}
+	for (cpu = 0; cpu < MAX_CPUS; cpu++)
+		stats[cpu].last_reason = -1;
+
+	if (!read_full(fd, &hdr, sizeof(hdr), 0) &&
+			!memcmp(hdr.magic, TRACE_PACK_MAGIC, sizeof(TRACE_PACK_MAGIC)))
+		err = analyze_container(fd, &hdr, buf);
+	else
+		err = analyze_raw(fd, buf);
+	if (err)
+		goto out;
+
+	if (ofile) {
+		if (snprintf(csv_name, PATH_LEN, "%s.csv", ofile) >= PATH_LEN)
+			printf("WARN: report file name is truncated\n");
+		csv = fopen(csv_name, "a");
+		if (!csv)
+			pr_err("Failed to open %s, errno %d\n", csv_name, errno);
+	}
+
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		if (!stats[cpu].nr_records)
+			continue;
+		if (flags & FLAG_VM_EXIT)
+			report_vm_exit(csv, cpu, &stats[cpu]);
+		if (flags & FLAG_IRQ)
+			report_irq(csv, cpu, &stats[cpu]);
+	}
+
+	if (csv)
+		fclose(csv);
+out:
+	free(buf);
+	free(stats);
+	close(fd);
+	return err;
+}
+
+/*
+ * Packing
+ */
+
+struct pack_dict {
+	struct trace_pack_event slot[DICT_SLOTS];
+	uint32_t used[DICT_SLOTS];
+	uint32_t nr;
+};
+
+static int dict_count(struct pack_dict *dict, uint64_t id)
+{
+	uint32_t i = (uint32_t)((id * 0x9e3779b97f4a7c15UL) >> 51) % DICT_SLOTS;
+
+	while (dict->used[i] && dict->slot[i].id != id)
+		i = (i + 1) % DICT_SLOTS;
+
+	if (!dict->used[i]) {
+		if (dict->nr == DICT_MAX_EVENTS)
+			return -1;
+		dict->used[i] = 1;
+		dict->slot[i].id = id;
+		dict->nr++;
+	}
+	dict->slot[i].count++;
+
+	return 0;
+}
+
+static int pack_cpu(int in, int out, uint16_t cpu, uint64_t *off,
+		struct trace_pack_block **blocks, uint32_t *nr_blocks,
+		struct pack_dict *dict, trace_ev_t *buf)
+{
+	const size_t len = TRACE_PACK_BLOCK_RECORDS * sizeof(trace_ev_t);
+	struct trace_pack_block *blk;
+	size_t have, i, nr;
+	ssize_t ret;
+
+	while (1) {
+		have = 0;
+		do {
+			ret = read(in, (char *)buf + have, len - have);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret < 0) {
+				pr_err("Failed to read CPU%u data, errno %d\n", cpu, errno);
+				return -1;
+			}
+			have += ret;
+		} while (ret != 0 && have < len);
+
+		nr = have / sizeof(trace_ev_t);
+		if (nr == 0)
+			return 0;
+
+		blk = realloc(*blocks, (*nr_blocks + 1) * sizeof(*blk));
+		if (!blk) {
+			pr_err("Failed to allocate memory\n");
+			return -1;
+		}
+		*blocks = blk;
+		blk += (*nr_blocks)++;
+		memset(blk, 0, sizeof(*blk));
+		blk->offset = *off;
+		blk->first_tsc = buf[0].tsc;
+		blk->last_tsc = buf[nr - 1].tsc;
+		blk->nr_records = nr;
+		blk->cpu = cpu;
+
+		for (i = 0; i < nr; i++) {
+			if (dict_count(dict, buf[i].id & EVENT_ID_MASK)) {
+				pr_err("Too many distinct event ids\n");
+				return -1;
+			}
+		}
+
+		if (write_full(out, buf, nr * sizeof(trace_ev_t), *off)) {
+			pr_err("Failed to write container, errno %d\n", errno);
+			return -1;
+		}
+		*off += nr * sizeof(trace_ev_t);
+
+		if (ret == 0)
+			return 0;
+	}
+}
+
+static int pack(const char *dir, const char *ofile)
+{
+	struct trace_pack_block *blocks = NULL;
+	struct trace_pack_event *events = NULL;
+	struct trace_pack_header hdr;
+	struct pack_dict *dict = NULL;
+	trace_ev_t *buf = NULL;
+	char path[PATH_LEN];
+	uint64_t off = sizeof(hdr);
+	uint32_t cpu, i, n;
+	const char *name;
+	int in, out, err = -1;
+
+	out = open(ofile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0) {
+		pr_err("Failed to open %s, errno %d\n", ofile, errno);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	dict = calloc(1, sizeof(*dict));
+	buf = malloc(TRACE_PACK_BLOCK_RECORDS * sizeof(trace_ev_t));
+	if (!dict || !buf) {
+		pr_err("Failed to allocate memory\n");
+		goto out;
+	}
+
+	/* acrntrace names the per-CPU files 0, 1, ... */
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		if (snprintf(path, PATH_LEN, "%s/%u", dir, cpu) >= PATH_LEN) {
+			pr_err("Trace file name is too long\n");
+			goto out;
+		}
+		in = open(path, O_RDONLY);
+		if (in < 0)
+			break;
+
+		err = pack_cpu(in, out, cpu, &off, &blocks, &hdr.nr_blocks, dict, buf);
+		close(in);
+		if (err)
+			goto out;
+		err = -1;
+	}
+
+	if (cpu == 0) {
+		pr_err("No trace data file in %s\n", dir);
+		goto out;
+	}
+
+	qsort(blocks, hdr.nr_blocks, sizeof(*blocks), compare_blocks);
+
+	events = calloc(dict->nr ? dict->nr : 1, sizeof(*events));
+	if (!events) {
+		pr_err("Failed to allocate memory\n");
+		goto out;
+	}
+	for (i = 0, n = 0; i < DICT_SLOTS; i++) {
+		if (!dict->used[i])
+			continue;
+		events[n] = dict->slot[i];
+		name = event_name(events[n].id);
+		if (name)
+			strncpy(events[n].name, name, TRACE_PACK_NAME_LEN - 1);
+		n++;
+	}
+
+	memcpy(hdr.magic, TRACE_PACK_MAGIC, sizeof(TRACE_PACK_MAGIC));
+	hdr.version = TRACE_PACK_VERSION;
+	hdr.record_size = TRACE_PACK_RECORD_SIZE;
+	hdr.nr_cpus = cpu;
+	hdr.nr_events = n;
+	hdr.index_offset = off;
+	hdr.dict_offset = off + hdr.nr_blocks * sizeof(*blocks);
+
+	if (write_full(out, blocks, hdr.nr_blocks * sizeof(*blocks), hdr.index_offset) ||
+	    write_full(out, events, n * sizeof(*events), hdr.dict_offset) ||
+	    write_full(out, &hdr, sizeof(hdr), 0)) {
+		pr_err("Failed to write container, errno %d\n", errno);
+		goto out;
+	}
+
+	pr_info("packed %u CPUs, %u blocks, %u event ids into %s\n",
+		hdr.nr_cpus, hdr.nr_blocks, hdr.nr_events, ofile);
+	err = 0;
+out:
+	free(events);
+	free(blocks);
+	free(dict);
+	free(buf);
+	close(out);
+	return err;
+}
+
+static int parse_window(char *arg)
+{
+	char *end;
+
+	errno = 0;
+	window_begin = strtoul(arg, &end, 0);
+	if (errno || *end != ':')
+		return -EINVAL;
+
+	if (*(end + 1) != '\0') {
+		window_end = strtoul(end + 1, &end, 0);
+		if (errno || *end != '\0' || window_end < window_begin)
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option opts_long[] = {
+		{ "ifile", required_argument, NULL, 'i' },
+		{ "ofile", required_argument, NULL, 'o' },
+		{ "frequency", required_argument, NULL, 'f' },
+		{ "vm_exit", no_argument, NULL, 'V' },
+		{ "irq", no_argument, NULL, 'I' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char *ifile = NULL, *ofile = NULL;
+	int opt, do_pack = 0;
+
+	while ((opt = getopt_long(argc, argv, "hi:o:f:w:lp", opts_long, NULL)) != -1) {
+		switch (opt) {
+		case 'i':
+			ifile = optarg;
+			break;
+		case 'o':
+			ofile = optarg;
+			break;
+		case 'f':
+			tsc_freq = strtod(optarg, NULL);
+			if (tsc_freq <= 0) {
+				pr_err("'-f' requires a frequency in MHz\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'w':
+			if (parse_window(optarg)) {
+				pr_err("'-w' requires begin:end TSC values\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'l':
+			flags |= FLAG_LIST_EVENTS;
+			break;
+		case 'p':
+			do_pack = 1;
+			break;
+		case 'V':
+			flags |= FLAG_VM_EXIT;
+			break;
+		case 'I':
+			flags |= FLAG_IRQ;
+			break;
+		default:
+			display_usage();
+			return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (!ifile || (do_pack && !ofile) || (!do_pack && !flags)) {
+		display_usage();
+		return EXIT_FAILURE;
+	}
+
+	if (do_pack)
+		return pack(ifile, ofile) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	return analyze(ifile, ofile) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -9,6 +9,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <sys/statvfs.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -29,11 +30,13 @@ static int exiting = 0;
 
 /* for opt */
 static uint64_t period = 10000;
-static const char optString[] = "i:hct:";
+static int period_set = 0;
+static const char optString[] = "i:hct:e:a";
 static const char dev_prefix[] = "acrn_trace_";
 
 static uint32_t flags;
 static char trace_file_dir[TRACE_FILE_DIR_LEN];
+static trace_mask_t trace_mask;
 
 static reader_struct *reader;
 static int dev_cnt = 0; /* Count of /dev/acrn_trace_xxx devices */
@@ -41,12 +44,104 @@ static int dev_cnt = 0; /* Count of /dev/acrn_trace_xxx devices */
 static void display_usage(void)
 {
 	printf("acrntrace - tool to collect ACRN trace data\n"
-	       "[Usage] acrntrace [-i period] [-t max_time] [-ch]\n\n"
+	       "[Usage] acrntrace [-i period] [-t max_time] [-e events] [-cah]\n\n"
 	       "[Options]\n"
 	       "\t-h: print this message\n"
 	       "\t-i: period_in_ms: specify polling interval [1-999]\n"
 	       "\t-t: max time to capture trace data (in second)\n"
-	       "\t-c: clear the buffered old data\n");
+	       "\t-c: clear the buffered old data\n"
+	       "\t-e: only capture the given comma separated events: event ids,\n"
+	       "\t    'vmexit' for all VM exits or 'other' for the ids above 0xff\n"
+	       "\t    which are not VM exits\n"
+	       "\t-a: aggregate: save per-CPU event counts and VM exit latency\n"
+	       "\t    histograms every period (default 500ms) instead of events\n");
+}
+
+static int set_aggregation(int fd, uint32_t cmd)
+{
+	if (ioctl(fd, TRACE_IOC_AGGREGATE, &cmd) < 0) {
+		pr_err("Failed to %s the aggregation, errno %d\n",
+			cmd == TRACE_AGGR_START ? "start" : "stop", errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* VM exit counts, average and worst case latency from a snapshot */
+static void aggr_summary(const char *dev_name, const trace_aggr_t *aggr)
+{
+	uint64_t nr;
+	int r, b;
+
+	pr_info("%s: %lu cycles aggregated\n", dev_name, aggr->tsc - aggr->start_tsc);
+	printf("%-8s\t%-12s\t%-12s\t%s\n", "Reason", "NR_Exit",
+		"Avg(cycles)", "Max(cycles)");
+	for (r = 0; r < TRACE_VMEXIT_REASONS; r++) {
+		nr = 0;
+		for (b = 0; b < TRACE_AGGR_HIST_BUCKETS; b++)
+			nr += aggr->exit_hist[r][b];
+		if (nr == 0)
+			continue;
+
+		for (b = TRACE_AGGR_HIST_BUCKETS - 1; aggr->exit_hist[r][b] == 0; b--)
+			;
+		printf("0x%02x    \t%-12lu\t%-12lu\t< %lu\n", r, nr,
+			aggr->exit_cycles[r] / nr, 1UL << (b + 1));
+	}
+}
+
+static void trace_mask_set_bit(uint32_t bit)
+{
+	trace_mask.mask[bit / 64] |= 1UL << (bit % 64);
+}
+
+static int parse_event_mask(char *list)
+{
+	char *tok, *end, *save = NULL;
+	unsigned long evid;
+	int i;
+
+	for (tok = strtok_r(list, ",", &save); tok != NULL;
+			tok = strtok_r(NULL, ",", &save)) {
+		if (!strcmp(tok, "vmexit")) {
+			for (i = 0; i < TRACE_VMEXIT_REASONS; i++)
+				trace_mask_set_bit(TRACE_MASK_VMEXIT + i);
+			continue;
+		}
+
+		if (!strcmp(tok, "other")) {
+			trace_mask_set_bit(TRACE_MASK_OTHER);
+			continue;
+		}
+
+		errno = 0;
+		evid = strtoul(tok, &end, 0);
+		if (errno || end == tok || *end != '\0') {
+			pr_err("'-e' invalid event '%s'\n", tok);
+			return -EINVAL;
+		}
+
+		if (evid < TRACE_MASK_VMEXIT)
+			trace_mask_set_bit(evid);
+		else if (evid >= TRACE_VMEXIT_ENTRY &&
+			 evid < TRACE_VMEXIT_ENTRY + TRACE_VMEXIT_REASONS)
+			trace_mask_set_bit(TRACE_MASK_VMEXIT + evid - TRACE_VMEXIT_ENTRY);
+		else
+			trace_mask_set_bit(TRACE_MASK_OTHER);
+	}
+
+	return 0;
+}
+
+static int set_event_mask(int fd, const trace_mask_t *mask)
+{
+	if (ioctl(fd, TRACE_IOC_SET_MASK, mask) < 0) {
+		pr_err("Failed to set the event mask, errno %d\n", errno);
+		return -1;
+	}
+
+	return 0;
 }
 
 static void timer_handler(union sigval sv)
@@ -102,6 +197,7 @@ static int parse_opt(int argc, char *argv[])
 				return -EINVAL;
 			}
 			period = ret * 1000;
+			period_set = 1;
 			pr_dbg("Period is %lu\n", period);
 			break;
 		case 't':
@@ -116,6 +212,14 @@ static int parse_opt(int argc, char *argv[])
 		case 'c':
 			flags |= FLAG_CLEAR_BUF;
 			break;
+		case 'e':
+			if (parse_event_mask(optarg))
+				return -EINVAL;
+			flags |= FLAG_EVENT_MASK;
+			break;
+		case 'a':
+			flags |= FLAG_AGGREGATE;
+			break;
 		case 'h':
 			display_usage();
 			return -EINVAL;
@@ -125,6 +229,10 @@ static int parse_opt(int argc, char *argv[])
 			return -EINVAL;
 		}
 	};
+
+	if ((flags & FLAG_AGGREGATE) && !period_set)
+		period = TRACE_AGGR_PERIOD;
+
 	return 0;
 }
 
@@ -209,10 +317,22 @@ static void reader_fn(param_t * param)
 	int ret;
 	int fd = param->trace_fd;
 	shared_buf_t *sbuf = param->sbuf;
+	cpu_set_t cpus;
+	trace_aggr_t *aggr;
 
 	pr_dbg("reader thread[%lu] created for FILE*[0x%p]\n",
 	       pthread_self(), fp);
 
+	/*
+	 * The SOS vCPUs run on the matching pCPUs: draining each buffer from
+	 * its own CPU keeps the readers from competing with each other.
+	 */
+	CPU_ZERO(&cpus);
+	CPU_SET(param->devid, &cpus);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+		pr_info("reader of devid %u not pinned, runs on any cpu\n",
+			param->devid);
+
 	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
 
@@ -220,9 +340,28 @@ static void reader_fn(param_t * param)
 	if (flags & FLAG_CLEAR_BUF)
 		sbuf_clear_buffered(sbuf);
 
+	if (flags & FLAG_AGGREGATE) {
+		aggr = malloc(sizeof(*aggr));
+		if (!aggr) {
+			pr_err("Failed to allocate snapshot memory\n");
+			return;
+		}
+
+		pthread_cleanup_push(free, aggr);
+		while (1) {
+			usleep(period);
+			memset(aggr, 0, sizeof(*aggr));
+			if (ioctl(param->dev_fd, TRACE_IOC_AGGR_SNAPSHOT, aggr) < 0 ||
+			    write(fd, aggr, sizeof(*aggr)) != sizeof(*aggr))
+				pr_err("Failed to save snapshot of devid %u, errno %d\n",
+					param->devid, errno);
+		}
+		pthread_cleanup_pop(1);
+	}
+
 	while (1) {
 		do {
-			ret = sbuf_write(fd, sbuf);
+			ret = sbuf_write_all(fd, sbuf);
 		} while (ret > 0);
 
 		usleep(period);
@@ -255,12 +394,17 @@ static int create_reader(reader_struct * reader, uint32_t dev_id)
 		return -2;
 	}
 
+	reader->param.overrun_start = reader->param.sbuf->overrun_cnt;
+
 	pr_dbg("sbuf[%d]:\nmagic_num: %lx\nele_num: %u\n ele_size: %u\n",
 	       dev_id, reader->param.sbuf->magic, reader->param.sbuf->ele_num,
 	       reader->param.sbuf->ele_size);
 
-	if(snprintf(trace_file_name, TRACE_FILE_NAME_LEN, "%s/%d", trace_file_dir,
-		 dev_id) >= TRACE_FILE_NAME_LEN)
+	reader->param.dev_fd = reader->dev_fd;
+
+	/* Snapshots go to <devid>.aggr, not to be mistaken for raw events */
+	if(snprintf(trace_file_name, TRACE_FILE_NAME_LEN, "%s/%d%s", trace_file_dir,
+		 dev_id, (flags & FLAG_AGGREGATE) ? ".aggr" : "") >= TRACE_FILE_NAME_LEN)
 		printf("WARN: trace file name is truncated\n");
 	reader->param.trace_fd = open(trace_file_name,
 					O_WRONLY | O_CREAT | O_TRUNC, 0644);
@@ -292,6 +436,10 @@ static void destory_reader(reader_struct * reader)
 	}
 
 	if (reader->param.sbuf) {
+		if (reader->param.sbuf->overrun_cnt != reader->param.overrun_start)
+			pr_info("%s: %u events lost to overruns\n", reader->dev_name,
+				reader->param.sbuf->overrun_cnt -
+				reader->param.overrun_start);
 		munmap(reader->param.sbuf, MMAP_SIZE);
 		reader->param.sbuf = NULL;
 	}
@@ -306,6 +454,40 @@ static void destory_reader(reader_struct * reader)
 	}
 }
 
+/* Let the hypervisor trace all the events again */
+static void restore_event_mask(void)
+{
+	if (!(flags & FLAG_EVENT_MASK) || !reader[0].dev_fd)
+		return;
+
+	memset(&trace_mask, 0xff, sizeof(trace_mask));
+	(void)set_event_mask(reader[0].dev_fd, &trace_mask);
+	flags &= ~FLAG_EVENT_MASK;
+}
+
+/* Report the final statistics and let the hypervisor record events again */
+static void stop_aggregation(void)
+{
+	trace_aggr_t *aggr;
+	uint32_t dev_id;
+
+	if (!(flags & FLAG_AGGREGATE) || !reader[0].dev_fd)
+		return;
+
+	aggr = malloc(sizeof(*aggr));
+	foreach_dev(dev_id) {
+		if (!aggr || !reader[dev_id].dev_fd)
+			break;
+		memset(aggr, 0, sizeof(*aggr));
+		if (!ioctl(reader[dev_id].dev_fd, TRACE_IOC_AGGR_SNAPSHOT, aggr))
+			aggr_summary(reader[dev_id].dev_name, aggr);
+	}
+	free(aggr);
+
+	(void)set_aggregation(reader[0].dev_fd, TRACE_AGGR_STOP);
+	flags &= ~FLAG_AGGREGATE;
+}
+
 static void handle_on_exit(void)
 {
 	uint32_t dev_id;
@@ -316,6 +498,9 @@ static void handle_on_exit(void)
 
 	pr_info("exiting - to release resources...\n");
 
+	restore_event_mask();
+	stop_aggregation();
+
 	foreach_dev(dev_id)
 	    destory_reader(&reader[dev_id]);
 }
@@ -370,6 +555,19 @@ int main(int argc, char *argv[])
 	    if (create_reader(&reader[dev_id], dev_id) < 0)
 		goto out_free;
 
+	/* The mask is global: set it once, through the first device */
+	if ((flags & FLAG_EVENT_MASK) &&
+			set_event_mask(reader[0].dev_fd, &trace_mask) < 0) {
+		flags &= ~FLAG_EVENT_MASK;
+		goto out_free;
+	}
+
+	if ((flags & FLAG_AGGREGATE) &&
+			set_aggregation(reader[0].dev_fd, TRACE_AGGR_START) < 0) {
+		flags &= ~FLAG_AGGREGATE;
+		goto out_free;
+	}
+
 	/* for kill exit handling */
 	signal(SIGTERM, signal_exit_handler);
 	signal(SIGINT, signal_exit_handler);
@@ -380,6 +578,9 @@ int main(int argc, char *argv[])
 		printf("q <enter> to quit:\n");
 
  out_free:
+	restore_event_mask();
+	stop_aggregation();
+
 	foreach_dev(dev_id)
 	    destory_reader(&reader[dev_id]);
 
@@ -17,7 +17,7 @@
 #define MMAP_SIZE 		((TRACE_ELEMENT_SIZE * TRACE_ELEMENT_NUM \
 				+ PAGE_SIZE - 1) & PAGE_MASK)
 */
-#define TRACE_FILE_NAME_LEN	32
+#define TRACE_FILE_NAME_LEN	40
 #define TRACE_FILE_DIR_LEN	(TRACE_FILE_NAME_LEN - 3)
 #define TRACE_FILE_ROOT		"acrntrace/"
 #define DEV_PATH_LEN		18
@@ -38,9 +38,40 @@
  * flags:
  * FLAG_TO_REL   - resources need to be release
  * FLAG_CLEAR_BUF - to clear buffered old data
+ * FLAG_EVENT_MASK - only capture the events given with -e
+ * FLAG_AGGREGATE - save statistics snapshots instead of the events
  */
 #define FLAG_TO_REL		(1UL << 0)
 #define FLAG_CLEAR_BUF		(1UL << 1)
+#define FLAG_EVENT_MASK		(1UL << 2)
+#define FLAG_AGGREGATE		(1UL << 3)
+
+/*
+ * Event filter, forwarded by the acrn_trace driver to the hypervisor as
+ * HC_SET_TRACE_MASK. Bit n enables event id n for n < 256, bit
+ * TRACE_MASK_VMEXIT + r the VM exit of reason r, and bit TRACE_MASK_OTHER
+ * all the other event ids.
+ */
+#define TRACE_MASK_WORDS	6
+#define TRACE_MASK_VMEXIT	256
+#define TRACE_MASK_OTHER	320
+#define TRACE_VMEXIT_ENTRY	0x10000
+#define TRACE_VMEXIT_REASONS	64
+#define TRACE_IOC_SET_MASK	_IOW('T', 0x01, trace_mask_t)
+
+/*
+ * Aggregation mode: the hypervisor keeps per-CPU event counters and VM exit
+ * latency histograms (HC_TRACE_AGGREGATE) instead of recording events, and
+ * acrntrace saves snapshots of them. The layout is struct trace_aggr of the
+ * hypervisor.
+ */
+#define TRACE_AGGR_STOP		0
+#define TRACE_AGGR_START	1
+#define TRACE_AGGR_COUNTERS	(TRACE_MASK_OTHER + 1)
+#define TRACE_AGGR_HIST_BUCKETS	32
+#define TRACE_AGGR_PERIOD	500000	/* us, default snapshot period */
+#define TRACE_IOC_AGGREGATE	_IOW('T', 0x02, uint32_t)
+#define TRACE_IOC_AGGR_SNAPSHOT	_IOR('T', 0x03, trace_aggr_t)
 
 #define foreach_dev(dev_id)                                       \
         for ((dev_id) = 0; (dev_id) < (dev_cnt); (dev_id)++)
@@ -70,11 +101,27 @@ typedef struct {
 	};
 } trace_ev_t;
 
+typedef struct {
+	uint64_t mask[TRACE_MASK_WORDS];
+} trace_mask_t;
+
+typedef struct {
+	unsigned short pcpu_id;
+	unsigned short reserved[3];
+	uint64_t start_tsc;
+	uint64_t tsc;
+	uint64_t count[TRACE_AGGR_COUNTERS];
+	uint64_t exit_cycles[TRACE_VMEXIT_REASONS];
+	uint64_t exit_hist[TRACE_VMEXIT_REASONS][TRACE_AGGR_HIST_BUCKETS];
+} trace_aggr_t;
+
 typedef struct {
 	uint32_t devid;
+	int dev_fd;
 	int exit_flag;
 	int trace_fd;
 	shared_buf_t *sbuf;
+	uint32_t overrun_start;	/* sbuf->overrun_cnt when reading started */
 	pthread_mutex_t *sbuf_lock;
 } param_t;
 
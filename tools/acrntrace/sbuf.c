@@ -7,6 +7,7 @@
 #include <asm/errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include "sbuf.h"
@@ -71,6 +72,59 @@ int sbuf_write(int fd, shared_buf_t *sbuf)
 	return sbuf->ele_size;
 }
 
+/*
+ * Write all the elements buffered when called straight from the mapped
+ * buffer, with one writev() for the (at most two) contiguous spans. head
+ * only ever moves by whole elements, as the hypervisor expects.
+ */
+int sbuf_write_all(int fd, shared_buf_t *sbuf)
+{
+	struct iovec iov[2];
+	uint32_t head, tail, len, done = 0, partial = 0;
+	int cnt, written;
+
+	if (sbuf == NULL)
+		return -EINVAL;
+
+	head = sbuf->head;
+	tail = __atomic_load_n(&sbuf->tail, __ATOMIC_ACQUIRE);
+	if (head == tail)
+		return 0;
+
+	len = (tail > head) ? (tail - head) : (sbuf->size - head + tail);
+	while (done < len) {
+		iov[0].iov_base = (void *)sbuf + SBUF_HEAD_SIZE + head + partial;
+		if (tail > head) {
+			iov[0].iov_len = tail - head - partial;
+			cnt = 1;
+		} else {
+			iov[0].iov_len = sbuf->size - head - partial;
+			iov[1].iov_base = (void *)sbuf + SBUF_HEAD_SIZE;
+			iov[1].iov_len = tail;
+			cnt = 2;
+		}
+
+		written = writev(fd, iov, cnt);
+		if (written <= 0) {
+			if (written < 0 && errno == EINTR)
+				continue;
+			printf("Failed to write: ret %d, errno %d\n",
+				written, (written == -1) ? errno : 0);
+			return -1;
+		}
+
+		/* Release the whole elements written so far */
+		done += written;
+		partial += written;
+		head = sbuf_next_ptr(head, partial - partial % sbuf->ele_size,
+				sbuf->size);
+		partial %= sbuf->ele_size;
+		__atomic_store_n(&sbuf->head, head, __ATOMIC_RELEASE);
+	}
+
+	return done;
+}
+
 int sbuf_clear_buffered(shared_buf_t *sbuf)
 {
 	if (sbuf == NULL)
@@ -11,6 +11,7 @@ import sys
 import getopt
 import os
 import config
+import irq_analyze
 from vmexit_analyze import analyze_vm_exit
 from irq_analyze import analyze_irq
 
@@ -25,11 +26,12 @@ def usage():
 
     [options]
     -h: print this message
-    -i, --ifile=[string]: input file
+    -i, --ifile=[string]: input file, --irq takes comma separated ones
     -o, --ofile=[string]: output file
     -f, --frequency=[unsigned int]: TSC frequency in MHz
     --vm_exit: to generate vm_exit report
     --irq: to generate irq related report
+    --guest=[string]: guest TSCs of acrn-irqprobe -t, for the --irq stages
     ''')
 
 def do_analysis(ifile, ofile, analyzer):
@@ -60,7 +62,7 @@ def main(argv):
     inputfile = ''
     outputfile = ''
     opts_short = "hi:o:f:"
-    opts_long = ["ifile=", "ofile=", "frequency=", "vm_exit", "irq"]
+    opts_long = ["ifile=", "ofile=", "frequency=", "vm_exit", "irq", "guest="]
     analyzer = []
 
     try:
@@ -83,6 +85,8 @@ def main(argv):
             analyzer.append(analyze_vm_exit)
         elif opt == "--irq":
             analyzer.append(analyze_irq)
+        elif opt == "--guest":
+            irq_analyze.GUEST_TSC_FILE = arg
         else:
             assert False, "unhandled option"
 
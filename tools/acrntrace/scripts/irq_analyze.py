@@ -7,56 +7,148 @@ This script defines the function to do the irq related analysis
 
 import csv
 import struct
+import sys
+from bisect import bisect_left
 from config import TSC_FREQ
 
 TSC_BEGIN = 0
 TSC_END = 0
 
+VM_ENTER = 0x11
 VMEXIT_ENTRY = 0x10000
 
 LIST_EVENTS = {
     'VMEXIT_EXTERNAL_INTERRUPT':   VMEXIT_ENTRY + 0x00000001,
 }
 
+# path of a passthrough interrupt, see hypervisor/include/debug/trace.h
+PTIRQ_IRQ = 0x20
+PTIRQ_SOFTIRQ = 0x21
+VLAPIC_INTR = 0x22
+VLAPIC_INJECT = 0x23
+
 IRQ_EXITS = {}
 
+# stage name -> latencies in cycles, in the order of the path
+STAGES = ['irq->softirq', 'softirq->vlapic', 'vlapic->inject',
+          'inject->vmenter', 'vmenter->guest', 'irq->vmenter', 'irq->guest']
+STAGE_LAT = {}
+# posted to a vCPU in the guest: delivered with no injection or VM entry
+NR_POSTED = 0
+
+# file of guest TSCs, one per line, as logged by acrn-irqprobe -t
+GUEST_TSC_FILE = ''
+
 # 4 * 64bit per trace entry
 TRCREC = "QQQQ"
 
-def parse_trace(ifile):
-    """parse the trace data file
+def read_events(ifile):
+    """read the trace records of one or more files
     Args:
-        ifile: input trace data file
+        ifile: trace data file, or comma separated files of several pCPUs
     Return:
-        None
+        list of (tsc, cpu, event, d1, d2) sorted by TSC
     """
 
-    fd = open(ifile, 'rb')
+    events = []
+    for name in ifile.split(','):
+        with open(name, 'rb') as fd:
+            while True:
+                line = fd.read(struct.calcsize(TRCREC))
+                if len(line) < struct.calcsize(TRCREC):
+                    break
+                (tsc, event, d1, d2) = struct.unpack(TRCREC, line)
+                events.append((tsc, event >> 56, event & 0xffffffffffff,
+                               d1, d2))
 
-    while True:
-        global TSC_BEGIN, TSC_END
-        try:
-            line = fd.read(struct.calcsize(TRCREC))
-            if not line:
-                break
-            (tsc, event, vec, d2) = struct.unpack(TRCREC, line)
+    events.sort(key=lambda e: e[0])
+    return events
 
-            event = event & 0xffffffffffff
+def add_lat(stage, cycles):
+    """account the latency of one stage"""
 
-            if TSC_BEGIN == 0:
-               TSC_BEGIN = tsc
+    STAGE_LAT.setdefault(stage, []).append(cycles)
 
-            TSC_END = tsc
+def finish_chain(chain, guest_tscs):
+    """account the stages of an interrupt which reached the VM entry"""
 
-            for key in LIST_EVENTS.keys():
-                if event == LIST_EVENTS.get(key):
-                    if vec in IRQ_EXITS.keys():
-                        IRQ_EXITS[vec] += 1
-                    else:
-                        IRQ_EXITS[vec] = 1
+    add_lat('inject->vmenter', chain['enter'] - chain['inject'])
+    add_lat('irq->vmenter', chain['enter'] - chain['irq'])
 
-        except struct.error:
-            sys.exit()
+    if guest_tscs:
+        i = bisect_left(guest_tscs, chain['enter'])
+        if i < len(guest_tscs):
+            add_lat('vmenter->guest', guest_tscs[i] - chain['enter'])
+            add_lat('irq->guest', guest_tscs[i] - chain['irq'])
+
+def parse_trace(ifile):
+    """parse the trace data file
+    Args:
+        ifile: input trace data file
+    Return:
+        None
+    """
+
+    global TSC_BEGIN, TSC_END, NR_POSTED
+
+    guest_tscs = []
+    if GUEST_TSC_FILE:
+        with open(GUEST_TSC_FILE) as fd:
+            guest_tscs = sorted(int(l.split()[0], 0) for l in fd
+                                if l.strip() and not l.startswith('#'))
+
+    pend_irq = {}       # pirq -> TSC of its first IRQ not taken yet
+    cur_softirq = {}    # pCPU -> chain taken, until the vLAPIC has it
+    pend_inject = {}    # (vm, vcpu) -> chains recorded in the vLAPIC
+    pend_enter = {}     # pCPU -> chains injected, until the VM entry
+
+    for (tsc, cpu, event, d1, d2) in read_events(ifile):
+        if TSC_BEGIN == 0:
+            TSC_BEGIN = tsc
+        TSC_END = tsc
+
+        a, b = d1 & 0xffffffff, d1 >> 32
+        c, d = d2 & 0xffffffff, d2 >> 32
+
+        if event == LIST_EVENTS['VMEXIT_EXTERNAL_INTERRUPT']:
+            IRQ_EXITS[d1] = IRQ_EXITS.get(d1, 0) + 1
+        elif event == PTIRQ_IRQ:
+            # the first of a coalesced batch waits the longest
+            pend_irq.setdefault(a, tsc)
+        elif event == PTIRQ_SOFTIRQ and a in pend_irq:
+            t0 = pend_irq.pop(a)
+            add_lat('irq->softirq', tsc - t0)
+            cur_softirq[cpu] = {'irq': t0, 'softirq': tsc, 'vm': b}
+        elif event == VLAPIC_INTR:
+            chain = cur_softirq.pop(cpu, None)
+            if chain is None or chain['vm'] != c:
+                continue
+            add_lat('softirq->vlapic', tsc - chain['softirq'])
+            chain['vlapic'] = tsc
+            chain['posted'] = (d != 0)
+            # a posted chain never injected was delivered by the CPU
+            waiting = pend_inject.setdefault((c, a), [])
+            for old in [w for w in waiting if w['posted']]:
+                waiting.remove(old)
+                NR_POSTED += 1
+            waiting.append(chain)
+        elif event == VLAPIC_INJECT:
+            for chain in pend_inject.pop((c, a), []):
+                add_lat('vlapic->inject', tsc - chain['vlapic'])
+                chain['inject'] = tsc
+                pend_enter.setdefault(cpu, []).append(chain)
+        elif event == VM_ENTER:
+            for chain in pend_enter.pop(cpu, []):
+                chain['enter'] = tsc
+                finish_chain(chain, guest_tscs)
+
+    for waiting in pend_inject.values():
+        NR_POSTED += len([w for w in waiting if w['posted']])
+
+def percentile(sorted_lat, pct):
+    """the latency under which pct percent of them are"""
+
+    return sorted_lat[min(len(sorted_lat) - 1, len(sorted_lat) * pct // 100)]
 
 def generate_report(ofile, freq):
     """ generate analysis report
@@ -87,6 +179,44 @@ def generate_report(ofile, freq):
                 print ("0x%08x\t%-8d\t%-8.2f" % (e, IRQ_EXITS[e], pct))
                 f_csv.writerow(['0x%08x' % e, IRQ_EXITS[e], '%.2f' % pct])
 
+            if not STAGE_LAT:
+                return
+
+            us = float(freq)
+            print ("\nPassthrough IRQ latency (us), %d posted to a running "
+                   "vCPU without injection" % NR_POSTED)
+            print ("%-16s\t%-8s\t%-8s\t%-8s\t%-8s\t%-8s\t%-8s" %
+                   ("Stage", "Count", "Min", "Avg", "P50", "P99", "Max"))
+            f_csv.writerow(['Stage', 'Count', 'Min(us)', 'Avg(us)',
+                            'P50(us)', 'P99(us)', 'Max(us)'])
+            for stage in STAGES:
+                lat = sorted(STAGE_LAT.get(stage, []))
+                if not lat:
+                    continue
+                row = [lat[0] / us, sum(lat) / len(lat) / us,
+                       percentile(lat, 50) / us, percentile(lat, 99) / us,
+                       lat[-1] / us]
+                print ("%-16s\t%-8d\t%s" % (stage, len(lat),
+                       "\t".join("%-8.2f" % v for v in row)))
+                f_csv.writerow([stage, len(lat)] +
+                               ['%.2f' % v for v in row])
+
+            # log2 distribution of each stage, in us
+            f_csv.writerow(['Stage', 'From(us)', 'To(us)', 'Count'])
+            for stage in STAGES:
+                lat = STAGE_LAT.get(stage, [])
+                if not lat:
+                    continue
+                buckets = {}
+                for cycles in lat:
+                    b = int(cycles / us).bit_length()
+                    buckets[b] = buckets.get(b, 0) + 1
+                print ("%s:" % stage)
+                for b in sorted(buckets):
+                    lo = 0 if b == 0 else 1 << (b - 1)
+                    print ("  [%6d, %6d) %8d" % (lo, 1 << b, buckets[b]))
+                    f_csv.writerow([stage, lo, 1 << b, buckets[b]])
+
     except IOError as err:
         print ("Output File Error: " + str(err))
 
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2018 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef TRACE_PACK_H
+#define TRACE_PACK_H
+
+/*
+ * Packed trace container, as written by "acrnalyze -p":
+ *
+ * -------------------------------------------------------------------
+ * | header | block | block | ... | block | block index | event dict |
+ * -------------------------------------------------------------------
+ *
+ * Each block holds up to TRACE_PACK_BLOCK_RECORDS raw trace records of a
+ * single pCPU, in the order acrntrace captured them. The block index is
+ * sorted by the TSC of the first record of each block, so the blocks of a
+ * time window are found without reading the others. The event dictionary
+ * lists every event id present, with its number of records and name.
+ *
+ * All fields are little endian.
+ */
+
+#define TRACE_PACK_MAGIC		"ACRNTRC"
+#define TRACE_PACK_VERSION		1
+#define TRACE_PACK_RECORD_SIZE		32
+#define TRACE_PACK_BLOCK_RECORDS	65536
+#define TRACE_PACK_NAME_LEN		32
+
+struct trace_pack_header {
+	char magic[8];			/* TRACE_PACK_MAGIC */
+	uint32_t version;		/* TRACE_PACK_VERSION */
+	uint32_t record_size;		/* TRACE_PACK_RECORD_SIZE */
+	uint32_t nr_cpus;
+	uint32_t nr_blocks;
+	uint32_t nr_events;
+	uint32_t reserved;
+	uint64_t index_offset;		/* of nr_blocks struct trace_pack_block */
+	uint64_t dict_offset;		/* of nr_events struct trace_pack_event */
+};
+
+struct trace_pack_block {
+	uint64_t offset;		/* of the first record in the file */
+	uint64_t first_tsc;
+	uint64_t last_tsc;
+	uint32_t nr_records;
+	uint16_t cpu;
+	uint16_t reserved;
+};
+
+struct trace_pack_event {
+	uint64_t id;
+	uint64_t count;
+	char name[TRACE_PACK_NAME_LEN];	/* empty if not known to acrnalyze */
+};
+
+#endif /* TRACE_PACK_H */